@@ -0,0 +1,53 @@
+#! /usr/bin/env ruby
+
+# Generate a script for the interpreter benchmarks, and print it.
+#
+# Usage: gen_script.rb nest <n>    units adding expressions parenthesized
+#                                  NEST_DEPTH deep, n operators in all
+#        gen_script.rb wide <n>    n units, each assigning a new variable
+#        gen_script.rb chain <n>   units adding expressions of
+#                                  CHAIN_LENGTH binary operators, n
+#                                  operators in all
+#
+# (minicalc has no loops or functions, so the scripts are long, rather
+# than repeating the same code.)  The last value of each script is its
+# number of operations (operators or assignments), which run_bench.rb
+# checks.
+
+NEST_DEPTH = 1000
+CHAIN_LENGTH = 200
+
+kind, count = ARGV[0], ARGV[1].to_i
+if !['nest', 'wide', 'chain'].include?(kind) || count < 1
+  STDERR.puts "Usage: gen_script.rb (nest|wide|chain) <n>"
+  exit 1
+end
+
+if kind == 'nest'
+  # (1 + (1 + ... (1 + 1))), whose value is its number of operators plus
+  # one (the addition to n)
+  expr = '(1 + ' * NEST_DEPTH + '1' + ')' * NEST_DEPTH
+  puts "n = 0;"
+  ((count + NEST_DEPTH) / (NEST_DEPTH + 1)).times do
+    puts "n = n + #{expr};"
+  end
+  puts "n;"
+elsif kind == 'wide'
+  # each variable is found among all those assigned before it
+  puts "v0 = 1;"
+  (1...count).each { |i| puts "v#{i} = v#{i - 1} + 1;" }
+  puts "v#{count - 1};"
+else
+  # (the operands are variables, so the expression can't be folded, and
+  # the operators cancel out, other than the addition of the number of
+  # operators)
+  ops = ['+ a', '- a', '* b', '/ b']
+  expr = (0...CHAIN_LENGTH).map { |j| ops[j % ops.size] }.join(' ')
+  puts "a = 3;"
+  puts "b = 2;"
+  puts "n = 0;"
+  ((count + CHAIN_LENGTH + 1) / (CHAIN_LENGTH + 2)).times do
+    puts "n = n + #{CHAIN_LENGTH + 2} #{expr};"
+  end
+  puts "n;"
+end
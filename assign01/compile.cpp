@@ -0,0 +1,221 @@
+#include <string>
+#include <set>
+#include <vector>
+#include <cassert>
+#include "util.h"
+#include "cpputil.h"
+#include "token.h"
+#include "error.h"
+#include "compile.h"
+
+////////////////////////////////////////////////////////////////////////
+// Compiler implementation
+////////////////////////////////////////////////////////////////////////
+
+// The expressions are lowered to assignments of one operation each (in the
+// order the Interpreter evaluates them), to temporaries which the assign06
+// compiler allocates like any other scalar variable (to virtual registers,
+// with optimization).  The variables are prefixed with "v_", so they can't
+// be keywords or temporaries.
+struct Compiler {
+private:
+  struct Node *m_tree;
+  std::set<std::string> m_vars;       // the variables assigned so far
+  std::vector<std::string> m_stmts;   // the statements of the program
+  int m_num_temps;
+
+public:
+  Compiler(struct Node *tree);
+  ~Compiler();
+
+  void emit(FILE *out);
+
+private:
+  void gen_program();
+  std::string gen(struct Node *expr);
+  std::string gen_power(struct Node *left, struct Node *right);
+  std::string new_temp();
+  std::string protect(const std::string &operand, struct Node *later);
+  static bool has_assign(struct Node *expr);
+};
+
+Compiler::Compiler(struct Node *tree) : m_tree(tree), m_num_temps(0) {
+}
+
+Compiler::~Compiler() {
+}
+
+void Compiler::emit(FILE *out) {
+  m_vars.clear();
+  m_stmts.clear();
+  m_num_temps = 0;
+  gen_program();
+
+  fprintf(out, "PROGRAM minicalc;\n");
+  std::string vars;
+  for (auto i = m_vars.begin(); i != m_vars.end(); i++) {
+    vars += (vars.empty() ? "" : ", ") + ("v_" + *i);
+  }
+  for (int i = 1; i <= m_num_temps; i++) {
+    vars += (vars.empty() ? "" : ", ") + cpputil::format("tmp%d", i);
+  }
+  if (!vars.empty()) {
+    fprintf(out, "  VAR %s: INTEGER;\n", vars.c_str());
+  }
+  fprintf(out, "BEGIN\n");
+  for (auto i = m_stmts.begin(); i != m_stmts.end(); i++) {
+    fprintf(out, "  %s;\n", i->c_str());
+  }
+  fprintf(out, "END.\n");
+}
+
+void Compiler::gen_program() {
+  std::string result;
+  struct Node *unit = m_tree;
+
+  // (like Interpreter::exec)
+  while (unit) {
+    result = gen(node_get_kid(unit, 0));
+    if (node_get_num_kids(unit) == 3) {
+      unit = node_get_kid(unit, 2);
+    } else {
+      unit = nullptr;
+    }
+  }
+
+  m_stmts.push_back("WRITE " + result);
+}
+
+// generate the statements evaluating an expression, returning the operand
+// (a literal, variable or temporary) with its value
+std::string Compiler::gen(struct Node *expr) {
+  int num_kids = node_get_num_kids(expr);
+  int tag = node_get_tag(expr);
+
+  const char *lexeme = node_get_str(expr);
+  if (tag == TOK_INTEGER_LITERAL) {
+    return lexeme;
+  } else if (tag == TOK_IDENTIFIER) {
+    // (there's no control flow, so a variable which isn't assigned yet
+    // would be undefined when it is evaluated)
+    if (m_vars.count(lexeme) == 0) {
+      std::string errmsg = cpputil::format("Undefined variable '%s'", lexeme);
+      error_on_node(expr, errmsg.c_str());
+    }
+    return std::string("v_") + lexeme;
+  }
+
+  if (num_kids == 1) {
+    return gen(node_get_kid(expr, 0));
+  }
+
+  struct Node *op = node_get_kid(expr, 1);
+  struct Node *left = node_get_kid(expr, 0);
+  struct Node *right = node_get_kid(expr, 2);
+  tag = node_get_tag(op);
+
+  if (tag == TOK_POWER) {
+    return gen_power(left, right);
+  }
+
+  if (tag == TOK_ASSIGN) {
+    struct Node *var = left;
+    while (node_get_num_kids(var) == 1) {
+      var = node_get_kid(var, 0);
+    }
+    if (node_get_str(var) == nullptr) {
+      error_on_node(var, "Illegal assignment");
+    }
+    std::string rvalue = gen(right);
+    m_vars.insert(node_get_str(var));
+    std::string varname = std::string("v_") + node_get_str(var);
+    m_stmts.push_back(varname + " := " + rvalue);
+    return varname;
+  }
+
+  const char *opname;
+  switch (tag) {
+  case TOK_PLUS:
+    opname = "+";
+    break;
+  case TOK_MINUS:
+    opname = "-";
+    break;
+  case TOK_TIMES:
+    opname = "*";
+    break;
+  case TOK_DIVIDE:
+    opname = "DIV";
+    break;
+  default:
+    err_fatal("Unknown operator: %d\n", tag);
+    return "";
+  }
+
+  std::string lhs = protect(gen(left), right);
+  std::string rhs = gen(right);
+  std::string result = new_temp();
+  m_stmts.push_back(result + " := " + lhs + " " + opname + " " + rhs);
+  return result;
+}
+
+// generate a power (by repeated multiplication), evaluating the exponent
+// twice like the Interpreter does.  (Unlike the Interpreter, a negative
+// exponent can't be reported, so its power is 1.)
+std::string Compiler::gen_power(struct Node *left, struct Node *right) {
+  gen(right);
+  std::string base = protect(gen(left), right);
+  std::string exponent = gen(right);
+
+  std::string result = new_temp();
+  std::string count = new_temp();
+  m_stmts.push_back(result + " := 1");
+  m_stmts.push_back(count + " := " + exponent);
+  m_stmts.push_back("WHILE " + count + " > 0 DO " + result + " := " + result + " * " + base
+                    + "; " + count + " := " + count + " - 1; END");
+  return result;
+}
+
+std::string Compiler::new_temp() {
+  return cpputil::format("tmp%d", ++m_num_temps);
+}
+
+// copy a variable operand to a temporary if an expression evaluated after
+// it is read could assign the variable
+std::string Compiler::protect(const std::string &operand, struct Node *later) {
+  if (operand.compare(0, 2, "v_") != 0 || !has_assign(later)) {
+    return operand;
+  }
+  std::string temp = new_temp();
+  m_stmts.push_back(temp + " := " + operand);
+  return temp;
+}
+
+bool Compiler::has_assign(struct Node *expr) {
+  if (node_get_tag(expr) == TOK_ASSIGN) {
+    return true;
+  }
+  int num_kids = node_get_num_kids(expr);
+  for (int i = 0; i < num_kids; i++) {
+    if (has_assign(node_get_kid(expr, i))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Compiler API functions
+////////////////////////////////////////////////////////////////////////
+
+struct Compiler *compiler_create(struct Node *tree) {
+  return new Compiler(tree);
+}
+
+void compiler_destroy(struct Compiler *compiler) {
+  delete compiler;
+}
+
+void compiler_emit(struct Compiler *compiler, FILE *out) {
+  compiler->emit(out);
+}
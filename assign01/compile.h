@@ -0,0 +1,29 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+struct Node;
+struct Compiler;
+
+// create a Compiler, which translates the given parse tree to a program
+// for the assign06 compiler (whose HighLevelCodeGen and AssemblyCodeGen
+// translate it to native code)
+struct Compiler *compiler_create(struct Node *tree);
+
+// destroy given Compiler
+void compiler_destroy(struct Compiler *compiler);
+
+// write the translated program, which writes the result of the last
+// evaluation
+void compiler_emit(struct Compiler *compiler, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // COMPILE_H
@@ -1,7 +1,7 @@
 #include <string>
 #include <map>
+#include <vector>
 #include <cassert>
-#include <cmath>
 // #include <iostream>
 #include "util.h"
 #include "cpputil.h"
@@ -13,33 +13,155 @@
 // Interpreter implementation
 ////////////////////////////////////////////////////////////////////////
 
+// (each identifier node's ival is the slot of its variable, which is
+// assigned by scan_vars before evaluation)
+//
+// An expression is evaluated by first compiling it to a tree of closures,
+// one per node: the function evaluating the node, with its operands'
+// closures, its literal's value or its variable's slot bound in, so that
+// evaluating it (and evaluating it again, as the exponent of a power is)
+// doesn't dispatch on the tags of the nodes or look up their kids.  The
+// closures of a unit are kept until it has been evaluated.
 struct Interpreter {
 private:
+  struct Closure {
+    long (*fn)(Interpreter *interp, const Closure *c);
+    const Closure *left, *right;
+    // the value of a literal, or the slot of a variable
+    long value;
+    // the node reported in an error
+    struct Node *node;
+
+    long operator()(Interpreter *interp) const { return fn(interp, this); }
+  };
+
   struct Node *m_tree;
-  std::map<std::string, long> m_vars;
+  std::map<std::string, int> m_slots;
+  std::vector<long> m_vars;
+  std::vector<bool> m_defined;  // has the variable in each slot been assigned?
+  // the closures are allocated in chunks, which are reused by the
+  // next unit (so a closure never moves)
+  static const size_t CLOSURE_CHUNK_SIZE = 4096;
+  std::vector<Closure *> m_closure_chunks;
+  size_t m_num_closures;
 
 public:
   Interpreter(struct Node *tree);
   ~Interpreter();
 
   long exec();
+  long exec_unit(struct Node *unit);
 
 private:
+  void scan_vars(struct Node *n);
+  struct Node *fold_powers(struct Node *expr);
   long eval(struct Node *expr);
+  const Closure *compile(struct Node *expr);
+  const Closure *compile_operation(struct Node *expr);
+  const Closure *add_closure(long (*fn)(Interpreter *, const Closure *), const Closure *left,
+                             const Closure *right, long value, struct Node *node);
+
+  static long eval_literal(Interpreter *interp, const Closure *c);
+  static long eval_variable(Interpreter *interp, const Closure *c);
+  static long eval_assign(Interpreter *interp, const Closure *c);
+  static long eval_plus(Interpreter *interp, const Closure *c);
+  static long eval_minus(Interpreter *interp, const Closure *c);
+  static long eval_times(Interpreter *interp, const Closure *c);
+  static long eval_divide(Interpreter *interp, const Closure *c);
+  static long eval_power(Interpreter *interp, const Closure *c);
+  static long eval_unknown(Interpreter *interp, const Closure *c);
 };
 
-Interpreter::Interpreter(struct Node *tree) : m_tree(tree) {
+// compute base^exponent (for exponent >= 0) by repeated squaring, returning
+// false if the result (or an intermediate square which is still needed)
+// overflows a long
+static bool int_power(long base, long exponent, long &result) {
+  long power = 1;
+  for (;;) {
+    if ((exponent & 1) && __builtin_mul_overflow(power, base, &power)) {
+      return false;
+    }
+    exponent >>= 1;
+    if (exponent == 0) {
+      result = power;
+      return true;
+    }
+    if (__builtin_mul_overflow(base, base, &base)) {
+      return false;
+    }
+  }
+}
+
+Interpreter::Interpreter(struct Node *tree) : m_tree(tree), m_num_closures(0) {
 }
 
 Interpreter::~Interpreter() {
+  for (auto i = m_closure_chunks.begin(); i != m_closure_chunks.end(); i++) {
+    delete[] *i;
+  }
+}
+
+// assign a slot to each variable name (names seen in earlier
+// calls keep their slots)
+void Interpreter::scan_vars(struct Node *n) {
+  // (the last child is visited iteratively, since the units are nested)
+  while (n) {
+    if (node_get_tag(n) == TOK_IDENTIFIER) {
+      auto i = m_slots.insert(std::make_pair(std::string(node_get_str(n)), int(m_slots.size()))).first;
+      node_set_ival(n, i->second);
+    }
+    int num_kids = node_get_num_kids(n);
+    for (int i = 0; i < num_kids && i < 2; i++) {
+      scan_vars(node_get_kid(n, i));
+    }
+    n = (num_kids == 3) ? node_get_kid(n, 2) : nullptr;
+  }
+  m_vars.resize(m_slots.size(), 0);
+  m_defined.resize(m_slots.size(), false);
+}
+
+// fold the powers of integer literals in an expression, returning the
+// expression (or the literal replacing it).  A power which can't be
+// computed (because the exponent is negative, or it overflows) is left
+// to be reported when it's evaluated.
+struct Node *Interpreter::fold_powers(struct Node *expr) {
+  int num_kids = node_get_num_kids(expr);
+  if (num_kids == 1) {
+    node_set_kid(expr, 0, fold_powers(node_get_kid(expr, 0)));
+    return expr;
+  } else if (num_kids != 3) {
+    return expr;
+  }
+
+  struct Node *left = fold_powers(node_get_kid(expr, 0));
+  struct Node *right = fold_powers(node_get_kid(expr, 2));
+  node_set_kid(expr, 0, left);
+  node_set_kid(expr, 2, right);
+  if (node_get_tag(node_get_kid(expr, 1)) != TOK_POWER
+      || node_get_tag(left) != TOK_INTEGER_LITERAL || node_get_tag(right) != TOK_INTEGER_LITERAL) {
+    return expr;
+  }
+
+  long exponent = strtol(node_get_str(right), nullptr, 10);
+  long power;
+  if (exponent < 0 || !int_power(strtol(node_get_str(left), nullptr, 10), exponent, power)) {
+    return expr;
+  }
+  struct Node *literal = node_alloc_str_copy(TOK_INTEGER_LITERAL, cpputil::format("%ld", power).c_str());
+  node_set_source_info(literal, node_get_source_info(left));
+  node_destroy_recursive(expr);
+  return literal;
 }
 
 long Interpreter::exec() {
   long result = -1;
   struct Node *unit = m_tree;
 
+  scan_vars(m_tree);
+
   while (unit) {
     // first child is (E)xpression
+    node_set_kid(unit, 0, fold_powers(node_get_kid(unit, 0)));
     struct Node *expr = node_get_kid(unit, 0);
 
     // evaluate the expression!
@@ -58,83 +180,157 @@ long Interpreter::exec() {
   return result;
 }
 
+// evaluate a single unit, keeping the variables of the units
+// evaluated before it
+long Interpreter::exec_unit(struct Node *unit) {
+  scan_vars(unit);
+  node_set_kid(unit, 0, fold_powers(node_get_kid(unit, 0)));
+  return eval(node_get_kid(unit, 0));
+}
+
+// compile an expression and evaluate it
 long Interpreter::eval(struct Node *expr) {
-  // the number of children and the first child's tag will determine
-  // how to evaluate the expression
+  long result = (*compile(expr))(this);
+  m_num_closures = 0;
+  return result;
+}
+
+const Interpreter::Closure *Interpreter::add_closure(long (*fn)(Interpreter *, const Closure *),
+                                                     const Closure *left, const Closure *right,
+                                                     long value, struct Node *node) {
+  size_t chunk = m_num_closures / CLOSURE_CHUNK_SIZE;
+  if (chunk == m_closure_chunks.size()) {
+    m_closure_chunks.push_back(new Closure[CLOSURE_CHUNK_SIZE]);
+  }
+  Closure *c = &m_closure_chunks[chunk][m_num_closures % CLOSURE_CHUNK_SIZE];
+  m_num_closures++;
+  *c = { fn, left, right, value, node };
+  return c;
+}
+
+const Interpreter::Closure *Interpreter::compile(struct Node *expr) {
+  // the number of children and the tag determine how to evaluate the
+  // expression
   int num_kids = node_get_num_kids(expr);
   int tag = node_get_tag(expr);
 
-  //std::cout << "Eval() on node tag" << tag << "\n";
-
-  const char *lexeme = node_get_str(expr);
   if (tag == TOK_INTEGER_LITERAL) {
-    return strtol(lexeme, nullptr, 10); 
+    return add_closure(eval_literal, nullptr, nullptr, strtol(node_get_str(expr), nullptr, 10), expr);
   } else if (tag == TOK_IDENTIFIER) {
-    // look up value of variable
-      assert(tag == TOK_IDENTIFIER);
-      std::map<std::string, long>::const_iterator i = m_vars.find(lexeme);
-      if (i == m_vars.end()) {
-        std::string errmsg = cpputil::format("Undefined variable '%s'", lexeme);
-        error_on_node(expr, errmsg.c_str());
-      }
-      return i->second;
+    return add_closure(eval_variable, nullptr, nullptr, node_get_ival(expr), expr);
   }
 
+  // (a parenthesized expression is evaluated as its contents)
   if (num_kids == 1) {
-    struct Node *next = node_get_kid(expr, 0);
-    return eval(next);
-  } else {
-    struct Node *op = node_get_kid(expr, 1);  // operator is in the center
-    tag = node_get_tag(op);
-
-    // std::cout << "Reached operator " << tag << "\n";
-
-    // left and right operands follow
-    struct Node *left = node_get_kid(expr, 0);
-    struct Node *right = node_get_kid(expr, 2);
-
-  // Do the evaluation
-    switch (tag) {
-    case TOK_PLUS:
-      return eval(left) + eval(right);
-    case TOK_MINUS:
-      return eval(left) - eval(right);
-    case TOK_TIMES:
-      return eval(left) * eval(right);
-    case TOK_DIVIDE:
-      return eval(left) / eval(right);
-    case TOK_POWER: {
-      long exponent = eval(right);
-      if (exponent < 0) {
-        error_at_pos(node_get_source_info(op), "Negative exponent");
-        return -1L;
-      }
-      return pow(eval(left), eval(right));
+    return compile(node_get_kid(expr, 0));
+  }
+  return compile_operation(expr);
+}
+
+const Interpreter::Closure *Interpreter::compile_operation(struct Node *expr) {
+  struct Node *op = node_get_kid(expr, 1);  // operator is in the center
+  int tag = node_get_tag(op);
+
+  // left and right operands follow
+  struct Node *left_node = node_get_kid(expr, 0);
+  struct Node *right_node = node_get_kid(expr, 2);
+
+  if (tag == TOK_ASSIGN) {
+    // the left operand is an identifier naming the variable:
+    // iterate down until we get an identifier
+    struct Node *var = left_node;
+    while (node_get_num_kids(var) == 1) {
+      var = node_get_kid(var, 0);
     }
-    case TOK_ASSIGN:
-      // in this case, the left operand is an identifier naming
-      // the variable
-      {
-        // get the variable name
-        struct Node *var = left;
-        // iterate down until we get an identifier
-        while(node_get_num_kids(var) == 1) {
-          var = node_get_kid(var, 0);
-        }
-        std::string varname = node_get_str(var);
-        // evaluate the expression producing the value to be assigned
-        long rvalue = eval(right);
-        // store the value
-        m_vars[varname] = rvalue;
-        // result of the evaluation is the value assigned
-        return rvalue;
-      }
-
-    default:
-      err_fatal("Unknown operator: %d\n", tag);
-      return -1L;
+    const Closure *right = compile(right_node);
+    // (a variable which isn't an identifier can't be evaluated, so it
+    // needn't be stored)
+    if (node_get_tag(var) != TOK_IDENTIFIER) {
+      return right;
     }
+    return add_closure(eval_assign, nullptr, right, node_get_ival(var), var);
+  }
+
+  const Closure *left = compile(left_node);
+  const Closure *right = compile(right_node);
+  switch (tag) {
+  case TOK_PLUS:
+    return add_closure(eval_plus, left, right, 0, op);
+  case TOK_MINUS:
+    return add_closure(eval_minus, left, right, 0, op);
+  case TOK_TIMES:
+    return add_closure(eval_times, left, right, 0, op);
+  case TOK_DIVIDE:
+    return add_closure(eval_divide, left, right, 0, op);
+  case TOK_POWER:
+    return add_closure(eval_power, left, right, 0, op);
+  default:
+    // (reported only if the operation is evaluated)
+    return add_closure(eval_unknown, left, right, tag, op);
+  }
+}
+
+long Interpreter::eval_literal(Interpreter *, const Closure *c) {
+  return c->value;
+}
+
+long Interpreter::eval_variable(Interpreter *interp, const Closure *c) {
+  // look up value of variable
+  if (!interp->m_defined[c->value]) {
+    std::string errmsg = cpputil::format("Undefined variable '%s'", node_get_str(c->node));
+    error_on_node(c->node, errmsg.c_str());
+  }
+  return interp->m_vars[c->value];
+}
+
+long Interpreter::eval_assign(Interpreter *interp, const Closure *c) {
+  // the result of the evaluation is the value assigned
+  long rvalue = (*c->right)(interp);
+  interp->m_vars[c->value] = rvalue;
+  interp->m_defined[c->value] = true;
+  return rvalue;
+}
+
+long Interpreter::eval_plus(Interpreter *interp, const Closure *c) {
+  return (*c->left)(interp) + (*c->right)(interp);
+}
+
+long Interpreter::eval_minus(Interpreter *interp, const Closure *c) {
+  return (*c->left)(interp) - (*c->right)(interp);
+}
+
+long Interpreter::eval_times(Interpreter *interp, const Closure *c) {
+  return (*c->left)(interp) * (*c->right)(interp);
+}
+
+long Interpreter::eval_divide(Interpreter *interp, const Closure *c) {
+  return (*c->left)(interp) / (*c->right)(interp);
+}
+
+long Interpreter::eval_power(Interpreter *interp, const Closure *c) {
+  // (the exponent is evaluated again after the base, so an
+  // assignment in the base is seen by the exponent)
+  long exponent = (*c->right)(interp);
+  long base = 0;
+  if (exponent >= 0) {
+    base = (*c->left)(interp);
+    exponent = (*c->right)(interp);
+  }
+  if (exponent < 0) {
+    error_at_pos(node_get_source_info(c->node), "Negative exponent");
+    return -1L;
+  }
+  long power;
+  if (!int_power(base, exponent, power)) {
+    error_at_pos(node_get_source_info(c->node), "Integer overflow");
+    return -1L;
   }
+  return power;
+}
+
+long Interpreter::eval_unknown(Interpreter *, const Closure *c) {
+  err_fatal("Unknown operator: %ld\n", c->value);
+  return -1L;
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -152,3 +348,7 @@ void interp_destroy(struct Interpreter *interp) {
 long interp_exec(struct Interpreter *interp) {
   return interp->exec();
 }
+
+long interp_exec_unit(struct Interpreter *interp, struct Node *unit) {
+  return interp->exec_unit(unit);
+}
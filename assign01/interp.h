@@ -8,7 +8,8 @@ extern "C" {
 struct Node;
 struct Interpreter;
 
-// create an Interpreter from given parse tree
+// create an Interpreter from given parse tree (which may be NULL
+// if units will be passed to interp_exec_unit instead)
 struct Interpreter *interp_create(struct Node *tree);
 
 // destroy given Interpreter
@@ -17,6 +18,10 @@ void interp_destroy(struct Interpreter *interp);
 // execute the Interpreter, returning the result of the last evaluation
 long interp_exec(struct Interpreter *interp);
 
+// execute a single unit (which the caller still owns), returning its
+// result; variables assigned by earlier units remain defined
+long interp_exec_unit(struct Interpreter *interp, struct Node *unit);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
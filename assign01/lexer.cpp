@@ -1,18 +1,30 @@
 #include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "cpputil.h"
 #include "token.h"
 #include "error.h"
+#include "util.h"
 #include "lexer.h"
 
 ////////////////////////////////////////////////////////////////////////
 // Lexer implementation
 ////////////////////////////////////////////////////////////////////////
 
+// The whole input is scanned from memory: a regular file is mapped with
+// mmap, and any other input (such as a pipe) is read into a buffer.
 struct Lexer {
 private:
-  FILE *m_in;
-  struct Node *m_next;
+  const char *m_buf;
+  size_t m_len;
+  bool m_mapped;        // m_buf is mapped (rather than allocated)
+  const char *m_cur, *m_end;
+  struct Token m_tok;   // the token last read
+  struct Token m_next;  // the next token (if m_has_next is true)
+  bool m_has_next;
   std::string m_filename;
   int m_line, m_col;
   bool m_eof;
@@ -21,42 +33,59 @@ public:
   Lexer(FILE *in, const std::string &filename);
   ~Lexer();
 
-  struct Node *next();
-  struct Node *peek();
+  const struct Token *next();
+  const struct Token *peek();
 
   struct SourceInfo get_current_pos() const;
 
 private:
+  void load(FILE *in);
   int read();
-  void unread(int c);
   void fill();
-  struct Node *read_token();
-  struct Node *read_continued_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col);
-  struct Node *token_create(enum TokenKind kind, const std::string &lexeme, int line, int col);
+  bool read_token();
+  bool read_continued_token(enum TokenKind kind, const char *start, int line, int col);
+  bool token_create(enum TokenKind kind, const char *start, size_t len, int line, int col);
 };
 
 Lexer::Lexer(FILE *in, const std::string &filename)
-  : m_in(in)
-  , m_next(nullptr)
+  : m_buf(nullptr)
+  , m_len(0)
+  , m_mapped(false)
+  , m_cur(nullptr)
+  , m_end(nullptr)
+  , m_tok()
+  , m_next()
+  , m_has_next(false)
   , m_filename(filename)
   , m_line(1)
   , m_col(1)
   , m_eof(false) {
+  load(in);
+  m_cur = m_buf;
+  m_end = m_buf + m_len;
 }
 
 Lexer::~Lexer() {
+  if (m_mapped) {
+    munmap(const_cast<char *>(m_buf), m_len);
+  } else {
+    free(const_cast<char *>(m_buf));
+  }
 }
 
-struct Node *Lexer::next() {
+const struct Token *Lexer::next() {
   fill();
-  Node *tok = m_next;
-  m_next = nullptr;
-  return tok;
+  if (!m_has_next) {
+    return nullptr;
+  }
+  m_tok = m_next;
+  m_has_next = false;
+  return &m_tok;
 }
 
-struct Node *Lexer::peek() {
+const struct Token *Lexer::peek() {
   fill();
-  return m_next;
+  return m_has_next ? &m_next : nullptr;
 }
 
 struct SourceInfo Lexer::get_current_pos() const {
@@ -68,13 +97,46 @@ struct SourceInfo Lexer::get_current_pos() const {
   return source_pos;
 }
 
+// Map (or read) the rest of the input into memory.
+void Lexer::load(FILE *in) {
+  struct stat st;
+  int fd = fileno(in);
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && ftell(in) == 0) {
+    m_len = size_t(st.st_size);
+    if (m_len == 0) {
+      return;
+    }
+    void *p = mmap(nullptr, m_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      m_buf = static_cast<const char *>(p);
+      m_mapped = true;
+      return;
+    }
+  }
+
+  size_t capacity = 1 << 16, n;
+  char *buf = static_cast<char *>(xmalloc(capacity));
+  m_len = 0;
+  while ((n = fread(buf + m_len, 1, capacity - m_len, in)) > 0) {
+    m_len += n;
+    if (m_len == capacity) {
+      capacity *= 2;
+      buf = static_cast<char *>(realloc(buf, capacity));
+      if (!buf) {
+        err_fatal("Could not read input\n");
+      }
+    }
+  }
+  m_buf = buf;
+}
+
 // Read the next character of input, returning -1 (and setting m_eof to true)
 // if the end of input has been reached.
 int Lexer::read() {
   if (m_eof) {
     return -1;
   }
-  int c = fgetc(m_in);
+  int c = m_cur != m_end ? (unsigned char) *m_cur++ : -1;
   if (c < 0) {
     m_eof = true;
   } else if (c == '\n') {
@@ -86,20 +148,14 @@ int Lexer::read() {
   return c;
 }
 
-// "Unread" a character.  Useful for when reading a character indicates
-// that the current token has ended and the next one has begun.
-void Lexer::unread(int c) {
-  ungetc(c, m_in);
-  m_col--;
-}
-
 void Lexer::fill() {
-  if (!m_eof && !m_next) {
-    m_next = read_token();
+  if (!m_eof && !m_has_next) {
+    m_has_next = read_token();
   }
 }
 
-struct Node *Lexer::read_token() {
+// Read a token into m_next, returning false at the end of input.
+bool Lexer::read_token() {
   int c, line = -1, col = -1;
 
   // skip whitespace characters until a non-whitespace character is read
@@ -114,36 +170,35 @@ struct Node *Lexer::read_token() {
 
   if (c < 0) {
     // reached end of file
-    return nullptr;
+    return false;
   }
 
-  std::string lexeme;
-  lexeme.push_back(char(c));
+  const char *start = m_cur - 1;
 
   if (isalpha(c)) {
-    return read_continued_token(TOK_IDENTIFIER, lexeme, line, col);
+    return read_continued_token(TOK_IDENTIFIER, start, line, col);
   } else if (isdigit(c)) {
-    return read_continued_token(TOK_INTEGER_LITERAL, lexeme, line, col);
+    return read_continued_token(TOK_INTEGER_LITERAL, start, line, col);
   } else {
     switch (c) {
     case '+':
-      return token_create(TOK_PLUS, lexeme, line, col);
+      return token_create(TOK_PLUS, start, 1, line, col);
     case '-':
-      return token_create(TOK_MINUS, lexeme, line, col);
+      return token_create(TOK_MINUS, start, 1, line, col);
     case '*':
-      return token_create(TOK_TIMES, lexeme, line, col);
+      return token_create(TOK_TIMES, start, 1, line, col);
     case '/':
-      return token_create(TOK_DIVIDE, lexeme, line, col);
+      return token_create(TOK_DIVIDE, start, 1, line, col);
     case '^':
-      return token_create(TOK_POWER, lexeme, line, col);
+      return token_create(TOK_POWER, start, 1, line, col);
     case ';':
-      return token_create(TOK_SEMICOLON, lexeme, line, col);
+      return token_create(TOK_SEMICOLON, start, 1, line, col);
     case '=':
-      return token_create(TOK_ASSIGN, lexeme, line, col);
+      return token_create(TOK_ASSIGN, start, 1, line, col);
     case '(':
-      return token_create(TOK_LPAREN, lexeme, line, col);
+      return token_create(TOK_LPAREN, start, 1, line, col);
     case ')':
-      return token_create(TOK_RPAREN, lexeme, line, col);
+      return token_create(TOK_RPAREN, start, 1, line, col);
     default:
       {
         struct SourceInfo pos = {
@@ -153,53 +208,41 @@ struct Node *Lexer::read_token() {
         };
         std::string errmsg = cpputil::format("Unrecognized character '%c'", c).c_str();
         error_at_pos(pos, errmsg.c_str());
-        return nullptr;
+        return false;
       }
     }
   } 
 }
 
 // Read the continuation of a (possibly) multi-character token, such as
-// an identifier or integer literal.  pred is a pointer to a predicate
-// function to determine which characters are valid continuations.
-struct Node *Lexer::read_continued_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col) {
-  std::string lexeme(lexeme_start);
-  for (;;) {
-    int c = read();
-    if (kind == TOK_INTEGER_LITERAL) {
-      if (c >= 0 && isdigit(c)) {
-        // token has finished
-        lexeme.push_back(char(c));
-      } else {
-        if (c >= 0) {
-          unread(c);
-        }
-        return token_create(kind, lexeme, line, col);
-      }
-    } else if (kind == TOK_IDENTIFIER) {
-      if (c >= 0 && (isdigit(c) || isalpha(c))) {
-        // token has finished
-        lexeme.push_back(char(c));
-      } else {
-        if (c >= 0) {
-          unread(c);
-        }
-        return token_create(kind, lexeme, line, col);
-      }
+// an identifier or integer literal, whose first character is at start.
+// (The continuation can't contain a newline, so only the column changes.)
+bool Lexer::read_continued_token(enum TokenKind kind, const char *start, int line, int col) {
+  const char *p = m_cur;
+  if (kind == TOK_INTEGER_LITERAL) {
+    while (p != m_end && isdigit((unsigned char) *p)) {
+      p++;
+    }
+  } else {
+    while (p != m_end && isalnum((unsigned char) *p)) {
+      p++;
     }
   }
+  m_col += int(p - m_cur);
+  m_cur = p;
+
+  return token_create(kind, start, size_t(p - start), line, col);
 }
 
-// Helper function to create a Node object to represent a token.
-struct Node *Lexer::token_create(enum TokenKind kind, const std::string &lexeme, int line, int col) {
-  struct Node *token = node_alloc_str_copy(kind, lexeme.c_str());
-  struct SourceInfo source_info = {
-    .filename = m_filename.c_str(),
-    .line = line,
-    .col = col,
-  };
-  node_set_source_info(token, source_info);
-  return token;
+// Helper function to set m_next to a token.
+bool Lexer::token_create(enum TokenKind kind, const char *start, size_t len, int line, int col) {
+  m_next.kind = kind;
+  m_next.lexeme = start;
+  m_next.len = len;
+  m_next.source_info.filename = m_filename.c_str();
+  m_next.source_info.line = line;
+  m_next.source_info.col = col;
+  return true;
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -214,14 +257,23 @@ void lexer_destroy(struct Lexer *lexer) {
   delete lexer;
 }
 
-struct Node *lexer_next(struct Lexer *lexer) {
+const struct Token *lexer_next(struct Lexer *lexer) {
   return lexer->next();
 }
 
-struct Node *lexer_peek(struct Lexer *lexer) {
+const struct Token *lexer_peek(struct Lexer *lexer) {
   return lexer->peek();
 }
 
 struct SourceInfo lexer_get_current_pos(struct Lexer *lexer) {
   return lexer->get_current_pos();
 }
+
+struct Node *lexer_token_to_node(const struct Token *tok) {
+  char *str = static_cast<char *>(xmalloc(tok->len + 1));
+  memcpy(str, tok->lexeme, tok->len);
+  str[tok->len] = '\0';
+  struct Node *node = node_alloc_str_adopt(tok->kind, str);
+  node_set_source_info(node, tok->source_info);
+  return node;
+}
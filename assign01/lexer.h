@@ -1,6 +1,7 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <stddef.h>
 #include <stdio.h>
 #include "node.h"
 
@@ -10,13 +11,31 @@ extern "C" {
 
 struct Lexer;
 
+// A token: its kind, its lexeme (a range of the input, which isn't
+// null-terminated) and its position.  Tokens aren't allocated, and a
+// token is only copied into a Node (by lexer_token_to_node) when the
+// parser keeps it in the tree.
+struct Token {
+  int kind;
+  const char *lexeme;
+  size_t len;
+  struct SourceInfo source_info;
+};
+
 struct Lexer *lexer_create(FILE *in, const char *filename);
 void lexer_destroy(struct Lexer *lexer);
 
-struct Node *lexer_next(struct Lexer *lexer);
-struct Node *lexer_peek(struct Lexer *lexer);
+// Read the next token, or look at it without reading it, returning null
+// at the end of input.  A token returned by lexer_next is valid until
+// the next call to lexer_next, and one returned by lexer_peek until it
+// is read.
+const struct Token *lexer_next(struct Lexer *lexer);
+const struct Token *lexer_peek(struct Lexer *lexer);
 struct SourceInfo lexer_get_current_pos(struct Lexer *lexer);
 
+// Create a Node for a token (with a copy of its lexeme).
+struct Node *lexer_token_to_node(const struct Token *tok);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -4,17 +4,20 @@
 #include "lexer.h"
 #include "parser.h"
 #include "interp.h"
+#include "compile.h"
 
 enum {
   INTERPRET,
   PRINT_TOKENS,
   PRINT_PARSE_TREE,
+  COMPILE,
+  STREAM,
 };
 
 int main(int argc, char **argv) {
   int mode = INTERPRET, opt;
 
-  while ((opt = getopt(argc, argv, "lp")) != -1) {
+  while ((opt = getopt(argc, argv, "lpcs")) != -1) {
     switch (opt) {
     case 'l':
       mode = PRINT_TOKENS;
@@ -22,6 +25,14 @@ int main(int argc, char **argv) {
     case 'p':
       mode = PRINT_PARSE_TREE;
       break;
+    case 'c':
+      // translate to a program for the assign06 compiler
+      mode = COMPILE;
+      break;
+    case 's':
+      // evaluate and print each unit as soon as it is parsed
+      mode = STREAM;
+      break;
     default:
       err_fatal("Unknown command-line option '%c'\n", opt);
     }
@@ -44,20 +55,39 @@ int main(int argc, char **argv) {
 
   struct Lexer *lexer = lexer_create(in, filename);
   if (mode == PRINT_TOKENS) {
-    struct Node *tok;
+    const struct Token *tok;
     while ((tok = lexer_next(lexer)) != NULL) {
-      printf("%d:%s\n", node_get_tag(tok), node_get_str(tok));
+      printf("%d:%.*s\n", tok->kind, (int) tok->len, tok->lexeme);
     }
     return 0;
   }
 
   struct Parser *parser = parser_create(lexer);
+
+  if (mode == STREAM) {
+    // only one unit's tree is in memory at a time
+    struct Interpreter *interp = interp_create(NULL);
+    struct Node *unit;
+    while ((unit = parser_parse_unit(parser)) != NULL) {
+      long result = interp_exec_unit(interp, unit);
+      printf("Result: %ld\n", result);
+      node_destroy_recursive(unit);
+    }
+    interp_destroy(interp);
+    parser_destroy(parser);
+    return 0;
+  }
+
   struct Node *root = parser_parse(parser);
 
   if (mode == PRINT_PARSE_TREE) {
     // just print a parse tree
     printf("Parse tree:\n");
     parser_print_parse_tree(root);
+  } else if (mode == COMPILE) {
+    struct Compiler *compiler = compiler_create(root);
+    compiler_emit(compiler, stdout);
+    compiler_destroy(compiler);
   } else {
     // evaluate and print result
 
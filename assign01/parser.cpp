@@ -22,17 +22,20 @@ public:
   ~Parser();
 
   struct Node *parse();
+  struct Node *parse_next_unit();
 
 private:
   // Parse functions for nonterminal grammar symbols
   struct Node *parse_U();
-  struct Node *parse_A();
-  struct Node *parse_E();
-  struct Node *parse_T();
-  struct Node *parse_F();
+  struct Node *parse_unit();
 
-  // Consume a specific token, wrapping it in a Node
-  struct Node *expect(enum TokenKind tok_kind);
+  // Parse an expression whose operators bind more tightly than min_power
+  // (see s_operators)
+  struct Node *parse_expression(int min_power);
+  struct Node *parse_primary();
+
+  // Consume a specific token
+  const struct Token *expect(enum TokenKind tok_kind);
 
   // Report an error at current lexer position
   void error_at_current_pos(const std::string &msg);
@@ -49,12 +52,17 @@ struct Node *Parser::parse() {
   return parse_U();
 }
 
-struct Node *Parser::parse_U() {
-  struct Node *u = node_build0(NODE_UNIT);
+// parse a single unit (without the units following it), or return
+// null if there is no more input
+struct Node *Parser::parse_next_unit() {
+  if (!lexer_peek(m_lexer)) {
+    return nullptr;
+  }
+  return parse_unit();
+}
 
-  // U -> A ;
-  node_add_kid(u, parse_A());
-  node_add_kid(u, expect(TOK_SEMICOLON));
+struct Node *Parser::parse_U() {
+  struct Node *u = parse_unit();
 
   if (lexer_peek(m_lexer)) {
     // there is more input, then the sequence of expressions continues
@@ -64,110 +72,108 @@ struct Node *Parser::parse_U() {
   return u;
 }
 
-struct Node *Parser::parse_A() {
-
-  struct Node *a = node_build0(NODE_ASSIGN);
-  node_add_kid(a, parse_E());
-
-  struct Node *next_terminal = lexer_peek(m_lexer);
-  if (!next_terminal) {
-    error_at_current_pos("Parser error (missing expression)");
-  }
-
-  int tag = node_get_tag(next_terminal);
+struct Node *Parser::parse_unit() {
+  struct Node *u = node_build0(NODE_UNIT);
 
-  if (tag == TOK_ASSIGN) {
-    // A -> E = A'
-    node_add_kid(a, lexer_next(m_lexer));
-    node_add_kid(a, parse_A());
-  }
+  // U -> A ;
+  node_add_kid(u, parse_expression(0));
+  node_add_kid(u, lexer_token_to_node(expect(TOK_SEMICOLON)));
 
-  return a;
+  return u;
 }
 
-struct Node *Parser::parse_E() {
-
-  struct Node *e = node_build0(NODE_EXPRESSION);
-  node_add_kid(e, parse_T());
-
-  struct Node *next_terminal = lexer_peek(m_lexer);
-  if (!next_terminal) {
-    error_at_current_pos("Parser error (missing expression)");
-  }
+// The binary operators, indexed by token kind: the power with which each
+// binds its operands, and the tag of the nodes it builds (the nonterminal
+// of its precedence level in the grammar, so the tree prints the same
+// way).  Every operator is right associative, as in the grammar
+//
+//   A -> E = A | E      E -> T + E | T - E | T
+//   T -> F * T | F / T | F      F -> P ^ F | P
+//   P -> integer | identifier | ( A )
+//
+// so an operator's right operand is parsed at one less than its power,
+// taking in the operators of the same level which follow it.  (A power
+// of 0 means the token isn't a binary operator.)
+namespace {
+
+const struct {
+  int power;
+  int tag;
+} s_operators[] = {
+  { 0, 0 },                  // TOK_IDENTIFIER
+  { 0, 0 },                  // TOK_INTEGER_LITERAL
+  { 20, NODE_EXPRESSION },   // TOK_PLUS
+  { 20, NODE_EXPRESSION },   // TOK_MINUS
+  { 30, NODE_TERM },         // TOK_TIMES
+  { 30, NODE_TERM },         // TOK_DIVIDE
+  { 40, NODE_FACTOR },       // TOK_POWER
+  { 10, NODE_ASSIGN },       // TOK_ASSIGN
+  { 0, 0 },                  // TOK_LPAREN
+  { 0, 0 },                  // TOK_RPAREN
+  { 0, 0 },                  // TOK_SEMICOLON
+};
 
-  int tag = node_get_tag(next_terminal);
-  
-  if (tag == TOK_PLUS || tag == TOK_MINUS) {
-    // E -> T + E'
-    // E -> T - E'
-    node_add_kid(e, lexer_next(m_lexer));
-    node_add_kid(e, parse_E());
-  }
+static_assert(sizeof(s_operators) / sizeof(s_operators[0]) == TOK_SEMICOLON + 1,
+              "s_operators must have an entry for each token kind");
 
-  return e;
 }
 
-struct Node *Parser::parse_T() {
-
-  struct Node *t = node_build0(NODE_TERM);
-  node_add_kid(t, parse_F());
-
-  struct Node *next_terminal = lexer_peek(m_lexer);
-  if (!next_terminal) {
-    error_at_current_pos("Parser error (missing expression)");
-  }
-
-  int tag = node_get_tag(next_terminal);
-
-  if (tag == TOK_TIMES || tag == TOK_DIVIDE) {
-    // T -> F * T'
-    // T -> F / T'
-    node_add_kid(t, lexer_next(m_lexer));
-    node_add_kid(t, parse_T());
+// Each operator builds a node with the left operand, the operator token
+// and the right operand as its children, and each primary is its token
+// (a parenthesized expression is just the expression), so there are no
+// nodes for the precedence levels an operand passes through.
+struct Node *Parser::parse_expression(int min_power) {
+  struct Node *left = parse_primary();
+
+  for (;;) {
+    const struct Token *next_terminal = lexer_peek(m_lexer);
+    if (!next_terminal) {
+      error_at_current_pos("Parser error (missing expression)");
+    }
+
+    int power = s_operators[next_terminal->kind].power;
+    if (power <= min_power) {
+      return left;
+    }
+
+    // (the operator's node is created before its right operand's tokens
+    // are read, which invalidates the operator's token)
+    struct Node *op = lexer_token_to_node(lexer_next(m_lexer));
+    struct Node *right = parse_expression(power - 1);
+    left = node_build3(s_operators[node_get_tag(op)].tag, left, op, right);
   }
-
-  return t;
 }
 
-struct Node *Parser::parse_F() {
-
-  struct Node *f = node_build0(NODE_FACTOR);
-
-  struct Node *next_terminal = lexer_next(m_lexer);
+struct Node *Parser::parse_primary() {
+  const struct Token *next_terminal = lexer_next(m_lexer);
   if (!next_terminal) {
     error_at_current_pos("Parser error (missing expression)");
   }
 
-  int tag = node_get_tag(next_terminal);
+  int tag = next_terminal->kind;
 
-  if (tag == TOK_INTEGER_LITERAL) {
-    node_add_kid(f, next_terminal);
-  } else if (tag == TOK_IDENTIFIER) {
-    node_add_kid(f, next_terminal);
+  if (tag == TOK_INTEGER_LITERAL || tag == TOK_IDENTIFIER) {
+    return lexer_token_to_node(next_terminal);
   } else if (tag == TOK_LPAREN) {
-    node_add_kid(f, parse_A());
+    // (the parentheses aren't part of the tree, so they never get nodes)
+    struct Node *expr = parse_expression(0);
     expect(TOK_RPAREN);
-  } else {
-    std::string errmsg = cpputil::format("Illegal expression (at '%s')", node_get_str(next_terminal));
-    error_on_node(next_terminal, errmsg.c_str());
+    return expr;
   }
 
-  next_terminal = lexer_peek(m_lexer);
-  tag = node_get_tag(next_terminal);
-
-  if (tag == TOK_POWER) {
-    node_add_kid(f, lexer_next(m_lexer));
-    node_add_kid(f, parse_F());
-  } 
-
-  return f;
+  std::string errmsg = cpputil::format("Illegal expression (at '%.*s')", int(next_terminal->len), next_terminal->lexeme);
+  error_at_pos(next_terminal->source_info, errmsg.c_str());
+  return nullptr;
 }
 
-struct Node *Parser::expect(enum TokenKind tok_kind) {
-  struct Node *next_terminal = lexer_next(m_lexer);
-  if (node_get_tag(next_terminal) != tok_kind) {
-    std::string errmsg = cpputil::format("Unexpected token '%s'", node_get_str(next_terminal));
-    error_on_node(next_terminal, errmsg.c_str());
+const struct Token *Parser::expect(enum TokenKind tok_kind) {
+  const struct Token *next_terminal = lexer_next(m_lexer);
+  if (!next_terminal) {
+    error_at_current_pos("Parser error (unexpected end of input)");
+  }
+  if (next_terminal->kind != tok_kind) {
+    std::string errmsg = cpputil::format("Unexpected token '%.*s'", int(next_terminal->len), next_terminal->lexeme);
+    error_at_pos(next_terminal->source_info, errmsg.c_str());
   }
   return next_terminal;
 }
@@ -235,6 +241,10 @@ struct Node *parser_parse(struct Parser *parser) {
   return parser->parse();
 }
 
+struct Node *parser_parse_unit(struct Parser *parser) {
+  return parser->parse_next_unit();
+}
+
 void parser_print_parse_tree(struct Node *tree) {
   treeprint(tree, minicalc_stringify_node_tag);
 }
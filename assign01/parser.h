@@ -24,6 +24,10 @@ void parser_destroy(struct Parser *parser);
 
 struct Node *parser_parse(struct Parser *parser);
 
+// parse the next unit only (with no following units), returning
+// NULL at the end of the input
+struct Node *parser_parse_unit(struct Parser *parser);
+
 void parser_print_parse_tree(struct Node *tree);
 
 #ifdef __cplusplus
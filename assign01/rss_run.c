@@ -0,0 +1,61 @@
+// Run a program, measuring its run time and peak memory use (for the
+// benchmarks, see bench/run_bench.rb).
+//
+// Usage: rss_run <report-file> <program> [<args>...]
+//
+// The program's standard input and output are this program's, and the
+// exit status is the program's (or 127 if it can't be run).  The report
+// file gets a CSV header row and a row of the program's (wall clock) run
+// time in milliseconds, and its maximum resident set size in KB.
+//
+// (The peak memory use of a process includes that of the process it was
+// forked from, even after it executes another program, so the benchmark
+// runner, whose own memory use is much larger than this program's, can't
+// measure it itself.)
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: rss_run <report-file> <program> [<args>...]\n");
+    return 127;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return 127;
+  }
+  if (pid == 0) {
+    execvp(argv[2], argv + 2);
+    perror(argv[2]);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0) {
+    perror("wait4");
+    return 127;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  FILE *out = fopen(argv[1], "w");
+  if (out == NULL) {
+    perror(argv[1]);
+    return 127;
+  }
+  fprintf(out, "run_ms,peak_rss_kb\n");
+  fprintf(out, "%.3f,%ld\n",
+          (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0,
+          usage.ru_maxrss);
+  fclose(out);
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "util.h"
+#include "node.h"
+#include "grammar_symbols.h"
+#include "ast_cache.h"
+
+#define SNAPSHOT_MAGIC "A2ASTv1"
+
+struct SnapshotHeader {
+  char magic[8];
+  uint64_t hash;
+  uint32_t num_nodes;
+  uint32_t strings_size;
+};
+
+struct SnapshotNode {
+  int32_t tag;
+  int32_t num_kids;
+  // offset of the string in the string table, or -1 if there is none
+  int32_t str;
+  // the source line (-1 if the node has no source info) and column
+  int32_t line, col;
+};
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ p[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+// the hash of the names of the grammar symbols, so that a snapshot
+// isn't used by an interpreter whose tags are different
+static uint64_t hash_grammar(void) {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  int first_tags[] = { NODE_IDENTIFIER, 1000 };
+  for (int i = 0; i < 2; i++) {
+    const char *name;
+    for (int tag = first_tags[i]; (name = get_grammar_symbol_name(tag)) != NULL; tag++) {
+      hash = fnv1a(hash, name, strlen(name) + 1);
+    }
+  }
+  return hash;
+}
+
+char *ast_cache_get_filename(const char *script) {
+  size_t len = strlen(script);
+  char *filename = xmalloc(len + 5);
+  memcpy(filename, script, len);
+  strcpy(filename + len, ".ast");
+  return filename;
+}
+
+// map a file (read-only), returning null if it can't be (or is empty)
+static const char *map_file(const char *filename, size_t *size) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+  *size = st.st_size;
+  return p;
+}
+
+uint64_t ast_cache_hash_script(const char *script) {
+  size_t size;
+  const char *text = map_file(script, &size);
+  if (!text) {
+    return 0;
+  }
+  uint64_t hash = fnv1a(hash_grammar(), text, size);
+  munmap((void *) text, size);
+  // (0 means the script couldn't be read)
+  return hash != 0 ? hash : 1;
+}
+
+// a node of the tree being built, and the number of its kids still to add
+struct LoadFrame {
+  struct Node *node;
+  int32_t kids_left;
+};
+
+static struct Node *build_tree(const struct SnapshotNode *nodes, uint32_t num_nodes,
+                               const char *strings, uint32_t strings_size, const char *filename) {
+  struct LoadFrame *stack = xmalloc(sizeof(struct LoadFrame) * num_nodes);
+  int depth = 0;
+  struct Node *root = NULL;
+  uint32_t i;
+
+  for (i = 0; i < num_nodes; i++) {
+    const struct SnapshotNode *sn = &nodes[i];
+    // (a string must end in the string table, and only the root has no
+    // parent)
+    if (sn->num_kids < 0 || sn->str < -1 || (sn->str >= 0 && (uint32_t) sn->str >= strings_size)
+        || (i > 0 && depth == 0)) {
+      break;
+    }
+    struct Node *n = sn->str >= 0 ? node_alloc_str_copy(sn->tag, strings + sn->str) : node_alloc(sn->tag);
+    if (sn->line >= 0) {
+      struct SourceInfo info = { filename, sn->line, sn->col };
+      node_set_source_info(n, info);
+    }
+
+    if (depth == 0) {
+      root = n;
+    } else {
+      node_add_kid(stack[depth - 1].node, n);
+      stack[depth - 1].kids_left--;
+    }
+    stack[depth].node = n;
+    stack[depth].kids_left = sn->num_kids;
+    depth++;
+    while (depth > 0 && stack[depth - 1].kids_left == 0) {
+      depth--;
+    }
+  }
+  free(stack);
+
+  if (i < num_nodes || depth != 0) {
+    if (root) {
+      node_destroy_recursive(root);
+    }
+    return NULL;
+  }
+  return root;
+}
+
+struct Node *ast_cache_load(const char *snapshot, uint64_t hash, const char *script) {
+  size_t size;
+  const char *data = map_file(snapshot, &size);
+  if (!data) {
+    return NULL;
+  }
+
+  struct Node *root = NULL;
+  const struct SnapshotHeader *header = (const struct SnapshotHeader *) data;
+  if (size >= sizeof(struct SnapshotHeader)
+      && memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0
+      && header->hash == hash
+      && header->num_nodes > 0
+      && size == sizeof(struct SnapshotHeader) + sizeof(struct SnapshotNode) * (size_t) header->num_nodes
+                 + header->strings_size
+      && header->strings_size > 0) {
+    const struct SnapshotNode *nodes = (const struct SnapshotNode *) (header + 1);
+    const char *strings = (const char *) (nodes + header->num_nodes);
+    // (the string table ends in a null, so no string can run past it)
+    if (strings[header->strings_size - 1] == '\0') {
+      root = build_tree(nodes, header->num_nodes, strings, header->strings_size, xstrdup(script));
+    }
+  }
+
+  munmap((void *) data, size);
+  return root;
+}
+
+// a growable buffer of the snapshot's nodes or strings
+struct SaveBuffer {
+  char *data;
+  size_t len, capacity;
+};
+
+static void buffer_append(struct SaveBuffer *buf, const void *data, size_t len) {
+  if (buf->len + len > buf->capacity) {
+    size_t capacity = buf->capacity ? buf->capacity : 4096;
+    while (buf->len + len > capacity) {
+      capacity *= 2;
+    }
+    char *new_data = xmalloc(capacity);
+    memcpy(new_data, buf->data, buf->len);
+    free(buf->data);
+    buf->data = new_data;
+    buf->capacity = capacity;
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+// the string table, where each distinct string is stored once (most of
+// the strings are identifiers and operators, which recur), found by an
+// open addressing hash table of their offsets
+struct StringTable {
+  struct SaveBuffer buf;
+  int32_t *slots;
+  size_t num_slots, num_strings;
+};
+
+static int32_t intern_string(struct StringTable *table, const char *str) {
+  if (2 * (table->num_strings + 1) > table->num_slots) {
+    size_t num_slots = table->num_slots ? table->num_slots * 2 : 1024;
+    int32_t *slots = xmalloc(sizeof(int32_t) * num_slots);
+    for (size_t i = 0; i < num_slots; i++) {
+      slots[i] = -1;
+    }
+    for (size_t i = 0; i < table->num_slots; i++) {
+      if (table->slots[i] >= 0) {
+        const char *s = table->buf.data + table->slots[i];
+        size_t j = fnv1a(FNV_OFFSET_BASIS, s, strlen(s)) & (num_slots - 1);
+        while (slots[j] >= 0) {
+          j = (j + 1) & (num_slots - 1);
+        }
+        slots[j] = table->slots[i];
+      }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->num_slots = num_slots;
+  }
+
+  size_t len = strlen(str);
+  size_t i = fnv1a(FNV_OFFSET_BASIS, str, len) & (table->num_slots - 1);
+  while (table->slots[i] >= 0) {
+    if (strcmp(table->buf.data + table->slots[i], str) == 0) {
+      return table->slots[i];
+    }
+    i = (i + 1) & (table->num_slots - 1);
+  }
+  table->slots[i] = (int32_t) table->buf.len;
+  table->num_strings++;
+  buffer_append(&table->buf, str, len + 1);
+  return table->slots[i];
+}
+
+void ast_cache_save(const char *snapshot, uint64_t hash, struct Node *root) {
+  struct SaveBuffer nodes = { NULL, 0, 0 };
+  struct StringTable strings = { { NULL, 0, 0 }, NULL, 0, 0 };
+
+  // write the nodes in preorder (the kids are pushed in reverse order, so
+  // that they are popped in order)
+  size_t stack_capacity = 64, depth = 0;
+  struct Node **stack = xmalloc(sizeof(struct Node *) * stack_capacity);
+  stack[depth++] = root;
+  uint32_t num_nodes = 0;
+  while (depth > 0) {
+    struct Node *n = stack[--depth];
+    struct SourceInfo info = node_get_source_info(n);
+    const char *str = node_get_str(n);
+    struct SnapshotNode sn;
+    sn.tag = node_get_tag(n);
+    sn.num_kids = node_get_num_kids(n);
+    sn.str = str ? intern_string(&strings, str) : -1;
+    sn.line = info.line;
+    sn.col = info.col;
+    buffer_append(&nodes, &sn, sizeof(sn));
+    num_nodes++;
+
+    if (depth + sn.num_kids > stack_capacity) {
+      while (depth + sn.num_kids > stack_capacity) {
+        stack_capacity *= 2;
+      }
+      struct Node **new_stack = xmalloc(sizeof(struct Node *) * stack_capacity);
+      memcpy(new_stack, stack, sizeof(struct Node *) * depth);
+      free(stack);
+      stack = new_stack;
+    }
+    for (int i = sn.num_kids - 1; i >= 0; i--) {
+      stack[depth++] = node_get_kid(n, i);
+    }
+  }
+  free(stack);
+  if (strings.buf.len == 0) {
+    buffer_append(&strings.buf, "", 1);
+  }
+
+  struct SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.hash = hash;
+  header.num_nodes = num_nodes;
+  header.strings_size = (uint32_t) strings.buf.len;
+
+  // (written to a temporary file, which is renamed to the snapshot, so
+  // that a run never maps a partly written snapshot)
+  size_t len = strlen(snapshot);
+  char *temp = xmalloc(len + 32);
+  sprintf(temp, "%s.%ld.tmp", snapshot, (long) getpid());
+  FILE *out = fopen(temp, "wb");
+  if (out) {
+    int ok = fwrite(&header, sizeof(header), 1, out) == 1
+             && fwrite(nodes.data, 1, nodes.len, out) == nodes.len
+             && fwrite(strings.buf.data, 1, strings.buf.len, out) == strings.buf.len;
+    ok = (fclose(out) == 0) && ok;
+    if (!ok || rename(temp, snapshot) != 0) {
+      remove(temp);
+    }
+  }
+  free(temp);
+  free(nodes.data);
+  free(strings.buf.data);
+  free(strings.slots);
+}
@@ -0,0 +1,44 @@
+#ifndef AST_CACHE_H
+#define AST_CACHE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+struct Node;
+
+// Binary snapshots of parse trees, so that a script which is run again
+// isn't lexed and parsed again.  The snapshot of a script is written next
+// to it (with ".ast" appended to its name), and is keyed by the hash of
+// the script's contents and of the grammar's symbols: a snapshot which
+// doesn't match the script (or the interpreter's grammar) is replaced.
+//
+// A snapshot is a header, the nodes in preorder (each with its tag, its
+// number of kids, the offset of its string in the string table, and its
+// source line and column), and the string table (holding each distinct
+// string once).  It's mmap'd, and the tree is built from it directly.
+
+// the name of the snapshot of a script (free it with free)
+char *ast_cache_get_filename(const char *script);
+
+// the hash of a script's contents (and of the grammar), or 0 if it can't
+// be read
+uint64_t ast_cache_hash_script(const char *script);
+
+// load the parse tree of a script from its snapshot, returning null if
+// the snapshot doesn't exist, doesn't have the given hash, or isn't valid
+// (the source info of the nodes names the script)
+struct Node *ast_cache_load(const char *snapshot, uint64_t hash, const char *script);
+
+// write the snapshot of a parse tree (replacing it atomically, so that
+// runs of the same script can share it), ignoring any error, since the
+// snapshot is only an optimization
+void ast_cache_save(const char *snapshot, uint64_t hash, struct Node *root);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // AST_CACHE_H
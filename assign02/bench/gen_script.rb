@@ -0,0 +1,87 @@
+#! /usr/bin/env ruby
+
+# Generate a script for the interpreter benchmarks, and print it.
+#
+# Usage: gen_script.rb recursion <n>  calls of a function recursing
+#                                     RECURSION_DEPTH deep, n calls in all
+#        gen_script.rb loop <n>       a WHILE loop of n iterations
+#        gen_script.rb wide <n>       a WHILE loop assigning each of
+#                                     WIDTH variables, n assignments in all
+#        gen_script.rb chain <n>      a WHILE loop evaluating an
+#                                     expression of CHAIN_LENGTH binary
+#                                     operators, n operators in all
+#
+# The last value of each script is its number of operations (calls,
+# iterations, assignments or operators), which run_bench.rb checks.
+
+RECURSION_DEPTH = 1000
+WIDTH = 200
+CHAIN_LENGTH = 200
+
+kind, count = ARGV[0], ARGV[1].to_i
+if !['recursion', 'loop', 'wide', 'chain'].include?(kind) || count < 1
+  STDERR.puts "Usage: gen_script.rb (recursion|loop|wide|chain) <n>"
+  exit 1
+end
+
+if kind == 'recursion'
+  # (the addition after the recursive call keeps it from being a tail
+  # call, so each call has its own frame)
+  puts "function down(n) {"
+  puts "  var r;"
+  puts "  if (n == 0) {"
+  puts "    r = 0;"
+  puts "  } else {"
+  puts "    r = 1 + down(n - 1);"
+  puts "  }"
+  puts "  r;"
+  puts "}"
+  puts "var i, calls;"
+  puts "i = 0;"
+  puts "calls = 0;"
+  puts "while (i < #{(count + RECURSION_DEPTH) / (RECURSION_DEPTH + 1)}) {"
+  puts "  calls = calls + down(#{RECURSION_DEPTH}) + 1;"
+  puts "  i = i + 1;"
+  puts "}"
+  puts "calls;"
+elsif kind == 'loop'
+  puts "var i, s;"
+  puts "i = 0;"
+  puts "s = 0;"
+  puts "while (i < #{count}) {"
+  puts "  s = s + i;"
+  puts "  i = i + 1;"
+  puts "}"
+  puts "i;"
+elsif kind == 'wide'
+  # each variable is found among WIDTH others (and the variables of the
+  # loop)
+  vars = (0...WIDTH).map { |j| "v#{j}" }
+  vars.each_slice(10) { |slice| puts "var #{slice.join(', ')};" }
+  puts "var i;"
+  vars.each { |v| puts "#{v} = 0;" }
+  puts "i = 0;"
+  puts "while (i < #{(count + WIDTH - 1) / WIDTH}) {"
+  vars.each_with_index do |v, j|
+    puts "  #{v} = #{vars[(j + WIDTH - 1) % WIDTH]} + 1;"
+  end
+  puts "  i = i + 1;"
+  puts "}"
+  puts "i * #{WIDTH};"
+else
+  # (the operands are variables, so the expression can't be folded, and
+  # the operators cancel out, so its value doesn't grow)
+  ops = ['+ a', '- a', '* b', '/ b']
+  expr = 'i ' + (0...CHAIN_LENGTH).map { |j| ops[j % ops.size] }.join(' ')
+  puts "var i, s, n, a, b;"
+  puts "i = 0;"
+  puts "a = 3;"
+  puts "b = 2;"
+  puts "n = 0;"
+  puts "while (i < #{(count + CHAIN_LENGTH - 1) / CHAIN_LENGTH}) {"
+  puts "  s = #{expr};"
+  puts "  n = n + #{CHAIN_LENGTH};"
+  puts "  i = i + 1;"
+  puts "}"
+  puts "n;"
+end
@@ -0,0 +1,74 @@
+#! /usr/bin/env ruby
+
+# Run the interpreter benchmarks, printing the results as CSV.
+#
+# Usage: run_bench.rb <interp>
+#
+# Each benchmark script (generated by gen_script.rb) is run with the
+# tree-walking interpreter and with the VM (-b), using rss_run (from the
+# interpreter's directory) to get its run time and peak memory use.  The
+# best of RUNS run times is reported, with the operations per second, and
+# the largest peak memory use.  The number of operations of a script is
+# its result (see gen_script.rb), which must be the same with each set of
+# options.  The columns are described by the header row; times are in
+# milliseconds, and memory use in KB.
+
+require 'tmpdir'
+
+RUNS = 3
+
+# the generated scripts, and the options to run them with
+GENERATED = [
+  ['recursion', 200000, [[], ['-b']]],
+  ['loop', 5000000, [[], ['-b']]],
+  ['wide', 10000000, [[], ['-b']]],
+  ['chain', 20000000, [[], ['-b']]],
+]
+
+interp = ARGV[0]
+if interp.nil?
+  STDERR.puts "Usage: run_bench.rb <interp>"
+  exit 1
+end
+interp = File.expand_path(interp)
+bench_dir = File.dirname(File.expand_path(__FILE__))
+commit = `git -C #{bench_dir} rev-parse --short HEAD 2>/dev/null`.strip
+rss_run = File.join(File.dirname(interp), 'rss_run')
+abort "#{rss_run} not found (run make)" if !File.executable?(rss_run)
+
+Dir.mktmpdir('bench') do |tmp|
+  puts ['commit', 'script', 'options', 'ops', 'run_ms', 'ops_per_sec', 'peak_rss_kb'].join(',')
+
+  GENERATED.each do |kind, count, option_sets|
+    name = "#{kind}#{count}"
+    src = File.join(tmp, name + '.in')
+    system(File.join(bench_dir, 'gen_script.rb'), kind, count.to_s, out: src) or abort "Could not generate #{name}"
+
+    ops = nil
+    option_sets.each do |opts|
+      output = File.join(tmp, 'output.txt')
+      report = File.join(tmp, 'report.csv')
+      run_ms = nil
+      peak_rss = 0
+      RUNS.times do
+        ok = system(rss_run, report, interp, *opts, src, out: output, err: output)
+        abort "#{name} #{opts.join(' ')}: failed\n#{File.read(output)}" if !ok
+        header, values = File.readlines(report).map { |line| line.chomp.split(',') }
+        row = header.zip(values).to_h
+        run_ms = row['run_ms'].to_f if run_ms.nil? || row['run_ms'].to_f < run_ms
+        peak_rss = [peak_rss, row['peak_rss_kb'].to_i].max
+      end
+
+      result = File.read(output)[/^Result: (-?\d+)$/, 1]
+      abort "#{name} #{opts.join(' ')}: no result" if result.nil?
+      if !ops.nil? && result.to_i != ops
+        abort "#{name}: the result with options '#{opts.join(' ')}' is #{result}, rather than #{ops}"
+      end
+      ops = result.to_i
+
+      puts [commit, name, opts.join(' '), ops, format('%.3f', run_ms),
+            format('%.0f', ops / (run_ms / 1000.0)), peak_rss].join(',')
+      STDOUT.flush
+    end
+  end
+end
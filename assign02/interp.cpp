@@ -1,6 +1,10 @@
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <tuple>
 #include <vector>
 #include <string>
 #include <map>
@@ -8,82 +12,402 @@
 #include "util.h"
 #include "node.h"
 #include "grammar_symbols.h"
+#include "simplify.h"
+#include "purity.h"
+#include "intrinsics.h"
 #include "interp.h"
 
 ////////////////////////////////////////////////////////////////////////
 // Interp class
 ////////////////////////////////////////////////////////////////////////
 
+// The layout of the environment of a function (or of the top level), in
+// which each variable which may be defined has a slot.  (Since a function's
+// enclosing environment is that of its caller, a variable's depth can't be
+// known before execution, but the slot a name has in each scope can.)
+struct Scope {
+    std::vector<int> slots; // the slot of each name, or -1 if it has none
+    int num_slots;
+
+    Scope() : num_slots(0) { }
+};
+
+// a variable of an environment (which is only defined once its
+// declaration is executed)
+struct Variable {
+    bool defined;
+    Value val;
+
+    Variable() : defined(false) { }
+};
+
+// The environment of a call, whose variables are a frame pushed onto a
+// stack of variables shared by all of the calls, and popped when the
+// environment is destroyed (so environments must be destroyed in the
+// reverse order of their creation).  The frame is accessed by index,
+// since the stack may be reallocated as it grows.
+// (each function refers to the names as identifier nodes, whose ival is
+// the index of the name)
 struct Environment {
-    std::map<std::string, Value> vars;
+    const Scope *scope;
+    std::vector<Variable> *stack;
+    size_t base;    // the index of the frame in the stack
     struct Environment *parent;
 
 public:
-    Environment();
+    Environment(const Scope *scope, std::vector<Variable> *stack, Environment *parent);
     ~Environment();
-    void init_val(const char* name);
-    Value find_val(const char* name);
-    bool val_exists(const char*name);
-    void set_val(const char*, Value val);
-};
+    void init_val(struct Node *name);
+    Value find_val(struct Node *name);
+    bool val_exists(struct Node *name);
+    void set_val(struct Node *name, Value val);
+    void reset(const Scope *new_scope);
+    void bind(int slot, Value val);
 
-Environment::Environment() {
+private:
+    Variable &get_var(struct Node *name);
+    Variable &get_slot(int slot) { return (*stack)[base + slot]; }
+};
 
+Environment::Environment(const Scope *scope, std::vector<Variable> *stack, Environment *parent)
+    : scope(scope), stack(stack), base(stack->size()), parent(parent) {
+    stack->resize(base + scope->num_slots);
 }
 
 Environment::~Environment() {
+    assert(stack->size() == base + scope->num_slots);
+    stack->resize(base);
+}
+
+Variable &Environment::get_var(struct Node *name) {
+    int slot = scope->slots[node_get_ival(name)];
+    assert(slot >= 0);
+    return get_slot(slot);
+}
+
+// replace the environment's frame (the last one pushed) with an empty
+// frame of another scope
+void Environment::reset(const Scope *new_scope) {
+    assert(stack->size() == base + scope->num_slots);
+    stack->resize(base);
+    scope = new_scope;
+    stack->resize(base + scope->num_slots);
+}
 
+// define the variable in a slot
+void Environment::bind(int slot, Value val) {
+    Variable &var = get_slot(slot);
+    var.defined = true;
+    var.val = val;
 }
 
-void Environment::init_val(const char* name) {
-    if (val_exists(name)) {
-        err_fatal("Error: Variable '%s' cannot be redefined\n", name);
+void Environment::init_val(struct Node *name) {
+    // (a variable can replace an intrinsic)
+    if (val_exists(name) && get_var(name).val.kind != VAL_INTRINSIC) {
+        err_fatal("Error: Variable '%s' cannot be redefined\n", node_get_str(name));
     }
-    vars[name] = val_create_ival(0);
+    Variable &var = get_var(name);
+    var.defined = true;
+    var.val = val_create_ival(0);
 }
 
-struct Value Environment::find_val(const char* name) {
-    std::map<std::string, Value>::const_iterator i = vars.find(name);
-    if (i == vars.end()) {
-        // did not find the value
-        if (parent == nullptr) {
-            err_fatal("Undefined variable '%s'\n", name);
+struct Value Environment::find_val(struct Node *name) {
+    for (Environment *env = this; env != nullptr; env = env->parent) {
+        int slot = env->scope->slots[node_get_ival(name)];
+        if (slot >= 0 && env->get_slot(slot).defined) {
+            return env->get_slot(slot).val;
         }
-        return parent->find_val(name);
     }
-    return i->second;
+    err_fatal("Undefined variable '%s'\n", node_get_str(name));
+    return val_create_error();
 }
 
-bool Environment::val_exists(const char* name) {
-    std::map<std::string, Value>::const_iterator i = vars.find(name);
-    if (i == vars.end()) {
-        return false;
-    }
-    return true;
+bool Environment::val_exists(struct Node *name) {
+    int slot = scope->slots[node_get_ival(name)];
+    return slot >= 0 && get_slot(slot).defined;
 }
 
-void Environment::set_val(const char* name, Value val) {
+void Environment::set_val(struct Node *name, Value val) {
     if (val.kind == VAL_INT) {
         if (val_exists(name)) {
-            vars[name] = val;
+            get_var(name).val = val;
         } else if (parent != nullptr && parent->val_exists(name)) {
-            parent->set_val(name, val);
+            parent->get_var(name).val = val;
         } else {
-            err_fatal("Error: Variable '%s' has not been declared\n", name);
+            err_fatal("Error: Variable '%s' has not been declared\n", node_get_str(name));
         }
     } else {
-        vars[name] = val;
+        Variable &var = get_var(name);
+        var.defined = true;
+        var.val = val;
+    }
+}
+
+// Assigns an index to each name (stored in the ival of its identifier
+// nodes), and a slot in the scope of each function and the top level to
+// each variable which may be defined in it.  (The index of a function's
+// scope is stored in the ival of its definition.)
+class Resolver {
+private:
+    std::vector<Scope> &m_scopes;
+    std::map<std::string, int> m_names;
+
+public:
+    Resolver(std::vector<Scope> &scopes);
+
+    void resolve(struct Node *unit);
+    int get_global_slot(const char *name);
+
+private:
+    int get_name(const char *name);
+    void resolve_names(struct Node *n);
+    void add_slot(Scope &scope, struct Node *identifier);
+    void add_slots(Scope &scope, struct Node *statements);
+};
+
+Resolver::Resolver(std::vector<Scope> &scopes) : m_scopes(scopes) {
+}
+
+void Resolver::resolve(struct Node *unit) {
+    resolve_names(unit);
+
+    // functions can only be defined at the top level
+    int num_stmts = node_get_num_kids(unit);
+    m_scopes.assign(1, Scope());
+    for (int i = 0; i < num_stmts; i++) {
+        struct Node *statement = node_get_kid(unit, i);
+        if (node_get_tag(statement) == NODE_AST_FUNC_DEF) {
+            node_set_ival(statement, long(m_scopes.size()));
+            m_scopes.push_back(Scope());
+        }
+    }
+    for (const Intrinsic *intr = g_intrinsics; intr->name != nullptr; intr++) {
+        get_name(intr->name);
+    }
+    for (auto i = m_scopes.begin(); i != m_scopes.end(); i++) {
+        i->slots.assign(m_names.size(), -1);
+    }
+
+    // the intrinsics are defined in the global environment
+    for (const Intrinsic *intr = g_intrinsics; intr->name != nullptr; intr++) {
+        int &slot = m_scopes[0].slots[get_name(intr->name)];
+        if (slot < 0) {
+            slot = m_scopes[0].num_slots++;
+        }
+    }
+    add_slots(m_scopes[0], unit);
+    for (int i = 0; i < num_stmts; i++) {
+        struct Node *statement = node_get_kid(unit, i);
+        if (node_get_tag(statement) == NODE_AST_FUNC_DEF) {
+            Scope &scope = m_scopes[node_get_ival(statement)];
+            struct Node *params = node_get_kid(statement, 1);
+            for (int j = 0; j < node_get_num_kids(params); j++) {
+                add_slot(scope, node_get_kid(params, j));
+            }
+            add_slots(scope, node_get_kid(statement, 2));
+        }
+    }
+}
+
+// the slot of a name in the global scope (once it has been resolved)
+int Resolver::get_global_slot(const char *name) {
+    return m_scopes[0].slots[get_name(name)];
+}
+
+int Resolver::get_name(const char *name) {
+    auto i = m_names.find(name);
+    if (i != m_names.end()) {
+        return i->second;
+    }
+    int id = int(m_names.size());
+    m_names[name] = id;
+    return id;
+}
+
+void Resolver::resolve_names(struct Node *n) {
+    if (node_get_tag(n) == NODE_IDENTIFIER) {
+        node_set_ival(n, get_name(node_get_str(n)));
+    }
+    for (int i = 0; i < node_get_num_kids(n); i++) {
+        resolve_names(node_get_kid(n, i));
+    }
+}
+
+void Resolver::add_slot(Scope &scope, struct Node *identifier) {
+    int &slot = scope.slots[node_get_ival(identifier)];
+    if (slot < 0) {
+        slot = scope.num_slots++;
+    }
+}
+
+// add slots for the variables (and functions) which may be defined by
+// a list of statements, including those in IF and WHILE statements
+void Resolver::add_slots(Scope &scope, struct Node *statements) {
+    int num_stmts = node_get_num_kids(statements);
+    for (int i = 0; i < num_stmts; i++) {
+        struct Node *statement = node_get_kid(statements, i);
+        int tag = node_get_tag(statement);
+        if (tag == NODE_AST_VAR_DEC) {
+            for (int j = 0; j < node_get_num_kids(statement); j++) {
+                add_slot(scope, node_get_kid(statement, j));
+            }
+        } else if (tag == NODE_AST_FUNC_DEF) {
+            add_slot(scope, node_get_kid(statement, 0));
+        } else if (tag == NODE_AST_IF || tag == NODE_AST_WHILE) {
+            for (int j = 1; j < node_get_num_kids(statement); j++) {
+                add_slots(scope, node_get_kid(statement, j));
+            }
+        }
+    }
+}
+
+// the results of the calls of a pure function (see purity.h) with integer
+// arguments, keyed by the values of the arguments
+struct MemoTable {
+    const char *name; // the function's name (null if it isn't pure)
+    std::map<std::vector<long>, long> results;
+    long hits, misses;
+
+    MemoTable() : name(nullptr), hits(0), misses(0) { }
+};
+
+// The profile of an execution (see Interp::set_profile): the calls of each
+// function, with the time spent in them (including and excluding the
+// functions they call), and the iterations of each WHILE loop.  A tail call
+// ends the call of the function making it, as its frame is replaced.
+class Profiler {
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct FunctionProfile {
+        const char *name;
+        long calls;
+        double inclusive_ms, exclusive_ms;
+        int depth, max_depth;
+
+        FunctionProfile() : name(nullptr), calls(0), inclusive_ms(0.0), exclusive_ms(0.0), depth(0), max_depth(0) { }
+    };
+
+    // a call being executed
+    struct Frame {
+        int scope;
+        Clock::time_point start;
+        double callee_ms; // the time spent in the functions it called
+    };
+
+    std::vector<FunctionProfile> m_functions; // (indexed by the scope of each function)
+    std::vector<Frame> m_frames;
+    // (keyed by the source position of the loop)
+    std::map<std::tuple<std::string, int, int>, long> m_loops;
+
+public:
+    void enter(struct Node *func);
+    void leave();
+    void add_iterations(struct Node *loop, long iterations);
+    void print(FILE *out);
+};
+
+// (a call is recorded when it's entered, and then when it's left, however
+// it returns)
+struct ProfiledCall {
+    Profiler *profiler;
+
+    ProfiledCall(Profiler *p, struct Node *func) : profiler(p) {
+        if (profiler != nullptr) {
+            profiler->enter(func);
+        }
+    }
+    ~ProfiledCall() {
+        if (profiler != nullptr) {
+            profiler->leave();
+        }
+    }
+};
+
+void Profiler::enter(struct Node *func) {
+    size_t scope = size_t(node_get_ival(func));
+    if (scope >= m_functions.size()) {
+        m_functions.resize(scope + 1);
+    }
+    FunctionProfile &profile = m_functions[scope];
+    profile.name = node_get_str(node_get_kid(func, 0));
+    profile.calls++;
+    profile.max_depth = std::max(profile.max_depth, ++profile.depth);
+    m_frames.push_back(Frame{ int(scope), Clock::now(), 0.0 });
+}
+
+void Profiler::leave() {
+    Frame frame = m_frames.back();
+    m_frames.pop_back();
+    double elapsed_ms = std::chrono::duration<double, std::milli>(Clock::now() - frame.start).count();
+    FunctionProfile &profile = m_functions[frame.scope];
+    profile.exclusive_ms += elapsed_ms - frame.callee_ms;
+    // (the time of a recursive call is already included in the outermost call)
+    if (--profile.depth == 0) {
+        profile.inclusive_ms += elapsed_ms;
+    }
+    if (!m_frames.empty()) {
+        m_frames.back().callee_ms += elapsed_ms;
+    }
+}
+
+void Profiler::add_iterations(struct Node *loop, long iterations) {
+    struct SourceInfo info = node_get_source_info(loop);
+    m_loops[std::make_tuple(std::string(info.filename), info.line, info.col)] += iterations;
+}
+
+// print the functions in decreasing order of the time spent in them
+// (excluding their callees), and the loops in decreasing order of their
+// iterations
+void Profiler::print(FILE *out) {
+    std::vector<const FunctionProfile *> functions;
+    for (auto i = m_functions.begin(); i != m_functions.end(); i++) {
+        if (i->calls > 0) {
+            functions.push_back(&*i);
+        }
+    }
+    std::stable_sort(functions.begin(), functions.end(), [](const FunctionProfile *a, const FunctionProfile *b) {
+        return a->exclusive_ms > b->exclusive_ms;
+    });
+    fprintf(out, "%-24s %12s %12s %12s %9s\n", "function", "calls", "incl (ms)", "excl (ms)", "max depth");
+    for (auto i = functions.begin(); i != functions.end(); i++) {
+        fprintf(out, "%-24s %12ld %12.3f %12.3f %9d\n",
+                (*i)->name, (*i)->calls, (*i)->inclusive_ms, (*i)->exclusive_ms, (*i)->max_depth);
+    }
+
+    std::vector<std::pair<long, std::string>> loops;
+    for (auto i = m_loops.begin(); i != m_loops.end(); i++) {
+        loops.push_back(std::make_pair(i->second, cpputil::format("%s:%d:%d", std::get<0>(i->first).c_str(),
+                                                                  std::get<1>(i->first), std::get<2>(i->first))));
+    }
+    std::stable_sort(loops.begin(), loops.end(), [](const std::pair<long, std::string> &a,
+                                                    const std::pair<long, std::string> &b) {
+        return a.first > b.first;
+    });
+    fprintf(out, "%-38s %12s\n", "loop", "iterations");
+    for (auto i = loops.begin(); i != loops.end(); i++) {
+        fprintf(out, "%-38s %12ld\n", i->second.c_str(), i->first);
     }
 }
 
 struct Interp {
 private:
   struct Node *m_tree;
+  std::vector<Scope> m_scopes; // the top level, followed by the functions
+  std::vector<Variable> m_stack; // the frames of the environments
+  std::vector<Value> m_args; // the arguments of the intrinsic calls being evaluated
+  long m_memo_max_entries; // the size of each MemoTable (0 if calls aren't memoized)
+  std::vector<MemoTable> m_memos; // (indexed by the scope of each function)
+  std::unique_ptr<Profiler> m_profiler; // (null if the execution isn't profiled)
 
 public:
   Interp(struct Node *t);
   ~Interp();
 
+  void set_memoize(long max_entries);
+  void print_memo_stats(FILE *out);
+  void set_profile();
+  void print_profile(FILE *out);
   struct Value exec();
 
 private:
@@ -91,24 +415,71 @@ private:
   struct Value eval_all(struct Node *statements, Environment *env);
   struct Value eval_st(struct Node *statement, Environment *env);
   struct Value eval_fn(struct Function *fn, struct Node *args, Environment *parent);
+  struct Value eval_body(struct Function *fn, Environment &local);
+  struct Value eval_intrinsic(IntrinsicFunction *fn, struct Node *args, Environment *env);
   bool val_is_truthy(Value val);
 };
 
-Interp::Interp(struct Node *t) : m_tree(t) {
+Interp::Interp(struct Node *t) : m_tree(t), m_memo_max_entries(0) {
 }
 
 Interp::~Interp() {
 }
 
+// memoize the calls of the pure functions whose arguments and result are
+// integers, keeping the results of up to max_entries calls of each function
+void Interp::set_memoize(long max_entries) {
+    m_memo_max_entries = max_entries;
+}
+
+// profile the execution (see Profiler)
+void Interp::set_profile() {
+    m_profiler.reset(new Profiler());
+}
+
+void Interp::print_profile(FILE *out) {
+    if (m_profiler) {
+        m_profiler->print(out);
+    }
+}
+
+void Interp::print_memo_stats(FILE *out) {
+    for (auto i = m_memos.begin(); i != m_memos.end(); i++) {
+        if (i->name != nullptr) {
+            fprintf(out, "memo %s: %ld hits, %ld misses, %lu entries\n",
+                    i->name, i->hits, i->misses, (unsigned long) i->results.size());
+        }
+    }
+}
+
 struct Value Interp::exec() {
     struct Value result = val_create_void();
     struct Node *unit = m_tree;
-    struct Environment *global = env_create(nullptr);
+
+    ast_simplify(unit);
+    Resolver resolver(m_scopes);
+    resolver.resolve(unit);
+    if (m_memo_max_entries > 0) {
+        ast_mark_pure_functions(unit);
+        m_memos.assign(m_scopes.size(), MemoTable());
+        for (int i = 0; i < node_get_num_kids(unit); i++) {
+            struct Node *statement = node_get_kid(unit, i);
+            if (node_get_tag(statement) == NODE_AST_FUNC_DEF && node_get_ival(node_get_kid(statement, 1)) != 0) {
+                m_memos[node_get_ival(statement)].name = node_get_str(node_get_kid(statement, 0));
+            }
+        }
+    }
+    m_stack.clear();
+    m_stack.reserve(1024);
+    struct Environment global(&m_scopes[0], &m_stack, nullptr);
+    for (const Intrinsic *intr = g_intrinsics; intr->name != nullptr; intr++) {
+        global.bind(resolver.get_global_slot(intr->name), val_create_intrinsic(intr->fn));
+    }
 
     // evaluation of statements or functions should go on stack
     // previous values may affect later values
 
-    result = eval_all(unit, global);
+    result = eval_all(unit, &global);
     return result;
 }
 
@@ -132,41 +503,148 @@ bool Interp::val_is_truthy(Value val) {
     if (val.kind == VAL_FN) {
         return true;
     }
-    return val.ival >= 1;
+    return val_get_ival(val) >= 1;
+}
+
+// check the number of arguments of a call
+static void check_num_args(struct Function *fn, struct Node *args) {
+    struct Node* func = fn->ast;
+    if (node_get_num_kids(node_get_kid(func, 1)) != node_get_num_kids(args)) {
+        const char* func_name = node_get_str(node_get_kid(func, 0));
+        err_fatal("Error: Invalid number of arguments for function '%s'\n", func_name);
+    }
 }
 
 struct Value Interp::eval_fn(struct Function *fn, struct Node* args, Environment *parent) {
-    struct Value result = val_create_void();
     struct Node* func = fn->ast;
-    struct Environment* local = env_create(parent);
+    ProfiledCall profiled(m_profiler.get(), func);
+    struct Environment local(&m_scopes[node_get_ival(func)], &m_stack, parent);
 
-    const char* func_name = node_get_str(node_get_kid(func, 0));
     struct Node *expected_args = node_get_kid(func, 1);
-    struct Node *statements = node_get_kid(func, 2);
-
     int num_args = node_get_num_kids(expected_args);
-    int num_actual = node_get_num_kids(args);
 
     // check number of args
-    if (num_args != num_actual) {
-        err_fatal("Error: Invalid number of arguments for function '%s'\n", func_name);
+    check_num_args(fn, args);
+
+    // (the calls of a pure function are memoized if its arguments are
+    // integers, see set_memoize)
+    MemoTable *memo = nullptr;
+    if (!m_memos.empty() && m_memos[node_get_ival(func)].name != nullptr) {
+        memo = &m_memos[node_get_ival(func)];
     }
+    std::vector<long> key;
 
     int index = 0;
     while (index < num_args) {
         struct Node* arg = node_get_kid(expected_args, index);
-        const char* name = node_get_str(arg);
 
         struct Node *real = node_get_kid(args, index);
 
-        local->init_val(name);
-        local->set_val(name, eval_st(real, parent));
+        local.init_val(arg);
+        Value val = eval_st(real, parent);
+        local.set_val(arg, val);
+        if (memo != nullptr) {
+            if (val.kind == VAL_INT) {
+                key.push_back(val.ival);
+            } else {
+                memo = nullptr;
+            }
+        }
 
         index++;
     }
 
-    result = eval_all(statements, local);
+    if (memo == nullptr) {
+        return eval_body(fn, local);
+    }
+    auto found = memo->results.find(key);
+    if (found != memo->results.end()) {
+        memo->hits++;
+        return val_create_ival(found->second);
+    }
+    memo->misses++;
+    Value result = eval_body(fn, local);
+    if (result.kind == VAL_INT && long(memo->results.size()) < m_memo_max_entries) {
+        memo->results[key] = result.ival;
+    }
+    return result;
+}
+
+// execute the body of a function called with its arguments bound in local
+struct Value Interp::eval_body(struct Function *fn, Environment &local) {
+    struct Node *args, *expected_args;
+    int num_args;
+
+    // each tail call replaces the function being executed (and its
+    // environment), rather than being evaluated recursively
+    for (;;) {
+        struct Node *statements = node_get_kid(fn->ast, 2);
+        int num_stmts = node_get_num_kids(statements);
+        if (num_stmts == 0) {
+            return val_create_void();
+        }
+        for (int i = 0; i < num_stmts - 1; i++) {
+            eval_st(node_get_kid(statements, i), &local);
+        }
+
+        struct Node *last = node_get_kid(statements, num_stmts - 1);
+        if (node_get_tag(last) != NODE_AST_FUNC_CALL || node_get_ival(last) == 0) {
+            return eval_st(last, &local);
+        }
+
+        Value callee = local.find_val(node_get_kid(last, 0));
+        if (callee.kind != VAL_FN) {
+            // (it is an intrinsic, or can't be called)
+            return eval_st(last, &local);
+        }
+        struct Node *callee_statements = node_get_kid(callee.fn->ast, 2);
+        if (node_get_ival(callee_statements) != 0) {
+            // (the callee assigns variables of its caller)
+            return eval_fn(callee.fn, node_get_kid(last, 1), &local);
+        }
 
+        // evaluate the arguments (in this environment) as eval_fn would
+        args = node_get_kid(last, 1);
+        check_num_args(callee.fn, args);
+        expected_args = node_get_kid(callee.fn->ast, 1);
+        num_args = node_get_num_kids(expected_args);
+        std::vector<Value> vals;
+        for (int i = 0; i < num_args; i++) {
+            struct Node *arg = node_get_kid(expected_args, i);
+            for (int j = 0; j < i; j++) {
+                if (node_get_ival(node_get_kid(expected_args, j)) == node_get_ival(arg)) {
+                    err_fatal("Error: Variable '%s' cannot be redefined\n", node_get_str(arg));
+                }
+            }
+            vals.push_back(eval_st(node_get_kid(args, i), &local));
+        }
+
+        fn = callee.fn;
+        if (m_profiler) {
+            m_profiler->leave();
+            m_profiler->enter(fn->ast);
+        }
+        local.reset(&m_scopes[node_get_ival(fn->ast)]);
+        for (int i = 0; i < num_args; i++) {
+            struct Node *arg = node_get_kid(expected_args, i);
+            local.init_val(arg);
+            local.set_val(arg, vals[i]);
+        }
+    }
+}
+
+struct Value Interp::eval_intrinsic(IntrinsicFunction *fn, struct Node *args, Environment *env) {
+    // (the arguments are evaluated in the same order as for a function,
+    // which is the reverse of the order they're written)
+    int num_args = node_get_num_kids(args);
+    size_t base = m_args.size();
+    m_args.resize(base + num_args);
+    for (int i = 0; i < num_args; i++) {
+        Value val = eval_st(node_get_kid(args, i), env);
+        m_args[base + num_args - 1 - i] = val;
+    }
+    Value result = fn(m_args.data() + base, num_args, this);
+    m_args.resize(base);
     return result;
 }
 
@@ -174,12 +652,11 @@ struct Value Interp::eval_st(struct Node *statement, Environment *env) {
     int tag = node_get_tag(statement);
 
     if (tag == NODE_INT_LITERAL) {
-        return val_create_ival(strtol(node_get_str(statement), nullptr, 10));
+        return val_create_ival(node_get_ival(statement));
     }
 
     if (tag == NODE_IDENTIFIER) {
-        const char* name = node_get_str(statement);
-        return env->find_val(name);
+        return env->find_val(statement);
     }
 
     if (tag == NODE_AST_VAR_DEC) {
@@ -187,8 +664,7 @@ struct Value Interp::eval_st(struct Node *statement, Environment *env) {
         int index = 0;
         while (index < num_kids) {
             struct Node *var = node_get_kid(statement, index);
-            const char* name = node_get_str(var);
-            env->init_val(name); // for all declared variables, assign to 0;
+            env->init_val(var); // for all declared variables, assign to 0;
             index++;
         }
         return val_create_void();
@@ -217,29 +693,37 @@ struct Value Interp::eval_st(struct Node *statement, Environment *env) {
         struct Node *condition = node_get_kid(statement, 0);
         struct Node *while_clause= node_get_kid(statement, 1);
 
+        long iterations = 0;
         while (val_is_truthy(eval_st(condition, env))) {
             eval_all(while_clause, env);
+            iterations++;
+        }
+        if (m_profiler) {
+            m_profiler->add_iterations(statement, iterations);
         }
 
         return val_create_void();
     }
 
     if (tag == NODE_AST_FUNC_DEF) {
-        Function func = function_create(statement);
-        Value function = val_create_fn(&func);
-        const char* func_name = node_get_str(node_get_kid(statement, 0));
-        env->set_val(func_name, function);
+        // (the Function must outlive this call, since the value refers to it)
+        Function *func = new Function(function_create(statement));
+        Value function = val_create_fn(func);
+        env->set_val(node_get_kid(statement, 0), function);
         return val_create_void();
     }
 
     if (tag == NODE_AST_FUNC_CALL) {
         struct Node *function = node_get_kid(statement, 0);
         const char *func_name = node_get_str(function);
-        Value func = env->find_val(func_name);
+        Value func = env->find_val(function);
+        struct Node* args = node_get_kid(statement, 1);
+        if (func.kind == VAL_INTRINSIC) {
+            return eval_intrinsic(func.intrinsic_fn, args, env);
+        }
         if (func.kind != VAL_FN) {
             err_fatal("Error: Cannot call '%s' because it isn’t a function\n", func_name);
         }
-        struct Node* args = node_get_kid(statement, 1);
         return eval_fn(func.fn, args, env);
     }
 
@@ -254,7 +738,7 @@ struct Value Interp::eval_st(struct Node *statement, Environment *env) {
             err_fatal("Error: Cannot assign non-int value to variable '%s'\n", varname);
         }
 
-        env->set_val(varname, val);
+        env->set_val(left, val);
 
         // Feels like assignment should be a VAL_VOID type
         // public test function01.in says otherwise though
@@ -262,58 +746,48 @@ struct Value Interp::eval_st(struct Node *statement, Environment *env) {
         return val;
     }
 
+    if (tag == NODE_AST_AND) {
+        if (val_is_truthy(eval_st(left, env)) && val_is_truthy(eval_st(right, env))) {
+            return val_create_true();
+        }
+        return val_create_false();
+    }
+
+    if (tag == NODE_AST_OR) {
+        if (val_is_truthy(eval_st(left, env)) || val_is_truthy(eval_st(right, env))) {
+            return val_create_true();
+        }
+        return val_create_false();
+    }
+
+    // each operand is evaluated once, left to right
+    long lhs = val_get_ival(eval_st(left, env));
+    long rhs = val_get_ival(eval_st(right, env));
+
     switch (tag) {
         case NODE_AST_PLUS:
-            return val_create_ival(eval_st(left, env).ival + eval_st(right, env).ival);
+            return val_create_ival(lhs + rhs);
         case NODE_AST_MINUS:
-            return val_create_ival(eval_st(left, env).ival - eval_st(right, env).ival);
+            return val_create_ival(lhs - rhs);
         case NODE_AST_TIMES:
-            return val_create_ival(eval_st(left, env).ival * eval_st(right, env).ival);
+            return val_create_ival(lhs * rhs);
         case NODE_AST_DIVIDE:
-            if (eval_st(right, env).ival == 0) {
+            if (rhs == 0) {
                 err_fatal("Error: Cannot divide by 0\n");
             }
-            return val_create_ival(eval_st(left, env).ival / eval_st(right, env).ival);
-        case NODE_AST_AND:
-            if (val_is_truthy(eval_st(left, env)) && val_is_truthy(eval_st(right, env))) {
-                return val_create_true();
-            }
-            return val_create_false();
-        case NODE_AST_OR:
-            if (val_is_truthy(eval_st(left, env)) || val_is_truthy(eval_st(right, env))) {
-                return val_create_true();
-            }
-            return val_create_false();
+            return val_create_ival(lhs / rhs);
         case NODE_AST_EQ:
-            if (eval_st(left, env).ival == eval_st(right, env).ival) {
-                return val_create_true();
-            }
-            return val_create_false();
+            return lhs == rhs ? val_create_true() : val_create_false();
         case NODE_AST_NE:
-            if (eval_st(left, env).ival != eval_st(right, env).ival) {
-                return val_create_true();
-            }
-            return val_create_false();
+            return lhs != rhs ? val_create_true() : val_create_false();
         case NODE_AST_LT:
-            if (eval_st(left, env).ival < eval_st(right, env).ival) {
-                return val_create_true();
-            }
-            return val_create_false();
+            return lhs < rhs ? val_create_true() : val_create_false();
         case NODE_AST_LE:
-            if (eval_st(left, env).ival <= eval_st(right, env).ival) {
-                return val_create_true();
-            }
-            return val_create_false();
+            return lhs <= rhs ? val_create_true() : val_create_false();
         case NODE_AST_GT:
-            if (eval_st(left, env).ival > eval_st(right, env).ival) {
-                return val_create_true();
-            }
-            return val_create_false();
+            return lhs > rhs ? val_create_true() : val_create_false();
         case NODE_AST_GE:
-            if (eval_st(left, env).ival >= eval_st(right, env).ival) {
-                return val_create_true();
-            }
-            return val_create_false();
+            return lhs >= rhs ? val_create_true() : val_create_false();
         default:
             err_fatal("Unknown operator: %d\n", tag);
             return val_create_error();
@@ -333,12 +807,22 @@ void interp_destroy(struct Interp *interp) {
     delete interp;
 }
 
+void interp_set_memoize(struct Interp *interp, long max_entries) {
+    interp->set_memoize(max_entries);
+}
+
+void interp_print_memo_stats(struct Interp *interp, FILE *out) {
+    interp->print_memo_stats(out);
+}
+
+void interp_set_profile(struct Interp *interp) {
+    interp->set_profile();
+}
+
+void interp_print_profile(struct Interp *interp, FILE *out) {
+    interp->print_profile(out);
+}
+
 struct Value interp_exec(struct Interp *interp) {
     return interp->exec();
 }
-
-struct Environment *env_create(struct Environment *parent) {
-    Environment *env = new Environment();
-    env->parent = parent;
-    return env;
-}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef INTERP_H
 #define INTERP_H
 
+#include <stdio.h>
 #include "value.h"
 
 #ifdef __cplusplus
@@ -9,7 +10,6 @@ extern "C" {
 
 struct Node;
 struct Interp;
-struct Environment;
 
 // create an interpreter from a parse tree
 struct Interp *interp_create(struct Node *t);
@@ -17,11 +17,32 @@ struct Interp *interp_create(struct Node *t);
 // destroy interpreter
 void interp_destroy(struct Interp *interp);
 
+// the number of results of calls kept for each function by default, when
+// they are memoized
+#define INTERP_DEFAULT_MEMO_ENTRIES 65536
+
+// memoize the calls of the pure functions (see purity.h) whose arguments and
+// results are integers, keeping the results of up to max_entries calls of
+// each function (no calls are memoized unless this is called)
+void interp_set_memoize(struct Interp *interp, long max_entries);
+
+// print the number of calls of each pure function whose results were found
+// (hits) and computed (misses), and the number of results kept
+void interp_print_memo_stats(struct Interp *interp, FILE *out);
+
+// profile the execution: count the calls of each function, with the time
+// spent in them and their deepest recursion, and the iterations of each
+// WHILE loop
+void interp_set_profile(struct Interp *interp);
+
+// print the profile, with the functions in decreasing order of the time
+// spent in them (excluding the functions they call), and the loops in
+// decreasing order of their iterations
+void interp_print_profile(struct Interp *interp, FILE *out);
+
 // execute interpreter
 struct Value interp_exec(struct Interp *interp);
 
-struct Environment *env_create(struct Environment *parent);
-
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "util.h"
+#include "intrinsics.h"
+
+// (the interp argument is a null pointer when an intrinsic is called
+// by the VM, so none of them use it)
+
+static void check_num_args(const char *name, int num_args, int expected) {
+  if (num_args != expected) {
+    err_fatal("Error: Invalid number of arguments for function '%s'\n", name);
+  }
+}
+
+// print(x): print the value of x, on a line of its own
+static struct Value intrinsic_print(struct Value *args, int num_args, struct Interp *interp) {
+  (void) interp;
+  check_num_args("print", num_args, 1);
+  char *s = val_stringify(args[0]);
+  printf("%s\n", s);
+  free(s);
+  return val_create_void();
+}
+
+// abs(x): the absolute value of x
+static struct Value intrinsic_abs(struct Value *args, int num_args, struct Interp *interp) {
+  (void) interp;
+  check_num_args("abs", num_args, 1);
+  long x = val_get_ival(args[0]);
+  return val_create_ival(x < 0 ? -x : x);
+}
+
+// max(x, y): the greater of x and y
+static struct Value intrinsic_max(struct Value *args, int num_args, struct Interp *interp) {
+  (void) interp;
+  check_num_args("max", num_args, 2);
+  long x = val_get_ival(args[0]), y = val_get_ival(args[1]);
+  return val_create_ival(x > y ? x : y);
+}
+
+// min(x, y): the lesser of x and y
+static struct Value intrinsic_min(struct Value *args, int num_args, struct Interp *interp) {
+  (void) interp;
+  check_num_args("min", num_args, 2);
+  long x = val_get_ival(args[0]), y = val_get_ival(args[1]);
+  return val_create_ival(x < y ? x : y);
+}
+
+const struct Intrinsic g_intrinsics[] = {
+  { "print", intrinsic_print },
+  { "abs", intrinsic_abs },
+  { "max", intrinsic_max },
+  { "min", intrinsic_min },
+  { NULL, NULL },
+};
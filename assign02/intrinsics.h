@@ -0,0 +1,25 @@
+#ifndef INTRINSICS_H
+#define INTRINSICS_H
+
+#include "value.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+// A native function, which is bound to its name in the global environment
+// before a program is executed.  It is called with the values of its
+// arguments (in the order they are written), without an environment.
+struct Intrinsic {
+  const char *name;
+  IntrinsicFunction *fn;
+};
+
+// the intrinsics (terminated by an entry whose name is a null pointer)
+extern const struct Intrinsic g_intrinsics[];
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // INTRINSICS_H
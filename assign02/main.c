@@ -6,6 +6,8 @@
 #include "grammar_symbols.h"
 #include "treeprint.h"
 #include "interp.h"
+#include "vm.h"
+#include "ast_cache.h"
 
 int yyparse(void);
 
@@ -16,6 +18,13 @@ void print_usage(void) {
     "Usage: interp [options] <filename>\n"
     "Options:\n"
     "   -p    print parse tree\n"
+    "   -b    execute with the bytecode VM (instead of the tree-walking interpreter)\n"
+    "   -m    memoize the calls of pure functions with integer arguments (not with\n"
+    "         -b), printing the hits and misses of each function's results to stderr\n"
+    "   -c    load the parse tree from the script's snapshot (<filename>.ast) if it\n"
+    "         matches the script, and otherwise parse the script and write it\n"
+    "   -P    profile the execution (not with -b), printing the calls, time and deepest\n"
+    "         recursion of each function and the iterations of each loop to stderr\n"
   );
 }
 
@@ -24,42 +33,101 @@ int main(int argc, char **argv) {
   extern struct Node *g_translation_unit;
 
   int print_parse_tree = 0;
+  int use_vm = 0;
+  int memoize = 0;
+  int profile = 0;
+  int use_snapshot = 0;
   int opt;
 
-  while ((opt = getopt(argc, argv, "p")) != -1) {
+  while ((opt = getopt(argc, argv, "pbmPc")) != -1) {
     switch (opt) {
     case 'p':
       print_parse_tree = 1;
       break;
 
+    case 'b':
+      use_vm = 1;
+      break;
+
+    case 'm':
+      memoize = 1;
+      break;
+
+    case 'P':
+      profile = 1;
+      break;
+
+    case 'c':
+      use_snapshot = 1;
+      break;
+
     case '?':
       print_usage();
     }
   }
 
-  if (optind >= argc) {
+  if (optind >= argc || (use_vm && (memoize || profile))) {
     print_usage();
   }
 
   const char *filename = argv[optind];
 
-  yyin = fopen(filename, "r");
-  if (!yyin) {
-    err_fatal("Could not open input file \"%s\"\n", filename);
+  // (with -c, the script is only lexed and parsed if its snapshot is
+  // missing or out of date)
+  struct Node *tree = NULL;
+  char *snapshot = NULL;
+  uint64_t hash = 0;
+  if (use_snapshot) {
+    snapshot = ast_cache_get_filename(filename);
+    hash = ast_cache_hash_script(filename);
+    if (hash != 0) {
+      tree = ast_cache_load(snapshot, hash, filename);
+    }
   }
-  lexer_set_source_file(filename);
 
-  yyparse();
+  if (!tree) {
+    yyin = fopen(filename, "r");
+    if (!yyin) {
+      err_fatal("Could not open input file \"%s\"\n", filename);
+    }
+    lexer_set_source_file(filename);
+
+    yyparse();
+    tree = g_translation_unit;
+    if (hash != 0) {
+      ast_cache_save(snapshot, hash, tree);
+    }
+  }
+  free(snapshot);
 
   if (print_parse_tree) {
-    treeprint(g_translation_unit, get_grammar_symbol_name);
+    treeprint(tree, get_grammar_symbol_name);
   } else {
-    struct Interp *interp = interp_create(g_translation_unit);
-    struct Value val = interp_exec(interp);
+    struct Value val;
+    if (use_vm) {
+      struct VM *vm = vm_create(tree);
+      val = vm_exec(vm);
+      vm_destroy(vm);
+    } else {
+      struct Interp *interp = interp_create(tree);
+      if (memoize) {
+        interp_set_memoize(interp, INTERP_DEFAULT_MEMO_ENTRIES);
+      }
+      if (profile) {
+        interp_set_profile(interp);
+      }
+      val = interp_exec(interp);
+      if (memoize) {
+        interp_print_memo_stats(interp, stderr);
+      }
+      if (profile) {
+        interp_print_profile(interp, stderr);
+      }
+      interp_destroy(interp);
+    }
     char *result_as_str = val_stringify(val);
     printf("Result: %s\n", result_as_str);
     free(result_as_str);
-    interp_destroy(interp);
   }
 
   return 0;
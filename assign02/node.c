@@ -186,6 +186,12 @@ struct Node *node_get_kid(struct Node *n, int index) {
   return n->kids[index];
 }
 
+void node_set_kid(struct Node *n, int index, struct Node *kid) {
+  assert(index >= 0);
+  assert(index < n->num_kids);
+  n->kids[index] = kid;
+}
+
 int node_first_kid_has_tag(struct Node *n, int tag) {
   return n->num_kids > 0 && n->kids[0]->tag == tag;
 }
@@ -73,6 +73,9 @@ void node_add_kid(struct Node *n, struct Node *kid);
 
 // Get a child Node (index 0 is the first child.)
 struct Node *node_get_kid(struct Node *n, int index);
+
+// Replace a child Node (the previous child isn't destroyed.)
+void node_set_kid(struct Node *n, int index, struct Node *kid);
 int node_first_kid_has_tag(struct Node *n, int tag);
 
 // Set the SourceInfo for a Node.
@@ -125,7 +125,7 @@ statement
     ;
 
 var_dec_statement
-    : KW_VAR identifier_list { $$ = $2 }
+    : KW_VAR identifier_list { $$ = $2; }
     ;
 
 identifier_list
@@ -139,7 +139,7 @@ if_statement
     ;
 
 while_statement
-    : KW_WHILE LPAREN expression RPAREN LBRACE opt_statement_list RBRACE { $$ = node_build2(NODE_AST_WHILE, $3, $6); }
+    : KW_WHILE LPAREN expression RPAREN LBRACE opt_statement_list RBRACE { $$ = node_build2(NODE_AST_WHILE, $3, $6); node_set_source_info($$, node_get_source_info($1)); }
     ;
 
 opt_statement_list
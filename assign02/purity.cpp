@@ -0,0 +1,144 @@
+#include <map>
+#include <set>
+#include <string>
+#include "node.h"
+#include "grammar_symbols.h"
+#include "purity.h"
+
+namespace {
+
+// the intrinsics which have no effects
+const char *const PURE_INTRINSICS[] = { "abs", "max", "min", nullptr };
+
+bool is_pure_intrinsic(const std::string &name) {
+    for (const char *const *intr = PURE_INTRINSICS; *intr != nullptr; intr++) {
+        if (name == *intr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// count the times each name is bound anywhere in a subtree: as the name of
+// a function, a variable declared, a parameter, or a variable assigned
+void count_bindings(struct Node *n, std::map<std::string, int> &bindings) {
+    int tag = node_get_tag(n);
+    if (tag == NODE_AST_FUNC_DEF) {
+        bindings[node_get_str(node_get_kid(n, 0))]++;
+        struct Node *params = node_get_kid(n, 1);
+        for (int i = 0; i < node_get_num_kids(params); i++) {
+            bindings[node_get_str(node_get_kid(params, i))]++;
+        }
+        count_bindings(node_get_kid(n, 2), bindings);
+        return;
+    }
+    if (tag == NODE_AST_VAR_DEC) {
+        for (int i = 0; i < node_get_num_kids(n); i++) {
+            bindings[node_get_str(node_get_kid(n, i))]++;
+        }
+        return;
+    }
+    if (tag == NODE_AST_ASSIGN) {
+        bindings[node_get_str(node_get_kid(n, 0))]++;
+    }
+    for (int i = 0; i < node_get_num_kids(n); i++) {
+        count_bindings(node_get_kid(n, i), bindings);
+    }
+}
+
+// check that a statement of a function only reads and assigns the names
+// defined, adding the names of the functions it calls to callees
+bool refers_to_defined(struct Node *n, const std::set<std::string> &defined, std::set<std::string> &callees) {
+    int tag = node_get_tag(n);
+    if (tag == NODE_IDENTIFIER) {
+        return defined.count(node_get_str(n)) > 0;
+    }
+    if (tag == NODE_AST_VAR_DEC) {
+        // (in an IF or WHILE: the variables are local, but not defined
+        // for the statements after it)
+        return true;
+    }
+    if (tag == NODE_AST_FUNC_CALL) {
+        callees.insert(node_get_str(node_get_kid(n, 0)));
+        return refers_to_defined(node_get_kid(n, 1), defined, callees);
+    }
+    for (int i = 0; i < node_get_num_kids(n); i++) {
+        if (!refers_to_defined(node_get_kid(n, i), defined, callees)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// check that a function only refers to its own variables (other than the
+// functions it calls, which are added to callees)
+bool refers_to_locals(struct Node *func, std::set<std::string> &callees) {
+    std::set<std::string> defined;
+    struct Node *params = node_get_kid(func, 1);
+    for (int i = 0; i < node_get_num_kids(params); i++) {
+        defined.insert(node_get_str(node_get_kid(params, i)));
+    }
+    struct Node *statements = node_get_kid(func, 2);
+    for (int i = 0; i < node_get_num_kids(statements); i++) {
+        struct Node *statement = node_get_kid(statements, i);
+        if (node_get_tag(statement) == NODE_AST_VAR_DEC) {
+            for (int j = 0; j < node_get_num_kids(statement); j++) {
+                defined.insert(node_get_str(node_get_kid(statement, j)));
+            }
+        } else if (!refers_to_defined(statement, defined, callees)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+void ast_mark_pure_functions(struct Node *t) {
+    std::map<std::string, int> bindings;
+    count_bindings(t, bindings);
+
+    // the functions which may be pure (those defined once, whose names
+    // aren't bound to anything else), and the functions each one calls
+    std::map<std::string, std::set<std::string>> pure;
+    int num_stmts = node_get_num_kids(t);
+    for (int i = 0; i < num_stmts; i++) {
+        struct Node *statement = node_get_kid(t, i);
+        if (node_get_tag(statement) != NODE_AST_FUNC_DEF) {
+            continue;
+        }
+        node_set_ival(node_get_kid(statement, 1), 0);
+        const char *name = node_get_str(node_get_kid(statement, 0));
+        std::set<std::string> callees;
+        if (bindings[name] == 1 && refers_to_locals(statement, callees)) {
+            pure[name] = callees;
+        }
+    }
+
+    // (a function calling only pure functions is pure, including itself,
+    // so those calling functions which aren't are removed until none are)
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto i = pure.begin(); i != pure.end(); ) {
+            bool calls_impure = false;
+            for (auto j = i->second.begin(); j != i->second.end() && !calls_impure; j++) {
+                calls_impure = pure.count(*j) == 0 && !(is_pure_intrinsic(*j) && bindings.count(*j) == 0);
+            }
+            if (calls_impure) {
+                i = pure.erase(i);
+                changed = true;
+            } else {
+                i++;
+            }
+        }
+    }
+
+    for (int i = 0; i < num_stmts; i++) {
+        struct Node *statement = node_get_kid(t, i);
+        if (node_get_tag(statement) == NODE_AST_FUNC_DEF
+            && pure.count(node_get_str(node_get_kid(statement, 0))) > 0) {
+            node_set_ival(node_get_kid(statement, 1), 1);
+        }
+    }
+}
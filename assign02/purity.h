@@ -0,0 +1,30 @@
+#ifndef PURITY_H
+#define PURITY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+struct Node;
+
+// Find the pure functions of a parse tree (after ast_simplify), whose
+// result only depends on their arguments, and which have no effects, so
+// that a call with the same arguments as an earlier call can reuse its
+// result: the parameter list of each pure function has ival 1 (and 0
+// otherwise).
+//
+// Since a function's enclosing environment is its caller's, a function is
+// only pure if each name it reads or assigns is one of its parameters, or a
+// variable declared (by a statement of its body, rather than in an IF or
+// WHILE) before it's used, so it never refers to a variable of its caller.
+// Each function it calls must be either an intrinsic other than print, or
+// a pure function, and the name of the function called must not be bound
+// to anything else anywhere in the program (so a call of it always calls
+// the same function).
+void ast_mark_pure_functions(struct Node *t);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // PURITY_H
@@ -0,0 +1,176 @@
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+#include "cpputil.h"
+#include "node.h"
+#include "grammar_symbols.h"
+#include "simplify.h"
+
+namespace {
+
+bool is_literal(struct Node *n) {
+    return node_get_tag(n) == NODE_INT_LITERAL;
+}
+
+// (like Interp::val_is_truthy)
+bool is_truthy(long ival) {
+    return ival >= 1;
+}
+
+// compute the value of an operator applied to literals, returning false
+// if it can't be folded (because it isn't an operator, or would fail)
+bool fold(int tag, long left, long right, long &result) {
+    switch (tag) {
+        case NODE_AST_PLUS:  result = left + right; return true;
+        case NODE_AST_MINUS: result = left - right; return true;
+        case NODE_AST_TIMES: result = left * right; return true;
+        case NODE_AST_DIVIDE:
+            if (right == 0) {
+                return false;  // (fails when it's executed)
+            }
+            result = left / right;
+            return true;
+        case NODE_AST_AND:   result = is_truthy(left) && is_truthy(right); return true;
+        case NODE_AST_OR:    result = is_truthy(left) || is_truthy(right); return true;
+        case NODE_AST_EQ:    result = left == right; return true;
+        case NODE_AST_NE:    result = left != right; return true;
+        case NODE_AST_LT:    result = left < right; return true;
+        case NODE_AST_LE:    result = left <= right; return true;
+        case NODE_AST_GT:    result = left > right; return true;
+        case NODE_AST_GE:    result = left >= right; return true;
+        default:
+            return false;
+    }
+}
+
+// simplify a subtree, returning the node which replaces it
+struct Node *simplify(struct Node *n) {
+    if (is_literal(n)) {
+        node_set_ival(n, strtol(node_get_str(n), nullptr, 10));
+        return n;
+    }
+
+    int num_kids = node_get_num_kids(n);
+    for (int i = 0; i < num_kids; i++) {
+        struct Node *kid = node_get_kid(n, i);
+        struct Node *simplified = simplify(kid);
+        if (simplified != kid) {
+            node_set_kid(n, i, simplified);
+        }
+    }
+
+    long result;
+    if (num_kids == 2 && is_literal(node_get_kid(n, 0)) && is_literal(node_get_kid(n, 1))
+        && fold(node_get_tag(n), node_get_ival(node_get_kid(n, 0)), node_get_ival(node_get_kid(n, 1)), result)) {
+        struct Node *literal = node_alloc_str_copy(NODE_INT_LITERAL, cpputil::format("%ld", result).c_str());
+        node_set_ival(literal, result);
+        node_set_source_info(literal, node_get_source_info(n));
+        node_destroy_recursive(n);
+        return literal;
+    }
+    return n;
+}
+
+// the names a function defines (its parameters and the variables declared
+// in its body, including in IF and WHILE statements)
+void find_locals(struct Node *statements, std::set<std::string> &locals) {
+    int num_stmts = node_get_num_kids(statements);
+    for (int i = 0; i < num_stmts; i++) {
+        struct Node *statement = node_get_kid(statements, i);
+        int tag = node_get_tag(statement);
+        if (tag == NODE_AST_VAR_DEC) {
+            for (int j = 0; j < node_get_num_kids(statement); j++) {
+                locals.insert(node_get_str(node_get_kid(statement, j)));
+            }
+        } else if (tag == NODE_AST_IF || tag == NODE_AST_WHILE) {
+            for (int j = 1; j < node_get_num_kids(statement); j++) {
+                find_locals(node_get_kid(statement, j), locals);
+            }
+        }
+    }
+}
+
+// find the names a subtree of a function refers to (or assigns) which
+// the function doesn't define, returning true if it assigns one of them
+bool find_free_names(struct Node *n, const std::set<std::string> &locals, std::set<std::string> &free_names) {
+    int tag = node_get_tag(n);
+    if (tag == NODE_IDENTIFIER) {
+        if (locals.count(node_get_str(n)) == 0) {
+            free_names.insert(node_get_str(n));
+        }
+        return false;
+    }
+    if (tag == NODE_AST_VAR_DEC) {
+        return false;
+    }
+
+    bool assigns_free = tag == NODE_AST_ASSIGN
+        && locals.count(node_get_str(node_get_kid(n, 0))) == 0;
+    for (int i = 0; i < node_get_num_kids(n); i++) {
+        if (find_free_names(node_get_kid(n, i), locals, free_names)) {
+            assigns_free = true;
+        }
+    }
+    return assigns_free;
+}
+
+// Mark the calls which can reuse the frame of the function calling them.
+// Since a function's enclosing environment is its caller's, a call in the
+// tail position of a function F can only replace F's environment with the
+// callee's if no function refers to a name F defines (which could be found
+// in F's environment), and if the callee doesn't assign a name it doesn't
+// define (which must be defined by its caller).  The latter is only known
+// once the callee is, so it is recorded for each function.
+void mark_tail_calls(struct Node *t) {
+    std::vector<std::set<std::string>> locals;
+    std::set<std::string> free_names;
+
+    // functions can only be defined at the top level
+    int num_stmts = node_get_num_kids(t);
+    for (int i = 0; i < num_stmts; i++) {
+        struct Node *statement = node_get_kid(t, i);
+        if (node_get_tag(statement) == NODE_AST_FUNC_DEF) {
+            struct Node *params = node_get_kid(statement, 1);
+            struct Node *body = node_get_kid(statement, 2);
+            locals.push_back(std::set<std::string>());
+            for (int j = 0; j < node_get_num_kids(params); j++) {
+                locals.back().insert(node_get_str(node_get_kid(params, j)));
+            }
+            find_locals(body, locals.back());
+            bool assigns_free = find_free_names(body, locals.back(), free_names);
+            node_set_ival(body, assigns_free ? 1 : 0);
+        }
+    }
+
+    auto function_locals = locals.begin();
+    for (int i = 0; i < num_stmts; i++) {
+        struct Node *statement = node_get_kid(t, i);
+        if (node_get_tag(statement) != NODE_AST_FUNC_DEF) {
+            continue;
+        }
+        const std::set<std::string> &defined = *function_locals++;
+        struct Node *body = node_get_kid(statement, 2);
+        int num_body_stmts = node_get_num_kids(body);
+        if (num_body_stmts == 0) {
+            continue;
+        }
+        struct Node *last = node_get_kid(body, num_body_stmts - 1);
+        if (node_get_tag(last) != NODE_AST_FUNC_CALL) {
+            continue;
+        }
+        bool is_visible = false;
+        for (auto j = defined.begin(); j != defined.end() && !is_visible; j++) {
+            is_visible = free_names.count(*j) > 0;
+        }
+        node_set_ival(last, is_visible ? 0 : 1);
+    }
+}
+
+}
+
+void ast_simplify(struct Node *t) {
+    // (the root is a list of statements, so it is never replaced)
+    simplify(t);
+    mark_tail_calls(t);
+}
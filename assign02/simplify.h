@@ -0,0 +1,23 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+struct Node;
+
+// Simplify a parse tree before it is executed: the value of each integer
+// literal is stored as its ival, and each operator whose operands are
+// literals is replaced by a literal with its value.  Also, each call which
+// may be a tail call (replacing the environment of the function it ends)
+// has ival 1, and the statement list of each function has ival 1 if it
+// assigns a variable it doesn't define (so a tail call to it must be an
+// ordinary call).
+void ast_simplify(struct Node *t);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // SIMPLIFY_H
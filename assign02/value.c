@@ -7,18 +7,10 @@
 #include "node.h"
 
 // Initialize value by setting the kind field and clearing
-// all of the data fields.
+// the data.
 static void val_init(struct Value *val, enum ValueKind kind) {
   val->kind = kind;
   val->ival = 0L;
-  val->fn = NULL;
-  val->intrinsic_fn = NULL;
-}
-
-struct Value val_create_void(void) {
-  struct Value val;
-  val_init(&val, VAL_VOID);
-  return val;
 }
 
 struct Value val_create_error(void) {
@@ -27,21 +19,6 @@ struct Value val_create_error(void) {
   return val;
 }
 
-struct Value val_create_ival(long ival) {
-  struct Value val;
-  val_init(&val, VAL_INT);
-  val.ival = ival;
-  return val;
-}
-
-struct Value val_create_true() {
-    return val_create_ival(1);
-}
-
-struct Value val_create_false() {
-    return val_create_ival(0);
-}
-
 struct Value val_create_fn(struct Function *fn) {
   assert(fn != NULL);
   struct Value val;
@@ -28,23 +28,51 @@ struct Function {
     struct Node *ast;
 };
 
+// A value is 16 bytes: its kind, and the data of that kind of value
+// (only the member for the kind is valid).
 struct Value {
   enum ValueKind kind;
-  long ival;
-  struct Function *fn;
-  IntrinsicFunction *intrinsic_fn;
+  union {
+    long ival;
+    struct Function *fn;
+    IntrinsicFunction *intrinsic_fn;
 
-  // You may add additional struct members for additional kinds
-  // of values.
-  struct Cons *cons;
+    // You may add additional union members for additional kinds
+    // of values.
+    struct Cons *cons;
+  };
 };
 
+// (the constructors for void and integer values are inline, since
+// the interpreters create them constantly)
+static inline struct Value val_create_void(void) {
+  struct Value val;
+  val.kind = VAL_VOID;
+  val.ival = 0L;
+  return val;
+}
+
+static inline struct Value val_create_ival(long ival) {
+  struct Value val;
+  val.kind = VAL_INT;
+  val.ival = ival;
+  return val;
+}
+
+static inline struct Value val_create_true(void) {
+  return val_create_ival(1);
+}
+
+static inline struct Value val_create_false(void) {
+  return val_create_ival(0);
+}
+
+// The integer value of a value, which is 0 unless it is an integer.
+static inline long val_get_ival(struct Value val) {
+  return val.kind == VAL_INT ? val.ival : 0L;
+}
 
-struct Value val_create_void(void);
 struct Value val_create_error(void);
-struct Value val_create_ival(long ival);
-struct Value val_create_true();
-struct Value val_create_false();
 struct Value val_create_fn(struct Function *fn);
 struct Value val_create_intrinsic(IntrinsicFunction *intrinsic_fn);
 struct Function function_create(struct Node *ast);
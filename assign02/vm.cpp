@@ -0,0 +1,1195 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include "util.h"
+#include "node.h"
+#include "grammar_symbols.h"
+#include "simplify.h"
+#include "intrinsics.h"
+#include "vm.h"
+
+// dispatch with computed gotos (a GNU extension) where they are available
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Bytecode
+////////////////////////////////////////////////////////////////////////
+
+// The instructions of the virtual machine.  Each instruction has operands
+// a, b and c, which are registers (R), constants (K), local variable slots
+// (L), names, or instruction indices (the targets of jumps are always c).
+// A name is used to find a variable in the environment of an enclosing
+// call (the caller) if it isn't defined in the local slot.
+//
+// The instructions which operate on local slots (ADDLK to SUBLL, and
+// JEQLK to JGELL) are superinstructions for the commonest sequences of
+// GETL, arithmetic (or a conditional jump) and SETL: a slot which isn't
+// defined is the variable named by the unit's name for the slot, as for
+// GETL and SETL.  CALLPREPF is the quickened form of CALLPREP, which
+// a CALLPREP rewrites itself to once it calls a function (rather than an
+// intrinsic), and which rewrites itself back if it calls another one.
+#define VM_OPCODES(X) \
+    X(LOADK)    /* R[a] = K[b] */ \
+    X(LOADV)    /* R[a] = void */ \
+    X(GETL)     /* R[a] = L[b] (or the variable named c) */ \
+    X(GETN)     /* R[a] = the variable named c */ \
+    X(SETL)     /* L[b] (or the variable named c) = R[a] */ \
+    X(SETN)     /* the variable named c = R[a] */ \
+    X(DECL)     /* declare L[b], named c */ \
+    X(FUNC)     /* L[b] = function c */ \
+    X(ADD)      /* R[a] = R[b] + R[c] */ \
+    X(SUB)      /* R[a] = R[b] - R[c] */ \
+    X(MUL)      /* R[a] = R[b] * R[c] */ \
+    X(DIV)      /* R[a] = R[b] / R[c] */ \
+    X(ADDK)     /* R[a] = R[b] + K[c] */ \
+    X(SUBK)     /* R[a] = R[b] - K[c] */ \
+    X(MULK)     /* R[a] = R[b] * K[c] */ \
+    X(DIVK)     /* R[a] = R[b] / K[c] (K[c] isn't 0) */ \
+    X(ADDLK)    /* R[a] = L[b] = L[b] + K[c] */ \
+    X(SUBLK)    /* R[a] = L[b] = L[b] - K[c] */ \
+    X(ADDLL)    /* R[a] = L[b] = L[b] + L[c] */ \
+    X(SUBLL)    /* R[a] = L[b] = L[b] - L[c] */ \
+    X(EQ)       /* R[a] = R[b] == R[c] */ \
+    X(NE)       /* R[a] = R[b] != R[c] */ \
+    X(LT)       /* R[a] = R[b] < R[c] */ \
+    X(LE)       /* R[a] = R[b] <= R[c] */ \
+    X(GT)       /* R[a] = R[b] > R[c] */ \
+    X(GE)       /* R[a] = R[b] >= R[c] */ \
+    X(BOOL)     /* R[a] = R[a] is truthy */ \
+    X(JMP)      /* jump to c */ \
+    X(JT)       /* jump to c if R[a] is truthy */ \
+    X(JF)       /* jump to c if R[a] isn't truthy */ \
+    X(JEQ)      /* jump to c if R[a] == R[b] */ \
+    X(JNE)      /* jump to c if R[a] != R[b] */ \
+    X(JLT)      /* jump to c if R[a] < R[b] */ \
+    X(JLE)      /* jump to c if R[a] <= R[b] */ \
+    X(JGT)      /* jump to c if R[a] > R[b] */ \
+    X(JGE)      /* jump to c if R[a] >= R[b] */ \
+    X(JEQK)     /* jump to c if R[a] == K[b] */ \
+    X(JNEK)     /* jump to c if R[a] != K[b] */ \
+    X(JLTK)     /* jump to c if R[a] < K[b] */ \
+    X(JLEK)     /* jump to c if R[a] <= K[b] */ \
+    X(JGTK)     /* jump to c if R[a] > K[b] */ \
+    X(JGEK)     /* jump to c if R[a] >= K[b] */ \
+    X(JEQLK)    /* jump to c if L[a] == K[b] */ \
+    X(JNELK)    /* jump to c if L[a] != K[b] */ \
+    X(JLTLK)    /* jump to c if L[a] < K[b] */ \
+    X(JLELK)    /* jump to c if L[a] <= K[b] */ \
+    X(JGTLK)    /* jump to c if L[a] > K[b] */ \
+    X(JGELK)    /* jump to c if L[a] >= K[b] */ \
+    X(JEQLL)    /* jump to c if L[a] == L[b] */ \
+    X(JNELL)    /* jump to c if L[a] != L[b] */ \
+    X(JLTLL)    /* jump to c if L[a] < L[b] */ \
+    X(JLELL)    /* jump to c if L[a] <= L[b] */ \
+    X(JGTLL)    /* jump to c if L[a] > L[b] */ \
+    X(JGELL)    /* jump to c if L[a] >= L[b] */ \
+    X(CALLPREP) /* prepare a call of the function (or intrinsic) R[a] (named c) with b arguments */ \
+    X(CALLPREPF) /* prepare a call of R[a] (named c), which was function b (see CALLPREP) */ \
+    X(PARAM)    /* declare parameter b of the prepared call */ \
+    X(ARG)      /* parameter b of the prepared call = R[a] */ \
+    X(TAILCALL) /* replace the current call with the prepared call (if possible) */ \
+    X(CALL)     /* R[a] = the result of the prepared call */ \
+    X(RET)      /* return R[a] */ \
+    X(UNKNOWN)  /* fail because the node tagged b isn't an operator */
+
+enum Opcode {
+#define VM_OPCODE_ENUM(name) OP_##name,
+    VM_OPCODES(VM_OPCODE_ENUM)
+#undef VM_OPCODE_ENUM
+};
+
+// the comparisons, in the order of the opcodes for them
+enum Comparison { CMP_EQ, CMP_NE, CMP_LT, CMP_LE, CMP_GT, CMP_GE };
+
+struct Instruction {
+    uint16_t opcode;
+    uint16_t a;
+    int32_t b;
+    int32_t c;
+};
+
+// a compiled function (or the top level of the program)
+struct Unit {
+    std::string name;             // (empty for the top level)
+    unsigned entry;               // the index of the first instruction
+    unsigned num_regs;
+    std::vector<int> params;      // the slot of each parameter
+    std::vector<int> local_names; // the name of each local variable slot
+    std::vector<int> slots;       // the slot of each name, or -1 if it isn't local
+    bool assigns_outer;           // assigns variables it doesn't define (see ast_simplify)
+};
+
+// a local variable (which is only defined once its declaration is executed)
+struct Variable {
+    bool defined;
+    struct Value val;
+
+    Variable() : defined(false) { }
+};
+
+// a call (the registers and local variables are indices in VM::regs
+// and VM::locals, which may be reallocated)
+struct Frame {
+    const Unit *unit;
+    size_t regs;
+    size_t locals;
+    Instruction *ret_pc;
+    int ret_reg;
+    IntrinsicFunction *intrinsic; // (if the call is of an intrinsic)
+};
+
+////////////////////////////////////////////////////////////////////////
+// VM class
+////////////////////////////////////////////////////////////////////////
+
+struct VM {
+    std::vector<Instruction> code;
+    std::vector<long> constants;
+    std::vector<std::string> names;
+    std::vector<Function> functions;
+    std::vector<Unit> units;   // the top level, followed by the functions
+    // the slots of the intrinsics in the top level's environment
+    std::vector<std::pair<int, IntrinsicFunction *>> intrinsic_slots;
+    // the layout of the arguments of the intrinsic calls with each
+    // number of arguments
+    std::map<int, Unit> intrinsic_units;
+
+    // the calls being executed: since the environment of a call is enclosed
+    // by the environment of its caller, the enclosing environments of a call
+    // are those of the frames before it
+    std::vector<Frame> frames;
+    // the calls whose arguments are being evaluated
+    std::vector<Frame> pending;
+    std::vector<Value> regs;
+    std::vector<Variable> locals;
+    std::vector<Value> args;   // the arguments of an intrinsic call
+
+public:
+    struct Value exec();
+
+private:
+    void prepare_frame(const Unit *unit, IntrinsicFunction *intrinsic = nullptr);
+    const Unit *get_intrinsic_unit(int num_args);
+    Variable *find_local(const Frame &frame, int name);
+    const Value &find_outer(int name);
+    void set_outer(int name, const Value &val);
+};
+
+class BytecodeCompiler {
+private:
+    VM *m_vm;
+    Unit *m_unit;
+    // the slot of each local name of the unit being compiled
+    std::unordered_map<int, int> m_locals;
+    std::unordered_map<std::string, int> m_name_ids;
+    std::unordered_map<long, int> m_constant_ids;
+    std::unordered_map<struct Node *, int> m_function_ids;
+
+public:
+    BytecodeCompiler(VM *vm);
+
+    void compile(struct Node *t);
+
+private:
+    int get_name(struct Node *identifier);
+    int get_name(const std::string &name);
+    int get_constant(long value);
+    int get_local(int name);
+    int add_local(int name);
+    void find_locals(struct Node *statements);
+    void compile_unit(struct Node *params, struct Node *statements);
+
+    unsigned emit(int opcode, int a = 0, int b = 0, int c = 0);
+    void use_reg(int r);
+    void patch(const std::vector<unsigned> &jumps, unsigned target);
+
+    void compile_statements(struct Node *statements, int r, bool keep_value);
+    bool compile_statement(struct Node *statement, int r);
+    void compile_expr(struct Node *n, int r);
+    bool compile_update(struct Node *identifier, struct Node *value, int r);
+    void compile_call(struct Node *call, int r, bool is_tail = false);
+    void compile_branch(struct Node *cond, int r, bool when, std::vector<unsigned> &jumps);
+    void emit_get(struct Node *identifier, int r);
+    void emit_set(struct Node *identifier, int r);
+
+    static int get_comparison(int tag);
+    static int get_operator(int tag);
+};
+
+////////////////////////////////////////////////////////////////////////
+// BytecodeCompiler class
+////////////////////////////////////////////////////////////////////////
+
+BytecodeCompiler::BytecodeCompiler(VM *vm) : m_vm(vm), m_unit(nullptr) {
+}
+
+void BytecodeCompiler::compile(struct Node *t) {
+    // functions can only be defined at the top level
+    int num_stmts = node_get_num_kids(t);
+    for (int i = 0; i < num_stmts; i++) {
+        struct Node *statement = node_get_kid(t, i);
+        if (node_get_tag(statement) == NODE_AST_FUNC_DEF) {
+            m_function_ids[statement] = int(m_vm->functions.size());
+            m_vm->functions.push_back(function_create(statement));
+        }
+    }
+    m_vm->units.resize(m_vm->functions.size() + 1);
+
+    m_unit = &m_vm->units[0];
+    compile_unit(nullptr, t);
+    for (unsigned i = 0; i < m_vm->functions.size(); i++) {
+        struct Node *ast = m_vm->functions[i].ast;
+        m_unit = &m_vm->units[i + 1];
+        m_unit->name = node_get_str(node_get_kid(ast, 0));
+        compile_unit(node_get_kid(ast, 1), node_get_kid(ast, 2));
+    }
+
+    // (only now are all of the names known)
+    for (auto i = m_vm->units.begin(); i != m_vm->units.end(); i++) {
+        i->slots.assign(m_vm->names.size(), -1);
+        for (unsigned slot = 0; slot < i->local_names.size(); slot++) {
+            i->slots[i->local_names[slot]] = int(slot);
+        }
+    }
+}
+
+int BytecodeCompiler::get_name(struct Node *identifier) {
+    return get_name(std::string(node_get_str(identifier)));
+}
+
+int BytecodeCompiler::get_name(const std::string &name) {
+    auto i = m_name_ids.find(name);
+    if (i != m_name_ids.end()) {
+        return i->second;
+    }
+    int id = int(m_vm->names.size());
+    m_vm->names.push_back(name);
+    m_name_ids[name] = id;
+    return id;
+}
+
+int BytecodeCompiler::get_constant(long value) {
+    auto i = m_constant_ids.find(value);
+    if (i != m_constant_ids.end()) {
+        return i->second;
+    }
+    int id = int(m_vm->constants.size());
+    m_vm->constants.push_back(value);
+    m_constant_ids[value] = id;
+    return id;
+}
+
+int BytecodeCompiler::get_local(int name) {
+    auto i = m_locals.find(name);
+    return i != m_locals.end() ? i->second : -1;
+}
+
+int BytecodeCompiler::add_local(int name) {
+    int slot = get_local(name);
+    if (slot < 0) {
+        slot = int(m_unit->local_names.size());
+        m_unit->local_names.push_back(name);
+        m_locals[name] = slot;
+    }
+    return slot;
+}
+
+// find the variables (and functions) which may be declared in a unit's
+// environment, including those in the bodies of its IF and WHILE statements
+void BytecodeCompiler::find_locals(struct Node *statements) {
+    int num_stmts = node_get_num_kids(statements);
+    for (int i = 0; i < num_stmts; i++) {
+        struct Node *statement = node_get_kid(statements, i);
+        int tag = node_get_tag(statement);
+        if (tag == NODE_AST_VAR_DEC) {
+            for (int j = 0; j < node_get_num_kids(statement); j++) {
+                add_local(get_name(node_get_kid(statement, j)));
+            }
+        } else if (tag == NODE_AST_FUNC_DEF) {
+            add_local(get_name(node_get_kid(statement, 0)));
+        } else if (tag == NODE_AST_IF || tag == NODE_AST_WHILE) {
+            for (int j = 1; j < node_get_num_kids(statement); j++) {
+                find_locals(node_get_kid(statement, j));
+            }
+        }
+    }
+}
+
+void BytecodeCompiler::compile_unit(struct Node *params, struct Node *statements) {
+    m_locals.clear();
+    if (params != nullptr) {
+        for (int i = 0; i < node_get_num_kids(params); i++) {
+            m_unit->params.push_back(add_local(get_name(node_get_kid(params, i))));
+        }
+    } else {
+        // the intrinsics are defined in the top level's environment
+        for (const Intrinsic *intr = g_intrinsics; intr->name != nullptr; intr++) {
+            int slot = add_local(get_name(intr->name));
+            m_vm->intrinsic_slots.push_back(std::make_pair(slot, intr->fn));
+        }
+    }
+    find_locals(statements);
+
+    m_unit->entry = unsigned(m_vm->code.size());
+    m_unit->num_regs = 1;
+    m_unit->assigns_outer = params != nullptr && node_get_ival(statements) != 0;
+
+    int num_stmts = node_get_num_kids(statements);
+    struct Node *last = num_stmts > 0 ? node_get_kid(statements, num_stmts - 1) : nullptr;
+    if (params != nullptr && last != nullptr
+        && node_get_tag(last) == NODE_AST_FUNC_CALL && node_get_ival(last) != 0) {
+        // the function ends with a tail call
+        for (int i = 0; i < num_stmts - 1; i++) {
+            compile_statement(node_get_kid(statements, i), 0);
+        }
+        compile_call(last, 0, true);
+    } else {
+        compile_statements(statements, 0, true);
+    }
+    emit(OP_RET, 0);
+}
+
+unsigned BytecodeCompiler::emit(int opcode, int a, int b, int c) {
+    Instruction ins;
+    ins.opcode = uint16_t(opcode);
+    ins.a = uint16_t(a);
+    ins.b = b;
+    ins.c = c;
+    m_vm->code.push_back(ins);
+    return unsigned(m_vm->code.size() - 1);
+}
+
+void BytecodeCompiler::use_reg(int r) {
+    if (r > UINT16_MAX) {
+        err_fatal("Error: Expression is too deeply nested\n");
+    }
+    if (unsigned(r) >= m_unit->num_regs) {
+        m_unit->num_regs = unsigned(r) + 1;
+    }
+}
+
+void BytecodeCompiler::patch(const std::vector<unsigned> &jumps, unsigned target) {
+    for (auto i = jumps.begin(); i != jumps.end(); i++) {
+        m_vm->code[*i].c = int32_t(target);
+    }
+}
+
+// compile a list of statements, leaving the value of the last one in R[r]
+// if keep_value is true
+void BytecodeCompiler::compile_statements(struct Node *statements, int r, bool keep_value) {
+    bool has_value = false;
+    int num_stmts = node_get_num_kids(statements);
+    for (int i = 0; i < num_stmts; i++) {
+        has_value = compile_statement(node_get_kid(statements, i), r);
+    }
+    if (keep_value && !has_value) {
+        emit(OP_LOADV, r);
+    }
+}
+
+// compile a statement (using registers from r up), returning true
+// if its value is in R[r] (or false if its value is void)
+bool BytecodeCompiler::compile_statement(struct Node *statement, int r) {
+    int tag = node_get_tag(statement);
+
+    if (tag == NODE_AST_VAR_DEC) {
+        for (int i = 0; i < node_get_num_kids(statement); i++) {
+            struct Node *var = node_get_kid(statement, i);
+            int name = get_name(var);
+            emit(OP_DECL, 0, get_local(name), name);
+        }
+        return false;
+    }
+
+    if (tag == NODE_AST_IF) {
+        struct Node *condition = node_get_kid(statement, 0);
+        std::vector<unsigned> else_jumps;
+        compile_branch(condition, r, false, else_jumps);
+        compile_statements(node_get_kid(statement, 1), r, false);
+        if (node_get_num_kids(statement) == 3) {    // there is an else clause
+            std::vector<unsigned> out_jumps(1, emit(OP_JMP));
+            patch(else_jumps, unsigned(m_vm->code.size()));
+            compile_statements(node_get_kid(statement, 2), r, false);
+            patch(out_jumps, unsigned(m_vm->code.size()));
+        } else {
+            patch(else_jumps, unsigned(m_vm->code.size()));
+        }
+        return false;
+    }
+
+    if (tag == NODE_AST_WHILE) {
+        // the condition is tested at the end of the loop
+        std::vector<unsigned> test_jumps(1, emit(OP_JMP));
+        unsigned body = unsigned(m_vm->code.size());
+        compile_statements(node_get_kid(statement, 1), r, false);
+        patch(test_jumps, unsigned(m_vm->code.size()));
+        std::vector<unsigned> body_jumps;
+        compile_branch(node_get_kid(statement, 0), r, true, body_jumps);
+        patch(body_jumps, body);
+        return false;
+    }
+
+    if (tag == NODE_AST_FUNC_DEF) {
+        int name = get_name(node_get_kid(statement, 0));
+        emit(OP_FUNC, 0, get_local(name), m_function_ids[statement]);
+        return false;
+    }
+
+    compile_expr(statement, r);
+    return true;
+}
+
+// compile an expression whose value is put in R[r] (using the registers
+// after r for temporaries), evaluating the operands in the same order
+// as Interp::eval_st
+void BytecodeCompiler::compile_expr(struct Node *n, int r) {
+    use_reg(r);
+    int tag = node_get_tag(n);
+
+    if (tag == NODE_INT_LITERAL) {
+        emit(OP_LOADK, r, get_constant(node_get_ival(n)));
+        return;
+    }
+
+    if (tag == NODE_IDENTIFIER) {
+        emit_get(n, r);
+        return;
+    }
+
+    if (tag == NODE_AST_FUNC_CALL) {
+        compile_call(n, r);
+        return;
+    }
+
+    if (tag != NODE_AST_ASSIGN && get_operator(tag) < 0) {
+        // (like Interp::eval_st, fail only if the node is evaluated)
+        emit(OP_UNKNOWN, 0, tag);
+        return;
+    }
+
+    struct Node *left = node_get_kid(n, 0);
+    struct Node *right = node_get_kid(n, 1);
+
+    if (tag == NODE_AST_ASSIGN) {
+        if (compile_update(left, right, r)) {
+            return;
+        }
+        compile_expr(right, r);
+        emit_set(left, r);
+        return;
+    }
+
+    int opcode;
+    switch (tag) {
+        case NODE_AST_PLUS:
+        case NODE_AST_MINUS:
+        case NODE_AST_TIMES:
+            opcode = get_operator(tag);
+            compile_expr(left, r);
+            if (node_get_tag(right) == NODE_INT_LITERAL) {
+                emit(opcode - OP_ADD + OP_ADDK, r, r, get_constant(node_get_ival(right)));
+            } else {
+                compile_expr(right, r + 1);
+                emit(opcode, r, r, r + 1);
+            }
+            return;
+        case NODE_AST_DIVIDE:
+            if (node_get_tag(right) == NODE_INT_LITERAL && node_get_ival(right) != 0) {
+                compile_expr(left, r);
+                emit(OP_DIVK, r, r, get_constant(node_get_ival(right)));
+                return;
+            }
+            compile_expr(left, r);
+            compile_expr(right, r + 1);
+            emit(OP_DIV, r, r, r + 1);
+            return;
+        case NODE_AST_AND:
+        case NODE_AST_OR:
+            {
+                compile_expr(left, r);
+                emit(OP_BOOL, r);
+                std::vector<unsigned> out_jumps(1, emit(get_operator(tag), r));
+                compile_expr(right, r);
+                emit(OP_BOOL, r);
+                patch(out_jumps, unsigned(m_vm->code.size()));
+            }
+            return;
+        case NODE_AST_EQ:
+        case NODE_AST_NE:
+        case NODE_AST_LT:
+        case NODE_AST_LE:
+        case NODE_AST_GT:
+        case NODE_AST_GE:
+            compile_expr(left, r);
+            compile_expr(right, r + 1);
+            emit(get_operator(tag), r, r, r + 1);
+            return;
+    }
+}
+
+// compile an assignment which adds a constant or a local variable to
+// a local variable (or subtracts one from it), such as i = i + 1, as
+// a single instruction, returning false if the assignment isn't one
+bool BytecodeCompiler::compile_update(struct Node *identifier, struct Node *value, int r) {
+    int tag = node_get_tag(value);
+    if (tag != NODE_AST_PLUS && tag != NODE_AST_MINUS) {
+        return false;
+    }
+    struct Node *left = node_get_kid(value, 0);
+    struct Node *right = node_get_kid(value, 1);
+    int name = get_name(identifier);
+    int slot = get_local(name);
+    if (slot < 0 || node_get_tag(left) != NODE_IDENTIFIER || get_name(left) != name) {
+        return false;
+    }
+
+    int opcode = (tag == NODE_AST_PLUS) ? OP_ADDLK : OP_SUBLK;
+    if (node_get_tag(right) == NODE_INT_LITERAL) {
+        emit(opcode, r, slot, get_constant(node_get_ival(right)));
+        return true;
+    }
+    int right_slot = node_get_tag(right) == NODE_IDENTIFIER ? get_local(get_name(right)) : -1;
+    if (right_slot < 0) {
+        return false;
+    }
+    emit(opcode - OP_ADDLK + OP_ADDLL, r, slot, right_slot);
+    return true;
+}
+
+void BytecodeCompiler::compile_call(struct Node *call, int r, bool is_tail) {
+    struct Node *function = node_get_kid(call, 0);
+    struct Node *args = node_get_kid(call, 1);
+    int num_args = node_get_num_kids(args);
+
+    emit_get(function, r);
+    emit(OP_CALLPREP, r, num_args, get_name(function));
+    for (int i = 0; i < num_args; i++) {
+        emit(OP_PARAM, 0, i);
+        compile_expr(node_get_kid(args, i), r + 1);
+        emit(OP_ARG, r + 1, i);
+    }
+    emit(is_tail ? OP_TAILCALL : OP_CALL, r);
+}
+
+// compile the test of a condition, with jumps (added to jumps, to be
+// patched) which are taken if the condition's truth is the same as when
+void BytecodeCompiler::compile_branch(struct Node *cond, int r, bool when, std::vector<unsigned> &jumps) {
+    // the opposite of each comparison
+    static const int inverse[] = { CMP_NE, CMP_EQ, CMP_GE, CMP_GT, CMP_LE, CMP_LT };
+
+    int tag = node_get_tag(cond);
+    int cmp = get_comparison(tag);
+    if (cmp >= 0) {
+        if (!when) {
+            cmp = inverse[cmp];
+        }
+        struct Node *left = node_get_kid(cond, 0);
+        struct Node *right = node_get_kid(cond, 1);
+
+        // (the registers of a condition are dead after its jump, so
+        // a comparison of local variables needn't load them)
+        int slot = node_get_tag(left) == NODE_IDENTIFIER ? get_local(get_name(left)) : -1;
+        int right_slot = node_get_tag(right) == NODE_IDENTIFIER ? get_local(get_name(right)) : -1;
+        if (slot >= 0 && slot <= UINT16_MAX) {
+            if (node_get_tag(right) == NODE_INT_LITERAL) {
+                jumps.push_back(emit(OP_JEQLK + cmp, slot, get_constant(node_get_ival(right))));
+                return;
+            } else if (right_slot >= 0) {
+                jumps.push_back(emit(OP_JEQLL + cmp, slot, right_slot));
+                return;
+            }
+        }
+
+        compile_expr(left, r);
+        if (node_get_tag(right) == NODE_INT_LITERAL) {
+            jumps.push_back(emit(OP_JEQK + cmp, r, get_constant(node_get_ival(right))));
+        } else {
+            compile_expr(right, r + 1);
+            jumps.push_back(emit(OP_JEQ + cmp, r, r + 1));
+        }
+        return;
+    }
+
+    if (tag == NODE_AST_AND || tag == NODE_AST_OR) {
+        // (the right operand is only evaluated if the left one doesn't
+        // determine the truth of the condition)
+        bool is_and = (tag == NODE_AST_AND);
+        if (when != is_and) {
+            compile_branch(node_get_kid(cond, 0), r, when, jumps);
+            compile_branch(node_get_kid(cond, 1), r, when, jumps);
+        } else {
+            std::vector<unsigned> skip_jumps;
+            compile_branch(node_get_kid(cond, 0), r, !when, skip_jumps);
+            compile_branch(node_get_kid(cond, 1), r, when, jumps);
+            patch(skip_jumps, unsigned(m_vm->code.size()));
+        }
+        return;
+    }
+
+    compile_expr(cond, r);
+    jumps.push_back(emit(when ? OP_JT : OP_JF, r));
+}
+
+void BytecodeCompiler::emit_get(struct Node *identifier, int r) {
+    int name = get_name(identifier);
+    int slot = get_local(name);
+    if (slot >= 0) {
+        emit(OP_GETL, r, slot, name);
+    } else {
+        emit(OP_GETN, r, 0, name);
+    }
+}
+
+void BytecodeCompiler::emit_set(struct Node *identifier, int r) {
+    int name = get_name(identifier);
+    int slot = get_local(name);
+    if (slot >= 0) {
+        emit(OP_SETL, r, slot, name);
+    } else {
+        emit(OP_SETN, r, 0, name);
+    }
+}
+
+// the comparison of a node, or -1 if it isn't a comparison
+int BytecodeCompiler::get_comparison(int tag) {
+    switch (tag) {
+        case NODE_AST_EQ: return CMP_EQ;
+        case NODE_AST_NE: return CMP_NE;
+        case NODE_AST_LT: return CMP_LT;
+        case NODE_AST_LE: return CMP_LE;
+        case NODE_AST_GT: return CMP_GT;
+        case NODE_AST_GE: return CMP_GE;
+        default: return -1;
+    }
+}
+
+// the opcode of a binary operator (for AND and OR, the jump which skips
+// the right operand), or -1 if the tag isn't a binary operator
+int BytecodeCompiler::get_operator(int tag) {
+    switch (tag) {
+        case NODE_AST_PLUS: return OP_ADD;
+        case NODE_AST_MINUS: return OP_SUB;
+        case NODE_AST_TIMES: return OP_MUL;
+        case NODE_AST_DIVIDE: return OP_DIV;
+        case NODE_AST_AND: return OP_JF;
+        case NODE_AST_OR: return OP_JT;
+        default:
+            {
+                int cmp = get_comparison(tag);
+                return cmp >= 0 ? OP_EQ + cmp : -1;
+            }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// VM execution
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+inline void set_int(Value &val, long ival) {
+    val.kind = VAL_INT;
+    val.ival = ival;
+}
+
+inline bool is_truthy(const Value &val) {
+    return val.kind == VAL_FN || val_get_ival(val) >= 1;
+}
+
+}
+
+// allocate the registers and local variables of a call
+void VM::prepare_frame(const Unit *unit, IntrinsicFunction *intrinsic) {
+    Frame frame;
+    frame.unit = unit;
+    frame.intrinsic = intrinsic;
+    frame.regs = regs.size();
+    frame.locals = locals.size();
+    frame.ret_pc = nullptr;
+    frame.ret_reg = 0;
+    regs.resize(regs.size() + unit->num_regs);
+    locals.resize(locals.size() + unit->local_names.size());
+    pending.push_back(frame);
+}
+
+// the layout of the arguments of an intrinsic call, which are its unit's
+// only variables
+const Unit *VM::get_intrinsic_unit(int num_args) {
+    auto i = intrinsic_units.find(num_args);
+    if (i == intrinsic_units.end()) {
+        Unit unit;
+        unit.entry = 0;
+        unit.num_regs = 0;
+        for (int j = 0; j < num_args; j++) {
+            unit.params.push_back(j);
+            unit.local_names.push_back(0);
+        }
+        unit.assigns_outer = true;  // (so it can't be a tail call)
+        i = intrinsic_units.insert(std::make_pair(num_args, unit)).first;
+    }
+    return &i->second;
+}
+
+// the variable of a call's environment with a name, or a null pointer
+// if it isn't defined there
+Variable *VM::find_local(const Frame &frame, int name) {
+    int slot = frame.unit->slots[name];
+    if (slot < 0 || !locals[frame.locals + slot].defined) {
+        return nullptr;
+    }
+    return &locals[frame.locals + slot];
+}
+
+// the value of a variable in the environment of the current call's caller
+// (or one enclosing it), like Environment::find_val
+const Value &VM::find_outer(int name) {
+    for (size_t i = frames.size() - 1; i > 0; i--) {
+        Variable *var = find_local(frames[i - 1], name);
+        if (var != nullptr) {
+            return var->val;
+        }
+    }
+    err_fatal("Undefined variable '%s'\n", names[name].c_str());
+    return regs[0];
+}
+
+// set a variable in the environment of the current call's caller, which
+// (like Environment::set_val) must be defined there
+void VM::set_outer(int name, const Value &val) {
+    Variable *var = frames.size() > 1 ? find_local(frames[frames.size() - 2], name) : nullptr;
+    if (var == nullptr) {
+        err_fatal("Error: Variable '%s' has not been declared\n", names[name].c_str());
+    }
+    var->val = val;
+}
+
+struct Value VM::exec() {
+    frames.clear();
+    pending.clear();
+    regs.clear();
+    locals.clear();
+
+    prepare_frame(&units[0]);
+    frames.push_back(pending.back());
+    pending.pop_back();
+    for (auto i = intrinsic_slots.begin(); i != intrinsic_slots.end(); i++) {
+        locals[i->first].defined = true;
+        locals[i->first].val = val_create_intrinsic(i->second);
+    }
+
+    Instruction *pc = &code[units[0].entry];
+    const long *K = constants.data();
+    Value *R;
+    Variable *L;
+
+    // (the registers and local variables of the current call, which must be
+    // reloaded after a frame is allocated)
+#define RELOAD_FRAME() \
+    do { \
+        R = regs.data() + frames.back().regs; \
+        L = locals.data() + frames.back().locals; \
+    } while (0)
+
+#ifdef VM_COMPUTED_GOTO
+    static void *const dispatch_table[] = {
+#define VM_OPCODE_LABEL(name) &&L_##name,
+        VM_OPCODES(VM_OPCODE_LABEL)
+#undef VM_OPCODE_LABEL
+    };
+#define DISPATCH() goto *dispatch_table[pc->opcode]
+#define CASE(name) L_##name
+#else
+#define DISPATCH() goto dispatch
+#define CASE(name) case OP_##name
+#endif
+
+#define ARITH(op, rhs) \
+    do { \
+        long result = val_get_ival(R[pc->b]) op (rhs); \
+        set_int(R[pc->a], result); \
+        pc++; \
+        DISPATCH(); \
+    } while (0)
+
+#define COMPARE(op) \
+    do { \
+        long result = val_get_ival(R[pc->b]) op val_get_ival(R[pc->c]); \
+        set_int(R[pc->a], result); \
+        pc++; \
+        DISPATCH(); \
+    } while (0)
+
+#define BRANCH(cond) \
+    do { \
+        pc = (cond) ? &code[pc->c] : pc + 1; \
+        DISPATCH(); \
+    } while (0)
+
+    // the value of a local slot (or, if it isn't defined, of the variable
+    // named by the slot's name)
+#define LOCAL(slot) \
+    (L[slot].defined ? L[slot].val : find_outer(frames.back().unit->local_names[slot]))
+
+#define UPDATE(op, rhs) \
+    do { \
+        long lhs = val_get_ival(LOCAL(pc->b)); \
+        set_int(R[pc->a], lhs op (rhs)); \
+        if (L[pc->b].defined) { \
+            L[pc->b].val = R[pc->a]; \
+        } else { \
+            set_outer(frames.back().unit->local_names[pc->b], R[pc->a]); \
+        } \
+        pc++; \
+        DISPATCH(); \
+    } while (0)
+
+#define BRANCH_LOCALS(op) \
+    do { \
+        long lhs = val_get_ival(LOCAL(pc->a)); \
+        BRANCH(lhs op val_get_ival(LOCAL(pc->b))); \
+    } while (0)
+
+    RELOAD_FRAME();
+    DISPATCH();
+
+#ifndef VM_COMPUTED_GOTO
+dispatch:
+    switch (pc->opcode) {
+#endif
+
+    CASE(LOADK):
+        set_int(R[pc->a], K[pc->b]);
+        pc++;
+        DISPATCH();
+
+    CASE(LOADV):
+        R[pc->a] = val_create_void();
+        pc++;
+        DISPATCH();
+
+    CASE(GETL):
+        {
+            const Variable &var = L[pc->b];
+            R[pc->a] = var.defined ? var.val : find_outer(pc->c);
+        }
+        pc++;
+        DISPATCH();
+
+    CASE(GETN):
+        R[pc->a] = find_outer(pc->c);
+        pc++;
+        DISPATCH();
+
+    CASE(SETL):
+        if (R[pc->a].kind != VAL_INT) {
+            err_fatal("Error: Cannot assign non-int value to variable '%s'\n", names[pc->c].c_str());
+        }
+        if (L[pc->b].defined) {
+            L[pc->b].val = R[pc->a];
+        } else {
+            set_outer(pc->c, R[pc->a]);
+        }
+        pc++;
+        DISPATCH();
+
+    CASE(SETN):
+        if (R[pc->a].kind != VAL_INT) {
+            err_fatal("Error: Cannot assign non-int value to variable '%s'\n", names[pc->c].c_str());
+        }
+        set_outer(pc->c, R[pc->a]);
+        pc++;
+        DISPATCH();
+
+    CASE(DECL):
+        // (a variable can replace an intrinsic)
+        if (L[pc->b].defined && L[pc->b].val.kind != VAL_INTRINSIC) {
+            err_fatal("Error: Variable '%s' cannot be redefined\n", names[pc->c].c_str());
+        }
+        L[pc->b].defined = true;
+        set_int(L[pc->b].val, 0);
+        pc++;
+        DISPATCH();
+
+    CASE(FUNC):
+        L[pc->b].defined = true;
+        L[pc->b].val = val_create_fn(&functions[pc->c]);
+        pc++;
+        DISPATCH();
+
+    CASE(ADD):
+        ARITH(+, val_get_ival(R[pc->c]));
+    CASE(SUB):
+        ARITH(-, val_get_ival(R[pc->c]));
+    CASE(MUL):
+        ARITH(*, val_get_ival(R[pc->c]));
+    CASE(DIV):
+        if (val_get_ival(R[pc->c]) == 0) {
+            err_fatal("Error: Cannot divide by 0\n");
+        }
+        ARITH(/, val_get_ival(R[pc->c]));
+    CASE(ADDK):
+        ARITH(+, K[pc->c]);
+    CASE(SUBK):
+        ARITH(-, K[pc->c]);
+    CASE(MULK):
+        ARITH(*, K[pc->c]);
+    CASE(DIVK):
+        ARITH(/, K[pc->c]);
+
+    CASE(ADDLK):
+        UPDATE(+, K[pc->c]);
+    CASE(SUBLK):
+        UPDATE(-, K[pc->c]);
+    CASE(ADDLL):
+        UPDATE(+, val_get_ival(LOCAL(pc->c)));
+    CASE(SUBLL):
+        UPDATE(-, val_get_ival(LOCAL(pc->c)));
+
+    CASE(EQ):
+        COMPARE(==);
+    CASE(NE):
+        COMPARE(!=);
+    CASE(LT):
+        COMPARE(<);
+    CASE(LE):
+        COMPARE(<=);
+    CASE(GT):
+        COMPARE(>);
+    CASE(GE):
+        COMPARE(>=);
+
+    CASE(BOOL):
+        set_int(R[pc->a], is_truthy(R[pc->a]) ? 1 : 0);
+        pc++;
+        DISPATCH();
+
+    CASE(JMP):
+        pc = &code[pc->c];
+        DISPATCH();
+    CASE(JT):
+        BRANCH(is_truthy(R[pc->a]));
+    CASE(JF):
+        BRANCH(!is_truthy(R[pc->a]));
+
+    CASE(JEQ):
+        BRANCH(val_get_ival(R[pc->a]) == val_get_ival(R[pc->b]));
+    CASE(JNE):
+        BRANCH(val_get_ival(R[pc->a]) != val_get_ival(R[pc->b]));
+    CASE(JLT):
+        BRANCH(val_get_ival(R[pc->a]) < val_get_ival(R[pc->b]));
+    CASE(JLE):
+        BRANCH(val_get_ival(R[pc->a]) <= val_get_ival(R[pc->b]));
+    CASE(JGT):
+        BRANCH(val_get_ival(R[pc->a]) > val_get_ival(R[pc->b]));
+    CASE(JGE):
+        BRANCH(val_get_ival(R[pc->a]) >= val_get_ival(R[pc->b]));
+    CASE(JEQK):
+        BRANCH(val_get_ival(R[pc->a]) == K[pc->b]);
+    CASE(JNEK):
+        BRANCH(val_get_ival(R[pc->a]) != K[pc->b]);
+    CASE(JLTK):
+        BRANCH(val_get_ival(R[pc->a]) < K[pc->b]);
+    CASE(JLEK):
+        BRANCH(val_get_ival(R[pc->a]) <= K[pc->b]);
+    CASE(JGTK):
+        BRANCH(val_get_ival(R[pc->a]) > K[pc->b]);
+    CASE(JGEK):
+        BRANCH(val_get_ival(R[pc->a]) >= K[pc->b]);
+
+    CASE(JEQLK):
+        BRANCH(val_get_ival(LOCAL(pc->a)) == K[pc->b]);
+    CASE(JNELK):
+        BRANCH(val_get_ival(LOCAL(pc->a)) != K[pc->b]);
+    CASE(JLTLK):
+        BRANCH(val_get_ival(LOCAL(pc->a)) < K[pc->b]);
+    CASE(JLELK):
+        BRANCH(val_get_ival(LOCAL(pc->a)) <= K[pc->b]);
+    CASE(JGTLK):
+        BRANCH(val_get_ival(LOCAL(pc->a)) > K[pc->b]);
+    CASE(JGELK):
+        BRANCH(val_get_ival(LOCAL(pc->a)) >= K[pc->b]);
+    CASE(JEQLL):
+        BRANCH_LOCALS(==);
+    CASE(JNELL):
+        BRANCH_LOCALS(!=);
+    CASE(JLTLL):
+        BRANCH_LOCALS(<);
+    CASE(JLELL):
+        BRANCH_LOCALS(<=);
+    CASE(JGTLL):
+        BRANCH_LOCALS(>);
+    CASE(JGELL):
+        BRANCH_LOCALS(>=);
+
+    CASE(CALLPREP):
+        {
+            const Value &fn = R[pc->a];
+            if (fn.kind == VAL_INTRINSIC) {
+                prepare_frame(get_intrinsic_unit(pc->b), fn.intrinsic_fn);
+                RELOAD_FRAME();
+                pc++;
+                DISPATCH();
+            }
+            if (fn.kind != VAL_FN) {
+                err_fatal("Error: Cannot call '%s' because it isn’t a function\n", names[pc->c].c_str());
+            }
+            const Unit *unit = &units[fn.fn - functions.data() + 1];
+            if (unit->params.size() != size_t(pc->b)) {
+                err_fatal("Error: Invalid number of arguments for function '%s'\n", unit->name.c_str());
+            }
+            pc->opcode = OP_CALLPREPF;
+            pc->b = int32_t(fn.fn - functions.data());
+            prepare_frame(unit);
+        }
+        RELOAD_FRAME();
+        pc++;
+        DISPATCH();
+
+    CASE(CALLPREPF):
+        if (R[pc->a].kind != VAL_FN || R[pc->a].fn != &functions[pc->b]) {
+            // (the number of arguments was the function's number of parameters)
+            pc->b = int32_t(units[pc->b + 1].params.size());
+            pc->opcode = OP_CALLPREP;
+            DISPATCH();
+        }
+        prepare_frame(&units[pc->b + 1]);
+        RELOAD_FRAME();
+        pc++;
+        DISPATCH();
+
+    CASE(PARAM):
+        {
+            const Frame &callee = pending.back();
+            int slot = callee.unit->params[pc->b];
+            Variable &var = locals[callee.locals + slot];
+            if (var.defined) {
+                err_fatal("Error: Variable '%s' cannot be redefined\n", names[callee.unit->local_names[slot]].c_str());
+            }
+            var.defined = true;
+            set_int(var.val, 0);
+        }
+        pc++;
+        DISPATCH();
+
+    CASE(ARG):
+        {
+            const Frame &callee = pending.back();
+            locals[callee.locals + callee.unit->params[pc->b]].val = R[pc->a];
+        }
+        pc++;
+        DISPATCH();
+
+    CASE(TAILCALL):
+        if (!pending.back().unit->assigns_outer) {
+            // the callee's frame replaces the current one, moving
+            // the callee's variables down
+            Frame callee = pending.back();
+            pending.pop_back();
+            Frame &frame = frames.back();
+            size_t num_locals = callee.unit->local_names.size();
+            std::copy(locals.begin() + callee.locals, locals.begin() + callee.locals + num_locals,
+                      locals.begin() + frame.locals);
+            locals.resize(frame.locals + num_locals);
+            regs.resize(frame.regs + callee.unit->num_regs);
+            frame.unit = callee.unit;
+            pc = &code[callee.unit->entry];
+            RELOAD_FRAME();
+            DISPATCH();
+        }
+        // (otherwise, it is an ordinary call)
+        // fall through
+
+    CASE(CALL):
+        if (pending.back().intrinsic != nullptr) {
+            // (the arguments are passed in the order they're written, which
+            // is the reverse of the order of the parameters)
+            Frame callee = pending.back();
+            pending.pop_back();
+            size_t num_args = callee.unit->params.size();
+            args.resize(num_args);
+            for (size_t i = 0; i < num_args; i++) {
+                args[num_args - 1 - i] = locals[callee.locals + i].val;
+            }
+            locals.resize(callee.locals);
+            regs.resize(callee.regs);
+            Value result = callee.intrinsic(args.data(), int(num_args), nullptr);
+            RELOAD_FRAME();
+            R[pc->a] = result;
+            pc++;
+            DISPATCH();
+        }
+        {
+            Frame callee = pending.back();
+            pending.pop_back();
+            callee.ret_pc = pc + 1;
+            callee.ret_reg = pc->a;
+            frames.push_back(callee);
+            pc = &code[callee.unit->entry];
+        }
+        RELOAD_FRAME();
+        DISPATCH();
+
+    CASE(RET):
+        {
+            Value result = R[pc->a];
+            Frame callee = frames.back();
+            frames.pop_back();
+            regs.resize(callee.regs);
+            locals.resize(callee.locals);
+            if (frames.empty()) {
+                return result;
+            }
+            RELOAD_FRAME();
+            R[callee.ret_reg] = result;
+            pc = callee.ret_pc;
+        }
+        DISPATCH();
+
+    CASE(UNKNOWN):
+        err_fatal("Unknown operator: %d\n", pc->b);
+        return val_create_error();
+
+#ifndef VM_COMPUTED_GOTO
+    }
+    assert(false); // unknown opcode
+    return val_create_error();
+#endif
+
+#undef RELOAD_FRAME
+#undef DISPATCH
+#undef CASE
+#undef ARITH
+#undef COMPARE
+#undef BRANCH
+#undef LOCAL
+#undef UPDATE
+#undef BRANCH_LOCALS
+}
+
+////////////////////////////////////////////////////////////////////////
+// API functions
+////////////////////////////////////////////////////////////////////////
+
+struct VM *vm_create(struct Node *t) {
+    VM *vm = new VM();
+    ast_simplify(t);
+    BytecodeCompiler compiler(vm);
+    compiler.compile(t);
+    return vm;
+}
+
+void vm_destroy(struct VM *vm) {
+    delete vm;
+}
+
+struct Value vm_exec(struct VM *vm) {
+    return vm->exec();
+}
@@ -0,0 +1,26 @@
+#ifndef VM_H
+#define VM_H
+
+#include "value.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+struct Node;
+struct VM;
+
+// compile a parse tree to bytecode for the virtual machine
+struct VM *vm_create(struct Node *t);
+
+// destroy virtual machine
+void vm_destroy(struct VM *vm);
+
+// execute the bytecode (with the same results as interp_exec)
+struct Value vm_exec(struct VM *vm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VM_H
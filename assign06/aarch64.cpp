@@ -0,0 +1,275 @@
+#include <cassert>
+#include "aarch64.h"
+#include "output.h"
+
+PrintAArch64InstructionSequence::PrintAArch64InstructionSequence(InstructionSequence *iseq)
+        : PrintInstructionSequence(iseq) {
+}
+
+const AArch64OpcodeInfo AArch64::s_opcode_info[] = {
+    { "nop",        0 },
+    { "mov",        0 },
+    { "movz",       0 },
+    { "movn",       0 },
+    { "movk",       0 },
+    { "ldr",        0 },
+    { "str",        0 },
+    { "ldrb",       0 },
+    { "strb",       0 },
+    { "ldr",        0 },
+    { "str",        0 },
+    { "str",        0 },
+    { "stp",        0 },
+    { "ldp",        0 },
+    { "add",        0 },
+    { "sub",        0 },
+    { "add",        0 },
+    { "sub",        0 },
+    { "add",        0 },
+    { "adrp",       0 },
+    { "subs",       0 },
+    { "mul",        0 },
+    { "smulh",      0 },
+    { "umulh",      0 },
+    { "sdiv",       0 },
+    { "udiv",       0 },
+    { "msub",       0 },
+    { "and",        0 },
+    { "asr",        0 },
+    { "lsr",        0 },
+    { "lsl",        0 },
+    { "cmp",        0 },
+    { "cmn",        0 },
+    { "csel",       0 },
+    { "csel",       0 },
+    { "csel",       0 },
+    { "csel",       0 },
+    { "csel",       0 },
+    { "csel",       0 },
+    { "b",          AOP_JUMP },
+    { "b.eq",       AOP_BRANCH },
+    { "b.ne",       AOP_BRANCH },
+    { "b.lt",       AOP_BRANCH },
+    { "b.le",       AOP_BRANCH },
+    { "b.gt",       AOP_BRANCH },
+    { "b.ge",       AOP_BRANCH },
+    { "b.hi",       AOP_BRANCH },
+    { "bl",         AOP_CALL },
+    { "ret",        0 },
+    { "udf",        0 },
+    { ".cold",      0 },
+    { "prfm",       0 },
+    { "ldr",        AOP_SIMD },
+    { "str",        AOP_SIMD },
+    { "add",        AOP_SIMD },
+    { "sub",        AOP_SIMD },
+    { "dup",        AOP_SIMD },
+};
+
+static_assert(sizeof(AArch64::s_opcode_info) / sizeof(AArch64OpcodeInfo) == AINS_DUP_2D + 1,
+              "every AArch64 opcode needs an entry in the table");
+
+namespace {
+    const char *const REG_NAMES[] = {
+        "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11", "x12", "x13",
+        "x14", "x15", "x16", "x17", "x18", "x19", "x20", "x21", "x22", "x23", "x24", "x25", "x26",
+        "x27", "x28", "x29", "x30", "sp", "xzr", "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7",
+        "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15", "v16", "v17", "v18", "v19", "v20",
+        "v21", "v22", "v23", "v24", "v25", "v26", "v27", "v28", "v29", "v30", "v31",
+    };
+
+    // (the names of the low 32 bits of the scalar registers, used for bytes)
+    const char *const W_REG_NAMES[] = {
+        "w0", "w1", "w2", "w3", "w4", "w5", "w6", "w7", "w8", "w9", "w10", "w11", "w12", "w13",
+        "w14", "w15", "w16", "w17", "w18", "w19", "w20", "w21", "w22", "w23", "w24", "w25", "w26",
+        "w27", "w28", "w29", "w30", "wsp", "wzr",
+    };
+
+    // (the names of the SIMD registers loaded and stored as 128 bits, and
+    // operated on as pairs of 64-bit integers)
+    const char *const Q_REG_NAMES[] = {
+        "q0", "q1", "q2", "q3", "q4", "q5", "q6", "q7", "q8", "q9", "q10", "q11", "q12", "q13",
+        "q14", "q15", "q16", "q17", "q18", "q19", "q20", "q21", "q22", "q23", "q24", "q25", "q26",
+        "q27", "q28", "q29", "q30", "q31",
+    };
+    const char *const V2D_REG_NAMES[] = {
+        "v0.2d", "v1.2d", "v2.2d", "v3.2d", "v4.2d", "v5.2d", "v6.2d", "v7.2d", "v8.2d", "v9.2d",
+        "v10.2d", "v11.2d", "v12.2d", "v13.2d", "v14.2d", "v15.2d", "v16.2d", "v17.2d", "v18.2d",
+        "v19.2d", "v20.2d", "v21.2d", "v22.2d", "v23.2d", "v24.2d", "v25.2d", "v26.2d", "v27.2d",
+        "v28.2d", "v29.2d", "v30.2d", "v31.2d",
+    };
+
+    // the condition of a conditional select
+    const char *get_condition(int opcode) {
+        switch (opcode) {
+            case AINS_CSEL_EQ: return "eq";
+            case AINS_CSEL_NE: return "ne";
+            case AINS_CSEL_LT: return "lt";
+            case AINS_CSEL_LE: return "le";
+            case AINS_CSEL_GT: return "gt";
+            case AINS_CSEL_GE: return "ge";
+            default:
+                assert(false);
+                return "<invalid>";
+        }
+    }
+
+    // log2 of the scale of an index register
+    int get_shift(int scale) {
+        int shift = 0;
+        while ((1 << shift) < scale) {
+            shift++;
+        }
+        return shift;
+    }
+}
+
+const char *PrintAArch64InstructionSequence::get_opcode_name(int opcode) {
+    return AArch64::get_opcode_info(opcode).name;
+}
+
+const char *PrintAArch64InstructionSequence::get_mreg_name(int regnum) {
+    if (regnum < AREG_X0 || regnum > AREG_V31) {
+        assert(false);
+        return "<invalid>";
+    }
+    return REG_NAMES[regnum];
+}
+
+const char *PrintAArch64InstructionSequence::get_operand_mreg_name(const Instruction *ins, unsigned i, int regnum) {
+    int opcode = ins->get_opcode();
+    if ((opcode == AINS_LDRB || opcode == AINS_STRB) && i == 0) {
+        assert(regnum <= AREG_XZR);
+        return W_REG_NAMES[regnum];
+    }
+    if ((opcode == AINS_LDR_Q || opcode == AINS_STR_Q) && i == 0) {
+        assert(regnum >= AREG_V0);
+        return Q_REG_NAMES[regnum - AREG_V0];
+    }
+    if (regnum >= AREG_V0 && regnum <= AREG_V31
+            && (opcode == AINS_ADD_2D || opcode == AINS_SUB_2D || opcode == AINS_DUP_2D)) {
+        return V2D_REG_NAMES[regnum - AREG_V0];
+    }
+    return get_mreg_name(regnum);
+}
+
+void PrintAArch64InstructionSequence::format_instruction(OutputSink &out, const Instruction *ins) {
+    size_t start = out.get_count();
+    int opcode = ins->get_opcode();
+    out.put(get_opcode_name(opcode));
+    if (opcode == AINS_UDF) {
+        out.put(" #0");
+    } else if (opcode == AINS_PRFM) {
+        out.put(" pldl1keep,");
+    }
+    for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+        out.put(j > 0 ? ", " : " ");
+        // (the last operand of a move of 16 bits, or of an addition or
+        // subtraction of a shifted register, is the shift)
+        bool is_shift = (j == 2 && (opcode == AINS_MOVZ || opcode == AINS_MOVN || opcode == AINS_MOVK))
+                        || (j == 3 && (opcode == AINS_ADD_LSL || opcode == AINS_SUB_LSL));
+        if (is_shift) {
+            out.put("lsl #");
+            out.put_int(ins->get_operand(j).get_int_value());
+            continue;
+        }
+        format_operand(out, ins, j);
+    }
+    if (opcode >= AINS_CSEL_EQ && opcode <= AINS_CSEL_GE) {
+        out.put(", ");
+        out.put(get_condition(opcode));
+    } else if (opcode == AINS_STR_PRE || opcode == AINS_STP_PRE) {
+        out.put('!');
+    }
+    if (ins->has_comment()) {
+        out.pad_to(start + 28);
+        out.put("/* ");
+        out.put(ins->get_comment());
+        out.put(" */");
+    }
+}
+
+void PrintAArch64InstructionSequence::format_operand(OutputSink &out, const Instruction *ins, unsigned i) {
+    const Operand &operand = ins->get_operand(i);
+    switch (operand.get_kind()) {
+        case OPERAND_VREG:
+            out.put("vr");
+            out.put_int(operand.get_base_reg());
+            return;
+        case OPERAND_MREG:
+            out.put(get_operand_mreg_name(ins, i, operand.get_base_reg()));
+            return;
+        case OPERAND_INT_LITERAL:
+            out.put('#');
+            out.put_int(operand.get_int_value());
+            return;
+        case OPERAND_LABEL:
+            out.put(operand.get_target_label());
+            return;
+        case OPERAND_LABEL_IMMEDIATE:
+            // (the low 12 bits of the address, added to its page)
+            if (ins->get_opcode() == AINS_ADD_LO12) {
+                out.put(":lo12:");
+            }
+            out.put(operand.get_target_label());
+            return;
+        case OPERAND_MREG_MEMREF:
+        case OPERAND_MREG_MEMREF_OFFSET:
+        case OPERAND_MREG_MEMREF_INDEX:
+        case OPERAND_MREG_MEMREF_OFFSET_INDEX:
+            break;
+        default:
+            assert(false);
+            out.put("<invalid>");
+            return;
+    }
+
+    // [base], [base, #offset], [base, index] or [base, index, lsl #shift]
+    out.put('[');
+    out.put(get_mreg_name(operand.get_base_reg()));
+    if (operand.has_index_reg()) {
+        out.put(", ");
+        out.put(get_mreg_name(operand.get_index_reg()));
+        if (operand.get_kind() == OPERAND_MREG_MEMREF_OFFSET_INDEX && operand.get_scale() != 1) {
+            assert(operand.get_offset() == 0);
+            out.put(", lsl #");
+            out.put_int(get_shift(operand.get_scale()));
+        }
+    } else if (operand.get_kind() == OPERAND_MREG_MEMREF_OFFSET && operand.get_offset() != 0) {
+        out.put(", #");
+        out.put_int(operand.get_offset());
+    }
+    out.put(']');
+}
+
+AArch64ControlFlowGraphBuilder::AArch64ControlFlowGraphBuilder(InstructionSequence *iseq)
+        : ControlFlowGraphBuilder(iseq) {
+}
+
+AArch64ControlFlowGraphBuilder::~AArch64ControlFlowGraphBuilder() {
+}
+
+// (as for x86-64, a call's label operand doesn't make it a branch)
+bool AArch64ControlFlowGraphBuilder::is_branch(Instruction *ins) {
+    if (AArch64::has_flags(ins->get_opcode(), AOP_CALL)) {
+        return false;
+    }
+    return ControlFlowGraphBuilder::is_branch(ins);
+}
+
+bool AArch64ControlFlowGraphBuilder::falls_through(Instruction *ins) {
+    // only the b instruction does not fall through
+    return !AArch64::has_flags(ins->get_opcode(), AOP_JUMP);
+}
+
+AArch64ControlFlowGraphPrinter::AArch64ControlFlowGraphPrinter(ControlFlowGraph *cfg)
+        : ControlFlowGraphPrinter(cfg) {
+}
+
+AArch64ControlFlowGraphPrinter::~AArch64ControlFlowGraphPrinter() {
+}
+
+void AArch64ControlFlowGraphPrinter::print_basic_block(OutputSink &out, BasicBlock *bb) {
+    PrintAArch64InstructionSequence print_iseq(bb);
+    print_iseq.print(out);
+}
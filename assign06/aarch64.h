@@ -0,0 +1,211 @@
+#ifndef AARCH64_H
+#define AARCH64_H
+
+#include <cassert>
+#include "cfg.h"
+
+enum AArch64Reg {
+    AREG_X0,
+    AREG_X1,
+    AREG_X2,
+    AREG_X3,
+    AREG_X4,
+    AREG_X5,
+    AREG_X6,
+    AREG_X7,
+    AREG_X8,
+    AREG_X9,
+    AREG_X10,
+    AREG_X11,
+    AREG_X12,
+    AREG_X13,
+    AREG_X14,
+    AREG_X15,
+    AREG_X16,
+    AREG_X17,
+    AREG_X18,
+    AREG_X19,
+    AREG_X20,
+    AREG_X21,
+    AREG_X22,
+    AREG_X23,
+    AREG_X24,
+    AREG_X25,
+    AREG_X26,
+    AREG_X27,
+    AREG_X28,
+    AREG_X29,   // (the frame pointer)
+    AREG_X30,   // (the link register)
+    AREG_SP,
+    AREG_XZR,
+    // SIMD registers (only used by vectorized loops)
+    AREG_V0,
+    AREG_V1,
+    AREG_V2,
+    AREG_V3,
+    AREG_V4,
+    AREG_V5,
+    AREG_V6,
+    AREG_V7,
+    AREG_V8,
+    AREG_V9,
+    AREG_V10,
+    AREG_V11,
+    AREG_V12,
+    AREG_V13,
+    AREG_V14,
+    AREG_V15,
+    AREG_V16,
+    AREG_V17,
+    AREG_V18,
+    AREG_V19,
+    AREG_V20,
+    AREG_V21,
+    AREG_V22,
+    AREG_V23,
+    AREG_V24,
+    AREG_V25,
+    AREG_V26,
+    AREG_V27,
+    AREG_V28,
+    AREG_V29,
+    AREG_V30,
+    AREG_V31,
+};
+
+// (the operands are in the assembler's order, with the destination
+// first, and the memory references are printed as [base, #offset] or
+// [base, index, lsl #log2(scale)])
+enum AArch64Instruction {
+    AINS_NOP,
+    AINS_MOV,        // mov xD, xS (or a 16-bit immediate, possibly negated)
+    AINS_MOVZ,       // movz xD, #imm, lsl #shift
+    AINS_MOVN,       // movn xD, #imm, lsl #shift: xD = ~(imm << shift)
+    AINS_MOVK,       // movk xD, #imm, lsl #shift: replaces 16 bits of xD
+    AINS_LDR,
+    AINS_STR,
+    AINS_LDRB,       // load a byte, zero-extended (to wD)
+    AINS_STRB,       // store the low byte of wS
+    AINS_LDR_POST,   // ldr xD, [xB], #imm: then xB += imm
+    AINS_STR_POST,
+    AINS_STR_PRE,    // str xS, [xB, #imm]!: xB += imm first
+    AINS_STP_PRE,
+    AINS_LDP_POST,
+    AINS_ADD,        // (a register, or a 12-bit unsigned immediate)
+    AINS_SUB,
+    AINS_ADD_LSL,    // add xD, xN, xM, lsl #k: xD = xN + (xM << k)
+    AINS_SUB_LSL,
+    AINS_ADD_LO12,   // add xD, xN, :lo12:label (after adrp xN, label)
+    AINS_ADRP,       // the address of the 4KB page containing a label
+    AINS_SUBS,       // (a subtraction setting the flags)
+    AINS_MUL,
+    AINS_SMULH,      // the high 64 bits of the signed 128-bit product
+    AINS_UMULH,
+    AINS_SDIV,
+    AINS_UDIV,
+    AINS_MSUB,       // msub xD, xN, xM, xA: xD = xA - xN * xM
+    AINS_AND,
+    AINS_ASR,
+    AINS_LSR,
+    AINS_LSL,
+    AINS_CMP,
+    AINS_CMN,        // (compares with the negated immediate)
+    AINS_CSEL_EQ,    // csel xD, xT, xF, cc: xD = cc ? xT : xF
+    AINS_CSEL_NE,
+    AINS_CSEL_LT,
+    AINS_CSEL_LE,
+    AINS_CSEL_GT,
+    AINS_CSEL_GE,
+    AINS_B,
+    AINS_B_EQ,
+    AINS_B_NE,
+    AINS_B_LT,
+    AINS_B_LE,
+    AINS_B_GT,
+    AINS_B_GE,
+    AINS_B_HI,       // (unsigned, only used for array bounds checks)
+    AINS_BL,
+    AINS_RET,
+    AINS_UDF,        // (the trap for a failed array bounds check)
+    AINS_COLD,       // (the epilogue goes here, and the cold code follows, see HINS_COLD)
+    AINS_PRFM,       // prefetch the cache line at the address for a load
+    // Advanced SIMD instructions (operating on pairs of 64-bit integers)
+    AINS_LDR_Q,
+    AINS_STR_Q,
+    AINS_ADD_2D,
+    AINS_SUB_2D,
+    AINS_DUP_2D,     // both elements of vD are xS
+};
+
+// properties of the AArch64 opcodes (see AArch64OpcodeInfo)
+enum AArch64OpcodeFlags {
+    AOP_JUMP   = 1 << 0,    // an unconditional branch
+    AOP_BRANCH = 1 << 1,    // a conditional branch
+    AOP_CALL   = 1 << 2,    // a call (which has a label operand, but isn't a branch)
+    AOP_SIMD   = 1 << 3,    // an Advanced SIMD instruction
+};
+
+struct AArch64OpcodeInfo {
+    const char *name;
+    unsigned flags;     // AArch64OpcodeFlags
+};
+
+class AArch64 {
+public:
+    // the properties of each opcode (indexed by opcode)
+    static const AArch64OpcodeInfo s_opcode_info[];
+
+    static const AArch64OpcodeInfo &get_opcode_info(int opcode) {
+        assert(opcode >= AINS_NOP && opcode <= AINS_DUP_2D);
+        return s_opcode_info[opcode];
+    }
+    static bool has_flags(int opcode, unsigned flags) {
+        return (get_opcode_info(opcode).flags & flags) != 0;
+    }
+
+    // can a load or store of size bytes (1, 8 or 16) address base + offset
+    // with an immediate offset?  (A multiple of the size up to 4095 times
+    // the size, or an unscaled offset from -256 to 255.)
+    static bool is_memref_offset(long offset, long size) {
+        return (offset >= 0 && offset % size == 0 && offset / size <= 4095) || (offset >= -256 && offset <= 255);
+    }
+
+    // is a value an arithmetic immediate (an unsigned 12-bit integer)?
+    static bool is_arith_immediate(long value) {
+        return value >= 0 && value <= 4095;
+    }
+};
+
+class PrintAArch64InstructionSequence : public PrintInstructionSequence {
+public:
+    PrintAArch64InstructionSequence(InstructionSequence *iseq);
+
+    virtual const char *get_opcode_name(int opcode);
+    virtual const char *get_mreg_name(int regnum);
+    virtual const char *get_operand_mreg_name(const Instruction *ins, unsigned i, int regnum);
+
+    using PrintInstructionSequence::format_instruction;
+    virtual void format_instruction(OutputSink &out, const Instruction *ins);
+
+private:
+    void format_operand(OutputSink &out, const Instruction *ins, unsigned i);
+};
+
+class AArch64ControlFlowGraphBuilder : public ControlFlowGraphBuilder {
+public:
+    AArch64ControlFlowGraphBuilder(InstructionSequence *iseq);
+    ~AArch64ControlFlowGraphBuilder();
+
+    virtual bool is_branch(Instruction *ins);
+    virtual bool falls_through(Instruction *ins);
+};
+
+class AArch64ControlFlowGraphPrinter : public ControlFlowGraphPrinter {
+public:
+    AArch64ControlFlowGraphPrinter(ControlFlowGraph *cfg);
+    ~AArch64ControlFlowGraphPrinter();
+
+    virtual void print_basic_block(OutputSink &out, BasicBlock *bb);
+};
+
+#endif // AARCH64_H
@@ -0,0 +1,1056 @@
+#include <cassert>
+#include <climits>
+#include <string>
+#include <utility>
+#include "util.h"
+#include "cfg.h"
+#include "highlevel.h"
+#include "aarch64.h"
+#include "output.h"
+#include "aarch64_lowering.h"
+
+const int AArch64Lowering::ARG_REGS[AArch64Lowering::MAX_ARGS] = {
+    AREG_X0, AREG_X1, AREG_X2, AREG_X3, AREG_X4, AREG_X5, AREG_X6, AREG_X7
+};
+
+namespace {
+    const Operand X0(OPERAND_MREG, AREG_X0);
+    const Operand X1(OPERAND_MREG, AREG_X1);
+    const Operand X2(OPERAND_MREG, AREG_X2);
+    const Operand X15(OPERAND_MREG, AREG_X15);
+    const Operand X16(OPERAND_MREG, AREG_X16);
+    const Operand X17(OPERAND_MREG, AREG_X17);
+    const Operand X19(OPERAND_MREG, AREG_X19);
+    const Operand X20(OPERAND_MREG, AREG_X20);
+    const Operand X21(OPERAND_MREG, AREG_X21);
+    const Operand X29(OPERAND_MREG, AREG_X29);
+    const Operand X30(OPERAND_MREG, AREG_X30);
+    const Operand SP(OPERAND_MREG, AREG_SP);
+    const Operand XZR(OPERAND_MREG, AREG_XZR);
+
+    Operand imm(long value) {
+        return Operand(OPERAND_INT_LITERAL, value);
+    }
+}
+
+AArch64Lowering::AArch64Lowering(InstructionSequence *highlevelins, StorageLayout *storage_layout, long vreg_max)
+        : Lowering(highlevelins, storage_layout, vreg_max, AREG_SP)
+        , folded_vreg(-1) {
+}
+
+AArch64Lowering::~AArch64Lowering() {
+}
+
+void AArch64Lowering::translate_instructions() {
+    allocate_storage(AREG_V16, NUM_VECTOR_REGS, "SIMD");
+
+    vreg_occurrences.assign(num_vreg, 0);
+    for (unsigned i = 0; i < hins->get_length(); i++) {
+        Instruction *hin = hins->get_instruction(i);
+        for (unsigned j = 0; j < hin->get_num_operands(); j++) {
+            Operand operand = hin->get_operand(j);
+            int regs[2] = { operand.has_base_reg() ? operand.get_base_reg() : -1,
+                            operand.has_index_reg() ? operand.get_index_reg() : -1 };
+            for (unsigned k = 0; k < 2; k++) {
+                if (regs[k] < 0) {
+                    continue;
+                }
+                if (unsigned(regs[k]) >= vreg_occurrences.size()) {
+                    vreg_occurrences.resize(regs[k] + 1, 0);
+                }
+                vreg_occurrences[regs[k]]++;
+            }
+        }
+    }
+
+    // static labels
+    Operand printf_label("printf");
+    Operand scanf_label("scanf");
+    Operand write_int_label("__rt_write_int");
+    Operand read_int_label("__rt_read_int");
+    Operand write_int_array_label("__rt_write_int_array");
+    Operand read_int_array_label("__rt_read_int_array");
+
+    // set once the hot code has ended (see HINS_COLD)
+    bool ended = false;
+    const unsigned num_ins = hins->get_length();
+    for (unsigned i = 0; i < num_ins; i++) {
+        Instruction *hin = hins->get_instruction(i);
+
+        if (hins->has_label(i)) {
+            define_label(hins->get_label(i));
+        }
+
+        Code code;
+        switch (hin->get_opcode()) {
+            case HINS_LOCALADDR: {
+                // (large variables are in .bss)
+                const StorageLayout::Placement &placement = layout->get_placement(hin->get_operand(1).get_int_value());
+                Operand dest = get_mreg(hin->get_operand(0));
+                Operand d = (dest.get_kind() == OPERAND_MREG) ? dest : X16;
+                if (placement.is_static) {
+                    load_label_address(d, placement.label, code);
+                } else {
+                    add_sp_offset(d, local_storage_offset + placement.offset, code);
+                }
+                move_from(dest, d, code);
+                break;
+            }
+            case HINS_LOAD_INT:
+            case HINS_LOAD_CHAR: {
+                // ldr xD, [xA] (or ldrb wD, zero-extending the byte)
+                bool is_char = (hin->get_opcode() == HINS_LOAD_CHAR);
+                Operand dest = get_mreg(hin->get_operand(0));
+                Operand d = (dest.get_kind() == OPERAND_MREG) ? dest : X16;
+                Operand addr = get_address(hin->get_operand(1), is_char ? 1 : WORD_SIZE, X16, code);
+                code.push_back(new Instruction(is_char ? AINS_LDRB : AINS_LDR, d, addr));
+                move_from(dest, d, code);
+                break;
+            }
+            case HINS_STORE_INT:
+            case HINS_STORE_CHAR: {
+                // str xS, [xA] (or strb wS, storing the low byte)
+                bool is_char = (hin->get_opcode() == HINS_STORE_CHAR);
+                Operand value = hin->get_operand(1);
+                if (is_char && value.get_kind() == OPERAND_INT_LITERAL) {
+                    value = imm(value.get_int_value() & 0xFF);
+                }
+                Operand src = get_value_or_zero(value, X17, code);
+                Operand addr = get_address(hin->get_operand(0), is_char ? 1 : WORD_SIZE, X16, code);
+                code.push_back(new Instruction(is_char ? AINS_STRB : AINS_STR, src, addr));
+                break;
+            }
+            case HINS_LOAD_ICONST:
+            case HINS_MOV:
+                select_move(get_mreg(hin->get_operand(0)), get_mreg_or_lit(hin->get_operand(1)), code);
+                break;
+            case HINS_WRITE_INT:
+                if (use_runtime) {
+                    // the value is the only argument
+                    select_move(X0, get_mreg_or_lit(hin->get_operand(0)), code);
+                    code.push_back(new Instruction(AINS_BL, write_int_label));
+                    break;
+                }
+                // (the value goes to x1 before x0 is overwritten, since
+                // the vreg may be allocated to it)
+                select_move(X1, get_mreg_or_lit(hin->get_operand(0)), code);
+                load_label_address(X0, "s_writeint_fmt", code);
+                code.push_back(new Instruction(AINS_BL, printf_label));
+                break;
+            case HINS_READ_INT:
+                if (use_runtime) {
+                    // the value read is returned in x0
+                    code.push_back(new Instruction(AINS_BL, read_int_label));
+                    select_move(get_mreg(hin->get_operand(0)), X0, code);
+                    break;
+                }
+                // (scanf always reads into the vreg's stack slot, which is
+                // loaded into its machine register, if it has one)
+                load_label_address(X0, "s_readint_fmt", code);
+                add_sp_offset(X1, get_vreg_slot(hin->get_operand(0)).get_offset(), code);
+                code.push_back(new Instruction(AINS_BL, scanf_label));
+                if (get_mreg(hin->get_operand(0)).get_kind() == OPERAND_MREG) {
+                    move_to(get_mreg(hin->get_operand(0)), get_vreg_slot(hin->get_operand(0)), code);
+                }
+                break;
+            case HINS_WRITE_INT_ARRAY:
+            case HINS_READ_INT_ARRAY: {
+                // the address of the first element, and the number of elements
+                std::vector<std::pair<Operand, Operand>> moves;
+                moves.push_back(std::make_pair(get_mreg_or_lit(hin->get_operand(0)), X0));
+                moves.push_back(std::make_pair(get_mreg_or_lit(hin->get_operand(1)), X1));
+                select_parallel_move(moves, code);
+                code.push_back(new Instruction(AINS_BL, hin->get_opcode() == HINS_WRITE_INT_ARRAY
+                                               ? write_int_array_label : read_int_array_label));
+                break;
+            }
+            case HINS_FILL_INT:
+            case HINS_COPY_INT:
+                translate_fill_copy(hin);
+                break;
+            case HINS_INT_ADD:
+            case HINS_INT_SUB:
+            case HINS_INT_MUL:
+                if (hin->get_opcode() != HINS_INT_MUL && fold_address(i)) {
+                    break;
+                }
+                translate_binary(hin, code);
+                break;
+            case HINS_LEA: {
+                // lea vrD, vrB, vrI, $scale is add xD, xB, xI, lsl #log2(scale)
+                if (fold_address(i)) {
+                    break;
+                }
+                Operand dest = get_mreg(hin->get_operand(0));
+                Operand d = (dest.get_kind() == OPERAND_MREG) ? dest : X16;
+                Operand base = get_value(hin->get_operand(1), X16, code);
+                Operand index = get_value(hin->get_operand(2), X17, code);
+                long scale = hin->get_operand(3).get_int_value();
+                if (scale == 1) {
+                    code.push_back(new Instruction(AINS_ADD, d, base, index));
+                } else {
+                    code.push_back(new Instruction(AINS_ADD_LSL, { d, base, index, imm(__builtin_ctzl(scale)) }));
+                }
+                move_from(dest, d, code);
+                break;
+            }
+            case HINS_INT_DIV:
+            case HINS_INT_MOD:
+            case HINS_UINT_DIV:
+            case HINS_UINT_MOD: {
+                // (a division and the remainder of the same operands share
+                // the division, as for x86-64)
+                Instruction *pair = nullptr;
+                if (i + 1 < num_ins && !hins->has_label(i + 1) && is_division_pair(hin, hins->get_instruction(i + 1))) {
+                    pair = hins->get_instruction(++i);
+                }
+                translate_division(hin, pair);
+                break;
+            }
+            case HINS_INT_COMPARE:
+                translate_compare(hin, code);
+                break;
+            case HINS_CMOVE:
+            case HINS_CMOVNE:
+            case HINS_CMOVLT:
+            case HINS_CMOVLTE:
+            case HINS_CMOVGT:
+            case HINS_CMOVGTE: {
+                // csel xD, xT, xF, cc (the loads of the operands into the
+                // scratch registers don't change the flags of the cmpi)
+                Operand dest = get_mreg(hin->get_operand(0));
+                Operand d = (dest.get_kind() == OPERAND_MREG) ? dest : X16;
+                Operand t = get_value_or_zero(hin->get_operand(1), X16, code);
+                Operand f = get_value_or_zero(hin->get_operand(2), X17, code);
+                code.push_back(new Instruction(get_csel_opcode(hin->get_opcode()), d, t, f));
+                move_from(dest, d, code);
+                break;
+            }
+            case HINS_JUMP:
+            case HINS_JE:
+            case HINS_JNE:
+            case HINS_JLT:
+            case HINS_JLTE:
+            case HINS_JGT:
+            case HINS_JGTE:
+                code.push_back(new Instruction(get_branch_opcode(hin->get_opcode()), hin->get_operand(0)));
+                break;
+            case HINS_NOP:
+                code.push_back(new Instruction(AINS_NOP));
+                break;
+            case HINS_VEC_LOAD:
+            case HINS_VEC_STORE:
+            case HINS_VEC_ADD:
+            case HINS_VEC_SUB:
+            case HINS_VEC_DUP:
+                translate_vector_instruction(hin, code);
+                break;
+            case HINS_PARAM: {
+                // the parameters are copied from the argument registers
+                // all at once (since their vregs may be allocated to them)
+                std::vector<std::pair<Operand, Operand>> moves;
+                Instruction *first = hin;
+                for (;;) {
+                    Instruction *param = hins->get_instruction(i);
+                    unsigned k = unsigned(param->get_operand(1).get_int_value());
+                    assert(k < MAX_ARGS);
+                    moves.push_back(std::make_pair(Operand(OPERAND_MREG, ARG_REGS[k]), get_mreg(param->get_operand(0))));
+                    if (i + 1 == num_ins || hins->has_label(i + 1)
+                            || hins->get_instruction(i + 1)->get_opcode() != HINS_PARAM) {
+                        break;
+                    }
+                    i++;
+                }
+                select_parallel_move(moves, code);
+                if (code.empty()) {
+                    code.push_back(new Instruction(AINS_NOP));
+                }
+                add_code(code, first);
+                code.clear();
+                break;
+            }
+            case HINS_CALL:
+            case HINS_CALL_PROC:
+                translate_call(hin, code);
+                break;
+            case HINS_RETURN:
+                select_move(X0, get_mreg_or_lit(hin->get_operand(0)), code);
+                break;
+            case HINS_PREFETCH: {
+                // prfm pldl1keep, [xB, #n]
+                Operand ahead = hin->get_operand(0);
+                Operand base = get_mreg(ahead);
+                if (base.get_kind() != OPERAND_MREG) {
+                    move_to(X16, base, code);
+                    base = X16;
+                }
+                long offset = (ahead.get_kind() == OPERAND_VREG_MEMREF_OFFSET) ? ahead.get_offset() : 0;
+                if (AArch64::is_memref_offset(offset, WORD_SIZE)) {
+                    code.push_back(new Instruction(AINS_PRFM, Operand(OPERAND_MREG_MEMREF_OFFSET, base.get_base_reg(), int(offset))));
+                } else {
+                    load_constant(offset, X17, code);
+                    code.push_back(new Instruction(AINS_PRFM, Operand(OPERAND_MREG_MEMREF_INDEX, base.get_base_reg(), AREG_X17)));
+                }
+                break;
+            }
+            case HINS_BOUNDS_CHECK: {
+                // cmp xI, #(n-1); b.hi <trap>: a negative index is a large
+                // unsigned number, so one comparison checks both bounds
+                Operand trap(get_bounds_trap_label());
+                long limit = hin->get_operand(1).get_int_value() - 1;
+                if (limit < 0) {
+                    // (no index is in range)
+                    code.push_back(new Instruction(AINS_B, trap));
+                    break;
+                }
+                Operand index = get_value(hin->get_operand(0), X16, code);
+                if (AArch64::is_arith_immediate(limit)) {
+                    code.push_back(new Instruction(AINS_CMP, index, imm(limit)));
+                } else {
+                    load_constant(limit, X17, code);
+                    code.push_back(new Instruction(AINS_CMP, index, X17));
+                }
+                code.push_back(new Instruction(AINS_B_HI, trap));
+                break;
+            }
+            case HINS_PROFILE_COUNT: {
+                // the counter of block N is at offset 8N in __profile_counts
+                long offset = WORD_SIZE * hin->get_operand(0).get_int_value();
+                load_label_address(X16, "__profile_counts", code);
+                Operand counter(OPERAND_MREG_MEMREF_OFFSET, AREG_X16, int(offset));
+                if (!AArch64::is_memref_offset(offset, WORD_SIZE)) {
+                    load_constant(offset, X15, code);
+                    counter = Operand(OPERAND_MREG_MEMREF_INDEX, AREG_X16, AREG_X15);
+                }
+                code.push_back(new Instruction(AINS_LDR, X17, counter));
+                code.push_back(new Instruction(AINS_ADD, X17, X17, imm(1)));
+                code.push_back(new Instruction(AINS_STR, X17, counter));
+                break;
+            }
+            case HINS_COLD:
+                // the epilogue goes here (after the profile is written),
+                // and the cold code follows it
+                if (num_profile_counters > 0 && is_main) {
+                    translate_profile_dump();
+                }
+                assembly->add_instruction(new Instruction(AINS_COLD));
+                ended = true;
+                break;
+            default:
+                break;
+        }
+        add_code(code, hin);
+    }
+    assert(folded_vreg < 0);
+
+    if (hins->has_label_at_end()) {
+        define_label(hins->get_label_at_end());
+    }
+    if (num_profile_counters > 0 && is_main && !ended) {
+        translate_profile_dump();
+    }
+}
+
+void AArch64Lowering::emit(OutputSink &out) {
+    std::vector<int> saved_regs = get_saved_regs(TARGET_AARCH64);
+    unsigned hot_end = get_hot_end(AINS_COLD);
+    bool has_cold = hot_end < assembly->get_length();
+
+    out.put("/* ");
+    out.put_int(num_vreg);
+    out.put(" vregs used */\n");
+    if (is_global) {
+        out.put("\t.globl ");
+        out.put(function_label);
+        out.put('\n');
+    }
+    out.put(function_label);
+    out.put(":\n");
+    emit_prologue(out, saved_regs);
+
+    PrintAArch64InstructionSequence print_asm(assembly);
+    print_asm.print(out, 0, hot_end);
+    if (has_cold && assembly->has_label(hot_end)) {
+        out.put(assembly->get_label(hot_end));
+        out.put(":\n");
+    }
+    emit_epilogue(out, saved_regs);
+    if (has_cold) {
+        print_asm.print(out, hot_end + 1, assembly->get_length());
+    }
+    if (uses_bounds_trap()) {
+        out.put(get_bounds_trap_label());
+        out.put(":\n\tudf #0\n");
+    }
+}
+
+void AArch64Lowering::add_code(const Code &code, Instruction *hin) {
+    if (code.empty()) {
+        return;
+    }
+    set_hins_comment(code[0], hin);
+    for (auto i = code.begin(); i != code.end(); i++) {
+        assembly->add_instruction(*i);
+    }
+}
+
+void AArch64Lowering::define_label(const std::string &label) {
+    if (assembly->has_label_at_end()) {
+        assembly->add_instruction(new Instruction(AINS_NOP));
+    }
+    assembly->define_label(label);
+}
+
+void AArch64Lowering::load_constant(long value, const Operand &reg, Code &code) {
+    if (value >= -65536 && value <= 65535) {
+        code.push_back(new Instruction(AINS_MOV, reg, imm(value)));
+        return;
+    }
+
+    // (the pieces equal to the initial value of the register are skipped)
+    unsigned long bits = (unsigned long) value;
+    int num_zero = 0, num_ones = 0;
+    for (int shift = 0; shift < 64; shift += 16) {
+        unsigned long piece = (bits >> shift) & 0xFFFF;
+        num_zero += (piece == 0) ? 1 : 0;
+        num_ones += (piece == 0xFFFF) ? 1 : 0;
+    }
+    bool inverted = num_ones > num_zero;
+    bool first = true;
+    for (int shift = 0; shift < 64; shift += 16) {
+        long piece = long((bits >> shift) & 0xFFFF);
+        if (piece == (inverted ? 0xFFFF : 0)) {
+            continue;
+        }
+        if (first) {
+            code.push_back(new Instruction(inverted ? AINS_MOVN : AINS_MOVZ,
+                                           { reg, imm(inverted ? (~piece & 0xFFFF) : piece), imm(shift) }));
+            first = false;
+        } else {
+            code.push_back(new Instruction(AINS_MOVK, { reg, imm(piece), imm(shift) }));
+        }
+    }
+}
+
+Operand AArch64Lowering::get_sp_memref(const Operand &memref, long size, Code &code) {
+    long offset = memref.get_offset();
+    if (AArch64::is_memref_offset(offset, size)) {
+        return memref;
+    }
+    load_constant(offset, X30, code);
+    return Operand(OPERAND_MREG_MEMREF_INDEX, memref.get_base_reg(), AREG_X30);
+}
+
+void AArch64Lowering::add_sp_offset(const Operand &reg, long offset, Code &code) {
+    if (AArch64::is_arith_immediate(offset)) {
+        code.push_back(new Instruction(AINS_ADD, reg, SP, imm(offset)));
+    } else {
+        load_constant(offset, reg, code);
+        code.push_back(new Instruction(AINS_ADD, reg, SP, reg));
+    }
+}
+
+void AArch64Lowering::load_label_address(const Operand &reg, const std::string &label, Code &code) {
+    code.push_back(new Instruction(AINS_ADRP, reg, Operand(label)));
+    code.push_back(new Instruction(AINS_ADD_LO12, reg, reg, Operand(label, true)));
+}
+
+void AArch64Lowering::move_to(const Operand &reg, const Operand &src, Code &code) {
+    if (src.get_kind() == OPERAND_INT_LITERAL) {
+        load_constant(src.get_int_value(), reg, code);
+    } else if (src.get_kind() == OPERAND_MREG) {
+        if (!is_same_mreg(src, reg)) {
+            code.push_back(new Instruction(AINS_MOV, reg, src));
+        }
+    } else {
+        code.push_back(new Instruction(AINS_LDR, reg, get_sp_memref(src, WORD_SIZE, code)));
+    }
+}
+
+void AArch64Lowering::move_from(const Operand &dest, const Operand &reg, Code &code) {
+    if (dest.get_kind() == OPERAND_MREG) {
+        if (!is_same_mreg(dest, reg)) {
+            code.push_back(new Instruction(AINS_MOV, dest, reg));
+        }
+    } else {
+        code.push_back(new Instruction(AINS_STR, reg, get_sp_memref(dest, WORD_SIZE, code)));
+    }
+}
+
+void AArch64Lowering::select_move(const Operand &dest, const Operand &src, Code &code) {
+    if (dest.get_kind() == OPERAND_MREG) {
+        move_to(dest, src, code);
+    } else if (src.get_kind() == OPERAND_MREG) {
+        move_from(dest, src, code);
+    } else if (src.get_kind() == OPERAND_INT_LITERAL && src.get_int_value() == 0) {
+        move_from(dest, XZR, code);
+    } else {
+        move_to(X16, src, code);
+        move_from(dest, X16, code);
+    }
+}
+
+Operand AArch64Lowering::get_value(const Operand &operand, const Operand &scratch, Code &code) {
+    Operand reg = get_mreg_or_lit(operand);
+    if (reg.get_kind() != OPERAND_MREG) {
+        move_to(scratch, reg, code);
+        reg = scratch;
+    }
+    if (operand.is_memref()) {
+        code.push_back(new Instruction(AINS_LDR, scratch, reg.to_memref()));
+        reg = scratch;
+    }
+    return reg;
+}
+
+Operand AArch64Lowering::get_value_or_zero(const Operand &operand, const Operand &scratch, Code &code) {
+    if (operand.get_kind() == OPERAND_INT_LITERAL && operand.get_int_value() == 0) {
+        return XZR;
+    }
+    return get_value(operand, scratch, code);
+}
+
+Operand AArch64Lowering::get_address(const Operand &memref, long size, const Operand &scratch, Code &code) {
+    if (memref.get_kind() == OPERAND_LOCAL_MEMREF) {
+        return get_sp_memref(get_local_memref(memref), size, code);
+    }
+    if (folded_vreg >= 0 && memref.has_base_reg() && memref.get_base_reg() == folded_vreg) {
+        folded_vreg = -1;
+        return folded_address;
+    }
+    Operand base = get_mreg_or_lit(memref);
+    if (base.get_kind() != OPERAND_MREG) {
+        move_to(scratch, base, code);
+        base = scratch;
+    }
+    return base.to_memref();
+}
+
+bool AArch64Lowering::fold_address(unsigned i) {
+    Instruction *hin = hins->get_instruction(i);
+    int vreg = hin->get_operand(0).get_base_reg();
+    if (i + 1 >= hins->get_length() || hins->has_label(i + 1) || vreg_occurrences[vreg] != 2) {
+        return false;
+    }
+
+    // (the vreg is defined here, and only used as the address of the next
+    // instruction, if it's a load or store)
+    Instruction *next = hins->get_instruction(i + 1);
+    long size;
+    Operand memref;
+    switch (next->get_opcode()) {
+        case HINS_LOAD_INT:   size = WORD_SIZE; memref = next->get_operand(1); break;
+        case HINS_LOAD_CHAR:  size = 1;         memref = next->get_operand(1); break;
+        case HINS_STORE_INT:  size = WORD_SIZE; memref = next->get_operand(0); break;
+        case HINS_STORE_CHAR: size = 1;         memref = next->get_operand(0); break;
+        case HINS_VEC_LOAD:   size = 16;        memref = next->get_operand(1); break;
+        case HINS_VEC_STORE:  size = 16;        memref = next->get_operand(0); break;
+        default:              return false;
+    }
+    if (memref.get_kind() != OPERAND_VREG_MEMREF || memref.get_base_reg() != vreg) {
+        return false;
+    }
+
+    // the base goes to x16 and the index to x15, if they're in memory
+    Code code;
+    if (hin->get_opcode() == HINS_LEA) {
+        // [xB, xI, lsl #log2(scale)], for a scale of 1 or the size
+        long scale = hin->get_operand(3).get_int_value();
+        if (scale != 1 && scale != size) {
+            return false;
+        }
+        Operand base = get_value(hin->get_operand(1), X16, code);
+        Operand index = get_value(hin->get_operand(2), X15, code);
+        folded_address = (scale == 1)
+                ? Operand(OPERAND_MREG_MEMREF_INDEX, base.get_base_reg(), index.get_base_reg())
+                : Operand(OPERAND_MREG_MEMREF_OFFSET_INDEX, base.get_base_reg(), index.get_base_reg(), 0, int(scale));
+    } else {
+        // [xB, #offset] or [xB, xI]
+        bool is_add = (hin->get_opcode() == HINS_INT_ADD);
+        Operand a = hin->get_operand(1);
+        Operand b = hin->get_operand(2);
+        if (a.is_memref() || b.is_memref()) {
+            return false;
+        }
+        if (is_add && a.get_kind() == OPERAND_INT_LITERAL) {
+            std::swap(a, b);
+        }
+        if (a.get_kind() == OPERAND_INT_LITERAL) {
+            return false;
+        }
+        if (b.get_kind() == OPERAND_INT_LITERAL) {
+            long value = b.get_int_value();
+            if (value == LONG_MIN || !AArch64::is_memref_offset(is_add ? value : -value, size)) {
+                return false;
+            }
+            Operand base = get_value(a, X16, code);
+            folded_address = Operand(OPERAND_MREG_MEMREF_OFFSET, base.get_base_reg(), int(is_add ? value : -value));
+        } else {
+            if (!is_add) {
+                return false;
+            }
+            Operand base = get_value(a, X16, code);
+            Operand index = get_value(b, X15, code);
+            folded_address = Operand(OPERAND_MREG_MEMREF_INDEX, base.get_base_reg(), index.get_base_reg());
+        }
+    }
+    folded_vreg = vreg;
+    add_code(code, hin);
+    return true;
+}
+
+void AArch64Lowering::select_parallel_move(const std::vector<std::pair<Operand, Operand>> &moves, Code &code) {
+    std::vector<std::pair<Operand, Operand>> sequence;
+    order_parallel_move(moves, X15, sequence);
+    for (auto i = sequence.begin(); i != sequence.end(); i++) {
+        select_move(i->second, i->first, code);
+    }
+}
+
+void AArch64Lowering::translate_binary(Instruction *hin, Code &code) {
+    int opcode = hin->get_opcode();
+    Operand dest = get_mreg(hin->get_operand(0));
+    Operand d = (dest.get_kind() == OPERAND_MREG) ? dest : X16;
+    Operand arg1 = hin->get_operand(1);
+    Operand arg2 = hin->get_operand(2);
+
+    // (a constant operand of an addition or multiplication goes second,
+    // where it may be an immediate, or a shift)
+    if (opcode != HINS_INT_SUB && arg1.get_kind() == OPERAND_INT_LITERAL && arg2.get_kind() != OPERAND_INT_LITERAL) {
+        std::swap(arg1, arg2);
+    }
+    Operand a = get_value(arg1, X16, code);
+    if (arg2.get_kind() == OPERAND_INT_LITERAL) {
+        long value = arg2.get_int_value();
+        if (opcode != HINS_INT_MUL) {
+            // add or subtract a 12-bit immediate (or its negation)
+            bool is_add = (opcode == HINS_INT_ADD);
+            if (AArch64::is_arith_immediate(value)) {
+                code.push_back(new Instruction(is_add ? AINS_ADD : AINS_SUB, d, a, imm(value)));
+                move_from(dest, d, code);
+                return;
+            }
+            if (value != LONG_MIN && AArch64::is_arith_immediate(-value)) {
+                code.push_back(new Instruction(is_add ? AINS_SUB : AINS_ADD, d, a, imm(-value)));
+                move_from(dest, d, code);
+                return;
+            }
+        } else if (value > 0 && (value & (value - 1)) == 0) {
+            // multiply by a power of two with a shift
+            int k = __builtin_ctzl(value);
+            if (k > 0) {
+                code.push_back(new Instruction(AINS_LSL, d, a, imm(k)));
+            } else if (!is_same_mreg(a, d)) {
+                code.push_back(new Instruction(AINS_MOV, d, a));
+            }
+            move_from(dest, d, code);
+            return;
+        }
+    }
+    Operand b = get_value(arg2, X17, code);
+    int ains = (opcode == HINS_INT_ADD) ? AINS_ADD : (opcode == HINS_INT_SUB) ? AINS_SUB : AINS_MUL;
+    code.push_back(new Instruction(ains, d, a, b));
+    move_from(dest, d, code);
+}
+
+void AArch64Lowering::translate_compare(Instruction *hin, Code &code) {
+    // cmp xL, xR (or a 12-bit immediate, or cmn with its negation)
+    Operand l = get_value(hin->get_operand(0), X16, code);
+    Operand r = hin->get_operand(1);
+    if (r.get_kind() == OPERAND_INT_LITERAL) {
+        long value = r.get_int_value();
+        if (AArch64::is_arith_immediate(value)) {
+            code.push_back(new Instruction(AINS_CMP, l, imm(value)));
+            return;
+        }
+        if (value != LONG_MIN && AArch64::is_arith_immediate(-value)) {
+            code.push_back(new Instruction(AINS_CMN, l, imm(-value)));
+            return;
+        }
+    }
+    code.push_back(new Instruction(AINS_CMP, l, get_value(r, X17, code)));
+}
+
+void AArch64Lowering::translate_call(Instruction *hin, Code &code) {
+    // the arguments are moved into their registers all at once (since
+    // they may be in the argument registers already), and a function's
+    // result is returned in x0
+    bool is_function = (hin->get_opcode() == HINS_CALL);
+    unsigned first_arg = is_function ? 2 : 1;
+    std::vector<std::pair<Operand, Operand>> moves;
+    for (unsigned j = first_arg; j < hin->get_num_operands(); j++) {
+        assert(j - first_arg < MAX_ARGS);
+        moves.push_back(std::make_pair(get_mreg_or_lit(hin->get_operand(j)), Operand(OPERAND_MREG, ARG_REGS[j - first_arg])));
+    }
+    select_parallel_move(moves, code);
+    code.push_back(new Instruction(AINS_BL, hin->get_operand(first_arg - 1)));
+    if (is_function) {
+        select_move(get_mreg(hin->get_operand(0)), X0, code);
+    }
+}
+
+void AArch64Lowering::translate_fill_copy(Instruction *hin) {
+    bool is_fill = (hin->get_opcode() == HINS_FILL_INT);
+    Operand dest = get_mreg_or_lit(hin->get_operand(0));
+    Operand src = get_mreg_or_lit(hin->get_operand(1));
+    Operand count = get_mreg_or_lit(hin->get_operand(2));
+    Code code;
+
+    if (use_runtime) {
+        // (the runtime's functions use non-temporal stores for large arrays)
+        std::vector<std::pair<Operand, Operand>> moves;
+        moves.push_back(std::make_pair(dest, X0));
+        moves.push_back(std::make_pair(src, X1));
+        moves.push_back(std::make_pair(count, X2));
+        select_parallel_move(moves, code);
+        code.push_back(new Instruction(AINS_BL, Operand(is_fill ? "__rt_fill_int" : "__rt_copy_int")));
+        add_code(code, hin);
+        return;
+    }
+
+    bool is_positive = count.get_kind() == OPERAND_INT_LITERAL && count.get_int_value() > 0;
+    if (count.get_kind() == OPERAND_INT_LITERAL && !is_positive) {
+        code.push_back(new Instruction(AINS_NOP));
+        add_code(code, hin);
+        return;
+    }
+
+    // a loop storing x17 (or the element loaded through x17) through x16,
+    // x15 times (entered at the test, unless the count is known to be positive)
+    move_to(X16, dest, code);
+    move_to(X17, src, code);
+    move_to(X15, count, code);
+    std::string loop_label = StringTable::labels().new_label(is_fill ? ".Lfill" : ".Lcopy");
+    std::string test_label;
+    if (!is_positive) {
+        test_label = StringTable::labels().new_label(is_fill ? ".Lfill" : ".Lcopy");
+        code.push_back(new Instruction(AINS_B, Operand(test_label)));
+    }
+    add_code(code, hin);
+
+    Operand step = imm(WORD_SIZE);
+    define_label(loop_label);
+    if (is_fill) {
+        assembly->add_instruction(new Instruction(AINS_STR_POST, X17, Operand(OPERAND_MREG_MEMREF, AREG_X16), step));
+    } else {
+        assembly->add_instruction(new Instruction(AINS_LDR_POST, X30, Operand(OPERAND_MREG_MEMREF, AREG_X17), step));
+        assembly->add_instruction(new Instruction(AINS_STR_POST, X30, Operand(OPERAND_MREG_MEMREF, AREG_X16), step));
+    }
+    if (!is_positive) {
+        define_label(test_label);
+    }
+    assembly->add_instruction(new Instruction(AINS_SUBS, X15, X15, imm(1)));
+    assembly->add_instruction(new Instruction(is_positive ? AINS_B_NE : AINS_B_GE, Operand(loop_label)));
+}
+
+void AArch64Lowering::translate_vector_instruction(Instruction *hin, Code &code) {
+    // (the Advanced SIMD instructions for pairs of 64-bit integers, on the
+    // caller-saved registers v16-v31)
+    switch (hin->get_opcode()) {
+        case HINS_VEC_LOAD: {
+            Operand addr = get_address(hin->get_operand(1), 2 * WORD_SIZE, X16, code);
+            code.push_back(new Instruction(AINS_LDR_Q, get_vector_reg(hin->get_operand(0)), addr));
+            break;
+        }
+        case HINS_VEC_STORE: {
+            Operand addr = get_address(hin->get_operand(0), 2 * WORD_SIZE, X16, code);
+            code.push_back(new Instruction(AINS_STR_Q, get_vector_reg(hin->get_operand(1)), addr));
+            break;
+        }
+        case HINS_VEC_ADD:
+        case HINS_VEC_SUB:
+            code.push_back(new Instruction(hin->get_opcode() == HINS_VEC_ADD ? AINS_ADD_2D : AINS_SUB_2D,
+                                           get_vector_reg(hin->get_operand(0)), get_vector_reg(hin->get_operand(1)),
+                                           get_vector_reg(hin->get_operand(2))));
+            break;
+        case HINS_VEC_DUP: {
+            Operand src = get_value_or_zero(hin->get_operand(1), X16, code);
+            code.push_back(new Instruction(AINS_DUP_2D, get_vector_reg(hin->get_operand(0)), src));
+            break;
+        }
+        default:
+            assert(false);
+    }
+}
+
+void AArch64Lowering::translate_division(Instruction *hin, Instruction *pair) {
+    int opcode = hin->get_opcode();
+    bool is_unsigned = opcode == HINS_UINT_DIV || opcode == HINS_UINT_MOD;
+    bool need_quotient = is_quotient(opcode) || (pair != nullptr && is_quotient(pair->get_opcode()));
+    bool need_remainder = !is_quotient(opcode) || (pair != nullptr && !is_quotient(pair->get_opcode()));
+
+    // the quotient is computed in x15, and the remainder in x16
+    Code code;
+    Operand n = get_value(hin->get_operand(1), X16, code);
+    Operand quotient, remainder;
+    bool by_constant = is_unsigned
+            ? translate_unsigned_div_by_constant(hin, n, need_quotient, need_remainder, code, quotient, remainder)
+            : translate_div_by_constant(hin, n, need_remainder, code, quotient, remainder);
+    if (!by_constant) {
+        // (the remainder is n - (n / d) * d, as msub computes it)
+        Operand d = get_value(hin->get_operand(2), X17, code);
+        code.push_back(new Instruction(is_unsigned ? AINS_UDIV : AINS_SDIV, X15, n, d));
+        quotient = X15;
+        if (need_remainder) {
+            code.push_back(new Instruction(AINS_MSUB, { X16, X15, d, n }));
+            remainder = X16;
+        }
+    }
+
+    // (hin's destination isn't one of the operands, but the pair's may be)
+    move_from(get_mreg(hin->get_operand(0)), is_quotient(opcode) ? quotient : remainder, code);
+    add_code(code, hin);
+    if (pair != nullptr) {
+        Code pair_code;
+        move_from(get_mreg(pair->get_operand(0)), is_quotient(pair->get_opcode()) ? quotient : remainder, pair_code);
+        add_code(pair_code, pair);
+    }
+}
+
+bool AArch64Lowering::translate_div_by_constant(Instruction *hin, const Operand &n, bool need_remainder, Code &code,
+                                                Operand &quotient, Operand &remainder) {
+    Operand divisor = hin->get_operand(2);
+    if (divisor.get_kind() != OPERAND_INT_LITERAL || divisor.get_int_value() < 2) {
+        return false;
+    }
+    long d = divisor.get_int_value();
+
+    if ((d & (d - 1)) == 0) {
+        // add d - 1 to a negative dividend, so the shift rounds towards zero
+        int k = __builtin_ctzl(d);
+        if (k > 1) {
+            code.push_back(new Instruction(AINS_ASR, X17, n, imm(63)));
+            code.push_back(new Instruction(AINS_LSR, X17, X17, imm(64 - k)));
+        } else {
+            code.push_back(new Instruction(AINS_LSR, X17, n, imm(63)));
+        }
+        code.push_back(new Instruction(AINS_ADD, X17, n, X17));
+        code.push_back(new Instruction(AINS_ASR, X15, X17, imm(k)));
+        quotient = X15;
+        if (need_remainder) {
+            code.push_back(new Instruction(AINS_SUB_LSL, { X16, n, X15, imm(k) }));
+            remainder = X16;
+        }
+        return true;
+    }
+
+    // smulh gives the high word of the product, which is corrected
+    // as for x86-64 (see get_magic_number)
+    long multiplier;
+    int shift;
+    get_magic_number(d, multiplier, shift);
+    load_constant(multiplier, X17, code);
+    code.push_back(new Instruction(AINS_SMULH, X15, n, X17));
+    if (multiplier < 0) {
+        code.push_back(new Instruction(AINS_ADD, X15, X15, n));
+    }
+    if (shift > 0) {
+        code.push_back(new Instruction(AINS_ASR, X15, X15, imm(shift)));
+    }
+    code.push_back(new Instruction(AINS_LSR, X17, n, imm(63)));
+    code.push_back(new Instruction(AINS_ADD, X15, X15, X17));
+    quotient = X15;
+    if (need_remainder) {
+        load_constant(d, X17, code);
+        code.push_back(new Instruction(AINS_MSUB, { X16, X15, X17, n }));
+        remainder = X16;
+    }
+    return true;
+}
+
+bool AArch64Lowering::translate_unsigned_div_by_constant(Instruction *hin, const Operand &n, bool need_quotient,
+                                                         bool need_remainder, Code &code, Operand &quotient,
+                                                         Operand &remainder) {
+    Operand divisor = hin->get_operand(2);
+    if (divisor.get_kind() != OPERAND_INT_LITERAL || divisor.get_int_value() == 0) {
+        return false;
+    }
+    unsigned long d = (unsigned long) divisor.get_int_value();
+
+    if ((d & (d - 1)) == 0) {
+        // a shift for the quotient, and a mask for the remainder
+        int k = __builtin_ctzl(d);
+        quotient = n;
+        if (need_quotient && k > 0) {
+            code.push_back(new Instruction(AINS_LSR, X15, n, imm(k)));
+            quotient = X15;
+        }
+        remainder = XZR;
+        if (need_remainder && k > 0) {
+            code.push_back(new Instruction(AINS_AND, X16, n, imm(long(d - 1))));
+            remainder = X16;
+        }
+        return true;
+    }
+
+    unsigned long multiplier;
+    int shift;
+    bool add;
+    get_unsigned_magic_number(d, multiplier, shift, add);
+    load_constant(long(multiplier), X17, code);
+    code.push_back(new Instruction(AINS_UMULH, X15, n, X17));
+    if (add) {
+        code.push_back(new Instruction(AINS_SUB, X17, n, X15));
+        code.push_back(new Instruction(AINS_LSR, X17, X17, imm(1)));
+        code.push_back(new Instruction(AINS_ADD, X15, X15, X17));
+        shift--;
+    }
+    if (shift > 0) {
+        code.push_back(new Instruction(AINS_LSR, X15, X15, imm(shift)));
+    }
+    quotient = X15;
+    if (need_remainder) {
+        load_constant(long(d), X17, code);
+        code.push_back(new Instruction(AINS_MSUB, { X16, X15, X17, n }));
+        remainder = X16;
+    }
+    return true;
+}
+
+void AArch64Lowering::translate_profile_dump() {
+    std::string loop_label = StringTable::labels().new_label(".Lprofile");
+    std::string done_label = StringTable::labels().new_label(".Lprofile");
+    Code code;
+
+    // x19 = fopen(s_profile_file, "w"), skipping the rest if it fails
+    load_label_address(X0, "s_profile_file", code);
+    code[0]->set_comment("write the profile");
+    load_label_address(X1, "s_profile_mode", code);
+    code.push_back(new Instruction(AINS_BL, Operand("fopen")));
+    code.push_back(new Instruction(AINS_MOV, X19, X0));
+    code.push_back(new Instruction(AINS_CMP, X19, imm(0)));
+    code.push_back(new Instruction(AINS_B_EQ, Operand(done_label)));
+
+    // fprintf each counter, with x20 pointing to it and x21 counting down
+    load_label_address(X20, "__profile_counts", code);
+    load_constant(long(num_profile_counters), X21, code);
+    for (auto i = code.begin(); i != code.end(); i++) {
+        assembly->add_instruction(*i);
+    }
+    code.clear();
+    define_label(loop_label);
+    code.push_back(new Instruction(AINS_MOV, X0, X19));
+    load_label_address(X1, "s_writeint_fmt", code);
+    code.push_back(new Instruction(AINS_LDR_POST, X2, Operand(OPERAND_MREG_MEMREF, AREG_X20), imm(WORD_SIZE)));
+    code.push_back(new Instruction(AINS_BL, Operand("fprintf")));
+    code.push_back(new Instruction(AINS_SUBS, X21, X21, imm(1)));
+    code.push_back(new Instruction(AINS_B_NE, Operand(loop_label)));
+
+    code.push_back(new Instruction(AINS_MOV, X0, X19));
+    code.push_back(new Instruction(AINS_BL, Operand("fclose")));
+    for (auto i = code.begin(); i != code.end(); i++) {
+        assembly->add_instruction(*i);
+    }
+    define_label(done_label);
+}
+
+bool AArch64Lowering::uses_bounds_trap() const {
+    const std::string label = get_bounds_trap_label();
+    for (auto i = assembly->cbegin(); i != assembly->cend(); i++) {
+        Instruction *ins = *i;
+        if ((ins->get_opcode() == AINS_B_HI || ins->get_opcode() == AINS_B)
+                && ins->get_operand(0).get_target_label() == label) {
+            return true;
+        }
+    }
+    return false;
+}
+
+long AArch64Lowering::get_frame_size() const {
+    return (total_storage_size + 15) / 16 * 16;
+}
+
+void AArch64Lowering::emit_prologue(OutputSink &out, const std::vector<int> &saved_regs) {
+    // stp x29, x30, [sp, #-16]!; mov x29, sp; then the saved registers in
+    // pairs, and the storage
+    Operand push(OPERAND_MREG_MEMREF_OFFSET, AREG_SP, -16);
+    Code code;
+    code.push_back(new Instruction(AINS_STP_PRE, X29, X30, push));
+    code.push_back(new Instruction(AINS_MOV, X29, SP));
+    for (unsigned i = 0; i < saved_regs.size(); i += 2) {
+        Operand reg(OPERAND_MREG, saved_regs[i]);
+        if (i + 1 < saved_regs.size()) {
+            code.push_back(new Instruction(AINS_STP_PRE, reg, Operand(OPERAND_MREG, saved_regs[i + 1]), push));
+        } else {
+            code.push_back(new Instruction(AINS_STR_PRE, reg, push));
+        }
+    }
+    long frame_size = get_frame_size();
+    if (AArch64::is_arith_immediate(frame_size)) {
+        if (frame_size != 0) {
+            code.push_back(new Instruction(AINS_SUB, SP, SP, imm(frame_size)));
+        }
+    } else {
+        load_constant(frame_size, X16, code);
+        code.push_back(new Instruction(AINS_SUB, SP, SP, X16));
+    }
+
+    PrintAArch64InstructionSequence print_asm(nullptr);
+    for (auto i = code.begin(); i != code.end(); i++) {
+        out.put('\t');
+        print_asm.format_instruction(out, *i);
+        out.put('\n');
+        delete *i;
+    }
+}
+
+void AArch64Lowering::emit_epilogue(OutputSink &out, const std::vector<int> &saved_regs) {
+    Operand pop(OPERAND_MREG_MEMREF, AREG_SP);
+    Code code;
+    long frame_size = get_frame_size();
+    if (AArch64::is_arith_immediate(frame_size)) {
+        if (frame_size != 0) {
+            code.push_back(new Instruction(AINS_ADD, SP, SP, imm(frame_size)));
+        }
+    } else {
+        load_constant(frame_size, X16, code);
+        code.push_back(new Instruction(AINS_ADD, SP, SP, X16));
+    }
+    // (the pairs the prologue saved, the other way around)
+    for (unsigned i = unsigned(saved_regs.size() + 1) / 2 * 2; i > 0; i -= 2) {
+        Operand reg(OPERAND_MREG, saved_regs[i - 2]);
+        if (i - 1 < saved_regs.size()) {
+            code.push_back(new Instruction(AINS_LDP_POST, { reg, Operand(OPERAND_MREG, saved_regs[i - 1]), pop, imm(16) }));
+        } else {
+            code.push_back(new Instruction(AINS_LDR_POST, reg, pop, imm(16)));
+        }
+    }
+    code.push_back(new Instruction(AINS_LDP_POST, { X29, X30, pop, imm(16) }));
+    if (is_main) {
+        code.push_back(new Instruction(AINS_MOV, X0, imm(0)));
+    }
+    code.push_back(new Instruction(AINS_RET));
+
+    PrintAArch64InstructionSequence print_asm(nullptr);
+    for (auto i = code.begin(); i != code.end(); i++) {
+        out.put('\t');
+        print_asm.format_instruction(out, *i);
+        out.put('\n');
+        delete *i;
+    }
+}
+
+int AArch64Lowering::get_branch_opcode(int opcode) {
+    switch (opcode) {
+        case HINS_JUMP: return AINS_B;
+        case HINS_JE:   return AINS_B_EQ;
+        case HINS_JNE:  return AINS_B_NE;
+        case HINS_JLT:  return AINS_B_LT;
+        case HINS_JLTE: return AINS_B_LE;
+        case HINS_JGT:  return AINS_B_GT;
+        case HINS_JGTE: return AINS_B_GE;
+        default:        assert(false); return AINS_NOP;
+    }
+}
+
+int AArch64Lowering::get_csel_opcode(int opcode) {
+    switch (opcode) {
+        case HINS_CMOVE:   return AINS_CSEL_EQ;
+        case HINS_CMOVNE:  return AINS_CSEL_NE;
+        case HINS_CMOVLT:  return AINS_CSEL_LT;
+        case HINS_CMOVLTE: return AINS_CSEL_LE;
+        case HINS_CMOVGT:  return AINS_CSEL_GT;
+        case HINS_CMOVGTE: return AINS_CSEL_GE;
+        default:           assert(false); return AINS_NOP;
+    }
+}
@@ -0,0 +1,150 @@
+#ifndef AARCH64_LOWERING_H
+#define AARCH64_LOWERING_H
+
+#include <utility>
+#include <vector>
+#include "cfg.h"
+#include "storage_layout.h"
+#include "lowering.h"
+
+class OutputSink;
+
+// Translation of a function's high-level code to AArch64 assembly code
+// (for Linux, following the AAPCS64 calling convention), which can only
+// be printed (the encoder, and so -c and -run, are x86-64 only).
+//
+// The vregs are assigned the registers of TargetRegisters::get(TARGET_AARCH64)
+// by the register allocators.  The lowering's scratch registers are x16
+// and x17 (the operands and result of an instruction whose vregs are in
+// stack slots), x15 (a third one, e.g. for the quotient of a division,
+// the count of a fill or copy loop, or breaking a cycle of parallel
+// moves), and x30 (the link register, saved by the prologue: the address
+// of a stack slot too far from sp for an immediate offset).
+//
+// The frame is the saved x29 and x30, then the callee-saved registers used,
+// then the slots and local storage (see Lowering), from sp, which is
+// 16-byte aligned throughout.  Since ldr/str can add a (shifted) index
+// register or an immediate to the base address, an address computed by
+// lea, or by adding a constant or a register, and used only by the load
+// or store following it, is folded into the load or store.  The cold
+// code follows the epilogue in .text (rather than in .text.unlikely, as
+// for x86-64), since a conditional branch can only reach 1MB.
+class AArch64Lowering : public Lowering {
+private:
+    static const unsigned NUM_VECTOR_REGS = 16;
+
+    // the registers of the arguments of a subprogram (AAPCS64)
+    static const unsigned MAX_ARGS = 8;
+    static const int ARG_REGS[MAX_ARGS];
+
+    typedef std::vector<Instruction *> Code;
+
+    // the number of operands of the high-level code naming each vreg
+    // (its definitions and uses)
+    std::vector<unsigned> vreg_occurrences;
+
+    // the vreg whose address computation was folded into the following
+    // load or store (or -1), and the memory reference it becomes
+    int folded_vreg;
+    Operand folded_address;
+
+public:
+    AArch64Lowering(InstructionSequence *highlevelins, StorageLayout *storage_layout, long vreg_max);
+    virtual ~AArch64Lowering();
+
+    virtual void translate_instructions();
+
+    // print the function (with its cold code, and the bounds check trap,
+    // after the epilogue)
+    virtual void emit(OutputSink &out);
+
+private:
+    // add the code of a high-level instruction (commented with it) to the
+    // assembly code
+    void add_code(const Code &code, Instruction *hin);
+
+    // define a label at the next instruction (with a nop at the label
+    // already there, if the instructions between them became no code)
+    void define_label(const std::string &label);
+
+    // load a constant into a register: with a single mov if it (or its
+    // complement) fits in 16 bits, and otherwise a movz (or a movn, if more
+    // of its 16-bit pieces are all ones) and a movk for each other piece
+    void load_constant(long value, const Operand &reg, Code &code);
+
+    // the memory reference of a stack slot (or of local storage), for a
+    // load or store of size bytes, with the offset in x30 if it can't be
+    // an immediate
+    Operand get_sp_memref(const Operand &memref, long size, Code &code);
+
+    // reg = sp + offset
+    void add_sp_offset(const Operand &reg, long offset, Code &code);
+    // reg = the address of a label (in the page adrp gives, plus its low 12 bits)
+    void load_label_address(const Operand &reg, const std::string &label, Code &code);
+
+    // move a vreg's machine register, stack slot or a constant to a register
+    void move_to(const Operand &reg, const Operand &src, Code &code);
+    // move a register to a vreg's machine register or stack slot
+    void move_from(const Operand &dest, const Operand &reg, Code &code);
+    // move any of them to any other one (through x16 if both are in memory)
+    void select_move(const Operand &dest, const Operand &src, Code &code);
+
+    // the register holding the value of an operand of a high-level
+    // instruction: its vreg's machine register, or the scratch register,
+    // into which its stack slot or constant is loaded (and the value at
+    // the address in the vreg, if the operand is a memory reference)
+    Operand get_value(const Operand &operand, const Operand &scratch, Code &code);
+    // (likewise, but xzr for 0, where the instruction can read it)
+    Operand get_value_or_zero(const Operand &operand, const Operand &scratch, Code &code);
+
+    // the memory reference of a load or store of size bytes: relative to sp
+    // for a local memref, the folded address computation (see
+    // fold_address) if there is one, and otherwise the address in the
+    // vreg (loaded into the scratch register if it's in memory)
+    Operand get_address(const Operand &memref, long size, const Operand &scratch, Code &code);
+
+    // if the address computed by the high-level instruction at index i is
+    // only used by the load or store following it, fold it into the load
+    // or store (setting folded_vreg and folded_address), returning false
+    // if it can't be folded
+    bool fold_address(unsigned i);
+
+    // the moves of values into the given locations, done as if all at
+    // once (see order_parallel_move), breaking a cycle of moves with x15
+    void select_parallel_move(const std::vector<std::pair<Operand, Operand>> &moves, Code &code);
+
+    void translate_binary(Instruction *hin, Code &code);
+    void translate_compare(Instruction *hin, Code &code);
+    void translate_call(Instruction *hin, Code &code);
+    void translate_fill_copy(Instruction *hin);
+    void translate_vector_instruction(Instruction *hin, Code &code);
+
+    // translate a division or remainder, and the other one of the same
+    // operands which follows it (pair, or null), using a single division
+    void translate_division(Instruction *hin, Instruction *pair);
+    // compute the quotient and/or remainder of a division by a constant
+    // (d >= 2 if signed, d != 0 if unsigned) using shifts or a
+    // multiplication by a magic number, returning the registers holding
+    // them (or false, for any other divisor)
+    bool translate_div_by_constant(Instruction *hin, const Operand &n, bool need_remainder, Code &code,
+                                   Operand &quotient, Operand &remainder);
+    bool translate_unsigned_div_by_constant(Instruction *hin, const Operand &n, bool need_quotient,
+                                            bool need_remainder, Code &code, Operand &quotient, Operand &remainder);
+
+    // write the block execution counters to the profile file (this is
+    // the end of the program, so any callee-saved register can be used)
+    void translate_profile_dump();
+
+    // does the code branch to the bounds check trap?
+    bool uses_bounds_trap() const;
+
+    // the size of the storage below the saved registers (16-byte aligned)
+    long get_frame_size() const;
+    void emit_prologue(OutputSink &out, const std::vector<int> &saved_regs);
+    void emit_epilogue(OutputSink &out, const std::vector<int> &saved_regs);
+
+    static int get_branch_opcode(int opcode);
+    static int get_csel_opcode(int opcode);
+};
+
+#endif // AARCH64_LOWERING_H
@@ -0,0 +1,147 @@
+#include <utility>
+#include <vector>
+#include "cfg.h"
+#include "highlevel.h"
+#include "storage_layout.h"
+#include "stats.h"
+#include "addr_fold.h"
+
+namespace {
+    bool is_load(int opcode) {
+        return opcode == HINS_LOAD_INT || opcode == HINS_LOAD_CHAR;
+    }
+
+    bool is_store(int opcode) {
+        return opcode == HINS_STORE_INT || opcode == HINS_STORE_CHAR;
+    }
+
+    // larger constants are never part of an address computation
+    // (so the offsets can't overflow)
+    const long MAX_CONSTANT = StorageLayout::STATIC_THRESHOLD;
+
+    bool is_small_literal(const Operand &operand) {
+        return operand.get_kind() == OPERAND_INT_LITERAL
+               && operand.get_int_value() > -MAX_CONSTANT && operand.get_int_value() < MAX_CONSTANT;
+    }
+}
+
+LocalAddressFolding::LocalAddressFolding(ControlFlowGraph *cfg, const StorageLayout &layout)
+        : ControlFlowGraphTransform(cfg)
+        , m_layout(layout) {
+    find_addresses();
+}
+
+LocalAddressFolding::~LocalAddressFolding() {
+}
+
+InstructionSequence *LocalAddressFolding::transform_basic_block(InstructionSequence *iseq) {
+    auto out = new InstructionSequence();
+
+    for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+        Instruction *ins = (*i)->duplicate();
+        int opcode = ins->get_opcode();
+        unsigned memref_index = is_store(opcode) ? 0 : 1;
+        long size = (opcode == HINS_LOAD_CHAR || opcode == HINS_STORE_CHAR) ? 1 : 8;
+        Operand folded;
+        if ((is_load(opcode) || is_store(opcode)) && get_folded((*ins)[memref_index], size, folded)) {
+            (*ins)[memref_index] = folded;
+            Statistics::get().add("addrfold.folded");
+        }
+        out->add_instruction(ins);
+    }
+
+    return out;
+}
+
+void LocalAddressFolding::find_addresses() {
+    // the definitions of the vregs which may hold constant addresses
+    std::map<int, std::vector<Instruction *>> defs;
+    std::vector<int> not_addresses;
+    ControlFlowGraph *cfg = get_orig_cfg();
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            Instruction *ins = *j;
+            if (!HighLevel::is_def(ins) || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+                continue;
+            }
+            int vreg = ins->get_operand(0).get_base_reg();
+            int opcode = ins->get_opcode();
+            if (opcode == HINS_LOCALADDR || opcode == HINS_INT_ADD || opcode == HINS_INT_SUB || opcode == HINS_MOV) {
+                defs[vreg].push_back(ins);
+            } else {
+                not_addresses.push_back(vreg);
+            }
+        }
+    }
+    for (auto i = not_addresses.begin(); i != not_addresses.end(); i++) {
+        defs.erase(*i);
+    }
+
+    // a vreg holds a constant address once every definition of it is
+    // known to compute the same one (so vregs incremented in a loop,
+    // whose definitions depend on themselves, never do)
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto i = defs.begin(); i != defs.end(); i++) {
+            if (m_addresses.count(i->first) > 0) {
+                continue;
+            }
+            Address address = { -1, 0 };
+            bool same = true;
+            for (auto j = i->second.begin(); j != i->second.end() && same; j++) {
+                Address a;
+                same = evaluate(*j, a) && (address.variable < 0
+                        || (a.variable == address.variable && a.offset == address.offset));
+                address = a;
+            }
+            if (same) {
+                m_addresses[i->first] = address;
+                changed = true;
+            }
+        }
+    }
+}
+
+bool LocalAddressFolding::evaluate(Instruction *def, Address &address) const {
+    int opcode = def->get_opcode();
+    if (opcode == HINS_LOCALADDR) {
+        address.variable = def->get_operand(1).get_int_value();
+        address.offset = 0;
+        return m_layout.get_variable_size(address.variable) > 0;
+    }
+
+    Operand a = def->get_operand(1);
+    Operand b = (opcode == HINS_MOV) ? Operand(OPERAND_INT_LITERAL, 0) : def->get_operand(2);
+    if (opcode == HINS_INT_ADD && a.get_kind() == OPERAND_INT_LITERAL) {
+        std::swap(a, b);
+    }
+    if (a.get_kind() != OPERAND_VREG || !is_small_literal(b)) {
+        return false;
+    }
+    auto i = m_addresses.find(a.get_base_reg());
+    if (i == m_addresses.end()) {
+        return false;
+    }
+    address = i->second;
+    address.offset += (opcode == HINS_INT_SUB) ? -b.get_int_value() : b.get_int_value();
+    return address.offset > -MAX_CONSTANT && address.offset < MAX_CONSTANT;
+}
+
+bool LocalAddressFolding::get_folded(const Operand &memref, long access_size, Operand &folded) const {
+    if (memref.get_kind() != OPERAND_VREG_MEMREF) {
+        return false;
+    }
+    auto i = m_addresses.find(memref.get_base_reg());
+    if (i == m_addresses.end()) {
+        return false;
+    }
+
+    const Address &address = i->second;
+    long size = m_layout.get_variable_size(address.variable);
+    if (m_layout.is_static_variable(address.variable) || address.offset < 0 || address.offset + access_size > size) {
+        return false;
+    }
+    folded = Operand(OPERAND_LOCAL_MEMREF, address.variable + address.offset);
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef ADDR_FOLD_H
+#define ADDR_FOLD_H
+
+#include <map>
+#include "cfg.h"
+#include "cfg_transform.h"
+
+class StorageLayout;
+
+// Fold the addresses of variables into the loads and stores using them,
+// for a high-level CFG not in SSA form.
+//
+// A vreg whose definitions all compute the same variable's address plus
+// the same constant (HINS_LOCALADDR, followed by additions or subtractions
+// of constants, and moves) holds a constant address: a load or store
+// through it, such as the access to a record field or to an array element
+// at a constant index,
+//
+//   localaddr vrA, $48
+//   addi vrB, vrA, $16
+//   sti (vrB), vr1
+//
+// becomes "sti 64(local), vr1", which is lowered to a single instruction
+// addressing the variable's storage relative to %rsp.  Accesses outside
+// the variable and variables placed in .bss are left alone.  The address
+// computations left without uses are dead code.
+class LocalAddressFolding : public ControlFlowGraphTransform {
+private:
+    struct Address {
+        long variable;  // symbol table offset of the variable
+        long offset;    // offset in the variable
+    };
+
+    const StorageLayout &m_layout;
+    // the vregs holding constant addresses
+    std::map<int, Address> m_addresses;
+
+public:
+    LocalAddressFolding(ControlFlowGraph *cfg, const StorageLayout &layout);
+    virtual ~LocalAddressFolding();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+    virtual bool is_block_local() const { return true; }
+
+private:
+    void find_addresses();
+    bool evaluate(Instruction *def, Address &address) const;
+    bool get_folded(const Operand &memref, long access_size, Operand &folded) const;
+};
+
+#endif // ADDR_FOLD_H
@@ -0,0 +1,260 @@
+#include <cassert>
+#include <cstdlib>
+#include "cfg.h"
+#include "highlevel.h"
+#include "storage_layout.h"
+#include "alias.h"
+
+namespace {
+    typedef AliasAnalysis::Value Value;
+
+    // the largest residue and modulus tracked (beyond it, only the
+    // variable an address points into is known), so that the arithmetic
+    // on them can't overflow
+    const long MAX_VALUE = 1L << 30;
+
+    long gcd(long a, long b) {
+        a = std::labs(a);
+        b = std::labs(b);
+        while (b != 0) {
+            long t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+    Value make_value(Value::Kind kind, long variable, long residue, long modulus) {
+        modulus = std::labs(modulus);
+        if (modulus > MAX_VALUE || std::labs(residue) > MAX_VALUE) {
+            // (any integer)
+            residue = 0;
+            modulus = 1;
+        }
+        if (modulus > 0) {
+            residue = ((residue % modulus) + modulus) % modulus;
+        }
+        return Value{ kind, variable, residue, modulus };
+    }
+
+    const Value UNDEFINED_VALUE = { Value::UNDEFINED, -1, 0, 0 };
+    const Value UNKNOWN_VALUE = { Value::UNKNOWN, -1, 0, 0 };
+
+    // the result of an operation is undefined if an operand is still
+    // undefined, and unknown if one is unknown
+    bool is_defined(const Value &a, const Value &b, Value &result) {
+        if (a.kind == Value::UNDEFINED || b.kind == Value::UNDEFINED) {
+            result = UNDEFINED_VALUE;
+            return false;
+        }
+        if (a.kind == Value::UNKNOWN || b.kind == Value::UNKNOWN) {
+            result = UNKNOWN_VALUE;
+            return false;
+        }
+        return true;
+    }
+
+    Value add(const Value &a, const Value &b) {
+        Value result;
+        if (!is_defined(a, b, result)) {
+            return result;
+        }
+        if (a.kind == Value::ADDRESS && b.kind == Value::ADDRESS) {
+            return UNKNOWN_VALUE;
+        }
+        long variable = a.kind == Value::ADDRESS ? a.variable : b.variable;
+        Value::Kind kind = (a.kind == Value::ADDRESS || b.kind == Value::ADDRESS) ? Value::ADDRESS : Value::INTEGER;
+        return make_value(kind, variable, a.residue + b.residue, gcd(a.modulus, b.modulus));
+    }
+
+    Value negate(const Value &a) {
+        if (a.kind != Value::INTEGER) {
+            return a.kind == Value::UNDEFINED ? UNDEFINED_VALUE : UNKNOWN_VALUE;
+        }
+        return make_value(Value::INTEGER, -1, -a.residue, a.modulus);
+    }
+
+    Value multiply(const Value &a, const Value &b) {
+        Value result;
+        if (!is_defined(a, b, result)) {
+            return result;
+        }
+        if (a.kind != Value::INTEGER || b.kind != Value::INTEGER) {
+            return UNKNOWN_VALUE;
+        }
+        // (ra + ka * ma) * (rb + kb * mb) = ra * rb + ka * ra * mb + ...
+        long modulus = gcd(gcd(a.residue * b.modulus, b.residue * a.modulus), a.modulus * b.modulus);
+        return make_value(Value::INTEGER, -1, a.residue * b.residue, modulus);
+    }
+
+    Value join(const Value &a, const Value &b) {
+        if (a.kind == Value::UNDEFINED) {
+            return b;
+        }
+        if (b.kind == Value::UNDEFINED) {
+            return a;
+        }
+        if (a.kind == Value::UNKNOWN || b.kind != a.kind || b.variable != a.variable) {
+            return UNKNOWN_VALUE;
+        }
+        return make_value(a.kind, a.variable, a.residue, gcd(gcd(a.modulus, b.modulus), a.residue - b.residue));
+    }
+}
+
+bool AliasAnalysis::Value::operator==(const Value &other) const {
+    return kind == other.kind && variable == other.variable && residue == other.residue && modulus == other.modulus;
+}
+
+////////////////////////////////////////////////////////////////////////
+// AliasAnalysis implementation
+////////////////////////////////////////////////////////////////////////
+
+AliasAnalysis::AliasAnalysis(ControlFlowGraph *cfg, const StorageLayout *layout)
+        : m_layout(layout) {
+    analyze(cfg);
+}
+
+AliasAnalysis::~AliasAnalysis() {
+}
+
+const AliasAnalysis::Value &AliasAnalysis::get_value(int vreg) const {
+    if (vreg < 0 || unsigned(vreg) >= m_values.size() || m_values[unsigned(vreg)].kind == Value::UNDEFINED) {
+        return UNKNOWN_VALUE;
+    }
+    return m_values[unsigned(vreg)];
+}
+
+bool AliasAnalysis::may_alias(const Operand &memref1, long size1, const Operand &memref2, long size2) const {
+    return may_alias(get_address(memref1), size1, get_address(memref2), size2);
+}
+
+bool AliasAnalysis::may_alias(const Value &a, long size1, const Value &b, long size2) {
+    if (a.kind != Value::ADDRESS || b.kind != Value::ADDRESS) {
+        return true;
+    }
+    if (a.variable != b.variable) {
+        return false;
+    }
+
+    long g = gcd(a.modulus, b.modulus);
+    if (g == 0) {
+        return a.residue < b.residue + size2 && b.residue < a.residue + size1;
+    }
+    // the accesses overlap unless, modulo g, b's bytes fit between the
+    // end of a's and the start of the next one
+    long distance = (((b.residue - a.residue) % g) + g) % g;
+    return !(size1 <= distance && distance + size2 <= g);
+}
+
+bool AliasAnalysis::is_in_bounds(const Operand &memref, long size) const {
+    Value address = get_address(memref);
+    return m_layout != nullptr && address.kind == Value::ADDRESS && address.modulus == 0
+           && address.residue >= 0 && address.residue + size <= m_layout->get_variable_size(address.variable);
+}
+
+long AliasAnalysis::get_access_size(Instruction *ins) {
+    switch (ins->get_opcode()) {
+        case HINS_LOAD_CHAR:
+        case HINS_STORE_CHAR:
+            return 1;
+        case HINS_VEC_LOAD:
+        case HINS_VEC_STORE:
+            return 16;
+        default:
+            return 8;
+    }
+}
+
+void AliasAnalysis::analyze(ControlFlowGraph *cfg) {
+    // the vregs which are never defined hold unknown values
+    m_values.assign(unsigned(HighLevel::get_num_vregs(cfg)), UNKNOWN_VALUE);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            if (HighLevel::is_def(*j) && (*j)->get_operand(0).get_kind() == OPERAND_VREG) {
+                m_values[unsigned((*j)->get_operand(0).get_base_reg())] = UNDEFINED_VALUE;
+            }
+        }
+    }
+
+    // (the values only move up the lattice, each time a definition
+    // gives a value not yet joined in, so this terminates)
+    const ControlFlowGraph::BlockList &rpo = cfg->get_reverse_postorder();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto i = rpo.cbegin(); i != rpo.cend(); i++) {
+            for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+                Instruction *ins = *j;
+                if (!HighLevel::is_def(ins) || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+                    continue;
+                }
+                Value &value = m_values[unsigned(ins->get_operand(0).get_base_reg())];
+                Value joined = join(value, evaluate(ins));
+                if (joined != value) {
+                    value = joined;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+AliasAnalysis::Value AliasAnalysis::evaluate(Instruction *ins) const {
+    switch (ins->get_opcode()) {
+        case HINS_LOAD_ICONST:
+            return get_operand_value(ins->get_operand(1));
+        case HINS_LOCALADDR:
+            return Value{ Value::ADDRESS, ins->get_operand(1).get_int_value(), 0, 0 };
+        case HINS_MOV:
+            return get_operand_value(ins->get_operand(1));
+        case HINS_INT_ADD:
+            return add(get_operand_value(ins->get_operand(1)), get_operand_value(ins->get_operand(2)));
+        case HINS_INT_SUB:
+            return add(get_operand_value(ins->get_operand(1)), negate(get_operand_value(ins->get_operand(2))));
+        case HINS_INT_MUL:
+            return multiply(get_operand_value(ins->get_operand(1)), get_operand_value(ins->get_operand(2)));
+        case HINS_INT_NEGATE:
+            return negate(get_operand_value(ins->get_operand(1)));
+        case HINS_INT_DIV:
+        case HINS_INT_MOD:
+        case HINS_UINT_DIV:
+        case HINS_UINT_MOD:
+            // (any integer: addresses are never divided)
+            return make_value(Value::INTEGER, -1, 0, 1);
+        case HINS_LEA:
+            return add(get_operand_value(ins->get_operand(1)),
+                       multiply(get_operand_value(ins->get_operand(2)), get_operand_value(ins->get_operand(3))));
+        case HINS_PHI:
+            {
+                Value value = UNDEFINED_VALUE;
+                for (unsigned i = 1; i < ins->get_num_operands(); i++) {
+                    value = join(value, get_operand_value(ins->get_operand(i)));
+                }
+                return value;
+            }
+        default:
+            return UNKNOWN_VALUE;
+    }
+}
+
+AliasAnalysis::Value AliasAnalysis::get_operand_value(const Operand &operand) const {
+    switch (operand.get_kind()) {
+        case OPERAND_VREG:
+            return m_values[unsigned(operand.get_base_reg())];
+        case OPERAND_INT_LITERAL:
+            return make_value(Value::INTEGER, -1, operand.get_int_value(), 0);
+        default:
+            return UNKNOWN_VALUE;
+    }
+}
+
+AliasAnalysis::Value AliasAnalysis::get_address(const Operand &memref) const {
+    switch (memref.get_kind()) {
+        case OPERAND_VREG_MEMREF:
+            return get_value(memref.get_base_reg());
+        case OPERAND_VREG_MEMREF_OFFSET:
+            return add(get_value(memref.get_base_reg()), make_value(Value::INTEGER, -1, memref.get_offset(), 0));
+        default:
+            return UNKNOWN_VALUE;
+    }
+}
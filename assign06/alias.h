@@ -0,0 +1,97 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <vector>
+#include "cfg.h"
+
+class StorageLayout;
+
+// Alias analysis for the memory references of a high-level CFG (in or out
+// of SSA form).
+//
+// Every address is computed from the HINS_LOCALADDR of a variable, by
+// adding integers to it, so the analysis finds what each vreg may hold:
+// an integer congruent to a residue modulo a modulus, or the address of a
+// variable plus such an integer.  For example, after
+//
+//   localaddr vr1, $32
+//   muli vr2, vr3, $24
+//   addi vr4, vr1, vr2
+//   addi vr5, vr4, $16
+//
+// vr5 is the address of the variable at offset 32 plus 16 modulo 24 (the
+// field at offset 16 of an element of an array of 24-byte records), so an
+// 8-byte access through it can't overlap one through vr4.  A vreg's value
+// is the join of the values of all of its definitions (so in a CFG not in
+// SSA form, the analysis is flow-insensitive), and the values are found
+// by iterating to a fixed point from "undefined", so that a pointer
+// incremented in a loop is still known to point into its variable.
+//
+// As in LocalValueNumbering, the accesses through the addresses of
+// different variables are assumed not to alias, since the program can't
+// index past the end of a variable.  A quotient or remainder is some
+// integer; the value of a vreg defined in any other way (e.g., loaded from
+// memory), or never defined, is unknown, and an access through it may
+// alias anything.
+class AliasAnalysis {
+public:
+    struct Value {
+        enum Kind {
+            UNDEFINED,  // (only while iterating)
+            INTEGER,    // residue + k * modulus for some k
+            ADDRESS,    // the variable's address plus an INTEGER
+            UNKNOWN,
+        } kind;
+        long variable;  // symbol table offset of the variable, for ADDRESS
+        long residue;   // in [0, modulus), unless the modulus is 0
+        long modulus;   // 0 if the value is exactly residue
+
+        bool operator==(const Value &other) const;
+        bool operator!=(const Value &other) const { return !(*this == other); }
+    };
+
+private:
+    const StorageLayout *m_layout;
+    // the value of each vreg
+    std::vector<Value> m_values;
+
+    // disallow copy ctor and assignment operator
+    AliasAnalysis(const AliasAnalysis &);
+    AliasAnalysis &operator=(const AliasAnalysis &);
+
+public:
+    // (the sizes of the variables are only needed by is_in_bounds)
+    AliasAnalysis(ControlFlowGraph *cfg, const StorageLayout *layout = nullptr);
+    ~AliasAnalysis();
+
+    const Value &get_value(int vreg) const;
+
+    // may an access of size1 bytes through memref1 overlap one of size2
+    // bytes through memref2?  (Memory references other than through a
+    // vreg, possibly plus an offset, may alias anything.)
+    bool may_alias(const Operand &memref1, long size1, const Operand &memref2, long size2) const;
+
+    // may accesses of size1 bytes at address1 and of size2 bytes at
+    // address2 overlap?
+    static bool may_alias(const Value &address1, long size1, const Value &address2, long size2);
+
+    // the address a memory reference accesses (UNKNOWN if it isn't
+    // through a vreg)
+    Value get_address(const Operand &memref) const;
+
+    // is an access of size bytes through memref known to be at a constant
+    // offset inside its variable?  (Such an access can't fault, so it can
+    // be executed speculatively.)
+    bool is_in_bounds(const Operand &memref, long size) const;
+
+    // the number of bytes an instruction accessing memory through its
+    // memory reference operand reads or writes
+    static long get_access_size(Instruction *ins);
+
+private:
+    void analyze(ControlFlowGraph *cfg);
+    Value evaluate(Instruction *ins) const;
+    Value get_operand_value(const Operand &operand) const;
+};
+
+#endif // ALIAS_H
@@ -0,0 +1,102 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+#include <type_traits>
+
+// A pool of objects of type T, allocated in large chunks rather than
+// individually.  An object returned to the pool has its storage reused
+// by a later allocation, and release() destroys all objects still in use
+// and frees all of the storage at once.  (reset() destroys the objects
+// too, but keeps the chunks for later allocations, for a process which
+// compiles many programs.)
+//
+// A class allocated from a pool defines operator new and operator delete
+// using allocate() and deallocate().
+template<typename T>
+class ObjectPool {
+private:
+    struct Slot {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        Slot *next_free;
+        bool live;
+    };
+
+    static const unsigned CHUNK_SIZE = 1024;
+
+    std::vector<Slot *> m_chunks;
+    unsigned m_num_used;     // number of slots used in the last chunk
+    Slot *m_free_list;
+    std::vector<Slot *> m_spare_chunks;   // (kept by reset())
+
+    // disallow copy ctor and assignment operator
+    ObjectPool(const ObjectPool &);
+    ObjectPool &operator=(const ObjectPool &);
+
+public:
+    ObjectPool()
+            : m_num_used(CHUNK_SIZE)
+            , m_free_list(nullptr) {
+    }
+
+    ~ObjectPool() {
+        release();
+    }
+
+    void *allocate() {
+        Slot *slot;
+        if (m_free_list != nullptr) {
+            slot = m_free_list;
+            m_free_list = slot->next_free;
+        } else {
+            if (m_num_used == CHUNK_SIZE) {
+                if (!m_spare_chunks.empty()) {
+                    m_chunks.push_back(m_spare_chunks.back());
+                    m_spare_chunks.pop_back();
+                } else {
+                    m_chunks.push_back(new Slot[CHUNK_SIZE]);
+                }
+                m_num_used = 0;
+            }
+            slot = &m_chunks.back()[m_num_used++];
+        }
+        slot->live = true;
+        return &slot->storage;
+    }
+
+    void deallocate(void *p) {
+        // the storage is the first member of its Slot
+        Slot *slot = reinterpret_cast<Slot *>(p);
+        slot->live = false;
+        slot->next_free = m_free_list;
+        m_free_list = slot;
+    }
+
+    void release() {
+        reset();
+        for (auto i = m_spare_chunks.begin(); i != m_spare_chunks.end(); i++) {
+            delete[] *i;
+        }
+        m_spare_chunks.clear();
+    }
+
+    void reset() {
+        for (unsigned i = 0; i < m_chunks.size(); i++) {
+            Slot *chunk = m_chunks[i];
+            unsigned num_slots = (i + 1 == m_chunks.size()) ? m_num_used : CHUNK_SIZE;
+            for (unsigned j = 0; j < num_slots; j++) {
+                if (chunk[j].live) {
+                    reinterpret_cast<T *>(&chunk[j].storage)->~T();
+                    chunk[j].live = false;
+                }
+            }
+            m_spare_chunks.push_back(chunk);
+        }
+        m_chunks.clear();
+        m_num_used = CHUNK_SIZE;
+        m_free_list = nullptr;
+    }
+};
+
+#endif // ARENA_H
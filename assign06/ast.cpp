@@ -6,6 +6,7 @@
 #include "grammar_symbols.h"
 #include "node.h"
 #include "ast.h"
+#include "output.h"
 
 const char *ast_get_tag_name(int ast_tag) {
   if (ast_tag < AST_PROGRAM) {
@@ -38,6 +39,10 @@ const char *ast_get_tag_name(int ast_tag) {
   case AST_IF_ELSE: return "if_else";
   case AST_REPEAT: return "repeat";
   case AST_WHILE: return "while";
+  case AST_FOR: return "for";
+  case AST_CASE: return "case";
+  case AST_CASE_LIST: return "case_list";
+  case AST_CASE_ARM: return "case_arm";
   case AST_COMPARE_EQ: return "compare_eq";
   case AST_COMPARE_NEQ: return "compare_neq";
   case AST_COMPARE_LT: return "compare_lt";
@@ -51,6 +56,13 @@ const char *ast_get_tag_name(int ast_tag) {
   case AST_FIELD_REF: return "field_ref";
   case AST_IDENTIFIER_LIST: return "identifier_list";
   case AST_EXPRESSION_LIST: return "expression_list";
+  case AST_PROCEDURE: return "procedure";
+  case AST_FUNCTION: return "function";
+  case AST_PARAMETER_LIST: return "parameter_list";
+  case AST_PROCEDURE_CALL: return "procedure_call";
+  case AST_FUNCTION_CALL: return "function_call";
+  case AST_UNIT: return "unit";
+  case AST_USES: return "uses";
   default:
     err_fatal("Unknown AST node type %d\n", ast_tag);
     return "<<unknown>>";
@@ -64,6 +76,14 @@ private:
   std::map<int, int> m_node_type_count;
   struct Node *m_ast;
 
+  // a node on the stack of the traversal (its name, and the index of the
+  // next kid to visit)
+  struct Frame {
+    struct Node *node;
+    std::string name;
+    int next_kid;
+  };
+
 public:
   ASTGraphPrinter(struct Node *ast);
   ~ASTGraphPrinter();
@@ -71,8 +91,11 @@ public:
   void print();
 
 private:
-  // returns maximum level
-  int visit(struct Node *n, const std::string &parent_name, int level);
+  // name the nodes of the tree (in preorder) and record their levels and
+  // edges, using an explicit stack (a generated program's AST can be
+  // deeper than the call stack allows)
+  void visit(struct Node *root);
+  std::string add_node(struct Node *n, const std::string &parent_name, int level);
 };
 
 ASTGraphPrinter::ASTGraphPrinter(struct Node *ast)
@@ -83,29 +106,52 @@ ASTGraphPrinter::~ASTGraphPrinter() {
 }
 
 void ASTGraphPrinter::print() {
-  visit(m_ast, "", 0);
+  visit(m_ast);
 
-  printf("digraph ast {\n");
-  printf("  graph [ordering=\"out\"];\n");
+  OutputSink &out = OutputSink::get_stdout();
+  out.put("digraph ast {\n");
+  out.put("  graph [ordering=\"out\"];\n");
 
   // output ranks so nodes are at the correct heights
   for (std::map<std::string, int>::iterator i = m_node_levels.begin(); i != m_node_levels.end(); i++) {
-    std::string rankattr = cpputil::format("{ rank = %d; \"%s\"; }", i->second, i->first.c_str());
-    printf("  %s\n", rankattr.c_str());
+    out.put("  { rank = ");
+    out.put_int(i->second);
+    out.put("; \"");
+    out.put(i->first);
+    out.put("\"; }\n");
   }
 
   // output edges
   for (std::map<std::string, std::vector<std::string>>::iterator i = m_edges.begin(); i != m_edges.end(); i++) {
     for (std::vector<std::string>::iterator j = i->second.begin(); j != i->second.end(); j++) {
-      std::string edge = cpputil::format("\"%s\" -> \"%s\";", i->first.c_str(), j->c_str());
-      printf("  %s\n", edge.c_str());
+      out.put("  \"");
+      out.put(i->first);
+      out.put("\" -> \"");
+      out.put(*j);
+      out.put("\";\n");
     }
   }
 
-  printf("}\n");
+  out.put("}\n");
+  out.flush();
 }
 
-int ASTGraphPrinter::visit(struct Node *n, const std::string &parent_name, int level) {
+void ASTGraphPrinter::visit(struct Node *root) {
+  std::vector<Frame> stack;
+  stack.push_back({ root, add_node(root, "", 0), 0 });
+  while (!stack.empty()) {
+    Frame &top = stack.back();
+    if (top.next_kid == node_get_num_kids(top.node)) {
+      stack.pop_back();
+      continue;
+    }
+    struct Node *kid = node_get_kid(top.node, top.next_kid++);
+    std::string name = add_node(kid, top.name, int(stack.size()));
+    stack.push_back({ kid, name, 0 });
+  }
+}
+
+std::string ASTGraphPrinter::add_node(struct Node *n, const std::string &parent_name, int level) {
   int tag = node_get_tag(n);
   std::map<int, int>::iterator i = m_node_type_count.find(tag);
   int count = (i == m_node_type_count.end()) ? 0 : i->second;
@@ -125,15 +171,7 @@ int ASTGraphPrinter::visit(struct Node *n, const std::string &parent_name, int l
   if (!parent_name.empty()) {
     m_edges[parent_name].push_back(node_name);
   }
-  int num_kids = node_get_num_kids(n);
-  int max_level = level;
-  for (int j = 0; j < num_kids; j++) {
-    int subtree_level = visit(node_get_kid(n, j), node_name, level + 1);
-    if (subtree_level > max_level) {
-      max_level = subtree_level;
-    }
-  }
-  return max_level;
+  return node_name;
 }
 
 void ast_print_graph(struct Node *ast) {
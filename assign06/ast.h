@@ -32,6 +32,10 @@ enum ASTKind {
   AST_IF_ELSE,
   AST_REPEAT,
   AST_WHILE,
+  AST_FOR,
+  AST_CASE,
+  AST_CASE_LIST,
+  AST_CASE_ARM,
 
   AST_COMPARE_EQ,
   AST_COMPARE_NEQ,
@@ -49,6 +53,15 @@ enum ASTKind {
 
   AST_IDENTIFIER_LIST,
   AST_EXPRESSION_LIST,
+
+  AST_PROCEDURE,
+  AST_FUNCTION,
+  AST_PARAMETER_LIST,
+  AST_PROCEDURE_CALL,
+  AST_FUNCTION_CALL,
+
+  AST_UNIT,
+  AST_USES,
 };
 
 const char *ast_get_tag_name(int ast_tag);
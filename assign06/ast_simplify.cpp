@@ -0,0 +1,164 @@
+#include <climits>
+#include <vector>
+#include "node.h"
+#include "ast.h"
+#include "stats.h"
+#include "ast_simplify.h"
+
+ASTSimplifier::ASTSimplifier() {
+}
+
+ASTSimplifier::~ASTSimplifier() {
+}
+
+void ASTSimplifier::simplify(struct Node *ast) {
+    // (traversed without recursion, like the deep chains of arithmetic
+    // operations in SymbolTableBuilder)
+    traverse(ast);
+}
+
+struct Node *ASTSimplifier::simplify_statement(struct Node *statement) {
+    traverse(statement);
+    Node *replacement = get_replacement(statement);
+    return (replacement != nullptr) ? replacement : statement;
+}
+
+bool ASTSimplifier::fold(struct Node *ast) {
+    int tag = node_get_tag(ast);
+    if (node_get_num_kids(ast) != 2 || tag < AST_ADD || (tag > AST_MODULUS && tag < AST_COMPARE_EQ)
+            || tag > AST_COMPARE_GTE) {
+        return false;
+    }
+    Node *left = node_get_kid(ast, 0);
+    Node *right = node_get_kid(ast, 1);
+    if (!left->is_const() || !right->is_const()) {
+        return false;
+    }
+
+    // (the arithmetic wraps around, as it does in the generated code)
+    long lval = left->get_ival();
+    long rval = right->get_ival();
+    unsigned long ulval = (unsigned long) lval, urval = (unsigned long) rval;
+    long result;
+    switch (tag) {
+    case AST_ADD:         result = long(ulval + urval); break;
+    case AST_SUBTRACT:    result = long(ulval - urval); break;
+    case AST_MULTIPLY:    result = long(ulval * urval); break;
+    case AST_COMPARE_EQ:  result = (lval == rval); break;
+    case AST_COMPARE_NEQ: result = (lval != rval); break;
+    case AST_COMPARE_LT:  result = (lval < rval); break;
+    case AST_COMPARE_LTE: result = (lval <= rval); break;
+    case AST_COMPARE_GT:  result = (lval > rval); break;
+    case AST_COMPARE_GTE: result = (lval >= rval); break;
+    default:
+        if (rval == 0 || (rval == -1 && lval == LONG_MIN)) {
+            return false;
+        }
+        result = (tag == AST_DIVIDE) ? lval / rval : lval % rval;
+        break;
+    }
+    ast->set_ival(result);
+    ast->set_is_const(true);
+    return true;
+}
+
+void ASTSimplifier::post_visit(struct Node *ast) {
+    if (node_get_tag(ast) != AST_INSTRUCTIONS) {
+        if (fold(ast)) {
+            Statistics::get().add("astsimplify.folded");
+        }
+        return;
+    }
+
+    // the statements are already simplified: replace those whose control
+    // flow is known
+    std::vector<Node *> statements;
+    bool changed = false;
+    for (int i = 0; i < node_get_num_kids(ast); i++) {
+        Node *statement = node_get_kid(ast, i);
+        Node *replacement = get_replacement(statement);
+        if (replacement == nullptr) {
+            statements.push_back(statement);
+            continue;
+        }
+        for (int j = 0; j < node_get_num_kids(replacement); j++) {
+            statements.push_back(node_get_kid(replacement, j));
+        }
+        changed = true;
+    }
+    if (!changed) {
+        return;
+    }
+
+    int num_kids = node_get_num_kids(ast);
+    for (unsigned i = 0; i < statements.size(); i++) {
+        if (int(i) < num_kids) {
+            ast->set_kid(int(i), statements[i]);
+        } else {
+            ast->add_kid(statements[i]);
+        }
+    }
+    if (int(statements.size()) < num_kids) {
+        ast->truncate_kids(int(statements.size()));
+    }
+}
+
+struct Node *ASTSimplifier::get_replacement(struct Node *statement) {
+    Node *replacement = nullptr;
+    Node *condition;
+    switch (node_get_tag(statement)) {
+    case AST_IF:
+        condition = node_get_kid(statement, 0);
+        if (condition->is_const()) {
+            replacement = condition->get_ival() ? node_get_kid(statement, 1) : node_build0(AST_INSTRUCTIONS);
+        }
+        break;
+
+    case AST_IF_ELSE:
+        condition = node_get_kid(statement, 0);
+        if (condition->is_const()) {
+            replacement = node_get_kid(statement, condition->get_ival() ? 1 : 2);
+        }
+        break;
+
+    case AST_WHILE:
+        condition = node_get_kid(statement, 0);
+        if (condition->is_const() && !condition->get_ival()) {
+            replacement = node_build0(AST_INSTRUCTIONS);
+        }
+        break;
+
+    case AST_REPEAT:
+        // (the body is executed once if the condition is true)
+        condition = node_get_kid(statement, 1);
+        if (condition->is_const() && condition->get_ival()) {
+            replacement = node_get_kid(statement, 0);
+        }
+        break;
+
+    case AST_CASE:
+        condition = node_get_kid(statement, 0);
+        if (condition->is_const()) {
+            // the arm with the selector's value, or the ELSE part
+            Node *arms = node_get_kid(statement, 1);
+            replacement = node_get_kid(statement, 2);
+            for (int i = 0; i < node_get_num_kids(arms); i++) {
+                Node *values = node_get_kid(node_get_kid(arms, i), 0);
+                for (int j = 0; j < node_get_num_kids(values); j++) {
+                    if (node_get_kid(values, j)->get_ival() == condition->get_ival()) {
+                        replacement = node_get_kid(node_get_kid(arms, i), 1);
+                    }
+                }
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    if (replacement != nullptr) {
+        Statistics::get().add("astsimplify.branches");
+    }
+    return replacement;
+}
@@ -0,0 +1,44 @@
+#ifndef AST_SIMPLIFY_H
+#define AST_SIMPLIFY_H
+
+#include "astvisitor.h"
+
+struct Node;
+
+// Simplification of the AST, after its names are resolved (by
+// SymbolTableBuilder), so that the high-level code generated for it is
+// smaller:
+//
+// - an arithmetic operation or comparison whose operands are constants is
+//   folded (becoming a constant: a comparison's value is 1 if it is true,
+//   and 0 if it is false), except for a division by zero, which is left
+//   to trap when the program runs
+// - a statement whose control flow is known is replaced by the statements
+//   it executes: the branch of an IF (or IF/ELSE) taken, the arm of a CASE
+//   with a constant selector, the body of a REPEAT whose condition is
+//   true, and nothing for a WHILE whose condition is false
+//
+// The nodes replaced are left in the NodeArena.
+class ASTSimplifier : public ASTVisitor {
+public:
+    ASTSimplifier();
+    virtual ~ASTSimplifier();
+
+    // simplify a tree in place
+    void simplify(struct Node *ast);
+
+    // simplify a statement, returning it (or the AST_INSTRUCTIONS
+    // which replace it)
+    struct Node *simplify_statement(struct Node *statement);
+
+    // fold an arithmetic operation or comparison whose operands are
+    // constants (returning false if it isn't folded)
+    static bool fold(struct Node *ast);
+
+    virtual void post_visit(struct Node *ast);
+
+private:
+    struct Node *get_replacement(struct Node *statement);
+};
+
+#endif // AST_SIMPLIFY_H
@@ -1,4 +1,6 @@
 #include <cassert>
+#include <utility>
+#include <vector>
 #include "node.h"
 #include "grammar_symbols.h"
 #include "ast.h"
@@ -10,131 +12,133 @@ ASTVisitor::ASTVisitor() {
 ASTVisitor::~ASTVisitor() {
 }
 
+// the visit method of each AST node kind, indexed by its tag (in the order
+// of enum ASTKind)
+typedef void (ASTVisitor::*VisitMethod)(struct Node *ast);
+
+static const VisitMethod s_visit_methods[] = {
+  &ASTVisitor::visit_program,
+  &ASTVisitor::visit_declarations,
+  &ASTVisitor::visit_constant_declarations,
+  &ASTVisitor::visit_constant_def,
+  &ASTVisitor::visit_type_declarations,
+  &ASTVisitor::visit_type_def,
+  &ASTVisitor::visit_named_type,
+  &ASTVisitor::visit_array_type,
+  &ASTVisitor::visit_record_type,
+  &ASTVisitor::visit_var_declarations,
+  &ASTVisitor::visit_var_def,
+  &ASTVisitor::visit_add,
+  &ASTVisitor::visit_subtract,
+  &ASTVisitor::visit_multiply,
+  &ASTVisitor::visit_divide,
+  &ASTVisitor::visit_modulus,
+  &ASTVisitor::visit_negate,
+  &ASTVisitor::visit_int_literal,
+  &ASTVisitor::visit_instructions,
+  &ASTVisitor::visit_assign,
+  &ASTVisitor::visit_if,
+  &ASTVisitor::visit_if_else,
+  &ASTVisitor::visit_repeat,
+  &ASTVisitor::visit_while,
+  &ASTVisitor::visit_for,
+  &ASTVisitor::visit_case,
+  &ASTVisitor::visit_case_list,
+  &ASTVisitor::visit_case_arm,
+  &ASTVisitor::visit_compare_eq,
+  &ASTVisitor::visit_compare_neq,
+  &ASTVisitor::visit_compare_lt,
+  &ASTVisitor::visit_compare_lte,
+  &ASTVisitor::visit_compare_gt,
+  &ASTVisitor::visit_compare_gte,
+  &ASTVisitor::visit_write,
+  &ASTVisitor::visit_read,
+  &ASTVisitor::visit_var_ref,
+  &ASTVisitor::visit_array_element_ref,
+  &ASTVisitor::visit_field_ref,
+  &ASTVisitor::visit_identifier_list,
+  &ASTVisitor::visit_expression_list,
+  &ASTVisitor::visit_procedure,
+  &ASTVisitor::visit_function,
+  &ASTVisitor::visit_parameter_list,
+  &ASTVisitor::visit_procedure_call,
+  &ASTVisitor::visit_function_call,
+  &ASTVisitor::visit_unit,
+  &ASTVisitor::visit_uses,
+};
+
+static_assert(sizeof(s_visit_methods) / sizeof(s_visit_methods[0]) == AST_USES - AST_PROGRAM + 1,
+              "s_visit_methods must have an entry for each AST node kind");
+
 void ASTVisitor::visit(struct Node *ast) {
-  int tag = node_get_tag(ast);
-  switch (tag) {
-  case AST_PROGRAM:
-    visit_program(ast);
-    break;
-  case AST_DECLARATIONS:
-    visit_declarations(ast);
-    break;
-  case AST_CONSTANT_DECLARATIONS:
-    visit_constant_declarations(ast);
-    break;
-  case AST_CONSTANT_DEF:
-    visit_constant_def(ast);
-    break;
-  case AST_TYPE_DECLARATIONS:
-    visit_type_declarations(ast);
-    break;
-  case AST_TYPE_DEF:
-    visit_type_def(ast);
-    break;
-  case AST_NAMED_TYPE:
-    visit_named_type(ast);
-    break;
-  case AST_ARRAY_TYPE:
-    visit_array_type(ast);
-    break;
-  case AST_RECORD_TYPE:
-    visit_record_type(ast);
-    break;
-  case AST_VAR_DECLARATIONS:
-    visit_var_declarations(ast);
-    break;
-  case AST_VAR_DEF:
-    visit_var_def(ast);
-    break;
-  case AST_ADD:
-    visit_add(ast);
-    break;
-  case AST_SUBTRACT:
-    visit_subtract(ast);
-    break;
-  case AST_MULTIPLY:
-    visit_multiply(ast);
-    break;
-  case AST_DIVIDE:
-    visit_divide(ast);
-    break;
-  case AST_MODULUS:
-    visit_modulus(ast);
-    break;
-  case AST_NEGATE:
-    visit_negate(ast);
-    break;
-  case AST_INT_LITERAL:
-    visit_int_literal(ast);
-    break;
-  case AST_INSTRUCTIONS:
-    visit_instructions(ast);
-    break;
-  case AST_ASSIGN:
-    visit_assign(ast);
-    break;
-  case AST_IF:
-    visit_if(ast);
-    break;
-  case AST_IF_ELSE:
-    visit_if_else(ast);
-    break;
-  case AST_REPEAT:
-    visit_repeat(ast);
-    break;
-  case AST_WHILE:
-    visit_while(ast);
-    break;
-  case AST_COMPARE_EQ:
-    visit_compare_eq(ast);
-    break;
-  case AST_COMPARE_NEQ:
-    visit_compare_neq(ast);
-    break;
-  case AST_COMPARE_LT:
-    visit_compare_lt(ast);
-    break;
-  case AST_COMPARE_LTE:
-    visit_compare_lte(ast);
-    break;
-  case AST_COMPARE_GT:
-    visit_compare_gt(ast);
-    break;
-  case AST_COMPARE_GTE:
-    visit_compare_gte(ast);
-    break;
-  case AST_WRITE:
-    visit_write(ast);
-    break;
-  case AST_READ:
-    visit_read(ast);
-    break;
-  case AST_VAR_REF:
-    visit_var_ref(ast);
-    break;
-  case AST_ARRAY_ELEMENT_REF:
-    visit_array_element_ref(ast);
-    break;
-  case AST_FIELD_REF:
-    visit_field_ref(ast);
-    break;
-  case AST_IDENTIFIER_LIST:
-    visit_identifier_list(ast);
-    break;
-  case AST_EXPRESSION_LIST:
-    visit_expression_list(ast);
-    break;
+  // (a load from a dense table, rather than a switch, since this is called
+  // for every node of the tree)
+  unsigned index = unsigned(node_get_tag(ast) - AST_PROGRAM);
+  if (index < sizeof(s_visit_methods) / sizeof(s_visit_methods[0])) {
+    (this->*s_visit_methods[index])(ast);
+    return;
+  }
+
+  // the tokens
+  switch (node_get_tag(ast)) {
   case NODE_TOK_IDENT:
     visit_identifier(ast);
     break;
-    case NODE_TOK_INT_LITERAL:
-        visit_int_literal(ast);
-       break;
+  case NODE_TOK_INT_LITERAL:
+    visit_int_literal(ast);
+    break;
   default:
     assert(false); // unknown AST node type
   }
 }
 
+void ASTVisitor::traverse(struct Node *ast) {
+  // each entry is a node, the number of its children visited, and
+  // whether they are visited in reverse
+  struct Entry {
+    struct Node *node;
+    int num_visited;
+    bool reversed;
+  };
+  std::vector<Entry> stack;
+  if (pre_visit(ast)) {
+    stack.push_back(Entry{ ast, 0, reverse_kids(ast) });
+  } else {
+    post_visit(ast);
+  }
+
+  while (!stack.empty()) {
+    struct Node *node = stack.back().node;
+    int i = stack.back().num_visited;
+    int num_kids = node_get_num_kids(node);
+    if (i == num_kids) {
+      stack.pop_back();
+      post_visit(node);
+      continue;
+    }
+    stack.back().num_visited = i + 1;
+
+    struct Node *kid = node_get_kid(node, stack.back().reversed ? num_kids - 1 - i : i);
+    if (pre_visit(kid)) {
+      stack.push_back(Entry{ kid, 0, reverse_kids(kid) });
+    } else {
+      post_visit(kid);
+    }
+  }
+}
+
+bool ASTVisitor::pre_visit(struct Node *ast) {
+  return true; // default behavior
+}
+
+void ASTVisitor::post_visit(struct Node *ast) {
+  // default behavior: nothing
+}
+
+bool ASTVisitor::reverse_kids(struct Node *ast) {
+  return false; // default behavior
+}
+
 void ASTVisitor::visit_program(struct Node *ast) {
   recur_on_children(ast); // default behavior
 }
@@ -231,6 +235,22 @@ void ASTVisitor::visit_while(struct Node *ast) {
   recur_on_children(ast); // default behavior
 }
 
+void ASTVisitor::visit_for(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_case(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_case_list(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_case_arm(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
 void ASTVisitor::visit_compare_eq(struct Node *ast) {
   recur_on_children(ast); // default behavior
 }
@@ -283,6 +303,34 @@ void ASTVisitor::visit_expression_list(struct Node *ast) {
   recur_on_children(ast); // default behavior
 }
 
+void ASTVisitor::visit_procedure(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_function(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_parameter_list(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_procedure_call(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_function_call(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_unit(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
+void ASTVisitor::visit_uses(struct Node *ast) {
+  recur_on_children(ast); // default behavior
+}
+
 void ASTVisitor::visit_identifier(struct Node *ast) {
   recur_on_children(ast); // default behavior
 }
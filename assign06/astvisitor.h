@@ -8,6 +8,17 @@ public:
 
   void visit(struct Node *ast);
 
+  // Visit a tree of any depth using an explicit stack rather than recursion:
+  // pre_visit is called on each node before its children, and post_visit
+  // after them.  The children of a node for which pre_visit returns false
+  // are skipped (but post_visit is still called on it), and the children
+  // of a node for which reverse_kids returns true are visited from the
+  // last to the first.
+  void traverse(struct Node *ast);
+  virtual bool pre_visit(struct Node *ast);
+  virtual void post_visit(struct Node *ast);
+  virtual bool reverse_kids(struct Node *ast);
+
   virtual void visit_program(struct Node *ast);
   virtual void visit_declarations(struct Node *ast);
   virtual void visit_constant_declarations(struct Node *ast);
@@ -32,6 +43,10 @@ public:
   virtual void visit_if_else(struct Node *ast);
   virtual void visit_repeat(struct Node *ast);
   virtual void visit_while(struct Node *ast);
+  virtual void visit_for(struct Node *ast);
+  virtual void visit_case(struct Node *ast);
+  virtual void visit_case_list(struct Node *ast);
+  virtual void visit_case_arm(struct Node *ast);
   virtual void visit_compare_eq(struct Node *ast);
   virtual void visit_compare_neq(struct Node *ast);
   virtual void visit_compare_lt(struct Node *ast);
@@ -45,6 +60,13 @@ public:
   virtual void visit_field_ref(struct Node *ast);
   virtual void visit_identifier_list(struct Node *ast);
   virtual void visit_expression_list(struct Node *ast);
+  virtual void visit_procedure(struct Node *ast);
+  virtual void visit_function(struct Node *ast);
+  virtual void visit_parameter_list(struct Node *ast);
+  virtual void visit_procedure_call(struct Node *ast);
+  virtual void visit_function_call(struct Node *ast);
+  virtual void visit_unit(struct Node *ast);
+  virtual void visit_uses(struct Node *ast);
   virtual void visit_identifier(struct Node *ast);
 
   virtual void recur_on_children(struct Node *ast);
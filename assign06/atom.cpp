@@ -0,0 +1,54 @@
+#include <cassert>
+#include <vector>
+#include <unordered_map>
+#include "atom.h"
+
+namespace {
+    class AtomTable {
+    private:
+        std::unordered_map<std::string, Atom> m_atoms;
+        // the keys of m_atoms, indexed by atom
+        std::vector<const std::string *> m_strings;
+
+    public:
+        AtomTable() {
+            intern(std::string());
+        }
+
+        Atom intern(const std::string &str) {
+            auto i = m_atoms.find(str);
+            if (i != m_atoms.end()) {
+                return i->second;
+            }
+            i = m_atoms.insert(std::make_pair(str, Atom(m_strings.size()))).first;
+            m_strings.push_back(&i->first);
+            return i->second;
+        }
+
+        const std::string &get_string(Atom atom) const {
+            assert(atom < m_strings.size());
+            return *m_strings[atom];
+        }
+    };
+
+    AtomTable &atom_table() {
+        static thread_local AtomTable table;
+        return table;
+    }
+}
+
+Atom atom_intern(const char *str) {
+    return atom_table().intern(std::string(str));
+}
+
+Atom atom_intern(const std::string &str) {
+    return atom_table().intern(str);
+}
+
+const char *atom_get_str(Atom atom) {
+    return atom_table().get_string(atom).c_str();
+}
+
+const std::string &atom_get_string(Atom atom) {
+    return atom_table().get_string(atom);
+}
@@ -0,0 +1,35 @@
+#ifndef ATOM_H
+#define ATOM_H
+
+#ifdef __cplusplus
+#include <string>
+#endif // __cplusplus
+
+// Interned strings.
+//
+// Each distinct string is entered in a table once, and is identified by
+// its index in the table (an atom), so that names can be compared (and
+// used as keys) as integers.  Atom 0 is the empty string.  Each thread
+// has its own table, so atoms must not be passed between threads.  The
+// strings of atoms are never freed, so pointers to them remain valid.
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef unsigned Atom;
+
+// Get the atom for a string, adding it to the table if necessary.
+Atom atom_intern(const char *str);
+
+// Get the string of an atom.
+const char *atom_get_str(Atom atom);
+
+#ifdef __cplusplus
+}
+
+Atom atom_intern(const std::string &str);
+const std::string &atom_get_string(Atom atom);
+#endif // __cplusplus
+
+#endif // ATOM_H
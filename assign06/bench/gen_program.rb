@@ -0,0 +1,157 @@
+#! /usr/bin/env ruby
+
+# Generate a large program for the compiler benchmarks, and print it.
+#
+# Usage: gen_program.rb decls <n>   program declaring n variables
+#        gen_program.rb lines <n>   program of (about) n lines of code
+#        gen_program.rb nest <n>    (about) n lines of loops nested
+#                                   NEST_DEPTH deep
+#        gen_program.rb procs <n>   (about) n lines of code in
+#                                   procedures of about 10 lines
+#
+# The programs are the same for the same arguments (the pseudo-random
+# numbers are generated with a fixed seed), so results can be compared
+# across commits.
+
+kind, count = ARGV[0], ARGV[1].to_i
+if !['decls', 'lines', 'nest', 'procs'].include?(kind) || count < 1
+  STDERR.puts "Usage: gen_program.rb (decls|lines|nest|procs) <n>"
+  exit 1
+end
+
+rng = Random.new(42)
+
+if kind == 'decls'
+  # a long declaration list, where each variable is used once
+  puts "PROGRAM decls#{count};"
+  (0...count).each_slice(10) do |vars|
+    puts "  VAR #{vars.map { |i| "v#{i}" }.join(', ')}: INTEGER;"
+  end
+  puts "  VAR s: INTEGER;"
+  puts "BEGIN"
+  puts "  s := 0;"
+  (0...count).each do |i|
+    puts "  v#{i} := #{rng.rand(1000)};"
+    puts "  s := s + v#{i};"
+  end
+  puts "  WRITE s;"
+  puts "END."
+  exit 0
+end
+
+if kind == 'nest'
+  # WHILE loops nested NEST_DEPTH deep (each running once), repeated
+  # until there are enough lines
+  NEST_DEPTH = 16
+  puts "PROGRAM nest#{count};"
+  puts "  VAR #{(0...NEST_DEPTH).map { |d| "i#{d}" }.join(', ')}, s: INTEGER;"
+  puts "BEGIN"
+  puts "  s := 0;"
+  lines = 5
+  while lines < count
+    (0...NEST_DEPTH).each do |d|
+      indent = '  ' * (d + 1)
+      puts "#{indent}i#{d} := 0;"
+      puts "#{indent}WHILE i#{d} < 1 DO"
+    end
+    puts "#{'  ' * (NEST_DEPTH + 1)}s := (s + i#{rng.rand(NEST_DEPTH)} + #{rng.rand(1000)}) MOD 10007;"
+    (0...NEST_DEPTH).reverse_each do |d|
+      indent = '  ' * (d + 2)
+      puts "#{indent}i#{d} := i#{d} + 1;"
+      puts "#{indent[2..-1]}END;"
+    end
+    lines += NEST_DEPTH * 4 + 1
+  end
+  puts "  WRITE s;"
+  puts "END."
+  exit 0
+end
+
+if kind == 'procs'
+  # many small procedures (each with its own locals), called in turn
+  # from the main program
+  num_procs = [count / 12, 1].max
+  puts "PROGRAM procs#{count};"
+  puts "  VAR s: INTEGER;"
+  (0...num_procs).each do |p|
+    puts "  PROCEDURE p#{p}(a: INTEGER);"
+    puts "    VAR i, t: INTEGER;"
+    puts "  BEGIN"
+    puts "    i := 0;"
+    puts "    t := #{rng.rand(1000)};"
+    puts "    WHILE i < a DO"
+    puts "      t := (t * #{rng.rand(100) + 1} + i) MOD 1009;"
+    puts "      i := i + 1;"
+    puts "    END;"
+    puts "    s := (s + t) MOD 10007;"
+    puts "  END;"
+  end
+  puts "BEGIN"
+  puts "  s := 0;"
+  (0...num_procs).each { |p| puts "  p#{p}(#{rng.rand(10)});" }
+  puts "  WRITE s;"
+  puts "END."
+  exit 0
+end
+
+# straight-line code and loops over a few arrays and scalars, in blocks
+# of about 20 lines
+NUM_VARS = 64
+puts "PROGRAM lines#{count};"
+puts "  VAR a, b: ARRAY 256 OF INTEGER;"
+(0...NUM_VARS).each_slice(16) do |vars|
+  puts "  VAR #{vars.map { |i| "x#{i}" }.join(', ')}: INTEGER;"
+end
+puts "  VAR i, s: INTEGER;"
+puts "BEGIN"
+(0...NUM_VARS).each { |i| puts "  x#{i} := #{i + 1};" }
+puts "  s := 0;"
+puts "  i := 0;"
+puts "  WHILE i < 256 DO"
+puts "    b[i] := 0;"
+puts "    i := i + 1;"
+puts "  END;"
+
+lines = NUM_VARS + 13
+block = 0
+while lines < count
+  x = lambda { "x#{rng.rand(NUM_VARS)}" }
+  case block % 4
+  when 0
+    # arithmetic on scalars
+    8.times do
+      puts "  #{x.call} := (#{x.call} + #{x.call} * #{rng.rand(100)}) MOD 10007;"
+    end
+    lines += 8
+  when 1
+    # a counted loop over an array
+    puts "  i := 0;"
+    puts "  WHILE i < 256 DO"
+    puts "    a[i] := (i * #{rng.rand(1000)} + #{x.call}) MOD 1009;"
+    puts "    b[i] := b[i] + a[i];"
+    puts "    i := i + 1;"
+    puts "  END;"
+    lines += 6
+  when 2
+    # a conditional
+    puts "  IF #{x.call} < #{x.call} THEN"
+    puts "    s := s + #{x.call};"
+    puts "  ELSE"
+    puts "    s := s - #{x.call} DIV #{rng.rand(9) + 1};"
+    puts "  END;"
+    lines += 5
+  when 3
+    # a REPEAT loop reducing an array
+    puts "  i := #{rng.rand(200) + 50};"
+    puts "  REPEAT"
+    puts "    s := (s + b[i] * #{x.call}) MOD 1000003;"
+    puts "    i := i - 1;"
+    puts "  UNTIL i < 0 END;"
+    lines += 5
+  end
+  block += 1
+end
+
+puts "  WRITE s;"
+(0...NUM_VARS).step(8) { |i| puts "  WRITE x#{i};" }
+puts "END."
@@ -0,0 +1,147 @@
+#! /usr/bin/env ruby
+
+# Run the compiler benchmarks, printing the results as CSV.
+#
+# Usage: run_bench.rb <compiler> [<runtime-object>]
+#
+# Each benchmark program (the .in files in this directory, and the
+# programs generated by gen_program.rb) is compiled with each of its
+# sets of options, using -T to get the time and peak memory use of
+# each phase (the optimization passes are reported together, as
+# "optimize").  The generated assembly code is then linked and run
+# (reading the program's .stdin file, if there is one), and the best of
+# RUNS run times is reported.  The hardware events (cycles, instructions,
+# branch misses and L1 data cache misses, and the instructions per cycle)
+# of the compilation, and of a run of the program (using perf_run, from
+# the compiler's directory), are reported too; they're left empty if the
+# hardware counters aren't available.  The columns are described by the
+# header row; times are in milliseconds, and memory use in KB.
+
+require 'tmpdir'
+
+RUNS = 3
+PHASES = ['parse', 'symtab', 'hlcodegen', 'cfgbuild', 'optimize', 'layout', 'asmgen', 'emit']
+EVENTS = ['cycles', 'instructions', 'branch_misses', 'l1d_misses']
+
+# the generated programs, and the options to compile them with
+# (optimizing the largest programs would take too long)
+GENERATED = [
+  ['decls', 5000, [[], ['-o']]],
+  ['lines', 2000, [[], ['-o']]],
+  ['lines', 100000, [[]]],
+]
+
+def now_ms
+  Process.clock_gettime(Process::CLOCK_MONOTONIC, :float_millisecond)
+end
+
+# the instructions per cycle of a hash of event counts (or '' if the
+# counts aren't known)
+def ipc(counts)
+  return '' if counts['cycles'].nil? || counts['cycles'] == 0
+  format('%.3f', counts['instructions'].to_f / counts['cycles'])
+end
+
+compiler = ARGV[0]
+runtime = ARGV[1]
+if compiler.nil?
+  STDERR.puts "Usage: run_bench.rb <compiler> [<runtime-object>]"
+  exit 1
+end
+compiler = File.expand_path(compiler)
+bench_dir = File.dirname(File.expand_path(__FILE__))
+commit = `git -C #{bench_dir} rev-parse --short HEAD 2>/dev/null`.strip
+perf_run = File.join(File.dirname(compiler), 'perf_run')
+abort "#{perf_run} not found (run make)" if !File.executable?(perf_run)
+
+Dir.mktmpdir('bench') do |tmp|
+  # [name, source file, stdin file, options]
+  benchmarks = []
+  Dir.glob(File.join(bench_dir, '*.in')).sort.each do |src|
+    name = File.basename(src, '.in')
+    stdin = File.join(bench_dir, name + '.stdin')
+    stdin = '/dev/null' if !File.exist?(stdin)
+    [[], ['-o']].each { |opts| benchmarks << [name, src, stdin, opts] }
+  end
+  GENERATED.each do |kind, count, option_sets|
+    name = "#{kind}#{count}"
+    src = File.join(tmp, name + '.in')
+    system(File.join(bench_dir, 'gen_program.rb'), kind, count.to_s, out: src) or abort "Could not generate #{name}"
+    option_sets.each { |opts| benchmarks << [name, src, '/dev/null', opts] }
+  end
+
+  cols = ['commit', 'program', 'options', 'lines']
+  PHASES.each { |p| cols << "#{p}_ms" << "#{p}_rss_kb" }
+  cols += ['compile_ms', 'peak_rss_kb', 'allocations']
+  cols += (EVENTS + ['ipc']).map { |e| "compile_#{e}" }
+  cols << 'run_ms'
+  cols += EVENTS + ['ipc']
+  puts cols.join(',')
+
+  outputs = {}
+  benchmarks.each do |name, src, stdin, opts|
+    asm = File.join(tmp, 'bench.s')
+    exe = File.join(tmp, 'bench')
+    report = File.join(tmp, 'report.txt')
+
+    start = now_ms
+    ok = system(compiler, '-T', *opts, src, out: asm, err: report)
+    compile_ms = now_ms - start
+    abort "#{name} #{opts.join(' ')}: compilation failed\n#{File.read(report)}" if !ok
+
+    # the phase report has a row for each phase which ran, with the
+    # columns named by its header row (the event counts are empty if the
+    # counters aren't available)
+    phases = {}
+    allocations = 0
+    peak_rss = 0
+    compile_events = {}
+    header, *rows = File.readlines(report).map { |line| line.chomp.split(',', -1) }
+    rows.each do |fields|
+      row = header.zip(fields).to_h
+      phase = row['phase'].start_with?('pass:') ? 'optimize' : row['phase']
+      time, rss = phases.fetch(phase, [0.0, 0])
+      phases[phase] = [time + row['time_ms'].to_f, [rss, row['peak_rss_kb'].to_i].max]
+      allocations += row['allocations'].to_i
+      peak_rss = [peak_rss, row['peak_rss_kb'].to_i].max
+      EVENTS.each do |e|
+        compile_events[e] = compile_events.fetch(e, 0) + row[e].to_i if !row[e].to_s.empty?
+      end
+    end
+
+    link = ['gcc', '-no-pie', '-o', exe, asm]
+    link += ['-pthread', runtime] if runtime
+    system(*link, err: File::NULL) or abort "#{name} #{opts.join(' ')}: linking failed"
+
+    run_ms = nil
+    output = nil
+    RUNS.times do
+      start = now_ms
+      output = IO.popen([exe], in: stdin, &:read)
+      t = now_ms - start
+      run_ms = t if run_ms.nil? || t < run_ms
+    end
+    # the output shouldn't depend on the options
+    if outputs.key?(name) && outputs[name] != output
+      STDERR.puts "Warning: the output of #{name} differs with options '#{opts.join(' ')}'"
+    end
+    outputs[name] = output
+
+    counts_file = File.join(tmp, 'counts.csv')
+    system(perf_run, counts_file, exe, in: stdin, out: File::NULL)
+    names, values = File.readlines(counts_file).map { |line| line.chomp.split(',', -1) }
+    run_events = {}
+    names.zip(values).each { |e, v| run_events[e] = v.to_i if EVENTS.include?(e) && !v.empty? }
+
+    row = [commit, name, opts.join(' '), File.foreach(src).count]
+    PHASES.each do |p|
+      row += phases.key?(p) ? [format('%.3f', phases[p][0]), phases[p][1]] : ['', '']
+    end
+    row += [format('%.3f', compile_ms), peak_rss, allocations]
+    row += EVENTS.map { |e| compile_events.fetch(e, '') } + [ipc(compile_events)]
+    row << format('%.3f', run_ms)
+    row += EVENTS.map { |e| run_events.fetch(e, '') } + [ipc(run_events)]
+    puts row.join(',')
+    STDOUT.flush
+  end
+end
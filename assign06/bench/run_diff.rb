@@ -0,0 +1,105 @@
+#! /usr/bin/env ruby
+
+# Differential test of the optimizer: compile each program with and
+# without optimization, run both with the same input, and check that
+# they produce the same output (and exit status).  The run time of the
+# optimized program relative to the unoptimized one is also reported.
+#
+# Usage: run_diff.rb [-O <options>] [-r <runtime-object>] <compiler> [<program>...]
+#
+# The programs default to the .in files in this directory and in regress/
+# (small programs which were once miscompiled), and the programs
+# generated by gen_program.rb; a program reads its .stdin file,
+# if there is one.  The optimized programs are compiled with -o (or with
+# the given options, such as "-o -funroll=4").  The exit status is 1 if
+# any program's outputs differ, or if it can't be compiled.
+
+require 'optparse'
+require 'shellwords'
+require 'tmpdir'
+
+RUNS = 3
+GENERATED = [['lines', 2000]]
+
+def now_ms
+  Process.clock_gettime(Process::CLOCK_MONOTONIC, :float_millisecond)
+end
+
+opt_options = ['-o']
+runtime = nil
+parser = OptionParser.new do |p|
+  p.banner = 'Usage: run_diff.rb [-O <options>] [-r <runtime-object>] <compiler> [<program>...]'
+  p.on('-O OPTIONS', 'compiler options for the optimized programs') { |o| opt_options = Shellwords.split(o) }
+  p.on('-r OBJECT', 'compile with -r, linking with the runtime object') { |o| runtime = File.expand_path(o) }
+end
+parser.parse!
+if ARGV.empty?
+  STDERR.puts parser.banner
+  exit 1
+end
+compiler = File.expand_path(ARGV.shift)
+bench_dir = File.dirname(File.expand_path(__FILE__))
+
+# compile and link a program, returning the executable (or nil)
+def build(compiler, src, opts, runtime, exe)
+  asm = exe + '.s'
+  opts = opts + ['-r'] if runtime
+  return nil if !system(compiler, *opts, src, out: asm)
+  link = ['gcc', '-no-pie', '-o', exe, asm]
+  link += ['-pthread', runtime] if runtime
+  return nil if !system(*link, err: File::NULL)
+  exe
+end
+
+# run a program RUNS times, returning its output, exit status and best time
+def run(exe, stdin)
+  best = nil
+  output = status = nil
+  RUNS.times do
+    start = now_ms
+    output = IO.popen([exe], in: stdin, &:read)
+    status = $?.exitstatus
+    t = now_ms - start
+    best = t if best.nil? || t < best
+  end
+  [output, status, best]
+end
+
+failures = 0
+Dir.mktmpdir('diff') do |tmp|
+  # [name, source file, stdin file]
+  programs = []
+  sources = ARGV.empty? ? Dir.glob(File.join(bench_dir, '{,regress/}*.in')).sort : ARGV
+  sources.each do |src|
+    stdin = src.sub(/\.in\z/, '') + '.stdin'
+    programs << [File.basename(src, '.in'), src, File.exist?(stdin) ? stdin : '/dev/null']
+  end
+  if ARGV.empty?
+    GENERATED.each do |kind, count|
+      name = "#{kind}#{count}"
+      src = File.join(tmp, name + '.in')
+      system(File.join(bench_dir, 'gen_program.rb'), kind, count.to_s, out: src) or abort "Could not generate #{name}"
+      programs << [name, src, '/dev/null']
+    end
+  end
+
+  puts format('%-20s %12s %12s %8s  %s', 'program', 'plain (ms)', 'opt (ms)', 'ratio', 'result')
+  programs.each do |name, src, stdin|
+    plain = build(compiler, src, [], runtime, File.join(tmp, 'plain'))
+    opt = build(compiler, src, opt_options, runtime, File.join(tmp, 'opt'))
+    if plain.nil? || opt.nil?
+      puts format('%-20s %12s %12s %8s  %s', name, '', '', '', 'COMPILE FAILED')
+      failures += 1
+      next
+    end
+
+    plain_output, plain_status, plain_ms = run(plain, stdin)
+    opt_output, opt_status, opt_ms = run(opt, stdin)
+    same = (plain_output == opt_output && plain_status == opt_status)
+    failures += 1 if !same
+    puts format('%-20s %12.3f %12.3f %8.3f  %s', name, plain_ms, opt_ms, opt_ms / plain_ms, same ? 'ok' : 'OUTPUT DIFFERS')
+    STDOUT.flush
+  end
+end
+
+exit(failures == 0 ? 0 : 1)
@@ -0,0 +1,96 @@
+#! /usr/bin/env ruby
+
+# Compile-time scaling test: compile programs of each shape generated by
+# gen_program.rb at growing sizes, and check that the time of no phase
+# of the compilation grows faster than (about) linearly with the size.
+#
+# Usage: run_scaling.rb [-O <options>] [-n <sizes>] [-k <kinds>] <compiler>
+#
+# The sizes default to 1000, 10000 and 100000 (lines, or declarations),
+# and the kinds to all of gen_program.rb's.  The programs are compiled
+# with -T (and the given options, such as "-o" to check the optimization
+# passes too), taking the best of RUNS compilations of each phase.  When
+# the size grows by a factor k, a phase whose time grows by more than
+# SLACK * k fails, unless it still takes less than MIN_MS milliseconds
+# (so that timer noise in the fast phases isn't reported).  The exit
+# status is 1 if any phase fails, or if a program can't be compiled.
+
+require 'optparse'
+require 'shellwords'
+require 'tmpdir'
+
+RUNS = 2
+SLACK = 2.5
+MIN_MS = 50.0
+
+options = []
+sizes = [1000, 10000, 100000]
+kinds = ['decls', 'lines', 'nest', 'procs']
+parser = OptionParser.new do |p|
+  p.banner = 'Usage: run_scaling.rb [-O <options>] [-n <sizes>] [-k <kinds>] <compiler>'
+  p.on('-O OPTIONS', 'compiler options') { |o| options = Shellwords.split(o) }
+  p.on('-n SIZES', 'comma-separated program sizes') { |o| sizes = o.split(',').map(&:to_i).sort }
+  p.on('-k KINDS', 'comma-separated program kinds') { |o| kinds = o.split(',') }
+end
+parser.parse!
+if ARGV.size != 1 || sizes.size < 2
+  STDERR.puts parser.banner
+  exit 1
+end
+compiler = File.expand_path(ARGV[0])
+bench_dir = File.dirname(File.expand_path(__FILE__))
+
+# compile a program RUNS times, returning the best time of each phase
+# (or nil if it can't be compiled); a phase which runs more than once
+# (such as an optimization pass) is reported with its total time
+def phase_times(compiler, src, options, tmp)
+  report = File.join(tmp, 'report.txt')
+  best = {}
+  RUNS.times do
+    return nil if !system(compiler, '-T', *options, src, out: File::NULL, err: report)
+    times = Hash.new(0.0)
+    header, *rows = File.readlines(report).map { |line| line.chomp.split(',', -1) }
+    rows.each do |fields|
+      row = header.zip(fields).to_h
+      times[row['phase']] += row['time_ms'].to_f
+    end
+    times.each { |phase, t| best[phase] = t if !best.key?(phase) || t < best[phase] }
+  end
+  best
+end
+
+failures = 0
+Dir.mktmpdir('scaling') do |tmp|
+  puts format('%-8s %-20s %s', 'program', 'phase', sizes.map { |n| format('%12s', "#{n} (ms)") }.join(' ') + '  result')
+  kinds.each do |kind|
+    # the phase times at each size
+    results = sizes.map do |n|
+      src = File.join(tmp, "#{kind}#{n}.in")
+      system(File.join(bench_dir, 'gen_program.rb'), kind, n.to_s, out: src) or abort "Could not generate #{kind}#{n}"
+      phase_times(compiler, src, options, tmp)
+    end
+    if results.include?(nil)
+      puts format('%-8s %-20s %s', kind, '', 'COMPILE FAILED')
+      failures += 1
+      next
+    end
+
+    phases = results.flat_map(&:keys).uniq
+    phases.each do |phase|
+      times = results.map { |r| r.fetch(phase, 0.0) }
+      worst = nil
+      (1...sizes.size).each do |i|
+        next if times[i] < MIN_MS
+        growth = times[i] / [times[i - 1], 0.001].max / (sizes[i].to_f / sizes[i - 1])
+        worst = growth if worst.nil? || growth > worst
+      end
+      ok = worst.nil? || worst <= SLACK
+      failures += 1 if !ok
+      result = ok ? 'ok' : format('SUPER-LINEAR (%.1fx linear)', worst)
+      puts format('%-8s %-20s %s  %s', kind, phase, times.map { |t| format('%12.3f', t) }.join(' '), result)
+    end
+    STDOUT.flush
+  end
+end
+
+exit(failures == 0 ? 0 : 1)
@@ -0,0 +1,364 @@
+#include <cassert>
+#include <climits>
+#include <map>
+#include "cfg.h"
+#include "highlevel.h"
+#include "ssa.h"
+#include "stats.h"
+#include "bounds_check.h"
+
+namespace {
+    bool is_vreg(const Operand &operand, int vreg) {
+        return operand.get_kind() == OPERAND_VREG && operand.get_base_reg() == vreg;
+    }
+
+    bool is_literal(const Operand &operand) {
+        return operand.get_kind() == OPERAND_INT_LITERAL;
+    }
+
+    // is an operand a literal, or a vreg which isn't defined in a loop
+    // (with the given defs)?
+    bool is_invariant(const Operand &operand, const std::set<int> &defs) {
+        return is_literal(operand) || (operand.get_kind() == OPERAND_VREG && defs.count(operand.get_base_reg()) == 0);
+    }
+
+    // the conditional branch opcode testing "r op l" when another tests "l op r"
+    int get_swapped_branch(int opcode) {
+        switch (opcode) {
+            case HINS_JLT:  return HINS_JGT;
+            case HINS_JLTE: return HINS_JGTE;
+            case HINS_JGT:  return HINS_JLT;
+            case HINS_JGTE: return HINS_JLTE;
+            default:        return opcode;
+        }
+    }
+}
+
+BoundsCheckElimination::BoundsCheckElimination(ControlFlowGraph *cfg, const DominatorTree &domtree,
+                                               const LoopForest &loops, const ValueRangeAnalysis &ranges)
+        : ControlFlowGraphTransform(cfg)
+        , m_cfg(cfg)
+        , m_domtree(domtree)
+        , m_loops(loops)
+        , m_ranges(ranges)
+        , m_next_vreg(HighLevel::get_num_vregs(cfg))
+        , m_num_defs(unsigned(m_next_vreg), 0) {
+    m_appended.resize(cfg->get_num_blocks());
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            if (HighLevel::is_def(*j) && (*j)->get_operand(0).get_kind() == OPERAND_VREG) {
+                m_num_defs[unsigned((*j)->get_operand(0).get_base_reg())]++;
+            }
+        }
+    }
+
+    // the checks which can't fail
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            Instruction *ins = *j;
+            if (ins->get_opcode() != HINS_BOUNDS_CHECK) {
+                continue;
+            }
+            ValueRangeAnalysis::Range range = m_ranges.get_range(bb, ins->get_operand(0));
+            if (range.lo >= 0 && range.hi < ins->get_operand(1).get_int_value()) {
+                m_removed.insert(ins);
+                Statistics::get().add("boundscheck.removed");
+            }
+        }
+    }
+    remove_redundant_checks();
+
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        hoist_checks(m_loops.get_loop(i));
+    }
+}
+
+BoundsCheckElimination::~BoundsCheckElimination() {
+    for (unsigned i = 0; i < m_appended.size(); i++) {
+        for (auto j = m_appended[i].begin(); j != m_appended[i].end(); j++) {
+            delete *j;
+        }
+    }
+}
+
+InstructionSequence *BoundsCheckElimination::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+    const std::vector<Instruction *> &appended = m_appended[bb->get_id()];
+    unsigned len = bb->get_length();
+    unsigned split = SSA::get_insertion_point(bb);
+
+    for (unsigned i = 0; i <= len; i++) {
+        if (i == split) {
+            for (auto j = appended.begin(); j != appended.end(); j++) {
+                out->add_instruction((*j)->duplicate());
+            }
+        }
+        if (i == len) {
+            break;
+        }
+        Instruction *ins = bb->get_instruction(i);
+        if (m_removed.count(ins) == 0) {
+            out->add_instruction(ins->duplicate());
+        }
+    }
+
+    // don't leave a (possibly labeled) basic block without instructions
+    if (out->get_length() == 0 && len > 0) {
+        out->add_instruction(new Instruction(HINS_NOP));
+    }
+
+    return out;
+}
+
+void BoundsCheckElimination::remove_redundant_checks() {
+    // the checks of each index (a literal, or a vreg with a single def,
+    // which has the same value at every check) in the order of the blocks
+    std::map<std::pair<int, long>, std::vector<std::pair<BasicBlock *, Instruction *>>> checks;
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            Instruction *ins = *j;
+            if (ins->get_opcode() != HINS_BOUNDS_CHECK || m_removed.count(ins) > 0) {
+                continue;
+            }
+            const Operand &index = ins->get_operand(0);
+            if (is_literal(index)) {
+                checks[std::make_pair(0, index.get_int_value())].push_back(std::make_pair(*i, ins));
+            } else if (index.get_kind() == OPERAND_VREG && m_num_defs[unsigned(index.get_base_reg())] <= 1) {
+                checks[std::make_pair(1, long(index.get_base_reg()))].push_back(std::make_pair(*i, ins));
+            }
+        }
+    }
+
+    // (a check removed because of a dominating one which is removed in
+    // turn is dominated by the check that one is redundant with)
+    for (auto i = checks.begin(); i != checks.end(); i++) {
+        const std::vector<std::pair<BasicBlock *, Instruction *>> &list = i->second;
+        for (unsigned j = 0; j < list.size(); j++) {
+            BasicBlock *bb = list[j].first;
+            long size = list[j].second->get_operand(1).get_int_value();
+            for (unsigned k = 0; k < list.size(); k++) {
+                // (an earlier check in the same block comes earlier in the list)
+                BasicBlock *other = list[k].first;
+                bool dominates = (other == bb) ? k < j : m_domtree.dominates(other, bb);
+                if (dominates && list[k].second->get_operand(1).get_int_value() <= size) {
+                    m_removed.insert(list[j].second);
+                    Statistics::get().add("boundscheck.removed");
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void BoundsCheckElimination::hoist_checks(const LoopForest::Loop &loop) {
+    if (!loop.children.empty() || loop.preheader == nullptr || loop.latches.size() != 1) {
+        return;
+    }
+    for (auto i = loop.exits.begin(); i != loop.exits.end(); i++) {
+        if ((*i)->get_source() != loop.header) {
+            return;
+        }
+    }
+
+    // the vregs defined in the loop, and its checks
+    std::set<int> defs;
+    std::vector<std::pair<BasicBlock *, Instruction *>> checks;
+    for (auto i = loop.blocks.begin(); i != loop.blocks.end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            Instruction *ins = *j;
+            if (ins->get_opcode() == HINS_BOUNDS_CHECK) {
+                if (m_removed.count(ins) == 0 && m_domtree.dominates(*i, loop.latches[0])
+                        && ins->get_operand(1).get_int_value() > 0) {
+                    checks.push_back(std::make_pair(*i, ins));
+                }
+            } else if (HighLevel::has_flags(ins->get_opcode(), HOP_SIDE_EFFECT | HOP_CALL | HOP_MAY_TRAP)) {
+                return;
+            }
+            if (HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG) {
+                defs.insert(ins->get_operand(0).get_base_reg());
+            }
+        }
+    }
+    if (checks.empty()) {
+        return;
+    }
+
+    // the condition on which the loop continues, and the header's
+    // comparison on entry to the loop
+    BasicBlock *body = nullptr;
+    const ControlFlowGraph::EdgeList &edges = m_cfg->get_outgoing_edges(loop.header);
+    for (auto i = edges.cbegin(); i != edges.cend(); i++) {
+        if (loop.contains((*i)->get_target())) {
+            body = (*i)->get_target();
+        }
+    }
+    ValueRangeAnalysis::Condition condition;
+    if (body == nullptr || edges.size() != 2 || loop.exits.size() != 1
+            || !m_ranges.get_edge_condition(loop.header, body, condition)) {
+        return;
+    }
+    Operand entry_left, entry_right;
+    if (!get_entry_value(loop, defs, condition.left, entry_left)
+            || !get_entry_value(loop, defs, condition.right, entry_right)) {
+        return;
+    }
+
+    // the indices to check in the preheader if the loop is entered, and
+    // the checks in the header (which need no guard)
+    std::vector<Instruction *> &appended = m_appended[loop.preheader->get_id()];
+    std::vector<Instruction *> guarded, unguarded;
+    for (auto i = checks.begin(); i != checks.end(); i++) {
+        BasicBlock *bb = i->first;
+        const Operand &index = i->second->get_operand(0);
+        const Operand &size = i->second->get_operand(1);
+        Operand hoisted;
+        if (get_invariant_value(loop, defs, index, hoisted)) {
+            if (bb == loop.header) {
+                unguarded.push_back(new Instruction(HINS_BOUNDS_CHECK, hoisted, size));
+                m_removed.insert(i->second);
+                Statistics::get().add("boundscheck.hoisted");
+                continue;
+            }
+        } else if (bb == loop.header || index.get_kind() != OPERAND_VREG
+                   || !get_last_index(loop, defs, index.get_base_reg(), condition, appended, hoisted)) {
+            continue;
+        }
+        Operand dest(OPERAND_VREG, m_next_vreg++);
+        int cmov = HighLevel::get_conditional_move(condition.opcode);
+        guarded.push_back(new Instruction(cmov, dest, hoisted, Operand(OPERAND_INT_LITERAL, 0L)));
+        guarded.push_back(new Instruction(HINS_BOUNDS_CHECK, dest, size));
+        m_removed.insert(i->second);
+        Statistics::get().add("boundscheck.hoisted");
+    }
+
+    // (the conditional moves follow the comparison, and then come the checks)
+    if (!guarded.empty()) {
+        appended.push_back(new Instruction(HINS_INT_COMPARE, entry_left, entry_right));
+        for (unsigned i = 0; i < guarded.size(); i += 2) {
+            appended.push_back(guarded[i]);
+        }
+        for (unsigned i = 1; i < guarded.size(); i += 2) {
+            appended.push_back(guarded[i]);
+        }
+    }
+    appended.insert(appended.end(), unguarded.begin(), unguarded.end());
+}
+
+Instruction *BoundsCheckElimination::get_header_phi(const LoopForest::Loop &loop, const Operand &operand) const {
+    for (auto i = loop.header->cbegin(); i != loop.header->cend() && SSA::is_phi(*i); i++) {
+        if (operand.get_kind() == OPERAND_VREG && is_vreg((*i)->get_operand(0), operand.get_base_reg())) {
+            return *i;
+        }
+    }
+    return nullptr;
+}
+
+bool BoundsCheckElimination::get_entry_value(const LoopForest::Loop &loop, const std::set<int> &defs,
+                                             const Operand &operand, Operand &value) const {
+    if (is_invariant(operand, defs)) {
+        value = operand;
+        return true;
+    }
+    Instruction *phi = get_header_phi(loop, operand);
+    if (phi == nullptr) {
+        return false;
+    }
+    value = phi->get_operand(SSA::get_pred_index(m_cfg, loop.header, loop.preheader) + 1);
+    return true;
+}
+
+bool BoundsCheckElimination::get_invariant_value(const LoopForest::Loop &loop, const std::set<int> &defs,
+                                                 const Operand &operand, Operand &value) const {
+    if (is_invariant(operand, defs)) {
+        value = operand;
+        return true;
+    }
+    // (a phi which keeps its value around the loop, "phi vrX, vrA, vrX",
+    // is the invariant vrA)
+    Instruction *phi = get_header_phi(loop, operand);
+    if (phi == nullptr || phi->get_num_operands() != 3) {
+        return false;
+    }
+    unsigned entry = SSA::get_pred_index(m_cfg, loop.header, loop.preheader) + 1;
+    if (!(phi->get_operand(3 - entry) == operand)) {
+        return false;
+    }
+    value = phi->get_operand(entry);
+    return true;
+}
+
+bool BoundsCheckElimination::get_last_index(const LoopForest::Loop &loop, const std::set<int> &defs, int vreg,
+                                            const ValueRangeAnalysis::Condition &condition,
+                                            std::vector<Instruction *> &code, Operand &last) {
+    // "vrI op bound", where op is < or <=
+    int opcode = condition.opcode;
+    const Operand *limit = &condition.right;
+    if (is_vreg(condition.right, vreg)) {
+        opcode = get_swapped_branch(opcode);
+        limit = &condition.left;
+    } else if (!is_vreg(condition.left, vreg)) {
+        return false;
+    }
+    Operand bound;
+    if ((opcode != HINS_JLT && opcode != HINS_JLTE) || !get_invariant_value(loop, defs, *limit, bound)) {
+        return false;
+    }
+
+    // vrI is set by a phi of the header to a non-negative value on entry,
+    // and to vrI + 1 on the back edge (possibly through moves)
+    Instruction *phi = get_header_phi(loop, Operand(OPERAND_VREG, vreg));
+    if (phi == nullptr || phi->get_num_operands() != 3 || m_num_defs[unsigned(vreg)] != 1) {
+        return false;
+    }
+    unsigned entry = SSA::get_pred_index(m_cfg, loop.header, loop.preheader) + 1;
+    if (m_ranges.get_range(loop.preheader, phi->get_operand(entry)).lo < 0) {
+        return false;
+    }
+    std::map<int, Instruction *> loop_defs;
+    for (auto i = loop.blocks.begin(); i != loop.blocks.end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            if (HighLevel::is_def(*j) && (*j)->get_operand(0).get_kind() == OPERAND_VREG) {
+                loop_defs[(*j)->get_operand(0).get_base_reg()] = *j;
+            }
+        }
+    }
+    Operand next = phi->get_operand(3 - entry);
+    Instruction *increment = nullptr;
+    while (increment == nullptr || increment->get_opcode() == HINS_MOV) {
+        if (increment != nullptr) {
+            next = increment->get_operand(1);
+        }
+        if (next.get_kind() != OPERAND_VREG || m_num_defs[unsigned(next.get_base_reg())] != 1
+                || loop_defs.count(next.get_base_reg()) == 0) {
+            return false;
+        }
+        increment = loop_defs[next.get_base_reg()];
+    }
+    if (increment->get_opcode() != HINS_INT_ADD) {
+        return false;
+    }
+    Operand left = increment->get_operand(1), right = increment->get_operand(2);
+    if (is_literal(left)) {
+        std::swap(left, right);
+    }
+    if (!is_vreg(left, vreg) || !is_literal(right) || right.get_int_value() != 1) {
+        return false;
+    }
+
+    // (vrI is less than the bound if the loop is entered, so bound - 1
+    // doesn't overflow then)
+    if (opcode == HINS_JLTE) {
+        last = bound;
+    } else if (is_literal(bound)) {
+        if (bound.get_int_value() == LONG_MIN) {
+            return false;
+        }
+        last = Operand(OPERAND_INT_LITERAL, bound.get_int_value() - 1);
+    } else {
+        last = Operand(OPERAND_VREG, m_next_vreg++);
+        code.push_back(new Instruction(HINS_INT_SUB, last, bound, Operand(OPERAND_INT_LITERAL, 1L)));
+    }
+    return true;
+}
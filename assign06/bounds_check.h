@@ -0,0 +1,92 @@
+#ifndef BOUNDS_CHECK_H
+#define BOUNDS_CHECK_H
+
+#include <set>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "loops.h"
+#include "value_range.h"
+
+class DominatorTree;
+
+// Elimination of the array bounds checks (the chkb instructions emitted
+// with -fbounds-check) of a high-level CFG in SSA form:
+//   - a check whose index is in range for every value in its range (see
+//     ValueRangeAnalysis), or which is dominated by a check of the same
+//     index against no more elements, is removed,
+//   - a check in an innermost loop whose index is loop-invariant is moved
+//     to the loop's preheader, and a check of the induction variable of a
+//     loop such as
+//
+//       header:  phi vrI, vr1, vr2        (where vr1 >= 0)
+//                cmpi vrI, vrN
+//                jgte exit
+//       body:    chkb vrI, $10
+//                ...
+//                addi vr2, vrI, $1
+//
+//     is replaced by a check of the last value vrI takes (vrN - 1) in the
+//     preheader, so that the loop is checked once, rather than on every
+//     iteration.
+//
+// A failed check ends the program, so a check is only moved out of a loop
+// if the loop certainly gets to it on its first iteration (and, for the
+// induction variable, on every iteration), with nothing observable
+// happening first: the loop has nothing with side effects or which may
+// trap (other than checks), is only left from its header, and the check's
+// block dominates its latch.  A check in the preheader mustn't fail when
+// the loop isn't entered, so it is of an index which is 0 unless the
+// header's comparison holds for the values on entry:
+//
+//   cmpi vr1, vrN         (vr1 is the value of vrI on entry)
+//   cmovlt vrG, vrL, $0   (vrL is the invariant index, or vrN - 1)
+//   chkb vrG, $10
+//
+// (except for a check in the header, which runs whenever the loop is
+// entered).  Loops without a preheader are left alone.
+class BoundsCheckElimination : public ControlFlowGraphTransform {
+private:
+    ControlFlowGraph *m_cfg;
+    const DominatorTree &m_domtree;
+    const LoopForest &m_loops;
+    const ValueRangeAnalysis &m_ranges;
+    int m_next_vreg;
+    // the number of defs of each vreg
+    std::vector<unsigned> m_num_defs;
+    // the checks removed (or moved to a preheader), and the code added at
+    // the end of each preheader (indexed by block id)
+    std::set<Instruction *> m_removed;
+    std::vector<std::vector<Instruction *>> m_appended;
+
+    // disallow copy ctor and assignment operator
+    BoundsCheckElimination(const BoundsCheckElimination &);
+    BoundsCheckElimination &operator=(const BoundsCheckElimination &);
+
+public:
+    BoundsCheckElimination(ControlFlowGraph *cfg, const DominatorTree &domtree, const LoopForest &loops,
+                           const ValueRangeAnalysis &ranges);
+    virtual ~BoundsCheckElimination();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void remove_redundant_checks();
+    void hoist_checks(const LoopForest::Loop &loop);
+    Instruction *get_header_phi(const LoopForest::Loop &loop, const Operand &operand) const;
+    // the value of an operand of the header's comparison when the loop is
+    // entered, or false if it isn't known in the preheader
+    bool get_entry_value(const LoopForest::Loop &loop, const std::set<int> &defs, const Operand &operand,
+                         Operand &value) const;
+    // the value of an operand which is the same throughout the loop
+    bool get_invariant_value(const LoopForest::Loop &loop, const std::set<int> &defs, const Operand &operand,
+                             Operand &value) const;
+    // the last value of the induction variable vrI checked in a loop,
+    // given the condition on which it continues, "vrI op bound" (or false
+    // if vrI isn't such an induction variable)
+    bool get_last_index(const LoopForest::Loop &loop, const std::set<int> &defs, int vreg,
+                        const ValueRangeAnalysis::Condition &condition, std::vector<Instruction *> &code,
+                        Operand &last);
+};
+
+#endif // BOUNDS_CHECK_H
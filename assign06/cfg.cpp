@@ -1,8 +1,460 @@
 #include <cassert>
+#include <cctype>
 #include <cstdio>
 #include <algorithm>
-#include "cpputil.h"
+#include <set>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include "util.h"
 #include "cfg.h"
+#include "output.h"
+#include "arena.h"
+
+static_assert(std::is_trivially_copyable<Operand>::value, "Operand should be trivially copyable");
+static_assert(std::is_trivially_copyable<Instruction>::value, "Instruction should be trivially copyable");
+
+////////////////////////////////////////////////////////////////////////
+// IRArena implementation
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+    // storage for the extra operands of instructions (each instruction's
+    // are contiguous), allocated in large chunks which are never moved
+    class OperandPool {
+    private:
+        static const unsigned CHUNK_SIZE = 1024;
+
+        std::vector<Operand *> m_chunks;
+        unsigned m_num_used;     // number of operands used in the last chunk
+        // the chunks of CHUNK_SIZE operands kept by reset() (larger ones
+        // are freed)
+        std::vector<Operand *> m_spare_chunks;
+        std::vector<bool> m_is_large;
+
+    public:
+        OperandPool() : m_num_used(CHUNK_SIZE) { }
+        ~OperandPool() { release(); }
+
+        Operand *allocate(unsigned n) {
+            if (m_num_used + n > CHUNK_SIZE) {
+                if (n <= CHUNK_SIZE && !m_spare_chunks.empty()) {
+                    m_chunks.push_back(m_spare_chunks.back());
+                    m_spare_chunks.pop_back();
+                } else {
+                    m_chunks.push_back(new Operand[(n > CHUNK_SIZE) ? n : CHUNK_SIZE]);
+                }
+                m_is_large.push_back(n > CHUNK_SIZE);
+                m_num_used = 0;
+            }
+            Operand *operands = m_chunks.back() + m_num_used;
+            m_num_used += n;
+            return operands;
+        }
+
+        void release() {
+            reset();
+            for (auto i = m_spare_chunks.begin(); i != m_spare_chunks.end(); i++) {
+                delete[] *i;
+            }
+            m_spare_chunks.clear();
+        }
+
+        void reset() {
+            for (unsigned i = 0; i < m_chunks.size(); i++) {
+                if (m_is_large[i]) {
+                    delete[] m_chunks[i];
+                } else {
+                    m_spare_chunks.push_back(m_chunks[i]);
+                }
+            }
+            m_chunks.clear();
+            m_is_large.clear();
+            m_num_used = CHUNK_SIZE;
+        }
+    };
+
+    struct Arena {
+        ObjectPool<Instruction> instruction_pool;
+        ObjectPool<InstructionSequence> iseq_pool;
+        ObjectPool<BasicBlock> basic_block_pool;
+        ObjectPool<Edge> edge_pool;
+        ObjectPool<ControlFlowGraph> cfg_pool;
+        OperandPool extra_operands;
+        // the arenas of the threads which ran tasks for this thread's
+        // compilation (see IRArena::run_parallel)
+        std::vector<Arena *> workers;
+
+        ~Arena() {
+            release(false);
+        }
+
+        // (keeping this arena's storage for later compilations if
+        // keep_storage is set: the workers' arenas are always freed)
+        void release(bool keep_storage) {
+            // (all of the pools of a kind are released before the next
+            // kind, as objects may be returned to another arena's pool)
+            for (auto i = workers.begin(); i != workers.end(); i++) {
+                (*i)->cfg_pool.release();
+            }
+            release_pool(cfg_pool, keep_storage);
+            for (auto i = workers.begin(); i != workers.end(); i++) {
+                (*i)->edge_pool.release();
+            }
+            release_pool(edge_pool, keep_storage);
+            for (auto i = workers.begin(); i != workers.end(); i++) {
+                (*i)->basic_block_pool.release();
+            }
+            release_pool(basic_block_pool, keep_storage);
+            for (auto i = workers.begin(); i != workers.end(); i++) {
+                (*i)->iseq_pool.release();
+            }
+            release_pool(iseq_pool, keep_storage);
+            for (auto i = workers.begin(); i != workers.end(); i++) {
+                (*i)->instruction_pool.release();
+                (*i)->extra_operands.release();
+                delete *i;
+            }
+            workers.clear();
+            release_pool(instruction_pool, keep_storage);
+            release_pool(extra_operands, keep_storage);
+        }
+
+        template<typename Pool>
+        static void release_pool(Pool &pool, bool keep_storage) {
+            if (keep_storage) {
+                pool.reset();
+            } else {
+                pool.release();
+            }
+        }
+    };
+
+    // the arena of this thread's compilation, and the one it allocates
+    // from (which belongs to another thread's compilation while running
+    // one of its tasks)
+    thread_local Arena s_own_arena;
+    thread_local Arena *s_arena = nullptr;
+
+    Arena &get_arena() {
+        return (s_arena != nullptr) ? *s_arena : s_own_arena;
+    }
+
+    thread_local StringTable s_labels, s_comments;
+    thread_local StringTable *s_shared_labels = nullptr, *s_shared_comments = nullptr;
+    thread_local std::string s_label_suffix;
+    thread_local bool s_reuse_storage = false;
+}
+
+void IRArena::release() {
+    s_own_arena.release(s_reuse_storage);
+    StringTable::labels().clear();
+    StringTable::comments().clear();
+}
+
+void IRArena::set_reuse_storage(bool reuse) {
+    s_reuse_storage = reuse;
+}
+
+namespace {
+    // the instructions of a replacement (which aren't freed), to which the
+    // ones freed are added, in case one is in two of the sequences freed
+    typedef std::unordered_set<const Instruction *> InstructionSet;
+
+    void add_instructions(InstructionSet &kept, const ControlFlowGraph *cfg) {
+        for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+            kept.insert((*i)->cbegin(), (*i)->cend());
+        }
+    }
+
+    void free_instructions(InstructionSet &kept, const InstructionSequence *iseq) {
+        for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+            if (kept.insert(*i).second) {
+                delete *i;
+            }
+        }
+    }
+}
+
+void IRArena::free_replaced(ControlFlowGraph *cfg, const ControlFlowGraph *replacement) {
+    free_replaced(std::vector<ControlFlowGraph *>(1, cfg), replacement);
+}
+
+void IRArena::free_replaced(const std::vector<ControlFlowGraph *> &cfgs, const ControlFlowGraph *replacement) {
+    // (a pass may move an instruction to the CFG it creates)
+    InstructionSet kept;
+    add_instructions(kept, replacement);
+    for (auto c = cfgs.begin(); c != cfgs.end(); c++) {
+        ControlFlowGraph *cfg = *c;
+        if (cfg == replacement) {
+            continue;
+        }
+        for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+            BasicBlock *bb = *i;
+            const ControlFlowGraph::EdgeList &edges = cfg->get_outgoing_edges(bb);
+            for (auto j = edges.begin(); j != edges.end(); j++) {
+                delete *j;
+            }
+            if (!bb->shares_instructions()) {
+                free_instructions(kept, bb);
+            }
+        }
+        // (the blocks are deleted last, as the edge lists are indexed by them)
+        for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+            delete *i;
+        }
+        delete cfg;
+    }
+}
+
+void IRArena::free_replaced(InstructionSequence *iseq, const InstructionSequence *replacement) {
+    if (iseq == replacement) {
+        return;
+    }
+    InstructionSet kept(replacement->cbegin(), replacement->cend());
+    free_instructions(kept, iseq);
+    delete iseq;
+}
+
+void IRArena::free_replaced(InstructionSequence *iseq, const ControlFlowGraph *replacement) {
+    InstructionSet kept;
+    add_instructions(kept, replacement);
+    free_instructions(kept, iseq);
+    delete iseq;
+}
+
+void IRArena::run_parallel(unsigned num_tasks, unsigned num_threads, const std::function<void(unsigned)> &task) {
+    num_threads = std::min(num_threads, num_tasks);
+    if (num_threads <= 1) {
+        for (unsigned i = 0; i < num_tasks; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    // each thread (including this one) allocates from an arena of its
+    // own while running the tasks
+    Arena &owner = get_arena();
+    StringTable &labels = StringTable::labels();
+    StringTable &comments = StringTable::comments();
+    std::vector<Arena *> arenas;
+    for (unsigned i = 0; i < num_threads; i++) {
+        arenas.push_back(new Arena());
+        owner.workers.push_back(arenas.back());
+    }
+    // (the tables are already shared if this is one of another
+    // run_parallel's tasks)
+    bool was_shared = labels.m_shared;
+    if (!was_shared) {
+        labels.set_shared(true);
+        comments.set_shared(true);
+    }
+
+    // (a fatal error in a task is handled by the handler of this thread,
+    // see err_set_handler: if it throws an exception, the tasks not yet
+    // started are skipped, and the first exception is rethrown here once
+    // all of the threads are done)
+    void (*handler)(const char *msg) = err_get_handler();
+    std::exception_ptr error;
+    std::mutex error_lock;
+    std::atomic<unsigned> next_task(0);
+    auto worker = [&](unsigned thread) {
+        Arena *saved_arena = s_arena;
+        StringTable *saved_labels = s_shared_labels, *saved_comments = s_shared_comments;
+        std::string saved_suffix = s_label_suffix;
+        void (*saved_handler)(const char *msg) = err_get_handler();
+        s_arena = arenas[thread];
+        s_shared_labels = &labels;
+        s_shared_comments = &comments;
+        err_set_handler(handler);
+        try {
+            unsigned i;
+            while ((i = next_task++) < num_tasks) {
+                task(i);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(error_lock);
+            if (!error) {
+                error = std::current_exception();
+            }
+            next_task = num_tasks;
+        }
+        err_set_handler(saved_handler);
+        s_arena = saved_arena;
+        s_shared_labels = saved_labels;
+        s_shared_comments = saved_comments;
+        s_label_suffix = saved_suffix;
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < num_threads; i++) {
+        threads.push_back(std::thread(worker, i));
+    }
+    worker(0);
+    for (auto i = threads.begin(); i != threads.end(); i++) {
+        i->join();
+    }
+
+    if (!was_shared) {
+        labels.set_shared(false);
+        comments.set_shared(false);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void *Instruction::operator new(std::size_t size) {
+    assert(size == sizeof(Instruction));
+    return get_arena().instruction_pool.allocate();
+}
+
+void Instruction::operator delete(void *p) {
+    get_arena().instruction_pool.deallocate(p);
+}
+
+void *InstructionSequence::operator new(std::size_t size) {
+    assert(size == sizeof(InstructionSequence));
+    return get_arena().iseq_pool.allocate();
+}
+
+void InstructionSequence::operator delete(void *p) {
+    get_arena().iseq_pool.deallocate(p);
+}
+
+void *BasicBlock::operator new(std::size_t size) {
+    assert(size == sizeof(BasicBlock));
+    return get_arena().basic_block_pool.allocate();
+}
+
+void BasicBlock::operator delete(void *p) {
+    get_arena().basic_block_pool.deallocate(p);
+}
+
+void *Edge::operator new(std::size_t size) {
+    assert(size == sizeof(Edge));
+    return get_arena().edge_pool.allocate();
+}
+
+void Edge::operator delete(void *p) {
+    get_arena().edge_pool.deallocate(p);
+}
+
+void *ControlFlowGraph::operator new(std::size_t size) {
+    assert(size == sizeof(ControlFlowGraph));
+    return get_arena().cfg_pool.allocate();
+}
+
+void ControlFlowGraph::operator delete(void *p) {
+    get_arena().cfg_pool.deallocate(p);
+}
+
+////////////////////////////////////////////////////////////////////////
+// StringTable implementation
+////////////////////////////////////////////////////////////////////////
+
+StringTable::StringTable()
+        : m_shared(false) {
+}
+
+int StringTable::intern(const std::string &s) {
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    if (m_shared) {
+        lock.lock();
+    }
+    auto i = m_index.find(s);
+    if (i != m_index.end()) {
+        return i->second;
+    }
+    int id = int(m_strings.size());
+    m_strings.push_back(s);
+    m_index[s] = id;
+    return id;
+}
+
+int StringTable::lookup(const std::string &s) const {
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    if (m_shared) {
+        lock.lock();
+    }
+    auto i = m_index.find(s);
+    return i != m_index.end() ? i->second : -1;
+}
+
+std::string StringTable::new_label(const std::string &prefix) {
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    if (m_shared) {
+        lock.lock();
+    }
+    // (the labels with each suffix are numbered separately)
+    unsigned number = m_next_label_numbers[prefix + s_label_suffix]++;
+    return prefix + std::to_string(number) + s_label_suffix;
+}
+
+void StringTable::reserve_label(const std::string &label) {
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    if (m_shared) {
+        lock.lock();
+    }
+    size_t suffix_size = s_label_suffix.size();
+    if (label.size() < suffix_size || label.compare(label.size() - suffix_size, suffix_size, s_label_suffix) != 0) {
+        return;
+    }
+    size_t end = label.size() - suffix_size, start = end;
+    while (start > 0 && isdigit((unsigned char) label[start - 1])) {
+        start--;
+    }
+    if (start < end) {
+        unsigned number = unsigned(std::stoul(label.substr(start, end - start)));
+        unsigned &next = m_next_label_numbers[label.substr(0, start) + s_label_suffix];
+        next = std::max(next, number + 1);
+    }
+}
+
+int StringTable::defer(const Instruction *source, CommentFormatter format) {
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    if (m_shared) {
+        lock.lock();
+    }
+    m_deferred.push_back(std::make_pair(source, format));
+    return int(m_deferred.size()) - 1;
+}
+
+std::string StringTable::get_deferred(int id) const {
+    std::pair<const Instruction *, CommentFormatter> deferred;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+        if (m_shared) {
+            lock.lock();
+        }
+        assert(id >= 0 && id < int(m_deferred.size()));
+        deferred = m_deferred[id];
+    }
+    // (formatted without the lock held, as the formatter may use the table)
+    return deferred.second(deferred.first);
+}
+
+void StringTable::clear() {
+    m_strings.clear();
+    m_index.clear();
+    m_deferred.clear();
+    m_next_label_numbers.clear();
+}
+
+StringTable &StringTable::labels() {
+    return (s_shared_labels != nullptr) ? *s_shared_labels : s_labels;
+}
+
+StringTable &StringTable::comments() {
+    return (s_shared_comments != nullptr) ? *s_shared_comments : s_comments;
+}
+
+void StringTable::set_label_suffix(const std::string &suffix) {
+    s_label_suffix = suffix;
+}
 
 ////////////////////////////////////////////////////////////////////////
 // Operand implementation
@@ -12,9 +464,10 @@ Operand::Operand()
         : m_kind(OPERAND_NONE)
         , m_basereg(0)
         , m_indexreg(0)
-        , m_ival(0)
+        , m_scale(1)
         , m_is_scalar(false)
         , m_maps_mreg(false)
+        , m_ival(0)
 {
 }
 
@@ -22,14 +475,15 @@ Operand::Operand(OperandKind kind, long ival)
         : m_kind(kind)
         , m_basereg(0)
         , m_indexreg(0)
-        , m_ival(0)
+        , m_scale(1)
         , m_is_scalar(false)
-        , m_maps_mreg(false) {
+        , m_maps_mreg(false)
+        , m_ival(0) {
     assert(kind == OPERAND_VREG || kind == OPERAND_MREG ||
            kind == OPERAND_VREG_MEMREF || kind == OPERAND_MREG_MEMREF ||
-           kind == OPERAND_INT_LITERAL);
+           kind == OPERAND_INT_LITERAL || kind == OPERAND_LOCAL_MEMREF);
 
-    if (kind == OPERAND_INT_LITERAL) {
+    if (kind == OPERAND_INT_LITERAL || kind == OPERAND_LOCAL_MEMREF) {
         m_ival = ival;
     } else {
         m_basereg = int(ival);
@@ -40,9 +494,10 @@ Operand::Operand(OperandKind kind, int basereg, int offset_or_index)
         : m_kind(kind)
         , m_basereg(basereg)
         , m_indexreg(0)
-        , m_ival(0)
+        , m_scale(1)
         , m_is_scalar(false)
-        , m_maps_mreg(false) {
+        , m_maps_mreg(false)
+        , m_ival(0) {
     assert(kind == OPERAND_VREG_MEMREF_OFFSET || kind == OPERAND_VREG_MEMREF_INDEX ||
            kind == OPERAND_MREG_MEMREF_OFFSET || kind == OPERAND_MREG_MEMREF_INDEX);
 
@@ -53,25 +508,38 @@ Operand::Operand(OperandKind kind, int basereg, int offset_or_index)
     }
 }
 
-Operand::Operand(OperandKind kind, int basereg, int indexreg, int offset)
+Operand::Operand(OperandKind kind, int basereg, int indexreg, int offset, int scale)
         : m_kind(kind)
         , m_basereg(basereg)
         , m_indexreg(indexreg)
-        , m_ival(offset)
+        , m_scale(scale)
         , m_is_scalar(false)
-        , m_maps_mreg(false) {
+        , m_maps_mreg(false)
+        , m_ival(offset) {
     // currently there is only one kind of reg+reg+offset operand
     assert(m_kind == OPERAND_MREG_MEMREF_OFFSET_INDEX);
+    assert(scale == 1 || scale == 2 || scale == 4 || scale == 8);
 }
 
 Operand::Operand(const std::string &target_label, bool is_immediate)
         : m_kind(is_immediate ? OPERAND_LABEL_IMMEDIATE : OPERAND_LABEL)
         , m_basereg(0)
         , m_indexreg(0)
-        , m_ival(0)
+        , m_scale(1)
         , m_is_scalar(false)
         , m_maps_mreg(false)
-        , m_target_label(target_label) {
+        , m_ival(StringTable::labels().intern(target_label)) {
+}
+
+Operand::Operand(OperandKind kind, const std::string &target_label)
+        : m_kind(kind)
+        , m_basereg(0)
+        , m_indexreg(0)
+        , m_scale(1)
+        , m_is_scalar(false)
+        , m_maps_mreg(false)
+        , m_ival(StringTable::labels().intern(target_label)) {
+    assert((kind & OPROP_HAS_LABEL) != 0);
 }
 
 bool Operand::has_base_reg() const {
@@ -102,9 +570,24 @@ int Operand::get_offset() const {
     return int(m_ival);
 }
 
-std::string Operand::get_target_label() const {
+const std::string &Operand::get_target_label() const {
+    assert((m_kind & OPROP_HAS_LABEL) != 0);
+    return StringTable::labels().get(int(m_ival));
+}
+
+int Operand::get_target_label_number() const {
     assert((m_kind & OPROP_HAS_LABEL) != 0);
-    return m_target_label;
+    return int(m_ival);
+}
+
+void Operand::set_base_reg(int basereg) {
+    assert(has_base_reg());
+    m_basereg = basereg;
+}
+
+void Operand::set_index_reg(int indexreg) {
+    assert(has_index_reg());
+    m_indexreg = indexreg;
 }
 
 bool Operand::get_is_scalar() {
@@ -123,6 +606,16 @@ void Operand::set_does_map_mreg(bool maps_mreg) {
     m_maps_mreg = maps_mreg;
 }
 
+bool Operand::operator==(const Operand &other) const {
+    return m_kind == other.m_kind
+           && m_basereg == other.m_basereg
+           && m_indexreg == other.m_indexreg
+           && m_scale == other.m_scale
+           && m_is_scalar == other.m_is_scalar
+           && m_maps_mreg == other.m_maps_mreg
+           && m_ival == other.m_ival;
+}
+
 
 ////////////////////////////////////////////////////////////////////////
 // Instruction implementation
@@ -130,91 +623,144 @@ void Operand::set_does_map_mreg(bool maps_mreg) {
 
 Instruction::Instruction(int opcode)
         : m_opcode(opcode)
-        , m_num_operands(0) {
+        , m_num_operands(0)
+        , m_extra_operands(nullptr)
+        , m_comment(-1) {
 }
 
 Instruction::Instruction(int opcode, Operand op1)
         : m_opcode(opcode)
-        , m_num_operands(1) {
+        , m_num_operands(1)
+        , m_extra_operands(nullptr)
+        , m_comment(-1) {
     m_operands[0] = op1;
 }
 
 Instruction::Instruction(int opcode, Operand op1, Operand op2)
         : m_opcode(opcode)
-        , m_num_operands(2) {
+        , m_num_operands(2)
+        , m_extra_operands(nullptr)
+        , m_comment(-1) {
     m_operands[0] = op1;
     m_operands[1] = op2;
 }
 
 Instruction::Instruction(int opcode, Operand op1, Operand op2, Operand op3)
         : m_opcode(opcode)
-        , m_num_operands(3) {
+        , m_num_operands(3)
+        , m_extra_operands(nullptr)
+        , m_comment(-1) {
     m_operands[0] = op1;
     m_operands[1] = op2;
     m_operands[2] = op3;
 }
 
-unsigned Instruction::get_num_operands() const {
-    return m_num_operands;
+Instruction::Instruction(int opcode, const std::vector<Operand> &operands)
+        : m_opcode(opcode)
+        , m_num_operands(unsigned(operands.size()))
+        , m_extra_operands(nullptr)
+        , m_comment(-1) {
+    if (m_num_operands > 3) {
+        m_extra_operands = allocate_extra_operands(m_num_operands - 3);
+    }
+    for (unsigned i = 0; i < m_num_operands; i++) {
+        (*this)[i] = operands[i];
+    }
 }
 
-Operand Instruction::get_operand(unsigned index) const {
-    assert(index >= 0);
-    assert(index < m_num_operands);
-    return m_operands[index];
+Operand *Instruction::allocate_extra_operands(unsigned n) {
+    return get_arena().extra_operands.allocate(n);
 }
 
 void Instruction::set_comment(const std::string &comment) {
-    m_comment = comment;
+    m_comment = comment.empty() ? -1 : StringTable::comments().intern(comment);
+}
+
+void Instruction::set_comment(const Instruction *source, CommentFormatter format) {
+    m_comment = -2 - StringTable::comments().defer(source, format);
 }
 
 bool Instruction::has_comment() const {
-    return !m_comment.empty();
+    return m_comment != -1;
 }
 
-const std::string &Instruction::get_comment() const {
-    return m_comment;
+std::string Instruction::get_comment() const {
+    if (m_comment < -1) {
+        return StringTable::comments().get_deferred(-2 - m_comment);
+    }
+    return m_comment >= 0 ? StringTable::comments().get(m_comment) : std::string();
 }
 
 Instruction *Instruction::duplicate() const {
-    return new Instruction(*this);
+    Instruction *dup = new Instruction(*this);
+    if (m_num_operands > 3) {
+        // the duplicate needs its own extra operands
+        dup->m_extra_operands = allocate_extra_operands(m_num_operands - 3);
+        std::copy(m_extra_operands, m_extra_operands + (m_num_operands - 3), dup->m_extra_operands);
+    }
+    return dup;
+}
+
+bool Instruction::is_same(const Instruction *other) const {
+    if (m_opcode != other->m_opcode || m_num_operands != other->m_num_operands) {
+        return false;
+    }
+    for (unsigned i = 0; i < m_num_operands; i++) {
+        if ((*this)[i] != (*other)[i]) {
+            return false;
+        }
+    }
+    return true;
 }
 
 ////////////////////////////////////////////////////////////////////////
 // InstructionSequence implementation
 ////////////////////////////////////////////////////////////////////////
 
-InstructionSequence::InstructionSequence() {
+InstructionSequence::InstructionSequence()
+        : m_next_label(-1)
+        , m_shares_instructions(false) {
 }
 
 void InstructionSequence::add_instruction(Instruction *ins) {
     m_labels.push_back(m_next_label);
     m_instr_seq.push_back(ins);
 
-    m_next_label = "";
+    m_next_label = -1;
+}
+
+void InstructionSequence::add_shared_instructions(InstructionSequence *other, unsigned begin, unsigned end) {
+    assert(begin <= end && end <= other->get_length());
+    for (unsigned i = begin; i < end; i++) {
+        add_instruction(other->m_instr_seq[i]);
+    }
+    if (begin < end) {
+        m_shares_instructions = true;
+        other->m_shares_instructions = true;
+    }
 }
 
 void InstructionSequence::define_label(const std::string &label) {
-    assert(m_next_label.empty());
-    m_next_label = label;
-    m_label_to_index[label] = unsigned(m_instr_seq.size());
+    assert(m_next_label < 0);
+    m_next_label = StringTable::labels().intern(label);
+    m_label_to_index[m_next_label] = unsigned(m_instr_seq.size());
 }
 
 void InstructionSequence::define_label_if_necessary(const std::string &label, Instruction *branch) {
     assert(branch->get_num_operands() == 1);
     assert((*branch)[0].get_target_label() == label);
 
-    if (m_next_label.empty()) {
+    if (m_next_label < 0) {
         // define the label
         define_label(label);
     } else {
         // use the existing label
-        (*branch)[0] = Operand(m_next_label);
+        (*branch)[0] = Operand(StringTable::labels().get(m_next_label));
     }
 }
 
 Instruction *InstructionSequence::get_labeled_instruction(const std::string &label) const {
-    auto i = m_label_to_index.find(label);
+    auto i = m_label_to_index.find(StringTable::labels().lookup(label));
     if (i == m_label_to_index.cend()) {
         // nonexistent label
         return nullptr;
@@ -225,7 +771,7 @@ Instruction *InstructionSequence::get_labeled_instruction(const std::string &lab
 }
 
 unsigned InstructionSequence::get_index_of_labeled_instruction(const std::string &label) const {
-    auto i = m_label_to_index.find(label);
+    auto i = m_label_to_index.find(StringTable::labels().lookup(label));
     assert(i != m_label_to_index.cend());
     return i->second;
 }
@@ -239,6 +785,42 @@ Instruction *InstructionSequence::get_instruction(unsigned index) const {
     return m_instr_seq[index];
 }
 
+Instruction *InstructionSequence::replace_instruction(unsigned index, Instruction *ins) {
+    assert(m_label_to_index.empty());
+    unshare();
+    assert(index < unsigned(m_instr_seq.size()));
+    Instruction *orig = m_instr_seq[index];
+    m_instr_seq[index] = ins;
+    return orig;
+}
+
+Instruction *InstructionSequence::remove_instruction(unsigned index) {
+    assert(m_label_to_index.empty());
+    unshare();
+    assert(index < unsigned(m_instr_seq.size()));
+    Instruction *orig = m_instr_seq[index];
+    m_instr_seq.erase(m_instr_seq.begin() + index);
+    m_labels.pop_back();
+    return orig;
+}
+
+void InstructionSequence::insert_instruction(unsigned index, Instruction *ins) {
+    assert(m_label_to_index.empty());
+    unshare();
+    assert(index <= unsigned(m_instr_seq.size()));
+    m_instr_seq.insert(m_instr_seq.begin() + index, ins);
+    m_labels.push_back(-1);
+}
+
+void InstructionSequence::unshare() {
+    if (m_shares_instructions) {
+        for (auto i = m_instr_seq.begin(); i != m_instr_seq.end(); i++) {
+            *i = (*i)->duplicate();
+        }
+        m_shares_instructions = false;
+    }
+}
+
 Instruction *InstructionSequence::get_last() const {
     assert(!m_instr_seq.empty());
     return m_instr_seq.back();
@@ -252,22 +834,27 @@ bool InstructionSequence::has_label(unsigned index) const {
     if (index == unsigned(m_instr_seq.size())) {
         return has_label_at_end();
     } else {
-        return !m_labels[index].empty();
+        return m_labels[index] >= 0;
     }
 }
 
-std::string InstructionSequence::get_label(unsigned index) const {
+const std::string &InstructionSequence::get_label(unsigned index) const {
     assert(has_label(index));
-    return m_labels[index];
+    return index == unsigned(m_instr_seq.size()) ? get_label_at_end() : StringTable::labels().get(m_labels[index]);
+}
+
+int InstructionSequence::get_label_number(unsigned index) const {
+    assert(index <= unsigned(m_instr_seq.size()));
+    return index == unsigned(m_instr_seq.size()) ? m_next_label : m_labels[index];
 }
 
 bool InstructionSequence::has_label_at_end() const {
-    return !m_next_label.empty();
+    return m_next_label >= 0;
 }
 
-std::string InstructionSequence::get_label_at_end() const {
+const std::string &InstructionSequence::get_label_at_end() const {
     assert(has_label_at_end());
-    return m_next_label;
+    return StringTable::labels().get(m_next_label);
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -279,82 +866,127 @@ PrintInstructionSequence::PrintInstructionSequence(InstructionSequence *iseq)
 }
 
 std::string PrintInstructionSequence::format_instruction(const Instruction *ins) {
-    std::string formatted_ins;
-    formatted_ins += get_opcode_name(ins->get_opcode());
-    formatted_ins += " ";
+    OutputSink out;
+    format_instruction(out, ins);
+    return out.get_string();
+}
+
+void PrintInstructionSequence::format_instruction(OutputSink &out, const Instruction *ins) {
+    size_t start = out.get_count();
+    out.put(get_opcode_name(ins->get_opcode()));
+    out.put(' ');
     for (unsigned j = 0; j < ins->get_num_operands(); j++) {
-        Operand operand = ins->get_operand(j);
         if (j > 0) {
-            formatted_ins += ", ";
+            out.put(", ");
         }
-        formatted_ins += format_operand(operand);
+        format_operand(out, ins, j);
     }
-    unsigned len(formatted_ins.size());
     if (ins->has_comment()) {
-        for (unsigned i = len; i < 28; i++) {
-            formatted_ins += ' ';
-        }
-        formatted_ins += "/* ";
-        formatted_ins += ins->get_comment();
-        formatted_ins += " */";
+        out.pad_to(start + 28);
+        out.put("/* ");
+        out.put(ins->get_comment());
+        out.put(" */");
     }
-    return formatted_ins;
 }
 
 void PrintInstructionSequence::print() {
-    for (unsigned i = 0; i < m_iseq->get_length(); i++) {
+    OutputSink &out = OutputSink::get_stdout();
+    print(out);
+    out.flush();
+}
+
+void PrintInstructionSequence::print(OutputSink &out) {
+    print(out, 0, m_iseq->get_length());
+}
+
+void PrintInstructionSequence::print(OutputSink &out, unsigned begin, unsigned end) {
+    for (unsigned i = begin; i < end; i++) {
         if (m_iseq->has_label(i)) {
-            std::string label = m_iseq->get_label(i);
-            printf("%s:\n", label.c_str());
+            out.put(m_iseq->get_label(i));
+            out.put(":\n");
         }
-        Instruction *ins = m_iseq->get_instruction(i);
-        std::string formatted_ins = format_instruction(ins);
-        printf("\t%s\n", formatted_ins.c_str());
+        out.put('\t');
+        format_instruction(out, m_iseq->get_instruction(i));
+        out.put('\n');
     }
 
     // special case: if there is a label at the end, print it
-    if (m_iseq->has_label_at_end()) {
-        printf("%s:\n", m_iseq->get_label_at_end().c_str());
+    if (end == m_iseq->get_length() && m_iseq->has_label_at_end()) {
+        out.put(m_iseq->get_label_at_end());
+        out.put(":\n");
     }
 }
 
-std::string PrintInstructionSequence::format_operand(const Operand &operand) {
+const char *PrintInstructionSequence::get_operand_mreg_name(const Instruction *ins, unsigned i, int regnum) {
+    return get_mreg_name(regnum);
+}
+
+void PrintInstructionSequence::format_operand(OutputSink &out, const Instruction *ins, unsigned i) {
+    const Operand &operand = ins->get_operand(i);
     assert(operand.get_kind() != OPERAND_NONE);
 
-    switch (operand.get_kind()) {
+    OperandKind kind = operand.get_kind();
+    switch (kind) {
         case OPERAND_VREG:
-            return cpputil::format("vr%d", operand.get_base_reg());
-        case OPERAND_VREG_MEMREF:
-            return cpputil::format("(vr%d)", operand.get_base_reg());
-        case OPERAND_VREG_MEMREF_OFFSET:
-            return cpputil::format("%d(vr%d)", operand.get_offset(), operand.get_base_reg());
-        case OPERAND_VREG_MEMREF_INDEX:
-            return cpputil::format("(vr%d,vr%d)", operand.get_base_reg(), operand.get_index_reg());
+            out.put("vr");
+            out.put_int(operand.get_base_reg());
+            return;
         case OPERAND_MREG:
-            return get_mreg_name(operand.get_base_reg());
-        case OPERAND_MREG_MEMREF:
-            return cpputil::format("(%s)", get_mreg_name(operand.get_base_reg()).c_str());
-        case OPERAND_MREG_MEMREF_OFFSET:
-            return cpputil::format("%d(%s)", operand.get_offset(), get_mreg_name(operand.get_base_reg()).c_str());
-        case OPERAND_MREG_MEMREF_INDEX:
-            return cpputil::format("(%s,%s)",
-                                   get_mreg_name(operand.get_base_reg()).c_str(),
-                                   get_mreg_name(operand.get_index_reg()).c_str());
-        case OPERAND_MREG_MEMREF_OFFSET_INDEX:
-            return cpputil::format("%d(%s, %s)",
-                                   operand.get_offset(),
-                                   get_mreg_name(operand.get_base_reg()).c_str(),
-                                   get_mreg_name(operand.get_index_reg()).c_str());
+            out.put(get_operand_mreg_name(ins, i, operand.get_base_reg()));
+            return;
         case OPERAND_INT_LITERAL:
-            return cpputil::format("$%ld", operand.get_int_value());
+            out.put('$');
+            out.put_int(operand.get_int_value());
+            return;
         case OPERAND_LABEL:
-            return operand.get_target_label();
+            out.put(operand.get_target_label());
+            return;
         case OPERAND_LABEL_IMMEDIATE:
-            return "$" + operand.get_target_label();
+            out.put('$');
+            out.put(operand.get_target_label());
+            return;
+        case OPERAND_LABEL_MEMREF:
+            out.put(operand.get_target_label());
+            out.put("(%rip)");
+            return;
+        case OPERAND_LOCAL_MEMREF:
+            out.put_int(operand.get_offset());
+            out.put("(local)");
+            return;
         default:
-            assert(false);
-            return "<invalid>";
+            break;
     }
+
+    // a memory reference: [offset](base[,index[,scale]])
+    assert(operand.is_memref());
+    bool is_vreg = (kind == OPERAND_VREG_MEMREF || kind == OPERAND_VREG_MEMREF_OFFSET ||
+                    kind == OPERAND_VREG_MEMREF_INDEX);
+    // (the form with both an offset and an index is printed with spaces)
+    const char *sep = (kind == OPERAND_MREG_MEMREF_OFFSET_INDEX) ? ", " : ",";
+    if ((kind & OPROP_HAS_INTVAL) != 0) {
+        out.put_int(operand.get_offset());
+    }
+    out.put('(');
+    if (is_vreg) {
+        out.put("vr");
+        out.put_int(operand.get_base_reg());
+    } else {
+        out.put(get_mreg_name(operand.get_base_reg()));
+    }
+    if (operand.has_index_reg()) {
+        out.put(sep);
+        if (is_vreg) {
+            out.put("vr");
+            out.put_int(operand.get_index_reg());
+        } else {
+            out.put(get_mreg_name(operand.get_index_reg()));
+        }
+        if (kind == OPERAND_MREG_MEMREF_OFFSET_INDEX && operand.get_scale() != 1) {
+            out.put(sep);
+            out.put_int(operand.get_scale());
+        }
+    }
+    out.put(')');
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -364,7 +996,8 @@ std::string PrintInstructionSequence::format_operand(const Operand &operand) {
 BasicBlock::BasicBlock(BasicBlockKind kind, unsigned id, const std::string &label)
         : m_kind(kind)
         , m_id(id)
-        , m_label(label) {
+        , m_label(label)
+        , m_count(-1) {
 }
 
 BasicBlock::~BasicBlock() {
@@ -391,6 +1024,125 @@ void BasicBlock::set_label(const std::string &label) {
     m_label = label;
 }
 
+////////////////////////////////////////////////////////////////////////
+// BasicBlockEditor implementation
+////////////////////////////////////////////////////////////////////////
+
+InstructionListener::~InstructionListener() {
+}
+
+BasicBlockEditor::BasicBlockEditor(BasicBlock *bb, InstructionListener *listener)
+        : m_bb(bb)
+        , m_listener(listener)
+        , m_replacements(bb->get_length(), nullptr)
+        , m_removed(bb->get_length(), false)
+        , m_edited(false) {
+}
+
+BasicBlockEditor::~BasicBlockEditor() {
+    for (auto i = m_replacements.begin(); i != m_replacements.end(); i++) {
+        delete *i;
+    }
+    for (auto i = m_insertions.begin(); i != m_insertions.end(); i++) {
+        delete i->second;
+    }
+}
+
+Instruction *BasicBlockEditor::get_instruction(unsigned index) const {
+    if (m_removed[index]) {
+        return nullptr;
+    }
+    return m_replacements[index] != nullptr ? m_replacements[index] : m_bb->get_instruction(index);
+}
+
+void BasicBlockEditor::remove(unsigned index) {
+    assert(!m_removed[index]);
+    if (m_listener != nullptr) {
+        m_listener->instruction_removed(m_bb, get_instruction(index));
+    }
+    delete m_replacements[index];
+    m_replacements[index] = nullptr;
+    m_removed[index] = true;
+    m_edited = true;
+}
+
+void BasicBlockEditor::replace(unsigned index, Instruction *ins) {
+    assert(!m_removed[index]);
+    if (m_listener != nullptr) {
+        m_listener->instruction_removed(m_bb, get_instruction(index));
+        m_listener->instruction_added(m_bb, ins);
+    }
+    delete m_replacements[index];
+    m_replacements[index] = ins;
+    m_edited = true;
+}
+
+void BasicBlockEditor::insert(unsigned index, Instruction *ins) {
+    assert(index <= unsigned(m_removed.size()));
+    if (m_listener != nullptr) {
+        m_listener->instruction_added(m_bb, ins);
+    }
+    m_insertions.push_back(std::make_pair(index, ins));
+    m_edited = true;
+}
+
+bool BasicBlockEditor::commit() {
+    if (!m_edited) {
+        return false;
+    }
+    assert(m_bb->m_label_to_index.empty());
+    std::vector<Instruction *> &instructions = m_bb->m_instr_seq;
+    if (m_bb->m_shares_instructions) {
+        // the instructions kept are replaced by copies
+        std::vector<Instruction *> orig(instructions);
+        m_bb->unshare();
+        if (m_listener != nullptr) {
+            for (unsigned i = 0; i < unsigned(orig.size()); i++) {
+                if (!m_removed[i] && m_replacements[i] == nullptr) {
+                    m_listener->instruction_removed(m_bb, orig[i]);
+                    m_listener->instruction_added(m_bb, instructions[i]);
+                }
+            }
+        }
+    }
+
+    // (the insertions at each index stay in the order they were made)
+    std::stable_sort(m_insertions.begin(), m_insertions.end(),
+                     [](const std::pair<unsigned, Instruction *> &a, const std::pair<unsigned, Instruction *> &b) {
+                         return a.first < b.first;
+                     });
+
+    std::vector<Instruction *> result;
+    result.reserve(instructions.size() + m_insertions.size());
+    auto next = m_insertions.begin();
+    for (unsigned i = 0; i <= unsigned(instructions.size()); i++) {
+        for (; next != m_insertions.end() && next->first == i; next++) {
+            result.push_back(next->second);
+        }
+        if (i == unsigned(instructions.size())) {
+            break;
+        }
+        if (m_removed[i] || m_replacements[i] != nullptr) {
+            delete instructions[i];
+        }
+        if (m_replacements[i] != nullptr) {
+            result.push_back(m_replacements[i]);
+        } else if (!m_removed[i]) {
+            result.push_back(instructions[i]);
+        }
+    }
+
+    instructions.swap(result);
+    m_bb->m_labels.assign(instructions.size(), -1);
+
+    // the editor can't be used again
+    m_replacements.clear();
+    m_removed.clear();
+    m_insertions.clear();
+    m_edited = false;
+    return true;
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Edge implementation
 ////////////////////////////////////////////////////////////////////////
@@ -432,6 +1184,10 @@ BasicBlock *ControlFlowGraph::get_block(unsigned i) const {
 BasicBlock *ControlFlowGraph::create_basic_block(BasicBlockKind kind, const std::string &label) {
     BasicBlock *bb = new BasicBlock(kind, unsigned(m_basic_blocks.size()), label);
     m_basic_blocks.push_back(bb);
+    m_incoming_edges.emplace_back();
+    m_outgoing_edges.emplace_back();
+    m_rpo.clear();
+    m_reverse_cfg_rpo.clear();
     if (bb->get_kind() == BASICBLOCK_ENTRY) {
         assert(m_entry == nullptr);
         m_entry = bb;
@@ -445,26 +1201,24 @@ BasicBlock *ControlFlowGraph::create_basic_block(BasicBlockKind kind, const std:
 
 Edge *ControlFlowGraph::create_edge(BasicBlock *source, BasicBlock *target, EdgeKind kind) {
     // make sure BasicBlocks belong to this ControlFlowGraph
-    assert(std::find(m_basic_blocks.begin(), m_basic_blocks.end(), source) != m_basic_blocks.end());
-    assert(std::find(m_basic_blocks.begin(), m_basic_blocks.end(), target) != m_basic_blocks.end());
+    assert(has_block(source));
+    assert(has_block(target));
 
     // make sure this Edge doesn't already exist
     assert(lookup_edge(source, target) == nullptr);
 
     // create the edge, add it to outgoing/incoming edge maps
     Edge *e = new Edge(source, target, kind);
-    m_outgoing_edges[source].push_back(e);
-    m_incoming_edges[target].push_back(e);
+    m_outgoing_edges[source->get_id()].push_back(e);
+    m_incoming_edges[target->get_id()].push_back(e);
+    m_rpo.clear();
+    m_reverse_cfg_rpo.clear();
 
     return e;
 }
 
 Edge *ControlFlowGraph::lookup_edge(BasicBlock *source, BasicBlock *target) const {
-    auto i = m_outgoing_edges.find(source);
-    if (i == m_outgoing_edges.cend()) {
-        return nullptr;
-    }
-    const EdgeList &outgoing = i->second;
+    const EdgeList &outgoing = get_outgoing_edges(source);
     for (auto j = outgoing.cbegin(); j != outgoing.cend(); j++) {
         Edge *e = *j;
         assert(e->get_source() == source);
@@ -476,41 +1230,182 @@ Edge *ControlFlowGraph::lookup_edge(BasicBlock *source, BasicBlock *target) cons
 }
 
 const ControlFlowGraph::EdgeList &ControlFlowGraph::get_outgoing_edges(BasicBlock *bb) const {
-    EdgeMap::const_iterator i = m_outgoing_edges.find(bb);
-    return i == m_outgoing_edges.end() ? m_empty_edge_list : i->second;
+    assert(has_block(bb));
+    return m_outgoing_edges[bb->get_id()];
 }
 
 const ControlFlowGraph::EdgeList &ControlFlowGraph::get_incoming_edges(BasicBlock *bb) const {
-    EdgeMap::const_iterator i = m_incoming_edges.find(bb);
-    return i == m_incoming_edges.end() ? m_empty_edge_list : i->second;
+    assert(has_block(bb));
+    return m_incoming_edges[bb->get_id()];
+}
+
+const ControlFlowGraph::BlockList &ControlFlowGraph::get_reverse_postorder() const {
+    assert(m_entry != nullptr);
+    if (m_rpo.empty()) {
+        compute_reverse_postorder(m_entry, false, m_rpo);
+    }
+    return m_rpo;
+}
+
+const ControlFlowGraph::BlockList &ControlFlowGraph::get_reverse_cfg_reverse_postorder() const {
+    assert(m_exit != nullptr);
+    if (m_reverse_cfg_rpo.empty()) {
+        compute_reverse_postorder(m_exit, true, m_reverse_cfg_rpo);
+    }
+    return m_reverse_cfg_rpo;
+}
+
+void ControlFlowGraph::compute_reverse_postorder(BasicBlock *start, bool reverse_cfg, BlockList &order) const {
+    // iterative depth-first search, following the incoming edges
+    // for the reversed CFG (each stack entry is a block, and the
+    // index of the next edge to follow)
+    std::vector<bool> visited(m_basic_blocks.size(), false);
+    std::vector<std::pair<BasicBlock *, unsigned>> stack;
+
+    visited[start->get_id()] = true;
+    stack.push_back(std::make_pair(start, 0U));
+    while (!stack.empty()) {
+        BasicBlock *bb = stack.back().first;
+        unsigned next = stack.back().second;
+        const EdgeList &edges = reverse_cfg ? m_incoming_edges[bb->get_id()] : m_outgoing_edges[bb->get_id()];
+
+        if (next < edges.size()) {
+            stack.back().second++;
+            BasicBlock *succ = reverse_cfg ? edges[next]->get_source() : edges[next]->get_target();
+            if (!visited[succ->get_id()]) {
+                visited[succ->get_id()] = true;
+                stack.push_back(std::make_pair(succ, 0U));
+            }
+        } else {
+            order.push_back(bb);
+            stack.pop_back();
+        }
+    }
+
+    std::reverse(order.begin(), order.end());
 }
 
-InstructionSequence *ControlFlowGraph::create_instruction_sequence() const {
+InstructionSequence *ControlFlowGraph::create_instruction_sequence(int (*invert_branch)(int opcode),
+                                                                   int cold_opcode, int jump_opcode) const {
     assert(m_entry != nullptr);
     assert(m_exit != nullptr);
-    assert(m_outgoing_edges.size() == m_incoming_edges.size());
+    bool split_cold = (cold_opcode >= 0 && invert_branch != nullptr);
 
-    // Find all Chunks (groups of basic blocks connected via fall-through)
-    typedef std::map<BasicBlock *, Chunk *> ChunkMap;
+    std::deque<Chunk> chunks;
     ChunkMap chunk_map;
-    for (auto i = m_outgoing_edges.cbegin(); i != m_outgoing_edges.cend(); i++) {
-        const EdgeList &outgoing_edges = i->second;
+    find_chunks(chunks, chunk_map, split_cold ? invert_branch : nullptr);
+
+    std::vector<BasicBlock *> layout;
+    layout_chunks(chunk_map, split_cold, layout);
+
+    InstructionSequence *result = new InstructionSequence();
+    for (unsigned i = 0; i < layout.size(); i++) {
+        BasicBlock *bb = layout[i];
+        unsigned len = bb->get_length();
+        Instruction *inverted = nullptr, *jump = nullptr;
+        bool skip_next = false;
+
+        BasicBlock *next = (i + 1 < layout.size()) ? layout[i + 1] : nullptr;
+
+        // (the cold block which the block falls through to, if it was split
+        // from this block's chunk, or the block falling through to the exit
+        // block, if it was split from the entry block's chunk)
+        BasicBlock *cold = nullptr, *last = nullptr;
+        const EdgeList &outgoing_edges = get_outgoing_edges(bb);
+        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+            if (split_cold && is_cold_fall_through(*j, invert_branch)) {
+                cold = (*j)->get_target();
+            } else if ((*j)->get_kind() == EDGE_FALLTHROUGH && (*j)->get_target() != next) {
+                last = (*j)->get_target();
+            }
+        }
+
+        if (last != nullptr) {
+            // branch to the block falling through to the exit block, which is
+            // placed (with the exit block) at the end
+            assert(jump_opcode >= 0);
+            if (!last->has_label()) {
+                last->set_label(StringTable::labels().new_label(".Llast"));
+            }
+            jump = new Instruction(jump_opcode, Operand(last->get_label()));
+        } else if (next != nullptr && get_jump_target(bb) == next && (len > 1 || !bb->has_label())) {
+            // the unconditional branch is not needed
+            // (unless it's the only instruction the label can refer to)
+            len--;
+        } else if (cold != nullptr) {
+            // branch to the cold block rather than falling through to it, and
+            // to the original branch target unless it's the next block
+            if (!cold->has_label()) {
+                cold->set_label(StringTable::labels().new_label(".Lcold"));
+            }
+            int opcode = invert_branch(bb->get_instruction(len - 1)->get_opcode());
+            inverted = new Instruction(opcode, Operand(cold->get_label()));
+            BasicBlock *target = get_branch_target(bb);
+            if (target != next) {
+                jump = new Instruction(jump_opcode, Operand(target->get_label()));
+            }
+            len--;
+        } else if (invert_branch != nullptr && is_inverted_branch_candidate(layout, i)) {
+            int opcode = invert_branch(bb->get_instruction(len - 1)->get_opcode());
+            if (opcode >= 0) {
+                // branch directly to the target of the next block's unconditional
+                // branch, and fall through to the original branch target instead
+                Operand target(get_jump_target(next)->get_label());
+                inverted = new Instruction(opcode, target);
+                len--;
+                // skip the block containing only the unconditional branch
+                skip_next = true;
+            }
+        }
+
+        if (bb->has_label()) {
+            result->define_label(bb->get_label());
+        }
+        result->add_shared_instructions(bb, 0, len);
+        if (inverted != nullptr) {
+            result->add_instruction(inverted);
+        }
+        if (jump != nullptr) {
+            result->add_instruction(jump);
+        }
+        if (skip_next) {
+            i++;
+        }
+        if (bb == m_exit && i + 1 < layout.size()) {
+            // (the cold Chunks follow)
+            result->add_instruction(new Instruction(cold_opcode));
+        }
+    }
+
+    return result;
+}
+
+void ControlFlowGraph::find_chunks(std::deque<Chunk> &chunks, ChunkMap &chunk_map,
+                                   int (*split_cold)(int opcode)) const {
+    // Find all Chunks (groups of basic blocks connected via fall-through),
+    // except that if split_cold is given (the function inverting branches),
+    // a block which was never executed isn't put in the same Chunk as an
+    // executed block falling through to it
+    for (auto i = m_basic_blocks.cbegin(); i != m_basic_blocks.cend(); i++) {
+        const EdgeList &outgoing_edges = get_outgoing_edges(*i);
         for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
             Edge *e = *j;
 
-            if (e->get_kind() != EDGE_FALLTHROUGH) {
+            if (e->get_kind() != EDGE_FALLTHROUGH || is_cold_fall_through(e, split_cold)) {
                 continue;
             }
 
             BasicBlock *pred = e->get_source();
             BasicBlock *succ = e->get_target();
 
-            Chunk *pred_chunk = (chunk_map.find(pred) == chunk_map.end()) ? nullptr : chunk_map[pred];
-            Chunk *succ_chunk = (chunk_map.find(succ) == chunk_map.end()) ? nullptr : chunk_map[succ];
+            auto pred_i = chunk_map.find(pred), succ_i = chunk_map.find(succ);
+            Chunk *pred_chunk = (pred_i == chunk_map.end()) ? nullptr : pred_i->second;
+            Chunk *succ_chunk = (succ_i == chunk_map.end()) ? nullptr : succ_i->second;
 
             if (pred_chunk == nullptr && succ_chunk == nullptr) {
                 // create a new chunk
-                Chunk *chunk = new Chunk();
+                chunks.push_back(Chunk());
+                Chunk *chunk = &chunks.back();
                 chunk->append(pred);
                 chunk->append(succ);
                 chunk_map[pred] = chunk;
@@ -526,105 +1421,163 @@ InstructionSequence *ControlFlowGraph::create_instruction_sequence() const {
                 pred_chunk->append(succ);
                 chunk_map[succ] = pred_chunk;
             } else {
-                // merge the chunks
-                Chunk *merged = pred_chunk->merge_with(succ_chunk);
-                // update every basic block to point to the merged chunk
-                for (auto i = merged->blocks.begin(); i != merged->blocks.end(); i++) {
-                    BasicBlock *bb = *i;
-                    chunk_map[bb] = merged;
+                // merge the chunks, and update every basic block to point to the merged chunk
+                assert(pred_chunk->is_last(pred) && succ_chunk->is_first(succ));
+                for (auto k = succ_chunk->blocks.begin(); k != succ_chunk->blocks.end(); k++) {
+                    chunk_map[*k] = pred_chunk;
                 }
-                // delete old Chunks
-                delete pred_chunk;
-                delete succ_chunk;
+                pred_chunk->absorb(succ_chunk);
             }
         }
     }
 
-    InstructionSequence *result = new InstructionSequence();
-    std::vector<bool> finished_blocks(get_num_blocks(), false);
-    Chunk *exit_chunk = nullptr;
-
-    // Traverse the CFG, appending basic blocks to the generated InstructionSequence.
-    // If we find a block that is part of a Chunk, the entire Chunk is emitted.
-    // (This allows fall through to work.)
-    std::deque<BasicBlock *> work_list;
-    work_list.push_back(m_entry);
-
-    while (!work_list.empty()) {
-        BasicBlock *bb = work_list.front();
-        work_list.pop_front();
-        unsigned block_id = bb->get_id();
-
-        if (finished_blocks[block_id]) {
-            // already added this block
-            continue;
+    // every other block is a chunk by itself
+    for (auto i = m_basic_blocks.cbegin(); i != m_basic_blocks.cend(); i++) {
+        if (chunk_map.find(*i) == chunk_map.end()) {
+            chunks.push_back(Chunk());
+            Chunk *chunk = &chunks.back();
+            chunk->append(*i);
+            chunk_map[*i] = chunk;
         }
+    }
+}
 
-        ChunkMap::iterator i = chunk_map.find(bb);
-        if (i != chunk_map.end()) {
-            // This basic block is part of a Chunk: append all of its blocks
-            Chunk *chunk = i->second;
-
-            // If this chunk contains the exit block, it needs to be at the end
-            // of the generated InstructionSequence, so defer appending any of
-            // its blocks.  (But, *do* find its control successors.)
-            bool is_exit_chunk = false;
+void ControlFlowGraph::layout_chunks(const ChunkMap &chunk_map, bool split_cold, std::vector<BasicBlock *> &layout) const {
+    // Traverse the chunks depth-first from the entry block.  The chunk containing
+    // the entry block is placed first, since the code begins there.  The chunk
+    // containing the exit block needs to be at the end, so it is deferred (but
+    // its control successors *are* visited); if that is the entry block's chunk,
+    // only the exit block and the block falling through to it are deferred, and
+    // the block before them branches to them instead (see
+    // create_instruction_sequence).  Chunks which a profile shows were never
+    // executed are also deferred, and placed just before the exit chunk (or
+    // after it, if the cold code is split from the hot code).
+    std::set<const Chunk *> placed;
+    std::vector<BasicBlock *> stack;
+    BlockList exit_blocks;
+    std::vector<const Chunk *> cold_chunks;
+    const Chunk *entry_chunk = chunk_map.find(m_entry)->second;
+
+    BasicBlock *next = m_entry;
+    while (next != nullptr) {
+        const Chunk *chunk = chunk_map.find(next)->second;
+        next = nullptr;
+
+        placed.insert(chunk);
+        // (a chunk of the entry block and the exit block alone is the whole
+        // function)
+        if (chunk->contains_exit_block() && (chunk != entry_chunk || chunk->blocks.size() <= 2)) {
+            exit_blocks = chunk->blocks;
+        } else if (chunk->is_cold() && chunk != entry_chunk) {
+            cold_chunks.push_back(chunk);
+        } else {
+            auto end = chunk->blocks.end();
             if (chunk->contains_exit_block()) {
-                exit_chunk = chunk;
-                is_exit_chunk = true;
+                // (the exit block is the last block of its chunk, after the
+                // block falling through to it)
+                end -= 2;
+                exit_blocks.assign(end, chunk->blocks.end());
             }
-
-            for (auto j = chunk->blocks.begin(); j != chunk->blocks.end(); j++) {
-                BasicBlock *b = *j;
-                if (is_exit_chunk) {
-                    // mark the block as finished, but don't append its instructions yet
-                    finished_blocks[b->get_id()] = true;
-                } else {
-                    append_basic_block(result, b, finished_blocks);
+            layout.insert(layout.end(), chunk->blocks.begin(), end);
+
+            // if the chunk ends with an unconditional branch to the beginning of
+            // another chunk, place that chunk next so the branch can be removed
+            // (or, for a block whose fall-through to a cold block was split
+            // from it, to its branch target)
+            BasicBlock *target = get_jump_target(chunk->blocks.back());
+            if (target == nullptr && split_cold && get_outgoing_edges(chunk->blocks.back()).size() == 2) {
+                target = get_branch_target(chunk->blocks.back());
+            }
+            if (target != nullptr) {
+                const Chunk *target_chunk = chunk_map.find(target)->second;
+                if (target_chunk->is_first(target) && !target_chunk->contains_exit_block()
+                    && placed.count(target_chunk) == 0) {
+                    next = target;
                 }
+            }
+        }
 
-                // Visit control successors
-                visit_successors(b, work_list);
+        // visit the branch targets of earlier blocks first (and the cold
+        // blocks split from the chunk, as if they were branch targets)
+        for (auto i = chunk->blocks.rbegin(); i != chunk->blocks.rend(); i++) {
+            const EdgeList &outgoing_edges = get_outgoing_edges(*i);
+            for (auto j = outgoing_edges.crbegin(); j != outgoing_edges.crend(); j++) {
+                if ((*j)->get_kind() == EDGE_BRANCH || chunk_map.find((*j)->get_target())->second != chunk) {
+                    stack.push_back((*j)->get_target());
+                }
             }
-        } else {
-            // This basic block is not part of a Chunk
-            append_basic_block(result, bb, finished_blocks);
+        }
 
-            // Visit control successors
-            visit_successors(bb, work_list);
+        while (next == nullptr && !stack.empty()) {
+            BasicBlock *bb = stack.back();
+            stack.pop_back();
+            if (placed.count(chunk_map.find(bb)->second) == 0) {
+                next = bb;
+            }
         }
     }
 
-    // append exit chunk
-    if (exit_chunk != nullptr) {
-        append_chunk(result, exit_chunk, finished_blocks);
+    if (split_cold) {
+        layout.insert(layout.end(), exit_blocks.begin(), exit_blocks.end());
+    }
+    for (auto i = cold_chunks.begin(); i != cold_chunks.end(); i++) {
+        layout.insert(layout.end(), (*i)->blocks.begin(), (*i)->blocks.end());
+    }
+    if (!split_cold) {
+        layout.insert(layout.end(), exit_blocks.begin(), exit_blocks.end());
     }
-
-    return result;
 }
 
-void ControlFlowGraph::append_basic_block(InstructionSequence *iseq, const BasicBlock *bb, std::vector<bool> &finished_blocks) const {
-    if (bb->has_label()) {
-        iseq->define_label(bb->get_label());
+bool ControlFlowGraph::is_cold_fall_through(Edge *e, int (*invert_branch)(int opcode)) const {
+    // is the edge an executed block's fall-through to a block which was never
+    // executed, which can be replaced by inverting the block's conditional
+    // branch?
+    if (invert_branch == nullptr || e->get_kind() != EDGE_FALLTHROUGH) {
+        return false;
     }
-    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
-        iseq->add_instruction((*i)->duplicate());
+    BasicBlock *pred = e->get_source(), *succ = e->get_target();
+    if (pred->get_count() <= 0 || succ->get_count() != 0 || succ->get_kind() != BASICBLOCK_INTERIOR) {
+        return false;
     }
-    finished_blocks[bb->get_id()] = true;
+    BasicBlock *target = get_branch_target(pred);
+    return target != nullptr && target != succ && target->has_label()
+        && invert_branch(pred->get_last()->get_opcode()) >= 0;
 }
 
-void ControlFlowGraph::append_chunk(InstructionSequence *iseq, Chunk *chunk, std::vector<bool> &finished_blocks) const {
-    for (auto i = chunk->blocks.begin(); i != chunk->blocks.end(); i++) {
-        append_basic_block(iseq, *i, finished_blocks);
+BasicBlock *ControlFlowGraph::get_branch_target(BasicBlock *bb) const {
+    const EdgeList &outgoing_edges = get_outgoing_edges(bb);
+    for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+        if ((*i)->get_kind() == EDGE_BRANCH) {
+            return (*i)->get_target();
+        }
     }
+    return nullptr;
 }
 
-void ControlFlowGraph::visit_successors(BasicBlock *bb, std::deque<BasicBlock *> &work_list) const {
+BasicBlock *ControlFlowGraph::get_jump_target(BasicBlock *bb) const {
+    // a block whose only successor is reached by a branch ends with an unconditional branch
     const EdgeList &outgoing_edges = get_outgoing_edges(bb);
-    for (auto k = outgoing_edges.cbegin(); k != outgoing_edges.cend(); k++) {
-        Edge *e = *k;
-        work_list.push_back(e->get_target());
+    if (outgoing_edges.size() != 1 || outgoing_edges[0]->get_kind() != EDGE_BRANCH || bb->get_length() == 0) {
+        return nullptr;
+    }
+    return outgoing_edges[0]->get_target();
+}
+
+bool ControlFlowGraph::is_inverted_branch_candidate(const std::vector<BasicBlock *> &layout, unsigned i) const {
+    // is the block at position i a conditional branch to the block at i + 2,
+    // falling through to a block (at i + 1) which only contains an unconditional
+    // branch, and can't be reached any other way?
+    if (i + 2 >= layout.size()) {
+        return false;
+    }
+    BasicBlock *bb = layout[i], *next = layout[i + 1], *after = layout[i + 2];
+    Edge *fall_through = lookup_edge(bb, next), *branch = lookup_edge(bb, after);
+    if (fall_through == nullptr || fall_through->get_kind() != EDGE_FALLTHROUGH
+        || branch == nullptr || branch->get_kind() != EDGE_BRANCH) {
+        return false;
     }
+    BasicBlock *target = get_jump_target(next);
+    return !next->has_label() && next->get_length() == 1 && target != nullptr && target != after;
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -645,8 +1598,11 @@ ControlFlowGraph *ControlFlowGraphBuilder::build() {
     BasicBlock *entry = m_cfg->create_basic_block(BASICBLOCK_ENTRY);
     BasicBlock *exit = m_cfg->create_basic_block(BASICBLOCK_EXIT);
 
+    find_leaders();
+
     // exit block is reached by any branch that targets the end of the
     // InstructionSequence
+    m_basic_blocks.assign(num_instructions + 1, nullptr);
     m_basic_blocks[num_instructions] = exit;
 
     std::deque<WorkItem> work_list;
@@ -661,16 +1617,20 @@ ControlFlowGraph *ControlFlowGraphBuilder::build() {
 
         // if item target is end of InstructionSequence, then it targets the exit block
         if (item.ins_index == m_iseq->get_length()) {
+            // a branch to the end of the InstructionSequence uses the label
+            // at the end, which the exit block needs to carry
+            if (item.edge_kind == EDGE_BRANCH && !exit->has_label()) {
+                exit->set_label(item.label);
+            }
             m_cfg->create_edge(item.pred, exit, item.edge_kind);
             continue;
         }
 
         BasicBlock *bb;
         bool is_new_block;
-        std::map<unsigned, BasicBlock *>::iterator i = m_basic_blocks.find(item.ins_index);
-        if (i != m_basic_blocks.end()) {
+        if (m_basic_blocks[item.ins_index] != nullptr) {
             // a block starting at this instruction already exists
-            bb = i->second;
+            bb = m_basic_blocks[item.ins_index];
             is_new_block = false;
 
             // Special case: if this block was originally discovered via a fall-through
@@ -705,7 +1665,7 @@ ControlFlowGraph *ControlFlowGraphBuilder::build() {
         // to the BasicBlock for the target (creating the BasicBlock if it
         // doesn't exist yet)
         if (ends_in_branch(bb)) {
-            unsigned target_index = get_branch_target_index(bb);
+            unsigned target_index = m_branch_targets[item.ins_index + bb->get_length() - 1];
             // Note: we assume that branch instructions have a single Operand,
             // which is a label
             Instruction *branch = bb->get_last();
@@ -722,7 +1682,7 @@ ControlFlowGraph *ControlFlowGraphBuilder::build() {
         if (falls_through(bb)) {
             unsigned target_index = item.ins_index + bb->get_length();
             assert(target_index <= m_iseq->get_length());
-            if (target_index == num_instructions) {
+            if (target_index == num_instructions || ends_function(bb->get_last())) {
                 // this is the basic block at the end of the instruction sequence,
                 // its fall-through successor should be the exit block
                 last = bb;
@@ -739,6 +1699,10 @@ ControlFlowGraph *ControlFlowGraphBuilder::build() {
     return m_cfg;
 }
 
+bool ControlFlowGraphBuilder::ends_function(Instruction *ins) {
+    return false;
+}
+
 // Note that subclasses may override this method.
 bool ControlFlowGraphBuilder::is_branch(Instruction *ins) {
     // assume that any branch instruction will have a single operand which is
@@ -746,32 +1710,69 @@ bool ControlFlowGraphBuilder::is_branch(Instruction *ins) {
     return (ins->get_num_operands() != 1) ? false : (*ins)[0].get_kind() == OPERAND_LABEL;
 }
 
+// Find the first instruction of each basic block (the leaders) and the
+// target of each branch, in a single pass over the InstructionSequence.
+void ControlFlowGraphBuilder::find_leaders() {
+    unsigned num_instructions = m_iseq->get_length();
+
+    // the labels of an InstructionSequence are (usually) interned
+    // together, so their instruction indices are kept in a vector indexed
+    // by label number, offset by the smallest label number
+    int min_label = -1, max_label = -1;
+    for (unsigned i = 0; i <= num_instructions; i++) {
+        int label = m_iseq->get_label_number(i);
+        if (label >= 0) {
+            min_label = (min_label < 0 || label < min_label) ? label : min_label;
+            max_label = label > max_label ? label : max_label;
+        }
+    }
+    std::vector<unsigned> label_index(min_label < 0 ? 0 : max_label - min_label + 1, ~0U);
+    for (unsigned i = 0; i <= num_instructions; i++) {
+        int label = m_iseq->get_label_number(i);
+        if (label >= 0) {
+            label_index[label - min_label] = i;
+        }
+    }
+
+    // an instruction is a leader if it is labeled (a branch might target it)
+    // or it follows a branch
+    m_leaders.assign(num_instructions + 1, false);
+    m_branch_targets.assign(num_instructions, ~0U);
+    for (unsigned i = 0; i < num_instructions; i++) {
+        if (m_iseq->get_label_number(i) >= 0) {
+            m_leaders[i] = true;
+        }
+        Instruction *ins = m_iseq->get_instruction(i);
+        if (ends_function(ins)) {
+            m_leaders[i + 1] = true;
+        }
+        if (is_branch(ins)) {
+            m_leaders[i + 1] = true;
+
+            // Note: we assume that branch instructions have a single Operand,
+            // which is a label
+            assert(ins->get_num_operands() == 1);
+            int label = (*ins)[0].get_target_label_number();
+            assert(label >= min_label && label <= max_label && label_index[label - min_label] != ~0U);
+            m_branch_targets[i] = label_index[label - min_label];
+        }
+    }
+}
+
 BasicBlock *ControlFlowGraphBuilder::scan_basic_block(const WorkItem &item, const std::string &label) {
     unsigned index = item.ins_index;
 
     BasicBlock *bb = m_cfg->create_basic_block(BASICBLOCK_INTERIOR, label);
 
-    // keep adding instructions until we
+    // the block's instructions continue until we
     // - reach an instruction that is a branch
     // - reach an instruction that is a target of a branch
     // - reach the end of the overall instruction sequence
-    while (index < m_iseq->get_length()) {
-        Instruction *ins = m_iseq->get_instruction(index);
-
-        // this instruction is part of the basic block
-        ins = ins->duplicate();
-        bb->add_instruction(ins);
+    // (the instructions aren't copied unless the block is edited)
+    do {
         index++;
-
-        if (m_iseq->has_label(index)) {
-            // instruction at index is a control target
-            break;
-        }
-        if (is_branch(ins)) {
-            // this is a branch instruction
-            break;
-        }
-    }
+    } while (index < m_iseq->get_length() && !m_leaders[index]);
+    bb->add_shared_instructions(m_iseq, item.ins_index, index);
 
     assert(bb->get_length() > 0);
 
@@ -782,21 +1783,6 @@ bool ControlFlowGraphBuilder::ends_in_branch(BasicBlock *bb) {
     return is_branch(bb->get_last());
 }
 
-unsigned ControlFlowGraphBuilder::get_branch_target_index(BasicBlock *bb) {
-    assert(ends_in_branch(bb));
-    Instruction *last = bb->get_last();
-
-    // assume that any branch instruction will have a single operand which is
-    // a label
-    assert(last->get_num_operands() == 1);
-    Operand label = (*last)[0];
-    assert(label.get_kind() == OPERAND_LABEL);
-
-    // look up the index of the instruction targeted by this label
-    unsigned target_index = m_iseq->get_index_of_labeled_instruction(label.get_target_label());
-    return target_index;
-}
-
 bool ControlFlowGraphBuilder::falls_through(BasicBlock *bb) {
     return falls_through(bb->get_last());
 }
@@ -813,24 +1799,36 @@ ControlFlowGraphPrinter::~ControlFlowGraphPrinter() {
 }
 
 void ControlFlowGraphPrinter::print() {
+    OutputSink &out = OutputSink::get_stdout();
+    print(out);
+    out.flush();
+}
+
+void ControlFlowGraphPrinter::print(OutputSink &out) {
     for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
         BasicBlock *bb = *i;
-        printf("BASIC BLOCK %u", bb->get_id());
+        out.put("BASIC BLOCK ");
+        out.put_int(bb->get_id());
         BasicBlockKind bb_kind = bb->get_kind();
         if (bb_kind != BASICBLOCK_INTERIOR) {
-            printf(" %s", bb_kind == BASICBLOCK_ENTRY ? "[entry]" : "[exit]");
+            out.put(bb_kind == BASICBLOCK_ENTRY ? " [entry]" : " [exit]");
         }
         if (bb->has_label()) {
-            printf(" (label %s)", bb->get_label().c_str());
+            out.put(" (label ");
+            out.put(bb->get_label());
+            out.put(')');
         }
-        printf("\n");
-        print_basic_block(bb);
+        out.put('\n');
+        print_basic_block(out, bb);
         const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
         for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
             const Edge *e = *j;
             assert(e->get_kind() == EDGE_BRANCH || e->get_kind() == EDGE_FALLTHROUGH);
-            printf("  %s EDGE to BASIC BLOCK %u\n", e->get_kind() == EDGE_FALLTHROUGH ? "fall-through" : "branch", e->get_target()->get_id());
+            out.put(e->get_kind() == EDGE_FALLTHROUGH ? "  fall-through" : "  branch");
+            out.put(" EDGE to BASIC BLOCK ");
+            out.put_int(e->get_target()->get_id());
+            out.put('\n');
         }
-        printf("\n");
+        out.put('\n');
     }
-}
\ No newline at end of file
+}
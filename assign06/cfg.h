@@ -2,10 +2,101 @@
 #define CFG_H
 
 #include <cassert>
+#include <cstddef>
 #include <vector>
 #include <map>
 #include <deque>
 #include <string>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+class Instruction;
+
+// formats the comment of an instruction from another instruction (see
+// Instruction::set_comment)
+typedef std::string (*CommentFormatter)(const Instruction *source);
+
+// Table of interned strings.  Labels and instruction comments are stored
+// in a table and referred to by number, so that Operand and Instruction
+// don't own any strings and can be copied cheaply.  Since operands are
+// copied between instruction sequences (and CFGs), the tables are shared by
+// all of them.  Interned strings are only removed by IRArena::release(), and
+// references to them remain valid until then.  While the threads running
+// the tasks of a compilation (see IRArena::run_parallel) share its tables,
+// the tables are locked.
+//
+// A table can also hold deferred strings, which are formatted from an
+// instruction only when they're read (such as the assembly code comments
+// showing the high-level instruction each instruction was translated
+// from, which are only read if the assembly code is printed).
+class StringTable {
+private:
+    std::deque<std::string> m_strings;
+    std::unordered_map<std::string, int> m_index;
+    std::deque<std::pair<const Instruction *, CommentFormatter>> m_deferred;
+    // the next number of each prefix of labels created by new_label()
+    std::unordered_map<std::string, unsigned> m_next_label_numbers;
+    bool m_shared;
+    mutable std::mutex m_mutex;
+
+    // disallow copy ctor and assignment operator
+    StringTable(const StringTable &);
+    StringTable &operator=(const StringTable &);
+
+public:
+    StringTable();
+
+    // get the number of a string, adding it to the table if necessary
+    int intern(const std::string &s);
+
+    // get the number of a string, or -1 if it isn't in the table
+    int lookup(const std::string &s) const;
+
+    const std::string &get(int id) const {
+        if (m_shared) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            assert(id >= 0 && id < int(m_strings.size()));
+            return m_strings[id];
+        }
+        assert(id >= 0 && id < int(m_strings.size()));
+        return m_strings[id];
+    }
+
+    // create a new label, a prefix followed by a number and the label
+    // suffix of the current thread (prefix0, prefix1, ...; the label isn't
+    // interned until it's used)
+    std::string new_label(const std::string &prefix);
+
+    // note a label created by new_label in an earlier compilation of the
+    // current thread's function (see the incremental optimization option),
+    // so that new_label doesn't create it again
+    void reserve_label(const std::string &label);
+
+    // add a deferred string, formatted from an instruction (which must not
+    // be deleted or changed until the table is cleared), and get its number
+    int defer(const Instruction *source, CommentFormatter format);
+
+    // format a deferred string
+    std::string get_deferred(int id) const;
+
+    void clear();
+
+    // the tables of labels and comments (of the compilation on the
+    // current thread)
+    static StringTable &labels();
+    static StringTable &comments();
+
+    // set the suffix of the labels created on the current thread, which
+    // keeps the labels of each function of a program distinct (and
+    // numbered independently of the other functions, whichever thread
+    // they're created on)
+    static void set_label_suffix(const std::string &suffix);
+
+private:
+    friend class IRArena;
+    void set_shared(bool shared) { m_shared = shared; }
+};
 
 // "Properties" that an OperandKind can have.
 // These are encoded into the ordinal value.  Because
@@ -47,27 +138,36 @@ enum OperandKind {
     OPERAND_LABEL                   = (OPROP_HAS_LABEL) + 12,
     // label used as an immediate operand
     OPERAND_LABEL_IMMEDIATE         = (OPROP_HAS_LABEL|OPROP_IS_IMMEDIATE) + 13,
+    // memory reference at a label, addressed relative to %rip
+    OPERAND_LABEL_MEMREF            = (OPROP_HAS_LABEL|OPROP_IS_MEMREF) + 14,
+    // memory reference to a variable's storage, at an offset in the symbol
+    // table (high-level code only: lowered to an offset from %rsp)
+    OPERAND_LOCAL_MEMREF            = (OPROP_HAS_INTVAL|OPROP_IS_MEMREF) + 15,
 };
 
+// Operand is trivially copyable (24 bytes): labels are stored as
+// numbers in StringTable::labels().
 struct Operand {
 private:
     enum OperandKind m_kind;    // kind of operand
     int m_basereg;              // base register number
     int m_indexreg;             // index register number
-    long m_ival;                // literal integer value or offset value
+    unsigned char m_scale;      // scale factor for index register (1, 2, 4, or 8)
     bool m_is_scalar;             // this operand represents a scalar variable in the program
     bool m_maps_mreg;             // this Operand wants to be mapped to a mreg when converting from vreg
-    std::string m_target_label;
+    long m_ival;                // literal integer value, offset value, or label number
 
 public:
     // default ctor, creates invalid Operand
     Operand();
 
     // ctor for Operand with a single register or integer value
-    // (e.g., OPERAND_VREG, OPERAND_MREG, OPERAND_INT_LITERAL)
+    // (e.g., OPERAND_VREG, OPERAND_MREG, OPERAND_INT_LITERAL,
+    // OPERAND_LOCAL_MEMREF)
     // Parameters:
     //   - kind: the OperandKind
-    //   - ival: either a register number or a literal integer value
+    //   - ival: either a register number, a literal integer value,
+    //     or a symbol table offset
     Operand(OperandKind kind, long ival);
 
     // ctor for Operand with reg+integer or reg+reg
@@ -86,13 +186,18 @@ public:
     //   - basereg: base register number
     //   - indexreg: index register number
     //   - offset: offset value
-    Operand(OperandKind kind, int basereg, int indexreg, int offset);
+    //   - scale: scale factor for the index register (1, 2, 4, or 8)
+    Operand(OperandKind kind, int basereg, int indexreg, int offset, int scale = 1);
 
     // ctor for label
     // (e.g., OPERAND_LABEL, OPERAND_LABEL_IMMEDIATE)
     // Parameters:
     Operand(const std::string &target_label, bool is_immediate = false);
 
+    // ctor for label with a specific kind
+    // (e.g., OPERAND_LABEL_MEMREF)
+    Operand(OperandKind kind, const std::string &target_label);
+
     OperandKind get_kind() const { return m_kind; }
 
     // does this Operand have a base register?
@@ -118,14 +223,24 @@ public:
     // get index register number
     int get_index_reg() const;
 
+    // change the base/index register number (e.g., when renaming vregs)
+    void set_base_reg(int basereg);
+    void set_index_reg(int indexreg);
+
     // get literal integer value
     long get_int_value() const;
 
     // get offset
     int get_offset() const;
 
+    // get scale factor of index register
+    int get_scale() const { return m_scale; }
+
     // get target label name
-    std::string get_target_label() const;
+    const std::string &get_target_label() const;
+
+    // get number of target label in StringTable::labels()
+    int get_target_label_number() const;
 
     bool get_is_scalar();
 
@@ -134,30 +249,49 @@ public:
     bool get_does_map_mreg();
 
     void set_does_map_mreg(bool maps_mreg);
+
+    bool operator==(const Operand &other) const;
+    bool operator!=(const Operand &other) const { return !(*this == other); }
 };
 
+// Instruction is trivially copyable: its comment is stored as a number
+// in StringTable::comments(), and operands beyond the first three (only
+// used by instructions with a variable number of operands, such as phi
+// functions) are stored in a pool (see IRArena).  Note that a plain copy of an
+// Instruction with extra operands shares them with the original; use
+// duplicate() to get an independent copy.
 class Instruction {
 private:
     int m_opcode;
     unsigned m_num_operands;
     Operand m_operands[3];
-    std::string m_comment;
+    Operand *m_extra_operands;  // the extra operands, in the pool
+    // comment number, or -1 if none (or -2 - n for deferred comment n,
+    // see StringTable::defer)
+    int m_comment;
+
+    static Operand *allocate_extra_operands(unsigned n);
 
 public:
     Instruction(int opcode);
     Instruction(int opcode, Operand op1);
     Instruction(int opcode, Operand op1, Operand op2);
     Instruction(int opcode, Operand op1, Operand op2, Operand op3);
+    Instruction(int opcode, const std::vector<Operand> &operands);
+
+    // allocated from a pool (see IRArena)
+    static void *operator new(std::size_t size);
+    static void operator delete(void *p);
 
     int get_opcode() const { return m_opcode; }
 
-    unsigned get_num_operands() const;
-    Operand get_operand(unsigned index) const;
+    unsigned get_num_operands() const { return m_num_operands; }
+    const Operand &get_operand(unsigned index) const { return (*this)[index]; }
 
     // more convenient notation for referring to operand
-    Operand operator[](unsigned index) const {
+    const Operand &operator[](unsigned index) const {
         assert(index < m_num_operands);
-        return m_operands[index];
+        return index < 3 ? m_operands[index] : m_extra_operands[index - 3];
     }
 
     // this operator can be used for changing an operand in place;
@@ -165,29 +299,44 @@ public:
     // a different target
     Operand &operator[](unsigned index) {
         assert(index < m_num_operands);
-        return m_operands[index];
+        return index < 3 ? m_operands[index] : m_extra_operands[index - 3];
     }
 
     void set_comment(const std::string &comment);
+    // set the comment to an instruction formatted by format, which is only
+    // called if the comment is read
+    void set_comment(const Instruction *source, CommentFormatter format);
+    // give this Instruction the same comment as another one
+    void copy_comment(const Instruction *other) { m_comment = other->m_comment; }
     bool has_comment() const;
-    const std::string &get_comment() const;
+    std::string get_comment() const;
 
     // create an exact duplicate of this Instruction
     Instruction *duplicate() const;
+
+    // do two Instructions have the same opcode and operands?
+    // (comments are ignored)
+    bool is_same(const Instruction *other) const;
 };
 
 class InstructionSequence {
 private:
     std::vector<Instruction *> m_instr_seq;
 
-    // vector of labels (corresponding to instruction indices)
-    std::vector<std::string> m_labels;
+    // vector of labels (corresponding to instruction indices),
+    // as numbers in StringTable::labels(), or -1 if not labeled
+    std::vector<int> m_labels;
+
+    // map of label numbers to instruction indices
+    std::unordered_map<int, unsigned> m_label_to_index;
 
-    // map of label names to instruction indices
-    std::map<std::string, unsigned> m_label_to_index;
+    // this will be set (to a label number) if the next instruction should be labeled
+    int m_next_label;
 
-    // this will be set of the next instruction should be labeled
-    std::string m_next_label;
+    // set if the Instructions are also referenced by another sequence
+    // (see add_shared_instructions), in which case they're copied
+    // before this sequence is edited
+    bool m_shares_instructions;
 
 public:
     typedef std::vector<Instruction *>::iterator iterator;
@@ -196,8 +345,20 @@ public:
 
     InstructionSequence();
 
+    // allocated from a pool (see IRArena)
+    static void *operator new(std::size_t size);
+    static void operator delete(void *p);
+
     void add_instruction(Instruction *ins);
 
+    // add the instructions at indices [begin, end) of another sequence
+    // without copying them: both sequences share them (so neither one
+    // owns them) until either one is edited
+    void add_shared_instructions(InstructionSequence *other, unsigned begin, unsigned end);
+
+    // are the instructions also referenced by another sequence?
+    bool shares_instructions() const { return m_shares_instructions; }
+
     // define label to refer to the next instruction to be added
     // to the InstructionSequence; note that at most ONE label
     // should be added to a particular instruction
@@ -220,22 +381,42 @@ public:
     // get instruction at specified index
     Instruction *get_instruction(unsigned index) const;
 
+    // Edit the sequence: these may only be used for sequences without
+    // labels (such as BasicBlocks), and the caller takes ownership of
+    // the replaced or removed instructions.  Each removal or insertion
+    // shifts the rest of the sequence (see BasicBlockEditor for making
+    // many edits).
+    Instruction *replace_instruction(unsigned index, Instruction *ins);
+    Instruction *remove_instruction(unsigned index);
+    void insert_instruction(unsigned index, Instruction *ins);
+
+private:
+    friend class BasicBlockEditor;
+
+    // copy shared instructions, so this sequence can be edited
+    void unshare();
+
+public:
+
     // get last instruction
     Instruction *get_last() const;
 
     // determine whether instruction at specified index is labeled
     bool has_label(unsigned index) const;
 
-    // get the label at specified index: returns empty string if there is
-    // no label at the index
-    std::string get_label(unsigned index) const;
+    // get the label at specified index (which must be labeled)
+    const std::string &get_label(unsigned index) const;
+
+    // get the number of the label at specified index (in
+    // StringTable::labels()), or -1 if it isn't labeled
+    int get_label_number(unsigned index) const;
 
     // returns true if there is a label at the end of the instruction
     // sequence (i.e., not labeling any actual Instruction)
     bool has_label_at_end() const;
 
     // get the label at the end
-    std::string get_label_at_end() const;
+    const std::string &get_label_at_end() const;
 
     iterator begin() { return m_instr_seq.begin(); }
     iterator end() { return m_instr_seq.end(); }
@@ -245,6 +426,8 @@ public:
     const_reverse_iterator crend() const { return m_instr_seq.crend(); }
 };
 
+class OutputSink;
+
 // For debugging: print a textual representation of an InstructionSequence
 class PrintInstructionSequence {
 private:
@@ -258,15 +441,29 @@ public:
     PrintInstructionSequence(InstructionSequence *iseq);
 
     // subclasses must override the following member functions
-    virtual std::string get_opcode_name(int opcode) = 0;
-    virtual std::string get_mreg_name(int regnum) = 0;
+    // (the names are string constants)
+    virtual const char *get_opcode_name(int opcode) = 0;
+    virtual const char *get_mreg_name(int regnum) = 0;
+
+    // the name of a machine register which is operand i of an instruction
+    // (by default get_mreg_name: an instruction using only part of the
+    // register may need a different name)
+    virtual const char *get_operand_mreg_name(const Instruction *ins, unsigned i, int regnum);
 
     std::string format_instruction(const Instruction *ins);
+    // (overridden for an instruction whose operands aren't simply
+    // separated by commas)
+    virtual void format_instruction(OutputSink &out, const Instruction *ins);
 
+    // print to stdout
     void print();
+    void print(OutputSink &out);
+    // print the instructions at indices [begin, end), with their labels
+    // (and the label at the end of the sequence, if end is its length)
+    void print(OutputSink &out, unsigned begin, unsigned end);
 
 private:
-    std::string format_operand(const Operand &operand);
+    void format_operand(OutputSink &out, const Instruction *ins, unsigned i);
 };
 
 enum BasicBlockKind {
@@ -282,11 +479,18 @@ private:
     BasicBlockKind m_kind;
     unsigned m_id;
     std::string m_label;
+    // number of times the block was executed, according to a profile
+    // (-1 if unknown, see profile.h)
+    long m_count;
 
 public:
     BasicBlock(BasicBlockKind kind, unsigned id, const std::string &label = "");
     ~BasicBlock();
 
+    // allocated from a pool (see IRArena)
+    static void *operator new(std::size_t size);
+    static void operator delete(void *p);
+
     BasicBlockKind get_kind() const;
     unsigned get_id() const;
 
@@ -295,6 +499,66 @@ public:
 
     // it is sometimes necessary to set a BasicBlock's label after it is created
     void set_label(const std::string &label);
+
+    long get_count() const { return m_count; }
+    void set_count(long count) { m_count = count; }
+};
+
+// Notified of the instructions added to and removed from a BasicBlock
+// by a BasicBlockEditor (see DefUseChains).
+class InstructionListener {
+public:
+    virtual ~InstructionListener();
+
+    virtual void instruction_added(BasicBlock *bb, Instruction *ins) = 0;
+    virtual void instruction_removed(BasicBlock *bb, Instruction *ins) = 0;
+};
+
+// Makes any number of edits to a BasicBlock in time linear in its length.
+// The edits refer to the instructions by their indices in the block as it
+// was when the editor was created, so a pass can keep using those indices
+// (and facts computed for them) while it edits, and they're applied in one
+// pass over the block by commit().  The editor owns the instructions it's
+// given, and deletes the instructions removed or replaced when committed.
+// A listener is notified of each edit as it's made (while the instructions
+// removed still exist).
+class BasicBlockEditor {
+private:
+    BasicBlock *m_bb;
+    InstructionListener *m_listener;
+    // the original instructions' replacements (or null), and whether
+    // each one is removed
+    std::vector<Instruction *> m_replacements;
+    std::vector<bool> m_removed;
+    // the instructions inserted, with the index each is inserted before
+    std::vector<std::pair<unsigned, Instruction *>> m_insertions;
+    bool m_edited;
+
+    // disallow copy ctor and assignment operator
+    BasicBlockEditor(const BasicBlockEditor &);
+    BasicBlockEditor &operator=(const BasicBlockEditor &);
+
+public:
+    BasicBlockEditor(BasicBlock *bb, InstructionListener *listener = nullptr);
+    // (the edits not committed are discarded, and must not have been
+    // made with a listener)
+    ~BasicBlockEditor();
+
+    // get an instruction as edited (null if it was removed)
+    Instruction *get_instruction(unsigned index) const;
+    bool is_removed(unsigned index) const { return m_removed[index]; }
+
+    void remove(unsigned index);
+    void replace(unsigned index, Instruction *ins);
+    // insert before the instruction at index (or at the end of the block,
+    // if index is the block's length), after the instructions already
+    // inserted there
+    void insert(unsigned index, Instruction *ins);
+
+    bool has_edits() const { return m_edited; }
+
+    // apply the edits, returning true if there were any
+    bool commit();
 };
 
 // Edges can be
@@ -319,6 +583,10 @@ public:
     Edge(BasicBlock *source, BasicBlock *target, EdgeKind kind);
     ~Edge();
 
+    // allocated from a pool (see IRArena)
+    static void *operator new(std::size_t size);
+    static void operator delete(void *p);
+
     EdgeKind get_kind() const { return m_kind; }
     BasicBlock *get_source() const { return m_source; }
     BasicBlock *get_target() const { return m_target; }
@@ -330,14 +598,16 @@ class ControlFlowGraph {
 public:
     typedef std::vector<BasicBlock *> BlockList;
     typedef std::vector<Edge *> EdgeList;
-    typedef std::map<BasicBlock *, EdgeList> EdgeMap;
 
 private:
     BlockList m_basic_blocks;
     BasicBlock *m_entry, *m_exit;
-    EdgeMap m_incoming_edges;
-    EdgeMap m_outgoing_edges;
-    EdgeList m_empty_edge_list;
+    // incoming/outgoing edges of each block, indexed by block id
+    std::vector<EdgeList> m_incoming_edges;
+    std::vector<EdgeList> m_outgoing_edges;
+    // block orders (see get_reverse_postorder), computed when first
+    // needed: they are cleared whenever a block or edge is created
+    mutable BlockList m_rpo, m_reverse_cfg_rpo;
 
     // A "Chunk" is a collection of BasicBlocks
     // connected by fall-through edges.  All of the blocks
@@ -356,15 +626,13 @@ private:
             if (bb->get_kind() == BASICBLOCK_EXIT) { is_exit = true; }
         }
 
-        Chunk *merge_with(Chunk *other) {
-            Chunk *merged = new Chunk();
-            for (auto i = blocks.begin(); i != blocks.end(); i++) {
-                merged->append(*i);
-            }
+        // move all of the blocks of other (which follow this chunk's blocks) into this chunk
+        void absorb(Chunk *other) {
             for (auto i = other->blocks.begin(); i != other->blocks.end(); i++) {
-                merged->append(*i);
+                append(*i);
             }
-            return merged;
+            other->blocks.clear();
+            other->is_exit = false;
         }
 
         bool is_first(BasicBlock *bb) const {
@@ -376,12 +644,24 @@ private:
         }
 
         bool contains_exit_block() const { return is_exit; }
+
+        // is the chunk known (from a profile) never to have been executed?
+        bool is_cold() const {
+            for (auto i = blocks.begin(); i != blocks.end(); i++) {
+                if ((*i)->get_count() != 0) { return false; }
+            }
+            return !blocks.empty();
+        }
     };
 
 public:
     ControlFlowGraph();
     ~ControlFlowGraph();
 
+    // allocated from a pool (see IRArena)
+    static void *operator new(std::size_t size);
+    static void operator delete(void *p);
+
     // get total number of BasicBlocks (including entry and exit)
     unsigned get_num_blocks() const { return unsigned(m_basic_blocks.size()); }
 
@@ -416,22 +696,121 @@ public:
     // Get vector of all incoming edges to given block
     const EdgeList &get_incoming_edges(BasicBlock *bb) const;
 
+    // The blocks reachable from the entry block in reverse postorder (the
+    // order for forward dataflow problems), and the blocks from which the
+    // exit block is reachable in reverse postorder of the reversed CFG
+    // (the order for backward problems).  The depth-first searches are
+    // iterative, and visit the edges of each block in order.
+    const BlockList &get_reverse_postorder() const;
+    const BlockList &get_reverse_cfg_reverse_postorder() const;
+
     // Return a "flat" InstructionSequence created from this ControlFlowGraph;
-    // this is useful for optimization passes which create a transformed ControlFlowGraph
-    InstructionSequence *create_instruction_sequence() const;
+    // this is useful for optimization passes which create a transformed ControlFlowGraph.
+    //
+    // Blocks connected by fall-through edges stay together (as Chunks), and the
+    // Chunks are laid out depth-first from the entry block, with the target of a
+    // Chunk's final unconditional branch placed right after it when possible, so
+    // loop bodies stay contiguous.  The entry block's Chunk comes first, and the
+    // exit block (which is reached by falling through) last: if both are in the
+    // same Chunk, the block falling through to the exit block is placed with it,
+    // and the block before it branches to it instead (with jump_opcode, the
+    // opcode of an unconditional branch), unless nothing is placed between them.
+    // Unconditional branches to the next block are removed.  If invert_branch is given (it returns the opposite of a
+    // conditional branch opcode, or -1), a conditional branch over a block
+    // containing only an unconditional branch is inverted to go directly to that
+    // branch's target, when the conditional branch's target is the next block
+    // after it.
+    //
+    // The Chunks which a profile shows were never executed are placed just
+    // before the exit Chunk or, if cold_opcode is given, after it, following
+    // an instruction with that opcode, which ends the hot code (so that the
+    // cold code can be placed away from it, see HINS_COLD).  A block which
+    // was never executed is then also split from an executed block falling
+    // through to it, by inverting the executed block's conditional branch
+    // (with invert_branch) to go to the cold block, and branching to the
+    // original target (with jump_opcode) unless it comes next.  (The cold block is given a label if it
+    // has none.)
+    InstructionSequence *create_instruction_sequence(int (*invert_branch)(int opcode) = nullptr,
+                                                     int cold_opcode = -1, int jump_opcode = -1) const;
 
 private:
-    void append_basic_block(InstructionSequence *iseq, const BasicBlock *bb, std::vector<bool> &finished_blocks) const;
-    void append_chunk(InstructionSequence *iseq, Chunk *chunk, std::vector<bool> &finished_blocks) const;
-    void visit_successors(BasicBlock *bb, std::deque<BasicBlock *> &work_list) const;
+    typedef std::map<BasicBlock *, Chunk *> ChunkMap;
+
+    // does the given BasicBlock belong to this ControlFlowGraph?
+    bool has_block(BasicBlock *bb) const {
+        return bb->get_id() < m_basic_blocks.size() && m_basic_blocks[bb->get_id()] == bb;
+    }
+
+    void compute_reverse_postorder(BasicBlock *start, bool reverse_cfg, BlockList &order) const;
+    void find_chunks(std::deque<Chunk> &chunks, ChunkMap &chunk_map, int (*split_cold)(int opcode)) const;
+    bool is_cold_fall_through(Edge *e, int (*invert_branch)(int opcode)) const;
+    BasicBlock *get_branch_target(BasicBlock *bb) const;
+    void layout_chunks(const ChunkMap &chunk_map, bool split_cold, std::vector<BasicBlock *> &layout) const;
+    BasicBlock *get_jump_target(BasicBlock *bb) const;
+    bool is_inverted_branch_candidate(const std::vector<BasicBlock *> &layout, unsigned i) const;
+};
+
+// All Instructions, InstructionSequences, BasicBlocks, Edges, and
+// ControlFlowGraphs are allocated from object pools (see arena.h), so
+// creating them doesn't require a call to malloc, and the ones which are
+// never explicitly deleted (e.g., the CFGs, sequences and instructions of
+// intermediate passes) can be freed at once at the end of
+// the compilation.  No pointer to one of these objects may be used after release(),
+// which also clears the StringTables.  The pools (and tables) are thread-local,
+// so each thread can compile a program.
+//
+// A compilation can also run independent tasks (such as optimizing each
+// function of the program) on other threads with run_parallel().  Each
+// thread running its tasks allocates from pools of its own (so no locking
+// is needed), which are owned by the compilation's thread and freed by its
+// release(), and uses the compilation's StringTables.
+class IRArena {
+public:
+    static void release();
+
+    // Free a ControlFlowGraph which was replaced by another (as the result
+    // of a pass), so its objects can be reused before the end of the
+    // compilation: its blocks, edges, and the instructions of its blocks
+    // which aren't in the replacement (except for blocks sharing their
+    // instructions with another sequence, see add_shared_instructions).
+    // Nothing is freed if the replacement is the CFG itself.
+    static void free_replaced(ControlFlowGraph *cfg, const ControlFlowGraph *replacement);
+    // (several CFGs replaced in turn, which may have instructions in common)
+    static void free_replaced(const std::vector<ControlFlowGraph *> &cfgs, const ControlFlowGraph *replacement);
+
+    // Free an InstructionSequence which was replaced by another, with its
+    // instructions which aren't in the replacement (including the ones
+    // shared with other sequences, which must no longer be used).
+    static void free_replaced(InstructionSequence *iseq, const InstructionSequence *replacement);
+    // (such as a function's high-level code, by the CFG optimized from it)
+    static void free_replaced(InstructionSequence *iseq, const ControlFlowGraph *replacement);
+
+    // keep the storage of the pools of the current thread when they are
+    // released, for the next compilation on the thread to reuse (for a
+    // process compiling many programs, such as the compile server)
+    static void set_reuse_storage(bool reuse);
+
+    // run task(0), task(1), ..., task(num_tasks - 1) on up to num_threads
+    // threads (the current thread and num_threads - 1 others), each task
+    // being started, in order, by the first thread which is idle; returns
+    // when all of the tasks are done (the threads handle fatal errors with
+    // the current thread's handler, see err_set_handler, and if a task
+    // throws an exception, the tasks not started are skipped, and it's
+    // rethrown once the others are done)
+    static void run_parallel(unsigned num_tasks, unsigned num_threads, const std::function<void(unsigned)> &task);
 };
 
 class ControlFlowGraphBuilder {
 private:
     InstructionSequence *m_iseq;
     ControlFlowGraph *m_cfg;
-    // map of instruction index to pointer to BasicBlock starting at that instruction
-    std::map<unsigned, BasicBlock *> m_basic_blocks;
+    // BasicBlock starting at each instruction index (or null if no such
+    // block has been created yet)
+    std::vector<BasicBlock *> m_basic_blocks;
+    // is each instruction the first instruction of a basic block?
+    std::vector<bool> m_leaders;
+    // index of the instruction targeted by each branch instruction
+    std::vector<unsigned> m_branch_targets;
 
     struct WorkItem {
         unsigned ins_index;
@@ -460,10 +839,16 @@ public:
     // true for all Instructions *except* unconditional branches.
     virtual bool falls_through(Instruction *ins) = 0;
 
+    // Subclasses may override this to mark the Instructions which end the
+    // function as the end of the InstructionSequence does (falling through
+    // to the exit block), such as the end of the hot code followed by the
+    // cold code (see ControlFlowGraph::create_instruction_sequence).
+    virtual bool ends_function(Instruction *ins);
+
 private:
+    void find_leaders();
     BasicBlock *scan_basic_block(const WorkItem &item, const std::string &label);
     bool ends_in_branch(BasicBlock *bb);
-    unsigned get_branch_target_index(BasicBlock *bb);
     bool falls_through(BasicBlock *bb);
 };
 
@@ -477,11 +862,13 @@ public:
     ControlFlowGraphPrinter(ControlFlowGraph *cfg);
     ~ControlFlowGraphPrinter();
 
+    // print to stdout
     void print();
+    void print(OutputSink &out);
 
     // The intended way to implement this method is to use a specialized
     // variant of PrintInstructionSequence.
-    virtual void print_basic_block(BasicBlock *bb) = 0;
+    virtual void print_basic_block(OutputSink &out, BasicBlock *bb) = 0;
 };
 
 #endif // CFG_H
\ No newline at end of file
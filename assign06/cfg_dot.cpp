@@ -0,0 +1,121 @@
+#include <cstdio>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "cfg_dot.h"
+
+ControlFlowGraphDotPrinter::ControlFlowGraphDotPrinter(FILE *out)
+        : m_out(out)
+        , m_num_cfgs(0) {
+    m_out.put("digraph cfg {\n");
+    m_out.put("  node [shape=box, fontname=\"monospace\", style=filled, fillcolor=white];\n");
+    m_out.put("  edge [fontname=\"monospace\", fontsize=10];\n");
+}
+
+ControlFlowGraphDotPrinter::~ControlFlowGraphDotPrinter() {
+    m_out.put("}\n");
+}
+
+void ControlFlowGraphDotPrinter::print(const std::string &name, ControlFlowGraph *cfg) {
+    unsigned k = m_num_cfgs++;
+    LiveVregs live_vregs(cfg);
+    live_vregs.execute();
+
+    long max_count = 0;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        if ((*i)->get_count() > max_count) {
+            max_count = (*i)->get_count();
+        }
+    }
+
+    m_out.put("  subgraph cluster_");
+    m_out.put_int(k);
+    m_out.put(" {\n    label=\"");
+    put_escaped(name);
+    m_out.put("\";\n");
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+
+        // the register pressure is the most vregs live at the end of the
+        // block or after any of its instructions (scanning backwards)
+        LiveVregs::LiveSet live = live_vregs.get_fact_at_end_of_block(bb);
+        unsigned pressure = live.count();
+        for (auto j = bb->crbegin(); j != bb->crend(); j++) {
+            live_vregs.model_instruction(*j, live);
+            pressure = live.count() > pressure ? live.count() : pressure;
+        }
+
+        m_out.put("    f");
+        m_out.put_int(k);
+        m_out.put("_b");
+        m_out.put_int(bb->get_id());
+        m_out.put(" [label=\"");
+        if (bb->get_kind() == BASICBLOCK_ENTRY) {
+            m_out.put("entry");
+        } else if (bb->get_kind() == BASICBLOCK_EXIT) {
+            m_out.put("exit");
+        } else {
+            m_out.put("BB ");
+            m_out.put_int(bb->get_id());
+            if (bb->has_label()) {
+                m_out.put(" (");
+                put_escaped(bb->get_label());
+                m_out.put(')');
+            }
+        }
+        m_out.put("\\l");
+        if (bb->get_count() >= 0) {
+            m_out.put("count: ");
+            m_out.put_int(bb->get_count());
+            m_out.put("\\l");
+        }
+        m_out.put("max live vregs: ");
+        m_out.put_int(pressure);
+        m_out.put("\\l");
+        PrintHighLevelInstructionSequence print_hins(bb);
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            m_out.put("  ");
+            put_escaped(print_hins.format_instruction(*j));
+            m_out.put("\\l");
+        }
+        m_out.put('"');
+        if (bb->get_count() >= 0 && max_count > 0) {
+            // (white for blocks which never ran, red for the hottest)
+            int shade = int(255 - 255 * double(bb->get_count()) / double(max_count));
+            char color[16];
+            snprintf(color, sizeof(color), "#ff%02x%02x", shade, shade);
+            m_out.put(", fillcolor=\"");
+            m_out.put(color);
+            m_out.put('"');
+        }
+        m_out.put("];\n");
+    }
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        const ControlFlowGraph::EdgeList &outgoing_edges = cfg->get_outgoing_edges(*i);
+        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+            const Edge *e = *j;
+            m_out.put("    f");
+            m_out.put_int(k);
+            m_out.put("_b");
+            m_out.put_int(e->get_source()->get_id());
+            m_out.put(" -> f");
+            m_out.put_int(k);
+            m_out.put("_b");
+            m_out.put_int(e->get_target()->get_id());
+            m_out.put(e->get_kind() == EDGE_FALLTHROUGH ? " [label=\"fall-through\", style=dashed];\n"
+                                                        : " [label=\"branch\"];\n");
+        }
+    }
+    m_out.put("  }\n");
+}
+
+void ControlFlowGraphDotPrinter::put_escaped(const std::string &s) {
+    for (auto i = s.begin(); i != s.end(); i++) {
+        if (*i == '"' || *i == '\\') {
+            m_out.put('\\');
+        }
+        m_out.put(*i);
+    }
+}
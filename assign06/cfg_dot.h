@@ -0,0 +1,40 @@
+#ifndef CFG_DOT_H
+#define CFG_DOT_H
+
+#include <cstdio>
+#include <string>
+#include "output.h"
+
+class ControlFlowGraph;
+
+// Print the high-level CFGs of a program's functions as a Graphviz (DOT)
+// graph, for -cfg-dot, with a cluster for each function.  Each block is
+// labeled with its instructions, its execution count (if it's known from
+// -fprofile-use) and its register pressure: the largest number of vregs
+// live at once in the block, so that the blocks where vregs are likely
+// to be spilled stand out.  The blocks with counts are filled from white
+// to red by their count relative to the hottest block of their function,
+// and each edge is labeled with its EdgeKind.
+class ControlFlowGraphDotPrinter {
+private:
+    OutputSink m_out;
+    unsigned m_num_cfgs;
+
+    // disallow copy ctor and assignment operator
+    ControlFlowGraphDotPrinter(const ControlFlowGraphDotPrinter &);
+    ControlFlowGraphDotPrinter &operator=(const ControlFlowGraphDotPrinter &);
+
+public:
+    // (the graph is written to out, and ended when the printer is destroyed)
+    ControlFlowGraphDotPrinter(FILE *out);
+    ~ControlFlowGraphDotPrinter();
+
+    // add the CFG of a function to the graph
+    void print(const std::string &name, ControlFlowGraph *cfg);
+
+private:
+    // put a string in a DOT string literal
+    void put_escaped(const std::string &s);
+};
+
+#endif // CFG_DOT_H
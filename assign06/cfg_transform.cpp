@@ -1,15 +1,17 @@
 #include <cassert>
+#include <algorithm>
 #include "cfg.h"
 #include "cfg_transform.h"
 
 ControlFlowGraphTransform::ControlFlowGraphTransform(ControlFlowGraph *cfg)
-        : m_cfg(cfg) {
+        : m_cfg(cfg)
+        , m_num_threads(1) {
 }
 
 ControlFlowGraphTransform::~ControlFlowGraphTransform() {
 }
 
-ControlFlowGraph *ControlFlowGraphTransform::get_orig_cfg() {
+ControlFlowGraph *ControlFlowGraphTransform::get_orig_cfg() const {
     return m_cfg;
 }
 
@@ -19,20 +21,31 @@ ControlFlowGraph *ControlFlowGraphTransform::transform_cfg() {
     // map of basic blocks of original CFG to basic blocks in transformed CFG
     std::map<BasicBlock *, BasicBlock *> block_map;
 
-    // iterate over all basic blocks, transforming each one
+    // transform the instructions of the blocks which are kept
+    std::vector<BasicBlock *> kept;
     for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
         BasicBlock *orig = *i;
+        if (orig->get_kind() != BASICBLOCK_INTERIOR || keep_basic_block(orig)) {
+            kept.push_back(orig);
+        }
+    }
+    std::vector<InstructionSequence *> result_iseqs(kept.size());
+    for_each_block(unsigned(kept.size()), [&](unsigned i) {
+        result_iseqs[i] = transform_basic_block(kept[i]);
+    });
 
-        // transform the instructions
-        InstructionSequence *result_iseq = transform_basic_block(orig);
+    for (unsigned i = 0; i < kept.size(); i++) {
+        BasicBlock *orig = kept[i];
+        InstructionSequence *result_iseq = result_iseqs[i];
 
         // create result basic block
         BasicBlock *result_bb = result->create_basic_block(orig->get_kind(), orig->get_label());
         block_map[orig] = result_bb;
+        result_bb->set_count(orig->get_count());
 
-        // copy instructions into result basic block
+        // move instructions into result basic block
         for (auto j = result_iseq->cbegin(); j != result_iseq->cend(); j++) {
-            result_bb->add_instruction((*j)->duplicate());
+            result_bb->add_instruction(*j);
         }
 
         delete result_iseq;
@@ -45,6 +58,12 @@ ControlFlowGraph *ControlFlowGraphTransform::transform_cfg() {
         for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
             Edge *orig_edge = *j;
 
+            if (block_map.find(orig_edge->get_source()) == block_map.end()
+                    || block_map.find(orig_edge->get_target()) == block_map.end()
+                    || !keep_edge(orig_edge)) {
+                continue;
+            }
+
             BasicBlock *transformed_source = block_map[orig_edge->get_source()];
             BasicBlock *transformed_target = block_map[orig_edge->get_target()];
 
@@ -55,3 +74,75 @@ ControlFlowGraph *ControlFlowGraphTransform::transform_cfg() {
     return result;
 }
 
+
+bool ControlFlowGraphTransform::transform_in_place() {
+    unsigned num_blocks = m_cfg->get_num_blocks();
+    // (vector<bool> can't be written by several threads)
+    std::vector<char> changed(num_blocks, false);
+    for_each_block(num_blocks, [&](unsigned i) {
+        changed[i] = transform_basic_block_in_place(m_cfg->get_block(i));
+    });
+
+    m_changed_blocks.clear();
+    for (unsigned i = 0; i < num_blocks; i++) {
+        if (changed[i]) {
+            m_changed_blocks.push_back(m_cfg->get_block(i));
+        }
+    }
+    return !m_changed_blocks.empty();
+}
+
+bool ControlFlowGraphTransform::transform_basic_block_in_place(BasicBlock *bb) {
+    InstructionSequence *result_iseq = transform_basic_block(bb);
+
+    bool changed = result_iseq->get_length() != bb->get_length();
+    for (unsigned i = 0; i < result_iseq->get_length() && !changed; i++) {
+        changed = !result_iseq->get_instruction(i)->is_same(bb->get_instruction(i));
+    }
+
+    if (changed) {
+        while (bb->get_length() > 0) {
+            delete bb->remove_instruction(bb->get_length() - 1);
+        }
+        for (auto j = result_iseq->cbegin(); j != result_iseq->cend(); j++) {
+            bb->add_instruction(*j);
+        }
+    } else {
+        for (auto j = result_iseq->cbegin(); j != result_iseq->cend(); j++) {
+            delete *j;
+        }
+    }
+
+    delete result_iseq;
+    return changed;
+}
+
+bool ControlFlowGraphTransform::keep_basic_block(BasicBlock *orig) {
+    return true;
+}
+
+bool ControlFlowGraphTransform::keep_edge(Edge *orig) {
+    return true;
+}
+
+BasicBlock *ControlFlowGraphTransform::to_basic_block(InstructionSequence *iseq) {
+    return static_cast<BasicBlock *>(iseq);
+}
+
+void ControlFlowGraphTransform::for_each_block(unsigned n, const std::function<void(unsigned)> &transform) {
+    if (m_num_threads <= 1 || n < MIN_PARALLEL_BLOCKS || !is_block_local()) {
+        for (unsigned i = 0; i < n; i++) {
+            transform(i);
+        }
+        return;
+    }
+
+    // (each task transforms a run of consecutive blocks)
+    unsigned num_tasks = (n + BLOCKS_PER_TASK - 1) / BLOCKS_PER_TASK;
+    IRArena::run_parallel(num_tasks, m_num_threads, [&](unsigned task) {
+        unsigned end = std::min(n, (task + 1) * BLOCKS_PER_TASK);
+        for (unsigned i = task * BLOCKS_PER_TASK; i < end; i++) {
+            transform(i);
+        }
+    });
+}
@@ -1,20 +1,78 @@
 #ifndef CFG_TRANSFORM_H
 #define CFG_TRANSFORM_H
 
+#include <functional>
+#include <vector>
+
 class ControlFlowGraph;
+class BasicBlock;
+class Edge;
 
 class ControlFlowGraphTransform {
+public:
+    // the fewest blocks a CFG must have for a block-local transformation
+    // to run on several threads (see set_num_threads), and the number of
+    // consecutive blocks each thread takes at a time
+    static const unsigned MIN_PARALLEL_BLOCKS = 512;
+    static const unsigned BLOCKS_PER_TASK = 64;
+
 private:
     ControlFlowGraph *m_cfg;
+    std::vector<BasicBlock *> m_changed_blocks;
+    unsigned m_num_threads;
 
 public:
     ControlFlowGraphTransform(ControlFlowGraph *cfg);
     virtual ~ControlFlowGraphTransform();
 
-    ControlFlowGraph *get_orig_cfg();
+    ControlFlowGraph *get_orig_cfg() const;
     ControlFlowGraph *transform_cfg();
 
+    // Transform the blocks of a large CFG on up to n threads, if the
+    // transformation is block-local (the blocks are still put together
+    // in order, so the result is the same).
+    void set_num_threads(unsigned n) { m_num_threads = n; }
+
+    // Is the transformation block-local?  A subclass may return true if
+    // transform_basic_block (and transform_basic_block_in_place) only read
+    // the block they're given and state which doesn't change once the
+    // transformation is constructed (such as the results of an analysis),
+    // so that they can transform different blocks at the same time.
+    virtual bool is_block_local() const { return false; }
+
+    // Transform the original CFG in place, rather than building a new one:
+    // returns true if any basic block changed (and get_changed_blocks
+    // returns the blocks which changed).  This can only be used by
+    // transformations which don't remove blocks or edges.
+    bool transform_in_place();
+    const std::vector<BasicBlock *> &get_changed_blocks() const { return m_changed_blocks; }
+
+    // returns a new InstructionSequence containing new Instructions
+    // (which are moved into the transformed CFG)
     virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq) = 0;
+
+    // Transform one of the original CFG's basic blocks in place, returning
+    // true if it changed.  The default implementation replaces the block's
+    // instructions with the result of transform_basic_block if they differ;
+    // subclasses may override this to edit the block directly.
+    virtual bool transform_basic_block_in_place(BasicBlock *bb);
+
+    // Subclasses may override these to remove basic blocks and edges
+    // from the transformed CFG (e.g., unreachable blocks, or the untaken
+    // edge of a branch whose outcome is known).  The entry and exit blocks
+    // are always kept.
+    virtual bool keep_basic_block(BasicBlock *orig);
+    virtual bool keep_edge(Edge *orig);
+
+protected:
+    // the InstructionSequence passed to transform_basic_block is always
+    // one of the original CFG's basic blocks
+    static BasicBlock *to_basic_block(InstructionSequence *iseq);
+
+private:
+    // call transform(i) for each of the first n blocks, on several threads
+    // if the transformation is block-local and the CFG is large enough
+    void for_each_block(unsigned n, const std::function<void(unsigned)> &transform);
 };
 
 #endif // CFG_TRANSFORM_H
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <map>
+#include <string>
+#include "cfg.h"
+#include "x86_64.h"
+#include "schedule.h"
+#include "stats.h"
+#include "code_align.h"
+
+namespace {
+    const unsigned FLAGS = 1U << X86_64::FLAGS;
+
+    bool has_memref(const Instruction *ins) {
+        if (ins->get_opcode() == MINS_LEAQ) {
+            return false;
+        }
+        for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+            if (ins->get_operand(i).is_memref()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // does ins only read memory (loading it into a register)?
+    bool is_load(const Instruction *ins) {
+        int opcode = ins->get_opcode();
+        return (opcode == MINS_MOVQ || opcode == MINS_MOVZBQ || opcode == MINS_MOVSLQ)
+            && ins->get_operand(1).get_kind() == OPERAND_MREG;
+    }
+}
+
+CodeAlignment::CodeAlignment(InstructionSequence *iseq)
+        : m_iseq(iseq)
+        , m_num_loops(0)
+        , m_num_moved(0)
+        , m_num_fused(0) {
+}
+
+CodeAlignment::~CodeAlignment() {
+}
+
+InstructionSequence *CodeAlignment::transform() {
+    // the instruction at each position (the labels stay at their positions)
+    unsigned len = m_iseq->get_length();
+    std::vector<unsigned> order(len);
+    for (unsigned i = 0; i < len; i++) {
+        order[i] = i;
+    }
+
+    for (unsigned i = 0; i < len; i++) {
+        if (!X86_64::has_flags(m_iseq->get_instruction(order[i])->get_opcode(), MOP_BRANCH)) {
+            continue;
+        }
+        int compare = find_compare(order, i);
+        if (compare >= 0) {
+            std::rotate(order.begin() + compare, order.begin() + compare + 1, order.begin() + i);
+            m_num_moved++;
+        }
+        if (i > 0 && !m_iseq->has_label(i)
+                && is_fusible(m_iseq->get_instruction(order[i - 1]), m_iseq->get_instruction(order[i]))) {
+            m_num_fused++;
+        }
+    }
+
+    std::vector<bool> is_loop_top = find_loop_tops();
+    auto out = new InstructionSequence();
+    for (unsigned i = 0; i < len; i++) {
+        Instruction *ins = m_iseq->get_instruction(order[i]);
+        if (is_loop_top[i] && (X86_64::get_effects(ins).reads & FLAGS) == 0) {
+            out->add_instruction(new Instruction(MINS_P2ALIGN, Operand(OPERAND_INT_LITERAL, LOOP_ALIGNMENT),
+                                                 Operand(OPERAND_INT_LITERAL, MAX_PADDING)));
+            m_num_loops++;
+        }
+        if (m_iseq->has_label(i)) {
+            out->define_label(m_iseq->get_label(i));
+        }
+        out->add_instruction(ins->duplicate());
+    }
+    if (m_iseq->has_label_at_end()) {
+        out->define_label(m_iseq->get_label_at_end());
+    }
+
+    Statistics::get().add("align.loops", m_num_loops);
+    Statistics::get().add("align.moved-compares", m_num_moved);
+    Statistics::get().add("align.fused-pairs", m_num_fused);
+    return out;
+}
+
+bool CodeAlignment::is_fusible(const Instruction *ins, const Instruction *branch) {
+    bool has_imm = false, has_memref = false;
+    for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+        const Operand &operand = ins->get_operand(i);
+        if (operand.get_kind() == OPERAND_LABEL_MEMREF) {
+            return false;
+        }
+        has_imm = has_imm || operand.get_kind() == OPERAND_INT_LITERAL
+            || operand.get_kind() == OPERAND_LABEL_IMMEDIATE;
+        has_memref = has_memref || operand.is_memref();
+    }
+    switch (ins->get_opcode()) {
+        case MINS_CMPQ:
+            return !(has_imm && has_memref);
+        case MINS_ADDQ:
+        case MINS_SUBQ:
+        case MINS_ANDQ:
+            // (not with a memory destination)
+            return !ins->get_operand(1).is_memref();
+        case MINS_INCQ:
+        case MINS_DECQ:
+            // (which leave the carry flag alone, so ja can't use them)
+            return !ins->get_operand(0).is_memref() && branch->get_opcode() != MINS_JA;
+        default:
+            return false;
+    }
+}
+
+int CodeAlignment::find_compare(const std::vector<unsigned> &order, unsigned branch) const {
+    // find the instruction setting the condition codes, which must not be
+    // separated from the branch by a label, a barrier, or a use of them
+    unsigned i = branch;
+    const Instruction *compare = nullptr;
+    while (i > 0 && !m_iseq->has_label(i)) {
+        const Instruction *ins = m_iseq->get_instruction(order[i - 1]);
+        X86_64Effects effects = X86_64::get_effects(ins);
+        if (InstructionScheduler::is_barrier(ins) || (effects.reads & FLAGS) != 0) {
+            return -1;
+        }
+        i--;
+        if ((effects.writes & FLAGS) != 0) {
+            compare = ins;
+            break;
+        }
+    }
+    if (compare == nullptr || i + 1 == branch
+            || !is_fusible(compare, m_iseq->get_instruction(order[branch]))) {
+        return -1;
+    }
+
+    // the instructions between them must not depend on it (or it on them)
+    X86_64Effects compare_effects = X86_64::get_effects(compare);
+    unsigned writes = compare_effects.writes & ~FLAGS;
+    bool accesses_memory = has_memref(compare);
+    for (unsigned j = i + 1; j < branch; j++) {
+        const Instruction *ins = m_iseq->get_instruction(order[j]);
+        X86_64Effects effects = X86_64::get_effects(ins);
+        if ((effects.writes & (compare_effects.reads | writes)) != 0 || (effects.reads & writes) != 0) {
+            return -1;
+        }
+        if (accesses_memory && has_memref(ins)
+                && !(compare->get_opcode() == MINS_CMPQ && is_load(ins))) {
+            return -1;
+        }
+    }
+    return int(i);
+}
+
+std::vector<bool> CodeAlignment::find_loop_tops() const {
+    // (the labels of the positions, in the hot code before any cold code)
+    std::map<std::string, unsigned> positions;
+    unsigned len = m_iseq->get_length();
+    std::vector<bool> is_loop_top(len, false);
+    for (unsigned i = 0; i < len; i++) {
+        const Instruction *ins = m_iseq->get_instruction(i);
+        if (ins->get_opcode() == MINS_COLD) {
+            break;
+        }
+        if (m_iseq->has_label(i)) {
+            positions[m_iseq->get_label(i)] = i;
+        }
+        if (X86_64::has_flags(ins->get_opcode(), MOP_JUMP | MOP_BRANCH) && ins->get_num_operands() == 1
+                && ins->get_operand(0).get_kind() == OPERAND_LABEL) {
+            auto target = positions.find(ins->get_operand(0).get_target_label());
+            if (target != positions.end()) {
+                is_loop_top[target->second] = true;
+            }
+        }
+    }
+    return is_loop_top;
+}
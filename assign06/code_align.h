@@ -0,0 +1,73 @@
+#ifndef CODE_ALIGN_H
+#define CODE_ALIGN_H
+
+#include <vector>
+#include "cfg.h"
+
+// The last pass over the x86-64 code generated by AssemblyCodeGen (after
+// scheduling), which lays it out for the processor's front end.
+//
+// A conditional branch is macro-fused with the comparison (or the addq,
+// subq, andq, incq or decq) just before it, which then decodes and
+// executes as a single operation; the pair isn't fused if other
+// instructions come between them.  The comparison setting the condition
+// codes a branch uses is moved down to it, past the instructions between
+// them, if none of those uses the condition codes or a register the
+// comparison reads or writes (or memory, if the comparison accesses it),
+// and no label comes between them.  (The comparison and register-register
+// or register-immediate operations fuse; a memory operand with an
+// immediate, or a %rip-relative one, doesn't.)
+//
+// The top of each loop in the hot code (the target of a branch back to an
+// earlier instruction: the header of a loop as laid out, whether its test
+// is at the top or the bottom) is aligned to a 1 << LOOP_ALIGNMENT byte
+// boundary, with a .p2align directive padding with nops if that takes at
+// most MAX_PADDING bytes (see MINS_P2ALIGN), so the body of a small loop
+// is fetched (and cached as decoded operations) in as few blocks as
+// possible.  A loop top
+// which uses the condition codes set before it (so its padding would split
+// a fused pair) isn't aligned.
+class CodeAlignment {
+public:
+    // log2 of the alignment of a loop top (16 bytes), and the most padding
+    // added for it
+    static const unsigned LOOP_ALIGNMENT = 4;
+    static const unsigned MAX_PADDING = 10;
+
+private:
+    InstructionSequence *m_iseq;
+    unsigned m_num_loops;
+    unsigned m_num_moved;
+    unsigned m_num_fused;
+
+    // disallow copy ctor and assignment operator
+    CodeAlignment(const CodeAlignment &);
+    CodeAlignment &operator=(const CodeAlignment &);
+
+public:
+    CodeAlignment(InstructionSequence *iseq);
+    ~CodeAlignment();
+
+    // the number of loop tops aligned, the number of comparisons moved
+    // down to their branches, and the number of fusible pairs of a
+    // comparison and a branch in the result
+    unsigned get_num_loops() const { return m_num_loops; }
+    unsigned get_num_moved() const { return m_num_moved; }
+    unsigned get_num_fused() const { return m_num_fused; }
+
+    // get the transformed instruction sequence
+    InstructionSequence *transform();
+
+    // can ins be macro-fused with a following conditional branch?
+    static bool is_fusible(const Instruction *ins, const Instruction *branch);
+
+private:
+    // the position of the instruction setting the condition codes which
+    // the conditional branch at position branch should be fused with, if
+    // it can be moved down to it (or -1)
+    int find_compare(const std::vector<unsigned> &order, unsigned branch) const;
+    // which positions are loop tops
+    std::vector<bool> find_loop_tops() const;
+};
+
+#endif // CODE_ALIGN_H
@@ -0,0 +1,142 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <atomic>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "compile_cache.h"
+
+const char *CompileCache::VERSION = "assign06-1";
+
+namespace {
+    // two 64-bit FNV-1a hashes with different offset bases and primes
+    // (the key is both, in hex)
+    struct Hash {
+        unsigned long h1 = 0xcbf29ce484222325UL;
+        unsigned long h2 = 0x84222325cbf29ce4UL;
+
+        void add(const char *data, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                unsigned char c = (unsigned char) data[i];
+                h1 = (h1 ^ c) * 0x100000001b3UL;
+                h2 = (h2 ^ c) * 0x100000000000067UL;
+            }
+        }
+
+        // (a string is added with its length, so that the strings of a
+        // sequence can't run together)
+        void add(const std::string &s) {
+            unsigned long n = s.size();
+            add((const char *) &n, sizeof(n));
+            add(s.data(), s.size());
+        }
+
+        std::string get_hex() const {
+            char buf[33];
+            snprintf(buf, sizeof(buf), "%016lx%016lx", h1, h2);
+            return buf;
+        }
+    };
+
+    bool read_file(const char *filename, std::string &contents) {
+        FILE *in = fopen(filename, "rb");
+        if (in == nullptr) {
+            return false;
+        }
+        char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+            contents.append(buf, n);
+        }
+        bool ok = !ferror(in);
+        fclose(in);
+        return ok;
+    }
+
+    // a hash of the cache's version and the identity of the compiler
+    Hash get_compiler_hash() {
+        Hash hash;
+        hash.add(CompileCache::VERSION);
+        struct stat exe;
+        if (stat("/proc/self/exe", &exe) == 0) {
+            hash.add(std::to_string(long(exe.st_size)) + ":" + std::to_string(long(exe.st_mtime)));
+        }
+        return hash;
+    }
+
+    bool copy_file(const char *filename, FILE *out) {
+        std::string contents;
+        return read_file(filename, contents)
+               && fwrite(contents.data(), 1, contents.size(), out) == contents.size();
+    }
+}
+
+CompileCache::CompileCache() {
+    const char *dir = getenv("COMPILER_CACHE_DIR");
+    if (dir != nullptr && *dir != '\0') {
+        m_dir = dir;
+        if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+            m_dir.clear();
+        }
+    }
+}
+
+CompileCache::~CompileCache() {
+}
+
+std::string CompileCache::get_key(const char *filename, const std::vector<std::string> &options,
+                                  const std::vector<std::string> &file_options) const {
+    Hash hash = get_compiler_hash();
+    std::string contents;
+    if (!read_file(filename, contents)) {
+        return "";
+    }
+    hash.add(contents);
+    for (auto i = options.begin(); i != options.end(); i++) {
+        hash.add(*i);
+    }
+    for (auto i = file_options.begin(); i != file_options.end(); i++) {
+        contents.clear();
+        if (!read_file(i->c_str(), contents)) {
+            return "";
+        }
+        hash.add(contents);
+    }
+    return hash.get_hex();
+}
+
+std::string CompileCache::get_key(const std::string &data, const std::vector<std::string> &options) const {
+    Hash hash = get_compiler_hash();
+    hash.add(data);
+    for (auto i = options.begin(); i != options.end(); i++) {
+        hash.add(*i);
+    }
+    return hash.get_hex();
+}
+
+bool CompileCache::fetch(const std::string &key, FILE *out) const {
+    return copy_file(get_entry_filename(key).c_str(), out);
+}
+
+std::string CompileCache::find(const std::string &key) const {
+    std::string filename = get_entry_filename(key);
+    return (access(filename.c_str(), R_OK) == 0) ? filename : std::string();
+}
+
+std::string CompileCache::get_temp_filename(const std::string &key) const {
+    // (unique to the process, and to the compilation within it)
+    static std::atomic<unsigned> next_temp(0);
+    return get_entry_filename(key) + ".tmp." + std::to_string(long(getpid())) + "." + std::to_string(next_temp++);
+}
+
+bool CompileCache::store(const std::string &key, const std::string &temp_filename, FILE *out) const {
+    bool copied = (out == nullptr) || copy_file(temp_filename.c_str(), out);
+    if (!copied || rename(temp_filename.c_str(), get_entry_filename(key).c_str()) != 0) {
+        remove(temp_filename.c_str());
+    }
+    return copied;
+}
+
+std::string CompileCache::get_entry_filename(const std::string &key) const {
+    return m_dir + "/" + key;
+}
@@ -0,0 +1,68 @@
+#ifndef COMPILE_CACHE_H
+#define COMPILE_CACHE_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// An on-disk cache of the code generated for source files, in the directory
+// named by $COMPILER_CACHE_DIR (the cache is disabled if it isn't set).
+//
+// An entry is keyed by a 128-bit hash of the bytes of the source file, the
+// identity of the compiler (its version, and the size and modification time
+// of its executable, so that rebuilding the compiler invalidates the cache)
+// and the options which affect the code generated, and holds the assembly
+// code (or object file) the compilation wrote.  Entries are written to a
+// temporary file which is then renamed, so compilations running at the same
+// time (in this process or others) never see a partly written entry.  Any
+// error reading or writing the cache just means the file is compiled.
+//
+// The cache also holds the optimized code of each function of a program
+// (see the incremental optimization option), keyed by a hash of the
+// function's code before it is optimized, so that after a file is edited,
+// only the functions whose code changed are optimized again.
+class CompileCache {
+public:
+    static const char *VERSION;
+
+private:
+    std::string m_dir;
+
+public:
+    // the cache in the directory named by $COMPILER_CACHE_DIR
+    CompileCache();
+    ~CompileCache();
+
+    bool is_enabled() const { return !m_dir.empty(); }
+
+    // the key of compiling the file with the given options (the contents
+    // of the files named by file_options are part of the key too), or ""
+    // if the file can't be read
+    std::string get_key(const char *filename, const std::vector<std::string> &options,
+                        const std::vector<std::string> &file_options) const;
+
+    // the key of some data (such as the code of a function), and the
+    // options it's compiled with
+    std::string get_key(const std::string &data, const std::vector<std::string> &options) const;
+
+    // copy the entry for the key to out, if there is one
+    bool fetch(const std::string &key, FILE *out) const;
+
+    // the name of the file of the entry for the key, or "" if there isn't
+    // one (the file is replaced, rather than changed, if the entry is
+    // stored again)
+    std::string find(const std::string &key) const;
+
+    // the name of a file the output of a compilation can be written to
+    // before it's stored
+    std::string get_temp_filename(const std::string &key) const;
+
+    // make the file written by a compilation the entry for the key, copying
+    // it to out if it isn't null (returns false if it couldn't be copied)
+    bool store(const std::string &key, const std::string &temp_filename, FILE *out) const;
+
+private:
+    std::string get_entry_filename(const std::string &key) const;
+};
+
+#endif // COMPILE_CACHE_H
@@ -0,0 +1,185 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include "util.h"
+#include "node.h"
+#include "cfg.h"
+#include "context.h"
+#include "stats.h"
+#include "compiler_api.h"
+
+extern "C" {
+struct Node *parse_program_text(const char *text, size_t len, const char *filename);
+}
+
+namespace {
+    // a fatal error while compiling (thrown by the handler set for the
+    // compilation, see err_set_handler)
+    struct Error {
+        std::string message;
+    };
+
+    void throw_error(const char *msg) {
+        throw Error{ msg };
+    }
+
+    // (restores the handler of fatal errors the thread had before)
+    struct HandlerGuard {
+        void (*saved)(const char *msg);
+        ~HandlerGuard() { err_set_handler(saved); }
+    };
+
+    // (the context is destroyed even if the compilation fails, freeing the
+    // thread's AST and IR, as in the compile server)
+    struct ContextGuard {
+        struct Context *ctx;
+        ~ContextGuard() { context_destroy(ctx); }
+    };
+
+    // a copy of s allocated with malloc (null if it can't be allocated)
+    char *copy_string(const std::string &s) {
+        char *copy = static_cast<char *>(malloc(s.size() + 1));
+        if (copy != nullptr) {
+            memcpy(copy, s.c_str(), s.size() + 1);
+        }
+        return copy;
+    }
+
+    // is s a nonempty string of digits?
+    bool is_number(const std::string &s) {
+        return !s.empty() && s.find_first_not_of("0123456789") == std::string::npos;
+    }
+
+    // add the diagnostic for the message of a fatal error, which is
+    // "<filename>:<line>:<col>: Error: <message>" if it has a position
+    void add_diagnostic(CompilerResult *result, std::string text) {
+        while (!text.empty() && text.back() == '\n') {
+            text.pop_back();
+        }
+        CompilerDiagnostic diag = CompilerDiagnostic();
+        std::string filename, message = text;
+        size_t end = text.find(": Error: ");
+        size_t col_start = (end == std::string::npos) ? end : text.rfind(':', end - 1);
+        size_t line_start = (col_start == std::string::npos || col_start == 0)
+            ? std::string::npos : text.rfind(':', col_start - 1);
+        if (line_start != std::string::npos
+                && is_number(text.substr(line_start + 1, col_start - line_start - 1))
+                && is_number(text.substr(col_start + 1, end - col_start - 1))) {
+            filename = text.substr(0, line_start);
+            diag.line = atoi(text.c_str() + line_start + 1);
+            diag.col = atoi(text.c_str() + col_start + 1);
+            message = text.substr(end + 9);
+        }
+
+        auto *diagnostics = static_cast<CompilerDiagnostic *>(
+                realloc(result->diagnostics, (result->num_diagnostics + 1) * sizeof(CompilerDiagnostic)));
+        if (diagnostics == nullptr) {
+            return;
+        }
+        diag.filename = (line_start != std::string::npos) ? copy_string(filename) : nullptr;
+        diag.message = copy_string(message);
+        diagnostics[result->num_diagnostics++] = diag;
+        result->diagnostics = diagnostics;
+    }
+
+    // compile the request's source, writing the code to out
+    void compile(const CompilerRequest *request, const char *filename, FILE *out) {
+        Statistics &stats = Statistics::get();
+        stats.clear();
+        stats.set_enabled(false);
+
+        // (the nodes of an AST which failed to parse are freed here, since
+        // there is no context yet)
+        struct Node *program;
+        try {
+            program = parse_program_text(request->source, request->source_len, filename);
+        } catch (...) {
+            NodeArena::release();
+            throw;
+        }
+
+        ContextGuard guard = { context_create(program) };
+        struct Context *ctx = guard.ctx;
+        if (request->output_kind == COMPILER_OUTPUT_OBJECT) {
+            context_set_object_output(ctx, out);
+        } else {
+            context_set_output(ctx, out);
+        }
+        if (request->use_runtime) {
+            context_set_flag(ctx, 'r');
+        }
+        context_set_num_threads(ctx, request->num_threads > 0 ? request->num_threads : 1);
+        for (unsigned i = 0; i < request->num_options; i++) {
+            context_set_option(ctx, request->options[i]);
+        }
+        if (request->optimize) {
+            context_set_flag(ctx, 'o');
+        }
+        context_set_flag(ctx, 'c');
+
+        context_build_symtab(ctx);
+        context_gen_code(ctx);
+    }
+}
+
+int compiler_compile(const CompilerRequest *request, CompilerResult *result) {
+    result->code = nullptr;
+    result->code_len = 0;
+    result->diagnostics = nullptr;
+    result->num_diagnostics = 0;
+    if (request->output_kind != COMPILER_OUTPUT_ASM && request->output_kind != COMPILER_OUTPUT_OBJECT) {
+        add_diagnostic(result, "Unknown output kind\n");
+        return 1;
+    }
+
+    // (the filename is kept until the AST, whose source positions refer
+    // to it, is freed with the context)
+    std::string filename = (request->filename != nullptr) ? request->filename : "<input>";
+    char *code = nullptr;
+    size_t code_len = 0;
+    FILE *out = open_memstream(&code, &code_len);
+    if (out == nullptr) {
+        add_diagnostic(result, "Could not allocate the output\n");
+        return 1;
+    }
+
+    std::string error;
+    {
+        HandlerGuard handler_guard = { err_get_handler() };
+        err_set_handler(throw_error);
+        try {
+            compile(request, filename.c_str(), out);
+        } catch (const Error &e) {
+            error = e.message;
+        } catch (const std::bad_alloc &) {
+            error = "Out of memory\n";
+        }
+    }
+    if (fclose(out) != 0 && error.empty()) {
+        error = "Error writing output\n";
+    }
+
+    if (!error.empty()) {
+        free(code);
+        add_diagnostic(result, error);
+        return 1;
+    }
+    result->code = code;
+    result->code_len = code_len;
+    return 0;
+}
+
+void compiler_free_result(CompilerResult *result) {
+    free(result->code);
+    for (unsigned i = 0; i < result->num_diagnostics; i++) {
+        free(const_cast<char *>(result->diagnostics[i].filename));
+        free(const_cast<char *>(result->diagnostics[i].message));
+    }
+    free(result->diagnostics);
+    result->code = nullptr;
+    result->code_len = 0;
+    result->diagnostics = nullptr;
+    result->num_diagnostics = 0;
+}
@@ -0,0 +1,76 @@
+#ifndef COMPILER_API_H
+#define COMPILER_API_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The compiler as a library (libcompiler.a), for programs which compile
+// source held in memory without starting a compiler process: the code is
+// returned in a buffer rather than written to a file, and the errors as
+// diagnostics rather than printed (a fatal error, see err_fatal, ends the
+// compilation rather than the process).
+//
+// Any number of compilations can run at once, on different threads: all of
+// the state of a compilation is either in its Context or thread-local (see
+// IRArena and NodeArena), including the handler of its fatal errors.
+
+enum CompilerOutputKind {
+  COMPILER_OUTPUT_ASM,
+  COMPILER_OUTPUT_OBJECT,
+};
+
+// what to compile, and how
+struct CompilerRequest {
+  // the source of a program (or unit), which needn't end with a NUL
+  const char *source;
+  size_t source_len;
+  // the name of the source in the diagnostics (by default "<input>"); the
+  // interfaces of the units it uses are read from its directory, as are
+  // written the interfaces of a unit (see unit_interface.h)
+  const char *filename;
+  // assembly code, or an ELF object file
+  int output_kind;
+  // optimize the code (as -o), and the optimization options, as given with
+  // -O (see context_set_option: "level=3", "size", "bounds-check", ...)
+  int optimize;
+  const char *const *options;
+  unsigned num_options;
+  // use the buffered I/O runtime for READ and WRITE (as -r)
+  int use_runtime;
+  // the number of threads compiling the program's functions (0 is 1)
+  unsigned num_threads;
+};
+
+// an error, at a position in the source (a null filename, and 0 for line
+// and col, if it has none, such as an unknown option)
+struct CompilerDiagnostic {
+  const char *filename;
+  int line, col;
+  const char *message;
+};
+
+// the result of a compilation, owned by the caller (see compiler_free_result)
+struct CompilerResult {
+  // the code (null if it failed), allocated with malloc; the assembly code
+  // is followed by a NUL, which isn't included in code_len
+  char *code;
+  size_t code_len;
+  struct CompilerDiagnostic *diagnostics;
+  unsigned num_diagnostics;
+};
+
+// Compile the source of a request into result, returning 0 if it was
+// compiled, or nonzero if it wasn't (result then has the diagnostics).
+int compiler_compile(const struct CompilerRequest *request, struct CompilerResult *result);
+
+// Free the code and diagnostics of a result (leaving it empty).
+void compiler_free_result(struct CompilerResult *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COMPILER_API_H
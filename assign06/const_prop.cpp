@@ -0,0 +1,429 @@
+#include <cassert>
+#include <climits>
+#include <deque>
+#include "cfg.h"
+#include "highlevel.h"
+#include "ssa.h"
+#include "stats.h"
+#include "const_prop.h"
+
+////////////////////////////////////////////////////////////////////////
+// ConstantPropagation implementation
+////////////////////////////////////////////////////////////////////////
+
+ConstantPropagation::ConstantPropagation(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_prune(false) {
+    analyze();
+}
+
+ConstantPropagation::~ConstantPropagation() {
+}
+
+InstructionSequence *ConstantPropagation::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+
+    // constants known at the beginning of the block
+    ConstMap consts = m_beginfacts[bb->get_id()].consts;
+
+    // if the block ends in a branch whose outcome is known, the comparison
+    // and the branch are replaced by an unconditional jump (if taken) or
+    // nothing (if not taken)
+    Instruction *branch = nullptr;
+    bool taken = false;
+    if (m_prune && bb->get_length() > 0) {
+        auto i = m_resolved_branches.find(bb->get_last());
+        if (i != m_resolved_branches.end()) {
+            branch = i->first;
+            taken = i->second;
+        }
+    }
+
+    // phis which are known to be constant become constant loads
+    // following the remaining phis
+    std::vector<Instruction *> phi_consts;
+
+    unsigned num_ins = bb->get_length();
+    for (unsigned i = 0; i < num_ins; i++) {
+        Instruction *ins = bb->get_instruction(i);
+
+        if (SSA::is_phi(ins)) {
+            model_phi(bb, ins, consts);
+            Operand dest = ins->get_operand(0);
+            auto k = consts.find(dest.get_base_reg());
+            if (k != consts.end()) {
+                phi_consts.push_back(new Instruction(HINS_LOAD_ICONST, dest, Operand(OPERAND_INT_LITERAL, k->second)));
+                continue;
+            }
+
+            // keep only the operands for incoming edges which are kept
+            std::vector<Operand> operands;
+            operands.push_back(dest);
+            std::vector<BasicBlock *> preds = SSA::get_predecessors(get_orig_cfg(), bb);
+            for (unsigned j = 0; j < preds.size(); j++) {
+                if (m_prune && !is_executable(preds[j], bb)) {
+                    continue;
+                }
+                Operand arg = ins->get_operand(j + 1);
+                long val;
+                if (arg.get_kind() == OPERAND_VREG && get_const_value(arg, m_beginfacts[preds[j]->get_id()].end_consts, val)) {
+                    arg = Operand(OPERAND_INT_LITERAL, val);
+                }
+                operands.push_back(arg);
+            }
+            out->add_instruction(new Instruction(HINS_PHI, operands));
+            continue;
+        }
+
+        for (auto j = phi_consts.begin(); j != phi_consts.end(); j++) {
+            out->add_instruction(*j);
+        }
+        phi_consts.clear();
+
+        if (branch != nullptr && i + 2 >= num_ins) {
+            if (ins == branch) {
+                Statistics::get().add("constprop.branches");
+                if (taken) {
+                    out->add_instruction(new Instruction(HINS_JUMP, ins->get_operand(0)));
+                }
+            }
+            continue;
+        }
+
+        Instruction *hin = ins->duplicate();
+
+        // replace uses of constant vregs with literals
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            Operand operand = ins->get_operand(j);
+            long val;
+            if (HighLevel::is_use(ins, j) && operand.get_kind() == OPERAND_VREG
+                    && get_const_value(operand, consts, val)) {
+                (*hin)[j] = Operand(OPERAND_INT_LITERAL, val);
+                Statistics::get().add("constprop.operands");
+            }
+        }
+
+        model_instruction(ins, consts);
+
+        // a def computing a known constant becomes a constant load
+        if (HighLevel::is_def(ins) && ins->get_opcode() != HINS_LOAD_ICONST) {
+            Operand dest = ins->get_operand(0);
+            auto k = consts.find(dest.get_base_reg());
+            if (k != consts.end()) {
+                delete hin;
+                hin = new Instruction(HINS_LOAD_ICONST, dest, Operand(OPERAND_INT_LITERAL, k->second));
+                Statistics::get().add("constprop.folded");
+            }
+        }
+
+        out->add_instruction(hin);
+    }
+
+    for (auto j = phi_consts.begin(); j != phi_consts.end(); j++) {
+        out->add_instruction(*j);
+    }
+
+    // don't leave a (possibly labeled) basic block without instructions
+    if (out->get_length() == 0 && num_ins > 0) {
+        out->add_instruction(new Instruction(HINS_NOP));
+    }
+
+    return out;
+}
+
+bool ConstantPropagation::keep_basic_block(BasicBlock *orig) {
+    bool keep = !m_prune || m_beginfacts[orig->get_id()].reachable;
+    if (!keep) {
+        Statistics::get().add("constprop.blocks-removed");
+    }
+    return keep;
+}
+
+bool ConstantPropagation::keep_edge(Edge *orig) {
+    return !m_prune || m_executable.count(orig) > 0;
+}
+
+bool ConstantPropagation::get_const_value(const Operand &operand, const ConstMap &consts, long &val) {
+    if (operand.get_kind() == OPERAND_INT_LITERAL) {
+        val = operand.get_int_value();
+        return true;
+    }
+    if (operand.get_kind() == OPERAND_VREG) {
+        auto i = consts.find(operand.get_base_reg());
+        if (i != consts.end()) {
+            val = i->second;
+            return true;
+        }
+    }
+    // memory references (and everything else) are not constant
+    return false;
+}
+
+bool ConstantPropagation::fold(int opcode, long lval, long rval, long &result) {
+    // do the arithmetic on unsigned values so that overflow wraps around
+    // (the same way it does in the generated code)
+    unsigned long l = (unsigned long) lval, r = (unsigned long) rval;
+
+    switch (opcode) {
+        case HINS_INT_ADD:
+            result = long(l + r);
+            return true;
+        case HINS_INT_SUB:
+            result = long(l - r);
+            return true;
+        case HINS_INT_MUL:
+            result = long(l * r);
+            return true;
+        case HINS_INT_DIV:
+        case HINS_INT_MOD:
+            // these would trap at runtime, so leave them alone
+            if (rval == 0 || (rval == -1 && lval == LONG_MIN)) {
+                return false;
+            }
+            result = (opcode == HINS_INT_DIV) ? lval / rval : lval % rval;
+            return true;
+        case HINS_UINT_DIV:
+        case HINS_UINT_MOD:
+            if (rval == 0) {
+                return false;
+            }
+            result = long((opcode == HINS_UINT_DIV) ? (unsigned long) lval / (unsigned long) rval
+                                                     : (unsigned long) lval % (unsigned long) rval);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool ConstantPropagation::eval_branch(int opcode, long lval, long rval) {
+    switch (opcode) {
+        case HINS_JE:   return lval == rval;
+        case HINS_JNE:  return lval != rval;
+        case HINS_JLT:  return lval < rval;
+        case HINS_JLTE: return lval <= rval;
+        case HINS_JGT:  return lval > rval;
+        case HINS_JGTE: return lval >= rval;
+        default:
+            assert(false);
+            return false;
+    }
+}
+
+void ConstantPropagation::analyze() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    unsigned num_blocks = cfg->get_num_blocks();
+
+    m_beginfacts.assign(num_blocks, Fact{ false, ConstMap(), ConstMap() });
+
+    // nothing is known about any vreg at the beginning of the program
+    BasicBlock *entry = cfg->get_entry_block();
+    m_beginfacts[entry->get_id()].reachable = true;
+
+    std::deque<unsigned> work_list;
+    std::vector<bool> on_work_list(num_blocks, false);
+    work_list.push_back(entry->get_id());
+    on_work_list[entry->get_id()] = true;
+
+    while (!work_list.empty()) {
+        unsigned id = work_list.front();
+        work_list.pop_front();
+        on_work_list[id] = false;
+
+        BasicBlock *bb = cfg->get_block(id);
+
+        ConstMap consts = m_beginfacts[id].consts;
+        model_block(bb, consts);
+
+        // the values of phis in successors depend on the end fact
+        bool end_change = consts != m_beginfacts[id].end_consts;
+        m_beginfacts[id].end_consts = consts;
+
+        bool taken = false;
+        bool resolved = resolve_branch(bb, consts, taken);
+
+        // propagate to the successors reached by executable edges
+        const ControlFlowGraph::EdgeList &outgoing_edges = cfg->get_outgoing_edges(bb);
+        for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+            Edge *e = *i;
+            if (resolved && (e->get_kind() == EDGE_BRANCH) != taken) {
+                continue;
+            }
+            bool new_edge = m_executable.insert(e).second;
+
+            unsigned succ_id = e->get_target()->get_id();
+            Fact &succ = m_beginfacts[succ_id];
+            bool change = end_change || new_edge;
+            if (!succ.reachable) {
+                succ.reachable = true;
+                succ.consts = consts;
+            } else {
+                // the meet can only remove constants
+                size_t before = succ.consts.size();
+                meet(succ.consts, consts);
+                change = change || succ.consts.size() != before;
+            }
+
+            if (change && !on_work_list[succ_id]) {
+                on_work_list[succ_id] = true;
+                work_list.push_back(succ_id);
+            }
+        }
+    }
+
+    // Known facts only ever lose constants, so a branch outcome can't change
+    // (although a branch can become unresolved): determine the final outcomes.
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        if (!m_beginfacts[bb->get_id()].reachable) {
+            continue;
+        }
+        ConstMap consts = m_beginfacts[bb->get_id()].consts;
+        model_block(bb, consts);
+        bool taken = false;
+        if (resolve_branch(bb, consts, taken)) {
+            m_resolved_branches[bb->get_last()] = taken;
+        }
+    }
+
+    // Removing the edges into the exit block would leave the CFG
+    // without a path to the end of the program.
+    m_prune = m_beginfacts[cfg->get_exit_block()->get_id()].reachable;
+}
+
+void ConstantPropagation::model_instruction(Instruction *ins, ConstMap &consts) const {
+    if (!HighLevel::is_def(ins)) {
+        return;
+    }
+
+    int dest = ins->get_operand(0).get_base_reg();
+    int opcode = ins->get_opcode();
+    long lval, rval, result;
+    bool is_const = false;
+
+    switch (opcode) {
+        case HINS_LOAD_ICONST:
+            result = ins->get_operand(1).get_int_value();
+            is_const = true;
+            break;
+
+        case HINS_MOV:
+            is_const = get_const_value(ins->get_operand(1), consts, result);
+            break;
+
+        case HINS_INT_NEGATE:
+            if (get_const_value(ins->get_operand(1), consts, lval)) {
+                result = long(0UL - (unsigned long) lval);
+                is_const = true;
+            }
+            break;
+
+        case HINS_INT_ADD:
+        case HINS_INT_SUB:
+        case HINS_INT_MUL:
+        case HINS_INT_DIV:
+        case HINS_INT_MOD:
+        case HINS_UINT_DIV:
+        case HINS_UINT_MOD:
+            is_const = get_const_value(ins->get_operand(1), consts, lval)
+                       && get_const_value(ins->get_operand(2), consts, rval)
+                       && fold(opcode, lval, rval, result);
+            break;
+
+        default:
+            // loads, local addresses, reads: not constant
+            break;
+    }
+
+    if (is_const) {
+        consts[dest] = result;
+    } else {
+        consts.erase(dest);
+    }
+}
+
+void ConstantPropagation::model_phi(BasicBlock *bb, Instruction *phi, ConstMap &consts) const {
+    // the phi's value is the value of the operand for the incoming edge
+    // by which control arrives: it is constant only if all of the operands
+    // for executable edges are the same constant
+    ControlFlowGraph *cfg = get_orig_cfg();
+    std::vector<BasicBlock *> preds = SSA::get_predecessors(cfg, bb);
+
+    int dest = phi->get_operand(0).get_base_reg();
+    bool is_const = false;
+    long result = 0;
+    for (unsigned j = 0; j < preds.size(); j++) {
+        if (!is_executable(preds[j], bb)) {
+            continue;
+        }
+        long val;
+        if (!get_const_value(phi->get_operand(j + 1), m_beginfacts[preds[j]->get_id()].end_consts, val)
+                || (is_const && val != result)) {
+            consts.erase(dest);
+            return;
+        }
+        is_const = true;
+        result = val;
+    }
+
+    if (is_const) {
+        consts[dest] = result;
+    } else {
+        consts.erase(dest);
+    }
+}
+
+void ConstantPropagation::model_block(BasicBlock *bb, ConstMap &consts) const {
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        if (SSA::is_phi(*i)) {
+            model_phi(bb, *i, consts);
+        } else {
+            model_instruction(*i, consts);
+        }
+    }
+}
+
+bool ConstantPropagation::is_executable(BasicBlock *pred, BasicBlock *bb) const {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    Edge *e = cfg->lookup_edge(pred, bb);
+    return e != nullptr && m_executable.count(e) > 0;
+}
+
+bool ConstantPropagation::resolve_branch(BasicBlock *bb, const ConstMap &consts, bool &taken) const {
+    // the high-level code generator always emits the comparison
+    // immediately before the conditional branch
+    unsigned num_ins = bb->get_length();
+    if (num_ins < 2) {
+        return false;
+    }
+    Instruction *branch = bb->get_instruction(num_ins - 1);
+    Instruction *compare = bb->get_instruction(num_ins - 2);
+    if (!is_conditional_branch(branch->get_opcode()) || compare->get_opcode() != HINS_INT_COMPARE) {
+        return false;
+    }
+
+    long lval, rval;
+    if (!get_const_value(compare->get_operand(0), consts, lval)
+            || !get_const_value(compare->get_operand(1), consts, rval)) {
+        return false;
+    }
+
+    taken = eval_branch(branch->get_opcode(), lval, rval);
+    return true;
+}
+
+bool ConstantPropagation::is_conditional_branch(int opcode) {
+    return HighLevel::has_flags(opcode, HOP_BRANCH);
+}
+
+void ConstantPropagation::meet(ConstMap &fact, const ConstMap &other) {
+    // a vreg is constant only if it has the same constant value in both facts
+    for (auto i = fact.begin(); i != fact.end(); ) {
+        auto j = other.find(i->first);
+        if (j == other.end() || j->second != i->second) {
+            i = fact.erase(i);
+        } else {
+            i++;
+        }
+    }
+}
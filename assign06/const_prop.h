@@ -0,0 +1,82 @@
+#ifndef CONST_PROP_H
+#define CONST_PROP_H
+
+#include <map>
+#include <set>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+
+// Global conditional constant propagation over the high-level CFG.
+//
+// This is a forward dataflow analysis in which the fact at each point
+// is the set of vregs known to hold a constant value, computed only over
+// the CFG edges that can actually execute.  Branches whose comparison
+// has constant operands only make the taken edge executable, so code that
+// is only reachable through an untaken edge never contributes facts.
+//
+// The transformation
+//   - replaces uses of constant vregs with integer literals,
+//   - folds HINS_INT_ADD/SUB/MUL/DIV/MOD/NEGATE and HINS_MOV of constants
+//     into HINS_LOAD_ICONST,
+//   - turns branches with a known outcome into HINS_JUMP (or removes them),
+//   - removes unreachable basic blocks.
+//
+// The CFG may be in SSA form: a phi is constant if the operands for all of
+// its executable incoming edges have the same constant value, and operands for
+// incoming edges which are removed are removed from the phi.
+class ConstantPropagation : public ControlFlowGraphTransform {
+public:
+    // map of vreg numbers to constant values
+    typedef std::map<int, long> ConstMap;
+
+private:
+    struct Fact {
+        bool reachable;
+        ConstMap consts;      // at the beginning of the block
+        ConstMap end_consts;  // at the end of the block
+    };
+
+    // facts for each basic block (indexed by block id)
+    std::vector<Fact> m_beginfacts;
+    // executable edges
+    std::set<Edge *> m_executable;
+    // conditional branches with a known outcome (true if taken)
+    std::map<Instruction *, bool> m_resolved_branches;
+    // false if the exit block was found to be unreachable, in which case
+    // no branches are resolved and no blocks are removed
+    bool m_prune;
+
+public:
+    ConstantPropagation(ControlFlowGraph *cfg);
+    virtual ~ConstantPropagation();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+    virtual bool is_block_local() const { return true; }
+    virtual bool keep_basic_block(BasicBlock *orig);
+    virtual bool keep_edge(Edge *orig);
+
+    // evaluate an operand: returns true (and sets val) if the operand
+    // is an integer literal or a vreg with a known constant value
+    static bool get_const_value(const Operand &operand, const ConstMap &consts, long &val);
+
+    // fold an arithmetic instruction whose operands are constants:
+    // returns false if the result can't be computed (e.g., division by 0)
+    static bool fold(int opcode, long lval, long rval, long &result);
+
+    // evaluate the condition of a conditional branch given the
+    // values compared by the preceding HINS_INT_COMPARE
+    static bool eval_branch(int opcode, long lval, long rval);
+
+private:
+    void analyze();
+    void model_instruction(Instruction *ins, ConstMap &consts) const;
+    void model_phi(BasicBlock *bb, Instruction *phi, ConstMap &consts) const;
+    void model_block(BasicBlock *bb, ConstMap &consts) const;
+    bool is_executable(BasicBlock *pred, BasicBlock *bb) const;
+    bool resolve_branch(BasicBlock *bb, const ConstMap &consts, bool &taken) const;
+    static bool is_conditional_branch(int opcode);
+    static void meet(ConstMap &fact, const ConstMap &other);
+};
+
+#endif // CONST_PROP_H
@@ -1,11 +1,19 @@
 #include <cassert>
+#include <climits>
+#include <algorithm>
 #include <cstdio>
 #include <cstdarg>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <string>
 #include <map>
+#include <memory>
 #include <set>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include "util.h"
 #include "cpputil.h"
 #include "node.h"
@@ -14,44 +22,314 @@
 #include "symtab.h"
 #include "ast.h"
 #include "astvisitor.h"
+#include "ast_simplify.h"
 #include "context.h"
 #include "cfg.h"
 #include "highlevel.h"
 #include "x86_64.h"
+#include "target.h"
+#include "lowering.h"
+#include "aarch64_lowering.h"
 #include "cfg_transform.h"
 #include "live_vregs.h"
+#include "reg_alloc.h"
+#include "const_prop.h"
+#include "ssa.h"
+#include "licm.h"
+#include "strength_reduction.h"
+#include "peephole.h"
+#include "jump_table.h"
+#include "instruction_selection.h"
+#include "x86_64_encoder.h"
+#include "elf_writer.h"
+#include "output.h"
+#include "stack_slots.h"
+#include "highlevel_io.h"
+#include "jit.h"
+#include "interp.h"
+#include "storage_layout.h"
+#include "unroll.h"
+#include "prefetch.h"
+#include "inline.h"
+#include "ipcp.h"
+#include "pass_manager.h"
+#include "compile_cache.h"
+#include "phase_report.h"
+#include "cfg_dot.h"
+#include "profile.h"
+#include "stats.h"
+#include "unit_interface.h"
+
+extern "C" {
+struct Node *parse_program_streaming(const char *filename, int lexer_thread,
+                                     void (*begin)(void *data, struct Node *declarations),
+                                     void (*statement)(void *data, struct Node *statement),
+                                     void *data);
+}
 
 ////////////////////////////////////////////////////////////////////////
 // Classes
 ////////////////////////////////////////////////////////////////////////
 
+struct FunctionCode;
+
 struct Context {
 private:
     Node *root;
     SymbolTable *global;
+    // the array and record types of the program
+    TypeContext types;
+    // the unit compiled (if it isn't a program), and the units it uses
+    UnitInterfaces units;
     bool flag_print_symtab;
     bool flag_print_hins;
     bool flag_optimize;
     bool flag_compile;
+    bool flag_time_report;
+    bool flag_runtime;
+    // inline calls of the subprograms (when optimizing, see inline.h)
+    bool flag_inline;
+    // propagate constant arguments into the subprograms, and specialize
+    // them (when optimizing, see ipcp.h)
+    bool flag_ipcp;
+    // optimize for size (-Os): run the passes of get_size_pipeline, and
+    // inline and specialize the subprograms only where the code gets smaller
+    bool flag_optimize_size;
+    // print the size of each function's code (see print_size_report)
+    bool flag_size_report;
+    // place the code which the profile shows was never executed after the
+    // epilogue of its function, in .text.unlikely (see HINS_COLD)
+    bool flag_split_cold;
+    // check the index of each array element referenced (-fbounds-check)
+    bool flag_bounds_check;
+    // the machine the code is generated for (-ftarget=), and the x86-64
+    // processor (-march= and -mtune=)
+    Target target;
+    X86_64Cpu cpu;
+    // reuse the optimized code of the functions which are unchanged since
+    // they were last compiled, from the compile cache (see compile_cache.h)
+    bool flag_incremental;
+    // comment the assembly code with the high-level code it's translated
+    // from (1) or not (0); by default (-1), only when not optimizing
+    int asm_comments;
+    // build the symbol table while generating the high-level code
+    bool flag_one_pass;
+    // scan the source file on its own thread (with source_file)
+    bool flag_lexer_thread;
+    // the number of threads compiling the program's functions
+    unsigned num_threads;
+    // the optimization level, and the passes, unroll factor and per-function
+    // time budget (in milliseconds), which come from the level unless they
+    // are given (see resolve_level)
+    unsigned opt_level;
+    std::string pass_spec;
+    unsigned unroll_factor;
+    long prefetch_distance;
+    double time_budget_ms;
+    // if non-empty, write an object file rather than printing assembly
+    std::string object_file;
+    // if non-empty, write the assembly code to this file rather than stdout
+    std::string asm_file;
+    // if non-null (and there is no asm_file), print the assembly code
+    // to this stream rather than stdout (or write the object file to it,
+    // with object_output)
+    FILE *output;
+    bool object_output;
+    // if non-null, the end of each phase is recorded here
+    PhaseReport *phase_report;
+    // if non-empty, instrument the code to write a profile to this file
+    // (without optimizing it), or read a profile from this file to guide
+    // the optimizations (see profile.h)
+    std::string profile_generate;
+    std::string profile_use;
+    // if non-empty, write the high-level code to this file (rather than
+    // compiling it), or read it from this file (rather than generating it
+    // from the AST)
+    std::string hir_output;
+    std::string hir_input;
+    // if non-empty, write the high-level CFGs of the functions (after
+    // optimization) to this file as a Graphviz graph (see cfg_dot.h)
+    std::string cfg_dot_output;
+    // if non-empty, the program is parsed from this file as its code is
+    // generated (see context_set_source_file)
+    std::string source_file;
+    // load the code into memory to be run in this process (see -run),
+    // rather than printing it; jit_program is the loaded program
+    bool flag_run;
+    std::unique_ptr<JitProgram> jit_program;
+    // interpret the high-level code when it is run (see -interp), rather
+    // than printing it, and print the counts of the instructions and
+    // blocks executed; interpreter has the program's code
+    bool flag_interpret;
+    bool flag_print_counts;
+    std::unique_ptr<HighLevelInterpreter> interpreter;
 
 public:
   Context(struct Node *ast);
   ~Context();
 
   void set_flag(char flag);
+  void set_option(const char *option);
+  void set_object_file(const char *filename);
+  void set_asm_file(const char *filename);
+  void set_output(FILE *out);
+  void set_object_output(FILE *out);
+  void set_phase_report(PhaseReport *report);
+  void set_num_threads(unsigned n);
+  void set_hir_output(const char *filename);
+  void set_hir_input(const char *filename);
+  void set_cfg_dot_output(const char *filename);
+  void set_source_file(const char *filename);
 
   void build_symtab();
   void print_err(Node* node, const char *fmt, ...);
 
   void gen_code();
+  // fill in the optimization options not given from the level
+  void resolve_level();
+  int run_program();
+
+private:
+  void end_phase(const char *name);
+  // note whether the file is a unit (once its AST is known), and check
+  // that a unit, or a program using units, is compiled rather than run
+  void find_unit();
+  void check_units() const;
+  void write_hir(const std::vector<FunctionCode> &functions, const std::vector<StorageLayout *> &layouts);
+  void read_hir(std::vector<FunctionCode> &functions, std::vector<StorageLayout *> &layouts);
+  void write_cfg_dot(const std::vector<FunctionCode> &functions, const std::vector<ControlFlowGraph *> &cfgs);
+  std::string get_function_key(const CompileCache &cache, const FunctionCode &function, const ControlFlowGraph *cfg,
+                               const StorageLayout *layout) const;
+  bool fetch_function(const CompileCache &cache, const std::string &key, FunctionCode &function,
+                      InstructionSequence *&iseq, std::map<int, int> &assignment) const;
+  void store_function(const CompileCache &cache, const std::string &key, const FunctionCode &function,
+                      const InstructionSequence *iseq, const std::map<int, int> &assignment) const;
 };
 
+// is a node a binary arithmetic operation?
+static bool is_arithmetic(struct Node *ast) {
+    int tag = node_get_tag(ast);
+    return tag == AST_ADD || tag == AST_SUBTRACT || tag == AST_MULTIPLY
+        || tag == AST_DIVIDE || tag == AST_MODULUS;
+}
+
 class SymbolTableBuilder : public ASTVisitor {
 private:
     SymbolTable* scope;
+    TypeContext* types;
     Type* integer_type;
     Type* char_type;
+    Atom integer_name;
+    Atom char_name;
     long curr_offset = 0;
+    // the scope of the subprogram being visited (null in the main program)
+    SymbolTable* subprogram_scope = nullptr;
+    // the unit compiled (if it is one), and the units used
+    UnitInterfaces* units;
+
+    // is a name defined, so that it can't be defined again in the current
+    // scope?  (The locals of a subprogram may hide the program's names.)
+    bool is_defined(Atom name) const {
+        return (scope == subprogram_scope) ? scope->defines(name) : scope->s_exists(name);
+    }
+
+    void visit_subprogram(struct Node *ast, bool is_function) {
+        Node* ident = node_get_kid(ast, 0);
+        const char* name = node_get_str(ident);
+        SourceInfo info = node_get_source_info(ident);
+        if (subprogram_scope != nullptr) {
+            err_fatal("%s:%d:%d: Error: Nested subprogram '%s'\n", info.filename, info.line, info.col, name);
+        }
+        SymbolTable* outer = scope;
+        if (outer->s_exists(node_get_atom(ident))) {
+            err_fatal("%s:%d:%d: Error: Name '%s' is already defined\n", info.filename, info.line, info.col, name);
+        }
+
+        // the parameters are the first symbols of the subprogram's scope
+        // (they are passed in registers, so there can only be 6 scalars)
+        subprogram_scope = scope = new SymbolTable(outer);
+        visit(node_get_kid(ast, 1));
+        std::vector<Type*> paramTypes;
+        for (auto i = scope->begin(); i != scope->end(); i++) {
+            if (i->get_type()->realType != PRIMITIVE) {
+                err_fatal("%s:%d:%d: Error: Parameter '%s' of '%s' is not an INTEGER or CHAR\n",
+                          info.filename, info.line, info.col, i->get_name(), name);
+            }
+            paramTypes.push_back(i->get_type());
+        }
+        if (paramTypes.size() > 6) {
+            err_fatal("%s:%d:%d: Error: '%s' has more than 6 parameters\n", info.filename, info.line, info.col, name);
+        }
+
+        Type* resultType = nullptr;
+        int kid = 2;
+        if (is_function) {
+            Node* result = node_get_kid(ast, kid++);
+            visit(result);
+            resultType = result->get_type();
+            if (resultType->realType != PRIMITIVE) {
+                err_fatal("%s:%d:%d: Error: Result of '%s' is not an INTEGER or CHAR\n", info.filename, info.line, info.col, name);
+            }
+        }
+
+        Type* type = types->get_subprogram(scope, paramTypes, resultType);
+        type->unit = units->get_unit();
+        std::unique_ptr<Symbol> sym(symbol_create(name, type, is_function ? FUNCTION : PROCEDURE, get_curr_offset()));
+        outer->insert(*sym);
+        unsigned index;
+        outer->locate(node_get_atom(ident), index);
+        ident->set_symbol(outer, index);
+
+        // (the result of a function is assigned to a variable named after it)
+        if (is_function) {
+            std::unique_ptr<Symbol> result(symbol_create(name, resultType, VARIABLE, get_curr_offset()));
+            incr_curr_offset(resultType->get_size());
+            scope->insert(*result);
+        }
+
+        visit(node_get_kid(ast, kid));
+        visit(node_get_kid(ast, kid + 1));
+
+        scope = outer;
+        subprogram_scope = nullptr;
+    }
+
+    // resolve the name of the subprogram called by ast, and check the arguments
+    const Symbol *visit_call(struct Node *ast, int kind) {
+        recur_on_children(ast);
+
+        Node* ident = node_get_kid(ast, 0);
+        const char* name = node_get_str(ident);
+        SourceInfo info = node_get_source_info(ident);
+        // (subprograms are defined by the program, and may be hidden by
+        // the result variable of a recursive function)
+        SymbolTable *program_scope = scope;
+        while (program_scope->get_parent() != nullptr) {
+            program_scope = program_scope->get_parent();
+        }
+        unsigned index;
+        SymbolTable *defining_scope = program_scope->locate(node_get_atom(ident), index);
+        if (defining_scope == nullptr || defining_scope->get_symbol(index).get_kind() != kind) {
+            err_fatal("%s:%d:%d: Error: '%s' is not a %s\n", info.filename, info.line, info.col, name,
+                      (kind == FUNCTION) ? "function" : "procedure");
+        }
+        ident->set_symbol(defining_scope, index);
+        const Symbol *sym = &defining_scope->get_symbol(index);
+
+        Node* args = node_get_kid(ast, 1);
+        int num_args = node_get_num_kids(args);
+        if (num_args != int(sym->get_type()->paramTypes.size())) {
+            err_fatal("%s:%d:%d: Error: Wrong number of arguments to '%s'\n", info.filename, info.line, info.col, name);
+        }
+        for (int i = 0; i < num_args; i++) {
+            Type* type = node_get_kid(args, i)->get_type();
+            if (type != nullptr && type->realType != PRIMITIVE) {
+                err_fatal("%s:%d:%d: Error: Argument %d of '%s' is not an INTEGER or CHAR\n",
+                          info.filename, info.line, info.col, i + 1, name);
+            }
+        }
+        return sym;
+    }
 public:
 
     void print_err(Node* node, const char* fmt, ...) {
@@ -79,10 +357,14 @@ public:
         curr_offset += offset;
     }
 
-    SymbolTableBuilder(SymbolTable* symbolTable) {
+    SymbolTableBuilder(SymbolTable* symbolTable, TypeContext* typeContext, UnitInterfaces* unitInterfaces) {
         scope = symbolTable;
-        integer_type = type_create_integer();
-        char_type = type_create_char();
+        types = typeContext;
+        units = unitInterfaces;
+        integer_type = type_get_integer();
+        char_type = type_get_char();
+        integer_name = atom_intern("INTEGER");
+        char_name = atom_intern("CHAR");
     }
 
     void visit_constant_def(struct Node *ast) override {
@@ -109,11 +391,11 @@ public:
 
         // set entry in symtab for name, type
         long offset = get_curr_offset();
-        Symbol* sym = symbol_create(name, type, CONST, offset);
+        std::unique_ptr<Symbol> sym(symbol_create(name, type, CONST, offset));
         sym->set_ival(val);
         incr_curr_offset(type->get_size());
 
-        if (scope->s_exists(name)) {
+        if (is_defined(node_get_atom(left))) {
             SourceInfo info = node_get_source_info(left);
             err_fatal("%s:%d:%d: Error: Name '%s' is already defined\n", info.filename, info.line, info.col, name);
         } else {
@@ -137,9 +419,9 @@ public:
             const char* name = node_get_str(id);
             // set entry in symtab for name, type
             long offset = get_curr_offset();
-            Symbol* sym = symbol_create(name, type, VARIABLE, offset);
+            std::unique_ptr<Symbol> sym(symbol_create(name, type, VARIABLE, offset));
             incr_curr_offset(type->get_size());
-            if (scope->s_exists(name)) {
+            if (is_defined(node_get_atom(id))) {
                 SourceInfo info = node_get_source_info(left);
                 err_fatal("%s:%d:%d: Error: Name '%s' is already defined\n", info.filename, info.line, info.col, name);
             } else {
@@ -161,9 +443,9 @@ public:
 
         // set entry in symtab for name, type
         long offset = get_curr_offset();
-        Symbol* sym = symbol_create(name, type, TYPE, offset);
+        std::unique_ptr<Symbol> sym(symbol_create(name, type, TYPE, offset));
         incr_curr_offset(type->get_size());
-        if (scope->s_exists(name)) {
+        if (is_defined(node_get_atom(left))) {
             SourceInfo info = node_get_source_info(left);
             err_fatal("%s:%d:%d: Error: Name '%s' is already defined\n", info.filename, info.line, info.col, name);
         } else {
@@ -175,17 +457,18 @@ public:
         Node* type = node_get_kid(ast, 0);
 
         const char* type_str = node_get_str(type);
+        Atom type_name = node_get_atom(type);
         Type* named_type;
 
-        if (std::strcmp(type_str, "INTEGER") == 0) {
+        if (type_name == integer_name) {
             named_type = integer_type;
-        } else if (std::strcmp(type_str, "CHAR") == 0) {
+        } else if (type_name == char_name) {
             named_type = char_type;
         } else {
             // perform lookup
-            if (scope->s_exists(type_str)) {
-                Symbol typeSymbol = scope->lookup(type_str);
-                named_type = typeSymbol.get_type();
+            const Symbol *typeSymbol = scope->find(type_name);
+            if (typeSymbol != nullptr) {
+                named_type = typeSymbol->get_type();
             } else {
                 SourceInfo info = node_get_source_info(type);
                 err_fatal("%s:%d:%d: Error: Unknown type '%s'\n", info.filename, info.line, info.col, type_str);
@@ -210,7 +493,7 @@ public:
         }
         long size = node_get_ival(left);
 
-        Type* arrayType = type_create_array(size, type);
+        Type* arrayType = types->get_array(size, type);
         ast->set_type(arrayType);
     }
 
@@ -226,7 +509,7 @@ public:
 
         scope = scope->get_parent();    // bring it back to parent scope
 
-        Type* recordType = type_create_record(nestedSymTab);
+        Type* recordType = types->get_record(nestedSymTab);
         ast->set_type(recordType);
     }
 
@@ -234,121 +517,183 @@ public:
         Node* ident = node_get_kid(ast, 0);
         const char* varname = node_get_str(ident);
 
-        if (scope->s_exists(varname)) {
-            // if name references a TYPE or RECORD, is also wrong
-        } else {
+        unsigned index;
+        SymbolTable *defining_scope = scope->locate(node_get_atom(ident), index);
+        if (defining_scope == nullptr) {
+            // (if name references a TYPE or RECORD, it is also wrong)
             SourceInfo info = node_get_source_info(ident);
             err_fatal("%s:%d:%d: Error: Undefined variable '%s'\n", info.filename, info.line, info.col, varname);
         }
-        Symbol sym = scope->lookup(varname);
-        ast->set_str(varname);
-        ast->set_type(sym.get_type());
+        // (the symbol is cached on the identifier, so that code generation
+        // doesn't look the name up again)
+        ident->set_symbol(defining_scope, index);
+        const Symbol *sym = &defining_scope->get_symbol(index);
+        if (sym->get_kind() == PROCEDURE || sym->get_kind() == FUNCTION) {
+            SourceInfo info = node_get_source_info(ident);
+            err_fatal("%s:%d:%d: Error: '%s' is not a variable\n", info.filename, info.line, info.col, varname);
+        }
+        ast->set_atom(node_get_atom(ident));
+        ast->set_type(sym->get_type());
         ast->set_source_info(node_get_source_info(ident));
-        if (sym.get_kind() == CONST) {
+        if (sym->get_kind() == CONST) {
             ast->set_is_const(true);
-            ast->set_ival(sym.get_ival());
+            ast->set_ival(sym->get_ival());
         }
     }
 
-    void visit_int_literal(struct Node *ast) override {
-        // set literal value
-        ast->set_ival(strtol(node_get_str(ast), nullptr, 10));
-        // set type to integer
-        ast->set_type(integer_type);
-        ast->set_is_const(true);
-    }
+    void visit_array_element_ref(struct Node *ast) override {
+        ASTVisitor::visit_array_element_ref(ast);
 
-    void visit_add(struct Node *ast) override {
-        ASTVisitor::visit_add(ast);
+        // (an element may be an array or record, assigned as a whole)
+        Type* array_type = node_get_kid(ast, 0)->get_type();
+        if (array_type != nullptr && array_type->realType == ARRAY) {
+            ast->set_type(array_type->arrayElementType);
+        }
+    }
 
-        Node *left = node_get_kid(ast, 0);
-        Node *right = node_get_kid(ast, 1);
+    void visit_assign(struct Node *ast) override {
+        ASTVisitor::visit_assign(ast);
 
-        if (!left->is_const() || !right->is_const()) {
-            // skip evaluation if calculation is not constant
-            return;
+        // an array or record can only be assigned a value of the same type
+        Type* left = node_get_kid(ast, 0)->get_type();
+        Type* right = node_get_kid(ast, 1)->get_type();
+        if (((left != nullptr && left->realType != PRIMITIVE) || (right != nullptr && right->realType != PRIMITIVE))
+                && left != right) {
+            SourceInfo info = node_get_source_info(ast);
+            err_fatal("%s:%d:%d: Error: Assignment of incompatible types\n", info.filename, info.line, info.col);
         }
+    }
 
-        long lval = left->get_ival();
-        long rval = right->get_ival();
+    void visit_for(struct Node *ast) override {
+        ASTVisitor::visit_for(ast);
 
-        ast->set_ival(lval + rval);
-        ast->set_is_const(true);
+        // the loop variable must be an INTEGER variable
+        Node* ident = node_get_kid(node_get_kid(ast, 0), 0);
+        const Symbol* sym = node_get_symbol(ident);
+        if (sym->get_kind() != VARIABLE || sym->get_type() != integer_type) {
+            SourceInfo info = node_get_source_info(ident);
+            err_fatal("%s:%d:%d: Error: FOR loop variable '%s' is not an INTEGER variable\n",
+                      info.filename, info.line, info.col, node_get_str(ident));
+        }
     }
 
-    void visit_subtract(struct Node *ast) override {
-        ASTVisitor::visit_subtract(ast);
+    void visit_case(struct Node *ast) override {
+        ASTVisitor::visit_case(ast);
 
-        Node *left = node_get_kid(ast, 0);
-        Node *right = node_get_kid(ast, 1);
+        Node *selector = node_get_kid(ast, 0);
+        Type *type = selector->get_type();
+        if (type != nullptr && type->realType != PRIMITIVE) {
+            SourceInfo info = node_get_source_info(selector);
+            err_fatal("%s:%d:%d: Error: CASE selector is not an INTEGER or CHAR\n", info.filename, info.line, info.col);
+        }
 
-        if (!left->is_const() || !right->is_const()) {
-            // skip evaluation if calculation is not constant
-            return;
+        // the labels must be distinct constants
+        std::set<long> labels;
+        Node *arms = node_get_kid(ast, 1);
+        for (int i = 0; i < node_get_num_kids(arms); i++) {
+            Node *values = node_get_kid(node_get_kid(arms, i), 0);
+            for (int j = 0; j < node_get_num_kids(values); j++) {
+                Node *value = node_get_kid(values, j);
+                SourceInfo info = node_get_source_info(value);
+                if (!value->is_const()) {
+                    err_fatal("%s:%d:%d: Error: Non-constant CASE label\n", info.filename, info.line, info.col);
+                }
+                if (!labels.insert(value->get_ival()).second) {
+                    err_fatal("%s:%d:%d: Error: Duplicate CASE label %ld\n",
+                              info.filename, info.line, info.col, value->get_ival());
+                }
+            }
         }
+    }
 
-        long lval = left->get_ival();
-        long rval = right->get_ival();
+    void visit_procedure(struct Node *ast) override {
+        visit_subprogram(ast, false);
+    }
 
-        ast->set_ival(lval - rval);
-        ast->set_is_const(true);
+    // (the name of a unit isn't defined in it)
+    void visit_unit(struct Node *ast) override {
+        visit(node_get_kid(ast, 0));
     }
 
-    void visit_multiply(struct Node *ast) override {
-        ASTVisitor::visit_multiply(ast);
+    void visit_uses(struct Node *ast) override {
+        Node* names = node_get_kid(ast, 0);
+        for (int i = 0; i < node_get_num_kids(names); i++) {
+            Node* name = node_get_kid(names, i);
+            units->import(node_get_str(name), node_get_source_info(name), scope, types, curr_offset);
+        }
+    }
 
-        Node *left = node_get_kid(ast, 0);
-        Node *right = node_get_kid(ast, 1);
+    void visit_function(struct Node *ast) override {
+        visit_subprogram(ast, true);
+    }
 
-        if (!left->is_const() || !right->is_const()) {
-            // skip evaluation if calculation is not constant
-            return;
-        }
+    void visit_procedure_call(struct Node *ast) override {
+        visit_call(ast, PROCEDURE);
+    }
 
-        long lval = left->get_ival();
-        long rval = right->get_ival();
+    void visit_function_call(struct Node *ast) override {
+        const Symbol *sym = visit_call(ast, FUNCTION);
+        ast->set_type(sym->get_type()->resultType);
+        ast->set_source_info(node_get_source_info(node_get_kid(ast, 0)));
+    }
 
-        ast->set_ival(lval * rval);
+    void visit_int_literal(struct Node *ast) override {
+        // set literal value
+        ast->set_ival(strtol(node_get_str(ast), nullptr, 10));
+        // set type to integer
+        ast->set_type(integer_type);
         ast->set_is_const(true);
     }
 
-    void visit_divide(struct Node *ast) override {
-        ASTVisitor::visit_divide(ast);
-
-        Node *left = node_get_kid(ast, 0);
-        Node *right = node_get_kid(ast, 1);
+    // Chains of arithmetic operations (such as a + a + ... + a, which the
+    // left-recursive grammar turns into a tree as deep as the chain is long)
+    // are traversed without recursion, folding constants after visiting the
+    // operands of each operation.
+    void visit_add(struct Node *ast) override {
+        traverse(ast);
+    }
 
-        if (!left->is_const() || !right->is_const()) {
-            // skip evaluation if calculation is not constant
-            return;
-        }
+    void visit_subtract(struct Node *ast) override {
+        traverse(ast);
+    }
 
-        long lval = left->get_ival();
-        long rval = right->get_ival();
+    void visit_multiply(struct Node *ast) override {
+        traverse(ast);
+    }
 
-        ast->set_ival(lval / rval);
-        ast->set_is_const(true);
+    void visit_divide(struct Node *ast) override {
+        traverse(ast);
     }
 
     void visit_modulus(struct Node *ast) override {
-        ASTVisitor::visit_modulus(ast);
-
-        Node *left = node_get_kid(ast, 0);
-        Node *right = node_get_kid(ast, 1);
+        traverse(ast);
+    }
 
-        if (!left->is_const() || !right->is_const()) {
-            // skip evaluation if calculation is not constant
-            return;
+    bool pre_visit(struct Node *ast) override {
+        if (is_arithmetic(ast)) {
+            return true;
         }
+        visit(ast);
+        return false;
+    }
 
-        long lval = left->get_ival();
-        long rval = right->get_ival();
-
-        ast->set_ival(lval % rval);
-        ast->set_is_const(true);
+    void post_visit(struct Node *ast) override {
+        if (is_arithmetic(ast)) {
+            ASTSimplifier::fold(ast);
+        }
     }
 };
 
+// the high-level code of the main program or of one of its subprograms
+struct FunctionCode {
+    std::string label;
+    // the scope of the function (the program's for the main program)
+    SymbolTable *symtab;
+    InstructionSequence *iseq;
+    long num_vregs;
+    bool is_main;
+};
+
 class HighLevelCodeGen : public ASTVisitor {
 
 private:
@@ -356,31 +701,167 @@ private:
     long m_vreg_max = -1;
     long loop_index = 0;
     long initial_vreg = -1;
+    // the vregs and labels are numbered separately in each function, and
+    // the labels of a subprogram have a suffix (see get_label_suffix)
+    std::string m_label_suffix;
+    // the scope of the function whose code is generated, and the program's
     SymbolTable* m_symtab;
-    std::map<std::string, Operand> scalars;
+    SymbolTable* m_program_symtab;
+    // the code of the subprograms, followed by the main program's
+    std::vector<FunctionCode> functions;
+    // the offsets of the program's variables used by its subprograms
+    // (which are kept in memory rather than promoted to scalars by main)
+    std::set<long> shared_variables;
+    // a scalar variable (var, 0, -1), or an element of an array
+    // (var, 0, index) or field of a record (var, field, -1) promoted to
+    // a scalar (var and field are the atoms of the names)
+    typedef std::tuple<Atom, Atom, long> ScalarName;
+    // vregs of the scalars
+    std::map<ScalarName, Operand> scalars;
     InstructionSequence* code;
 
+    // arrays with at most this many elements, which are only indexed by
+    // constants, are promoted to scalars
+    static const long MAX_PROMOTED_ARRAY_SIZE = 16;
+    // aggregate variables which can't be promoted to scalars (because they are
+    // indexed by a non-constant, or used as a whole), and the constant indices
+    // used for each array
+    std::set<Atom> unpromotable;
+    std::map<Atom, std::set<long>> constant_indices;
+
+    // the runtime library (runtime.c) can be called to write or read a
+    // range of array elements with one writeia or readia instruction
+    bool use_runtime;
+    // check the index of each array element referenced (with a chkb
+    // instruction, see visit_array_element_ref)
+    bool bounds_check;
+    // the size of an integer written by writeia (or read by readia)
+    static const long INTEGER_SIZE = 8;
+    // an array or record assigned as a whole is copied by loading and
+    // storing each of its integers if it has at most this many bytes,
+    // and by a copyi otherwise
+    static const long MAX_UNROLLED_COPY_SIZE = 64;
+    // the largest constant index whose offset is computed at compile time
+    // (so that multiplying it by the element size can't overflow)
+    static const long MAX_CONSTANT_INDEX = 1L << 31;
+    // a CASE statement's dispatch compares the selector with each case of
+    // a cluster of at most this many cases (see emit_dispatch), and a chain
+    // of IF statements testing a variable for equality with at least this
+    // many constants is compiled as a CASE statement (see get_if_ladder)
+    static const size_t MAX_CASE_COMPARISONS = 3;
+    static const size_t MIN_IF_LADDER_CASES = 4;
+
+    // an arm of a CASE statement: its labels' values, and its statements
+    struct CaseArm {
+        std::vector<long> values;
+        Node *body;
+    };
+
+    // the operand computed for each expression node (or the target
+    // label of a condition), and the conditions which branch when false
+    std::unordered_map<Node *, Operand> operands;
+    std::unordered_set<Node *> inverted_conditions;
+
+    // the number of vregs needed to evaluate each expression node (its
+    // Sethi-Ullman number), the nodes containing a function call, and the
+    // arithmetic operations whose right operand needs more vregs than its
+    // left, and is evaluated first (unless either operand calls a
+    // function, whose side effects must happen in order)
+    std::unordered_map<Node *, int> register_needs;
+    std::unordered_set<Node *> calls;
+    std::unordered_set<Node *> reversed_operations;
+    // the last vreg allocated before each arithmetic operation being
+    // generated: the vregs allocated for its operands are free once it is
+    std::vector<long> operation_vregs;
+
+    // if not null, the names in the program are resolved by this builder
+    // while the code is generated, rather than in a separate pass
+    SymbolTableBuilder *symtab_builder;
+    ASTSimplifier simplifier;
+
 public:
     HighLevelCodeGen(SymbolTable* symbolTable)
         : m_symtab(symbolTable),
-        scalars() {
+        m_program_symtab(symbolTable),
+        scalars(),
+        use_runtime(false),
+        bounds_check(false),
+        symtab_builder(nullptr) {
         code = new InstructionSequence();
     }
 
-    InstructionSequence* get_iseq() {
-        return code;
+    void set_use_runtime(bool runtime) {
+        use_runtime = runtime;
+    }
+
+    void set_bounds_check(bool check) {
+        bounds_check = check;
+    }
+
+    void set_symtab_builder(SymbolTableBuilder *builder) {
+        symtab_builder = builder;
+    }
+
+    const std::vector<FunctionCode> &get_functions() const {
+        return functions;
     }
 
-    long get_storage_size() {
-        return m_symtab->get_total_size();
+    const std::set<long> &get_shared_variables() const {
+        return shared_variables;
     }
 
+private:
     long get_vreg_max() {
         // if N is the index of vreg used, e.g. vrN, then the number of registers is N + 1
         return m_vreg_max + 1;
     }
 
+    // start generating the code of a function whose scope is symtab
+    void begin_function(SymbolTable *symtab, const std::string &label) {
+        m_symtab = symtab;
+        code = new InstructionSequence();
+        m_vreg = m_vreg_max = initial_vreg = -1;
+        loop_index = 0;
+        m_label_suffix = get_label_suffix(label, symtab == m_program_symtab);
+        scalars.clear();
+        unpromotable.clear();
+        constant_indices.clear();
+    }
+
+    void end_function(const std::string &label, bool is_main) {
+        functions.push_back(FunctionCode{ label, m_symtab, code, get_vreg_max(), is_main });
+    }
+
+    // the label of a subprogram (distinct from the names of the library
+    // functions the code calls), qualified by its unit's name if it's
+    // declared in a unit (see UnitInterfaces)
+    static std::string get_subprogram_label(struct Node *ident) {
+        const std::string &unit = node_get_symbol(ident)->get_type()->unit;
+        return "f_" + (unit.empty() ? std::string() : unit + ".") + node_get_str(ident);
+    }
+
+public:
+    // the suffix of the labels in the code of a function (none in the main
+    // program), which keeps them distinct from the other functions' labels
+    // although each function's are numbered from 0 (so that the functions
+    // can be compiled independently, see StringTable::set_label_suffix)
+    static std::string get_label_suffix(const std::string &label, bool is_main) {
+        return is_main ? std::string() : "_" + label;
+    }
+
 private:
+
+    // note a use of a program's variable by a subprogram
+    void scan_variable_use(struct Node *var_ref) {
+        Node *ident = node_get_kid(var_ref, 0);
+        if (m_symtab != m_program_symtab && node_get_symtab(ident) == m_program_symtab) {
+            const Symbol &symbol = get_var_ref_symbol(var_ref);
+            if (symbol.get_kind() == VARIABLE) {
+                shared_variables.insert(symbol.get_offset());
+            }
+        }
+    }
+
     long next_vreg() {
         m_vreg += 1;
         if (m_vreg_max < (m_vreg)) {
@@ -398,407 +879,865 @@ private:
     }
 
     std::string next_label() {
-        std::string label = cpputil::format(".L%ld", loop_index);
+        std::string label = cpputil::format(".L%ld%s", loop_index, m_label_suffix.c_str());
         loop_index++;
         return label;
     }
 
-public:
-
-    void visit_declarations(struct Node *ast) override {
-        for (auto symbol : m_symtab->get_symbols()) {
-            if (symbol.get_kind() == VARIABLE && symbol.get_type()->realType == PRIMITIVE) {
-                // this is a scalar variable
-                long next = next_vreg();
-                Operand scalar_vreg(OPERAND_VREG, next);
-                scalar_vreg.set_is_scalar(true);
-                scalars[symbol.get_name()] = scalar_vreg;
-            }
+    // define a label for the next instruction, adding a nop for a label
+    // still pending at the end of the code before (such as the end of an IF
+    // or an empty CASE arm, which nothing was generated after) to refer to
+    void define_label(const std::string &label) {
+        if (code->has_label_at_end()) {
+            code->add_instruction(new Instruction(HINS_NOP));
         }
+        code->define_label(label);
+    }
 
-        set_initial_vreg(scalars.size() - 1);
-
-        // specifically disable visits to declarations so no vregs are incremented
-        //ASTVisitor::visit_declarations(ast);
-        reset_vreg();
+    void add_scalar(const ScalarName &name) {
+        long next = next_vreg();
+        Operand scalar_vreg(OPERAND_VREG, next);
+        scalar_vreg.set_is_scalar(true);
+        scalars[name] = scalar_vreg;
     }
 
-    void visit_if(struct Node *ast) override {
-        Node *cond = ast->get_kid(0);
-        Node *iftrue = ast->get_kid(1);
+    Operand get_operand(Node *ast) const {
+        auto i = operands.find(ast);
+        return i != operands.end() ? i->second : Operand();
+    }
 
-        std::string out_label = next_label();
+    void set_operand(Node *ast, const Operand &op) {
+        operands[ast] = op;
+    }
 
-        cond->set_inverted(true);
-        Operand op_out(out_label);
-        cond->set_operand(op_out);
+    bool is_inverted(Node *ast) const {
+        return inverted_conditions.count(ast) > 0;
+    }
 
-        visit(cond);
-        visit(iftrue);
-        code->define_label(out_label);
+    void set_inverted(Node *ast) {
+        inverted_conditions.insert(ast);
     }
 
-    void visit_if_else(struct Node *ast) override {
-        Node *condition = node_get_kid(ast, 0);
-        Node *iftrue = node_get_kid(ast, 1);
-        Node *otherwise = node_get_kid(ast, 2);
+    static Atom get_var_ref_name(struct Node *ast) {
+        return node_get_atom(node_get_kid(ast, 0));
+    }
 
-        std::string else_label = next_label();
-        std::string out_label = next_label();
+    // the symbol of a variable reference (cached on its identifier by
+    // SymbolTableBuilder)
+    static const Symbol &get_var_ref_symbol(struct Node *ast) {
+        return *node_get_symbol(node_get_kid(ast, 0));
+    }
 
-        condition->set_inverted(true);
-        Operand op_else(else_label);
-        condition->set_operand(op_else);
+    // find the uses of aggregate variables which prevent
+    // them from being promoted to scalars
+    void scan_aggregate_uses(struct Node *root) {
+        // (with an explicit stack, since expressions may be deeply nested)
+        std::vector<Node *> stack(1, root);
+        while (!stack.empty()) {
+            Node *ast = stack.back();
+            stack.pop_back();
+
+            int tag = node_get_tag(ast);
+            if (tag == AST_ASSIGN && is_record_assign(ast)) {
+                // (a record assigned as a whole is copied field by field,
+                // so the records may still be promoted to scalars)
+                scan_variable_use(node_get_kid(ast, 0));
+                scan_variable_use(node_get_kid(ast, 1));
+                continue;
+            }
+            if (tag == AST_VAR_REF) {
+                // an aggregate used as a whole
+                unpromotable.insert(get_var_ref_name(ast));
+                scan_variable_use(ast);
+                continue;
+            }
 
-        visit(condition);
-        visit(iftrue);
-        Operand op_out(out_label);
-        auto *jumpins = new Instruction(HINS_JUMP, op_out);  // jump after iftrue to skip else
-        code->add_instruction(jumpins);
-        code->define_label(else_label);
-        visit(otherwise);
-        code->define_label(out_label);
+            int first_kid = 0;
+            if (tag == AST_ARRAY_ELEMENT_REF || tag == AST_FIELD_REF) {
+                Node *designator = node_get_kid(ast, 0);
+                if (node_get_tag(designator) == AST_VAR_REF) {
+                    first_kid = 1;
+                    scan_variable_use(designator);
+                    Atom name = get_var_ref_name(designator);
+                    if (tag == AST_ARRAY_ELEMENT_REF) {
+                        Node *index = node_get_kid(ast, 1);
+                        if (symtab_builder != nullptr) {
+                            // (in one pass, the index must be resolved first
+                            // to find out whether it is constant)
+                            symtab_builder->visit(index);
+                        }
+                        if (index->is_const()) {
+                            constant_indices[name].insert(index->get_ival());
+                        } else {
+                            unpromotable.insert(name);
+                        }
+                    }
+                }
+                if (tag == AST_FIELD_REF) {
+                    // the field name is not a variable reference (but the
+                    // designator may use one, such as the array in a[i].x)
+                    if (first_kid == 0) {
+                        stack.push_back(designator);
+                    }
+                    continue;
+                }
+            }
 
-        // add no-op to resolve define_label assertion error
-        auto *noopins = new Instruction(HINS_NOP);
-        code->add_instruction(noopins);
+            for (int i = first_kid; i < node_get_num_kids(ast); i++) {
+                stack.push_back(node_get_kid(ast, i));
+            }
+        }
     }
 
-    void visit_repeat(struct Node *ast) override {
-        Node *instructions = node_get_kid(ast, 0);
-        Node *condition = node_get_kid(ast, 1);
+    // is an assignment of a record variable to another, whose
+    // fields are all INTEGERs or CHARs?
+    bool is_record_assign(struct Node *ast) {
+        Node *lhs = node_get_kid(ast, 0);
+        Node *rhs = node_get_kid(ast, 1);
+        if (node_get_tag(lhs) != AST_VAR_REF || node_get_tag(rhs) != AST_VAR_REF) {
+            return false;
+        }
+        if (symtab_builder != nullptr) {
+            // (in one pass, the variables must be resolved first)
+            symtab_builder->visit(lhs);
+            symtab_builder->visit(rhs);
+        }
+        Type *type = lhs->get_type();
+        if (type == nullptr || type->realType != RECORD || rhs->get_type() != type) {
+            return false;
+        }
+        for (const Symbol &field : *type->symtab) {
+            if (field.get_type()->realType != PRIMITIVE) {
+                return false;
+            }
+        }
+        return true;
+    }
 
-        std::string loop_body_label = next_label();         // .L0
-        std::string loop_condition_label = next_label();    // .L1
+    bool is_promotable_array(const Symbol &symbol) {
+        Type *type = symbol.get_type();
+        // (the elements of CHAR arrays are always stored as bytes)
+        if (type->arrayElementType->realType != PRIMITIVE || type->arrayElementType == type_get_char()
+            || type->arraySize > MAX_PROMOTED_ARRAY_SIZE
+            || unpromotable.count(symbol.get_atom()) > 0) {
+            return false;
+        }
+        const std::set<long> &indices = constant_indices[symbol.get_atom()];
+        return indices.empty() || (*indices.begin() >= 0 && *indices.rbegin() < type->arraySize);
+    }
 
-        Operand op_loop_body(loop_body_label);
-        Operand op_loop_condition(loop_condition_label);
+    // the opcodes loading and storing the value of a variable or array
+    // element in memory (a CHAR is stored in a single byte)
+    static int get_load_opcode(struct Node *ast) {
+        return (ast->get_type() == type_get_char()) ? HINS_LOAD_CHAR : HINS_LOAD_INT;
+    }
 
-        // no need to jump, will flow right into loop body for first loop iteration
+    static int get_store_opcode(struct Node *ast) {
+        return (ast->get_type() == type_get_char()) ? HINS_STORE_CHAR : HINS_STORE_INT;
+    }
 
-        code->define_label(loop_body_label);
-        visit(instructions);
+    // get an operand holding the value of an expression: a constant is used
+    // as an immediate, and a variable stored in memory is loaded into a vreg
+    Operand get_value_operand(struct Node *ast) {
+        if (ast->is_const()) {
+            return Operand(OPERAND_INT_LITERAL, ast->get_ival());
+        }
 
-        code->define_label(loop_condition_label);
-        condition->set_inverted(true);
-        condition->set_operand(op_loop_body);
-        visit(condition);
+        Operand op = get_operand(ast);
+        int tag = node_get_tag(ast);
+        if (!op.get_is_scalar() && (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF || tag == AST_FIELD_REF)) {
+            // ldi vr3, (vr1)
+            Operand dest(OPERAND_VREG, next_vreg());
+            code->add_instruction(new Instruction(get_load_opcode(ast), dest, op.to_memref()));
+            op = dest;
+        }
+        return op;
     }
 
-    void visit_while(struct Node *ast) override {
-        Node *condition = node_get_kid(ast, 0);
-        Node *instructions = node_get_kid(ast, 1);
-
-        std::string loop_body_label = next_label();         // .L0
-        std::string loop_condition_label = next_label();    // .L1
+    // get an operand holding the value of a variable, and assign a value
+    // to it (through its address, if it is stored in memory)
+    Operand load_variable(struct Node *var_ref) {
+        visit(var_ref);
+        return get_value_operand(var_ref);
+    }
 
-        Operand op_loop_condition(loop_condition_label);
-        auto *jumpins = new Instruction(HINS_JUMP, op_loop_condition);
-        code->add_instruction(jumpins);
+    void store_variable(struct Node *var_ref, const Operand &value) {
+        visit(var_ref);
+        Operand op = get_operand(var_ref);
+        if (op.get_is_scalar()) {
+            code->add_instruction(new Instruction(HINS_MOV, op, value));
+        } else {
+            code->add_instruction(new Instruction(get_store_opcode(var_ref), op.to_memref(), value));
+        }
+    }
 
-        // loop body
-        Operand op_loop_body(loop_body_label);
-        code->define_label(loop_body_label);
-        visit(instructions);
+    // emit the comparison of a condition's operands, and the branch taken
+    // to the condition's target label when the condition is true (or
+    // when it is false, if the condition is inverted)
+    void emit_compare(struct Node *ast, int branch_opcode, int inverted_opcode) {
+        Operand l_op = get_value_operand(node_get_kid(ast, 0));
+        Operand r_op = get_value_operand(node_get_kid(ast, 1));
+        code->add_instruction(new Instruction(HINS_INT_COMPARE, l_op, r_op));
 
-        // loop condition
-        code->define_label(loop_condition_label);
-        condition->set_operand(op_loop_body);
-        visit(condition);
+        int opcode = is_inverted(ast) ? inverted_opcode : branch_opcode;
+        code->add_instruction(new Instruction(opcode, get_operand(ast)));
     }
 
-    void visit_compare_eq(struct Node *ast) override {
-        ASTVisitor::visit_compare_eq(ast);
+    // the vreg of a scalar variable referenced by a node, or a null
+    // pointer if the node isn't a reference to a scalar variable
+    const Operand *get_scalar_ref(struct Node *ast) {
+        if (node_get_tag(ast) != AST_VAR_REF || ast->is_const()) {
+            return nullptr;
+        }
+        auto it = scalars.find(ScalarName(get_var_ref_name(ast), 0, -1));
+        return (it != scalars.end()) ? &it->second : nullptr;
+    }
 
-        Node *lhs = node_get_kid(ast, 0);
-        Node *rhs = node_get_kid(ast, 1);
+    // is the node a reference to the named scalar variable?
+    bool is_scalar_ref(struct Node *ast, Atom name) {
+        return get_scalar_ref(ast) != nullptr && get_var_ref_name(ast) == name;
+    }
 
-        Operand l_op = lhs->get_operand();
-        Operand r_op = rhs->get_operand();
+    // the code of a CASE statement (or of an IF ladder, see get_if_ladder),
+    // whose selector is a vreg or a constant:
+    //     (the dispatch on the selector, see emit_dispatch)
+    //     (the ELSE part, executed if no label matches)
+    //     jmp .L0
+    // .L1:
+    //     (the first arm)
+    //     jmp .L0
+    //     ...
+    // .Ln:
+    //     (the last arm)
+    // .L0:
+    // (the dispatch falls through to the ELSE part, so the code before the
+    // CASE doesn't fall through all the way to the end of a procedure)
+    void emit_case(const Operand &selector, const std::vector<CaseArm> &arms, Node *otherwise) {
+        std::string out_label = next_label();
+        bool has_else = otherwise != nullptr && node_get_num_kids(otherwise) > 0;
+        std::string else_label = has_else ? next_label() : out_label;
+
+        // the labels' values, sorted (the first arm with a value is the
+        // one executed)
+        std::vector<std::string> arm_labels;
+        std::vector<std::pair<long, std::string>> cases;
+        std::set<long> values;
+        for (auto i = arms.begin(); i != arms.end(); i++) {
+            arm_labels.push_back(next_label());
+            for (auto j = i->values.begin(); j != i->values.end(); j++) {
+                if (values.insert(*j).second) {
+                    cases.push_back(std::make_pair(*j, arm_labels.back()));
+                }
+            }
+        }
+        std::sort(cases.begin(), cases.end());
+
+        if (selector.get_kind() == OPERAND_INT_LITERAL) {
+            // (a constant selects its arm at compile time)
+            std::string target = else_label;
+            for (auto i = cases.begin(); i != cases.end(); i++) {
+                if (i->first == selector.get_int_value()) {
+                    target = i->second;
+                }
+            }
+            code->add_instruction(new Instruction(HINS_JUMP, Operand(target)));
+        } else {
+            emit_dispatch(selector, cases, 0, cases.size(), else_label);
+        }
+        reset_vreg();
 
-        int tag = node_get_tag(lhs);
-        if (l_op.get_is_scalar()) {
-            // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-            // ldi vr3, (vr1)
-            long lreg = next_vreg();
-            Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
-            auto *lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
-            l_op = ldest;
-            code->add_instruction(lload);
+        if (has_else) {
+            code->define_label(else_label);
+            visit(otherwise);
         }
+        for (unsigned i = 0; i < arms.size(); i++) {
+            code->add_instruction(new Instruction(HINS_JUMP, Operand(out_label)));
+            code->define_label(arm_labels[i]);
+            visit(arms[i].body);
+        }
+        define_label(out_label);
+        code->add_instruction(new Instruction(HINS_NOP));
+    }
 
-        if (!rhs->is_const()) {
-            tag = node_get_tag(rhs);
-            if (r_op.get_is_scalar()) {
-                // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-                // ldi vr4, (vr2)
-                long rreg = next_vreg();
-                Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
-                auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
-                r_op = rdest;
-                code->add_instruction(rload);
+    // branch to the label of the case (among the sorted cases in [lo, hi))
+    // equal to the selector, or to the default label: a cluster of at most
+    // MAX_CASE_COMPARISONS cases, or of cases dense enough for a jump table,
+    // is compared with the selector in turn,
+    //     cmpi vrS, $1
+    //     je .L1
+    //     cmpi vrS, $2
+    //     je .L2
+    //     ...
+    //     jmp .Ldefault
+    // (which the "jumptable" pass turns into a jump table, see
+    // JumpTableFormation), and any other set of cases is split in half by
+    // comparing the selector with the middle case (a binary search)
+    void emit_dispatch(const Operand &selector, const std::vector<std::pair<long, std::string>> &cases,
+                       size_t lo, size_t hi, const std::string &default_label) {
+        size_t n = hi - lo;
+        if (n <= MAX_CASE_COMPARISONS
+                || JumpTableFormation::is_dense(n, cases[lo].first, cases[hi - 1].first)) {
+            for (size_t i = lo; i < hi; i++) {
+                code->add_instruction(new Instruction(HINS_INT_COMPARE, selector,
+                                                      Operand(OPERAND_INT_LITERAL, cases[i].first)));
+                code->add_instruction(new Instruction(HINS_JE, Operand(cases[i].second)));
             }
+            code->add_instruction(new Instruction(HINS_JUMP, Operand(default_label)));
+            return;
         }
 
-        auto *cmpins = new Instruction(HINS_INT_COMPARE, l_op, r_op);
-        code->add_instruction(cmpins);
+        size_t mid = lo + n / 2;
+        std::string upper_label = next_label();
+        code->add_instruction(new Instruction(HINS_INT_COMPARE, selector,
+                                              Operand(OPERAND_INT_LITERAL, cases[mid].first)));
+        code->add_instruction(new Instruction(HINS_JGTE, Operand(upper_label)));
+        emit_dispatch(selector, cases, lo, mid, default_label);
+        code->define_label(upper_label);
+        emit_dispatch(selector, cases, mid, hi, default_label);
+    }
 
-        Instruction *jumpins;
-        if (ast->is_inverted()) {
-            jumpins = new Instruction(HINS_JNE, ast->get_operand());
-        } else {
-            jumpins = new Instruction(HINS_JE, ast->get_operand());
+    // the scalar variable and the constant compared for equality by a
+    // condition (x = c or c = x), if it is such a comparison
+    bool get_equality_test(struct Node *condition, Operand &var, long &value) {
+        if (node_get_tag(condition) != AST_COMPARE_EQ) {
+            return false;
         }
-        code->add_instruction(jumpins);
+        Node *left = node_get_kid(condition, 0);
+        Node *right = node_get_kid(condition, 1);
+        if (left->is_const()) {
+            std::swap(left, right);
+        }
+        const Operand *scalar = get_scalar_ref(left);
+        if (scalar == nullptr || !right->is_const()) {
+            return false;
+        }
+        var = *scalar;
+        value = right->get_ival();
+        return true;
     }
 
-    void visit_compare_neq(struct Node *ast) override {
-        ASTVisitor::visit_compare_neq(ast);
+    // match a chain of IF statements testing the same scalar variable for
+    // equality with constants, each the only statement of the ELSE part of
+    // the previous one,
+    //     IF x = 1 THEN ... ELSE IF x = 7 THEN ... ELSE ... END END
+    // which is the CASE statement
+    //     CASE x OF 1: ... | 7: ... ELSE ... END
+    // (if it tests at least MIN_IF_LADDER_CASES constants)
+    bool get_if_ladder(struct Node *ast, Operand &selector, std::vector<CaseArm> &arms, Node *&otherwise) {
+        Node *rest = nullptr;
+        for (Node *test = ast; test != nullptr; ) {
+            Operand var;
+            long value;
+            if (!get_equality_test(node_get_kid(test, 0), var, value)
+                    || (!arms.empty() && var.get_base_reg() != selector.get_base_reg())) {
+                // (the rest of the chain is the ELSE part)
+                break;
+            }
+            selector = var;
+            arms.push_back(CaseArm{ std::vector<long>(1, value), node_get_kid(test, 1) });
+            rest = (node_get_tag(test) == AST_IF_ELSE) ? node_get_kid(test, 2) : nullptr;
+            test = nullptr;
+            if (rest != nullptr && node_get_num_kids(rest) == 1) {
+                int tag = node_get_tag(node_get_kid(rest, 0));
+                if (tag == AST_IF || tag == AST_IF_ELSE) {
+                    test = node_get_kid(rest, 0);
+                }
+            }
+        }
+        if (arms.size() < MIN_IF_LADDER_CASES) {
+            arms.clear();
+            return false;
+        }
+        otherwise = rest;
+        return true;
+    }
 
-        Node *lhs = node_get_kid(ast, 0);
-        Node *rhs = node_get_kid(ast, 1);
+    // match a loop which writes (or reads, if io_tag is AST_READ) a range
+    // of the elements of an array,
+    //     WHILE i < hi DO WRITE a[i]; i := i + 1; END
+    // (or with i <= hi), where i is a scalar variable, hi is a constant or
+    // another scalar variable, and a is an array of integers stored in memory
+    bool is_array_io_loop(struct Node *ast, int io_tag) {
+        Node *condition = node_get_kid(ast, 0);
+        Node *body = node_get_kid(ast, 1);
+        int cond_tag = node_get_tag(condition);
+        if ((cond_tag != AST_COMPARE_LT && cond_tag != AST_COMPARE_LTE) || node_get_num_kids(body) != 2) {
+            return false;
+        }
 
-        Operand l_op = lhs->get_operand();
-        Operand r_op = rhs->get_operand();
+        Node *index = node_get_kid(condition, 0);
+        Node *bound = node_get_kid(condition, 1);
+        if (get_scalar_ref(index) == nullptr) {
+            return false;
+        }
+        Atom index_name = get_var_ref_name(index);
+        if (!bound->is_const() && (get_scalar_ref(bound) == nullptr || is_scalar_ref(bound, index_name))) {
+            return false;
+        }
 
-        int tag = node_get_tag(lhs);
-        if (l_op.get_is_scalar()) {
-            // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-            // ldi vr3, (vr1)
-            long lreg = next_vreg();
-            Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
-            auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
-            l_op = ldest;
-            code->add_instruction(lload);
+        // WRITE a[i] (or READ a[i])
+        Node *io = node_get_kid(body, 0);
+        if (node_get_tag(io) != io_tag || node_get_tag(node_get_kid(io, 0)) != AST_ARRAY_ELEMENT_REF) {
+            return false;
+        }
+        Node *element = node_get_kid(io, 0);
+        Node *array = node_get_kid(element, 0);
+        if (node_get_tag(array) != AST_VAR_REF || !is_scalar_ref(node_get_kid(element, 1), index_name)) {
+            return false;
+        }
+        const Symbol &symbol = get_var_ref_symbol(array);
+        Type *type = symbol.get_type();
+        if (symbol.get_kind() != VARIABLE || type->realType != ARRAY
+                || type->arrayElementType->realType != PRIMITIVE || type->arrayElementType->get_size() != INTEGER_SIZE) {
+            return false;
         }
 
-        if (!rhs->is_const()) {
-            tag = node_get_tag(rhs);
-            if (r_op.get_is_scalar()) {
-                // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-                // ldi vr4, (vr2)
-                long rreg = next_vreg();
-                Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
-                auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
-                r_op = rdest;
-                code->add_instruction(rload);
+        // i := i + 1
+        Node *assign = node_get_kid(body, 1);
+        if (node_get_tag(assign) != AST_ASSIGN || !is_scalar_ref(node_get_kid(assign, 0), index_name)
+                || node_get_tag(node_get_kid(assign, 1)) != AST_ADD) {
+            return false;
+        }
+        Node *sum = node_get_kid(assign, 1);
+        Node *left = node_get_kid(sum, 0), *right = node_get_kid(sum, 1);
+        return (is_scalar_ref(left, index_name) && right->is_const() && right->get_ival() == 1)
+               || (is_scalar_ref(right, index_name) && left->is_const() && left->get_ival() == 1);
+    }
+
+    // emit the code for a loop matched by is_array_io_loop:
+    //     subi vrN, hi, vrI
+    //     cmpi vrN, $0
+    //     jlte .Lk
+    //     (compute the address vrA of a[i])
+    //     writeia vrA, vrN     (or readia)
+    //     mov vrI, hi
+    // .Lk:
+    void emit_array_io_loop(struct Node *ast, int opcode) {
+        Node *condition = node_get_kid(ast, 0);
+        Node *element = node_get_kid(node_get_kid(node_get_kid(ast, 1), 0), 0);
+        Operand index_op = *get_scalar_ref(node_get_kid(condition, 0));
+
+        // the value of the index after the loop
+        Node *bound = node_get_kid(condition, 1);
+        bool inclusive = (node_get_tag(condition) == AST_COMPARE_LTE);
+        Operand end_op;
+        if (bound->is_const()) {
+            end_op = Operand(OPERAND_INT_LITERAL, bound->get_ival() + (inclusive ? 1 : 0));
+        } else {
+            end_op = *get_scalar_ref(bound);
+            if (inclusive) {
+                Operand sum(OPERAND_VREG, next_vreg());
+                code->add_instruction(new Instruction(HINS_INT_ADD, sum, end_op, Operand(OPERAND_INT_LITERAL, 1)));
+                end_op = sum;
             }
         }
 
-        auto *cmpins = new Instruction(HINS_INT_COMPARE, l_op, r_op);
-        code->add_instruction(cmpins);
+        std::string out_label = next_label();
+        Operand count(OPERAND_VREG, next_vreg());
+        code->add_instruction(new Instruction(HINS_INT_SUB, count, end_op, index_op));
+        code->add_instruction(new Instruction(HINS_INT_COMPARE, count, Operand(OPERAND_INT_LITERAL, 0)));
+        code->add_instruction(new Instruction(HINS_JLTE, Operand(out_label)));
+
+        const Symbol &symbol = get_var_ref_symbol(node_get_kid(element, 0));
+        Operand base(OPERAND_VREG, next_vreg());
+        Operand offset(OPERAND_VREG, next_vreg());
+        Operand addr(OPERAND_VREG, next_vreg());
+        code->add_instruction(new Instruction(HINS_LOCALADDR, base, Operand(OPERAND_INT_LITERAL, symbol.get_offset())));
+        code->add_instruction(new Instruction(HINS_INT_MUL, offset, index_op, Operand(OPERAND_INT_LITERAL, INTEGER_SIZE)));
+        code->add_instruction(new Instruction(HINS_INT_ADD, addr, base, offset));
+        code->add_instruction(new Instruction(opcode, addr, count));
+        code->add_instruction(new Instruction(HINS_MOV, index_op, end_op));
 
-        Instruction *jumpins;
-        if (ast->is_inverted()) {
-            jumpins = new Instruction(HINS_JE, ast->get_operand());
-        } else {
-            jumpins = new Instruction(HINS_JNE, ast->get_operand());
+        code->define_label(out_label);
+        // add no-op to resolve define_label assertion error
+        code->add_instruction(new Instruction(HINS_NOP));
+        reset_vreg();
+    }
+
+public:
+
+    // the code of the subprograms is generated first (finding the
+    // program's variables they use), then the main program's
+    void visit_program(struct Node *ast) override {
+        Node *declarations = node_get_kid(ast, 0);
+        Node *instructions = node_get_kid(ast, 1);
+
+        begin_program(declarations, instructions);
+        for (int i = 0; i < node_get_num_kids(instructions); i++) {
+            gen_statement(node_get_kid(instructions, i));
         }
-        code->add_instruction(jumpins);
+        end_program();
     }
 
-    void visit_compare_lt(struct Node *ast) override {
-        ASTVisitor::visit_compare_lt(ast);
+    // (a unit is compiled as a program whose main program does nothing,
+    // see Context::gen_code)
+    void visit_unit(struct Node *ast) override {
+        visit_program(ast);
+    }
 
-        Node *lhs = node_get_kid(ast, 0);
-        Node *rhs = node_get_kid(ast, 1);
+    // The program may also be parsed and compiled a statement at a time
+    // (see parse_program_streaming), in one pass: begin_streaming is called
+    // with the declarations, and stream_statement with each statement of
+    // the main program, whose code is generated immediately, and which is
+    // then freed.
+    static void begin_streaming(void *data, struct Node *declarations) {
+        static_cast<HighLevelCodeGen *>(data)->begin_program(declarations, nullptr);
+    }
 
-        Operand l_op = lhs->get_operand();
-        Operand r_op = rhs->get_operand();
+    static void stream_statement(void *data, struct Node *statement) {
+        auto codegen = static_cast<HighLevelCodeGen *>(data);
+        // (if the statement was replaced by the simplifier, it's left in
+        // the NodeArena, and the statements replacing it are freed)
+        node_destroy_recursive(codegen->gen_statement(statement));
+
+        // the freed nodes' addresses may be reused by the next statement
+        codegen->operands.clear();
+        codegen->inverted_conditions.clear();
+        codegen->register_needs.clear();
+        codegen->calls.clear();
+        codegen->reversed_operations.clear();
+    }
 
-        int tag = node_get_tag(lhs);
-        if (l_op.get_is_scalar()) {
-            // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-            // ldi vr3, (vr1)
-            long lreg = next_vreg();
-            Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
-            auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
-            l_op = ldest;
-            code->add_instruction(lload);
+    void end_program() {
+        if (code->get_length() == 0) {
+            // (a program which does nothing, such as a unit's)
+            code->add_instruction(new Instruction(HINS_NOP));
         }
+        end_function("main", true);
+    }
 
-        if (!rhs->is_const()) {
-            tag = node_get_tag(rhs);
-            if (r_op.get_is_scalar()) {
-                // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-                // ldi vr4, (vr2)
-                long rreg = next_vreg();
-                Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
-                auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
-                r_op = rdest;
-                code->add_instruction(rload);
+private:
+    void begin_program(struct Node *declarations, struct Node *instructions) {
+        // in one pass, resolve the declarations (assigning storage, and
+        // resolving and simplifying the subprograms entirely), and then
+        // resolve and simplify each statement of the main program and
+        // generate its code immediately
+        SymbolTableBuilder *builder = symtab_builder;
+        if (builder != nullptr) {
+            builder->visit(declarations);
+            simplifier.simplify(declarations);
+        }
+        symtab_builder = nullptr;
+        for (int i = 0; i < node_get_num_kids(declarations); i++) {
+            Node *declaration = node_get_kid(declarations, i);
+            int tag = node_get_tag(declaration);
+            if (tag == AST_PROCEDURE || tag == AST_FUNCTION) {
+                gen_subprogram(declaration, tag == AST_FUNCTION);
             }
         }
+        symtab_builder = builder;
 
-        auto *cmpins = new Instruction(HINS_INT_COMPARE, l_op, r_op);
-        code->add_instruction(cmpins);
-
-        Instruction *jumpins;
-        if (ast->is_inverted()) {
-            jumpins = new Instruction(HINS_JGTE, ast->get_operand());
+        begin_function(m_program_symtab, "main");
+        if (instructions != nullptr) {
+            scan_aggregate_uses(instructions);
         } else {
-            jumpins = new Instruction(HINS_JLT, ast->get_operand());
+            // (the statements aren't known yet, so none of the arrays can
+            // be promoted to scalars; a record can only be used as a whole
+            // in an assignment, which doesn't prevent promoting it)
+            for (const Symbol &symbol : *m_symtab) {
+                if (symbol.get_kind() == VARIABLE && symbol.get_type()->realType == ARRAY) {
+                    unpromotable.insert(symbol.get_atom());
+                }
+            }
         }
-        code->add_instruction(jumpins);
+        visit(declarations);
     }
 
-    void visit_compare_lte(struct Node *ast) override {
-        ASTVisitor::visit_compare_lte(ast);
-
-        Node *lhs = node_get_kid(ast, 0);
-        Node *rhs = node_get_kid(ast, 1);
+    // generate the code of a statement of the main program, returning it
+    // (or the statements replacing it, see ASTSimplifier::simplify_statement)
+    struct Node *gen_statement(struct Node *statement) {
+        if (symtab_builder != nullptr) {
+            symtab_builder->visit(statement);
+            statement = simplifier.simplify_statement(statement);
+        }
+        visit(statement);
+        return statement;
+    }
 
-        Operand l_op = lhs->get_operand();
-        Operand r_op = rhs->get_operand();
+public:
 
-        int tag = node_get_tag(lhs);
-        if (l_op.get_is_scalar()) {
-            // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-            // ldi vr3, (vr1)
-            long lreg = next_vreg();
-            Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
-            auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
-            l_op = ldest;
-            code->add_instruction(lload);
+    // the code of a subprogram starts by copying its parameters into
+    // their vregs, and a function ends by returning its result variable
+    void gen_subprogram(struct Node *ast, bool is_function) {
+        Node *ident = node_get_kid(ast, 0);
+        Type *type = node_get_symbol(ident)->get_type();
+        int kid = is_function ? 3 : 2;
+        Node *declarations = node_get_kid(ast, kid);
+        Node *instructions = node_get_kid(ast, kid + 1);
+
+        begin_function(type->symtab, get_subprogram_label(ident));
+        scan_aggregate_uses(instructions);
+        visit_declarations(declarations);
+        for (unsigned i = 0; i < type->paramTypes.size(); i++) {
+            const Symbol &param = m_symtab->get_symbol(i);
+            Operand dest = scalars[ScalarName(param.get_atom(), 0, -1)];
+            code->add_instruction(new Instruction(HINS_PARAM, dest, Operand(OPERAND_INT_LITERAL, long(i))));
+        }
+        visit(instructions);
+        if (is_function) {
+            Operand result = scalars[ScalarName(node_get_atom(ident), 0, -1)];
+            code->add_instruction(new Instruction(HINS_RETURN, result));
+        } else if (code->get_length() == 0) {
+            // (a procedure which does nothing)
+            code->add_instruction(new Instruction(HINS_NOP));
         }
+        end_function(get_subprogram_label(ident), false);
+    }
 
-        if (!rhs->is_const()) {
-            tag = node_get_tag(rhs);
-            if (r_op.get_is_scalar()) {
-                // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-                // ldi vr4, (vr2)
-                long rreg = next_vreg();
-                Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
-                auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
-                r_op = rdest;
-                code->add_instruction(rload);
+    void visit_declarations(struct Node *ast) override {
+        for (const Symbol &symbol : *m_symtab) {
+            if (symbol.get_kind() != VARIABLE || shared_variables.count(symbol.get_offset()) > 0) {
+                continue;
+            }
+            Type *type = symbol.get_type();
+            if (type->realType == PRIMITIVE) {
+                // this is a scalar variable
+                add_scalar(ScalarName(symbol.get_atom(), 0, -1));
+            } else if (type->realType == ARRAY && is_promotable_array(symbol)) {
+                for (long i = 0; i < type->arraySize; i++) {
+                    add_scalar(ScalarName(symbol.get_atom(), 0, i));
+                }
+            } else if (type->realType == RECORD && unpromotable.count(symbol.get_atom()) == 0) {
+                for (const Symbol &field : *type->symtab) {
+                    if (field.get_kind() == VARIABLE && field.get_type()->realType == PRIMITIVE) {
+                        add_scalar(ScalarName(symbol.get_atom(), field.get_atom(), -1));
+                    }
+                }
             }
         }
 
-        auto *cmpins = new Instruction(HINS_INT_COMPARE, l_op, r_op);
-        code->add_instruction(cmpins);
+        set_initial_vreg(scalars.size() - 1);
 
-        Instruction *jumpins;
-        if (ast->is_inverted()) {
-            jumpins = new Instruction(HINS_JGT, ast->get_operand());
-        } else {
-            jumpins = new Instruction(HINS_JLTE, ast->get_operand());
+        // specifically disable visits to declarations so no vregs are incremented
+        //ASTVisitor::visit_declarations(ast);
+        reset_vreg();
+    }
+
+    void visit_if(struct Node *ast) override {
+        Node *cond = ast->get_kid(0);
+        Node *iftrue = ast->get_kid(1);
+
+        std::string out_label = next_label();
+
+        set_inverted(cond);
+        Operand op_out(out_label);
+        set_operand(cond, op_out);
+
+        visit(cond);
+        visit(iftrue);
+        define_label(out_label);
+    }
+
+    void visit_if_else(struct Node *ast) override {
+        Node *condition = node_get_kid(ast, 0);
+        Node *iftrue = node_get_kid(ast, 1);
+        Node *otherwise = node_get_kid(ast, 2);
+
+        Operand selector;
+        std::vector<CaseArm> arms;
+        if (get_if_ladder(ast, selector, arms, otherwise)) {
+            emit_case(selector, arms, otherwise);
+            return;
         }
+
+        std::string else_label = next_label();
+        std::string out_label = next_label();
+
+        set_inverted(condition);
+        Operand op_else(else_label);
+        set_operand(condition, op_else);
+
+        visit(condition);
+        visit(iftrue);
+        Operand op_out(out_label);
+        auto *jumpins = new Instruction(HINS_JUMP, op_out);  // jump after iftrue to skip else
         code->add_instruction(jumpins);
+        code->define_label(else_label);
+        visit(otherwise);
+        define_label(out_label);
+
+        // add no-op to resolve define_label assertion error
+        auto *noopins = new Instruction(HINS_NOP);
+        code->add_instruction(noopins);
     }
 
-    void visit_compare_gt(struct Node *ast) override {
-        ASTVisitor::visit_compare_gt(ast);
+    void visit_repeat(struct Node *ast) override {
+        Node *instructions = node_get_kid(ast, 0);
+        Node *condition = node_get_kid(ast, 1);
 
-        Node *lhs = node_get_kid(ast, 0);
-        Node *rhs = node_get_kid(ast, 1);
+        std::string loop_body_label = next_label();         // .L0
+        std::string loop_condition_label = next_label();    // .L1
 
-        Operand l_op = lhs->get_operand();
-        Operand r_op = rhs->get_operand();
+        Operand op_loop_body(loop_body_label);
+        Operand op_loop_condition(loop_condition_label);
 
-        int tag = node_get_tag(lhs);
-        if (l_op.get_is_scalar()) {
-            // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-            // ldi vr3, (vr1)
-            long lreg = next_vreg();
-            Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
-            auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
-            l_op = ldest;
-            code->add_instruction(lload);
-        }
+        // no need to jump, will flow right into loop body for first loop iteration
 
-        if (!rhs->is_const()) {
-            tag = node_get_tag(rhs);
-            if (r_op.get_is_scalar()) {
-                // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-                // ldi vr4, (vr2)
-                long rreg = next_vreg();
-                Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
-                auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
-                r_op = rdest;
-                code->add_instruction(rload);
-            }
-        }
+        define_label(loop_body_label);
+        visit(instructions);
 
-        auto *cmpins = new Instruction(HINS_INT_COMPARE, l_op, r_op);
-        code->add_instruction(cmpins);
+        define_label(loop_condition_label);
+        set_inverted(condition);
+        set_operand(condition, op_loop_body);
+        visit(condition);
+    }
 
-        Instruction *jumpins;
-        if (ast->is_inverted()) {
-            jumpins = new Instruction(HINS_JLTE, ast->get_operand());
-        } else {
-            jumpins = new Instruction(HINS_JGT, ast->get_operand());
+    // WHILE c DO ... END is generated already rotated, with its test at
+    // the bottom, so each iteration only takes the conditional branch
+    // back to the body:
+    //     jmp .L1
+    // .L0:
+    //     (the body)
+    // .L1:
+    //     (the test of c)
+    //     jcc .L0
+    // (Copying the test before the loop, instead of jumping to it, would
+    // only save the jump on entering the loop, and the loop passes expect
+    // the test to be the loop's header, see LoopForest.)
+    void visit_while(struct Node *ast) override {
+        if (use_runtime && is_array_io_loop(ast, AST_WRITE)) {
+            emit_array_io_loop(ast, HINS_WRITE_INT_ARRAY);
+            return;
+        }
+        // (an element read out of bounds must trap before it's stored)
+        if (use_runtime && !bounds_check && is_array_io_loop(ast, AST_READ)) {
+            emit_array_io_loop(ast, HINS_READ_INT_ARRAY);
+            return;
         }
+
+        Node *condition = node_get_kid(ast, 0);
+        Node *instructions = node_get_kid(ast, 1);
+
+        std::string loop_body_label = next_label();         // .L0
+        std::string loop_condition_label = next_label();    // .L1
+
+        Operand op_loop_condition(loop_condition_label);
+        auto *jumpins = new Instruction(HINS_JUMP, op_loop_condition);
         code->add_instruction(jumpins);
+
+        // loop body
+        Operand op_loop_body(loop_body_label);
+        code->define_label(loop_body_label);
+        visit(instructions);
+
+        // loop condition
+        define_label(loop_condition_label);
+        set_operand(condition, op_loop_body);
+        visit(condition);
     }
 
-    void visit_compare_gte(struct Node *ast) override {
-        ASTVisitor::visit_compare_gte(ast);
+    // FOR i := a TO b DO ... END is the counted loop
+    //     i := a; t := b; WHILE i <= t DO ...; i := i + 1 END
+    // where t is a vreg (or b itself, if it's a constant), kept for the
+    // whole loop, so the bound is only evaluated once:
+    //     mov vrI, a
+    //     mov vrT, b
+    //     jmp .L1
+    // .L0:
+    //     (the body)
+    //     addi vrI, vrI, $1
+    // .L1:
+    //     cmpi vrI, vrT
+    //     jlte .L0
+    // (with loads and stores of a loop variable stored in memory)
+    void visit_for(struct Node *ast) override {
+        Node *var_ref = node_get_kid(ast, 0);
+        Node *from = node_get_kid(ast, 1);
+        Node *to = node_get_kid(ast, 2);
+        Node *instructions = node_get_kid(ast, 3);
+
+        if (!from->is_const()) {
+            visit(from);
+        }
+        store_variable(var_ref, get_value_operand(from));
+        reset_vreg();
 
-        Node *lhs = node_get_kid(ast, 0);
-        Node *rhs = node_get_kid(ast, 1);
+        // (the temporary vregs of the body are allocated above the bound's)
+        long outer_initial_vreg = initial_vreg;
+        Operand bound;
+        if (to->is_const()) {
+            bound = Operand(OPERAND_INT_LITERAL, to->get_ival());
+        } else {
+            bound = Operand(OPERAND_VREG, next_vreg());
+            set_initial_vreg(bound.get_base_reg());
+            visit(to);
+            code->add_instruction(new Instruction(HINS_MOV, bound, get_value_operand(to)));
+            reset_vreg();
+        }
 
-        Operand l_op = lhs->get_operand();
-        Operand r_op = rhs->get_operand();
+        std::string loop_body_label = next_label();         // .L0
+        std::string loop_condition_label = next_label();    // .L1
+        code->add_instruction(new Instruction(HINS_JUMP, Operand(loop_condition_label)));
 
-        int tag = node_get_tag(lhs);
-        if (l_op.get_is_scalar()) {
-            // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-            // ldi vr3, (vr1)
-            long lreg = next_vreg();
-            Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
-            auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
-            l_op = ldest;
-            code->add_instruction(lload);
+        code->define_label(loop_body_label);
+        visit(instructions);
+        Operand value = load_variable(var_ref);
+        if (value.get_is_scalar()) {
+            code->add_instruction(new Instruction(HINS_INT_ADD, value, value, Operand(OPERAND_INT_LITERAL, 1)));
+        } else {
+            Operand sum(OPERAND_VREG, next_vreg());
+            code->add_instruction(new Instruction(HINS_INT_ADD, sum, value, Operand(OPERAND_INT_LITERAL, 1)));
+            store_variable(var_ref, sum);
         }
+        reset_vreg();
 
-        if (!rhs->is_const()) {
-            tag = node_get_tag(rhs);
-            if (r_op.get_is_scalar()) {
-                // just use r_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-                // ldi vr4, (vr2)
-                long rreg = next_vreg();
-                Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
-                auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
-                r_op = rdest;
-                code->add_instruction(rload);
+        define_label(loop_condition_label);
+        code->add_instruction(new Instruction(HINS_INT_COMPARE, load_variable(var_ref), bound));
+        code->add_instruction(new Instruction(HINS_JLTE, Operand(loop_body_label)));
+
+        set_initial_vreg(outer_initial_vreg);
+        reset_vreg();
+    }
+
+    void visit_case(struct Node *ast) override {
+        Node *selector = node_get_kid(ast, 0);
+        Node *arm_list = node_get_kid(ast, 1);
+        Node *otherwise = node_get_kid(ast, 2);
+
+        std::vector<CaseArm> arms;
+        for (int i = 0; i < node_get_num_kids(arm_list); i++) {
+            Node *arm = node_get_kid(arm_list, i);
+            Node *values = node_get_kid(arm, 0);
+            arms.push_back(CaseArm{ std::vector<long>(), node_get_kid(arm, 1) });
+            for (int j = 0; j < node_get_num_kids(values); j++) {
+                arms.back().values.push_back(node_get_kid(values, j)->get_ival());
             }
         }
 
-        auto *cmpins = new Instruction(HINS_INT_COMPARE, l_op, r_op);
-        code->add_instruction(cmpins);
-
-        Instruction *jumpins;
-        if (ast->is_inverted()) {
-            jumpins = new Instruction(HINS_JLT, ast->get_operand());
-        } else {
-            jumpins = new Instruction(HINS_JGTE, ast->get_operand());
+        if (!selector->is_const()) {
+            visit(selector);
         }
-        code->add_instruction(jumpins);
+        emit_case(get_value_operand(selector), arms, otherwise);
+    }
+
+    void visit_compare_eq(struct Node *ast) override {
+        ASTVisitor::visit_compare_eq(ast);
+        emit_compare(ast, HINS_JE, HINS_JNE);
+    }
+
+    void visit_compare_neq(struct Node *ast) override {
+        ASTVisitor::visit_compare_neq(ast);
+        emit_compare(ast, HINS_JNE, HINS_JE);
+    }
+
+    void visit_compare_lt(struct Node *ast) override {
+        ASTVisitor::visit_compare_lt(ast);
+        emit_compare(ast, HINS_JLT, HINS_JGTE);
+    }
+
+    void visit_compare_lte(struct Node *ast) override {
+        ASTVisitor::visit_compare_lte(ast);
+        emit_compare(ast, HINS_JLTE, HINS_JGT);
+    }
+
+    void visit_compare_gt(struct Node *ast) override {
+        ASTVisitor::visit_compare_gt(ast);
+        emit_compare(ast, HINS_JGT, HINS_JLTE);
+    }
+
+    void visit_compare_gte(struct Node *ast) override {
+        ASTVisitor::visit_compare_gte(ast);
+        emit_compare(ast, HINS_JGTE, HINS_JLT);
     }
 
     void visit_read(struct Node *ast) override {
@@ -814,13 +1753,13 @@ public:
         // storeint into loaded addr
         // sti (vr0), vr1
         Node *varref = node_get_kid(ast, 0);
-        Operand destreg = varref->get_operand();    // don't use this one
+        Operand destreg = get_operand(varref);    // don't use this one
         if (destreg.get_is_scalar()) {
             auto *movins = new Instruction(HINS_MOV, destreg, readdest);
             code->add_instruction(movins);
         } else {
             Operand toaddr(OPERAND_VREG_MEMREF, destreg.get_base_reg());   // use this one
-            auto *storeins = new Instruction(HINS_STORE_INT, toaddr, readdest);
+            auto *storeins = new Instruction(get_store_opcode(varref), toaddr, readdest);
             code->add_instruction(storeins);
         }
 
@@ -831,20 +1770,20 @@ public:
         ASTVisitor::visit_write(ast);
 
         Node* kid = node_get_kid(ast, 0);
-        Operand op = kid->get_operand();
+        Operand op = get_operand(kid);
 
         int tag = node_get_tag(kid);
         if (op.get_is_scalar()) {
             // just use op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF || tag == AST_FIELD_REF) {
             // loadint from addr to vreg
             // ldi vr1, (vr0)
             long toreg = next_vreg();
             Operand writedest(OPERAND_VREG, toreg);
             op = writedest;
-            Operand fromreg = kid->get_operand();    // don't use this one
+            Operand fromreg = get_operand(kid);    // don't use this one
             Operand fromaddr(OPERAND_VREG_MEMREF, fromreg.get_base_reg()); // use this one
-            auto *loadins = new Instruction(HINS_LOAD_INT, writedest, fromaddr);
+            auto *loadins = new Instruction(get_load_opcode(kid), writedest, fromaddr);
             code->add_instruction(loadins);
         }
 
@@ -857,37 +1796,51 @@ public:
     }
 
     void visit_assign(struct Node *ast) override {
+        Node* lhs = node_get_kid(ast, 0);
+        Node* rhs = node_get_kid(ast, 1);
+        Type* type = lhs->get_type();
+        if (type != nullptr && type->realType != PRIMITIVE) {
+            // an array or record assigned as a whole
+            if (is_promoted_record(lhs) || is_promoted_record(rhs)) {
+                emit_record_assign(lhs, rhs);
+            } else {
+                ASTVisitor::visit_assign(ast);
+                emit_block_copy(get_operand(lhs), get_operand(rhs), type->get_size());
+            }
+            reset_vreg();
+            return;
+        }
+
         ASTVisitor::visit_assign(ast);
 
         // storeint into loaded addr
         // sti (vr0), vr1
-        Node* lhs = node_get_kid(ast, 0);
-        Node* rhs = node_get_kid(ast, 1);
 
-        Operand valop = rhs->get_operand();
+        Operand valop = get_operand(rhs);
 
         if (!rhs->is_const()) {
             int tag = node_get_tag(rhs);
             if (valop.get_is_scalar()) {
                 // do nothing
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF || tag == AST_FIELD_REF) {
                 long vreg = next_vreg();
                 Operand loaddest(OPERAND_VREG, vreg);
-                auto *loadins = new Instruction(HINS_LOAD_INT, loaddest, valop.to_memref());
+                auto *loadins = new Instruction(get_load_opcode(rhs), loaddest, valop.to_memref());
                 code->add_instruction(loadins);
                 valop = loaddest;
             }
         }
 
-        Operand l_vreg = lhs->get_operand();
+        Operand l_vreg = get_operand(lhs);
 
-        if (node_get_tag(lhs) == AST_VAR_REF || node_get_tag(lhs) == AST_ARRAY_ELEMENT_REF) {
+        int lhs_tag = node_get_tag(lhs);
+        if (lhs_tag == AST_VAR_REF || lhs_tag == AST_ARRAY_ELEMENT_REF || lhs_tag == AST_FIELD_REF) {
             if (l_vreg.get_is_scalar()) {
                 auto *movins = new Instruction(HINS_MOV, l_vreg, valop);
                 code->add_instruction(movins);
             } else {
                 Operand refop(OPERAND_VREG_MEMREF, l_vreg.get_base_reg());
-                auto *storeins = new Instruction(HINS_STORE_INT, refop, valop);
+                auto *storeins = new Instruction(get_store_opcode(lhs), refop, valop);
                 code->add_instruction(storeins);
             }
         } else {
@@ -898,208 +1851,222 @@ public:
         reset_vreg();
     }
 
-    void visit_add(struct Node *ast) override {
-        ASTVisitor::visit_add(ast);
-
-        Node* lhs = node_get_kid(ast, 0);
-        Node* rhs = node_get_kid(ast, 1);
-
-        Operand l_op = lhs->get_operand();
-        Operand r_op = rhs->get_operand();
+    // the vreg of a field of a record variable promoted to scalars, or a
+    // null pointer if the record is stored in memory
+    const Operand *get_field_scalar(struct Node *var_ref, const Symbol &field) {
+        auto it = scalars.find(ScalarName(get_var_ref_name(var_ref), field.get_atom(), -1));
+        return (it != scalars.end()) ? &it->second : nullptr;
+    }
 
-        int tag = node_get_tag(lhs);
-        if (l_op.get_is_scalar()) {
-            // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-            // ldi vr3, (vr1)
-            long lreg = next_vreg();
-            Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
-            auto* lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
-            l_op = ldest;
-            code->add_instruction(lload);
+    bool is_promoted_record(struct Node *ast) {
+        if (node_get_tag(ast) != AST_VAR_REF || ast->get_type()->realType != RECORD) {
+            return false;
         }
-
-        if (!rhs->is_const()) {
-            tag = node_get_tag(rhs);
-            if (r_op.get_is_scalar()) {
-                // just use l_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-                // ldi vr4, (vr2)
-                long rreg = next_vreg();
-                Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
-                auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
-                r_op = rdest;
-                code->add_instruction(rload);
-            }
-        }
-
-        // addi vr5, vr3, vr4
-        long result_reg = next_vreg();
-        Operand adddest(OPERAND_VREG, result_reg);
-        auto* divins = new Instruction(HINS_INT_ADD, adddest, l_op, r_op);
-        code->add_instruction(divins);
-
-        ast->set_operand(adddest);
+        SymbolTable *fields = ast->get_type()->symtab;
+        return fields->begin() != fields->end() && get_field_scalar(ast, *fields->begin()) != nullptr;
     }
 
-    void visit_subtract(struct Node *ast) override {
-        ASTVisitor::visit_subtract(ast);
+    // emit the assignment of a record variable to another (matched by
+    // is_record_assign), one of which is promoted to scalars, copying each
+    // field from its vreg, or through the address of a record in memory
+    //     ldi vr3, (vr2)        (or mov vrF, vrG to a promoted field)
+    //     sti (vr1), vr3
+    void emit_record_assign(struct Node *lhs, struct Node *rhs) {
+        Operand lhs_addr, rhs_addr;
+        if (!is_promoted_record(lhs)) {
+            visit(lhs);
+            lhs_addr = get_operand(lhs);
+        }
+        if (!is_promoted_record(rhs)) {
+            visit(rhs);
+            rhs_addr = get_operand(rhs);
+        }
 
-        Node* lhs = node_get_kid(ast, 0);
-        Node* rhs = node_get_kid(ast, 1);
+        Type *type = lhs->get_type();
+        unsigned index = 0;
+        for (const Symbol &field : *type->symtab) {
+            Operand offset(OPERAND_INT_LITERAL, type->get_field_offset(index++));
+            bool is_char = (field.get_type() == type_get_char());
 
-        Operand l_op = lhs->get_operand();
-        Operand r_op = rhs->get_operand();
+            Operand value;
+            const Operand *source = get_field_scalar(rhs, field);
+            if (source != nullptr) {
+                value = *source;
+            } else {
+                Operand addr(OPERAND_VREG, next_vreg());
+                value = Operand(OPERAND_VREG, next_vreg());
+                code->add_instruction(new Instruction(HINS_INT_ADD, addr, rhs_addr, offset));
+                code->add_instruction(new Instruction(is_char ? HINS_LOAD_CHAR : HINS_LOAD_INT, value, addr.to_memref()));
+            }
 
-        // ldi vr3, (vr1)
-        int tag = node_get_tag(lhs);
-        if (l_op.get_is_scalar()) {
-            // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-            long lreg = next_vreg();
-            Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
-            auto *lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
-            l_op = ldest;
-            code->add_instruction(lload);
+            const Operand *dest = get_field_scalar(lhs, field);
+            if (dest != nullptr) {
+                code->add_instruction(new Instruction(HINS_MOV, *dest, value));
+            } else {
+                Operand addr(OPERAND_VREG, next_vreg());
+                code->add_instruction(new Instruction(HINS_INT_ADD, addr, lhs_addr, offset));
+                code->add_instruction(new Instruction(is_char ? HINS_STORE_CHAR : HINS_STORE_INT, addr.to_memref(), value));
+            }
         }
+    }
 
-        if (!rhs->is_const()) {
-            tag = node_get_tag(rhs);
-            if (r_op.get_is_scalar()) {
-                // just use l_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-                // ldi vr4, (vr2)
-                long rreg = next_vreg();
-                Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
-                auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
-                r_op = rdest;
-                code->add_instruction(rload);
+    // emit the copy of size bytes from the array or record at the address
+    // in src to the one at the address in dest (which are the same, or
+    // don't overlap): a small one is copied by loading and storing each
+    // integer, and a larger one by
+    //     copyi vr1, vr2, $n
+    // and then any bytes left over (of an array of CHARs) one at a time
+    void emit_block_copy(const Operand &dest, const Operand &src, long size) {
+        long num_integers = size / INTEGER_SIZE;
+        long offset = 0;
+        auto emit_copy = [&](int load_opcode, int store_opcode) {
+            Operand dest_addr = dest, src_addr = src;
+            if (offset != 0) {
+                dest_addr = Operand(OPERAND_VREG, next_vreg());
+                src_addr = Operand(OPERAND_VREG, next_vreg());
+                code->add_instruction(new Instruction(HINS_INT_ADD, dest_addr, dest, Operand(OPERAND_INT_LITERAL, offset)));
+                code->add_instruction(new Instruction(HINS_INT_ADD, src_addr, src, Operand(OPERAND_INT_LITERAL, offset)));
             }
+            Operand value(OPERAND_VREG, next_vreg());
+            code->add_instruction(new Instruction(load_opcode, value, src_addr.to_memref()));
+            code->add_instruction(new Instruction(store_opcode, dest_addr.to_memref(), value));
+        };
+
+        if (size <= MAX_UNROLLED_COPY_SIZE) {
+            for (; offset < num_integers * INTEGER_SIZE; offset += INTEGER_SIZE) {
+                emit_copy(HINS_LOAD_INT, HINS_STORE_INT);
+            }
+        } else {
+            code->add_instruction(new Instruction(HINS_COPY_INT, dest, src, Operand(OPERAND_INT_LITERAL, num_integers)));
+            offset = num_integers * INTEGER_SIZE;
+        }
+        for (; offset < size; offset++) {
+            emit_copy(HINS_LOAD_CHAR, HINS_STORE_CHAR);
         }
+    }
 
-        // subi vr5, vr3, vr4
-        long result_reg = next_vreg();
-        Operand subdest(OPERAND_VREG, result_reg);
-        auto* divins = new Instruction(HINS_INT_SUB, subdest, l_op, r_op);
-        code->add_instruction(divins);
+    // arithmetic operations are traversed without recursion (see
+    // SymbolTableBuilder), generating the code for each operation after
+    // the code for its operands, which are evaluated in the order needing
+    // the fewest vregs (an operation folded to a constant is loaded like
+    // a literal)
+    void visit_add(struct Node *ast) override {
+        visit_arithmetic(ast);
+    }
 
-        ast->set_operand(subdest);
+    void visit_subtract(struct Node *ast) override {
+        visit_arithmetic(ast);
     }
 
     void visit_multiply(struct Node *ast) override {
-        ASTVisitor::visit_multiply(ast);
-
-        Node* lhs = node_get_kid(ast, 0);
-        Node* rhs = node_get_kid(ast, 1);
-
-        Operand l_op = lhs->get_operand();
-        Operand r_op = rhs->get_operand();
-
-        int tag = node_get_tag(lhs);
-        if (l_op.get_is_scalar()) {
-            // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-            // ldi vr3, (vr1)
-            long lreg = next_vreg();
-            Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
-            auto *lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
-            l_op = ldest;
-            code->add_instruction(lload);
-        }
-
-        if (!rhs->is_const()) {
-            tag = node_get_tag(rhs);
-            if (r_op.get_is_scalar()) {
-                // just use l_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-                // ldi vr4, (vr2)
-                long rreg = next_vreg();
-                Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
-                auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
-                r_op = rdest;
-                code->add_instruction(rload);
-            }
-        }
-
-        // muli vr5, vr3, vr4
-        long result_reg = next_vreg();
-        Operand muldest(OPERAND_VREG, result_reg);
-        auto* divins = new Instruction(HINS_INT_MUL, muldest, l_op, r_op);
-        code->add_instruction(divins);
-
-        ast->set_operand(muldest);
+        visit_arithmetic(ast);
     }
 
     void visit_divide(struct Node *ast) override {
-        ASTVisitor::visit_divide(ast);
-
-        Node* lhs = node_get_kid(ast, 0);
-        Node* rhs = node_get_kid(ast, 1);
+        visit_arithmetic(ast);
+    }
 
-        Operand l_op = lhs->get_operand();
-        Operand r_op = rhs->get_operand();
+    void visit_modulus(struct Node *ast) override {
+        visit_arithmetic(ast);
+    }
 
-        int tag = node_get_tag(lhs);
-        if (l_op.get_is_scalar()) {
-            // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-            // ldi vr3, (vr1)
-            long lreg = next_vreg();
-            Operand ldest(OPERAND_VREG, lreg);
-            Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
-            auto *lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
-            l_op = ldest;
-            code->add_instruction(lload);
+    void visit_arithmetic(struct Node *ast) {
+        if (ast->is_const()) {
+            emit_constant(ast);
+            return;
         }
+        label_register_needs(ast);
+        traverse(ast);
+    }
 
-        if (!rhs->is_const()) {
-            tag = node_get_tag(rhs);
-            if (r_op.get_is_scalar()) {
-                // just use l_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
-                // ldi vr4, (vr2)
-                long rreg = next_vreg();
-                Operand rdest(OPERAND_VREG, rreg);
-                Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
-                auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
-                r_op = rdest;
-                code->add_instruction(rload);
+    // is a node an arithmetic operation whose code is generated?
+    static bool is_operation(struct Node *ast) {
+        return is_arithmetic(ast) && !ast->is_const();
+    }
+
+    // compute the register needs of an expression's nodes (without
+    // recursion): an operand which is a scalar variable needs no vreg,
+    // and any other operand which isn't an arithmetic operation needs one
+    // (to hold its value); an operation whose operands need l and r vregs
+    // needs max(l, r) if they differ (evaluating the operand needing more
+    // first), and l + 1 otherwise.  (The nodes of an expression nested in
+    // one already labeled, such as an array index, aren't labeled again.)
+    void label_register_needs(struct Node *root) {
+        // each entry is a node, and whether its children have been labeled
+        std::vector<std::pair<Node *, bool>> stack(1, std::make_pair(root, false));
+        while (!stack.empty()) {
+            Node *ast = stack.back().first;
+            if (register_needs.count(ast) > 0) {
+                stack.pop_back();
+                continue;
+            }
+            if (!stack.back().second) {
+                stack.back().second = true;
+                for (int i = 0; i < node_get_num_kids(ast); i++) {
+                    stack.push_back(std::make_pair(node_get_kid(ast, i), false));
+                }
+                continue;
+            }
+            stack.pop_back();
+
+            bool has_call = (node_get_tag(ast) == AST_FUNCTION_CALL);
+            for (int i = 0; i < node_get_num_kids(ast); i++) {
+                has_call = has_call || calls.count(node_get_kid(ast, i)) > 0;
+            }
+            if (has_call) {
+                calls.insert(ast);
+            }
+
+            if (is_operation(ast)) {
+                Node *lhs = node_get_kid(ast, 0);
+                Node *rhs = node_get_kid(ast, 1);
+                int l = register_needs[lhs], r = register_needs[rhs];
+                register_needs[ast] = (l == r) ? l + 1 : std::max(l, r);
+                if (r > l && calls.count(lhs) == 0 && calls.count(rhs) == 0) {
+                    reversed_operations.insert(ast);
+                }
+            } else {
+                register_needs[ast] = (get_scalar_ref(ast) != nullptr) ? 0 : 1;
             }
         }
+    }
 
-        // divi vr5, vr3, vr4
-        long result_reg = next_vreg();
-        Operand divdest(OPERAND_VREG, result_reg);
-        auto* divins = new Instruction(HINS_INT_DIV, divdest, l_op, r_op);
-        code->add_instruction(divins);
+    bool reverse_kids(struct Node *ast) override {
+        return reversed_operations.count(ast) > 0;
+    }
 
-        ast->set_operand(divdest);
+    bool pre_visit(struct Node *ast) override {
+        if (is_operation(ast)) {
+            operation_vregs.push_back(m_vreg);
+            return true;
+        }
+        visit(ast);
+        return false;
     }
 
-    void visit_modulus(struct Node *ast) override {
-        ASTVisitor::visit_modulus(ast);
+    void post_visit(struct Node *ast) override {
+        if (is_operation(ast)) {
+            gen_arithmetic(ast);
+        }
+    }
 
+    // generate code for an arithmetic operation, whose operands have been visited
+    void gen_arithmetic(struct Node *ast) {
         Node* lhs = node_get_kid(ast, 0);
         Node* rhs = node_get_kid(ast, 1);
 
-        Operand l_op = lhs->get_operand();
-        Operand r_op = rhs->get_operand();
+        Operand l_op = get_operand(lhs);
+        Operand r_op = get_operand(rhs);
 
         int tag = node_get_tag(lhs);
         if (l_op.get_is_scalar()) {
             // just use l_op directly
-        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+        } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF || tag == AST_FIELD_REF) {
             // ldi vr3, (vr1)
             long lreg = next_vreg();
             Operand ldest(OPERAND_VREG, lreg);
             Operand lfrom(OPERAND_VREG_MEMREF, l_op.get_base_reg());
-            auto *lload = new Instruction(HINS_LOAD_INT, ldest, lfrom);
+            auto* lload = new Instruction(get_load_opcode(lhs), ldest, lfrom);
             l_op = ldest;
             code->add_instruction(lload);
         }
@@ -1108,28 +2075,74 @@ public:
             tag = node_get_tag(rhs);
             if (r_op.get_is_scalar()) {
                 // just use l_op directly
-            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF) {
+            } else if (tag == AST_VAR_REF || tag == AST_ARRAY_ELEMENT_REF || tag == AST_FIELD_REF) {
                 // ldi vr4, (vr2)
                 long rreg = next_vreg();
                 Operand rdest(OPERAND_VREG, rreg);
                 Operand rfrom(OPERAND_VREG_MEMREF, r_op.get_base_reg());
-                auto *rload = new Instruction(HINS_LOAD_INT, rdest, rfrom);
+                auto *rload = new Instruction(get_load_opcode(rhs), rdest, rfrom);
                 r_op = rdest;
                 code->add_instruction(rload);
             }
         }
 
-        // divi vr5, vr3, vr4
+        int opcode;
+        switch (node_get_tag(ast)) {
+        case AST_ADD:
+            opcode = HINS_INT_ADD;
+            break;
+        case AST_SUBTRACT:
+            opcode = HINS_INT_SUB;
+            break;
+        case AST_MULTIPLY:
+            opcode = HINS_INT_MUL;
+            break;
+        case AST_DIVIDE:
+            opcode = HINS_INT_DIV;
+            break;
+        default:
+            opcode = HINS_INT_MOD;
+            break;
+        }
+
+        // addi vr5, vr3, vr4 (or subi, muli, divi, modi), where the
+        // result reuses the first vreg allocated for the operands (whose
+        // vregs are free once they are consumed)
+        m_vreg = operation_vregs.back();
+        operation_vregs.pop_back();
         long result_reg = next_vreg();
-        Operand moddest(OPERAND_VREG, result_reg);
-        auto* modins = new Instruction(HINS_INT_MOD, moddest, l_op, r_op);
-        code->add_instruction(modins);
+        Operand dest(OPERAND_VREG, result_reg);
+        auto *ins = new Instruction(opcode, dest, l_op, r_op);
+        code->add_instruction(ins);
 
-        ast->set_operand(moddest);
+        set_operand(ast, dest);
     }
 
     void visit_array_element_ref(struct Node *ast) override {
-        ASTVisitor::visit_array_element_ref(ast);
+        Node *designator = node_get_kid(ast, 0);
+        Node *index_node = node_get_kid(ast, 1);
+        if (node_get_tag(designator) == AST_VAR_REF && index_node->is_const()) {
+            // an element of an array promoted to scalars?
+            auto it = scalars.find(ScalarName(get_var_ref_name(designator), 0, index_node->get_ival()));
+            if (it != scalars.end()) {
+                if (bounds_check) {
+                    emit_bounds_check(Operand(OPERAND_INT_LITERAL, index_node->get_ival()),
+                                      get_var_ref_symbol(designator).get_type()->arraySize);
+                }
+                set_operand(ast, it->second);
+                return;
+            }
+        }
+
+        // with a constant index, the offset is computed here (rather than
+        // by multiplying at run time), so the address is a single add
+        bool constant_index = index_node->is_const() && index_node->get_ival() >= -MAX_CONSTANT_INDEX
+                && index_node->get_ival() <= MAX_CONSTANT_INDEX;
+        if (constant_index) {
+            visit(designator);
+        } else {
+            ASTVisitor::visit_array_element_ref(ast);
+        }
 
         // load array start addr into vr0
         // load array accessor into into vr1
@@ -1142,34 +2155,105 @@ public:
         // vr3 = vr0 + vr2
 
         Node *identifier = node_get_kid(ast, 0);
-        Operand arr_start = identifier->get_operand();
+        Operand arr_start = get_operand(identifier);
 
         Node *index = node_get_kid(ast, 1);
-        Operand index_op = index->get_operand();
-
-        if (index_op.get_is_scalar()) {
-            // do nothing
-        } else if (node_get_tag(index) == AST_VAR_REF) {   // dereference any identifiers passed into index
-            index_op = index_op.to_memref();
-        }   // otherwise, the index immediate is safe to use
+        Operand index_op;
+        if (!constant_index) {
+            index_op = get_operand(index);
+            if (index_op.get_is_scalar()) {
+                // do nothing
+            } else if (node_get_tag(index) == AST_VAR_REF) {   // dereference any identifiers passed into index
+                index_op = index_op.to_memref();
+            }   // otherwise, the index immediate is safe to use
+        }
 
-        const char* varname = node_get_str(identifier);
-        Type *array_type = m_symtab->lookup(varname).get_type();
+        // (only an element of an array variable is supported: the lookup of
+        // any other designator fails)
+        Type *array_type = node_get_tag(identifier) == AST_VAR_REF
+                ? get_var_ref_symbol(identifier).get_type()
+                : m_symtab->lookup(node_get_atom(identifier)).get_type();
         Type *element_type = array_type->arrayElementType;
         Operand element_size(OPERAND_INT_LITERAL, element_type->get_size());
 
-        long next = next_vreg();
-        Operand offset_reg(OPERAND_VREG, next);
-        auto *mulins = new Instruction(HINS_INT_MUL, offset_reg, index_op, element_size);
-        code->add_instruction(mulins);
+        if (index_op.is_memref()) {
+            // (a program variable used by a subprogram is stored in memory:
+            // the index is loaded once, for both the check and the offset)
+            Operand loaded(OPERAND_VREG, next_vreg());
+            code->add_instruction(new Instruction(HINS_LOAD_INT, loaded, index_op));
+            index_op = loaded;
+        }
+        if (bounds_check) {
+            if (constant_index) {
+                emit_bounds_check(Operand(OPERAND_INT_LITERAL, index->get_ival()), array_type->arraySize);
+            } else {
+                emit_bounds_check(index_op, array_type->arraySize);
+            }
+        }
+
+        Operand offset_reg;
+        if (constant_index) {
+            offset_reg = Operand(OPERAND_INT_LITERAL, index->get_ival() * element_type->get_size());
+        } else {
+            offset_reg = Operand(OPERAND_VREG, next_vreg());
+            auto *mulins = new Instruction(HINS_INT_MUL, offset_reg, index_op, element_size);
+            code->add_instruction(mulins);
+        }
 
         // result reg now contains offset from array start
         // add the address and offset to get address of (arr[index])
-        next = next_vreg();
+        long next = next_vreg();
         Operand arr_addr_reg(OPERAND_VREG, next);
         auto *addins = new Instruction(HINS_INT_ADD, arr_addr_reg, arr_start, offset_reg);
         code->add_instruction(addins);
-        ast->set_operand(arr_addr_reg);
+        set_operand(ast, arr_addr_reg);
+        // (so that the element is loaded and stored with the opcodes for its type)
+        ast->set_type(element_type);
+    }
+
+    // check an array index (a vreg or literal) against the number of
+    // elements: a constant which is in range needs no check
+    void emit_bounds_check(const Operand &index, long size) {
+        if (index.get_kind() == OPERAND_INT_LITERAL && index.get_int_value() >= 0 && index.get_int_value() < size) {
+            return;
+        }
+        code->add_instruction(new Instruction(HINS_BOUNDS_CHECK, index, Operand(OPERAND_INT_LITERAL, size)));
+    }
+
+    void visit_field_ref(struct Node *ast) override {
+        Node *designator = node_get_kid(ast, 0);
+        Node *field = node_get_kid(ast, 1);
+        if (node_get_tag(designator) == AST_VAR_REF) {
+            auto it = scalars.find(ScalarName(get_var_ref_name(designator), node_get_atom(field), -1));
+            if (it != scalars.end()) {
+                set_operand(ast, it->second);
+                return;
+            }
+        }
+
+        // a field of a record stored in memory (used as a whole, or a
+        // program variable used by a subprogram) is at the record's
+        // address plus the field's offset
+        //     addi vr1, vr0, $8
+        visit(designator);
+        Type *record_type = node_get_tag(designator) == AST_VAR_REF
+                ? get_var_ref_symbol(designator).get_type()
+                : designator->get_type();
+        assert(record_type != nullptr && record_type->realType == RECORD);
+        unsigned index = 0;
+        for (const Symbol &symbol : *record_type->symtab) {
+            if (symbol.get_atom() == node_get_atom(field)) {
+                Operand addr(OPERAND_VREG, next_vreg());
+                Operand offset(OPERAND_INT_LITERAL, record_type->get_field_offset(index));
+                code->add_instruction(new Instruction(HINS_INT_ADD, addr, get_operand(designator), offset));
+                set_operand(ast, addr);
+                // (so that the field is loaded and stored with the opcodes for its type)
+                ast->set_type(symbol.get_type());
+                return;
+            }
+            index++;
+        }
+        assert(false);
     }
 
     void visit_var_ref(struct Node *ast) override {
@@ -1177,20 +2261,20 @@ public:
 
         // set Operand on Node
         Node *identifier = node_get_kid(ast, 0);
-        ast->set_str(node_get_str(identifier));
-        Operand op = identifier->get_operand();
-        ast->set_operand(op);
+        ast->set_atom(node_get_atom(identifier));
+        Operand op = get_operand(identifier);
+        set_operand(ast, op);
     }
 
     void visit_identifier(struct Node *ast) override {
         ASTVisitor::visit_identifier(ast);
 
-        const char* varname = node_get_str(ast);
+        Atom varname = node_get_atom(ast);
 
-        auto it = scalars.find(varname);
+        auto it = scalars.find(ScalarName(varname, 0, -1));
         if (it != scalars.end()) {
             Operand scalar_vreg = it->second;
-            ast->set_operand(scalar_vreg);
+            set_operand(ast, scalar_vreg);
             return;
         }
 
@@ -1201,7 +2285,7 @@ public:
 
         // get offset from symbol
         // instruction is an offset ref
-        Symbol sym = m_symtab->lookup(varname);
+        const Symbol &sym = *node_get_symbol(ast);
 
         if (sym.get_kind() == CONST) {
             long value = sym.get_ival();
@@ -1218,61 +2302,83 @@ public:
         }
 
         // set Operand to Node
-        ast->set_operand(destreg);
+        set_operand(ast, destreg);
 
         // don't reset virtual registers
     }
 
+    void visit_procedure_call(struct Node *ast) override {
+        // callp p, args...
+        std::vector<Operand> operands(1, Operand(get_subprogram_label(node_get_kid(ast, 0))));
+        gen_arguments(node_get_kid(ast, 1), operands);
+        code->add_instruction(new Instruction(HINS_CALL_PROC, operands));
+        reset_vreg();
+    }
+
+    void visit_function_call(struct Node *ast) override {
+        // call vrD, f, args...
+        Operand dest(OPERAND_VREG, next_vreg());
+        std::vector<Operand> operands;
+        operands.push_back(dest);
+        operands.push_back(Operand(get_subprogram_label(node_get_kid(ast, 0))));
+        gen_arguments(node_get_kid(ast, 1), operands);
+        code->add_instruction(new Instruction(HINS_CALL, operands));
+        set_operand(ast, dest);
+    }
+
+    // generate the code for the arguments of a call, appending their
+    // values to its operands
+    void gen_arguments(struct Node *args, std::vector<Operand> &operands) {
+        for (int i = 0; i < node_get_num_kids(args); i++) {
+            Node *arg = node_get_kid(args, i);
+            if (!arg->is_const()) {
+                visit(arg);
+            }
+            operands.push_back(get_value_operand(arg));
+        }
+    }
+
     void visit_int_literal(struct Node *ast) override {
         ASTVisitor::visit_int_literal(ast);
+        emit_constant(ast);
+    }
 
+    void emit_constant(struct Node *ast) {
         long vreg = next_vreg();
         Operand destreg(OPERAND_VREG, vreg);    // $vr0
         Operand immval(OPERAND_INT_LITERAL, ast->get_ival());   // $1
         auto *ins = new Instruction(HINS_LOAD_ICONST, destreg, immval);
         code->add_instruction(ins);
-        ast->set_operand(destreg);
+        set_operand(ast, destreg);
     }
 };
 
-class AssemblyCodeGen {
+class AssemblyCodeGen : public Lowering {
     // needs to know about storage requirements
     // needs to know highest virtual register value
     // needs HINS instruction sequence
 
 private:
-    InstructionSequence* assembly;
-    InstructionSequence* hins;
-    PrintHighLevelInstructionSequence* print_helper;
-    const long WORD_SIZE = 8;
-    long local_storage_size;
-    long num_vreg;
-    long total_storage_size;
-    // total is just local_storage_size + (WORD_SIZE * num_vreg)
-
-    // localaddr with $N means N offset of rsp
-    // N(%rsp)
-
-    // vrN means storage size + (N * 8);
-    // N = storage_size + (N * WORD_SIZE)
-    // N(%rsp)
-public:
-    AssemblyCodeGen(InstructionSequence* highlevelins, long storage_size, long vreg_max) {
-        hins = highlevelins;
-        local_storage_size = storage_size;
-        num_vreg = vreg_max;
+    const unsigned NUM_XMM_REGS = 16;
 
-        // calculate total storage
-        total_storage_size = local_storage_size + (num_vreg * WORD_SIZE);
-        // stack alignment check
-        if (total_storage_size % 16 != 0) {
-            total_storage_size += 8;
-        }
-        assembly = new InstructionSequence();
-        print_helper = new PrintHighLevelInstructionSequence(nullptr);
+    // the registers of the arguments of a subprogram (System V ABI)
+    static const unsigned MAX_ARGS = 6;
+    static const int ARG_REGS[MAX_ARGS];
+
+    // use the AVX forms of the vector instructions (see X86_64Cpu)
+    bool use_avx2;
+
+public:
+    AssemblyCodeGen(InstructionSequence* highlevelins, StorageLayout *storage_layout, long vreg_max)
+            : Lowering(highlevelins, storage_layout, vreg_max, MREG_RSP)
+            , use_avx2(false) {
     }
 
+    void set_avx2(bool avx2) { use_avx2 = avx2; }
+
     void translate_instructions() {
+        allocate_storage(MREG_XMM0, NUM_XMM_REGS, "SSE");
+
         // callee-owned
         Operand rsp(OPERAND_MREG, MREG_RSP);
         Operand rdi(OPERAND_MREG, MREG_RDI);
@@ -1281,13 +2387,22 @@ public:
         Operand r11(OPERAND_MREG, MREG_R11);
         Operand rax(OPERAND_MREG, MREG_RAX);
         Operand rdx(OPERAND_MREG, MREG_RDX);
+        Operand rcx(OPERAND_MREG, MREG_RCX);
 
         // static labels
         Operand inputfmt("s_readint_fmt", true);
         Operand outputfmt("s_writeint_fmt", true);
         Operand printf_label("printf");
         Operand scanf_label("scanf");
-
+        Operand write_int_label("__rt_write_int");
+        Operand read_int_label("__rt_read_int");
+        Operand write_int_array_label("__rt_write_int_array");
+        Operand read_int_array_label("__rt_read_int_array");
+        Operand fill_int_label("__rt_fill_int");
+        Operand copy_int_label("__rt_copy_int");
+
+        // set once the hot code has ended (see HINS_COLD)
+        bool ended = false;
         const long num_ins = hins->get_length();
         for (int i = 0; i < num_ins; i++) {
             auto *hin = hins->get_instruction(i);
@@ -1300,9 +2415,13 @@ public:
             switch(hin->get_opcode()) {
                 case HINS_LOCALADDR: {
                     Operand rhs = hin->get_operand(1); // offset is rhs
-                    Operand locaddr(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, rhs.get_int_value());
+                    const StorageLayout::Placement &placement = layout->get_placement(rhs.get_int_value());
+                    // (large variables are in .bss, addressed relative to %rip)
+                    Operand locaddr = placement.is_static
+                            ? Operand(OPERAND_LABEL_MEMREF, placement.label)
+                            : Operand(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, local_storage_offset + placement.offset);
                     auto *leaq = new Instruction(MINS_LEAQ, locaddr, r10);
-                    leaq->set_comment(get_hins_comment(hin));
+                    set_hins_comment(leaq, hin);
                     assembly->add_instruction(leaq);
 
                     // vrN is offset 8N(rsp);
@@ -1314,13 +2433,20 @@ public:
                 }
                 case HINS_LOAD_INT:{
                     Operand rhs = hin->get_operand(1);
+                    if (rhs.get_kind() == OPERAND_LOCAL_MEMREF) {
+                        auto *mov1 = new Instruction(MINS_MOVQ, get_local_memref(rhs), r11);
+                        set_hins_comment(mov1, hin);
+                        assembly->add_instruction(mov1);
+                        assembly->add_instruction(new Instruction(MINS_MOVQ, r11, get_mreg(hin->get_operand(0))));
+                        break;
+                    }
                     Operand loadsrc = get_mreg_or_lit(rhs);
 
                     Operand lhs = hin->get_operand(0);
                     Operand loaddest = get_mreg(lhs);
 
                     auto *mov1 = new Instruction(MINS_MOVQ, loadsrc, r11);
-                    mov1->set_comment(get_hins_comment(hin));
+                    set_hins_comment(mov1, hin);
                     assembly->add_instruction(mov1);
 
                     if (rhs.get_kind() != OPERAND_INT_LITERAL) {
@@ -1333,14 +2459,51 @@ public:
                     assembly->add_instruction(mov3);
                     break;
                 }
-                case HINS_LOAD_ICONST: {
-                    Operand vreg = hin->get_operand(0);
-                    Operand lit = hin->get_operand(1);
-
-                    Operand dest = get_mreg(vreg);
-                    auto *movins = new Instruction(MINS_MOVQ, lit, dest);
-                    movins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movins);
+                case HINS_LOAD_CHAR: {
+                    // movzbq (%r11), %rD
+                    Operand rhs = hin->get_operand(1);
+                    Operand dest = get_mreg(hin->get_operand(0));
+                    InstructionSelector::Code code;
+                    Operand src = get_local_memref_or_load(rhs, r11, code);
+                    Operand loaddest = (dest.get_kind() == OPERAND_MREG) ? dest : r11;
+                    code.push_back(new Instruction(MINS_MOVZBQ, src, loaddest));
+                    if (loaddest != dest) {
+                        code.push_back(new Instruction(MINS_MOVQ, r11, dest));
+                    }
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
+                    break;
+                }
+                case HINS_STORE_CHAR: {
+                    // movb %r11b, (%r10)
+                    Operand rhs = hin->get_operand(1);
+                    InstructionSelector::Code code;
+                    Operand src = r11;
+                    if (rhs.get_kind() == OPERAND_INT_LITERAL) {
+                        src = Operand(OPERAND_INT_LITERAL, rhs.get_int_value() & 0xFF);
+                    } else {
+                        code.push_back(new Instruction(MINS_MOVQ, get_mreg(rhs), r11));
+                    }
+                    Operand dest = get_local_memref_or_load(hin->get_operand(0), r10, code);
+                    code.push_back(new Instruction(MINS_MOVB, src, dest));
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
+                    break;
+                }
+                case HINS_LOAD_ICONST:
+                case HINS_MOV: {
+                    Operand dest = get_mreg(hin->get_operand(0));
+                    Operand src = get_mreg_or_lit(hin->get_operand(1));
+                    InstructionSelector::Code code = InstructionSelector::select_move(dest, src);
+
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
                     break;
                 }
                 case HINS_STORE_INT: {
@@ -1348,11 +2511,15 @@ public:
                     Operand src = get_mreg_or_lit(rhs);
 
                     Operand lhs = hin->get_operand(0);
-                    Operand dest = get_mreg(lhs);
-
                     auto *mov1 = new Instruction(MINS_MOVQ, src, r11);
-                    mov1->set_comment(get_hins_comment(hin));
+                    set_hins_comment(mov1, hin);
                     assembly->add_instruction(mov1);
+                    if (lhs.get_kind() == OPERAND_LOCAL_MEMREF) {
+                        assembly->add_instruction(new Instruction(MINS_MOVQ, r11, get_local_memref(lhs)));
+                        break;
+                    }
+
+                    Operand dest = get_mreg(lhs);
 
                     auto *mov2 = new Instruction(MINS_MOVQ, dest, r10);
                     assembly->add_instruction(mov2);
@@ -1362,257 +2529,442 @@ public:
                     assembly->add_instruction(mov3);
                     break;
                 }
-                case HINS_MOV: {
-                    Operand rhs = hin->get_operand(1);
-                    Operand src = get_mreg_or_lit(rhs);
-                    Operand lhs = hin->get_operand(0);
-                    Operand dest = get_mreg(lhs);
-
-                    auto *movins = new Instruction(MINS_MOVQ, src, r11);
-                    movins->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movins);
-
-                    auto *movins2 = new Instruction(MINS_MOVQ, r11, dest);
-                    assembly->add_instruction(movins2);
-                    break;
-                }
                 case HINS_WRITE_INT: {
-                    // move outputfmt to first argument register
-                    auto *movfmt = new Instruction(MINS_MOVQ, outputfmt, rdi);
-                    movfmt->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movfmt);
+                    if (use_runtime) {
+                        // the value is the only argument
+                        auto *movarg = new Instruction(MINS_MOVQ, get_mreg_or_lit(hin->get_operand(0)), rdi);
+                        set_hins_comment(movarg, hin);
+                        assembly->add_instruction(movarg);
+                        assembly->add_instruction(new Instruction(MINS_CALL, write_int_label));
+                        break;
+                    }
 
-                    // load addr of vreg into second argument register
+                    // load value of vreg into second argument register
+                    // (before rdi is overwritten, since the vreg may be allocated to it)
                     Operand op = hin->get_operand(0);
                     Operand src = get_mreg_or_lit(op);
                     auto *leaq = new Instruction(MINS_MOVQ, src, rsi);
+                    set_hins_comment(leaq, hin);
                     assembly->add_instruction(leaq);
 
+                    // move outputfmt to first argument register
+                    auto *movfmt = new Instruction(MINS_MOVQ, outputfmt, rdi);
+                    assembly->add_instruction(movfmt);
+
                     // call the printf function
                     auto *printf = new Instruction(MINS_CALL, printf_label);
                     assembly->add_instruction(printf);
                     break;
                 }
+                case HINS_WRITE_INT_ARRAY:
+                case HINS_READ_INT_ARRAY: {
+                    // the address of the first element, and the number of elements
+                    // (the count goes through %r10 if it was allocated to %rdi)
+                    Operand addr = get_mreg_or_lit(hin->get_operand(0));
+                    Operand count = get_mreg_or_lit(hin->get_operand(1));
+                    std::vector<Instruction *> code;
+                    if (count.get_kind() == OPERAND_MREG && count.get_base_reg() == MREG_RDI) {
+                        code.push_back(new Instruction(MINS_MOVQ, count, r10));
+                        count = r10;
+                    }
+                    code.push_back(new Instruction(MINS_MOVQ, addr, rdi));
+                    code.push_back(new Instruction(MINS_MOVQ, count, rsi));
+                    code.push_back(new Instruction(MINS_CALL, hin->get_opcode() == HINS_WRITE_INT_ARRAY
+                                                   ? write_int_array_label : read_int_array_label));
+
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
+                    break;
+                }
+                case HINS_FILL_INT:
+                case HINS_COPY_INT: {
+                    // the address and the value (or source) go through %r10 and
+                    // %r11, since they may be in the registers the count goes to
+                    bool is_fill = (hin->get_opcode() == HINS_FILL_INT);
+                    Operand count = get_mreg_or_lit(hin->get_operand(2));
+                    std::vector<Instruction *> code;
+                    code.push_back(new Instruction(MINS_MOVQ, get_mreg_or_lit(hin->get_operand(0)), r10));
+                    code.push_back(new Instruction(MINS_MOVQ, get_mreg_or_lit(hin->get_operand(1)), r11));
+                    if (use_runtime) {
+                        // (the runtime's functions use non-temporal stores for large arrays)
+                        code.push_back(new Instruction(MINS_MOVQ, count, rdx));
+                        code.push_back(new Instruction(MINS_MOVQ, r10, rdi));
+                        code.push_back(new Instruction(MINS_MOVQ, r11, rsi));
+                        code.push_back(new Instruction(MINS_CALL, is_fill ? fill_int_label : copy_int_label));
+                    } else {
+                        code.push_back(new Instruction(MINS_MOVQ, count, rcx));
+                        code.push_back(new Instruction(MINS_MOVQ, r10, rdi));
+                        code.push_back(new Instruction(MINS_MOVQ, r11, is_fill ? rax : rsi));
+                        code.push_back(new Instruction(is_fill ? MINS_REP_STOSQ : MINS_REP_MOVSQ));
+                    }
+
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
+                    break;
+                }
                 case HINS_READ_INT: {
+                    if (use_runtime) {
+                        // the value read is returned in %rax
+                        auto *callins = new Instruction(MINS_CALL, read_int_label);
+                        set_hins_comment(callins, hin);
+                        assembly->add_instruction(callins);
+                        assembly->add_instruction(new Instruction(MINS_MOVQ, rax, get_mreg(hin->get_operand(0))));
+                        break;
+                    }
+
                     // move inputfmt to first argument register
                     auto *movfmt = new Instruction(MINS_MOVQ, inputfmt, rdi);
-                    movfmt->set_comment(get_hins_comment(hin));
+                    set_hins_comment(movfmt, hin);
                     assembly->add_instruction(movfmt);
 
                     // load addr of vreg into second argument register
+                    // (scanf always reads into the vreg's stack slot)
                     Operand op = hin->get_operand(0);
-                    Operand dest = get_mreg(op);
-                    auto *leaq = new Instruction(MINS_LEAQ, dest, rsi);
+                    Operand slot = get_vreg_slot(op);
+                    auto *leaq = new Instruction(MINS_LEAQ, slot, rsi);
                     assembly->add_instruction(leaq);
 
                     // call the scanf function
                     auto *scanf = new Instruction(MINS_CALL, scanf_label);
                     assembly->add_instruction(scanf);
-                    break;
-                }
-                case HINS_INT_ADD: {
-                    Operand dest = hin->get_operand(0);
-                    Operand arg1 = hin->get_operand(1);
-                    Operand arg2 = hin->get_operand(2);
-
-                    Operand addend = get_mreg_or_lit(arg1);
-                    auto *movarg1 = new Instruction(MINS_MOVQ,addend, r11);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
-
-                    Operand destination = get_mreg_or_lit(arg2);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, destination, r10);
-                    assembly->add_instruction(movarg2);
-
-                    auto *addins = new Instruction(MINS_ADDQ, r11, r10);
-                    assembly->add_instruction(addins);
-
-                    Operand resultdestination = get_mreg(dest);
-                    auto *movins = new Instruction(MINS_MOVQ, r10, resultdestination);
-                    assembly->add_instruction(movins);
-                    break;
-                }
-                case HINS_INT_SUB: {
-                    Operand dest = hin->get_operand(0);
-                    Operand arg1 = hin->get_operand(1);
-                    Operand arg2 = hin->get_operand(2);
 
-                    Operand destination = get_mreg_or_lit(arg1);
-                    auto *movarg1 = new Instruction(MINS_MOVQ, destination, r10);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
-
-                    Operand subtrahend = get_mreg_or_lit(arg2);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, subtrahend, r11);
-                    assembly->add_instruction(movarg2);
-
-                    // https://en.wikibooks.org/wiki/X86_Assembly/Arithmetic#Addition_and_Subtraction
-                    // sub subtrahend, dest
-                    // dest -= subtrahend
-                    // dest = dest - subtrahend
-                    // HINS_INT_SUB d, a1, a2
-                    // SUBQ a2, a1 // places result in a1
-                    auto *subins = new Instruction(MINS_SUBQ, r11, r10);
-                    assembly->add_instruction(subins);
-
-                    // r10 contains the result now
-                    Operand resultdestination = get_mreg(dest);
-                    auto *movins = new Instruction(MINS_MOVQ, r10, resultdestination);
-                    assembly->add_instruction(movins);
+                    // if the vreg was allocated a machine register, load the value into it
+                    Operand dest = get_mreg(op);
+                    if (dest.get_kind() == OPERAND_MREG) {
+                        auto *movins = new Instruction(MINS_MOVQ, slot, dest);
+                        assembly->add_instruction(movins);
+                    }
                     break;
                 }
+                case HINS_INT_ADD:
+                case HINS_INT_SUB:
                 case HINS_INT_MUL: {
-                    Operand dest = hin->get_operand(0);
+                    Operand dest = get_mreg(hin->get_operand(0));
                     Operand arg1 = hin->get_operand(1);
                     Operand arg2 = hin->get_operand(2);
 
-                    Operand multiplicand = get_mreg_or_lit(arg1);
-                    auto *movarg1 = new Instruction(MINS_MOVQ, multiplicand, r11);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
-
+                    // a memory reference operand (the index of an array element) is
+                    // loaded first: the first operand into %r10, the second into %r11
+                    std::vector<Instruction *> code;
+                    Operand a = get_mreg_or_lit(arg1);
                     if (arg1.is_memref()) {
-                        auto *deref = new Instruction(MINS_MOVQ, r11.to_memref(), r11);
-                        assembly->add_instruction(deref);
+                        code.push_back(new Instruction(MINS_MOVQ, a, r10));
+                        code.push_back(new Instruction(MINS_MOVQ, r10.to_memref(), r10));
+                        a = r10;
                     }
-
-                    Operand destination = get_mreg_or_lit(arg2);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, destination, r10);
-                    assembly->add_instruction(movarg2);
-
+                    Operand b = get_mreg_or_lit(arg2);
                     if (arg2.is_memref()) {
-                        auto *deref = new Instruction(MINS_MOVQ, r10.to_memref(), r10);
-                        assembly->add_instruction(deref);
+                        code.push_back(new Instruction(MINS_MOVQ, b, r11));
+                        code.push_back(new Instruction(MINS_MOVQ, r11.to_memref(), r11));
+                        b = r11;
                     }
 
-                    auto *mulins = new Instruction(MINS_IMULQ, r11, r10);
-                    assembly->add_instruction(mulins);
+                    InstructionSelector::Code selected = InstructionSelector::select_binary(hin->get_opcode(), dest, a, b);
+                    code.insert(code.end(), selected.begin(), selected.end());
 
-                    Operand resultdestination = get_mreg(dest);
-                    auto *movdest = new Instruction(MINS_MOVQ, r10, resultdestination);
-                    assembly->add_instruction(movdest);
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
                     break;
                 }
-                case HINS_INT_DIV: {
+                case HINS_LEA: {
+                    // lea vrD, vrB, vrI, $scale computes vrB + vrI*scale
+                    // using a scaled-index address
                     Operand dest = hin->get_operand(0);
-                    Operand divarg1 = hin->get_operand(1);
-                    Operand divarg2 = hin->get_operand(2);
-
-                    Operand op1 = get_mreg_or_lit(divarg1);
-                    auto *movarg1 = new Instruction(MINS_MOVQ, op1, rax);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
-
-                    auto *convertins = new Instruction(MINS_CQTO);
-                    assembly->add_instruction(convertins);
-
-                    Operand op2 = get_mreg_or_lit(divarg2);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, op2, r10);
-                    assembly->add_instruction(movarg2);
-
-                    auto *divins = new Instruction(MINS_IDIVQ, r10);
-                    assembly->add_instruction(divins);
+                    Operand base = get_mreg(hin->get_operand(1));
+                    Operand index = get_mreg(hin->get_operand(2));
+                    int scale = int(hin->get_operand(3).get_int_value());
+
+                    std::vector<Instruction *> code;
+                    if (base.get_kind() != OPERAND_MREG) {
+                        code.push_back(new Instruction(MINS_MOVQ, base, r11));
+                        base = r11;
+                    }
+                    if (index.get_kind() != OPERAND_MREG) {
+                        code.push_back(new Instruction(MINS_MOVQ, index, r10));
+                        index = r10;
+                    }
+                    Operand addr(OPERAND_MREG_MEMREF_OFFSET_INDEX, base.get_base_reg(), index.get_base_reg(), 0, scale);
+                    code.push_back(new Instruction(MINS_LEAQ, addr, r10));
+                    code.push_back(new Instruction(MINS_MOVQ, r10, get_mreg(dest)));
 
-                    Operand resultdestination = get_mreg(dest);
-                    auto *movdest = new Instruction(MINS_MOVQ, rax, resultdestination);
-                    assembly->add_instruction(movdest);
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
                     break;
                 }
-                case HINS_INT_MOD: {
-                    Operand dest = hin->get_operand(0);
-                    Operand modarg1 = hin->get_operand(1);
-                    Operand modarg2 = hin->get_operand(2);
-
-                    Operand op1 = get_mreg_or_lit(modarg1);
-                    auto *movarg1 = new Instruction(MINS_MOVQ, op1, rax);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
-
-                    auto *convertins = new Instruction(MINS_CQTO);
-                    assembly->add_instruction(convertins);
-
-                    Operand op2 = get_mreg_or_lit(modarg2);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, op2, r10);
-                    assembly->add_instruction(movarg2);
-
-                    auto *divins = new Instruction(MINS_IDIVQ, r10);
-                    assembly->add_instruction(divins);
-
-                    Operand resultdestination = get_mreg(dest);
-                    auto *movdest = new Instruction(MINS_MOVQ, rdx, resultdestination);   // different from DIV, check %rdx for remainder
-                    assembly->add_instruction(movdest);
+                case HINS_INT_DIV:
+                case HINS_INT_MOD:
+                case HINS_UINT_DIV:
+                case HINS_UINT_MOD: {
+                    // a division followed by the remainder of the same
+                    // operands (or the other way around, as paired by
+                    // DivisionCombining) shares the division
+                    Instruction *pair = nullptr;
+                    if (i + 1 < num_ins && !hins->has_label(i + 1) && is_division_pair(hin, hins->get_instruction(i + 1))) {
+                        pair = hins->get_instruction(++i);
+                    }
+                    translate_division(hin, pair);
                     break;
                 }
                 case HINS_INT_COMPARE: {
-                    Operand l_op = hin->get_operand(0);
-                    Operand r_op = hin->get_operand(1);
-
-                    Operand l_arg = get_mreg_or_lit(l_op);
-                    auto *movarg1 = new Instruction(MINS_MOVQ, l_arg, r10);
-                    movarg1->set_comment(get_hins_comment(hin));
-                    assembly->add_instruction(movarg1);
+                    // cmpq R, L sets the flags for L - R: L can't be an immediate,
+                    // R must fit in a sign-extended 32-bit immediate, and at most
+                    // one of them can be in memory
+                    Operand l_arg = get_mreg_or_lit(hin->get_operand(0));
+                    Operand r_arg = get_mreg_or_lit(hin->get_operand(1));
+
+                    std::vector<Instruction *> code;
+                    if (l_arg.get_kind() == OPERAND_INT_LITERAL || (l_arg.is_memref() && r_arg.is_memref())) {
+                        code.push_back(new Instruction(MINS_MOVQ, l_arg, r10));
+                        l_arg = r10;
+                    }
+                    if (r_arg.get_kind() == OPERAND_INT_LITERAL
+                            && (r_arg.get_int_value() < INT_MIN || r_arg.get_int_value() > INT_MAX)) {
+                        code.push_back(new Instruction(MINS_MOVQ, r_arg, r11));
+                        r_arg = r11;
+                    }
+                    code.push_back(new Instruction(MINS_CMPQ, r_arg, l_arg));
 
-                    Operand r_arg = get_mreg_or_lit(r_op);
-                    auto *movarg2 = new Instruction(MINS_MOVQ, r_arg, r11);
-                    assembly->add_instruction(movarg2);
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
+                    break;
+                }
+                case HINS_CMOVE:
+                case HINS_CMOVNE:
+                case HINS_CMOVLT:
+                case HINS_CMOVLTE:
+                case HINS_CMOVGT:
+                case HINS_CMOVGTE: {
+                    // cmovCC vrD, T, F becomes "movq F, D; cmovCC T, D" (or a
+                    // single cmov if D already holds T or F): the flags are
+                    // still those of the cmpi, so only movqs (which preserve
+                    // them) may be emitted, and a cmov needs a register destination
+                    Operand dest = get_mreg(hin->get_operand(0));
+                    Operand t_arg = get_mreg_or_lit(hin->get_operand(1));
+                    Operand f_arg = get_mreg_or_lit(hin->get_operand(2));
+                    Operand d = (dest.get_kind() == OPERAND_MREG) ? dest : r10;
+
+                    std::vector<Instruction *> code;
+                    if (t_arg.get_kind() == OPERAND_INT_LITERAL) {
+                        code.push_back(new Instruction(MINS_MOVQ, t_arg, r11));
+                        t_arg = r11;
+                    }
+                    if (is_same_mreg(t_arg, d)) {
+                        // D holds T: move F into it if the condition is false
+                        if (f_arg.get_kind() == OPERAND_INT_LITERAL) {
+                            code.push_back(new Instruction(MINS_MOVQ, f_arg, r11));
+                            f_arg = r11;
+                        }
+                        code.push_back(new Instruction(get_cmov_opcode(hin->get_opcode(), true), f_arg, d));
+                    } else {
+                        if (!is_same_mreg(f_arg, d)) {
+                            code.push_back(new Instruction(MINS_MOVQ, f_arg, d));
+                        }
+                        code.push_back(new Instruction(get_cmov_opcode(hin->get_opcode(), false), t_arg, d));
+                    }
+                    if (!is_same_mreg(d, dest)) {
+                        code.push_back(new Instruction(MINS_MOVQ, d, dest));
+                    }
 
-                    auto *compareins = new Instruction(MINS_CMPQ, r11, r10);
-                    assembly->add_instruction(compareins);
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
                     break;
                 }
                 case HINS_JUMP: {
                     Operand label = hin->get_operand(0);
                     auto *jumpins = new Instruction(MINS_JMP, label);
-                    jumpins->set_comment(get_hins_comment(hin));
+                    set_hins_comment(jumpins, hin);
                     assembly->add_instruction(jumpins);
                     break;
                 }
                 case HINS_JE: {
                     Operand label = hin->get_operand(0);
                     auto *jumpins = new Instruction(MINS_JE, label);
-                    jumpins->set_comment(get_hins_comment(hin));
+                    set_hins_comment(jumpins, hin);
                     assembly->add_instruction(jumpins);
                     break;
                 }
                 case HINS_JNE: {
                     Operand label = hin->get_operand(0);
                     auto *jumpins = new Instruction(MINS_JNE, label);
-                    jumpins->set_comment(get_hins_comment(hin));
+                    set_hins_comment(jumpins, hin);
                     assembly->add_instruction(jumpins);
                     break;
                 }
                 case HINS_JLT: {
                     Operand label = hin->get_operand(0);
                     auto *jumpins = new Instruction(MINS_JL, label);
-                    jumpins->set_comment(get_hins_comment(hin));
+                    set_hins_comment(jumpins, hin);
                     assembly->add_instruction(jumpins);
                     break;
                 }
                 case HINS_JLTE: {
                     Operand label = hin->get_operand(0);
                     auto *jumpins = new Instruction(MINS_JLE, label);
-                    jumpins->set_comment(get_hins_comment(hin));
+                    set_hins_comment(jumpins, hin);
                     assembly->add_instruction(jumpins);
                     break;
                 }
                 case HINS_JGT: {
                     Operand label = hin->get_operand(0);
                     auto *jumpins = new Instruction(MINS_JG, label);
-                    jumpins->set_comment(get_hins_comment(hin));
+                    set_hins_comment(jumpins, hin);
                     assembly->add_instruction(jumpins);
                     break;
                 }
                 case HINS_JGTE: {
                     Operand label = hin->get_operand(0);
                     auto *jumpins = new Instruction(MINS_JGE, label);
-                    jumpins->set_comment(get_hins_comment(hin));
+                    set_hins_comment(jumpins, hin);
                     assembly->add_instruction(jumpins);
                     break;
                 }
                 case HINS_NOP: {
                     auto *nopins = new Instruction(MINS_NOP);
-                    nopins->set_comment(get_hins_comment(hin));
+                    set_hins_comment(nopins, hin);
                     assembly->add_instruction(nopins);
+                    break;
+                }
+                case HINS_VEC_LOAD:
+                case HINS_VEC_STORE:
+                case HINS_VEC_ADD:
+                case HINS_VEC_SUB:
+                case HINS_VEC_DUP:
+                    translate_vector_instruction(hin);
+                    break;
+                case HINS_PARAM: {
+                    // the parameters are copied from the argument registers
+                    // all at once (since their vregs may be allocated to them)
+                    std::vector<std::pair<Operand, Operand>> moves;
+                    int first = i;
+                    for (;;) {
+                        Instruction *param = hins->get_instruction(i);
+                        Operand arg(OPERAND_MREG, ARG_REGS[param->get_operand(1).get_int_value()]);
+                        moves.push_back(std::make_pair(arg, get_mreg(param->get_operand(0))));
+                        if (i + 1 == num_ins || hins->has_label(i + 1)
+                                || hins->get_instruction(i + 1)->get_opcode() != HINS_PARAM) {
+                            break;
+                        }
+                        i++;
+                    }
+                    std::vector<Instruction *> code;
+                    select_parallel_move(moves, code);
+                    if (code.empty()) {
+                        code.push_back(new Instruction(MINS_NOP));
+                    }
+                    set_hins_comment(code[0], hins->get_instruction(first));
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
+                    break;
+                }
+                case HINS_CALL:
+                case HINS_CALL_PROC: {
+                    // the arguments are moved into their registers all at once
+                    // (since they may be in the argument registers already),
+                    // and a function's result is returned in %rax
+                    bool is_function = (hin->get_opcode() == HINS_CALL);
+                    unsigned first_arg = is_function ? 2 : 1;
+                    std::vector<std::pair<Operand, Operand>> moves;
+                    for (unsigned j = first_arg; j < hin->get_num_operands(); j++) {
+                        Operand arg(OPERAND_MREG, ARG_REGS[j - first_arg]);
+                        moves.push_back(std::make_pair(get_mreg_or_lit(hin->get_operand(j)), arg));
+                    }
+                    std::vector<Instruction *> code;
+                    select_parallel_move(moves, code);
+                    code.push_back(new Instruction(MINS_CALL, hin->get_operand(first_arg - 1)));
+                    if (is_function) {
+                        InstructionSelector::Code result = InstructionSelector::select_move(get_mreg(hin->get_operand(0)), rax);
+                        code.insert(code.end(), result.begin(), result.end());
+                    }
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
+                    break;
+                }
+                case HINS_RETURN: {
+                    InstructionSelector::Code code = InstructionSelector::select_move(rax, get_mreg_or_lit(hin->get_operand(0)));
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
+                    break;
+                }
+                case HINS_PREFETCH: {
+                    // prefetcht0 n(%rB)
+                    InstructionSelector::Code code;
+                    Operand ahead = hin->get_operand(0);
+                    Operand base = get_mreg(ahead);
+                    if (base.get_kind() != OPERAND_MREG) {
+                        code.push_back(new Instruction(MINS_MOVQ, base, r10));
+                        base = r10;
+                    }
+                    long offset = (ahead.get_kind() == OPERAND_VREG_MEMREF_OFFSET) ? ahead.get_offset() : 0;
+                    code.push_back(new Instruction(MINS_PREFETCHT0,
+                                                   Operand(OPERAND_MREG_MEMREF_OFFSET, base.get_base_reg(), offset)));
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
+                    break;
+                }
+                case HINS_BOUNDS_CHECK: {
+                    // cmpq $(n-1), i; ja <trap>: a negative index is a
+                    // large unsigned number, so one comparison checks both bounds
+                    InstructionSelector::Code code;
+                    Operand index = get_mreg_or_lit(hin->get_operand(0));
+                    if (index.get_kind() == OPERAND_INT_LITERAL) {
+                        code.push_back(new Instruction(MINS_MOVQ, index, r10));
+                        index = r10;
+                    }
+                    Operand limit(OPERAND_INT_LITERAL, hin->get_operand(1).get_int_value() - 1);
+                    if (limit.get_int_value() < 0) {
+                        // (no index is in range)
+                        code.push_back(new Instruction(MINS_JMP, Operand(get_bounds_trap_label())));
+                    } else {
+                        if (limit.get_int_value() > INT_MAX) {
+                            code.push_back(new Instruction(MINS_MOVQ, limit, r11));
+                            limit = r11;
+                        }
+                        code.push_back(new Instruction(MINS_CMPQ, limit, index));
+                        code.push_back(new Instruction(MINS_JA, Operand(get_bounds_trap_label())));
+                    }
+                    set_hins_comment(code[0], hin);
+                    for (auto j = code.begin(); j != code.end(); j++) {
+                        assembly->add_instruction(*j);
+                    }
+                    break;
+                }
+                case HINS_PROFILE_COUNT: {
+                    // the counter of block N is at offset 8N in __profile_counts
+                    Operand counter(OPERAND_MREG_MEMREF_OFFSET, MREG_R10, int(WORD_SIZE * hin->get_operand(0).get_int_value()));
+                    auto *leaq = new Instruction(MINS_LEAQ, Operand(OPERAND_LABEL_MEMREF, "__profile_counts"), r10);
+                    set_hins_comment(leaq, hin);
+                    assembly->add_instruction(leaq);
+                    assembly->add_instruction(new Instruction(MINS_INCQ, counter));
+                    break;
+                }
+                case HINS_COLD: {
+                    // the epilogue goes here (after the profile is written),
+                    // and the cold code follows it
+                    if (num_profile_counters > 0 && is_main) {
+                        translate_profile_dump();
+                    }
+                    assembly->add_instruction(new Instruction(MINS_COLD));
+                    ended = true;
+                    break;
                 }
                 default:
                     break;
@@ -1622,171 +2974,562 @@ public:
         if (hins->has_label_at_end()) {
             assembly->define_label(hins->get_label_at_end());
         }
+        if (num_profile_counters > 0 && is_main && !ended) {
+            translate_profile_dump();
+        }
+    }
+
+    // does the code jump to the bounds check trap?  (It's found from the
+    // code, since the assembly may be replaced, see set_assembly.)
+    bool uses_bounds_trap() const {
+        const std::string label = get_bounds_trap_label();
+        for (auto i = assembly->cbegin(); i != assembly->cend(); i++) {
+            Instruction *ins = *i;
+            if ((ins->get_opcode() == MINS_JA || ins->get_opcode() == MINS_JMP) && ins->get_num_operands() == 1
+                    && ins->get_operand(0).get_kind() == OPERAND_LABEL
+                    && ins->get_operand(0).get_target_label() == label) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // print the function (with its cold code, and the bounds check trap,
+    // in .text.unlikely if it has any cold code)
+    void emit(OutputSink &out) {
+        std::vector<int> saved_regs = get_saved_regs(TARGET_X86_64);
+        unsigned hot_end = get_hot_end(MINS_COLD);
+        bool has_cold = hot_end < assembly->get_length();
+        emit_preamble(out, saved_regs);
+        emit_asm(out, 0, hot_end);
+        if (has_cold && assembly->has_label(hot_end)) {
+            out.put(assembly->get_label(hot_end));
+            out.put(":\n");
+        }
+        emit_epilogue(out, saved_regs);
+        if (has_cold) {
+            out.put("\t.section .text.unlikely\n");
+            emit_asm(out, hot_end + 1, assembly->get_length());
+        }
+        if (uses_bounds_trap()) {
+            out.put(get_bounds_trap_label());
+            out.put(":\n\tud2\n");
+        }
+        if (has_cold) {
+            out.put("\t.section .text\n");
+        }
+    }
+
+    // encode the same code (with the same prologue and epilogue) that
+    // emit() prints (the cold code follows the epilogue, in the same
+    // section, since the code is all encoded into one)
+    void encode(X86_64Encoder &encoder) {
+        Operand rsp(OPERAND_MREG, MREG_RSP);
+        Operand rax(OPERAND_MREG, MREG_RAX);
+        std::vector<int> saved_regs = get_saved_regs(TARGET_X86_64);
+        long frame_size = get_frame_size(saved_regs);
+        Operand storage(OPERAND_INT_LITERAL, frame_size);
+
+        encoder.define_label(function_label);
+        for (auto i = saved_regs.begin(); i != saved_regs.end(); i++) {
+            Instruction push(MINS_PUSHQ, Operand(OPERAND_MREG, *i));
+            encoder.encode(&push);
+        }
+        if (frame_size != 0) {
+            Instruction alloc(MINS_SUBQ, storage, rsp);
+            encoder.encode(&alloc);
+        }
+
+        unsigned hot_end = get_hot_end(MINS_COLD);
+        encoder.encode(assembly, 0, hot_end);
+        if (hot_end < assembly->get_length() && assembly->has_label(hot_end)) {
+            encoder.define_label(assembly->get_label(hot_end));
+        }
+
+        if (frame_size != 0) {
+            Instruction dealloc(MINS_ADDQ, storage, rsp);
+            encoder.encode(&dealloc);
+        }
+        for (auto i = saved_regs.rbegin(); i != saved_regs.rend(); i++) {
+            Instruction pop(MINS_POPQ, Operand(OPERAND_MREG, *i));
+            encoder.encode(&pop);
+        }
+        if (is_main) {
+            Instruction zero(MINS_MOVL, Operand(OPERAND_INT_LITERAL, 0), rax);
+            encoder.encode(&zero);
+        }
+        Instruction ret(MINS_RET);
+        encoder.encode(&ret);
+        if (hot_end < assembly->get_length()) {
+            encoder.encode(assembly, hot_end + 1, assembly->get_length());
+        }
+        if (uses_bounds_trap()) {
+            encoder.define_label(get_bounds_trap_label());
+            Instruction trap(MINS_UD2);
+            encoder.encode(&trap);
+        }
     }
 
-    void emit() {
-        emit_preamble();
-        emit_asm();
-        emit_epilogue();
+    // add the program's data (with the given variables in .bss) to an
+    // object file
+    void add_data(DataSections &writer, const std::vector<StorageLayout::Placement> &statics) {
+        writer.add_rodata_string("s_readint_fmt", "%ld");
+        writer.add_rodata_string("s_writeint_fmt", "%ld\n");
+        if (num_profile_counters > 0) {
+            writer.add_rodata_string("s_profile_file", profile_file);
+            writer.add_rodata_string("s_profile_mode", "w");
+        }
+        for (auto i = statics.begin(); i != statics.end(); i++) {
+            writer.add_bss_variable(i->label, i->size, StorageLayout::get_static_alignment(i->size));
+        }
+        if (num_profile_counters > 0) {
+            writer.add_bss_variable("__profile_counts", WORD_SIZE * num_profile_counters,
+                                    StorageLayout::get_static_alignment(WORD_SIZE * num_profile_counters));
+        }
     }
 
 private:
-    void emit_preamble() {
-        printf("/* %ld vregs used */\n", num_vreg);
-        printf("\t.section .rodata\n");
-        printf("s_readint_fmt: .string \"%%ld\"\n");
-        printf("s_writeint_fmt: .string \"%%ld\\n\"\n");
-        printf("\t.section .text\n");
-        printf("\t.globl main\n");
-        printf("main:\n");
-        printf("\tpushq %%rbx\n");
-        printf("\tpushq %%r12\n");
-        printf("\tpushq %%r13\n");
-        printf("\tpushq %%r14\n");
-        printf("\tpushq %%r15\n");
-        printf("\tsubq $%ld, %%rsp\n", total_storage_size);
-    }
-
-    void emit_asm() {
+    // write the block execution counters to the profile file (this
+    // is the end of the program, so any callee-saved register can be used)
+    void translate_profile_dump() {
+        Operand rdi(OPERAND_MREG, MREG_RDI);
+        Operand rsi(OPERAND_MREG, MREG_RSI);
+        Operand rdx(OPERAND_MREG, MREG_RDX);
+        Operand rax(OPERAND_MREG, MREG_RAX);
+        Operand rbx(OPERAND_MREG, MREG_RBX);
+        Operand r12(OPERAND_MREG, MREG_R12);
+        Operand r13(OPERAND_MREG, MREG_R13);
+        std::string loop_label = StringTable::labels().new_label(".Lprofile");
+        std::string done_label = StringTable::labels().new_label(".Lprofile");
+
+        // %rbx = fopen(s_profile_file, "w"), skipping the rest if it fails
+        auto *movfile = new Instruction(MINS_MOVQ, Operand("s_profile_file", true), rdi);
+        movfile->set_comment("write the profile");
+        assembly->add_instruction(movfile);
+        assembly->add_instruction(new Instruction(MINS_MOVQ, Operand("s_profile_mode", true), rsi));
+        assembly->add_instruction(new Instruction(MINS_CALL, Operand("fopen")));
+        assembly->add_instruction(new Instruction(MINS_MOVQ, rax, rbx));
+        assembly->add_instruction(new Instruction(MINS_CMPQ, Operand(OPERAND_INT_LITERAL, 0), rbx));
+        assembly->add_instruction(new Instruction(MINS_JE, Operand(done_label)));
+
+        // fprintf each counter, with %r12 pointing to it and %r13 counting down
+        assembly->add_instruction(new Instruction(MINS_LEAQ, Operand(OPERAND_LABEL_MEMREF, "__profile_counts"), r12));
+        assembly->add_instruction(new Instruction(MINS_MOVQ, Operand(OPERAND_INT_LITERAL, long(num_profile_counters)), r13));
+        assembly->define_label(loop_label);
+        assembly->add_instruction(new Instruction(MINS_MOVQ, rbx, rdi));
+        assembly->add_instruction(new Instruction(MINS_MOVQ, Operand("s_writeint_fmt", true), rsi));
+        assembly->add_instruction(new Instruction(MINS_MOVQ, Operand(OPERAND_MREG_MEMREF, MREG_R12), rdx));
+        assembly->add_instruction(new Instruction(MINS_MOVQ, Operand(OPERAND_INT_LITERAL, 0), rax));
+        assembly->add_instruction(new Instruction(MINS_CALL, Operand("fprintf")));
+        assembly->add_instruction(new Instruction(MINS_ADDQ, Operand(OPERAND_INT_LITERAL, WORD_SIZE), r12));
+        assembly->add_instruction(new Instruction(MINS_DECQ, r13));
+        assembly->add_instruction(new Instruction(MINS_JNE, Operand(loop_label)));
+
+        assembly->add_instruction(new Instruction(MINS_MOVQ, rbx, rdi));
+        assembly->add_instruction(new Instruction(MINS_CALL, Operand("fclose")));
+        assembly->define_label(done_label);
+    }
+
+    void emit_preamble(OutputSink &out, const std::vector<int> &saved_regs) {
+        out.put("/* ");
+        out.put_int(num_vreg);
+        out.put(" vregs used */\n");
+        if (is_global) {
+            out.put("\t.globl ");
+            out.put(function_label);
+            out.put('\n');
+        }
+        out.put(function_label);
+        out.put(":\n");
+        PrintX86_64InstructionSequence print_asm(nullptr);
+        for (auto i = saved_regs.begin(); i != saved_regs.end(); i++) {
+            out.put("\tpushq ");
+            out.put(print_asm.get_mreg_name(*i));
+            out.put('\n');
+        }
+        long frame_size = get_frame_size(saved_regs);
+        if (frame_size != 0) {
+            out.put("\tsubq $");
+            out.put_int(frame_size);
+            out.put(", %rsp\n");
+        }
+    }
+
+    void emit_asm(OutputSink &out, unsigned begin, unsigned end) {
         PrintX86_64InstructionSequence print_asm(assembly);
-        print_asm.print();
+        print_asm.print(out, begin, end);
+    }
+
+    // addq storage + (8 * num_vreg_slots), rsp
+    void emit_epilogue(OutputSink &out, const std::vector<int> &saved_regs) {
+        long frame_size = get_frame_size(saved_regs);
+        if (frame_size != 0) {
+            out.put("\taddq $");
+            out.put_int(frame_size);
+            out.put(", %rsp\n");
+        }
+        PrintX86_64InstructionSequence print_asm(nullptr);
+        for (auto i = saved_regs.rbegin(); i != saved_regs.rend(); i++) {
+            out.put("\tpopq ");
+            out.put(print_asm.get_mreg_name(*i));
+            out.put('\n');
+        }
+        if (is_main) {
+            out.put("\tmovl $0, %eax\n");
+        }
+        out.put("\tret\n");
+    }
+
+    // the size of the stack frame: the storage, padded so that %rsp is
+    // 16-byte aligned at calls (below the return address and the saved
+    // registers)
+    long get_frame_size(const std::vector<int> &saved_regs) const {
+        long size = total_storage_size;
+        if ((size + WORD_SIZE * long(saved_regs.size() + 1)) % 16 != 0) {
+            size += WORD_SIZE;
+        }
+        return size;
     }
 
-    // addq storage + (8 * num_vreg), rsp
-    void emit_epilogue() {
-        printf("\taddq $%ld, %%rsp\n", total_storage_size);
-        printf("\tpopq %%r15\n");
-        printf("\tpopq %%r14\n");
-        printf("\tpopq %%r13\n");
-        printf("\tpopq %%r12\n");
-        printf("\tpopq %%rbx\n");
-        printf("\tmovl $0, %%eax\n");
-        printf("\tret\n");
+    // the moves of values into the given locations, done as if all at
+    // once (see order_parallel_move), breaking a cycle of moves with %r10
+    void select_parallel_move(const std::vector<std::pair<Operand, Operand>> &moves, std::vector<Instruction *> &code) {
+        Operand r10(OPERAND_MREG, MREG_R10);
+        std::vector<std::pair<Operand, Operand>> sequence;
+        order_parallel_move(moves, r10, sequence);
+        for (auto i = sequence.begin(); i != sequence.end(); i++) {
+            if (is_same_mreg(i->second, r10)) {
+                code.push_back(new Instruction(MINS_MOVQ, i->first, r10));
+                continue;
+            }
+            InstructionSelector::Code move = InstructionSelector::select_move(i->second, i->first);
+            code.insert(code.end(), move.begin(), move.end());
+        }
+    }
+
+    // the x86-64 conditional move for a high-level one (or for its
+    // inverted condition)
+    static int get_cmov_opcode(int opcode, bool inverted) {
+        switch (opcode) {
+            case HINS_CMOVE:   return inverted ? MINS_CMOVNE : MINS_CMOVE;
+            case HINS_CMOVNE:  return inverted ? MINS_CMOVE : MINS_CMOVNE;
+            case HINS_CMOVLT:  return inverted ? MINS_CMOVGE : MINS_CMOVL;
+            case HINS_CMOVLTE: return inverted ? MINS_CMOVG : MINS_CMOVLE;
+            case HINS_CMOVGT:  return inverted ? MINS_CMOVLE : MINS_CMOVG;
+            case HINS_CMOVGTE: return inverted ? MINS_CMOVL : MINS_CMOVGE;
+            default:           assert(false); return MINS_NOP;
+        }
+    }
+
+    // a vector instruction (see vectorize.h), using the SSE2 instructions
+    // for pairs of 64-bit integers
+    void translate_vector_instruction(Instruction *hin) {
+        Operand r10(OPERAND_MREG, MREG_R10);
+        std::vector<Instruction *> code;
+
+        switch (hin->get_opcode()) {
+            case HINS_VEC_LOAD: {
+                Operand addr = get_vector_address(hin->get_operand(1), code);
+                code.push_back(new Instruction(use_avx2 ? MINS_VMOVDQU : MINS_MOVDQU, addr,
+                                               get_vector_reg(hin->get_operand(0))));
+                break;
+            }
+            case HINS_VEC_STORE: {
+                Operand addr = get_vector_address(hin->get_operand(0), code);
+                code.push_back(new Instruction(use_avx2 ? MINS_VMOVDQU : MINS_MOVDQU,
+                                               get_vector_reg(hin->get_operand(1)), addr));
+                break;
+            }
+            case HINS_VEC_ADD:
+            case HINS_VEC_SUB: {
+                Operand dest = get_vector_reg(hin->get_operand(0));
+                if (use_avx2) {
+                    // vpaddq B, A, D (with a separate destination)
+                    int opcode = (hin->get_opcode() == HINS_VEC_ADD) ? MINS_VPADDQ : MINS_VPSUBQ;
+                    code.push_back(new Instruction(opcode, get_vector_reg(hin->get_operand(2)),
+                                                   get_vector_reg(hin->get_operand(1)), dest));
+                    break;
+                }
+                // (the destination is never in the same register
+                // as an operand, see StackSlotAllocation)
+                int opcode = (hin->get_opcode() == HINS_VEC_ADD) ? MINS_PADDQ : MINS_PSUBQ;
+                code.push_back(new Instruction(MINS_MOVDQA, get_vector_reg(hin->get_operand(1)), dest));
+                code.push_back(new Instruction(opcode, get_vector_reg(hin->get_operand(2)), dest));
+                break;
+            }
+            case HINS_VEC_DUP: {
+                Operand dest = get_vector_reg(hin->get_operand(0));
+                Operand src = get_mreg_or_lit(hin->get_operand(1));
+                if (src.get_kind() != OPERAND_MREG) {
+                    code.push_back(new Instruction(MINS_MOVQ, src, r10));
+                    src = r10;
+                }
+                if (use_avx2) {
+                    code.push_back(new Instruction(MINS_VMOVQX, src, dest));
+                    code.push_back(new Instruction(MINS_VPBROADCASTQ, dest, dest));
+                    break;
+                }
+                code.push_back(new Instruction(MINS_MOVQX, src, dest));
+                code.push_back(new Instruction(MINS_PUNPCKLQDQ, dest, dest));
+                break;
+            }
+            default:
+                assert(false);
+        }
+
+        set_hins_comment(code[0], hin);
+        for (auto i = code.begin(); i != code.end(); i++) {
+            assembly->add_instruction(*i);
+        }
     }
 
-    std::string get_hins_comment(Instruction* hin) {
-        return print_helper->format_instruction(hin);
+    // the address of a vector load or store, loaded into %r10 if the
+    // vreg containing it is in memory
+    Operand get_vector_address(Operand memref, std::vector<Instruction *> &code) {
+        Operand addr = get_mreg(memref);
+        if (addr.get_kind() != OPERAND_MREG) {
+            Operand r10(OPERAND_MREG, MREG_R10);
+            code.push_back(new Instruction(MINS_MOVQ, addr, r10));
+            addr = r10;
+        }
+        return addr.to_memref();
     }
 
-    Operand get_mreg(Operand vreg) {
-        assert(vreg.has_base_reg());
+    // translate a division or remainder, and the other one of the same
+    // operands which follows it (pair, or null), using a single division
+    void translate_division(Instruction *hin, Instruction *pair) {
+        Operand r10(OPERAND_MREG, MREG_R10);
+        Operand rax(OPERAND_MREG, MREG_RAX);
+        Operand rdx(OPERAND_MREG, MREG_RDX);
 
-        if (vreg.get_does_map_mreg()) {
-            // naively map vr0 - vr4 to rbx, r12, r13, r14, r15
-            switch(vreg.get_base_reg()) {
-                case 0:
-                    return Operand(OPERAND_MREG, MREG_RBX);
-                case 1:
-                    return Operand(OPERAND_MREG, MREG_R12);
-                case 2:
-                    return Operand(OPERAND_MREG, MREG_R13);
-                case 3:
-                    return Operand(OPERAND_MREG, MREG_R14);
-                case 4:
-                    return Operand(OPERAND_MREG, MREG_R15);
-            }
+        int opcode = hin->get_opcode();
+        bool is_unsigned = opcode == HINS_UINT_DIV || opcode == HINS_UINT_MOD;
+        bool need_quotient = is_quotient(opcode) || (pair != nullptr && is_quotient(pair->get_opcode()));
+        bool need_remainder = !is_quotient(opcode) || (pair != nullptr && !is_quotient(pair->get_opcode()));
+
+        std::vector<Instruction *> code;
+        Operand quotient, remainder;
+        bool by_constant = is_unsigned
+                ? translate_unsigned_div_by_constant(hin, need_quotient, need_remainder, code, quotient, remainder)
+                : translate_div_by_constant(hin, need_quotient, need_remainder, code, quotient, remainder);
+        if (!by_constant) {
+            // idivq leaves the quotient of %rdx:%rax in %rax and the
+            // remainder in %rdx (divq likewise, with %rdx cleared rather
+            // than set to the sign of the dividend by cqto)
+            code.push_back(new Instruction(MINS_MOVQ, get_mreg_or_lit(hin->get_operand(1)), rax));
+            code.push_back(is_unsigned ? new Instruction(MINS_XORQ, rdx, rdx) : new Instruction(MINS_CQTO));
+            code.push_back(new Instruction(MINS_MOVQ, get_mreg_or_lit(hin->get_operand(2)), r10));
+            code.push_back(new Instruction(is_unsigned ? MINS_DIVQ : MINS_IDIVQ, r10));
+            quotient = rax;
+            remainder = rdx;
+        }
+        set_hins_comment(code[0], hin);
+
+        // (hin's destination isn't one of the operands, but the pair's may be)
+        code.push_back(new Instruction(MINS_MOVQ, is_quotient(opcode) ? quotient : remainder, get_mreg(hin->get_operand(0))));
+        if (pair != nullptr) {
+            Instruction *mov = new Instruction(MINS_MOVQ, is_quotient(pair->get_opcode()) ? quotient : remainder,
+                                               get_mreg(pair->get_operand(0)));
+            set_hins_comment(mov, pair);
+            code.push_back(mov);
+        }
+        for (auto j = code.begin(); j != code.end(); j++) {
+            assembly->add_instruction(*j);
         }
-
-        long offset = local_storage_size + (vreg.get_base_reg() * WORD_SIZE);
-        Operand rspwithoffset(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, offset);
-        return rspwithoffset;
     }
 
-    Operand get_mreg_or_lit(Operand vreg_or_lit) {
-        if (vreg_or_lit.get_kind() == OPERAND_INT_LITERAL) {
-            return vreg_or_lit;
-        } else {
-            return get_mreg(vreg_or_lit);
+    // compute the quotient and/or remainder of a division by a constant
+    // d >= 2 using shifts or a multiplication, returning the registers
+    // holding them (or false, for any other divisor)
+    bool translate_div_by_constant(Instruction *hin, bool need_quotient, bool need_remainder,
+                                   std::vector<Instruction *> &code, Operand &quotient, Operand &remainder) {
+        Operand divisor = hin->get_operand(2);
+        if (divisor.get_kind() != OPERAND_INT_LITERAL || divisor.get_int_value() < 2) {
+            return false;
         }
-    }
-};
+        long d = divisor.get_int_value();
 
-class ConstantPropagation : public ControlFlowGraphTransform {
+        Operand r10(OPERAND_MREG, MREG_R10);
+        Operand r11(OPERAND_MREG, MREG_R11);
+        Operand rax(OPERAND_MREG, MREG_RAX);
+        Operand rdx(OPERAND_MREG, MREG_RDX);
 
-public:
-    ConstantPropagation(ControlFlowGraph *cfg) : ControlFlowGraphTransform(cfg) {}
+        // the dividend is kept in %r11, and the quotient computed in %rdx
+        code.push_back(new Instruction(MINS_MOVQ, get_mreg_or_lit(hin->get_operand(1)), r11));
 
-public:
-    InstructionSequence *transform_basic_block(InstructionSequence *iseq) override {
-        auto out = new InstructionSequence();
+        int k = 0;
+        bool is_power_of_two = (d & (d - 1)) == 0;
+        if (is_power_of_two) {
+            while ((1L << k) != d) {
+                k++;
+            }
+            // add d - 1 to a negative dividend, so the shift rounds towards zero
+            code.push_back(new Instruction(MINS_MOVQ, r11, rdx));
+            if (k > 1) {
+                code.push_back(new Instruction(MINS_SARQ, Operand(OPERAND_INT_LITERAL, 63), rdx));
+            }
+            code.push_back(new Instruction(MINS_SHRQ, Operand(OPERAND_INT_LITERAL, 64 - k), rdx));
+            code.push_back(new Instruction(MINS_ADDQ, r11, rdx));
+            code.push_back(new Instruction(MINS_SARQ, Operand(OPERAND_INT_LITERAL, k), rdx));
+        } else {
+            long multiplier;
+            int shift;
+            get_magic_number(d, multiplier, shift);
+
+            // imulq with one operand leaves the high word of %rax * op in %rdx
+            code.push_back(new Instruction(MINS_MOVQ, Operand(OPERAND_INT_LITERAL, multiplier), rax));
+            code.push_back(new Instruction(MINS_IMULQ, r11));
+            if (multiplier < 0) {
+                code.push_back(new Instruction(MINS_ADDQ, r11, rdx));
+            }
+            if (shift > 0) {
+                code.push_back(new Instruction(MINS_SARQ, Operand(OPERAND_INT_LITERAL, shift), rdx));
+            }
+            code.push_back(new Instruction(MINS_MOVQ, r11, r10));
+            code.push_back(new Instruction(MINS_SHRQ, Operand(OPERAND_INT_LITERAL, 63), r10));
+            code.push_back(new Instruction(MINS_ADDQ, r10, rdx));
+        }
 
-        std::map<int, Operand> const_values;
+        quotient = rdx;
+        if (need_remainder) {
+            // n % d = n - (n / d) * d (keeping the quotient in %rax)
+            if (need_quotient) {
+                code.push_back(new Instruction(MINS_MOVQ, rdx, rax));
+                quotient = rax;
+            }
+            if (is_power_of_two) {
+                code.push_back(new Instruction(MINS_SHLQ, Operand(OPERAND_INT_LITERAL, k), rdx));
+            } else if (d <= INT_MAX) {
+                code.push_back(new Instruction(MINS_IMULQ, divisor, rdx));
+            } else {
+                code.push_back(new Instruction(MINS_MOVQ, divisor, r10));
+                code.push_back(new Instruction(MINS_IMULQ, r10, rdx));
+            }
+            code.push_back(new Instruction(MINS_SUBQ, rdx, r11));
+            remainder = r11;
+        }
+        return true;
+    }
 
-        for (auto ins : *iseq) {
-            Instruction *hin = ins->duplicate();
-            int opcode = hin->get_opcode();
+    // likewise for an unsigned division or remainder (see value_range.h),
+    // by any constant other than 0: a shift or a mask for a power of two,
+    // and otherwise a multiplication by a magic number
+    bool translate_unsigned_div_by_constant(Instruction *hin, bool need_quotient, bool need_remainder,
+                                            std::vector<Instruction *> &code, Operand &quotient, Operand &remainder) {
+        Operand divisor = hin->get_operand(2);
+        if (divisor.get_kind() != OPERAND_INT_LITERAL || divisor.get_int_value() == 0) {
+            return false;
+        }
+        unsigned long d = (unsigned long) divisor.get_int_value();
 
-            // the instruction that may be modified
-            Instruction *instruction = hin->duplicate();
+        Operand r10(OPERAND_MREG, MREG_R10);
+        Operand r11(OPERAND_MREG, MREG_R11);
+        Operand rax(OPERAND_MREG, MREG_RAX);
+        Operand rdx(OPERAND_MREG, MREG_RDX);
 
-            if (opcode == HINS_LOAD_ICONST) {
-                // lhs is virtual register, rhs is const literal
-                Operand dest = hin->get_operand(0);
-                int vreg = dest.get_base_reg();
-                Operand lit = hin->get_operand(1);
+        // the dividend is kept in %r11
+        code.push_back(new Instruction(MINS_MOVQ, get_mreg_or_lit(hin->get_operand(1)), r11));
+        if ((d & (d - 1)) == 0) {
+            int k = __builtin_ctzl(d);
+            if (need_quotient) {
+                code.push_back(new Instruction(MINS_MOVQ, r11, rdx));
+                if (k > 0) {
+                    code.push_back(new Instruction(MINS_SHRQ, Operand(OPERAND_INT_LITERAL, k), rdx));
+                }
+                quotient = rdx;
+            }
+            if (need_remainder) {
+                if (d - 1 <= (unsigned long) INT_MAX) {
+                    code.push_back(new Instruction(MINS_ANDQ, Operand(OPERAND_INT_LITERAL, long(d - 1)), r11));
+                } else {
+                    code.push_back(new Instruction(MINS_MOVQ, Operand(OPERAND_INT_LITERAL, long(d - 1)), r10));
+                    code.push_back(new Instruction(MINS_ANDQ, r10, r11));
+                }
+                remainder = r11;
+            }
+            return true;
+        }
 
-                const_values[vreg] = lit;
+        unsigned long multiplier;
+        int shift;
+        bool add;
+        get_unsigned_magic_number(d, multiplier, shift, add);
+
+        // mulq leaves the high word of %rax * op in %rdx
+        code.push_back(new Instruction(MINS_MOVQ, Operand(OPERAND_INT_LITERAL, long(multiplier)), rax));
+        code.push_back(new Instruction(MINS_MULQ, r11));
+        if (add) {
+            code.push_back(new Instruction(MINS_MOVQ, r11, r10));
+            code.push_back(new Instruction(MINS_SUBQ, rdx, r10));
+            code.push_back(new Instruction(MINS_SHRQ, Operand(OPERAND_INT_LITERAL, 1), r10));
+            code.push_back(new Instruction(MINS_ADDQ, r10, rdx));
+            shift--;
+        }
+        if (shift > 0) {
+            code.push_back(new Instruction(MINS_SHRQ, Operand(OPERAND_INT_LITERAL, shift), rdx));
+        }
 
-                // for further instructions, replace all usages of vreg with $lit
-                // remove (aka don't add to ins) HINS_LOAD_ICONST instructions
+        quotient = rdx;
+        if (need_remainder) {
+            // n % d = n - (n / d) * d (keeping the quotient in %rax)
+            if (need_quotient) {
+                code.push_back(new Instruction(MINS_MOVQ, rdx, rax));
+                quotient = rax;
+            }
+            if (d <= (unsigned long) INT_MAX) {
+                code.push_back(new Instruction(MINS_IMULQ, divisor, rdx));
             } else {
-
-                for (int j = 0; j < hin->get_num_operands(); j++) {
-                    Operand operand = hin->get_operand(j);
-
-                    if (operand.has_base_reg()) {
-                        auto it = const_values.find(operand.get_base_reg());
-                        if (it != const_values.end()) {
-                            if (opcode == HINS_LOCALADDR || opcode == HINS_LOAD_INT) {
-                                // if used in LOCALADDR or LOAD_INT, vreg is now in use for a scalar variable
-                                const_values.erase(it);
-                            } else {
-                                // vreg representing constant found
-                                // replace vreg with literal
-                                instruction->operator[](j) = it->second;
-
-                                // after a usage, we can kill the constant
-                                const_values.erase(it);
-                            }
-                        }
-                    }
-                }
-                out->add_instruction(instruction);
+                code.push_back(new Instruction(MINS_MOVQ, divisor, r10));
+                code.push_back(new Instruction(MINS_IMULQ, r10, rdx));
             }
+            code.push_back(new Instruction(MINS_SUBQ, rdx, r11));
+            remainder = r11;
         }
-        return out;
+        return true;
     }
-};
 
-class NaiveRegisterAllocation : public ControlFlowGraphTransform {
+    // the memory reference of a load or store: a local memref is addressed
+    // relative to %rsp, otherwise the address is loaded into a scratch register
+    Operand get_local_memref_or_load(const Operand &memref, const Operand &scratch, InstructionSelector::Code &code) {
+        if (memref.get_kind() == OPERAND_LOCAL_MEMREF) {
+            return get_local_memref(memref);
+        }
+        code.push_back(new Instruction(MINS_MOVQ, get_mreg(memref), scratch));
+        return Operand(OPERAND_MREG_MEMREF, scratch.get_base_reg());
+    }
 
-public:
-    NaiveRegisterAllocation(ControlFlowGraph *cfg) : ControlFlowGraphTransform(cfg) {}
+};
 
-public:
-    InstructionSequence *transform_basic_block(InstructionSequence *iseq) override {
-        auto out = new InstructionSequence();
-
-        for (auto ins : *iseq) {
-            Instruction *hin = ins->duplicate();
-            int opcode = hin->get_opcode();
-
-            // transform operands that are scalars contained in vregs
-            // set them to want mregs
-            for (int j = 0; j < hin->get_num_operands(); j++) {
-                Operand operand = hin->get_operand(j);
-                if (operand.get_is_scalar()) {
-                    operand.set_does_map_mreg(true);
-                    hin->operator[](j) = operand;
-                }
-            }
+const int AssemblyCodeGen::ARG_REGS[AssemblyCodeGen::MAX_ARGS] = {
+    MREG_RDI, MREG_RSI, MREG_RDX, MREG_RCX, MREG_R8, MREG_R9
+};
 
-            out->add_instruction(hin);
-        }
+// print the assembly code of the program: its data, and its functions
+// (the main program first, unless it's a unit, whose main program is
+// empty, and isn't emitted)
+static void emit_program(OutputSink &out, const std::vector<Lowering *> &asmcodegens,
+                         const std::vector<StorageLayout::Placement> &statics, bool is_unit) {
+    asmcodegens.front()->emit_data(out, statics);
+    for (auto i = asmcodegens.begin() + (is_unit ? 1 : 0); i != asmcodegens.end(); i++) {
+        (*i)->emit(out);
+    }
+    out.flush();
+}
 
-        return out;
+// print the size of the code of each function (as encoded, with its
+// prologue, epilogue and cold code) to stderr, and the total
+static void print_size_report(const std::vector<Lowering *> &asmcodegens) {
+    unsigned long total = 0;
+    fprintf(stderr, "%-30s %8s\n", "function", "bytes");
+    for (auto i = asmcodegens.begin(); i != asmcodegens.end(); i++) {
+        X86_64Encoder encoder;
+        static_cast<AssemblyCodeGen *>(*i)->encode(encoder);
+        unsigned long size = encoder.get_code().size();
+        fprintf(stderr, "%-30s %8lu\n", (*i)->get_function_label().c_str(), size);
+        total += size;
     }
-};
+    fprintf(stderr, "%-30s %8lu\n", "total", total);
+}
 
 ////////////////////////////////////////////////////////////////////////
 // Context class implementation
@@ -1797,9 +3540,39 @@ Context::Context(struct Node *ast) {
     global = new SymbolTable(nullptr);
     flag_print_symtab = false;
     flag_print_hins = false;
+    flag_optimize = false;
+    flag_compile = false;
+    flag_time_report = false;
+    flag_runtime = false;
+    flag_inline = true;
+    flag_ipcp = true;
+    flag_split_cold = true;
+    flag_optimize_size = false;
+    flag_size_report = false;
+    flag_incremental = false;
+    flag_bounds_check = false;
+    target = TARGET_X86_64;
+    asm_comments = -1;
+    flag_one_pass = false;
+    flag_lexer_thread = false;
+    num_threads = 1;
+    opt_level = PassManager::DEFAULT_LEVEL;
+    unroll_factor = 0;
+    prefetch_distance = LoopPrefetching::DEFAULT_DISTANCE;
+    time_budget_ms = -1.0;
+    phase_report = nullptr;
+    output = nullptr;
+    object_output = false;
+    flag_run = false;
+    flag_interpret = false;
+    flag_print_counts = false;
 }
 
 Context::~Context() {
+    // free all of the IR objects and Nodes created during the compilation
+    IRArena::release();
+    NodeArena::release();
+    delete global;
 }
 
 void Context::set_flag(char flag) {
@@ -1815,29 +3588,602 @@ void Context::set_flag(char flag) {
   if (flag == 'c') {
       flag_compile = true;
   }
+  if (flag == 'r') {
+      flag_runtime = true;
+  }
+  if (flag == '1') {
+      flag_one_pass = true;
+  }
+  if (flag == 'l') {
+      flag_lexer_thread = true;
+  }
+  if (flag == 'x') {
+      flag_run = true;
+  }
+  if (flag == 'i') {
+      flag_interpret = true;
+  }
+  if (flag == 'n') {
+      flag_print_counts = true;
+  }
+}
+
+void Context::set_option(const char *option) {
+  std::string opt(option);
+  if (opt.compare(0, 7, "passes=") == 0) {
+      pass_spec = opt.substr(7);
+  } else if (opt == "time-report") {
+      flag_time_report = true;
+  } else if (opt == "no-inline") {
+      flag_inline = false;
+  } else if (opt == "no-ipcp") {
+      flag_ipcp = false;
+  } else if (opt == "no-split-cold") {
+      flag_split_cold = false;
+  } else if (opt == "size") {
+      flag_optimize_size = true;
+  } else if (opt == "size-report") {
+      flag_size_report = true;
+  } else if (opt == "incremental") {
+      flag_incremental = true;
+  } else if (opt == "bounds-check") {
+      flag_bounds_check = true;
+  } else if (opt == "asm-comments" || opt == "no-asm-comments") {
+      asm_comments = (opt == "asm-comments") ? 1 : 0;
+  } else if (opt == "target=x86-64" || opt == "target=aarch64") {
+      target = (opt == "target=aarch64") ? TARGET_AARCH64 : TARGET_X86_64;
+  } else if (opt.compare(0, 5, "arch=") == 0) {
+      if (!cpu.set_arch(opt.substr(5))) {
+          err_fatal("Unknown architecture '%s' (must be x86-64, x86-64-v2, x86-64-v3, x86-64-v4 or native)\n",
+                    opt.c_str() + 5);
+      }
+  } else if (opt.compare(0, 5, "tune=") == 0) {
+      if (!cpu.set_tune(opt.substr(5))) {
+          err_fatal("Unknown processor '%s' (must be generic, skylake, znver or native)\n", opt.c_str() + 5);
+      }
+  } else if (opt == "reorder-fields") {
+      types.set_reorder_fields(true);
+  } else if (opt.compare(0, 7, "unroll=") == 0) {
+      char *end;
+      long factor = strtol(opt.c_str() + 7, &end, 10);
+      if (*end != '\0' || end == opt.c_str() + 7 || factor < 1 || factor > int(LoopUnrolling::MAX_FACTOR)) {
+          err_fatal("Invalid unroll factor '%s' (must be 1 to %d)\n", opt.c_str() + 7, int(LoopUnrolling::MAX_FACTOR));
+      }
+      unroll_factor = unsigned(factor);
+  } else if (opt.compare(0, 18, "prefetch-distance=") == 0) {
+      char *end;
+      long distance = strtol(opt.c_str() + 18, &end, 10);
+      if (*end != '\0' || end == opt.c_str() + 18 || distance < 0 || distance > LoopPrefetching::MAX_DISTANCE) {
+          err_fatal("Invalid prefetch distance '%s' (must be 0 to %ld)\n", opt.c_str() + 18,
+                    LoopPrefetching::MAX_DISTANCE);
+      }
+      prefetch_distance = distance;
+  } else if (opt.size() == 7 && opt.compare(0, 6, "level=") == 0 && opt[6] >= '0' && opt[6] <= '3') {
+      opt_level = unsigned(opt[6] - '0');
+  } else if (opt.compare(0, 7, "budget=") == 0) {
+      char *end;
+      double ms = strtod(opt.c_str() + 7, &end);
+      if (*end != '\0' || end == opt.c_str() + 7 || ms < 0.0) {
+          err_fatal("Invalid time budget '%s'\n", opt.c_str() + 7);
+      }
+      time_budget_ms = ms;
+  } else if (opt.compare(0, 17, "profile-generate=") == 0 && opt.size() > 17) {
+      profile_generate = opt.substr(17);
+  } else if (opt.compare(0, 12, "profile-use=") == 0 && opt.size() > 12) {
+      profile_use = opt.substr(12);
+  } else {
+      err_fatal("Unknown optimization option '%s'\n", option);
+  }
+}
+
+void Context::set_object_file(const char *filename) {
+  object_file = filename;
+}
+
+void Context::set_asm_file(const char *filename) {
+  asm_file = filename;
+}
+
+void Context::set_output(FILE *out) {
+  output = out;
+}
+
+void Context::set_object_output(FILE *out) {
+  output = out;
+  object_output = true;
+}
+
+void Context::set_phase_report(PhaseReport *report) {
+  phase_report = report;
+}
+
+void Context::set_num_threads(unsigned n) {
+  num_threads = n;
+}
+
+void Context::set_hir_output(const char *filename) {
+  hir_output = filename;
+}
+
+void Context::set_hir_input(const char *filename) {
+  hir_input = filename;
+}
+
+void Context::set_cfg_dot_output(const char *filename) {
+  cfg_dot_output = filename;
+}
+
+void Context::set_source_file(const char *filename) {
+  source_file = filename;
+  flag_one_pass = true;
+}
+
+void Context::end_phase(const char *name) {
+  if (phase_report != nullptr) {
+      phase_report->end_phase(name);
+  }
+}
+
+void Context::find_unit() {
+    if (root != nullptr && node_get_tag(root) == AST_UNIT) {
+        Node *ident = node_get_kid(root, 2);
+        units.set_unit(node_get_str(ident), node_get_source_info(ident).filename);
+    }
+}
+
+void Context::check_units() const {
+    if (units.is_unit()) {
+        if (flag_run || flag_interpret) {
+            err_fatal("Unit '%s' has no main program to run\n", units.get_unit().c_str());
+        }
+        if (!hir_output.empty() || !profile_generate.empty()) {
+            err_fatal("Unit '%s' can only be compiled (without -emit-hir or -fprofile-generate)\n",
+                      units.get_unit().c_str());
+        }
+    } else if (units.uses_units() && (flag_run || flag_interpret)) {
+        err_fatal("A program using units can't be run (its object file must be linked with theirs)\n");
+    }
 }
 
 void Context::build_symtab() {
+    find_unit();
+    if (flag_one_pass || !hir_input.empty()) {
+        // (the symbol table is built by gen_code, or not needed)
+        return;
+    }
 
     // give symtabbuilder a symtab in constructor?
-    SymbolTableBuilder *visitor = new SymbolTableBuilder(global);
+    std::unique_ptr<SymbolTableBuilder> visitor(new SymbolTableBuilder(global, &types, &units));
     visitor->visit(root);
 
     if (flag_print_symtab) {
       // print symbol table
       visitor->get_symtab()->print_sym_tab();
     }
+    end_phase("symtab");
+
+    ASTSimplifier simplifier;
+    simplifier.simplify(root);
+    end_phase("simplify");
+}
+
+// The high-level code of a program in a HIR file (see highlevel_io.h) is
+// the number of functions, followed by the label, kind (main program or
+// subprogram), number of vregs, storage layout and code of each one.
+void Context::write_hir(const std::vector<FunctionCode> &functions, const std::vector<StorageLayout *> &layouts) {
+    HighLevelWriter writer;
+    writer.write_unsigned(functions.size());
+    for (unsigned f = 0; f < functions.size(); f++) {
+        writer.write_string(functions[f].label);
+        writer.write_unsigned(functions[f].is_main ? 1 : 0);
+        writer.write_signed(functions[f].num_vregs);
+        writer.write_layout(layouts[f]);
+        writer.write_iseq(functions[f].iseq);
+    }
+    writer.save(hir_output);
+}
+
+void Context::write_cfg_dot(const std::vector<FunctionCode> &functions, const std::vector<ControlFlowGraph *> &cfgs) {
+    FILE *out = fopen(cfg_dot_output.c_str(), "w");
+    if (out == nullptr) {
+        err_fatal("Could not open output file \"%s\"\n", cfg_dot_output.c_str());
+    }
+    {
+        ControlFlowGraphDotPrinter printer(out);
+        for (unsigned f = 0; f < functions.size(); f++) {
+            printer.print(functions[f].is_main ? "main" : functions[f].label, cfgs[f]);
+        }
+    }
+    fclose(out);
+}
+
+void Context::read_hir(std::vector<FunctionCode> &functions, std::vector<StorageLayout *> &layouts) {
+    HighLevelReader reader(hir_input);
+    unsigned long num_functions = reader.read_unsigned();
+    for (unsigned long f = 0; f < num_functions; f++) {
+        FunctionCode function;
+        function.label = reader.read_string();
+        function.symtab = nullptr;
+        function.is_main = (reader.read_unsigned() != 0);
+        function.num_vregs = reader.read_signed();
+        layouts.push_back(reader.read_layout());
+        function.iseq = reader.read_iseq();
+        functions.push_back(function);
+    }
+    if (functions.empty() || !functions.front().is_main || !reader.at_end()) {
+        err_fatal("Invalid HIR file \"%s\"\n", hir_input.c_str());
+    }
+}
+
+// With the incremental option, the optimized code of each function is
+// stored in the compile cache, keyed by a hash of its code and storage
+// layout before the optimization passes (after inlining, so that a function
+// whose inlined callees change is optimized again) and of the options
+// affecting the passes.  The entry is the optimized code, its number of
+// vregs and its assignment of vregs to machine registers, in the HIR format.
+std::string Context::get_function_key(const CompileCache &cache, const FunctionCode &function,
+                                      const ControlFlowGraph *cfg, const StorageLayout *layout) const {
+    HighLevelWriter writer;
+    writer.write_string(function.label);
+    writer.write_unsigned(function.is_main ? 1 : 0);
+    writer.write_signed(function.num_vregs);
+    writer.write_layout(layout);
+    writer.write_cfg(cfg);
+    std::vector<std::string> options = { pass_spec, std::to_string(unroll_factor), std::to_string(prefetch_distance),
+                                         std::to_string(time_budget_ms),
+                                         flag_runtime ? "-r" : "", flag_split_cold ? "" : "no-split-cold",
+                                         target == TARGET_AARCH64 ? "aarch64" : cpu.get_name() };
+    return cache.get_key(writer.get_data(), options);
+}
+
+bool Context::fetch_function(const CompileCache &cache, const std::string &key, FunctionCode &function,
+                             InstructionSequence *&iseq, std::map<int, int> &assignment) const {
+    std::string filename = cache.find(key);
+    if (filename.empty()) {
+        return false;
+    }
+    HighLevelReader reader(filename);
+    iseq = reader.read_iseq();
+    function.num_vregs = reader.read_signed();
+    assignment.clear();
+    unsigned long num_assigned = reader.read_unsigned();
+    for (unsigned long i = 0; i < num_assigned; i++) {
+        int vreg = int(reader.read_signed());
+        assignment[vreg] = int(reader.read_signed());
+    }
+
+    // (the labels created for the function later, by the x86-64 passes,
+    // must be distinct from the ones created when it was optimized)
+    for (unsigned i = 0; i < iseq->get_length(); i++) {
+        if (iseq->has_label(i)) {
+            StringTable::labels().reserve_label(iseq->get_label(i));
+        }
+    }
+    if (iseq->has_label_at_end()) {
+        StringTable::labels().reserve_label(iseq->get_label_at_end());
+    }
+    return true;
+}
+
+void Context::store_function(const CompileCache &cache, const std::string &key, const FunctionCode &function,
+                             const InstructionSequence *iseq, const std::map<int, int> &assignment) const {
+    HighLevelWriter writer;
+    writer.write_iseq(iseq);
+    writer.write_signed(function.num_vregs);
+    writer.write_unsigned(assignment.size());
+    for (auto i = assignment.begin(); i != assignment.end(); i++) {
+        writer.write_signed(i->first);
+        writer.write_signed(i->second);
+    }
+
+    // (an error writing the entry just means it isn't stored)
+    std::string data = writer.get_data();
+    std::string temp_file = cache.get_temp_filename(key);
+    FILE *f = fopen(temp_file.c_str(), "wb");
+    if (f == nullptr) {
+        return;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = (fclose(f) == 0) && ok;
+    if (ok) {
+        cache.store(key, temp_file, nullptr);
+    } else {
+        remove(temp_file.c_str());
+    }
+}
+
+void Context::resolve_level() {
+    if (pass_spec.empty()) {
+        pass_spec = flag_optimize_size ? PassManager::get_size_pipeline() : PassManager::get_pipeline(opt_level);
+    }
+    if (unroll_factor == 0) {
+        unroll_factor = (opt_level >= 3 && !flag_optimize_size) ? 4 : 1;
+    }
+    if (time_budget_ms < 0.0) {
+        time_budget_ms = (opt_level >= 3) ? 5000.0 : (opt_level == 2) ? 1000.0 : 0.0;
+    }
 }
 
 void Context::gen_code() {
-    auto *hlcodegen = new HighLevelCodeGen(global);
-    hlcodegen->visit(root);
+    resolve_level();
+    if (target == TARGET_AARCH64 && (!object_file.empty() || object_output || flag_run || flag_size_report)) {
+        err_fatal("AArch64 code can only be printed as assembly code\n");
+    }
+    if (flag_run && !cpu.is_supported_by_host()) {
+        err_fatal("The AVX2 code of -march can't run on this processor\n");
+    }
+
+    // the main program and each subprogram are optimized and translated
+    // separately, each with its own storage layout (and the main program
+    // comes first, so that it is at the start of the code)
+    std::vector<FunctionCode> functions;
+    std::vector<StorageLayout *> layouts;
+    struct LayoutsGuard {
+        std::vector<StorageLayout *> &layouts;
+        ~LayoutsGuard() {
+            for (auto i = layouts.begin(); i != layouts.end(); i++) {
+                delete *i;
+            }
+        }
+    } layouts_guard = { layouts };
+    if (!hir_input.empty()) {
+        read_hir(functions, layouts);
+        end_phase("hirload");
+    } else {
+        std::unique_ptr<HighLevelCodeGen> hlcodegen(new HighLevelCodeGen(global));
+        hlcodegen->set_use_runtime(flag_runtime);
+        hlcodegen->set_bounds_check(flag_bounds_check);
+        if (!source_file.empty()) {
+            SymbolTableBuilder symtab_builder(global, &types, &units);
+            hlcodegen->set_symtab_builder(&symtab_builder);
+            root = parse_program_streaming(source_file.c_str(), flag_lexer_thread,
+                                           HighLevelCodeGen::begin_streaming, HighLevelCodeGen::stream_statement,
+                                           hlcodegen.get());
+            find_unit();
+            if (units.is_unit()) {
+                hlcodegen->visit(root);
+            } else {
+                hlcodegen->end_program();
+            }
+            hlcodegen->set_symtab_builder(nullptr);
+            if (flag_print_symtab) {
+                global->print_sym_tab();
+            }
+        } else if (flag_one_pass) {
+            SymbolTableBuilder symtab_builder(global, &types, &units);
+            hlcodegen->set_symtab_builder(&symtab_builder);
+            hlcodegen->visit(root);
+            hlcodegen->set_symtab_builder(nullptr);
+            if (flag_print_symtab) {
+                global->print_sym_tab();
+            }
+        } else {
+            hlcodegen->visit(root);
+        }
+        end_phase("hlcodegen");
+
+        // (a unit's interface is written once its names are resolved)
+        check_units();
+        if (units.is_unit()) {
+            units.write(global);
+        }
+
+        functions = hlcodegen->get_functions();
+        std::rotate(functions.begin(), functions.end() - 1, functions.end());
+        for (auto i = functions.begin(); i != functions.end(); i++) {
+            auto *layout = new StorageLayout(i->symtab);
+            if (i->is_main) {
+                layout->set_static_variables(hlcodegen->get_shared_variables());
+            }
+            layouts.push_back(layout);
+        }
+
+        // the AST is no longer needed (hlcodegen's maps are keyed by its
+        // Nodes), so its memory is reused by the later phases
+        hlcodegen.reset();
+        NodeArena::release();
+        root = nullptr;
+    }
+    unsigned num_functions = unsigned(functions.size());
+
+    // the subprograms of a unit are called from other object files, so
+    // they are all kept, and may be passed any arguments
+    std::set<std::string> exported;
+    if (units.is_unit()) {
+        for (auto i = functions.begin(); i != functions.end(); i++) {
+            if (!i->is_main) {
+                exported.insert(i->label);
+            }
+        }
+    }
 
-    InstructionSequence *iseq = hlcodegen->get_iseq();
+    if (!hir_output.empty()) {
+        write_hir(functions, layouts);
+        end_phase("hiremit");
+        return;
+    }
+
+    std::vector<InstructionSequence *> iseqs;
+    std::vector<std::map<int, int>> mreg_assignments(num_functions);
+    for (auto i = functions.begin(); i != functions.end(); i++) {
+        iseqs.push_back(i->iseq);
+        Statistics::get().add_snapshot("hlcodegen", i->iseq, std::map<int, int>());
+    }
+    PassManager pass_manager(pass_spec);
+    pass_manager.set_time_report(flag_time_report);
+    pass_manager.set_unroll_factor(unroll_factor);
+    pass_manager.set_prefetch_distance(prefetch_distance);
+    pass_manager.set_time_budget(time_budget_ms);
+    pass_manager.set_phase_report(phase_report);
+    pass_manager.set_target(target);
+    pass_manager.set_tune(cpu.tune);
+
+    // the instrumented code isn't optimized, so that the profile counts
+    // the blocks of the CFG that -fprofile-use builds
+    bool optimize = flag_optimize && profile_generate.empty();
+    unsigned num_profile_counters = 0;
+
+    // Each function is optimized and translated independently, so they
+    // can be compiled on several threads (with their own PassManagers),
+    // the largest first, to balance the threads' work.  (With the phase,
+    // time and -stats reports, which record each pass as it runs, they
+    // are compiled one at a time.)  Each function's labels have its own
+    // suffix, so the code is the same whichever thread compiles it.
+    unsigned function_threads = num_threads;
+    if (phase_report != nullptr || flag_time_report || Statistics::get().is_enabled()) {
+        function_threads = 1;
+    }
+    // (a program with one function uses the threads for its blocks, see
+    // ControlFlowGraphTransform::set_num_threads)
+    pass_manager.set_num_threads(function_threads);
+    std::vector<unsigned> function_order;
+    auto for_each_function = [&](const std::function<void(unsigned, PassManager &)> &compile) {
+        if (function_threads <= 1 || num_functions <= 1) {
+            for (unsigned f = 0; f < num_functions; f++) {
+                StringTable::set_label_suffix(HighLevelCodeGen::get_label_suffix(functions[f].label, functions[f].is_main));
+                compile(f, pass_manager);
+            }
+            return;
+        }
+        if (function_order.size() != num_functions) {
+            function_order.clear();
+            for (unsigned f = 0; f < num_functions; f++) {
+                function_order.push_back(f);
+            }
+            std::stable_sort(function_order.begin(), function_order.end(), [&](unsigned a, unsigned b) {
+                return iseqs[a]->get_length() > iseqs[b]->get_length();
+            });
+        }
+        IRArena::run_parallel(num_functions, function_threads, [&](unsigned task) {
+            unsigned f = function_order[task];
+            StringTable::set_label_suffix(HighLevelCodeGen::get_label_suffix(functions[f].label, functions[f].is_main));
+            PassManager function_pass_manager(pass_spec);
+            function_pass_manager.set_unroll_factor(unroll_factor);
+            function_pass_manager.set_prefetch_distance(prefetch_distance);
+            function_pass_manager.set_time_budget(time_budget_ms);
+            function_pass_manager.set_target(target);
+            function_pass_manager.set_tune(cpu.tune);
+            compile(f, function_pass_manager);
+        });
+    };
+
+    if (!profile_generate.empty()) {
+        for (unsigned f = 0; f < num_functions; f++) {
+            HighLevelControlFlowGraphBuilder cfg_builder(iseqs[f]);
+            ControlFlowGraph *cfg = cfg_builder.build();
+            end_phase("cfgbuild");
+            num_profile_counters += Profile::instrument(cfg, num_profile_counters);
+            iseqs[f] = cfg->create_instruction_sequence(nullptr, -1, HINS_JUMP);
+            end_phase("layout");
+        }
+    }
+
+    if (optimize) {
+        std::vector<ControlFlowGraph *> cfgs;
+        for (unsigned f = 0; f < num_functions; f++) {
+            HighLevelControlFlowGraphBuilder cfg_builder(iseqs[f]);
+            cfgs.push_back(cfg_builder.build());
+        }
+        end_phase("cfgbuild");
+        if (!profile_use.empty()) {
+            Profile::read(profile_use, cfgs);
+        }
+
+        // the function each function is a clone of (itself, if it isn't one)
+        std::vector<unsigned> original;
+        for (unsigned f = 0; f < num_functions; f++) {
+            original.push_back(f);
+        }
 
-    if (flag_optimize) {
-        HighLevelControlFlowGraphBuilder cfg_builder(iseq);
-        ControlFlowGraph *cfg = cfg_builder.build();
+        if (flag_ipcp && num_functions > 1) {
+            // (the subprograms in the order they were declared, and then main)
+            InterproceduralConstantPropagation ipcp;
+            ipcp.set_optimize_size(flag_optimize_size);
+            for (unsigned f = 1; f <= num_functions; f++) {
+                const std::string &label = functions[f % num_functions].label;
+                ipcp.add_function(label, cfgs[f % num_functions], exported.count(label) != 0);
+            }
+            ipcp.run();
+
+            // (the CFGs replaced share their instructions with the
+            // functions' high-level code, which is freed after their passes)
+            for (unsigned k = 0; k < ipcp.get_num_functions(); k++) {
+                if (k < num_functions) {
+                    unsigned f = (k + 1) % num_functions;
+                    IRArena::free_replaced(cfgs[f], ipcp.get_cfg(k));
+                    cfgs[f] = ipcp.get_cfg(k);
+                    continue;
+                }
+                // (a clone of a subprogram, which has the same variables)
+                unsigned f = (ipcp.get_original(k) + 1) % num_functions;
+                FunctionCode clone = functions[f];
+                clone.label = ipcp.get_label(k);
+                clone.iseq = ipcp.get_cfg(k)->create_instruction_sequence(HighLevel::get_inverted_branch, -1,
+                                                                          HINS_JUMP);
+                functions.push_back(clone);
+                cfgs.push_back(ipcp.get_cfg(k));
+                iseqs.push_back(clone.iseq);
+                layouts.push_back(new StorageLayout(clone.symtab));
+                original.push_back(f);
+            }
+            num_functions = unsigned(functions.size());
+            mreg_assignments.resize(num_functions);
+            end_phase("ipcp");
+        }
+
+        if (flag_inline && num_functions > 1) {
+            // (the subprograms in the order they were declared, which
+            // is the order they are called in, each followed by its clones,
+            // and then main)
+            std::vector<unsigned> order;
+            for (unsigned f = 1; f < num_functions; f++) {
+                for (unsigned g = f; g < num_functions && original[f] == f; g++) {
+                    if (original[g] == f) {
+                        order.push_back(g);
+                    }
+                }
+            }
+            order.push_back(0);
+            FunctionInlining inlining;
+            inlining.set_optimize_size(flag_optimize_size);
+            for (unsigned k = 0; k < num_functions; k++) {
+                inlining.add_function(functions[order[k]].label, cfgs[order[k]]);
+            }
+            inlining.run();
+
+            std::vector<bool> is_called(num_functions);
+            for (unsigned k = 0; k < num_functions; k++) {
+                unsigned f = order[k];
+                IRArena::free_replaced(cfgs[f], inlining.get_cfg(k));
+                cfgs[f] = inlining.get_cfg(k);
+                is_called[f] = inlining.is_called(k) || exported.count(functions[f].label) != 0;
+                const std::set<unsigned> &inlined = inlining.get_inlined_functions(k);
+                for (auto i = inlined.begin(); i != inlined.end(); i++) {
+                    layouts[f]->add_scope(*layouts[order[*i]]);
+                }
+            }
+
+            // the subprograms which are no longer called aren't emitted
+            unsigned num_called = 0;
+            for (unsigned f = 0; f < num_functions; f++) {
+                if (is_called[f]) {
+                    functions[num_called] = functions[f];
+                    cfgs[num_called] = cfgs[f];
+                    iseqs[num_called] = iseqs[f];
+                    layouts[num_called] = layouts[f];
+                    num_called++;
+                } else {
+                    delete layouts[f];
+                }
+            }
+            num_functions = num_called;
+            functions.resize(num_functions);
+            cfgs.resize(num_functions);
+            layouts.resize(num_functions);
+            iseqs.resize(num_functions);
+            mreg_assignments.resize(num_functions);
+            end_phase("inline");
+        }
 
         // CFG Printer
         //HighLevelControlFlowGraphPrinter cfg_printer(cfg);
@@ -1848,29 +4194,210 @@ void Context::gen_code() {
         // LiveVregsControlFlowGraphPrinter live_vregs_printer(cfg, live_vregs);
         //live_vregs_printer.print();
 
-        NaiveRegisterAllocation registerAllocation(cfg);
-        cfg = registerAllocation.transform_cfg();
+        CompileCache cache;
+        bool incremental = flag_incremental && cache.is_enabled();
+        for_each_function([&](unsigned f, PassManager &function_pass_manager) {
+            std::string key;
+            if (incremental) {
+                key = get_function_key(cache, functions[f], cfgs[f], layouts[f]);
+                if (fetch_function(cache, key, functions[f], iseqs[f], mreg_assignments[f])) {
+                    Statistics::get().add("incremental.reused");
+                    end_phase("layout");
+                    return;
+                }
+            }
 
-        ConstantPropagation constantPropagation(cfg);
-        cfg = constantPropagation.transform_cfg();
+            function_pass_manager.set_storage_layout(layouts[f]);
+            function_pass_manager.set_function_label(functions[f].is_main ? std::string() : functions[f].label);
+            ControlFlowGraph *cfg = function_pass_manager.run_highlevel(cfgs[f]);
+            mreg_assignments[f] = function_pass_manager.get_assignment();
+            cfgs[f] = cfg;
+
+            // (the function's high-level code, and the blocks sharing it,
+            // are no longer used)
+            IRArena::free_replaced(iseqs[f], cfg);
+            iseqs[f] = cfg->create_instruction_sequence(HighLevel::get_inverted_branch,
+                                                        flag_split_cold ? HINS_COLD : -1, HINS_JUMP);
+            functions[f].iseq = iseqs[f];
+            if (iseqs[f]->get_length() == 0) {
+                // (a subprogram which does nothing)
+                iseqs[f]->add_instruction(new Instruction(HINS_NOP));
+            }
+            // (the optimizations remove vregs and create new ones, and the
+            // "renumber" pass numbers the remaining ones densely)
+            functions[f].num_vregs = HighLevel::get_num_vregs(iseqs[f]);
+            if (incremental) {
+                store_function(cache, key, functions[f], iseqs[f], mreg_assignments[f]);
+            }
+            end_phase("layout");
+        });
+        StringTable::set_label_suffix("");
 
-        iseq = cfg->create_instruction_sequence();
+        if (!cfg_dot_output.empty()) {
+            write_cfg_dot(functions, cfgs);
+        }
+    } else if (!cfg_dot_output.empty()) {
+        // (the unoptimized code's CFGs, with the counts of a profile if
+        // there is one)
+        std::vector<ControlFlowGraph *> cfgs;
+        for (unsigned f = 0; f < num_functions; f++) {
+            HighLevelControlFlowGraphBuilder cfg_builder(iseqs[f]);
+            cfgs.push_back(cfg_builder.build());
+        }
+        if (!profile_use.empty()) {
+            Profile::read(profile_use, cfgs);
+        }
+        write_cfg_dot(functions, cfgs);
     }
 
     if (flag_print_hins) {
-        auto *hlprinter = new PrintHighLevelInstructionSequence(iseq);
-        hlprinter->print();
+        for (unsigned f = 0; f < num_functions; f++) {
+            if (!functions[f].is_main) {
+                printf("%s:\n", functions[f].label.c_str());
+            }
+            PrintHighLevelInstructionSequence hlprinter(iseqs[f]);
+            hlprinter.print();
+        }
+    }
+
+    if (flag_interpret) {
+        // (the layouts are deleted when this returns, so the interpreter
+        // places the variables now)
+        interpreter.reset(new HighLevelInterpreter());
+        interpreter->set_use_runtime(flag_runtime);
+        interpreter->set_profile(profile_generate, num_profile_counters);
+        for (unsigned f = 0; f < num_functions; f++) {
+            interpreter->add_function(functions[f].label, iseqs[f], layouts[f], functions[f].num_vregs,
+                                      mreg_assignments[f]);
+        }
     }
 
     if (flag_compile) {
-        auto *asmcodegen = new AssemblyCodeGen(
-                iseq,
-                hlcodegen->get_storage_size(),
-                hlcodegen->get_vreg_max()
-                );
-        asmcodegen->translate_instructions();
-        asmcodegen->emit();
+        std::vector<Lowering *> asmcodegens(num_functions);
+        // (the comments are only needed if the assembly code is printed)
+        bool print_comments = (asm_comments < 0 ? !flag_optimize : asm_comments != 0)
+            && object_file.empty() && !object_output && !flag_run;
+        for_each_function([&](unsigned f, PassManager &function_pass_manager) {
+            Lowering *asmcodegen;
+            if (target == TARGET_AARCH64) {
+                asmcodegen = new AArch64Lowering(iseqs[f], layouts[f], functions[f].num_vregs);
+            } else {
+                AssemblyCodeGen *x86_64_codegen = new AssemblyCodeGen(iseqs[f], layouts[f], functions[f].num_vregs);
+                x86_64_codegen->set_avx2(cpu.avx2);
+                asmcodegen = x86_64_codegen;
+            }
+            asmcodegen->set_function(functions[f].label, functions[f].is_main);
+            asmcodegen->set_global(functions[f].is_main ? !units.is_unit() : exported.count(functions[f].label) != 0);
+            asmcodegen->set_mreg_assignment(mreg_assignments[f]);
+            asmcodegen->set_use_runtime(flag_runtime);
+            asmcodegen->set_comments(print_comments);
+            asmcodegen->set_profile(profile_generate, num_profile_counters);
+            asmcodegen->translate_instructions();
+            end_phase("asmgen");
+            // (the x86-64 passes, such as the peephole optimizer and the
+            // scheduler, only apply to x86-64 code)
+            if (target == TARGET_X86_64) {
+                Statistics::get().add_x86_64_snapshot("asmgen", asmcodegen->get_assembly());
+                if (optimize) {
+                    asmcodegen->set_assembly(function_pass_manager.run_x86_64(asmcodegen->get_assembly()));
+                }
+            }
+            asmcodegens[f] = asmcodegen;
+        });
+        StringTable::set_label_suffix("");
+
+        // the variables in .bss (each program variable used by the
+        // subprograms is in the layout of each function using it)
+        std::vector<StorageLayout::Placement> statics;
+        std::set<std::string> static_labels;
+        for (unsigned f = 0; f < num_functions; f++) {
+            std::vector<StorageLayout::Placement> function_statics = asmcodegens[f]->get_static_variables();
+            for (auto i = function_statics.begin(); i != function_statics.end(); i++) {
+                if (static_labels.insert(i->label).second) {
+                    statics.push_back(*i);
+                }
+            }
+        }
+
+        if (flag_size_report) {
+            print_size_report(asmcodegens);
+        }
+
+        if (!object_file.empty() || object_output || flag_run) {
+            // (a unit's main program isn't encoded; offsets are where the
+            // code of each function encoded starts, and the end of the code)
+            X86_64Encoder encoder;
+            unsigned first = units.is_unit() ? 1 : 0;
+            std::vector<unsigned long> offsets;
+            for (unsigned f = first; f < num_functions; f++) {
+                offsets.push_back(encoder.get_code().size());
+                static_cast<AssemblyCodeGen *>(asmcodegens[f])->encode(encoder);
+            }
+            offsets.push_back(encoder.get_code().size());
+            encoder.finish();
+            if (flag_run) {
+                jit_program.reset(new JitProgram());
+                jit_program->set_text(encoder.get_code(), encoder.get_relocations());
+                static_cast<AssemblyCodeGen *>(asmcodegens.front())->add_data(*jit_program, statics);
+                jit_program->load();
+            } else {
+                ElfObjectWriter writer;
+                writer.set_text(encoder.get_code(), encoder.get_relocations());
+                for (unsigned f = first; f < num_functions; f++) {
+                    if (asmcodegens[f]->is_global_function()) {
+                        unsigned k = f - first;
+                        writer.add_function(asmcodegens[f]->get_function_label(), offsets[k], offsets[k + 1] - offsets[k]);
+                    }
+                }
+                static_cast<AssemblyCodeGen *>(asmcodegens.front())->add_data(writer, statics);
+                if (object_output) {
+                    writer.write(output);
+                } else {
+                    writer.write(object_file);
+                }
+            }
+        } else if (!asm_file.empty()) {
+            FILE *f = fopen(asm_file.c_str(), "w");
+            if (f == nullptr) {
+                err_fatal("Could not open output file \"%s\"\n", asm_file.c_str());
+            }
+            {
+                OutputSink out(f);
+                emit_program(out, asmcodegens, statics, units.is_unit());
+            }
+            if (fclose(f) != 0) {
+                err_fatal("Error writing output file \"%s\"\n", asm_file.c_str());
+            }
+        } else if (output != nullptr) {
+            OutputSink out(output);
+            emit_program(out, asmcodegens, statics, units.is_unit());
+        } else {
+            emit_program(OutputSink::get_stdout(), asmcodegens, statics, units.is_unit());
+        }
+        end_phase("emit");
+        for (auto i = asmcodegens.begin(); i != asmcodegens.end(); i++) {
+            delete *i;
+        }
+    }
+
+    if (optimize) {
+        pass_manager.print_time_report();
+    }
+}
+
+int Context::run_program() {
+    if (interpreter) {
+        int status = interpreter->run();
+        if (flag_print_counts) {
+            fflush(stdout);
+            interpreter->print_counts(stderr);
+        }
+        return status;
+    }
+    if (!jit_program) {
+        err_fatal("No program was loaded to be run\n");
     }
+    return jit_program->run();
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -1889,6 +4416,50 @@ void context_set_flag(struct Context *ctx, char flag) {
   ctx->set_flag(flag);
 }
 
+void context_set_option(struct Context *ctx, const char *option) {
+  ctx->set_option(option);
+}
+
+void context_set_object_file(struct Context *ctx, const char *filename) {
+  ctx->set_object_file(filename);
+}
+
+void context_set_asm_file(struct Context *ctx, const char *filename) {
+  ctx->set_asm_file(filename);
+}
+
+void context_set_output(struct Context *ctx, FILE *out) {
+  ctx->set_output(out);
+}
+
+void context_set_object_output(struct Context *ctx, FILE *out) {
+  ctx->set_object_output(out);
+}
+
+void context_set_phase_report(struct Context *ctx, struct PhaseReport *report) {
+  ctx->set_phase_report(report);
+}
+
+void context_set_num_threads(struct Context *ctx, unsigned num_threads) {
+  ctx->set_num_threads(num_threads);
+}
+
+void context_set_hir_output(struct Context *ctx, const char *filename) {
+  ctx->set_hir_output(filename);
+}
+
+void context_set_hir_input(struct Context *ctx, const char *filename) {
+  ctx->set_hir_input(filename);
+}
+
+void context_set_cfg_dot_output(struct Context *ctx, const char *filename) {
+  ctx->set_cfg_dot_output(filename);
+}
+
+void context_set_source_file(struct Context *ctx, const char *filename) {
+  ctx->set_source_file(filename);
+}
+
 void context_build_symtab(struct Context *ctx) {
   ctx->build_symtab();
 }
@@ -1899,3 +4470,7 @@ void context_check_types(struct Context *ctx) {
 void context_gen_code(struct Context *ctx) {
     ctx->gen_code();
 }
+
+int context_run_program(struct Context *ctx) {
+    return ctx->run_program();
+}
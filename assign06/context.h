@@ -1,6 +1,8 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
 
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -10,6 +12,7 @@ extern "C" {
 
 struct Node;
 struct Context;
+struct PhaseReport;
 
 struct Context *context_create(struct Node *ast);
 void context_destroy(struct Context *ctx);
@@ -17,13 +20,114 @@ void context_destroy(struct Context *ctx);
 // This function can be called multiple times to configure
 // compilation options.  Flags available:
 //   's' - print symbol table info
+//   'r' - use the buffered I/O runtime (runtime.c) for READ and WRITE
+//   '1' - resolve names while generating code, in a single pass over the
+//         AST (context_build_symtab then does nothing)
+//   'x' - load the generated code into memory, to be run in this process
+//         by context_run_program (rather than printing it)
+//   'i' - interpret the high-level code when context_run_program is
+//         called (see interp.h), rather than printing the assembly code
+//   'n' - print the counts of the instructions and blocks executed when
+//         interpreting the program, to stderr
+//   'l' - scan the source file on a separate thread while parsing it (see
+//         context_set_source_file)
 void context_set_flag(struct Context *ctx, char flag);
 
+// Set an optimization option (given with -O).  Options available:
+//   level=<n>      - the optimization level, 0 to 3 (by default 2), which
+//                    chooses the passes, unroll factor and time budget not
+//                    given explicitly (see PassManager::get_pipeline)
+//   passes=<spec>  - the optimization passes to run (see PassManager)
+//   budget=<ms>    - skip the passes after a function has been optimized
+//                    for this long, except for register allocation (0 for
+//                    no budget; by default 1000 at -O2, 5000 at -O3)
+//   time-report    - print the time spent in each pass
+//   size           - optimize for the size of the code (given with -Os): run
+//                    the passes of PassManager::get_size_pipeline, don't
+//                    unroll loops, and only inline tiny subprograms (and
+//                    those called once), without cloning any
+//   size-report    - print the size of each function's code to stderr
+//   no-inline      - don't inline calls of the subprograms
+//   no-ipcp        - don't propagate constant arguments into the
+//                    subprograms, or clone them for constant arguments
+//   no-split-cold  - don't move the code which the profile shows was never
+//                    executed out of line, into .text.unlikely
+//   reorder-fields - lay out the fields of records in decreasing order of
+//                    alignment, to avoid padding between them
+//   unroll=<n>     - unroll loops n times (given with -funroll=<n>)
+//   prefetch-distance=<n> - prefetch n bytes ahead of the accesses to large
+//                    arrays in loops (0 for none, given with
+//                    -fprefetch-distance=<n>)
+//   profile-generate=<file> - instrument the code to count the executions
+//                    of each basic block, writing them to the file at exit
+//   profile-use=<file> - guide the optimizations with the counts from the
+//                    file (see profile.h)
+//   bounds-check   - check that the index of each array element referenced
+//                    is in range, trapping if it isn't (given with
+//                    -fbounds-check, and used when not optimizing too)
+//   asm-comments, no-asm-comments - comment (or don't) the assembly code
+//                    with the high-level instructions it's translated from
+//                    (by default, only when not optimizing)
+//   target=x86-64, target=aarch64 - the machine the code is generated for
+//                    (AArch64 code can only be printed as assembly code)
+//   arch=<name>, tune=<name> - the x86-64 instruction set extensions the
+//                    code may use, and the processor it's scheduled for
+//                    (see X86_64Cpu)
+void context_set_option(struct Context *ctx, const char *option);
+
+// Write the generated code to an ELF object file (rather than printing
+// assembly code).
+void context_set_object_file(struct Context *ctx, const char *filename);
+
+// Write the assembly code to a file (rather than printing it).
+void context_set_asm_file(struct Context *ctx, const char *filename);
+
+// Print the assembly code to the given stream rather than stdout.
+void context_set_output(struct Context *ctx, FILE *out);
+
+// Write the generated code to the given stream as an ELF object file
+// (rather than printing assembly code).
+void context_set_object_output(struct Context *ctx, FILE *out);
+
+// Record the end of each phase of the compilation (symtab, simplify,
+// hlcodegen, cfgbuild, each optimization pass, layout, asmgen, and emit)
+// in the given PhaseReport.
+void context_set_phase_report(struct Context *ctx, struct PhaseReport *report);
+
+// Compile the functions of the program (optimizing them and generating
+// their assembly code) on up to num_threads threads.  The code generated
+// doesn't depend on the number of threads.
+void context_set_num_threads(struct Context *ctx, unsigned num_threads);
+
+// Write the high-level code of the program to a HIR file (see
+// highlevel_io.h) rather than compiling it: the back end can compile it
+// later, from the file.
+void context_set_hir_output(struct Context *ctx, const char *filename);
+
+// Compile the high-level code read from a HIR file, rather than the
+// program's AST (which may be null).
+void context_set_hir_input(struct Context *ctx, const char *filename);
+
+// Write the high-level CFG of each function (as optimized, with the 'o'
+// flag) to a file as a Graphviz graph, with the blocks' execution counts
+// from the profile (if there is one) and register pressure (see cfg_dot.h).
+void context_set_cfg_dot_output(struct Context *ctx, const char *filename);
+
+// Parse the program from a source file while generating its code (see
+// parse_program_streaming), in one pass (as with the '1' flag), rather
+// than compiling the program's AST (which is then null): each statement
+// of the main program is freed once its code is generated.
+void context_set_source_file(struct Context *ctx, const char *filename);
+
 void context_build_symtab(struct Context *ctx);
 void context_check_types(struct Context *ctx);
 
 void context_gen_code(struct Context *ctx);
 
+// Run the program loaded by context_gen_code (with the 'x' flag), or
+// interpret it (with the 'i' flag), and return its exit status.
+int context_run_program(struct Context *ctx);
+
 #ifdef __cplusplus
 }
 #endif
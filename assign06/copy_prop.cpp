@@ -0,0 +1,221 @@
+#include <cassert>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "dce.h"
+#include "stats.h"
+#include "copy_prop.h"
+
+namespace {
+    // does an instruction use or define a vreg?
+    bool mentions(Instruction *ins, int vreg) {
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            const Operand &operand = ins->get_operand(j);
+            if (operand.has_base_reg() && operand.get_base_reg() == vreg) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// AvailableCopies implementation
+////////////////////////////////////////////////////////////////////////
+
+AvailableCopies::AvailableCopies(ControlFlowGraph *cfg)
+        : m_is_vector(find_vectors(cfg)) {
+}
+
+void AvailableCopies::meet(Fact &fact, const Fact &other) const {
+    if (!other.reachable) {
+        return;
+    }
+    if (!fact.reachable) {
+        fact = other;
+        return;
+    }
+
+    // a copy is available only if it is available in both facts
+    for (auto i = fact.copies.begin(); i != fact.copies.end(); ) {
+        auto j = other.copies.find(i->first);
+        if (j == other.copies.end() || j->second != i->second) {
+            i = fact.copies.erase(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+void AvailableCopies::model_instruction(Instruction *ins, Fact &fact) const {
+    if (!fact.reachable || !HighLevel::is_def(ins) || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+        return;
+    }
+
+    // a definition kills the copies to and from its destination
+    CopyMap &copies = fact.copies;
+    int dest = ins->get_operand(0).get_base_reg();
+    copies.erase(dest);
+    for (auto i = copies.begin(); i != copies.end(); ) {
+        if (i->second == dest) {
+            i = copies.erase(i);
+        } else {
+            i++;
+        }
+    }
+
+    if (is_copy(ins, m_is_vector)) {
+        copies[dest] = ins->get_operand(1).get_base_reg();
+    }
+}
+
+bool AvailableCopies::is_copy(Instruction *ins, const std::vector<bool> &is_vector) {
+    if (ins->get_opcode() != HINS_MOV || ins->get_operand(0).get_kind() != OPERAND_VREG
+            || ins->get_operand(1).get_kind() != OPERAND_VREG) {
+        return false;
+    }
+    int dest = ins->get_operand(0).get_base_reg(), src = ins->get_operand(1).get_base_reg();
+    return dest != src && !is_vector[unsigned(dest)] && !is_vector[unsigned(src)];
+}
+
+std::vector<bool> AvailableCopies::find_vectors(ControlFlowGraph *cfg) {
+    std::vector<bool> is_vector(unsigned(HighLevel::get_num_vregs(cfg)), false);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            for (unsigned k = 0; k < (*j)->get_num_operands(); k++) {
+                if (HighLevel::is_vector(*j, k)) {
+                    is_vector[unsigned((*j)->get_operand(k).get_base_reg())] = true;
+                }
+            }
+        }
+    }
+    return is_vector;
+}
+
+////////////////////////////////////////////////////////////////////////
+// CopyPropagation implementation
+////////////////////////////////////////////////////////////////////////
+
+CopyPropagation::CopyPropagation(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_available_copies(cfg, AvailableCopies(cfg)) {
+    m_available_copies.execute();
+}
+
+CopyPropagation::~CopyPropagation() {
+}
+
+InstructionSequence *CopyPropagation::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+
+    // copies available at the beginning of the block
+    const AvailableCopies &lattice = m_available_copies.get_lattice();
+    AvailableCopies::Fact fact = m_available_copies.get_fact_at_beginning_of_block(bb);
+
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        Instruction *ins = *i;
+        Instruction *hin = ins->duplicate();
+
+        // uses of copies read the vregs they were copied from
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            if (!HighLevel::is_use(ins, j)) {
+                continue;
+            }
+            auto k = fact.copies.find(ins->get_operand(j).get_base_reg());
+            if (k != fact.copies.end()) {
+                (*hin)[j].set_base_reg(k->second);
+                Statistics::get().add("copyprop.operands");
+            }
+        }
+
+        lattice.model_instruction(ins, fact);
+        out->add_instruction(hin);
+    }
+
+    return out;
+}
+
+bool CopyPropagation::run(ControlFlowGraph *cfg, const LiveVregs *live_vregs, unsigned num_threads) {
+    LiveVregs *own_live_vregs = nullptr;
+    if (live_vregs == nullptr) {
+        own_live_vregs = new LiveVregs(cfg);
+        own_live_vregs->execute();
+        live_vregs = own_live_vregs;
+    }
+
+    // (coalescing only changes the liveness of the vregs between each
+    // definition and copy it coalesces, which no other copy in the block
+    // depends on)
+    bool changed = false;
+    std::vector<bool> is_vector = AvailableCopies::find_vectors(cfg);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        changed = coalesce(*i, *live_vregs, is_vector) || changed;
+    }
+    delete own_live_vregs;
+
+    CopyPropagation propagation(cfg);
+    propagation.set_num_threads(num_threads);
+    if (propagation.transform_in_place()) {
+        // (removing the copies which are no longer used)
+        DeadCodeElimination::run_to_fixpoint(cfg, nullptr, num_threads);
+        changed = true;
+    }
+    return changed;
+}
+
+bool CopyPropagation::coalesce(BasicBlock *bb, const LiveVregs &live_vregs, const std::vector<bool> &is_vector) {
+    // the vregs live after each instruction
+    unsigned num_ins = bb->get_length();
+    std::vector<LiveVregs::LiveSet> live_after(num_ins);
+    LiveVregs::LiveSet live = live_vregs.get_fact_at_end_of_block(bb);
+    for (unsigned i = num_ins; i > 0; i--) {
+        live_after[i - 1] = live;
+        live_vregs.model_instruction(bb->get_instruction(i - 1), live);
+    }
+
+    // (the instructions are looked up through the editor, so each copy
+    // sees the definitions already coalesced, and not the copies removed)
+    BasicBlockEditor editor(bb);
+    for (unsigned j = 0; j < num_ins; j++) {
+        Instruction *copy = editor.get_instruction(j);
+        if (!AvailableCopies::is_copy(copy, is_vector)) {
+            continue;
+        }
+        int dest = copy->get_operand(0).get_base_reg(), src = copy->get_operand(1).get_base_reg();
+        if (live_after[j].test(unsigned(src))) {
+            continue;
+        }
+
+        // find the definition of the source, with neither vreg mentioned
+        // between it and the copy
+        unsigned i = j;
+        while (i > 0) {
+            Instruction *ins = editor.get_instruction(i - 1);
+            if (ins == nullptr) {
+                i--;
+                continue;
+            }
+            if (HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG
+                    && ins->get_operand(0).get_base_reg() == src) {
+                break;
+            }
+            if (mentions(ins, src) || mentions(ins, dest)) {
+                i = 0;
+                break;
+            }
+            i--;
+        }
+        if (i == 0) {
+            continue;
+        }
+
+        // the definition writes the copy's destination
+        Instruction *def = editor.get_instruction(i - 1)->duplicate();
+        (*def)[0] = copy->get_operand(0);
+        editor.replace(i - 1, def);
+        editor.remove(j);
+        Statistics::get().add("copyprop.coalesced");
+    }
+    return editor.commit();
+}
@@ -0,0 +1,88 @@
+#ifndef COPY_PROP_H
+#define COPY_PROP_H
+
+#include <map>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "dataflow.h"
+
+class LiveVregs;
+
+// The lattice of available copies, for a CFG not in SSA form: a copy
+// "mov vrD, vrS" is available at a point if it is on every path to the
+// point, and neither vrD nor vrS is defined again after it.  The facts map
+// the destination of each available copy to its source.  Vector vregs
+// (see vectorize.h) are never considered copies.
+class AvailableCopies : public DataflowLattice<AvailableCopies, ForwardDataflow> {
+public:
+    // map of vreg numbers to the vreg each one is a copy of
+    typedef std::map<int, int> CopyMap;
+
+    struct Fact {
+        // the top fact (at the beginning of the unreachable blocks)
+        // is unreachable, and is the identity of the meet
+        bool reachable;
+        CopyMap copies;
+
+        bool operator==(const Fact &other) const {
+            return reachable == other.reachable && copies == other.copies;
+        }
+    };
+
+private:
+    // the vregs used as vectors
+    std::vector<bool> m_is_vector;
+
+public:
+    AvailableCopies(ControlFlowGraph *cfg);
+
+    const std::vector<bool> &get_is_vector() const { return m_is_vector; }
+
+    Fact get_top() const { return Fact{ false, CopyMap() }; }
+    Fact get_boundary() const { return Fact{ true, CopyMap() }; }
+    void meet(Fact &fact, const Fact &other) const;
+    void model_instruction(Instruction *ins, Fact &fact) const;
+
+    // is an instruction a copy between scalar vregs?
+    static bool is_copy(Instruction *ins, const std::vector<bool> &is_vector);
+
+    // the vregs of a CFG which are used as vectors
+    static std::vector<bool> find_vectors(ControlFlowGraph *cfg);
+};
+
+// Copy propagation for the high-level CFG (not in SSA form).  A use of
+// vrD where the copy "mov vrD, vrS" is available reads vrS instead, so
+// copies of copies are forwarded to the original vreg, and a copy whose
+// destination is left without uses is dead code.
+//
+// Before propagating the copies, run coalesces each copy from a vreg
+// defined earlier in the same block which is dead after the copy, such
+// as the temporary holding the value assigned to a scalar variable:
+//
+//   addi vr7, vr1, $1
+//   mov vr1, vr7
+//
+// becomes "addi vr1, vr1, $1", if neither vreg is used or defined between
+// the definition and the copy.  Vector vregs are never copied or coalesced.
+class CopyPropagation : public ControlFlowGraphTransform {
+private:
+    DataflowAnalysis<AvailableCopies, ForwardDataflow> m_available_copies;
+
+public:
+    CopyPropagation(ControlFlowGraph *cfg);
+    virtual ~CopyPropagation();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+    virtual bool is_block_local() const { return true; }
+
+    // Coalesce the copies which can be coalesced, propagate the others,
+    // and remove the copies left dead (all in place), returning true if
+    // the CFG changed.  live_vregs (if provided) must be up to date.
+    static bool run(ControlFlowGraph *cfg, const LiveVregs *live_vregs = nullptr, unsigned num_threads = 1);
+
+private:
+    static bool coalesce(BasicBlock *bb, const LiveVregs &live_vregs, const std::vector<bool> &is_vector);
+};
+
+#endif // COPY_PROP_H
@@ -0,0 +1,321 @@
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+#include <cassert>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "cfg.h"
+
+// The directions of dataflow problems: each gives the order the blocks
+// are iterated in (cached by the CFG), and the order the instructions of
+// a block are modeled in.
+struct ForwardDataflow {
+    static const bool IS_FORWARD = true;
+
+    static const ControlFlowGraph::BlockList &get_iter_order(const ControlFlowGraph *cfg) {
+        return cfg->get_reverse_postorder();
+    }
+
+    template<typename Lattice, typename Fact>
+    static void model_block(const Lattice &lattice, BasicBlock *bb, Fact &fact) {
+        for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+            lattice.model_instruction(*i, fact);
+        }
+    }
+};
+
+struct BackwardDataflow {
+    static const bool IS_FORWARD = false;
+
+    static const ControlFlowGraph::BlockList &get_iter_order(const ControlFlowGraph *cfg) {
+        return cfg->get_reverse_cfg_reverse_postorder();
+    }
+
+    template<typename Lattice, typename Fact>
+    static void model_block(const Lattice &lattice, BasicBlock *bb, Fact &fact) {
+        for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+            lattice.model_instruction(*i, fact);
+        }
+    }
+};
+
+// A base class for lattices whose block transfer function is just the
+// instructions' transfer functions applied in the analysis's direction.
+template<typename Derived, typename Direction>
+class DataflowLattice {
+public:
+    template<typename Fact>
+    void model_block(BasicBlock *bb, Fact &fact) const {
+        Direction::model_block(static_cast<const Derived &>(*this), bb, fact);
+    }
+};
+
+// A dataflow analysis of a ControlFlowGraph, solved by iterating to a
+// fixed point in the direction's block order.  The analysis is specified
+// by the Lattice class, which provides:
+//
+//   typedef ... Fact;          // (which must have operator==)
+//   Fact get_top() const;      // the initial fact (the identity of meet)
+//   Fact get_boundary() const; // the fact entering the entry block (forward)
+//                              // or leaving the exit block (backward)
+//   void meet(Fact &fact, const Fact &other) const;
+//   void model_instruction(Instruction *ins, Fact &fact) const;
+//   void model_block(BasicBlock *bb, Fact &fact) const;
+//
+// where the model functions transform a fact in the direction of the
+// analysis (DataflowLattice provides model_block).  All of them are
+// called directly, so an analysis is as fast as a hand-written one.
+//
+// Only the blocks in the iteration order are visited (for a backward
+// problem, the blocks from which the exit block can't be reached are
+// not), and the facts of the others are left as the top fact.
+template<typename Lattice, typename Direction>
+class DataflowAnalysis {
+public:
+    typedef typename Lattice::Fact Fact;
+
+private:
+    ControlFlowGraph *m_cfg;
+    Lattice m_lattice;
+    // facts at the beginning and end of each basic block (indexed by block id)
+    std::vector<Fact> m_beginfacts, m_endfacts;
+    // use the worklist solver (rather than round-robin iteration)
+    bool m_use_worklist;
+    // materialized per-instruction facts: for each block, element i is
+    // the fact before instruction i, and the last element is the fact
+    // at the end of the block
+    std::vector<std::vector<Fact>> m_ins_facts;
+    // position of each instruction within its block
+    std::unordered_map<Instruction *, unsigned> m_ins_index;
+
+public:
+    DataflowAnalysis(ControlFlowGraph *cfg, Lattice lattice)
+            : m_cfg(cfg)
+            , m_lattice(std::move(lattice))
+            , m_beginfacts(cfg->get_num_blocks(), m_lattice.get_top())
+            , m_endfacts(cfg->get_num_blocks(), m_lattice.get_top())
+            , m_use_worklist(true) {
+    }
+
+    // choose between the worklist solver (the default) and
+    // round-robin iteration over all blocks
+    void set_use_worklist(bool use_worklist) { m_use_worklist = use_worklist; }
+
+    const Lattice &get_lattice() const { return m_lattice; }
+
+    // execute the analysis
+    void execute() {
+        if (m_use_worklist) {
+            execute_worklist();
+        } else {
+            execute_round_robin();
+        }
+    }
+
+    // Compute and store the facts before and after every instruction,
+    // so that get_fact_after_instruction and get_fact_before_instruction
+    // don't need to rescan the block.  Must be called after execute().
+    void materialize_instruction_facts();
+    bool has_instruction_facts() const { return !m_ins_facts.empty(); }
+
+    const Fact &get_fact_at_beginning_of_block(BasicBlock *bb) const { return m_beginfacts.at(bb->get_id()); }
+    const Fact &get_fact_at_end_of_block(BasicBlock *bb) const { return m_endfacts.at(bb->get_id()); }
+
+    // get the fact after/before the specified instruction
+    Fact get_fact_after_instruction(BasicBlock *bb, Instruction *ins) const;
+    Fact get_fact_before_instruction(BasicBlock *bb, Instruction *ins) const;
+
+    // get the fact after/before the instruction at the given position
+    // in the block (requires materialized instruction facts)
+    const Fact &get_fact_after_instruction(BasicBlock *bb, unsigned index) const {
+        assert(has_instruction_facts());
+        return m_ins_facts[bb->get_id()].at(index + 1);
+    }
+    const Fact &get_fact_before_instruction(BasicBlock *bb, unsigned index) const {
+        assert(has_instruction_facts());
+        return m_ins_facts[bb->get_id()].at(index);
+    }
+
+private:
+    // the facts where the analysis enters and leaves a block
+    std::vector<Fact> &in_facts() { return Direction::IS_FORWARD ? m_beginfacts : m_endfacts; }
+    std::vector<Fact> &out_facts() { return Direction::IS_FORWARD ? m_endfacts : m_beginfacts; }
+
+    // model a block, returning true if the fact leaving it changed
+    bool visit(BasicBlock *bb);
+    void execute_round_robin();
+    void execute_worklist();
+};
+
+template<typename Lattice, typename Direction>
+bool DataflowAnalysis<Lattice, Direction>::visit(BasicBlock *bb) {
+    unsigned id = bb->get_id();
+    std::vector<Fact> &out = out_facts();
+
+    // the fact entering the block is the meet of the facts leaving its
+    // predecessors (forward) or successors (backward)
+    Fact fact;
+    if (bb->get_kind() == (Direction::IS_FORWARD ? BASICBLOCK_ENTRY : BASICBLOCK_EXIT)) {
+        fact = m_lattice.get_boundary();
+    } else {
+        fact = m_lattice.get_top();
+        const ControlFlowGraph::EdgeList &edges =
+            Direction::IS_FORWARD ? m_cfg->get_incoming_edges(bb) : m_cfg->get_outgoing_edges(bb);
+        for (auto i = edges.cbegin(); i != edges.cend(); i++) {
+            BasicBlock *other = Direction::IS_FORWARD ? (*i)->get_source() : (*i)->get_target();
+            m_lattice.meet(fact, out[other->get_id()]);
+        }
+    }
+    in_facts()[id] = fact;
+
+    m_lattice.model_block(bb, fact);
+    if (fact == out[id]) {
+        return false;
+    }
+    out[id] = std::move(fact);
+    return true;
+}
+
+template<typename Lattice, typename Direction>
+void DataflowAnalysis<Lattice, Direction>::execute_round_robin() {
+    const ControlFlowGraph::BlockList &order = Direction::get_iter_order(m_cfg);
+
+    // until no block's outgoing fact changes...
+    bool change = true;
+    while (change) {
+        change = false;
+        for (auto i = order.cbegin(); i != order.cend(); i++) {
+            change = visit(*i) || change;
+        }
+    }
+}
+
+template<typename Lattice, typename Direction>
+void DataflowAnalysis<Lattice, Direction>::execute_worklist() {
+    const ControlFlowGraph::BlockList &order = Direction::get_iter_order(m_cfg);
+
+    // The work list is a flag for each block, swept in iteration order
+    // (so the blocks on it are always visited in that order); initially,
+    // every block needs to be visited.
+    std::vector<bool> on_work_list(m_cfg->get_num_blocks(), false);
+    for (auto i = order.cbegin(); i != order.cend(); i++) {
+        on_work_list[(*i)->get_id()] = true;
+    }
+
+    bool pending = true;
+    while (pending) {
+        pending = false;
+        for (auto i = order.cbegin(); i != order.cend(); i++) {
+            BasicBlock *bb = *i;
+            if (!on_work_list[bb->get_id()]) {
+                continue;
+            }
+            on_work_list[bb->get_id()] = false;
+
+            // if the fact leaving the block changed, the blocks it flows
+            // into need to be revisited
+            if (visit(bb)) {
+                const ControlFlowGraph::EdgeList &edges =
+                    Direction::IS_FORWARD ? m_cfg->get_outgoing_edges(bb) : m_cfg->get_incoming_edges(bb);
+                for (auto j = edges.cbegin(); j != edges.cend(); j++) {
+                    BasicBlock *next = Direction::IS_FORWARD ? (*j)->get_target() : (*j)->get_source();
+                    on_work_list[next->get_id()] = true;
+                    pending = true;
+                }
+            }
+        }
+    }
+}
+
+template<typename Lattice, typename Direction>
+void DataflowAnalysis<Lattice, Direction>::materialize_instruction_facts() {
+    if (has_instruction_facts()) {
+        return;
+    }
+
+    m_ins_facts.resize(m_cfg->get_num_blocks());
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        unsigned len = bb->get_length();
+        std::vector<Fact> &facts = m_ins_facts[bb->get_id()];
+
+        // one sweep over the block
+        facts.resize(len + 1);
+        if (Direction::IS_FORWARD) {
+            facts[0] = m_beginfacts[bb->get_id()];
+            for (unsigned j = 0; j < len; j++) {
+                Instruction *ins = bb->get_instruction(j);
+                facts[j + 1] = facts[j];
+                m_lattice.model_instruction(ins, facts[j + 1]);
+                m_ins_index[ins] = j;
+            }
+        } else {
+            facts[len] = m_endfacts[bb->get_id()];
+            for (unsigned j = len; j > 0; j--) {
+                Instruction *ins = bb->get_instruction(j - 1);
+                facts[j - 1] = facts[j];
+                m_lattice.model_instruction(ins, facts[j - 1]);
+                m_ins_index[ins] = j - 1;
+            }
+        }
+    }
+}
+
+template<typename Lattice, typename Direction>
+typename DataflowAnalysis<Lattice, Direction>::Fact
+DataflowAnalysis<Lattice, Direction>::get_fact_after_instruction(BasicBlock *bb, Instruction *ins) const {
+    if (has_instruction_facts()) {
+        return get_fact_after_instruction(bb, m_ins_index.at(ins));
+    }
+
+    if (Direction::IS_FORWARD) {
+        Fact fact = m_beginfacts[bb->get_id()];
+        for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+            m_lattice.model_instruction(*i, fact);
+            if (*i == ins) {
+                break;
+            }
+        }
+        return fact;
+    } else {
+        Fact fact = m_endfacts[bb->get_id()];
+        for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+            if (*i == ins) {
+                break;
+            }
+            m_lattice.model_instruction(*i, fact);
+        }
+        return fact;
+    }
+}
+
+template<typename Lattice, typename Direction>
+typename DataflowAnalysis<Lattice, Direction>::Fact
+DataflowAnalysis<Lattice, Direction>::get_fact_before_instruction(BasicBlock *bb, Instruction *ins) const {
+    if (has_instruction_facts()) {
+        return get_fact_before_instruction(bb, m_ins_index.at(ins));
+    }
+
+    if (Direction::IS_FORWARD) {
+        Fact fact = m_beginfacts[bb->get_id()];
+        for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+            if (*i == ins) {
+                break;
+            }
+            m_lattice.model_instruction(*i, fact);
+        }
+        return fact;
+    } else {
+        Fact fact = m_endfacts[bb->get_id()];
+        for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+            m_lattice.model_instruction(*i, fact);
+            if (*i == ins) {
+                break;
+            }
+        }
+        return fact;
+    }
+}
+
+#endif // DATAFLOW_H
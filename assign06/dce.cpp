@@ -0,0 +1,192 @@
+#include <cassert>
+#include <memory>
+#include <unordered_map>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "def_use.h"
+#include "stats.h"
+#include "dce.h"
+
+DeadCodeElimination::DeadCodeElimination(ControlFlowGraph *cfg, const LiveVregs *live_vregs)
+        : ControlFlowGraphTransform(cfg)
+        , m_own_live_vregs(nullptr)
+        , m_live_vregs(live_vregs) {
+    if (m_live_vregs == nullptr) {
+        m_own_live_vregs = new LiveVregs(cfg);
+        m_own_live_vregs->execute();
+        m_live_vregs = m_own_live_vregs;
+    }
+}
+
+DeadCodeElimination::~DeadCodeElimination() {
+    delete m_own_live_vregs;
+}
+
+InstructionSequence *DeadCodeElimination::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+
+    std::vector<bool> dead;
+    find_dead(bb, dead);
+    for (unsigned i = 0; i < bb->get_length(); i++) {
+        if (!dead[i]) {
+            out->add_instruction(bb->get_instruction(i)->duplicate());
+        }
+    }
+
+    // don't leave a (possibly labeled) basic block without instructions
+    if (out->get_length() == 0 && bb->get_length() > 0) {
+        out->add_instruction(new Instruction(HINS_NOP));
+    }
+
+    return out;
+}
+
+bool DeadCodeElimination::transform_basic_block_in_place(BasicBlock *bb) {
+    std::vector<bool> dead;
+    find_dead(bb, dead);
+
+    BasicBlockEditor editor(bb);
+    unsigned num_removed = 0;
+    for (unsigned i = 0; i < bb->get_length(); i++) {
+        if (dead[i]) {
+            editor.remove(i);
+            Statistics::get().add("dce.removed");
+            num_removed++;
+        }
+    }
+
+    // don't leave a (possibly labeled) basic block without instructions
+    if (num_removed > 0 && num_removed == bb->get_length()) {
+        editor.insert(bb->get_length(), new Instruction(HINS_NOP));
+    }
+
+    return editor.commit();
+}
+
+bool DeadCodeElimination::run_to_fixpoint(ControlFlowGraph *cfg, const LiveVregs *live_vregs, unsigned num_threads) {
+    bool changed = false;
+    for (;;) {
+        DeadCodeElimination dce(cfg, live_vregs);
+        dce.set_num_threads(num_threads);
+        if (!dce.transform_in_place()) {
+            return changed;
+        }
+        changed = true;
+        // the facts are out of date now
+        live_vregs = nullptr;
+    }
+}
+
+bool DeadCodeElimination::remove_unused(ControlFlowGraph *cfg) {
+    DefUseChains chains(cfg);
+    unsigned num_blocks = cfg->get_num_blocks();
+    std::vector<std::unique_ptr<BasicBlockEditor>> editors(num_blocks);
+    std::vector<unsigned> num_removed(num_blocks, 0);
+
+    // the positions of the instructions in their blocks
+    std::unordered_map<Instruction *, unsigned> index;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (unsigned j = 0; j < (*i)->get_length(); j++) {
+            index[(*i)->get_instruction(j)] = j;
+        }
+    }
+
+    std::vector<int> work_list;
+    for (unsigned v = 0; v < chains.get_num_vregs(); v++) {
+        if (!chains.get_defs(int(v)).empty() && !chains.has_uses(int(v))) {
+            work_list.push_back(int(v));
+        }
+    }
+
+    while (!work_list.empty()) {
+        int vreg = work_list.back();
+        work_list.pop_back();
+        if (chains.has_uses(vreg)) {
+            continue;
+        }
+
+        // (removing a def changes the list)
+        DefUseChains::SiteList defs = chains.get_defs(vreg);
+        for (auto i = defs.begin(); i != defs.end(); i++) {
+            if (!is_removable(i->ins)) {
+                continue;
+            }
+            unsigned id = i->bb->get_id();
+            if (!editors[id]) {
+                editors[id].reset(new BasicBlockEditor(i->bb, &chains));
+            }
+
+            // the vregs the definition used may be left without uses
+            Instruction *ins = i->ins;
+            std::vector<int> used;
+            for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+                if (HighLevel::is_use(ins, j)) {
+                    used.push_back(ins->get_operand(j).get_base_reg());
+                    if (ins->get_operand(j).has_index_reg()) {
+                        used.push_back(ins->get_operand(j).get_index_reg());
+                    }
+                }
+            }
+            editors[id]->remove(index.at(ins));
+            num_removed[id]++;
+            Statistics::get().add("dce.removed");
+            for (auto j = used.begin(); j != used.end(); j++) {
+                if (!chains.has_uses(*j)) {
+                    work_list.push_back(*j);
+                }
+            }
+        }
+    }
+
+    bool changed = false;
+    for (unsigned id = 0; id < num_blocks; id++) {
+        if (editors[id]) {
+            // don't leave a (possibly labeled) basic block without instructions
+            BasicBlock *bb = cfg->get_block(id);
+            if (num_removed[id] == bb->get_length()) {
+                editors[id]->insert(bb->get_length(), new Instruction(HINS_NOP));
+            }
+            editors[id]->commit();
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool DeadCodeElimination::is_removable(Instruction *ins) {
+    // (a def whose destination is a memory reference is a store)
+    if (!HighLevel::is_def(ins) || ins->get_operand(0).is_memref()) {
+        return false;
+    }
+
+    const HighLevelOpcodeInfo &info = HighLevel::get_opcode_info(ins->get_opcode());
+    if ((info.flags & (HOP_STORE | HOP_SIDE_EFFECT)) != 0) {
+        // reads input, or calls a function which may have side effects
+        return false;
+    }
+    if ((info.flags & HOP_MAY_TRAP) != 0) {
+        // a division by zero must still trap
+        Operand divisor = ins->get_operand(ins->get_num_operands() - 1);
+        return divisor.get_kind() == OPERAND_INT_LITERAL && divisor.get_int_value() != 0;
+    }
+    return true;
+}
+
+void DeadCodeElimination::find_dead(BasicBlock *bb, std::vector<bool> &dead) const {
+    unsigned len = bb->get_length();
+    dead.assign(len, false);
+
+    // going backwards: a removed instruction's uses don't keep
+    // the vregs they use alive
+    LiveVregs::LiveSet live = m_live_vregs->get_fact_at_end_of_block(bb);
+    for (unsigned i = len; i > 0; i--) {
+        Instruction *ins = bb->get_instruction(i - 1);
+        if (is_removable(ins) && !live.test(ins->get_operand(0).get_base_reg())) {
+            dead[i - 1] = true;
+        } else {
+            m_live_vregs->model_instruction(ins, live);
+        }
+    }
+}
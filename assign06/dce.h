@@ -0,0 +1,57 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "live_vregs.h"
+
+// Dead code elimination for the high-level CFG (in or out of SSA form).
+//
+// An instruction is removed if it defines a vreg which is not live
+// afterwards and has no side effect other than defining that vreg
+// (see is_removable: reads, stores, writes, branches, and divisions which
+// could trap are always kept).  Each block is scanned backwards starting
+// from the live vregs at its end, so a chain of dead definitions within
+// a block is removed at once; a definition whose only uses are dead
+// code in other blocks is removed when the liveness facts are recomputed,
+// which run_to_fixpoint does until nothing else can be removed.
+//
+// In SSA form, a definition is dead exactly when its vreg has no uses, so
+// remove_unused does the same without the liveness facts: it follows the
+// def-use chains (see def_use.h) from the vregs without uses, removing
+// their definitions and then those of the vregs only they used, in time
+// proportional to the number removed (after building the chains).
+class DeadCodeElimination : public ControlFlowGraphTransform {
+private:
+    LiveVregs *m_own_live_vregs;
+    const LiveVregs *m_live_vregs;
+
+public:
+    DeadCodeElimination(ControlFlowGraph *cfg, const LiveVregs *live_vregs = nullptr);
+    virtual ~DeadCodeElimination();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+    virtual bool transform_basic_block_in_place(BasicBlock *bb);
+    virtual bool is_block_local() const { return true; }
+
+    // Remove dead code from the CFG (in place), recomputing the liveness
+    // facts until no more instructions are removed: returns true if any
+    // were removed.  live_vregs (if provided) is only used for the first
+    // round.  The blocks are transformed on up to num_threads threads.
+    static bool run_to_fixpoint(ControlFlowGraph *cfg, const LiveVregs *live_vregs = nullptr,
+                                unsigned num_threads = 1);
+
+    // can the instruction be removed if the vreg it defines is dead?
+    static bool is_removable(Instruction *ins);
+
+    // Remove the definitions of the vregs which aren't used, in place
+    // (which, outside SSA form, may leave some dead code), returning true
+    // if any were removed.
+    static bool remove_unused(ControlFlowGraph *cfg);
+
+private:
+    void find_dead(BasicBlock *bb, std::vector<bool> &dead) const;
+};
+
+#endif // DCE_H
@@ -0,0 +1,83 @@
+#include <cassert>
+#include "cfg.h"
+#include "highlevel.h"
+#include "def_use.h"
+
+DefUseChains::DefUseChains(ControlFlowGraph *cfg) {
+    unsigned num_vregs = unsigned(HighLevel::get_num_vregs(cfg));
+    m_defs.resize(num_vregs);
+    m_uses.resize(num_vregs);
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            instruction_added(bb, *j);
+        }
+    }
+}
+
+DefUseChains::~DefUseChains() {
+}
+
+const DefUseChains::SiteList &DefUseChains::get_defs(int vreg) const {
+    static const SiteList s_none;
+    return unsigned(vreg) < m_defs.size() ? m_defs[unsigned(vreg)] : s_none;
+}
+
+const DefUseChains::SiteList &DefUseChains::get_uses(int vreg) const {
+    static const SiteList s_none;
+    return unsigned(vreg) < m_uses.size() ? m_uses[unsigned(vreg)] : s_none;
+}
+
+void DefUseChains::instruction_added(BasicBlock *bb, Instruction *ins) {
+    if (HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG) {
+        add_site(m_defs, ins->get_operand(0).get_base_reg(), bb, ins);
+    }
+    for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+        if (HighLevel::is_use(ins, i)) {
+            const Operand &operand = ins->get_operand(i);
+            add_site(m_uses, operand.get_base_reg(), bb, ins);
+            if (operand.has_index_reg()) {
+                add_site(m_uses, operand.get_index_reg(), bb, ins);
+            }
+        }
+    }
+}
+
+void DefUseChains::instruction_removed(BasicBlock *bb, Instruction *ins) {
+    if (HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG) {
+        remove_site(m_defs, ins->get_operand(0).get_base_reg(), ins);
+    }
+    for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+        if (HighLevel::is_use(ins, i)) {
+            const Operand &operand = ins->get_operand(i);
+            remove_site(m_uses, operand.get_base_reg(), ins);
+            if (operand.has_index_reg()) {
+                remove_site(m_uses, operand.get_index_reg(), ins);
+            }
+        }
+    }
+}
+
+void DefUseChains::add_site(std::vector<SiteList> &sites, int vreg, BasicBlock *bb, Instruction *ins) {
+    // (passes may add vregs numbered after the highest one in the CFG)
+    if (unsigned(vreg) >= m_defs.size()) {
+        m_defs.resize(unsigned(vreg) + 1);
+        m_uses.resize(unsigned(vreg) + 1);
+    }
+    sites[unsigned(vreg)].push_back(Site{ bb, ins });
+}
+
+void DefUseChains::remove_site(std::vector<SiteList> &sites, int vreg, Instruction *ins) {
+    // (the order of the sites doesn't matter, so the last one is moved
+    // into the removed one's place)
+    SiteList &list = sites.at(unsigned(vreg));
+    for (auto i = list.begin(); i != list.end(); i++) {
+        if (i->ins == ins) {
+            *i = list.back();
+            list.pop_back();
+            return;
+        }
+    }
+    assert(false);
+}
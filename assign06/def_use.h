@@ -0,0 +1,53 @@
+#ifndef DEF_USE_H
+#define DEF_USE_H
+
+#include <vector>
+#include "cfg.h"
+
+// Def-use chains for the high-level code of a CFG (in or out of SSA
+// form): for each vreg, the instructions defining it (as the destination
+// of a def, see HighLevel::is_def) and the instructions using it (see
+// HighLevel::is_use: as the base or index register of an operand), each
+// with its block.  An instruction using a vreg in several operands is a
+// use for each of them.
+//
+// The chains are built once, and kept up to date by the BasicBlockEditors
+// they're given as a listener, so a pass can find all of the uses of a
+// vreg in time proportional to their number, after any of its edits.
+class DefUseChains : public InstructionListener {
+public:
+    struct Site {
+        BasicBlock *bb;
+        Instruction *ins;
+    };
+    typedef std::vector<Site> SiteList;
+
+private:
+    // the defs and uses of each vreg (indexed by vreg number)
+    std::vector<SiteList> m_defs, m_uses;
+
+    // disallow copy ctor and assignment operator
+    DefUseChains(const DefUseChains &);
+    DefUseChains &operator=(const DefUseChains &);
+
+public:
+    DefUseChains(ControlFlowGraph *cfg);
+    virtual ~DefUseChains();
+
+    // get the number of vregs (all vreg numbers are less than this)
+    unsigned get_num_vregs() const { return unsigned(m_defs.size()); }
+
+    const SiteList &get_defs(int vreg) const;
+    const SiteList &get_uses(int vreg) const;
+    bool has_uses(int vreg) const { return !get_uses(vreg).empty(); }
+
+    // add or remove the defs and uses of an instruction
+    virtual void instruction_added(BasicBlock *bb, Instruction *ins);
+    virtual void instruction_removed(BasicBlock *bb, Instruction *ins);
+
+private:
+    void add_site(std::vector<SiteList> &sites, int vreg, BasicBlock *bb, Instruction *ins);
+    void remove_site(std::vector<SiteList> &sites, int vreg, Instruction *ins);
+};
+
+#endif // DEF_USE_H
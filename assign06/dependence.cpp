@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cstdlib>
+#include "highlevel.h"
+#include "dependence.h"
+
+namespace {
+    // the deepest chain of definitions followed by AffineForm::get
+    const unsigned MAX_DEPTH = 16;
+
+    // wrapping arithmetic on coefficients
+    long add_wrap(long a, long b) {
+        return long((unsigned long) a + (unsigned long) b);
+    }
+
+    long mul_wrap(long a, long b) {
+        return long((unsigned long) a * (unsigned long) b);
+    }
+
+    long gcd(long a, long b) {
+        while (b != 0) {
+            long t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+    // the largest multiple of m (m > 0) which is at most n
+    long floor_multiple(long n, long m) {
+        long q = n / m;
+        if (n % m != 0 && n < 0) {
+            q--;
+        }
+        return q * m;
+    }
+}
+
+bool DependenceTest::gcd_test(const AffineAccess &a, const AffineAccess &b) {
+    if (!is_small(a) || !is_small(b)) {
+        return true;
+    }
+    // the right-hand sides of the equation are lo..hi
+    long diff = b.offset - a.offset;
+    long lo = diff - (a.size - 1), hi = diff + (b.size - 1);
+    long g = gcd(std::labs(a.stride), std::labs(b.stride));
+    if (g == 0) {
+        return lo <= 0 && 0 <= hi;
+    }
+    return floor_multiple(hi, g) >= lo;
+}
+
+bool DependenceTest::banerjee_test(const AffineAccess &a, const AffineAccess &b, long num_iterations) {
+    if (num_iterations < 0 || num_iterations > MAX_VALUE || !is_small(a) || !is_small(b)) {
+        return true;
+    }
+    if (num_iterations == 0) {
+        return false;
+    }
+    // the bounds of stride_a * k - stride_b * k' for 0 <= k, k' <= last
+    long last = num_iterations - 1;
+    long min = std::min(0L, a.stride * last) - std::max(0L, b.stride * last);
+    long max = std::max(0L, a.stride * last) - std::min(0L, b.stride * last);
+    long diff = b.offset - a.offset;
+    long lo = diff - (a.size - 1), hi = diff + (b.size - 1);
+    return lo <= max && hi >= min;
+}
+
+bool DependenceTest::may_depend(const AffineAccess &a, const AffineAccess &b, long num_iterations) {
+    return gcd_test(a, b) && banerjee_test(a, b, num_iterations);
+}
+
+bool DependenceTest::get_distance(const AffineAccess &a, const AffineAccess &b, long &distance) {
+    if (!is_small(a) || !is_small(b) || a.stride != b.stride || a.stride == 0 || a.size != b.size) {
+        return false;
+    }
+    // stride * k + offset_a = stride * (k + distance) + offset_b
+    long diff = a.offset - b.offset;
+    if (diff % a.stride != 0) {
+        return false;
+    }
+    distance = diff / a.stride;
+    return true;
+}
+
+bool DependenceTest::is_small(const AffineAccess &access) {
+    return access.stride >= -MAX_VALUE && access.stride <= MAX_VALUE
+           && access.offset >= -MAX_VALUE && access.offset <= MAX_VALUE
+           && access.size > 0 && access.size <= MAX_VALUE;
+}
+
+void AffineForm::add(const AffineForm &other, long scale) {
+    for (auto i = other.terms.begin(); i != other.terms.end(); i++) {
+        long &coefficient = terms[i->first];
+        coefficient = add_wrap(coefficient, mul_wrap(scale, i->second));
+        if (coefficient == 0) {
+            terms.erase(i->first);
+        }
+    }
+    constant = add_wrap(constant, mul_wrap(scale, other.constant));
+}
+
+bool AffineForm::get(const InstructionSequence *bb, unsigned index, const Operand &operand, AffineForm &form) {
+    form = AffineForm();
+    return get(bb, index, operand, form, 0);
+}
+
+bool AffineForm::get(const InstructionSequence *bb, unsigned index, const Operand &operand, AffineForm &form,
+                     unsigned depth) {
+    // (form is added to)
+    if (operand.get_kind() == OPERAND_INT_LITERAL) {
+        form.constant = add_wrap(form.constant, operand.get_int_value());
+        return true;
+    }
+    if (operand.get_kind() != OPERAND_VREG || depth > MAX_DEPTH) {
+        return false;
+    }
+
+    // find the last definition of the vreg before index
+    int vreg = operand.get_base_reg();
+    unsigned def = index;
+    while (def > 0) {
+        Instruction *ins = bb->get_instruction(def - 1);
+        if (HighLevel::is_def(ins) && ins->get_operand(0).get_base_reg() == vreg) {
+            break;
+        }
+        def--;
+    }
+    if (def == 0) {
+        // the value at the start of the block
+        AffineForm term;
+        term.terms[std::make_pair(vreg, 0L)] = 1;
+        form.add(term);
+        return true;
+    }
+
+    Instruction *ins = bb->get_instruction(def - 1);
+    if (ins->get_operand(0).get_kind() != OPERAND_VREG) {
+        return false;
+    }
+    switch (ins->get_opcode()) {
+        case HINS_LOAD_ICONST:
+        case HINS_MOV:
+            return get(bb, def - 1, ins->get_operand(1), form, depth + 1);
+
+        case HINS_LOCALADDR: {
+            AffineForm term;
+            term.terms[std::make_pair(-1, ins->get_operand(1).get_int_value())] = 1;
+            form.add(term);
+            return true;
+        }
+
+        case HINS_INT_ADD:
+        case HINS_INT_SUB: {
+            AffineForm a, b;
+            if (!get(bb, def - 1, ins->get_operand(1), a, depth + 1)
+                    || !get(bb, def - 1, ins->get_operand(2), b, depth + 1)) {
+                return false;
+            }
+            form.add(a);
+            form.add(b, ins->get_opcode() == HINS_INT_ADD ? 1 : -1);
+            return true;
+        }
+
+        case HINS_INT_MUL: {
+            // (one of the factors must be a constant)
+            AffineForm a, b;
+            if (!get(bb, def - 1, ins->get_operand(1), a, depth + 1)
+                    || !get(bb, def - 1, ins->get_operand(2), b, depth + 1)) {
+                return false;
+            }
+            if (!a.terms.empty()) {
+                std::swap(a, b);
+            }
+            if (!a.terms.empty()) {
+                return false;
+            }
+            form.add(b, a.constant);
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef DEPENDENCE_H
+#define DEPENDENCE_H
+
+#include <map>
+#include <utility>
+#include "cfg.h"
+
+// Dependence tests for the array accesses of a loop.
+//
+// An access is affine in the number k of the iteration (counting from 0):
+// in iteration k, it accesses the size bytes at base + stride * k + offset,
+// where base is loop-invariant.  Two accesses a and b with the same base
+// access a common byte in iterations k and k' only if
+//
+//   stride_a * k - stride_b * k' = offset_b - offset_a + t
+//
+// for some t with -size_a < t < size_b.  The tests are conservative: they
+// only say the accesses are independent when the equation has no solution
+// (so they are also correct for accesses whose addresses wrap around, since
+// offsets are compared as exact integers).
+struct AffineAccess {
+    long stride;
+    long offset;
+    long size;
+};
+
+class DependenceTest {
+public:
+    // the largest stride, offset and number of iterations for which the
+    // tests are exact (beyond it, the accesses are assumed to depend on
+    // each other, so that the computations can't overflow)
+    static const long MAX_VALUE = 1L << 30;
+
+    // the GCD test: false if the equation has no integer solution
+    // (for any k and k'), because the greatest common divisor of the
+    // strides divides none of its right-hand sides
+    static bool gcd_test(const AffineAccess &a, const AffineAccess &b);
+
+    // the Banerjee test: false if the equation has no real solution with
+    // 0 <= k, k' < num_iterations (true if num_iterations is negative,
+    // meaning the number of iterations isn't known)
+    static bool banerjee_test(const AffineAccess &a, const AffineAccess &b, long num_iterations);
+
+    // may a and b access the same byte (in any iterations)?
+    static bool may_depend(const AffineAccess &a, const AffineAccess &b, long num_iterations = -1);
+
+    // if a and b have the same (non-zero) stride and size, and access the
+    // same bytes in iterations k and k + distance (for every k), find the
+    // distance (which may be negative)
+    static bool get_distance(const AffineAccess &a, const AffineAccess &b, long &distance);
+
+private:
+    static bool is_small(const AffineAccess &access);
+};
+
+// A linear combination of the values of vregs at the start of a basic block
+// and of the addresses of variables (as computed by HINS_LOCALADDR), plus a
+// constant, such as the address of an array element computed before a loop.
+// Two addresses with the same terms differ by the difference of their
+// constants.  (The arithmetic wraps around, like the integer instructions.)
+struct AffineForm {
+    // the coefficient of each term, which is (vreg, 0) for the value
+    // of a vreg, or (-1, offset) for the address of a variable
+    std::map<std::pair<int, long>, long> terms;
+    long constant;
+
+    AffineForm() : constant(0) { }
+
+    // add scale * other to this form
+    void add(const AffineForm &other, long scale = 1);
+
+    // find the form of the value of the operand before the instruction at
+    // index in a basic block (following the definitions of the vregs in the
+    // block back to its start), or return false if it isn't known to be affine
+    static bool get(const InstructionSequence *bb, unsigned index, const Operand &operand, AffineForm &form);
+
+private:
+    static bool get(const InstructionSequence *bb, unsigned index, const Operand &operand, AffineForm &form,
+                    unsigned depth);
+};
+
+#endif // DEPENDENCE_H
@@ -0,0 +1,185 @@
+#include <cassert>
+#include <vector>
+#include "cfg.h"
+#include "highlevel.h"
+#include "storage_layout.h"
+#include "stats.h"
+#include "dse.h"
+
+namespace {
+    template<typename T>
+    void intersect(std::set<T> &set, const std::set<T> &other) {
+        for (auto i = set.begin(); i != set.end(); ) {
+            if (other.count(*i) == 0) {
+                i = set.erase(i);
+            } else {
+                i++;
+            }
+        }
+    }
+
+    bool is_load(int opcode) {
+        return opcode == HINS_LOAD_INT || opcode == HINS_LOAD_CHAR || opcode == HINS_VEC_LOAD;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// DeadMemory implementation
+////////////////////////////////////////////////////////////////////////
+
+DeadMemory::DeadMemory(ControlFlowGraph *cfg, const AliasAnalysis &alias, const StorageLayout *layout)
+        : m_alias(&alias)
+        , m_gvn(cfg) {
+    if (layout != nullptr) {
+        const std::map<long, StorageLayout::Variable> &variables = layout->get_variables();
+        for (auto i = variables.begin(); i != variables.end(); i++) {
+            if (!layout->is_static_variable(i->first)) {
+                m_frame_variables.insert(i->first);
+            }
+        }
+    }
+}
+
+void DeadMemory::meet(Fact &fact, const Fact &other) const {
+    if (!other.reachable) {
+        return;
+    }
+    if (!fact.reachable) {
+        fact = other;
+        return;
+    }
+
+    // a location is dead only if it is dead in both facts
+    intersect(fact.overwritten, other.overwritten);
+    intersect(fact.dead_variables, other.dead_variables);
+}
+
+void DeadMemory::model_instruction(Instruction *ins, Fact &fact) const {
+    if (!fact.reachable) {
+        return;
+    }
+
+    // (the instruction's writes come after its reads, so they are modeled first)
+    int opcode = ins->get_opcode();
+    Location location;
+    if (opcode == HINS_STORE_INT && get_location(ins->get_operand(0), location)) {
+        fact.overwritten.insert(location);
+    }
+    // (a copy or a constant holds a value number defined above it, or a literal's)
+    if (HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG
+            && opcode != HINS_MOV && opcode != HINS_LOAD_ICONST) {
+        int vn = m_gvn.get_value_number(ins->get_operand(0).get_base_reg());
+        fact.overwritten.erase(Location(-1, vn));
+    }
+
+    if (is_load(opcode) && ins->get_operand(1).is_memref()) {
+        AliasAnalysis::Value address = m_alias->get_address(ins->get_operand(1));
+        long size = AliasAnalysis::get_access_size(ins);
+        for (auto i = fact.overwritten.begin(); i != fact.overwritten.end(); ) {
+            if (AliasAnalysis::may_alias(get_address(*i), 8, address, size)) {
+                i = fact.overwritten.erase(i);
+            } else {
+                i++;
+            }
+        }
+        if (address.kind == AliasAnalysis::Value::ADDRESS) {
+            fact.dead_variables.erase(address.variable);
+        } else {
+            fact.dead_variables.clear();
+        }
+    } else if (HighLevel::has_flags(opcode, HOP_LOAD)) {
+        // some other read of memory (or a call, which may read anything)
+        fact.overwritten.clear();
+        fact.dead_variables.clear();
+    }
+}
+
+bool DeadMemory::is_dead_store(Instruction *ins, const Fact &fact_after) const {
+    Location location;
+    if (!fact_after.reachable || ins->get_opcode() != HINS_STORE_INT
+            || !get_location(ins->get_operand(0), location)) {
+        return false;
+    }
+    if (fact_after.overwritten.count(location) > 0) {
+        return true;
+    }
+    AliasAnalysis::Value address = m_alias->get_address(ins->get_operand(0));
+    return address.kind == AliasAnalysis::Value::ADDRESS && fact_after.dead_variables.count(address.variable) > 0;
+}
+
+bool DeadMemory::get_location(const Operand &memref, Location &location) const {
+    if (memref.get_kind() != OPERAND_VREG_MEMREF) {
+        return false;
+    }
+    AliasAnalysis::Value address = m_alias->get_address(memref);
+    if (address.kind == AliasAnalysis::Value::ADDRESS && address.modulus == 0) {
+        location = Location(address.variable, address.residue);
+        return true;
+    }
+    int vn = m_gvn.get_value_number(memref.get_base_reg());
+    location = Location(-1, vn);
+    return vn >= 0;
+}
+
+AliasAnalysis::Value DeadMemory::get_address(const Location &location) const {
+    if (location.first >= 0) {
+        return AliasAnalysis::Value{ AliasAnalysis::Value::ADDRESS, location.first, location.second, 0 };
+    }
+    return m_alias->get_value(m_gvn.get_holder(int(location.second)));
+}
+
+////////////////////////////////////////////////////////////////////////
+// DeadStoreElimination implementation
+////////////////////////////////////////////////////////////////////////
+
+DeadStoreElimination::DeadStoreElimination(ControlFlowGraph *cfg, const AliasAnalysis *alias,
+                                           const StorageLayout *layout)
+        : ControlFlowGraphTransform(cfg)
+        , m_own_alias(alias != nullptr ? nullptr : new AliasAnalysis(cfg, layout))
+        , m_dead_memory(cfg, DeadMemory(cfg, alias != nullptr ? *alias : *m_own_alias, layout))
+        , m_all_blocks_exit(true) {
+    // are all of the reachable blocks visited by the analysis?
+    std::vector<bool> reaches_exit(cfg->get_num_blocks(), false);
+    const ControlFlowGraph::BlockList &order = cfg->get_reverse_cfg_reverse_postorder();
+    for (auto i = order.cbegin(); i != order.cend(); i++) {
+        reaches_exit[(*i)->get_id()] = true;
+    }
+    const ControlFlowGraph::BlockList &rpo = cfg->get_reverse_postorder();
+    for (auto i = rpo.cbegin(); i != rpo.cend(); i++) {
+        m_all_blocks_exit = m_all_blocks_exit && reaches_exit[(*i)->get_id()];
+    }
+
+    if (m_all_blocks_exit) {
+        m_dead_memory.execute();
+    }
+}
+
+DeadStoreElimination::~DeadStoreElimination() {
+    delete m_own_alias;
+}
+
+InstructionSequence *DeadStoreElimination::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+
+    // the stores to locations dead after them, found from the end of the block
+    const DeadMemory &lattice = m_dead_memory.get_lattice();
+    DeadMemory::Fact fact = m_dead_memory.get_fact_at_end_of_block(bb);
+    unsigned len = bb->get_length();
+    std::vector<bool> is_dead(len, false);
+    for (unsigned i = len; i > 0 && m_all_blocks_exit; i--) {
+        Instruction *ins = bb->get_instruction(i - 1);
+        if (lattice.is_dead_store(ins, fact)) {
+            is_dead[i - 1] = true;
+            Statistics::get().add("dse.stores");
+        }
+        lattice.model_instruction(ins, fact);
+    }
+
+    for (unsigned i = 0; i < len; i++) {
+        if (!is_dead[i]) {
+            out->add_instruction(bb->get_instruction(i)->duplicate());
+        }
+    }
+    return out;
+}
@@ -0,0 +1,93 @@
+#ifndef DSE_H
+#define DSE_H
+
+#include <set>
+#include <utility>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "dataflow.h"
+#include "alias.h"
+#include "gvn.h"
+
+class StorageLayout;
+
+// The lattice of dead memory, for a CFG in SSA form: a location is dead at
+// a point if on every path from the point, it is overwritten before it is
+// read, or the function returns without reading it (if it is part of a
+// variable in the function's stack frame).
+//
+// A location stored to by a HINS_STORE_INT is identified by the variable
+// and offset of its address, if the alias analysis knows them, and
+// otherwise by the value number of the address (see GlobalValueNumbering),
+// which stops identifying the location above the instruction computing
+// that value number (a copy of it doesn't).  A load kills the locations it may alias, and any
+// other instruction reading memory (such as a call) kills all of them.
+class DeadMemory : public DataflowLattice<DeadMemory, BackwardDataflow> {
+public:
+    // (variable, offset), or (-1, value number)
+    typedef std::pair<long, long> Location;
+
+    struct Fact {
+        // the top fact (at the end of the blocks from which the exit
+        // isn't reached) is unreachable, and is the identity of the meet
+        bool reachable;
+        // the locations overwritten before they are read
+        std::set<Location> overwritten;
+        // the variables not read again before the function returns
+        std::set<long> dead_variables;
+
+        bool operator==(const Fact &other) const {
+            return reachable == other.reachable && overwritten == other.overwritten
+                   && dead_variables == other.dead_variables;
+        }
+    };
+
+private:
+    const AliasAnalysis *m_alias;
+    GlobalValueNumbering m_gvn;
+    // the variables in the stack frame (dead at the exit)
+    std::set<long> m_frame_variables;
+
+public:
+    DeadMemory(ControlFlowGraph *cfg, const AliasAnalysis &alias, const StorageLayout *layout);
+
+    Fact get_top() const { return Fact{ false, std::set<Location>(), std::set<long>() }; }
+    Fact get_boundary() const { return Fact{ true, std::set<Location>(), m_frame_variables }; }
+    void meet(Fact &fact, const Fact &other) const;
+    void model_instruction(Instruction *ins, Fact &fact) const;
+
+    // is an instruction a store to a dead location?
+    bool is_dead_store(Instruction *ins, const Fact &fact_after) const;
+
+private:
+    bool get_location(const Operand &memref, Location &location) const;
+    AliasAnalysis::Value get_address(const Location &location) const;
+};
+
+// Dead store elimination for the high-level CFG (in SSA form): a
+// HINS_STORE_INT to a location which is dead after it (see DeadMemory) is
+// removed, such as a store to an array element assigned again before it
+// is read, or to a local array never read again before the function
+// returns.  The address computations left without uses are dead code.
+//
+// A function with a loop which never exits is left alone, since the
+// analysis doesn't reach the blocks of the loop (whose reads it would
+// miss).
+class DeadStoreElimination : public ControlFlowGraphTransform {
+private:
+    AliasAnalysis *m_own_alias;
+    DataflowAnalysis<DeadMemory, BackwardDataflow> m_dead_memory;
+    bool m_all_blocks_exit;
+
+public:
+    // (the alias analysis is computed if it isn't given; without the
+    // storage layout, no variable is known to be dead at the exit)
+    DeadStoreElimination(ControlFlowGraph *cfg, const AliasAnalysis *alias = nullptr,
+                         const StorageLayout *layout = nullptr);
+    virtual ~DeadStoreElimination();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+    virtual bool is_block_local() const { return true; }
+};
+
+#endif // DSE_H
@@ -0,0 +1,231 @@
+#include <cassert>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <elf.h>
+#include "util.h"
+#include "elf_writer.h"
+
+namespace {
+    // section header indices
+    enum {
+        SEC_NULL,
+        SEC_TEXT,
+        SEC_RODATA,
+        SEC_BSS,
+        SEC_RELA_TEXT,
+        SEC_SYMTAB,
+        SEC_STRTAB,
+        SEC_SHSTRTAB,
+        SEC_NOTE_GNU_STACK,
+        NUM_SECTIONS,
+    };
+
+    // a string table (.strtab or .shstrtab), starting with the empty string
+    class StringSection {
+    private:
+        std::vector<unsigned char> m_data;
+
+    public:
+        StringSection() : m_data(1, 0) { }
+
+        Elf64_Word add(const std::string &s) {
+            Elf64_Word offset = Elf64_Word(m_data.size());
+            m_data.insert(m_data.end(), s.begin(), s.end());
+            m_data.push_back(0);
+            return offset;
+        }
+
+        const std::vector<unsigned char> &get_data() const { return m_data; }
+    };
+
+    template<typename T>
+    void append(std::vector<unsigned char> &out, const T &value) {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(&value);
+        out.insert(out.end(), p, p + sizeof(T));
+    }
+
+    void align(std::vector<unsigned char> &out, unsigned long alignment) {
+        while (out.size() % alignment != 0) {
+            out.push_back(0);
+        }
+    }
+}
+
+ElfObjectWriter::ElfObjectWriter()
+        : m_bss_size(0)
+        , m_bss_alignment(1) {
+}
+
+ElfObjectWriter::~ElfObjectWriter() {
+}
+
+void ElfObjectWriter::set_text(const std::vector<unsigned char> &code,
+                               const std::vector<X86_64Encoder::Relocation> &relocations) {
+    m_text = code;
+    m_relocations = relocations;
+}
+
+void ElfObjectWriter::add_function(const std::string &label, unsigned long offset, unsigned long size) {
+    m_functions.push_back(Function{ label, offset, size });
+}
+
+void ElfObjectWriter::add_rodata_string(const std::string &label, const std::string &s) {
+    assert(m_rodata_labels.count(label) == 0);
+    m_rodata_labels[label] = m_rodata.size();
+    m_rodata.insert(m_rodata.end(), s.begin(), s.end());
+    m_rodata.push_back(0);
+}
+
+void ElfObjectWriter::add_bss_variable(const std::string &label, unsigned long size, unsigned long alignment) {
+    assert(m_bss_labels.count(label) == 0);
+    m_bss_size = (m_bss_size + alignment - 1) / alignment * alignment;
+    m_bss_labels[label] = m_bss_size;
+    m_bss_size += size;
+    m_bss_alignment = std::max(m_bss_alignment, alignment);
+}
+
+void ElfObjectWriter::write(const std::string &filename) const {
+    std::vector<unsigned char> out = get_image();
+    FILE *f = fopen(filename.c_str(), "wb");
+    if (f == nullptr) {
+        err_fatal("Could not open output file \"%s\"\n", filename.c_str());
+    }
+    if (fwrite(&out[0], 1, out.size(), f) != out.size() || fclose(f) != 0) {
+        err_fatal("Could not write output file \"%s\"\n", filename.c_str());
+    }
+}
+
+void ElfObjectWriter::write(FILE *f) const {
+    std::vector<unsigned char> out = get_image();
+    if (fwrite(&out[0], 1, out.size(), f) != out.size()) {
+        err_fatal("Could not write the object file\n");
+    }
+}
+
+std::vector<unsigned char> ElfObjectWriter::get_image() const {
+    StringSection strtab, shstrtab;
+    std::vector<Elf64_Sym> symbols;
+    std::map<std::string, Elf64_Word> symbol_index;
+
+    // local symbols: the null symbol, the sections, and the read-only data
+    symbols.push_back(Elf64_Sym());
+    for (unsigned sec : { SEC_TEXT, SEC_RODATA, SEC_BSS }) {
+        Elf64_Sym sym = Elf64_Sym();
+        sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+        sym.st_shndx = Elf64_Section(sec);
+        symbols.push_back(sym);
+    }
+    for (unsigned sec : { SEC_RODATA, SEC_BSS }) {
+        const std::map<std::string, unsigned long> &labels = (sec == SEC_RODATA) ? m_rodata_labels : m_bss_labels;
+        for (auto i = labels.begin(); i != labels.end(); i++) {
+            Elf64_Sym sym = Elf64_Sym();
+            sym.st_name = strtab.add(i->first);
+            sym.st_info = ELF64_ST_INFO(STB_LOCAL, (sec == SEC_BSS) ? STT_OBJECT : STT_NOTYPE);
+            sym.st_shndx = Elf64_Section(sec);
+            sym.st_value = i->second;
+            symbol_index[i->first] = Elf64_Word(symbols.size());
+            symbols.push_back(sym);
+        }
+    }
+    Elf64_Word first_global = Elf64_Word(symbols.size());
+
+    // global symbols: the functions, and the external symbols
+    for (auto i = m_functions.begin(); i != m_functions.end(); i++) {
+        Elf64_Sym sym = Elf64_Sym();
+        sym.st_name = strtab.add(i->label);
+        sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+        sym.st_shndx = SEC_TEXT;
+        sym.st_value = i->offset;
+        sym.st_size = i->size;
+        symbol_index[i->label] = Elf64_Word(symbols.size());
+        symbols.push_back(sym);
+    }
+
+    std::vector<unsigned char> rela;
+    for (auto i = m_relocations.begin(); i != m_relocations.end(); i++) {
+        if (symbol_index.count(i->symbol) == 0) {
+            Elf64_Sym sym = Elf64_Sym();
+            sym.st_name = strtab.add(i->symbol);
+            sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+            sym.st_shndx = SHN_UNDEF;
+            symbol_index[i->symbol] = Elf64_Word(symbols.size());
+            symbols.push_back(sym);
+        }
+        Elf64_Rela r;
+        r.r_offset = i->offset;
+        r.r_info = ELF64_R_INFO(symbol_index[i->symbol], i->type);
+        r.r_addend = i->addend;
+        append(rela, r);
+    }
+
+    std::vector<unsigned char> symtab;
+    for (auto i = symbols.begin(); i != symbols.end(); i++) {
+        append(symtab, *i);
+    }
+
+    // the section headers
+    std::vector<Elf64_Shdr> headers(NUM_SECTIONS, Elf64_Shdr());
+    const std::vector<unsigned char> empty;
+    const std::vector<unsigned char> *contents[NUM_SECTIONS] = {
+        &empty, &m_text, &m_rodata, &empty, &rela, &symtab, &strtab.get_data(), nullptr, &empty,
+    };
+    struct { const char *name; Elf64_Word type; Elf64_Xword flags; Elf64_Xword align; } info[NUM_SECTIONS] = {
+        { "",                SHT_NULL,     0,                         0 },
+        { ".text",           SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 16 },
+        { ".rodata",         SHT_PROGBITS, SHF_ALLOC,                 1 },
+        { ".bss",            SHT_NOBITS,   SHF_ALLOC | SHF_WRITE,     1 },
+        { ".rela.text",      SHT_RELA,     SHF_INFO_LINK,             8 },
+        { ".symtab",         SHT_SYMTAB,   0,                         8 },
+        { ".strtab",         SHT_STRTAB,   0,                         1 },
+        { ".shstrtab",       SHT_STRTAB,   0,                         1 },
+        { ".note.GNU-stack", SHT_PROGBITS, 0,                         1 },
+    };
+    for (unsigned i = 1; i < NUM_SECTIONS; i++) {
+        headers[i].sh_name = shstrtab.add(info[i].name);
+        headers[i].sh_type = info[i].type;
+        headers[i].sh_flags = info[i].flags;
+        headers[i].sh_addralign = info[i].align;
+    }
+    headers[SEC_BSS].sh_addralign = m_bss_alignment;
+    contents[SEC_SHSTRTAB] = &shstrtab.get_data();
+    headers[SEC_RELA_TEXT].sh_link = SEC_SYMTAB;
+    headers[SEC_RELA_TEXT].sh_info = SEC_TEXT;
+    headers[SEC_RELA_TEXT].sh_entsize = sizeof(Elf64_Rela);
+    headers[SEC_SYMTAB].sh_link = SEC_STRTAB;
+    headers[SEC_SYMTAB].sh_info = first_global;
+    headers[SEC_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+
+    // lay out the file: the ELF header, the sections, then the section headers
+    std::vector<unsigned char> out(sizeof(Elf64_Ehdr), 0);
+    for (unsigned i = 1; i < NUM_SECTIONS; i++) {
+        align(out, (info[i].align != 0) ? info[i].align : 1);
+        headers[i].sh_offset = out.size();
+        headers[i].sh_size = contents[i]->size();
+        out.insert(out.end(), contents[i]->begin(), contents[i]->end());
+    }
+    // (.bss takes no space in the file)
+    headers[SEC_BSS].sh_size = m_bss_size;
+    align(out, 8);
+    Elf64_Off shoff = out.size();
+    for (auto i = headers.begin(); i != headers.end(); i++) {
+        append(out, *i);
+    }
+
+    Elf64_Ehdr ehdr = Elf64_Ehdr();
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = ET_REL;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_shoff = shoff;
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shnum = NUM_SECTIONS;
+    ehdr.e_shstrndx = SEC_SHSTRTAB;
+    memcpy(&out[0], &ehdr, sizeof(ehdr));
+    return out;
+}
@@ -0,0 +1,61 @@
+#ifndef ELF_WRITER_H
+#define ELF_WRITER_H
+
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <map>
+#include "x86_64_encoder.h"
+
+// Writes an ELF64 relocatable object file (for x86-64 Linux) containing
+// the code of a program, its read-only data and uninitialized (.bss)
+// variables, and the relocations left by X86_64Encoder.  The functions
+// added by add_function are global symbols (the program's main function, or
+// the subprograms of a unit; the calls within the code have already been
+// resolved by the encoder), and the labels of the data are local symbols;
+// any other symbol referred to by a relocation is an undefined (external)
+// symbol.
+class ElfObjectWriter : public DataSections {
+private:
+    struct Function {
+        std::string label;
+        unsigned long offset, size;
+    };
+
+    std::vector<unsigned char> m_text;
+    std::vector<Function> m_functions;
+    std::vector<X86_64Encoder::Relocation> m_relocations;
+    std::vector<unsigned char> m_rodata;
+    std::map<std::string, unsigned long> m_rodata_labels;
+    unsigned long m_bss_size;
+    unsigned long m_bss_alignment;
+    std::map<std::string, unsigned long> m_bss_labels;
+
+    // disallow copy ctor and assignment operator
+    ElfObjectWriter(const ElfObjectWriter &);
+    ElfObjectWriter &operator=(const ElfObjectWriter &);
+
+public:
+    ElfObjectWriter();
+    ~ElfObjectWriter();
+
+    void set_text(const std::vector<unsigned char> &code,
+                  const std::vector<X86_64Encoder::Relocation> &relocations);
+
+    // define a global function, whose code is size bytes at offset in the code
+    void add_function(const std::string &label, unsigned long offset, unsigned long size);
+
+    void add_rodata_string(const std::string &label, const std::string &s) override;
+    void add_bss_variable(const std::string &label, unsigned long size, unsigned long alignment) override;
+
+    // write the object file, to a file or a stream (a fatal error if it
+    // can't be written)
+    void write(const std::string &filename) const;
+    void write(FILE *f) const;
+
+private:
+    // the contents of the object file
+    std::vector<unsigned char> get_image() const;
+};
+
+#endif // ELF_WRITER_H
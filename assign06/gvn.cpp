@@ -0,0 +1,369 @@
+#include <cassert>
+#include <climits>
+#include <map>
+#include <utility>
+#include "cfg.h"
+#include "highlevel.h"
+#include "ssa.h"
+#include "stats.h"
+#include "gvn.h"
+
+namespace {
+    bool is_pure(int opcode) {
+        switch (opcode) {
+            case HINS_LOCALADDR:
+            case HINS_INT_ADD:
+            case HINS_INT_SUB:
+            case HINS_INT_MUL:
+            case HINS_INT_DIV:
+            case HINS_INT_MOD:
+            case HINS_INT_NEGATE:
+            case HINS_UINT_DIV:
+            case HINS_UINT_MOD:
+            case HINS_LEA:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool is_commutative(int opcode) {
+        return opcode == HINS_INT_ADD || opcode == HINS_INT_MUL;
+    }
+
+    bool is_value(const Operand &operand) {
+        return operand.get_kind() == OPERAND_VREG || operand.get_kind() == OPERAND_INT_LITERAL;
+    }
+
+    // the operands of a def, other than its destination
+    std::vector<Operand> get_uses(Instruction *ins) {
+        std::vector<Operand> uses;
+        for (unsigned i = 1; i < ins->get_num_operands(); i++) {
+            uses.push_back(ins->get_operand(i));
+        }
+        return uses;
+    }
+}
+
+GlobalValueNumbering::GlobalValueNumbering(ControlFlowGraph *cfg)
+        : m_vreg_vn(unsigned(HighLevel::get_num_vregs(cfg)), -1) {
+    // The operands of every instruction other than a phi function were
+    // numbered by their definitions (which dominate it), except for vregs
+    // never defined.  The value numbers of literals and expressions are
+    // keyed by the opcode (-1 for a literal) and the operands' value numbers.
+    std::map<std::vector<long>, int> expr_vn;
+    int next_vn = 0;
+    auto number_operand = [&](const Operand &operand) -> int {
+        if (operand.get_kind() == OPERAND_INT_LITERAL) {
+            auto found = expr_vn.emplace(std::vector<long>{ -1, operand.get_int_value() }, next_vn);
+            if (found.second) {
+                next_vn++;
+            }
+            return found.first->second;
+        }
+        int &vn = m_vreg_vn[unsigned(operand.get_base_reg())];
+        if (vn < 0) {
+            vn = next_vn++;
+        }
+        return vn;
+    };
+
+    const ControlFlowGraph::BlockList &rpo = cfg->get_reverse_postorder();
+    for (auto i = rpo.cbegin(); i != rpo.cend(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            Instruction *ins = *j;
+            if (!HighLevel::is_def(ins) || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+                continue;
+            }
+            int opcode = ins->get_opcode();
+            int &dest_vn = m_vreg_vn[unsigned(ins->get_operand(0).get_base_reg())];
+
+            bool numbered = opcode == HINS_LOAD_ICONST || opcode == HINS_MOV || is_pure(opcode);
+            for (unsigned k = 1; k < ins->get_num_operands() && numbered; k++) {
+                numbered = is_value(ins->get_operand(k));
+            }
+            if (!numbered) {
+                dest_vn = next_vn++;
+                continue;
+            }
+            if (opcode == HINS_LOAD_ICONST || opcode == HINS_MOV) {
+                // the same value as the literal or source
+                dest_vn = number_operand(ins->get_operand(1));
+                continue;
+            }
+
+            std::vector<long> expr(1, opcode);
+            for (unsigned k = 1; k < ins->get_num_operands(); k++) {
+                expr.push_back(number_operand(ins->get_operand(k)));
+            }
+            if (is_commutative(opcode) && expr.size() == 3 && expr[1] > expr[2]) {
+                std::swap(expr[1], expr[2]);
+            }
+            auto found = expr_vn.emplace(expr, next_vn);
+            dest_vn = found.first->second;
+            if (found.second) {
+                next_vn++;
+            }
+        }
+    }
+
+    m_vn_vreg.assign(unsigned(next_vn), -1);
+    for (unsigned i = 0; i < m_vreg_vn.size(); i++) {
+        if (m_vreg_vn[i] >= 0 && m_vn_vreg[unsigned(m_vreg_vn[i])] < 0) {
+            m_vn_vreg[unsigned(m_vreg_vn[i])] = int(i);
+        }
+    }
+}
+
+GlobalValueNumbering::~GlobalValueNumbering() {
+}
+
+int GlobalValueNumbering::get_value_number(int vreg) const {
+    return vreg >= 0 && unsigned(vreg) < m_vreg_vn.size() ? m_vreg_vn[unsigned(vreg)] : -1;
+}
+
+bool GlobalValueNumbering::same_value(const Operand &a, const Operand &b) const {
+    if (a.get_kind() == OPERAND_VREG && b.get_kind() == OPERAND_VREG) {
+        int vn = get_value_number(a.get_base_reg());
+        return vn >= 0 && vn == get_value_number(b.get_base_reg());
+    }
+    return a.get_kind() == OPERAND_INT_LITERAL && a == b;
+}
+
+////////////////////////////////////////////////////////////////////////
+// PartialRedundancyElimination implementation
+////////////////////////////////////////////////////////////////////////
+
+PartialRedundancyElimination::PartialRedundancyElimination(ControlFlowGraph *cfg, const DominatorTree *domtree)
+        : ControlFlowGraphTransform(cfg)
+        , m_own_domtree(domtree != nullptr ? nullptr : new DominatorTree(cfg))
+        , m_domtree(domtree != nullptr ? *domtree : *m_own_domtree)
+        , m_gvn(cfg)
+        , m_next_vreg(HighLevel::get_num_vregs(cfg))
+        , m_def_blocks(unsigned(m_next_vreg), nullptr) {
+    m_new_phis.resize(cfg->get_num_blocks());
+    m_appended.resize(cfg->get_num_blocks());
+
+    // the defs, and the pure instructions computing each expression
+    const std::vector<BasicBlock *> &rpo = m_domtree.get_reverse_postorder();
+    for (auto i = rpo.begin(); i != rpo.end(); i++) {
+        for (unsigned j = 0; j < (*i)->get_length(); j++) {
+            Instruction *ins = (*i)->get_instruction(j);
+            if (!HighLevel::is_def(ins) || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+                continue;
+            }
+            int dest = ins->get_operand(0).get_base_reg();
+            m_def_blocks[unsigned(dest)] = *i;
+
+            Expression expr;
+            std::vector<Operand> operands = get_uses(ins);
+            if (is_pure(ins->get_opcode()) && get_expression(ins->get_opcode(), operands, expr)) {
+                m_holders[expr].push_back(Holder{ dest, *i, j });
+            }
+        }
+    }
+
+    for (auto i = rpo.begin(); i != rpo.end(); i++) {
+        for (unsigned j = 0; j < (*i)->get_length(); j++) {
+            eliminate(*i, j);
+        }
+    }
+}
+
+PartialRedundancyElimination::~PartialRedundancyElimination() {
+    delete m_own_domtree;
+    for (unsigned i = 0; i < m_new_phis.size(); i++) {
+        for (auto j = m_new_phis[i].begin(); j != m_new_phis[i].end(); j++) {
+            delete *j;
+        }
+        for (auto j = m_appended[i].begin(); j != m_appended[i].end(); j++) {
+            delete *j;
+        }
+    }
+    for (auto i = m_replaced.begin(); i != m_replaced.end(); i++) {
+        delete i->second;
+    }
+}
+
+InstructionSequence *PartialRedundancyElimination::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+    const std::vector<Instruction *> &new_phis = m_new_phis[bb->get_id()];
+    const std::vector<Instruction *> &appended = m_appended[bb->get_id()];
+
+    // the new phis go after the original ones
+    unsigned len = bb->get_length(), num_phis = 0;
+    while (num_phis < len && SSA::is_phi(bb->get_instruction(num_phis))) {
+        num_phis++;
+    }
+    unsigned split = SSA::get_insertion_point(bb);
+
+    for (unsigned i = 0; i <= len; i++) {
+        if (i == num_phis) {
+            for (auto j = new_phis.begin(); j != new_phis.end(); j++) {
+                out->add_instruction((*j)->duplicate());
+            }
+        }
+        if (i == split) {
+            for (auto j = appended.begin(); j != appended.end(); j++) {
+                out->add_instruction((*j)->duplicate());
+            }
+        }
+        if (i == len) {
+            break;
+        }
+
+        Instruction *ins = bb->get_instruction(i);
+        auto r = m_replaced.find(ins);
+        if (r == m_replaced.end()) {
+            out->add_instruction(ins->duplicate());
+        } else if (r->second != nullptr) {
+            out->add_instruction(r->second->duplicate());
+        }
+    }
+
+    // don't leave a (possibly labeled) basic block without instructions
+    if (out->get_length() == 0 && len > 0) {
+        out->add_instruction(new Instruction(HINS_NOP));
+    }
+
+    return out;
+}
+
+bool PartialRedundancyElimination::get_expression(int opcode, const std::vector<Operand> &operands,
+                                                  Expression &expr) const {
+    expr.assign(1, opcode);
+    for (auto i = operands.begin(); i != operands.end(); i++) {
+        if (i->get_kind() == OPERAND_INT_LITERAL) {
+            expr.push_back(0);
+            expr.push_back(i->get_int_value());
+            continue;
+        }
+        int vn = i->get_kind() == OPERAND_VREG ? m_gvn.get_value_number(i->get_base_reg()) : -1;
+        if (vn < 0) {
+            return false;
+        }
+        expr.push_back(1);
+        expr.push_back(vn);
+    }
+    if (is_commutative(opcode) && expr.size() == 5
+            && std::make_pair(expr[1], expr[2]) > std::make_pair(expr[3], expr[4])) {
+        std::swap(expr[1], expr[3]);
+        std::swap(expr[2], expr[4]);
+    }
+    return true;
+}
+
+int PartialRedundancyElimination::find_available(const Expression &expr, BasicBlock *bb, unsigned index) const {
+    auto found = m_holders.find(expr);
+    if (found == m_holders.end()) {
+        return -1;
+    }
+    for (auto i = found->second.begin(); i != found->second.end(); i++) {
+        if (i->bb == bb ? i->index < index : m_domtree.dominates(i->bb, bb)) {
+            return i->vreg;
+        }
+    }
+    return -1;
+}
+
+void PartialRedundancyElimination::eliminate(BasicBlock *bb, unsigned index) {
+    Instruction *ins = bb->get_instruction(index);
+    int opcode = ins->get_opcode();
+    if (!is_pure(opcode) || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+        return;
+    }
+    const Operand &dest = ins->get_operand(0);
+    std::vector<Operand> operands = get_uses(ins);
+    Expression expr;
+    if (!get_expression(opcode, operands, expr)) {
+        return;
+    }
+
+    int available = find_available(expr, bb, index);
+    if (available >= 0) {
+        m_replaced[ins] = new Instruction(HINS_MOV, dest, Operand(OPERAND_VREG, available));
+        m_replaced[ins]->copy_comment(ins);
+        Statistics::get().add("pre.redundant");
+        return;
+    }
+
+    ControlFlowGraph *cfg = get_orig_cfg();
+    std::vector<BasicBlock *> preds = SSA::get_predecessors(cfg, bb);
+    if (preds.size() < 2) {
+        return;
+    }
+
+    // translate the expression into each predecessor: an operand defined
+    // by a phi of the block is replaced by the phi's operand, and one
+    // defined by another instruction of the block can't be translated
+    std::vector<std::vector<Operand>> translated(preds.size(), operands);
+    std::vector<Expression> pred_exprs(preds.size());
+    std::vector<int> holders(preds.size(), -1);
+    unsigned num_available = 0;
+    for (unsigned i = 0; i < preds.size(); i++) {
+        if (!m_domtree.is_reachable(preds[i])) {
+            return;
+        }
+        for (auto op = translated[i].begin(); op != translated[i].end(); op++) {
+            if (op->get_kind() != OPERAND_VREG || m_def_blocks[unsigned(op->get_base_reg())] != bb) {
+                continue;
+            }
+            Instruction *phi = nullptr;
+            for (unsigned j = 0; j < bb->get_length() && SSA::is_phi(bb->get_instruction(j)); j++) {
+                if (bb->get_instruction(j)->get_operand(0) == *op) {
+                    phi = bb->get_instruction(j);
+                }
+            }
+            if (phi == nullptr) {
+                return;
+            }
+            *op = phi->get_operand(i + 1);
+        }
+        if (!get_expression(opcode, translated[i], pred_exprs[i])) {
+            return;
+        }
+        holders[i] = find_available(pred_exprs[i], preds[i], UINT_MAX);
+        if (holders[i] >= 0) {
+            num_available++;
+        }
+    }
+    if (num_available == 0) {
+        return;
+    }
+
+    // compute the expression where it isn't available (where it wasn't
+    // computed before on any path)
+    if (num_available < preds.size()) {
+        if (HighLevel::has_flags(opcode, HOP_MAY_TRAP)) {
+            return;
+        }
+        for (unsigned i = 0; i < preds.size(); i++) {
+            if (holders[i] < 0 && cfg->get_outgoing_edges(preds[i]).size() != 1) {
+                return;
+            }
+        }
+        for (unsigned i = 0; i < preds.size(); i++) {
+            if (holders[i] >= 0) {
+                continue;
+            }
+            int vreg = m_next_vreg++;
+            std::vector<Operand> computed(1, Operand(OPERAND_VREG, vreg));
+            computed.insert(computed.end(), translated[i].begin(), translated[i].end());
+            Instruction *insertion = new Instruction(opcode, computed);
+            insertion->copy_comment(ins);
+            m_appended[preds[i]->get_id()].push_back(insertion);
+            m_holders[pred_exprs[i]].push_back(Holder{ vreg, preds[i], preds[i]->get_length() });
+            holders[i] = vreg;
+            Statistics::get().add("pre.inserted");
+        }
+    }
+
+    std::vector<Operand> phi_operands(1, dest);
+    for (unsigned i = 0; i < preds.size(); i++) {
+        phi_operands.push_back(Operand(OPERAND_VREG, holders[i]));
+    }
+    m_new_phis[bb->get_id()].push_back(new Instruction(HINS_PHI, phi_operands));
+    m_replaced[ins] = nullptr;
+    Statistics::get().add("pre.phis");
+}
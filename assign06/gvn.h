@@ -0,0 +1,114 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include <map>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+
+class DominatorTree;
+
+// Global value numbers of the vregs of a CFG in SSA form.
+//
+// Since each vreg has a single definition, the numbers are valid across
+// blocks: visiting the blocks in reverse postorder, the instructions
+// computing the same pure expression (the same opcode, of operands with
+// the same value numbers) get the same value number, such as the element
+// address of a[i] computed in two blocks, and so do copies and their
+// sources, and constants and their literals.  Every other definition
+// (including each phi function) gets a new value number.
+//
+// Two vregs with the same value number hold the same value wherever both
+// are defined, as long as no definition of either is executed again in
+// between (e.g., in the next iteration of a loop).
+class GlobalValueNumbering {
+private:
+    // the value number of each vreg (-1 if it isn't defined), and a vreg
+    // holding each value number (-1 for a literal held by no vreg)
+    std::vector<int> m_vreg_vn;
+    std::vector<int> m_vn_vreg;
+
+public:
+    GlobalValueNumbering(ControlFlowGraph *cfg);
+    ~GlobalValueNumbering();
+
+    unsigned get_num_values() const { return unsigned(m_vn_vreg.size()); }
+
+    // the value number of a vreg (or -1)
+    int get_value_number(int vreg) const;
+
+    // a vreg holding the value number
+    int get_holder(int vn) const { return m_vn_vreg.at(unsigned(vn)); }
+
+    // do two operands (vregs or literals) hold the same value?
+    bool same_value(const Operand &a, const Operand &b) const;
+};
+
+// Partial redundancy elimination for a high-level CFG in SSA form, using
+// the global value numbers (GVN-PRE).  A pure expression computed in a
+// block is redundant if the same expression (of operands with the same
+// value numbers) is computed earlier in the block or in a block dominating
+// it, and is then replaced by a move.  Otherwise, in a block with several
+// predecessors, such as the join of
+//
+//   then:  muli vr5, vrI, $8              else:  muli vr7, vrI, $8
+//          ...                                   ...
+//   join:  phi vrJ, vr1, vr2
+//          muli vr9, vrI, $8
+//
+// the expression is translated into each predecessor (replacing the
+// operands defined by phis with the phis' operands for it).  If it is
+// available at the end of all of them, the computation is replaced by a phi
+// of the vregs holding it ("phi vr9, vr5, vr7"), and if it is available in
+// only some of them, it is first computed at the end of the others, so that
+// it becomes fully redundant.  Such a computation is only inserted in a
+// predecessor whose only successor is the block (so that it isn't executed
+// on any path where it wasn't before), and never for an expression which
+// may trap.  The later copies of the expression are then redundant.
+class PartialRedundancyElimination : public ControlFlowGraphTransform {
+private:
+    // an expression: its opcode, and for each operand, 0 and a literal
+    // or 1 and a value number
+    typedef std::vector<long> Expression;
+
+    // a vreg holding an expression, and where it's computed
+    struct Holder {
+        int vreg;
+        BasicBlock *bb;
+        unsigned index;
+    };
+
+    DominatorTree *m_own_domtree;
+    const DominatorTree &m_domtree;
+    GlobalValueNumbering m_gvn;
+    int m_next_vreg;
+    // the block defining each vreg (or null)
+    std::vector<BasicBlock *> m_def_blocks;
+    std::map<Expression, std::vector<Holder>> m_holders;
+
+    // edits: new phis at the start of blocks, new instructions at the end
+    // of predecessors (both indexed by block id), and replaced (or
+    // removed) instructions
+    std::vector<std::vector<Instruction *>> m_new_phis;
+    std::vector<std::vector<Instruction *>> m_appended;
+    std::map<Instruction *, Instruction *> m_replaced;
+
+    // disallow copy ctor and assignment operator
+    PartialRedundancyElimination(const PartialRedundancyElimination &);
+    PartialRedundancyElimination &operator=(const PartialRedundancyElimination &);
+
+public:
+    PartialRedundancyElimination(ControlFlowGraph *cfg, const DominatorTree *domtree = nullptr);
+    virtual ~PartialRedundancyElimination();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    bool get_expression(int opcode, const std::vector<Operand> &operands, Expression &expr) const;
+    // a vreg holding an expression before the instruction at index of a
+    // block (or anywhere in it, for index == UINT_MAX), or -1
+    int find_available(const Expression &expr, BasicBlock *bb, unsigned index) const;
+    void eliminate(BasicBlock *bb, unsigned index);
+};
+
+#endif // GVN_H
@@ -1,79 +1,101 @@
 #include <cassert>
+#include <algorithm>
 #include "highlevel.h"
+#include "output.h"
 
 PrintHighLevelInstructionSequence::PrintHighLevelInstructionSequence(InstructionSequence *ins)
         : PrintInstructionSequence(ins) {
 }
 
-std::string PrintHighLevelInstructionSequence::get_opcode_name(int opcode) {
-    switch (opcode) {
-        case HINS_NOP:         return "nop";
-        case HINS_LOAD_ICONST: return "ldci";
-        case HINS_INT_ADD:     return "addi";
-        case HINS_INT_SUB:     return "subi";
-        case HINS_INT_MUL:     return "muli";
-        case HINS_INT_DIV:     return "divi";
-        case HINS_INT_MOD:     return "modi";
-        case HINS_INT_NEGATE:  return "negi";
-        case HINS_LOCALADDR:   return "localaddr";
-        case HINS_LOAD_INT:    return "ldi";
-        case HINS_STORE_INT:   return "sti";
-        case HINS_READ_INT:    return "readi";
-        case HINS_WRITE_INT:   return "writei";
-        case HINS_JUMP:        return "jmp";
-        case HINS_JE:          return "je";
-        case HINS_JNE:         return "jne";
-        case HINS_JLT:         return "jlt";
-        case HINS_JLTE:        return "jlte";
-        case HINS_JGT:         return "jgt";
-        case HINS_JGTE:        return "jgte";
-        case HINS_INT_COMPARE: return "cmpi";
-        case HINS_LEA:         return "lea";
-        case HINS_MOV:         return "mov";
-
-        default:
-            assert(false);
-            return "<invalid>";
-    }
+const HighLevelOpcodeInfo HighLevel::s_opcode_info[] = {
+    { "nop",       0,                                                          0 },
+    { "ldci",      HOP_DEF,                                                    0 },
+    { "addi",      HOP_DEF,                                                    0 },
+    { "subi",      HOP_DEF,                                                    0 },
+    { "muli",      HOP_DEF,                                                    0 },
+    { "divi",      HOP_DEF | HOP_MAY_TRAP,                                     0 },
+    { "modi",      HOP_DEF | HOP_MAY_TRAP,                                     0 },
+    { "negi",      HOP_DEF,                                                    0 },
+    { "divu",      HOP_DEF | HOP_MAY_TRAP,                                     0 },
+    { "modu",      HOP_DEF | HOP_MAY_TRAP,                                     0 },
+    { "localaddr", HOP_DEF,                                                    0 },
+    { "ldi",       HOP_DEF | HOP_LOAD,                                         0 },
+    { "sti",       HOP_STORE,                                                  0 },
+    { "ldc",       HOP_DEF | HOP_LOAD,                                         0 },
+    { "stc",       HOP_STORE,                                                  0 },
+    { "readi",     HOP_DEF | HOP_CALL | HOP_SIDE_EFFECT,                       0 },
+    { "writei",    HOP_CALL | HOP_SIDE_EFFECT,                                 0 },
+    { "writeia",   HOP_LOAD | HOP_CALL | HOP_SIDE_EFFECT,                      0 },
+    { "readia",    HOP_STORE | HOP_CALL | HOP_SIDE_EFFECT,                     0 },
+    { "filli",     HOP_STORE | HOP_CALL,                                       0 },
+    { "copyi",     HOP_LOAD | HOP_STORE | HOP_CALL,                            0 },
+    { "jmp",       HOP_JUMP,                                                   0 },
+    { "je",        HOP_BRANCH,                                                 0 },
+    { "jne",       HOP_BRANCH,                                                 0 },
+    { "jlt",       HOP_BRANCH,                                                 0 },
+    { "jlte",      HOP_BRANCH,                                                 0 },
+    { "jgt",       HOP_BRANCH,                                                 0 },
+    { "jgte",      HOP_BRANCH,                                                 0 },
+    { "cmpi",      0,                                                          0 },
+    { "cmove",     HOP_DEF,                                                    0 },
+    { "cmovne",    HOP_DEF,                                                    0 },
+    { "cmovlt",    HOP_DEF,                                                    0 },
+    { "cmovlte",   HOP_DEF,                                                    0 },
+    { "cmovgt",    HOP_DEF,                                                    0 },
+    { "cmovgte",   HOP_DEF,                                                    0 },
+    { "lea",       HOP_DEF,                                                    0 },
+    { "mov",       HOP_DEF,                                                    0 },
+    { "phi",       HOP_DEF,                                                    0 },
+    { "vldi",      HOP_DEF | HOP_LOAD,                                         1 << 0 },
+    { "vsti",      HOP_STORE,                                                  1 << 1 },
+    { "vaddi",     HOP_DEF,                                                    7 },
+    { "vsubi",     HOP_DEF,                                                    7 },
+    { "vdupi",     HOP_DEF,                                                    1 << 0 },
+    { "profcount", HOP_SIDE_EFFECT,                                            0 },
+    { "prefetch",  0,                                                          0 },
+    { "chkb",      HOP_SIDE_EFFECT,                                            0 },
+    { "cold",      HOP_SIDE_EFFECT,                                            0 },
+    { "param",     HOP_DEF,                                                    0 },
+    { "call",      HOP_DEF | HOP_LOAD | HOP_STORE | HOP_CALL | HOP_SUBPROGRAM | HOP_SIDE_EFFECT, 0 },
+    { "callp",     HOP_LOAD | HOP_STORE | HOP_CALL | HOP_SUBPROGRAM | HOP_SIDE_EFFECT,           0 },
+    { "ret",       HOP_SIDE_EFFECT,                                            0 },
+};
+
+static_assert(sizeof(HighLevel::s_opcode_info) / sizeof(HighLevelOpcodeInfo) == HINS_RETURN + 1,
+              "every high-level opcode needs an entry in the table");
+
+const char *PrintHighLevelInstructionSequence::get_opcode_name(int opcode) {
+    return HighLevel::get_opcode_info(opcode).name;
 }
 
-bool HighLevel::is_def(Instruction *ins) {
-    int opcode = ins->get_opcode();
-    switch(opcode) {
-        case HINS_LOAD_ICONST:  return true;
-        case HINS_INT_ADD:      return true;
-        case HINS_INT_SUB:      return true;
-        case HINS_INT_MUL:      return true;
-        case HINS_INT_DIV:      return true;
-        case HINS_INT_MOD:      return true;
-        case HINS_INT_NEGATE:   return true;
-        case HINS_LOCALADDR:    return true;
-        case HINS_LOAD_INT:     return true;
-        case HINS_READ_INT:     return true;
-        default:                return false;
+int HighLevel::get_inverted_branch(int opcode) {
+    switch (opcode) {
+        case HINS_JE:   return HINS_JNE;
+        case HINS_JNE:  return HINS_JE;
+        case HINS_JLT:  return HINS_JGTE;
+        case HINS_JLTE: return HINS_JGT;
+        case HINS_JGT:  return HINS_JLTE;
+        case HINS_JGTE: return HINS_JLT;
+        default:        return -1;
     }
 }
 
-bool HighLevel::is_use(Instruction *ins, unsigned i) {
-    int opcode = ins->get_opcode();
-
-    Operand op = ins->get_operand(i);
-    bool op_is_vreg = op.has_base_reg();
-
-    switch(opcode) {
-        // TODO:
-    }
-
-    if (op_is_vreg) {
-        return true;
+int HighLevel::get_conditional_move(int branch_opcode) {
+    switch (branch_opcode) {
+        case HINS_JE:   return HINS_CMOVE;
+        case HINS_JNE:  return HINS_CMOVNE;
+        case HINS_JLT:  return HINS_CMOVLT;
+        case HINS_JLTE: return HINS_CMOVLTE;
+        case HINS_JGT:  return HINS_CMOVGT;
+        case HINS_JGTE: return HINS_CMOVGTE;
+        default:        return -1;
     }
-
-    return false;
 }
 
 int HighLevel::get_num_vregs(InstructionSequence *hins) {
-    // map unique vregs
-    std::map<long, Operand> vregs;
+    // the number of vregs is one more than the highest vreg number used,
+    // so that every vreg number can be used as an index
+    int num_vregs = 0;
 
     const long num_ins = hins->get_length();
     for (int i = 0; i < num_ins; i++) {
@@ -82,16 +104,23 @@ int HighLevel::get_num_vregs(InstructionSequence *hins) {
         for (int j = 0; j < num_operands; j++) {
             Operand operand = hin->get_operand(j);
             if (operand.get_kind() == OPERAND_VREG || operand.get_kind() == OPERAND_VREG_MEMREF) {
-                int base_reg = operand.get_base_reg();
-                vregs[base_reg] = operand;
+                num_vregs = std::max(num_vregs, operand.get_base_reg() + 1);
             }
         }
     }
 
-    return vregs.size();
+    return num_vregs;
 }
 
-std::string PrintHighLevelInstructionSequence::get_mreg_name(int regnum) {
+int HighLevel::get_num_vregs(ControlFlowGraph *cfg) {
+    int num_vregs = 0;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        num_vregs = std::max(num_vregs, get_num_vregs(*i));
+    }
+    return num_vregs;
+}
+
+const char *PrintHighLevelInstructionSequence::get_mreg_name(int regnum) {
     // high level instructions should not use machine registers
     assert(false);
     return "<invalid>";
@@ -104,9 +133,18 @@ HighLevelControlFlowGraphBuilder::HighLevelControlFlowGraphBuilder(InstructionSe
 HighLevelControlFlowGraphBuilder::~HighLevelControlFlowGraphBuilder() {
 }
 
+bool HighLevelControlFlowGraphBuilder::is_branch(Instruction *ins) {
+    // (a call of a procedure without arguments has a single label operand)
+    return !HighLevel::is_subprogram_call(ins) && ControlFlowGraphBuilder::is_branch(ins);
+}
+
 bool HighLevelControlFlowGraphBuilder::falls_through(Instruction *ins) {
     // only unconditional jump instructions don't fall through
-    return ins->get_opcode() != HINS_JUMP;
+    return !HighLevel::has_flags(ins->get_opcode(), HOP_JUMP);
+}
+
+bool HighLevelControlFlowGraphBuilder::ends_function(Instruction *ins) {
+    return ins->get_opcode() == HINS_COLD;
 }
 
 HighLevelControlFlowGraphPrinter::HighLevelControlFlowGraphPrinter(ControlFlowGraph *cfg)
@@ -116,16 +154,16 @@ HighLevelControlFlowGraphPrinter::HighLevelControlFlowGraphPrinter(ControlFlowGr
 HighLevelControlFlowGraphPrinter::~HighLevelControlFlowGraphPrinter() {
 }
 
-void HighLevelControlFlowGraphPrinter::print_basic_block(BasicBlock *bb) {
+void HighLevelControlFlowGraphPrinter::print_basic_block(OutputSink &out, BasicBlock *bb) {
     for (auto i = bb->cbegin(); i != bb->cend(); i++) {
-        Instruction *ins = *i;
-        std::string s = format_instruction(bb, ins);
-        printf("\t%s\n", s.c_str());
+        out.put('\t');
+        format_instruction(out, bb, *i);
+        out.put('\n');
     }
 }
 
-std::string HighLevelControlFlowGraphPrinter::format_instruction(BasicBlock *bb,
-                                                                 Instruction *ins) {
+void HighLevelControlFlowGraphPrinter::format_instruction(OutputSink &out, BasicBlock *bb,
+                                                          Instruction *ins) {
     PrintHighLevelInstructionSequence p(bb);
-    return p.format_instruction(ins);
+    p.format_instruction(out, ins);
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef HIGHLEVEL_H
 #define HIGHLEVEL_H
 
+#include <cassert>
 #include "cfg.h"
 
 // "High-level" opcodes
@@ -13,11 +14,29 @@ enum HighLevelOpcode {
     HINS_INT_DIV,
     HINS_INT_MOD,
     HINS_INT_NEGATE,
+    // unsigned division and remainder (only emitted by
+    // ValueRangeSimplification, see value_range.h)
+    HINS_UINT_DIV,
+    HINS_UINT_MOD,
     HINS_LOCALADDR,
     HINS_LOAD_INT,
     HINS_STORE_INT,
+    HINS_LOAD_CHAR,     // (zero-extended from a single byte)
+    HINS_STORE_CHAR,    // (truncated to a single byte)
     HINS_READ_INT,
     HINS_WRITE_INT,
+    // "writeia vrA, n" writes the n integers at vrA, and "readia vrA, n"
+    // reads n integers into them, for n > 0 (only emitted when using the
+    // runtime library, runtime.c, for a loop writing or reading a range of
+    // the elements of an array)
+    HINS_WRITE_INT_ARRAY,
+    HINS_READ_INT_ARRAY,
+    // "filli vrD, v, n" stores v to the n integers at vrD, and "copyi vrD,
+    // vrS, n" copies the n integers at vrS (which are the same integers,
+    // or don't overlap them) to vrD, for n > 0 (emitted for an array or
+    // record assigned as a whole, and by LoopIdiomRecognition)
+    HINS_FILL_INT,
+    HINS_COPY_INT,
     HINS_JUMP,
     HINS_JE,
     HINS_JNE,
@@ -26,23 +45,119 @@ enum HighLevelOpcode {
     HINS_JGT,
     HINS_JGTE,
     HINS_INT_COMPARE,
+    // conditional moves: "cmovlt vrD, a, b" sets vrD to a if the last
+    // cmpi's first operand was less than its second, and to b otherwise
+    // (only emitted by IfConversion, see if_conversion.h, each one right
+    // after the cmpi or another conditional move)
+    HINS_CMOVE,
+    HINS_CMOVNE,
+    HINS_CMOVLT,
+    HINS_CMOVLTE,
+    HINS_CMOVGT,
+    HINS_CMOVGTE,
     HINS_LEA,
-    HINS_MOV
+    HINS_MOV,
+    HINS_PHI,    // only present in SSA form (see ssa.h)
+    // vector instructions, operating on pairs of adjacent integers
+    // (only emitted by LoopVectorization, see vectorize.h)
+    HINS_VEC_LOAD,
+    HINS_VEC_STORE,
+    HINS_VEC_ADD,
+    HINS_VEC_SUB,
+    HINS_VEC_DUP,   // both elements of the destination are the scalar operand
+    // increment the execution counter of a basic block (only emitted
+    // with -fprofile-generate, see profile.h)
+    HINS_PROFILE_COUNT,
+    // "prefetch n(vrA)" fetches the cache line at vrA + n into the caches,
+    // as a hint which can't fault (only emitted by LoopPrefetching, see
+    // prefetch.h)
+    HINS_PREFETCH,
+    // "chkb i, $n" traps unless 0 <= i < n, for the index i of an element
+    // of an array of n elements (only emitted with -fbounds-check, and
+    // removed or hoisted out of loops by BoundsCheckElimination, see
+    // bounds_check.h)
+    HINS_BOUNDS_CHECK,
+    // "cold" ends the function's hot code (as if it fell off the end): the
+    // code after it was never executed according to the profile, and is
+    // placed after the epilogue, in .text.unlikely (only emitted by
+    // ControlFlowGraph::create_instruction_sequence, when splitting the
+    // cold code)
+    HINS_COLD,
+    // subprograms: "param vrD, $i" sets vrD to the i-th argument (the
+    // parameters are set at the start of a subprogram), "call vrD, f,
+    // args..." calls the function f, setting vrD to its result, "callp p,
+    // args..." calls the procedure p, and "ret v" sets the result of a
+    // function (at its end)
+    HINS_PARAM,
+    HINS_CALL,
+    HINS_CALL_PROC,
+    HINS_RETURN,
+};
+
+// properties of the high-level opcodes (see HighLevelOpcodeInfo)
+enum HighLevelOpcodeFlags {
+    HOP_DEF         = 1 << 0,   // defines operand 0 (or stores to it, if it's a memory reference)
+    HOP_LOAD        = 1 << 1,   // reads memory (other than through memory reference operands)
+    HOP_STORE       = 1 << 2,   // writes memory (other than through memory reference operands)
+    HOP_CALL        = 1 << 3,   // lowered to a call, which clobbers the caller-saved registers
+    HOP_SUBPROGRAM  = 1 << 4,   // calls one of the program's subprograms
+    HOP_SIDE_EFFECT = 1 << 5,   // has an effect besides its defs and stores (input, output, ...)
+    HOP_MAY_TRAP    = 1 << 6,   // traps if its last operand is zero
+    HOP_JUMP        = 1 << 7,   // an unconditional branch
+    HOP_BRANCH      = 1 << 8,   // a conditional branch
+};
+
+struct HighLevelOpcodeInfo {
+    const char *name;
+    unsigned flags;             // HighLevelOpcodeFlags
+    unsigned vector_operands;   // mask of the operands which are vectors
 };
 
 class HighLevel {
 public:
-    static bool is_def(Instruction *ins);
-    static bool is_use(Instruction *ins, unsigned i);
+    // the properties of each opcode (indexed by opcode)
+    static const HighLevelOpcodeInfo s_opcode_info[];
+
+    static const HighLevelOpcodeInfo &get_opcode_info(int opcode) {
+        assert(opcode >= HINS_NOP && opcode <= HINS_RETURN);
+        return s_opcode_info[opcode];
+    }
+    static bool has_flags(int opcode, unsigned flags) {
+        return (get_opcode_info(opcode).flags & flags) != 0;
+    }
+
+    static bool is_def(Instruction *ins) { return has_flags(ins->get_opcode(), HOP_DEF); }
+    static bool is_use(Instruction *ins, unsigned i) {
+        // the destination of a def is not a use (but a memory reference
+        // uses the vreg containing the address)
+        const Operand &op = ins->get_operand(i);
+        return op.has_base_reg() && (i != 0 || !is_def(ins) || op.is_memref());
+    }
+    static bool is_call(Instruction *ins) { return has_flags(ins->get_opcode(), HOP_CALL); }
+    // is an instruction a call to one of the program's subprograms?
+    // (which may store to the program's variables)
+    static bool is_subprogram_call(Instruction *ins) { return has_flags(ins->get_opcode(), HOP_SUBPROGRAM); }
+    // is operand i of an instruction a vector (held in an SSE register,
+    // rather than in a machine register or stack slot)?
+    static bool is_vector(Instruction *ins, unsigned i) {
+        return ((get_opcode_info(ins->get_opcode()).vector_operands >> i) & 1) != 0;
+    }
+    // get the conditional branch opcode with the opposite condition,
+    // or -1 if the opcode isn't a conditional branch
+    static int get_inverted_branch(int opcode);
+    // get the conditional move opcode with a conditional branch's
+    // condition, or -1 if the opcode isn't a conditional branch
+    static int get_conditional_move(int branch_opcode);
     static int get_num_vregs(InstructionSequence *hins);
+    static int get_num_vregs(ControlFlowGraph *cfg);
 };
 
 class PrintHighLevelInstructionSequence : public PrintInstructionSequence {
 public:
     PrintHighLevelInstructionSequence(InstructionSequence *ins);
 
-    virtual std::string get_opcode_name(int opcode);
-    virtual std::string get_mreg_name(int regnum);
+    virtual const char *get_opcode_name(int opcode);
+    virtual const char *get_mreg_name(int regnum);
 };
 
 class HighLevelControlFlowGraphBuilder : public ControlFlowGraphBuilder {
@@ -50,7 +165,9 @@ public:
     HighLevelControlFlowGraphBuilder(InstructionSequence *iseq);
     virtual ~HighLevelControlFlowGraphBuilder();
 
+    virtual bool is_branch(Instruction *ins);
     virtual bool falls_through(Instruction *ins);
+    virtual bool ends_function(Instruction *ins);
 };
 
 class HighLevelControlFlowGraphPrinter : public ControlFlowGraphPrinter {
@@ -58,8 +175,8 @@ public:
     HighLevelControlFlowGraphPrinter(ControlFlowGraph *cfg);
     ~HighLevelControlFlowGraphPrinter();
 
-    virtual void print_basic_block(BasicBlock *bb);
-    virtual std::string format_instruction(BasicBlock *bb, Instruction *ins);
+    virtual void print_basic_block(OutputSink &out, BasicBlock *bb);
+    virtual void format_instruction(OutputSink &out, BasicBlock *bb, Instruction *ins);
 };
 
 #endif // HIGHLEVEL_H
\ No newline at end of file
@@ -0,0 +1,395 @@
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "util.h"
+#include "storage_layout.h"
+#include "highlevel_io.h"
+
+namespace {
+    const char MAGIC[] = { 'H', 'I', 'R', 3 };
+
+    // the kinds of operands, by the low bits of their values (which
+    // are written in the low 4 bits of an operand's first byte)
+    const OperandKind OPERAND_KINDS[] = {
+        OPERAND_NONE, OPERAND_NONE, OPERAND_VREG, OPERAND_MREG, OPERAND_VREG_MEMREF,
+        OPERAND_VREG_MEMREF_OFFSET, OPERAND_VREG_MEMREF_INDEX, OPERAND_MREG_MEMREF,
+        OPERAND_MREG_MEMREF_OFFSET, OPERAND_MREG_MEMREF_INDEX, OPERAND_MREG_MEMREF_OFFSET_INDEX,
+        OPERAND_INT_LITERAL, OPERAND_LABEL, OPERAND_LABEL_IMMEDIATE, OPERAND_LABEL_MEMREF,
+        OPERAND_LOCAL_MEMREF,
+    };
+    const unsigned NUM_OPERAND_KINDS = sizeof(OPERAND_KINDS) / sizeof(OPERAND_KINDS[0]);
+
+    // the flags in the high bits of an operand's first byte
+    const unsigned SCALE_SHIFT = 4;        // (log2 of the scale, in 2 bits)
+    const unsigned IS_SCALAR = 1 << 6;
+    const unsigned MAPS_MREG = 1 << 7;
+
+    unsigned get_scale_log2(int scale) {
+        return (scale == 8) ? 3 : (scale == 4) ? 2 : (scale == 2) ? 1 : 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// HighLevelWriter implementation
+////////////////////////////////////////////////////////////////////////
+
+HighLevelWriter::HighLevelWriter() {
+}
+
+HighLevelWriter::~HighLevelWriter() {
+}
+
+void HighLevelWriter::write_unsigned(unsigned long value) {
+    while (value >= 0x80) {
+        m_records.push_back((unsigned char) (value | 0x80));
+        value >>= 7;
+    }
+    m_records.push_back((unsigned char) value);
+}
+
+void HighLevelWriter::write_signed(long value) {
+    write_unsigned((static_cast<unsigned long>(value) << 1) ^ static_cast<unsigned long>(value >> 63));
+}
+
+void HighLevelWriter::write_string(const std::string &s) {
+    auto i = m_string_index.find(s);
+    if (i == m_string_index.end()) {
+        i = m_string_index.insert(std::make_pair(s, unsigned(m_strings.size()))).first;
+        m_strings.push_back(s);
+    }
+    write_unsigned(i->second);
+}
+
+void HighLevelWriter::write_operand(const Operand &op) {
+    Operand copy(op);
+    OperandKind kind = op.get_kind();
+    unsigned flags = (kind & 0xffff) | (get_scale_log2(op.get_scale()) << SCALE_SHIFT);
+    if (copy.get_is_scalar()) {
+        flags |= IS_SCALAR;
+    }
+    if (copy.get_does_map_mreg()) {
+        flags |= MAPS_MREG;
+    }
+    m_records.push_back((unsigned char) flags);
+
+    if (op.has_base_reg()) {
+        write_unsigned(unsigned(op.get_base_reg()));
+    }
+    if (op.has_index_reg()) {
+        write_unsigned(unsigned(op.get_index_reg()));
+    }
+    if (kind == OPERAND_INT_LITERAL) {
+        write_signed(op.get_int_value());
+    } else if ((kind & OPROP_HAS_INTVAL) != 0) {
+        write_signed(op.get_offset());
+    }
+    if ((kind & OPROP_HAS_LABEL) != 0) {
+        write_string(op.get_target_label());
+    }
+}
+
+void HighLevelWriter::write_instruction(const Instruction *ins) {
+    write_unsigned(unsigned(ins->get_opcode()));
+    write_unsigned(ins->get_num_operands());
+    for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+        write_operand(ins->get_operand(i));
+    }
+    write_string(ins->has_comment() ? ins->get_comment() : "");
+}
+
+void HighLevelWriter::write_iseq(const InstructionSequence *iseq) {
+    unsigned length = iseq->get_length();
+    write_unsigned(length);
+    for (unsigned i = 0; i < length; i++) {
+        write_string(iseq->has_label(i) ? iseq->get_label(i) : "");
+        write_instruction(iseq->get_instruction(i));
+    }
+    write_string(iseq->has_label_at_end() ? iseq->get_label_at_end() : "");
+}
+
+void HighLevelWriter::write_cfg(const ControlFlowGraph *cfg) {
+    write_unsigned(cfg->get_num_blocks());
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        write_unsigned(unsigned(bb->get_kind()));
+        write_string(bb->get_label());
+        write_signed(bb->get_count());
+        write_unsigned(bb->get_length());
+        for (unsigned j = 0; j < bb->get_length(); j++) {
+            write_instruction(bb->get_instruction(j));
+        }
+    }
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(*i);
+        write_unsigned(outgoing.size());
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            write_unsigned((*j)->get_target()->get_id());
+            write_unsigned(unsigned((*j)->get_kind()));
+        }
+    }
+}
+
+void HighLevelWriter::write_layout(const StorageLayout *layout) {
+    const std::map<long, StorageLayout::Variable> &variables = layout->get_variables();
+    write_unsigned(variables.size());
+    for (auto i = variables.begin(); i != variables.end(); i++) {
+        write_signed(i->first);
+        write_string(i->second.name);
+        write_signed(i->second.size);
+        write_unsigned((i->second.is_static ? 1 : 0) | (i->second.is_local ? 2 : 0));
+    }
+}
+
+std::string HighLevelWriter::get_data() const {
+    // (the string table is written before the records using it)
+    HighLevelWriter header;
+    header.m_records.assign(MAGIC, MAGIC + sizeof(MAGIC));
+    header.write_unsigned(m_strings.size());
+    for (auto i = m_strings.begin(); i != m_strings.end(); i++) {
+        header.write_unsigned(i->size());
+        header.m_records.insert(header.m_records.end(), i->begin(), i->end());
+    }
+
+    std::string data(header.m_records.begin(), header.m_records.end());
+    data.append(m_records.begin(), m_records.end());
+    return data;
+}
+
+void HighLevelWriter::save(const std::string &filename) const {
+    std::string data = get_data();
+    FILE *f = fopen(filename.c_str(), "wb");
+    if (f == nullptr) {
+        err_fatal("Could not open output file \"%s\"\n", filename.c_str());
+    }
+    if (fwrite(data.data(), 1, data.size(), f) != data.size() || fclose(f) != 0) {
+        err_fatal("Could not write output file \"%s\"\n", filename.c_str());
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// HighLevelReader implementation
+////////////////////////////////////////////////////////////////////////
+
+HighLevelReader::HighLevelReader(const std::string &filename)
+        : m_filename(filename)
+        , m_data(nullptr)
+        , m_size(0)
+        , m_pos(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        err_fatal("Could not open HIR file \"%s\"\n", filename.c_str());
+    }
+    m_size = size_t(st.st_size);
+    if (m_size < sizeof(MAGIC)) {
+        fail();
+    }
+    void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        err_fatal("Could not map HIR file \"%s\"\n", filename.c_str());
+    }
+    m_data = static_cast<const unsigned char *>(data);
+    if (memcmp(m_data, MAGIC, sizeof(MAGIC)) != 0) {
+        fail();
+    }
+    m_pos = sizeof(MAGIC);
+
+    unsigned long num_strings = read_unsigned();
+    for (unsigned long i = 0; i < num_strings; i++) {
+        unsigned long length = read_unsigned();
+        if (length > m_size - m_pos) {
+            fail();
+        }
+        m_strings.push_back(std::make_pair(reinterpret_cast<const char *>(m_data + m_pos), size_t(length)));
+        m_pos += length;
+    }
+}
+
+HighLevelReader::~HighLevelReader() {
+    if (m_data != nullptr) {
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+    }
+}
+
+unsigned char HighLevelReader::read_byte() {
+    if (m_pos >= m_size) {
+        fail();
+    }
+    return m_data[m_pos++];
+}
+
+unsigned long HighLevelReader::read_unsigned() {
+    unsigned long value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        unsigned char b = read_byte();
+        value |= static_cast<unsigned long>(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return value;
+        }
+    }
+    fail();
+    return 0;
+}
+
+long HighLevelReader::read_signed() {
+    unsigned long value = read_unsigned();
+    return static_cast<long>(value >> 1) ^ -static_cast<long>(value & 1);
+}
+
+std::string HighLevelReader::read_string() {
+    unsigned long index = read_unsigned();
+    if (index >= m_strings.size()) {
+        fail();
+    }
+    return std::string(m_strings[index].first, m_strings[index].second);
+}
+
+Operand HighLevelReader::read_operand() {
+    unsigned flags = read_byte();
+    unsigned code = flags & 0xf;
+    if (code == 0 || code >= NUM_OPERAND_KINDS) {
+        fail();
+    }
+    OperandKind kind = OPERAND_KINDS[code];
+    int basereg = 0, indexreg = 0;
+    long ival = 0;
+    std::string label;
+    if ((kind & OPROP_HAS_BASEREG) != 0) {
+        basereg = int(read_unsigned());
+    }
+    if ((kind & OPROP_HAS_INDEXREG) != 0) {
+        indexreg = int(read_unsigned());
+    }
+    if ((kind & OPROP_HAS_INTVAL) != 0) {
+        ival = read_signed();
+    }
+    if ((kind & OPROP_HAS_LABEL) != 0) {
+        label = read_string();
+    }
+
+    Operand op;
+    switch (kind) {
+    case OPERAND_NONE:
+        break;
+    case OPERAND_VREG:
+    case OPERAND_MREG:
+    case OPERAND_VREG_MEMREF:
+    case OPERAND_MREG_MEMREF:
+        op = Operand(kind, long(basereg));
+        break;
+    case OPERAND_INT_LITERAL:
+    case OPERAND_LOCAL_MEMREF:
+        op = Operand(kind, ival);
+        break;
+    case OPERAND_VREG_MEMREF_OFFSET:
+    case OPERAND_MREG_MEMREF_OFFSET:
+        op = Operand(kind, basereg, int(ival));
+        break;
+    case OPERAND_VREG_MEMREF_INDEX:
+    case OPERAND_MREG_MEMREF_INDEX:
+        op = Operand(kind, basereg, indexreg);
+        break;
+    case OPERAND_MREG_MEMREF_OFFSET_INDEX:
+        op = Operand(kind, basereg, indexreg, int(ival), 1 << ((flags >> SCALE_SHIFT) & 3));
+        break;
+    default:
+        op = Operand(kind, label);
+        break;
+    }
+    op.set_is_scalar((flags & IS_SCALAR) != 0);
+    op.set_does_map_mreg((flags & MAPS_MREG) != 0);
+    return op;
+}
+
+Instruction *HighLevelReader::read_instruction() {
+    int opcode = int(read_unsigned());
+    unsigned long num_operands = read_unsigned();
+    if (num_operands > m_size - m_pos) {
+        fail();
+    }
+    std::vector<Operand> operands;
+    for (unsigned long i = 0; i < num_operands; i++) {
+        operands.push_back(read_operand());
+    }
+    Instruction *ins = new Instruction(opcode, operands);
+    std::string comment = read_string();
+    if (!comment.empty()) {
+        ins->set_comment(comment);
+    }
+    return ins;
+}
+
+InstructionSequence *HighLevelReader::read_iseq() {
+    InstructionSequence *iseq = new InstructionSequence();
+    unsigned long length = read_unsigned();
+    for (unsigned long i = 0; i < length; i++) {
+        std::string label = read_string();
+        if (!label.empty()) {
+            iseq->define_label(label);
+        }
+        iseq->add_instruction(read_instruction());
+    }
+    std::string label = read_string();
+    if (!label.empty()) {
+        iseq->define_label(label);
+    }
+    return iseq;
+}
+
+ControlFlowGraph *HighLevelReader::read_cfg() {
+    ControlFlowGraph *cfg = new ControlFlowGraph();
+    unsigned long num_blocks = read_unsigned();
+    for (unsigned long i = 0; i < num_blocks; i++) {
+        unsigned long kind = read_unsigned();
+        if (kind > BASICBLOCK_INTERIOR
+            || (kind == BASICBLOCK_ENTRY && cfg->get_entry_block() != nullptr)
+            || (kind == BASICBLOCK_EXIT && cfg->get_exit_block() != nullptr)) {
+            fail();
+        }
+        BasicBlock *bb = cfg->create_basic_block(BasicBlockKind(kind), read_string());
+        bb->set_count(read_signed());
+        unsigned long length = read_unsigned();
+        for (unsigned long j = 0; j < length; j++) {
+            bb->add_instruction(read_instruction());
+        }
+    }
+    if (cfg->get_entry_block() == nullptr || cfg->get_exit_block() == nullptr) {
+        fail();
+    }
+    for (unsigned long i = 0; i < num_blocks; i++) {
+        unsigned long num_edges = read_unsigned();
+        for (unsigned long j = 0; j < num_edges; j++) {
+            unsigned long target = read_unsigned();
+            unsigned long kind = read_unsigned();
+            if (target >= num_blocks || kind > EDGE_BRANCH) {
+                fail();
+            }
+            cfg->create_edge(cfg->get_block(unsigned(i)), cfg->get_block(unsigned(target)), EdgeKind(kind));
+        }
+    }
+    return cfg;
+}
+
+StorageLayout *HighLevelReader::read_layout() {
+    StorageLayout *layout = new StorageLayout();
+    unsigned long num_variables = read_unsigned();
+    for (unsigned long i = 0; i < num_variables; i++) {
+        long offset = read_signed();
+        StorageLayout::Variable variable;
+        variable.name = read_string();
+        variable.size = read_signed();
+        unsigned long flags = read_unsigned();
+        variable.is_static = (flags & 1) != 0;
+        variable.is_local = (flags & 2) != 0;
+        layout->add_variable(offset, variable);
+    }
+    return layout;
+}
+
+void HighLevelReader::fail() const {
+    err_fatal("Invalid HIR file \"%s\"\n", m_filename.c_str());
+}
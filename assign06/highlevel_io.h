@@ -0,0 +1,93 @@
+#ifndef HIGHLEVEL_IO_H
+#define HIGHLEVEL_IO_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "cfg.h"
+
+class StorageLayout;
+
+// A compact binary format for high-level code: instruction sequences, CFGs
+// and the storage layouts of functions, so that the front end and the back
+// end of the compiler can run separately (see the -emit-hir and -load-hir
+// options), and compiled code can be saved.
+//
+// A file is the magic number "HIR" and a version byte, followed by a table
+// of the strings used by the code (labels, comments, and the names of
+// functions and variables), each written once, and then the records written
+// by the HighLevelWriter, which refer to the strings by number.  Integers
+// (opcodes, register numbers, offsets, ...) are written as LEB128 varints
+// (signed ones zigzag-encoded first), so most take a single byte: an operand
+// is its kind and flags in one byte, followed by only the fields its kind
+// has.  A file is read from a read-only mapping of it, without copying it.
+class HighLevelWriter {
+private:
+    std::vector<unsigned char> m_records;
+    std::vector<std::string> m_strings;
+    std::unordered_map<std::string, unsigned> m_string_index;
+
+public:
+    HighLevelWriter();
+    ~HighLevelWriter();
+
+    void write_unsigned(unsigned long value);
+    void write_signed(long value);
+    void write_string(const std::string &s);
+
+    void write_operand(const Operand &op);
+    void write_instruction(const Instruction *ins);
+    // (with its labels)
+    void write_iseq(const InstructionSequence *iseq);
+    // (with its blocks' labels and profile counts)
+    void write_cfg(const ControlFlowGraph *cfg);
+    // (the variables, not their placement)
+    void write_layout(const StorageLayout *layout);
+
+    // the contents of the file
+    std::string get_data() const;
+    // write the file (a fatal error if it can't be written)
+    void save(const std::string &filename) const;
+};
+
+class HighLevelReader {
+private:
+    std::string m_filename;
+    const unsigned char *m_data;
+    size_t m_size;
+    size_t m_pos;
+    // the strings in the table, in place in the file
+    std::vector<std::pair<const char *, size_t>> m_strings;
+
+    // disallow copy ctor and assignment operator
+    HighLevelReader(const HighLevelReader &);
+    HighLevelReader &operator=(const HighLevelReader &);
+
+public:
+    // map the file, and read its string table (a fatal error if the file
+    // can't be read or isn't a HIR file)
+    HighLevelReader(const std::string &filename);
+    ~HighLevelReader();
+
+    // have all of the records been read?
+    bool at_end() const { return m_pos == m_size; }
+
+    // these read the records written by the corresponding functions of
+    // HighLevelWriter (a fatal error if the file is malformed)
+    unsigned long read_unsigned();
+    long read_signed();
+    std::string read_string();
+
+    Operand read_operand();
+    Instruction *read_instruction();
+    InstructionSequence *read_iseq();
+    ControlFlowGraph *read_cfg();
+    StorageLayout *read_layout();
+
+private:
+    unsigned char read_byte();
+    void fail() const;
+};
+
+#endif // HIGHLEVEL_IO_H
@@ -0,0 +1,359 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "ssa.h"
+#include "dependence.h"
+#include "stats.h"
+#include "if_conversion.h"
+
+IfConversion::IfConversion(ControlFlowGraph *cfg)
+        : m_cfg(cfg) {
+    unsigned num_blocks = cfg->get_num_blocks();
+    m_conversions.assign(num_blocks, nullptr);
+    m_removed.assign(num_blocks, false);
+
+    for (unsigned i = 0; i < num_blocks; i++) {
+        // (the arms and join blocks of earlier conversions are left alone)
+        if (!m_removed[i]) {
+            m_conversions[i] = convert(cfg->get_block(i));
+        }
+    }
+}
+
+IfConversion::~IfConversion() {
+    for (auto i = m_conversions.begin(); i != m_conversions.end(); i++) {
+        if (*i != nullptr) {
+            for (auto j = (*i)->code.begin(); j != (*i)->code.end(); j++) {
+                delete *j;
+            }
+            delete *i;
+        }
+    }
+}
+
+ControlFlowGraph *IfConversion::transform_cfg() {
+    ControlFlowGraph *result = new ControlFlowGraph();
+    unsigned num_blocks = m_cfg->get_num_blocks();
+
+    // create the blocks
+    std::vector<BasicBlock *> block_map(num_blocks, nullptr);
+    for (unsigned i = 0; i < num_blocks; i++) {
+        if (m_removed[i]) {
+            continue;
+        }
+        BasicBlock *orig = m_cfg->get_block(i);
+        block_map[i] = result->create_basic_block(orig->get_kind(), orig->get_label());
+        block_map[i]->set_count(orig->get_count());
+    }
+
+    // the block which each block's outgoing edges come from in the result
+    // (a converted block has the edges of the last join block merged into it)
+    std::vector<unsigned> source_of(num_blocks);
+    for (unsigned i = 0; i < num_blocks; i++) {
+        source_of[i] = i;
+    }
+    for (unsigned i = 0; i < num_blocks; i++) {
+        if (m_conversions[i] != nullptr) {
+            source_of[m_conversions[i]->last_join] = i;
+        }
+    }
+
+    // add the instructions and edges
+    for (unsigned i = 0; i < num_blocks; i++) {
+        BasicBlock *result_bb = block_map[i];
+        if (result_bb == nullptr) {
+            continue;
+        }
+        BasicBlock *orig = m_cfg->get_block(i);
+        std::vector<unsigned> phi_order = get_phi_order(orig, source_of);
+        Conversion *conversion = m_conversions[i];
+        if (conversion == nullptr) {
+            for (auto j = orig->cbegin(); j != orig->cend(); j++) {
+                result_bb->add_instruction(duplicate(*j, phi_order));
+            }
+        } else {
+            // (the code begins with the block's own instructions, so its
+            // phis are the block's)
+            for (auto j = conversion->code.begin(); j != conversion->code.end(); j++) {
+                result_bb->add_instruction(duplicate(*j, phi_order));
+            }
+            orig = m_cfg->get_block(conversion->last_join);
+        }
+
+        const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+            result->create_edge(result_bb, block_map[(*j)->get_target()->get_id()], (*j)->get_kind());
+        }
+    }
+
+    return result;
+}
+
+std::vector<unsigned> IfConversion::get_phi_order(BasicBlock *bb, const std::vector<unsigned> &source_of) const {
+    // the operands of a phi are in the order of the ids of the predecessors,
+    // and a predecessor which was the last join block of a conversion is
+    // replaced by the converted block, whose id may order differently: find
+    // the original index of the predecessor at each index in the result
+    std::vector<BasicBlock *> preds = SSA::get_predecessors(m_cfg, bb);
+    std::vector<unsigned> order(preds.size());
+    for (unsigned i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+        return source_of[preds[a]->get_id()] < source_of[preds[b]->get_id()];
+    });
+    return order;
+}
+
+Instruction *IfConversion::duplicate(Instruction *ins, const std::vector<unsigned> &phi_order) {
+    Instruction *copy = ins->duplicate();
+    if (SSA::is_phi(ins)) {
+        for (unsigned i = 0; i < phi_order.size(); i++) {
+            (*copy)[i + 1] = ins->get_operand(phi_order[i] + 1);
+        }
+    }
+    return copy;
+}
+
+bool IfConversion::is_arm(BasicBlock *bb, BasicBlock *pred) const {
+    if (bb == pred || bb->get_kind() != BASICBLOCK_INTERIOR || m_removed[bb->get_id()]
+            || m_cfg->get_incoming_edges(bb).size() != 1 || m_cfg->get_outgoing_edges(bb).size() != 1) {
+        return false;
+    }
+    return m_cfg->get_outgoing_edges(bb)[0]->get_target() != bb;
+}
+
+BasicBlock *IfConversion::get_successor(BasicBlock *bb, EdgeKind kind) const {
+    const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+    for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+        if ((*i)->get_kind() == kind) {
+            return (*i)->get_target();
+        }
+    }
+    return nullptr;
+}
+
+bool IfConversion::is_predictable(BasicBlock *bb, BasicBlock *branch_arm, BasicBlock *fall_arm) const {
+    BasicBlock *arm = (branch_arm != nullptr) ? branch_arm : fall_arm;
+    long total = bb->get_count(), count = arm->get_count();
+    if (total <= 0 || count < 0) {
+        // (no profile counts)
+        return false;
+    }
+    return count * 16 <= total || count * 16 >= total * 15;
+}
+
+IfConversion::Conversion *IfConversion::convert(BasicBlock *bb) {
+    if (bb->get_kind() != BASICBLOCK_INTERIOR) {
+        return nullptr;
+    }
+    Conversion *conversion = new Conversion();
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        conversion->code.push_back((*i)->duplicate());
+    }
+
+    // convert the branch at the end of the block, and then the branch
+    // at the end of the join block merged into it, and so on (the block
+    // is marked as removed meanwhile, so that it can't be an arm or a
+    // join block itself)
+    BasicBlock *last = bb;
+    m_removed[bb->get_id()] = true;
+    for (;;) {
+        BasicBlock *join = convert_branch(last, conversion->code);
+        if (join == nullptr) {
+            break;
+        }
+        Statistics::get().add("ifconvert.converted");
+        last = join;
+    }
+    m_removed[bb->get_id()] = false;
+
+    if (last == bb) {
+        for (auto i = conversion->code.begin(); i != conversion->code.end(); i++) {
+            delete *i;
+        }
+        delete conversion;
+        return nullptr;
+    }
+    conversion->last_join = last->get_id();
+    return conversion;
+}
+
+BasicBlock *IfConversion::convert_branch(BasicBlock *bb, std::vector<Instruction *> &code) {
+    // (the block's instructions are the last ones in code)
+    unsigned len = unsigned(code.size());
+    if (len < 2 || HighLevel::get_conditional_move(code[len - 1]->get_opcode()) < 0
+            || code[len - 2]->get_opcode() != HINS_INT_COMPARE) {
+        return nullptr;
+    }
+    BasicBlock *target = get_successor(bb, EDGE_BRANCH);
+    BasicBlock *next = get_successor(bb, EDGE_FALLTHROUGH);
+    if (target == nullptr || next == nullptr || target == next) {
+        return nullptr;
+    }
+
+    // find the arms (one of which may be missing) and the join block
+    BasicBlock *branch_arm = nullptr, *fall_arm = nullptr, *join = nullptr;
+    bool target_is_arm = is_arm(target, bb), next_is_arm = is_arm(next, bb);
+    BasicBlock *target_succ = target_is_arm ? m_cfg->get_outgoing_edges(target)[0]->get_target() : nullptr;
+    BasicBlock *next_succ = next_is_arm ? m_cfg->get_outgoing_edges(next)[0]->get_target() : nullptr;
+    if (target_is_arm && next_is_arm && target_succ == next_succ) {
+        branch_arm = target;
+        fall_arm = next;
+        join = target_succ;
+    } else if (next_is_arm && next_succ == target) {
+        fall_arm = next;
+        join = target;
+    } else if (target_is_arm && target_succ == next) {
+        branch_arm = target;
+        join = next;
+    } else {
+        return nullptr;
+    }
+    if (join->get_kind() != BASICBLOCK_INTERIOR || m_removed[join->get_id()]
+            || m_conversions[join->get_id()] != nullptr || is_predictable(bb, branch_arm, fall_arm)) {
+        return nullptr;
+    }
+
+    // the join block must have no other predecessors (so that each phi
+    // has an operand for each side of the branch)
+    std::vector<BasicBlock *> preds = SSA::get_predecessors(m_cfg, join);
+    BasicBlock *branch_side = (branch_arm != nullptr) ? branch_arm : bb;
+    BasicBlock *fall_side = (fall_arm != nullptr) ? fall_arm : bb;
+    unsigned branch_index;
+    if (preds.size() == 2 && preds[0] == branch_side && preds[1] == fall_side) {
+        branch_index = 0;
+    } else if (preds.size() == 2 && preds[0] == fall_side && preds[1] == branch_side) {
+        branch_index = 1;
+    } else {
+        return nullptr;
+    }
+
+    // the code before the comparison, then the arms
+    Instruction *compare = code[len - 2], *branch = code[len - 1];
+    code.resize(len - 2);
+    if ((branch_arm != nullptr && !append_arm(branch_arm, len - 2, code))
+            || (fall_arm != nullptr && !append_arm(fall_arm, len - 2, code))) {
+        for (unsigned i = len - 2; i < code.size(); i++) {
+            delete code[i];
+        }
+        code.resize(len - 2);
+        code.push_back(compare);
+        code.push_back(branch);
+        return nullptr;
+    }
+
+    // the comparison, then a conditional move for each phi, then the
+    // rest of the join block
+    code.push_back(compare);
+    int opcode = HighLevel::get_conditional_move(branch->get_opcode());
+    delete branch;
+    unsigned i = 0;
+    for (; i < join->get_length() && SSA::is_phi(join->get_instruction(i)); i++) {
+        Instruction *phi = join->get_instruction(i);
+        Operand t_arg = phi->get_operand(branch_index + 1), f_arg = phi->get_operand(2 - branch_index);
+        if (t_arg == f_arg) {
+            code.push_back(new Instruction(HINS_MOV, phi->get_operand(0), t_arg));
+        } else {
+            code.push_back(new Instruction(opcode, phi->get_operand(0), t_arg, f_arg));
+        }
+    }
+    for (; i < join->get_length(); i++) {
+        code.push_back(join->get_instruction(i)->duplicate());
+    }
+
+    if (branch_arm != nullptr) {
+        m_removed[branch_arm->get_id()] = true;
+    }
+    if (fall_arm != nullptr) {
+        m_removed[fall_arm->get_id()] = true;
+    }
+    m_removed[join->get_id()] = true;
+    return join;
+}
+
+bool IfConversion::append_arm(BasicBlock *arm, unsigned num_branch_block, std::vector<Instruction *> &code) const {
+    unsigned length = 0;
+    for (unsigned i = 0; i < arm->get_length(); i++) {
+        Instruction *ins = arm->get_instruction(i);
+        int opcode = ins->get_opcode();
+        if (opcode == HINS_NOP || (opcode == HINS_JUMP && i + 1 == arm->get_length())) {
+            continue;
+        }
+        if (opcode != HINS_MOV && ++length > MAX_ARM_LENGTH) {
+            return false;
+        }
+
+        // only computations which can't fault, into vregs
+        bool is_load = (opcode == HINS_LOAD_INT || opcode == HINS_LOAD_CHAR);
+        switch (opcode) {
+            case HINS_LOAD_ICONST:
+            case HINS_MOV:
+            case HINS_INT_ADD:
+            case HINS_INT_SUB:
+            case HINS_INT_MUL:
+            case HINS_INT_NEGATE:
+            case HINS_LOCALADDR:
+            case HINS_LEA:
+            case HINS_LOAD_INT:
+            case HINS_LOAD_CHAR:
+                break;
+            default:
+                return false;
+        }
+        if (ins->get_operand(0).get_kind() != OPERAND_VREG) {
+            return false;
+        }
+        for (unsigned j = 1; j < ins->get_num_operands(); j++) {
+            if (ins->get_operand(j).is_memref() && !(is_load && j == 1)) {
+                return false;
+            }
+        }
+
+        code.push_back(ins->duplicate());
+        if (is_load && !is_safe_load(code, unsigned(code.size()) - 1, num_branch_block)) {
+            return false;
+        }
+    }
+    return true;
+}
+bool IfConversion::is_safe_load(const std::vector<Instruction *> &code, unsigned index, unsigned num_branch_block) {
+    // the load can't fault if the branch block accessed the same bytes
+    // (at an address with the same affine form)
+    InstructionSequence iseq;
+    for (unsigned i = 0; i <= index; i++) {
+        iseq.add_instruction(code[i]);
+    }
+    Instruction *load = code[index];
+    long size = (load->get_opcode() == HINS_LOAD_INT) ? 8 : 1;
+    AffineForm addr;
+    if (load->get_operand(1).get_kind() != OPERAND_VREG_MEMREF
+            || !AffineForm::get(&iseq, index, Operand(OPERAND_VREG, load->get_operand(1).get_base_reg()), addr)) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < num_branch_block; i++) {
+        Instruction *ins = code[i];
+        int opcode = ins->get_opcode();
+        Operand memref;
+        if (opcode == HINS_LOAD_INT || opcode == HINS_LOAD_CHAR) {
+            memref = ins->get_operand(1);
+        } else if (opcode == HINS_STORE_INT || opcode == HINS_STORE_CHAR) {
+            memref = ins->get_operand(0);
+        } else {
+            continue;
+        }
+        if (memref.get_kind() != OPERAND_VREG_MEMREF) {
+            continue;
+        }
+        long access_size = (opcode == HINS_LOAD_INT || opcode == HINS_STORE_INT) ? 8 : 1;
+        AffineForm access;
+        if (AffineForm::get(&iseq, i, Operand(OPERAND_VREG, memref.get_base_reg()), access)
+                && access.terms == addr.terms
+                && addr.constant >= access.constant && addr.constant + size <= access.constant + access_size) {
+            return true;
+        }
+    }
+    return false;
+}
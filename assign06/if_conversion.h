@@ -0,0 +1,73 @@
+#ifndef IF_CONVERSION_H
+#define IF_CONVERSION_H
+
+#include <vector>
+#include "cfg.h"
+
+// If-conversion for a high-level CFG in SSA form.
+//
+// A small IF (or IF/ELSE) statement, a block ending in
+//
+//   cmpi a, b
+//   jlt target            (or any other conditional branch)
+//
+// whose successors are either two "arms" (blocks with no other predecessors)
+// followed by the same join block, or one arm followed by the block the
+// other successor leads to, is converted into straight-line code when the
+// join block has no other predecessors: the arms are executed
+// unconditionally before the cmpi (their vregs are only used in the arms
+// and by the phis of the join block), and each phi of the join block is
+// replaced by a conditional move after the cmpi
+//
+//   cmovlt vrD, vrT, vrF  (vrT and vrF being the phi's operands for the
+//                          branch target and fall-through sides)
+//
+// followed by the rest of the join block, which is merged into the
+// converted block (so that the body of a loop containing IF statements can
+// become a single block for the loop optimizations).  If the join block
+// also ends with a branch which can be converted, it is converted as well.
+//
+// An arm can contain at most MAX_ARM_LENGTH instructions (not counting
+// moves or a final jump), which must be computations which can't fault:
+// constants, moves, additions, subtractions, multiplications, negations,
+// address computations, and loads of bytes which the converted block already
+// loaded from or stored to (at an address with the same AffineForm, see
+// dependence.h).  A branch which profile counts (see profile.h) show goes
+// the same way at least 15 times in 16 is left alone, since predicting it
+// is cheaper than executing both arms.
+class IfConversion {
+public:
+    static const unsigned MAX_ARM_LENGTH = 6;
+
+private:
+    // a block ending in a branch, to be converted
+    struct Conversion {
+        std::vector<Instruction *> code;   // the code replacing the block (owned)
+        unsigned last_join;                // the last join block merged into it
+    };
+
+    ControlFlowGraph *m_cfg;
+    // indexed by block id
+    std::vector<Conversion *> m_conversions;
+    std::vector<bool> m_removed;            // merged into a converted block
+
+public:
+    IfConversion(ControlFlowGraph *cfg);
+    ~IfConversion();
+
+    ControlFlowGraph *get_orig_cfg() { return m_cfg; }
+    ControlFlowGraph *transform_cfg();
+
+private:
+    std::vector<unsigned> get_phi_order(BasicBlock *bb, const std::vector<unsigned> &source_of) const;
+    static Instruction *duplicate(Instruction *ins, const std::vector<unsigned> &phi_order);
+    bool is_arm(BasicBlock *bb, BasicBlock *pred) const;
+    BasicBlock *get_successor(BasicBlock *bb, EdgeKind kind) const;
+    bool is_predictable(BasicBlock *bb, BasicBlock *branch_arm, BasicBlock *fall_arm) const;
+    Conversion *convert(BasicBlock *bb);
+    BasicBlock *convert_branch(BasicBlock *bb, std::vector<Instruction *> &code);
+    bool append_arm(BasicBlock *arm, unsigned num_branch_block, std::vector<Instruction *> &code) const;
+    static bool is_safe_load(const std::vector<Instruction *> &code, unsigned index, unsigned num_branch_block);
+};
+
+#endif // IF_CONVERSION_H
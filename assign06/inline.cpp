@@ -0,0 +1,284 @@
+#include <cassert>
+#include "cfg.h"
+#include "highlevel.h"
+#include "stats.h"
+#include "inline.h"
+
+namespace {
+    // the number of instructions of a function (not counting no-ops)
+    unsigned get_size(ControlFlowGraph *cfg) {
+        unsigned size = 0;
+        for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+            BasicBlock *bb = *i;
+            for (unsigned j = 0; j < bb->get_length(); j++) {
+                int opcode = bb->get_instruction(j)->get_opcode();
+                if (opcode != HINS_NOP && opcode != HINS_PROFILE_COUNT) {
+                    size++;
+                }
+            }
+        }
+        return size;
+    }
+
+    void add_nop_if_empty(BasicBlock *bb) {
+        if (bb->get_length() == 0 && bb->get_kind() == BASICBLOCK_INTERIOR) {
+            bb->add_instruction(new Instruction(HINS_NOP));
+        }
+    }
+}
+
+FunctionInlining::FunctionInlining()
+        : m_optimize_size(false) {
+}
+
+FunctionInlining::~FunctionInlining() {
+}
+
+void FunctionInlining::add_function(const std::string &label, ControlFlowGraph *cfg) {
+    m_index[label] = unsigned(m_functions.size());
+    m_functions.push_back(Function{ label, cfg, get_size(cfg), 0, std::set<unsigned>(), false });
+}
+
+void FunctionInlining::run() {
+    for (auto i = m_functions.begin(); i != m_functions.end(); i++) {
+        for (auto j = i->cfg->bb_begin(); j != i->cfg->bb_end(); j++) {
+            BasicBlock *bb = *j;
+            for (unsigned k = 0; k < bb->get_length(); k++) {
+                int callee = find_callee(bb->get_instruction(k));
+                if (callee >= 0) {
+                    m_functions[callee].num_calls++;
+                }
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < m_functions.size(); i++) {
+        m_functions[i].cfg = inline_calls(i);
+        m_functions[i].size = get_size(m_functions[i].cfg);
+    }
+    find_called_functions();
+}
+
+int FunctionInlining::find_callee(Instruction *ins) const {
+    if (!HighLevel::is_subprogram_call(ins)) {
+        return -1;
+    }
+    unsigned label_index = (ins->get_opcode() == HINS_CALL) ? 1 : 0;
+    auto i = m_index.find(ins->get_operand(label_index).get_target_label());
+    return (i != m_index.end()) ? int(i->second) : -1;
+}
+
+bool FunctionInlining::should_inline(unsigned caller, unsigned callee, long count) const {
+    // (a function can only call itself or the functions added before it)
+    if (callee >= caller) {
+        return false;
+    }
+    // (count is -1 if there is no profile)
+    if (count == 0) {
+        return false;
+    }
+    unsigned size = m_functions[callee].size;
+    if (m_optimize_size) {
+        return size <= TINY_SIZE || (m_functions[callee].num_calls == 1 && size <= SINGLE_CALL_SIZE);
+    }
+    return size <= SMALL_SIZE
+           || (m_functions[callee].num_calls == 1 && size <= SINGLE_CALL_SIZE)
+           || (count >= HOT_COUNT && size <= HOT_SIZE);
+}
+
+ControlFlowGraph *FunctionInlining::inline_calls(unsigned caller) {
+    ControlFlowGraph *cfg = m_functions[caller].cfg;
+
+    // choose the calls to inline, in order, until the function has grown
+    // by MAX_GROWTH instructions
+    std::map<Instruction *, unsigned> inlined_calls;
+    unsigned growth = 0;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (unsigned j = 0; j < bb->get_length(); j++) {
+            Instruction *ins = bb->get_instruction(j);
+            int callee = find_callee(ins);
+            if (callee < 0 || !should_inline(caller, unsigned(callee), bb->get_count())) {
+                continue;
+            }
+            unsigned size = m_functions[callee].size;
+            if (growth + size > MAX_GROWTH) {
+                continue;
+            }
+            growth += size;
+            inlined_calls[ins] = unsigned(callee);
+        }
+    }
+    if (inlined_calls.empty()) {
+        return cfg;
+    }
+
+    ControlFlowGraph *result = new ControlFlowGraph();
+    int num_vregs = HighLevel::get_num_vregs(cfg);
+    unsigned num_blocks = cfg->get_num_blocks();
+
+    // the first and last of the blocks each original block is split into
+    std::vector<BasicBlock *> first(num_blocks), last(num_blocks);
+    for (unsigned i = 0; i < num_blocks; i++) {
+        BasicBlock *orig = cfg->get_block(i);
+        BasicBlock *bb = result->create_basic_block(orig->get_kind(), orig->get_label());
+        bb->set_count(orig->get_count());
+        first[i] = bb;
+        for (unsigned j = 0; j < orig->get_length(); j++) {
+            Instruction *ins = orig->get_instruction(j);
+            auto call = inlined_calls.find(ins);
+            if (call == inlined_calls.end()) {
+                bb->add_instruction(ins->duplicate());
+                continue;
+            }
+            unsigned callee = call->second;
+            bb = inline_call(result, bb, ins, callee, num_vregs, orig->get_count());
+            num_vregs += HighLevel::get_num_vregs(m_functions[callee].cfg);
+
+            Function &fn = m_functions[caller];
+            fn.inlined.insert(callee);
+            fn.inlined.insert(m_functions[callee].inlined.begin(), m_functions[callee].inlined.end());
+            Statistics::get().add("inline.calls");
+        }
+        add_nop_if_empty(bb);
+        last[i] = bb;
+    }
+
+    for (unsigned i = 0; i < num_blocks; i++) {
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(cfg->get_block(i));
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            Edge *e = *j;
+            result->create_edge(last[i], first[e->get_target()->get_id()], e->get_kind());
+        }
+    }
+
+    return result;
+}
+
+// copy the blocks of the callee after bb (the block containing the
+// instructions before the call), returning the block which will contain
+// the instructions after the call
+BasicBlock *FunctionInlining::inline_call(ControlFlowGraph *result, BasicBlock *bb, Instruction *call,
+                                          unsigned callee, int vreg_offset, long count) {
+    ControlFlowGraph *callee_cfg = m_functions[callee].cfg;
+    unsigned num_blocks = callee_cfg->get_num_blocks();
+    BasicBlock *callee_exit = callee_cfg->get_exit_block();
+    unsigned first_arg = (call->get_opcode() == HINS_CALL) ? 2 : 1;
+
+    // the block after the call is labeled if the callee branches to its end
+    std::string after_label;
+    const ControlFlowGraph::EdgeList &exit_edges = callee_cfg->get_incoming_edges(callee_exit);
+    for (auto i = exit_edges.begin(); i != exit_edges.end(); i++) {
+        if ((*i)->get_kind() == EDGE_BRANCH) {
+            after_label = StringTable::labels().new_label(".Linline");
+        }
+    }
+
+    // scale the counts of the callee's blocks by the count of the call
+    // site (relative to the count of the callee's first block)
+    long callee_count = -1;
+    const ControlFlowGraph::EdgeList &entry_edges = callee_cfg->get_outgoing_edges(callee_cfg->get_entry_block());
+    if (!entry_edges.empty()) {
+        callee_count = entry_edges.front()->get_target()->get_count();
+    }
+    double scale = (count >= 0 && callee_count > 0) ? double(count) / double(callee_count) : 1.0;
+
+    std::map<std::string, std::string> labels;
+    if (callee_exit->has_label()) {
+        labels[callee_exit->get_label()] = after_label;
+    }
+    std::vector<BasicBlock *> block_map(num_blocks, nullptr);
+    for (unsigned i = 0; i < num_blocks; i++) {
+        BasicBlock *orig = callee_cfg->get_block(i);
+        if (orig->get_kind() != BASICBLOCK_INTERIOR) {
+            continue;
+        }
+        std::string label;
+        if (orig->has_label()) {
+            label = StringTable::labels().new_label(".Linline");
+            labels[orig->get_label()] = label;
+        }
+        block_map[i] = result->create_basic_block(BASICBLOCK_INTERIOR, label);
+        long orig_count = orig->get_count();
+        block_map[i]->set_count(orig_count >= 0 ? long(double(orig_count) * scale) : count);
+    }
+
+    for (unsigned i = 0; i < num_blocks; i++) {
+        BasicBlock *orig = callee_cfg->get_block(i);
+        BasicBlock *copy_bb = block_map[i];
+        if (copy_bb == nullptr) {
+            continue;
+        }
+        for (unsigned j = 0; j < orig->get_length(); j++) {
+            Instruction *copy = orig->get_instruction(j)->duplicate();
+            for (unsigned k = 0; k < copy->get_num_operands(); k++) {
+                Operand &op = (*copy)[k];
+                if (op.has_base_reg()) {
+                    op.set_base_reg(op.get_base_reg() + vreg_offset);
+                }
+                if (op.has_index_reg()) {
+                    op.set_index_reg(op.get_index_reg() + vreg_offset);
+                }
+                if (op.get_kind() == OPERAND_LABEL) {
+                    auto label = labels.find(op.get_target_label());
+                    if (label != labels.end()) {
+                        op = Operand(label->second);
+                    }
+                }
+            }
+
+            if (copy->get_opcode() == HINS_PARAM) {
+                Operand arg = call->get_operand(first_arg + unsigned((*copy)[1].get_int_value()));
+                Instruction *mov = new Instruction(HINS_MOV, (*copy)[0], arg);
+                delete copy;
+                copy = mov;
+            } else if (copy->get_opcode() == HINS_RETURN) {
+                assert(call->get_opcode() == HINS_CALL);
+                Instruction *mov = new Instruction(HINS_MOV, call->get_operand(0), (*copy)[0]);
+                delete copy;
+                copy = mov;
+            }
+            copy_bb->add_instruction(copy);
+        }
+        add_nop_if_empty(copy_bb);
+    }
+
+    BasicBlock *after = result->create_basic_block(BASICBLOCK_INTERIOR, after_label);
+    after->set_count(count);
+    add_nop_if_empty(bb);
+
+    // the callee's entry is the block before the call, and its exit is
+    // the block after the call
+    for (unsigned i = 0; i < num_blocks; i++) {
+        const ControlFlowGraph::EdgeList &outgoing = callee_cfg->get_outgoing_edges(callee_cfg->get_block(i));
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            Edge *e = *j;
+            BasicBlock *source = (i == callee_cfg->get_entry_block()->get_id()) ? bb : block_map[i];
+            BasicBlock *target = (e->get_target() == callee_exit) ? after : block_map[e->get_target()->get_id()];
+            result->create_edge(source, target, e->get_kind());
+        }
+    }
+
+    return after;
+}
+
+void FunctionInlining::find_called_functions() {
+    // (the main program is the last function)
+    std::vector<unsigned> worklist;
+    m_functions.back().is_called = true;
+    worklist.push_back(unsigned(m_functions.size() - 1));
+    while (!worklist.empty()) {
+        ControlFlowGraph *cfg = m_functions[worklist.back()].cfg;
+        worklist.pop_back();
+        for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+            BasicBlock *bb = *i;
+            for (unsigned j = 0; j < bb->get_length(); j++) {
+                int callee = find_callee(bb->get_instruction(j));
+                if (callee >= 0 && !m_functions[callee].is_called) {
+                    m_functions[callee].is_called = true;
+                    worklist.push_back(unsigned(callee));
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef INLINE_H
+#define INLINE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "cfg.h"
+
+// Inlining of calls to the program's subprograms, in the high-level CFGs
+// of the functions (before they are optimized).
+//
+// The functions are added callees first: the subprograms in the order they
+// were declared (since a subprogram can only call itself and the ones
+// declared before it), and then the main program.  The calls in each
+// function are inlined in that order, so that the code copied into a call
+// site already has the calls inlined into the callee.  The block containing
+// an inlined call is split at the call, and the blocks of the callee are
+// copied between the two halves, with its vregs renumbered after the
+// caller's and its labels renamed: its "param" instructions become moves
+// from the arguments, and its "ret" a move to the destination of the call.
+// (The counts of the copied blocks are scaled by the count of the call site,
+// if there is a profile.)
+//
+// A call is inlined if the callee is small, if it is the only call of the
+// callee in the program, or if the profile shows it is executed often and
+// the callee isn't too large; calls which the profile shows were never
+// executed, and recursive calls, are not inlined, and the size of a function
+// can only grow by a limited amount.  The variables of each callee whose
+// code is copied into a function must be placed in its frame too (see
+// get_inlined_functions): the copies in a function can share them, since
+// a function never inlines a call of itself.
+//
+// When optimizing for size (see set_optimize_size), only callees of at
+// most TINY_SIZE instructions (whose code is about the size of a call),
+// and callees which are only called once (and then aren't emitted), are
+// inlined.
+class FunctionInlining {
+public:
+    // callees with at most this many instructions are always inlined
+    static const unsigned SMALL_SIZE = 12;
+    // limit on the size of a callee which is called once in the program
+    static const unsigned SINGLE_CALL_SIZE = 200;
+    // limit on the size of a callee inlined at a hot call site, which
+    // is executed at least HOT_COUNT times
+    static const unsigned HOT_SIZE = 60;
+    static const long HOT_COUNT = 1000;
+    // limit on the number of instructions added to a function
+    static const unsigned MAX_GROWTH = 400;
+    // limit on the size of a callee inlined when optimizing for size
+    static const unsigned TINY_SIZE = 6;
+
+private:
+    struct Function {
+        std::string label;
+        ControlFlowGraph *cfg;
+        unsigned size;
+        unsigned num_calls;            // the number of calls of the function in the program
+        std::set<unsigned> inlined;    // the functions whose code was copied into it
+        bool is_called;
+    };
+
+    std::vector<Function> m_functions;
+    std::map<std::string, unsigned> m_index;
+    bool m_optimize_size;
+
+public:
+    FunctionInlining();
+    ~FunctionInlining();
+
+    void set_optimize_size(bool optimize_size) { m_optimize_size = optimize_size; }
+
+    // add the next function (callees first, and the main program last)
+    void add_function(const std::string &label, ControlFlowGraph *cfg);
+
+    // inline the calls in all of the functions
+    void run();
+
+    // the CFG of the i-th function added, after inlining
+    ControlFlowGraph *get_cfg(unsigned i) const { return m_functions[i].cfg; }
+
+    // the functions whose code was copied into the i-th function (directly,
+    // or inlined into a function which was copied into it)
+    const std::set<unsigned> &get_inlined_functions(unsigned i) const { return m_functions[i].inlined; }
+
+    // is the i-th function still called (from the main program, after
+    // inlining)?  A subprogram which isn't needn't be emitted.
+    bool is_called(unsigned i) const { return m_functions[i].is_called; }
+
+private:
+    int find_callee(Instruction *ins) const;
+    bool should_inline(unsigned caller, unsigned callee, long count) const;
+    ControlFlowGraph *inline_calls(unsigned caller);
+    BasicBlock *inline_call(ControlFlowGraph *result, BasicBlock *bb, Instruction *call,
+                            unsigned callee, int vreg_offset, long count);
+    void find_called_functions();
+};
+
+#endif // INLINE_H
@@ -0,0 +1,293 @@
+#include <cassert>
+#include <climits>
+#include "cfg.h"
+#include "highlevel.h"
+#include "x86_64.h"
+#include "instruction_selection.h"
+
+namespace {
+    const Operand R10(OPERAND_MREG, MREG_R10);
+    const Operand R11(OPERAND_MREG, MREG_R11);
+
+    bool is_mreg(const Operand &operand) {
+        return operand.get_kind() == OPERAND_MREG;
+    }
+
+    bool is_imm(const Operand &operand) {
+        return operand.get_kind() == OPERAND_INT_LITERAL;
+    }
+
+    bool is_imm32(const Operand &operand) {
+        return is_imm(operand) && operand.get_int_value() >= INT_MIN && operand.get_int_value() <= INT_MAX;
+    }
+
+    bool is_imm_value(const Operand &operand, long value) {
+        return is_imm(operand) && operand.get_int_value() == value;
+    }
+
+    // is the operand a register or memory location which holds the same value as another?
+    bool same_location(const Operand &a, const Operand &b) {
+        if (a.get_kind() != b.get_kind() || is_imm(a)) {
+            return false;
+        }
+        if (is_mreg(a)) {
+            return a.get_base_reg() == b.get_base_reg();
+        }
+        return a.get_kind() == OPERAND_MREG_MEMREF_OFFSET
+               && a.get_base_reg() == b.get_base_reg() && a.get_offset() == b.get_offset();
+    }
+
+    // can "op src, dst" (an arithmetic instruction) be encoded?
+    bool can_alu(int opcode, const Operand &src, const Operand &dst) {
+        if (!is_mreg(dst) && !(dst.is_memref() && opcode != MINS_IMULQ)) {
+            return false;
+        }
+        if (src.is_memref()) {
+            return !dst.is_memref();
+        }
+        return is_mreg(src) || is_imm32(src);
+    }
+
+    // log2 of a power of two, or -1 if the operand isn't an immediate power of two
+    int get_shift(const Operand &operand) {
+        if (!is_imm(operand) || operand.get_int_value() <= 0
+                || (operand.get_int_value() & (operand.get_int_value() - 1)) != 0) {
+            return -1;
+        }
+        int shift = 0;
+        while ((1L << shift) != operand.get_int_value()) {
+            shift++;
+        }
+        return shift;
+    }
+}
+
+InstructionSelector::Code InstructionSelector::select_move(const Operand &dest, const Operand &src) {
+    assert(!same_location(dest, R10) && !same_location(dest, R11));
+    Code code;
+    if (is_mreg(dest) || is_mreg(src) || is_imm32(src)) {
+        code.push_back(new Instruction(MINS_MOVQ, src, dest));
+    } else {
+        // a memory-to-memory move, or a 64-bit immediate stored to memory
+        code.push_back(new Instruction(MINS_MOVQ, src, R11));
+        code.push_back(new Instruction(MINS_MOVQ, R11, dest));
+    }
+    return code;
+}
+
+InstructionSelector::Code InstructionSelector::select_binary(int hins_opcode, const Operand &dest,
+                                                            const Operand &a, const Operand &b) {
+    assert(!same_location(dest, R10) && !same_location(dest, R11) && !same_location(b, R10));
+    std::vector<Code> candidates;
+    switch (hins_opcode) {
+        case HINS_INT_ADD:
+            select_add(dest, a, b, candidates);
+            break;
+        case HINS_INT_SUB:
+            select_sub(dest, a, b, candidates);
+            break;
+        case HINS_INT_MUL:
+            select_mul(dest, a, b, candidates);
+            break;
+        default:
+            assert(false);
+    }
+    return choose_cheapest(candidates);
+}
+
+unsigned InstructionSelector::get_cost(const Code &code) {
+    // one for each instruction and each memory access, and the
+    // latency of a multiplication
+    unsigned cost = 0;
+    for (auto i = code.begin(); i != code.end(); i++) {
+        Instruction *ins = *i;
+        cost += (ins->get_opcode() == MINS_IMULQ) ? 3 : 1;
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            if (ins->get_operand(j).is_memref() && ins->get_opcode() != MINS_LEAQ) {
+                cost++;
+            }
+        }
+    }
+    return cost;
+}
+
+void InstructionSelector::select_add(const Operand &dest, const Operand &a, const Operand &b,
+                                     std::vector<Code> &candidates) {
+    // try both orders of the operands, since addition is commutative
+    // (preferring to compute the result in the location of b, which is
+    // usually the intermediate result of a larger expression)
+    for (unsigned order = 0; order < 2; order++) {
+        const Operand &x = (order == 0) ? b : a;
+        const Operand &y = (order == 0) ? a : b;
+
+        if (same_location(dest, x)) {
+            if (is_imm_value(y, 1) || is_imm_value(y, -1)) {
+                candidates.push_back({ new Instruction(is_imm_value(y, 1) ? MINS_INCQ : MINS_DECQ, dest) });
+            }
+            if (can_alu(MINS_ADDQ, y, dest)) {
+                candidates.push_back({ new Instruction(MINS_ADDQ, y, dest) });
+            }
+        }
+        if (is_mreg(dest) && is_mreg(x) && is_imm32(y)) {
+            Operand addr(OPERAND_MREG_MEMREF_OFFSET, x.get_base_reg(), int(y.get_int_value()));
+            candidates.push_back({ new Instruction(MINS_LEAQ, addr, dest) });
+        }
+        if (is_mreg(dest) && !same_location(dest, y) && can_alu(MINS_ADDQ, y, dest)) {
+            candidates.push_back({ new Instruction(MINS_MOVQ, x, dest), new Instruction(MINS_ADDQ, y, dest) });
+        }
+    }
+    if (is_mreg(dest) && is_mreg(a) && is_mreg(b)) {
+        Operand addr(OPERAND_MREG_MEMREF_INDEX, a.get_base_reg(), b.get_base_reg());
+        candidates.push_back({ new Instruction(MINS_LEAQ, addr, dest) });
+    }
+    candidates.push_back(select_general(MINS_ADDQ, dest, a, b));
+}
+
+void InstructionSelector::select_sub(const Operand &dest, const Operand &a, const Operand &b,
+                                     std::vector<Code> &candidates) {
+    if (same_location(dest, a)) {
+        if (is_imm_value(b, 1) || is_imm_value(b, -1)) {
+            candidates.push_back({ new Instruction(is_imm_value(b, 1) ? MINS_DECQ : MINS_INCQ, dest) });
+        }
+        if (can_alu(MINS_SUBQ, b, dest)) {
+            candidates.push_back({ new Instruction(MINS_SUBQ, b, dest) });
+        }
+    }
+    if (is_mreg(dest) && is_mreg(a) && is_imm32(b) && b.get_int_value() != INT_MIN) {
+        Operand addr(OPERAND_MREG_MEMREF_OFFSET, a.get_base_reg(), int(-b.get_int_value()));
+        candidates.push_back({ new Instruction(MINS_LEAQ, addr, dest) });
+    }
+    if (is_mreg(dest) && !same_location(dest, b) && can_alu(MINS_SUBQ, b, dest)) {
+        candidates.push_back({ new Instruction(MINS_MOVQ, a, dest), new Instruction(MINS_SUBQ, b, dest) });
+    }
+    candidates.push_back(select_general(MINS_SUBQ, dest, a, b));
+}
+
+void InstructionSelector::select_mul(const Operand &dest, const Operand &a, const Operand &b,
+                                     std::vector<Code> &candidates) {
+    // try both orders of the operands, since multiplication is commutative
+    for (unsigned order = 0; order < 2; order++) {
+        const Operand &x = (order == 0) ? b : a;
+        const Operand &y = (order == 0) ? a : b;
+
+        int shift = get_shift(y);
+        if (same_location(dest, x)) {
+            if (shift >= 0) {
+                candidates.push_back({ new Instruction(MINS_SHLQ, Operand(OPERAND_INT_LITERAL, shift), dest) });
+            }
+            if (can_alu(MINS_IMULQ, y, dest)) {
+                candidates.push_back({ new Instruction(MINS_IMULQ, y, dest) });
+            }
+        }
+        if (is_mreg(dest) && (is_mreg(x) || x.is_memref()) && is_imm32(y)) {
+            // imulq $imm, src, dest
+            candidates.push_back({ new Instruction(MINS_IMULQ, y, x, dest) });
+        }
+        if (is_mreg(dest) && !same_location(dest, y)) {
+            if (shift >= 0) {
+                candidates.push_back({ new Instruction(MINS_MOVQ, x, dest),
+                                       new Instruction(MINS_SHLQ, Operand(OPERAND_INT_LITERAL, shift), dest) });
+            }
+            if (can_alu(MINS_IMULQ, y, dest)) {
+                candidates.push_back({ new Instruction(MINS_MOVQ, x, dest), new Instruction(MINS_IMULQ, y, dest) });
+            }
+        }
+        if (is_imm(y) && !is_imm(x)) {
+            select_mul_by_constant(dest, x, y.get_int_value(), candidates);
+        }
+    }
+    candidates.push_back(select_general(MINS_IMULQ, dest, a, b));
+}
+
+void InstructionSelector::select_mul_by_constant(const Operand &dest, const Operand &x, long c,
+                                                 std::vector<Code> &candidates) {
+    // the product is computed in dest, or in %r10 (and then stored)
+    // if dest isn't a register, from x in a register (x is loaded
+    // into %r10 first if it isn't)
+    Operand src = is_mreg(x) ? x : R10;
+    Operand t = is_mreg(dest) ? dest : R10;
+    auto add_candidate = [&](Code code) {
+        if (!is_mreg(x)) {
+            code.insert(code.begin(), new Instruction(MINS_MOVQ, x, R10));
+        }
+        if (!is_mreg(dest)) {
+            code.push_back(new Instruction(MINS_MOVQ, R10, dest));
+        }
+        candidates.push_back(code);
+    };
+    auto lea = [](const Operand &base, int scale, const Operand &dst) {
+        Operand addr(OPERAND_MREG_MEMREF_OFFSET_INDEX, base.get_base_reg(), base.get_base_reg(), 0, scale);
+        return new Instruction(MINS_LEAQ, addr, dst);
+    };
+    auto shl = [](int shift, const Operand &dst) {
+        return new Instruction(MINS_SHLQ, Operand(OPERAND_INT_LITERAL, shift), dst);
+    };
+
+    // leaq (%rX,%rX,s) multiplies by s + 1 (for s = 1, 2, 4 or 8), which
+    // can be followed by a shift or another leaq
+    static const int scales[] = { 1, 2, 4, 8 };
+    for (int s1 : scales) {
+        long m1 = s1 + 1;
+        if (c == m1) {
+            add_candidate({ lea(src, s1, t) });
+        }
+        for (int shift = 1; shift < 60 && (m1 << shift) <= c; shift++) {
+            if (c == (m1 << shift)) {
+                add_candidate({ lea(src, s1, t), shl(shift, t) });
+            }
+        }
+        for (int s2 : scales) {
+            if (c == m1 * (s2 + 1)) {
+                add_candidate({ lea(src, s1, t), lea(t, s2, t) });
+            }
+        }
+    }
+
+    // 2^k + 1 and 2^k - 1: shift a copy, then add or subtract the original
+    // (which this needs to be kept in another register)
+    if (!same_location(src, t)) {
+        for (int shift = 2; shift < 62; shift++) {
+            long power = 1L << shift;
+            if (c == power + 1 || c == power - 1) {
+                add_candidate({ new Instruction(MINS_MOVQ, src, t), shl(shift, t),
+                                new Instruction((c == power + 1) ? MINS_ADDQ : MINS_SUBQ, src, t) });
+            }
+        }
+    }
+}
+
+InstructionSelector::Code InstructionSelector::select_general(int opcode, const Operand &dest,
+                                                              const Operand &a, const Operand &b) {
+    Code code;
+    if (!same_location(a, R10)) {
+        code.push_back(new Instruction(MINS_MOVQ, a, R10));
+    }
+    Operand src = b;
+    if (is_imm(b) && !is_imm32(b)) {
+        code.push_back(new Instruction(MINS_MOVQ, b, R11));
+        src = R11;
+    }
+    code.push_back(new Instruction(opcode, src, R10));
+    code.push_back(new Instruction(MINS_MOVQ, R10, dest));
+    return code;
+}
+
+InstructionSelector::Code InstructionSelector::choose_cheapest(std::vector<Code> &candidates) {
+    // the first of the cheapest candidates is chosen
+    assert(!candidates.empty());
+    unsigned best = 0;
+    for (unsigned i = 1; i < candidates.size(); i++) {
+        if (get_cost(candidates[i]) < get_cost(candidates[best])) {
+            best = i;
+        }
+    }
+
+    for (unsigned i = 0; i < candidates.size(); i++) {
+        if (i != best) {
+            for (auto j = candidates[i].begin(); j != candidates[i].end(); j++) {
+                delete *j;
+            }
+        }
+    }
+    return candidates[best];
+}
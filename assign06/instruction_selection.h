@@ -0,0 +1,48 @@
+#ifndef INSTRUCTION_SELECTION_H
+#define INSTRUCTION_SELECTION_H
+
+#include <vector>
+#include "cfg.h"
+
+// Selection of the x86-64 instructions for the high-level moves and
+// integer arithmetic instructions, used by AssemblyCodeGen.
+//
+// The operands are machine operands: a machine register, a memory
+// reference (such as a vreg's stack slot), or an immediate.  For each
+// high-level opcode, every encoding which can be used for the given kinds
+// of operands (e.g. "incq dest", "addq b, dest", "leaq b(a), dest", or
+// "movq a, %r10; addq b, %r10; movq %r10, dest") is generated, and the
+// cheapest one is chosen.  The encodings may use %r10 and %r11 as scratch
+// registers, so neither of them can be the destination, and %r10 can
+// only be the first source operand.
+class InstructionSelector {
+public:
+    typedef std::vector<Instruction *> Code;
+
+    // select the instructions for dest = src
+    static Code select_move(const Operand &dest, const Operand &src);
+
+    // select the instructions for dest = a op b, where op is
+    // HINS_INT_ADD, HINS_INT_SUB, or HINS_INT_MUL
+    static Code select_binary(int hins_opcode, const Operand &dest, const Operand &a, const Operand &b);
+
+    // the estimated cost of executing a sequence of instructions
+    static unsigned get_cost(const Code &code);
+
+private:
+    static void select_add(const Operand &dest, const Operand &a, const Operand &b, std::vector<Code> &candidates);
+    static void select_sub(const Operand &dest, const Operand &a, const Operand &b, std::vector<Code> &candidates);
+    static void select_mul(const Operand &dest, const Operand &a, const Operand &b, std::vector<Code> &candidates);
+
+    // sequences of leaq, shlq, addq and subq for dest = x * c, which
+    // replace the imulq when they are cheaper
+    static void select_mul_by_constant(const Operand &dest, const Operand &x, long c, std::vector<Code> &candidates);
+
+    // "movq a, %r10; op b, %r10; movq %r10, dest", which can always be
+    // encoded (b is first moved to %r11 if it is a 64-bit immediate)
+    static Code select_general(int opcode, const Operand &dest, const Operand &a, const Operand &b);
+
+    static Code choose_cheapest(std::vector<Code> &candidates);
+};
+
+#endif // INSTRUCTION_SELECTION_H
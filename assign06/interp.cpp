@@ -0,0 +1,470 @@
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <set>
+#include "util.h"
+#include "highlevel.h"
+#include "storage_layout.h"
+#include "interp.h"
+
+// the functions of the buffered I/O runtime (runtime.c, which is linked
+// with the compiler)
+extern "C" {
+long __rt_read_int(void);
+void __rt_write_int(long val);
+void __rt_write_int_array(const long *elems, long count);
+}
+
+namespace {
+    const unsigned MAX_ARGS = 6;
+
+    bool is_branch(int opcode) {
+        return opcode >= HINS_JUMP && opcode <= HINS_JGTE;
+    }
+
+    // the condition of a conditional branch or move, given the operands
+    // of the last cmpi
+    bool test(int opcode, long l, long r) {
+        switch (opcode) {
+            case HINS_JE:   case HINS_CMOVE:   return l == r;
+            case HINS_JNE:  case HINS_CMOVNE:  return l != r;
+            case HINS_JLT:  case HINS_CMOVLT:  return l < r;
+            case HINS_JLTE: case HINS_CMOVLTE: return l <= r;
+            case HINS_JGT:  case HINS_CMOVGT:  return l > r;
+            case HINS_JGTE: case HINS_CMOVGTE: return l >= r;
+            default:        return true;
+        }
+    }
+
+    long load(const unsigned char *p) {
+        long value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    void store(unsigned char *p, long value) {
+        memcpy(p, &value, sizeof(value));
+    }
+}
+
+HighLevelInterpreter::HighLevelInterpreter()
+        : m_linked(false)
+        , m_use_runtime(false)
+        , m_opcode_counts(HINS_RETURN + 1, 0) {
+}
+
+HighLevelInterpreter::~HighLevelInterpreter() {
+}
+
+void HighLevelInterpreter::set_use_runtime(bool use_runtime) {
+    m_use_runtime = use_runtime;
+}
+
+void HighLevelInterpreter::set_profile(const std::string &filename, unsigned num_counters) {
+    m_profile_file = filename;
+    m_profile_counts.assign(num_counters, 0);
+}
+
+void HighLevelInterpreter::add_function(const std::string &label, ControlFlowGraph *cfg, StorageLayout *layout,
+                                        long num_vregs, const std::map<int, int> &mreg_assignment) {
+    add_function(label, cfg->create_instruction_sequence(HighLevel::get_inverted_branch, -1, HINS_JUMP), layout,
+                 num_vregs, mreg_assignment);
+}
+
+void HighLevelInterpreter::add_function(const std::string &label, InstructionSequence *iseq, StorageLayout *layout,
+                                        long num_vregs, const std::map<int, int> &mreg_assignment) {
+    // place the variables whose storage is used (as AssemblyCodeGen does)
+    std::set<long> variables;
+    for (unsigned i = 0; i < iseq->get_length(); i++) {
+        Instruction *ins = iseq->get_instruction(i);
+        if (ins->get_opcode() == HINS_LOCALADDR) {
+            variables.insert(ins->get_operand(1).get_int_value());
+        }
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            if (ins->get_operand(j).get_kind() == OPERAND_LOCAL_MEMREF) {
+                variables.insert(layout->find_variable(ins->get_operand(j).get_offset()));
+            }
+        }
+    }
+    layout->place_variables(variables);
+
+    m_functions.push_back(Function());
+    Function &fn = m_functions.back();
+    fn.label = label;
+    num_vregs = std::max(num_vregs, long(HighLevel::get_num_vregs(iseq)));
+    fn.num_values = num_vregs;
+    for (auto i = mreg_assignment.begin(); i != mreg_assignment.end(); i++) {
+        fn.num_values = std::max(fn.num_values, num_vregs + i->second + 1);
+    }
+    fn.frame_size = layout->get_frame_size();
+    fn.uses_vectors = false;
+
+    for (unsigned i = 0; i < iseq->get_length(); i++) {
+        Instruction *ins = iseq->get_instruction(i);
+        Code code;
+        code.opcode = ins->get_opcode();
+        code.first_operand = unsigned(fn.operands.size());
+        code.num_operands = ins->get_num_operands();
+        code.target = 0;
+        code.block = -1;
+        if (i == 0 || iseq->has_label(i) || is_branch(iseq->get_instruction(i - 1)->get_opcode())) {
+            code.block = int(fn.block_names.size());
+            fn.block_names.push_back(iseq->has_label(i) ? iseq->get_label(i) : "@" + std::to_string(i));
+        }
+        for (unsigned j = 0; j < code.num_operands; j++) {
+            bool is_address = (code.opcode == HINS_LOCALADDR && j == 1);
+            fn.operands.push_back(decode_operand(ins->get_operand(j), layout, is_address, num_vregs, mreg_assignment));
+        }
+        if (is_branch(code.opcode)) {
+            code.target = iseq->get_index_of_labeled_instruction(ins->get_operand(0).get_target_label());
+        } else if (code.opcode == HINS_CALL || code.opcode == HINS_CALL_PROC) {
+            unsigned callee = (code.opcode == HINS_CALL) ? 1 : 0;
+            fn.calls.push_back(std::make_pair(i, ins->get_operand(callee).get_target_label()));
+            if (code.num_operands - callee - 1 > MAX_ARGS) {
+                err_fatal("Too many arguments in a call of '%s'\n", fn.calls.back().second.c_str());
+            }
+        } else if (code.opcode >= HINS_VEC_LOAD && code.opcode <= HINS_VEC_DUP) {
+            fn.uses_vectors = true;
+        }
+        fn.code.push_back(code);
+    }
+    fn.block_counts.assign(fn.block_names.size(), 0);
+    m_linked = false;
+}
+
+HighLevelInterpreter::Value HighLevelInterpreter::decode_operand(const Operand &operand, const StorageLayout *layout,
+                                                                 bool is_address, long num_vregs,
+                                                                 const std::map<int, int> &mreg_assignment) {
+    Value value;
+    switch (operand.get_kind()) {
+        case OPERAND_VREG:
+        case OPERAND_VREG_MEMREF: {
+            // (as in AssemblyCodeGen::get_mreg)
+            value.kind = (operand.get_kind() == OPERAND_VREG) ? Value::VREG : Value::VREG_MEMREF;
+            value.n = operand.get_base_reg();
+            auto mreg = mreg_assignment.find(operand.get_base_reg());
+            if (Operand(operand).get_does_map_mreg() && mreg != mreg_assignment.end()) {
+                value.n = num_vregs + mreg->second;
+            }
+            return value;
+        }
+        case OPERAND_INT_LITERAL:
+            if (!is_address) {
+                value.kind = Value::LITERAL;
+                value.n = operand.get_int_value();
+                return value;
+            }
+            // (the address of the variable at a symbol table offset)
+            // fall through
+        case OPERAND_LOCAL_MEMREF: {
+            long offset = is_address ? operand.get_int_value() : operand.get_offset();
+            long variable = layout->find_variable(offset);
+            const StorageLayout::Placement &placement = layout->get_placement(variable);
+            if (placement.is_static) {
+                std::vector<long> &storage = m_statics[placement.label];
+                if (storage.empty()) {
+                    storage.assign(size_t(placement.size + 7) / 8, 0);
+                }
+                value.kind = is_address ? Value::STATIC_ADDRESS : Value::STATIC_MEMREF;
+                value.n = long(storage.data()) + (offset - variable);
+            } else {
+                value.kind = is_address ? Value::FRAME_ADDRESS : Value::FRAME_MEMREF;
+                value.n = placement.offset + (offset - variable);
+            }
+            return value;
+        }
+        default:
+            // (labels are resolved separately)
+            value.kind = Value::LITERAL;
+            value.n = 0;
+            return value;
+    }
+}
+
+void HighLevelInterpreter::link() {
+    for (auto f = m_functions.begin(); f != m_functions.end(); f++) {
+        for (auto i = f->calls.begin(); i != f->calls.end(); i++) {
+            unsigned callee = 0;
+            while (callee < m_functions.size() && m_functions[callee].label != i->second) {
+                callee++;
+            }
+            if (callee == m_functions.size()) {
+                err_fatal("Call of undefined function '%s'\n", i->second.c_str());
+            }
+            f->code[i->first].target = callee;
+        }
+    }
+    m_linked = true;
+}
+
+int HighLevelInterpreter::run() {
+    if (!m_linked) {
+        link();
+    }
+    if (m_functions.empty()) {
+        return 0;
+    }
+    call(0, nullptr, 0);
+
+    // (as the instrumented main does at its end, see profile.h)
+    if (!m_profile_file.empty()) {
+        FILE *out = fopen(m_profile_file.c_str(), "w");
+        if (out != nullptr) {
+            for (auto i = m_profile_counts.begin(); i != m_profile_counts.end(); i++) {
+                fprintf(out, "%ld\n", *i);
+            }
+            fclose(out);
+        }
+    }
+    return 0;
+}
+
+long HighLevelInterpreter::call(unsigned f, const long *args, unsigned num_args) {
+    Function &fn = m_functions[f];
+    std::vector<long> vregs(size_t(fn.num_values) + 1, 0);
+    std::vector<long> high(fn.uses_vectors ? vregs.size() : 0, 0);
+    std::vector<long> frame_storage(size_t(fn.frame_size + 7) / 8 + 1, 0);
+    long *v = vregs.data();
+    long *h = high.data();
+    unsigned char *frame = reinterpret_cast<unsigned char *>(frame_storage.data());
+
+    // the value of an operand, and the address of a memory operand
+    auto get = [&](const Value &value) -> long {
+        switch (value.kind) {
+            case Value::LITERAL:        return value.n;
+            case Value::VREG:           return v[value.n];
+            case Value::VREG_MEMREF:    return load(reinterpret_cast<unsigned char *>(v[value.n]));
+            case Value::FRAME_ADDRESS:  return long(frame + value.n);
+            case Value::FRAME_MEMREF:   return load(frame + value.n);
+            case Value::STATIC_ADDRESS: return value.n;
+            case Value::STATIC_MEMREF:  return load(reinterpret_cast<unsigned char *>(value.n));
+        }
+        return 0;
+    };
+    auto address = [&](const Value &value) -> unsigned char * {
+        switch (value.kind) {
+            case Value::FRAME_MEMREF:  return frame + value.n;
+            case Value::STATIC_MEMREF: return reinterpret_cast<unsigned char *>(value.n);
+            default:                   return reinterpret_cast<unsigned char *>(v[value.n]);
+        }
+    };
+
+    const Code *code = fn.code.data();
+    const Value *operands = fn.operands.data();
+    unsigned length = unsigned(fn.code.size());
+    unsigned long *opcode_counts = m_opcode_counts.data();
+    long cmp_l = 0, cmp_r = 0, result = 0;
+    unsigned pc = 0;
+    while (pc < length) {
+        const Code &ins = code[pc++];
+        const Value *op = operands + ins.first_operand;
+        if (ins.block >= 0) {
+            fn.block_counts[ins.block]++;
+        }
+        opcode_counts[ins.opcode]++;
+
+        switch (ins.opcode) {
+            case HINS_NOP:
+            case HINS_PREFETCH:
+                break;
+            case HINS_LOAD_ICONST:
+            case HINS_MOV:
+            case HINS_LOCALADDR:
+                v[op[0].n] = get(op[1]);
+                break;
+            case HINS_INT_ADD:
+                v[op[0].n] = long((unsigned long) get(op[1]) + (unsigned long) get(op[2]));
+                break;
+            case HINS_INT_SUB:
+                v[op[0].n] = long((unsigned long) get(op[1]) - (unsigned long) get(op[2]));
+                break;
+            case HINS_INT_MUL:
+                v[op[0].n] = long((unsigned long) get(op[1]) * (unsigned long) get(op[2]));
+                break;
+            case HINS_INT_DIV:
+            case HINS_INT_MOD: {
+                long l = get(op[1]), r = get(op[2]);
+                if (r == 0 || (l == LONG_MIN && r == -1)) {
+                    err_fatal("Error: division overflow (%ld / %ld)\n", l, r);
+                }
+                v[op[0].n] = (ins.opcode == HINS_INT_DIV) ? l / r : l % r;
+                break;
+            }
+            case HINS_UINT_DIV:
+            case HINS_UINT_MOD: {
+                unsigned long l = (unsigned long) get(op[1]), r = (unsigned long) get(op[2]);
+                if (r == 0) {
+                    err_fatal("Error: division overflow (%lu / %lu)\n", l, r);
+                }
+                v[op[0].n] = long((ins.opcode == HINS_UINT_DIV) ? l / r : l % r);
+                break;
+            }
+            case HINS_BOUNDS_CHECK: {
+                long index = get(op[0]), size = get(op[1]);
+                if (index < 0 || index >= size) {
+                    err_fatal("Error: array index out of bounds (%ld, with %ld elements)\n", index, size);
+                }
+                break;
+            }
+            case HINS_INT_NEGATE:
+                v[op[0].n] = long(0UL - (unsigned long) get(op[1]));
+                break;
+            case HINS_LEA:
+                v[op[0].n] = long((unsigned long) v[op[1].n] + (unsigned long) v[op[2].n] * (unsigned long) op[3].n);
+                break;
+            case HINS_LOAD_INT:
+                // (a literal source is the value itself, as in AssemblyCodeGen)
+                v[op[0].n] = (op[1].kind == Value::LITERAL) ? op[1].n : load(address(op[1]));
+                break;
+            case HINS_STORE_INT:
+                store(address(op[0]), get(op[1]));
+                break;
+            case HINS_LOAD_CHAR:
+                v[op[0].n] = *address(op[1]);
+                break;
+            case HINS_STORE_CHAR:
+                *address(op[0]) = (unsigned char) get(op[1]);
+                break;
+            case HINS_READ_INT:
+                if (m_use_runtime) {
+                    v[op[0].n] = __rt_read_int();
+                } else {
+                    // (the vreg is unchanged if no integer is read)
+                    long value = v[op[0].n];
+                    if (scanf("%ld", &value) == 1) {
+                        v[op[0].n] = value;
+                    }
+                }
+                break;
+            case HINS_WRITE_INT:
+                if (m_use_runtime) {
+                    __rt_write_int(get(op[0]));
+                } else {
+                    printf("%ld\n", get(op[0]));
+                }
+                break;
+            case HINS_WRITE_INT_ARRAY:
+                __rt_write_int_array(reinterpret_cast<const long *>(get(op[0])), get(op[1]));
+                break;
+            case HINS_READ_INT_ARRAY: {
+                unsigned char *dest = reinterpret_cast<unsigned char *>(get(op[0]));
+                long count = get(op[1]);
+                for (long k = 0; k < count; k++) {
+                    store(dest + 8 * k, __rt_read_int());
+                }
+                break;
+            }
+            case HINS_FILL_INT: {
+                unsigned char *dest = reinterpret_cast<unsigned char *>(get(op[0]));
+                long value = get(op[1]), count = get(op[2]);
+                for (long k = 0; k < count; k++) {
+                    store(dest + 8 * k, value);
+                }
+                break;
+            }
+            case HINS_COPY_INT: {
+                unsigned char *dest = reinterpret_cast<unsigned char *>(get(op[0]));
+                unsigned char *source = reinterpret_cast<unsigned char *>(get(op[1]));
+                memmove(dest, source, size_t(get(op[2])) * 8);
+                break;
+            }
+            case HINS_JUMP:
+                pc = ins.target;
+                break;
+            case HINS_JE:
+            case HINS_JNE:
+            case HINS_JLT:
+            case HINS_JLTE:
+            case HINS_JGT:
+            case HINS_JGTE:
+                if (test(ins.opcode, cmp_l, cmp_r)) {
+                    pc = ins.target;
+                }
+                break;
+            case HINS_INT_COMPARE:
+                cmp_l = get(op[0]);
+                cmp_r = get(op[1]);
+                break;
+            case HINS_CMOVE:
+            case HINS_CMOVNE:
+            case HINS_CMOVLT:
+            case HINS_CMOVLTE:
+            case HINS_CMOVGT:
+            case HINS_CMOVGTE:
+                v[op[0].n] = test(ins.opcode, cmp_l, cmp_r) ? get(op[1]) : get(op[2]);
+                break;
+            case HINS_VEC_LOAD: {
+                unsigned char *p = address(op[1]);
+                v[op[0].n] = load(p);
+                h[op[0].n] = load(p + 8);
+                break;
+            }
+            case HINS_VEC_STORE: {
+                unsigned char *p = address(op[0]);
+                store(p, v[op[1].n]);
+                store(p + 8, h[op[1].n]);
+                break;
+            }
+            case HINS_VEC_ADD:
+                v[op[0].n] = long((unsigned long) v[op[1].n] + (unsigned long) v[op[2].n]);
+                h[op[0].n] = long((unsigned long) h[op[1].n] + (unsigned long) h[op[2].n]);
+                break;
+            case HINS_VEC_SUB:
+                v[op[0].n] = long((unsigned long) v[op[1].n] - (unsigned long) v[op[2].n]);
+                h[op[0].n] = long((unsigned long) h[op[1].n] - (unsigned long) h[op[2].n]);
+                break;
+            case HINS_VEC_DUP:
+                v[op[0].n] = h[op[0].n] = get(op[1]);
+                break;
+            case HINS_PROFILE_COUNT:
+                m_profile_counts[size_t(op[0].n)]++;
+                break;
+            case HINS_PARAM:
+                v[op[0].n] = (op[1].n < long(num_args)) ? args[op[1].n] : 0;
+                break;
+            case HINS_CALL:
+            case HINS_CALL_PROC: {
+                unsigned first_arg = (ins.opcode == HINS_CALL) ? 2 : 1;
+                long call_args[MAX_ARGS];
+                for (unsigned j = first_arg; j < ins.num_operands; j++) {
+                    call_args[j - first_arg] = get(op[j]);
+                }
+                long value = call(ins.target, call_args, ins.num_operands - first_arg);
+                if (ins.opcode == HINS_CALL) {
+                    v[op[0].n] = value;
+                }
+                break;
+            }
+            case HINS_RETURN:
+                result = get(op[0]);
+                break;
+            case HINS_COLD:
+                // (the end of the function's hot code)
+                pc = length;
+                break;
+            default:
+                err_fatal("Can't interpret opcode %d\n", ins.opcode);
+        }
+    }
+    return result;
+}
+
+void HighLevelInterpreter::print_counts(FILE *out) const {
+    PrintHighLevelInstructionSequence printer(nullptr);
+    unsigned long total = 0;
+    for (auto i = m_opcode_counts.begin(); i != m_opcode_counts.end(); i++) {
+        total += *i;
+    }
+    fprintf(out, "%-24s %14lu\n", "instructions executed", total);
+    for (unsigned opcode = 0; opcode < m_opcode_counts.size(); opcode++) {
+        if (m_opcode_counts[opcode] != 0) {
+            fprintf(out, "  %-22s %14lu\n", printer.get_opcode_name(int(opcode)), m_opcode_counts[opcode]);
+        }
+    }
+    for (auto f = m_functions.begin(); f != m_functions.end(); f++) {
+        fprintf(out, "block executions in %s\n", f->label.c_str());
+        for (unsigned b = 0; b < f->block_names.size(); b++) {
+            fprintf(out, "  %-22s %14lu\n", f->block_names[b].c_str(), f->block_counts[b]);
+        }
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include "cfg.h"
+
+class StorageLayout;
+
+// Runs a program by interpreting its high-level code (see the -interp
+// option), to check the code generated or optimized without translating
+// it to x86-64, assembling and linking it.
+//
+// Each call of a function has a flat array of its vregs (a vector vreg
+// uses a second array for its second element), in which the vregs
+// assigned the same machine register by the register allocator share an
+// element (as the copies between them may have been removed), and a
+// zero-filled frame,
+// a byte array of the size of the variables placed in the function's
+// storage layout, which LOCALADDR and local memory references address;
+// the variables placed in .bss are shared by all of the functions.  READ
+// and WRITE call scanf and printf, or the runtime's functions with
+// set_use_runtime, so the output is the same as the compiled program's.
+// The instructions are decoded when a function is added: their operands
+// are resolved to literals, vregs and addresses (of a variable in the
+// frame or in .bss), and their labels to instruction indices.
+//
+// The interpreter counts the instructions executed with each opcode, and
+// the executions of each basic block (each instruction starting a block
+// of the flattened code).  A program instrumented with -fprofile-generate
+// (see profile.h) writes its profile when main ends, as the compiled
+// program would, so the interpreter can generate the profile used by
+// -fprofile-use.
+class HighLevelInterpreter {
+private:
+    // a decoded operand
+    struct Value {
+        enum Kind {
+            LITERAL,        // n is the value (or the label's index in calls)
+            VREG,           // n is the vreg number
+            VREG_MEMREF,    // the memory at the address in vreg n
+            FRAME_ADDRESS,  // n is an offset in the frame
+            FRAME_MEMREF,
+            STATIC_ADDRESS, // n is an address in .bss
+            STATIC_MEMREF,
+        } kind;
+        long n;
+    };
+
+    // a decoded instruction
+    struct Code {
+        int opcode;
+        unsigned first_operand, num_operands;
+        // the index of the instruction a branch targets, or of the
+        // function called
+        unsigned target;
+        // the block starting at the instruction (or -1 if it doesn't start one)
+        int block;
+    };
+
+    struct Function {
+        std::string label;
+        // the number of elements of the vreg array
+        long num_values;
+        long frame_size;
+        bool uses_vectors;
+        std::vector<Code> code;
+        std::vector<Value> operands;
+        // the calls, with the labels of the functions called (resolved by link)
+        std::vector<std::pair<unsigned, std::string>> calls;
+        // the label (or instruction index) and executions of each block
+        std::vector<std::string> block_names;
+        std::vector<unsigned long> block_counts;
+    };
+
+    std::vector<Function> m_functions;
+    bool m_linked;
+    // the storage of the variables in .bss, by label
+    std::map<std::string, std::vector<long>> m_statics;
+    bool m_use_runtime;
+    std::string m_profile_file;
+    std::vector<long> m_profile_counts;
+    std::vector<unsigned long> m_opcode_counts;
+
+    // disallow copy ctor and assignment operator
+    HighLevelInterpreter(const HighLevelInterpreter &);
+    HighLevelInterpreter &operator=(const HighLevelInterpreter &);
+
+public:
+    HighLevelInterpreter();
+    ~HighLevelInterpreter();
+
+    // call __rt_read_int/__rt_write_int (runtime.c) rather than scanf/printf
+    void set_use_runtime(bool use_runtime);
+
+    // write the counters of HINS_PROFILE_COUNT to the file when main ends
+    void set_profile(const std::string &filename, unsigned num_counters);
+
+    // add a function of the program (main first), with its label, code,
+    // storage layout, number of vregs and the machine registers assigned
+    // to its vregs (if it was optimized, see reg_alloc.h); a CFG is
+    // flattened first
+    void add_function(const std::string &label, InstructionSequence *iseq, StorageLayout *layout, long num_vregs,
+                      const std::map<int, int> &mreg_assignment = std::map<int, int>());
+    void add_function(const std::string &label, ControlFlowGraph *cfg, StorageLayout *layout, long num_vregs,
+                      const std::map<int, int> &mreg_assignment = std::map<int, int>());
+
+    // run the program, returning its exit status
+    int run();
+
+    // print the number of instructions executed with each opcode, and
+    // the number of executions of each block of each function
+    void print_counts(FILE *out) const;
+
+private:
+    // (the element of a vreg assigned a machine register is num_vregs
+    // plus the register's number)
+    Value decode_operand(const Operand &operand, const StorageLayout *layout, bool is_address,
+                         long num_vregs, const std::map<int, int> &mreg_assignment);
+
+    // resolve the calls of the functions
+    void link();
+
+    long call(unsigned f, const long *args, unsigned num_args);
+};
+
+#endif // INTERP_H
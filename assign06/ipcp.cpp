@@ -0,0 +1,362 @@
+#include <cassert>
+#include "cfg.h"
+#include "highlevel.h"
+#include "ssa.h"
+#include "loops.h"
+#include "stats.h"
+#include "ipcp.h"
+
+namespace {
+    // the block beginning with the "param" instructions (null if the
+    // entry block doesn't have a single successor)
+    BasicBlock *get_param_block(ControlFlowGraph *cfg) {
+        const ControlFlowGraph::EdgeList &entry_edges = cfg->get_outgoing_edges(cfg->get_entry_block());
+        return (entry_edges.size() == 1) ? entry_edges.front()->get_target() : nullptr;
+    }
+
+    bool is_vreg_def(Instruction *ins, int vreg) {
+        return HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG
+               && ins->get_operand(0).get_base_reg() == vreg;
+    }
+}
+
+InterproceduralConstantPropagation::InterproceduralConstantPropagation()
+        : m_optimize_size(false) {
+}
+
+InterproceduralConstantPropagation::~InterproceduralConstantPropagation() {
+}
+
+void InterproceduralConstantPropagation::add_function(const std::string &label, ControlFlowGraph *cfg,
+                                                      bool is_exported) {
+    unsigned index = unsigned(m_functions.size());
+    m_index[label] = index;
+
+    Function fn;
+    fn.label = label;
+    fn.cfg = cfg;
+    fn.size = 0;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        fn.size += (*i)->get_length();
+    }
+    fn.num_params = 0;
+    BasicBlock *param_block = get_param_block(cfg);
+    while (param_block != nullptr && fn.num_params < param_block->get_length()
+           && param_block->get_instruction(fn.num_params)->get_opcode() == HINS_PARAM) {
+        fn.num_params++;
+    }
+    fn.original = index;
+    fn.num_clones = 0;
+    fn.is_exported = is_exported;
+    m_functions.push_back(fn);
+}
+
+void InterproceduralConstantPropagation::run() {
+    for (unsigned f = 0; f < m_functions.size(); f++) {
+        find_calls(f);
+    }
+    propagate();
+    if (!m_optimize_size) {
+        specialize();
+    }
+
+    std::vector<ControlFlowGraph *> cfgs;
+    for (unsigned f = 0; f < m_functions.size(); f++) {
+        cfgs.push_back(transform_cfg(f));
+    }
+    for (unsigned f = 0; f < m_functions.size(); f++) {
+        m_functions[f].cfg = cfgs[f];
+    }
+}
+
+void InterproceduralConstantPropagation::find_calls(unsigned caller) {
+    Function &fn = m_functions[caller];
+    ControlFlowGraph *cfg = fn.cfg;
+    DominatorTree domtree(cfg);
+    LoopForest *loops = nullptr;
+
+    // the defs of each vreg (and the only one, for a vreg with one def),
+    // and the parameters' vregs
+    int num_vregs = HighLevel::get_num_vregs(cfg);
+    std::vector<unsigned> num_defs(unsigned(num_vregs), 0);
+    std::vector<std::pair<BasicBlock *, Instruction *>> single_def(num_defs.size());
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (unsigned j = 0; j < (*i)->get_length(); j++) {
+            Instruction *ins = (*i)->get_instruction(j);
+            if (HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG) {
+                int vreg = ins->get_operand(0).get_base_reg();
+                num_defs[unsigned(vreg)]++;
+                single_def[unsigned(vreg)] = std::make_pair(*i, ins);
+            }
+        }
+    }
+
+    auto classify = [&](Instruction *def, Argument &arg) {
+        if (def->get_opcode() == HINS_LOAD_ICONST && def->get_operand(1).get_kind() == OPERAND_INT_LITERAL) {
+            arg.kind = Argument::CONSTANT;
+            arg.constant = def->get_operand(1).get_int_value();
+        } else if (def->get_opcode() == HINS_PARAM && num_defs[unsigned(def->get_operand(0).get_base_reg())] == 1) {
+            arg.kind = Argument::PARAM;
+            arg.param = unsigned(def->get_operand(1).get_int_value());
+        }
+    };
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (unsigned j = 0; j < bb->get_length(); j++) {
+            Instruction *ins = bb->get_instruction(j);
+            if (!HighLevel::is_subprogram_call(ins)) {
+                continue;
+            }
+            unsigned label_index = (ins->get_opcode() == HINS_CALL) ? 1 : 0;
+            auto callee = m_index.find(ins->get_operand(label_index).get_target_label());
+            if (callee == m_index.end()) {
+                continue;
+            }
+
+            CallSite call;
+            call.block = bb->get_id();
+            call.index = j;
+            call.callee = callee->second;
+            for (unsigned k = label_index + 1; k < ins->get_num_operands(); k++) {
+                const Operand &operand = ins->get_operand(k);
+                Argument arg = { Argument::OTHER, 0, 0 };
+                if (operand.get_kind() == OPERAND_INT_LITERAL) {
+                    arg.kind = Argument::CONSTANT;
+                    arg.constant = operand.get_int_value();
+                } else if (operand.get_kind() == OPERAND_VREG) {
+                    // the last def before the call in its block, or else
+                    // the vreg's only def, if it dominates the call
+                    int vreg = operand.get_base_reg();
+                    int def_index = int(j) - 1;
+                    while (def_index >= 0 && !is_vreg_def(bb->get_instruction(unsigned(def_index)), vreg)) {
+                        def_index--;
+                    }
+                    if (def_index >= 0) {
+                        classify(bb->get_instruction(unsigned(def_index)), arg);
+                    } else if (num_defs[unsigned(vreg)] == 1 && domtree.dominates(single_def[unsigned(vreg)].first, bb)) {
+                        classify(single_def[unsigned(vreg)].second, arg);
+                    }
+                }
+                call.args.push_back(arg);
+            }
+
+            // (without a profile, the calls in loops are hot)
+            if (bb->get_count() >= 0) {
+                call.is_hot = bb->get_count() >= HOT_COUNT;
+            } else {
+                if (loops == nullptr) {
+                    loops = new LoopForest(cfg, domtree);
+                }
+                call.is_hot = loops->get_innermost_loop(bb) >= 0;
+            }
+            fn.calls.push_back(call);
+        }
+    }
+    delete loops;
+}
+
+void InterproceduralConstantPropagation::propagate() {
+    for (auto i = m_functions.begin(); i != m_functions.end(); i++) {
+        i->params.assign(i->num_params, Value{ i->is_exported ? Value::VARYING : Value::UNKNOWN, 0 });
+    }
+
+    // (the callers are visited first, from the main program, which is last)
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (unsigned caller = unsigned(m_functions.size()); caller-- > 0; ) {
+            const Function &fn = m_functions[caller];
+            for (auto i = fn.calls.begin(); i != fn.calls.end(); i++) {
+                Function &callee = m_functions[i->callee];
+                for (unsigned j = 0; j < callee.num_params; j++) {
+                    Value arg = { Value::VARYING, 0 };
+                    if (i->args.size() == callee.num_params) {
+                        const Argument &a = i->args[j];
+                        if (a.kind == Argument::CONSTANT) {
+                            arg = Value{ Value::CONSTANT, a.constant };
+                        } else if (a.kind == Argument::PARAM && a.param < fn.num_params) {
+                            arg = fn.params[a.param];
+                        }
+                    }
+
+                    Value &param = callee.params[j];
+                    Value meet = param;
+                    if (param.kind == Value::UNKNOWN) {
+                        meet = arg;
+                    } else if (arg.kind != Value::UNKNOWN && !(arg == param)) {
+                        meet = Value{ Value::VARYING, 0 };
+                    }
+                    if (!(meet == param)) {
+                        param = meet;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    for (auto i = m_functions.begin(); i != m_functions.end(); i++) {
+        for (auto j = i->params.begin(); j != i->params.end(); j++) {
+            if (j->kind == Value::CONSTANT) {
+                Statistics::get().add("ipcp.constant-params");
+            }
+        }
+    }
+}
+
+bool InterproceduralConstantPropagation::get_constant(unsigned caller, const Argument &arg, long &value) const {
+    const Function &fn = m_functions[caller];
+    if (arg.kind == Argument::CONSTANT) {
+        value = arg.constant;
+        return true;
+    }
+    if (arg.kind == Argument::PARAM && arg.param < fn.num_params && fn.params[arg.param].kind == Value::CONSTANT) {
+        value = fn.params[arg.param].constant;
+        return true;
+    }
+    return false;
+}
+
+std::map<unsigned, long> InterproceduralConstantPropagation::get_specialization(unsigned caller,
+                                                                                const CallSite &call) const {
+    std::map<unsigned, long> specialization;
+    const Function &callee = m_functions[call.callee];
+    if (call.args.size() != callee.num_params) {
+        return specialization;
+    }
+    for (unsigned j = 0; j < callee.num_params; j++) {
+        long value;
+        if (callee.params[j].kind == Value::VARYING && get_constant(caller, call.args[j], value)) {
+            specialization[j] = value;
+        }
+    }
+    return specialization;
+}
+
+int InterproceduralConstantPropagation::find_clone(unsigned callee, const std::map<unsigned, long> &specialization) const {
+    for (unsigned i = 0; i < m_functions.size(); i++) {
+        if (i != callee && m_functions[i].original == callee && m_functions[i].specialized == specialization) {
+            return int(i);
+        }
+    }
+    return -1;
+}
+
+void InterproceduralConstantPropagation::specialize() {
+    // clone the subprograms for the hot call sites in the original functions
+    unsigned num_original = unsigned(m_functions.size());
+    for (unsigned caller = 0; caller < num_original; caller++) {
+        for (unsigned i = 0; i < m_functions[caller].calls.size(); i++) {
+            const CallSite &call = m_functions[caller].calls[i];
+            unsigned callee = call.callee;
+            if (!call.is_hot || m_functions[callee].size > MAX_CLONE_SIZE
+                || m_functions[callee].num_clones >= MAX_CLONES) {
+                continue;
+            }
+            std::map<unsigned, long> specialization = get_specialization(caller, call);
+            if (specialization.empty() || find_clone(callee, specialization) >= 0) {
+                continue;
+            }
+
+            Function clone = m_functions[callee];
+            clone.label = clone.label + "." + std::to_string(++m_functions[callee].num_clones);
+            clone.original = callee;
+            clone.specialized = specialization;
+            for (auto j = specialization.begin(); j != specialization.end(); j++) {
+                clone.params[j->first] = Value{ Value::CONSTANT, j->second };
+            }
+            clone.num_clones = 0;
+            clone.is_exported = false;
+            m_index[clone.label] = unsigned(m_functions.size());
+            m_functions.push_back(clone);
+            Statistics::get().add("ipcp.clones");
+        }
+    }
+
+    // redirect the calls passing the constants of a clone to it (in the
+    // clones, too)
+    for (unsigned caller = 0; caller < m_functions.size(); caller++) {
+        Function &fn = m_functions[caller];
+        for (unsigned i = 0; i < fn.calls.size(); i++) {
+            std::map<unsigned, long> specialization = get_specialization(caller, fn.calls[i]);
+            int clone = specialization.empty() ? -1 : find_clone(fn.calls[i].callee, specialization);
+            if (clone >= 0) {
+                fn.redirected[i] = m_functions[unsigned(clone)].label;
+                Statistics::get().add("ipcp.redirected-calls");
+            }
+        }
+    }
+}
+
+ControlFlowGraph *InterproceduralConstantPropagation::transform_cfg(unsigned f) const {
+    const Function &fn = m_functions[f];
+    const Function &original = m_functions[fn.original];
+    ControlFlowGraph *cfg = original.cfg;
+    bool has_constants = false;
+    for (auto i = fn.params.begin(); i != fn.params.end(); i++) {
+        has_constants = has_constants || i->kind == Value::CONSTANT;
+    }
+    if (fn.original == f && !has_constants && fn.redirected.empty()) {
+        return cfg;
+    }
+
+    // (a clone's labels get the suffix of its label)
+    std::string suffix = fn.label.substr(original.label.size());
+    std::map<std::string, std::string> labels;
+    ControlFlowGraph *result = new ControlFlowGraph();
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        std::string label = orig->get_label();
+        if (!label.empty()) {
+            labels[label] = label + suffix;
+        }
+        BasicBlock *bb = result->create_basic_block(orig->get_kind(), label.empty() ? label : label + suffix);
+        bb->set_count(orig->get_count());
+        assert(bb->get_id() == orig->get_id());
+    }
+
+    std::map<std::pair<unsigned, unsigned>, std::string> redirected;
+    for (auto i = fn.redirected.begin(); i != fn.redirected.end(); i++) {
+        const CallSite &call = fn.calls[i->first];
+        redirected[std::make_pair(call.block, call.index)] = i->second;
+    }
+
+    BasicBlock *param_block = get_param_block(cfg);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        BasicBlock *bb = result->get_block(orig->get_id());
+        for (unsigned j = 0; j < orig->get_length(); j++) {
+            Instruction *copy = orig->get_instruction(j)->duplicate();
+            for (unsigned k = 0; k < copy->get_num_operands(); k++) {
+                Operand &op = (*copy)[k];
+                if (op.get_kind() == OPERAND_LABEL) {
+                    auto label = labels.find(op.get_target_label());
+                    if (label != labels.end()) {
+                        op = Operand(label->second);
+                    }
+                }
+            }
+
+            if (orig == param_block && j < fn.num_params && fn.params[j].kind == Value::CONSTANT) {
+                // (the argument passed is ignored)
+                Instruction *ldci = new Instruction(HINS_LOAD_ICONST, (*copy)[0],
+                                                    Operand(OPERAND_INT_LITERAL, fn.params[j].constant));
+                delete copy;
+                copy = ldci;
+            }
+            auto callee = redirected.find(std::make_pair(orig->get_id(), j));
+            if (callee != redirected.end()) {
+                (*copy)[(copy->get_opcode() == HINS_CALL) ? 1 : 0] = Operand(callee->second);
+            }
+            bb->add_instruction(copy);
+        }
+
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            result->create_edge(bb, result->get_block((*j)->get_target()->get_id()), (*j)->get_kind());
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,136 @@
+#ifndef IPCP_H
+#define IPCP_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "cfg.h"
+
+// Interprocedural constant propagation and specialization of the
+// program's subprograms, in the high-level CFGs of the functions (before
+// they are optimized, and before inlining).
+//
+// The arguments of each call of a subprogram are classified as integer
+// constants (a literal, or a vreg last set by "ldci" before the call), the
+// caller's parameters (a vreg only set by its "param" instruction), or
+// unknown.  The value of each parameter is then found by iterating over
+// the call graph to a fixed point: a parameter is constant if every call
+// passes it the same constant (directly, or through a constant parameter
+// of the caller, so that constants reach down a chain of calls), and its
+// "param" instruction becomes an "ldci" of the constant, which the
+// optimization passes can fold (the calls still pass the argument).
+//
+// A parameter which varies may still be constant at some call sites: a
+// hot call site (one whose block the profile shows is executed at least
+// HOT_COUNT times or, without a profile, one in a loop) passing constants
+// to some of them gets a clone of the subprogram specialized for those
+// constants, as if it was always called with them:
+//
+//   call vr4, f_sum, vr3, $8     becomes     call vr4, f_sum.1, vr3, $8
+//
+// where f_sum.1 loads the constant 8 into its second parameter, so that
+// e.g. a loop up to that parameter has a known trip count, and can be
+// unrolled.  The calls with the same constants share a clone, and a
+// clone's calls of its subprogram passing its constants (such as a
+// recursive call passing a parameter on) are redirected to the clone too.
+// Only subprograms of at most MAX_CLONE_SIZE instructions are cloned, at
+// most MAX_CLONES times each.  The clones are added after the original
+// functions, with the original's label and the clone's number (its block
+// labels get the same suffix, so they are unique in the program).  No
+// clones are made when optimizing for size (see set_optimize_size).
+class InterproceduralConstantPropagation {
+public:
+    static const unsigned MAX_CLONE_SIZE = 200;
+    static const unsigned MAX_CLONES = 4;
+    static const long HOT_COUNT = 1000;
+
+private:
+    // the value of a parameter (or argument), in the lattice of the
+    // propagation: UNKNOWN (no calls seen yet), a CONSTANT, or VARYING
+    struct Value {
+        enum Kind { UNKNOWN, CONSTANT, VARYING } kind;
+        long constant;
+
+        bool operator==(const Value &other) const {
+            return kind == other.kind && (kind != CONSTANT || constant == other.constant);
+        }
+    };
+
+    // an argument of a call: a constant, a parameter of the caller (whose
+    // index is param), or neither
+    struct Argument {
+        enum Kind { CONSTANT, PARAM, OTHER } kind;
+        long constant;
+        unsigned param;
+    };
+
+    struct CallSite {
+        unsigned block, index;   // (the position of the call in the caller's CFG)
+        unsigned callee;
+        std::vector<Argument> args;
+        bool is_hot;
+    };
+
+    struct Function {
+        std::string label;
+        ControlFlowGraph *cfg;
+        unsigned size;
+        unsigned num_params;
+        std::vector<CallSite> calls;
+        // the value of each parameter, after the propagation
+        std::vector<Value> params;
+        // (for a clone) the function it was made from, and the parameters
+        // it was specialized for
+        unsigned original;
+        std::map<unsigned, long> specialized;
+        // the labels of the subprograms to call instead, by the index of
+        // the call in calls
+        std::map<unsigned, std::string> redirected;
+        unsigned num_clones;
+        bool is_exported;
+    };
+
+    std::vector<Function> m_functions;
+    std::map<std::string, unsigned> m_index;
+    bool m_optimize_size;
+
+public:
+    InterproceduralConstantPropagation();
+    ~InterproceduralConstantPropagation();
+
+    void set_optimize_size(bool optimize_size) { m_optimize_size = optimize_size; }
+
+    // add the next function (callees first, and the main program last);
+    // an exported function (a subprogram of a unit) may also be called
+    // from other object files, so its parameters vary
+    void add_function(const std::string &label, ControlFlowGraph *cfg, bool is_exported = false);
+
+    // propagate the constants, and clone the subprograms for hot call sites
+    void run();
+
+    // the functions, including the clones (which follow the functions
+    // added)
+    unsigned get_num_functions() const { return unsigned(m_functions.size()); }
+
+    // the label and (transformed) CFG of the i-th function
+    const std::string &get_label(unsigned i) const { return m_functions[i].label; }
+    ControlFlowGraph *get_cfg(unsigned i) const { return m_functions[i].cfg; }
+
+    // the function the i-th function is a clone of (i, if it isn't a clone)
+    unsigned get_original(unsigned i) const { return m_functions[i].original; }
+
+private:
+    void find_calls(unsigned caller);
+    void propagate();
+    // the constant an argument has in a function (with the values of its
+    // parameters), if it is one
+    bool get_constant(unsigned caller, const Argument &arg, long &value) const;
+    // the constants a call site passes to the parameters of its callee
+    // which vary
+    std::map<unsigned, long> get_specialization(unsigned caller, const CallSite &call) const;
+    int find_clone(unsigned callee, const std::map<unsigned, long> &specialization) const;
+    void specialize();
+    ControlFlowGraph *transform_cfg(unsigned f) const;
+};
+
+#endif // IPCP_H
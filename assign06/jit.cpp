@@ -0,0 +1,192 @@
+#include <cassert>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <elf.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "util.h"
+#include "jit.h"
+
+// the functions of the buffered I/O runtime (runtime.c, which is linked
+// with the compiler)
+extern "C" {
+long __rt_read_int(void);
+void __rt_write_int(long val);
+void __rt_write_int_array(const long *elems, long count);
+void __rt_read_int_array(long *elems, long count);
+void __rt_fill_int(long *dest, long value, long count);
+void __rt_copy_int(long *dest, const long *source, long count);
+}
+
+namespace {
+    // a stub jumping to a library function: jmp *0(%rip), followed by
+    // the function's address (and padding)
+    const unsigned STUB_SIZE = 16;
+    const unsigned char STUB_JMP[] = { 0xFF, 0x25, 0x00, 0x00, 0x00, 0x00 };
+
+    // the size of the stack the program runs on
+    const unsigned long STACK_SIZE = 8 * 1024 * 1024;
+
+    unsigned long round_up(unsigned long n, unsigned long alignment) {
+        return (n + alignment - 1) / alignment * alignment;
+    }
+
+    // the program being run, and its exit status (set by run_main, which
+    // runs on the program's stack)
+    thread_local int (*s_main_function)(void);
+    thread_local int s_exit_status;
+
+    void run_main() {
+        s_exit_status = s_main_function();
+    }
+}
+
+JitProgram::JitProgram()
+        : m_bss_size(0)
+        , m_bss_alignment(1)
+        , m_image(nullptr)
+        , m_image_size(0) {
+}
+
+JitProgram::~JitProgram() {
+    if (m_image != nullptr) {
+        munmap(m_image, m_image_size);
+    }
+}
+
+void JitProgram::set_text(const std::vector<unsigned char> &code,
+                          const std::vector<X86_64Encoder::Relocation> &relocations) {
+    m_text = code;
+    m_relocations = relocations;
+}
+
+void JitProgram::add_rodata_string(const std::string &label, const std::string &s) {
+    assert(m_rodata_labels.count(label) == 0);
+    m_rodata_labels[label] = m_rodata.size();
+    m_rodata.insert(m_rodata.end(), s.begin(), s.end());
+    m_rodata.push_back(0);
+}
+
+void JitProgram::add_bss_variable(const std::string &label, unsigned long size, unsigned long alignment) {
+    assert(m_bss_labels.count(label) == 0);
+    m_bss_size = round_up(m_bss_size, alignment);
+    m_bss_labels[label] = m_bss_size;
+    m_bss_size += size;
+    m_bss_alignment = std::max(m_bss_alignment, alignment);
+}
+
+void JitProgram::load() {
+    assert(m_image == nullptr);
+
+    // the image is the code, followed by the stubs of the functions it
+    // calls and the read-only data (which are mapped read-only and
+    // executable), then the .bss variables, starting on a new page
+    std::map<std::string, unsigned long> stubs;
+    unsigned long stubs_start = round_up(m_text.size(), STUB_SIZE);
+    unsigned long stubs_end = stubs_start;
+    for (auto i = m_relocations.begin(); i != m_relocations.end(); i++) {
+        if (m_rodata_labels.count(i->symbol) == 0 && m_bss_labels.count(i->symbol) == 0
+                && stubs.count(i->symbol) == 0) {
+            stubs[i->symbol] = stubs_end;
+            stubs_end += STUB_SIZE;
+        }
+    }
+    unsigned long rodata_start = stubs_end;
+    unsigned long page_size = (unsigned long) sysconf(_SC_PAGESIZE);
+    unsigned long bss_start = round_up(rodata_start + m_rodata.size(), std::max(page_size, m_bss_alignment));
+    m_image_size = round_up(bss_start + m_bss_size, page_size);
+
+    void *image = mmap(nullptr, m_image_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (image == MAP_FAILED) {
+        err_fatal("Could not map %lu bytes of memory for the program\n", m_image_size);
+    }
+    m_image = static_cast<unsigned char *>(image);
+    std::copy(m_text.begin(), m_text.end(), m_image);
+    std::copy(m_rodata.begin(), m_rodata.end(), m_image + rodata_start);
+    for (auto i = stubs.begin(); i != stubs.end(); i++) {
+        void *function = get_function(i->first);
+        if (function == nullptr) {
+            err_fatal("Can't run a program calling '%s'\n", i->first.c_str());
+        }
+        unsigned char *stub = m_image + i->second;
+        std::copy(STUB_JMP, STUB_JMP + sizeof(STUB_JMP), stub);
+        memcpy(stub + sizeof(STUB_JMP), &function, sizeof(function));
+    }
+
+    for (auto i = m_relocations.begin(); i != m_relocations.end(); i++) {
+        unsigned long target;
+        if (m_rodata_labels.count(i->symbol) != 0) {
+            target = rodata_start + m_rodata_labels[i->symbol];
+        } else if (m_bss_labels.count(i->symbol) != 0) {
+            target = bss_start + m_bss_labels[i->symbol];
+        } else {
+            target = stubs[i->symbol];
+        }
+        long value;
+        if (i->type == R_X86_64_PC32 || i->type == R_X86_64_PLT32) {
+            // (the image is smaller than 2GB, so the displacement fits)
+            value = long(target) + i->addend - long(i->offset);
+        } else if (i->type == R_X86_64_32S) {
+            value = long(m_image + target) + i->addend;
+            if (value != long(int(value))) {
+                err_fatal("The address of '%s' doesn't fit in 32 bits\n", i->symbol.c_str());
+            }
+        } else {
+            err_fatal("Unsupported relocation type %u\n", i->type);
+        }
+        int field = int(value);
+        memcpy(m_image + i->offset, &field, sizeof(field));
+    }
+
+    if (mprotect(m_image, bss_start, PROT_READ | PROT_EXEC) != 0) {
+        err_fatal("Could not make the program's code executable\n");
+    }
+}
+
+int JitProgram::run() const {
+    assert(m_image != nullptr);
+
+    // the program runs on a stack of its own, which (as in a new process)
+    // is initially zero-filled, rather than on the compiler's
+    void *stack = mmap(nullptr, STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        err_fatal("Could not map the program's stack\n");
+    }
+    ucontext_t caller, program;
+    getcontext(&program);
+    program.uc_stack.ss_sp = stack;
+    program.uc_stack.ss_size = STACK_SIZE;
+    program.uc_link = &caller;
+    makecontext(&program, run_main, 0);
+    s_main_function = reinterpret_cast<int (*)(void)>(m_image);
+    swapcontext(&caller, &program);
+    munmap(stack, STACK_SIZE);
+    return s_exit_status;
+}
+
+void *JitProgram::get_function(const std::string &name) {
+    static const struct {
+        const char *name;
+        void *address;
+    } functions[] = {
+        { "printf",               reinterpret_cast<void *>(printf) },
+        { "scanf",                reinterpret_cast<void *>(scanf) },
+        { "fopen",                reinterpret_cast<void *>(fopen) },
+        { "fprintf",              reinterpret_cast<void *>(fprintf) },
+        { "fclose",               reinterpret_cast<void *>(fclose) },
+        { "__rt_read_int",        reinterpret_cast<void *>(__rt_read_int) },
+        { "__rt_write_int",       reinterpret_cast<void *>(__rt_write_int) },
+        { "__rt_write_int_array", reinterpret_cast<void *>(__rt_write_int_array) },
+        { "__rt_read_int_array",  reinterpret_cast<void *>(__rt_read_int_array) },
+        { "__rt_fill_int",        reinterpret_cast<void *>(__rt_fill_int) },
+        { "__rt_copy_int",        reinterpret_cast<void *>(__rt_copy_int) },
+    };
+    for (auto i = std::begin(functions); i != std::end(functions); i++) {
+        if (name == i->name) {
+            return i->address;
+        }
+    }
+    return nullptr;
+}
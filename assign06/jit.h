@@ -0,0 +1,61 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include "x86_64_encoder.h"
+
+// Loads the code of a program (encoded by X86_64Encoder) and its data
+// into executable memory in the compiler's process, so that it can be run
+// without assembling and linking it (see the -run option).
+//
+// The code, read-only data and .bss variables are mapped in the low 2GB
+// of the address space (as in a non-PIE executable), so that the 32-bit
+// absolute and %rip-relative relocations left by the encoder fit.  The
+// library functions called by the code (printf, scanf, the runtime's
+// functions, ...) are bound by address: each call goes through a stub
+// jumping to the function, which may be anywhere in memory.
+class JitProgram : public DataSections {
+private:
+    std::vector<unsigned char> m_text;
+    std::vector<X86_64Encoder::Relocation> m_relocations;
+    std::vector<unsigned char> m_rodata;
+    std::map<std::string, unsigned long> m_rodata_labels;
+    unsigned long m_bss_size;
+    unsigned long m_bss_alignment;
+    std::map<std::string, unsigned long> m_bss_labels;
+
+    // the memory the program is loaded into (null until load())
+    unsigned char *m_image;
+    unsigned long m_image_size;
+
+    // disallow copy ctor and assignment operator
+    JitProgram(const JitProgram &);
+    JitProgram &operator=(const JitProgram &);
+
+public:
+    JitProgram();
+    ~JitProgram();
+
+    void set_text(const std::vector<unsigned char> &code,
+                  const std::vector<X86_64Encoder::Relocation> &relocations);
+
+    void add_rodata_string(const std::string &label, const std::string &s) override;
+    void add_bss_variable(const std::string &label, unsigned long size, unsigned long alignment) override;
+
+    // map the program into memory and resolve its relocations (a fatal
+    // error if it calls a function which can't be bound)
+    void load();
+
+    // call the program's main (at the start of its code) on a new stack,
+    // returning its exit status
+    int run() const;
+
+private:
+    // the address of a library function called by the code (or null if
+    // it isn't one of the functions which can be bound)
+    static void *get_function(const std::string &name);
+};
+
+#endif // JIT_H
@@ -0,0 +1,123 @@
+#include "cfg.h"
+#include "x86_64.h"
+#include "stats.h"
+#include "jump_table.h"
+
+namespace {
+    const Operand R10(OPERAND_MREG, MREG_R10);
+    const Operand R11(OPERAND_MREG, MREG_R11);
+
+    bool reads_flags(int opcode) {
+        return X86_64::has_flags(opcode, MOP_BRANCH) || (opcode >= MINS_CMOVE && opcode <= MINS_CMOVGE);
+    }
+}
+
+JumpTableFormation::JumpTableFormation(InstructionSequence *iseq)
+        : m_iseq(iseq) {
+}
+
+JumpTableFormation::~JumpTableFormation() {
+}
+
+InstructionSequence *JumpTableFormation::transform() {
+    auto out = new InstructionSequence();
+    // the label created for the default of a table at the instruction
+    // after its run
+    std::string pending_label;
+
+    unsigned len = m_iseq->get_length();
+    unsigned i = 0;
+    while (i < len) {
+        if (m_iseq->has_label(i)) {
+            out->define_label(m_iseq->get_label(i));
+        } else if (!pending_label.empty()) {
+            out->define_label(pending_label);
+        }
+        pending_label.clear();
+
+        Run run;
+        if (!find_run(i, run)) {
+            out->add_instruction(m_iseq->get_instruction(i)->duplicate());
+            i++;
+            continue;
+        }
+
+        // the default is the instruction after the run (or the target of
+        // an unconditional jump there, which is then left out)
+        Instruction *next = m_iseq->get_instruction(run.end);
+        std::string default_label;
+        i = run.end;
+        if (m_iseq->has_label(run.end)) {
+            default_label = m_iseq->get_label(run.end);
+        } else if (next->get_opcode() == MINS_JMP) {
+            default_label = next->get_operand(0).get_target_label();
+            i++;
+        } else {
+            default_label = pending_label = StringTable::labels().new_label(".Ljt");
+        }
+
+        long min = run.targets.begin()->first, max = run.targets.rbegin()->first;
+        std::string table_label = StringTable::labels().new_label(".Ljt");
+        out->add_instruction(new Instruction(MINS_MOVQ, run.operand, R11));
+        if (min != 0) {
+            out->add_instruction(new Instruction(MINS_SUBQ, Operand(OPERAND_INT_LITERAL, min), R11));
+        }
+        // (an index below 0 is above the last entry as an unsigned number)
+        out->add_instruction(new Instruction(MINS_CMPQ, Operand(OPERAND_INT_LITERAL, max - min), R11));
+        out->add_instruction(new Instruction(MINS_JA, Operand(default_label)));
+        out->add_instruction(new Instruction(MINS_LEAQ, Operand(OPERAND_LABEL_MEMREF, table_label), R10));
+        out->add_instruction(new Instruction(MINS_MOVSLQ, Operand(OPERAND_MREG_MEMREF_OFFSET_INDEX, MREG_R10,
+                                                                  MREG_R11, 0, 4), R11));
+        out->add_instruction(new Instruction(MINS_ADDQ, R10, R11));
+        out->add_instruction(new Instruction(MINS_JMP_INDIRECT, R11));
+
+        out->define_label(table_label);
+        auto target = run.targets.begin();
+        for (long value = min; value <= max; value++) {
+            std::string label = default_label;
+            if (target->first == value) {
+                label = target->second;
+                target++;
+            }
+            out->add_instruction(new Instruction(MINS_JUMP_TABLE_ENTRY, Operand(label), Operand(table_label)));
+        }
+        Statistics::get().add("jumptable.tables");
+    }
+    if (m_iseq->has_label_at_end()) {
+        out->define_label(m_iseq->get_label_at_end());
+    }
+    return out;
+}
+
+bool JumpTableFormation::is_dense(unsigned long n, long min, long max) {
+    // (the difference of the values as an unsigned number can't overflow)
+    return n >= MIN_CASES && (unsigned long) max - (unsigned long) min < MAX_ENTRIES_PER_CASE * n;
+}
+
+bool JumpTableFormation::find_run(unsigned start, Run &run) const {
+    unsigned len = m_iseq->get_length();
+    unsigned i = start;
+    for (; i + 1 < len; i += 2) {
+        Instruction *compare = m_iseq->get_instruction(i);
+        Instruction *branch = m_iseq->get_instruction(i + 1);
+        if (compare->get_opcode() != MINS_CMPQ || branch->get_opcode() != MINS_JE
+                || (i > start && m_iseq->has_label(i)) || m_iseq->has_label(i + 1)) {
+            break;
+        }
+        Operand value = compare->get_operand(0), operand = compare->get_operand(1);
+        if (value.get_kind() != OPERAND_INT_LITERAL || (i > start && !(operand == run.operand))) {
+            break;
+        }
+        run.operand = operand;
+        // (the first branch on a value is the one taken)
+        run.targets.insert(std::make_pair(value.get_int_value(), branch->get_operand(0).get_target_label()));
+    }
+    run.end = i;
+
+    if (run.targets.empty() || i >= len
+            || !is_dense(run.targets.size(), run.targets.begin()->first, run.targets.rbegin()->first)) {
+        return false;
+    }
+    // the condition codes of the last comparison must not be used
+    return !reads_flags(m_iseq->get_instruction(i)->get_opcode());
+}
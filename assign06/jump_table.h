@@ -0,0 +1,72 @@
+#ifndef JUMP_TABLE_H
+#define JUMP_TABLE_H
+
+#include <map>
+#include <string>
+#include "cfg.h"
+
+// Jump table formation for the x86-64 code generated by AssemblyCodeGen
+// (after peephole optimization): a run of comparisons of the same operand
+// with constants, each followed by a branch if equal (as generated for a
+// cluster of the cases of a CASE statement, see HighLevelCodeGen's
+// emit_dispatch),
+//
+//     cmpq $3, %rbx
+//     je .L5
+//     cmpq $4, %rbx
+//     je .L6
+//     ...
+//     (the default)
+//
+// is replaced by a bounds check and an indirect jump through a table of the
+// targets' offsets from the table (so the code needs no relocations):
+//
+//     movq %rbx, %r11
+//     subq $3, %r11
+//     cmpq $(max - 3), %r11
+//     ja .Ldefault
+//     leaq .Ljt0(%rip), %r10
+//     movslq 0(%r10, %r11, 4), %r11
+//     addq %r10, %r11
+//     jmp *%r11
+// .Ljt0:
+//     .long .L5-.Ljt0
+//     .long .L6-.Ljt0
+//     ...
+//
+// if it has at least MIN_CASES distinct constants, which are dense (see
+// is_dense); the values between them which aren't compared branch to the
+// default.  The run may only be labeled at its first comparison, and the
+// condition codes must not be used after it.
+class JumpTableFormation {
+public:
+    static const unsigned long MIN_CASES = 4;
+    // a table may have at most this many entries per case
+    static const unsigned long MAX_ENTRIES_PER_CASE = 2;
+
+private:
+    InstructionSequence *m_iseq;
+
+    // a run of comparisons: its end (the index of the instruction after
+    // it), the operand compared, and the target of each constant
+    struct Run {
+        unsigned end;
+        Operand operand;
+        std::map<long, std::string> targets;
+    };
+
+public:
+    JumpTableFormation(InstructionSequence *iseq);
+    ~JumpTableFormation();
+
+    // get the transformed instruction sequence
+    InstructionSequence *transform();
+
+    // are n cases with values from min to max dense enough for a jump table?
+    static bool is_dense(unsigned long n, long min, long max);
+
+private:
+    bool find_run(unsigned start, Run &run) const;
+};
+
+#endif // JUMP_TABLE_H
@@ -0,0 +1,240 @@
+#include <cassert>
+#include "cfg.h"
+#include "highlevel.h"
+#include "jump_threading.h"
+
+JumpThreading::JumpThreading(ControlFlowGraph *cfg)
+        : m_cfg(cfg) {
+    m_blocks.resize(cfg->get_num_blocks());
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        thread_edges(*i);
+    }
+    find_reachable();
+    merge_blocks();
+}
+
+JumpThreading::~JumpThreading() {
+}
+
+ControlFlowGraph *JumpThreading::transform_cfg() {
+    ControlFlowGraph *result = new ControlFlowGraph();
+    unsigned num_blocks = m_cfg->get_num_blocks();
+
+    std::vector<bool> is_target(num_blocks, false);
+    for (unsigned i = 0; i < num_blocks; i++) {
+        const BlockInfo &info = m_blocks[i];
+        if (!info.reachable || info.merged) {
+            continue;
+        }
+        for (auto j = info.succs.begin(); j != info.succs.end(); j++) {
+            if (j->kind == EDGE_BRANCH) {
+                is_target[j->block] = true;
+            }
+        }
+    }
+
+    // create the blocks
+    std::vector<BasicBlock *> block_map(num_blocks, nullptr);
+    for (unsigned i = 0; i < num_blocks; i++) {
+        const BlockInfo &info = m_blocks[i];
+        if (!info.reachable || info.merged) {
+            continue;
+        }
+        BasicBlock *orig = m_cfg->get_block(i);
+        std::string label = orig->get_label();
+        if (is_target[i] && label.empty()) {
+            label = StringTable::labels().new_label(".Lthread");
+        }
+        block_map[i] = result->create_basic_block(orig->get_kind(), label);
+        block_map[i]->set_count(orig->get_count());
+    }
+
+    // add the instructions and edges
+    for (unsigned i = 0; i < num_blocks; i++) {
+        const BlockInfo &info = m_blocks[i];
+        BasicBlock *result_bb = block_map[i];
+        if (result_bb == nullptr) {
+            continue;
+        }
+
+        std::string target_label;
+        for (auto j = info.succs.begin(); j != info.succs.end(); j++) {
+            if (j->kind == EDGE_BRANCH) {
+                target_label = block_map[j->block]->get_label();
+            }
+        }
+
+        for (unsigned j = 0; j < info.instructions.size(); j++) {
+            Instruction *copy = info.instructions[j]->duplicate();
+            if (j + 1 == info.instructions.size() && info.has_branch) {
+                (*copy)[0] = Operand(target_label);
+            }
+            result_bb->add_instruction(copy);
+        }
+        if (info.add_jump) {
+            result_bb->add_instruction(new Instruction(HINS_JUMP, Operand(target_label)));
+        }
+
+        // don't leave a (possibly labeled) basic block without instructions
+        if (result_bb->get_length() == 0 && result_bb->get_kind() == BASICBLOCK_INTERIOR) {
+            result_bb->add_instruction(new Instruction(HINS_NOP));
+        }
+
+        for (auto j = info.succs.begin(); j != info.succs.end(); j++) {
+            result->create_edge(result_bb, block_map[j->block], j->kind);
+        }
+    }
+
+    return result;
+}
+
+bool JumpThreading::is_forwarding(BasicBlock *bb) const {
+    if (bb->get_kind() != BASICBLOCK_INTERIOR || m_cfg->get_outgoing_edges(bb).size() != 1) {
+        return false;
+    }
+    for (unsigned i = 0; i < bb->get_length(); i++) {
+        int opcode = bb->get_instruction(i)->get_opcode();
+        if (opcode != HINS_NOP && !(opcode == HINS_JUMP && i + 1 == bb->get_length())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool JumpThreading::ends_in_jump(BasicBlock *bb) const {
+    return bb->get_length() > 0 && bb->get_last()->get_opcode() == HINS_JUMP;
+}
+
+unsigned JumpThreading::resolve(unsigned id, bool fall_through_only) const {
+    // follow a chain of forwarding blocks (the number of steps is
+    // limited, in case the chain is an infinite loop)
+    for (unsigned steps = 0; steps < m_cfg->get_num_blocks(); steps++) {
+        BasicBlock *bb = m_cfg->get_block(id);
+        if (!is_forwarding(bb) || (fall_through_only && ends_in_jump(bb))) {
+            break;
+        }
+        // (the exit block has no label, and must only be reached by falling
+        // through from the block before it, so that one is kept)
+        BasicBlock *succ = m_cfg->get_outgoing_edges(bb)[0]->get_target();
+        if (succ->get_kind() == BASICBLOCK_EXIT) {
+            break;
+        }
+        id = succ->get_id();
+    }
+    return id;
+}
+
+void JumpThreading::thread_edges(BasicBlock *bb) {
+    BlockInfo &info = m_blocks[bb->get_id()];
+    info.instructions.assign(bb->cbegin(), bb->cend());
+    info.has_branch = false;
+    info.add_jump = false;
+    info.reachable = false;
+    info.merged = false;
+    info.num_preds = 0;
+
+    const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+    bool ends_in_branch = false;
+    for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+        if ((*i)->get_kind() == EDGE_BRANCH) {
+            ends_in_branch = true;
+        }
+    }
+
+    for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+        unsigned target = (*i)->get_target()->get_id();
+        if ((*i)->get_kind() == EDGE_BRANCH) {
+            info.succs.push_back({ resolve(target, false), EDGE_BRANCH });
+            info.has_branch = true;
+            continue;
+        }
+
+        // a fall-through edge can only skip blocks which also fall through,
+        // unless the block can jump to the destination instead
+        unsigned dest = resolve(target, true);
+        BasicBlock *dest_bb = m_cfg->get_block(dest);
+        if (!ends_in_branch && bb->get_kind() == BASICBLOCK_INTERIOR && is_forwarding(dest_bb)) {
+            info.succs.push_back({ resolve(dest, false), EDGE_BRANCH });
+            info.add_jump = true;
+        } else {
+            info.succs.push_back({ dest, EDGE_FALLTHROUGH });
+        }
+    }
+
+    remove_redundant_branch(info);
+}
+
+void JumpThreading::remove_redundant_branch(BlockInfo &info) const {
+    if (info.succs.size() != 2) {
+        return;
+    }
+
+    // a conditional branch to the block it falls through to isn't needed,
+    // nor one to where the blocks it falls through to only jump (once
+    // those are laid out before the target, their jump is removed too)
+    unsigned fall_through = (info.succs[0].kind == EDGE_FALLTHROUGH) ? 0 : 1;
+    unsigned dest = info.succs[fall_through].block, target = info.succs[1 - fall_through].block;
+    if (target == dest || target == resolve(dest, false)) {
+        assert(info.has_branch);
+        info.instructions.pop_back();
+        info.has_branch = false;
+        info.succs.assign(1, { dest, EDGE_FALLTHROUGH });
+    }
+}
+
+void JumpThreading::find_reachable() {
+    std::vector<unsigned> work_list;
+    unsigned entry = m_cfg->get_entry_block()->get_id();
+    m_blocks[entry].reachable = true;
+    work_list.push_back(entry);
+    while (!work_list.empty()) {
+        unsigned id = work_list.back();
+        work_list.pop_back();
+        std::vector<Successor> &succs = m_blocks[id].succs;
+        for (auto i = succs.begin(); i != succs.end(); i++) {
+            BlockInfo &succ = m_blocks[i->block];
+            succ.num_preds++;
+            if (!succ.reachable) {
+                succ.reachable = true;
+                work_list.push_back(i->block);
+            }
+        }
+    }
+}
+
+void JumpThreading::merge_blocks() {
+    for (unsigned i = 0; i < m_blocks.size(); i++) {
+        BlockInfo &info = m_blocks[i];
+        if (!info.reachable || info.merged || m_cfg->get_block(i)->get_kind() != BASICBLOCK_INTERIOR) {
+            continue;
+        }
+
+        while (info.succs.size() == 1) {
+            Successor succ = info.succs[0];
+            BlockInfo &succ_info = m_blocks[succ.block];
+            if (succ.block == i || succ_info.num_preds != 1 || succ_info.merged
+                || m_cfg->get_block(succ.block)->get_kind() != BASICBLOCK_INTERIOR) {
+                break;
+            }
+
+            // the jump to the successor isn't needed
+            if (succ.kind == EDGE_BRANCH) {
+                if (info.add_jump) {
+                    info.add_jump = false;
+                } else {
+                    assert(info.has_branch);
+                    info.instructions.pop_back();
+                }
+            }
+            info.instructions.insert(info.instructions.end(),
+                                     succ_info.instructions.begin(), succ_info.instructions.end());
+            info.succs = succ_info.succs;
+            info.has_branch = succ_info.has_branch;
+            info.add_jump = succ_info.add_jump;
+            succ_info.merged = true;
+            // (the successor's branch was checked against its own fall-through,
+            // so it is checked again rather than relying on that)
+            remove_redundant_branch(info);
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef JUMP_THREADING_H
+#define JUMP_THREADING_H
+
+#include <vector>
+#include "cfg.h"
+
+// Jump threading and branch simplification for a high-level CFG
+// (not in SSA form).
+//
+// A "forwarding" block is one containing nothing but HINS_NOPs and
+// (possibly) a final HINS_JUMP.  Branches to a forwarding block are
+// redirected to its final destination, as are fall-through edges when the
+// forwarding block also falls through (or when the predecessor can end with
+// the HINS_JUMP instead).  A conditional branch whose target is the block it
+// falls through to (or which the blocks it falls through to only forward
+// to) is removed, also where merging blocks leaves one.  Blocks which are no longer reachable are
+// removed, and then a block whose only successor has no other predecessor is
+// merged with that successor.  Blocks which become branch targets get a new
+// label if they don't have one.
+class JumpThreading {
+private:
+    struct Successor {
+        unsigned block;
+        EdgeKind kind;
+    };
+
+    // the transformed code, indexed by original block id
+    struct BlockInfo {
+        std::vector<Instruction *> instructions;   // (not owned)
+        std::vector<Successor> succs;
+        bool has_branch;           // the last instruction is a branch to the BRANCH successor
+        bool add_jump;             // a HINS_JUMP to the BRANCH successor must be added
+        bool reachable;
+        bool merged;               // merged into its predecessor
+        unsigned num_preds;
+    };
+
+    ControlFlowGraph *m_cfg;
+    std::vector<BlockInfo> m_blocks;
+
+public:
+    JumpThreading(ControlFlowGraph *cfg);
+    ~JumpThreading();
+
+    ControlFlowGraph *get_orig_cfg() { return m_cfg; }
+    ControlFlowGraph *transform_cfg();
+
+private:
+    bool is_forwarding(BasicBlock *bb) const;
+    bool ends_in_jump(BasicBlock *bb) const;
+    unsigned resolve(unsigned id, bool fall_through_only) const;
+    void thread_edges(BasicBlock *bb);
+    void remove_redundant_branch(BlockInfo &info) const;
+    void find_reachable();
+    void merge_blocks();
+};
+
+#endif // JUMP_THREADING_H
@@ -0,0 +1,273 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "ssa.h"
+#include "stats.h"
+#include "licm.h"
+
+namespace {
+    // where a vreg is defined: either in a basic block,
+    // or in the preheader of a loop
+    struct DefLocation {
+        BasicBlock *block;
+        int loop;
+    };
+}
+
+////////////////////////////////////////////////////////////////////////
+// LoopInvariantCodeMotion implementation
+////////////////////////////////////////////////////////////////////////
+
+LoopInvariantCodeMotion::LoopInvariantCodeMotion(ControlFlowGraph *cfg, const DominatorTree *domtree,
+                                                 const LoopForest *loops, const AliasAnalysis *alias)
+        : m_cfg(cfg)
+        , m_own_domtree(domtree != nullptr ? nullptr : new DominatorTree(cfg))
+        , m_domtree(domtree != nullptr ? *domtree : *m_own_domtree)
+        , m_own_loops(loops != nullptr ? nullptr : new LoopForest(cfg, m_domtree))
+        , m_loops(loops != nullptr ? *loops : *m_own_loops)
+        , m_alias(alias) {
+    m_hoisted.resize(m_loops.get_num_loops());
+    analyze();
+}
+
+LoopInvariantCodeMotion::~LoopInvariantCodeMotion() {
+    delete m_own_loops;
+    delete m_own_domtree;
+}
+
+ControlFlowGraph *LoopInvariantCodeMotion::transform_cfg() {
+    ControlFlowGraph *result = new ControlFlowGraph();
+
+    // map of basic blocks of original CFG to basic blocks in transformed CFG
+    std::map<BasicBlock *, BasicBlock *> block_map;
+
+    // an entry predecessor with no other successors is used as the preheader;
+    // otherwise a new block is needed on the entry edge
+    std::map<BasicBlock *, unsigned> pred_preheaders, split_headers;
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        const LoopForest::Loop &loop = m_loops.get_loop(i);
+        if (m_hoisted[i].empty()) {
+            continue;
+        }
+        if (loop.preheader != nullptr) {
+            pred_preheaders[loop.preheader] = i;
+        } else {
+            split_headers[loop.header] = i;
+        }
+    }
+
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        BasicBlock *result_bb = result->create_basic_block(orig->get_kind(), orig->get_label());
+        block_map[orig] = result_bb;
+        result_bb->set_count(orig->get_count());
+
+        const std::vector<Instruction *> *hoisted = nullptr;
+        auto p = pred_preheaders.find(orig);
+        if (p != pred_preheaders.end()) {
+            hoisted = &m_hoisted[p->second];
+        }
+
+        // The new preheader block will be created after all of the original
+        // blocks, so it will be the header's last predecessor: move the phi
+        // operands for the entry predecessor to the end.
+        int entry_index = -1;
+        auto h = split_headers.find(orig);
+        if (h != split_headers.end()) {
+            entry_index = int(SSA::get_pred_index(m_cfg, orig, m_loops.get_loop(h->second).entry_pred));
+        }
+
+        unsigned len = orig->get_length(), split = SSA::get_insertion_point(orig);
+        for (unsigned j = 0; j <= len; j++) {
+            if (j == split && hoisted != nullptr) {
+                for (auto k = hoisted->begin(); k != hoisted->end(); k++) {
+                    result_bb->add_instruction((*k)->duplicate());
+                }
+            }
+            if (j == len) {
+                break;
+            }
+
+            Instruction *ins = orig->get_instruction(j);
+            if (m_is_hoisted.count(ins) > 0) {
+                continue;
+            }
+            Instruction *copy = ins->duplicate();
+            if (SSA::is_phi(ins) && entry_index >= 0) {
+                std::vector<Operand> operands;
+                for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                    if (int(k) != entry_index + 1) {
+                        operands.push_back(ins->get_operand(k));
+                    }
+                }
+                operands.push_back(ins->get_operand(unsigned(entry_index + 1)));
+                delete copy;
+                copy = new Instruction(HINS_PHI, operands);
+            }
+            result_bb->add_instruction(copy);
+        }
+
+        // don't leave a (possibly labeled) basic block without instructions
+        if (result_bb->get_length() == 0 && len > 0) {
+            result_bb->add_instruction(new Instruction(HINS_NOP));
+        }
+    }
+
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+            Edge *orig_edge = *j;
+            BasicBlock *source = block_map[orig];
+            BasicBlock *target = block_map[orig_edge->get_target()];
+
+            auto h = split_headers.find(orig_edge->get_target());
+            if (h != split_headers.end() && m_loops.get_loop(h->second).entry_pred == orig) {
+                InstructionSequence preheader;
+                const std::vector<Instruction *> &hoisted = m_hoisted[h->second];
+                for (auto k = hoisted.begin(); k != hoisted.end(); k++) {
+                    preheader.add_instruction(*k);
+                }
+                SSA::split_edge(result, source, target, orig_edge->get_kind(), preheader);
+            } else {
+                result->create_edge(source, target, orig_edge->get_kind());
+            }
+        }
+    }
+
+    return result;
+}
+
+bool LoopInvariantCodeMotion::is_hoistable(Instruction *ins) {
+    for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+        if (ins->get_operand(i).is_memref()) {
+            return false;
+        }
+    }
+
+    switch (ins->get_opcode()) {
+        case HINS_LOAD_ICONST:
+        case HINS_LOCALADDR:
+        case HINS_MOV:
+        case HINS_INT_ADD:
+        case HINS_INT_SUB:
+        case HINS_INT_MUL:
+        case HINS_INT_NEGATE:
+            return true;
+
+        case HINS_INT_DIV:
+        case HINS_INT_MOD:
+        case HINS_UINT_DIV:
+        case HINS_UINT_MOD:
+            {
+                // moving a division which could trap would make a program
+                // fail even if the loop body never executes
+                Operand divisor = ins->get_operand(2);
+                return divisor.get_kind() == OPERAND_INT_LITERAL
+                       && divisor.get_int_value() != 0 && divisor.get_int_value() != -1;
+            }
+
+        default:
+            return false;
+    }
+}
+
+bool LoopInvariantCodeMotion::is_hoistable_load(Instruction *ins) const {
+    return m_alias != nullptr && ins->get_opcode() == HINS_LOAD_INT
+           && ins->get_operand(1).get_kind() == OPERAND_VREG_MEMREF && m_alias->is_in_bounds(ins->get_operand(1), 8);
+}
+
+void LoopInvariantCodeMotion::analyze() {
+    std::vector<DefLocation> defs(HighLevel::get_num_vregs(m_cfg), DefLocation{ nullptr, -1 });
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            if (HighLevel::is_def(*j)) {
+                defs[(*j)->get_operand(0).get_base_reg()] = DefLocation{ *i, -1 };
+            }
+        }
+    }
+
+    // is the definition at loc inside loop?
+    auto is_in_loop = [this](const DefLocation &loc, unsigned loop) {
+        const LoopForest::Loop &l = m_loops.get_loop(loop);
+        if (loc.loop >= 0) {
+            // a preheader is inside every loop containing both
+            // the entry predecessor and the header of its loop
+            const LoopForest::Loop &inner = m_loops.get_loop(unsigned(loc.loop));
+            return unsigned(loc.loop) != loop && l.contains(inner.entry_pred) && l.contains(inner.header);
+        }
+        return loc.block != nullptr && l.contains(loc.block);
+    };
+
+    // the instructions in each loop which may store to memory (if there
+    // are loads which could be hoisted)
+    std::vector<std::vector<Instruction *>> stores(m_loops.get_num_loops());
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end() && m_alias != nullptr; i++) {
+        std::vector<unsigned> loops = m_loops.get_enclosing_loops(*i);
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            if (HighLevel::has_flags((*j)->get_opcode(), HOP_STORE)
+                    || ((*j)->get_num_operands() > 0 && (*j)->get_operand(0).is_memref())) {
+                for (auto k = loops.begin(); k != loops.end(); k++) {
+                    stores[*k].push_back(*j);
+                }
+            }
+        }
+    }
+
+    // may a store in the loop overwrite the value a load reads?
+    auto is_clobbered = [&](Instruction *load, unsigned loop) {
+        const std::vector<Instruction *> &loop_stores = stores[loop];
+        for (auto i = loop_stores.begin(); i != loop_stores.end(); i++) {
+            Instruction *store = *i;
+            if (!store->get_operand(0).is_memref()
+                    || m_alias->may_alias(store->get_operand(0), AliasAnalysis::get_access_size(store),
+                                          load->get_operand(1), 8)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // visit blocks in reverse postorder, so that each operand's definition
+    // is visited (and possibly moved) before its use
+    const std::vector<BasicBlock *> &rpo = m_domtree.get_reverse_postorder();
+    for (auto i = rpo.begin(); i != rpo.end(); i++) {
+        BasicBlock *bb = *i;
+
+        std::vector<unsigned> loops = m_loops.get_enclosing_loops(bb);
+        if (loops.empty()) {
+            continue;
+        }
+
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            Instruction *ins = *j;
+            bool is_load = is_hoistable_load(ins);
+            if (!is_load && !is_hoistable(ins)) {
+                continue;
+            }
+
+            for (auto k = loops.begin(); k != loops.end(); k++) {
+                if (m_loops.get_loop(*k).entry_pred == nullptr) {
+                    continue;
+                }
+
+                bool invariant = !is_load || !is_clobbered(ins, *k);
+                for (unsigned m = 1; m < ins->get_num_operands() && invariant; m++) {
+                    Operand operand = ins->get_operand(m);
+                    if (operand.has_base_reg() && is_in_loop(defs[operand.get_base_reg()], *k)) {
+                        invariant = false;
+                    }
+                }
+
+                if (invariant) {
+                    m_hoisted[*k].push_back(ins);
+                    Statistics::get().add(is_load ? "licm.loads" : "licm.hoisted");
+                    m_is_hoisted.insert(ins);
+                    defs[ins->get_operand(0).get_base_reg()] = DefLocation{ nullptr, int(*k) };
+                    break;
+                }
+            }
+        }
+    }
+}
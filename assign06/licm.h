@@ -0,0 +1,60 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include <vector>
+#include <set>
+#include "cfg.h"
+#include "ssa.h"
+#include "loops.h"
+#include "alias.h"
+
+// Loop-invariant code motion for a high-level CFG in SSA form.
+//
+// A pure instruction (a constant load, local address, move, or integer
+// arithmetic which can't trap) is invariant in a loop if none of its operands
+// is defined in the loop, and is moved to the preheader of the outermost such
+// loop.  Because the CFG is in SSA form, the moved definition can't conflict with
+// any other definition, and because the instruction has no side effects it doesn't
+// matter that the preheader executes even if the loop body doesn't.
+//
+// Given an alias analysis (with the sizes of the variables), a HINS_LOAD_INT
+// through an invariant address is hoisted too, if no store in the loop may
+// alias it and the loop calls no subprograms.  The address must be at a
+// constant offset inside a variable (such as a record field), so that the
+// load can't fault when the loop body doesn't execute.
+//
+// The preheader of a loop is its header's predecessor outside the loop, if that
+// block has no other successors; otherwise, a new block is created on the entry
+// edge.  Loops whose header has several predecessors outside the loop are skipped.
+class LoopInvariantCodeMotion {
+private:
+    ControlFlowGraph *m_cfg;
+    DominatorTree *m_own_domtree;
+    const DominatorTree &m_domtree;
+    LoopForest *m_own_loops;
+    const LoopForest &m_loops;
+    const AliasAnalysis *m_alias;
+
+    // instructions moved to the preheader of each loop (indexed by loop)
+    std::vector<std::vector<Instruction *>> m_hoisted;
+    // instructions moved out of their block
+    std::set<Instruction *> m_is_hoisted;
+
+public:
+    // (the dominator tree and loops are computed if they aren't given;
+    // without an alias analysis, no loads are hoisted)
+    LoopInvariantCodeMotion(ControlFlowGraph *cfg, const DominatorTree *domtree = nullptr,
+                            const LoopForest *loops = nullptr, const AliasAnalysis *alias = nullptr);
+    ~LoopInvariantCodeMotion();
+
+    ControlFlowGraph *get_orig_cfg() { return m_cfg; }
+    ControlFlowGraph *transform_cfg();
+
+    static bool is_hoistable(Instruction *ins);
+
+private:
+    bool is_hoistable_load(Instruction *ins) const;
+    void analyze();
+};
+
+#endif // LICM_H
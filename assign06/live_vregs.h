@@ -1,55 +1,60 @@
 #ifndef LIVE_VREGS_H
 #define LIVE_VREGS_H
 
-#include <bitset>
 #include <vector>
 #include "cfg.h"
+#include "dataflow.h"
 #include "highlevel.h"
-
-class LiveVregs {
+#include "vreg_set.h"
+
+// The lattice of live vregs: the facts are sets of vregs (a VregSet is
+// sized to the number of vregs used in the CFG, and is sparse or dense
+// depending on how many vregs are live), and the meet is union.  The
+// transfer function of each block is precomputed as the vregs used in the
+// block before being defined (gen) and the vregs defined (kill).
+class LiveVregsLattice {
 public:
-    // we assume that there are never more than this many vregs used
-    static const unsigned MAX_VREGS = 256;
-
-    // We use a bitset to represent the set of live vregs.
-    // To check whether a vreg is live, check the bit indexed by
-    // its register number.
-    typedef std::bitset<MAX_VREGS> LiveSet;
-
-    // we assume there are never more than this many basic blocks
-    static const unsigned MAX_BLOCKS = 1024;
+    typedef VregSet Fact;
 
 private:
-    // the control flow graph
-    ControlFlowGraph *m_cfg;
-    // live vregs at end and beginning of each basic block
-    std::vector<LiveSet> m_endfacts, m_beginfacts;
-    // block iteration order
-    std::vector<unsigned> m_iter_order;
+    // number of vregs used in the control flow graph
+    unsigned m_num_vregs;
+    // gen and kill sets of each block (indexed by block id)
+    std::vector<VregSet> m_gen, m_kill;
 
 public:
-    LiveVregs(ControlFlowGraph *cfg);
-    ~LiveVregs();
+    LiveVregsLattice(ControlFlowGraph *cfg);
+
+    unsigned get_num_vregs() const { return m_num_vregs; }
 
-    // execute the analysis
-    void execute();
+    Fact get_top() const { return VregSet(m_num_vregs); }
+    Fact get_boundary() const { return VregSet(m_num_vregs); }
+    void meet(Fact &fact, const Fact &other) const { fact |= other; }
 
-    // get live vregs at end of specified block
-    const LiveSet &get_fact_at_end_of_block(BasicBlock *bb) const;
+    // live at beginning = gen | (live at end - kill)
+    void model_block(BasicBlock *bb, Fact &fact) const {
+        fact -= m_kill[bb->get_id()];
+        fact |= m_gen[bb->get_id()];
+    }
 
-    // get live vregs at beginning of specific block
-    const LiveSet &get_fact_at_beginning_of_block(BasicBlock *bb) const;
+    void model_instruction(Instruction *ins, Fact &fact) const;
+};
+
+// The live vregs analysis (a backward dataflow problem).
+class LiveVregs : public DataflowAnalysis<LiveVregsLattice, BackwardDataflow> {
+public:
+    typedef VregSet LiveSet;
 
-    // get live vregs after specified instruction
-    LiveSet get_fact_after_instruction(BasicBlock *bb, Instruction *ins) const;
+    LiveVregs(ControlFlowGraph *cfg);
+    ~LiveVregs();
 
-    // get live vregs before specified instruction
-    LiveSet get_fact_before_instruction(BasicBlock *bb, Instruction *ins) const;
+    // get the number of vregs (all vreg numbers are less than this)
+    unsigned get_num_vregs() const { return get_lattice().get_num_vregs(); }
 
-private:
-    void compute_iter_order();
-    void postorder_on_rcfg(std::bitset<MAX_BLOCKS> &visited, BasicBlock *bb);
-    void model_instruction(Instruction *ins, LiveSet &fact) const;
+    // model the effect of an instruction (backwards) on a set of live vregs
+    void model_instruction(Instruction *ins, LiveSet &fact) const {
+        get_lattice().model_instruction(ins, fact);
+    }
 };
 
 class LiveVregsControlFlowGraphPrinter : public HighLevelControlFlowGraphPrinter {
@@ -60,10 +65,10 @@ public:
     LiveVregsControlFlowGraphPrinter(ControlFlowGraph *cfg, LiveVregs *live_vregs);
     virtual ~LiveVregsControlFlowGraphPrinter();
 
-    virtual void print_basic_block(BasicBlock *bb);
-    virtual std::string format_instruction(BasicBlock *bb, Instruction *ins);
+    virtual void print_basic_block(OutputSink &out, BasicBlock *bb);
+    virtual void format_instruction(OutputSink &out, BasicBlock *bb, Instruction *ins);
 
-    static std::string format_set(const LiveVregs::LiveSet &live_set);
+    static void format_set(OutputSink &out, const LiveVregs::LiveSet &live_set);
 };
 
 #endif // LIVE_VREGS_H
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include <cassert>
+#include "cfg.h"
+#include "highlevel.h"
+#include "stats.h"
+#include "load_elim.h"
+
+namespace {
+    bool is_value(const Operand &operand) {
+        return operand.get_kind() == OPERAND_VREG || operand.get_kind() == OPERAND_INT_LITERAL;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// AvailableLoads implementation
+////////////////////////////////////////////////////////////////////////
+
+AvailableLoads::AvailableLoads(ControlFlowGraph *cfg, const AliasAnalysis &alias)
+        : m_alias(&alias)
+        , m_gvn(cfg) {
+}
+
+void AvailableLoads::meet(Fact &fact, const Fact &other) const {
+    if (!other.reachable) {
+        return;
+    }
+    if (!fact.reachable) {
+        fact = other;
+        return;
+    }
+
+    // a value is available only if the same one is available in both facts
+    for (auto i = fact.memory.begin(); i != fact.memory.end(); ) {
+        auto j = other.memory.find(i->first);
+        if (j == other.memory.end() || j->second != i->second) {
+            i = fact.memory.erase(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+void AvailableLoads::model_instruction(Instruction *ins, Fact &fact) const {
+    if (!fact.reachable) {
+        return;
+    }
+
+    MemoryMap &memory = fact.memory;
+    int opcode = ins->get_opcode();
+    int addr = get_address(ins);
+    if (opcode == HINS_LOAD_INT && addr >= 0) {
+        // (a load whose value is available keeps the operand holding it)
+        if (memory.find(addr) == memory.end()) {
+            memory[addr] = ins->get_operand(0);
+        }
+        return;
+    }
+    if (opcode == HINS_STORE_INT && addr >= 0 && is_value(ins->get_operand(1))) {
+        kill(memory, ins->get_operand(0), 8);
+        memory[addr] = ins->get_operand(1);
+        return;
+    }
+
+    if (HighLevel::has_flags(opcode, HOP_STORE) && !ins->get_operand(0).is_memref()) {
+        // (a call may store to any of the program's variables, and a
+        // fill or copy to a whole array)
+        memory.clear();
+    } else if (ins->get_num_operands() > 0 && ins->get_operand(0).is_memref()) {
+        kill(memory, ins->get_operand(0), AliasAnalysis::get_access_size(ins));
+    }
+}
+
+int AvailableLoads::get_address(Instruction *ins) const {
+    int opcode = ins->get_opcode();
+    unsigned k;
+    if (opcode == HINS_LOAD_INT) {
+        k = 1;
+    } else if (opcode == HINS_STORE_INT) {
+        k = 0;
+    } else {
+        return -1;
+    }
+    const Operand &operand = ins->get_operand(k);
+    return operand.get_kind() == OPERAND_VREG_MEMREF ? m_gvn.get_value_number(operand.get_base_reg()) : -1;
+}
+
+void AvailableLoads::kill(MemoryMap &memory, const Operand &memref, long size) const {
+    for (auto i = memory.begin(); i != memory.end(); ) {
+        Operand address = Operand(OPERAND_VREG, m_gvn.get_holder(i->first)).to_memref();
+        if (m_alias->may_alias(address, 8, memref, size)) {
+            i = memory.erase(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// RedundantLoadElimination implementation
+////////////////////////////////////////////////////////////////////////
+
+RedundantLoadElimination::RedundantLoadElimination(ControlFlowGraph *cfg, const AliasAnalysis *alias)
+        : ControlFlowGraphTransform(cfg)
+        , m_own_alias(alias != nullptr ? nullptr : new AliasAnalysis(cfg))
+        , m_available_loads(cfg, AvailableLoads(cfg, alias != nullptr ? *alias : *m_own_alias)) {
+    m_available_loads.execute();
+}
+
+RedundantLoadElimination::~RedundantLoadElimination() {
+    delete m_own_alias;
+}
+
+InstructionSequence *RedundantLoadElimination::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+
+    // values available at the beginning of the block
+    const AvailableLoads &lattice = m_available_loads.get_lattice();
+    AvailableLoads::Fact fact = m_available_loads.get_fact_at_beginning_of_block(bb);
+
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        Instruction *ins = *i;
+        int addr = fact.reachable ? lattice.get_address(ins) : -1;
+        auto found = addr >= 0 ? fact.memory.find(addr) : fact.memory.end();
+
+        Instruction *hin;
+        if (found == fact.memory.end()) {
+            hin = ins->duplicate();
+        } else if (ins->get_opcode() == HINS_LOAD_INT) {
+            // the value loaded is already in a vreg (or is a constant)
+            const Operand &value = found->second;
+            int opcode = value.get_kind() == OPERAND_VREG ? HINS_MOV : HINS_LOAD_ICONST;
+            hin = new Instruction(opcode, ins->get_operand(0), value);
+            Statistics::get().add("loadelim.loads");
+        } else if (lattice.get_gvn().same_value(ins->get_operand(1), found->second)) {
+            // the value stored is already there
+            Statistics::get().add("loadelim.stores");
+            continue;
+        } else {
+            hin = ins->duplicate();
+        }
+
+        lattice.model_instruction(ins, fact);
+        out->add_instruction(hin);
+    }
+
+    return out;
+}
@@ -0,0 +1,79 @@
+#ifndef LOAD_ELIM_H
+#define LOAD_ELIM_H
+
+#include <map>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "dataflow.h"
+#include "alias.h"
+#include "gvn.h"
+
+// The lattice of available memory values, for a CFG in SSA form: the
+// value at an address is available at a point if on every path to the
+// point it was stored there (or loaded from there), and nothing which may
+// store to the address comes after.  The facts map the value number of
+// each address (see GlobalValueNumbering) to the operand (a vreg or a
+// literal) holding the value.  A store forgets the values at the
+// addresses it may alias (see AliasAnalysis), and a call forgets
+// everything.
+class AvailableLoads : public DataflowLattice<AvailableLoads, ForwardDataflow> {
+public:
+    // map of address value numbers to the operand holding the value there
+    typedef std::map<int, Operand> MemoryMap;
+
+    struct Fact {
+        // the top fact (at the beginning of the unreachable blocks)
+        // is unreachable, and is the identity of the meet
+        bool reachable;
+        MemoryMap memory;
+
+        bool operator==(const Fact &other) const {
+            return reachable == other.reachable && memory == other.memory;
+        }
+    };
+
+private:
+    const AliasAnalysis *m_alias;
+    GlobalValueNumbering m_gvn;
+
+public:
+    AvailableLoads(ControlFlowGraph *cfg, const AliasAnalysis &alias);
+
+    Fact get_top() const { return Fact{ false, MemoryMap() }; }
+    Fact get_boundary() const { return Fact{ true, MemoryMap() }; }
+    void meet(Fact &fact, const Fact &other) const;
+    void model_instruction(Instruction *ins, Fact &fact) const;
+
+    // the value number of the address an instruction loads from (for
+    // HINS_LOAD_INT) or stores to (for HINS_STORE_INT), or -1
+    int get_address(Instruction *ins) const;
+
+    const GlobalValueNumbering &get_gvn() const { return m_gvn; }
+
+private:
+    void kill(MemoryMap &memory, const Operand &memref, long size) const;
+};
+
+// Redundant load elimination for the high-level CFG (in SSA form).  A
+// HINS_LOAD_INT from an address whose value is available (see
+// AvailableLoads) becomes a copy of the vreg holding the value (or loads
+// the constant stored there), and a HINS_STORE_INT of the value already
+// at its address is removed.  This extends the in-block load reuse of
+// LocalValueNumbering across blocks, e.g. to the reload of a[i] in a
+// block following an IF which assigned it on both branches.
+class RedundantLoadElimination : public ControlFlowGraphTransform {
+private:
+    AliasAnalysis *m_own_alias;
+    DataflowAnalysis<AvailableLoads, ForwardDataflow> m_available_loads;
+
+public:
+    // (the alias analysis is computed if it isn't given)
+    RedundantLoadElimination(ControlFlowGraph *cfg, const AliasAnalysis *alias = nullptr);
+    virtual ~RedundantLoadElimination();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+    virtual bool is_block_local() const { return true; }
+};
+
+#endif // LOAD_ELIM_H
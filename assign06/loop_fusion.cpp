@@ -0,0 +1,337 @@
+#include <cassert>
+#include "cfg.h"
+#include "highlevel.h"
+#include "alias.h"
+#include "stats.h"
+#include "loop_fusion.h"
+
+namespace {
+    // the instructions which only compute a value in a vreg
+    bool is_arithmetic(Instruction *ins) {
+        const unsigned flags = HOP_LOAD | HOP_STORE | HOP_CALL | HOP_SIDE_EFFECT | HOP_MAY_TRAP;
+        if (!HighLevel::is_def(ins) || HighLevel::has_flags(ins->get_opcode(), flags)
+                || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+            return false;
+        }
+        for (unsigned i = 1; i < ins->get_num_operands(); i++) {
+            if (ins->get_operand(i).is_memref()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // add the vregs an instruction defines and uses to the sets
+    void add_vregs(Instruction *ins, std::set<int> &defs, std::set<int> &uses) {
+        if (HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG) {
+            defs.insert(ins->get_operand(0).get_base_reg());
+        }
+        for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+            const Operand &operand = ins->get_operand(i);
+            if (HighLevel::is_use(ins, i)) {
+                uses.insert(operand.get_base_reg());
+            }
+            if (operand.has_index_reg()) {
+                uses.insert(operand.get_index_reg());
+            }
+        }
+    }
+
+    bool intersects(const std::set<int> &a, const std::set<int> &b) {
+        for (auto i = a.begin(); i != a.end(); i++) {
+            if (b.count(*i) > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the instructions of a block, other than a jump at its end
+    unsigned get_code_end(BasicBlock *bb) {
+        unsigned end = bb->get_length();
+        return (end > 0 && bb->get_last()->get_opcode() == HINS_JUMP) ? end - 1 : end;
+    }
+}
+
+LoopFusion::LoopFusion(ControlFlowGraph *cfg, const LoopForest &loops, const AliasAnalysis &alias)
+        : ControlFlowGraphTransform(cfg)
+        , m_cfg(cfg)
+        , m_loops(loops)
+        , m_alias(alias) {
+    // (a loop is only fused once in each run)
+    std::set<unsigned> fused;
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        for (unsigned j = 0; j < m_loops.get_num_loops(); j++) {
+            if (i != j && fused.count(i) == 0 && fused.count(j) == 0
+                    && fuse(m_loops.get_loop(i), m_loops.get_loop(j))) {
+                fused.insert(i);
+                fused.insert(j);
+                Statistics::get().add("fusion.loops");
+            }
+        }
+    }
+}
+
+LoopFusion::~LoopFusion() {
+    for (auto i = m_code.begin(); i != m_code.end(); i++) {
+        for (auto j = i->second.begin(); j != i->second.end(); j++) {
+            delete *j;
+        }
+    }
+}
+
+InstructionSequence *LoopFusion::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+    auto code = m_code.find(bb);
+    if (code == m_code.end()) {
+        for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+            out->add_instruction((*i)->duplicate());
+        }
+    } else {
+        for (auto i = code->second.begin(); i != code->second.end(); i++) {
+            out->add_instruction((*i)->duplicate());
+        }
+    }
+    return out;
+}
+
+bool LoopFusion::keep_basic_block(BasicBlock *orig) {
+    return m_removed.count(orig) == 0;
+}
+
+BasicBlock *LoopFusion::get_body(const LoopForest::Loop &loop) const {
+    // the loop must be a header, which only has the loop test,
+    // and a body, which is only entered from the header
+    BasicBlock *header = loop.header;
+    if (loop.blocks.size() != 2 || loop.entry_pred == nullptr) {
+        return nullptr;
+    }
+    BasicBlock *body = *loop.blocks.begin() != header ? *loop.blocks.begin() : *loop.blocks.rbegin();
+    if (m_cfg->get_outgoing_edges(body).size() != 1 || m_cfg->get_incoming_edges(body).size() != 1) {
+        return nullptr;
+    }
+    Edge *back_edge = m_cfg->lookup_edge(header, body);
+    if (header->get_length() != 2 || back_edge == nullptr || back_edge->get_kind() != EDGE_BRANCH) {
+        return nullptr;
+    }
+    Instruction *compare = header->get_instruction(0);
+    Instruction *branch = header->get_instruction(1);
+    if (compare->get_opcode() != HINS_INT_COMPARE
+            || (branch->get_opcode() != HINS_JLT && branch->get_opcode() != HINS_JLTE)) {
+        return nullptr;
+    }
+    return body;
+}
+
+bool LoopFusion::fuse(const LoopForest::Loop &first, const LoopForest::Loop &second) {
+    BasicBlock *first_body = get_body(first), *second_body = get_body(second);
+    BasicBlock *preheader = first.preheader;
+    if (first_body == nullptr || second_body == nullptr || preheader == nullptr) {
+        return false;
+    }
+
+    // the first loop must exit to the second loop's entry predecessor
+    // (and only to it)
+    BasicBlock *between = second.entry_pred;
+    if (m_cfg->lookup_edge(first.header, between) == nullptr
+            || m_cfg->get_incoming_edges(between).size() != 1 || m_cfg->get_outgoing_edges(between).size() != 1) {
+        return false;
+    }
+    BasicBlock *blocks[] = { preheader, first.header, first_body, between, second.header, second_body };
+    for (unsigned i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++) {
+        if (m_code.count(blocks[i]) > 0 || m_removed.count(blocks[i]) > 0) {
+            return false;
+        }
+    }
+    long trip_count = m_loops.get_trip_count(first);
+    if (trip_count < 0 || trip_count != m_loops.get_trip_count(second)) {
+        return false;
+    }
+
+    // the vregs each part defines and uses
+    std::set<int> first_defs, first_uses, second_defs, second_uses, moved_defs, moved_uses, variant;
+    for (unsigned i = 0; i < get_code_end(between); i++) {
+        Instruction *ins = between->get_instruction(i);
+        if (ins->get_opcode() != HINS_NOP && !is_arithmetic(ins)) {
+            return false;
+        }
+        add_vregs(ins, moved_defs, moved_uses);
+    }
+    const unsigned flags = HOP_CALL | HOP_SIDE_EFFECT | HOP_MAY_TRAP;
+    for (unsigned i = 0; i < 4; i++) {
+        BasicBlock *bb = (i < 2) ? (i == 0 ? first.header : first_body) : (i == 2 ? second.header : second_body);
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            if (HighLevel::has_flags((*j)->get_opcode(), flags)) {
+                return false;
+            }
+            add_vregs(*j, i < 2 ? first_defs : second_defs, i < 2 ? first_uses : second_uses);
+        }
+    }
+    if (intersects(first_defs, second_uses) || intersects(first_defs, second_defs)
+            || intersects(second_defs, first_uses) || intersects(first_defs, moved_uses)
+            || intersects(moved_defs, first_uses) || intersects(moved_defs, first_defs)) {
+        return false;
+    }
+
+    // the accesses of the two loops which may depend on each other must
+    // stay in order
+    std::set<int> preheader_uses;
+    for (auto i = preheader->cbegin(); i != preheader->cend(); i++) {
+        add_vregs(*i, variant, preheader_uses);
+    }
+    variant.insert(first_defs.begin(), first_defs.end());
+    variant.insert(second_defs.begin(), second_defs.end());
+    variant.insert(moved_defs.begin(), moved_defs.end());
+    std::vector<Access> first_accesses, second_accesses;
+    find_accesses(first_body, preheader, variant, first_accesses);
+    find_accesses(second_body, between, variant, second_accesses);
+    for (auto a = first_accesses.begin(); a != first_accesses.end(); a++) {
+        for (auto b = second_accesses.begin(); b != second_accesses.end(); b++) {
+            if ((a->is_store || b->is_store) && m_alias.may_alias(a->memref, a->size, b->memref, b->size)
+                    && !are_in_order(*a, *b, trip_count)) {
+                return false;
+            }
+        }
+    }
+
+    // move the code between the loops to the end of the preheader
+    std::vector<Instruction *> &code = m_code[preheader];
+    for (unsigned i = 0; i < get_code_end(preheader); i++) {
+        code.push_back(preheader->get_instruction(i)->duplicate());
+    }
+    for (unsigned i = 0; i < get_code_end(between); i++) {
+        code.push_back(between->get_instruction(i)->duplicate());
+    }
+    if (get_code_end(preheader) < preheader->get_length()) {
+        code.push_back(preheader->get_last()->duplicate());
+    }
+
+    std::vector<Instruction *> &jump = m_code[between];
+    if (get_code_end(between) < between->get_length()) {
+        jump.push_back(between->get_last()->duplicate());
+    } else {
+        jump.push_back(new Instruction(HINS_NOP));
+    }
+
+    // the second loop's body follows the first's, and its test is removed
+    std::vector<Instruction *> &body = m_code[first_body];
+    for (unsigned i = 0; i < get_code_end(first_body); i++) {
+        body.push_back(first_body->get_instruction(i)->duplicate());
+    }
+    for (unsigned i = 0; i < get_code_end(second_body); i++) {
+        body.push_back(second_body->get_instruction(i)->duplicate());
+    }
+    if (get_code_end(first_body) < first_body->get_length()) {
+        body.push_back(first_body->get_last()->duplicate());
+    }
+    m_code[second.header].push_back(new Instruction(HINS_NOP));
+    m_removed.insert(second_body);
+    return true;
+}
+
+void LoopFusion::find_accesses(BasicBlock *body, BasicBlock *entry, const std::set<int> &variant,
+                               std::vector<Access> &accesses) const {
+    // the step of each induction variable
+    std::map<int, long> steps;
+    std::set<int> defs, uses;
+    for (auto i = body->cbegin(); i != body->cend(); i++) {
+        add_vregs(*i, defs, uses);
+    }
+    for (auto i = defs.begin(); i != defs.end(); i++) {
+        AffineForm form;
+        if (AffineForm::get(body, body->get_length(), Operand(OPERAND_VREG, *i), form)
+                && form.terms.size() == 1 && form.terms.begin()->first == std::make_pair(*i, 0L)
+                && form.terms.begin()->second == 1) {
+            steps[*i] = form.constant;
+        }
+    }
+
+    for (unsigned i = 0; i < body->get_length(); i++) {
+        Instruction *ins = body->get_instruction(i);
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            const Operand &memref = ins->get_operand(j);
+            if (!memref.is_memref()) {
+                continue;
+            }
+            Access access;
+            access.index = i;
+            access.memref = memref;
+            access.size = AliasAnalysis::get_access_size(ins);
+            access.is_store = (j == 0 && HighLevel::is_def(ins));
+            access.is_affine = false;
+            accesses.push_back(access);
+
+            // the address in iteration k: the induction variables are
+            // replaced by their initial values (at the start of the entry
+            // block) plus k times their steps
+            AffineForm form, address;
+            if ((memref.get_kind() != OPERAND_VREG_MEMREF && memref.get_kind() != OPERAND_VREG_MEMREF_OFFSET)
+                    || !AffineForm::get(body, i, Operand(OPERAND_VREG, memref.get_base_reg()), form)) {
+                continue;
+            }
+            long stride = 0;
+            bool is_affine = true;
+            for (auto t = form.terms.begin(); t != form.terms.end() && is_affine; t++) {
+                int vreg = t->first.first;
+                AffineForm term;
+                auto step = steps.find(vreg);
+                if (step != steps.end()) {
+                    long increment;
+                    is_affine = !__builtin_mul_overflow(t->second, step->second, &increment)
+                                && !__builtin_add_overflow(stride, increment, &stride)
+                                && AffineForm::get(entry, entry->get_length(), Operand(OPERAND_VREG, vreg), term);
+                } else if (vreg >= 0 && defs.count(vreg) > 0) {
+                    is_affine = false;
+                } else {
+                    term.terms[t->first] = 1;
+                }
+                address.add(term, t->second);
+            }
+            if (!is_affine) {
+                continue;
+            }
+            address.constant += form.constant;
+            if (memref.get_kind() == OPERAND_VREG_MEMREF_OFFSET) {
+                address.constant += memref.get_offset();
+            }
+
+            // an address known exactly is a variable's address plus a constant
+            access.terms.constant = 0;
+            for (auto t = address.terms.begin(); t != address.terms.end() && is_affine; t++) {
+                int vreg = t->first.first;
+                AffineForm term;
+                if (vreg >= 0 && m_alias.get_value(vreg).kind == AliasAnalysis::Value::ADDRESS
+                        && m_alias.get_value(vreg).modulus == 0) {
+                    term.terms[std::make_pair(-1, m_alias.get_value(vreg).variable)] = 1;
+                    term.constant = m_alias.get_value(vreg).residue;
+                } else if (vreg >= 0 && variant.count(vreg) > 0) {
+                    is_affine = false;
+                } else {
+                    term.terms[t->first] = 1;
+                }
+                access.terms.add(term, t->second);
+            }
+            access.affine = AffineAccess{ stride, address.constant + access.terms.constant, access.size };
+            access.terms.constant = 0;
+            accesses.back() = access;
+            accesses.back().is_affine = is_affine;
+        }
+    }
+}
+
+bool LoopFusion::are_in_order(const Access &first, const Access &second, long trip_count) const {
+    // (the accesses' addresses must differ by a constant)
+    if (!first.is_affine || !second.is_affine || first.terms.terms != second.terms.terms) {
+        return false;
+    }
+    // the second access of a location must be in the same iteration as
+    // the first, or a later one
+    long distance;
+    long stride = first.affine.stride;
+    if (stride != 0 && (stride >= first.affine.size || -stride >= first.affine.size)
+            && DependenceTest::get_distance(first.affine, second.affine, distance)) {
+        return distance >= 0;
+    }
+    return !DependenceTest::may_depend(first.affine, second.affine, trip_count);
+}
@@ -0,0 +1,84 @@
+#ifndef LOOP_FUSION_H
+#define LOOP_FUSION_H
+
+#include <map>
+#include <set>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "loops.h"
+#include "dependence.h"
+
+class AliasAnalysis;
+
+// Loop fusion for a high-level CFG (not in SSA form): two adjacent loops
+// which do the same number of iterations, such as
+//
+//   i := 0;  WHILE i < N DO b[i] := a[i] + k; i := i + 1; END;
+//   i := 0;  WHILE i < N DO s := s + b[i]; i := i + 1; END;
+//
+// are merged into one loop doing the work of both in each iteration, so
+// that the arrays they share are only streamed through the cache once.
+//
+// Each loop must have the form vectorized by LoopVectorization (a header
+// containing only the loop test, and a single body block), and
+// LoopForest::get_trip_count must find that they have the same trip
+// count.  The first loop's exit must be the second loop's entry
+// predecessor, which may only compute values (without accessing memory)
+// used by the second loop, such as the initial value of its induction
+// variable: that code is moved to the first loop's preheader.  The second
+// loop's body is then appended to the first's, and its header's test is
+// removed (its induction variables still reach the same values).
+//
+// The loops are fused unless that would reorder dependent operations:
+//
+// - neither body may use (or define) a vreg which the other defines,
+//   and the moved code may not use or define a vreg the first loop defines
+// - neither body may call, have side effects (such as input or output)
+//   or trap
+// - for each memory access of the first loop and each access of the second
+//   (at least one of them a store) which AliasAnalysis can't separate, the
+//   addresses must be affine in the iteration number with the same
+//   loop-invariant terms, and DependenceTest must show that the second
+//   loop's access of each location comes in the same iteration as the
+//   first's or a later one (or never)
+class LoopFusion : public ControlFlowGraphTransform {
+private:
+    // a memory access in a loop body, with its address in iteration k as
+    // terms + stride * k + offset
+    struct Access {
+        unsigned index;
+        Operand memref;
+        long size;
+        bool is_store;
+        bool is_affine;
+        AffineForm terms;
+        AffineAccess affine;
+    };
+
+    ControlFlowGraph *m_cfg;
+    const LoopForest &m_loops;
+    const AliasAnalysis &m_alias;
+    // the new code of the blocks changed, and the blocks removed
+    std::map<BasicBlock *, std::vector<Instruction *>> m_code;
+    std::set<BasicBlock *> m_removed;
+
+public:
+    LoopFusion(ControlFlowGraph *cfg, const LoopForest &loops, const AliasAnalysis &alias);
+    virtual ~LoopFusion();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+    virtual bool keep_basic_block(BasicBlock *orig);
+
+private:
+    // find the body of a loop of the right form
+    BasicBlock *get_body(const LoopForest::Loop &loop) const;
+    bool fuse(const LoopForest::Loop &first, const LoopForest::Loop &second);
+    // find the accesses of a loop body (the vregs in variant may change
+    // between the two loops, so an address using one isn't affine)
+    void find_accesses(BasicBlock *body, BasicBlock *entry, const std::set<int> &variant,
+                       std::vector<Access> &accesses) const;
+    bool are_in_order(const Access &first, const Access &second, long trip_count) const;
+};
+
+#endif // LOOP_FUSION_H
@@ -0,0 +1,279 @@
+#include <cassert>
+#include <set>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "alias.h"
+#include "stats.h"
+#include "loop_idiom.h"
+
+namespace {
+    // the size of an array element
+    const long ELEMENT_SIZE = 8;
+
+    // the instructions other than the store and load which may be in the body
+    bool is_arithmetic(Instruction *ins) {
+        const unsigned flags = HOP_LOAD | HOP_STORE | HOP_CALL | HOP_SIDE_EFFECT | HOP_MAY_TRAP;
+        return HighLevel::is_def(ins) && !HighLevel::has_flags(ins->get_opcode(), flags)
+               && ins->get_operand(0).get_kind() == OPERAND_VREG;
+    }
+}
+
+LoopIdiomRecognition::LoopIdiomRecognition(ControlFlowGraph *cfg, const LoopForest &loops,
+                                           const LiveVregs &live_vregs, const AliasAnalysis &alias)
+        : ControlFlowGraphTransform(cfg)
+        , m_cfg(cfg)
+        , m_loops(loops)
+        , m_live_vregs(live_vregs)
+        , m_alias(alias)
+        , m_next_vreg(HighLevel::get_num_vregs(cfg)) {
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        BasicBlock *body = nullptr;
+        std::vector<Instruction *> code;
+        if (recognize(m_loops.get_loop(i), body, code)) {
+            m_bodies[body] = code;
+        }
+    }
+}
+
+LoopIdiomRecognition::~LoopIdiomRecognition() {
+    for (auto i = m_bodies.begin(); i != m_bodies.end(); i++) {
+        for (auto j = i->second.begin(); j != i->second.end(); j++) {
+            delete *j;
+        }
+    }
+}
+
+InstructionSequence *LoopIdiomRecognition::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+    auto body = m_bodies.find(bb);
+    if (body == m_bodies.end()) {
+        for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+            out->add_instruction((*i)->duplicate());
+        }
+    } else {
+        for (auto i = body->second.begin(); i != body->second.end(); i++) {
+            out->add_instruction((*i)->duplicate());
+        }
+    }
+    return out;
+}
+
+bool LoopIdiomRecognition::recognize(const LoopForest::Loop &loop, BasicBlock *&body,
+                                     std::vector<Instruction *> &code) {
+    // the loop must be a header, which only has the loop test,
+    // and a body, which is only entered from the header
+    BasicBlock *header = loop.header;
+    if (loop.blocks.size() != 2 || loop.entry_pred == nullptr) {
+        return false;
+    }
+    body = *loop.blocks.begin() != header ? *loop.blocks.begin() : *loop.blocks.rbegin();
+    if (m_cfg->get_outgoing_edges(body).size() != 1 || m_cfg->get_incoming_edges(body).size() != 1) {
+        return false;
+    }
+    Edge *back_edge = m_cfg->lookup_edge(header, body);
+    if (header->get_length() != 2 || back_edge == nullptr || back_edge->get_kind() != EDGE_BRANCH) {
+        return false;
+    }
+    Instruction *compare = header->get_instruction(0);
+    Instruction *branch = header->get_instruction(1);
+    if (compare->get_opcode() != HINS_INT_COMPARE
+            || (branch->get_opcode() != HINS_JLT && branch->get_opcode() != HINS_JLTE)) {
+        return false;
+    }
+    Operand counter = compare->get_operand(0), bound = compare->get_operand(1);
+    if (counter.get_kind() != OPERAND_VREG
+            || (bound.get_kind() != OPERAND_VREG && bound.get_kind() != OPERAND_INT_LITERAL)) {
+        return false;
+    }
+    long trip_count = m_loops.get_trip_count(loop);
+    if (trip_count >= 0 && trip_count < MIN_ITERATIONS) {
+        return false;
+    }
+
+    // find the store (and load), and the other definitions
+    std::set<int> defs;
+    int store = -1, load = -1;
+    for (unsigned i = 0; i < body->get_length(); i++) {
+        Instruction *ins = body->get_instruction(i);
+        int opcode = ins->get_opcode();
+        if (opcode == HINS_NOP || opcode == HINS_JUMP) {
+            continue;
+        }
+        if (opcode == HINS_STORE_INT && store < 0 && ins->get_operand(0).get_kind() == OPERAND_VREG_MEMREF) {
+            store = int(i);
+        } else if (opcode == HINS_LOAD_INT && load < 0 && ins->get_operand(0).get_kind() == OPERAND_VREG
+                   && ins->get_operand(1).get_kind() == OPERAND_VREG_MEMREF) {
+            load = int(i);
+            defs.insert(ins->get_operand(0).get_base_reg());
+        } else if (is_arithmetic(ins)) {
+            defs.insert(ins->get_operand(0).get_base_reg());
+        } else {
+            return false;
+        }
+    }
+    if (store < 0 || (bound.get_kind() == OPERAND_VREG && defs.count(bound.get_base_reg()) > 0)) {
+        return false;
+    }
+
+    // the vregs defined in the body which are used in later iterations
+    // (or after the loop) must be induction variables
+    std::map<int, long> steps;
+    const LiveVregs::LiveSet &live_out = m_live_vregs.get_fact_at_end_of_block(body);
+    for (auto i = defs.begin(); i != defs.end(); i++) {
+        if (!live_out.test(unsigned(*i))) {
+            continue;
+        }
+        AffineForm form;
+        if (!AffineForm::get(body, body->get_length(), Operand(OPERAND_VREG, *i), form)
+                || form.terms.size() != 1 || form.terms.begin()->first != std::make_pair(*i, 0L)
+                || form.terms.begin()->second != 1) {
+            return false;
+        }
+        steps[*i] = form.constant;
+    }
+    auto counter_step = steps.find(counter.get_base_reg());
+    if (counter_step == steps.end() || counter_step->second <= 0) {
+        return false;
+    }
+    long step = counter_step->second;
+
+    // consecutive iterations must access adjacent elements (an address
+    // may only depend on induction variables and loop-invariant values)
+    auto get_address = [&](unsigned index, const Operand &memref, AffineForm &form) {
+        if (!AffineForm::get(body, index, Operand(OPERAND_VREG, memref.get_base_reg()), form)) {
+            return false;
+        }
+        long stride = 0;
+        for (auto i = form.terms.begin(); i != form.terms.end(); i++) {
+            int vreg = i->first.first;
+            auto iv_step = steps.find(vreg);
+            if (iv_step != steps.end()) {
+                stride += i->second * iv_step->second;
+            } else if (vreg >= 0 && defs.count(vreg) > 0) {
+                return false;
+            }
+        }
+        return stride == ELEMENT_SIZE;
+    };
+    Instruction *sti = body->get_instruction(unsigned(store));
+    Operand value = sti->get_operand(1);
+    AffineForm dest, source;
+    if (!get_address(unsigned(store), sti->get_operand(0), dest)) {
+        return false;
+    }
+    if (load >= 0) {
+        // a copy: the loaded value is stored, to another variable
+        Instruction *ldi = body->get_instruction(unsigned(load));
+        if (load > store || !(value == ldi->get_operand(0))
+                || !get_address(unsigned(load), ldi->get_operand(1), source)) {
+            return false;
+        }
+        for (int i = load + 1; i < store; i++) {
+            Instruction *ins = body->get_instruction(unsigned(i));
+            if (HighLevel::is_def(ins) && ins->get_operand(0) == value) {
+                return false;
+            }
+        }
+        long dest_variable = get_variable(dest), source_variable = get_variable(source);
+        if (dest_variable < 0 || source_variable < 0 || dest_variable == source_variable) {
+            return false;
+        }
+    } else if (value.get_kind() != OPERAND_INT_LITERAL
+               && (value.get_kind() != OPERAND_VREG || defs.count(value.get_base_reg()) > 0)) {
+        // a fill, with a loop-invariant value
+        return false;
+    }
+
+    // the number of iterations: (bound - vrI + step - 1) / step (or
+    // (bound - vrI) / step + 1 for jlte), which is positive in the body
+    Operand count(OPERAND_VREG, m_next_vreg++);
+    code.push_back(new Instruction(HINS_INT_SUB, count, bound, counter));
+    long round = (branch->get_opcode() == HINS_JLTE) ? step : step - 1;
+    if (round != 0) {
+        code.push_back(new Instruction(HINS_INT_ADD, count, count, Operand(OPERAND_INT_LITERAL, round)));
+    }
+    if (step != 1) {
+        code.push_back(new Instruction(HINS_INT_DIV, count, count, Operand(OPERAND_INT_LITERAL, step)));
+    }
+
+    Operand dest_address = emit(dest, code);
+    if (load >= 0) {
+        Operand source_address = emit(source, code);
+        code.push_back(new Instruction(HINS_COPY_INT, dest_address, source_address, count));
+        Statistics::get().add("loopidiom.copies");
+    } else {
+        code.push_back(new Instruction(HINS_FILL_INT, dest_address, value, count));
+        Statistics::get().add("loopidiom.fills");
+    }
+
+    // the induction variables' values after the last iteration
+    for (auto i = steps.begin(); i != steps.end(); i++) {
+        Operand iv(OPERAND_VREG, i->first);
+        if (i->second == 1) {
+            code.push_back(new Instruction(HINS_INT_ADD, iv, iv, count));
+        } else if (i->second != 0) {
+            Operand increment(OPERAND_VREG, m_next_vreg++);
+            code.push_back(new Instruction(HINS_INT_MUL, increment, count, Operand(OPERAND_INT_LITERAL, i->second)));
+            code.push_back(new Instruction(HINS_INT_ADD, iv, iv, increment));
+        }
+    }
+    if (body->get_length() > 0 && body->get_last()->get_opcode() == HINS_JUMP) {
+        code.push_back(body->get_last()->duplicate());
+    }
+    return true;
+}
+
+long LoopIdiomRecognition::get_variable(const AffineForm &address) const {
+    // the address must be the address of a variable (or a pointer into
+    // it) plus integers
+    long variable = -1;
+    for (auto i = address.terms.begin(); i != address.terms.end(); i++) {
+        int vreg = i->first.first;
+        const AliasAnalysis::Value *value = vreg >= 0 ? &m_alias.get_value(vreg) : nullptr;
+        if (value != nullptr && value->kind == AliasAnalysis::Value::INTEGER) {
+            continue;
+        }
+        if (i->second != 1 || variable >= 0
+                || (value != nullptr && value->kind != AliasAnalysis::Value::ADDRESS)) {
+            return -1;
+        }
+        variable = (value != nullptr) ? value->variable : i->first.second;
+    }
+    return variable;
+}
+
+Operand LoopIdiomRecognition::emit(const AffineForm &form, std::vector<Instruction *> &code) {
+    // the sum of the terms (at the start of the body), plus the constant
+    Operand result;
+    bool has_terms = false;
+    for (auto i = form.terms.begin(); i != form.terms.end(); i++) {
+        Operand term(OPERAND_VREG, i->first.first);
+        if (i->first.first < 0) {
+            term = Operand(OPERAND_VREG, m_next_vreg++);
+            code.push_back(new Instruction(HINS_LOCALADDR, term, Operand(OPERAND_INT_LITERAL, i->first.second)));
+        }
+        if (i->second != 1) {
+            Operand product(OPERAND_VREG, m_next_vreg++);
+            code.push_back(new Instruction(HINS_INT_MUL, product, term, Operand(OPERAND_INT_LITERAL, i->second)));
+            term = product;
+        }
+        if (has_terms) {
+            Operand sum(OPERAND_VREG, m_next_vreg++);
+            code.push_back(new Instruction(HINS_INT_ADD, sum, result, term));
+            term = sum;
+        }
+        result = term;
+        has_terms = true;
+    }
+    if (!has_terms) {
+        return Operand(OPERAND_INT_LITERAL, form.constant);
+    }
+    if (form.constant != 0) {
+        Operand sum(OPERAND_VREG, m_next_vreg++);
+        code.push_back(new Instruction(HINS_INT_ADD, sum, result, Operand(OPERAND_INT_LITERAL, form.constant)));
+        result = sum;
+    }
+    return result;
+}
@@ -0,0 +1,73 @@
+#ifndef LOOP_IDIOM_H
+#define LOOP_IDIOM_H
+
+#include <map>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "loops.h"
+#include "dependence.h"
+
+class LiveVregs;
+class AliasAnalysis;
+
+// Loop idiom recognition for a high-level CFG (not in SSA form): a loop
+// which fills an array with a loop-invariant value, or copies the elements
+// of one array to another, is replaced by a single HINS_FILL_INT or
+// HINS_COPY_INT, lowered to "rep stosq" or "rep movsq" (or to a call of
+// the runtime, which uses non-temporal stores for large arrays).
+//
+// The loop must have the form vectorized by LoopVectorization: a header
+// containing only
+//
+//   cmpi vrI, bound
+//   jlt body              (or jlte)
+//
+// and a single body block, whose only stores and loads are
+//
+//   sti (vrA), value      (value is a loop-invariant operand), or
+//   ldi vrT, (vrB)
+//   sti (vrA), vrT        (vrA and vrB point into different variables)
+//
+// and whose other instructions are arithmetic.  The addresses must be
+// affine in the induction variables (see AffineForm), stepping by the size
+// of an integer, and every vreg defined in the body which is live at its
+// end must be an induction variable (vrI with a positive step, and bound
+// loop-invariant).  The body is rewritten to do all of the iterations at
+// once, and to set the induction variables to their values after the last
+// iteration:
+//
+//   body:  subi vrN, bound, vrI          (the number of iterations)
+//          (the address of the first element, and of its source)
+//          filli vrD, value, vrN         (or copyi vrD, vrS, vrN)
+//          addi vrI, vrI, vrN            (and the other induction variables)
+//
+// so the header's test then leaves the loop.  A loop known to do fewer
+// than MIN_ITERATIONS iterations is left alone.
+class LoopIdiomRecognition : public ControlFlowGraphTransform {
+public:
+    static const long MIN_ITERATIONS = 16;
+
+private:
+    ControlFlowGraph *m_cfg;
+    const LoopForest &m_loops;
+    const LiveVregs &m_live_vregs;
+    const AliasAnalysis &m_alias;
+    int m_next_vreg;
+    // the new code of the bodies of the loops replaced
+    std::map<BasicBlock *, std::vector<Instruction *>> m_bodies;
+
+public:
+    LoopIdiomRecognition(ControlFlowGraph *cfg, const LoopForest &loops, const LiveVregs &live_vregs,
+                         const AliasAnalysis &alias);
+    virtual ~LoopIdiomRecognition();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    bool recognize(const LoopForest::Loop &loop, BasicBlock *&body, std::vector<Instruction *> &code);
+    long get_variable(const AffineForm &address) const;
+    Operand emit(const AffineForm &form, std::vector<Instruction *> &code);
+};
+
+#endif // LOOP_IDIOM_H
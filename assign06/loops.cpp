@@ -0,0 +1,263 @@
+#include <cassert>
+#include <climits>
+#include <algorithm>
+#include <map>
+#include "cfg.h"
+#include "highlevel.h"
+#include "ssa.h"
+#include "loops.h"
+
+namespace {
+    bool is_vreg(const Operand &operand, int vreg) {
+        return operand.get_kind() == OPERAND_VREG && operand.get_base_reg() == vreg;
+    }
+
+    bool is_literal(const Operand &operand) {
+        return operand.get_kind() == OPERAND_INT_LITERAL;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// LoopForest implementation
+////////////////////////////////////////////////////////////////////////
+
+LoopForest::LoopForest(ControlFlowGraph *cfg, const DominatorTree &domtree)
+        : m_cfg(cfg)
+        , m_domtree(domtree) {
+    std::map<BasicBlock *, unsigned> header_to_loop;
+
+    const std::vector<BasicBlock *> &rpo = domtree.get_reverse_postorder();
+    for (auto i = rpo.begin(); i != rpo.end(); i++) {
+        BasicBlock *tail = *i;
+        const ControlFlowGraph::EdgeList &outgoing_edges = cfg->get_outgoing_edges(tail);
+        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+            BasicBlock *header = (*j)->get_target();
+            if (!domtree.dominates(header, tail)) {
+                continue;
+            }
+
+            // found a back edge
+            if (header_to_loop.find(header) == header_to_loop.end()) {
+                header_to_loop[header] = unsigned(m_loops.size());
+                Loop loop;
+                loop.header = header;
+                loop.blocks.insert(header);
+                loop.entry_pred = nullptr;
+                loop.preheader = nullptr;
+                loop.parent = -1;
+                loop.depth = 1;
+                m_loops.push_back(loop);
+            }
+            Loop &loop = m_loops[header_to_loop[header]];
+            if (loop.latches.empty() || loop.latches.back() != tail) {
+                loop.latches.push_back(tail);
+            }
+
+            // the loop body is everything which reaches the tail
+            // without going through the header
+            std::vector<BasicBlock *> work_list;
+            if (loop.blocks.insert(tail).second) {
+                work_list.push_back(tail);
+            }
+            while (!work_list.empty()) {
+                BasicBlock *bb = work_list.back();
+                work_list.pop_back();
+                const ControlFlowGraph::EdgeList &incoming_edges = cfg->get_incoming_edges(bb);
+                for (auto k = incoming_edges.cbegin(); k != incoming_edges.cend(); k++) {
+                    BasicBlock *pred = (*k)->get_source();
+                    if (domtree.is_reachable(pred) && loop.blocks.insert(pred).second) {
+                        work_list.push_back(pred);
+                    }
+                }
+            }
+        }
+    }
+
+    find_nesting();
+    find_edges();
+}
+
+LoopForest::~LoopForest() {
+}
+
+unsigned LoopForest::get_loop_depth(BasicBlock *bb) const {
+    int loop = get_innermost_loop(bb);
+    return loop < 0 ? 0 : m_loops[loop].depth;
+}
+
+std::vector<unsigned> LoopForest::get_enclosing_loops(BasicBlock *bb) const {
+    std::vector<unsigned> result(get_loop_depth(bb));
+    unsigned n = unsigned(result.size());
+    for (int loop = get_innermost_loop(bb); loop >= 0; loop = m_loops[loop].parent) {
+        result[--n] = unsigned(loop);
+    }
+    return result;
+}
+
+void LoopForest::find_nesting() {
+    // in a reducible CFG, loops are either nested or disjoint, so the
+    // innermost loop containing a block is the smallest one
+    m_innermost.assign(m_cfg->get_num_blocks(), -1);
+    for (unsigned i = 0; i < m_loops.size(); i++) {
+        for (auto j = m_loops[i].blocks.begin(); j != m_loops[i].blocks.end(); j++) {
+            int &innermost = m_innermost[(*j)->get_id()];
+            if (innermost < 0 || m_loops[innermost].blocks.size() > m_loops[i].blocks.size()) {
+                innermost = int(i);
+            }
+        }
+    }
+
+    // the parent of a loop is the smallest other loop containing its header
+    for (unsigned i = 0; i < m_loops.size(); i++) {
+        Loop &loop = m_loops[i];
+        for (unsigned j = 0; j < m_loops.size(); j++) {
+            if (j != i && m_loops[j].contains(loop.header)
+                    && (loop.parent < 0 || m_loops[loop.parent].blocks.size() > m_loops[j].blocks.size())) {
+                loop.parent = int(j);
+            }
+        }
+        if (loop.parent >= 0) {
+            m_loops[loop.parent].children.push_back(i);
+        }
+    }
+
+    // (a parent is larger than its children, so visiting the loops
+    // from the largest down finds each parent's depth first)
+    std::vector<std::vector<unsigned>> by_size(m_cfg->get_num_blocks() + 1);
+    for (unsigned i = 0; i < m_loops.size(); i++) {
+        by_size[m_loops[i].blocks.size()].push_back(i);
+    }
+    for (auto i = by_size.rbegin(); i != by_size.rend(); i++) {
+        for (auto j = i->begin(); j != i->end(); j++) {
+            Loop &loop = m_loops[*j];
+            loop.depth = loop.parent < 0 ? 1 : m_loops[loop.parent].depth + 1;
+        }
+    }
+}
+
+void LoopForest::find_edges() {
+    for (auto i = m_loops.begin(); i != m_loops.end(); i++) {
+        Loop &loop = *i;
+
+        std::vector<BasicBlock *> preds = SSA::get_predecessors(m_cfg, loop.header);
+        unsigned num_outside = 0;
+        for (auto j = preds.begin(); j != preds.end(); j++) {
+            if (!loop.contains(*j)) {
+                loop.entry_pred = *j;
+                num_outside++;
+            }
+        }
+        if (num_outside != 1) {
+            loop.entry_pred = nullptr;
+        } else if (loop.entry_pred->get_kind() == BASICBLOCK_INTERIOR
+                   && m_cfg->get_outgoing_edges(loop.entry_pred).size() == 1) {
+            loop.preheader = loop.entry_pred;
+        }
+
+        // (in the CFG's block order, so that the exits are in a consistent order)
+        for (auto j = m_cfg->bb_begin(); j != m_cfg->bb_end(); j++) {
+            if (!loop.contains(*j)) {
+                continue;
+            }
+            const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(*j);
+            for (auto k = outgoing_edges.cbegin(); k != outgoing_edges.cend(); k++) {
+                if (!loop.contains((*k)->get_target())) {
+                    loop.exits.push_back(*k);
+                }
+            }
+        }
+    }
+}
+
+bool LoopForest::find_constant_def(BasicBlock *bb, int vreg, long &value) const {
+    for (auto i = bb->crbegin(); i != bb->crend(); i++) {
+        Instruction *ins = *i;
+        if (!HighLevel::is_def(ins) || !is_vreg(ins->get_operand(0), vreg)) {
+            continue;
+        }
+        int opcode = ins->get_opcode();
+        if ((opcode == HINS_LOAD_ICONST || opcode == HINS_MOV) && is_literal(ins->get_operand(1))) {
+            value = ins->get_operand(1).get_int_value();
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+long LoopForest::get_trip_count(const Loop &loop) const {
+    BasicBlock *header = loop.header;
+    if (loop.entry_pred == nullptr || loop.exits.size() != 1 || loop.exits[0]->get_source() != header
+            || header->get_length() < 2) {
+        return -1;
+    }
+
+    // the loop continues while vrI < limit
+    Instruction *compare = header->get_instruction(header->get_length() - 2);
+    Instruction *branch = header->get_last();
+    if (compare->get_opcode() != HINS_INT_COMPARE || compare->get_operand(0).get_kind() != OPERAND_VREG
+            || !is_literal(compare->get_operand(1))) {
+        return -1;
+    }
+    int vreg = compare->get_operand(0).get_base_reg();
+    long bound = compare->get_operand(1).get_int_value();
+    bool branch_exits = loop.exits[0]->get_kind() == EDGE_BRANCH;
+    int opcode = branch->get_opcode();
+    long limit;
+    if (opcode == (branch_exits ? HINS_JGTE : HINS_JLT)) {
+        limit = bound;
+    } else if (opcode == (branch_exits ? HINS_JGT : HINS_JLTE) && bound < LONG_MAX) {
+        limit = bound + 1;
+    } else {
+        return -1;
+    }
+
+    // find the increment of vrI, which must execute once per iteration
+    Instruction *increment = nullptr;
+    BasicBlock *increment_bb = nullptr;
+    for (auto i = loop.blocks.begin(); i != loop.blocks.end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            if (HighLevel::is_def(*j) && is_vreg((*j)->get_operand(0), vreg)) {
+                if (increment != nullptr) {
+                    return -1;
+                }
+                increment = *j;
+                increment_bb = *i;
+            }
+        }
+    }
+    if (increment == nullptr || increment->get_opcode() != HINS_INT_ADD || increment_bb == header
+            || &m_loops[get_innermost_loop(increment_bb)] != &loop) {
+        return -1;
+    }
+    for (auto i = loop.latches.begin(); i != loop.latches.end(); i++) {
+        if (!m_domtree.dominates(increment_bb, *i)) {
+            return -1;
+        }
+    }
+    Operand left = increment->get_operand(1), right = increment->get_operand(2);
+    if (is_literal(left)) {
+        std::swap(left, right);
+    }
+    if (!is_vreg(left, vreg) || !is_literal(right) || right.get_int_value() <= 0) {
+        return -1;
+    }
+    unsigned long step = (unsigned long) right.get_int_value();
+
+    long start;
+    if (!find_constant_def(loop.entry_pred, vreg, start)) {
+        return -1;
+    }
+    if (start >= limit) {
+        return 0;
+    }
+
+    // vrI must not wrap around before it reaches the limit
+    unsigned long distance = (unsigned long) limit - (unsigned long) start;
+    unsigned long count = distance / step + (distance % step != 0 ? 1 : 0);
+    if (count > (unsigned long) LONG_MAX || count > ULONG_MAX / step
+            || count * step > (unsigned long) LONG_MAX - (unsigned long) start) {
+        return -1;
+    }
+    return long(count);
+}
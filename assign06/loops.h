@@ -0,0 +1,97 @@
+#ifndef LOOPS_H
+#define LOOPS_H
+
+#include <vector>
+#include <set>
+#include "cfg.h"
+#include "ssa.h"
+
+// Natural loops of a ControlFlowGraph, found from its back edges
+// (edges whose target dominates their source, see DominatorTree).  All
+// back edges to the same header are part of the same loop.
+//
+// The loops form a forest: since the loops of a reducible CFG are either
+// nested or disjoint, each loop's parent is the smallest loop containing
+// its header.  (Blocks of an irreducible cycle, which has no header
+// dominating the rest of it, aren't part of any loop.)
+//
+// The forest refers to the blocks of the CFG and to the dominator tree
+// it was built from, so it is only valid while neither changes.
+class LoopForest {
+public:
+    struct Loop {
+        BasicBlock *header;
+        std::set<BasicBlock *> blocks;  // including the header
+        // the single predecessor of the header outside the loop,
+        // or a null pointer if there are several
+        BasicBlock *entry_pred;
+        // the entry predecessor, if instructions added to its end run
+        // exactly once before the loop is entered (it is an interior
+        // block whose only successor is the header); otherwise a null
+        // pointer, and a block must be created on the entry edge
+        // (see SSA::split_edge) to hold them
+        BasicBlock *preheader;
+        // the blocks with a back edge to the header
+        std::vector<BasicBlock *> latches;
+        // the edges from a block of the loop to a block outside it
+        std::vector<Edge *> exits;
+        // the index of the innermost enclosing loop (or -1), the indices
+        // of the loops immediately nested in this one, and the number of
+        // loops this one is nested in (counting itself)
+        int parent;
+        std::vector<unsigned> children;
+        unsigned depth;
+
+        bool contains(BasicBlock *bb) const { return blocks.count(bb) > 0; }
+    };
+
+private:
+    ControlFlowGraph *m_cfg;
+    const DominatorTree &m_domtree;
+    std::vector<Loop> m_loops;
+    // the innermost loop containing each block (indexed by block id), or -1
+    std::vector<int> m_innermost;
+
+    // disallow copy ctor and assignment operator
+    LoopForest(const LoopForest &);
+    LoopForest &operator=(const LoopForest &);
+
+public:
+    LoopForest(ControlFlowGraph *cfg, const DominatorTree &domtree);
+    ~LoopForest();
+
+    unsigned get_num_loops() const { return unsigned(m_loops.size()); }
+    const Loop &get_loop(unsigned i) const { return m_loops[i]; }
+
+    // get the innermost loop containing a block (or -1)
+    int get_innermost_loop(BasicBlock *bb) const { return m_innermost.at(bb->get_id()); }
+
+    // get the number of loops containing a block
+    unsigned get_loop_depth(BasicBlock *bb) const;
+
+    // get the loops containing a block, outermost first
+    std::vector<unsigned> get_enclosing_loops(BasicBlock *bb) const;
+
+    // Get the number of times the body of a loop (of a CFG not in SSA
+    // form) executes when it is entered, if the loop is a WHILE loop
+    // counting up to a constant: the loop is left only by the test at the
+    // end of its header,
+    //
+    //   cmpi vrI, $C
+    //   jlt body              (or jlte, or jgte/jgt to the exit)
+    //
+    // vrI is set to a constant by the last instruction defining it in the
+    // entry predecessor (ldci or mov), and the only instruction defining vrI
+    // in the loop is "addi vrI, vrI, $step" with a positive step, in a block
+    // (other than the header) which isn't in a nested loop and dominates
+    // the latches, so that it executes once per iteration.  Returns -1 if
+    // the loop doesn't have this form (or vrI would overflow).
+    long get_trip_count(const Loop &loop) const;
+
+private:
+    void find_nesting();
+    void find_edges();
+    bool find_constant_def(BasicBlock *bb, int vreg, long &value) const;
+};
+
+#endif // LOOPS_H
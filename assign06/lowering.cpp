@@ -0,0 +1,374 @@
+#include <cassert>
+#include <algorithm>
+#include <set>
+#include "util.h"
+#include "cfg.h"
+#include "highlevel.h"
+#include "stack_slots.h"
+#include "output.h"
+#include "lowering.h"
+
+const long Lowering::WORD_SIZE;
+
+Lowering::Lowering(InstructionSequence *highlevelins, StorageLayout *storage_layout, long vreg_max, int stack_pointer)
+        : assembly(new InstructionSequence())
+        , hins(highlevelins)
+        , layout(storage_layout)
+        , num_vreg(vreg_max)
+        , stack_reg(stack_pointer)
+        // (computed by allocate_storage)
+        , local_storage_size(0)
+        , total_storage_size(0)
+        , local_storage_offset(0)
+        , use_runtime(false)
+        , comments(true)
+        , num_profile_counters(0)
+        , function_label("main")
+        , is_main(true)
+        , is_global(true) {
+}
+
+Lowering::~Lowering() {
+}
+
+void Lowering::set_function(const std::string &label, bool main) {
+    function_label = label;
+    is_main = main;
+    is_global = main;
+}
+
+void Lowering::set_profile(const std::string &filename, unsigned num_counters) {
+    profile_file = filename;
+    num_profile_counters = num_counters;
+}
+
+std::vector<StorageLayout::Placement> Lowering::get_static_variables() const {
+    return layout->get_static_variables();
+}
+
+std::string Lowering::get_bounds_trap_label() const {
+    // (with the suffix of the function's labels)
+    return ".Lbounds_trap" + (is_main ? std::string() : "_" + function_label);
+}
+
+void Lowering::emit_data(OutputSink &out, std::vector<StorageLayout::Placement> statics) {
+    out.put("\t.section .rodata\n");
+    out.put("s_readint_fmt: .string \"%ld\"\n");
+    out.put("s_writeint_fmt: .string \"%ld\\n\"\n");
+    if (num_profile_counters > 0) {
+        out.put("s_profile_file: .string \"");
+        for (auto i = profile_file.begin(); i != profile_file.end(); i++) {
+            if (*i == '"' || *i == '\\') {
+                out.put('\\');
+            }
+            out.put(*i);
+        }
+        out.put("\"\n");
+        out.put("s_profile_mode: .string \"w\"\n");
+    }
+    if (num_profile_counters > 0) {
+        StorageLayout::Placement counters;
+        counters.is_static = true;
+        counters.offset = 0;
+        counters.label = "__profile_counts";
+        counters.size = WORD_SIZE * num_profile_counters;
+        statics.push_back(counters);
+    }
+    if (!statics.empty()) {
+        out.put("\t.section .bss\n");
+        for (auto i = statics.begin(); i != statics.end(); i++) {
+            out.put("\t.balign ");
+            out.put_int(StorageLayout::get_static_alignment(i->size));
+            out.put('\n');
+            out.put(i->label);
+            out.put(": .zero ");
+            out.put_int(i->size);
+            out.put('\n');
+        }
+    }
+    out.put("\t.section .text\n");
+}
+
+void Lowering::allocate_storage(int first_vector_reg, unsigned num_vector_regs, const char *vector_reg_kind) {
+    std::vector<bool> needs_slot(num_vreg, false);
+    std::vector<bool> is_vector(num_vreg, false);
+    std::set<long> variables;
+    for (unsigned i = 0; i < hins->get_length(); i++) {
+        Instruction *hin = hins->get_instruction(i);
+        if (hin->get_opcode() == HINS_LOCALADDR) {
+            variables.insert(hin->get_operand(1).get_int_value());
+        }
+        for (unsigned j = 0; j < hin->get_num_operands(); j++) {
+            Operand operand = hin->get_operand(j);
+            if (operand.get_kind() == OPERAND_LOCAL_MEMREF) {
+                variables.insert(layout->find_variable(operand.get_offset()));
+            }
+            if (!operand.has_base_reg()) {
+                continue;
+            }
+            // (scanf always reads into the vreg's stack slot, and
+            // vectors are always in vector registers)
+            int vreg = operand.get_base_reg();
+            if (HighLevel::is_vector(hin, j)) {
+                mark_needs_slot(is_vector, vreg);
+                continue;
+            }
+            bool in_mreg = operand.get_does_map_mreg() && mreg_assignment.count(vreg) > 0;
+            if (!in_mreg || hin->get_opcode() == HINS_READ_INT) {
+                mark_needs_slot(needs_slot, vreg);
+            }
+            if (operand.has_index_reg()) {
+                mark_needs_slot(needs_slot, operand.get_index_reg());
+            }
+        }
+    }
+
+    HighLevelControlFlowGraphBuilder cfg_builder(hins);
+    ControlFlowGraph *cfg = cfg_builder.build();
+    StackSlotAllocation slots(cfg, needs_slot);
+
+    // the vector vregs are assigned vector registers the same way
+    vreg_vector.assign(is_vector.size(), -1);
+    if (std::find(is_vector.begin(), is_vector.end(), true) != is_vector.end()) {
+        StackSlotAllocation vector_regs(cfg, is_vector);
+        if (vector_regs.get_num_slots() > num_vector_regs) {
+            err_fatal("Too many vector values (%u) for the %s registers\n", vector_regs.get_num_slots(), vector_reg_kind);
+        }
+        for (unsigned v = 0; v < is_vector.size(); v++) {
+            if (is_vector[v]) {
+                vreg_vector[v] = first_vector_reg + int(vector_regs.get_slot(int(v)));
+            }
+        }
+    }
+
+    vreg_offset.assign(needs_slot.size(), -1);
+    for (unsigned v = 0; v < needs_slot.size(); v++) {
+        if (needs_slot[v]) {
+            vreg_offset[v] = long(slots.get_slot(int(v))) * WORD_SIZE;
+        }
+    }
+    layout->place_variables(variables);
+    local_storage_size = layout->get_frame_size();
+
+    // (the body runs with the stack pointer 16-byte aligned, so aligning
+    // the local storage keeps the arrays in it aligned)
+    local_storage_offset = long(slots.get_num_slots()) * WORD_SIZE;
+    if (local_storage_size > 0) {
+        local_storage_offset = (local_storage_offset + StorageLayout::FRAME_ALIGNMENT - 1)
+                / StorageLayout::FRAME_ALIGNMENT * StorageLayout::FRAME_ALIGNMENT;
+    }
+    total_storage_size = local_storage_offset + local_storage_size;
+}
+
+unsigned Lowering::get_hot_end(int cold_opcode) const {
+    unsigned len = assembly->get_length();
+    for (unsigned i = 0; i < len; i++) {
+        if (assembly->get_instruction(i)->get_opcode() == cold_opcode) {
+            return i;
+        }
+    }
+    return len;
+}
+
+std::vector<int> Lowering::get_saved_regs(Target target) const {
+    std::set<int> used;
+    for (auto i = assembly->cbegin(); i != assembly->cend(); i++) {
+        const Instruction *ins = *i;
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            Operand operand = ins->get_operand(j);
+            if (operand.get_kind() == OPERAND_MREG || (operand.is_memref() && operand.has_base_reg())) {
+                used.insert(operand.get_base_reg());
+            }
+            if (operand.has_index_reg()) {
+                used.insert(operand.get_index_reg());
+            }
+        }
+    }
+
+    std::vector<int> saved_regs;
+    const std::vector<int> &callee_saved = TargetRegisters::get(target).callee_saved;
+    for (auto i = callee_saved.begin(); i != callee_saved.end(); i++) {
+        if (used.count(*i) > 0) {
+            saved_regs.push_back(*i);
+        }
+    }
+    return saved_regs;
+}
+
+void Lowering::order_parallel_move(std::vector<std::pair<Operand, Operand>> moves, const Operand &scratch,
+                                   std::vector<std::pair<Operand, Operand>> &sequence) {
+    for (auto i = moves.begin(); i != moves.end(); ) {
+        if (i->first == i->second) {
+            i = moves.erase(i);
+        } else {
+            i++;
+        }
+    }
+
+    while (!moves.empty()) {
+        auto ready = moves.end();
+        for (auto i = moves.begin(); i != moves.end() && ready == moves.end(); i++) {
+            bool is_read = false;
+            for (auto j = moves.begin(); j != moves.end(); j++) {
+                is_read = is_read || (j != i && is_same_mreg(j->first, i->second));
+            }
+            if (!is_read) {
+                ready = i;
+            }
+        }
+
+        if (ready == moves.end()) {
+            // (every destination is read by another move, so none reads
+            // the scratch register)
+            Operand saved = moves.front().second;
+            sequence.push_back(std::make_pair(saved, scratch));
+            for (auto i = moves.begin(); i != moves.end(); i++) {
+                if (is_same_mreg(i->first, saved)) {
+                    i->first = scratch;
+                }
+            }
+            continue;
+        }
+
+        sequence.push_back(*ready);
+        moves.erase(ready);
+    }
+}
+
+void Lowering::set_hins_comment(Instruction *ins, Instruction *hin) {
+    if (comments) {
+        ins->set_comment(hin, format_hins_comment);
+    }
+}
+
+std::string Lowering::format_hins_comment(const Instruction *hin) {
+    PrintHighLevelInstructionSequence print_helper(nullptr);
+    return print_helper.format_instruction(hin);
+}
+
+void Lowering::mark_needs_slot(std::vector<bool> &needs_slot, int vreg) {
+    if (unsigned(vreg) >= needs_slot.size()) {
+        needs_slot.resize(vreg + 1, false);
+    }
+    needs_slot[vreg] = true;
+}
+
+bool Lowering::is_same_mreg(const Operand &a, const Operand &b) {
+    return a.get_kind() == OPERAND_MREG && b.get_kind() == OPERAND_MREG && a.get_base_reg() == b.get_base_reg();
+}
+
+void Lowering::get_magic_number(long divisor, long &multiplier, int &shift) {
+    const unsigned long two63 = 1UL << 63;
+    unsigned long ad = divisor;
+    unsigned long anc = two63 - 1 - two63 % ad;
+    int p = 63;
+    unsigned long q1 = two63 / anc, r1 = two63 - q1 * anc;
+    unsigned long q2 = two63 / ad, r2 = two63 - q2 * ad;
+    unsigned long delta;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    multiplier = long(q2 + 1);
+    shift = p - 64;
+}
+
+void Lowering::get_unsigned_magic_number(unsigned long divisor, unsigned long &multiplier, int &shift, bool &add) {
+    const unsigned long two63 = 1UL << 63;
+    unsigned long d = divisor;
+    int p = 63;
+    unsigned long q = (two63 - 1) / d, r = (two63 - 1) - q * d;
+    unsigned long p64 = 0, delta;
+    add = false;
+    do {
+        p++;
+        p64 = (p == 64) ? 1 : 2 * p64;
+        if (r + 1 >= d - r) {
+            add = add || q >= two63 - 1;
+            q = 2 * q + 1;
+            r = 2 * r + 1 - d;
+        } else {
+            add = add || q >= two63;
+            q = 2 * q;
+            r = 2 * r + 1;
+        }
+        delta = d - 1 - r;
+    } while (p < 128 && p64 < delta);
+
+    multiplier = q + 1;
+    shift = p - 64;
+}
+
+bool Lowering::is_quotient(int opcode) {
+    return opcode == HINS_INT_DIV || opcode == HINS_UINT_DIV;
+}
+
+bool Lowering::is_division_pair(Instruction *hin, Instruction *next) {
+    static const int PAIRS[][2] = {
+        { HINS_INT_DIV, HINS_INT_MOD }, { HINS_INT_MOD, HINS_INT_DIV },
+        { HINS_UINT_DIV, HINS_UINT_MOD }, { HINS_UINT_MOD, HINS_UINT_DIV },
+    };
+    bool is_pair = false;
+    for (unsigned k = 0; k < sizeof(PAIRS) / sizeof(PAIRS[0]); k++) {
+        is_pair = is_pair || (hin->get_opcode() == PAIRS[k][0] && next->get_opcode() == PAIRS[k][1]);
+    }
+    const Operand &dest = hin->get_operand(0);
+    return is_pair && next->get_operand(1) == hin->get_operand(1) && next->get_operand(2) == hin->get_operand(2)
+           && dest != hin->get_operand(1) && dest != hin->get_operand(2);
+}
+
+Operand Lowering::get_mreg(Operand vreg) const {
+    assert(vreg.has_base_reg());
+
+    if (vreg.get_does_map_mreg()) {
+        auto it = mreg_assignment.find(vreg.get_base_reg());
+        if (it != mreg_assignment.end()) {
+            return Operand(OPERAND_MREG, it->second);
+        }
+    }
+
+    return get_vreg_slot(vreg);
+}
+
+Operand Lowering::get_mreg_or_lit(Operand vreg_or_lit) const {
+    if (vreg_or_lit.get_kind() == OPERAND_INT_LITERAL) {
+        return vreg_or_lit;
+    } else {
+        return get_mreg(vreg_or_lit);
+    }
+}
+
+Operand Lowering::get_vreg_slot(Operand vreg) const {
+    assert(vreg.has_base_reg());
+
+    int vreg_num = vreg.get_base_reg();
+    assert(unsigned(vreg_num) < vreg_offset.size() && vreg_offset[vreg_num] >= 0);
+    return Operand(OPERAND_MREG_MEMREF_OFFSET, stack_reg, vreg_offset[vreg_num]);
+}
+
+Operand Lowering::get_vector_reg(Operand vreg) const {
+    int vreg_num = vreg.get_base_reg();
+    assert(unsigned(vreg_num) < vreg_vector.size() && vreg_vector[vreg_num] >= 0);
+    return Operand(OPERAND_MREG, vreg_vector[vreg_num]);
+}
+
+Operand Lowering::get_local_memref(const Operand &local) const {
+    long variable = layout->find_variable(local.get_offset());
+    const StorageLayout::Placement &placement = layout->get_placement(variable);
+    assert(!placement.is_static);
+    long offset = local_storage_offset + placement.offset + (local.get_offset() - variable);
+    return Operand(OPERAND_MREG_MEMREF_OFFSET, stack_reg, int(offset));
+}
@@ -0,0 +1,177 @@
+#ifndef LOWERING_H
+#define LOWERING_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "cfg.h"
+#include "storage_layout.h"
+#include "target.h"
+
+class OutputSink;
+
+// Translation of a function's high-level code (after register allocation,
+// see reg_alloc.h) to a target's assembly code: the interface the code
+// generator of each target implements (AssemblyCodeGen, for x86-64, and
+// AArch64Lowering, see aarch64_lowering.h), and what they share.
+//
+// The vregs without a machine register are kept in stack slots, where
+// vregs which are never live at the same time share a slot (see
+// StackSlotAllocation).  The slots come first, at the bottom of the
+// frame (at the stack pointer), since they are used most often, followed
+// by the local storage (the variables whose addresses are used, placed by
+// StorageLayout): HINS_LOCALADDR with $N is offset
+// local_storage_offset + N from the stack pointer, and vrN is offset
+// vreg_offset[N].  The vector vregs (see vectorize.h) are each assigned a
+// vector register in the same way, and are never in memory.
+class Lowering {
+private:
+    // disallow copy ctor and assignment operator
+    Lowering(const Lowering &);
+    Lowering &operator=(const Lowering &);
+
+protected:
+    static const long WORD_SIZE = 8;
+
+    InstructionSequence *assembly;
+    InstructionSequence *hins;
+    StorageLayout *layout;
+    long num_vreg;
+    // the stack pointer, which the slots and local storage are addressed from
+    int stack_reg;
+    long local_storage_size;
+    // total is local_storage_size + (WORD_SIZE * number of vreg slots)
+    long total_storage_size;
+    long local_storage_offset;
+
+    // offset of each vreg's stack slot (or -1 if it doesn't have one)
+    std::vector<long> vreg_offset;
+
+    // vector register of each vector vreg (or -1 if it isn't a vector)
+    std::vector<int> vreg_vector;
+
+    // vregs assigned to machine registers by the register allocator
+    std::map<int, int> mreg_assignment;
+
+    // call __rt_read_int/__rt_write_int (runtime.c) rather than scanf/printf
+    bool use_runtime;
+
+    // comment the instructions with the high-level instructions they're
+    // translated from (see set_hins_comment)
+    bool comments;
+
+    // the file the block execution counters are written to, and the
+    // number of counters (if the code is instrumented, see profile.h)
+    std::string profile_file;
+    unsigned num_profile_counters;
+
+    // the label of the function, and whether it is the main program
+    // (which writes the profile, and returns 0) or a subprogram, and a
+    // global symbol (the main program, or a subprogram of a unit)
+    std::string function_label;
+    bool is_main;
+    bool is_global;
+
+public:
+    Lowering(InstructionSequence *highlevelins, StorageLayout *storage_layout, long vreg_max, int stack_pointer);
+    virtual ~Lowering();
+
+    void set_function(const std::string &label, bool main);
+    void set_global(bool global) { is_global = global; }
+    bool is_global_function() const { return is_global; }
+    const std::string &get_function_label() const { return function_label; }
+    void set_mreg_assignment(const std::map<int, int> &assignment) { mreg_assignment = assignment; }
+    void set_use_runtime(bool runtime) { use_runtime = runtime; }
+    void set_comments(bool c) { comments = c; }
+    void set_profile(const std::string &filename, unsigned num_counters);
+
+    // translate the high-level code to the assembly code
+    virtual void translate_instructions() = 0;
+
+    InstructionSequence *get_assembly() const { return assembly; }
+    void set_assembly(InstructionSequence *iseq) { assembly = iseq; }
+
+    // the variables in .bss
+    std::vector<StorageLayout::Placement> get_static_variables() const;
+
+    // the label of the trap which a failed bounds check jumps to (after
+    // the function's epilogue)
+    std::string get_bounds_trap_label() const;
+
+    // print the function, with its prologue and epilogue
+    virtual void emit(OutputSink &out) = 0;
+
+    // print the program's data (with the given variables in .bss),
+    // followed by the start of the code
+    void emit_data(OutputSink &out, std::vector<StorageLayout::Placement> statics);
+
+protected:
+    // give each vreg which may be kept in memory a stack slot, and each
+    // vector vreg one of the num_vector_regs registers from first_vector_reg
+    // (named vector_reg_kind in the error if there are too few), place the
+    // variables whose addresses are used, and compute the size of the
+    // storage
+    void allocate_storage(int first_vector_reg, unsigned num_vector_regs, const char *vector_reg_kind);
+
+    // the index of the end of the hot code, where the epilogue goes (the
+    // length of the code, unless it's followed by cold code, marked by
+    // the target's cold_opcode, see HINS_COLD)
+    unsigned get_hot_end(int cold_opcode) const;
+
+    // the callee-saved registers of the target used by the assembly code,
+    // which the prologue saves and the epilogue restores
+    std::vector<int> get_saved_regs(Target target) const;
+
+    // order the moves (source, destination) of values into the given
+    // locations, done as if all at once, as moves done one at a time: a
+    // move is done when no other move still reads its destination (a
+    // machine register), and a cycle of moves is broken by saving one of
+    // the registers in the scratch register
+    static void order_parallel_move(std::vector<std::pair<Operand, Operand>> moves, const Operand &scratch,
+                                    std::vector<std::pair<Operand, Operand>> &sequence);
+
+    // comment an instruction with the high-level instruction it was
+    // translated from (formatted only if the comment is printed)
+    void set_hins_comment(Instruction *ins, Instruction *hin);
+    static std::string format_hins_comment(const Instruction *hin);
+
+    static void mark_needs_slot(std::vector<bool> &needs_slot, int vreg);
+    static bool is_same_mreg(const Operand &a, const Operand &b);
+
+    // the multiplier and shift used for signed division by a constant
+    // d >= 2 which isn't a power of two: the quotient is the high word of
+    // multiplier * n (plus n, if the multiplier is negative) shifted right
+    // by shift, plus 1 if n is negative (Hacker's Delight, section 10-4)
+    static void get_magic_number(long divisor, long &multiplier, int &shift);
+
+    // the multiplier and shift used for unsigned division by a constant
+    // d >= 2 which isn't a power of two: the quotient is the high word of
+    // multiplier * n shifted right by shift, or, if add is set (the
+    // multiplier needs 65 bits), with the high word h replaced by
+    // ((n - h) / 2 + h) and shifted by shift - 1 (Hacker's Delight,
+    // section 10-10)
+    static void get_unsigned_magic_number(unsigned long divisor, unsigned long &multiplier, int &shift, bool &add);
+
+    static bool is_quotient(int opcode);
+
+    // does next compute the remainder of the division hin (or the other
+    // way around), of the same operands, which hin doesn't change?
+    static bool is_division_pair(Instruction *hin, Instruction *next);
+
+    // the machine register of a vreg, or its stack slot
+    Operand get_mreg(Operand vreg) const;
+    Operand get_mreg_or_lit(Operand vreg_or_lit) const;
+
+    // the stack slot of a vreg which may be kept in memory
+    Operand get_vreg_slot(Operand vreg) const;
+
+    // the vector register of a vector vreg
+    Operand get_vector_reg(Operand vreg) const;
+
+    // the memory reference, relative to the stack pointer, for an
+    // OPERAND_LOCAL_MEMREF (which is never to a variable in .bss)
+    Operand get_local_memref(const Operand &local) const;
+};
+
+#endif // LOWERING_H
@@ -0,0 +1,231 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "lvn.h"
+
+namespace {
+    bool is_pure(int opcode) {
+        switch (opcode) {
+            case HINS_LOCALADDR:
+            case HINS_INT_ADD:
+            case HINS_INT_SUB:
+            case HINS_INT_MUL:
+            case HINS_INT_DIV:
+            case HINS_INT_MOD:
+            case HINS_INT_NEGATE:
+            case HINS_UINT_DIV:
+            case HINS_UINT_MOD:
+            case HINS_LEA:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool is_commutative(int opcode) {
+        return opcode == HINS_INT_ADD || opcode == HINS_INT_MUL;
+    }
+}
+
+bool LocalValueNumbering::Expression::operator==(const Expression &other) const {
+    return opcode == other.opcode
+           && std::equal(operands, operands + 3, other.operands);
+}
+
+size_t LocalValueNumbering::ExpressionHash::operator()(const Expression &e) const {
+    size_t h = size_t(e.opcode);
+    for (unsigned i = 0; i < 3; i++) {
+        h = h * 31 + size_t(e.operands[i] + 1);
+    }
+    return h;
+}
+
+LocalValueNumbering::LocalValueNumbering(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg) {
+}
+
+LocalValueNumbering::~LocalValueNumbering() {
+}
+
+InstructionSequence *LocalValueNumbering::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+
+    State state;
+
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        Instruction *ins = *i;
+        int opcode = ins->get_opcode();
+
+        if (opcode == HINS_LOAD_ICONST) {
+            // the constant has the same value number as the literal
+            state.define(ins->get_operand(0).get_base_reg(), state.get_value_number(ins->get_operand(1)));
+        } else if (is_pure(opcode)) {
+            int dest = ins->get_operand(0).get_base_reg();
+            Expression expr = state.get_expression(ins);
+            auto found = state.expr_vn.find(expr);
+            if (found != state.expr_vn.end()) {
+                int vn = found->second;
+                auto holder = state.holders.find(vn);
+                if (holder != state.holders.end()) {
+                    // the value is available: reuse it
+                    if (holder->second != dest) {
+                        out->add_instruction(new Instruction(HINS_MOV, ins->get_operand(0),
+                                                             Operand(OPERAND_VREG, holder->second)));
+                    }
+                    state.define(dest, vn);
+                    continue;
+                }
+                state.define(dest, vn);
+            } else {
+                int vn = state.next_vn++;
+                state.expr_vn[expr] = vn;
+                state.compute_root(ins, vn);
+                state.define(dest, vn);
+            }
+        } else if (opcode == HINS_MOV && !ins->get_operand(0).is_memref() && !ins->get_operand(1).is_memref()) {
+            int dest = ins->get_operand(0).get_base_reg();
+            int vn = state.get_value_number(ins->get_operand(1));
+            auto current = state.vreg_vn.find(dest);
+            if (current != state.vreg_vn.end() && current->second == vn) {
+                // the destination already holds the value
+                continue;
+            }
+            state.define(dest, vn);
+        } else if (opcode == HINS_LOAD_INT && ins->get_operand(1).get_kind() == OPERAND_VREG_MEMREF) {
+            int dest = ins->get_operand(0).get_base_reg();
+            int addr = state.get_value_number(Operand(OPERAND_VREG, ins->get_operand(1).get_base_reg()));
+            auto found = state.memory.find(addr);
+            if (found != state.memory.end()) {
+                int vn = found->second;
+                auto holder = state.holders.find(vn);
+                if (holder != state.holders.end()) {
+                    if (holder->second != dest) {
+                        out->add_instruction(new Instruction(HINS_MOV, ins->get_operand(0),
+                                                             Operand(OPERAND_VREG, holder->second)));
+                    }
+                    state.define(dest, vn);
+                    continue;
+                }
+                state.define(dest, vn);
+            } else {
+                int vn = state.next_vn++;
+                state.memory[addr] = vn;
+                state.define(dest, vn);
+            }
+        } else if (opcode == HINS_STORE_INT && ins->get_operand(0).get_kind() == OPERAND_VREG_MEMREF) {
+            int addr = state.get_value_number(Operand(OPERAND_VREG, ins->get_operand(0).get_base_reg()));
+            state.store(addr, state.get_value_number(ins->get_operand(1)));
+        } else {
+            bool is_store = ins->get_num_operands() > 0 && ins->get_operand(0).is_memref();
+            if (is_store || HighLevel::has_flags(opcode, HOP_STORE)) {
+                // some other kind of store (or a call, which may store to the
+                // program's variables, or a fill or copy of an array): forget
+                // everything known about memory
+                state.memory.clear();
+            }
+            if (!is_store && HighLevel::is_def(ins)) {
+                state.define(ins->get_operand(0).get_base_reg(), state.next_vn++);
+            }
+        }
+
+        out->add_instruction(ins->duplicate());
+    }
+
+    // don't leave a (possibly labeled) basic block without instructions
+    if (out->get_length() == 0 && bb->get_length() > 0) {
+        out->add_instruction(new Instruction(HINS_NOP));
+    }
+
+    return out;
+}
+
+int LocalValueNumbering::State::get_value_number(const Operand &operand) {
+    if (operand.get_kind() == OPERAND_INT_LITERAL) {
+        auto i = literal_vn.find(operand.get_int_value());
+        if (i != literal_vn.end()) {
+            return i->second;
+        }
+        int vn = next_vn++;
+        literal_vn[operand.get_int_value()] = vn;
+        return vn;
+    }
+
+    assert(operand.get_kind() == OPERAND_VREG);
+    int vreg = operand.get_base_reg();
+    auto i = vreg_vn.find(vreg);
+    if (i != vreg_vn.end()) {
+        return i->second;
+    }
+    // a value computed before the block
+    int vn = next_vn++;
+    define(vreg, vn);
+    return vn;
+}
+
+LocalValueNumbering::Expression LocalValueNumbering::State::get_expression(Instruction *ins) {
+    Expression expr;
+    expr.opcode = ins->get_opcode();
+    std::fill(expr.operands, expr.operands + 3, -1);
+
+    assert(ins->get_num_operands() <= 4);
+    for (unsigned i = 1; i < ins->get_num_operands(); i++) {
+        expr.operands[i - 1] = get_value_number(ins->get_operand(i));
+    }
+    if (is_commutative(expr.opcode) && expr.operands[0] > expr.operands[1]) {
+        std::swap(expr.operands[0], expr.operands[1]);
+    }
+    return expr;
+}
+
+void LocalValueNumbering::State::define(int vreg, int vn) {
+    auto current = vreg_vn.find(vreg);
+    if (current != vreg_vn.end()) {
+        auto holder = holders.find(current->second);
+        if (holder != holders.end() && holder->second == vreg) {
+            holders.erase(holder);
+        }
+    }
+    vreg_vn[vreg] = vn;
+    holders.emplace(vn, vreg);
+}
+
+void LocalValueNumbering::State::compute_root(Instruction *ins, int vn) {
+    int opcode = ins->get_opcode();
+    if (opcode == HINS_LOCALADDR) {
+        root[vn] = ins->get_operand(1).get_int_value();
+        return;
+    }
+    if (opcode != HINS_INT_ADD && opcode != HINS_INT_SUB && opcode != HINS_LEA) {
+        return;
+    }
+
+    // an offset from an address points into the same variable
+    auto left = root.find(get_value_number(ins->get_operand(1)));
+    auto right = root.find(get_value_number(ins->get_operand(2)));
+    if (left != root.end() && right == root.end()) {
+        root[vn] = left->second;
+    } else if (opcode == HINS_INT_ADD && left == root.end() && right != root.end()) {
+        root[vn] = right->second;
+    }
+}
+
+bool LocalValueNumbering::State::may_alias(int addr1, int addr2) const {
+    if (addr1 == addr2) {
+        return true;
+    }
+    auto root1 = root.find(addr1), root2 = root.find(addr2);
+    return root1 == root.end() || root2 == root.end() || root1->second == root2->second;
+}
+
+void LocalValueNumbering::State::store(int addr, int value) {
+    for (auto i = memory.begin(); i != memory.end(); ) {
+        if (may_alias(i->first, addr)) {
+            i = memory.erase(i);
+        } else {
+            i++;
+        }
+    }
+    memory[addr] = value;
+}
@@ -0,0 +1,66 @@
+#ifndef LVN_H
+#define LVN_H
+
+#include <cstddef>
+#include <unordered_map>
+#include "cfg.h"
+#include "cfg_transform.h"
+
+// Local value numbering for the high-level CFG (in or out of SSA form).
+//
+// Within each basic block, every value computed is given a value number,
+// and the expressions computed so far are kept in a hash table keyed by
+// the opcode and the value numbers of the operands.  An instruction which
+// recomputes the value of an earlier expression (e.g., the HINS_LOCALADDR
+// emitted for every reference to an array) is replaced by a HINS_MOV from
+// a vreg still holding that value, or removed if its destination already
+// holds it.  Loads are numbered the same way: a HINS_LOAD_INT from an
+// address which was loaded from (or stored to) earlier in the block
+// reuses the value, until a HINS_STORE_INT to an address which may alias
+// it.  Addresses computed from the HINS_LOCALADDR of different variables
+// are assumed not to alias.
+class LocalValueNumbering : public ControlFlowGraphTransform {
+private:
+    struct Expression {
+        int opcode;
+        int operands[3];    // value numbers, -1 if not used
+
+        bool operator==(const Expression &other) const;
+    };
+
+    struct ExpressionHash {
+        size_t operator()(const Expression &e) const;
+    };
+
+    // value numbering state for the block being transformed (local to
+    // transform_basic_block, so blocks can be transformed in parallel)
+    struct State {
+        int next_vn;
+        std::unordered_map<int, int> vreg_vn;       // vreg -> value number
+        std::unordered_map<long, int> literal_vn;   // integer literal -> value number
+        std::unordered_map<Expression, int, ExpressionHash> expr_vn;
+        std::unordered_map<int, int> holders;       // value number -> vreg holding it
+        // value number of an address -> offset of the variable it points into
+        std::unordered_map<int, long> root;
+        // value number of an address -> value number of the value in memory there
+        std::unordered_map<int, int> memory;
+
+        State() : next_vn(0) { }
+
+        int get_value_number(const Operand &operand);
+        Expression get_expression(Instruction *ins);
+        void define(int vreg, int vn);
+        void compute_root(Instruction *ins, int vn);
+        bool may_alias(int addr1, int addr2) const;
+        void store(int addr, int value);
+    };
+
+public:
+    LocalValueNumbering(ControlFlowGraph *cfg);
+    virtual ~LocalValueNumbering();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+    virtual bool is_block_local() const { return true; }
+};
+
+#endif // LVN_H
@@ -1,5 +1,13 @@
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
 #include <unistd.h> // for getopt
 #include "node.h"
 #include "util.h"
@@ -7,21 +15,145 @@
 #include "ast.h"
 #include "treeprint.h"
 #include "context.h"
+#include "phase_report.h"
+#include "stats.h"
+#include "compile_cache.h"
+#include "server.h"
+#include "unit_interface.h"
 
 extern "C" {
-int yyparse(void);
-void lexer_set_source_file(const char *filename);
+struct Node *parse_program(const char *filename, int lexer_thread);
 }
 
 void print_usage(void) {
   err_fatal(
-    "Usage: compiler [options] <filename>\n"
+    "Usage: compiler [options] <filename>...\n"
     "Options:\n"
     "   -p    print AST\n"
     "   -g    print AST as graph (DOT/graphviz)\n"
+    "   -ast-depth <n>\n"
+    "         with -p, print only n levels of the AST below the root of each\n"
+    "         subtree printed (a node whose kids aren't printed ends in ...)\n"
+    "   -ast-filter <tag>, -ast-filter <tag>[<name>]\n"
+    "         with -p, print only the subtrees whose roots have the given\n"
+    "         tag, and the given string or first kid's string (e.g.\n"
+    "         procedure[sort] for the procedure sort)\n"
     "   -s    print symbol table information\n"
     "   -h    print high-level instruction translation\n"
-    "   -o    perform optimization on emitted assembly\n"
+    "   -o    perform optimization on emitted assembly (the same as -O2)\n"
+    "   -O0, -O1, -O2, -O3\n"
+    "         set the optimization level: none (the default), local passes\n"
+    "         with linear scan register allocation (the fastest to compile),\n"
+    "         all of the passes with graph coloring, or the passes repeated\n"
+    "         to a fixed point and loops unrolled 4 times (the slowest)\n"
+    "   -Os   optimize for the size of the code: the passes of -O2 which don't\n"
+    "         make it larger, with tail merging, and only tiny subprograms (or\n"
+    "         those called once) inlined\n"
+    "   -r    use the buffered I/O runtime for READ and WRITE\n"
+    "         (the program must be linked with runtime.o and -pthread)\n"
+    "   -1    resolve names and generate code in a single pass over the AST\n"
+    "   -stream\n"
+    "         as -1, generating the code of each statement of the main program\n"
+    "         as soon as it is parsed, and then freeing its AST (-p, -g and\n"
+    "         -load-hir can't be used)\n"
+    "   -lex-thread\n"
+    "         scan the source file on a separate thread, overlapping reading\n"
+    "         and scanning it with parsing it\n"
+    "   -t    print the time, peak memory use and allocations of each phase\n"
+    "         of the compilation (and its cycles, instructions, branch misses\n"
+    "         and L1 data cache misses, if the hardware counters are available)\n"
+    "   -T    print the same information as -t, as CSV\n"
+    "   -stats\n"
+    "         print the number of instructions, vregs, spilled vregs, loads,\n"
+    "         stores and branches after each pass, and what the passes did\n"
+    "   -c <file>\n"
+    "         write an object file rather than printing assembly code\n"
+    "   -run  run the program (reading its input from stdin) rather than\n"
+    "         printing its code, loading it into the compiler's memory; the\n"
+    "         exit status is the program's\n"
+    "   -interp\n"
+    "         run the program as -run does, interpreting its high-level code\n"
+    "   -interp-counts\n"
+    "         as -interp, then print the number of instructions executed with\n"
+    "         each opcode and the executions of each block to stderr\n"
+    "   -O <option>\n"
+    "         set an optimization option (implies -o):\n"
+    "           passes=<p1>,<p2>,...  run the given passes in order\n"
+    "                                 (p1+p2 runs p1 and p2 until neither changes the code)\n"
+    "           budget=<ms>           stop optimizing a function after this long, other\n"
+    "                                 than allocating registers (0 for no limit; by\n"
+    "                                 default 1000 at -O2, 5000 at -O3)\n"
+    "           time-report           print the time spent in each pass\n"
+    "           size                  optimize for size (as -Os)\n"
+    "           size-report           print the size of each function's code, in bytes\n"
+    "           no-inline             don't inline calls of the subprograms\n"
+    "           no-ipcp               don't propagate constant arguments into the\n"
+    "                                 subprograms, or specialize them for constants\n"
+    "           no-split-cold         don't move the code which the profile shows was\n"
+    "                                 never executed into .text.unlikely\n"
+    "           reorder-fields        lay out record fields in decreasing order of\n"
+    "                                 alignment, so that they need no padding\n"
+    "           incremental           reuse the optimized code of each function\n"
+    "                                 which is unchanged since it was last compiled\n"
+    "                                 (from the cache in $COMPILER_CACHE_DIR)\n"
+    "   -funroll=<n>\n"
+    "         unroll counted loops n times, for n up to 64 (implies -o)\n"
+    "   -fprefetch-distance=<n>\n"
+    "         prefetch the elements of large arrays n bytes ahead of the loops\n"
+    "         stepping through them, for n up to 65536 (0 turns prefetching\n"
+    "         off, by default 512; implies -o)\n"
+    "   -fbounds-check\n"
+    "         check the index of each array element referenced, trapping if\n"
+    "         it's out of range (the checks which are provably redundant are\n"
+    "         removed, or moved out of loops, when optimizing)\n"
+    "   -ftarget=<x86-64|aarch64>\n"
+    "         generate code for the given machine (by default x86-64); AArch64\n"
+    "         code (for Linux) can only be printed as assembly code\n"
+    "   -march=<x86-64|x86-64-v2|x86-64-v3|x86-64-v4|native>\n"
+    "         use the instruction set extensions of the given x86-64 level (or\n"
+    "         of the processor compiling the program): from x86-64-v3, AVX and\n"
+    "         AVX2 in vectorized loops (by default, only SSE2)\n"
+    "   -mtune=<generic|skylake|znver|native>\n"
+    "         schedule the x86-64 code for the latencies and execution ports\n"
+    "         of the given processor (by default, a generic recent core)\n"
+    "   -fasm-comments, -fno-asm-comments\n"
+    "         comment (or don't) each instruction of the assembly code with\n"
+    "         the high-level instruction it was translated from (by default,\n"
+    "         the code is only commented without -o)\n"
+    "   -fprofile-generate=<file>\n"
+    "         count the executions of each basic block, writing the counts\n"
+    "         to the file when the program exits (the code isn't optimized)\n"
+    "   -fprofile-use=<file>\n"
+    "         use the counts written by a -fprofile-generate build of the same\n"
+    "         program for block layout, if-conversion, loop unrolling and\n"
+    "         register allocation (with -o)\n"
+    "   -j <n>\n"
+    "         compile the files on n threads (the functions of a single\n"
+    "         file are then compiled on n threads)\n"
+    "   -emit-hir <file>\n"
+    "         write the high-level code of the program to a binary HIR file,\n"
+    "         rather than compiling it\n"
+    "   -cfg-dot <file>\n"
+    "         write the high-level CFG of each function (after optimization,\n"
+    "         with -o) to the file as a Graphviz graph, with each block's\n"
+    "         execution count (with -fprofile-use) and register pressure\n"
+    "   -load-hir\n"
+    "         the input is a HIR file written by -emit-hir, which is compiled\n"
+    "         (-p, -g and -s can't be used)\n"
+    "   --server <socket>\n"
+    "         (the only argument) compile programs on request, on a Unix\n"
+    "         socket (see server.h)\n"
+    "A unit (UNIT <name>; <declarations> END.) is compiled like a program, and\n"
+    "also writes its interface to <name>.int, in its source file's directory;\n"
+    "a program or unit in that directory declaring USES <name>; reads it, and\n"
+    "its object file is linked with the unit's (so it can't be run with -run\n"
+    "or -interp).  A unit is compiled before the files given with it which use it.\n"
+    "If the COMPILER_CACHE_DIR environment variable is set, the code generated\n"
+    "for each file is cached in that directory, and reused when the same\n"
+    "file is compiled again with the same options.\n"
+    "With more than one file, the assembly code for each file is written\n"
+    "to a .s file (replacing its extension), and -p, -g, -s, -h, -c, -emit-hir,\n"
+    "-cfg-dot, -run, -interp can't be used.\n"
   );
 }
 
@@ -34,33 +166,473 @@ enum Mode {
   COMPILE,
 };
 
-int main(int argc, char **argv) {
-  extern FILE *yyin;
-  extern struct Node *g_program;
+// the options of a compilation
+struct CompileOptions {
+  int mode;
+  std::vector<const char *> options;
+  bool use_runtime;
+  bool one_pass;
+  // generate the code of the main program as it is parsed (see -stream)
+  bool stream;
+  // scan the source file on its own thread (see -lex-thread)
+  bool lexer_thread;
+  bool phase_report;
+  bool phase_csv;
+  bool stats;
+  const char *object_file;
+  // if non-null, write the high-level code to this file (see -emit-hir)
+  const char *hir_file;
+  // if non-null, write the CFGs to this file (see -cfg-dot)
+  const char *cfg_dot_file;
+  // the levels of the AST printed (or -1), and if non-null, the subtrees
+  // printed (see -ast-depth and -ast-filter)
+  int ast_depth;
+  const char *ast_filter;
+  // the input files are HIR files (see -load-hir)
+  bool load_hir;
+  // run the program rather than printing its code (see -run), by
+  // interpreting it (see -interp), printing the counts of the
+  // instructions and blocks executed (see -interp-counts)
+  bool run;
+  bool interpret;
+  bool print_counts;
+  // if non-null, print the assembly code to this stream rather than stdout
+  FILE *output;
+  // the number of threads compiling the functions of each file
+  unsigned function_threads;
+};
+
+// the key of the compilation's output in the cache, or "" if it can't be
+// cached (because the compilation prints more than the code)
+std::string get_cache_key(const CompileCache &cache, const char *filename, const CompileOptions &opts) {
+  if ((opts.mode != COMPILE && opts.mode != OPTIMIZE) || opts.phase_report || opts.phase_csv || opts.stats
+      || opts.hir_file != nullptr || opts.cfg_dot_file != nullptr || opts.run) {
+    return "";
+  }
+  // (compiling a unit writes its interface, so it isn't cached, and the
+  // interfaces of the units a file uses are part of its key)
+  std::vector<std::string> options, file_options;
+  std::string unit;
+  std::vector<std::string> uses;
+  if (!opts.load_hir) {
+    if (!UnitInterfaces::scan_source(filename, unit, uses) || !unit.empty()) {
+      return "";
+    }
+    for (auto i = uses.begin(); i != uses.end(); i++) {
+      file_options.push_back(UnitInterfaces::get_filename(filename, *i));
+    }
+  }
+  options.push_back(opts.mode == OPTIMIZE ? "-o" : "");
+  options.push_back(opts.use_runtime ? "-r" : "");
+  options.push_back(opts.one_pass ? "-1" : "");
+  options.push_back(opts.stream ? "-stream" : "");
+  options.push_back(opts.object_file != nullptr ? "-c" : "");
+  options.push_back(opts.load_hir ? "-load-hir" : "");
+  for (auto i = opts.options.begin(); i != opts.options.end(); i++) {
+    if (strcmp(*i, "time-report") == 0 || strcmp(*i, "size-report") == 0) {
+      return "";
+    }
+    options.push_back(*i);
+    if (strncmp(*i, "profile-use=", 12) == 0) {
+      file_options.push_back(*i + 12);
+    }
+  }
+  return cache.get_key(filename, options, file_options);
+}
+
+// open the file the output of a compilation is written to
+FILE *open_output(const char *asm_file, const CompileOptions &opts) {
+  const char *output = (opts.object_file != nullptr) ? opts.object_file : asm_file;
+  if (output == nullptr) {
+    return (opts.output != nullptr) ? opts.output : stdout;
+  }
+  FILE *out = fopen(output, opts.object_file != nullptr ? "wb" : "w");
+  if (out == nullptr) {
+    err_fatal("Could not open output file \"%s\"\n", output);
+  }
+  return out;
+}
+
+void close_output(FILE *out, const CompileOptions &opts, bool ok) {
+  if (out == stdout || out == opts.output) {
+    ok = (fflush(out) == 0) && ok;
+  } else {
+    ok = (fclose(out) == 0) && ok;
+  }
+  if (!ok) {
+    err_fatal("Error writing output\n");
+  }
+}
+
+// compile one file, printing the output (or writing the assembly code to
+// asm_file, if it isn't null); with -run, the program is run, and its exit
+// status returned
+int compile_file(const char *filename, const char *asm_file, const CompileOptions &opts) {
+  // (with $COMPILER_CACHE_DIR set, the output is copied from the cache if
+  // the file was compiled before with the same options, and otherwise
+  // written to a temporary file which is then stored in the cache)
+  CompileCache cache;
+  std::string cache_key, temp_file;
+  FILE *out = nullptr;
+  if (cache.is_enabled()) {
+    cache_key = get_cache_key(cache, filename, opts);
+  }
+  if (!cache_key.empty()) {
+    out = open_output(asm_file, opts);
+    if (cache.fetch(cache_key, out)) {
+      close_output(out, opts, true);
+      return 0;
+    }
+    temp_file = cache.get_temp_filename(cache_key);
+  }
+
+  PhaseReport report;
+  if (opts.phase_report || opts.phase_csv) {
+    report.count_hardware_events();
+  }
+  Statistics &stats = Statistics::get();
+  stats.clear();
+  stats.set_enabled(opts.stats);
+  struct Node *program = nullptr;
+  if (!opts.load_hir && !opts.stream) {
+    program = parse_program(filename, opts.lexer_thread);
+    report.end_phase("parse");
+  }
+
+  // (the context is destroyed even if the compilation fails in the
+  // compile server, see server.h)
+  struct ContextGuard {
+    struct Context *ctx;
+    ~ContextGuard() { context_destroy(ctx); }
+  } guard = { context_create(program) };
+  struct Context *ctx = guard.ctx;
+  if (opts.load_hir) {
+    context_set_hir_input(ctx, filename);
+  } else if (opts.stream) {
+    context_set_source_file(ctx, filename);
+  }
+  if (opts.hir_file != nullptr) {
+    context_set_hir_output(ctx, opts.hir_file);
+  }
+  if (opts.cfg_dot_file != nullptr) {
+    context_set_cfg_dot_output(ctx, opts.cfg_dot_file);
+  }
+  if (opts.phase_report || opts.phase_csv) {
+    context_set_phase_report(ctx, &report);
+  }
+  if (opts.use_runtime) {
+    context_set_flag(ctx, 'r');
+  }
+  if (opts.one_pass) {
+    context_set_flag(ctx, '1');
+  }
+  if (opts.lexer_thread) {
+    context_set_flag(ctx, 'l');
+  }
+  if (opts.interpret) {
+    context_set_flag(ctx, 'i');
+    if (opts.print_counts) {
+      context_set_flag(ctx, 'n');
+    }
+  } else if (opts.run) {
+    context_set_flag(ctx, 'x');
+  } else if (opts.object_file != nullptr) {
+    context_set_object_file(ctx, temp_file.empty() ? opts.object_file : temp_file.c_str());
+  } else if (!temp_file.empty()) {
+    context_set_asm_file(ctx, temp_file.c_str());
+  } else if (asm_file != nullptr) {
+    context_set_asm_file(ctx, asm_file);
+  } else if (opts.output != nullptr) {
+    context_set_output(ctx, opts.output);
+  }
+  context_set_num_threads(ctx, opts.function_threads);
+  for (auto i = opts.options.begin(); i != opts.options.end(); i++) {
+    context_set_option(ctx, *i);
+  }
+
+  if (opts.mode == PRINT_AST) {
+    treeprint_subtrees(program, ast_get_tag_name, opts.ast_depth, opts.ast_filter);
+  } else if (opts.mode == PRINT_AST_GRAPH) {
+    ast_print_graph(program);
+  } else if (opts.mode == PRINT_SYMBOL_TABLE) {
+      context_set_flag(ctx, 's');
+  } else if (opts.mode == PRINT_HINS) {
+      context_set_flag(ctx, 'h');
+  } else if (opts.mode == OPTIMIZE) {
+      context_set_flag(ctx, 'o');
+      if (!opts.interpret) {
+        context_set_flag(ctx, 'c');
+      }
+  } else if (!opts.interpret) {
+      // mode is only compile
+      context_set_flag(ctx, 'c');
+  }
+
+  context_build_symtab(ctx);
+  context_gen_code(ctx);
+  if (opts.phase_report) {
+    report.print(filename);
+  }
+  if (opts.phase_csv) {
+    report.print_csv(filename);
+  }
+  if (opts.stats) {
+    stats.print(filename);
+  }
+
+  if (!temp_file.empty()) {
+    close_output(out, opts, cache.store(cache_key, temp_file, out));
+  }
+  if (opts.run) {
+    return context_run_program(ctx);
+  }
+  return 0;
+}
+
+// the name of the assembly file for an input file
+std::string get_asm_filename(const std::string &filename) {
+  size_t slash = filename.rfind('/');
+  size_t dot = filename.rfind('.');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    dot = filename.size();
+  }
+  return filename.substr(0, dot) + ".s";
+}
+
+// compile the files on num_threads threads, each compiling one file at a time
+// (all of the state of a compilation is either in its Context or thread-local)
+void compile_files(const std::vector<const char *> &filenames, const CompileOptions &opts, unsigned num_threads) {
+  std::vector<std::string> asm_files;
+  for (auto i = filenames.begin(); i != filenames.end(); i++) {
+    asm_files.push_back(get_asm_filename(*i));
+    if (asm_files.back() == *i) {
+      err_fatal("Input file \"%s\" would be overwritten by its assembly code\n", *i);
+    }
+  }
+
+  // the files are compiled in waves: each wave is the files which use no
+  // units left to be compiled (as files given here), since they read the
+  // interfaces of the units they use (with a cycle, the rest are compiled
+  // together, and fail to find the interfaces)
+  std::vector<std::string> units(filenames.size());
+  std::vector<std::vector<std::string>> uses(filenames.size());
+  for (unsigned i = 0; i < filenames.size(); i++) {
+    if (!opts.load_hir) {
+      UnitInterfaces::scan_source(filenames[i], units[i], uses[i]);
+    }
+  }
+  std::vector<bool> is_compiled(filenames.size(), false);
+  std::vector<unsigned> wave;
+  for (unsigned num_compiled = 0; num_compiled < filenames.size(); num_compiled += unsigned(wave.size())) {
+    std::set<std::string> pending;
+    for (unsigned i = 0; i < filenames.size(); i++) {
+      if (!is_compiled[i] && !units[i].empty()) {
+        pending.insert(units[i]);
+      }
+    }
+    wave.clear();
+    for (unsigned i = 0; i < filenames.size(); i++) {
+      bool ready = !is_compiled[i];
+      for (auto j = uses[i].begin(); j != uses[i].end() && ready; j++) {
+        ready = (pending.count(*j) == 0);
+      }
+      if (ready) {
+        wave.push_back(i);
+      }
+    }
+    if (wave.empty()) {
+      for (unsigned i = 0; i < filenames.size(); i++) {
+        if (!is_compiled[i]) {
+          wave.push_back(i);
+        }
+      }
+    }
+
+    std::atomic<unsigned> next_file(0);
+    auto worker = [&]() {
+      unsigned k;
+      while ((k = next_file++) < wave.size()) {
+        compile_file(filenames[wave[k]], asm_files[wave[k]].c_str(), opts);
+      }
+    };
 
-  int mode = COMPILE;
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < num_threads && i < wave.size(); i++) {
+      threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto i = threads.begin(); i != threads.end(); i++) {
+      i->join();
+    }
+    for (auto i = wave.begin(); i != wave.end(); i++) {
+      is_compiled[*i] = true;
+    }
+  }
+}
+
+// parse the command line (whose long options are removed), returning the
+// index of the first file in argv
+int parse_options(int &argc, char **argv, CompileOptions &opts, unsigned &num_threads) {
+  opts.mode = COMPILE;
+  opts.use_runtime = false;
+  opts.one_pass = false;
+  opts.stream = false;
+  opts.lexer_thread = false;
+  opts.phase_report = false;
+  opts.phase_csv = false;
+  opts.stats = false;
+  opts.object_file = nullptr;
+  opts.hir_file = nullptr;
+  opts.cfg_dot_file = nullptr;
+  opts.ast_depth = -1;
+  opts.ast_filter = nullptr;
+  opts.load_hir = false;
+  opts.run = false;
+  opts.interpret = false;
+  opts.print_counts = false;
+  opts.output = nullptr;
+  opts.function_threads = 1;
+  num_threads = 1;
   int opt;
 
-  while ((opt = getopt(argc, argv, "pgsho")) != -1) {
+  // (-stats, -stream, -lex-thread, -emit-hir, -cfg-dot, -ast-depth, -ast-filter, -load-hir, -run and -interp are
+  // long options, so they're removed before getopt sees them)
+  int num_args = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-stats") == 0) {
+      opts.stats = true;
+    } else if (strcmp(argv[i], "-stream") == 0) {
+      opts.stream = true;
+      opts.one_pass = true;
+    } else if (strcmp(argv[i], "-lex-thread") == 0) {
+      opts.lexer_thread = true;
+    } else if (strcmp(argv[i], "-emit-hir") == 0 && i + 1 < argc) {
+      opts.hir_file = argv[++i];
+    } else if (strcmp(argv[i], "-cfg-dot") == 0 && i + 1 < argc) {
+      opts.cfg_dot_file = argv[++i];
+    } else if (strcmp(argv[i], "-ast-depth") == 0 && i + 1 < argc) {
+      char *end;
+      const char *arg = argv[++i];
+      long n = strtol(arg, &end, 10);
+      if (*end != '\0' || end == arg || n < 0 || n > INT_MAX) {
+        err_fatal("Invalid AST depth '%s'\n", arg);
+      }
+      opts.ast_depth = int(n);
+    } else if (strcmp(argv[i], "-ast-filter") == 0 && i + 1 < argc) {
+      opts.ast_filter = argv[++i];
+    } else if (strcmp(argv[i], "-load-hir") == 0) {
+      opts.load_hir = true;
+    } else if (strcmp(argv[i], "-run") == 0) {
+      opts.run = true;
+    } else if (strcmp(argv[i], "-interp") == 0 || strcmp(argv[i], "-interp-counts") == 0) {
+      // (interpreting the program is a way of running it)
+      opts.run = true;
+      opts.interpret = true;
+      opts.print_counts = (argv[i][7] != '\0');
+    } else {
+      argv[num_args++] = argv[i];
+    }
+  }
+  argc = num_args;
+
+  // (optind is reset, since the compile server parses many command lines)
+  optind = 0;
+  while ((opt = getopt(argc, argv, "pgshor1tTc:O:f:m:j:")) != -1) {
     switch (opt) {
     case 'p':
-      mode = PRINT_AST;
+      opts.mode = PRINT_AST;
       break;
 
     case 'g':
-      mode = PRINT_AST_GRAPH;
+      opts.mode = PRINT_AST_GRAPH;
       break;
 
     case 's':
-      mode = PRINT_SYMBOL_TABLE;
+      opts.mode = PRINT_SYMBOL_TABLE;
       break;
 
     case 'h':
-      mode = PRINT_HINS;
+      opts.mode = PRINT_HINS;
       break;
 
     case 'o':
-      mode = OPTIMIZE;
+      opts.mode = OPTIMIZE;
+      break;
+
+    case 'r':
+      opts.use_runtime = true;
+      break;
+
+    case '1':
+      opts.one_pass = true;
+      break;
+
+    case 't':
+      opts.phase_report = true;
+      break;
+
+    case 'T':
+      opts.phase_csv = true;
+      break;
+
+    case 'c':
+      opts.object_file = optarg;
+      break;
+
+    case 'O':
+      // (-O0 to -O3 set the optimization level, -O0 turning it off, and
+      // -Os is the same as -O size)
+      if (strcmp(optarg, "s") == 0) {
+        opts.mode = OPTIMIZE;
+        opts.options.push_back("size");
+        break;
+      }
+      if (optarg[0] >= '0' && optarg[0] <= '3' && optarg[1] == '\0') {
+        static const char *const LEVELS[] = { "level=0", "level=1", "level=2", "level=3" };
+        if (optarg[0] == '0') {
+          opts.mode = (opts.mode == OPTIMIZE) ? COMPILE : opts.mode;
+          break;
+        }
+        opts.mode = OPTIMIZE;
+        opts.options.push_back(LEVELS[optarg[0] - '0']);
+        break;
+      }
+      opts.mode = OPTIMIZE;
+      opts.options.push_back(optarg);
+      break;
+
+    case 'f':
+      // (-funroll=<n> is the same as -O unroll=<n>, and likewise for
+      // -fprefetch-distance=<n>, but the profile, comment, bounds check
+      // and target options don't imply -o)
+      if (strncmp(optarg, "unroll=", 7) == 0 || strncmp(optarg, "prefetch-distance=", 18) == 0) {
+        opts.mode = OPTIMIZE;
+      } else if (strncmp(optarg, "profile-generate=", 17) != 0 && strncmp(optarg, "profile-use=", 12) != 0
+                 && strcmp(optarg, "asm-comments") != 0 && strcmp(optarg, "no-asm-comments") != 0
+                 && strcmp(optarg, "bounds-check") != 0 && strncmp(optarg, "target=", 7) != 0) {
+        print_usage();
+      }
+      opts.options.push_back(optarg);
+      break;
+
+    case 'm':
+      // (-march=<name> and -mtune=<name> are -m with arch=<name> and
+      // tune=<name>, which don't imply -o)
+      if (strncmp(optarg, "arch=", 5) != 0 && strncmp(optarg, "tune=", 5) != 0) {
+        print_usage();
+      }
+      opts.options.push_back(optarg);
+      break;
+
+    case 'j':
+      {
+        char *end;
+        long n = strtol(optarg, &end, 10);
+        if (*end != '\0' || end == optarg || n < 1 || n > 1024) {
+          err_fatal("Invalid number of threads '%s'\n", optarg);
+        }
+        num_threads = unsigned(n);
+      }
       break;
 
     case '?':
@@ -68,7 +640,7 @@ int main(int argc, char **argv) {
       break;
 
     default:
-      mode = COMPILE;
+      opts.mode = COMPILE;
       break;
     }
   }
@@ -76,36 +648,73 @@ int main(int argc, char **argv) {
   if (optind >= argc) {
     print_usage();
   }
+  if (opts.load_hir && (opts.mode == PRINT_AST || opts.mode == PRINT_AST_GRAPH || opts.mode == PRINT_SYMBOL_TABLE)) {
+    print_usage();
+  }
+  if (opts.stream && (opts.load_hir || opts.mode == PRINT_AST || opts.mode == PRINT_AST_GRAPH)) {
+    print_usage();
+  }
+  if (opts.run && ((opts.mode != COMPILE && opts.mode != OPTIMIZE) || opts.object_file != nullptr
+                   || opts.hir_file != nullptr || optind + 1 != argc)) {
+    print_usage();
+  }
 
-  const char *filename = argv[optind];
+  return optind;
+}
 
-  yyin = fopen(filename, "r");
-  if (!yyin) {
-    err_fatal("Could not open input file \"%s\"\n", filename);
+// serve a compile server request (see server.h): the arguments are as on
+// the command line, for a single file
+void serve_request(const std::vector<std::string> &args, FILE *out) {
+  std::vector<char *> argv;
+  argv.push_back(const_cast<char *>("compiler"));
+  for (auto i = args.begin(); i != args.end(); i++) {
+    argv.push_back(const_cast<char *>(i->c_str()));
   }
-  lexer_set_source_file(filename);
+  argv.push_back(nullptr);
+  int argc = int(argv.size()) - 1;
 
-  yyparse();
-  struct Context *ctx = context_create(g_program);
+  CompileOptions opts;
+  unsigned num_threads;
+  int first_file = parse_options(argc, argv.data(), opts, num_threads);
+  if (first_file + 1 != argc || (opts.mode != COMPILE && opts.mode != OPTIMIZE)
+      || opts.phase_report || opts.phase_csv || opts.stats || opts.run) {
+    err_fatal("The compile server compiles one file, without printing anything but its code\n");
+  }
+  opts.function_threads = num_threads;
+  opts.output = out;
+  compile_file(argv[first_file], nullptr, opts);
+}
 
-  if (mode == PRINT_AST) {
-    treeprint(g_program, ast_get_tag_name);
-  } else if (mode == PRINT_AST_GRAPH) {
-    ast_print_graph(g_program);
-  } else if (mode == PRINT_SYMBOL_TABLE) {
-      context_set_flag(ctx, 's');
-  } else if (mode == PRINT_HINS) {
-      context_set_flag(ctx, 'h');
-  } else if (mode == OPTIMIZE) {
-      context_set_flag(ctx, 'o');
-      context_set_flag(ctx, 'c');
-  } else {
-      // mode is only compile
-      context_set_flag(ctx, 'c');
+int main(int argc, char **argv) {
+  // (--server is only given on the command line, not in the compile
+  // server's requests)
+  if (argc == 3 && strcmp(argv[1], "--server") == 0) {
+    CompileServer::run(argv[2], serve_request);
+    return 1;
   }
 
-  context_build_symtab(ctx);
-  context_gen_code(ctx);
+  CompileOptions opts;
+  unsigned num_threads;
+  optind = parse_options(argc, argv, opts, num_threads);
+
+  if (opts.phase_csv) {
+    PhaseReport::print_csv_header();
+  }
+
+  if (optind + 1 == argc) {
+    opts.function_threads = num_threads;
+    return compile_file(argv[optind], nullptr, opts);
+  }
+
+  if ((opts.mode != COMPILE && opts.mode != OPTIMIZE) || opts.object_file != nullptr || opts.hir_file != nullptr
+      || opts.cfg_dot_file != nullptr) {
+    print_usage();
+  }
+  std::vector<const char *> filenames(argv + optind, argv + argc);
+  // (the threads left over when there are fewer files than threads
+  // compile the files' functions)
+  opts.function_threads = std::max(1u, num_threads / unsigned(filenames.size()));
+  compile_files(filenames, opts, num_threads);
 
   return 0;
 }
@@ -5,26 +5,65 @@
 /*
 #include "symbol.h"
 */
+#include "arena.h"
+#include "symtab.h"
 #include "node.h"
 
 #define DEBUG_PRINT(args...)
 //#define DEBUG_PRINT(args...) printf(args)
 
+////////////////////////////////////////////////////////////////////////
+// NodeArena implementation
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+  thread_local ObjectPool<Node> s_node_pool;
+  thread_local bool s_reuse_storage = false;
+}
+
+void NodeArena::release() {
+  if (s_reuse_storage) {
+    s_node_pool.reset();
+  } else {
+    s_node_pool.release();
+  }
+}
+
+void NodeArena::set_reuse_storage(bool reuse) {
+  s_reuse_storage = reuse;
+}
+
 ////////////////////////////////////////////////////////////////////////
 // C++ Node data type implementation
 ////////////////////////////////////////////////////////////////////////
 
 Node::Node(int tag)
   : m_tag(tag)
+  , m_num_kids(0)
+  , m_kids_capacity(INLINE_KIDS)
+  , m_kids(m_inline_kids)
   , m_source_info { .filename = "<unknown file>", .line = -1, .col = -1 }
   , m_ival(0L)
-/*
+  , m_atom(0)
   , m_symtab(nullptr)
   , m_index(0)
-*/ {
+  , m_type(nullptr)
+  , m_is_const(false) {
 }
 
 Node::~Node() {
+  if (m_kids != m_inline_kids) {
+    delete[] m_kids;
+  }
+}
+
+void *Node::operator new(std::size_t size) {
+  assert(size == sizeof(Node));
+  return s_node_pool.allocate();
+}
+
+void Node::operator delete(void *p) {
+  s_node_pool.deallocate(p);
 }
 
 int Node::get_tag() const {
@@ -32,11 +71,14 @@ int Node::get_tag() const {
 }
 
 int Node::get_num_kids() const {
-  return int(m_kids.size());
+  return int(m_num_kids);
 }
 
 void Node::add_kid(Node *kid) {
-  m_kids.push_back(kid);
+  if (m_num_kids == m_kids_capacity) {
+    grow_kids();
+  }
+  m_kids[m_num_kids++] = kid;
 
   // If the parent node doesn't yet have source info set,
   // and the child has source info, copy the child's source info
@@ -46,7 +88,14 @@ void Node::add_kid(Node *kid) {
 }
 
 void Node::prepend_kid(Node *kid) {
-  m_kids.insert(m_kids.begin(), kid);
+  if (m_num_kids == m_kids_capacity) {
+    grow_kids();
+  }
+  for (unsigned i = m_num_kids; i > 0; i--) {
+    m_kids[i] = m_kids[i - 1];
+  }
+  m_kids[0] = kid;
+  m_num_kids++;
 
   // Copy child's source info, if it has valid source info
   if (kid->m_source_info.line > 0) {
@@ -55,16 +104,47 @@ void Node::prepend_kid(Node *kid) {
 }
 
 Node *Node::get_kid(int index) {
-  assert(index >= 0);
-  return m_kids.at(unsigned(index));
+  assert(index >= 0 && unsigned(index) < m_num_kids);
+  return m_kids[index];
+}
+
+void Node::set_kid(int index, Node *kid) {
+  assert(index >= 0 && unsigned(index) < m_num_kids);
+  m_kids[index] = kid;
+}
+
+void Node::truncate_kids(int num_kids) {
+  assert(num_kids >= 0 && unsigned(num_kids) <= m_num_kids);
+  m_num_kids = unsigned(num_kids);
+}
+
+void Node::grow_kids() {
+  unsigned capacity = m_kids_capacity * 2;
+  Node **kids = new Node *[capacity];
+  for (unsigned i = 0; i < m_num_kids; i++) {
+    kids[i] = m_kids[i];
+  }
+  if (m_kids != m_inline_kids) {
+    delete[] m_kids;
+  }
+  m_kids = kids;
+  m_kids_capacity = capacity;
 }
 
 void Node::set_str(const std::string &s) {
-  m_strval = s;
+  m_atom = atom_intern(s);
 }
 
 const std::string &Node::get_str() const {
-  return m_strval;
+  return atom_get_string(m_atom);
+}
+
+void Node::set_atom(Atom atom) {
+  m_atom = atom;
+}
+
+Atom Node::get_atom() const {
+  return m_atom;
 }
 
 SourceInfo Node::get_source_info() const {
@@ -125,22 +205,6 @@ Type *Node::get_type() {
   return nullptr;
 }
 
-void Node::set_operand(Operand &op) {
-    m_operand = op;
-}
-
-Operand Node::get_operand() {
-    return m_operand;
-}
-
-void Node::set_inverted(bool inverted) {
-    m_invert = inverted;
-}
-
-bool Node::is_inverted() {
-    return m_invert;
-}
-
 void Node::set_is_const(bool is_const) {
     m_is_const = is_const;
 }
@@ -170,6 +234,12 @@ struct Node *node_alloc_str_adopt(int tag, char *str_to_adopt) {
   return n;
 }
 
+struct Node *node_alloc_atom(int tag, Atom atom) {
+  Node *n = new Node(tag);
+  n->set_atom(atom);
+  return n;
+}
+
 struct Node *node_alloc_ival(int tag, long ival) {
   Node *n = new Node(tag);
   n->set_ival(ival);
@@ -301,6 +371,10 @@ const char *node_get_str(struct Node *n) {
   return n->get_str().c_str();
 }
 
+Atom node_get_atom(struct Node *n) {
+  return n->get_atom();
+}
+
 long node_get_ival(struct Node *n) {
   return n->get_ival();
 }
@@ -322,15 +396,11 @@ unsigned node_get_index(struct Node *n) {
   return n->get_index();
 }
 
-// Assume that this function exists, and can retrieve a pointer to
-// a Symbol from a SymbolTable, given its index.
-//extern "C" struct Symbol *symtab_get_entry(struct SymbolTable *symtab, unsigned index);
-
 struct Symbol *node_get_symbol(struct Node *n) {
   SymbolTable *symtab = n->get_symtab();
   if (!symtab) {
     // The Node doesn't have a symbol table entry
     return nullptr;
   }
-  //return symtab_get_entry(symtab, n->get_index());
+  return &symtab->get_symbol(n->get_index());
 }
@@ -3,14 +3,15 @@
 
 #ifdef __cplusplus
 
+#include <cstddef>
 #include <string>
-#include <vector>
 #include "symbol.h"
 #include "symtab.h"
-#include "cfg.h"
 
 #endif // __cplusplus
 
+#include "atom.h"
+
 // Node datatype and functions
 
 // Forward declaration for SymbolTable, SymbolTableEntry, Type
@@ -31,40 +32,57 @@ struct Node;
 // Node data type exposed as a full C++ class.
 // The C functions from previous assignments still work,
 // and are retained for backwards compatibility.
+//
+// Nodes are allocated from a (thread-local) object pool, and are freed all
+// at once by NodeArena::release().  The children of a Node are stored in the Node
+// itself if there are at most INLINE_KIDS of them, and in a separately
+// allocated array otherwise.
 struct Node {
+public:
+  static const unsigned INLINE_KIDS = 3;
+
 private:
   int m_tag;
-  std::vector<Node *> m_kids;
+  unsigned m_num_kids;
+  unsigned m_kids_capacity;
+  Node **m_kids;   // points to m_inline_kids, or to an allocated array
+  Node *m_inline_kids[INLINE_KIDS];
   SourceInfo m_source_info;
   long m_ival;
-  std::string m_strval;
+  Atom m_atom;   // the (interned) string value
   SymbolTable *m_symtab;
   unsigned m_index; // index of symbol table entry
   Type *m_type;
-  Operand m_operand;
   bool m_is_const;
-  bool m_invert;
 
   // copy ctor and assignment operator disallowed
   Node(const Node &);
   Node &operator=(const Node &);
   
 public:
-  typedef std::vector<Node *>::iterator iterator;
+  typedef Node **iterator;
 
   Node(int tag);
   ~Node();
 
-  iterator begin() { return m_kids.begin(); }
-  iterator end() { return m_kids.end(); }
+  void *operator new(std::size_t size);
+  void operator delete(void *p);
+
+  iterator begin() { return m_kids; }
+  iterator end() { return m_kids + m_num_kids; }
 
   int get_tag() const;
   int get_num_kids() const;
   void add_kid(Node *kid);
   void prepend_kid(Node *kid);
   Node *get_kid(int index);
+  // replace a child, or remove the children from the given index on
+  void set_kid(int index, Node *kid);
+  void truncate_kids(int num_kids);
   void set_str(const std::string &s);
   const std::string &get_str() const;
+  void set_atom(Atom atom);
+  Atom get_atom() const;
   SourceInfo get_source_info() const;
   void set_source_info(const SourceInfo &source_info);
   long get_ival() const;
@@ -76,12 +94,21 @@ public:
   void set_symbol(SymbolTable *symtab, unsigned index);
   void set_type(Type *type);
   Type *get_type();
-  void set_operand(Operand &op);
-  Operand get_operand();
   void set_is_const(bool is_const);
   bool is_const();
-  void set_inverted(bool inverted);
-  bool is_inverted();
+
+private:
+  void grow_kids();
+};
+
+// Frees all of the Nodes (no pointer to a Node may be used after release()).
+class NodeArena {
+public:
+  static void release();
+
+  // keep the storage of the current thread's pool when it's released
+  // (see IRArena::set_reuse_storage)
+  static void set_reuse_storage(bool reuse);
 };
 
 extern "C" {
@@ -100,6 +127,9 @@ struct Node *node_alloc_str_copy(int tag, const char *str_to_copy);
 // which will be freed when the Node is destroyed.
 struct Node *node_alloc_str_adopt(int tag, char *str_to_adopt);
 
+// Create a node with an interned string value.
+struct Node *node_alloc_atom(int tag, Atom atom);
+
 // Create a node with a given integer value.
 struct Node *node_alloc_ival(int tag, long ival);
 
@@ -162,6 +192,9 @@ struct SourceInfo node_get_source_info(struct Node *n);
 // Get the string value of a Node.
 const char *node_get_str(struct Node *n);
 
+// Get the string value of a Node as an atom.
+Atom node_get_atom(struct Node *n);
+
 // Get integer value of a Node.
 long node_get_ival(struct Node *n);
 
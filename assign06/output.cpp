@@ -0,0 +1,103 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include "util.h"
+#include "output.h"
+
+OutputSink::OutputSink(FILE *file)
+        : m_file(file)
+        , m_buf(static_cast<char *>(xmalloc(BUFFER_SIZE)))
+        , m_len(0)
+        , m_capacity(BUFFER_SIZE)
+        , m_flushed(0) {
+}
+
+OutputSink::OutputSink()
+        : m_file(nullptr)
+        , m_buf(static_cast<char *>(xmalloc(256)))
+        , m_len(0)
+        , m_capacity(256)
+        , m_flushed(0) {
+}
+
+OutputSink::~OutputSink() {
+    flush();
+    free(m_buf);
+}
+
+OutputSink &OutputSink::get_stdout() {
+    static OutputSink s_stdout(stdout);
+    return s_stdout;
+}
+
+void OutputSink::put(const char *s, size_t len) {
+    if (m_capacity - m_len < len) {
+        make_room(len);
+        if (len > m_capacity) {
+            // too long to buffer
+            assert(m_len == 0 && m_file != nullptr);
+            fwrite(s, 1, len, m_file);
+            m_flushed += len;
+            return;
+        }
+    }
+    memcpy(m_buf + m_len, s, len);
+    m_len += len;
+}
+
+void OutputSink::put(const char *s) {
+    put(s, strlen(s));
+}
+
+void OutputSink::put_int(long value) {
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    // (negate each digit, rather than the value, so LONG_MIN works)
+    bool negative = value < 0;
+    do {
+        long digit = value % 10;
+        *--p = char('0' + (negative ? -digit : digit));
+        value /= 10;
+    } while (value != 0);
+    if (negative) {
+        *--p = '-';
+    }
+    put(p, size_t(digits + sizeof(digits) - p));
+}
+
+void OutputSink::pad_to(size_t count) {
+    while (get_count() < count) {
+        put(' ');
+    }
+}
+
+void OutputSink::flush() {
+    if (m_file == nullptr || m_len == 0) {
+        return;
+    }
+    if (fwrite(m_buf, 1, m_len, m_file) != m_len) {
+        err_fatal("Error writing output\n");
+    }
+    fflush(m_file);
+    m_flushed += m_len;
+    m_len = 0;
+}
+
+std::string OutputSink::get_string() const {
+    assert(m_file == nullptr);
+    return std::string(m_buf, m_len);
+}
+
+void OutputSink::make_room(size_t len) {
+    if (m_file != nullptr) {
+        flush();
+        return;
+    }
+    while (m_capacity - m_len < len) {
+        m_capacity *= 2;
+    }
+    m_buf = static_cast<char *>(realloc(m_buf, m_capacity));
+    if (m_buf == nullptr) {
+        err_fatal("Out of memory\n");
+    }
+}
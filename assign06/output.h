@@ -0,0 +1,73 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+// A buffered output sink, used to print assembly code, instruction
+// sequences, and CFGs.  Text is accumulated in one large buffer, which
+// (for a sink writing to a file) is written with a single fwrite when it
+// fills up or is flushed, rather than making a stdio call per line.  The
+// put_* functions never allocate memory (except when an in-memory sink
+// has to grow).
+//
+// Output written to the same file with other stdio functions (e.g.
+// printf) will appear out of order unless the sink is flushed first.
+class OutputSink {
+private:
+    FILE *m_file;        // null for an in-memory sink
+    char *m_buf;
+    size_t m_len;
+    size_t m_capacity;
+    size_t m_flushed;    // number of characters written by flush()
+
+    // disallow copy ctor and assignment operator
+    OutputSink(const OutputSink &);
+    OutputSink &operator=(const OutputSink &);
+
+public:
+    static const size_t BUFFER_SIZE = 1 << 16;
+
+    // a sink which writes to a file
+    OutputSink(FILE *file);
+
+    // an in-memory sink (use get_string() to get the text)
+    OutputSink();
+
+    ~OutputSink();
+
+    // the sink writing to stdout
+    static OutputSink &get_stdout();
+
+    void put(char c) {
+        if (m_len == m_capacity) {
+            make_room(1);
+        }
+        m_buf[m_len++] = c;
+    }
+
+    void put(const char *s, size_t len);
+    void put(const char *s);
+    void put(const std::string &s) { put(s.data(), s.size()); }
+
+    // print a decimal integer
+    void put_int(long value);
+
+    // the number of characters written to the sink so far (used to
+    // align columns)
+    size_t get_count() const { return m_flushed + m_len; }
+
+    // write spaces until get_count() is at least count
+    void pad_to(size_t count);
+
+    void flush();
+
+    // get the text written to an in-memory sink
+    std::string get_string() const;
+
+private:
+    void make_room(size_t len);
+};
+
+#endif // OUTPUT_H
@@ -2,17 +2,85 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "grammar_symbols.h"
 #include "util.h"
 #include "ast.h"
 #include "node.h"
+#include "token_ring.h"
+%}
 
-struct Node *g_program;
+%code requires {
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+
+#ifndef YY_TYPEDEF_YY_BUFFER_STATE
+#define YY_TYPEDEF_YY_BUFFER_STATE
+typedef struct yy_buffer_state *YY_BUFFER_STATE;
+#endif
+
+struct Node;
+struct TokenRing;
+
+/* the state of a lexer (flex's "extra" data) */
+struct LexerState {
+  const char *srcfile;
+  int col;
+  /* the first error (empty if none) */
+  char error[1024];
+  /* if not null, the scanner runs on its own thread, passing the tokens
+     to the parser through this ring (see parse_program); the parser then
+     reports a syntax error at the end of the last token it got, rather
+     than at the scanner's position */
+  struct TokenRing *tokens;
+  int parser_line;
+  int parser_col;
+};
+
+/* the functions called as the main program's statements are parsed (see
+   parse_program_streaming) */
+struct StatementHandler {
+  void (*begin)(void *data, struct Node *declarations);
+  void (*statement)(void *data, struct Node *statement);
+  void *data;
+};
+}
 
-void yyerror(const char *fmt, ...);
+%code provides {
+int yylex(YYSTYPE *lval, yyscan_t scanner);
+void yyerror(yyscan_t scanner, struct Node **program, struct StatementHandler *handler, const char *fmt, ...);
+
+/* the reentrant scanner's functions (defined in lex.yy.c) */
+int scan_token(YYSTYPE *lval, yyscan_t scanner);
+struct Node *create_token_node(struct LexerState *state, int tag, const char *text, int line, int col);
+int yylex_init_extra(struct LexerState *state, yyscan_t *scanner);
+int yylex_destroy(yyscan_t scanner);
+void yyset_in(FILE *in, yyscan_t scanner);
+struct LexerState *yyget_extra(yyscan_t scanner);
+int yyget_lineno(yyscan_t scanner);
+char *yyget_text(yyscan_t scanner);
+int yyget_leng(yyscan_t scanner);
+YY_BUFFER_STATE yy_scan_buffer(char *base, size_t size, yyscan_t scanner);
+void yy_delete_buffer(YY_BUFFER_STATE buffer, yyscan_t scanner);
+
+struct Node *parse_program(const char *filename, int lexer_thread);
+struct Node *parse_program_text(const char *text, size_t len, const char *filename);
+struct Node *parse_program_streaming(const char *filename, int lexer_thread,
+                                     void (*begin)(void *data, struct Node *declarations),
+                                     void (*statement)(void *data, struct Node *statement),
+                                     void *data);
+}
 
-int yylex(void);
-%}
+%define api.pure full
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {struct Node **program} {struct StatementHandler *handler}
 
 %union {
   struct Node *node;
@@ -23,29 +91,64 @@ int yylex(void);
 %token<node> TOK_PROGRAM TOK_BEGIN TOK_END TOK_CONST TOK_TYPE TOK_VAR
 %token<node> TOK_ARRAY TOK_OF TOK_RECORD TOK_DIV TOK_MOD TOK_IF
 %token<node> TOK_THEN TOK_ELSE TOK_REPEAT TOK_UNTIL TOK_WHILE TOK_DO
-%token<node> TOK_READ TOK_WRITE
+%token<node> TOK_READ TOK_WRITE TOK_PROCEDURE TOK_FUNCTION TOK_FOR TOK_TO
+%token<node> TOK_CASE TOK_UNIT TOK_USES
 
 %token<node> TOK_ASSIGN
 %token<node> TOK_SEMICOLON TOK_EQUALS TOK_COLON TOK_PLUS TOK_MINUS TOK_TIMES
 %token<node> TOK_HASH TOK_LT TOK_GT TOK_LTE TOK_GTE TOK_LPAREN
 %token<node> TOK_RPAREN TOK_LBRACKET TOK_RBRACKET TOK_DOT TOK_COMMA
+%token<node> TOK_BAR
 
-%type<node> program
-%type<node> opt_declarations declarations declaration
+%type<node> compilation_unit program unit
+%type<node> opt_declarations declarations declaration usesdecl
 %type<node> constdecl constdefn_list constdefn
 %type<node> typedecl typedefn_list typedefn
 %type<node> vardecl vardefn_list vardefn
+%type<node> procdecl funcdecl opt_parameters parameter_list parameter
+%type<node> opt_local_declarations local_declarations local_declaration
 %type<node> type named_type array_type record_type
-%type<node> opt_instructions instructions instruction
+%type<node> main_instructions opt_instructions instructions instruction
 %type<node> expression term factor primary
-%type<node> assignstmt ifstmt repeatstmt whilestmt condition writestmt readstmt
-%type<node> designator identifier_list
+%type<node> assignstmt ifstmt repeatstmt whilestmt forstmt casestmt condition writestmt readstmt callstmt
+%type<node> case_list case
+%type<node> designator identifier_list opt_expression_list expression_list
 
 %%
 
+compilation_unit
+    : program
+    | unit
+    ;
+
 program
-    : TOK_PROGRAM TOK_IDENT TOK_SEMICOLON opt_declarations TOK_BEGIN opt_instructions TOK_END TOK_DOT
-        { $$ = g_program = node_build2(AST_PROGRAM, $4, $6); }
+    : TOK_PROGRAM TOK_IDENT TOK_SEMICOLON opt_declarations TOK_BEGIN
+        { if (handler != NULL) handler->begin(handler->data, $4); }
+      main_instructions TOK_END TOK_DOT
+        { $$ = *program = node_build2(AST_PROGRAM, $4, $7); }
+    ;
+
+/* a unit is compiled separately, and its subprograms called by the programs
+   and units using it (a unit has no statements, so the handler isn't
+   called: its declarations are resolved and compiled after it is parsed) */
+unit
+    : TOK_UNIT TOK_IDENT TOK_SEMICOLON opt_declarations TOK_END TOK_DOT
+        { $$ = *program = node_build3(AST_UNIT, $4, node_build0(AST_INSTRUCTIONS), $2); }
+    ;
+
+/* (each statement is passed to the handler, if there is one, as soon as
+   it is parsed, rather than added to the program's AST) */
+main_instructions
+    : main_instructions instruction
+        {
+          $$ = $1;
+          if (handler != NULL) {
+            handler->statement(handler->data, $2);
+          } else {
+            node_add_kid($1, $2);
+          }
+        }
+    | /* epsilon */ { $$ = node_build0(AST_INSTRUCTIONS); }
     ;
 
 opt_declarations
@@ -62,6 +165,56 @@ declaration
     : constdecl { $$ = $1; }
     | typedecl { $$ = $1; }
     | vardecl { $$ = $1; }
+    | procdecl { $$ = $1; }
+    | funcdecl { $$ = $1; }
+    | usesdecl { $$ = $1; }
+    ;
+
+usesdecl
+    : TOK_USES identifier_list TOK_SEMICOLON { $$ = node_build1(AST_USES, $2); }
+    ;
+
+/* the declarations of a subprogram, which can't contain other subprograms */
+opt_local_declarations
+    : local_declarations
+    | /* epsilon */ { $$ = node_build0(AST_DECLARATIONS);  }
+    ;
+
+local_declarations
+    : local_declarations local_declaration { $$ = $1, node_add_kid($1, $2); }
+    | local_declaration { $$ = node_build1(AST_DECLARATIONS, $1); }
+    ;
+
+local_declaration
+    : constdecl { $$ = $1; }
+    | typedecl { $$ = $1; }
+    | vardecl { $$ = $1; }
+    ;
+
+procdecl
+    : TOK_PROCEDURE TOK_IDENT opt_parameters TOK_SEMICOLON opt_local_declarations TOK_BEGIN opt_instructions TOK_END TOK_SEMICOLON
+        { $$ = node_build4(AST_PROCEDURE, $2, $3, $5, $7); }
+    ;
+
+funcdecl
+    : TOK_FUNCTION TOK_IDENT opt_parameters TOK_COLON type TOK_SEMICOLON opt_local_declarations TOK_BEGIN opt_instructions TOK_END TOK_SEMICOLON
+        { $$ = node_build5(AST_FUNCTION, $2, $3, $5, $7, $9); }
+    ;
+
+opt_parameters
+    : TOK_LPAREN parameter_list TOK_RPAREN { $$ = $2; }
+    | TOK_LPAREN TOK_RPAREN { $$ = node_build0(AST_PARAMETER_LIST); }
+    | /* epsilon */ { $$ = node_build0(AST_PARAMETER_LIST); }
+    ;
+
+parameter_list
+    : parameter_list TOK_SEMICOLON parameter { $$ = $1; node_add_kid($1, $3); }
+    | parameter { $$ = node_build1(AST_PARAMETER_LIST, $1); }
+    ;
+
+/* (parameters are defined like variables) */
+parameter
+    : identifier_list TOK_COLON type { $$ = node_build2(AST_VAR_DEF, $1, $3); }
     ;
 
 constdecl
@@ -141,8 +294,11 @@ instruction
     | ifstmt TOK_SEMICOLON
     | repeatstmt TOK_SEMICOLON
     | whilestmt TOK_SEMICOLON
+    | forstmt TOK_SEMICOLON
+    | casestmt TOK_SEMICOLON
     | writestmt TOK_SEMICOLON
     | readstmt TOK_SEMICOLON
+    | callstmt TOK_SEMICOLON
     ;
 
 assignstmt
@@ -162,6 +318,27 @@ whilestmt
     : TOK_WHILE condition TOK_DO opt_instructions TOK_END { $$ = node_build2(AST_WHILE, $2, $4); }
     ;
 
+forstmt
+    : TOK_FOR TOK_IDENT TOK_ASSIGN expression TOK_TO expression TOK_DO opt_instructions TOK_END
+        { $$ = node_build4(AST_FOR, node_build1(AST_VAR_REF, $2), $4, $6, $8); }
+    ;
+
+casestmt
+    : TOK_CASE expression TOK_OF case_list TOK_END
+        { $$ = node_build3(AST_CASE, $2, $4, node_build0(AST_INSTRUCTIONS)); }
+    | TOK_CASE expression TOK_OF case_list TOK_ELSE opt_instructions TOK_END
+        { $$ = node_build3(AST_CASE, $2, $4, $6); }
+    ;
+
+case_list
+    : case_list TOK_BAR case { $$ = $1; node_add_kid($1, $3); }
+    | case { $$ = node_build1(AST_CASE_LIST, $1); }
+    ;
+
+case
+    : expression_list TOK_COLON opt_instructions { $$ = node_build2(AST_CASE_ARM, $1, $3); }
+    ;
+
 writestmt
     : TOK_WRITE expression { $$ = node_build1(AST_WRITE, $2); }
     ;
@@ -170,6 +347,11 @@ readstmt
     : TOK_READ designator { $$ = node_build1(AST_READ, $2); }
     ;
 
+callstmt
+    : TOK_IDENT TOK_LPAREN opt_expression_list TOK_RPAREN { $$ = node_build2(AST_PROCEDURE_CALL, $1, $3); }
+    | TOK_IDENT { $$ = node_build2(AST_PROCEDURE_CALL, $1, node_build0(AST_EXPRESSION_LIST)); }
+    ;
+
 condition
     : expression TOK_EQUALS expression { $$ = node_build2(AST_COMPARE_EQ, $1, $3); }
     | expression TOK_HASH expression { $$ = node_build2(AST_COMPARE_NEQ, $1, $3); }
@@ -185,12 +367,15 @@ designator
     | designator TOK_DOT TOK_IDENT { $$ = node_build2(AST_FIELD_REF, $1, $3); }
     ;
 
-/*
+opt_expression_list
+    : expression_list
+    | /* epsilon */ { $$ = node_build0(AST_EXPRESSION_LIST); }
+    ;
+
 expression_list
     : expression_list TOK_COMMA expression { $$ = $1; node_add_kid($1, $3); }
-    | expression { $$ = node_build1(NODE_expression_list, $1); }
+    | expression { $$ = node_build1(AST_EXPRESSION_LIST, $1); }
     ;
-*/
 
 expression
     : expression TOK_PLUS term { $$ = node_build2(AST_ADD, $1, $3); }
@@ -212,22 +397,220 @@ factor
 primary
     : TOK_INT_LITERAL { $$ = $1; }
     | designator { $$ = $1; }
+    | TOK_IDENT TOK_LPAREN opt_expression_list TOK_RPAREN { $$ = node_build2(AST_FUNCTION_CALL, $1, $3); }
     | TOK_LPAREN expression TOK_RPAREN { $$ = $2; }
     ;
 
 %%
 
-void yyerror(const char *fmt, ...) {
-  extern char *g_srcfile;
-  extern int yylineno, g_col;
+int yylex(YYSTYPE *lval, yyscan_t scanner) {
+  struct LexerState *state = yyget_extra(scanner);
+  const struct Token *token;
+  int tag;
+
+  if (state->tokens == NULL) {
+    return scan_token(lval, scanner);
+  }
+
+  /* (an error found by the lexer's thread is recorded when the parser
+     reaches it, so that the first error is the same as without the
+     thread) */
+  for (token = token_ring_peek(state->tokens); token->tag == TOKEN_ERROR;
+       token = token_ring_peek(state->tokens)) {
+    if (state->error[0] == '\0') {
+      snprintf(state->error, sizeof(state->error), "%s", token->text);
+    }
+    token_ring_advance(state->tokens);
+  }
+  tag = token->tag;
+  state->parser_line = token->line;
+  state->parser_col = token->col + token->len;
+  lval->node = (token->text != NULL) ? create_token_node(state, tag, token->text, token->line, token->col) : NULL;
+  token_ring_advance(state->tokens);
+  return tag;
+}
 
-  va_list args;
+/* the lexer's thread, which scans the whole input (unless the parser
+   stops first, closing the ring), and then adds the end of the input */
+static void *run_lexer(void *scanner) {
+  struct TokenRing *tokens = yyget_extra(scanner)->tokens;
+  YYSTYPE lval;
+  while (!token_ring_is_closed(tokens) && scan_token(&lval, scanner) != 0) {
+  }
+  token_ring_push(tokens, 0, NULL, 0, yyget_lineno(scanner), yyget_extra(scanner)->col);
+  return NULL;
+}
+
+/* the lexer's thread is stopped when parse returns, or when an error in a
+   StatementHandler unwinds it (see err_set_handler) */
+struct LexerThread {
+  struct TokenRing *tokens;
+  pthread_t thread;
+};
+
+static void stop_lexer_thread(struct LexerThread *lexer) {
+  if (lexer->tokens != NULL) {
+    token_ring_close(lexer->tokens);
+    pthread_join(lexer->thread, NULL);
+    token_ring_destroy(lexer->tokens);
+    lexer->tokens = NULL;
+  }
+}
+
+/*
+ * Parse a source file.  A regular file is mapped into memory and scanned in
+ * place, without being copied into the scanner's buffer.  (The scanner needs
+ * two NUL characters after the text; they are the zeroes filling the rest of
+ * the last page of the mapping, if there is room for them.  The mapping is
+ * private and writable, since the scanner temporarily modifies the text.)
+ * Any other file is read by the scanner.  If text isn't null, it's the
+ * source (of len bytes), which is copied and scanned in place, and filename
+ * is only used in the error messages.
+ *
+ * With lexer_thread, the scanner runs on its own thread, so that reading
+ * and scanning the file overlap with parsing it.
+ */
+static struct Node *parse(const char *filename, const char *text, size_t len, int lexer_thread,
+                          struct StatementHandler *handler) {
+  struct LexerState state = { .srcfile = filename, .col = 1 };
+  struct Node *program = NULL;
+  yyscan_t scanner;
+  struct stat st;
+  long page_size = sysconf(_SC_PAGESIZE);
+  char *base = MAP_FAILED;
+  size_t map_size = 0;
+  YY_BUFFER_STATE buffer = NULL;
+  FILE *in = NULL;
+  char *copy = NULL;
+  struct LexerThread lexer __attribute__((cleanup(stop_lexer_thread))) = { .tokens = NULL };
+
+  int fd = (text != NULL) ? -1 : open(filename, O_RDONLY);
+  if (text == NULL && fd < 0) {
+    err_fatal("Could not open input file \"%s\"\n", filename);
+  }
+  if (yylex_init_extra(&state, &scanner) != 0) {
+    err_fatal("Could not create a lexer\n");
+  }
+
+  if (text != NULL) {
+    copy = xmalloc(len + 2);
+    memcpy(copy, text, len);
+    copy[len] = copy[len + 1] = '\0';
+    buffer = yy_scan_buffer(copy, len + 2, scanner);
+  } else if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+      && st.st_size % page_size != 0 && st.st_size % page_size <= page_size - 2) {
+    map_size = (size_t) st.st_size + 2;
+    base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (base != MAP_FAILED) {
+      buffer = yy_scan_buffer(base, map_size, scanner);
+      if (buffer == NULL) {
+        munmap(base, map_size);
+        base = MAP_FAILED;
+      }
+    }
+  }
+  if (buffer != NULL) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  } else {
+    in = fdopen(fd, "r");
+    if (in == NULL) {
+      err_fatal("Could not open input file \"%s\"\n", filename);
+    }
+    yyset_in(in, scanner);
+  }
+
+  if (lexer_thread) {
+    state.tokens = token_ring_create();
+    if (pthread_create(&lexer.thread, NULL, run_lexer, scanner) != 0) {
+      err_fatal("Could not create the lexer's thread\n");
+    }
+    lexer.tokens = state.tokens;
+  }
+
+  /* (an error is reported after the scanner is freed) */
+  yyparse(scanner, &program, handler);
+  stop_lexer_thread(&lexer);
+
+  if (buffer != NULL) {
+    yy_delete_buffer(buffer, scanner);
+  }
+  yylex_destroy(scanner);
+  if (copy != NULL) {
+    free(copy);
+  } else if (base != MAP_FAILED) {
+    munmap(base, map_size);
+  } else {
+    fclose(in);
+  }
+
+  if (state.error[0] != '\0') {
+    err_fatal("%s\n", state.error);
+  }
+  return program;
+}
+
+struct Node *parse_program(const char *filename, int lexer_thread) {
+  return parse(filename, NULL, 0, lexer_thread, NULL);
+}
 
-  va_start(args, fmt);
-  fprintf(stderr, "%s:%d:%d: Error: ", g_srcfile, yylineno, g_col);
-  vfprintf(stderr, fmt, args);
-  fprintf(stderr, "\n");
-  va_end(args);
+/*
+ * Parse a source held in memory (len bytes of text, which needn't end with
+ * a NUL), naming it filename in the error messages.
+ */
+struct Node *parse_program_text(const char *text, size_t len, const char *filename) {
+  return parse(filename, text, len, 0, NULL);
+}
 
-  exit(1);
+/*
+ * Parse a source file, passing each statement of the main program to a
+ * handler as soon as it is parsed: begin is called with the program's
+ * declarations before the first statement is parsed, and then statement
+ * with each statement, which is left to the handler rather than added to
+ * the AST (so the AST returned has no statements in the main program, and
+ * the handler may free each one).  Neither is called for a unit, which has
+ * no statements: its whole AST is returned.
+ */
+struct Node *parse_program_streaming(const char *filename, int lexer_thread,
+                                     void (*begin)(void *data, struct Node *declarations),
+                                     void (*statement)(void *data, struct Node *statement),
+                                     void *data) {
+  struct StatementHandler handler = { .begin = begin, .statement = statement, .data = data };
+  return parse(filename, NULL, 0, lexer_thread, &handler);
+}
+
+void yyerror(yyscan_t scanner, struct Node **program, struct StatementHandler *handler, const char *fmt, ...) {
+  struct LexerState *state = yyget_extra(scanner);
+  /* (an error found by the scanner, whose program is null, on the lexer's
+     thread is passed to the parser, see yylex) */
+  int lexer_error = (program == NULL && state->tokens != NULL);
+  char message[sizeof(state->error)];
+  va_list args;
+  int line, col, len;
+
+  /* (the parser stops at a syntax error, and parse_program reports the
+     first error) */
+  (void) handler;
+  if (!lexer_error && state->error[0] != '\0') {
+    return;
+  }
+  if (state->tokens != NULL && !lexer_error) {
+    line = state->parser_line;
+    col = state->parser_col;
+  } else {
+    line = yyget_lineno(scanner);
+    col = state->col;
+  }
+  len = snprintf(message, sizeof(message), "%s:%d:%d: Error: ", state->srcfile, line, col);
+  if (len >= 0 && (size_t) len < sizeof(message)) {
+    va_start(args, fmt);
+    vsnprintf(message + len, sizeof(message) - len, fmt, args);
+    va_end(args);
+  }
+  if (lexer_error) {
+    token_ring_push(state->tokens, TOKEN_ERROR, message, (int) strlen(message), line, col);
+  } else {
+    memcpy(state->error, message, sizeof(message));
+  }
 }
@@ -0,0 +1,666 @@
+#include <cassert>
+#include <cstdio>
+#include <chrono>
+#include "util.h"
+#include "cfg.h"
+#include "live_vregs.h"
+#include "ssa.h"
+#include "const_prop.h"
+#include "dce.h"
+#include "lvn.h"
+#include "gvn.h"
+#include "load_elim.h"
+#include "dse.h"
+#include "loops.h"
+#include "alias.h"
+#include "licm.h"
+#include "strength_reduction.h"
+#include "value_range.h"
+#include "bounds_check.h"
+#include "tail_call.h"
+#include "jump_threading.h"
+#include "superblock.h"
+#include "tail_merge.h"
+#include "if_conversion.h"
+#include "loop_idiom.h"
+#include "unswitch.h"
+#include "loop_fusion.h"
+#include "scalar_promotion.h"
+#include "predictive_commoning.h"
+#include "prefetch.h"
+#include "vectorize.h"
+#include "unroll.h"
+#include "reg_alloc.h"
+#include "peephole.h"
+#include "jump_table.h"
+#include "code_align.h"
+#include "schedule.h"
+#include "addr_fold.h"
+#include "renumber.h"
+#include "copy_prop.h"
+#include "phase_report.h"
+#include "stats.h"
+#include "pass_manager.h"
+
+namespace {
+    // indices of the passes used to change the form of the CFG
+    const unsigned SSA_PASS = 0;
+    const unsigned OUT_OF_SSA_PASS = 1;
+
+    bool same_instructions(const InstructionSequence *a, const InstructionSequence *b) {
+        if (a->get_length() != b->get_length()) {
+            return false;
+        }
+        for (unsigned i = 0; i < a->get_length(); i++) {
+            if (!a->get_instruction(i)->is_same(b->get_instruction(i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool same_cfg(const ControlFlowGraph *a, const ControlFlowGraph *b) {
+        if (a->get_num_blocks() != b->get_num_blocks()) {
+            return false;
+        }
+        for (unsigned i = 0; i < a->get_num_blocks(); i++) {
+            if (!same_instructions(a->get_block(i), b->get_block(i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+const PassManager::PassInfo PassManager::s_passes[] = {
+    { "ssa",             FORM_ANY,    &PassManager::run_ssa },
+    { "out-of-ssa",      FORM_ANY,    &PassManager::run_out_of_ssa },
+    { "tailcall",        FORM_NORMAL, &PassManager::run_tailcall },
+    { "lvn",             FORM_ANY,    &PassManager::run_lvn },
+    { "constprop",       FORM_SSA,    &PassManager::run_constprop },
+    { "dce",             FORM_ANY,    &PassManager::run_dce },
+    { "ifconvert",       FORM_SSA,    &PassManager::run_ifconvert },
+    { "pre",             FORM_SSA,    &PassManager::run_pre },
+    { "loadelim",        FORM_SSA,    &PassManager::run_loadelim },
+    { "dse",             FORM_SSA,    &PassManager::run_dse },
+    { "licm",            FORM_SSA,    &PassManager::run_licm },
+    { "ivsr",            FORM_SSA,    &PassManager::run_ivsr },
+    { "range",           FORM_SSA,    &PassManager::run_range },
+    { "boundscheck",     FORM_SSA,    &PassManager::run_boundscheck },
+    { "divmod",          FORM_ANY,    &PassManager::run_divmod },
+    { "lea",             FORM_ANY,    &PassManager::run_lea },
+    { "addrfold",        FORM_NORMAL, &PassManager::run_addrfold },
+    { "copyprop",        FORM_NORMAL, &PassManager::run_copyprop },
+    { "unswitch",        FORM_NORMAL, &PassManager::run_unswitch },
+    { "fuse",            FORM_NORMAL, &PassManager::run_fuse },
+    { "promote",         FORM_NORMAL, &PassManager::run_promote },
+    { "loopidiom",       FORM_NORMAL, &PassManager::run_loopidiom },
+    { "commoning",       FORM_NORMAL, &PassManager::run_commoning },
+    { "vectorize",       FORM_NORMAL, &PassManager::run_vectorize },
+    { "unroll",          FORM_NORMAL, &PassManager::run_unroll },
+    { "prefetch",        FORM_NORMAL, &PassManager::run_prefetch },
+    { "jump-threading",  FORM_NORMAL, &PassManager::run_jump_threading },
+    { "superblock",      FORM_NORMAL, &PassManager::run_superblock },
+    { "tailmerge",       FORM_NORMAL, &PassManager::run_tailmerge },
+    { "renumber",        FORM_NORMAL, &PassManager::run_renumber },
+    { "regalloc",        FORM_NORMAL, &PassManager::run_regalloc },
+    { "linearscan",      FORM_NORMAL, &PassManager::run_linearscan },
+    { "peephole",        FORM_X86_64, &PassManager::run_peephole },
+    { "jumptable",       FORM_X86_64, &PassManager::run_jumptable },
+    { "schedule",        FORM_X86_64, &PassManager::run_schedule },
+    { "align",           FORM_X86_64, &PassManager::run_align },
+    { nullptr,           FORM_ANY,    nullptr },
+};
+
+PassManager::PassManager(const std::string &spec)
+        : m_time_report(false)
+        , m_unroll_factor(1)
+        , m_prefetch_distance(LoopPrefetching::DEFAULT_DISTANCE)
+        , m_time_budget_ms(0.0)
+        , m_num_threads(1)
+        , m_phase_report(nullptr)
+        , m_layout(nullptr)
+        , m_target(TARGET_X86_64)
+        , m_tune(TUNE_GENERIC)
+        , m_cfg(nullptr)
+        , m_asm(nullptr)
+        , m_in_ssa(false)
+        , m_replaced_asm(nullptr)
+        , m_live_vregs(nullptr)
+        , m_domtree(nullptr)
+        , m_loops(nullptr)
+        , m_alias(nullptr)
+        , m_ranges(nullptr) {
+    unsigned num_passes = 0;
+    while (s_passes[num_passes].name != nullptr) {
+        num_passes++;
+    }
+    m_stats.assign(num_passes, PassStats{0, 0.0, 0, 0});
+
+    // parse the spec (an empty spec runs no passes)
+    bool seen_x86_64 = false;
+    std::vector<unsigned> group;
+    std::string name;
+    for (unsigned i = 0; !spec.empty() && i <= spec.size(); i++) {
+        char c = (i < spec.size()) ? spec[i] : ',';
+        if (c != ',' && c != '+') {
+            name += c;
+            continue;
+        }
+        if (name.empty()) {
+            err_fatal("Empty pass name in pipeline '%s'\n", spec.c_str());
+        }
+        unsigned index = find_pass(name);
+        bool is_x86_64 = (s_passes[index].form == FORM_X86_64);
+        if (seen_x86_64 && !is_x86_64) {
+            err_fatal("Pass '%s' must come before the x86-64 passes\n", name.c_str());
+        }
+        if (!group.empty() && (s_passes[group[0]].form == FORM_X86_64) != is_x86_64) {
+            err_fatal("Pass '%s' can't be grouped with '%s'\n", name.c_str(), s_passes[group[0]].name);
+        }
+        seen_x86_64 = seen_x86_64 || is_x86_64;
+        group.push_back(index);
+        name.clear();
+        if (c == ',') {
+            m_pipeline.push_back(group);
+            group.clear();
+        }
+    }
+}
+
+PassManager::~PassManager() {
+    invalidate_analyses();
+}
+
+const char *PassManager::get_default_pipeline() {
+    return get_pipeline(DEFAULT_LEVEL);
+}
+
+const char *PassManager::get_pipeline(unsigned level) {
+    switch (level) {
+        case 0:
+            return "";
+        case 1:
+            return "lvn,dce,divmod,lea,addrfold,renumber,linearscan,peephole,jumptable,align";
+        case 2:
+            return "tailcall,ssa,lvn,constprop,dce,ifconvert,lvn,pre,loadelim,dse,dce,licm,ivsr,range,boundscheck,out-of-ssa,copyprop,unswitch,fuse,promote,loopidiom,vectorize,commoning,unroll,prefetch,jump-threading,divmod,lea,addrfold,renumber,regalloc,peephole,jumptable,schedule,align";
+        default:
+            return "tailcall,ssa,lvn,constprop+dce,ifconvert,lvn,pre,loadelim,dse,dce,licm,ivsr,range,boundscheck,constprop+dce,out-of-ssa,copyprop+dce,unswitch,fuse,promote,loopidiom,vectorize,commoning,unroll,prefetch,jump-threading,superblock,lvn,dce,divmod,lea,addrfold,renumber,regalloc,peephole,jumptable,schedule,align";
+    }
+}
+
+const char *PassManager::get_size_pipeline() {
+    return "tailcall,ssa,lvn,constprop,dce,ifconvert,lvn,pre,loadelim,dse,dce,licm,ivsr,range,boundscheck,out-of-ssa,copyprop,fuse,promote,loopidiom,tailmerge,jump-threading,divmod,lea,addrfold,renumber,regalloc,peephole,jumptable,schedule";
+}
+
+ControlFlowGraph *PassManager::run_highlevel(ControlFlowGraph *cfg) {
+    m_cfg = cfg;
+    m_in_ssa = false;
+    m_assignment.clear();
+    m_start = std::chrono::steady_clock::now();
+
+    for (auto i = m_pipeline.begin(); i != m_pipeline.end(); i++) {
+        if (s_passes[i->front()].form != FORM_X86_64) {
+            run_group(*i);
+        }
+    }
+    if (m_in_ssa) {
+        run_pass(OUT_OF_SSA_PASS);
+    }
+    invalidate_analyses();
+
+    ControlFlowGraph *result = m_cfg;
+    m_cfg = nullptr;
+    return result;
+}
+
+InstructionSequence *PassManager::run_x86_64(InstructionSequence *iseq) {
+    m_asm = iseq;
+
+    for (auto i = m_pipeline.begin(); i != m_pipeline.end(); i++) {
+        if (s_passes[i->front()].form == FORM_X86_64) {
+            run_group(*i);
+        }
+    }
+
+    InstructionSequence *result = m_asm;
+    m_asm = nullptr;
+    return result;
+}
+
+void PassManager::print_time_report() const {
+    if (!m_time_report) {
+        return;
+    }
+
+    double total = 0.0;
+    fprintf(stderr, "%-16s %6s %12s %12s %12s\n", "pass", "runs", "time (ms)", "ins before", "ins after");
+    for (auto i = m_run_order.begin(); i != m_run_order.end(); i++) {
+        const PassStats &stats = m_stats[*i];
+        fprintf(stderr, "%-16s %6u %12.3f %12u %12u\n",
+                s_passes[*i].name, stats.runs, stats.time_ms, stats.ins_before, stats.ins_after);
+        total += stats.time_ms;
+    }
+    fprintf(stderr, "%-16s %6s %12.3f\n", "total", "", total);
+}
+
+unsigned PassManager::find_pass(const std::string &name) {
+    for (unsigned i = 0; s_passes[i].name != nullptr; i++) {
+        if (name == s_passes[i].name) {
+            return i;
+        }
+    }
+    err_fatal("Unknown optimization pass '%s'\n", name.c_str());
+    return 0;
+}
+
+void PassManager::run_group(const std::vector<unsigned> &group) {
+    // a single pass is run once, a group is run until it stops changing the code
+    unsigned max_iterations = (group.size() == 1) ? 1 : MAX_ITERATIONS;
+    for (unsigned iter = 0; iter < max_iterations; iter++) {
+        bool changed = false;
+        for (auto i = group.begin(); i != group.end(); i++) {
+            unsigned index = *i;
+            if (is_over_budget()) {
+                // only the register allocation is still done, by linear scan
+                if (s_passes[index].run != &PassManager::run_regalloc) {
+                    Statistics::get().add("passmanager.skipped");
+                    continue;
+                }
+                index = find_pass("linearscan");
+            }
+            Form form = s_passes[index].form;
+            if (form == FORM_SSA && !m_in_ssa) {
+                run_pass(SSA_PASS);
+            } else if (form == FORM_NORMAL && m_in_ssa) {
+                run_pass(OUT_OF_SSA_PASS);
+            }
+            if (run_pass(index)) {
+                changed = true;
+            }
+        }
+        if (!changed) {
+            break;
+        }
+    }
+}
+
+bool PassManager::run_pass(unsigned index) {
+    const PassInfo &pass = s_passes[index];
+    PassStats &stats = m_stats[index];
+
+    unsigned ins_before = count_instructions();
+    auto start = std::chrono::steady_clock::now();
+    bool changed = (this->*pass.run)();
+    auto end = std::chrono::steady_clock::now();
+    if (m_phase_report != nullptr) {
+        m_phase_report->end_phase(std::string("pass:") + pass.name);
+    }
+
+    if (stats.runs == 0) {
+        stats.ins_before = ins_before;
+        m_run_order.push_back(index);
+    }
+    stats.runs++;
+    stats.time_ms += std::chrono::duration<double, std::milli>(end - start).count();
+    stats.ins_after = count_instructions();
+
+    if (changed && pass.form != FORM_X86_64) {
+        invalidate_analyses();
+        // the register assignment is only valid for the code it was made for
+        if (pass.run != &PassManager::run_regalloc && pass.run != &PassManager::run_linearscan) {
+            m_assignment.clear();
+        }
+    }
+    free_replaced();
+
+    if (m_cfg != nullptr) {
+        Statistics::get().add_snapshot(pass.name, m_cfg, m_assignment);
+    } else {
+        Statistics::get().add_x86_64_snapshot(pass.name, m_asm);
+    }
+    return changed;
+}
+
+void PassManager::free_replaced() {
+    if (!m_replaced_cfgs.empty()) {
+        IRArena::free_replaced(m_replaced_cfgs, m_cfg);
+        m_replaced_cfgs.clear();
+    }
+    if (m_replaced_asm != nullptr) {
+        IRArena::free_replaced(m_replaced_asm, m_asm);
+        m_replaced_asm = nullptr;
+    }
+}
+
+bool PassManager::is_over_budget() const {
+    if (m_time_budget_ms <= 0.0 || m_cfg == nullptr) {
+        return false;
+    }
+    auto now = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(now - m_start).count() > m_time_budget_ms;
+}
+
+unsigned PassManager::count_instructions() const {
+    if (m_cfg == nullptr) {
+        return m_asm->get_length();
+    }
+    unsigned count = 0;
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        count += (*i)->get_length();
+    }
+    return count;
+}
+
+const LiveVregs *PassManager::get_live_vregs() {
+    if (m_live_vregs == nullptr) {
+        m_live_vregs = new LiveVregs(m_cfg);
+        m_live_vregs->execute();
+        m_live_vregs->materialize_instruction_facts();
+    }
+    return m_live_vregs;
+}
+
+const DominatorTree *PassManager::get_domtree() {
+    if (m_domtree == nullptr) {
+        m_domtree = new DominatorTree(m_cfg);
+    }
+    return m_domtree;
+}
+
+const LoopForest *PassManager::get_loops() {
+    if (m_loops == nullptr) {
+        m_loops = new LoopForest(m_cfg, *get_domtree());
+    }
+    return m_loops;
+}
+
+const AliasAnalysis *PassManager::get_alias_analysis() {
+    if (m_alias == nullptr) {
+        m_alias = new AliasAnalysis(m_cfg, m_layout);
+    }
+    return m_alias;
+}
+
+const ValueRangeAnalysis *PassManager::get_value_ranges() {
+    assert(m_in_ssa);
+    if (m_ranges == nullptr) {
+        m_ranges = new ValueRangeAnalysis(m_cfg, *get_domtree());
+    }
+    return m_ranges;
+}
+
+void PassManager::invalidate_analyses() {
+    delete m_live_vregs;
+    m_live_vregs = nullptr;
+    // (the loop forest and the value ranges refer to the dominator tree)
+    delete m_ranges;
+    m_ranges = nullptr;
+    delete m_loops;
+    m_loops = nullptr;
+    delete m_domtree;
+    m_domtree = nullptr;
+    delete m_alias;
+    m_alias = nullptr;
+}
+
+bool PassManager::replace_cfg(ControlFlowGraph *result) {
+    // (the unused CFG is freed once the pass is done)
+    if (same_cfg(m_cfg, result)) {
+        m_replaced_cfgs.push_back(result);
+        return false;
+    }
+    m_replaced_cfgs.push_back(m_cfg);
+    m_cfg = result;
+    return true;
+}
+
+bool PassManager::run_ssa() {
+    if (m_in_ssa) {
+        return false;
+    }
+    SSAConstruction ssa_construction(m_cfg);
+    m_replaced_cfgs.push_back(m_cfg);
+    m_cfg = ssa_construction.transform_cfg();
+    m_in_ssa = true;
+    return true;
+}
+
+bool PassManager::run_out_of_ssa() {
+    if (!m_in_ssa) {
+        return false;
+    }
+    SSADestruction ssa_destruction(m_cfg);
+    m_replaced_cfgs.push_back(m_cfg);
+    m_cfg = ssa_destruction.transform_cfg();
+    m_in_ssa = false;
+    return true;
+}
+
+bool PassManager::run_tailcall() {
+    TailCallElimination tail_call_elimination(m_cfg, m_function_label, m_layout);
+    return replace_cfg(tail_call_elimination.transform_cfg());
+}
+
+bool PassManager::run_lvn() {
+    LocalValueNumbering local_value_numbering(m_cfg);
+    local_value_numbering.set_num_threads(m_num_threads);
+    return local_value_numbering.transform_in_place();
+}
+
+bool PassManager::run_constprop() {
+    ConstantPropagation constant_propagation(m_cfg);
+    constant_propagation.set_num_threads(m_num_threads);
+    return replace_cfg(constant_propagation.transform_cfg());
+}
+
+bool PassManager::run_dce() {
+    if (m_in_ssa) {
+        return DeadCodeElimination::remove_unused(m_cfg);
+    }
+    return DeadCodeElimination::run_to_fixpoint(m_cfg, get_live_vregs(), m_num_threads);
+}
+
+bool PassManager::run_ifconvert() {
+    IfConversion if_conversion(m_cfg);
+    return replace_cfg(if_conversion.transform_cfg());
+}
+
+bool PassManager::run_pre() {
+    PartialRedundancyElimination partial_redundancy_elimination(m_cfg, get_domtree());
+    return replace_cfg(partial_redundancy_elimination.transform_cfg());
+}
+
+bool PassManager::run_loadelim() {
+    RedundantLoadElimination load_elimination(m_cfg, get_alias_analysis());
+    load_elimination.set_num_threads(m_num_threads);
+    return load_elimination.transform_in_place();
+}
+
+bool PassManager::run_dse() {
+    DeadStoreElimination dead_store_elimination(m_cfg, get_alias_analysis(), m_layout);
+    dead_store_elimination.set_num_threads(m_num_threads);
+    return dead_store_elimination.transform_in_place();
+}
+
+bool PassManager::run_licm() {
+    LoopInvariantCodeMotion loop_invariant_code_motion(m_cfg, get_domtree(), get_loops(), get_alias_analysis());
+    return replace_cfg(loop_invariant_code_motion.transform_cfg());
+}
+
+bool PassManager::run_ivsr() {
+    InductionVariableStrengthReduction strength_reduction(m_cfg, get_domtree(), get_loops());
+    return replace_cfg(strength_reduction.transform_cfg());
+}
+
+bool PassManager::run_range() {
+    ValueRangeSimplification simplification(m_cfg, *get_value_ranges());
+    bool changed = replace_cfg(simplification.transform_cfg());
+    if (simplification.get_num_folded() > 0) {
+        // fold the branches on the constant comparisons
+        ConstantPropagation constant_propagation(m_cfg);
+        constant_propagation.set_num_threads(m_num_threads);
+        replace_cfg(constant_propagation.transform_cfg());
+    }
+    return changed;
+}
+
+bool PassManager::run_boundscheck() {
+    BoundsCheckElimination bounds_check_elimination(m_cfg, *get_domtree(), *get_loops(), *get_value_ranges());
+    return replace_cfg(bounds_check_elimination.transform_cfg());
+}
+
+bool PassManager::run_divmod() {
+    DivisionCombining division_combining(m_cfg);
+    division_combining.set_num_threads(m_num_threads);
+    return division_combining.transform_in_place();
+}
+
+bool PassManager::run_lea() {
+    ScaledIndexSelection scaled_index_selection(m_cfg, get_live_vregs());
+    scaled_index_selection.set_num_threads(m_num_threads);
+    return scaled_index_selection.transform_in_place();
+}
+
+bool PassManager::run_addrfold() {
+    if (m_layout == nullptr) {
+        return false;
+    }
+    LocalAddressFolding address_folding(m_cfg, *m_layout);
+    address_folding.set_num_threads(m_num_threads);
+    if (!address_folding.transform_in_place()) {
+        return false;
+    }
+    // (removing the address computations which are no longer used)
+    DeadCodeElimination::run_to_fixpoint(m_cfg, nullptr, m_num_threads);
+    return true;
+}
+
+bool PassManager::run_copyprop() {
+    return CopyPropagation::run(m_cfg, get_live_vregs(), m_num_threads);
+}
+
+bool PassManager::run_unswitch() {
+    LoopUnswitching unswitching(m_cfg, get_domtree(), get_loops());
+    return replace_cfg(unswitching.transform_cfg());
+}
+
+bool PassManager::run_fuse() {
+    LoopFusion fusion(m_cfg, *get_loops(), *get_alias_analysis());
+    return replace_cfg(fusion.transform_cfg());
+}
+
+bool PassManager::run_promote() {
+    LoopScalarPromotion promotion(m_cfg, *get_domtree(), *get_loops(), *get_alias_analysis());
+    return replace_cfg(promotion.transform_cfg());
+}
+
+bool PassManager::run_loopidiom() {
+    LoopIdiomRecognition loop_idiom(m_cfg, *get_loops(), *get_live_vregs(), *get_alias_analysis());
+    return loop_idiom.transform_in_place();
+}
+
+bool PassManager::run_vectorize() {
+    LoopVectorization vectorization(m_cfg, get_domtree(), get_loops(), get_live_vregs());
+    return replace_cfg(vectorization.transform_cfg());
+}
+
+bool PassManager::run_commoning() {
+    PredictiveCommoning commoning(m_cfg, *get_loops(), *get_alias_analysis());
+    if (!replace_cfg(commoning.transform_cfg())) {
+        return false;
+    }
+    // (removing the address computations of the loads replaced)
+    DeadCodeElimination::run_to_fixpoint(m_cfg, nullptr, m_num_threads);
+    return true;
+}
+
+bool PassManager::run_unroll() {
+    if (m_unroll_factor < 2) {
+        return false;
+    }
+    LoopUnrolling unrolling(m_cfg, m_unroll_factor, get_domtree(), get_loops(), get_live_vregs());
+    return replace_cfg(unrolling.transform_cfg());
+}
+
+bool PassManager::run_prefetch() {
+    if (m_layout == nullptr || m_prefetch_distance == 0) {
+        return false;
+    }
+    LoopPrefetching prefetching(m_cfg, *get_loops(), *get_alias_analysis(), *m_layout, m_prefetch_distance);
+    return replace_cfg(prefetching.transform_cfg());
+}
+
+bool PassManager::run_jump_threading() {
+    JumpThreading jump_threading(m_cfg);
+    return replace_cfg(jump_threading.transform_cfg());
+}
+
+bool PassManager::run_superblock() {
+    SuperblockFormation superblocks(m_cfg);
+    return replace_cfg(superblocks.transform_cfg());
+}
+
+bool PassManager::run_tailmerge() {
+    TailMerging tail_merging(m_cfg, get_live_vregs());
+    return replace_cfg(tail_merging.transform_cfg());
+}
+
+bool PassManager::run_renumber() {
+    VregRenumbering renumbering(m_cfg);
+    if (renumbering.is_dense()) {
+        return false;
+    }
+    renumbering.set_num_threads(m_num_threads);
+    return renumbering.transform_in_place();
+}
+
+bool PassManager::run_regalloc() {
+    GraphColoringRegisterAllocation register_allocation(m_cfg, get_live_vregs(), TargetRegisters::get(m_target));
+    bool changed = register_allocation.transform_in_place() || register_allocation.has_rewritten();
+    m_assignment = register_allocation.get_assignment();
+    return changed;
+}
+
+bool PassManager::run_linearscan() {
+    LinearScanRegisterAllocation register_allocation(m_cfg, get_live_vregs(), TargetRegisters::get(m_target));
+    bool changed = register_allocation.transform_in_place();
+    m_assignment = register_allocation.get_assignment();
+    return changed;
+}
+
+bool PassManager::run_peephole() {
+    PeepholeOptimizer peephole(m_asm);
+    InstructionSequence *result = peephole.optimize();
+    bool changed = !same_instructions(m_asm, result);
+    m_replaced_asm = m_asm;
+    m_asm = result;
+    return changed;
+}
+
+bool PassManager::run_jumptable() {
+    JumpTableFormation jump_tables(m_asm);
+    InstructionSequence *result = jump_tables.transform();
+    bool changed = !same_instructions(m_asm, result);
+    m_replaced_asm = m_asm;
+    m_asm = result;
+    return changed;
+}
+
+bool PassManager::run_schedule() {
+    InstructionScheduler scheduler(m_asm, m_tune);
+    InstructionSequence *result = scheduler.schedule();
+    bool changed = !same_instructions(m_asm, result);
+    m_replaced_asm = m_asm;
+    m_asm = result;
+    return changed;
+}
+
+bool PassManager::run_align() {
+    CodeAlignment alignment(m_asm);
+    InstructionSequence *result = alignment.transform();
+    bool changed = !same_instructions(m_asm, result);
+    m_replaced_asm = m_asm;
+    m_asm = result;
+    return changed;
+}
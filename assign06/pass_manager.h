@@ -0,0 +1,233 @@
+#ifndef PASS_MANAGER_H
+#define PASS_MANAGER_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <chrono>
+#include "cfg.h"
+#include "target.h"
+
+class LiveVregs;
+class DominatorTree;
+class LoopForest;
+class AliasAnalysis;
+class ValueRangeAnalysis;
+class StorageLayout;
+struct PhaseReport;
+
+// Runs the optimization passes named by a pipeline spec, such as
+// "tailcall,ssa,lvn,constprop,dce,ifconvert,lvn,pre,loadelim,dse,dce,licm,
+// ivsr,range,boundscheck,out-of-ssa,copyprop,unswitch,fuse,promote,
+// loopidiom,vectorize,commoning,unroll,prefetch,jump-threading,divmod,lea,
+// addrfold,renumber,regalloc,peephole,jumptable,schedule,align".
+//
+// Passes are separated by commas; passes joined by '+' (e.g. "constprop+dce")
+// form a group which is run repeatedly until none of its passes reports a
+// change.  A pass which requires the CFG to be in (or out of) SSA form has
+// the "ssa" or "out-of-ssa" pass run before it when necessary, and the CFG
+// is always taken out of SSA form after the last high-level pass.  The
+// "peephole", "jumptable", "schedule" and "align" passes work on the
+// generated x86-64 code, so they (and any other x86-64 pass) must come
+// after all of the high-level passes, and "align" (see code_align.h)
+// should be the last of them.
+//
+// The "unroll" pass unrolls loops by the factor given to set_unroll_factor
+// (by default 1, which leaves them alone), and the "prefetch" pass
+// prefetches the number of bytes ahead given to set_prefetch_distance (0
+// turns it off).  The "addrfold" and "prefetch" passes need the sizes of
+// the program's variables, from set_storage_layout (without them, they
+// leave the code alone), and so does the hoisting of loads by "licm".
+// The "tailcall" pass needs the label of the subprogram being optimized,
+// from set_function_label, to recognize its calls of itself.
+//
+// The optimization levels (see get_pipeline) trade the time spent
+// compiling for the quality of the code: -O1 only runs the local passes
+// and allocates registers by linear scan, which take about linear time,
+// and -O3 runs the SSA passes to a fixed point, and forms superblocks (see
+// superblock.h) for the value numbering after them.  With a time budget (see
+// set_time_budget), the passes which would start after a function has
+// taken longer than the budget to optimize are skipped, except that the
+// "regalloc" pass is replaced by "linearscan", so that a huge function
+// still gets compiled in reasonable time.  (The budget is only checked
+// between passes, so a pass is never stopped part way.)
+//
+// The live vregs analysis, the dominator tree, the loop forest, the alias
+// analysis and the value ranges (see value_range.h) are computed when a pass
+// first needs them, and are shared by later passes until a pass reports that
+// it changed the CFG.
+class PassManager {
+public:
+    // the form of the code a pass works on
+    enum Form {
+        FORM_ANY,       // a high-level CFG, in or out of SSA form
+        FORM_SSA,       // a high-level CFG in SSA form
+        FORM_NORMAL,    // a high-level CFG not in SSA form
+        FORM_X86_64,    // the generated x86-64 instruction sequence
+    };
+
+    // a pass's run function returns true if it changed the code
+    struct PassInfo {
+        const char *name;
+        Form form;
+        bool (PassManager::*run)();
+    };
+
+private:
+    struct PassStats {
+        unsigned runs;
+        double time_ms;
+        unsigned ins_before, ins_after;
+    };
+
+public:
+    // the optimization level of get_default_pipeline
+    static const unsigned DEFAULT_LEVEL = 2;
+
+private:
+    static const PassInfo s_passes[];
+    static const unsigned MAX_ITERATIONS = 10;
+
+    // groups of indices into s_passes
+    std::vector<std::vector<unsigned>> m_pipeline;
+    // indexed the same way as s_passes
+    std::vector<PassStats> m_stats;
+    // passes which have run, in the order they first ran
+    std::vector<unsigned> m_run_order;
+    bool m_time_report;
+    unsigned m_unroll_factor;
+    long m_prefetch_distance;
+    // the time (in milliseconds) after which the passes on a function are
+    // skipped (if positive), and when the current function's passes started
+    double m_time_budget_ms;
+    std::chrono::steady_clock::time_point m_start;
+    // the threads the block-local passes may use (see ControlFlowGraphTransform)
+    unsigned m_num_threads;
+    // if non-null, each pass is recorded as a phase ("pass:<name>")
+    PhaseReport *m_phase_report;
+    const StorageLayout *m_layout;
+    std::string m_function_label;
+    // the target whose registers the register allocators assign, and the
+    // x86-64 processor the scheduler models
+    Target m_target;
+    X86_64Tune m_tune;
+
+    ControlFlowGraph *m_cfg;
+    InstructionSequence *m_asm;
+    bool m_in_ssa;
+    // the code the current pass replaced (or created and didn't use),
+    // freed once the pass is done (see IRArena::free_replaced)
+    std::vector<ControlFlowGraph *> m_replaced_cfgs;
+    InstructionSequence *m_replaced_asm;
+
+    // cached analyses (null if not computed, or invalidated)
+    LiveVregs *m_live_vregs;
+    DominatorTree *m_domtree;
+    LoopForest *m_loops;
+    AliasAnalysis *m_alias;
+    ValueRangeAnalysis *m_ranges;
+
+    std::map<int, int> m_assignment;
+
+    // disallow copy ctor and assignment operator
+    PassManager(const PassManager &);
+    PassManager &operator=(const PassManager &);
+
+public:
+    PassManager(const std::string &spec);
+    ~PassManager();
+
+    static const char *get_default_pipeline();
+    // the passes of an optimization level from 0 (none) to 3
+    static const char *get_pipeline(unsigned level);
+    // the passes of -Os: those of -O2 which don't make the code larger
+    // (without unswitching, vectorization, predictive commoning, unrolling
+    // or prefetching), and "tailmerge"
+    static const char *get_size_pipeline();
+
+    void set_time_report(bool time_report) { m_time_report = time_report; }
+    void set_unroll_factor(unsigned unroll_factor) { m_unroll_factor = unroll_factor; }
+    void set_prefetch_distance(long distance) { m_prefetch_distance = distance; }
+    void set_time_budget(double ms) { m_time_budget_ms = ms; }
+    void set_num_threads(unsigned num_threads) { m_num_threads = num_threads; }
+    void set_phase_report(PhaseReport *report) { m_phase_report = report; }
+    void set_storage_layout(const StorageLayout *layout) { m_layout = layout; }
+    void set_function_label(const std::string &label) { m_function_label = label; }
+    void set_target(Target target) { m_target = target; }
+    void set_tune(X86_64Tune tune) { m_tune = tune; }
+
+    // run the high-level passes, returning the optimized CFG
+    // (which is never in SSA form)
+    ControlFlowGraph *run_highlevel(ControlFlowGraph *cfg);
+
+    // run the x86-64 passes, returning the optimized instruction sequence
+    InstructionSequence *run_x86_64(InstructionSequence *iseq);
+
+    // the vreg to machine register assignment made by the "regalloc"
+    // (or "linearscan") pass
+    // (empty if it didn't run, or if the CFG changed after it ran)
+    const std::map<int, int> &get_assignment() const { return m_assignment; }
+
+    // print the time spent in each pass, and the number of instructions
+    // before and after it ran, to stderr (if the time report is enabled)
+    void print_time_report() const;
+
+private:
+    static unsigned find_pass(const std::string &name);
+    void run_group(const std::vector<unsigned> &group);
+    bool run_pass(unsigned index);
+    void free_replaced();
+    bool is_over_budget() const;
+    unsigned count_instructions() const;
+
+    const LiveVregs *get_live_vregs();
+    const DominatorTree *get_domtree();
+    const LoopForest *get_loops();
+    const AliasAnalysis *get_alias_analysis();
+    // (only while the CFG is in SSA form)
+    const ValueRangeAnalysis *get_value_ranges();
+    void invalidate_analyses();
+
+    // replace the CFG with the result of a transformation,
+    // returning true if it differs from the original CFG
+    bool replace_cfg(ControlFlowGraph *result);
+
+    bool run_ssa();
+    bool run_out_of_ssa();
+    bool run_tailcall();
+    bool run_lvn();
+    bool run_constprop();
+    bool run_dce();
+    bool run_ifconvert();
+    bool run_pre();
+    bool run_loadelim();
+    bool run_dse();
+    bool run_licm();
+    bool run_ivsr();
+    bool run_range();
+    bool run_boundscheck();
+    bool run_copyprop();
+    bool run_unswitch();
+    bool run_fuse();
+    bool run_promote();
+    bool run_loopidiom();
+    bool run_vectorize();
+    bool run_commoning();
+    bool run_unroll();
+    bool run_prefetch();
+    bool run_divmod();
+    bool run_lea();
+    bool run_addrfold();
+    bool run_jump_threading();
+    bool run_superblock();
+    bool run_tailmerge();
+    bool run_renumber();
+    bool run_regalloc();
+    bool run_linearscan();
+    bool run_peephole();
+    bool run_jumptable();
+    bool run_schedule();
+    bool run_align();
+};
+
+#endif // PASS_MANAGER_H
@@ -0,0 +1,617 @@
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include "cfg.h"
+#include "x86_64.h"
+#include "peephole.h"
+
+namespace {
+    // the condition codes, as an extra "register" in a register mask
+    const int FLAGS = X86_64::FLAGS;
+
+    // the size of a stack slot
+    const long SLOT_SIZE = 8;
+
+    bool is_mreg(const Operand &operand) {
+        return operand.get_kind() == OPERAND_MREG;
+    }
+
+    bool is_mreg(const Operand &operand, int mreg) {
+        return operand.get_kind() == OPERAND_MREG && operand.get_base_reg() == mreg;
+    }
+
+    bool is_scratch(const Operand &operand) {
+        return is_mreg(operand) && PeepholeOptimizer::is_scratch_reg(operand.get_base_reg());
+    }
+
+    // does the operand's value (or address) depend on a register?
+    bool refers_to(const Operand &operand, int mreg) {
+        return (X86_64::get_source_regs(operand) & (1U << mreg)) != 0;
+    }
+
+    bool is_imm32(const Operand &operand) {
+        return operand.get_kind() == OPERAND_INT_LITERAL
+               && operand.get_int_value() >= INT_MIN && operand.get_int_value() <= INT_MAX;
+    }
+
+    bool same_operand(const Operand &a, const Operand &b) {
+        if (a.get_kind() != b.get_kind()) {
+            return false;
+        }
+        if (a.has_base_reg() && a.get_base_reg() != b.get_base_reg()) {
+            return false;
+        }
+        if (a.has_index_reg() && (a.get_index_reg() != b.get_index_reg() || a.get_scale() != b.get_scale())) {
+            return false;
+        }
+        if ((a.get_kind() & OPROP_HAS_INTVAL) != 0) {
+            if (a.is_memref() ? a.get_offset() != b.get_offset() : a.get_int_value() != b.get_int_value()) {
+                return false;
+            }
+        }
+        if ((a.get_kind() & OPROP_HAS_LABEL) != 0 && a.get_target_label() != b.get_target_label()) {
+            return false;
+        }
+        return true;
+    }
+
+    bool is_move(Instruction *ins) {
+        return ins->get_opcode() == MINS_MOVQ;
+    }
+
+    // arithmetic/comparison instructions of the form "op src, dst"
+    bool is_alu(Instruction *ins) {
+        int opcode = ins->get_opcode();
+        return (opcode == MINS_ADDQ || opcode == MINS_SUBQ || opcode == MINS_IMULQ || opcode == MINS_CMPQ)
+               && ins->get_num_operands() == 2;
+    }
+
+    bool is_commutative(int opcode) {
+        return opcode == MINS_ADDQ || opcode == MINS_IMULQ;
+    }
+
+    // can "movq src, dst" be encoded?
+    bool can_move(const Operand &src, const Operand &dst) {
+        if (dst.is_memref()) {
+            return is_mreg(src) || is_imm32(src);
+        }
+        return is_mreg(dst);
+    }
+
+    // can "op src, dst" be encoded?
+    bool can_alu(int opcode, const Operand &src, const Operand &dst) {
+        if (!is_mreg(dst) && !(dst.is_memref() && opcode != MINS_IMULQ)) {
+            return false;
+        }
+        if (src.is_memref()) {
+            return !dst.is_memref();
+        }
+        return is_mreg(src) || is_imm32(src);
+    }
+
+    // the number of bytes an instruction reads or writes through a memory operand
+    long get_access_size(int opcode) {
+        if (opcode == MINS_MOVB || opcode == MINS_MOVZBQ) {
+            return 1;
+        }
+        return (opcode == MINS_MOVDQU || opcode == MINS_MOVDQA || opcode == MINS_VMOVDQU) ? 16 : 8;
+    }
+
+    // is an instruction's operand a memory location it only writes?
+    bool is_memory_write(Instruction *ins, unsigned i) {
+        int opcode = ins->get_opcode();
+        return i == 1 && (opcode == MINS_MOVQ || opcode == MINS_MOVB || opcode == MINS_MOVDQU || opcode == MINS_VMOVDQU);
+    }
+
+    // is an %rsp-relative slot possibly read through a memory operand?
+    // (the leaq of an address reads nothing)
+    bool may_read_slot(Instruction *ins, unsigned i, long offset, long private_end) {
+        const Operand &operand = ins->get_operand(i);
+        if (!operand.is_memref() || is_memory_write(ins, i) || ins->get_opcode() == MINS_LEAQ
+            || operand.get_kind() == OPERAND_LABEL_MEMREF) {
+            return false;
+        }
+        if (!operand.has_base_reg() || operand.get_base_reg() != MREG_RSP) {
+            return offset + SLOT_SIZE > private_end;
+        }
+        if (operand.has_index_reg()) {
+            return true;
+        }
+        long start = operand.get_offset();
+        return start < offset + SLOT_SIZE && offset < start + get_access_size(ins->get_opcode());
+    }
+
+    Instruction *with_comment(Instruction *ins, Instruction *orig) {
+        ins->copy_comment(orig);
+        return ins;
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    // Rules
+    ////////////////////////////////////////////////////////////////////////
+
+    // movq %rX, %rX  =>  (nothing)
+    bool remove_self_move(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        return is_move(w[0]) && is_mreg(w[0]->get_operand(0))
+               && same_operand(w[0]->get_operand(0), w[0]->get_operand(1));
+    }
+
+    // nop  =>  (nothing)
+    bool remove_nop(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        return w[0]->get_opcode() == MINS_NOP;
+    }
+
+    // jmp L; L:  =>  L:
+    bool remove_jump_to_next(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        return w[0]->get_opcode() == MINS_JMP && w[0]->get_operand(0).get_target_label() == w.get_next_label();
+    }
+
+    // movq %rA, M; movq M, %rB  =>  movq %rA, M; movq %rA, %rB
+    bool fold_store_reload(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        if (!is_move(w[0]) || !is_move(w[1])) {
+            return false;
+        }
+        Operand a = w[0]->get_operand(0), m = w[0]->get_operand(1), b = w[1]->get_operand(1);
+        if (!is_mreg(a) || !m.is_memref() || !same_operand(m, w[1]->get_operand(0)) || !is_mreg(b)) {
+            return false;
+        }
+        result.push_back(w[0]->duplicate());
+        if (!same_operand(a, b)) {
+            result.push_back(new Instruction(MINS_MOVQ, a, b));
+        }
+        return true;
+    }
+
+    // movq M, %rA; movq %rA, M  =>  movq M, %rA
+    bool remove_redundant_store(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        if (!is_move(w[0]) || !is_move(w[1])) {
+            return false;
+        }
+        Operand m = w[0]->get_operand(0), a = w[0]->get_operand(1);
+        if (!m.is_memref() || !is_mreg(a) || refers_to(m, a.get_base_reg())
+            || !same_operand(a, w[1]->get_operand(0)) || !same_operand(m, w[1]->get_operand(1))) {
+            return false;
+        }
+        result.push_back(w[0]->duplicate());
+        return true;
+    }
+
+    // movq A, S; (code not reading S before overwriting it)  =>  (nothing)
+    // where S is a slot in the stack frame, such as a spilled vreg's
+    bool remove_dead_store(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        if (!is_move(w[0])) {
+            return false;
+        }
+        Operand s = w[0]->get_operand(1);
+        return s.get_kind() == OPERAND_MREG_MEMREF_OFFSET && s.get_base_reg() == MREG_RSP
+               && w.is_slot_dead_after(s.get_offset());
+    }
+
+    // movq A, %rS; movq %rS, B  =>  movq A, B
+    bool forward_copy(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        if (!is_move(w[0]) || !is_move(w[1])) {
+            return false;
+        }
+        Operand a = w[0]->get_operand(0), s = w[0]->get_operand(1), b = w[1]->get_operand(1);
+        if (!is_scratch(s) || !same_operand(s, w[1]->get_operand(0)) || refers_to(b, s.get_base_reg())
+            || !can_move(a, b) || !w.is_dead_after(s.get_base_reg())) {
+            return false;
+        }
+        if (!(is_mreg(a) && same_operand(a, b))) {
+            result.push_back(with_comment(new Instruction(MINS_MOVQ, a, b), w[0]));
+        }
+        return true;
+    }
+
+    // movq A, %rS; op %rS, X  =>  op A, X
+    bool forward_source(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        if (!is_move(w[0]) || !is_alu(w[1])) {
+            return false;
+        }
+        Operand a = w[0]->get_operand(0), s = w[0]->get_operand(1), x = w[1]->get_operand(1);
+        int opcode = w[1]->get_opcode();
+        if (!is_scratch(s) || !same_operand(s, w[1]->get_operand(0)) || refers_to(x, s.get_base_reg())
+            || !can_alu(opcode, a, x) || !w.is_dead_after(s.get_base_reg())) {
+            return false;
+        }
+        result.push_back(with_comment(new Instruction(opcode, a, x), w[0]));
+        return true;
+    }
+
+    // movq A, %rS; movq B, %rT; op %rS, %rT  =>  movq B, %rT; op A, %rT
+    bool forward_source_past_load(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        if (!is_move(w[0]) || !is_move(w[1]) || !is_alu(w[2])) {
+            return false;
+        }
+        Operand a = w[0]->get_operand(0), s = w[0]->get_operand(1);
+        Operand b = w[1]->get_operand(0), t = w[1]->get_operand(1);
+        int opcode = w[2]->get_opcode();
+        if (!is_scratch(s) || !is_scratch(t) || same_operand(s, t)
+            || !same_operand(s, w[2]->get_operand(0)) || !same_operand(t, w[2]->get_operand(1))
+            || refers_to(a, t.get_base_reg()) || refers_to(b, s.get_base_reg())
+            || !can_alu(opcode, a, t) || !w.is_dead_after(s.get_base_reg())) {
+            return false;
+        }
+        result.push_back(with_comment(w[1]->duplicate(), w[0]));
+        result.push_back(new Instruction(opcode, a, t));
+        return true;
+    }
+
+    // movq B, %rT; op A, %rT; movq %rT, %rD  =>  movq B, %rD; op A, %rD
+    // (or just "op B, %rD" if op is commutative and A is %rD)
+    bool fold_result(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        if (!is_move(w[0]) || !is_alu(w[1]) || w[1]->get_opcode() == MINS_CMPQ || !is_move(w[2])) {
+            return false;
+        }
+        Operand b = w[0]->get_operand(0), t = w[0]->get_operand(1);
+        Operand a = w[1]->get_operand(0), d = w[2]->get_operand(1);
+        int opcode = w[1]->get_opcode();
+        if (!is_scratch(t) || !same_operand(t, w[1]->get_operand(1)) || !same_operand(t, w[2]->get_operand(0))
+            || !is_mreg(d) || same_operand(d, t) || refers_to(a, t.get_base_reg())
+            || !w.is_dead_after(t.get_base_reg())) {
+            return false;
+        }
+
+        if (!refers_to(a, d.get_base_reg()) && can_alu(opcode, a, d)) {
+            if (!same_operand(b, d)) {
+                result.push_back(new Instruction(MINS_MOVQ, b, d));
+            }
+            result.push_back(new Instruction(opcode, a, d));
+        } else if (is_commutative(opcode) && same_operand(a, d) && can_alu(opcode, b, d)) {
+            result.push_back(new Instruction(opcode, b, d));
+        } else {
+            return false;
+        }
+        with_comment(result[0], w[0]);
+        return true;
+    }
+
+    // movq B, %rT; cmpq A, %rT  =>  cmpq A, B
+    bool fold_compare(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        if (!is_move(w[0]) || w[1]->get_opcode() != MINS_CMPQ) {
+            return false;
+        }
+        Operand b = w[0]->get_operand(0), t = w[0]->get_operand(1), a = w[1]->get_operand(0);
+        if (!is_scratch(t) || !same_operand(t, w[1]->get_operand(1)) || refers_to(a, t.get_base_reg())
+            || !(is_mreg(b) || b.is_memref()) || !can_alu(MINS_CMPQ, a, b)
+            || !w.is_dead_after(t.get_base_reg())) {
+            return false;
+        }
+        result.push_back(with_comment(new Instruction(MINS_CMPQ, a, b), w[0]));
+        return true;
+    }
+
+    // leaq M, %rS; movq %rS, %rD  =>  leaq M, %rD
+    bool fold_lea_result(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        if (w[0]->get_opcode() != MINS_LEAQ || !is_move(w[1])) {
+            return false;
+        }
+        Operand m = w[0]->get_operand(0), s = w[0]->get_operand(1), d = w[1]->get_operand(1);
+        if (!is_scratch(s) || !same_operand(s, w[1]->get_operand(0)) || !is_mreg(d)
+            || !w.is_dead_after(s.get_base_reg())) {
+            return false;
+        }
+        result.push_back(with_comment(new Instruction(MINS_LEAQ, m, d), w[0]));
+        return true;
+    }
+
+    // movq %rA, %rS; ... (%rS) ...  =>  ... (%rA) ...
+    bool forward_address(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        int opcode = w[1]->get_opcode();
+        if (!is_move(w[0]) || !(is_move(w[1]) || is_alu(w[1]) || opcode == MINS_LEAQ
+                                || opcode == MINS_MOVZBQ || opcode == MINS_MOVB)) {
+            return false;
+        }
+        Operand a = w[0]->get_operand(0), s = w[0]->get_operand(1);
+        if (!is_mreg(a) || !is_scratch(s) || same_operand(a, s)) {
+            return false;
+        }
+        int sreg = s.get_base_reg(), areg = a.get_base_reg();
+
+        // the instruction must use %rS only in addresses
+        Instruction *ins = w[1]->duplicate();
+        bool found = false;
+        for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+            Operand &operand = (*ins)[i];
+            if (is_mreg(operand, sreg) && (i == 0 || is_alu(ins))) {
+                delete ins;
+                return false;
+            }
+            if (operand.is_memref() && operand.has_base_reg() && operand.get_base_reg() == sreg) {
+                operand.set_base_reg(areg);
+                found = true;
+            }
+            if (operand.is_memref() && operand.has_index_reg() && operand.get_index_reg() == sreg) {
+                operand.set_index_reg(areg);
+                found = true;
+            }
+        }
+        if (!found || !((X86_64::get_effects(w[1]).writes & (1U << sreg)) != 0 || w.is_dead_after(sreg))) {
+            delete ins;
+            return false;
+        }
+        result.push_back(with_comment(ins, w[0]));
+        return true;
+    }
+
+    // movq %rB, %rD; addq A, %rD  =>  leaq A(%rB), %rD  (or leaq (%rB,%rA), %rD)
+    bool add_to_lea(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        int opcode = w[1]->get_opcode();
+        if (!is_move(w[0]) || (opcode != MINS_ADDQ && opcode != MINS_SUBQ)) {
+            return false;
+        }
+        Operand b = w[0]->get_operand(0), d = w[0]->get_operand(1), a = w[1]->get_operand(0);
+        if (!is_mreg(b) || !is_mreg(d) || same_operand(b, d) || !same_operand(d, w[1]->get_operand(1))
+            || !w.are_flags_dead_after()) {
+            return false;
+        }
+
+        Operand addr;
+        if (is_imm32(a) && (opcode == MINS_ADDQ || a.get_int_value() != INT_MIN)) {
+            long offset = (opcode == MINS_ADDQ) ? a.get_int_value() : -a.get_int_value();
+            addr = Operand(OPERAND_MREG_MEMREF_OFFSET, b.get_base_reg(), int(offset));
+        } else if (is_mreg(a) && opcode == MINS_ADDQ) {
+            // %rD holds %rB when the addition is done
+            int index = same_operand(a, d) ? b.get_base_reg() : a.get_base_reg();
+            addr = Operand(OPERAND_MREG_MEMREF_INDEX, b.get_base_reg(), index);
+        } else {
+            return false;
+        }
+        result.push_back(with_comment(new Instruction(MINS_LEAQ, addr, d), w[0]));
+        return true;
+    }
+
+    // movq $0, %rX  =>  xorl %eX, %eX
+    // (writing the low 32 bits of a register zeroes the rest, and the
+    // 32-bit form needs no REX prefix for the registers below %r8)
+    bool use_zero_idiom(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        if (!is_move(w[0])) {
+            return false;
+        }
+        Operand src = w[0]->get_operand(0), dst = w[0]->get_operand(1);
+        if (src.get_kind() != OPERAND_INT_LITERAL || src.get_int_value() != 0 || !is_mreg(dst)
+            || !w.are_flags_dead_after()) {
+            return false;
+        }
+        result.push_back(with_comment(new Instruction(MINS_XORL, dst, dst), w[0]));
+        return true;
+    }
+
+    // movq $n, %rX  =>  movl $n, %eX   (for 0 < n < 2^32)
+    // (a 5 or 6 byte instruction rather than a 7 byte one, or a 10 byte
+    // movabsq for n >= 2^31)
+    bool use_short_move(const PeepholeWindow &w, std::vector<Instruction *> &result) {
+        if (!is_move(w[0])) {
+            return false;
+        }
+        Operand src = w[0]->get_operand(0), dst = w[0]->get_operand(1);
+        if (src.get_kind() != OPERAND_INT_LITERAL || src.get_int_value() <= 0
+            || src.get_int_value() > long(UINT_MAX) || !is_mreg(dst)) {
+            return false;
+        }
+        result.push_back(with_comment(new Instruction(MINS_MOVL, src, dst), w[0]));
+        return true;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// PeepholeWindow implementation
+////////////////////////////////////////////////////////////////////////
+
+PeepholeWindow::PeepholeWindow(const InstructionSequence *iseq, unsigned start, unsigned size,
+                               long private_end)
+        : m_iseq(iseq)
+        , m_start(start)
+        , m_size(size)
+        , m_private_end(private_end) {
+}
+
+std::string PeepholeWindow::get_next_label() const {
+    unsigned next = m_start + m_size;
+    if (next == m_iseq->get_length()) {
+        return m_iseq->has_label_at_end() ? m_iseq->get_label_at_end() : "";
+    }
+    return m_iseq->has_label(next) ? m_iseq->get_label(next) : "";
+}
+
+bool PeepholeWindow::is_dead_after(int mreg) const {
+    assert(PeepholeOptimizer::is_scratch_reg(mreg));
+    for (unsigned i = m_start + m_size; i < m_iseq->get_length(); i++) {
+        if (m_iseq->has_label(i)) {
+            return true;
+        }
+        Instruction *ins = m_iseq->get_instruction(i);
+        X86_64Effects effects = X86_64::get_effects(ins);
+        if ((effects.reads & (1U << mreg)) != 0) {
+            return false;
+        }
+        if ((effects.writes & (1U << mreg)) != 0) {
+            return true;
+        }
+        int opcode = ins->get_opcode();
+        if (opcode == MINS_JMP || opcode == MINS_COLD || (effects.reads & (1U << FLAGS)) != 0) {
+            return true;
+        }
+    }
+    // (at the end of a function, %rax holds its result)
+    return mreg != MREG_RAX;
+}
+
+bool PeepholeWindow::are_flags_dead_after() const {
+    for (unsigned i = m_start + m_size; i < m_iseq->get_length(); i++) {
+        Instruction *ins = m_iseq->get_instruction(i);
+        if (m_iseq->has_label(i) || ins->get_opcode() == MINS_JMP || ins->get_opcode() == MINS_COLD) {
+            return true;
+        }
+        X86_64Effects effects = X86_64::get_effects(ins);
+        if ((effects.reads & (1U << FLAGS)) != 0) {
+            return false;
+        }
+        if ((effects.writes & (1U << FLAGS)) != 0) {
+            return true;
+        }
+    }
+    return true;
+}
+
+bool PeepholeWindow::is_slot_dead_after(long offset) const {
+    Operand slot(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, int(offset));
+    for (unsigned i = m_start + m_size; i < m_iseq->get_length(); i++) {
+        Instruction *ins = m_iseq->get_instruction(i);
+        int opcode = ins->get_opcode();
+        if (opcode == MINS_RET || opcode == MINS_COLD) {
+            return true;
+        }
+        if (opcode == MINS_CALL || opcode == MINS_PUSHQ || opcode == MINS_POPQ || opcode == MINS_REP_MOVSQ
+            || (opcode >= MINS_JMP && opcode <= MINS_JA) || (X86_64::get_effects(ins).writes & (1U << MREG_RSP)) != 0) {
+            return false;
+        }
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            if (may_read_slot(ins, j, offset, m_private_end)) {
+                return false;
+            }
+        }
+        if (opcode == MINS_MOVQ && same_operand(slot, ins->get_operand(1))) {
+            return true;
+        }
+    }
+    // (the stack frame is deallocated by the epilogue)
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// PeepholeOptimizer implementation
+////////////////////////////////////////////////////////////////////////
+
+const PeepholeRule PeepholeOptimizer::s_rules[] = {
+    { "remove-self-move",         1, remove_self_move },
+    { "remove-nop",               1, remove_nop },
+    { "remove-jump-to-next",      1, remove_jump_to_next },
+    { "fold-store-reload",        2, fold_store_reload },
+    { "remove-redundant-store",   2, remove_redundant_store },
+    { "remove-dead-store",        1, remove_dead_store },
+    { "forward-copy",             2, forward_copy },
+    { "forward-source",           2, forward_source },
+    { "forward-source-past-load", 3, forward_source_past_load },
+    { "fold-result",              3, fold_result },
+    { "fold-compare",             2, fold_compare },
+    { "fold-lea-result",          2, fold_lea_result },
+    { "forward-address",          2, forward_address },
+    { nullptr,                    0, nullptr },
+};
+
+const PeepholeRule PeepholeOptimizer::s_late_rules[] = {
+    { "add-to-lea",               2, add_to_lea },
+    { "use-zero-idiom",           1, use_zero_idiom },
+    { "use-short-move",           1, use_short_move },
+    { nullptr,                    0, nullptr },
+};
+
+PeepholeOptimizer::PeepholeOptimizer(InstructionSequence *iseq)
+        : m_iseq(iseq) {
+}
+
+PeepholeOptimizer::~PeepholeOptimizer() {
+}
+
+InstructionSequence *PeepholeOptimizer::optimize() {
+    InstructionSequence *iseq = m_iseq;
+    bool changed = true;
+    while (changed) {
+        auto out = new InstructionSequence();
+        changed = optimize_pass(s_rules, iseq, out);
+        iseq = out;
+    }
+
+    auto out = new InstructionSequence();
+    optimize_pass(s_late_rules, iseq, out);
+    return out;
+}
+
+bool PeepholeOptimizer::is_scratch_reg(int mreg) {
+    return mreg == MREG_RAX || mreg == MREG_RDX || mreg == MREG_R10 || mreg == MREG_R11;
+}
+
+long PeepholeOptimizer::get_private_end(const InstructionSequence *iseq) {
+    long end = LONG_MAX;
+    for (unsigned i = 0; i < iseq->get_length(); i++) {
+        Instruction *ins = iseq->get_instruction(i);
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            const Operand &operand = ins->get_operand(j);
+            if (is_mreg(operand, MREG_RSP)
+                || (operand.is_memref() && operand.has_index_reg() && operand.get_index_reg() == MREG_RSP)) {
+                return 0;
+            }
+            if (ins->get_opcode() == MINS_LEAQ && j == 0 && operand.has_base_reg()
+                && operand.get_base_reg() == MREG_RSP) {
+                end = std::min(end, operand.has_index_reg() ? 0L : long(operand.get_offset()));
+            }
+        }
+    }
+    return end;
+}
+
+bool PeepholeOptimizer::optimize_pass(const PeepholeRule *rules, const InstructionSequence *in,
+                                      InstructionSequence *out) {
+    bool changed = false;
+
+    // set if the label of a removed instruction will be the label of
+    // the next instruction added to out
+    bool label_pending = false;
+
+    long private_end = get_private_end(in);
+    unsigned len = in->get_length();
+    unsigned i = 0;
+    while (i < len) {
+        std::vector<Instruction *> result;
+        const PeepholeRule *rule;
+        for (rule = rules; rule->name != nullptr; rule++) {
+            if (i + rule->size > len) {
+                continue;
+            }
+            // only the first instruction in the window may be labeled
+            bool has_inner_label = false;
+            for (unsigned j = 1; j < rule->size; j++) {
+                has_inner_label = has_inner_label || in->has_label(i + j);
+            }
+            if (has_inner_label) {
+                continue;
+            }
+
+            PeepholeWindow window(in, i, rule->size, private_end);
+            if (!rule->apply(window, result)) {
+                continue;
+            }
+
+            // if all of the instructions are removed, their label (if any) is
+            // moved to the next instruction, which must not have its own label
+            if (result.empty() && (label_pending || in->has_label(i)) && window.get_next_label() != "") {
+                continue;
+            }
+            break;
+        }
+
+        unsigned size = 1;
+        if (rule->name != nullptr) {
+            size = rule->size;
+            changed = true;
+        } else {
+            result.push_back(in->get_instruction(i)->duplicate());
+        }
+
+        if (in->has_label(i)) {
+            out->define_label(in->get_label(i));
+        }
+        label_pending = result.empty() && (label_pending || in->has_label(i));
+        for (auto j = result.begin(); j != result.end(); j++) {
+            out->add_instruction(*j);
+        }
+        i += size;
+    }
+
+    if (in->has_label_at_end()) {
+        out->define_label(in->get_label_at_end());
+    }
+
+    return changed;
+}
@@ -0,0 +1,94 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <vector>
+#include <string>
+#include "cfg.h"
+#include "x86_64.h"
+
+// A window of consecutive instructions in an x86-64 InstructionSequence,
+// examined by a peephole rule.
+class PeepholeWindow {
+private:
+    const InstructionSequence *m_iseq;
+    unsigned m_start, m_size;
+    long m_private_end;
+
+public:
+    // (the %rsp-relative slots below private_end are never addressed
+    // other than through %rsp, see PeepholeOptimizer::get_private_end)
+    PeepholeWindow(const InstructionSequence *iseq, unsigned start, unsigned size, long private_end = 0);
+
+    unsigned get_size() const { return m_size; }
+    Instruction *operator[](unsigned i) const { return m_iseq->get_instruction(m_start + i); }
+
+    // get the label of the instruction following the window
+    // (or the label at the end of the sequence), if any
+    std::string get_next_label() const;
+
+    // Is the value of a scratch register (%rax, %rdx, %r10, or %r11)
+    // at the end of the window never used?  AssemblyCodeGen never leaves
+    // a value in a scratch register for a later high-level instruction,
+    // so scratch registers are dead at labels and branches (and at the
+    // end of the function, except %rax, which holds a function's result).
+    bool is_dead_after(int mreg) const;
+
+    // Are the condition codes at the end of the window never used?
+    // Conditional jumps are always generated immediately after the
+    // comparison they use, so the condition codes are also dead at labels
+    // and jumps.
+    bool are_flags_dead_after() const;
+
+    // Is the 8-byte %rsp-relative slot at offset never read after the
+    // window, before it is overwritten (by a movq) or the function
+    // returns?  Only a straight line of code is followed (up to a jump
+    // or call); the slot may be read by any access through another
+    // register unless it is a private slot, such as a spill slot.
+    bool is_slot_dead_after(long offset) const;
+};
+
+// A peephole rule: if the instructions in a window (of the rule's size)
+// match the rule's pattern, apply returns true and adds the (new) replacement
+// instructions to result.  The replacement may be empty.
+struct PeepholeRule {
+    const char *name;
+    unsigned size;
+    bool (*apply)(const PeepholeWindow &window, std::vector<Instruction *> &result);
+};
+
+// Peephole optimization of the x86-64 code generated by AssemblyCodeGen.
+//
+// The rules in PeepholeOptimizer::s_rules are applied repeatedly, to every window
+// of instructions not containing a label (other than at its first instruction),
+// until none of them applies; the rules in s_late_rules (which would prevent
+// other rules from matching) are then applied once.  Adding a pattern only
+// requires writing its apply function and adding it to one of the tables.
+class PeepholeOptimizer {
+private:
+    InstructionSequence *m_iseq;
+
+    static const PeepholeRule s_rules[];
+    static const PeepholeRule s_late_rules[];
+
+public:
+    PeepholeOptimizer(InstructionSequence *iseq);
+    ~PeepholeOptimizer();
+
+    // get the optimized instruction sequence
+    InstructionSequence *optimize();
+
+    // registers which are only used within the code for a single
+    // high-level instruction
+    static bool is_scratch_reg(int mreg);
+
+    // the end of the %rsp-relative slots at the bottom of the stack frame
+    // which are only accessed through %rsp: the lowest %rsp-relative
+    // address taken by a leaq (the vregs' stack slots are below the
+    // local variables), or 0 if %rsp itself is used as a value
+    static long get_private_end(const InstructionSequence *iseq);
+
+private:
+    bool optimize_pass(const PeepholeRule *rules, const InstructionSequence *in, InstructionSequence *out);
+};
+
+#endif // PEEPHOLE_H
@@ -0,0 +1,80 @@
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perf_counters.h"
+
+namespace {
+
+// the type and configuration of each counter's event (in the order of
+// enum Counter)
+const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} s_events[] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch_misses" },
+    { PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      "l1d_misses" },
+};
+
+static_assert(sizeof(s_events) / sizeof(s_events[0]) == PerfCounters::NUM_COUNTERS,
+              "s_events must have an entry for each counter");
+
+}
+
+PerfCounters::PerfCounters(pid_t pid, bool on_exec) {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = s_events[i].type;
+        attr.config = s_events[i].config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.disabled = on_exec;
+        attr.enable_on_exec = on_exec;
+        m_fds[i] = int(syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0));
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (m_fds[i] >= 0) {
+            close(m_fds[i]);
+        }
+    }
+}
+
+bool PerfCounters::is_available() const {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (m_fds[i] >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PerfCounters::read(uint64_t counts[NUM_COUNTERS]) const {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        // the count, the time enabled and the time running
+        uint64_t values[3];
+        counts[i] = 0;
+        if (m_fds[i] < 0 || ::read(m_fds[i], values, sizeof(values)) != ssize_t(sizeof(values))) {
+            continue;
+        }
+        if (values[2] != 0 && values[2] < values[1]) {
+            counts[i] = uint64_t(double(values[0]) * double(values[1]) / double(values[2]));
+        } else {
+            counts[i] = values[0];
+        }
+    }
+}
+
+const char *PerfCounters::get_name(Counter counter) {
+    return s_events[counter].name;
+}
@@ -0,0 +1,52 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <sys/types.h>
+
+// Hardware performance counters (cycles, instructions, branch misses and
+// L1 data cache read misses) of a thread, counted in user space only,
+// opened with perf_event_open.  The counters are independent of each
+// other (rather than a group), so that the ones the processor or the
+// kernel doesn't support are just missing; if the kernel multiplexes
+// them, the counts are scaled by the fraction of the time each ran.
+//
+// Counters which can't be opened (such as in a virtual machine without
+// a PMU, or when perf_event_paranoid forbids it) read as 0, and
+// is_available is false if none of them can.
+class PerfCounters {
+public:
+    enum Counter {
+        CYCLES,
+        INSTRUCTIONS,
+        BRANCH_MISSES,
+        L1D_MISSES,
+        NUM_COUNTERS
+    };
+
+private:
+    int m_fds[NUM_COUNTERS];
+
+public:
+    // count the events of the process with the given pid (0 is the
+    // calling thread), starting now or, if on_exec is true, when it next
+    // calls exec
+    explicit PerfCounters(pid_t pid = 0, bool on_exec = false);
+    ~PerfCounters();
+
+    bool is_available() const;
+    bool is_available(Counter counter) const { return m_fds[counter] >= 0; }
+
+    // read the counts since the counters were started
+    void read(uint64_t counts[NUM_COUNTERS]) const;
+
+    // the name of a counter (as a CSV column)
+    static const char *get_name(Counter counter);
+
+private:
+    // not copyable
+    PerfCounters(const PerfCounters &);
+    PerfCounters &operator=(const PerfCounters &);
+};
+
+#endif // PERF_COUNTERS_H
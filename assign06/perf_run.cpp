@@ -0,0 +1,86 @@
+// Run a program, counting its hardware events (for the benchmarks, see
+// bench/run_bench.rb).
+//
+// Usage: perf_run <counts-file> <program> [<args>...]
+//
+// The program's standard input and output are this program's, and the
+// exit status is the program's (or 127 if it can't be run).  The counts
+// file gets a CSV header row and a row of the counts of the program's
+// cycles, instructions, branch misses and L1 data cache misses, and its
+// instructions per cycle, in user space; the counts which aren't
+// available (see perf_counters.h) are left empty.
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "perf_counters.h"
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: perf_run <counts-file> <program> [<args>...]\n");
+    return 127;
+  }
+
+  // the child waits until its counters are opened before it runs the
+  // program (which starts them)
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return 127;
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return 127;
+  }
+  if (pid == 0) {
+    char c;
+    close(fds[1]);
+    if (read(fds[0], &c, 1) != 1) {
+      _exit(127);
+    }
+    close(fds[0]);
+    execvp(argv[2], argv + 2);
+    perror(argv[2]);
+    _exit(127);
+  }
+
+  close(fds[0]);
+  PerfCounters counters(pid, true);
+  if (write(fds[1], "x", 1) != 1) {
+    perror("write");
+  }
+  close(fds[1]);
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0) {
+    perror("waitpid");
+    return 127;
+  }
+  uint64_t counts[PerfCounters::NUM_COUNTERS];
+  counters.read(counts);
+
+  FILE *out = fopen(argv[1], "w");
+  if (out == nullptr) {
+    perror(argv[1]);
+    return 127;
+  }
+  for (int i = 0; i < PerfCounters::NUM_COUNTERS; i++) {
+    fprintf(out, "%s,", PerfCounters::get_name(PerfCounters::Counter(i)));
+  }
+  fprintf(out, "ipc\n");
+  for (int i = 0; i < PerfCounters::NUM_COUNTERS; i++) {
+    if (counters.is_available(PerfCounters::Counter(i))) {
+      fprintf(out, "%llu", (unsigned long long) counts[i]);
+    }
+    fputc(',', out);
+  }
+  if (counts[PerfCounters::CYCLES] != 0) {
+    fprintf(out, "%.3f", double(counts[PerfCounters::INSTRUCTIONS]) / double(counts[PerfCounters::CYCLES]));
+  }
+  fputc('\n', out);
+  fclose(out);
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
@@ -0,0 +1,170 @@
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sys/resource.h>
+#include "phase_report.h"
+
+namespace {
+
+// the number of allocations made with operator new on this thread,
+// and their total size
+thread_local unsigned long t_allocations, t_allocated_bytes;
+
+}
+
+void *operator new(std::size_t size) {
+    t_allocations++;
+    t_allocated_bytes += size;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+PhaseReport::PhaseReport()
+        : m_start(std::chrono::steady_clock::now())
+        , m_start_allocations(t_allocations)
+        , m_start_allocated_bytes(t_allocated_bytes) {
+    for (int i = 0; i < PerfCounters::NUM_COUNTERS; i++) {
+        m_start_counts[i] = 0;
+    }
+}
+
+void PhaseReport::count_hardware_events() {
+    m_counters.reset(new PerfCounters());
+    if (!m_counters->is_available()) {
+        m_counters.reset();
+        return;
+    }
+    m_counters->read(m_start_counts);
+}
+
+namespace {
+
+// the instructions per cycle of a phase (or 0 if it isn't known)
+double get_ipc(const uint64_t *counts) {
+    if (counts[PerfCounters::CYCLES] == 0) {
+        return 0.0;
+    }
+    return double(counts[PerfCounters::INSTRUCTIONS]) / double(counts[PerfCounters::CYCLES]);
+}
+
+}
+
+void PhaseReport::end_phase(const std::string &name) {
+    auto end = std::chrono::steady_clock::now();
+    uint64_t counts[PerfCounters::NUM_COUNTERS] = { 0 };
+    if (m_counters) {
+        m_counters->read(counts);
+    }
+    unsigned long allocations = t_allocations - m_start_allocations;
+    unsigned long allocated_bytes = t_allocated_bytes - m_start_allocated_bytes;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    Phase *phase = nullptr;
+    for (auto i = m_phases.begin(); i != m_phases.end(); i++) {
+        if (i->name == name) {
+            phase = &*i;
+        }
+    }
+    if (phase == nullptr) {
+        m_phases.push_back({ name, 0.0, 0, 0, 0, { 0 } });
+        phase = &m_phases.back();
+    }
+    phase->time_ms += std::chrono::duration<double, std::milli>(end - m_start).count();
+    phase->peak_rss_kb = usage.ru_maxrss;
+    phase->allocations += allocations;
+    phase->allocated_bytes += allocated_bytes;
+    for (int i = 0; i < PerfCounters::NUM_COUNTERS; i++) {
+        phase->counts[i] += counts[i] - m_start_counts[i];
+    }
+
+    // (the allocations made by this function belong to the next phase)
+    m_start = std::chrono::steady_clock::now();
+    m_start_allocations = t_allocations;
+    m_start_allocated_bytes = t_allocated_bytes;
+    if (m_counters) {
+        m_counters->read(m_start_counts);
+    }
+}
+
+void PhaseReport::print(const char *filename) const {
+    double total = 0.0;
+    unsigned long allocations = 0, allocated_bytes = 0;
+    long peak_rss_kb = 0;
+    uint64_t counts[PerfCounters::NUM_COUNTERS] = { 0 };
+    fprintf(stderr, "%s:\n", filename);
+    fprintf(stderr, "%-20s %12s %14s %12s %14s", "phase", "time (ms)", "peak RSS (KB)", "allocations", "bytes");
+    if (m_counters) {
+        fprintf(stderr, " %14s %14s %6s %12s %12s", "cycles", "instructions", "IPC", "br. misses", "L1D misses");
+    }
+    fputc('\n', stderr);
+    for (auto i = m_phases.begin(); i != m_phases.end(); i++) {
+        fprintf(stderr, "%-20s %12.3f %14ld %12lu %14lu",
+                i->name.c_str(), i->time_ms, i->peak_rss_kb, i->allocations, i->allocated_bytes);
+        print_counts(i->counts);
+        total += i->time_ms;
+        allocations += i->allocations;
+        allocated_bytes += i->allocated_bytes;
+        peak_rss_kb = i->peak_rss_kb > peak_rss_kb ? i->peak_rss_kb : peak_rss_kb;
+        for (int j = 0; j < PerfCounters::NUM_COUNTERS; j++) {
+            counts[j] += i->counts[j];
+        }
+    }
+    fprintf(stderr, "%-20s %12.3f %14ld %12lu %14lu", "total", total, peak_rss_kb, allocations, allocated_bytes);
+    print_counts(counts);
+}
+
+void PhaseReport::print_counts(const uint64_t *counts) const {
+    if (m_counters) {
+        fprintf(stderr, " %14llu %14llu %6.2f %12llu %12llu",
+                (unsigned long long) counts[PerfCounters::CYCLES],
+                (unsigned long long) counts[PerfCounters::INSTRUCTIONS], get_ipc(counts),
+                (unsigned long long) counts[PerfCounters::BRANCH_MISSES],
+                (unsigned long long) counts[PerfCounters::L1D_MISSES]);
+    }
+    fputc('\n', stderr);
+}
+
+void PhaseReport::print_csv(const char *filename) const {
+    for (auto i = m_phases.begin(); i != m_phases.end(); i++) {
+        fprintf(stderr, "%s,%s,%.3f,%ld,%lu,%lu",
+                filename, i->name.c_str(), i->time_ms, i->peak_rss_kb, i->allocations, i->allocated_bytes);
+        // (the counters which aren't available are left empty)
+        for (int j = 0; j < PerfCounters::NUM_COUNTERS; j++) {
+            if (m_counters && m_counters->is_available(PerfCounters::Counter(j))) {
+                fprintf(stderr, ",%llu", (unsigned long long) i->counts[j]);
+            } else {
+                fputc(',', stderr);
+            }
+        }
+        if (m_counters && i->counts[PerfCounters::CYCLES] != 0) {
+            fprintf(stderr, ",%.3f\n", get_ipc(i->counts));
+        } else {
+            fprintf(stderr, ",\n");
+        }
+    }
+}
+
+void PhaseReport::print_csv_header() {
+    fprintf(stderr, "file,phase,time_ms,peak_rss_kb,allocations,allocated_bytes");
+    for (int i = 0; i < PerfCounters::NUM_COUNTERS; i++) {
+        fprintf(stderr, ",%s", PerfCounters::get_name(PerfCounters::Counter(i)));
+    }
+    fprintf(stderr, ",ipc\n");
+}
@@ -0,0 +1,65 @@
+#ifndef PHASE_REPORT_H
+#define PHASE_REPORT_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <cstdint>
+#include "perf_counters.h"
+
+// Wall time, peak memory use and allocations of each phase of a
+// compilation (for the -t and -T options).  A phase ends when end_phase
+// is called, and the next one starts; a phase which ends more than once
+// (such as an optimization pass which is run repeatedly) is reported
+// once, with the totals of all of its runs.
+//
+// The peak memory use is that of the whole process (as of the end of
+// the phase), so it is only meaningful when one file is compiled at a
+// time.  Allocations are counted by replacing the global operator new,
+// on each thread separately; objects allocated from the IR and Node
+// pools are counted by the chunks the pools allocate.
+//
+// With count_hardware_events, the cycles, instructions, branch misses
+// and L1 data cache misses of each phase (on the thread compiling the
+// file) are reported too, when the hardware counters are available.
+struct PhaseReport {
+private:
+    struct Phase {
+        std::string name;
+        double time_ms;
+        long peak_rss_kb;
+        unsigned long allocations;
+        unsigned long allocated_bytes;
+        uint64_t counts[PerfCounters::NUM_COUNTERS];
+    };
+
+    std::vector<Phase> m_phases;
+    std::chrono::steady_clock::time_point m_start;
+    unsigned long m_start_allocations, m_start_allocated_bytes;
+    std::unique_ptr<PerfCounters> m_counters;
+    uint64_t m_start_counts[PerfCounters::NUM_COUNTERS];
+
+public:
+    PhaseReport();
+
+    // count the hardware events of the phases (from the current one on)
+    void count_hardware_events();
+
+    void end_phase(const std::string &name);
+
+    // print the phases to stderr as a table
+    void print(const char *filename) const;
+
+    // print the phases to stderr as CSV rows (with the columns named by
+    // print_csv_header)
+    void print_csv(const char *filename) const;
+    static void print_csv_header();
+
+private:
+    // print the hardware event counts of a row of the table (if they're
+    // counted), ending the row
+    void print_counts(const uint64_t *counts) const;
+};
+
+#endif // PHASE_REPORT_H
@@ -0,0 +1,305 @@
+#include <cassert>
+#include <algorithm>
+#include <set>
+#include "cfg.h"
+#include "highlevel.h"
+#include "alias.h"
+#include "stats.h"
+#include "predictive_commoning.h"
+
+namespace {
+    // the size of an array element
+    const long ELEMENT_SIZE = 8;
+
+    bool has_memref(Instruction *ins) {
+        for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+            if (ins->get_operand(i).is_memref()) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+PredictiveCommoning::PredictiveCommoning(ControlFlowGraph *cfg, const LoopForest &loops, const AliasAnalysis &alias)
+        : ControlFlowGraphTransform(cfg)
+        , m_cfg(cfg)
+        , m_loops(loops)
+        , m_alias(alias)
+        , m_next_vreg(HighLevel::get_num_vregs(cfg)) {
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        transform_loop(m_loops.get_loop(i));
+    }
+}
+
+PredictiveCommoning::~PredictiveCommoning() {
+    for (auto i = m_replaced.begin(); i != m_replaced.end(); i++) {
+        for (auto j = i->second.begin(); j != i->second.end(); j++) {
+            delete *j;
+        }
+    }
+    for (auto i = m_at_end.begin(); i != m_at_end.end(); i++) {
+        for (auto j = i->second.begin(); j != i->second.end(); j++) {
+            delete *j;
+        }
+    }
+}
+
+InstructionSequence *PredictiveCommoning::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+    auto at_end = m_at_end.find(bb);
+
+    // (the code at the end of a block goes before its jump)
+    unsigned end = bb->get_length();
+    if (at_end != m_at_end.end() && end > 0 && bb->get_last()->get_opcode() == HINS_JUMP) {
+        end--;
+    }
+    for (unsigned i = 0; i <= bb->get_length(); i++) {
+        if (i == end && at_end != m_at_end.end()) {
+            for (auto j = at_end->second.begin(); j != at_end->second.end(); j++) {
+                out->add_instruction((*j)->duplicate());
+            }
+        }
+        if (i == bb->get_length()) {
+            break;
+        }
+        Instruction *ins = bb->get_instruction(i);
+        auto replaced = m_replaced.find(ins);
+        if (replaced == m_replaced.end()) {
+            out->add_instruction(ins->duplicate());
+        } else {
+            for (auto j = replaced->second.begin(); j != replaced->second.end(); j++) {
+                out->add_instruction((*j)->duplicate());
+            }
+        }
+    }
+    return out;
+}
+
+void PredictiveCommoning::transform_loop(const LoopForest::Loop &loop) {
+    // the loop must be a header, which only has the loop test,
+    // and a body, which is only entered from the header
+    BasicBlock *header = loop.header;
+    if (loop.blocks.size() != 2 || loop.preheader == nullptr) {
+        return;
+    }
+    BasicBlock *body = *loop.blocks.begin() != header ? *loop.blocks.begin() : *loop.blocks.rbegin();
+    if (m_cfg->get_outgoing_edges(body).size() != 1 || m_cfg->get_incoming_edges(body).size() != 1) {
+        return;
+    }
+    Edge *back_edge = m_cfg->lookup_edge(header, body);
+    if (header->get_length() != 2 || back_edge == nullptr || back_edge->get_kind() != EDGE_BRANCH) {
+        return;
+    }
+    Instruction *compare = header->get_instruction(0);
+    Instruction *branch = header->get_instruction(1);
+    if (compare->get_opcode() != HINS_INT_COMPARE
+            || (branch->get_opcode() != HINS_JLT && branch->get_opcode() != HINS_JLTE)) {
+        return;
+    }
+
+    // the test must pass when the loop is entered (the operands are
+    // constants at the end of the preheader)
+    BasicBlock *preheader = loop.preheader;
+    AffineForm counter, bound;
+    if (!AffineForm::get(preheader, preheader->get_length(), compare->get_operand(0), counter)
+            || !AffineForm::get(preheader, preheader->get_length(), compare->get_operand(1), bound)
+            || !counter.terms.empty() || !bound.terms.empty()
+            || (branch->get_opcode() == HINS_JLT ? counter.constant >= bound.constant
+                                                  : counter.constant > bound.constant)) {
+        return;
+    }
+
+    // the vregs defined in the body, the steps of the induction variables,
+    // and the instructions which may store to memory
+    std::set<int> defs;
+    std::vector<Instruction *> stores;
+    for (auto i = body->cbegin(); i != body->cend(); i++) {
+        if (HighLevel::has_flags((*i)->get_opcode(), HOP_CALL)) {
+            return;
+        }
+        if (HighLevel::is_def(*i) && (*i)->get_operand(0).get_kind() == OPERAND_VREG) {
+            defs.insert((*i)->get_operand(0).get_base_reg());
+        }
+        if ((*i)->get_opcode() != HINS_LOAD_INT && has_memref(*i)) {
+            stores.push_back(*i);
+        }
+    }
+    std::map<int, long> steps;
+    for (auto i = defs.begin(); i != defs.end(); i++) {
+        AffineForm form;
+        if (AffineForm::get(body, body->get_length(), Operand(OPERAND_VREG, *i), form)
+                && form.terms.size() == 1 && form.terms.begin()->first == std::make_pair(*i, 0L)
+                && form.terms.begin()->second == 1) {
+            steps[*i] = form.constant;
+        }
+    }
+
+    // the loads whose addresses in iteration k are the same terms plus
+    // the same stride times k (in the order of the body), which no store
+    // may change
+    std::map<std::pair<std::map<std::pair<int, long>, long>, long>, std::vector<Load>> groups;
+    for (unsigned i = 0; i < body->get_length(); i++) {
+        Instruction *ins = body->get_instruction(i);
+        if (ins->get_opcode() != HINS_LOAD_INT || ins->get_operand(0).get_kind() != OPERAND_VREG
+                || ins->get_operand(1).get_kind() != OPERAND_VREG_MEMREF) {
+            continue;
+        }
+        const Operand &memref = ins->get_operand(1);
+        AffineForm address;
+        if (!AffineForm::get(body, i, Operand(OPERAND_VREG, memref.get_base_reg()), address)) {
+            continue;
+        }
+
+        // (the vregs are replaced by their values at the start of the
+        // preheader, so that addresses computed from different induction
+        // variables can be compared)
+        AffineForm start;
+        long stride = 0;
+        bool is_invariant = true;
+        for (auto t = address.terms.begin(); t != address.terms.end() && is_invariant; t++) {
+            int vreg = t->first.first;
+            AffineForm term;
+            auto step = steps.find(vreg);
+            if (vreg < 0) {
+                term.terms[t->first] = 1;
+            } else if (defs.count(vreg) > 0 && step == steps.end()) {
+                is_invariant = false;
+            } else {
+                long increment = 0;
+                is_invariant = AffineForm::get(preheader, preheader->get_length(), Operand(OPERAND_VREG, vreg), term)
+                               && (step == steps.end()
+                                   || (!__builtin_mul_overflow(t->second, step->second, &increment)
+                                       && !__builtin_add_overflow(stride, increment, &stride)));
+            }
+            start.add(term, t->second);
+        }
+        start.constant += address.constant;
+        for (auto s = stores.begin(); s != stores.end() && is_invariant; s++) {
+            for (unsigned j = 0; j < (*s)->get_num_operands(); j++) {
+                const Operand &operand = (*s)->get_operand(j);
+                if (operand.is_memref()
+                        && m_alias.may_alias(memref, ELEMENT_SIZE, operand, AliasAnalysis::get_access_size(*s))) {
+                    is_invariant = false;
+                }
+            }
+        }
+        if (is_invariant && stride != 0 && stride <= DependenceTest::MAX_VALUE && stride >= -DependenceTest::MAX_VALUE
+                && start.constant <= DependenceTest::MAX_VALUE && start.constant >= -DependenceTest::MAX_VALUE) {
+            groups[std::make_pair(start.terms, stride)].push_back(Load{ i, address, start.constant, 0 });
+        }
+    }
+
+    for (auto g = groups.begin(); g != groups.end(); g++) {
+        // the loads whose offsets differ by multiples of the stride form a
+        // chain (led by the one furthest ahead)
+        long stride = g->first.second;
+        long modulus = stride > 0 ? stride : -stride;
+        std::map<long, std::vector<Load>> chains;
+        for (auto i = g->second.begin(); i != g->second.end(); i++) {
+            chains[((i->offset % modulus) + modulus) % modulus].push_back(*i);
+        }
+        for (auto c = chains.begin(); c != chains.end(); c++) {
+            std::vector<Load> &chain = c->second;
+            long residue = c->first;
+            long lead = (chain.front().offset - residue) / stride;
+            for (auto i = chain.begin(); i != chain.end(); i++) {
+                lead = std::max(lead, (i->offset - residue) / stride);
+            }
+            std::set<long> distances;
+            for (auto i = chain.begin(); i != chain.end(); i++) {
+                i->distance = lead - (i->offset - residue) / stride;
+                distances.insert(i->distance);
+            }
+            long max_distance = *distances.rbegin();
+            if (max_distance > 0 && max_distance <= MAX_DISTANCE && long(distances.size()) == max_distance + 1) {
+                transform_chain(preheader, body, chain);
+            }
+        }
+    }
+}
+
+void PredictiveCommoning::transform_chain(BasicBlock *preheader, BasicBlock *body, std::vector<Load> &chain) {
+    // the vreg holding the value the lead loaded each number of
+    // iterations ago, which is what the loads at that distance read
+    long max_distance = 0;
+    for (auto i = chain.begin(); i != chain.end(); i++) {
+        max_distance = std::max(max_distance, i->distance);
+    }
+    std::vector<Operand> values;
+    for (long d = 0; d <= max_distance; d++) {
+        values.push_back(Operand(OPERAND_VREG, m_next_vreg++));
+    }
+
+    // the values for the first iteration are loaded in the preheader (at
+    // the addresses the loads read then)
+    std::vector<Instruction *> &init = m_at_end[preheader];
+    for (long d = 1; d <= max_distance; d++) {
+        for (auto i = chain.begin(); i != chain.end(); i++) {
+            if (i->distance == d) {
+                Operand address = emit(i->address, init);
+                Operand memref(OPERAND_VREG_MEMREF, address.get_base_reg());
+                init.push_back(new Instruction(HINS_LOAD_INT, values[d], memref));
+                break;
+            }
+        }
+    }
+
+    bool has_lead = false;
+    for (auto i = chain.begin(); i != chain.end(); i++) {
+        Instruction *ins = body->get_instruction(i->index);
+        std::vector<Instruction *> &code = m_replaced[ins];
+        if (i->distance == 0 && !has_lead) {
+            code.push_back(ins->duplicate());
+            code.push_back(new Instruction(HINS_MOV, values[0], ins->get_operand(0)));
+            has_lead = true;
+        } else {
+            code.push_back(new Instruction(HINS_MOV, ins->get_operand(0), values[i->distance]));
+            Statistics::get().add("commoning.loads");
+        }
+    }
+
+    // (rotating the values for the next iteration)
+    std::vector<Instruction *> &rotate = m_at_end[body];
+    for (long d = max_distance; d > 0; d--) {
+        rotate.push_back(new Instruction(HINS_MOV, values[d], values[d - 1]));
+    }
+    Statistics::get().add("commoning.chains");
+}
+
+Operand PredictiveCommoning::emit(const AffineForm &form, std::vector<Instruction *> &code) {
+    // the sum of the terms (at the end of the preheader), plus the
+    // constant, in a vreg
+    Operand result;
+    bool has_terms = false;
+    for (auto i = form.terms.begin(); i != form.terms.end(); i++) {
+        Operand term(OPERAND_VREG, i->first.first);
+        if (i->first.first < 0) {
+            term = Operand(OPERAND_VREG, m_next_vreg++);
+            code.push_back(new Instruction(HINS_LOCALADDR, term, Operand(OPERAND_INT_LITERAL, i->first.second)));
+        }
+        if (i->second != 1) {
+            Operand product(OPERAND_VREG, m_next_vreg++);
+            code.push_back(new Instruction(HINS_INT_MUL, product, term, Operand(OPERAND_INT_LITERAL, i->second)));
+            term = product;
+        }
+        if (has_terms) {
+            Operand sum(OPERAND_VREG, m_next_vreg++);
+            code.push_back(new Instruction(HINS_INT_ADD, sum, result, term));
+            term = sum;
+        }
+        result = term;
+        has_terms = true;
+    }
+    if (!has_terms || form.constant != 0) {
+        Operand sum(OPERAND_VREG, m_next_vreg++);
+        if (has_terms) {
+            code.push_back(new Instruction(HINS_INT_ADD, sum, result, Operand(OPERAND_INT_LITERAL, form.constant)));
+        } else {
+            code.push_back(new Instruction(HINS_LOAD_ICONST, sum, Operand(OPERAND_INT_LITERAL, form.constant)));
+        }
+        result = sum;
+    }
+    return result;
+}
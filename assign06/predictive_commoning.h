@@ -0,0 +1,77 @@
+#ifndef PREDICTIVE_COMMONING_H
+#define PREDICTIVE_COMMONING_H
+
+#include <map>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "loops.h"
+#include "dependence.h"
+
+class AliasAnalysis;
+
+// Predictive commoning for a high-level CFG (not in SSA form): in a loop
+// such as
+//
+//   WHILE i < N - 1 DO b[i] := a[i - 1] + a[i] + a[i + 1]; i := i + 1; END;
+//
+// the element a[i + 1] loaded in one iteration is loaded again as a[i] in
+// the next one, and as a[i - 1] in the one after that.  The values are
+// instead passed on in vregs: only the load of a[i + 1] remains, and the
+// others are replaced by moves from vregs which are rotated at the end of
+// each iteration, and loaded (for the first iteration) in the preheader.
+//
+// The loop must have the form vectorized by LoopVectorization (a header
+// containing only the loop test, and a single body block).  The loads of a
+// chain are HINS_LOAD_INT in the body whose addresses are affine (see
+// AffineForm) in induction variables and loop-invariant vregs: with the
+// induction variables replaced by their initial values plus their steps
+// times the number of the iteration, the addresses must have the same
+// terms and stride, and constants which differ by multiples of the
+// stride, so that each load reads what the next one read some number of
+// iterations earlier.  The chain must have a load for each of its
+// iterations, and span at most MAX_DISTANCE iterations (each of which
+// takes a vreg).
+//
+// No store in the loop may alias a load of a chain (see AliasAnalysis),
+// and the loop can't have calls.  The operands of the loop test must be
+// constants when the loop is entered, and the test must pass, since the
+// loads moved to the preheader can then only read what the first
+// iteration reads.
+class PredictiveCommoning : public ControlFlowGraphTransform {
+public:
+    static const long MAX_DISTANCE = 4;
+
+private:
+    // a load of a chain: its address (in the vregs at the start of the
+    // body), the constant of its address in the first iteration, and its
+    // distance (in iterations) behind the load leading the chain
+    struct Load {
+        unsigned index;
+        AffineForm address;
+        long offset;
+        long distance;
+    };
+
+    ControlFlowGraph *m_cfg;
+    const LoopForest &m_loops;
+    const AliasAnalysis &m_alias;
+    int m_next_vreg;
+    // the instructions replacing the loads of the chains, and the code
+    // added at the end of the preheaders and bodies
+    std::map<Instruction *, std::vector<Instruction *>> m_replaced;
+    std::map<BasicBlock *, std::vector<Instruction *>> m_at_end;
+
+public:
+    PredictiveCommoning(ControlFlowGraph *cfg, const LoopForest &loops, const AliasAnalysis &alias);
+    virtual ~PredictiveCommoning();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void transform_loop(const LoopForest::Loop &loop);
+    void transform_chain(BasicBlock *preheader, BasicBlock *body, std::vector<Load> &chain);
+    Operand emit(const AffineForm &form, std::vector<Instruction *> &code);
+};
+
+#endif // PREDICTIVE_COMMONING_H
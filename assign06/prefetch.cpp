@@ -0,0 +1,163 @@
+#include <cassert>
+#include <set>
+#include "cfg.h"
+#include "highlevel.h"
+#include "alias.h"
+#include "dependence.h"
+#include "storage_layout.h"
+#include "stats.h"
+#include "prefetch.h"
+
+namespace {
+    // the index of the memory reference operand of a load or store
+    // through a vreg (or -1)
+    int get_memref_index(Instruction *ins) {
+        switch (ins->get_opcode()) {
+            case HINS_LOAD_INT:
+            case HINS_LOAD_CHAR:
+                return ins->get_operand(1).get_kind() == OPERAND_VREG_MEMREF ? 1 : -1;
+            case HINS_STORE_INT:
+            case HINS_STORE_CHAR:
+                return ins->get_operand(0).get_kind() == OPERAND_VREG_MEMREF ? 0 : -1;
+            default:
+                return -1;
+        }
+    }
+
+    // the access leading a stream: the one furthest ahead in the
+    // direction of the stride
+    struct Stream {
+        Instruction *ins;
+        int address;
+        long constant;
+    };
+}
+
+LoopPrefetching::LoopPrefetching(ControlFlowGraph *cfg, const LoopForest &loops, const AliasAnalysis &alias,
+                                 const StorageLayout &layout, long distance)
+        : ControlFlowGraphTransform(cfg)
+        , m_cfg(cfg)
+        , m_loops(loops)
+        , m_alias(alias)
+        , m_layout(layout)
+        , m_distance(distance) {
+    assert(distance > 0 && distance <= MAX_DISTANCE);
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        transform_loop(m_loops.get_loop(i));
+    }
+}
+
+LoopPrefetching::~LoopPrefetching() {
+    for (auto i = m_before.begin(); i != m_before.end(); i++) {
+        for (auto j = i->second.begin(); j != i->second.end(); j++) {
+            delete *j;
+        }
+    }
+}
+
+InstructionSequence *LoopPrefetching::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        auto before = m_before.find(*i);
+        if (before != m_before.end()) {
+            for (auto j = before->second.begin(); j != before->second.end(); j++) {
+                out->add_instruction((*j)->duplicate());
+            }
+        }
+        out->add_instruction((*i)->duplicate());
+    }
+    return out;
+}
+
+void LoopPrefetching::transform_loop(const LoopForest::Loop &loop) {
+    if (!loop.children.empty()) {
+        return;
+    }
+    long trip_count = m_loops.get_trip_count(loop);
+    if (trip_count >= 0 && trip_count < MIN_TRIP_COUNT) {
+        return;
+    }
+
+    // the body is the only block of the loop defining vregs
+    BasicBlock *body = nullptr;
+    std::set<int> defs;
+    for (auto i = loop.blocks.begin(); i != loop.blocks.end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            if (HighLevel::has_flags((*j)->get_opcode(), HOP_CALL)) {
+                return;
+            }
+            if (HighLevel::is_def(*j) && (*j)->get_operand(0).get_kind() == OPERAND_VREG) {
+                if (body != nullptr && body != *i) {
+                    return;
+                }
+                body = *i;
+                defs.insert((*j)->get_operand(0).get_base_reg());
+            }
+        }
+    }
+    if (body == nullptr) {
+        return;
+    }
+    std::map<int, long> steps;
+    for (auto i = defs.begin(); i != defs.end(); i++) {
+        AffineForm form;
+        if (AffineForm::get(body, body->get_length(), Operand(OPERAND_VREG, *i), form)
+                && form.terms.size() == 1 && form.terms.begin()->first == std::make_pair(*i, 0L)
+                && form.terms.begin()->second == 1) {
+            steps[*i] = form.constant;
+        }
+    }
+
+    // the streams of accesses to large arrays, by the terms and stride of
+    // their addresses
+    std::map<std::pair<std::map<std::pair<int, long>, long>, long>, Stream> streams;
+    for (unsigned i = 0; i < body->get_length(); i++) {
+        Instruction *ins = body->get_instruction(i);
+        int index = get_memref_index(ins);
+        if (index < 0) {
+            continue;
+        }
+        const Operand &memref = ins->get_operand(unsigned(index));
+        AliasAnalysis::Value target = m_alias.get_address(memref);
+        if (target.kind != AliasAnalysis::Value::ADDRESS
+                || m_layout.get_variable_size(target.variable) < MIN_ARRAY_SIZE) {
+            continue;
+        }
+        AffineForm address;
+        if (!AffineForm::get(body, i, Operand(OPERAND_VREG, memref.get_base_reg()), address)) {
+            continue;
+        }
+        long stride = 0;
+        bool is_affine = true;
+        for (auto t = address.terms.begin(); t != address.terms.end() && is_affine; t++) {
+            int vreg = t->first.first;
+            if (vreg < 0 || defs.count(vreg) == 0) {
+                continue;
+            }
+            auto step = steps.find(vreg);
+            long increment = 0;
+            is_affine = step != steps.end() && !__builtin_mul_overflow(t->second, step->second, &increment)
+                        && !__builtin_add_overflow(stride, increment, &stride);
+        }
+        if (!is_affine || stride == 0 || stride > DependenceTest::MAX_VALUE || stride < -DependenceTest::MAX_VALUE) {
+            continue;
+        }
+
+        Stream stream{ ins, memref.get_base_reg(), address.constant };
+        auto result = streams.insert(std::make_pair(std::make_pair(address.terms, stride), stream));
+        Stream &lead = result.first->second;
+        if (!result.second && (stride > 0 ? stream.constant > lead.constant : stream.constant < lead.constant)) {
+            lead = stream;
+        }
+    }
+
+    for (auto i = streams.begin(); i != streams.end(); i++) {
+        long stride = i->first.second;
+        long size = stride > 0 ? stride : -stride;
+        long iterations = (m_distance + size - 1) / size;
+        Operand ahead(OPERAND_VREG_MEMREF_OFFSET, i->second.address, int(iterations * stride));
+        m_before[i->second.ins].push_back(new Instruction(HINS_PREFETCH, ahead));
+        Statistics::get().add("prefetch.streams");
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <map>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "loops.h"
+
+class AliasAnalysis;
+class StorageLayout;
+
+// Software prefetching for a high-level CFG (not in SSA form): in a loop
+// such as
+//
+//   WHILE i < N DO s := s + a[i]; i := i + 1; END;
+//
+// over an array much larger than the caches, each load misses and the loop
+// waits for memory.  A "prefetch" of the element some distance ahead is
+// inserted before the access, so that the cache line is already on its way
+// when the loop gets there:
+//
+//   prefetch 512(vrA)
+//   ldi vr9, (vrA)
+//
+// The accesses are the loads and stores of an innermost loop, without
+// calls, all of whose defs are in a single block (the body, as in the loops
+// unrolled by LoopUnrolling).  The address of an access is affine (see
+// AffineForm) in the body's induction variables and loop-invariant vregs,
+// and is known to point into a variable of at least MIN_ARRAY_SIZE bytes
+// (the address computed for an array element by visit_array_element_ref,
+// see AliasAnalysis).  The accesses whose addresses have the same terms and
+// stride form a stream, which gets one prefetch, of the access furthest
+// ahead.  The distance is given in bytes and rounded up to a whole number
+// of iterations (so that the prefetch is for an element the stream will
+// access).  A loop whose trip count is known to be less than
+// MIN_TRIP_COUNT is left alone, since it runs out before the prefetches pay
+// off.  (A prefetch can't fault, so one past the end of the array is
+// harmless.)
+class LoopPrefetching : public ControlFlowGraphTransform {
+public:
+    static const long DEFAULT_DISTANCE = 512;
+    static const long MAX_DISTANCE = 1L << 16;
+    static const long MIN_ARRAY_SIZE = 1L << 20;
+    static const long MIN_TRIP_COUNT = 256;
+
+private:
+    ControlFlowGraph *m_cfg;
+    const LoopForest &m_loops;
+    const AliasAnalysis &m_alias;
+    const StorageLayout &m_layout;
+    long m_distance;
+    // the prefetches inserted before each access leading a stream
+    std::map<Instruction *, std::vector<Instruction *>> m_before;
+
+public:
+    LoopPrefetching(ControlFlowGraph *cfg, const LoopForest &loops, const AliasAnalysis &alias,
+                    const StorageLayout &layout, long distance = DEFAULT_DISTANCE);
+    virtual ~LoopPrefetching();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void transform_loop(const LoopForest::Loop &loop);
+};
+
+#endif // PREFETCH_H
@@ -0,0 +1,49 @@
+#include <cstdio>
+#include "util.h"
+#include "cfg.h"
+#include "highlevel.h"
+#include "profile.h"
+
+unsigned Profile::instrument(ControlFlowGraph *cfg, unsigned first_counter) {
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        if (bb->get_kind() == BASICBLOCK_INTERIOR) {
+            Operand counter(OPERAND_INT_LITERAL, long(first_counter + bb->get_id()));
+            bb->insert_instruction(0, new Instruction(HINS_PROFILE_COUNT, counter));
+        }
+    }
+    return cfg->get_num_blocks();
+}
+
+void Profile::read(const std::string &filename, const std::vector<ControlFlowGraph *> &cfgs) {
+    FILE *in = fopen(filename.c_str(), "r");
+    if (in == nullptr) {
+        err_fatal("Could not open profile \"%s\"\n", filename.c_str());
+    }
+
+    unsigned num_blocks = 0, n = 0;
+    for (auto i = cfgs.begin(); i != cfgs.end(); i++) {
+        num_blocks += (*i)->get_num_blocks();
+    }
+    auto cfg = cfgs.begin();
+    unsigned first_block = 0;
+    long count;
+    while (fscanf(in, "%ld", &count) == 1) {
+        while (cfg != cfgs.end() && n >= first_block + (*cfg)->get_num_blocks()) {
+            first_block += (*cfg)->get_num_blocks();
+            cfg++;
+        }
+        if (cfg != cfgs.end()) {
+            BasicBlock *bb = (*cfg)->get_block(n - first_block);
+            // (the entry and exit blocks don't have counters)
+            bb->set_count(bb->get_kind() == BASICBLOCK_INTERIOR ? count : 1);
+        }
+        n++;
+    }
+    bool at_end = feof(in);
+    fclose(in);
+
+    if (!at_end || n != num_blocks) {
+        err_fatal("Profile \"%s\" doesn't match the program\n", filename.c_str());
+    }
+}
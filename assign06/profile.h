@@ -0,0 +1,31 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <string>
+#include <vector>
+
+class ControlFlowGraph;
+
+// Basic block execution counts (for -fprofile-generate and -fprofile-use).
+//
+// A program compiled with -fprofile-generate=<file> counts the executions
+// of each block of the CFG built from the (unoptimized) high-level code:
+// each interior block starts with a HINS_PROFILE_COUNT instruction, which
+// increments the block's counter, and the counters are written to the file
+// (one per line, indexed by block id, with the blocks of the main program
+// followed by those of each subprogram) when the program exits.  Since that
+// CFG is built the same way for the same program, the counts read with
+// -fprofile-use=<file> are attached to the same blocks (see
+// BasicBlock::get_count), and the optimization passes carry them over to
+// the blocks they copy.
+class Profile {
+public:
+    // insert the counter increments into the interior blocks of cfg (whose
+    // counters start at first_counter), returning the number of counters needed
+    static unsigned instrument(ControlFlowGraph *cfg, unsigned first_counter);
+
+    // set the counts of the blocks of the CFGs of the functions from a profile
+    static void read(const std::string &filename, const std::vector<ControlFlowGraph *> &cfgs);
+};
+
+#endif // PROFILE_H
@@ -0,0 +1,706 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "stats.h"
+#include "reg_alloc.h"
+
+GraphColoringRegisterAllocation::GraphColoringRegisterAllocation(ControlFlowGraph *cfg, const LiveVregs *live_vregs,
+                                                                 const TargetRegisters &regs)
+        : ControlFlowGraphTransform(cfg)
+        , m_regs(regs)
+        , m_num_vregs(0)
+        , m_num_rematerialized(0)
+        , m_num_split(0) {
+    LiveVregs *own_live_vregs = nullptr;
+    if (live_vregs == nullptr) {
+        own_live_vregs = new LiveVregs(cfg);
+        own_live_vregs->execute();
+        live_vregs = own_live_vregs;
+    }
+    allocate(*live_vregs);
+
+    for (unsigned round = 0; round < MAX_ROUNDS; round++) {
+        if (!rematerialize() && !split_around_calls(*live_vregs)) {
+            break;
+        }
+        delete own_live_vregs;
+        own_live_vregs = new LiveVregs(cfg);
+        own_live_vregs->execute();
+        live_vregs = own_live_vregs;
+        allocate(*live_vregs);
+    }
+    delete own_live_vregs;
+
+    if (!m_assignment.empty()) {
+        Statistics::get().add("regalloc.colored", long(m_assignment.size()));
+    }
+    if (!m_spilled.empty()) {
+        Statistics::get().add("regalloc.spilled", long(m_spilled.size()));
+    }
+}
+
+GraphColoringRegisterAllocation::~GraphColoringRegisterAllocation() {
+}
+
+InstructionSequence *GraphColoringRegisterAllocation::transform_basic_block(InstructionSequence *iseq) {
+    auto out = new InstructionSequence();
+
+    for (auto ins : *iseq) {
+        Instruction *hin = ins->duplicate();
+
+        for (unsigned j = 0; j < hin->get_num_operands(); j++) {
+            Operand operand = hin->get_operand(j);
+            if (operand.has_base_reg()) {
+                (*hin)[j] = rename_operand(operand);
+            }
+        }
+
+        // a move between two coalesced vregs (or two vregs assigned
+        // the same machine register) is a no-op
+        if (hin->get_opcode() == HINS_MOV
+                && (*hin)[0].get_kind() == OPERAND_VREG && (*hin)[1].get_kind() == OPERAND_VREG
+                && get_mreg((*hin)[0].get_base_reg()) == get_mreg((*hin)[1].get_base_reg())) {
+            delete hin;
+            continue;
+        }
+
+        out->add_instruction(hin);
+    }
+
+    // don't leave a (possibly labeled) basic block without instructions
+    if (out->get_length() == 0 && iseq->get_length() > 0) {
+        out->add_instruction(new Instruction(HINS_NOP));
+    }
+
+    return out;
+}
+
+void GraphColoringRegisterAllocation::allocate(const LiveVregs &live_vregs) {
+    // find out how many vregs are used
+    m_num_vregs = unsigned(HighLevel::get_num_vregs(get_orig_cfg()));
+
+    m_adj.assign(m_num_vregs, std::set<int>());
+    m_alias.resize(m_num_vregs);
+    m_crosses_call.assign(m_num_vregs, false);
+    m_cost.assign(m_num_vregs, 0);
+    m_is_vector.assign(m_num_vregs, false);
+    m_is_remat.resize(m_num_vregs, false);
+    m_is_split.resize(m_num_vregs, false);
+    for (unsigned i = 0; i < m_num_vregs; i++) {
+        m_alias[i] = int(i);
+    }
+    m_moves.clear();
+    m_assignment.clear();
+    m_spilled.clear();
+
+    build_interference_graph(live_vregs);
+    coalesce();
+    color();
+}
+
+void GraphColoringRegisterAllocation::build_interference_graph(const LiveVregs &live_vregs) {
+    ControlFlowGraph *cfg = get_orig_cfg();
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+
+        // work backwards from the end of the block, so that live_set
+        // is always the set of vregs live after the current instruction
+        LiveVregs::LiveSet live_set = live_vregs.get_fact_at_end_of_block(bb);
+
+        // (a block which wasn't executed still counts once)
+        unsigned long weight = bb->get_count() > 0 ? 1 + (unsigned long) bb->get_count() : 1;
+
+        for (auto j = bb->crbegin(); j != bb->crend(); j++) {
+            Instruction *ins = *j;
+
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                Operand operand = ins->get_operand(k);
+                if (operand.has_base_reg()) {
+                    m_cost[operand.get_base_reg()] += weight;
+                    if (HighLevel::is_vector(ins, k)) {
+                        m_is_vector[operand.get_base_reg()] = true;
+                    }
+                }
+                if (operand.has_index_reg()) {
+                    m_cost[operand.get_index_reg()] += weight;
+                }
+            }
+
+            int dest = -1;
+            if (HighLevel::is_def(ins)) {
+                dest = ins->get_operand(0).get_base_reg();
+
+                // the source of a move doesn't interfere with its destination,
+                // which is what makes it possible to coalesce them
+                int move_src = -1;
+                if (ins->get_opcode() == HINS_MOV && ins->get_operand(1).get_kind() == OPERAND_VREG) {
+                    move_src = ins->get_operand(1).get_base_reg();
+                    m_moves.push_back(std::make_pair(dest, move_src));
+                }
+
+                for (auto v = live_set.begin(); v != live_set.end(); v++) {
+                    if (int(*v) != dest && int(*v) != move_src) {
+                        add_interference(dest, int(*v));
+                    }
+                }
+            }
+
+            // vregs that are still alive after a call can't be kept in
+            // a caller-saved register
+            if (HighLevel::is_call(ins)) {
+                for (auto v = live_set.begin(); v != live_set.end(); v++) {
+                    if (int(*v) != dest) {
+                        m_crosses_call[*v] = true;
+                    }
+                }
+            }
+
+            live_vregs.model_instruction(ins, live_set);
+        }
+    }
+}
+
+void GraphColoringRegisterAllocation::add_interference(int a, int b) {
+    m_adj[a].insert(b);
+    m_adj[b].insert(a);
+}
+
+void GraphColoringRegisterAllocation::coalesce() {
+    bool change = true;
+    while (change) {
+        change = false;
+        for (auto i = m_moves.begin(); i != m_moves.end(); i++) {
+            int a = get_alias(i->first);
+            int b = get_alias(i->second);
+            if (m_is_split[i->first] || m_is_split[i->second] || a == b || m_adj[a].count(b) > 0 || !can_coalesce(a, b)) {
+                continue;
+            }
+
+            // merge the higher-numbered node into the lower-numbered one
+            if (b < a) {
+                std::swap(a, b);
+            }
+            m_alias[b] = a;
+            for (auto j = m_adj[b].begin(); j != m_adj[b].end(); j++) {
+                int n = *j;
+                m_adj[n].erase(b);
+                add_interference(a, n);
+            }
+            m_adj[b].clear();
+            m_crosses_call[a] = m_crosses_call[a] || m_crosses_call[b];
+            m_cost[a] += m_cost[b];
+            Statistics::get().add("regalloc.coalesced");
+            change = true;
+        }
+    }
+}
+
+bool GraphColoringRegisterAllocation::can_coalesce(int a, int b) const {
+    // Briggs test: the merged node is guaranteed to be colorable if it
+    // has fewer than K neighbors of significant degree (degree >= K)
+    bool crosses_call = m_crosses_call[a] || m_crosses_call[b];
+    unsigned k = crosses_call ? unsigned(m_regs.callee_saved.size())
+                                : unsigned(m_regs.callee_saved.size() + m_regs.caller_saved.size());
+
+    std::set<int> neighbors(m_adj[a]);
+    neighbors.insert(m_adj[b].begin(), m_adj[b].end());
+
+    unsigned num_significant = 0;
+    for (auto i = neighbors.begin(); i != neighbors.end(); i++) {
+        if (m_adj[*i].size() >= k) {
+            num_significant++;
+        }
+    }
+    return num_significant < k;
+}
+
+void GraphColoringRegisterAllocation::color() {
+    // the nodes of the (coalesced) interference graph
+    std::vector<int> nodes;
+    for (unsigned v = 0; v < m_num_vregs; v++) {
+        if (m_cost[v] > 0 && !m_is_vector[v] && get_alias(int(v)) == int(v)) {
+            nodes.push_back(int(v));
+        }
+    }
+
+    std::vector<unsigned> degree(m_num_vregs, 0);
+    std::vector<bool> removed(m_num_vregs, false);
+    for (auto i = nodes.begin(); i != nodes.end(); i++) {
+        for (auto j = m_adj[*i].begin(); j != m_adj[*i].end(); j++) {
+            if (!m_is_vector[*j]) {
+                degree[*i]++;
+            }
+        }
+    }
+
+    // simplify: repeatedly remove a node with fewer than K neighbors;
+    // if there is none, optimistically remove the node which is cheapest
+    // to spill (fewest occurrences per neighbor)
+    std::vector<int> stack;
+    while (stack.size() < nodes.size()) {
+        int pick = -1;
+        double pick_cost = 0.0;
+        for (auto i = nodes.begin(); i != nodes.end(); i++) {
+            int v = *i;
+            if (removed[v]) {
+                continue;
+            }
+            unsigned k = m_crosses_call[v] ? unsigned(m_regs.callee_saved.size())
+                                           : unsigned(m_regs.callee_saved.size() + m_regs.caller_saved.size());
+            if (degree[v] < k) {
+                pick = v;
+                break;
+            }
+            double cost = double(m_cost[v]) / double(degree[v]);
+            if (pick < 0 || cost < pick_cost) {
+                pick = v;
+                pick_cost = cost;
+            }
+        }
+
+        removed[pick] = true;
+        stack.push_back(pick);
+        for (auto j = m_adj[pick].begin(); j != m_adj[pick].end(); j++) {
+            if (!removed[*j] && !m_is_vector[*j]) {
+                degree[*j]--;
+            }
+        }
+    }
+
+    // select: pop nodes off the stack, giving each one a register not
+    // used by any of its neighbors; a node for which no register is available
+    // is spilled (i.e., left in its stack slot)
+    while (!stack.empty()) {
+        int v = stack.back();
+        stack.pop_back();
+
+        std::set<int> used;
+        for (auto j = m_adj[v].begin(); j != m_adj[v].end(); j++) {
+            auto k = m_assignment.find(*j);
+            if (k != m_assignment.end()) {
+                used.insert(k->second);
+            }
+        }
+
+        std::vector<int> candidates;
+        if (!m_crosses_call[v]) {
+            candidates.insert(candidates.end(), m_regs.caller_saved.begin(), m_regs.caller_saved.end());
+        }
+        candidates.insert(candidates.end(), m_regs.callee_saved.begin(), m_regs.callee_saved.end());
+
+        for (auto j = candidates.begin(); j != candidates.end(); j++) {
+            if (used.count(*j) == 0) {
+                m_assignment[v] = *j;
+                break;
+            }
+        }
+        if (m_assignment.count(v) == 0) {
+            m_spilled.push_back(v);
+        }
+    }
+}
+
+bool GraphColoringRegisterAllocation::rematerialize() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    if (m_spilled.empty()) {
+        return false;
+    }
+
+    // find the spilled nodes whose only def is a ldci or localaddr, and
+    // whose uses are all vreg operands or the bases of memory references
+    std::vector<bool> candidate(m_num_vregs, false);
+    for (auto i = m_spilled.begin(); i != m_spilled.end(); i++) {
+        candidate[*i] = !m_is_remat[*i];
+    }
+    std::vector<Instruction *> defs(m_num_vregs, nullptr);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            Instruction *ins = *j;
+            int opcode = ins->get_opcode();
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                Operand operand = ins->get_operand(k);
+                if (operand.has_index_reg() && candidate[get_alias(operand.get_index_reg())]) {
+                    candidate[get_alias(operand.get_index_reg())] = false;
+                }
+                if (!operand.has_base_reg() || operand.get_kind() == OPERAND_MREG) {
+                    continue;
+                }
+                int node = get_alias(operand.get_base_reg());
+                if (!candidate[node]) {
+                    continue;
+                }
+                if (k == 0 && HighLevel::is_def(ins) && operand.get_kind() == OPERAND_VREG) {
+                    if (defs[node] != nullptr || (opcode != HINS_LOAD_ICONST && opcode != HINS_LOCALADDR)) {
+                        candidate[node] = false;
+                    }
+                    defs[node] = ins;
+                } else if (HighLevel::is_vector(ins, k) || (opcode >= HINS_CMOVE && opcode <= HINS_CMOVGTE)
+                           || (operand.get_kind() != OPERAND_VREG && operand.get_kind() != OPERAND_VREG_MEMREF
+                               && operand.get_kind() != OPERAND_VREG_MEMREF_OFFSET)) {
+                    candidate[node] = false;
+                }
+            }
+        }
+    }
+
+    // (the defs are removed as the blocks are edited, so the values
+    // are kept as operands)
+    std::vector<int> def_opcode(m_num_vregs, -1);
+    std::vector<Operand> def_value(m_num_vregs);
+    bool any = false;
+    for (unsigned v = 0; v < m_num_vregs; v++) {
+        if (candidate[v] && defs[v] != nullptr) {
+            def_opcode[v] = defs[v]->get_opcode();
+            def_value[v] = defs[v]->get_operand(1);
+            Statistics::get().add("regalloc.rematerialized");
+            m_num_rematerialized++;
+            any = true;
+        }
+    }
+    if (!any) {
+        return false;
+    }
+
+    int next_vreg = int(m_num_vregs);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        BasicBlockEditor editor(bb);
+        for (unsigned j = 0; j < bb->get_length(); j++) {
+            Instruction *ins = bb->get_instruction(j);
+            if (HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG
+                    && def_opcode[get_alias(ins->get_operand(0).get_base_reg())] >= 0) {
+                editor.remove(j);
+                continue;
+            }
+
+            // the new vreg holding each rematerialized node used by the instruction
+            std::map<int, int> new_vregs;
+            Instruction *copy = nullptr;
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                Operand operand = ins->get_operand(k);
+                if (!operand.has_base_reg() || operand.get_kind() == OPERAND_MREG) {
+                    continue;
+                }
+                int node = get_alias(operand.get_base_reg());
+                if (def_opcode[node] < 0) {
+                    continue;
+                }
+                auto n = new_vregs.find(node);
+                if (n == new_vregs.end()) {
+                    n = new_vregs.insert(std::make_pair(node, next_vreg++)).first;
+                    editor.insert(j, new Instruction(def_opcode[node], Operand(OPERAND_VREG, n->second), def_value[node]));
+                }
+                if (copy == nullptr) {
+                    copy = ins->duplicate();
+                }
+                operand.set_base_reg(n->second);
+                (*copy)[k] = operand;
+            }
+            if (copy != nullptr) {
+                editor.replace(j, copy);
+            }
+        }
+        editor.commit();
+    }
+
+    m_is_remat.resize(unsigned(next_vreg), true);
+    return true;
+}
+
+int GraphColoringRegisterAllocation::get_mreg(int vreg) const {
+    // a vreg without a machine register is identified by its (negated) number
+    auto i = m_assignment.find(vreg);
+    return (i != m_assignment.end()) ? i->second : -1 - vreg;
+}
+
+int GraphColoringRegisterAllocation::get_alias(int vreg) const {
+    while (m_alias[vreg] != vreg) {
+        vreg = m_alias[vreg];
+    }
+    return vreg;
+}
+
+Operand GraphColoringRegisterAllocation::rename_operand(const Operand &operand) const {
+    int base = get_alias(operand.get_base_reg());
+
+    Operand result;
+    switch (operand.get_kind()) {
+        case OPERAND_VREG:
+        case OPERAND_VREG_MEMREF:
+            result = Operand(operand.get_kind(), base);
+            break;
+        case OPERAND_VREG_MEMREF_OFFSET:
+            result = Operand(operand.get_kind(), base, operand.get_offset());
+            break;
+        case OPERAND_VREG_MEMREF_INDEX:
+            result = Operand(operand.get_kind(), base, get_alias(operand.get_index_reg()));
+            break;
+        default:
+            // machine registers are left alone
+            return operand;
+    }
+
+    Operand orig(operand);
+    result.set_is_scalar(orig.get_is_scalar());
+    result.set_does_map_mreg(m_assignment.find(base) != m_assignment.end());
+    return result;
+}
+
+bool GraphColoringRegisterAllocation::split_around_calls(const LiveVregs &live_vregs) {
+    ControlFlowGraph *cfg = get_orig_cfg();
+
+    std::vector<bool> split(m_num_vregs, false);
+    bool any = false;
+    for (auto i = m_spilled.begin(); i != m_spilled.end(); i++) {
+        if (m_crosses_call[*i] && !m_is_split[*i]) {
+            split[*i] = true;
+            any = true;
+        }
+    }
+    if (!any) {
+        return false;
+    }
+
+    int next_vreg = int(m_num_vregs);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+
+        // find the vregs to split which are live after each call
+        // (other than the one it defines)
+        std::vector<std::vector<int>> saved(bb->get_length());
+        bool has_saved = false;
+        LiveVregs::LiveSet live_set = live_vregs.get_fact_at_end_of_block(bb);
+        for (unsigned j = bb->get_length(); j > 0; j--) {
+            Instruction *ins = bb->get_instruction(j - 1);
+            if (HighLevel::is_call(ins)) {
+                int dest = HighLevel::is_def(ins) ? ins->get_operand(0).get_base_reg() : -1;
+                for (auto v = live_set.begin(); v != live_set.end(); v++) {
+                    if (int(*v) != dest && split[get_alias(int(*v))]) {
+                        saved[j - 1].push_back(int(*v));
+                        has_saved = true;
+                    }
+                }
+            }
+            live_vregs.model_instruction(ins, live_set);
+        }
+        if (!has_saved) {
+            continue;
+        }
+
+        BasicBlockEditor editor(bb);
+        for (unsigned j = 0; j < bb->get_length(); j++) {
+            for (auto v = saved[j].begin(); v != saved[j].end(); v++) {
+                Operand vreg(OPERAND_VREG, *v), save(OPERAND_VREG, next_vreg++);
+                editor.insert(j, new Instruction(HINS_MOV, save, vreg));
+                editor.insert(j + 1, new Instruction(HINS_MOV, vreg, save));
+                Statistics::get().add("regalloc.split");
+                m_num_split++;
+            }
+        }
+        editor.commit();
+    }
+
+    m_is_split.resize(unsigned(next_vreg), true);
+    return true;
+}
+
+LinearScanRegisterAllocation::LinearScanRegisterAllocation(ControlFlowGraph *cfg, const LiveVregs *live_vregs,
+                                                           const TargetRegisters &regs)
+        : ControlFlowGraphTransform(cfg)
+        , m_regs(regs) {
+    LiveVregs *own_live_vregs = nullptr;
+    if (live_vregs == nullptr) {
+        own_live_vregs = new LiveVregs(cfg);
+        own_live_vregs->execute();
+        live_vregs = own_live_vregs;
+    }
+    std::vector<Interval> intervals;
+    find_intervals(*live_vregs, intervals);
+    delete own_live_vregs;
+    allocate(intervals);
+}
+
+LinearScanRegisterAllocation::~LinearScanRegisterAllocation() {
+}
+
+InstructionSequence *LinearScanRegisterAllocation::transform_basic_block(InstructionSequence *iseq) {
+    auto out = new InstructionSequence();
+
+    for (auto ins : *iseq) {
+        // a move between two vregs assigned the same machine register is a no-op
+        if (ins->get_opcode() == HINS_MOV
+                && (*ins)[0].get_kind() == OPERAND_VREG && (*ins)[1].get_kind() == OPERAND_VREG) {
+            auto dest = m_assignment.find((*ins)[0].get_base_reg());
+            auto src = m_assignment.find((*ins)[1].get_base_reg());
+            if (dest != m_assignment.end() && src != m_assignment.end() && dest->second == src->second) {
+                continue;
+            }
+        }
+
+        Instruction *hin = ins->duplicate();
+        for (unsigned j = 0; j < hin->get_num_operands(); j++) {
+            Operand operand = hin->get_operand(j);
+            if (operand.has_base_reg() && operand.get_kind() != OPERAND_MREG) {
+                operand.set_does_map_mreg(m_assignment.find(operand.get_base_reg()) != m_assignment.end());
+                (*hin)[j] = operand;
+            }
+        }
+        out->add_instruction(hin);
+    }
+
+    // don't leave a (possibly labeled) basic block without instructions
+    if (out->get_length() == 0 && iseq->get_length() > 0) {
+        out->add_instruction(new Instruction(HINS_NOP));
+    }
+
+    return out;
+}
+
+// Each block has a position at its beginning and at its end, and each
+// instruction two positions between them: one where it reads its operands
+// and one where it writes its destination, so that a vreg whose last use
+// is in an instruction doesn't overlap the instruction's destination.
+void LinearScanRegisterAllocation::find_intervals(const LiveVregs &live_vregs, std::vector<Interval> &intervals) const {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    unsigned num_vregs = unsigned(HighLevel::get_num_vregs(cfg));
+    const unsigned NONE = ~0u;
+    std::vector<unsigned> start(num_vregs, NONE), end(num_vregs, 0);
+    std::vector<bool> is_vector(num_vregs, false);
+    // the positions where the calls write their results
+    std::vector<unsigned> calls;
+
+    auto extend = [&](int vreg, unsigned pos) {
+        if (start[vreg] == NONE || pos < start[vreg]) {
+            start[vreg] = pos;
+        }
+        if (pos > end[vreg]) {
+            end[vreg] = pos;
+        }
+    };
+
+    unsigned pos = 0;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        const LiveVregs::LiveSet &live_in = live_vregs.get_fact_at_beginning_of_block(bb);
+        for (auto v = live_in.begin(); v != live_in.end(); v++) {
+            extend(int(*v), pos);
+        }
+        pos++;
+
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            Instruction *ins = *j;
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                Operand operand = ins->get_operand(k);
+                if (!operand.has_base_reg() || operand.get_kind() == OPERAND_MREG) {
+                    continue;
+                }
+                bool is_dest = (k == 0 && HighLevel::is_def(ins) && operand.get_kind() == OPERAND_VREG);
+                extend(operand.get_base_reg(), is_dest ? pos + 1 : pos);
+                if (operand.has_index_reg()) {
+                    extend(operand.get_index_reg(), pos);
+                }
+                if (HighLevel::is_vector(ins, k)) {
+                    is_vector[operand.get_base_reg()] = true;
+                }
+            }
+            if (HighLevel::is_call(ins)) {
+                calls.push_back(pos + 1);
+            }
+            pos += 2;
+        }
+
+        const LiveVregs::LiveSet &live_out = live_vregs.get_fact_at_end_of_block(bb);
+        for (auto v = live_out.begin(); v != live_out.end(); v++) {
+            extend(int(*v), pos);
+        }
+        pos++;
+    }
+
+    for (unsigned v = 0; v < num_vregs; v++) {
+        if (start[v] == NONE || is_vector[v]) {
+            continue;
+        }
+        // a vreg live after a call (other than its result) crosses it
+        auto call = std::upper_bound(calls.begin(), calls.end(), start[v]);
+        bool crosses_call = (call != calls.end() && *call < end[v]);
+        intervals.push_back(Interval{ int(v), start[v], end[v], crosses_call });
+    }
+}
+
+void LinearScanRegisterAllocation::allocate(std::vector<Interval> &intervals) {
+    std::stable_sort(intervals.begin(), intervals.end(), [](const Interval &a, const Interval &b) {
+        return a.start < b.start;
+    });
+
+    // the intervals holding registers (there are only a few, so they're
+    // searched linearly), and the registers held by none of them
+    std::vector<const Interval *> active;
+    std::vector<bool> is_free(m_regs.num_regs, false);
+    for (auto i = m_regs.caller_saved.begin(); i != m_regs.caller_saved.end(); i++) {
+        is_free[*i] = true;
+    }
+    for (auto i = m_regs.callee_saved.begin(); i != m_regs.callee_saved.end(); i++) {
+        is_free[*i] = true;
+    }
+    unsigned num_spilled = 0;
+
+    for (auto i = intervals.begin(); i != intervals.end(); i++) {
+        const Interval *cur = &*i;
+
+        // expire the intervals which end before this one starts
+        for (unsigned j = 0; j < active.size(); ) {
+            if (active[j]->end < cur->start) {
+                is_free[m_assignment[active[j]->vreg]] = true;
+                active[j] = active.back();
+                active.pop_back();
+            } else {
+                j++;
+            }
+        }
+
+        // (the caller-saved registers are preferred, as with graph coloring)
+        int mreg = -1;
+        if (!cur->crosses_call) {
+            for (auto j = m_regs.caller_saved.begin(); j != m_regs.caller_saved.end() && mreg < 0; j++) {
+                mreg = is_free[*j] ? *j : -1;
+            }
+        }
+        for (auto j = m_regs.callee_saved.begin(); j != m_regs.callee_saved.end() && mreg < 0; j++) {
+            mreg = is_free[*j] ? *j : -1;
+        }
+
+        if (mreg < 0) {
+            // spill the interval ending last
+            int victim = -1;
+            for (unsigned j = 0; j < active.size(); j++) {
+                int held = m_assignment[active[j]->vreg];
+                bool usable = !cur->crosses_call || m_regs.is_callee_saved(held);
+                if (usable && (victim < 0 || active[j]->end > active[victim]->end)) {
+                    victim = int(j);
+                }
+            }
+            num_spilled++;
+            if (victim < 0 || active[victim]->end <= cur->end) {
+                continue;
+            }
+            mreg = m_assignment[active[victim]->vreg];
+            m_assignment.erase(active[victim]->vreg);
+            active[victim] = active.back();
+            active.pop_back();
+        }
+
+        is_free[mreg] = false;
+        m_assignment[cur->vreg] = mreg;
+        active.push_back(cur);
+    }
+
+    if (!m_assignment.empty()) {
+        Statistics::get().add("linearscan.allocated", long(m_assignment.size()));
+    }
+    if (num_spilled > 0) {
+        Statistics::get().add("linearscan.spilled", long(num_spilled));
+    }
+}
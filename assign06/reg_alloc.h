@@ -0,0 +1,151 @@
+#ifndef REG_ALLOC_H
+#define REG_ALLOC_H
+
+#include <map>
+#include <set>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "target.h"
+
+class LiveVregs;
+
+// Chaitin-Briggs style graph coloring register allocator.
+//
+// The interference graph is built from the results of LiveVregs.
+// Vregs connected by a HINS_MOV are coalesced when the Briggs test
+// says the merged node is still guaranteed to be colorable.  Vregs
+// that are live across a call to printf/scanf are restricted to the
+// callee-saved registers.  A vreg that can't be colored stays in
+// its stack slot: since the x86-64 lowering always goes through the
+// r10/r11 scratch registers, no spill code needs to be inserted.
+// Vector vregs (see vectorize.h) are kept in SSE registers by the
+// lowering, so they aren't colored.
+//
+// A spilled vreg whose only def is a ldci or localaddr is rematerialized
+// rather than kept in its stack slot: its def is removed, and a copy of
+// the def into a new vreg is inserted before each instruction using it,
+// which is cheaper than a store and the loads from the slot.  The CFG is
+// modified in place, and the vregs are then allocated again (the new
+// vregs only live from their defs to the next instruction, so they can
+// be colored unless every register is in use there).  A vreg used by a
+// conditional move (which must follow its cmpi) isn't rematerialized.
+//
+// The calls (including the printf and scanf of HINS_READ_INT and
+// HINS_WRITE_INT) clobber the caller-saved registers, so only the
+// callee-saved registers are left for a vreg live across one.  Another
+// spilled vreg which is live across calls has its live range split around
+// each of them: before the call it is moved to a new vreg, which is moved
+// back after the call, so that it no longer crosses a call and can be
+// kept in any register (in particular, in the loops without calls), and
+// only the new vregs compete for the callee-saved registers (or are
+// kept in stack slots, saving and restoring the vreg around the call).
+class GraphColoringRegisterAllocation : public ControlFlowGraphTransform {
+public:
+    // maps vreg number to a machine register of the target, for every
+    // vreg that was assigned one
+    typedef std::map<int, int> Assignment;
+
+    // the largest number of times the vregs are allocated again after
+    // rematerializing spilled vregs, or splitting them around calls
+    static const unsigned MAX_ROUNDS = 4;
+
+private:
+    // the target's allocatable registers
+    const TargetRegisters &m_regs;
+    unsigned m_num_vregs;
+    // interference graph (adjacency sets, indexed by vreg number)
+    std::vector<std::set<int>> m_adj;
+    // coalescing: vreg number of the node each vreg was merged into
+    std::vector<int> m_alias;
+    // vregs that are live across a call instruction
+    std::vector<bool> m_crosses_call;
+    // number of occurrences of each vreg (used as the spill cost),
+    // weighted by the execution count of each block if there is a profile
+    std::vector<unsigned long> m_cost;
+    std::vector<bool> m_is_vector;
+    // (dest, src) vreg pairs of all vreg-to-vreg HINS_MOV instructions
+    std::vector<std::pair<int, int>> m_moves;
+    Assignment m_assignment;
+    // the nodes left without a machine register
+    std::vector<int> m_spilled;
+    // the vregs created by rematerialization (which aren't rematerialized
+    // again), and by splitting (which aren't split again, or coalesced)
+    std::vector<bool> m_is_remat;
+    std::vector<bool> m_is_split;
+    unsigned m_num_rematerialized;
+    unsigned m_num_split;
+
+public:
+    GraphColoringRegisterAllocation(ControlFlowGraph *cfg, const LiveVregs *live_vregs = nullptr,
+                                    const TargetRegisters &regs = TargetRegisters::get(TARGET_X86_64));
+    virtual ~GraphColoringRegisterAllocation();
+
+    const Assignment &get_assignment() const { return m_assignment; }
+
+    // did rematerialization or splitting change the CFG (before the
+    // transformation)?
+    bool has_rewritten() const { return m_num_rematerialized > 0 || m_num_split > 0; }
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void allocate(const LiveVregs &live_vregs);
+    void build_interference_graph(const LiveVregs &live_vregs);
+    void add_interference(int a, int b);
+    void coalesce();
+    bool can_coalesce(int a, int b) const;
+    void color();
+    bool rematerialize();
+    bool split_around_calls(const LiveVregs &live_vregs);
+    int get_alias(int vreg) const;
+    int get_mreg(int vreg) const;
+    Operand rename_operand(const Operand &operand) const;
+};
+
+// Linear scan register allocator (Poletto and Sarkar), for -O1: it runs
+// in time roughly linear in the size of the code, trading the quality
+// of the allocation for speed.
+//
+// The blocks are numbered in order, and each vreg's live interval is
+// the range from the first to the last position where it is live (or
+// occurs), so it's a conservative approximation of its live range.  The
+// intervals are allocated in order of their start: an interval takes
+// a register which no active interval (one overlapping it) holds, using
+// only the callee-saved registers if it contains a call, as with graph
+// coloring.  If there is none, whichever of it and the active interval
+// ending last (of those holding a register it can use) ends later is
+// left in its stack slot.  There is no coalescing, rematerialization or
+// splitting, but a move between two vregs which happen to get the same
+// register is still removed.
+class LinearScanRegisterAllocation : public ControlFlowGraphTransform {
+public:
+    typedef std::map<int, int> Assignment;
+
+private:
+    // a vreg's interval, from the positions numbered by find_intervals
+    struct Interval {
+        int vreg;
+        unsigned start, end;
+        bool crosses_call;
+    };
+
+    const TargetRegisters &m_regs;
+    Assignment m_assignment;
+
+public:
+    LinearScanRegisterAllocation(ControlFlowGraph *cfg, const LiveVregs *live_vregs = nullptr,
+                                 const TargetRegisters &regs = TargetRegisters::get(TARGET_X86_64));
+    virtual ~LinearScanRegisterAllocation();
+
+    const Assignment &get_assignment() const { return m_assignment; }
+
+    virtual bool is_block_local() const { return true; }
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void find_intervals(const LiveVregs &live_vregs, std::vector<Interval> &intervals) const;
+    void allocate(std::vector<Interval> &intervals);
+};
+
+#endif // REG_ALLOC_H
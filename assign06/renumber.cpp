@@ -0,0 +1,69 @@
+#include <cassert>
+#include "cfg.h"
+#include "highlevel.h"
+#include "stats.h"
+#include "renumber.h"
+
+VregRenumbering::VregRenumbering(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_num_used(0) {
+    std::vector<bool> used(unsigned(HighLevel::get_num_vregs(cfg)), false);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            for (unsigned k = 0; k < (*j)->get_num_operands(); k++) {
+                const Operand &operand = (*j)->get_operand(k);
+                if (operand.has_base_reg()) {
+                    used[unsigned(operand.get_base_reg())] = true;
+                }
+                if (operand.has_index_reg()) {
+                    used[unsigned(operand.get_index_reg())] = true;
+                }
+            }
+        }
+    }
+
+    m_numbers.assign(used.size(), -1);
+    for (unsigned v = 0; v < used.size(); v++) {
+        if (used[v]) {
+            m_numbers[v] = int(m_num_used++);
+        }
+    }
+    Statistics::get().add("renumber.removed", long(used.size() - m_num_used));
+}
+
+VregRenumbering::~VregRenumbering() {
+}
+
+InstructionSequence *VregRenumbering::transform_basic_block(InstructionSequence *iseq) {
+    auto out = new InstructionSequence();
+    for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+        Instruction *ins = (*i)->duplicate();
+        renumber(ins);
+        out->add_instruction(ins);
+    }
+    return out;
+}
+
+bool VregRenumbering::transform_basic_block_in_place(BasicBlock *bb) {
+    bool changed = false;
+    for (auto i = bb->begin(); i != bb->end(); i++) {
+        changed = renumber(*i) || changed;
+    }
+    return changed;
+}
+
+bool VregRenumbering::renumber(Instruction *ins) const {
+    bool changed = false;
+    for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+        Operand &operand = (*ins)[j];
+        if (operand.has_base_reg() && m_numbers[unsigned(operand.get_base_reg())] != operand.get_base_reg()) {
+            operand.set_base_reg(m_numbers[unsigned(operand.get_base_reg())]);
+            changed = true;
+        }
+        if (operand.has_index_reg() && m_numbers[unsigned(operand.get_index_reg())] != operand.get_index_reg()) {
+            operand.set_index_reg(m_numbers[unsigned(operand.get_index_reg())]);
+            changed = true;
+        }
+    }
+    return changed;
+}
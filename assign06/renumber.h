@@ -0,0 +1,43 @@
+#ifndef RENUMBER_H
+#define RENUMBER_H
+
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+
+// Renumber the vregs of a high-level CFG (not in SSA form) densely.
+//
+// The optimizations leave the vreg numbers sparse: constant propagation
+// and dead code elimination remove definitions, and SSA construction
+// and the loop transformations number their new vregs after the highest
+// one used.  Everything sized by the number of vregs (the live vregs
+// bitsets, the register allocator's interference graph, AssemblyCodeGen's
+// tables) is sized by the highest number, so the vregs still used are
+// given the numbers 0, 1, 2, ... (in the order of their old numbers, so
+// the parameters and the program's scalar variables keep the lowest).
+class VregRenumbering : public ControlFlowGraphTransform {
+private:
+    // the new number of each vreg (or -1 if it isn't used)
+    std::vector<int> m_numbers;
+    unsigned m_num_used;
+
+public:
+    VregRenumbering(ControlFlowGraph *cfg);
+    virtual ~VregRenumbering();
+
+    // the number of vregs after renumbering
+    unsigned get_num_vregs() const { return m_num_used; }
+
+    // are the vregs already numbered densely (so transforming the CFG
+    // would leave it unchanged)?
+    bool is_dense() const { return m_num_used == m_numbers.size(); }
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+    virtual bool transform_basic_block_in_place(BasicBlock *bb);
+    virtual bool is_block_local() const { return true; }
+
+private:
+    bool renumber(Instruction *ins) const;
+};
+
+#endif // RENUMBER_H
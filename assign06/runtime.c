@@ -0,0 +1,337 @@
+/*
+ * Buffered integer I/O for compiled programs, used instead of
+ * scanf/printf when the compiler is run with the -r option.
+ * The generated code must then be linked with runtime.o.
+ *
+ * Output is collected in a large buffer which is written when it
+ * fills up, and when the program exits.  It's double-buffered: a full
+ * buffer is handed to a writer thread (started the first time a buffer
+ * fills up), and the program goes on filling the other buffer while
+ * it's written, only waiting if it fills that one too before the write
+ * is done.  (So programs linked with runtime.o must be linked with
+ * -pthread, with C libraries which need it.)
+ *
+ * Input is mapped into memory if it's a regular file, and read in
+ * large blocks otherwise.  The digits of an integer are converted eight
+ * at a time, in a 64-bit word (when there are eight bytes of input left
+ * in the block), and a range of the elements of an array can be read
+ * with one call.
+ *
+ * The runtime also fills and copies arrays, for the loops replaced by
+ * the compiler's loop idiom recognition.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define RT_BUFFER_SIZE 65536
+
+/*
+ * arrays of at least this many integers (half of a typical last-level
+ * cache) are filled and copied with non-temporal stores, which don't
+ * evict the rest of the program's data from the cache
+ */
+#define RT_STREAM_THRESHOLD (1L << 18)
+
+/* enough for a 64-bit integer with its sign and a newline */
+#define RT_MAX_INT_CHARS 21
+
+static char s_out_bufs[2][RT_BUFFER_SIZE];
+static char *s_out = s_out_bufs[0];     /* the buffer being filled */
+static unsigned s_out_len;
+static int s_flush_at_exit;
+
+/*
+ * the buffer the writer thread is writing (null when it's idle), which
+ * is handed to it (and given back) with s_writer_lock held
+ */
+static pthread_mutex_t s_writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_writer_cond = PTHREAD_COND_INITIALIZER;
+static const char *s_writing;
+static unsigned s_writing_len;
+/* 1 once the writer thread is running, -1 if it couldn't be started */
+static int s_writer_state;
+
+static char s_in_buf[RT_BUFFER_SIZE];
+static const char *s_in = s_in_buf;     /* the block of input (or the mapped file) */
+static size_t s_in_pos, s_in_len;
+/* 1 once the input has been mapped (or found not to be a regular file) */
+static int s_in_started;
+/* 1 once the end of the input has been reached */
+static int s_in_eof;
+
+static void rt_write_all(const char *buf, unsigned len) {
+  unsigned done = 0;
+  while (done < len) {
+    ssize_t n = write(1, buf + done, len - done);
+    if (n <= 0) {
+      break;
+    }
+    done += (unsigned) n;
+  }
+}
+
+static void *rt_writer(void *arg) {
+  (void) arg;
+  pthread_mutex_lock(&s_writer_lock);
+  for (;;) {
+    while (s_writing == NULL) {
+      pthread_cond_wait(&s_writer_cond, &s_writer_lock);
+    }
+    pthread_mutex_unlock(&s_writer_lock);
+    rt_write_all(s_writing, s_writing_len);
+    pthread_mutex_lock(&s_writer_lock);
+    s_writing = NULL;
+    pthread_cond_broadcast(&s_writer_cond);
+  }
+  return NULL;
+}
+
+/* hand the full output buffer to the writer thread, and switch to the other */
+static void rt_flush(void) {
+  if (s_writer_state == 0) {
+    pthread_t writer;
+    s_writer_state = (pthread_create(&writer, NULL, rt_writer, NULL) == 0) ? 1 : -1;
+    if (s_writer_state > 0) {
+      pthread_detach(writer);
+    }
+  }
+  if (s_writer_state < 0) {
+    rt_write_all(s_out, s_out_len);
+    s_out_len = 0;
+    return;
+  }
+
+  pthread_mutex_lock(&s_writer_lock);
+  while (s_writing != NULL) {
+    pthread_cond_wait(&s_writer_cond, &s_writer_lock);
+  }
+  s_writing = s_out;
+  s_writing_len = s_out_len;
+  pthread_cond_broadcast(&s_writer_cond);
+  pthread_mutex_unlock(&s_writer_lock);
+  s_out = (s_out == s_out_bufs[0]) ? s_out_bufs[1] : s_out_bufs[0];
+  s_out_len = 0;
+}
+
+/* write the rest of the output (in order, after the writer thread's) */
+static void rt_flush_at_exit(void) {
+  if (s_writer_state > 0) {
+    pthread_mutex_lock(&s_writer_lock);
+    while (s_writing != NULL) {
+      pthread_cond_wait(&s_writer_cond, &s_writer_lock);
+    }
+    pthread_mutex_unlock(&s_writer_lock);
+  }
+  rt_write_all(s_out, s_out_len);
+  s_out_len = 0;
+}
+
+/* map the rest of the input if it's a regular file */
+static void rt_start_input(void) {
+  struct stat st;
+  off_t offset;
+  s_in_started = 1;
+  offset = lseek(0, 0, SEEK_CUR);
+  if (fstat(0, &st) == 0 && S_ISREG(st.st_mode) && offset >= 0 && st.st_size > offset) {
+    /* (the mapping starts at the page containing the current offset) */
+    off_t start = offset - offset % sysconf(_SC_PAGESIZE);
+    void *data = mmap(NULL, (size_t) (st.st_size - start), PROT_READ, MAP_PRIVATE, 0, start);
+    if (data != MAP_FAILED) {
+      madvise(data, (size_t) (st.st_size - start), MADV_SEQUENTIAL);
+      s_in = (const char *) data;
+      s_in_pos = (size_t) (offset - start);
+      s_in_len = (size_t) (st.st_size - start);
+      s_in_eof = 1;
+    }
+  }
+}
+
+/* get the next input character without consuming it (-1 at end of input) */
+static int rt_peek(void) {
+  if (s_in_pos == s_in_len) {
+    ssize_t n;
+    if (!s_in_started) {
+      rt_start_input();
+      if (s_in_pos < s_in_len) {
+        return (unsigned char) s_in[s_in_pos];
+      }
+    }
+    if (s_in_eof || (n = read(0, s_in_buf, RT_BUFFER_SIZE)) <= 0) {
+      s_in_eof = 1;
+      return -1;
+    }
+    s_in_pos = 0;
+    s_in_len = (size_t) n;
+  }
+  return (unsigned char) s_in[s_in_pos];
+}
+
+/*
+ * the number of leading digits of eight bytes of input (loaded in
+ * little-endian order, so the first byte is the low byte): a byte is a
+ * digit if both it and it plus 6 are 0x3X (a carry out of a byte which
+ * isn't a digit only affects the bytes after it)
+ */
+static int rt_count_digits(uint64_t bytes) {
+  uint64_t high = bytes & 0xF0F0F0F0F0F0F0F0ULL;
+  uint64_t high6 = (bytes + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL;
+  uint64_t diff = (high ^ 0x3030303030303030ULL) | (high6 ^ 0x3030303030303030ULL);
+  /* set the top bit of each nonzero byte (of each byte which isn't a digit) */
+  uint64_t nondigits = (((diff & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL) | diff) & 0x8080808080808080ULL;
+  return (nondigits == 0) ? 8 : __builtin_ctzll(nondigits) / 8;
+}
+
+/*
+ * the value of the first num_digits (1 to 8) bytes of input, which are
+ * digits: they're moved to the top of the word (so the bytes before them
+ * are zeros), and then pairs of digits, pairs of those, and pairs of
+ * those are combined
+ */
+static uint64_t rt_convert_digits(uint64_t bytes, int num_digits) {
+  uint64_t val = (bytes & 0x0F0F0F0F0F0F0F0FULL) << (8 * (8 - num_digits));
+  val = (val * 2561) >> 8;
+  val = ((val & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+  return ((val & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+}
+
+/* add an integer and a newline to the output buffer */
+static void rt_format_int(long val) {
+  char digits[RT_MAX_INT_CHARS];
+  int num_digits = 0;
+  unsigned long mag = (val < 0) ? 0UL - (unsigned long) val : (unsigned long) val;
+
+  if (s_out_len + RT_MAX_INT_CHARS > RT_BUFFER_SIZE) {
+    rt_flush();
+  }
+
+  do {
+    digits[num_digits++] = (char) ('0' + mag % 10);
+    mag /= 10;
+  } while (mag != 0);
+
+  if (val < 0) {
+    s_out[s_out_len++] = '-';
+  }
+  while (num_digits > 0) {
+    s_out[s_out_len++] = digits[--num_digits];
+  }
+  s_out[s_out_len++] = '\n';
+}
+
+static void rt_start_output(void) {
+  if (!s_flush_at_exit) {
+    atexit(rt_flush_at_exit);
+    s_flush_at_exit = 1;
+  }
+}
+
+void __rt_write_int(long val) {
+  rt_start_output();
+  rt_format_int(val);
+}
+
+/* write count consecutive integers (for WRITE a[i] in a loop over i) */
+void __rt_write_int_array(const long *elems, long count) {
+  long i;
+  rt_start_output();
+  for (i = 0; i < count; i++) {
+    rt_format_int(elems[i]);
+  }
+}
+
+/* store value to count consecutive integers */
+void __rt_fill_int(long *dest, long value, long count) {
+  long i = 0;
+#ifdef __SSE2__
+  if (count >= RT_STREAM_THRESHOLD) {
+    __m128i pair = _mm_set1_epi64x(value);
+    if (((unsigned long) dest & 15) != 0) {
+      dest[i++] = value;
+    }
+    for (; i + 2 <= count; i += 2) {
+      _mm_stream_si128((__m128i *) (dest + i), pair);
+    }
+    _mm_sfence();
+  }
+#endif
+  for (; i < count; i++) {
+    dest[i] = value;
+  }
+}
+
+/* copy count consecutive integers (the arrays don't overlap) */
+void __rt_copy_int(long *dest, const long *source, long count) {
+  long i = 0;
+#ifdef __SSE2__
+  if (count >= RT_STREAM_THRESHOLD) {
+    if (((unsigned long) dest & 15) != 0) {
+      dest[i] = source[i];
+      i++;
+    }
+    for (; i + 2 <= count; i += 2) {
+      _mm_stream_si128((__m128i *) (dest + i), _mm_loadu_si128((const __m128i *) (source + i)));
+    }
+    _mm_sfence();
+  }
+#endif
+  memcpy(dest + i, source + i, (size_t) (count - i) * sizeof(long));
+}
+
+/* read a decimal integer, skipping leading whitespace (0 if there is none) */
+static long rt_read_int(void) {
+  static const uint64_t powers_of_10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+  };
+  int c, negative = 0;
+  unsigned long mag = 0;
+
+  while ((c = rt_peek()) == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f') {
+    s_in_pos++;
+  }
+  if (c == '-' || c == '+') {
+    negative = (c == '-');
+    s_in_pos++;
+  }
+  /* (digits too close to the end of the block are converted one at a time) */
+  while (s_in_len - s_in_pos >= 8) {
+    uint64_t bytes;
+    int num_digits;
+    memcpy(&bytes, s_in + s_in_pos, 8);
+    num_digits = rt_count_digits(bytes);
+    if (num_digits == 0) {
+      break;
+    }
+    mag = mag * powers_of_10[num_digits] + rt_convert_digits(bytes, num_digits);
+    s_in_pos += (size_t) num_digits;
+    if (num_digits < 8) {
+      return negative ? (long) (0UL - mag) : (long) mag;
+    }
+  }
+  while ((c = rt_peek()) >= '0' && c <= '9') {
+    mag = mag * 10 + (unsigned long) (c - '0');
+    s_in_pos++;
+  }
+
+  return negative ? (long) (0UL - mag) : (long) mag;
+}
+
+long __rt_read_int(void) {
+  return rt_read_int();
+}
+
+/* read count consecutive integers (for READ a[i] in a loop over i) */
+void __rt_read_int_array(long *elems, long count) {
+  long i;
+  for (i = 0; i < count; i++) {
+    elems[i] = rt_read_int();
+  }
+}
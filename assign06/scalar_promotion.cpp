@@ -0,0 +1,191 @@
+#include <cassert>
+#include <set>
+#include "cfg.h"
+#include "highlevel.h"
+#include "alias.h"
+#include "stats.h"
+#include "scalar_promotion.h"
+
+namespace {
+    // the vreg holding the address of a promotable load or store (or -1)
+    int get_address_vreg(Instruction *ins) {
+        int opcode = ins->get_opcode();
+        if (opcode == HINS_LOAD_INT && ins->get_operand(0).get_kind() == OPERAND_VREG
+                && ins->get_operand(1).get_kind() == OPERAND_VREG_MEMREF) {
+            return ins->get_operand(1).get_base_reg();
+        }
+        if (opcode == HINS_STORE_INT && ins->get_operand(0).get_kind() == OPERAND_VREG_MEMREF) {
+            return ins->get_operand(0).get_base_reg();
+        }
+        return -1;
+    }
+}
+
+LoopScalarPromotion::LoopScalarPromotion(ControlFlowGraph *cfg, const DominatorTree &domtree,
+                                         const LoopForest &loops, const AliasAnalysis &alias)
+        : ControlFlowGraphTransform(cfg)
+        , m_cfg(cfg)
+        , m_domtree(domtree)
+        , m_loops(loops)
+        , m_alias(alias)
+        , m_next_vreg(HighLevel::get_num_vregs(cfg)) {
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        promote(m_loops.get_loop(i));
+    }
+}
+
+LoopScalarPromotion::~LoopScalarPromotion() {
+    for (auto i = m_replaced.begin(); i != m_replaced.end(); i++) {
+        delete i->second;
+    }
+    for (auto i = m_at_start.begin(); i != m_at_start.end(); i++) {
+        for (auto j = i->second.begin(); j != i->second.end(); j++) {
+            delete *j;
+        }
+    }
+    for (auto i = m_at_end.begin(); i != m_at_end.end(); i++) {
+        for (auto j = i->second.begin(); j != i->second.end(); j++) {
+            delete *j;
+        }
+    }
+}
+
+InstructionSequence *LoopScalarPromotion::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+    auto at_start = m_at_start.find(bb), at_end = m_at_end.find(bb);
+    if (at_start != m_at_start.end()) {
+        for (auto i = at_start->second.begin(); i != at_start->second.end(); i++) {
+            out->add_instruction((*i)->duplicate());
+        }
+    }
+
+    // (the loads at the end of a preheader go before its jump)
+    unsigned end = bb->get_length();
+    if (at_end != m_at_end.end() && end > 0 && bb->get_last()->get_opcode() == HINS_JUMP) {
+        end--;
+    }
+    for (unsigned i = 0; i < bb->get_length(); i++) {
+        if (i == end) {
+            for (auto j = at_end->second.begin(); j != at_end->second.end(); j++) {
+                out->add_instruction((*j)->duplicate());
+            }
+        }
+        Instruction *ins = bb->get_instruction(i);
+        auto replaced = m_replaced.find(ins);
+        out->add_instruction((replaced != m_replaced.end() ? replaced->second : ins)->duplicate());
+    }
+    if (at_end != m_at_end.end() && end == bb->get_length()) {
+        for (auto j = at_end->second.begin(); j != at_end->second.end(); j++) {
+            out->add_instruction((*j)->duplicate());
+        }
+    }
+    return out;
+}
+
+void LoopScalarPromotion::promote(const LoopForest::Loop &loop) {
+    // the store back must run exactly when the loop is left
+    if (!loop.children.empty() || loop.preheader == nullptr) {
+        return;
+    }
+    std::vector<BasicBlock *> exit_blocks;
+    for (auto i = loop.exits.begin(); i != loop.exits.end(); i++) {
+        BasicBlock *target = (*i)->get_target();
+        if (target == m_cfg->get_exit_block() || m_cfg->get_incoming_edges(target).size() != 1) {
+            return;
+        }
+        exit_blocks.push_back(target);
+    }
+
+    // the accesses of each address, and the vregs defined in the loop
+    std::map<int, std::vector<Access>> locations;
+    std::vector<Access> accesses;
+    std::set<int> defs;
+    for (auto i = loop.blocks.begin(); i != loop.blocks.end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            Instruction *ins = *j;
+            if (HighLevel::has_flags(ins->get_opcode(), HOP_CALL)) {
+                return;
+            }
+            if (HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG) {
+                defs.insert(ins->get_operand(0).get_base_reg());
+            }
+            int address = get_address_vreg(ins);
+            if (address >= 0) {
+                locations[address].push_back(Access{ *i, ins });
+            }
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                if (ins->get_operand(k).is_memref()) {
+                    accesses.push_back(Access{ *i, ins });
+                    break;
+                }
+            }
+        }
+    }
+
+    for (auto i = locations.begin(); i != locations.end(); i++) {
+        int address = i->first;
+        bool has_store = false;
+        for (auto j = i->second.begin(); j != i->second.end(); j++) {
+            has_store = has_store || j->ins->get_opcode() == HINS_STORE_INT;
+        }
+        if (defs.count(address) > 0 || !has_store) {
+            continue;
+        }
+
+        // no other access in the loop may touch the location
+        Operand memref(OPERAND_VREG_MEMREF, address);
+        bool is_private = true;
+        for (auto j = accesses.begin(); j != accesses.end() && is_private; j++) {
+            if (get_address_vreg(j->ins) == address) {
+                continue;
+            }
+            for (unsigned k = 0; k < j->ins->get_num_operands(); k++) {
+                const Operand &operand = j->ins->get_operand(k);
+                if (operand.is_memref()
+                        && m_alias.may_alias(memref, 8, operand, AliasAnalysis::get_access_size(j->ins))) {
+                    is_private = false;
+                }
+            }
+        }
+        if (!is_private || !is_safe_to_load(loop, i->second)) {
+            continue;
+        }
+
+        Operand vreg(OPERAND_VREG, m_next_vreg++);
+        m_at_end[loop.preheader].push_back(new Instruction(HINS_LOAD_INT, vreg, memref));
+        for (auto j = exit_blocks.begin(); j != exit_blocks.end(); j++) {
+            m_at_start[*j].push_back(new Instruction(HINS_STORE_INT, memref, vreg));
+        }
+        for (auto j = i->second.begin(); j != i->second.end(); j++) {
+            Instruction *ins = j->ins;
+            if (ins->get_opcode() == HINS_LOAD_INT) {
+                m_replaced[ins] = new Instruction(HINS_MOV, ins->get_operand(0), vreg);
+            } else {
+                m_replaced[ins] = new Instruction(HINS_MOV, vreg, ins->get_operand(1));
+            }
+        }
+        Statistics::get().add("promote.locations");
+        Statistics::get().add("promote.accesses", long(i->second.size()));
+    }
+}
+
+bool LoopScalarPromotion::is_safe_to_load(const LoopForest::Loop &loop, const std::vector<Access> &accesses) const {
+    const Access &first = accesses.front();
+    if (m_alias.is_in_bounds(first.ins->get_operand(first.ins->get_opcode() == HINS_LOAD_INT ? 1 : 0), 8)) {
+        return true;
+    }
+    if (m_loops.get_trip_count(loop) < 1) {
+        return false;
+    }
+    for (auto i = accesses.begin(); i != accesses.end(); i++) {
+        bool dominates_latches = true;
+        for (auto j = loop.latches.begin(); j != loop.latches.end(); j++) {
+            dominates_latches = dominates_latches && m_domtree.dominates(i->block, *j);
+        }
+        if (dominates_latches) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,73 @@
+#ifndef SCALAR_PROMOTION_H
+#define SCALAR_PROMOTION_H
+
+#include <map>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "ssa.h"
+#include "loops.h"
+
+class AliasAnalysis;
+
+// Scalar promotion for a high-level CFG (not in SSA form): a memory
+// location which an innermost loop reads and writes at a loop-invariant
+// address, such as the field in
+//
+//   WHILE i < N DO acc.total := acc.total + a[i]; i := i + 1; END;
+//
+// is kept in a new vreg while the loop runs.  The location is loaded into
+// the vreg at the end of the preheader, each "ldi vrX, (vrA)" of it in the
+// loop becomes "mov vrX, vrP", each "sti (vrA), value" becomes
+// "mov vrP, value", and the vreg is stored back at the start of each block
+// the loop exits to.
+//
+// The accesses of a location are the HINS_LOAD_INT and HINS_STORE_INT
+// through the same vreg, which isn't defined in the loop (at least one of
+// them a store, since LoopInvariantCodeMotion hoists invariant loads).  The
+// location is only promoted if AliasAnalysis shows that no other memory
+// access in the loop may overlap it, and the loop has no calls.  Since the
+// load in the preheader runs even if the loop body doesn't, the address
+// must be in bounds (see AliasAnalysis::is_in_bounds), or the loop must do
+// at least one iteration (see LoopForest::get_trip_count) in which one of
+// the accesses executes (it is in a block which dominates the latches).
+// Storing the vreg back when the body didn't run stores the value just
+// loaded, which doesn't change memory.
+//
+// The loop must have a preheader, and each block it exits to must only be
+// entered from the loop, so that the store runs exactly when the loop is
+// left.
+class LoopScalarPromotion : public ControlFlowGraphTransform {
+private:
+    // a load or store in a loop, and its block
+    struct Access {
+        BasicBlock *block;
+        Instruction *ins;
+    };
+
+    ControlFlowGraph *m_cfg;
+    const DominatorTree &m_domtree;
+    const LoopForest &m_loops;
+    const AliasAnalysis &m_alias;
+    int m_next_vreg;
+    // the instructions replacing the accesses of the promoted locations,
+    // and the loads and stores added at the end of the preheaders and the
+    // start of the exit blocks
+    std::map<Instruction *, Instruction *> m_replaced;
+    std::map<BasicBlock *, std::vector<Instruction *>> m_at_start;
+    std::map<BasicBlock *, std::vector<Instruction *>> m_at_end;
+
+public:
+    LoopScalarPromotion(ControlFlowGraph *cfg, const DominatorTree &domtree, const LoopForest &loops,
+                        const AliasAnalysis &alias);
+    virtual ~LoopScalarPromotion();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void promote(const LoopForest::Loop &loop);
+    // can the location be loaded in the preheader without faulting?
+    bool is_safe_to_load(const LoopForest::Loop &loop, const std::vector<Access> &accesses) const;
+};
+
+#endif // SCALAR_PROMOTION_H
@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <cassert>
+#include "cfg.h"
+#include "x86_64.h"
+#include "peephole.h"
+#include "stats.h"
+#include "schedule.h"
+
+namespace {
+    // the processors of X86_64Tune (the latency of a 64-bit division
+    // varies with its operands, and is an estimate)
+    const InstructionScheduler::CpuModel CPU_MODELS[] = {
+        { 4, 4, 3, 40, { 4, 1, 1, 2, 1 } },     // TUNE_GENERIC
+        { 4, 5, 3, 42, { 4, 1, 1, 2, 1 } },     // TUNE_SKYLAKE
+        { 6, 4, 3, 18, { 4, 1, 1, 3, 2 } },     // TUNE_ZNVER
+    };
+
+    bool is_rsp_slot(const Operand &operand) {
+        return operand.has_base_reg() && operand.get_base_reg() == MREG_RSP && !operand.has_index_reg()
+               && operand.get_kind() != OPERAND_LABEL_MEMREF;
+    }
+
+    long get_slot_offset(const Operand &operand) {
+        return (operand.get_kind() & OPROP_HAS_INTVAL) != 0 ? operand.get_offset() : 0;
+    }
+
+    // does an instruction write its memory operand i (as the destination),
+    // and does it read it?  (A prefetch is ordered like a load.)
+    bool writes_memory(const Instruction *ins, unsigned i) {
+        int opcode = ins->get_opcode();
+        if (opcode == MINS_CMPQ || opcode == MINS_IDIVQ || opcode == MINS_DIVQ || opcode == MINS_MULQ
+                || (opcode == MINS_IMULQ && ins->get_num_operands() == 1) || opcode == MINS_PREFETCHT0) {
+            return false;
+        }
+        return i + 1 == ins->get_num_operands();
+    }
+
+    bool reads_memory(const Instruction *ins, unsigned i) {
+        int opcode = ins->get_opcode();
+        return !(writes_memory(ins, i) && (opcode == MINS_MOVQ || opcode == MINS_MOVB));
+    }
+
+    bool refers_to_rsp(const Operand &operand) {
+        return (X86_64::get_address_regs(operand) & (1U << MREG_RSP)) != 0;
+    }
+}
+
+InstructionScheduler::InstructionScheduler(InstructionSequence *iseq, X86_64Tune tune)
+        : m_iseq(iseq)
+        , m_cpu(CPU_MODELS[tune])
+        , m_private_end(0)
+        , m_num_moved(0) {
+}
+
+InstructionScheduler::~InstructionScheduler() {
+}
+
+InstructionSequence *InstructionScheduler::schedule() {
+    InstructionSequence *out = new InstructionSequence();
+    m_private_end = PeepholeOptimizer::get_private_end(m_iseq);
+
+    std::vector<Instruction *> region, result;
+    unsigned len = m_iseq->get_length();
+    unsigned i = 0;
+    while (i < len) {
+        if (m_iseq->has_label(i)) {
+            out->define_label(m_iseq->get_label(i));
+        }
+        if (is_barrier(m_iseq->get_instruction(i))) {
+            out->add_instruction(m_iseq->get_instruction(i));
+            i++;
+            continue;
+        }
+
+        // (the label of the region's first instruction labels the region)
+        region.clear();
+        unsigned j = i;
+        while (j < len && region.size() < MAX_REGION && !is_barrier(m_iseq->get_instruction(j))
+               && (j == i || !m_iseq->has_label(j))) {
+            region.push_back(m_iseq->get_instruction(j));
+            j++;
+        }
+
+        // keep the comparison of a conditional branch just before it (the
+        // condition codes are dead at a label, but may be used after a
+        // region split at MAX_REGION)
+        Instruction *compare = nullptr;
+        bool flags_live_at_end = false;
+        if (j < len && !m_iseq->has_label(j)) {
+            Instruction *next = m_iseq->get_instruction(j);
+            flags_live_at_end = !is_barrier(next) || (X86_64::get_effects(next).reads & (1U << X86_64::FLAGS)) != 0;
+            if (is_barrier(next) && flags_live_at_end
+                && (X86_64::get_effects(region.back()).writes & (1U << X86_64::FLAGS)) != 0) {
+                compare = region.back();
+                region.pop_back();
+                flags_live_at_end = false;
+            }
+        }
+
+        result.clear();
+        schedule_region(region, flags_live_at_end, result);
+        for (auto k = result.begin(); k != result.end(); k++) {
+            out->add_instruction(*k);
+        }
+        if (compare != nullptr) {
+            out->add_instruction(compare);
+        }
+        i = j;
+    }
+    if (m_iseq->has_label_at_end()) {
+        out->define_label(m_iseq->get_label_at_end());
+    }
+
+    if (m_num_moved > 0) {
+        Statistics::get().add("schedule.moved", long(m_num_moved));
+    }
+    return out;
+}
+
+InstructionScheduler::Timing InstructionScheduler::get_timing(const Instruction *ins) const {
+    Timing timing = { 1, 1U << UNIT_ALU };
+    switch (ins->get_opcode()) {
+        case MINS_IMULQ:
+        case MINS_MULQ:
+            timing = Timing{ m_cpu.mul_latency, 1U << UNIT_MUL };
+            break;
+        case MINS_IDIVQ:
+        case MINS_DIVQ:
+            timing = Timing{ m_cpu.div_latency, 1U << UNIT_DIV };
+            break;
+        case MINS_MOVQ:
+        case MINS_MOVZBQ:
+        case MINS_MOVSLQ:
+        case MINS_MOVB:
+            // (a move only needs the load or store unit to access memory)
+            if (ins->get_operand(0).is_memref() || ins->get_operand(1).is_memref()) {
+                timing.units = 0;
+            }
+            break;
+        default:
+            break;
+    }
+    if (ins->get_opcode() == MINS_LEAQ) {
+        return timing;
+    }
+
+    for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+        if (ins->get_operand(i).is_memref()) {
+            if (reads_memory(ins, i)) {
+                timing.units |= 1U << UNIT_LOAD;
+                timing.latency += m_cpu.load_latency;
+            }
+            if (writes_memory(ins, i)) {
+                timing.units |= 1U << UNIT_STORE;
+            }
+        }
+    }
+    return timing;
+}
+
+bool InstructionScheduler::is_barrier(const Instruction *ins) {
+    switch (ins->get_opcode()) {
+        case MINS_MOVQ:
+        case MINS_MOVZBQ:
+        case MINS_MOVB:
+        case MINS_MOVSLQ:
+        case MINS_MOVL:
+        case MINS_ADDQ:
+        case MINS_SUBQ:
+        case MINS_LEAQ:
+        case MINS_CMPQ:
+        case MINS_CMOVE:
+        case MINS_CMOVNE:
+        case MINS_CMOVL:
+        case MINS_CMOVLE:
+        case MINS_CMOVG:
+        case MINS_CMOVGE:
+        case MINS_IMULQ:
+        case MINS_MULQ:
+        case MINS_IDIVQ:
+        case MINS_DIVQ:
+        case MINS_CQTO:
+        case MINS_XORQ:
+        case MINS_XORL:
+        case MINS_ANDQ:
+        case MINS_SARQ:
+        case MINS_SHRQ:
+        case MINS_SHLQ:
+        case MINS_INCQ:
+        case MINS_DECQ:
+        case MINS_PREFETCHT0:
+            // (the stack pointer only changes in the prologue and epilogue)
+            return (X86_64::get_effects(ins).writes & (1U << MREG_RSP)) != 0;
+        default:
+            return true;
+    }
+}
+
+void InstructionScheduler::schedule_region(const std::vector<Instruction *> &region, bool flags_live_at_end,
+                                           std::vector<Instruction *> &result) {
+    unsigned n = unsigned(region.size());
+    if (n < 2) {
+        result = region;
+        return;
+    }
+
+    std::vector<Node> nodes(n);
+    const unsigned flags = 1U << X86_64::FLAGS;
+    bool flags_live = flags_live_at_end;
+    for (unsigned i = n; i > 0; i--) {
+        Node &node = nodes[i - 1];
+        node.ins = region[i - 1];
+        node.effects = X86_64::get_effects(node.ins);
+        node.timing = get_timing(node.ins);
+        node.num_preds = 0;
+        node.height = 0;
+        node.ready_cycle = 0;
+        find_accesses(node);
+
+        // condition codes which are never used don't order the instructions
+        // (except that they can't be set between the instruction setting
+        // the ones used and their users)
+        bool writes_flags = (node.effects.writes & flags) != 0;
+        node.clobbers_flags = writes_flags;
+        if (writes_flags && !flags_live) {
+            node.effects.writes &= ~flags;
+        }
+        flags_live = (flags_live && !writes_flags) || (node.effects.reads & flags) != 0;
+    }
+
+    // build the dependences (each edge goes from an earlier instruction
+    // to a later one, with the cycles the later one must wait)
+    for (unsigned j = 1; j < n; j++) {
+        Node &later = nodes[j];
+        for (unsigned i = 0; i < j; i++) {
+            Node &earlier = nodes[i];
+            bool depends = false;
+            unsigned delay = 0;
+            if ((earlier.effects.writes & later.effects.reads) != 0) {
+                depends = true;
+                delay = earlier.timing.latency;
+            }
+            if ((earlier.effects.reads & later.effects.writes) != 0
+                || (earlier.effects.writes & later.effects.writes) != 0
+                || (earlier.clobbers_flags && (later.effects.writes & flags) != 0)
+                || ((earlier.effects.reads & flags) != 0 && later.clobbers_flags)) {
+                depends = true;
+            }
+            for (auto a = earlier.accesses.begin(); a != earlier.accesses.end() && !depends; a++) {
+                for (auto b = later.accesses.begin(); b != later.accesses.end() && !depends; b++) {
+                    if ((a->is_write || b->is_write) && may_conflict(*a, *b)) {
+                        depends = true;
+                        // (a load from a store's location is forwarded from it)
+                        delay = a->is_write && !b->is_write ? 1 : 0;
+                    }
+                }
+            }
+            if (depends) {
+                earlier.succs.push_back(std::make_pair(j, delay));
+                later.num_preds++;
+            }
+        }
+    }
+    for (unsigned i = n; i > 0; i--) {
+        Node &node = nodes[i - 1];
+        node.height = node.timing.latency;
+        for (auto s = node.succs.begin(); s != node.succs.end(); s++) {
+            node.height = std::max(node.height, s->second + nodes[s->first].height);
+        }
+    }
+
+    // issue the instructions cycle by cycle
+    std::vector<unsigned> ready;
+    for (unsigned i = 0; i < n; i++) {
+        if (nodes[i].num_preds == 0) {
+            ready.push_back(i);
+        }
+    }
+    unsigned cycle = 0;
+    while (result.size() < n) {
+        unsigned ports_used[NUM_UNITS] = { 0, 0, 0, 0, 0 };
+        unsigned issued = 0;
+        while (issued < m_cpu.issue_width) {
+            // the ready instruction with the longest path to the end (or
+            // the earliest of them) whose units have free ports
+            int best = -1;
+            for (unsigned k = 0; k < ready.size(); k++) {
+                const Node &node = nodes[ready[k]];
+                if (node.ready_cycle > cycle) {
+                    continue;
+                }
+                bool has_ports = true;
+                for (unsigned u = 0; u < NUM_UNITS; u++) {
+                    if ((node.timing.units & (1U << u)) != 0 && ports_used[u] >= m_cpu.num_ports[u]) {
+                        has_ports = false;
+                    }
+                }
+                if (has_ports && (best < 0 || node.height > nodes[ready[best]].height
+                                  || (node.height == nodes[ready[best]].height && ready[k] < ready[best]))) {
+                    best = int(k);
+                }
+            }
+            if (best < 0) {
+                break;
+            }
+
+            unsigned index = ready[best];
+            ready.erase(ready.begin() + best);
+            Node &node = nodes[index];
+            for (unsigned u = 0; u < NUM_UNITS; u++) {
+                if ((node.timing.units & (1U << u)) != 0) {
+                    ports_used[u]++;
+                }
+            }
+            if (index != result.size()) {
+                m_num_moved++;
+            }
+            result.push_back(node.ins);
+            issued++;
+
+            for (auto s = node.succs.begin(); s != node.succs.end(); s++) {
+                Node &succ = nodes[s->first];
+                succ.ready_cycle = std::max(succ.ready_cycle, cycle + s->second);
+                if (--succ.num_preds == 0) {
+                    ready.push_back(s->first);
+                }
+            }
+        }
+        cycle++;
+    }
+}
+
+void InstructionScheduler::find_accesses(Node &node) const {
+    const Instruction *ins = node.ins;
+    int opcode = ins->get_opcode();
+    if (opcode == MINS_LEAQ) {
+        return;
+    }
+    long size = 8;
+    if (opcode == MINS_MOVB || opcode == MINS_MOVZBQ) {
+        size = 1;
+    } else if (opcode == MINS_MOVSLQ) {
+        size = 4;
+    }
+    for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+        const Operand &operand = ins->get_operand(i);
+        if (!operand.is_memref()) {
+            continue;
+        }
+        if (reads_memory(ins, i)) {
+            node.accesses.push_back(Access{ operand, size, false });
+        }
+        if (writes_memory(ins, i)) {
+            node.accesses.push_back(Access{ operand, size, true });
+        }
+    }
+}
+
+bool InstructionScheduler::may_conflict(const Access &a, const Access &b) const {
+    long start_a = get_slot_offset(a.operand), start_b = get_slot_offset(b.operand);
+    if (is_rsp_slot(a.operand) && is_rsp_slot(b.operand)) {
+        return start_a < start_b + b.size && start_b < start_a + a.size;
+    }
+    // a private slot is only accessed through %rsp
+    if (is_rsp_slot(a.operand) && start_a + a.size <= m_private_end && !refers_to_rsp(b.operand)) {
+        return false;
+    }
+    if (is_rsp_slot(b.operand) && start_b + b.size <= m_private_end && !refers_to_rsp(a.operand)) {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,130 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <vector>
+#include "cfg.h"
+#include "x86_64.h"
+#include "target.h"
+
+// List scheduling of the x86-64 code generated by AssemblyCodeGen (after
+// register allocation and peephole optimization), so that a load starts
+// as early as its address is known, rather than just before its value is
+// used.  For example, the loads of
+//
+//     leaq 1(%r14), %rdi
+//     leaq 0(%r12, %rdi, 8), %rdi
+//     movq (%rsi), %rbx
+//     movq (%rdi), %r9
+//
+// are independent of each other, and the load through %rsi is moved
+// above the address computation, so that its latency is overlapped with
+// the computation of the other address.
+//
+// The code is scheduled in regions: the straight-line code between labels
+// and barriers, which are the instructions whose effects aren't modeled
+// (branches, calls, pushes and pops, SSE and string instructions, and
+// changes to %rsp), and which stay where they are.  The comparison just
+// before a conditional branch stays with it (so the pair can still be
+// macro-fused, and the branch still follows its comparison, as the other
+// x86-64 passes expect).  Within a region, an instruction depends on the
+// earlier instructions which write the registers it reads (or read or
+// write the registers it writes), with the condition codes as a register
+// that is only tracked where they are used, and on the earlier memory
+// accesses which may access the same memory, if either access is a store.
+// (Two %rsp-relative slots at different offsets are different, and
+// neither is the same as an access through another register if it is one
+// of the private slots, see PeepholeOptimizer::get_private_end.)
+//
+// Each region is scheduled a cycle at a time: of the instructions whose
+// operands are ready, the one with the longest (latency-weighted) path to
+// the end of the region is issued first, as long as its execution unit
+// has a free port in the cycle and the cycle has issued fewer than
+// the processor's issue width.  The latencies, ports and issue width are
+// those of the processor given by -mtune (see X86_64Cpu), by default a
+// generic recent x86-64 core (see get_timing).  Regions longer than
+// MAX_REGION instructions are split, to bound the time to build the
+// dependences.
+class InstructionScheduler {
+public:
+    static const unsigned MAX_REGION = 128;
+
+    // the kinds of execution ports (each processor has its own number of
+    // each, see CpuModel)
+    enum Unit {
+        UNIT_ALU,       // simple integer operations
+        UNIT_MUL,       // multiplication
+        UNIT_DIV,       // division (not pipelined)
+        UNIT_LOAD,      // loads
+        UNIT_STORE,     // stores
+        NUM_UNITS,
+    };
+
+    // the cycles an instruction takes to produce its result, and the
+    // units it uses (as a mask of 1 << Unit)
+    struct Timing {
+        unsigned latency;
+        unsigned units;
+    };
+
+    // the timings of a processor: the instructions it can issue in a
+    // cycle, the latencies of a load which hits the L1 data cache (beyond
+    // the latency of the operation itself), a multiplication and a
+    // division, and the number of ports of each Unit
+    struct CpuModel {
+        unsigned issue_width;
+        unsigned load_latency;
+        unsigned mul_latency;
+        unsigned div_latency;
+        unsigned num_ports[NUM_UNITS];
+    };
+
+private:
+    // a memory access of an instruction
+    struct Access {
+        Operand operand;
+        long size;
+        bool is_write;
+    };
+
+    struct Node {
+        Instruction *ins;
+        X86_64Effects effects;
+        Timing timing;
+        std::vector<Access> accesses;
+        // does it write the condition codes (even if they're never used)?
+        bool clobbers_flags;
+        // the instructions which must come after this one, with the
+        // number of cycles after it that each one can issue
+        std::vector<std::pair<unsigned, unsigned>> succs;
+        unsigned num_preds;
+        // the longest path from this instruction to the end of the region
+        unsigned height;
+        // the first cycle at which its operands are ready
+        unsigned ready_cycle;
+    };
+
+    InstructionSequence *m_iseq;
+    const CpuModel &m_cpu;
+    long m_private_end;
+    unsigned m_num_moved;
+
+public:
+    InstructionScheduler(InstructionSequence *iseq, X86_64Tune tune = TUNE_GENERIC);
+    ~InstructionScheduler();
+
+    // get the scheduled instruction sequence
+    InstructionSequence *schedule();
+
+    Timing get_timing(const Instruction *ins) const;
+
+    // is an instruction left in place, ending a region?
+    static bool is_barrier(const Instruction *ins);
+
+private:
+    void schedule_region(const std::vector<Instruction *> &region, bool flags_live_at_end,
+                         std::vector<Instruction *> &result);
+    void find_accesses(Node &node) const;
+    bool may_conflict(const Access &a, const Access &b) const;
+};
+
+#endif // SCHEDULE_H
@@ -0,0 +1,111 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "util.h"
+#include "cfg.h"
+#include "node.h"
+#include "server.h"
+
+namespace {
+    // requests longer than this are refused
+    const size_t MAX_REQUEST = 64 * 1024;
+
+    void throw_error(const char *msg) {
+        throw CompileServer::Error{ msg };
+    }
+
+    bool write_all(int fd, const char *data, size_t len) {
+        while (len > 0) {
+            ssize_t n = write(fd, data, len);
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            len -= size_t(n);
+        }
+        return true;
+    }
+
+    void reply(int fd, const char *status, const char *data, size_t len) {
+        std::string header = std::string(status) + " " + std::to_string(len) + "\n";
+        if (write_all(fd, header.data(), header.size())) {
+            write_all(fd, data, len);
+        }
+    }
+}
+
+void CompileServer::run(const char *socket_path, const Handler &handler) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        err_fatal("Socket path \"%s\" is too long\n", socket_path);
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        err_fatal("Could not listen on socket \"%s\"\n", socket_path);
+    }
+    // (a client which goes away before reading the reply mustn't kill the server)
+    signal(SIGPIPE, SIG_IGN);
+
+    IRArena::set_reuse_storage(true);
+    NodeArena::set_reuse_storage(true);
+    for (;;) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd >= 0) {
+            serve(fd, handler);
+            close(fd);
+        }
+    }
+}
+
+void CompileServer::serve(int fd, const Handler &handler) {
+    std::string request;
+    char buf[4096];
+    ssize_t n;
+    while (request.find('\n') == std::string::npos && request.size() < MAX_REQUEST
+           && (n = read(fd, buf, sizeof(buf))) > 0) {
+        request.append(buf, size_t(n));
+    }
+    size_t end = request.find('\n');
+    if (end == std::string::npos) {
+        const char *msg = "Incomplete request\n";
+        reply(fd, "error", msg, strlen(msg));
+        return;
+    }
+
+    std::vector<std::string> args;
+    std::istringstream words(request.substr(0, end));
+    std::string word;
+    while (words >> word) {
+        args.push_back(word);
+    }
+
+    char *code = nullptr;
+    size_t code_len = 0;
+    FILE *out = open_memstream(&code, &code_len);
+    if (out == nullptr) {
+        const char *msg = "Could not allocate the output\n";
+        reply(fd, "error", msg, strlen(msg));
+        return;
+    }
+    err_set_handler(throw_error);
+    try {
+        handler(args, out);
+        fclose(out);
+        reply(fd, "ok", code, code_len);
+    } catch (const Error &e) {
+        fclose(out);
+        reply(fd, "error", e.message.data(), e.message.size());
+    }
+    err_set_handler(nullptr);
+    free(code);
+}
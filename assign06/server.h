@@ -0,0 +1,43 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// A compile server (for the --server option), which compiles programs on
+// request without starting a process for each one.
+//
+// A client connects to the server's Unix socket and sends one request: a
+// line with the arguments of the compilation, separated by spaces, as they
+// would be given on the command line (such as "-o -r /tmp/prog.in"; paths
+// are relative to the server's working directory).  The server replies
+// with "ok <n>\n" followed by the n bytes of assembly code (none if the
+// code was written to a file, with -c), or "error <n>\n" followed by the
+// error message, and closes the connection.  Requests are served one at a
+// time, each compiled the same way as by a separate process (its functions
+// may still be compiled on several threads, with -j): the IR and AST pools
+// keep their storage between compilations rather than freeing it, and the
+// shared INTEGER and CHAR types are created once.
+//
+// A fatal error (see err_fatal) while serving a request throws an Error,
+// which ends the request rather than the server.
+class CompileServer {
+public:
+    struct Error {
+        std::string message;
+    };
+
+    // compile the program given by the arguments, printing its code to out
+    typedef std::function<void(const std::vector<std::string> &args, FILE *out)> Handler;
+
+    // serve requests on a socket at the given path (replacing any file
+    // there); only returns if the socket can't be created
+    static void run(const char *socket_path, const Handler &handler);
+
+private:
+    static void serve(int fd, const Handler &handler);
+};
+
+#endif // SERVER_H
@@ -0,0 +1,633 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "ssa.h"
+
+namespace {
+    bool is_vreg_operand(const Operand &operand) {
+        switch (operand.get_kind()) {
+            case OPERAND_VREG:
+            case OPERAND_VREG_MEMREF:
+            case OPERAND_VREG_MEMREF_OFFSET:
+            case OPERAND_VREG_MEMREF_INDEX:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool is_branch(Instruction *ins) {
+        // same test as HighLevelControlFlowGraphBuilder::is_branch
+        return ins->get_num_operands() == 1 && (*ins)[0].get_kind() == OPERAND_LABEL
+               && !HighLevel::is_subprogram_call(ins);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// DominatorTree implementation
+////////////////////////////////////////////////////////////////////////
+
+DominatorTree::DominatorTree(ControlFlowGraph *cfg)
+        : m_cfg(cfg) {
+    unsigned num_blocks = cfg->get_num_blocks();
+    m_idom.assign(num_blocks, -1);
+    m_rpo_index.assign(num_blocks, 0);
+    m_children.resize(num_blocks);
+    m_frontier.resize(num_blocks);
+
+    compute_reverse_postorder();
+    compute_idoms();
+    compute_frontiers();
+}
+
+DominatorTree::~DominatorTree() {
+}
+
+bool DominatorTree::is_reachable(BasicBlock *bb) const {
+    return bb == m_cfg->get_entry_block() || m_idom[bb->get_id()] >= 0;
+}
+
+BasicBlock *DominatorTree::get_idom(BasicBlock *bb) const {
+    if (bb == m_cfg->get_entry_block() || m_idom[bb->get_id()] < 0) {
+        return nullptr;
+    }
+    return m_cfg->get_block(unsigned(m_idom[bb->get_id()]));
+}
+
+const std::vector<BasicBlock *> &DominatorTree::get_children(BasicBlock *bb) const {
+    return m_children[bb->get_id()];
+}
+
+const std::set<BasicBlock *> &DominatorTree::get_dominance_frontier(BasicBlock *bb) const {
+    return m_frontier[bb->get_id()];
+}
+
+bool DominatorTree::dominates(BasicBlock *a, BasicBlock *b) const {
+    if (!is_reachable(a) || !is_reachable(b)) {
+        return false;
+    }
+    // walk up the tree from b: an immediate dominator is always
+    // earlier in reverse postorder, so stop once we pass a
+    while (b != nullptr && m_rpo_index[b->get_id()] >= m_rpo_index[a->get_id()]) {
+        if (b == a) {
+            return true;
+        }
+        b = get_idom(b);
+    }
+    return false;
+}
+
+void DominatorTree::compute_reverse_postorder() {
+    m_rpo = m_cfg->get_reverse_postorder();
+    for (unsigned i = 0; i < m_rpo.size(); i++) {
+        m_rpo_index[m_rpo[i]->get_id()] = i;
+    }
+}
+
+void DominatorTree::compute_idoms() {
+    BasicBlock *entry = m_cfg->get_entry_block();
+    m_idom[entry->get_id()] = int(entry->get_id());
+
+    bool change = true;
+    while (change) {
+        change = false;
+        for (auto i = m_rpo.begin(); i != m_rpo.end(); i++) {
+            BasicBlock *bb = *i;
+            if (bb == entry) {
+                continue;
+            }
+
+            // the new idom is the intersection of all processed predecessors
+            int new_idom = -1;
+            const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(bb);
+            for (auto j = incoming_edges.cbegin(); j != incoming_edges.cend(); j++) {
+                unsigned pred = (*j)->get_source()->get_id();
+                if (m_idom[pred] < 0) {
+                    continue;
+                }
+                new_idom = (new_idom < 0) ? int(pred) : int(intersect(pred, unsigned(new_idom)));
+            }
+
+            if (new_idom != m_idom[bb->get_id()]) {
+                m_idom[bb->get_id()] = new_idom;
+                change = true;
+            }
+        }
+    }
+
+    // the entry block has no immediate dominator
+    m_idom[entry->get_id()] = -1;
+
+    for (auto i = m_rpo.begin(); i != m_rpo.end(); i++) {
+        BasicBlock *idom = get_idom(*i);
+        if (idom != nullptr) {
+            m_children[idom->get_id()].push_back(*i);
+        }
+    }
+}
+
+void DominatorTree::compute_frontiers() {
+    // a join point is in the dominance frontier of every block on the
+    // path up the dominator tree from each predecessor to the join point's idom
+    for (auto i = m_rpo.begin(); i != m_rpo.end(); i++) {
+        BasicBlock *bb = *i;
+        const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(bb);
+        if (incoming_edges.size() < 2) {
+            continue;
+        }
+
+        BasicBlock *idom = get_idom(bb);
+        for (auto j = incoming_edges.cbegin(); j != incoming_edges.cend(); j++) {
+            BasicBlock *runner = (*j)->get_source();
+            if (!is_reachable(runner)) {
+                continue;
+            }
+            while (runner != nullptr && runner != idom) {
+                m_frontier[runner->get_id()].insert(bb);
+                runner = get_idom(runner);
+            }
+        }
+    }
+}
+
+unsigned DominatorTree::intersect(unsigned a, unsigned b) const {
+    while (a != b) {
+        while (m_rpo_index[a] > m_rpo_index[b]) {
+            a = unsigned(m_idom[a]);
+        }
+        while (m_rpo_index[b] > m_rpo_index[a]) {
+            b = unsigned(m_idom[b]);
+        }
+    }
+    return a;
+}
+
+////////////////////////////////////////////////////////////////////////
+// SSA implementation
+////////////////////////////////////////////////////////////////////////
+
+std::vector<BasicBlock *> SSA::get_predecessors(ControlFlowGraph *cfg, BasicBlock *bb) {
+    std::vector<BasicBlock *> preds;
+    const ControlFlowGraph::EdgeList &incoming_edges = cfg->get_incoming_edges(bb);
+    for (auto i = incoming_edges.cbegin(); i != incoming_edges.cend(); i++) {
+        preds.push_back((*i)->get_source());
+    }
+    std::sort(preds.begin(), preds.end(),
+              [](BasicBlock *a, BasicBlock *b) { return a->get_id() < b->get_id(); });
+    preds.erase(std::unique(preds.begin(), preds.end()), preds.end());
+    return preds;
+}
+
+unsigned SSA::get_pred_index(ControlFlowGraph *cfg, BasicBlock *bb, BasicBlock *pred) {
+    std::vector<BasicBlock *> preds = get_predecessors(cfg, bb);
+    auto i = std::find(preds.begin(), preds.end(), pred);
+    assert(i != preds.end());
+    return unsigned(i - preds.begin());
+}
+
+unsigned SSA::get_insertion_point(BasicBlock *bb) {
+    // the instructions go before the branch (and the comparison
+    // it depends on) at the end of the block
+    unsigned index = bb->get_length();
+    if (index > 0 && is_branch(bb->get_instruction(index - 1))) {
+        index--;
+        if (index > 0 && bb->get_instruction(index)->get_opcode() != HINS_JUMP
+                && bb->get_instruction(index - 1)->get_opcode() == HINS_INT_COMPARE) {
+            index--;
+        }
+    }
+    return index;
+}
+
+BasicBlock *SSA::split_edge(ControlFlowGraph *cfg, BasicBlock *source, BasicBlock *target, EdgeKind kind,
+                            const InstructionSequence &instructions) {
+    BasicBlock *split_bb;
+    if (kind == EDGE_BRANCH) {
+        // the branch is redirected to the new block, which jumps to the target
+        std::string label = StringTable::labels().new_label(".Lsplit");
+        split_bb = cfg->create_basic_block(BASICBLOCK_INTERIOR, label);
+        for (auto i = instructions.cbegin(); i != instructions.cend(); i++) {
+            split_bb->add_instruction((*i)->duplicate());
+        }
+        split_bb->add_instruction(new Instruction(HINS_JUMP, Operand(target->get_label())));
+
+        Instruction *branch = source->get_last();
+        assert(is_branch(branch) && (*branch)[0].get_target_label() == target->get_label());
+        (*branch)[0] = Operand(label);
+    } else {
+        // the new block falls through to the target
+        split_bb = cfg->create_basic_block(BASICBLOCK_INTERIOR);
+        for (auto i = instructions.cbegin(); i != instructions.cend(); i++) {
+            split_bb->add_instruction((*i)->duplicate());
+        }
+        if (split_bb->get_length() == 0) {
+            split_bb->add_instruction(new Instruction(HINS_NOP));
+        }
+    }
+
+    cfg->create_edge(source, split_bb, kind);
+    cfg->create_edge(split_bb, target, kind);
+    return split_bb;
+}
+
+////////////////////////////////////////////////////////////////////////
+// SSAConstruction implementation
+////////////////////////////////////////////////////////////////////////
+
+SSAConstruction::SSAConstruction(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg)
+        , m_domtree(cfg)
+        , m_next_vreg(0) {
+    int num_vregs = HighLevel::get_num_vregs(cfg);
+    m_next_vreg = num_vregs;
+
+    unsigned num_blocks = cfg->get_num_blocks();
+    m_phis.resize(num_blocks);
+    m_renamed.assign(num_blocks, nullptr);
+    m_names.resize(num_vregs);
+
+    place_phis(num_vregs);
+    rename(cfg->get_entry_block());
+}
+
+SSAConstruction::~SSAConstruction() {
+    for (auto i = m_renamed.begin(); i != m_renamed.end(); i++) {
+        delete *i;
+    }
+}
+
+InstructionSequence *SSAConstruction::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+
+    // unreachable blocks are left unchanged
+    InstructionSequence *renamed = m_renamed[bb->get_id()];
+    if (renamed == nullptr) {
+        renamed = iseq;
+    }
+
+    const std::vector<Phi> &phis = m_phis[bb->get_id()];
+    for (auto i = phis.begin(); i != phis.end(); i++) {
+        std::vector<Operand> operands;
+        operands.push_back(Operand(OPERAND_VREG, i->dest));
+        operands.insert(operands.end(), i->args.begin(), i->args.end());
+        out->add_instruction(new Instruction(HINS_PHI, operands));
+    }
+
+    for (auto i = renamed->cbegin(); i != renamed->cend(); i++) {
+        out->add_instruction((*i)->duplicate());
+    }
+
+    return out;
+}
+
+void SSAConstruction::place_phis(int num_vregs) {
+    ControlFlowGraph *cfg = get_orig_cfg();
+
+    LiveVregs live_vregs(cfg);
+    live_vregs.execute();
+
+    // find the blocks defining each vreg
+    std::vector<std::set<BasicBlock *>> defsites(num_vregs);
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+            Instruction *ins = *j;
+            if (HighLevel::is_def(ins)) {
+                defsites[ins->get_operand(0).get_base_reg()].insert(bb);
+            }
+        }
+    }
+
+    // place phis on the iterated dominance frontier of the defining blocks
+    for (int v = 0; v < num_vregs; v++) {
+        std::vector<BasicBlock *> work_list(defsites[v].begin(), defsites[v].end());
+        std::set<BasicBlock *> has_phi;
+
+        while (!work_list.empty()) {
+            BasicBlock *bb = work_list.back();
+            work_list.pop_back();
+
+            const std::set<BasicBlock *> &frontier = m_domtree.get_dominance_frontier(bb);
+            for (auto i = frontier.begin(); i != frontier.end(); i++) {
+                BasicBlock *join = *i;
+                if (has_phi.count(join) > 0 || !live_vregs.get_fact_at_beginning_of_block(join).test(unsigned(v))) {
+                    continue;
+                }
+                has_phi.insert(join);
+
+                Phi phi;
+                phi.orig_vreg = v;
+                phi.dest = v;
+                phi.args.assign(SSA::get_predecessors(cfg, join).size(), Operand(OPERAND_VREG, v));
+                m_phis[join->get_id()].push_back(phi);
+
+                // the phi is a new definition of v
+                if (defsites[v].count(join) == 0) {
+                    work_list.push_back(join);
+                }
+            }
+        }
+    }
+}
+
+void SSAConstruction::rename(BasicBlock *entry) {
+    // walk the dominator tree depth-first with an explicit stack, since
+    // it can be as deep as the CFG is long (e.g., a long sequence of IFs);
+    // each entry is a block, the index of its next child to visit, and
+    // the original vregs given new names in the block (to pop afterwards)
+    struct Visit {
+        BasicBlock *bb;
+        unsigned next_child;
+        std::vector<int> defined;
+    };
+    std::vector<Visit> stack;
+
+    stack.push_back({ entry, 0, std::vector<int>() });
+    rename_block(entry, stack.back().defined);
+    while (!stack.empty()) {
+        Visit &visit = stack.back();
+        const std::vector<BasicBlock *> &children = m_domtree.get_children(visit.bb);
+        if (visit.next_child < children.size()) {
+            BasicBlock *child = children[visit.next_child++];
+            stack.push_back({ child, 0, std::vector<int>() });
+            rename_block(child, stack.back().defined);
+            continue;
+        }
+
+        for (auto i = visit.defined.begin(); i != visit.defined.end(); i++) {
+            m_names[*i].pop_back();
+        }
+        stack.pop_back();
+    }
+}
+
+void SSAConstruction::rename_block(BasicBlock *bb, std::vector<int> &defined) {
+    ControlFlowGraph *cfg = get_orig_cfg();
+
+    std::vector<Phi> &phis = m_phis[bb->get_id()];
+    for (auto i = phis.begin(); i != phis.end(); i++) {
+        i->dest = m_next_vreg++;
+        m_names[i->orig_vreg].push_back(i->dest);
+        defined.push_back(i->orig_vreg);
+    }
+
+    auto renamed = new InstructionSequence();
+    for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+        Instruction *ins = (*i)->duplicate();
+
+        // uses are renamed first, since an instruction may
+        // use the vreg it defines
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            if (HighLevel::is_use(ins, j) && is_vreg_operand((*ins)[j])) {
+                rename_use((*ins)[j]);
+            }
+        }
+
+        if (HighLevel::is_def(ins)) {
+            Operand &dest = (*ins)[0];
+            int orig_vreg = dest.get_base_reg();
+            int name = m_next_vreg++;
+            dest.set_base_reg(name);
+            m_names[orig_vreg].push_back(name);
+            defined.push_back(orig_vreg);
+        }
+
+        renamed->add_instruction(ins);
+    }
+    m_renamed[bb->get_id()] = renamed;
+
+    // fill in the phi operands for values flowing out of this block
+    const ControlFlowGraph::EdgeList &outgoing_edges = cfg->get_outgoing_edges(bb);
+    for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+        BasicBlock *succ = (*i)->get_target();
+        unsigned pred_index = SSA::get_pred_index(cfg, succ, bb);
+        std::vector<Phi> &succ_phis = m_phis[succ->get_id()];
+        for (auto j = succ_phis.begin(); j != succ_phis.end(); j++) {
+            j->args[pred_index] = Operand(OPERAND_VREG, get_current_name(j->orig_vreg));
+        }
+    }
+}
+
+void SSAConstruction::rename_use(Operand &operand) {
+    operand.set_base_reg(get_current_name(operand.get_base_reg()));
+    if (operand.has_index_reg()) {
+        operand.set_index_reg(get_current_name(operand.get_index_reg()));
+    }
+}
+
+int SSAConstruction::get_current_name(int orig_vreg) const {
+    // a use not reached by any definition keeps its original name
+    const std::vector<int> &names = m_names[orig_vreg];
+    return names.empty() ? orig_vreg : names.back();
+}
+
+////////////////////////////////////////////////////////////////////////
+// SSADestruction implementation
+////////////////////////////////////////////////////////////////////////
+
+SSADestruction::SSADestruction(ControlFlowGraph *cfg)
+        : m_cfg(cfg)
+        , m_next_vreg(HighLevel::get_num_vregs(cfg)) {
+}
+
+SSADestruction::~SSADestruction() {
+}
+
+ControlFlowGraph *SSADestruction::transform_cfg() {
+    ControlFlowGraph *result = new ControlFlowGraph();
+
+    // map of basic blocks of original CFG to basic blocks in transformed CFG
+    std::map<BasicBlock *, BasicBlock *> block_map;
+
+    LiveVregs live_vregs(m_cfg);
+    live_vregs.execute();
+
+    // edges whose copies are placed at the end of the source block
+    std::set<Edge *> copied_in_source;
+
+    // create the transformed blocks: the copies for an edge whose source
+    // has only one successor go at the end of the source block
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        BasicBlock *result_bb = result->create_basic_block(orig->get_kind(), orig->get_label());
+        block_map[orig] = result_bb;
+        result_bb->set_count(orig->get_count());
+
+        unsigned len = orig->get_length(), split = SSA::get_insertion_point(orig);
+
+        InstructionSequence copies;
+        const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(orig);
+        if (orig->get_kind() == BASICBLOCK_INTERIOR) {
+            Edge *copy_edge = nullptr;
+            std::vector<std::pair<Operand, Operand>> pcopy;
+            for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+                std::vector<std::pair<Operand, Operand>> edge_pcopy;
+                get_copies((*j)->get_target(), orig, edge_pcopy);
+                if (edge_pcopy.empty()) {
+                    continue;
+                }
+                // (if more than one edge needs copies, they must all be split)
+                copy_edge = (copy_edge == nullptr && pcopy.empty()) ? *j : nullptr;
+                pcopy.swap(edge_pcopy);
+            }
+
+            // The copies for a critical edge can also go in the source block
+            // if they don't change anything seen by the other successors
+            // (or by the branch): this avoids a block that just jumps to the
+            // target once the copies are coalesced by register allocation.
+            if (copy_edge != nullptr && can_copy_in_source(orig, copy_edge->get_target(), split, pcopy, live_vregs)) {
+                copied_in_source.insert(copy_edge);
+                sequentialize(pcopy, &copies);
+            }
+        }
+
+        for (unsigned j = 0; j < len; j++) {
+            if (j == split) {
+                for (auto k = copies.cbegin(); k != copies.cend(); k++) {
+                    result_bb->add_instruction((*k)->duplicate());
+                }
+            }
+            Instruction *ins = orig->get_instruction(j);
+            if (!SSA::is_phi(ins)) {
+                result_bb->add_instruction(ins->duplicate());
+            }
+        }
+        if (split == len) {
+            for (auto k = copies.cbegin(); k != copies.cend(); k++) {
+                result_bb->add_instruction((*k)->duplicate());
+            }
+        }
+        for (auto k = copies.begin(); k != copies.end(); k++) {
+            delete *k;
+        }
+
+        // don't leave a (possibly labeled) basic block without instructions
+        if (result_bb->get_length() == 0 && len > 0) {
+            result_bb->add_instruction(new Instruction(HINS_NOP));
+        }
+    }
+
+    // add edges, splitting those which need copies but whose source
+    // block has other successors
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+            Edge *orig_edge = *j;
+            BasicBlock *source = block_map[orig];
+            BasicBlock *target = block_map[orig_edge->get_target()];
+
+            std::vector<std::pair<Operand, Operand>> pcopy;
+            if (copied_in_source.count(orig_edge) == 0) {
+                get_copies(orig_edge->get_target(), orig, pcopy);
+            }
+            if (pcopy.empty()) {
+                result->create_edge(source, target, orig_edge->get_kind());
+                continue;
+            }
+
+            InstructionSequence copies;
+            sequentialize(pcopy, &copies);
+            SSA::split_edge(result, source, target, orig_edge->get_kind(), copies);
+            for (auto k = copies.begin(); k != copies.end(); k++) {
+                delete *k;
+            }
+        }
+    }
+
+    return result;
+}
+
+void SSADestruction::get_copies(BasicBlock *target, BasicBlock *pred, std::vector<std::pair<Operand, Operand>> &copies) {
+    unsigned pred_index = 0;
+    bool found_pred = false;
+
+    for (auto i = target->cbegin(); i != target->cend(); i++) {
+        Instruction *ins = *i;
+        if (!SSA::is_phi(ins)) {
+            continue;
+        }
+        if (!found_pred) {
+            pred_index = SSA::get_pred_index(m_cfg, target, pred);
+            found_pred = true;
+        }
+
+        Operand dest = ins->get_operand(0);
+        Operand src = ins->get_operand(pred_index + 1);
+        if (src.get_kind() == OPERAND_VREG && src.get_base_reg() == dest.get_base_reg()) {
+            continue;
+        }
+        copies.push_back(std::make_pair(dest, src));
+    }
+}
+
+bool SSADestruction::can_copy_in_source(BasicBlock *source, BasicBlock *target, unsigned index,
+                                        const std::vector<std::pair<Operand, Operand>> &copies,
+                                        const LiveVregs &live_vregs) {
+    const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(source);
+    for (auto i = copies.begin(); i != copies.end(); i++) {
+        unsigned dest = unsigned(i->first.get_base_reg());
+
+        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+            BasicBlock *succ = (*j)->get_target();
+            if (succ != target && live_vregs.get_fact_at_beginning_of_block(succ).test(dest)) {
+                return false;
+            }
+        }
+
+        for (unsigned j = index; j < source->get_length(); j++) {
+            Instruction *ins = source->get_instruction(j);
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                Operand operand = ins->get_operand(k);
+                if ((operand.has_base_reg() && unsigned(operand.get_base_reg()) == dest)
+                        || (operand.has_index_reg() && unsigned(operand.get_index_reg()) == dest)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void SSADestruction::sequentialize(std::vector<std::pair<Operand, Operand>> &copies, InstructionSequence *out) {
+    // does some pending copy read the vreg written by copies[i]?
+    auto is_read = [&copies](unsigned i) {
+        int vreg = copies[i].first.get_base_reg();
+        for (unsigned j = 0; j < copies.size(); j++) {
+            if (j != i && copies[j].second.get_kind() == OPERAND_VREG && copies[j].second.get_base_reg() == vreg) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    while (!copies.empty()) {
+        bool progress = false;
+        for (unsigned i = 0; i < copies.size(); i++) {
+            if (!is_read(i)) {
+                // (constant propagation may have replaced the source with a literal)
+                int opcode = copies[i].second.get_kind() == OPERAND_INT_LITERAL ? HINS_LOAD_ICONST : HINS_MOV;
+                out->add_instruction(new Instruction(opcode, copies[i].first, copies[i].second));
+                copies.erase(copies.begin() + i);
+                progress = true;
+                break;
+            }
+        }
+
+        if (!progress) {
+            // every remaining copy is part of a cycle: save the value
+            // of one destination in a temporary, and read it from there
+            Operand dest = copies[0].first;
+            Operand temp(OPERAND_VREG, m_next_vreg++);
+            out->add_instruction(new Instruction(HINS_MOV, temp, dest));
+            for (auto i = copies.begin(); i != copies.end(); i++) {
+                if (i->second.get_kind() == OPERAND_VREG && i->second.get_base_reg() == dest.get_base_reg()) {
+                    i->second = temp;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,172 @@
+#ifndef SSA_H
+#define SSA_H
+
+#include <vector>
+#include <set>
+#include <map>
+#include "cfg.h"
+#include "highlevel.h"
+#include "cfg_transform.h"
+
+class LiveVregs;
+
+// Dominator tree and dominance frontiers of a ControlFlowGraph.
+//
+// Immediate dominators are computed using the iterative algorithm
+// of Cooper, Harvey, and Kennedy ("A Simple, Fast Dominance Algorithm"),
+// which processes the blocks in reverse postorder until no immediate
+// dominator changes.  Blocks which are not reachable from the entry
+// block have no immediate dominator and are not in the tree.
+class DominatorTree {
+private:
+    ControlFlowGraph *m_cfg;
+    // all vectors are indexed by block id
+    std::vector<int> m_idom;                      // -1 if none
+    std::vector<unsigned> m_rpo_index;            // position in reverse postorder
+    std::vector<BasicBlock *> m_rpo;              // reachable blocks in reverse postorder
+    std::vector<std::vector<BasicBlock *>> m_children;
+    std::vector<std::set<BasicBlock *>> m_frontier;
+
+public:
+    DominatorTree(ControlFlowGraph *cfg);
+    ~DominatorTree();
+
+    ControlFlowGraph *get_cfg() const { return m_cfg; }
+
+    bool is_reachable(BasicBlock *bb) const;
+
+    // get the immediate dominator of a block: returns a null pointer
+    // for the entry block and for unreachable blocks
+    BasicBlock *get_idom(BasicBlock *bb) const;
+
+    // get the blocks immediately dominated by a block
+    const std::vector<BasicBlock *> &get_children(BasicBlock *bb) const;
+
+    // get the dominance frontier of a block
+    const std::set<BasicBlock *> &get_dominance_frontier(BasicBlock *bb) const;
+
+    // does block a dominate block b?  (every block dominates itself)
+    bool dominates(BasicBlock *a, BasicBlock *b) const;
+
+    // reachable blocks in reverse postorder (each block appears after
+    // its immediate dominator)
+    const std::vector<BasicBlock *> &get_reverse_postorder() const { return m_rpo; }
+
+private:
+    void compute_reverse_postorder();
+    void compute_idoms();
+    void compute_frontiers();
+    unsigned intersect(unsigned a, unsigned b) const;
+};
+
+// Helper functions for code in SSA form.
+//
+// A HINS_PHI instruction has the form
+//
+//   phi vrD, vrA0, vrA1, ...
+//
+// where operand i+1 is the value of vrD when control arrives
+// from the i'th predecessor of the phi's basic block, with predecessors
+// ordered by increasing block id (see get_predecessors).  Phis always
+// appear at the beginning of a basic block, and are evaluated in parallel.
+// Transformations of code in SSA form which remove an edge into a block
+// containing phi instructions must remove the corresponding phi operands.
+class SSA {
+public:
+    static bool is_phi(Instruction *ins) { return ins->get_opcode() == HINS_PHI; }
+
+    // get the (distinct) predecessors of a block, ordered by block id
+    static std::vector<BasicBlock *> get_predecessors(ControlFlowGraph *cfg, BasicBlock *bb);
+
+    // get the index of pred among the predecessors of bb (i.e., the phi operand
+    // for values arriving from pred is operand get_pred_index(...) + 1)
+    static unsigned get_pred_index(ControlFlowGraph *cfg, BasicBlock *bb, BasicBlock *pred);
+
+    // The following are also useful for transformations of high-level
+    // CFGs which aren't in SSA form.
+
+    // get the index at which instructions can be inserted at the end of
+    // a block (i.e., before its branch and the comparison the branch uses)
+    static unsigned get_insertion_point(BasicBlock *bb);
+
+    // split an edge (from source to target, both in cfg) with a new basic
+    // block containing copies of the given instructions: if the edge is a branch,
+    // the branch at the end of source is redirected to the new block
+    static BasicBlock *split_edge(ControlFlowGraph *cfg, BasicBlock *source, BasicBlock *target, EdgeKind kind,
+                                  const InstructionSequence &instructions);
+};
+
+// Convert a high-level CFG to (pruned) SSA form.
+//
+// Phi instructions are placed on the iterated dominance frontier of the blocks
+// defining each vreg, but only where the vreg is live (so that the temporary
+// vregs reused by HighLevelCodeGen for each statement don't get phis).  Every
+// definition is then given a fresh vreg number, and uses are renamed by a walk
+// of the dominator tree.  Uses which are not reached by any definition keep their
+// original vreg number.
+class SSAConstruction : public ControlFlowGraphTransform {
+private:
+    struct Phi {
+        int orig_vreg;
+        int dest;
+        std::vector<Operand> args;
+    };
+
+    DominatorTree m_domtree;
+    int m_next_vreg;
+    // phis to place at the beginning of each block (indexed by block id)
+    std::vector<std::vector<Phi>> m_phis;
+    // the renamed instructions of each block (indexed by block id)
+    std::vector<InstructionSequence *> m_renamed;
+    // stack of current names of each original vreg
+    std::vector<std::vector<int>> m_names;
+
+public:
+    SSAConstruction(ControlFlowGraph *cfg);
+    virtual ~SSAConstruction();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+    // number of vregs used by the SSA form (original vregs plus renamed ones)
+    int get_num_vregs() const { return m_next_vreg; }
+
+private:
+    void place_phis(int num_vregs);
+    void rename(BasicBlock *entry);
+    void rename_block(BasicBlock *bb, std::vector<int> &defined);
+    void rename_use(Operand &operand);
+    int get_current_name(int orig_vreg) const;
+};
+
+// Convert a high-level CFG in SSA form back to normal form by replacing
+// each phi with moves at the end of the predecessor blocks.
+//
+// The moves on a CFG edge whose source has other successors (a "critical"
+// edge) generally can't be placed in the source block, so such edges are
+// split by a new basic block containing the moves.  The moves for the phis of a block
+// form a parallel copy, which is sequentialized (using a temporary vreg to
+// break cycles) so that no move overwrites a value that a later move reads.
+//
+// Because new basic blocks may be needed, this doesn't use
+// ControlFlowGraphTransform.
+class SSADestruction {
+private:
+    ControlFlowGraph *m_cfg;
+    int m_next_vreg;
+
+public:
+    SSADestruction(ControlFlowGraph *cfg);
+    ~SSADestruction();
+
+    ControlFlowGraph *get_orig_cfg() { return m_cfg; }
+    ControlFlowGraph *transform_cfg();
+
+private:
+    void get_copies(BasicBlock *target, BasicBlock *pred, std::vector<std::pair<Operand, Operand>> &copies);
+    bool can_copy_in_source(BasicBlock *source, BasicBlock *target, unsigned index,
+                            const std::vector<std::pair<Operand, Operand>> &copies,
+                            const LiveVregs &live_vregs);
+    void sequentialize(std::vector<std::pair<Operand, Operand>> &copies, InstructionSequence *out);
+};
+
+#endif // SSA_H
@@ -0,0 +1,144 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "stack_slots.h"
+
+StackSlotAllocation::StackSlotAllocation(ControlFlowGraph *cfg, const std::vector<bool> &needs_slot)
+        : m_num_vregs(0)
+        , m_num_interferences(0)
+        , m_share_slots(true)
+        , m_num_slots(0) {
+    m_num_vregs = std::max(unsigned(HighLevel::get_num_vregs(cfg)), unsigned(needs_slot.size()));
+
+    m_needs_slot = needs_slot;
+    m_needs_slot.resize(m_num_vregs, false);
+    m_adj.resize(m_num_vregs);
+    m_slot.resize(m_num_vregs, -1);
+    m_cost.resize(m_num_vregs, 0);
+
+    LiveVregs live_vregs(cfg);
+    live_vregs.execute();
+    build_interference_graph(cfg, live_vregs);
+    color();
+}
+
+StackSlotAllocation::~StackSlotAllocation() {
+}
+
+unsigned StackSlotAllocation::get_slot(int vreg) const {
+    assert(vreg >= 0 && unsigned(vreg) < m_num_vregs && m_slot[vreg] >= 0);
+    return unsigned(m_slot[vreg]);
+}
+
+void StackSlotAllocation::build_interference_graph(ControlFlowGraph *cfg, const LiveVregs &live_vregs) {
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+
+        // work backwards from the end of the block, so that live_set
+        // is always the set of vregs live after the current instruction
+        LiveVregs::LiveSet live_set = live_vregs.get_fact_at_end_of_block(bb);
+
+        for (auto j = bb->crbegin(); j != bb->crend(); j++) {
+            Instruction *ins = *j;
+
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                Operand operand = ins->get_operand(k);
+                if (operand.has_base_reg()) {
+                    m_cost[operand.get_base_reg()]++;
+                }
+                if (operand.has_index_reg()) {
+                    m_cost[operand.get_index_reg()]++;
+                }
+            }
+
+            if (HighLevel::is_def(ins) && m_share_slots) {
+                int dest = ins->get_operand(0).get_base_reg();
+                for (auto v = live_set.begin(); v != live_set.end(); v++) {
+                    add_interference(dest, int(*v));
+                }
+
+                // the destination also interferes with the instruction's
+                // operands (even those which die here), since the x86-64
+                // lowering may store to the destination before it has
+                // read all of them
+                for (unsigned k = 1; k < ins->get_num_operands(); k++) {
+                    Operand operand = ins->get_operand(k);
+                    if (operand.has_base_reg()) {
+                        add_interference(dest, operand.get_base_reg());
+                    }
+                    if (operand.has_index_reg()) {
+                        add_interference(dest, operand.get_index_reg());
+                    }
+                }
+            }
+
+            live_vregs.model_instruction(ins, live_set);
+        }
+    }
+}
+
+void StackSlotAllocation::add_interference(int a, int b) {
+    if (a != b && m_needs_slot[a] && m_needs_slot[b] && m_share_slots) {
+        m_adj[a].insert(b);
+        m_adj[b].insert(a);
+        if (++m_num_interferences > MAX_INTERFERENCES) {
+            // give up on sharing slots
+            m_share_slots = false;
+            m_adj.assign(m_num_vregs, std::set<int>());
+        }
+    }
+}
+
+void StackSlotAllocation::color() {
+    // color the most frequently used vregs first, so that they get the
+    // lowest-numbered slots
+    std::vector<int> order;
+    for (unsigned v = 0; v < m_num_vregs; v++) {
+        if (m_needs_slot[v]) {
+            order.push_back(int(v));
+        }
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [this](int a, int b) { return m_cost[a] > m_cost[b]; });
+
+    // give each vreg the lowest-numbered slot not used by any of its neighbors
+    std::vector<bool> used;
+    std::vector<unsigned> slot_cost;
+    for (auto i = order.begin(); i != order.end(); i++) {
+        int v = *i;
+        used.assign(m_num_slots + 1, false);
+        for (auto j = m_adj[v].begin(); j != m_adj[v].end(); j++) {
+            if (m_slot[*j] >= 0) {
+                used[m_slot[*j]] = true;
+            }
+        }
+        unsigned slot = m_share_slots ? 0 : m_num_slots;
+        while (used[slot]) {
+            slot++;
+        }
+        m_slot[v] = int(slot);
+        if (slot == m_num_slots) {
+            m_num_slots++;
+            slot_cost.push_back(0);
+        }
+        slot_cost[slot] += m_cost[v];
+    }
+
+    // renumber the slots in order of how often they are used, so the
+    // busiest ones are together (at the lowest offsets)
+    std::vector<unsigned> slots(m_num_slots);
+    for (unsigned i = 0; i < m_num_slots; i++) {
+        slots[i] = i;
+    }
+    std::stable_sort(slots.begin(), slots.end(),
+                     [&slot_cost](unsigned a, unsigned b) { return slot_cost[a] > slot_cost[b]; });
+    std::vector<int> renumber(m_num_slots);
+    for (unsigned i = 0; i < m_num_slots; i++) {
+        renumber[slots[i]] = int(i);
+    }
+    for (auto i = order.begin(); i != order.end(); i++) {
+        m_slot[*i] = renumber[m_slot[*i]];
+    }
+}
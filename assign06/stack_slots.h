@@ -0,0 +1,63 @@
+#ifndef STACK_SLOTS_H
+#define STACK_SLOTS_H
+
+#include <set>
+#include <vector>
+#include "cfg.h"
+
+class LiveVregs;
+
+// Assignment of stack slots to the vregs of a high-level CFG.
+//
+// Two vregs can share a slot if they are never live at the same
+// time, so the slots are assigned by (greedily) coloring the
+// interference graph built from the results of LiveVregs, in the same
+// way as GraphColoringRegisterAllocation; since any number of slots
+// can be used, no vreg is ever spilled.  Vregs which don't need a
+// slot (because they are always kept in a machine register) aren't
+// given one.  The most frequently used vregs are colored first, and
+// the slots are numbered in order of how often they are used, so that
+// the busiest slots are adjacent.  If the interference graph would be
+// too large (with tens of thousands of vregs live at the same time),
+// every vreg simply gets a slot of its own.
+class StackSlotAllocation {
+public:
+    static const unsigned long MAX_INTERFERENCES = 1UL << 20;
+
+private:
+    unsigned m_num_vregs;
+    std::vector<bool> m_needs_slot;
+    // interference graph (adjacency sets, indexed by vreg number)
+    std::vector<std::set<int>> m_adj;
+    unsigned long m_num_interferences;
+    // false if the interference graph was too large to build
+    bool m_share_slots;
+    // number of occurrences of each vreg
+    std::vector<unsigned> m_cost;
+    // slot number of each vreg, or -1 if it doesn't have one
+    std::vector<int> m_slot;
+    unsigned m_num_slots;
+
+    // disallow copy ctor and assignment operator
+    StackSlotAllocation(const StackSlotAllocation &);
+    StackSlotAllocation &operator=(const StackSlotAllocation &);
+
+public:
+    // needs_slot[v] is true if vreg v needs a stack slot (vregs beyond
+    // the end of needs_slot don't)
+    StackSlotAllocation(ControlFlowGraph *cfg, const std::vector<bool> &needs_slot);
+    ~StackSlotAllocation();
+
+    // get the number of stack slots used
+    unsigned get_num_slots() const { return m_num_slots; }
+
+    // get the slot number of a vreg which needs a slot
+    unsigned get_slot(int vreg) const;
+
+private:
+    void build_interference_graph(ControlFlowGraph *cfg, const LiveVregs &live_vregs);
+    void add_interference(int a, int b);
+    void color();
+};
+
+#endif // STACK_SLOTS_H
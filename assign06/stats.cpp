@@ -0,0 +1,150 @@
+#include <cstdio>
+#include "cfg.h"
+#include "highlevel.h"
+#include "x86_64.h"
+#include "stats.h"
+
+namespace {
+    bool is_branch(int opcode) {
+        return HighLevel::has_flags(opcode, HOP_JUMP | HOP_BRANCH);
+    }
+
+    bool is_x86_64_branch(int opcode) {
+        return X86_64::has_flags(opcode, MOP_JUMP | MOP_BRANCH);
+    }
+
+    // the number of vregs used, and the number of them without a machine register
+    void count_vregs(const std::vector<bool> &used, const std::map<int, int> &assignment, Statistics::Snapshot &snapshot) {
+        snapshot.vregs = snapshot.spills = 0;
+        for (unsigned v = 0; v < used.size(); v++) {
+            if (used[v]) {
+                snapshot.vregs++;
+                if (assignment.count(int(v)) == 0) {
+                    snapshot.spills++;
+                }
+            }
+        }
+    }
+}
+
+Statistics::Statistics()
+        : m_enabled(false) {
+}
+
+Statistics &Statistics::get() {
+    static thread_local Statistics s_statistics;
+    return s_statistics;
+}
+
+void Statistics::add_snapshot(const std::string &name, const ControlFlowGraph *cfg, const std::map<int, int> &assignment) {
+    if (!m_enabled) {
+        return;
+    }
+    Snapshot snapshot = { name, 0, 0, 0, 0, 0, 0 };
+    std::vector<bool> used;
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        count_highlevel(*i, snapshot, used);
+    }
+    count_vregs(used, assignment, snapshot);
+    m_snapshots.push_back(snapshot);
+}
+
+void Statistics::add_snapshot(const std::string &name, const InstructionSequence *iseq, const std::map<int, int> &assignment) {
+    if (!m_enabled) {
+        return;
+    }
+    Snapshot snapshot = { name, 0, 0, 0, 0, 0, 0 };
+    std::vector<bool> used;
+    count_highlevel(iseq, snapshot, used);
+    count_vregs(used, assignment, snapshot);
+    m_snapshots.push_back(snapshot);
+}
+
+void Statistics::add_x86_64_snapshot(const std::string &name, const InstructionSequence *iseq) {
+    if (!m_enabled) {
+        return;
+    }
+    Snapshot snapshot = { name, 0, -1, -1, 0, 0, 0 };
+    for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+        const Instruction *ins = *i;
+        snapshot.instructions++;
+        if (is_x86_64_branch(ins->get_opcode())) {
+            snapshot.branches++;
+            continue;
+        }
+        // (the last operand is the destination; leaq doesn't access memory)
+        unsigned num_operands = ins->get_num_operands();
+        if (ins->get_opcode() == MINS_LEAQ || num_operands == 0) {
+            continue;
+        }
+        for (unsigned j = 0; j + 1 < num_operands; j++) {
+            if (ins->get_operand(j).is_memref()) {
+                snapshot.loads++;
+            }
+        }
+        if (ins->get_operand(num_operands - 1).is_memref()) {
+            snapshot.stores++;
+        }
+    }
+    m_snapshots.push_back(snapshot);
+}
+
+void Statistics::count_highlevel(const InstructionSequence *iseq, Snapshot &snapshot, std::vector<bool> &used) {
+    for (auto i = iseq->cbegin(); i != iseq->cend(); i++) {
+        Instruction *ins = *i;
+        int opcode = ins->get_opcode();
+        snapshot.instructions++;
+        if (is_branch(opcode)) {
+            snapshot.branches++;
+        } else if (opcode == HINS_STORE_INT || opcode == HINS_STORE_CHAR || opcode == HINS_VEC_STORE) {
+            snapshot.stores++;
+        } else if (opcode == HINS_LOAD_INT || opcode == HINS_LOAD_CHAR || opcode == HINS_VEC_LOAD) {
+            snapshot.loads++;
+        } else {
+            // (an array element used directly as an operand is a load)
+            for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+                if (ins->get_operand(j).is_memref() && HighLevel::is_use(ins, j)) {
+                    snapshot.loads++;
+                }
+            }
+        }
+
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            const Operand &operand = ins->get_operand(j);
+            if (operand.get_kind() == OPERAND_VREG || operand.get_kind() == OPERAND_VREG_MEMREF
+                    || operand.get_kind() == OPERAND_VREG_MEMREF_OFFSET || operand.get_kind() == OPERAND_VREG_MEMREF_INDEX) {
+                unsigned v = unsigned(operand.get_base_reg());
+                if (v >= used.size()) {
+                    used.resize(v + 1, false);
+                }
+                used[v] = true;
+            }
+        }
+    }
+}
+
+void Statistics::print(const char *filename) const {
+    fprintf(stderr, "%s:\n", filename);
+    fprintf(stderr, "%-20s %12s %8s %8s %8s %8s %8s\n",
+            "after", "instructions", "vregs", "spills", "loads", "stores", "branches");
+    for (auto i = m_snapshots.begin(); i != m_snapshots.end(); i++) {
+        if (i->vregs < 0) {
+            fprintf(stderr, "%-20s %12u %8s %8s %8u %8u %8u\n",
+                    i->name.c_str(), i->instructions, "-", "-", i->loads, i->stores, i->branches);
+        } else {
+            fprintf(stderr, "%-20s %12u %8d %8d %8u %8u %8u\n",
+                    i->name.c_str(), i->instructions, i->vregs, i->spills, i->loads, i->stores, i->branches);
+        }
+    }
+    if (!m_counters.empty()) {
+        fprintf(stderr, "%-29s %12s\n", "counter", "value");
+        for (auto i = m_counters.begin(); i != m_counters.end(); i++) {
+            fprintf(stderr, "%-29s %12ld\n", i->first.c_str(), i->second);
+        }
+    }
+}
+
+void Statistics::clear() {
+    m_counters.clear();
+    m_snapshots.clear();
+}
@@ -0,0 +1,66 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <string>
+#include <map>
+#include <vector>
+
+class InstructionSequence;
+class ControlFlowGraph;
+
+// Statistics about the generated code and what the optimizations did to
+// it (for the -stats option).
+//
+// Passes count what they do with named counters ("<pass>.<what>", such
+// as "constprop.folded"), and a snapshot of the code is recorded after
+// code generation and after each pass: the number of instructions, vregs,
+// loads, stores and branches, and the number of vregs which are spilled
+// (kept in stack slots).  The statistics are kept separately for each
+// thread, like the StringTables, and nothing is recorded unless they are
+// enabled.
+class Statistics {
+public:
+    struct Snapshot {
+        std::string name;
+        unsigned instructions;
+        // (-1 for x86-64 code, which no longer has vregs)
+        int vregs, spills;
+        unsigned loads, stores, branches;
+    };
+
+private:
+    bool m_enabled;
+    std::map<std::string, long> m_counters;
+    std::vector<Snapshot> m_snapshots;
+
+public:
+    Statistics();
+
+    // the statistics of the current thread
+    static Statistics &get();
+
+    bool is_enabled() const { return m_enabled; }
+    void set_enabled(bool enabled) { m_enabled = enabled; }
+
+    void add(const std::string &counter, long n = 1) {
+        if (m_enabled) {
+            m_counters[counter] += n;
+        }
+    }
+
+    // record a snapshot of high-level code (in which the vregs given a
+    // machine register by the assignment aren't spilled), or of x86-64 code
+    void add_snapshot(const std::string &name, const ControlFlowGraph *cfg, const std::map<int, int> &assignment);
+    void add_snapshot(const std::string &name, const InstructionSequence *iseq, const std::map<int, int> &assignment);
+    void add_x86_64_snapshot(const std::string &name, const InstructionSequence *iseq);
+
+    // print the snapshots and counters to stderr
+    void print(const char *filename) const;
+
+    void clear();
+
+private:
+    static void count_highlevel(const InstructionSequence *iseq, Snapshot &snapshot, std::vector<bool> &used);
+};
+
+#endif // STATS_H
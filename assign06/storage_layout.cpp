@@ -0,0 +1,130 @@
+#include <cassert>
+#include "util.h"
+#include "symbol.h"
+#include "symtab.h"
+#include "storage_layout.h"
+
+namespace {
+    long align_up(long value, long alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+StorageLayout::StorageLayout(SymbolTable *symtab)
+        : m_frame_size(0) {
+    // (the variables of the enclosing scope of a subprogram are the
+    // program's, which it can only use if they are in .bss)
+    for (SymbolTable *scope = symtab; scope != nullptr; scope = scope->get_parent()) {
+        bool is_enclosing = (scope != symtab);
+        bool is_subprogram = (scope->get_parent() != nullptr);
+        for (auto i = scope->begin(); i != scope->end(); i++) {
+            if (i->get_kind() == VARIABLE) {
+                m_variables[i->get_offset()] = Variable{ i->get_name(), i->get_size(), is_enclosing, is_subprogram };
+            }
+        }
+    }
+}
+
+StorageLayout::StorageLayout()
+        : m_frame_size(0) {
+}
+
+StorageLayout::~StorageLayout() {
+}
+
+void StorageLayout::add_variable(long offset, const Variable &variable) {
+    m_variables[offset] = variable;
+}
+
+void StorageLayout::set_static_variables(const std::set<long> &offsets) {
+    for (auto i = offsets.begin(); i != offsets.end(); i++) {
+        auto var = m_variables.find(*i);
+        if (var != m_variables.end()) {
+            var->second.is_static = true;
+        }
+    }
+}
+
+void StorageLayout::add_scope(const StorageLayout &callee) {
+    // (the callee's own variables, not the program's it uses)
+    for (auto i = callee.m_variables.begin(); i != callee.m_variables.end(); i++) {
+        if (i->second.is_local) {
+            m_variables[i->first] = Variable{ i->second.name, i->second.size, false, true };
+        }
+    }
+}
+
+void StorageLayout::place_variables(const std::set<long> &offsets) {
+    m_placements.clear();
+    m_frame_size = 0;
+
+    for (auto i = offsets.begin(); i != offsets.end(); i++) {
+        auto var = m_variables.find(*i);
+        if (var == m_variables.end()) {
+            err_fatal("No variable at offset %ld\n", *i);
+        }
+        const Variable &variable = var->second;
+        long size = variable.size;
+
+        Placement placement;
+        placement.size = size;
+        if (is_static_variable(*i)) {
+            placement.is_static = true;
+            placement.offset = 0;
+            placement.label = "v_" + variable.name;
+        } else {
+            // (aggregates are aligned, scalars only need to be 8-byte aligned)
+            long alignment = (size > 8) ? FRAME_ALIGNMENT : 8;
+            placement.is_static = false;
+            placement.offset = align_up(m_frame_size, alignment);
+            m_frame_size = placement.offset + size;
+        }
+        m_placements[*i] = placement;
+    }
+    m_frame_size = align_up(m_frame_size, 8);
+}
+
+const StorageLayout::Placement &StorageLayout::get_placement(long offset) const {
+    auto i = m_placements.find(offset);
+    assert(i != m_placements.end());
+    return i->second;
+}
+
+long StorageLayout::get_variable_size(long offset) const {
+    auto i = m_variables.find(offset);
+    return (i != m_variables.end()) ? i->second.size : 0;
+}
+
+bool StorageLayout::is_static_variable(long offset) const {
+    auto i = m_variables.find(offset);
+    if (i == m_variables.end()) {
+        return false;
+    }
+    const Variable &variable = i->second;
+    return variable.is_static || (variable.size >= STATIC_THRESHOLD && !variable.is_local);
+}
+
+long StorageLayout::find_variable(long offset) const {
+    auto i = m_variables.upper_bound(offset);
+    assert(i != m_variables.begin());
+    i--;
+    assert(offset < i->first + i->second.size);
+    return i->first;
+}
+
+long StorageLayout::get_static_alignment(long size) {
+    if (size >= STATIC_THRESHOLD) {
+        return STATIC_ALIGNMENT;
+    }
+    return (size > 8) ? SMALL_STATIC_ALIGNMENT : 8;
+}
+
+std::vector<StorageLayout::Placement> StorageLayout::get_static_variables() const {
+    std::vector<Placement> result;
+    for (auto i = m_placements.begin(); i != m_placements.end(); i++) {
+        if (i->second.is_static) {
+            result.push_back(i->second);
+        }
+    }
+    return result;
+}
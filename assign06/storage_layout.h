@@ -0,0 +1,112 @@
+#ifndef STORAGE_LAYOUT_H
+#define STORAGE_LAYOUT_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+struct SymbolTable;
+
+// Placement in memory of the variables used by the main program or one of
+// its subprograms.
+//
+// A variable is identified by its offset in the symbol table (which is
+// the operand of the HINS_LOCALADDR instructions computing its address,
+// and is unique in the whole program).  Only the variables whose
+// addresses are used are placed (variables promoted to scalars live in
+// vregs).  Large variables of the program (such as "ARRAY 100000 OF
+// INTEGER") are placed in .bss, page-aligned, so they can't overflow the
+// stack, and so are the program's variables used by its subprograms (see
+// set_static_variables), with only 8-byte alignment, or a cache line's
+// for an aggregate (see get_static_alignment); the others are placed in
+// the function's stack frame, with aggregates aligned to the 16-byte
+// alignment of the frame.
+// The variables of a subprogram are always in its frame, since each call
+// of a recursive subprogram needs its own.
+class StorageLayout {
+public:
+    // variables at least this large are placed in .bss
+    static const long STATIC_THRESHOLD = 64 * 1024;
+    // the alignment in .bss of the variables at least STATIC_THRESHOLD
+    // large, and of the smaller aggregates
+    static const long STATIC_ALIGNMENT = 4096;
+    static const long SMALL_STATIC_ALIGNMENT = 64;
+    static const long FRAME_ALIGNMENT = 16;
+
+    struct Placement {
+        bool is_static;
+        long offset;         // offset in the frame, if not static
+        std::string label;   // label of the storage in .bss, if static
+        long size;
+    };
+
+    struct Variable {
+        std::string name;
+        long size;
+        // the variables of the program placed in .bss whatever their size,
+        // and the variables of a subprogram, which are never placed there
+        bool is_static, is_local;
+    };
+
+private:
+    // the variables of the scope and its enclosing scopes, by symbol table offset
+    std::map<long, Variable> m_variables;
+    std::map<long, Placement> m_placements;
+    long m_frame_size;
+
+    // disallow copy ctor and assignment operator
+    StorageLayout(const StorageLayout &);
+    StorageLayout &operator=(const StorageLayout &);
+
+public:
+    // (the variables of the main program, or of a subprogram, whose scope
+    // is symtab)
+    StorageLayout(SymbolTable *symtab);
+    // (a layout whose variables are added by add_variable, such as one
+    // read from a HIR file)
+    StorageLayout();
+    ~StorageLayout();
+
+    void add_variable(long offset, const Variable &variable);
+
+    // the variables, by symbol table offset
+    const std::map<long, Variable> &get_variables() const { return m_variables; }
+
+    // the alignment in .bss of a static variable of the given size (page
+    // alignment only for a large one, since each small one would have a
+    // page of its own, and they would all map to the same cache sets)
+    static long get_static_alignment(long size);
+
+    // place the program's variables at the given symbol table offsets
+    // in .bss, whatever their size (since they are used by subprograms)
+    void set_static_variables(const std::set<long> &offsets);
+
+    // add the variables of a subprogram whose code was inlined into the
+    // function, given its layout (which are placed in its frame, see inline.h)
+    void add_scope(const StorageLayout &callee);
+
+    // place the variables at the given symbol table offsets
+    void place_variables(const std::set<long> &offsets);
+
+    // the size of the variables placed in the stack frame
+    long get_frame_size() const { return m_frame_size; }
+
+    const Placement &get_placement(long offset) const;
+
+    // the size of the variable at the given symbol table offset
+    // (0 if there is no variable there)
+    long get_variable_size(long offset) const;
+
+    // will the variable at the given symbol table offset be placed in .bss?
+    bool is_static_variable(long offset) const;
+
+    // the symbol table offset of the variable whose storage contains
+    // the given offset (which must be inside a variable)
+    long find_variable(long offset) const;
+
+    // the variables placed in .bss, in order of symbol table offset
+    std::vector<Placement> get_static_variables() const;
+};
+
+#endif // STORAGE_LAYOUT_H
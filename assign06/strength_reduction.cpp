@@ -0,0 +1,466 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "stats.h"
+#include "strength_reduction.h"
+
+namespace {
+    bool is_vreg(const Operand &operand, int vreg) {
+        return operand.get_kind() == OPERAND_VREG && operand.get_base_reg() == vreg;
+    }
+
+    bool is_literal(const Operand &operand) {
+        return operand.get_kind() == OPERAND_INT_LITERAL;
+    }
+
+    // arithmetic on induction variables wraps around, as it does in the generated code
+    long wrapping_mul(long a, long b) {
+        return long((unsigned long) a * (unsigned long) b);
+    }
+
+    long wrapping_add(long a, long b) {
+        return long((unsigned long) a + (unsigned long) b);
+    }
+
+    // the remainder opcode for a division opcode, and the other way around
+    // (or -1)
+    int get_division_partner(int opcode) {
+        switch (opcode) {
+            case HINS_INT_DIV:  return HINS_INT_MOD;
+            case HINS_INT_MOD:  return HINS_INT_DIV;
+            case HINS_UINT_DIV: return HINS_UINT_MOD;
+            case HINS_UINT_MOD: return HINS_UINT_DIV;
+            default:            return -1;
+        }
+    }
+
+    void add_vregs(Instruction *ins, std::set<int> &defs, std::set<int> &uses) {
+        if (HighLevel::is_def(ins) && ins->get_operand(0).get_kind() == OPERAND_VREG) {
+            defs.insert(ins->get_operand(0).get_base_reg());
+        }
+        for (unsigned i = 0; i < ins->get_num_operands(); i++) {
+            const Operand &operand = ins->get_operand(i);
+            if (HighLevel::is_use(ins, i)) {
+                uses.insert(operand.get_base_reg());
+            }
+            if (operand.has_index_reg()) {
+                uses.insert(operand.get_index_reg());
+            }
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// InductionVariableStrengthReduction implementation
+////////////////////////////////////////////////////////////////////////
+
+InductionVariableStrengthReduction::InductionVariableStrengthReduction(ControlFlowGraph *cfg,
+                                                                       const DominatorTree *domtree,
+                                                                       const LoopForest *loops)
+        : ControlFlowGraphTransform(cfg)
+        , m_own_domtree(domtree != nullptr ? nullptr : new DominatorTree(cfg))
+        , m_domtree(domtree != nullptr ? *domtree : *m_own_domtree)
+        , m_own_loops(loops != nullptr ? nullptr : new LoopForest(cfg, m_domtree))
+        , m_loops(loops != nullptr ? *loops : *m_own_loops)
+        , m_next_vreg(HighLevel::get_num_vregs(cfg)) {
+    m_new_phis.resize(cfg->get_num_blocks());
+    m_appended.resize(cfg->get_num_blocks());
+
+    find_defs_and_uses();
+
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        reduce_loop(m_loops.get_loop(i));
+    }
+}
+
+InductionVariableStrengthReduction::~InductionVariableStrengthReduction() {
+    delete m_own_loops;
+    delete m_own_domtree;
+    for (auto i = m_new_phis.begin(); i != m_new_phis.end(); i++) {
+        for (auto j = i->begin(); j != i->end(); j++) {
+            delete *j;
+        }
+    }
+    for (auto i = m_appended.begin(); i != m_appended.end(); i++) {
+        for (auto j = i->begin(); j != i->end(); j++) {
+            delete *j;
+        }
+    }
+    for (auto i = m_replaced.begin(); i != m_replaced.end(); i++) {
+        delete i->second;
+    }
+}
+
+InstructionSequence *InductionVariableStrengthReduction::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+
+    const std::vector<Instruction *> &new_phis = m_new_phis[bb->get_id()];
+    const std::vector<Instruction *> &appended = m_appended[bb->get_id()];
+
+    // the new phis go after the original ones
+    unsigned len = bb->get_length(), num_phis = 0;
+    while (num_phis < len && SSA::is_phi(bb->get_instruction(num_phis))) {
+        num_phis++;
+    }
+    unsigned split = SSA::get_insertion_point(bb);
+
+    for (unsigned i = 0; i <= len; i++) {
+        if (i == num_phis) {
+            for (auto j = new_phis.begin(); j != new_phis.end(); j++) {
+                out->add_instruction((*j)->duplicate());
+            }
+        }
+        if (i == split) {
+            for (auto j = appended.begin(); j != appended.end(); j++) {
+                out->add_instruction((*j)->duplicate());
+            }
+        }
+        if (i == len) {
+            break;
+        }
+
+        Instruction *ins = bb->get_instruction(i);
+        auto r = m_replaced.find(ins);
+        if (r == m_replaced.end()) {
+            out->add_instruction(ins->duplicate());
+        } else if (r->second != nullptr) {
+            out->add_instruction(r->second->duplicate());
+        }
+    }
+
+    // don't leave a (possibly labeled) basic block without instructions
+    if (out->get_length() == 0 && len > 0) {
+        out->add_instruction(new Instruction(HINS_NOP));
+    }
+
+    return out;
+}
+
+void InductionVariableStrengthReduction::find_defs_and_uses() {
+    ControlFlowGraph *cfg = get_orig_cfg();
+    int num_vregs = m_next_vreg;
+    m_defs.assign(num_vregs, nullptr);
+    m_use_counts.assign(num_vregs, 0);
+    m_users.assign(num_vregs, nullptr);
+
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            Instruction *ins = *j;
+            if (HighLevel::is_def(ins)) {
+                m_defs[ins->get_operand(0).get_base_reg()] = ins;
+                m_def_blocks[ins] = *i;
+            }
+            for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+                if (HighLevel::is_use(ins, k)) {
+                    int vreg = ins->get_operand(k).get_base_reg();
+                    m_use_counts[vreg]++;
+                    m_users[vreg] = ins;
+                }
+            }
+        }
+    }
+}
+
+void InductionVariableStrengthReduction::reduce_loop(const LoopForest::Loop &loop) {
+    ControlFlowGraph *cfg = get_orig_cfg();
+
+    // find the preheader and the (single) latch block
+    BasicBlock *preheader = loop.preheader;
+    if (preheader == nullptr || loop.latches.size() != 1
+            || SSA::get_predecessors(cfg, loop.header).size() != 2) {
+        return;
+    }
+    BasicBlock *latch = loop.latches[0];
+    unsigned entry_index = SSA::get_pred_index(cfg, loop.header, preheader);
+    unsigned latch_index = SSA::get_pred_index(cfg, loop.header, latch);
+
+    std::map<int, BasicIV> ivs;
+    for (auto i = loop.header->cbegin(); i != loop.header->cend() && SSA::is_phi(*i); i++) {
+        BasicIV iv;
+        if (find_basic_iv(loop, *i, entry_index, latch_index, iv)) {
+            ivs[iv.vreg] = iv;
+        }
+    }
+    if (ivs.empty()) {
+        return;
+    }
+
+    // visit the loop's blocks in order, so that new vregs are numbered consistently
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        if (!loop.contains(*i)) {
+            continue;
+        }
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            Instruction *ins = *j;
+            if (ins->get_opcode() != HINS_INT_MUL || m_replaced.count(ins) > 0) {
+                continue;
+            }
+
+            Operand left = ins->get_operand(1), right = ins->get_operand(2);
+            if (is_literal(left)) {
+                std::swap(left, right);
+            }
+            if (left.get_kind() != OPERAND_VREG || !is_literal(right) || ivs.count(left.get_base_reg()) == 0) {
+                continue;
+            }
+            const BasicIV &iv = ivs[left.get_base_reg()];
+            long scale = right.get_int_value();
+            int product = ins->get_operand(0).get_base_reg();
+
+            // if the product's only use adds a loop-invariant value, that
+            // addition is also folded into the new induction variable
+            Instruction *add = get_single_user(product, loop);
+            Operand base;
+            bool has_base = false;
+            if (add != nullptr && m_replaced.count(add) == 0) {
+                Operand other = is_vreg(add->get_operand(1), product) ? add->get_operand(2) : add->get_operand(1);
+                if (!is_vreg(other, product) && is_invariant(other, loop)) {
+                    base = other;
+                    has_base = true;
+                }
+            }
+
+            // initial value, computed in the preheader
+            std::vector<Instruction *> &init_code = m_appended[preheader->get_id()];
+            Operand init;
+            if (is_literal(iv.init)) {
+                init = Operand(OPERAND_INT_LITERAL, wrapping_mul(iv.init.get_int_value(), scale));
+            } else {
+                init = Operand(OPERAND_VREG, m_next_vreg++);
+                init_code.push_back(new Instruction(HINS_INT_MUL, init, iv.init, right));
+            }
+            if (has_base) {
+                if (is_literal(init) && is_literal(base)) {
+                    init = Operand(OPERAND_INT_LITERAL, wrapping_add(init.get_int_value(), base.get_int_value()));
+                } else if (is_literal(init) && init.get_int_value() == 0) {
+                    init = base;
+                } else {
+                    Operand sum(OPERAND_VREG, m_next_vreg++);
+                    init_code.push_back(new Instruction(HINS_INT_ADD, sum, init, base));
+                    init = sum;
+                }
+            }
+
+            // the new induction variable, and its increment in the latch block
+            Operand current(OPERAND_VREG, m_next_vreg++), next(OPERAND_VREG, m_next_vreg++);
+            std::vector<Operand> phi_operands(3);
+            phi_operands[0] = current;
+            phi_operands[entry_index + 1] = init;
+            phi_operands[latch_index + 1] = next;
+            m_new_phis[loop.header->get_id()].push_back(new Instruction(HINS_PHI, phi_operands));
+            m_appended[latch->get_id()].push_back(
+                new Instruction(HINS_INT_ADD, next, current,
+                                Operand(OPERAND_INT_LITERAL, wrapping_mul(iv.step, scale))));
+
+            if (has_base) {
+                m_replaced[add] = new Instruction(HINS_MOV, add->get_operand(0), current);
+                m_replaced[ins] = nullptr;
+            } else {
+                m_replaced[ins] = new Instruction(HINS_MOV, ins->get_operand(0), current);
+            }
+        }
+    }
+}
+
+bool InductionVariableStrengthReduction::find_basic_iv(const LoopForest::Loop &loop, Instruction *phi,
+                                                      unsigned entry_index, unsigned latch_index, BasicIV &iv) {
+    int vreg = phi->get_operand(0).get_base_reg();
+    Operand arg = phi->get_operand(latch_index + 1);
+
+    // follow moves back to the increment
+    Instruction *def = nullptr;
+    while (arg.get_kind() == OPERAND_VREG && (def = m_defs[arg.get_base_reg()]) != nullptr
+           && loop.contains(m_def_blocks[def]) && def->get_opcode() == HINS_MOV
+           && def->get_operand(1).get_kind() == OPERAND_VREG) {
+        arg = def->get_operand(1);
+    }
+    if (arg.get_kind() != OPERAND_VREG || def == nullptr || !loop.contains(m_def_blocks[def])) {
+        return false;
+    }
+
+    // (the value may come from a def with fewer operands, e.g. ldci)
+    if ((def->get_opcode() != HINS_INT_ADD && def->get_opcode() != HINS_INT_SUB) || def->get_num_operands() != 3) {
+        return false;
+    }
+    Operand left = def->get_operand(1), right = def->get_operand(2);
+    if (def->get_opcode() == HINS_INT_ADD) {
+        if (is_literal(left)) {
+            std::swap(left, right);
+        }
+        if (!is_vreg(left, vreg) || !is_literal(right)) {
+            return false;
+        }
+        iv.step = right.get_int_value();
+    } else if (def->get_opcode() == HINS_INT_SUB) {
+        if (!is_vreg(left, vreg) || !is_literal(right)) {
+            return false;
+        }
+        iv.step = long(0UL - (unsigned long) right.get_int_value());
+    }
+
+    iv.vreg = vreg;
+    iv.init = phi->get_operand(entry_index + 1);
+    return true;
+}
+
+Instruction *InductionVariableStrengthReduction::get_single_user(int vreg, const LoopForest::Loop &loop) {
+    if (m_use_counts[vreg] != 1) {
+        return nullptr;
+    }
+    Instruction *user = m_users[vreg];
+    if (user->get_opcode() != HINS_INT_ADD || !loop.contains(m_def_blocks[user])) {
+        return nullptr;
+    }
+    return user;
+}
+
+bool InductionVariableStrengthReduction::is_invariant(const Operand &operand, const LoopForest::Loop &loop) {
+    if (is_literal(operand)) {
+        return true;
+    }
+    if (operand.get_kind() != OPERAND_VREG) {
+        return false;
+    }
+    Instruction *def = m_defs[operand.get_base_reg()];
+    return def == nullptr || !loop.contains(m_def_blocks[def]);
+}
+
+////////////////////////////////////////////////////////////////////////
+// ScaledIndexSelection implementation
+////////////////////////////////////////////////////////////////////////
+
+ScaledIndexSelection::ScaledIndexSelection(ControlFlowGraph *cfg, const LiveVregs *live_vregs)
+        : ControlFlowGraphTransform(cfg)
+        , m_own_live_vregs(nullptr)
+        , m_live_vregs(live_vregs) {
+    if (m_live_vregs == nullptr) {
+        m_own_live_vregs = new LiveVregs(cfg);
+        m_own_live_vregs->execute();
+        m_own_live_vregs->materialize_instruction_facts();
+        m_live_vregs = m_own_live_vregs;
+    }
+    assert(m_live_vregs->has_instruction_facts());
+}
+
+ScaledIndexSelection::~ScaledIndexSelection() {
+    delete m_own_live_vregs;
+}
+
+InstructionSequence *ScaledIndexSelection::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+
+    unsigned len = bb->get_length();
+    for (unsigned i = 0; i < len; i++) {
+        Instruction *ins = bb->get_instruction(i);
+        if (ins->get_opcode() == HINS_INT_MUL && i + 1 < len) {
+            Operand product = ins->get_operand(0);
+            Operand index = ins->get_operand(1), scale = ins->get_operand(2);
+            if (is_literal(index)) {
+                std::swap(index, scale);
+            }
+
+            Instruction *next = bb->get_instruction(i + 1);
+            long s = is_literal(scale) ? scale.get_int_value() : 0;
+            if (index.get_kind() == OPERAND_VREG && (s == 1 || s == 2 || s == 4 || s == 8)
+                && next->get_opcode() == HINS_INT_ADD) {
+                int t = product.get_base_reg();
+                Operand dest = next->get_operand(0), base = next->get_operand(1);
+                if (is_vreg(base, t)) {
+                    base = next->get_operand(2);
+                } else if (!is_vreg(next->get_operand(2), t)) {
+                    base = Operand();
+                }
+
+                if (base.get_kind() == OPERAND_VREG && !is_vreg(base, t)
+                    && (is_vreg(dest, t) || !m_live_vregs->get_fact_after_instruction(bb, i + 1).test(t))) {
+                    out->add_instruction(new Instruction(HINS_LEA, { dest, base, index, scale }));
+                    i++;
+                    continue;
+                }
+            }
+        }
+        out->add_instruction(ins->duplicate());
+    }
+
+    return out;
+}
+
+////////////////////////////////////////////////////////////////////////
+// DivisionCombining implementation
+////////////////////////////////////////////////////////////////////////
+
+DivisionCombining::DivisionCombining(ControlFlowGraph *cfg)
+        : ControlFlowGraphTransform(cfg) {
+}
+
+DivisionCombining::~DivisionCombining() {
+}
+
+InstructionSequence *DivisionCombining::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+
+    unsigned len = bb->get_length();
+    std::vector<bool> moved(len, false);
+    for (unsigned i = 0; i < len; i++) {
+        if (moved[i]) {
+            continue;
+        }
+        out->add_instruction(bb->get_instruction(i)->duplicate());
+        int pair = find_pair(bb, i, moved);
+        if (pair >= 0) {
+            out->add_instruction(bb->get_instruction(unsigned(pair))->duplicate());
+            moved[pair] = true;
+            Statistics::get().add("divmod.pairs");
+        }
+    }
+
+    return out;
+}
+
+int DivisionCombining::find_pair(BasicBlock *bb, unsigned index, const std::vector<bool> &moved) {
+    Instruction *ins = bb->get_instruction(index);
+    int partner = get_division_partner(ins->get_opcode());
+    if (partner < 0) {
+        return -1;
+    }
+    const Operand &dest = ins->get_operand(0), &dividend = ins->get_operand(1), &divisor = ins->get_operand(2);
+    std::set<int> operands;
+    for (unsigned i = 1; i <= 2; i++) {
+        const Operand &operand = ins->get_operand(i);
+        if (operand.get_kind() == OPERAND_VREG) {
+            operands.insert(operand.get_base_reg());
+        } else if (!is_literal(operand)) {
+            return -1;
+        }
+    }
+    if (dest.get_kind() != OPERAND_VREG || operands.count(dest.get_base_reg()) > 0) {
+        return -1;
+    }
+
+    // the vregs defined and used by the instructions in between
+    std::set<int> defs, uses;
+    for (unsigned i = index + 1; i < bb->get_length(); i++) {
+        if (moved[i]) {
+            continue;
+        }
+        Instruction *next = bb->get_instruction(i);
+        if (next->get_opcode() == partner && next->get_operand(1) == dividend && next->get_operand(2) == divisor
+                && next->get_operand(0).get_kind() == OPERAND_VREG) {
+            int next_dest = next->get_operand(0).get_base_reg();
+            if (defs.count(next_dest) == 0 && uses.count(next_dest) == 0) {
+                return int(i);
+            }
+        }
+        add_vregs(next, defs, uses);
+        for (auto j = operands.begin(); j != operands.end(); j++) {
+            if (defs.count(*j) > 0) {
+                return -1;
+            }
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,126 @@
+#ifndef STRENGTH_REDUCTION_H
+#define STRENGTH_REDUCTION_H
+
+#include <vector>
+#include <map>
+#include <set>
+#include "cfg.h"
+#include "cfg_transform.h"
+#include "live_vregs.h"
+#include "ssa.h"
+#include "loops.h"
+
+// Induction variable strength reduction for a high-level CFG in SSA form.
+//
+// A basic induction variable is a phi in a loop header whose operand for the
+// back edge is the phi's value plus or minus a constant (possibly through moves),
+//
+//   vrI = phi vrI0, vrI2          vrI2 = vrI + $c
+//
+// A multiplication of a basic induction variable by a constant in the loop,
+// and an addition of a loop-invariant value to the product (as generated for
+// array element references), is replaced by a move from a new induction
+// variable, which is initialized in the preheader and incremented at the end
+// of the loop's latch block:
+//
+//   vrT = vrI * $s                vrT = vrP
+//   vrA = vrBase + vrT            (vrP = phi (vrI0 * $s + vrBase), vrP + $(c*s))
+//
+// Only loops with a preheader (a single predecessor outside the loop with no
+// other successors, as created by LoopInvariantCodeMotion) and a single back edge
+// are considered.
+class InductionVariableStrengthReduction : public ControlFlowGraphTransform {
+private:
+    struct BasicIV {
+        int vreg;     // phi destination
+        Operand init; // value on entry to the loop
+        long step;
+    };
+
+    DominatorTree *m_own_domtree;
+    const DominatorTree &m_domtree;
+    LoopForest *m_own_loops;
+    const LoopForest &m_loops;
+    int m_next_vreg;
+
+    // instructions defining each vreg, and the block containing them
+    std::vector<Instruction *> m_defs;
+    std::map<Instruction *, BasicBlock *> m_def_blocks;
+    // number of uses of each vreg, and the last instruction using it
+    std::vector<unsigned> m_use_counts;
+    std::vector<Instruction *> m_users;
+
+    // edits: new phis at the start of headers, new instructions at
+    // the end of preheaders and latches, and replaced (or removed)
+    // instructions in loop bodies (all indexed by block id)
+    std::vector<std::vector<Instruction *>> m_new_phis;
+    std::vector<std::vector<Instruction *>> m_appended;
+    std::map<Instruction *, Instruction *> m_replaced;
+
+public:
+    InductionVariableStrengthReduction(ControlFlowGraph *cfg, const DominatorTree *domtree = nullptr,
+                                       const LoopForest *loops = nullptr);
+    virtual ~InductionVariableStrengthReduction();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+private:
+    void find_defs_and_uses();
+    void reduce_loop(const LoopForest::Loop &loop);
+    bool find_basic_iv(const LoopForest::Loop &loop, Instruction *phi, unsigned entry_index, unsigned latch_index, BasicIV &iv);
+    Instruction *get_single_user(int vreg, const LoopForest::Loop &loop);
+    bool is_invariant(const Operand &operand, const LoopForest::Loop &loop);
+};
+
+// Combine a multiplication by 1, 2, 4, or 8 with the following addition
+// (the address arithmetic of an array element reference)
+//
+//   muli vrT, vrI, $8
+//   addi vrA, vrB, vrT
+//
+// into a single HINS_LEA instruction "lea vrA, vrB, vrI, $8" (if the product
+// isn't used afterwards), which is lowered using x86-64 scaled-index addressing.
+// This is for CFGs not in SSA form.
+class ScaledIndexSelection : public ControlFlowGraphTransform {
+private:
+    LiveVregs *m_own_live_vregs;
+    const LiveVregs *m_live_vregs;
+
+public:
+    // live_vregs, if provided, must have materialized instruction facts
+    ScaledIndexSelection(ControlFlowGraph *cfg, const LiveVregs *live_vregs = nullptr);
+    virtual ~ScaledIndexSelection();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+    virtual bool is_block_local() const { return true; }
+};
+
+// Pair a division with the remainder of the same operands later in its
+// block (as in digit extraction)
+//
+//   divi vrQ, vrN, $10
+//   ...
+//   modi vrR, vrN, $10
+//
+// by moving the second instruction up to just after the first, so that
+// both results are taken from a single division when they're lowered (see
+// translate_division in context.cpp).  This is done if the first doesn't
+// change its own operands, the instructions in between don't change them,
+// and don't use or define the second's destination.  (The second can't
+// trap where the first didn't.)  The same goes for HINS_UINT_DIV and
+// HINS_UINT_MOD.  This is for CFGs in or out of SSA form.
+class DivisionCombining : public ControlFlowGraphTransform {
+public:
+    DivisionCombining(ControlFlowGraph *cfg);
+    virtual ~DivisionCombining();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+    virtual bool is_block_local() const { return true; }
+
+private:
+    // the index of the instruction to move after the division at index
+    // (or -1), skipping the instructions already moved
+    static int find_pair(BasicBlock *bb, unsigned index, const std::vector<bool> &moved);
+};
+
+#endif // STRENGTH_REDUCTION_H
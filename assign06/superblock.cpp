@@ -0,0 +1,351 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "stats.h"
+#include "superblock.h"
+
+SuperblockFormation::SuperblockFormation(ControlFlowGraph *cfg)
+        : m_cfg(cfg)
+        , m_rpo_index(cfg->get_num_blocks(), cfg->get_num_blocks())
+        , m_is_loop_header(cfg->get_num_blocks(), false)
+        , m_trace_of(cfg->get_num_blocks(), -1)
+        , m_num_duplicated(0)
+        , m_num_superblocks(0) {
+    const ControlFlowGraph::BlockList &rpo = cfg->get_reverse_postorder();
+    for (unsigned i = 0; i < rpo.size(); i++) {
+        m_rpo_index[rpo[i]->get_id()] = i;
+    }
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        const ControlFlowGraph::EdgeList &incoming = cfg->get_incoming_edges(*i);
+        for (auto j = incoming.begin(); j != incoming.end(); j++) {
+            if (m_rpo_index[(*j)->get_source()->get_id()] >= m_rpo_index[(*i)->get_id()]) {
+                m_is_loop_header[(*i)->get_id()] = true;
+            }
+        }
+    }
+    form_traces();
+}
+
+SuperblockFormation::~SuperblockFormation() {
+}
+
+ControlFlowGraph *SuperblockFormation::transform_cfg() {
+    if (m_traces.empty()) {
+        return m_cfg;
+    }
+
+    unsigned num_blocks = m_cfg->get_num_blocks();
+    for (unsigned i = 0; i < num_blocks; i++) {
+        BasicBlock *bb = m_cfg->get_block(i);
+        Node node;
+        node.block = i;
+        node.instructions.assign(bb->cbegin(), bb->cend());
+        node.has_branch = false;
+        node.add_jump = false;
+        node.is_copy = false;
+        node.merged = false;
+        node.count = bb->get_count();
+        const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(bb);
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            node.succs.push_back(std::make_pair((*j)->get_target()->get_id(), (*j)->get_kind()));
+            node.has_branch = node.has_branch || (*j)->get_kind() == EDGE_BRANCH;
+        }
+        m_nodes.push_back(node);
+    }
+
+    for (unsigned t = 0; t < m_traces.size(); t++) {
+        if (m_traces[t].first_side_entrance < m_traces[t].blocks.size()) {
+            duplicate_tail(t);
+        }
+    }
+
+    std::vector<unsigned> num_preds(m_nodes.size(), 0);
+    for (auto i = m_nodes.begin(); i != m_nodes.end(); i++) {
+        for (auto j = i->succs.begin(); j != i->succs.end(); j++) {
+            num_preds[j->first]++;
+        }
+    }
+    for (auto i = m_traces.begin(); i != m_traces.end(); i++) {
+        merge_trace(i->blocks, num_preds);
+        if (!i->copies.empty()) {
+            merge_trace(i->copies, num_preds);
+        }
+    }
+
+    // the blocks which are branched to need labels
+    std::vector<bool> is_target(m_nodes.size(), false);
+    for (auto i = m_nodes.begin(); i != m_nodes.end(); i++) {
+        for (auto j = i->succs.begin(); j != i->succs.end(); j++) {
+            if (!i->merged && j->second == EDGE_BRANCH) {
+                is_target[j->first] = true;
+            }
+        }
+    }
+
+    ControlFlowGraph *result = new ControlFlowGraph();
+    std::vector<BasicBlock *> block_map(m_nodes.size(), nullptr);
+    for (unsigned i = 0; i < m_nodes.size(); i++) {
+        const Node &node = m_nodes[i];
+        if (node.merged) {
+            continue;
+        }
+        BasicBlock *orig = m_cfg->get_block(node.block);
+        std::string label = node.is_copy ? "" : orig->get_label();
+        if (is_target[i] && label.empty()) {
+            label = StringTable::labels().new_label(".Lsuper");
+        }
+        block_map[i] = result->create_basic_block(node.is_copy ? BASICBLOCK_INTERIOR : orig->get_kind(), label);
+        block_map[i]->set_count(node.count);
+    }
+
+    for (unsigned i = 0; i < m_nodes.size(); i++) {
+        const Node &node = m_nodes[i];
+        BasicBlock *result_bb = block_map[i];
+        if (result_bb == nullptr) {
+            continue;
+        }
+
+        std::string target_label;
+        for (auto j = node.succs.begin(); j != node.succs.end(); j++) {
+            if (j->second == EDGE_BRANCH) {
+                target_label = block_map[j->first]->get_label();
+            }
+        }
+
+        for (unsigned j = 0; j < node.instructions.size(); j++) {
+            Instruction *copy = node.instructions[j]->duplicate();
+            if (j + 1 == node.instructions.size() && node.has_branch) {
+                (*copy)[0] = Operand(target_label);
+            }
+            result_bb->add_instruction(copy);
+        }
+        if (node.add_jump) {
+            result_bb->add_instruction(new Instruction(HINS_JUMP, Operand(target_label)));
+        }
+
+        // don't leave a (possibly labeled) basic block without instructions
+        if (result_bb->get_length() == 0 && result_bb->get_kind() == BASICBLOCK_INTERIOR) {
+            result_bb->add_instruction(new Instruction(HINS_NOP));
+        }
+
+        for (auto j = node.succs.begin(); j != node.succs.end(); j++) {
+            result->create_edge(result_bb, block_map[j->first], j->second);
+        }
+    }
+
+    Statistics::get().add("superblock.formed", m_num_superblocks);
+    Statistics::get().add("superblock.duplicated-blocks", m_num_duplicated);
+    return result;
+}
+
+bool SuperblockFormation::has_profile() const {
+    return m_cfg->get_entry_block()->get_count() >= 0;
+}
+
+void SuperblockFormation::form_traces() {
+    // the seeds of the traces: the blocks in reverse postorder, or by
+    // decreasing execution count if there is a profile
+    const ControlFlowGraph::BlockList &rpo = m_cfg->get_reverse_postorder();
+    std::vector<BasicBlock *> seeds(rpo.begin(), rpo.end());
+    bool profile = has_profile();
+    if (profile) {
+        std::stable_sort(seeds.begin(), seeds.end(), [](BasicBlock *a, BasicBlock *b) {
+            return a->get_count() > b->get_count();
+        });
+    }
+
+    unsigned size = 0;
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        size += (*i)->get_length();
+    }
+    unsigned budget = std::max(unsigned(MAX_DUPLICATION), size * MAX_GROWTH / 100);
+
+    for (auto i = seeds.begin(); i != seeds.end(); i++) {
+        BasicBlock *seed = *i;
+        if (m_trace_of[seed->get_id()] >= 0 || seed->get_kind() != BASICBLOCK_INTERIOR
+            || (profile && seed->get_count() <= 0)) {
+            continue;
+        }
+
+        Trace trace;
+        trace.blocks.push_back(seed->get_id());
+        m_trace_of[seed->get_id()] = int(m_traces.size());
+        while (trace.blocks.size() < MAX_TRACE_BLOCKS) {
+            BasicBlock *bb = m_cfg->get_block(trace.blocks.back());
+            int succ = choose_successor(bb);
+            if (succ < 0 || !can_extend(bb, m_cfg->get_block(unsigned(succ)))) {
+                break;
+            }
+            trace.blocks.push_back(unsigned(succ));
+            m_trace_of[succ] = int(m_traces.size());
+        }
+
+        find_side_entrances(trace, budget);
+        if (trace.blocks.size() < 2) {
+            m_trace_of[seed->get_id()] = -1;
+            continue;
+        }
+        m_traces.push_back(trace);
+        m_num_superblocks++;
+    }
+}
+
+int SuperblockFormation::choose_successor(BasicBlock *bb) const {
+    const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(bb);
+    if (outgoing.size() == 1) {
+        return int(outgoing[0]->get_target()->get_id());
+    }
+    BasicBlock *best = nullptr;
+    for (auto i = outgoing.begin(); i != outgoing.end(); i++) {
+        BasicBlock *succ = (*i)->get_target();
+        if (has_profile() ? (best == nullptr || succ->get_count() > best->get_count())
+                          : (*i)->get_kind() == EDGE_FALLTHROUGH) {
+            best = succ;
+        }
+    }
+    return (best == nullptr) ? -1 : int(best->get_id());
+}
+
+bool SuperblockFormation::can_extend(BasicBlock *bb, BasicBlock *succ) const {
+    unsigned id = succ->get_id();
+    if (succ->get_kind() != BASICBLOCK_INTERIOR || m_trace_of[id] >= 0 || m_is_loop_header[id]
+        || m_rpo_index[id] <= m_rpo_index[bb->get_id()]) {
+        return false;
+    }
+
+    // (the exit block must only be reached by falling through from one
+    // block, so a block which falls through to it can't be copied)
+    const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(succ);
+    for (auto i = outgoing.begin(); i != outgoing.end(); i++) {
+        if ((*i)->get_target()->get_kind() == BASICBLOCK_EXIT && (*i)->get_kind() == EDGE_FALLTHROUGH) {
+            return false;
+        }
+    }
+
+    // the successor must be likely to follow the block, and the block
+    // must account for most of the successor's executions
+    if (has_profile()) {
+        long count = bb->get_count(), succ_count = succ->get_count();
+        return count > 0 && succ_count * 100 >= MIN_PROBABILITY * count && count * 100 >= MIN_PROBABILITY * succ_count;
+    }
+    return true;
+}
+
+void SuperblockFormation::find_side_entrances(Trace &trace, unsigned &budget) {
+    // find the first block entered other than from the previous block
+    unsigned first = unsigned(trace.blocks.size());
+    for (unsigned i = 1; i < trace.blocks.size() && first == trace.blocks.size(); i++) {
+        if (m_cfg->get_incoming_edges(m_cfg->get_block(trace.blocks[i])).size() > 1) {
+            first = i;
+        }
+    }
+
+    // shorten the trace until copying its tail is within the limits
+    for (;;) {
+        unsigned cost = 0;
+        for (unsigned i = first; i < trace.blocks.size(); i++) {
+            cost += m_cfg->get_block(trace.blocks[i])->get_length();
+        }
+        if (cost <= MAX_DUPLICATION && cost <= budget) {
+            budget -= cost;
+            break;
+        }
+        m_trace_of[trace.blocks.back()] = -1;
+        trace.blocks.pop_back();
+    }
+    trace.first_side_entrance = std::min(first, unsigned(trace.blocks.size()));
+}
+
+void SuperblockFormation::duplicate_tail(unsigned t) {
+    Trace &trace = m_traces[t];
+    const std::vector<unsigned> &blocks = trace.blocks;
+    unsigned first = trace.first_side_entrance;
+    unsigned num_copies = unsigned(blocks.size()) - first;
+    for (unsigned i = first; i < blocks.size(); i++) {
+        Node copy = m_nodes[blocks[i]];
+        copy.is_copy = true;
+        trace.copies.push_back(unsigned(m_nodes.size()));
+        m_nodes.push_back(copy);
+        m_num_duplicated++;
+    }
+
+    // the copies go to each other along the trace, and to the other
+    // successors of the blocks they're copies of (through a new block
+    // jumping there, instead of falling through, since the original
+    // block still falls through to it)
+    for (unsigned i = 0; i < num_copies; i++) {
+        unsigned index = trace.copies[i];
+        for (unsigned j = 0; j < m_nodes[index].succs.size(); j++) {
+            std::pair<unsigned, EdgeKind> succ = m_nodes[index].succs[j];
+            if (first + i + 1 < blocks.size() && succ.first == blocks[first + i + 1]) {
+                m_nodes[index].succs[j].first = trace.copies[i + 1];
+            } else if (succ.second == EDGE_FALLTHROUGH) {
+                Node jump;
+                jump.block = m_nodes[index].block;
+                jump.succs.push_back(std::make_pair(succ.first, EDGE_BRANCH));
+                jump.has_branch = false;
+                jump.add_jump = true;
+                jump.is_copy = true;
+                jump.merged = false;
+                jump.count = m_nodes[index].count;
+                m_nodes[index].succs[j].first = unsigned(m_nodes.size());
+                m_nodes.push_back(jump);
+            }
+        }
+    }
+
+    // redirect the side entrances to the copies
+    for (unsigned i = 0; i < m_nodes.size(); i++) {
+        for (auto j = m_nodes[i].succs.begin(); j != m_nodes[i].succs.end(); j++) {
+            if (j->first >= m_cfg->get_num_blocks() || m_trace_of[j->first] != int(t)) {
+                continue;
+            }
+            auto pos = std::find(blocks.begin() + first, blocks.end(), j->first);
+            if (pos != blocks.end() && i != *(pos - 1)) {
+                j->first = trace.copies[unsigned(pos - blocks.begin()) - first];
+            }
+        }
+    }
+
+    // estimate the counts of the copies: the side entrances enter the
+    // first copy as often as the first block is entered other than from
+    // the trace
+    if (m_nodes[blocks[first]].count >= 0) {
+        long count = std::max(0L, m_nodes[blocks[first]].count - m_nodes[blocks[first - 1]].count);
+        for (unsigned i = 0; i < num_copies; i++) {
+            Node &orig = m_nodes[blocks[first + i]];
+            count = std::min(count, orig.count);
+            m_nodes[trace.copies[i]].count = count;
+            orig.count -= count;
+        }
+    }
+}
+
+void SuperblockFormation::merge_trace(const std::vector<unsigned> &nodes, const std::vector<unsigned> &num_preds) {
+    // merge each block of the trace into the one before it, if it's only
+    // entered from there, and that only falls through or jumps to it
+    unsigned head = nodes[0];
+    for (unsigned i = 1; i < nodes.size(); i++) {
+        Node &pred = m_nodes[head];
+        Node &node = m_nodes[nodes[i]];
+        if (pred.succs.size() != 1 || pred.succs[0].first != nodes[i] || num_preds[nodes[i]] != 1) {
+            head = nodes[i];
+            continue;
+        }
+        if (pred.succs[0].second == EDGE_BRANCH) {
+            // (the jump to the block isn't needed)
+            if (pred.add_jump) {
+                pred.add_jump = false;
+            } else {
+                assert(pred.has_branch);
+                pred.instructions.pop_back();
+            }
+        }
+        pred.instructions.insert(pred.instructions.end(), node.instructions.begin(), node.instructions.end());
+        pred.succs = node.succs;
+        pred.has_branch = node.has_branch;
+        pred.add_jump = node.add_jump;
+        node.merged = true;
+    }
+}
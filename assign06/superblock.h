@@ -0,0 +1,110 @@
+#ifndef SUPERBLOCK_H
+#define SUPERBLOCK_H
+
+#include <utility>
+#include <vector>
+#include "cfg.h"
+
+// Superblock formation in a high-level CFG (not in SSA form), so that the
+// block-local passes (such as value numbering and the scheduling of the
+// generated code) see long straight-line regions rather than blocks ending
+// at every join of an IF.
+//
+// The blocks are grouped into traces, paths along which control is likely
+// to flow: starting with the most frequently executed block not yet in a
+// trace (with a profile, or in reverse postorder without one), a trace is
+// extended with the most frequently executed successor of its last block,
+// if their execution counts are within MIN_PROBABILITY percent of each
+// other (without a profile, with the only successor of the block, or the
+// block a conditional branch falls through to, such as the THEN arm of an
+// IF).  A trace never follows a back edge, or enters a loop other than at
+// its start, and has at most MAX_TRACE_BLOCKS blocks.
+//
+// The blocks of a trace which are entered from outside it (other than the
+// first) are then removed from the trace by tail duplication: the blocks
+// of the trace from the first one with a side entrance onwards are copied,
+// and the side entrances are redirected to the copies:
+//
+//   H: cmpi vr0, $0              H: cmpi vr0, $0
+//      jlte E                       jlte E
+//   T: addi vr1, vr1, $1         T: addi vr1, vr1, $1
+//      jmp J                        muli vr2, vr1, vr1     (T and J merged)
+//   E: subi vr1, vr1, $1            ...
+//   J: muli vr2, vr1, vr1        E: subi vr1, vr1, $1
+//      ...                       J': muli vr2, vr1, vr1
+//                                   ...
+//
+// so that the trace has a single entry, and its blocks can be merged into
+// a superblock wherever one only falls through or jumps to the next.  A
+// trace which would need more than MAX_DUPLICATION instructions copied is
+// cut short before its first side entrance instead, and the copies in a
+// function are limited to MAX_GROWTH percent of its instructions.
+class SuperblockFormation {
+public:
+    static const unsigned MAX_TRACE_BLOCKS = 16;
+    static const unsigned MAX_DUPLICATION = 48;
+    static const unsigned MAX_GROWTH = 50;
+    static const long MIN_PROBABILITY = 60;
+
+private:
+    // a block of the transformed CFG (an original block, a copy of one, or
+    // a block only jumping to the original successor of a copy), with its
+    // successors as node indices
+    struct Node {
+        unsigned block;                            // the original block
+        std::vector<Instruction *> instructions;   // (not owned)
+        std::vector<std::pair<unsigned, EdgeKind>> succs;
+        bool has_branch;    // the last instruction is a branch to the BRANCH successor
+        bool add_jump;      // a HINS_JUMP to the BRANCH successor must be added
+        bool is_copy;
+        bool merged;        // merged into its predecessor
+        long count;
+    };
+
+    struct Trace {
+        std::vector<unsigned> blocks;
+        // the index of the first block with a side entrance (the
+        // number of blocks, if none has one)
+        unsigned first_side_entrance;
+        // the nodes of the copies of the blocks from there on
+        std::vector<unsigned> copies;
+    };
+
+    ControlFlowGraph *m_cfg;
+    // the index of each block in reverse postorder
+    std::vector<unsigned> m_rpo_index;
+    // does a back edge enter the block?
+    std::vector<bool> m_is_loop_header;
+    std::vector<int> m_trace_of;
+    std::vector<Trace> m_traces;
+    unsigned m_num_duplicated;
+    unsigned m_num_superblocks;
+    std::vector<Node> m_nodes;
+
+    // disallow copy ctor and assignment operator
+    SuperblockFormation(const SuperblockFormation &);
+    SuperblockFormation &operator=(const SuperblockFormation &);
+
+public:
+    SuperblockFormation(ControlFlowGraph *cfg);
+    ~SuperblockFormation();
+
+    // the number of blocks copied, and of the superblocks formed (traces
+    // of at least two blocks)
+    unsigned get_num_duplicated() const { return m_num_duplicated; }
+    unsigned get_num_superblocks() const { return m_num_superblocks; }
+
+    // the transformed CFG (or the original, if no superblocks were formed)
+    ControlFlowGraph *transform_cfg();
+
+private:
+    bool has_profile() const;
+    void form_traces();
+    int choose_successor(BasicBlock *bb) const;
+    bool can_extend(BasicBlock *bb, BasicBlock *succ) const;
+    void find_side_entrances(Trace &trace, unsigned &budget);
+    void duplicate_tail(unsigned t);
+    void merge_trace(const std::vector<unsigned> &nodes, const std::vector<unsigned> &num_preds);
+};
+
+#endif // SUPERBLOCK_H
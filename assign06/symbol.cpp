@@ -4,27 +4,31 @@
 
 #include "symbol.h"
 
-const char* Symbol::get_name() {
+const char* Symbol::get_name() const {
     return m_name;
 }
 
-Type* Symbol::get_type() {
+Atom Symbol::get_atom() const {
+    return m_atom;
+}
+
+Type* Symbol::get_type() const {
     return m_type;
 }
 
-int Symbol::get_kind() {
+int Symbol::get_kind() const {
     return m_kind;
 }
 
-long Symbol::get_size() {
+long Symbol::get_size() const {
     return get_type()->get_size();
 }
 
-long Symbol::get_offset() {
+long Symbol::get_offset() const {
     return m_offset;
 }
 
-long Symbol::get_ival() {
+long Symbol::get_ival() const {
     return ival;
 }
 
@@ -34,7 +38,8 @@ void Symbol::set_ival(long val) {
 
 struct Symbol *symbol_create(const char* name, Type* type, int kind, long offset) {
     Symbol *symbol = new Symbol();
-    symbol->m_name = name;
+    symbol->m_atom = atom_intern(name);
+    symbol->m_name = atom_get_str(symbol->m_atom);
     symbol->m_type = type;
     symbol->m_kind = kind;
     symbol->m_offset = offset;
@@ -46,6 +51,10 @@ const char* get_name_for_kind(int kind) {
         return "TYPE";
     } else if (kind == CONST) {
         return "CONST";
+    } else if (kind == PROCEDURE) {
+        return "PROCEDURE";
+    } else if (kind == FUNCTION) {
+        return "FUNCTION";
     } else {
         return "VAR";
     }
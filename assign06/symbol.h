@@ -6,28 +6,33 @@
 #define ASSIGN03_SYMBOL_H
 
 #include "type.h"
+#include "atom.h"
 
 struct Type;
 
 enum Kind {
     VARIABLE = 5000,
     CONST,
-    TYPE
+    TYPE,
+    PROCEDURE,
+    FUNCTION
 };
 
 struct Symbol {
 public:
     const char* m_name;
+    Atom m_atom;   // the interned name
     Type* m_type;
     int m_kind;
     long m_offset;
     long ival;
-    const char* get_name();
-    Type* get_type();
-    int get_kind();
-    long get_size();
-    long get_offset();
-    long get_ival();
+    const char* get_name() const;
+    Atom get_atom() const;
+    Type* get_type() const;
+    int get_kind() const;
+    long get_size() const;
+    long get_offset() const;
+    long get_ival() const;
     void set_ival(long val);
 };
 
@@ -2,12 +2,12 @@
 // Created by Jesse Li on 10/31/20.
 //
 
-#include <cstring>
 #include <string>
 #include "symtab.h"
 #include "util.h"
 
 SymbolTable::SymbolTable(SymbolTable *outer) {
+    total_size = 0;
     parent = outer;
     if (outer == nullptr) {
         depth = 0;
@@ -16,63 +16,78 @@ SymbolTable::SymbolTable(SymbolTable *outer) {
     }
 }
 
-void SymbolTable::insert(Symbol symbol) {
-    if (s_exists(symbol.get_name())) {
+void SymbolTable::insert(const Symbol &symbol) {
+    if (defines(symbol.get_atom())) {
         err_fatal("Name '%s' is already defined", symbol.get_name());
     }
+    index[symbol.get_atom()] = unsigned(tab.size());
     tab.push_back(symbol);
+    total_size += symbol.get_size();
 }
 
-Symbol SymbolTable::lookup(const char *name) {
-    // searching for names in the current scope
-    // redefining a name in local scope is an error
+const Symbol &SymbolTable::lookup(Atom name) const {
+    const Symbol *sym = find(name);
+    if (sym == nullptr) {
+        err_fatal("Undefined variable '%s'\n", atom_get_str(name));
+    }
+    return *sym;
+}
+
+const Symbol &SymbolTable::lookup(const char *name) const {
+    return lookup(atom_intern(name));
+}
 
-    // for loop
-    for (auto sym : tab) {
-        if (std::strcmp(name, sym.get_name()) == 0) {
-            return sym;
+const Symbol *SymbolTable::find(Atom name) const {
+    // searching for names in the current scope, then the enclosing ones
+    for (const SymbolTable *scope = this; scope != nullptr; scope = scope->parent) {
+        auto i = scope->index.find(name);
+        if (i != scope->index.end()) {
+            return &scope->tab[i->second];
         }
     }
-    if (parent != nullptr) {
-        return parent->lookup(name);
+    return nullptr;
+}
+
+SymbolTable *SymbolTable::locate(Atom name, unsigned &i) {
+    for (SymbolTable *scope = this; scope != nullptr; scope = scope->parent) {
+        auto j = scope->index.find(name);
+        if (j != scope->index.end()) {
+            i = j->second;
+            return scope;
+        }
     }
-    err_fatal("Undefined variable '%s'\n", name);
+    return nullptr;
 }
 
-std::vector<Symbol> SymbolTable::get_symbols() {
-    return tab;
+const Symbol *SymbolTable::find(const char *name) const {
+    return find(atom_intern(name));
 }
 
 SymbolTable* SymbolTable::get_parent() {
     return parent;
 }
 
-long SymbolTable::get_total_size() {
-    long total_size = 0;
-    for (auto sym : tab) {
-        total_size += sym.get_size();
-    }
+long SymbolTable::get_total_size() const {
     return total_size;
 }
 
-bool SymbolTable::s_exists(const char* name) {
-    for (auto sym : tab) {
-        if (std::strcmp(name, sym.get_name()) == 0) {
-            return true;
-        }
-    }
-    if (parent) {
-        return parent->s_exists(name);
-    }
+bool SymbolTable::s_exists(Atom name) const {
+    return find(name) != nullptr;
+}
+
+bool SymbolTable::s_exists(const char* name) const {
+    return find(name) != nullptr;
+}
 
-    return false;
+bool SymbolTable::defines(Atom name) const {
+    return index.count(name) > 0;
 }
 
-void SymbolTable::print_sym_tab() {
-    for (auto sym : tab) {
+void SymbolTable::print_sym_tab() const {
+    for (const Symbol &sym : tab) {
 
-        if (sym.get_kind() == RECORD) {
-            // print record internals first
+        if (sym.get_kind() == RECORD || sym.get_kind() == PROCEDURE || sym.get_kind() == FUNCTION) {
+            // print record internals (or a subprogram's scope) first
             sym.get_type()->symtab->print_sym_tab();
         }
 
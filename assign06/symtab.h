@@ -7,6 +7,8 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include "atom.h"
 #include "symbol.h"
 
 struct Symbol;
@@ -14,17 +16,39 @@ struct Symbol;
 struct SymbolTable {
 private:
     std::vector<Symbol> tab;
+    // the index in tab of each name (atom) defined in this scope
+    std::unordered_map<Atom, unsigned> index;
+    // the sum of the sizes of the symbols (kept up to date by insert)
+    long total_size;
     SymbolTable* parent;
     int depth;
 public:
+    typedef std::vector<Symbol>::const_iterator const_iterator;
+
     SymbolTable(SymbolTable* outer);
-    void insert(Symbol symbol);
-    Symbol lookup(const char* name);
-    std::vector<Symbol> get_symbols();
+    void insert(const Symbol &symbol);
+    // look up a name in this scope or an enclosing one
+    // (find returns a null pointer if it isn't defined, lookup is a fatal error)
+    const Symbol &lookup(Atom name) const;
+    const Symbol &lookup(const char* name) const;
+    const Symbol *find(Atom name) const;
+    const Symbol *find(const char* name) const;
+    // find the scope defining a name, and the index of its symbol there
+    // (or return a null pointer if it isn't defined)
+    SymbolTable *locate(Atom name, unsigned &i);
+    // the symbols of this scope, in the order they were inserted
+    const_iterator begin() const { return tab.begin(); }
+    const_iterator end() const { return tab.end(); }
+    unsigned get_num_symbols() const { return unsigned(tab.size()); }
+    const Symbol &get_symbol(unsigned i) const { return tab[i]; }
+    Symbol &get_symbol(unsigned i) { return tab[i]; }
     SymbolTable* get_parent();
-    long get_total_size();
-    void print_sym_tab();
-    bool s_exists(const char* name);
+    long get_total_size() const;
+    void print_sym_tab() const;
+    bool s_exists(Atom name) const;
+    // is a name defined in this scope (rather than an enclosing one)?
+    bool defines(Atom name) const;
+    bool s_exists(const char* name) const;
 };
 
 
@@ -0,0 +1,283 @@
+#include <set>
+#include "cfg.h"
+#include "highlevel.h"
+#include "stats.h"
+#include "storage_layout.h"
+#include "tail_call.h"
+
+TailCallElimination::TailCallElimination(ControlFlowGraph *cfg, const std::string &label,
+                                         const StorageLayout *layout)
+        : m_cfg(cfg)
+        , m_label(label)
+        , m_layout(layout)
+        , m_param_block(nullptr)
+        , m_num_params(0)
+        , m_tail_calls(cfg->get_num_blocks(), -1)
+        , m_num_tail_calls(0) {
+    if (label.empty() || !find_params() || has_frame_variables()) {
+        return;
+    }
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (unsigned j = 0; j < bb->get_length(); j++) {
+            if (is_self_call(bb->get_instruction(j))) {
+                // (only the last call of a block can be a tail call)
+                if (is_tail_call(bb, j)) {
+                    m_tail_calls[bb->get_id()] = int(j);
+                    m_num_tail_calls++;
+                }
+                break;
+            }
+        }
+    }
+}
+
+TailCallElimination::~TailCallElimination() {
+}
+
+ControlFlowGraph *TailCallElimination::transform_cfg() {
+    if (m_num_tail_calls == 0) {
+        return m_cfg;
+    }
+
+    // the original blocks, and then the second half of the param block
+    // (which begins after the "param" instructions), as nodes of the
+    // transformed CFG.  The param block branches to the second half rather
+    // than falling through, so that the blocks with the tail calls can be
+    // laid out before it (the block falling through to the exit block must
+    // come last, see ControlFlowGraph::create_instruction_sequence).
+    unsigned num_blocks = m_cfg->get_num_blocks();
+    unsigned param_id = m_param_block->get_id();
+    unsigned body_id = num_blocks;
+    struct Node {
+        unsigned block;
+        unsigned start, end;
+        int tail_call;
+        std::vector<std::pair<unsigned, EdgeKind>> succs;
+    };
+    std::vector<Node> nodes(num_blocks + 1);
+    for (unsigned i = 0; i < num_blocks; i++) {
+        BasicBlock *bb = m_cfg->get_block(i);
+        Node &node = nodes[i];
+        node.block = i;
+        node.start = 0;
+        node.end = bb->get_length();
+        node.tail_call = m_tail_calls[i];
+        const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(bb);
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            node.succs.push_back(std::make_pair((*j)->get_target()->get_id(), (*j)->get_kind()));
+        }
+    }
+    nodes[body_id] = nodes[param_id];
+    nodes[body_id].start = m_num_params;
+    nodes[param_id].end = m_num_params;
+    nodes[param_id].tail_call = -1;
+    nodes[param_id].succs.assign(1, std::make_pair(body_id, EDGE_BRANCH));
+    for (unsigned i = 0; i <= num_blocks; i++) {
+        if (nodes[i].tail_call >= 0) {
+            nodes[i].end = unsigned(nodes[i].tail_call);
+            nodes[i].succs.assign(1, std::make_pair(body_id, EDGE_BRANCH));
+        }
+    }
+
+    // remove the blocks which are no longer reachable, unless the exit
+    // block would be one of them
+    std::vector<bool> reachable(num_blocks + 1, false);
+    std::vector<unsigned> worklist(1, m_cfg->get_entry_block()->get_id());
+    reachable[worklist.back()] = true;
+    while (!worklist.empty()) {
+        const Node &node = nodes[worklist.back()];
+        worklist.pop_back();
+        for (auto i = node.succs.begin(); i != node.succs.end(); i++) {
+            if (!reachable[i->first]) {
+                reachable[i->first] = true;
+                worklist.push_back(i->first);
+            }
+        }
+    }
+    if (!reachable[m_cfg->get_exit_block()->get_id()]) {
+        return m_cfg;
+    }
+
+    // the exit block must still be reached by falling through from the
+    // last block (as when the tail call was in the last block, and the
+    // others branched to the exit block's label), so otherwise a block
+    // with a "nop" is added before it, taking its label
+    unsigned exit_id = m_cfg->get_exit_block()->get_id();
+    bool exit_falls_through = false;
+    for (unsigned i = 0; i <= num_blocks; i++) {
+        for (auto j = nodes[i].succs.begin(); j != nodes[i].succs.end(); j++) {
+            if (reachable[i] && j->first == exit_id && j->second == EDGE_FALLTHROUGH) {
+                exit_falls_through = true;
+            }
+        }
+    }
+
+    ControlFlowGraph *result = new ControlFlowGraph();
+    std::string body_label = StringTable::labels().new_label(".Ltail");
+    int next_vreg = HighLevel::get_num_vregs(m_cfg);
+    std::vector<BasicBlock *> block_map(num_blocks + 1, nullptr);
+    for (unsigned i = 0; i <= num_blocks; i++) {
+        if (!reachable[i]) {
+            continue;
+        }
+        BasicBlock *orig = m_cfg->get_block(nodes[i].block);
+        std::string label = (i == body_id) ? body_label : orig->get_label();
+        block_map[i] = result->create_basic_block(orig->get_kind(), (i == exit_id && !exit_falls_through) ? "" : label);
+        block_map[i]->set_count(orig->get_count());
+    }
+    if (!exit_falls_through) {
+        BasicBlock *exit = block_map[exit_id];
+        block_map[exit_id] = result->create_basic_block(BASICBLOCK_INTERIOR, m_cfg->get_exit_block()->get_label());
+        block_map[exit_id]->set_count(exit->get_count());
+        block_map[exit_id]->add_instruction(new Instruction(HINS_NOP));
+        result->create_edge(block_map[exit_id], exit, EDGE_FALLTHROUGH);
+    }
+
+    for (unsigned i = 0; i <= num_blocks; i++) {
+        const Node &node = nodes[i];
+        BasicBlock *result_bb = block_map[i];
+        if (result_bb == nullptr) {
+            continue;
+        }
+        BasicBlock *orig = m_cfg->get_block(node.block);
+        for (unsigned j = node.start; j < node.end; j++) {
+            result_bb->add_instruction(orig->get_instruction(j)->duplicate());
+        }
+
+        if (i == param_id) {
+            result_bb->add_instruction(new Instruction(HINS_JUMP, Operand(body_label)));
+        } else if (node.tail_call >= 0) {
+            // move the arguments to the parameters, all at once
+            Instruction *call = orig->get_instruction(unsigned(node.tail_call));
+            unsigned first_arg = (call->get_opcode() == HINS_CALL) ? 2 : 1;
+            std::vector<Operand> temps;
+            for (unsigned j = 0; j < m_params.size(); j++) {
+                temps.push_back(Operand(OPERAND_VREG, next_vreg++));
+                result_bb->add_instruction(new Instruction(HINS_MOV, temps.back(), call->get_operand(first_arg + j)));
+            }
+            for (unsigned j = 0; j < m_params.size(); j++) {
+                result_bb->add_instruction(new Instruction(HINS_MOV, m_params[j], temps[j]));
+            }
+            result_bb->add_instruction(new Instruction(HINS_JUMP, Operand(body_label)));
+            Statistics::get().add("tailcall.eliminated");
+        }
+
+        // don't leave a (possibly labeled) basic block without instructions
+        if (result_bb->get_length() == 0 && result_bb->get_kind() == BASICBLOCK_INTERIOR) {
+            result_bb->add_instruction(new Instruction(HINS_NOP));
+        }
+
+        for (auto j = node.succs.begin(); j != node.succs.end(); j++) {
+            result->create_edge(result_bb, block_map[j->first], j->second);
+        }
+    }
+
+    return result;
+}
+
+bool TailCallElimination::find_params() {
+    // (the "param" instructions begin the block after the entry block, and
+    // nothing else may branch there)
+    const ControlFlowGraph::EdgeList &entry_edges = m_cfg->get_outgoing_edges(m_cfg->get_entry_block());
+    if (entry_edges.size() != 1) {
+        return false;
+    }
+    m_param_block = entry_edges.front()->get_target();
+    if (m_param_block->get_kind() != BASICBLOCK_INTERIOR || m_cfg->get_incoming_edges(m_param_block).size() != 1) {
+        return false;
+    }
+    while (m_num_params < m_param_block->get_length()
+           && m_param_block->get_instruction(m_num_params)->get_opcode() == HINS_PARAM) {
+        Instruction *param = m_param_block->get_instruction(m_num_params);
+        if (param->get_operand(1).get_int_value() != long(m_num_params)) {
+            return false;
+        }
+        m_params.push_back(param->get_operand(0));
+        m_num_params++;
+    }
+
+    // the parameters must not be redefined by a "param" anywhere else
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        unsigned start = (bb == m_param_block) ? m_num_params : 0;
+        for (unsigned j = start; j < bb->get_length(); j++) {
+            if (bb->get_instruction(j)->get_opcode() == HINS_PARAM) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool TailCallElimination::has_frame_variables() const {
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        for (unsigned j = 0; j < bb->get_length(); j++) {
+            Instruction *ins = bb->get_instruction(j);
+            if (ins->get_opcode() == HINS_LOCALADDR
+                && (m_layout == nullptr || !m_layout->is_static_variable(ins->get_operand(1).get_int_value()))) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool TailCallElimination::is_self_call(Instruction *ins) const {
+    if (!HighLevel::is_subprogram_call(ins)) {
+        return false;
+    }
+    unsigned label_index = (ins->get_opcode() == HINS_CALL) ? 1 : 0;
+    return ins->get_operand(label_index).get_target_label() == m_label;
+}
+
+bool TailCallElimination::is_tail_call(BasicBlock *bb, unsigned index) const {
+    Instruction *call = bb->get_instruction(index);
+    unsigned first_arg = (call->get_opcode() == HINS_CALL) ? 2 : 1;
+    if (call->get_num_operands() != first_arg + m_num_params) {
+        return false;
+    }
+
+    // follow the only path from the call to the exit block, tracking the
+    // vregs holding the call's result
+    bool is_function = (call->get_opcode() == HINS_CALL);
+    std::set<int> result;
+    if (is_function) {
+        result.insert(call->get_operand(0).get_base_reg());
+    }
+    bool returned = false;
+    unsigned start = index + 1;
+    for (unsigned steps = 0; steps < m_cfg->get_num_blocks(); steps++) {
+        for (unsigned i = start; i < bb->get_length(); i++) {
+            Instruction *ins = bb->get_instruction(i);
+            int opcode = ins->get_opcode();
+            if (opcode == HINS_NOP || (opcode == HINS_JUMP && i + 1 == bb->get_length())) {
+                continue;
+            }
+            if (returned) {
+                return false;
+            }
+            const Operand &src = (ins->get_num_operands() > 0) ? ins->get_operand(ins->get_num_operands() - 1) : Operand();
+            bool is_result = src.get_kind() == OPERAND_VREG && result.count(src.get_base_reg()) > 0;
+            if (opcode == HINS_MOV && is_result) {
+                result.insert(ins->get_operand(0).get_base_reg());
+            } else if (opcode == HINS_RETURN && is_result) {
+                returned = true;
+            } else {
+                return false;
+            }
+        }
+
+        const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(bb);
+        if (outgoing.size() != 1) {
+            return false;
+        }
+        bb = outgoing.front()->get_target();
+        if (bb->get_kind() == BASICBLOCK_EXIT) {
+            return returned || !is_function;
+        }
+        start = 0;
+    }
+    return false;
+}
@@ -0,0 +1,84 @@
+#ifndef TAIL_CALL_H
+#define TAIL_CALL_H
+
+#include <string>
+#include <vector>
+#include "cfg.h"
+
+class StorageLayout;
+
+// Elimination of the self tail calls of a subprogram, in its high-level
+// CFG (not in SSA form).  A call of the subprogram by itself is a tail
+// call if nothing but moves of its result, jumps and the "ret" of the
+// result follow it, as in
+//
+//   f_gcd:   param vr0, $0
+//            param vr1, $1
+//            ...
+//   .L0:     modi vr4, vr0, vr1
+//            call vr3, f_gcd, vr1, vr4
+//            mov vr2, vr3
+//   .L1:     nop
+//            ret vr2
+//
+// (or, for a procedure, if nothing follows it but jumps).  The call is
+// replaced by moves of its arguments to the parameters' vregs (through new
+// vregs, since an argument may be another parameter) and a jump to a new
+// label after the "param" instructions (which are followed by a jump
+// there, so that the loop can be laid out with its test at the bottom):
+//
+//   f_gcd:   param vr0, $0
+//            param vr1, $1
+//            jmp .Ltail
+//   .Ltail:  ...
+//   .L0:     modi vr4, vr0, vr1
+//            mov vr5, vr1
+//            mov vr6, vr4
+//            mov vr0, vr5
+//            mov vr1, vr6
+//            jmp .Ltail
+//
+// so that the recursion becomes a loop, running in constant stack space
+// (the copies are removed by copy propagation and coalescing).  The frame
+// of the call is reused, so a subprogram with variables of its own in its
+// frame (whose addresses might be passed to the call) is left alone, as
+// are the blocks which are no longer reachable after the transformation
+// (which are removed) if that would leave the function with no way to
+// return.
+class TailCallElimination {
+private:
+    ControlFlowGraph *m_cfg;
+    std::string m_label;
+    const StorageLayout *m_layout;
+    // the block with the "param" instructions, and how many there are
+    BasicBlock *m_param_block;
+    unsigned m_num_params;
+    // the vreg of each parameter
+    std::vector<Operand> m_params;
+    // the index of the tail call in each block (-1 if none)
+    std::vector<int> m_tail_calls;
+    unsigned m_num_tail_calls;
+
+    // disallow copy ctor and assignment operator
+    TailCallElimination(const TailCallElimination &);
+    TailCallElimination &operator=(const TailCallElimination &);
+
+public:
+    // (label is the subprogram's, which its calls of itself use)
+    TailCallElimination(ControlFlowGraph *cfg, const std::string &label, const StorageLayout *layout);
+    ~TailCallElimination();
+
+    // the number of tail calls found
+    unsigned get_num_tail_calls() const { return m_num_tail_calls; }
+
+    // the transformed CFG (or the original, if there are no tail calls)
+    ControlFlowGraph *transform_cfg();
+
+private:
+    bool find_params();
+    bool has_frame_variables() const;
+    bool is_self_call(Instruction *ins) const;
+    bool is_tail_call(BasicBlock *bb, unsigned index) const;
+};
+
+#endif // TAIL_CALL_H
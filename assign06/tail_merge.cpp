@@ -0,0 +1,360 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "stats.h"
+#include "tail_merge.h"
+
+TailMerging::TailMerging(ControlFlowGraph *cfg, const LiveVregs *live_vregs)
+        : m_cfg(cfg)
+        , m_live(live_vregs)
+        , m_preds(cfg->get_num_blocks())
+        , m_num_tails(0)
+        , m_num_removed(0) {
+    for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        Node node;
+        node.block = bb->get_id();
+        node.instructions.assign(bb->cbegin(), bb->cend());
+        node.has_branch = false;
+        node.add_jump = false;
+        node.is_tail = false;
+        node.count = bb->get_count();
+        const ControlFlowGraph::EdgeList &outgoing = cfg->get_outgoing_edges(bb);
+        for (auto j = outgoing.begin(); j != outgoing.end(); j++) {
+            node.succs.push_back(std::make_pair((*j)->get_target()->get_id(), (*j)->get_kind()));
+            node.has_branch = node.has_branch || (*j)->get_kind() == EDGE_BRANCH;
+        }
+
+        // a block which only falls through or jumps to its successor may
+        // have its tail moved (the jump is added back when it's copied)
+        if (bb->get_kind() == BASICBLOCK_INTERIOR && node.succs.size() == 1) {
+            if (node.has_branch && !node.instructions.empty()
+                && node.instructions.back()->get_opcode() == HINS_JUMP) {
+                node.instructions.pop_back();
+                node.has_branch = false;
+                node.add_jump = true;
+            }
+            if (!node.has_branch) {
+                m_preds[node.succs[0].first].push_back(unsigned(m_nodes.size()));
+            }
+        }
+        m_layout.push_back(unsigned(m_nodes.size()));
+        m_nodes.push_back(node);
+        m_live_in.push_back(live_vregs->get_fact_at_beginning_of_block(bb));
+    }
+
+    // (the tails added are merged too, since the blocks which jump to them
+    // may have longer tails in common)
+    for (unsigned i = 0; i < m_nodes.size(); i++) {
+        if (m_nodes[i].is_tail || m_cfg->get_block(i)->get_kind() == BASICBLOCK_INTERIOR) {
+            while (merge_tail(i)) {
+            }
+        }
+    }
+}
+
+TailMerging::~TailMerging() {
+}
+
+ControlFlowGraph *TailMerging::transform_cfg() {
+    if (m_num_tails == 0) {
+        return m_cfg;
+    }
+
+    // the blocks which are branched to need labels
+    std::vector<bool> is_target(m_nodes.size(), false);
+    for (auto i = m_nodes.begin(); i != m_nodes.end(); i++) {
+        for (auto j = i->succs.begin(); j != i->succs.end(); j++) {
+            if (j->second == EDGE_BRANCH) {
+                is_target[j->first] = true;
+            }
+        }
+    }
+
+    // (the blocks are created in layout order, so that those which fall
+    // through come right before their successors)
+    ControlFlowGraph *result = new ControlFlowGraph();
+    std::vector<BasicBlock *> block_map(m_nodes.size(), nullptr);
+    for (auto l = m_layout.begin(); l != m_layout.end(); l++) {
+        unsigned i = *l;
+        const Node &node = m_nodes[i];
+        // (a tail's successor may itself be a tail, so only the original
+        // blocks are looked up in the CFG)
+        BasicBlockKind kind = BASICBLOCK_INTERIOR;
+        std::string label;
+        if (!node.is_tail) {
+            BasicBlock *orig = m_cfg->get_block(node.block);
+            kind = orig->get_kind();
+            label = orig->get_label();
+        }
+        if (is_target[i] && label.empty()) {
+            label = StringTable::labels().new_label(".Ltail");
+        }
+        block_map[i] = result->create_basic_block(kind, label);
+        block_map[i]->set_count(node.count);
+    }
+
+    for (unsigned i = 0; i < m_nodes.size(); i++) {
+        const Node &node = m_nodes[i];
+        BasicBlock *result_bb = block_map[i];
+
+        std::string target_label;
+        for (auto j = node.succs.begin(); j != node.succs.end(); j++) {
+            if (j->second == EDGE_BRANCH) {
+                target_label = block_map[j->first]->get_label();
+            }
+        }
+
+        for (unsigned j = 0; j < node.instructions.size(); j++) {
+            Instruction *copy = node.instructions[j]->duplicate();
+            if (j + 1 == node.instructions.size() && node.has_branch) {
+                (*copy)[0] = Operand(target_label);
+            }
+            result_bb->add_instruction(copy);
+        }
+        if (node.add_jump) {
+            result_bb->add_instruction(new Instruction(HINS_JUMP, Operand(target_label)));
+        }
+
+        // don't leave a (possibly labeled) basic block without instructions
+        if (result_bb->get_length() == 0 && result_bb->get_kind() == BASICBLOCK_INTERIOR) {
+            result_bb->add_instruction(new Instruction(HINS_NOP));
+        }
+
+        for (auto j = node.succs.begin(); j != node.succs.end(); j++) {
+            result->create_edge(result_bb, block_map[j->first], j->second);
+        }
+    }
+
+    Statistics::get().add("tailmerge.tails", m_num_tails);
+    Statistics::get().add("tailmerge.removed-instructions", m_num_removed);
+    return result;
+}
+
+bool TailMerging::merge_tail(unsigned target) {
+    // find the predecessors with a tail in common with another whose
+    // merging saves the most instructions
+    const std::vector<unsigned> &preds = m_preds[target];
+    std::vector<unsigned> best_group;
+    std::vector<Moves> best_moves;
+    unsigned best_length = 0;
+    int best_saving = 0;
+    bool best_falls_through = false;
+    for (auto i = preds.begin(); i != preds.end(); i++) {
+        std::vector<unsigned> group(1, *i);
+        unsigned length = MAX_LENGTH;
+        for (auto j = preds.begin(); j != preds.end(); j++) {
+            unsigned common = (j != i) ? get_common_tail(*i, *j, target) : 0;
+            if (common > 0) {
+                group.push_back(*j);
+                length = std::min(length, common);
+            }
+        }
+
+        // (a shorter tail may not be the same, where the longer one defined
+        // the vregs it uses)
+        std::vector<Moves> moves(1);
+        for (unsigned j = 1; j < group.size(); j++) {
+            moves.push_back(Moves());
+            if (!is_same_tail(m_nodes[*i], m_nodes[group[j]], length, target, moves.back())) {
+                group.erase(group.begin() + j--);
+                moves.pop_back();
+            }
+        }
+        if (group.size() < 2) {
+            continue;
+        }
+
+        // (the new block needs a jump, unless it takes the place of the
+        // predecessor which fell through, and the moves are added)
+        bool falls_through = false;
+        int saving = int(group.size() - 1) * int(length);
+        for (unsigned j = 0; j < group.size(); j++) {
+            falls_through = falls_through || m_nodes[group[j]].succs[0].second == EDGE_FALLTHROUGH;
+            saving -= int(moves[j].size());
+        }
+        saving -= falls_through ? 0 : 1;
+        if (saving > best_saving) {
+            best_group = group;
+            best_moves = moves;
+            best_length = length;
+            best_saving = saving;
+            best_falls_through = falls_through;
+        }
+    }
+    if (best_group.empty()) {
+        return false;
+    }
+
+    // (the new block has the instructions of the first predecessor)
+    const Node &first = m_nodes[best_group[0]];
+    Node tail;
+    tail.block = NO_BLOCK;
+    tail.instructions.assign(first.instructions.end() - best_length, first.instructions.end());
+    tail.succs.push_back(std::make_pair(target, best_falls_through ? EDGE_FALLTHROUGH : EDGE_BRANCH));
+    tail.has_branch = false;
+    tail.add_jump = !best_falls_through;
+    tail.is_tail = true;
+    tail.count = 0;
+    for (auto i = best_group.begin(); i != best_group.end(); i++) {
+        tail.count = (tail.count >= 0 && m_nodes[*i].count >= 0) ? tail.count + m_nodes[*i].count : -1;
+    }
+    LiveVregs::LiveSet live = m_live_in[target];
+    for (auto i = tail.instructions.rbegin(); i != tail.instructions.rend(); i++) {
+        m_live->model_instruction(*i, live);
+    }
+
+    // (the new block goes after the predecessor which falls through to it,
+    // or else after the first, since that ends with a jump)
+    unsigned index = unsigned(m_nodes.size());
+    unsigned after = best_group[0];
+    for (auto i = best_group.begin(); i != best_group.end(); i++) {
+        if (m_nodes[*i].succs[0].second == EDGE_FALLTHROUGH) {
+            after = *i;
+        }
+    }
+    m_layout.insert(std::find(m_layout.begin(), m_layout.end(), after) + 1, index);
+    m_nodes.push_back(tail);
+    m_live_in.push_back(live);
+    m_preds.push_back(best_group);
+    for (unsigned i = 0; i < best_group.size(); i++) {
+        Node &pred = m_nodes[best_group[i]];
+        pred.instructions.resize(pred.instructions.size() - best_length);
+        for (auto j = best_moves[i].begin(); j != best_moves[i].end(); j++) {
+            pred.instructions.push_back(new Instruction(HINS_MOV, Operand(OPERAND_VREG, j->first),
+                                                        Operand(OPERAND_VREG, j->second)));
+        }
+        pred.succs[0].first = index;
+    }
+
+    std::vector<unsigned> &target_preds = m_preds[target];
+    for (auto i = best_group.begin(); i != best_group.end(); i++) {
+        target_preds.erase(std::find(target_preds.begin(), target_preds.end(), *i));
+    }
+    target_preds.push_back(index);
+
+    m_num_tails++;
+    m_num_removed += unsigned(best_saving);
+    return true;
+}
+
+unsigned TailMerging::get_common_tail(unsigned node, unsigned other, unsigned target) const {
+    // the instructions must have the same opcodes and kinds of operands
+    const std::vector<Instruction *> &a = m_nodes[node].instructions, &b = m_nodes[other].instructions;
+    unsigned length = 0;
+    while (length < MAX_LENGTH && length < a.size() && length < b.size()) {
+        Instruction *x = a[a.size() - 1 - length], *y = b[b.size() - 1 - length];
+        bool same = x->get_opcode() == y->get_opcode() && x->get_num_operands() == y->get_num_operands();
+        for (unsigned i = 0; same && i < x->get_num_operands(); i++) {
+            same = x->get_operand(i).get_kind() == y->get_operand(i).get_kind();
+        }
+        if (!same) {
+            break;
+        }
+        length++;
+    }
+
+    // (a longer tail may use different vregs where a shorter one defines them)
+    Moves moves;
+    while (length > 0 && !is_same_tail(m_nodes[node], m_nodes[other], length, target, moves)) {
+        length--;
+    }
+    return length;
+}
+
+bool TailMerging::is_same_tail(const Node &node, const Node &other, unsigned length, unsigned target,
+                               Moves &moves) const {
+    // the vreg of node which each vreg of other holds the same value as
+    // (and the reverse), where either was defined or used in the tail
+    std::map<int, int> map, reverse;
+    moves.clear();
+    for (unsigned n = 0; n < length; n++) {
+        Instruction *x = node.instructions[node.instructions.size() - length + n];
+        Instruction *y = other.instructions[other.instructions.size() - length + n];
+
+        // (the uses are matched before the def, which they happen before)
+        for (unsigned pass = 0; pass < 2; pass++) {
+            for (unsigned i = 0; i < x->get_num_operands(); i++) {
+                const Operand &a = x->get_operand(i), &b = y->get_operand(i);
+                bool is_def = !HighLevel::is_use(x, i);
+                if (!a.has_base_reg() || is_def != (pass == 1)) {
+                    continue;
+                }
+                if (!match_vreg(a.get_base_reg(), b.get_base_reg(), is_def, target, map, reverse, moves)
+                    || (a.has_index_reg()
+                        && !match_vreg(a.get_index_reg(), b.get_index_reg(), false, target, map, reverse, moves))) {
+                    return false;
+                }
+            }
+        }
+
+        // the operands must be the same other than their vregs
+        for (unsigned i = 0; i < x->get_num_operands(); i++) {
+            const Operand &a = x->get_operand(i);
+            Operand b = y->get_operand(i);
+            if (a.has_base_reg()) {
+                b.set_base_reg(a.get_base_reg());
+            }
+            if (a.has_index_reg()) {
+                b.set_index_reg(a.get_index_reg());
+            }
+            if (a != b) {
+                return false;
+            }
+        }
+    }
+
+    // (the moves are done one after another, so none may overwrite the
+    // source of another)
+    for (auto i = moves.begin(); i != moves.end(); i++) {
+        for (auto j = moves.begin(); j != moves.end(); j++) {
+            if (i->first == j->second) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool TailMerging::match_vreg(int vreg, int other_vreg, bool is_def, unsigned target, std::map<int, int> &map,
+                             std::map<int, int> &reverse, Moves &moves) const {
+    if (is_def) {
+        // a vreg live after the tail must be the same in both
+        if (vreg != other_vreg
+            && (m_live_in[target].test(unsigned(vreg)) || m_live_in[target].test(unsigned(other_vreg)))) {
+            return false;
+        }
+        // (neither holds the value it held before any more)
+        auto i = map.find(other_vreg);
+        if (i != map.end()) {
+            reverse.erase(i->second);
+        }
+        auto j = reverse.find(vreg);
+        if (j != reverse.end()) {
+            map.erase(j->second);
+        }
+        map[other_vreg] = vreg;
+        reverse[vreg] = other_vreg;
+        return true;
+    }
+
+    auto i = map.find(other_vreg);
+    if (i != map.end()) {
+        return i->second == vreg;
+    }
+    // a vreg set before the tail must be the same in both, or other's must
+    // be moved into node's before the tail (if node's isn't live after it)
+    if (reverse.count(vreg) != 0) {
+        return false;
+    }
+    if (vreg != other_vreg) {
+        if (m_live_in[target].test(unsigned(vreg))) {
+            return false;
+        }
+        moves.push_back(std::make_pair(vreg, other_vreg));
+    }
+    map[other_vreg] = vreg;
+    reverse[vreg] = other_vreg;
+    return true;
+}
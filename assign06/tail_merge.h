@@ -0,0 +1,106 @@
+#ifndef TAIL_MERGE_H
+#define TAIL_MERGE_H
+
+#include <map>
+#include <utility>
+#include <vector>
+#include "cfg.h"
+#include "live_vregs.h"
+
+// Tail merging (cross-jumping) for a high-level CFG (not in SSA form), to
+// make the code smaller.
+//
+// The predecessors of a block which only fall through or jump to it are
+// compared from their ends: when several of them end with the same
+// instructions, those instructions are moved into a new block which they
+// all jump to instead, and which goes on to the block:
+//
+//   .L1:  ...                      .L1:  ...
+//         mov vr3, vr5                   jmp .Ltail
+//         addi vr4, vr4, $1        .L2:  ...
+//         jmp .L3                  .Ltail: mov vr3, vr5
+//   .L2:  ...                            addi vr4, vr4, $1
+//         mov vr3, vr5             .L3:  ...
+//         addi vr4, vr4, $1
+//   .L3:  ...
+//
+// The instructions must be the same up to the renaming of the vregs they
+// define which are dead after them (such as the temporaries of an
+// expression), so the tails of the arms of an IF computing the same thing
+// are merged even though SSA renaming gave their temporaries different
+// vregs; the new block has the vregs of one of them.  (Where the others
+// use a different vreg set before the tail, such as a variable assigned
+// in both arms, it is moved into that one's first, as long as that isn't
+// live after the tail; the moves count against the instructions saved.)
+// The new block is placed right after the predecessor which fell through
+// to the block (if it is one of them), so that it needs no jump of its
+// own, or else after the first of them (which ends with a jump), and a
+// common tail is only moved if that saves at least one instruction.  The predecessors which
+// are left with nothing but a jump can then be removed by jump threading.
+class TailMerging {
+public:
+    // the longest tail compared at a time (a longer one is merged in
+    // pieces, since the predecessors of a new block are compared again)
+    static const unsigned MAX_LENGTH = 32;
+
+private:
+    static const unsigned NO_BLOCK = ~0U;
+
+    // a block of the transformed CFG (an original block, or a new block
+    // with a common tail), with its successors as node indices
+    struct Node {
+        unsigned block;                            // the original block (NO_BLOCK for a tail)
+        std::vector<Instruction *> instructions;   // (not owned)
+        std::vector<std::pair<unsigned, EdgeKind>> succs;
+        bool has_branch;    // the last instruction is a branch to the BRANCH successor
+        bool add_jump;      // a HINS_JUMP to the BRANCH successor must be added
+        bool is_tail;
+        long count;
+    };
+
+    // moves of vregs (the destination and source) added to a predecessor
+    typedef std::vector<std::pair<int, int>> Moves;
+
+    ControlFlowGraph *m_cfg;
+    const LiveVregs *m_live;
+    std::vector<Node> m_nodes;
+    // the nodes in the order their blocks are laid out
+    std::vector<unsigned> m_layout;
+    // the vregs live at the start of each node
+    std::vector<LiveVregs::LiveSet> m_live_in;
+    // the nodes which only fall through or jump to each node
+    std::vector<std::vector<unsigned>> m_preds;
+    unsigned m_num_tails;
+    unsigned m_num_removed;
+
+    // disallow copy ctor and assignment operator
+    TailMerging(const TailMerging &);
+    TailMerging &operator=(const TailMerging &);
+
+public:
+    TailMerging(ControlFlowGraph *cfg, const LiveVregs *live_vregs);
+    ~TailMerging();
+
+    // the number of common tails moved into blocks of their own, and the
+    // number of instructions that removed (less the jumps added)
+    unsigned get_num_tails() const { return m_num_tails; }
+    unsigned get_num_removed() const { return m_num_removed; }
+
+    // the transformed CFG (or the original, if no tails were merged)
+    ControlFlowGraph *transform_cfg();
+
+private:
+    bool merge_tail(unsigned target);
+    // the number of instructions at the end of a node which are the same
+    // as those at the end of another (both going on to target)
+    unsigned get_common_tail(unsigned node, unsigned other, unsigned target) const;
+    // are the tails of two nodes the same, given the moves (to node's
+    // vregs from other's) added to the end of other before them?
+    bool is_same_tail(const Node &node, const Node &other, unsigned length, unsigned target, Moves &moves) const;
+    // match the vregs of an operand of other with those of an operand of
+    // node (mapping other's vregs to node's, and node's back to other's)
+    bool match_vreg(int vreg, int other_vreg, bool is_def, unsigned target, std::map<int, int> &map,
+                    std::map<int, int> &reverse, Moves &moves) const;
+};
+
+#endif // TAIL_MERGE_H
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include "x86_64.h"
+#include "aarch64.h"
+#include "target.h"
+
+namespace {
+    // (%rax/%rdx are reserved for idivq, %r10/%r11 are the lowering's
+    // scratch registers)
+    const TargetRegisters X86_64_REGISTERS = {
+        { MREG_RCX, MREG_RSI, MREG_RDI, MREG_R8, MREG_R9 },
+        { MREG_RBX, MREG_R12, MREG_R13, MREG_R14, MREG_R15 },
+        MREG_XMM0,
+    };
+
+    // (x15-x17 are the lowering's scratch registers, x18 is the platform
+    // register, and x29/x30 are the frame pointer and link register; the
+    // argument registers come last, since the calls need them)
+    const TargetRegisters AARCH64_REGISTERS = {
+        { AREG_X9, AREG_X10, AREG_X11, AREG_X12, AREG_X13, AREG_X14,
+          AREG_X8, AREG_X7, AREG_X6, AREG_X5, AREG_X4, AREG_X3, AREG_X2, AREG_X1, AREG_X0 },
+        { AREG_X19, AREG_X20, AREG_X21, AREG_X22, AREG_X23, AREG_X24, AREG_X25, AREG_X26, AREG_X27, AREG_X28 },
+        AREG_V0,
+    };
+}
+
+bool TargetRegisters::is_callee_saved(int reg) const {
+    return std::find(callee_saved.begin(), callee_saved.end(), reg) != callee_saved.end();
+}
+
+const TargetRegisters &TargetRegisters::get(Target target) {
+    return (target == TARGET_AARCH64) ? AARCH64_REGISTERS : X86_64_REGISTERS;
+}
+
+namespace {
+    bool host_has_avx2() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+}
+
+bool X86_64Cpu::set_arch(const std::string &name) {
+    if (name == "x86-64" || name == "x86-64-v2") {
+        avx2 = false;
+    } else if (name == "x86-64-v3" || name == "x86-64-v4") {
+        avx2 = true;
+    } else if (name == "native") {
+        avx2 = host_has_avx2();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool X86_64Cpu::set_tune(const std::string &name) {
+    if (name == "generic") {
+        tune = TUNE_GENERIC;
+    } else if (name == "skylake") {
+        tune = TUNE_SKYLAKE;
+    } else if (name == "znver") {
+        tune = TUNE_ZNVER;
+    } else if (name == "native") {
+        __builtin_cpu_init();
+        tune = __builtin_cpu_is("amd") ? TUNE_ZNVER : __builtin_cpu_is("intel") ? TUNE_SKYLAKE : TUNE_GENERIC;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool X86_64Cpu::is_supported_by_host() const {
+    return !avx2 || host_has_avx2();
+}
+
+std::string X86_64Cpu::get_name() const {
+    static const char *const TUNE_NAMES[] = { "generic", "skylake", "znver" };
+    return std::string(avx2 ? "x86-64-v3" : "x86-64") + "," + TUNE_NAMES[tune];
+}
@@ -0,0 +1,72 @@
+#ifndef TARGET_H
+#define TARGET_H
+
+#include <string>
+#include <vector>
+
+// the machines code is generated for (-ftarget=, see Lowering)
+enum Target {
+    TARGET_X86_64,
+    TARGET_AARCH64,
+};
+
+// The machine registers the register allocators (see reg_alloc.h) can
+// assign to the vregs of a target's high-level code: the registers the
+// lowering doesn't reserve as scratch registers (or for particular
+// instructions).  Each list is in order of preference.
+struct TargetRegisters {
+    // registers which are not preserved across calls (preferred for the
+    // vregs which are not live across one)
+    std::vector<int> caller_saved;
+    // registers preserved across calls (saved and restored by the
+    // prologue and epilogue of a function using them)
+    std::vector<int> callee_saved;
+    // more than any register number (the scalar registers are numbered
+    // from 0)
+    int num_regs;
+
+    bool is_callee_saved(int reg) const;
+
+    static const TargetRegisters &get(Target target);
+};
+
+// the x86-64 processors the scheduler can model (-mtune=, see
+// InstructionScheduler)
+enum X86_64Tune {
+    TUNE_GENERIC,   // a generic recent core
+    TUNE_SKYLAKE,   // Intel Skylake and its successors
+    TUNE_ZNVER,     // AMD Zen 3 and Zen 4
+};
+
+// The x86-64 processor the code is generated for: the instruction set
+// extensions the lowering may use (-march=, by default the baseline
+// x86-64 with SSE2), and the processor whose latencies and execution
+// ports the scheduler models (-mtune=).  "native" is the processor the
+// compiler is running on.
+//
+// The only extensions the code can use are AVX and AVX2 (x86-64-v3, and
+// x86-64-v4): the vectorized loops then use the VEX-encoded forms of the
+// vector instructions, which take a separate destination register, and
+// vpbroadcastq.  (x86-64-v2 adds nothing the lowering uses, and the
+// language has no operations for BMI, LZCNT or POPCNT to implement.)
+struct X86_64Cpu {
+    bool avx2;
+    X86_64Tune tune;
+
+    X86_64Cpu() : avx2(false), tune(TUNE_GENERIC) { }
+
+    // set the extensions for -march=<name> (x86-64, x86-64-v2,
+    // x86-64-v3, x86-64-v4 or native), or the processor for
+    // -mtune=<name> (generic, skylake, znver or native), returning false
+    // for an unknown name
+    bool set_arch(const std::string &name);
+    bool set_tune(const std::string &name);
+
+    // can the processor the compiler is running on run the code?
+    bool is_supported_by_host() const;
+
+    // the name of the extensions and processor (for the compile cache key)
+    std::string get_name() const;
+};
+
+#endif // TARGET_H
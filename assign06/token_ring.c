@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include "util.h"
+#include "token_ring.h"
+
+/* the number of times a thread checks the ring again before yielding the
+   CPU while it waits */
+#define SPINS_BEFORE_YIELD 64
+
+#define CACHE_LINE_SIZE 64
+
+/*
+ * The tokens from index head up to (but not including) tail are in the
+ * ring (an index is a count of the tokens pushed, whose slot is the index
+ * modulo TOKEN_RING_SIZE).  Only the consumer stores head, and only the
+ * producer stores tail; each also keeps the value of the other's index it
+ * last loaded, so that it only loads that index (whose cache line the other
+ * thread writes) when the ring seems full or empty.
+ */
+struct TokenRing {
+  struct Token slots[TOKEN_RING_SIZE];
+
+  _Alignas(CACHE_LINE_SIZE) atomic_ulong head;
+  unsigned long cached_tail;
+
+  _Alignas(CACHE_LINE_SIZE) atomic_ulong tail;
+  unsigned long cached_head;
+
+  _Alignas(CACHE_LINE_SIZE) atomic_int closed;
+};
+
+struct TokenRing *token_ring_create(void) {
+  struct TokenRing *ring = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct TokenRing));
+  if (ring == NULL) {
+    err_fatal("Allocation of a token ring failed\n");
+  }
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->closed, 0);
+  ring->cached_tail = 0;
+  ring->cached_head = 0;
+  return ring;
+}
+
+void token_ring_destroy(struct TokenRing *ring) {
+  /* (free the text of the tokens which weren't consumed) */
+  unsigned long tail = atomic_load(&ring->tail);
+  while (atomic_load(&ring->head) != tail) {
+    token_ring_advance(ring);
+  }
+  free(ring);
+}
+
+int token_ring_push(struct TokenRing *ring, int tag, const char *text, int len, int line, int col) {
+  unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  struct Token *token;
+  int spins = 0;
+
+  while (tail - ring->cached_head == TOKEN_RING_SIZE) {
+    if (atomic_load_explicit(&ring->closed, memory_order_relaxed)) {
+      return 0;
+    }
+    ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (++spins == SPINS_BEFORE_YIELD) {
+      sched_yield();
+      spins = 0;
+    }
+  }
+  if (atomic_load_explicit(&ring->closed, memory_order_relaxed)) {
+    return 0;
+  }
+
+  token = &ring->slots[tail % TOKEN_RING_SIZE];
+  token->tag = tag;
+  token->line = line;
+  token->col = col;
+  token->len = len;
+  token->text = NULL;
+  if (text != NULL) {
+    token->text = (len < TOKEN_INLINE_TEXT) ? token->inline_text : xmalloc((size_t) len + 1);
+    memcpy(token->text, text, (size_t) len);
+    token->text[len] = '\0';
+  }
+  /* (the token is stored before the consumer can see it) */
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+const struct Token *token_ring_peek(struct TokenRing *ring) {
+  unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  int spins = 0;
+
+  while (head == ring->cached_tail) {
+    ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == ring->cached_tail && ++spins == SPINS_BEFORE_YIELD) {
+      sched_yield();
+      spins = 0;
+    }
+  }
+  return &ring->slots[head % TOKEN_RING_SIZE];
+}
+
+void token_ring_advance(struct TokenRing *ring) {
+  unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  struct Token *token = &ring->slots[head % TOKEN_RING_SIZE];
+
+  if (token->text != NULL && token->text != token->inline_text) {
+    free(token->text);
+  }
+  /* (the slot is no longer used before the producer can reuse it) */
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void token_ring_close(struct TokenRing *ring) {
+  atomic_store(&ring->closed, 1);
+}
+
+int token_ring_is_closed(struct TokenRing *ring) {
+  return atomic_load_explicit(&ring->closed, memory_order_relaxed);
+}
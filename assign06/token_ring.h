@@ -0,0 +1,62 @@
+#ifndef TOKEN_RING_H
+#define TOKEN_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A single-producer, single-consumer queue of the tokens which a lexer
+ * running on its own thread passes to the parser (see parse_program's
+ * lexer_thread).  It's a ring of TOKEN_RING_SIZE preallocated slots, and is
+ * lock-free: the producer and the consumer each advance their own index,
+ * and only wait (spinning, then yielding the CPU) while the ring is full or
+ * empty.
+ *
+ * The lexer's thread doesn't create the nodes of the tokens, since Nodes
+ * and atoms belong to the thread creating them (see NodeArena and atom.h):
+ * the text of a token is copied into its slot (or into an allocated string,
+ * if it's long), and the parser's thread creates its node.
+ */
+
+#define TOKEN_RING_SIZE 4096
+#define TOKEN_INLINE_TEXT 32
+
+/* the tag of a token which is an error found by the lexer (whose text is
+   the message), reported when the parser reaches it */
+#define TOKEN_ERROR (-1)
+
+/* a token (the end of the input has tag 0) */
+struct Token {
+  int tag;
+  int line;
+  int col;
+  int len;
+  /* the text (or null if it wasn't copied): inline_text, or allocated */
+  char *text;
+  char inline_text[TOKEN_INLINE_TEXT];
+};
+
+struct TokenRing;
+
+struct TokenRing *token_ring_create(void);
+void token_ring_destroy(struct TokenRing *ring);
+
+/* (producer) add a token of len characters, copying its text if text
+   isn't null; returns 0 (dropping the token) if the ring is closed */
+int token_ring_push(struct TokenRing *ring, int tag, const char *text, int len, int line, int col);
+
+/* (consumer) get the first token, waiting until there is one, and remove
+   it (after which its text may not be used) */
+const struct Token *token_ring_peek(struct TokenRing *ring);
+void token_ring_advance(struct TokenRing *ring);
+
+/* (consumer) stop consuming tokens: the producer's pushes fail */
+void token_ring_close(struct TokenRing *ring);
+int token_ring_is_closed(struct TokenRing *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TOKEN_RING_H */
@@ -1,63 +1,230 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "node.h"
 #include "treeprint.h"
 
-#define MAX_DEPTH 4096
+#define OUTBUF_SIZE 65536
+
+// the output, written to stdout by fwrite when the buffer fills up
+struct TreePrintOutput {
+  char buf[OUTBUF_SIZE];
+  size_t len;
+};
+
+// a node on the stack of the traversal, and the index of the next kid
+// to visit
+struct TreePrintFrame {
+  struct Node *node;
+  int next_kid;
+};
 
 struct TreePrintContext {
-  int stack_depth;
-  int index[MAX_DEPTH];
-  int nsibs[MAX_DEPTH];
+  const char *(*node_tag_to_str_fn)(int);
+  int max_depth;
+  struct TreePrintOutput out;
+
+  // the stack of the traversal
+  struct TreePrintFrame *stack;
+  int stack_depth, stack_capacity;
+
+  // the prefix of the lines of the kids of the node at the top of the
+  // stack: for each ancestor below the root of the subtree being printed,
+  // "|  " if it has later siblings, and "   " otherwise
+  char *prefix;
+  size_t prefix_len, prefix_capacity;
 };
 
-static void pushctx(struct TreePrintContext *ctx, int nsibs) {
-  int level = ctx->stack_depth;
-  ctx->index[level] = 0;
-  ctx->nsibs[level] = nsibs;
+static void *xrealloc(void *p, size_t size) {
+  p = realloc(p, size);
+  if (!p) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+static void flush_output(struct TreePrintOutput *out) {
+  fwrite(out->buf, 1, out->len, stdout);
+  out->len = 0;
+}
+
+static void put_str(struct TreePrintOutput *out, const char *s) {
+  size_t len = strlen(s);
+  while (len > 0) {
+    if (out->len == OUTBUF_SIZE) {
+      flush_output(out);
+    }
+    size_t n = OUTBUF_SIZE - out->len;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(out->buf + out->len, s, n);
+    out->len += n;
+    s += n;
+    len -= n;
+  }
+}
+
+static void push_frame(struct TreePrintContext *ctx, struct Node *n) {
+  if (ctx->stack_depth == ctx->stack_capacity) {
+    ctx->stack_capacity = ctx->stack_capacity ? ctx->stack_capacity * 2 : 64;
+    ctx->stack = xrealloc(ctx->stack, ctx->stack_capacity * sizeof(struct TreePrintFrame));
+  }
+  ctx->stack[ctx->stack_depth].node = n;
+  ctx->stack[ctx->stack_depth].next_kid = 0;
   ctx->stack_depth++;
 }
 
-static void popctx(struct TreePrintContext *ctx) {
-  ctx->stack_depth--;
+static void push_prefix(struct TreePrintContext *ctx, const char *s) {
+  if (ctx->prefix_len + 4 > ctx->prefix_capacity) {
+    ctx->prefix_capacity *= 2;
+    ctx->prefix = xrealloc(ctx->prefix, ctx->prefix_capacity);
+  }
+  memcpy(ctx->prefix + ctx->prefix_len, s, 3);
+  ctx->prefix_len += 3;
+  ctx->prefix[ctx->prefix_len] = '\0';
 }
 
-static void print_node(struct Node *n, struct TreePrintContext *ctx, const char *(*node_tag_to_str_fn)(int)) {
-  int depth = ctx->stack_depth;
-  for (int i = 1; i < depth; i++) {
-    if (i == depth-1) {
-      printf("+--");
-    } else {
-      int level_index = ctx->index[i];
-      int level_nsibs = ctx->nsibs[i];
-      if (level_index < level_nsibs) {
-        printf("|  ");
-      } else {
-        printf("   ");
+static void pop_prefix(struct TreePrintContext *ctx) {
+  ctx->prefix_len -= 3;
+  ctx->prefix[ctx->prefix_len] = '\0';
+}
+
+// print a node's line: its tag and string, and " ..." if it has kids
+// which aren't printed
+static void print_line(struct TreePrintContext *ctx, struct Node *n, int is_root, int kids_elided) {
+  struct TreePrintOutput *out = &ctx->out;
+  if (!is_root) {
+    put_str(out, ctx->prefix);
+    put_str(out, "+--");
+  }
+  put_str(out, ctx->node_tag_to_str_fn(node_get_tag(n)));
+  const char *str = node_get_str(n);
+  if (str) {
+    put_str(out, "[");
+    put_str(out, str);
+    put_str(out, "]");
+  }
+  if (kids_elided) {
+    put_str(out, " ...");
+  }
+  put_str(out, "\n");
+}
+
+// print the subtree of a node, down to max_depth below it
+static void print_subtree(struct TreePrintContext *ctx, struct Node *root) {
+  int base = ctx->stack_depth;
+  ctx->prefix_len = 0;
+  ctx->prefix[0] = '\0';
+
+  int elided = ctx->max_depth == 0 && node_get_num_kids(root) > 0;
+  print_line(ctx, root, 1, elided);
+  if (elided) {
+    return;
+  }
+  push_frame(ctx, root);
+
+  while (ctx->stack_depth > base) {
+    struct TreePrintFrame *top = &ctx->stack[ctx->stack_depth - 1];
+    int nkids = node_get_num_kids(top->node);
+    if (top->next_kid == nkids) {
+      ctx->stack_depth--;
+      if (ctx->stack_depth > base) {
+        pop_prefix(ctx);
       }
+      continue;
+    }
+
+    struct Node *kid = node_get_kid(top->node, top->next_kid);
+    top->next_kid++;
+    int depth = ctx->stack_depth - base;
+    int kid_nkids = node_get_num_kids(kid);
+    elided = depth == ctx->max_depth && kid_nkids > 0;
+    print_line(ctx, kid, 0, elided);
+    if (kid_nkids > 0 && !elided) {
+      push_prefix(ctx, top->next_kid < nkids ? "|  " : "   ");
+      push_frame(ctx, kid);
     }
   }
+}
 
-  int tag = node_get_tag(n);
-  const char *str = node_get_str(n);
+static int treeprint_matches(struct Node *n, const char *(*node_tag_to_str_fn)(int), const char *filter) {
+  const char *bracket = strchr(filter, '[');
+  size_t tag_len = bracket ? (size_t) (bracket - filter) : strlen(filter);
+  const char *tag_name = node_tag_to_str_fn(node_get_tag(n));
+  if (strlen(tag_name) != tag_len || strncmp(tag_name, filter, tag_len) != 0) {
+    return 0;
+  }
+  if (!bracket) {
+    return 1;
+  }
 
-  printf("%s", node_tag_to_str_fn(tag));
-  if (str) {
-    printf("[%s]", str);
+  // the string between the brackets must be the node's string, or its
+  // first kid's (the name of a procedure or function)
+  const char *name = bracket + 1;
+  size_t name_len = strlen(name);
+  if (name_len > 0 && name[name_len - 1] == ']') {
+    name_len--;
   }
-  printf("\n");
-  ctx->index[depth-1]++;
+  const char *str = node_get_str(n);
+  if (str && strlen(str) == name_len && strncmp(str, name, name_len) == 0) {
+    return 1;
+  }
+  if (node_get_num_kids(n) > 0) {
+    str = node_get_str(node_get_kid(n, 0));
+    if (str && strlen(str) == name_len && strncmp(str, name, name_len) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void treeprint_subtrees(struct Node *root, const char *(*node_tag_to_str_fn)(int), int max_depth,
+                        const char *filter) {
+  struct TreePrintContext *ctx = xrealloc(NULL, sizeof(struct TreePrintContext));
+  ctx->node_tag_to_str_fn = node_tag_to_str_fn;
+  ctx->max_depth = max_depth;
+  ctx->out.len = 0;
+  ctx->stack = NULL;
+  ctx->stack_depth = ctx->stack_capacity = 0;
+  ctx->prefix_capacity = 256;
+  ctx->prefix = xrealloc(NULL, ctx->prefix_capacity);
+  ctx->prefix_len = 0;
 
-  int nkids = node_get_num_kids(n);
-  pushctx(ctx, nkids);
-  for (int i = 0; i < nkids; i++) {
-    print_node(node_get_kid(n, i), ctx, node_tag_to_str_fn);
+  if (!filter) {
+    print_subtree(ctx, root);
+  } else {
+    // search the tree (in preorder) for the roots of the subtrees to
+    // print, without searching the printed subtrees
+    push_frame(ctx, root);
+    int matched = 0;
+    while (ctx->stack_depth > 0) {
+      struct TreePrintFrame *top = &ctx->stack[ctx->stack_depth - 1];
+      if (top->next_kid == 0 && treeprint_matches(top->node, node_tag_to_str_fn, filter)) {
+        print_subtree(ctx, top->node);
+        top = &ctx->stack[ctx->stack_depth - 1];
+        top->next_kid = node_get_num_kids(top->node);
+        matched = 1;
+      }
+      if (top->next_kid == node_get_num_kids(top->node)) {
+        ctx->stack_depth--;
+      } else {
+        push_frame(ctx, node_get_kid(top->node, top->next_kid++));
+      }
+    }
+    if (!matched) {
+      fprintf(stderr, "Warning: no subtree matches %s\n", filter);
+    }
   }
-  popctx(ctx);
+
+  flush_output(&ctx->out);
+  fflush(stdout);
+  free(ctx->stack);
+  free(ctx->prefix);
+  free(ctx);
 }
 
 void treeprint(struct Node *root, const char *(*node_tag_to_str_fn)(int)) {
-  struct TreePrintContext ctx;
-  ctx.stack_depth = 0;
-  pushctx(&ctx, 1);
-  print_node(root, &ctx, node_tag_to_str_fn);
+  treeprint_subtrees(root, node_tag_to_str_fn, -1, NULL);
 }
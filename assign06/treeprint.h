@@ -9,6 +9,16 @@ struct Node;
 
 void treeprint(struct Node *root, const char *(*node_tag_to_str_fn)(int));
 
+// print only the subtrees whose roots match filter (or the whole tree, if
+// it's null), each down to max_depth levels below its root (or all of
+// it, if max_depth is negative), where a node whose kids aren't printed
+// is followed by " ...": "tag" matches the nodes of that tag, and
+// "tag[s]" those whose string, or whose first kid's string, is s (e.g.
+// "procedure[sort]").  A subtree within a printed one isn't printed
+// again.
+void treeprint_subtrees(struct Node *root, const char *(*node_tag_to_str_fn)(int), int max_depth,
+                        const char *filter);
+
 #ifdef __cplusplus
 }
 #endif
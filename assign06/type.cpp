@@ -2,22 +2,32 @@
 // Created by Jesse Li on 10/31/20.
 //
 
+#include <algorithm>
 #include "cpputil.h"
 #include "type.h"
 
 static int INTEGER_SIZE = 8;
 static int CHAR_SIZE = 1;
 
-Type::Type(int realType) : realType(realType) {}
+Type::Type(int realType) : realType(realType), resultType(nullptr) {}
 
 long Type::get_size() {
     return size;
 }
 
+long Type::get_alignment() {
+    return alignment;
+}
+
+long Type::get_field_offset(unsigned index) {
+    return fieldOffsets.at(index);
+}
+
 Type* type_create_integer() {
     Type* integer = new Type(PRIMITIVE);
     integer->name = "INTEGER";
     integer->size = INTEGER_SIZE;
+    integer->alignment = INTEGER_SIZE;
     return integer;
 }
 
@@ -25,44 +35,163 @@ Type* type_create_char() {
     Type* integer = new Type(PRIMITIVE);
     integer->name = "CHAR";
     integer->size = CHAR_SIZE;
+    integer->alignment = CHAR_SIZE;
     return integer;
 }
 
+Type* type_get_integer() {
+    static Type* integer = type_create_integer();
+    return integer;
+}
+
+Type* type_get_char() {
+    static Type* character = type_create_char();
+    return character;
+}
+
 Type* type_create_array(long size, Type* elementType) {
     Type* arr = new Type(ARRAY);
     arr->arraySize = size;
     arr->arrayElementType = elementType;
     arr->size = size * elementType->get_size();
+    arr->alignment = elementType->get_alignment();
     return arr;
 }
 
-Type* type_create_record(SymbolTable* symbolTable) {
+Type* type_create_record(SymbolTable* symbolTable, bool reorderFields) {
     Type* record = new Type(RECORD);
     record->symtab = symbolTable;
-    record->size = symbolTable->get_total_size();
+
+    // the order in which the fields are laid out
+    unsigned num_fields = symbolTable->get_num_symbols();
+    std::vector<unsigned> order;
+    for (unsigned i = 0; i < num_fields; i++) {
+        order.push_back(i);
+    }
+    if (reorderFields) {
+        std::stable_sort(order.begin(), order.end(), [symbolTable](unsigned a, unsigned b) {
+            Type* ta = symbolTable->get_symbol(a).get_type();
+            Type* tb = symbolTable->get_symbol(b).get_type();
+            if (ta->get_alignment() != tb->get_alignment()) {
+                return ta->get_alignment() > tb->get_alignment();
+            }
+            return ta->get_size() > tb->get_size();
+        });
+    }
+
+    long offset = 0, alignment = 1;
+    record->fieldOffsets.assign(num_fields, 0);
+    for (auto i = order.begin(); i != order.end(); i++) {
+        Type* field_type = symbolTable->get_symbol(*i).get_type();
+        long field_alignment = field_type->get_alignment();
+        offset = (offset + field_alignment - 1) & ~(field_alignment - 1);
+        record->fieldOffsets[*i] = offset;
+        offset += field_type->get_size();
+        alignment = std::max(alignment, field_alignment);
+    }
+    record->size = (offset + alignment - 1) & ~(alignment - 1);
+    record->alignment = alignment;
     return record;
 }
 
+Type* type_create_subprogram(SymbolTable* symbolTable, const std::vector<Type*> &paramTypes, Type* resultType) {
+    Type* subprogram = new Type(SUBPROGRAM);
+    subprogram->symtab = symbolTable;
+    subprogram->paramTypes = paramTypes;
+    subprogram->resultType = resultType;
+    subprogram->size = 0;
+    subprogram->alignment = 1;
+    return subprogram;
+}
+
+TypeContext::TypeContext() : reorder_fields(false) {
+}
+
+TypeContext::~TypeContext() {
+    for (auto i = types.begin(); i != types.end(); i++) {
+        delete *i;
+    }
+    for (auto i = symtabs.begin(); i != symtabs.end(); i++) {
+        delete *i;
+    }
+}
+
+Type* TypeContext::get_array(long size, Type* elementType) {
+    Type*& type = arrays[std::make_pair(size, elementType)];
+    if (type == nullptr) {
+        type = type_create_array(size, elementType);
+        types.push_back(type);
+    }
+    return type;
+}
+
+Type* TypeContext::get_record(SymbolTable* symbolTable) {
+    symtabs.push_back(symbolTable);
+
+    FieldList fields;
+    for (auto i = symbolTable->begin(); i != symbolTable->end(); i++) {
+        fields.push_back(std::make_tuple(i->get_atom(), i->get_kind(), i->get_type()));
+    }
+    Type*& type = records[fields];
+    if (type == nullptr) {
+        type = type_create_record(symbolTable, reorder_fields);
+        types.push_back(type);
+    }
+    return type;
+}
+
+Type* TypeContext::get_subprogram(SymbolTable* symbolTable, const std::vector<Type*> &paramTypes, Type* resultType) {
+    symtabs.push_back(symbolTable);
+    Type* type = type_create_subprogram(symbolTable, paramTypes, resultType);
+    types.push_back(type);
+    return type;
+}
+
+void TypeContext::set_reorder_fields(bool reorder) {
+    reorder_fields = reorder;
+}
+
 std::string Type::to_string() {
+    // (the INTEGER and CHAR types are shared by all threads, so only
+    // the descriptions of the other types are cached)
+    if (realType == PRIMITIVE) {
+        return name;
+    }
+    if (!description.empty()) {
+        return description;
+    }
+
     switch(realType){
-        case PRIMITIVE:
-            return name;
         case ARRAY:
-            return cpputil::format("ARRAY %ld OF %s", arraySize, arrayElementType->to_string().c_str());
+            description = cpputil::format("ARRAY %ld OF %s", arraySize, arrayElementType->to_string().c_str());
+            break;
         case RECORD: {
-            std::string record_str = "RECORD (";
-            std::vector<Symbol> symbols = symtab->get_symbols();
-            for (int i = 0; i < symbols.size(); i++) {
-                if (i == 0) {
-                    record_str += symbols[i].get_type()->to_string();
-                } else {
-                    record_str += " x " + symbols[i].get_type()->to_string();
+            description = "RECORD (";
+            for (unsigned i = 0; i < symtab->get_num_symbols(); i++) {
+                if (i > 0) {
+                    description += " x ";
                 }
+                description += symtab->get_symbol(i).get_type()->to_string();
+            }
+            description += ")";
+            break;
+        }
+        case SUBPROGRAM: {
+            description = (resultType != nullptr) ? "FUNCTION (" : "PROCEDURE (";
+            for (unsigned i = 0; i < paramTypes.size(); i++) {
+                if (i > 0) {
+                    description += " x ";
+                }
+                description += paramTypes[i]->to_string();
+            }
+            description += ")";
+            if (resultType != nullptr) {
+                description += " : " + resultType->to_string();
             }
-            record_str += ")";
-            return record_str;
+            break;
         }
         default:
             return "<<unknown>>";
     }
+    return description;
 }
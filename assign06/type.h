@@ -6,6 +6,9 @@
 #define ASSIGN03_TYPE_H
 
 #include <string>
+#include <map>
+#include <tuple>
+#include <vector>
 #include "symtab.h"
 
 struct SymbolTable;
@@ -13,7 +16,8 @@ struct SymbolTable;
 enum RealType {
     PRIMITIVE = 6000,
     ARRAY,
-    RECORD
+    RECORD,
+    SUBPROGRAM
 };
 
 struct Type {
@@ -27,22 +31,102 @@ public:
 
     long size;
 
+    // the alignment of values of the type (a power of 2 up to 8)
+    long alignment;
+
     const char* name;
 
     SymbolTable* symtab;
+
+    // the types of the parameters of a subprogram (the first symbols in
+    // symtab, its scope), and the type of a function's result (null
+    // for a procedure)
+    std::vector<Type*> paramTypes;
+    Type* resultType;
+
+    // the unit a subprogram is declared in (empty if it's the program's),
+    // which is part of its label (see UnitInterfaces)
+    std::string unit;
+
+    // the offsets of the fields of a record within it, in the order
+    // of the symbols in symtab (not the order they are laid out in)
+    std::vector<long> fieldOffsets;
+
+    // the string returned by to_string (computed when first needed)
+    std::string description;
 public:
     Type(int realType);
-    ~Type();
     std::string to_string();
     long get_size();
+    long get_alignment();
+    long get_field_offset(unsigned index);
 };
 
 Type* type_create_integer();
 
 Type* type_create_char();
 
+// The INTEGER and CHAR types shared by all programs (which are never modified,
+// so they can be shared by compilations on different threads).
+Type* type_get_integer();
+
+Type* type_get_char();
+
+// (the array and record types of a program are created by its TypeContext)
 Type* type_create_array(long size, Type* elementType);
 
-Type* type_create_record(SymbolTable* symbolTable);
+// Each field of a record is aligned to its type's alignment, and the size
+// of the record is padded to a multiple of the largest alignment of its
+// fields (so that the fields of each element of an array are aligned too).
+// With reorderFields, the fields are laid out in decreasing order of
+// alignment (and then size) rather than in the order they were declared,
+// so that no padding is needed between them.
+Type* type_create_record(SymbolTable* symbolTable, bool reorderFields = false);
+
+// The type of a procedure (if resultType is null) or function, whose scope
+// is symbolTable.  (A subprogram takes no storage, so its size is 0.)
+Type* type_create_subprogram(SymbolTable* symbolTable, const std::vector<Type*> &paramTypes, Type* resultType);
+
+// The array and record types of a program, interned so that each distinct
+// type is created once: structurally identical types are the same object,
+// so types are compared by comparing pointers.  The fields of a record are
+// identified by their names, kinds and types.  (The type of each subprogram
+// is distinct, since it includes the subprogram's scope.)  The types, and
+// the symbol tables of the records' fields and subprograms' scopes, are
+// freed with the TypeContext.
+class TypeContext {
+private:
+    typedef std::vector<std::tuple<Atom, int, Type*>> FieldList;
+
+    std::map<std::pair<long, Type*>, Type*> arrays;
+    std::map<FieldList, Type*> records;
+    std::vector<Type*> types;
+    std::vector<SymbolTable*> symtabs;
+    bool reorder_fields;
+
+    // disallow copy ctor and assignment operator
+    TypeContext(const TypeContext &);
+    TypeContext &operator=(const TypeContext &);
+
+public:
+    TypeContext();
+    ~TypeContext();
+
+    // the type ARRAY size OF elementType
+    Type* get_array(long size, Type* elementType);
+
+    // the record type whose fields are the symbols in symbolTable
+    // (which is then owned by the TypeContext, and only used by the
+    // record type if it's the first with these fields)
+    Type* get_record(SymbolTable* symbolTable);
+
+    // the type of a subprogram whose scope is symbolTable (which is then
+    // owned by the TypeContext)
+    Type* get_subprogram(SymbolTable* symbolTable, const std::vector<Type*> &paramTypes, Type* resultType);
+
+    // lay out the fields of the records created after this is called in
+    // decreasing order of alignment (see type_create_record)
+    void set_reorder_fields(bool reorder);
+};
 
 #endif //ASSIGN03_TYPE_H
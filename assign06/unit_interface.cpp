@@ -0,0 +1,242 @@
+#include <cctype>
+#include <cstdio>
+#include <memory>
+#include <unistd.h>
+#include "util.h"
+#include "node.h"
+#include "type.h"
+#include "symbol.h"
+#include "symtab.h"
+#include "highlevel_io.h"
+#include "unit_interface.h"
+
+namespace {
+    // the kinds of types in an interface file
+    enum TypeTag { TYPE_INTEGER, TYPE_CHAR, TYPE_ARRAY, TYPE_RECORD };
+}
+
+UnitInterfaces::UnitInterfaces() {
+}
+
+UnitInterfaces::~UnitInterfaces() {
+}
+
+void UnitInterfaces::set_unit(const std::string &unit, const std::string &source_file) {
+    m_unit = unit;
+    m_source_file = source_file;
+}
+
+void UnitInterfaces::import(const std::string &unit, const SourceInfo &info, SymbolTable *scope, TypeContext *types,
+                            long &offset) {
+    if (unit == m_unit) {
+        err_fatal("%s:%d:%d: Error: Unit '%s' uses itself\n", info.filename, info.line, info.col, unit.c_str());
+    }
+    if (!m_used.insert(unit).second) {
+        return;
+    }
+    std::string filename = get_filename(info.filename, unit);
+    if (access(filename.c_str(), R_OK) != 0) {
+        err_fatal("%s:%d:%d: Error: Unit '%s' has no interface file \"%s\" (it must be compiled first)\n",
+                  info.filename, info.line, info.col, unit.c_str(), filename.c_str());
+    }
+
+    HighLevelReader reader(filename);
+    if (reader.read_string() != unit) {
+        err_fatal("Interface file \"%s\" isn't the interface of unit '%s'\n", filename.c_str(), unit.c_str());
+    }
+    unsigned long num_symbols = reader.read_unsigned();
+    for (unsigned long i = 0; i < num_symbols; i++) {
+        std::string name = reader.read_string();
+        int kind = VARIABLE + int(reader.read_unsigned());
+        std::unique_ptr<Symbol> sym;
+        if (kind == CONST) {
+            sym.reset(symbol_create(name.c_str(), type_get_integer(), CONST, offset));
+            sym->set_ival(reader.read_signed());
+        } else if (kind == TYPE) {
+            sym.reset(symbol_create(name.c_str(), read_type(reader, filename, scope, types, offset), TYPE, offset));
+        } else if (kind == PROCEDURE || kind == FUNCTION) {
+            // (the parameters are the first symbols of the subprogram's scope)
+            SymbolTable *params = new SymbolTable(scope);
+            std::vector<Type *> param_types;
+            unsigned long num_params = reader.read_unsigned();
+            for (unsigned long j = 0; j < num_params; j++) {
+                std::string param_name = reader.read_string();
+                Type *param_type = read_type(reader, filename, scope, types, offset);
+                std::unique_ptr<Symbol> param(symbol_create(param_name.c_str(), param_type, VARIABLE, offset));
+                offset += param_type->get_size();
+                params->insert(*param);
+                param_types.push_back(param_type);
+            }
+            Type *result_type = (kind == FUNCTION) ? read_type(reader, filename, scope, types, offset) : nullptr;
+            Type *type = types->get_subprogram(params, param_types, result_type);
+            type->unit = unit;
+            sym.reset(symbol_create(name.c_str(), type, kind, offset));
+        } else {
+            err_fatal("Invalid interface file \"%s\"\n", filename.c_str());
+        }
+        offset += sym->get_type()->get_size();
+
+        if (scope->s_exists(sym->get_atom())) {
+            err_fatal("%s:%d:%d: Error: Name '%s' of unit '%s' is already defined\n",
+                      info.filename, info.line, info.col, name.c_str(), unit.c_str());
+        }
+        scope->insert(*sym);
+        m_imported.insert(sym->get_atom());
+    }
+    if (!reader.at_end()) {
+        err_fatal("Invalid interface file \"%s\"\n", filename.c_str());
+    }
+}
+
+void UnitInterfaces::write(const SymbolTable *scope) const {
+    std::vector<const Symbol *> symbols;
+    for (auto i = scope->begin(); i != scope->end(); i++) {
+        if (i->get_kind() != VARIABLE && m_imported.count(i->get_atom()) == 0) {
+            symbols.push_back(&*i);
+        }
+    }
+
+    HighLevelWriter writer;
+    writer.write_string(m_unit);
+    writer.write_unsigned(symbols.size());
+    for (auto i = symbols.begin(); i != symbols.end(); i++) {
+        const Symbol &sym = **i;
+        writer.write_string(sym.get_name());
+        writer.write_unsigned(unsigned(sym.get_kind() - VARIABLE));
+        Type *type = sym.get_type();
+        if (sym.get_kind() == CONST) {
+            writer.write_signed(sym.get_ival());
+        } else if (sym.get_kind() == TYPE) {
+            write_type(writer, type);
+        } else {
+            writer.write_unsigned(type->paramTypes.size());
+            for (unsigned j = 0; j < type->paramTypes.size(); j++) {
+                writer.write_string(type->symtab->get_symbol(j).get_name());
+                write_type(writer, type->paramTypes[j]);
+            }
+            if (sym.get_kind() == FUNCTION) {
+                write_type(writer, type->resultType);
+            }
+        }
+    }
+
+    // (the file is replaced at once, so that a file using the unit which
+    // is compiled at the same time never reads part of it)
+    std::string filename = get_filename(m_source_file, m_unit);
+    std::string temp_file = filename + ".tmp." + std::to_string(long(getpid()));
+    std::string data = writer.get_data();
+    FILE *f = fopen(temp_file.c_str(), "wb");
+    if (f == nullptr) {
+        err_fatal("Could not open interface file \"%s\"\n", temp_file.c_str());
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(temp_file.c_str(), filename.c_str()) != 0) {
+        remove(temp_file.c_str());
+        err_fatal("Error writing interface file \"%s\"\n", filename.c_str());
+    }
+}
+
+std::string UnitInterfaces::get_filename(const std::string &source_file, const std::string &unit) {
+    size_t slash = source_file.rfind('/');
+    std::string dir = (slash == std::string::npos) ? std::string() : source_file.substr(0, slash + 1);
+    return dir + unit + ".int";
+}
+
+bool UnitInterfaces::scan_source(const std::string &filename, std::string &unit, std::vector<std::string> &uses) {
+    FILE *f = fopen(filename.c_str(), "r");
+    if (f == nullptr) {
+        return false;
+    }
+    unit.clear();
+    uses.clear();
+
+    // the identifiers (and keywords) are scanned, skipping the comments,
+    // and the ones following UNIT and USES (up to its semicolon) are noted
+    enum { OTHER, AFTER_UNIT, AFTER_USES } state = OTHER;
+    std::string word;
+    int c = fgetc(f);
+    while (c != EOF) {
+        if (isalpha(c) || c == '_') {
+            word.clear();
+            while (c != EOF && (isalnum(c) || c == '_')) {
+                word += char(c);
+                c = fgetc(f);
+            }
+            if (state == AFTER_UNIT) {
+                unit = word;
+                state = OTHER;
+            } else if (state == AFTER_USES) {
+                uses.push_back(word);
+            } else if (word == "UNIT") {
+                state = AFTER_UNIT;
+            } else if (word == "USES") {
+                state = AFTER_USES;
+            }
+            continue;
+        }
+        if (c == '-') {
+            c = fgetc(f);
+            if (c == '-') {
+                while (c != EOF && c != '\n') {
+                    c = fgetc(f);
+                }
+            }
+            continue;
+        }
+        if (c == ';' || (state == AFTER_UNIT && !isspace(c))) {
+            state = OTHER;
+        }
+        c = fgetc(f);
+    }
+    fclose(f);
+    return true;
+}
+
+void UnitInterfaces::write_type(HighLevelWriter &writer, Type *type) {
+    if (type == type_get_integer()) {
+        writer.write_unsigned(TYPE_INTEGER);
+    } else if (type == type_get_char()) {
+        writer.write_unsigned(TYPE_CHAR);
+    } else if (type->realType == ARRAY) {
+        writer.write_unsigned(TYPE_ARRAY);
+        writer.write_unsigned(type->arraySize);
+        write_type(writer, type->arrayElementType);
+    } else {
+        writer.write_unsigned(TYPE_RECORD);
+        writer.write_unsigned(type->symtab->get_num_symbols());
+        for (auto i = type->symtab->begin(); i != type->symtab->end(); i++) {
+            writer.write_string(i->get_name());
+            write_type(writer, i->get_type());
+        }
+    }
+}
+
+Type *UnitInterfaces::read_type(HighLevelReader &reader, const std::string &filename, SymbolTable *scope,
+                                TypeContext *types, long &offset) {
+    switch (reader.read_unsigned()) {
+        case TYPE_INTEGER:
+            return type_get_integer();
+        case TYPE_CHAR:
+            return type_get_char();
+        case TYPE_ARRAY: {
+            long size = long(reader.read_unsigned());
+            return types->get_array(size, read_type(reader, filename, scope, types, offset));
+        }
+        case TYPE_RECORD: {
+            SymbolTable *fields = new SymbolTable(scope);
+            unsigned long num_fields = reader.read_unsigned();
+            for (unsigned long i = 0; i < num_fields; i++) {
+                std::string name = reader.read_string();
+                Type *type = read_type(reader, filename, scope, types, offset);
+                std::unique_ptr<Symbol> field(symbol_create(name.c_str(), type, VARIABLE, offset));
+                offset += type->get_size();
+                fields->insert(*field);
+            }
+            return types->get_record(fields);
+        }
+        default:
+            err_fatal("Invalid interface file \"%s\"\n", filename.c_str());
+            return nullptr;
+    }
+}
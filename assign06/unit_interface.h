@@ -0,0 +1,100 @@
+#ifndef UNIT_INTERFACE_H
+#define UNIT_INTERFACE_H
+
+#include <set>
+#include <string>
+#include <vector>
+#include "atom.h"
+
+struct SourceInfo;
+struct SymbolTable;
+struct Type;
+class TypeContext;
+class HighLevelWriter;
+class HighLevelReader;
+
+// Separate compilation of units.
+//
+// A source file is either a program or a unit, which has declarations but
+// no statements:
+//
+//   UNIT Shapes;
+//   CONST MAX = 100;
+//   TYPE Point = RECORD x, y : INTEGER; END;
+//   FUNCTION area(w, h : INTEGER) : INTEGER; ...
+//   END.
+//
+// A unit is compiled on its own (to an object file or assembly code), and
+// its subprograms are global functions labeled f_<unit>.<name> (a name
+// can't contain a dot, so they are distinct from the program's own
+// subprograms, and from those of other units); its variables are private
+// to it.  Compiling a unit also writes its interface, the file <unit>.int
+// in the directory of its source file: the constants (with their values),
+// types and subprograms (with the types of their parameters and results)
+// which it declares, other than the names it imported itself.
+//
+// A program or unit declaring "USES Shapes;" reads the interface (rather
+// than parsing the unit's source again) from its own source file's
+// directory, and the names in it are then defined as if they had been
+// declared there; calls of the unit's subprograms are calls of external
+// functions.  So a unit is compiled before the files using it, which can
+// then be compiled in parallel, and the object files are linked together.
+//
+// An interface file is in the format of highlevel_io.h: the unit's name
+// and the number of symbols, followed by the name and kind of each symbol,
+// and then a constant's value, a type, or a subprogram's parameters (the
+// name and type of each) and a function's result type.  A type is INTEGER,
+// CHAR, an array (its size and element type) or a record (the name and
+// type of each field).
+class UnitInterfaces {
+private:
+    // the unit compiled (empty for a program), and its source file
+    std::string m_unit;
+    std::string m_source_file;
+    // the units used, and the names imported from them
+    std::set<std::string> m_used;
+    std::set<Atom> m_imported;
+
+    // disallow copy ctor and assignment operator
+    UnitInterfaces(const UnitInterfaces &);
+    UnitInterfaces &operator=(const UnitInterfaces &);
+
+public:
+    UnitInterfaces();
+    ~UnitInterfaces();
+
+    // the file compiled is a unit (rather than a program)
+    void set_unit(const std::string &unit, const std::string &source_file);
+    bool is_unit() const { return !m_unit.empty(); }
+    const std::string &get_unit() const { return m_unit; }
+
+    // does the file use any units?
+    bool uses_units() const { return !m_used.empty(); }
+
+    // define the names in the interface of a unit named by a USES at info
+    // in scope (the program's), as SymbolTableBuilder does, creating their
+    // types with types; offset is the offset of the next symbol (a fatal
+    // error if the interface can't be read, or defines a name which is
+    // already defined)
+    void import(const std::string &unit, const SourceInfo &info, SymbolTable *scope, TypeContext *types,
+                long &offset);
+
+    // write the interface of the unit compiled, whose names are defined in
+    // scope (a fatal error if it can't be written)
+    void write(const SymbolTable *scope) const;
+
+    // the interface file of a unit, used by (or compiled from) a source file
+    static std::string get_filename(const std::string &source_file, const std::string &unit);
+
+    // find the name of the unit a source file is (empty for a program),
+    // and the names of the units it uses, by scanning it without parsing
+    // it (returning false if it can't be read)
+    static bool scan_source(const std::string &filename, std::string &unit, std::vector<std::string> &uses);
+
+private:
+    static void write_type(HighLevelWriter &writer, Type *type);
+    static Type *read_type(HighLevelReader &reader, const std::string &filename, SymbolTable *scope,
+                           TypeContext *types, long &offset);
+};
+
+#endif // UNIT_INTERFACE_H
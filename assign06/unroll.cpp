@@ -0,0 +1,426 @@
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include "cfg.h"
+#include "highlevel.h"
+#include "ssa.h"
+#include "licm.h"
+#include "live_vregs.h"
+#include "stats.h"
+#include "unroll.h"
+
+namespace {
+    // the largest step (and compare offset) of a loop which is unrolled,
+    // so that computing the limit offset can't overflow
+    const long MAX_STEP = 1L << 32;
+}
+
+LoopUnrolling::LoopUnrolling(ControlFlowGraph *cfg, unsigned factor, const DominatorTree *domtree,
+                             const LoopForest *loops, const LiveVregs *live_vregs)
+        : m_cfg(cfg)
+        , m_own_domtree(domtree != nullptr ? nullptr : new DominatorTree(cfg))
+        , m_domtree(domtree != nullptr ? *domtree : *m_own_domtree)
+        , m_own_loops(loops != nullptr ? nullptr : new LoopForest(cfg, m_domtree))
+        , m_loops(loops != nullptr ? *loops : *m_own_loops)
+        , m_own_live_vregs(nullptr)
+        , m_live_vregs(live_vregs)
+        , m_factor(factor)
+        , m_next_vreg(HighLevel::get_num_vregs(cfg)) {
+    if (m_factor < 2) {
+        return;
+    }
+    if (m_live_vregs == nullptr) {
+        m_own_live_vregs = new LiveVregs(cfg);
+        m_own_live_vregs->execute();
+        m_live_vregs = m_own_live_vregs;
+    }
+
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        UnrolledLoop uloop;
+        if (analyze_loop(m_loops.get_loop(i), uloop)) {
+            m_unrolled_loops.push_back(uloop);
+            Statistics::get().add("unroll.loops");
+        }
+    }
+}
+
+LoopUnrolling::~LoopUnrolling() {
+    delete m_own_loops;
+    delete m_own_domtree;
+    delete m_own_live_vregs;
+}
+
+ControlFlowGraph *LoopUnrolling::transform_cfg() {
+    ControlFlowGraph *result = new ControlFlowGraph();
+
+    // map of basic blocks of original CFG to basic blocks in transformed CFG
+    std::map<BasicBlock *, BasicBlock *> block_map;
+    std::map<BasicBlock *, const UnrolledLoop *> preheaders;
+    for (auto i = m_unrolled_loops.begin(); i != m_unrolled_loops.end(); i++) {
+        preheaders[i->preheader] = &*i;
+    }
+
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        BasicBlock *result_bb = result->create_basic_block(orig->get_kind(), orig->get_label());
+        block_map[orig] = result_bb;
+        result_bb->set_count(orig->get_count());
+        for (auto j = orig->cbegin(); j != orig->cend(); j++) {
+            result_bb->add_instruction((*j)->duplicate());
+        }
+    }
+
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+            Edge *orig_edge = *j;
+            BasicBlock *source = block_map[orig];
+            BasicBlock *target = block_map[orig_edge->get_target()];
+
+            auto p = preheaders.find(orig);
+            if (p == preheaders.end()) {
+                result->create_edge(source, target, orig_edge->get_kind());
+                continue;
+            }
+
+            // insert the unrolled loop on the edge from the preheader to the header
+            const UnrolledLoop &uloop = *p->second;
+            std::string header_label = target->get_label();
+            int exit_opcode = HighLevel::get_inverted_branch(uloop.branch_opcode);
+
+            BasicBlock *setup_bb;
+            if (orig_edge->get_kind() == EDGE_BRANCH) {
+                std::string label = StringTable::labels().new_label(".Lunroll");
+                setup_bb = result->create_basic_block(BASICBLOCK_INTERIOR, label);
+                Instruction *branch = source->get_last();
+                assert(branch->get_opcode() == HINS_JUMP && (*branch)[0].get_target_label() == header_label);
+                (*branch)[0] = Operand(label);
+            } else {
+                setup_bb = result->create_basic_block(BASICBLOCK_INTERIOR);
+            }
+            for (auto k = uloop.setup.begin(); k != uloop.setup.end(); k++) {
+                setup_bb->add_instruction(*k);
+            }
+            setup_bb->add_instruction(new Instruction(HINS_INT_COMPARE, uloop.counter, uloop.limit));
+            setup_bb->add_instruction(new Instruction(exit_opcode, Operand(header_label)));
+
+            std::string body_label = StringTable::labels().new_label(".Lunroll");
+            BasicBlock *body_bb = result->create_basic_block(BASICBLOCK_INTERIOR, body_label);
+            for (unsigned n = 0; n < m_factor; n++) {
+                std::vector<Instruction *> copy;
+                for (auto k = uloop.body.begin(); k != uloop.body.end(); k++) {
+                    copy.push_back((*k)->duplicate());
+                }
+                for (auto k = uloop.reductions.begin(); k != uloop.reductions.end(); k++) {
+                    const Operand &acc = k->accumulators[n % k->accumulators.size()];
+                    (*copy[k->index])[k->operand] = acc;
+                    (*copy[k->def_index])[0] = acc;
+                }
+                for (auto k = copy.begin(); k != copy.end(); k++) {
+                    body_bb->add_instruction(*k);
+                }
+            }
+            body_bb->add_instruction(new Instruction(HINS_INT_COMPARE, uloop.counter, uloop.limit));
+            body_bb->add_instruction(new Instruction(uloop.branch_opcode, Operand(body_label)));
+
+            BasicBlock *exit_bb = result->create_basic_block(BASICBLOCK_INTERIOR);
+            for (auto k = uloop.reductions.begin(); k != uloop.reductions.end(); k++) {
+                int opcode = uloop.body[k->index]->get_opcode();
+                for (unsigned n = 1; n < k->accumulators.size(); n++) {
+                    exit_bb->add_instruction(new Instruction(opcode, k->accumulator, k->accumulator, k->accumulators[n]));
+                }
+            }
+            exit_bb->add_instruction(new Instruction(HINS_JUMP, Operand(header_label)));
+
+            // (the unrolled body is executed once for every m_factor iterations)
+            long count = orig_edge->get_target()->get_count();
+            setup_bb->set_count(orig->get_count());
+            body_bb->set_count(count >= 0 ? count / long(m_factor) : -1);
+            exit_bb->set_count(orig->get_count());
+
+            result->create_edge(source, setup_bb, orig_edge->get_kind());
+            result->create_edge(setup_bb, body_bb, EDGE_FALLTHROUGH);
+            result->create_edge(setup_bb, target, EDGE_BRANCH);
+            result->create_edge(body_bb, body_bb, EDGE_BRANCH);
+            result->create_edge(body_bb, exit_bb, EDGE_FALLTHROUGH);
+            result->create_edge(exit_bb, target, EDGE_BRANCH);
+        }
+    }
+
+    return result;
+}
+
+bool LoopUnrolling::analyze_loop(const LoopForest::Loop &loop, UnrolledLoop &uloop) {
+    BasicBlock *header = loop.header;
+    BasicBlock *preheader = loop.preheader;
+    if (preheader == nullptr || !header->has_label()) {
+        return false;
+    }
+
+    // find the body, and the block ending with the loop test
+    BasicBlock *body, *test;
+    if (loop.blocks.size() == 1) {
+        body = test = header;
+    } else if (loop.blocks.size() == 2) {
+        BasicBlock *other = *loop.blocks.begin() != header ? *loop.blocks.begin() : *loop.blocks.rbegin();
+        if (header->get_length() == 2) {
+            // a WHILE loop, whose header has nothing but the test
+            body = other;
+            test = header;
+        } else {
+            // a REPEAT loop, with the test at the end of its second block
+            body = header;
+            test = other;
+        }
+        if (m_cfg->get_outgoing_edges(body).size() != 1 || m_cfg->get_incoming_edges(other).size() != 1) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    bool test_first = (test == header && body != header);
+
+    // with a profile, don't unroll loops which were never executed, or
+    // which iterated fewer than m_factor times (on average) when entered
+    long entry_count = preheader->get_count(), body_count = body->get_count();
+    if (body_count == 0 || (body_count > 0 && entry_count > 0 && body_count < long(m_factor) * entry_count)) {
+        return false;
+    }
+
+    // nor loops which are known to iterate fewer than m_factor times
+    long trip_count = m_loops.get_trip_count(loop);
+    if (trip_count >= 0 && trip_count < long(m_factor)) {
+        Statistics::get().add("unroll.short_loops");
+        return false;
+    }
+
+    Edge *back_edge = m_cfg->lookup_edge(test, test_first ? body : header);
+    if (back_edge == nullptr || back_edge->get_kind() != EDGE_BRANCH || test->get_length() < 2) {
+        return false;
+    }
+    Instruction *compare = test->get_instruction(test->get_length() - 2);
+    Instruction *branch = test->get_last();
+
+    // the instructions of an iteration are the body, followed by
+    // the instructions before the test (for a REPEAT loop)
+    std::vector<Instruction *> &iteration = uloop.body;
+    if (body != test) {
+        for (auto i = body->cbegin(); i != body->cend(); i++) {
+            if ((*i)->get_opcode() != HINS_JUMP) {
+                iteration.push_back(*i);
+            }
+        }
+    }
+    if (!test_first) {
+        for (unsigned i = 0; i + 2 < test->get_length(); i++) {
+            iteration.push_back(test->get_instruction(i));
+        }
+    }
+
+    if (compare->get_opcode() != HINS_INT_COMPARE
+            || (branch->get_opcode() != HINS_JLT && branch->get_opcode() != HINS_JLTE)) {
+        return false;
+    }
+    Operand tested = compare->get_operand(0), bound = compare->get_operand(1);
+    if (tested.get_kind() != OPERAND_VREG
+            || (bound.get_kind() != OPERAND_VREG && bound.get_kind() != OPERAND_INT_LITERAL)) {
+        return false;
+    }
+    if (iteration.empty() || iteration.size() * m_factor > MAX_UNROLLED_SIZE) {
+        return false;
+    }
+
+    // find the values of the vregs defined in the body
+    std::map<int, Value> values;
+    Value test_value = { tested.get_base_reg(), 0 };
+    for (auto i = iteration.begin(); i != iteration.end(); i++) {
+        model_instruction(*i, values);
+    }
+    if (!test_first) {
+        test_value = get_value(values, tested);
+    }
+    if (bound.get_kind() == OPERAND_VREG && values.count(bound.get_base_reg()) > 0) {
+        return false;
+    }
+
+    // the tested vreg must be an induction variable (plus a constant)
+    int iv = test_value.iv;
+    long offset = test_value.offset;
+    auto end_value = values.find(iv);
+    if (iv < 0 || end_value == values.end() || end_value->second.iv != iv) {
+        return false;
+    }
+    long step = end_value->second.offset;
+    if (step <= 0 || step > MAX_STEP || offset < 0 || offset > MAX_STEP) {
+        return false;
+    }
+
+    // N iterations remain if vrI + d <= bound (or < bound)
+    long d = long(m_factor - 1) * step + offset;
+    Operand limit;
+    if (bound.get_kind() == OPERAND_INT_LITERAL) {
+        if (bound.get_int_value() < LONG_MIN + d) {
+            return false;
+        }
+        limit = Operand(OPERAND_INT_LITERAL, bound.get_int_value() - d);
+    } else {
+        limit = Operand(OPERAND_VREG, m_next_vreg++);
+        uloop.setup.push_back(new Instruction(HINS_INT_SUB, limit, bound, Operand(OPERAND_INT_LITERAL, d)));
+    }
+
+    uloop.preheader = preheader;
+    uloop.header = header;
+    uloop.counter = Operand(OPERAND_VREG, iv);
+    uloop.limit = limit;
+    uloop.branch_opcode = branch->get_opcode();
+    find_reductions(uloop, test, bound);
+    return true;
+}
+
+void LoopUnrolling::find_reductions(UnrolledLoop &uloop, BasicBlock *test, const Operand &bound) {
+    unsigned num_accumulators = std::min(m_factor, unsigned(MAX_ACCUMULATORS));
+    if (num_accumulators < 2) {
+        return;
+    }
+
+    // the number of defs and uses of each vreg in the loop (the loop
+    // test uses the counter and bound too), and the def of each vreg
+    // defined once
+    std::map<int, unsigned> defs, uses, def_index;
+    uses[uloop.counter.get_base_reg()]++;
+    if (bound.get_kind() == OPERAND_VREG) {
+        uses[bound.get_base_reg()]++;
+    }
+    for (unsigned i = 0; i < uloop.body.size(); i++) {
+        Instruction *ins = uloop.body[i];
+        if (HighLevel::is_def(ins)) {
+            int vreg = ins->get_operand(0).get_base_reg();
+            defs[vreg]++;
+            def_index[vreg] = i;
+        }
+        for (unsigned j = 0; j < ins->get_num_operands(); j++) {
+            if (HighLevel::is_use(ins, j)) {
+                Operand operand = ins->get_operand(j);
+                uses[operand.get_base_reg()]++;
+                if (operand.has_index_reg()) {
+                    uses[operand.get_index_reg()]++;
+                }
+            }
+        }
+    }
+    const LiveVregs::LiveSet &live_out = m_live_vregs->get_fact_at_end_of_block(test);
+
+    for (unsigned i = 0; i < uloop.body.size(); i++) {
+        Instruction *ins = uloop.body[i];
+        int opcode = ins->get_opcode();
+        if (opcode != HINS_INT_ADD && opcode != HINS_INT_MUL) {
+            continue;
+        }
+        Operand dest = ins->get_operand(0), a = ins->get_operand(1), b = ins->get_operand(2);
+        if (dest.get_kind() != OPERAND_VREG || a.get_kind() != OPERAND_VREG || b.get_kind() != OPERAND_VREG
+                || a == b || defs[dest.get_base_reg()] != 1) {
+            continue;
+        }
+
+        for (unsigned operand = 1; operand <= 2; operand++) {
+            // the accumulator vrS must be defined (and used) once, by
+            // the instruction or by a chain of moves from its result
+            Operand acc = ins->get_operand(operand);
+            int vreg = acc.get_base_reg();
+            if (defs[vreg] != 1 || uses[vreg] != 1 || !is_copy_chain(uloop.body, i, def_index[vreg], defs, uses, live_out)) {
+                continue;
+            }
+
+            Reduction reduction;
+            reduction.index = i;
+            reduction.operand = operand;
+            reduction.def_index = def_index[vreg];
+            reduction.accumulator = acc;
+            reduction.accumulators.push_back(acc);
+            long identity = (opcode == HINS_INT_ADD) ? 0 : 1;
+            for (unsigned n = 1; n < num_accumulators; n++) {
+                Operand acc_n(OPERAND_VREG, m_next_vreg++);
+                uloop.setup.push_back(new Instruction(HINS_LOAD_ICONST, acc_n, Operand(OPERAND_INT_LITERAL, identity)));
+                reduction.accumulators.push_back(acc_n);
+            }
+            uloop.reductions.push_back(reduction);
+            Statistics::get().add("unroll.reductions");
+            break;
+        }
+    }
+}
+
+bool LoopUnrolling::is_copy_chain(const std::vector<Instruction *> &body, unsigned start, unsigned end,
+                                  std::map<int, unsigned> &defs, std::map<int, unsigned> &uses,
+                                  const LiveVregs::LiveSet &live_out) {
+    // follow the moves back from the def at end to the instruction at
+    // start (each vreg before the last must only be used by the next move)
+    unsigned index = end;
+    while (index != start) {
+        Instruction *mov = body[index];
+        if (index < start || mov->get_opcode() != HINS_MOV || mov->get_operand(1).get_kind() != OPERAND_VREG) {
+            return false;
+        }
+        int src = mov->get_operand(1).get_base_reg();
+        if (defs[src] != 1 || uses[src] != 1 || live_out.test(unsigned(src))) {
+            return false;
+        }
+        unsigned src_index = 0;
+        while (src_index < index && (!HighLevel::is_def(body[src_index]) || body[src_index]->get_operand(0).get_base_reg() != src)) {
+            src_index++;
+        }
+        if (src_index == index) {
+            return false;
+        }
+        index = src_index;
+    }
+    return true;
+}
+
+LoopUnrolling::Value LoopUnrolling::get_value(const std::map<int, Value> &values, const Operand &operand) {
+    Value value = { -1, 0 };
+    if (operand.get_kind() != OPERAND_VREG) {
+        return value;
+    }
+    auto i = values.find(operand.get_base_reg());
+    if (i != values.end()) {
+        return i->second;
+    }
+    // (not yet defined in the body)
+    value.iv = operand.get_base_reg();
+    return value;
+}
+
+void LoopUnrolling::model_instruction(Instruction *ins, std::map<int, Value> &values) {
+    if (!HighLevel::is_def(ins)) {
+        return;
+    }
+    Operand dest = ins->get_operand(0);
+    if (dest.get_kind() != OPERAND_VREG) {
+        return;
+    }
+
+    Value value = { -1, 0 };
+    int opcode = ins->get_opcode();
+    if (opcode == HINS_MOV) {
+        value = get_value(values, ins->get_operand(1));
+    } else if (opcode == HINS_INT_ADD || opcode == HINS_INT_SUB) {
+        Operand a = ins->get_operand(1), b = ins->get_operand(2);
+        if (opcode == HINS_INT_ADD && a.get_kind() == OPERAND_INT_LITERAL) {
+            std::swap(a, b);
+        }
+        if (b.get_kind() == OPERAND_INT_LITERAL && b.get_int_value() > -MAX_STEP && b.get_int_value() < MAX_STEP) {
+            value = get_value(values, a);
+            long c = b.get_int_value();
+            value.offset += (opcode == HINS_INT_ADD) ? c : -c;
+            if (value.offset <= -MAX_STEP || value.offset >= MAX_STEP) {
+                value.iv = -1;
+            }
+        }
+    }
+    if (value.iv < 0) {
+        value.offset = 0;
+    }
+    values[dest.get_base_reg()] = value;
+}
@@ -0,0 +1,129 @@
+#ifndef UNROLL_H
+#define UNROLL_H
+
+#include <vector>
+#include <map>
+#include "cfg.h"
+#include "ssa.h"
+#include "loops.h"
+#include "vreg_set.h"
+
+class LiveVregs;
+
+// Loop unrolling for a high-level CFG (not in SSA form).
+//
+// A loop is unrolled if it is either a WHILE loop, consisting of a header
+// containing only
+//
+//   cmpi vrI, bound
+//   jlt body              (or jlte)
+//
+// and a single body block, or a REPEAT loop, consisting of a single block
+// (or a body block followed by a block) ending in
+//
+//   cmpi vrX, bound
+//   jlt loop              (or jlte)
+//
+// where vrI is an induction variable (it is increased by a positive
+// constant step in the body, and vrX is vrI plus a non-negative constant
+// c), and bound is loop-invariant.  The test is assumed to be at the start
+// of the body (c = 0) for a WHILE loop.
+//
+// An unrolled copy of the loop, which executes N iterations of the body
+// (N being the unroll factor) for each test, is inserted on the entry edge of
+// the loop:
+//
+//   preheader:  ldci vrL, $(bound - d)          (or subi vrL, bound, $d)
+//               cmpi vrI, vrL
+//               jgte header                     (or jgt, for jlte)
+//   unrolled:   (the body, N times)
+//               cmpi vrI, vrL
+//               jlt unrolled
+//               jmp header
+//
+// where d = (N - 1) * step + c, so that the original loop only executes the
+// remaining iterations.  (A bound in a vreg is assumed to be at least
+// LONG_MIN + d, so that bound - d doesn't wrap around.)  A loop whose trip
+// count is known (see LoopForest::get_trip_count) to be less than N is left
+// alone, as the unrolled copy would never execute.
+//
+// A reduction in the body, a vreg vrS whose only def and use in the loop
+// is an instruction "addi vrS, vrS, x" (or muli) with x a vreg other than
+// vrS (or "addi vrT, vrS, x" followed by moves of vrT to vrS, where the
+// moved vregs are only used by the moves), is split into up to
+// MAX_ACCUMULATORS independent accumulators so that the body isn't a single
+// chain of dependent instructions: copy n of the body accumulates into
+// vrA(n mod A), with vrA0 = vrS and the others set to 0 (or 1) in the
+// preheader, and they are combined into vrS on the exit from the unrolled
+// loop.  (The integer operations wrap around, so this can't change the
+// result.)
+class LoopUnrolling {
+public:
+    static const unsigned MAX_FACTOR = 64;
+    // the largest number of instructions in an unrolled body
+    static const unsigned MAX_UNROLLED_SIZE = 256;
+    // the largest number of accumulators a reduction is split into
+    static const unsigned MAX_ACCUMULATORS = 4;
+
+private:
+    // a reduction in the body of a loop: the instruction at index in
+    // the body is "opcode vrT, vrS, x" (with vrS as operand operand), and
+    // the one at def_index (either the same instruction, with vrT = vrS,
+    // or the last of the moves of vrT to vrS) defines vrS
+    struct Reduction {
+        unsigned index;
+        unsigned operand;
+        unsigned def_index;
+        Operand accumulator;                 // vrS
+        std::vector<Operand> accumulators;   // vrA0 (vrS), vrA1, ...
+    };
+
+    // a loop which can be unrolled
+    struct UnrolledLoop {
+        BasicBlock *preheader;
+        BasicBlock *header;
+        std::vector<Instruction *> body;    // the instructions of one iteration (without the test)
+        Operand counter;        // vrI
+        Operand limit;          // vrI must be less than (or equal to) limit for N iterations to remain
+        int branch_opcode;
+        std::vector<Instruction *> setup;   // (without the compare and branch)
+        std::vector<Reduction> reductions;
+    };
+
+    // the value of a vreg, as the value of vreg iv at the start of the
+    // body plus an offset (iv is -1 if the value is unknown)
+    struct Value {
+        int iv;
+        long offset;
+    };
+
+    ControlFlowGraph *m_cfg;
+    DominatorTree *m_own_domtree;
+    const DominatorTree &m_domtree;
+    LoopForest *m_own_loops;
+    const LoopForest &m_loops;
+    LiveVregs *m_own_live_vregs;
+    const LiveVregs *m_live_vregs;
+    unsigned m_factor;
+    int m_next_vreg;
+    std::vector<UnrolledLoop> m_unrolled_loops;
+
+public:
+    LoopUnrolling(ControlFlowGraph *cfg, unsigned factor, const DominatorTree *domtree = nullptr,
+                  const LoopForest *loops = nullptr, const LiveVregs *live_vregs = nullptr);
+    ~LoopUnrolling();
+
+    ControlFlowGraph *get_orig_cfg() { return m_cfg; }
+    ControlFlowGraph *transform_cfg();
+
+private:
+    bool analyze_loop(const LoopForest::Loop &loop, UnrolledLoop &uloop);
+    void find_reductions(UnrolledLoop &uloop, BasicBlock *test, const Operand &bound);
+    static bool is_copy_chain(const std::vector<Instruction *> &body, unsigned start, unsigned end,
+                              std::map<int, unsigned> &defs, std::map<int, unsigned> &uses,
+                              const VregSet &live_out);
+    static Value get_value(const std::map<int, Value> &values, const Operand &operand);
+    static void model_instruction(Instruction *ins, std::map<int, Value> &values);
+};
+
+#endif // UNROLL_H
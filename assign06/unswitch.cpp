@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <cassert>
+#include "cfg.h"
+#include "highlevel.h"
+#include "ssa.h"
+#include "stats.h"
+#include "unswitch.h"
+
+namespace {
+    bool is_conditional_branch(int opcode) {
+        return opcode >= HINS_JE && opcode <= HINS_JGTE;
+    }
+}
+
+LoopUnswitching::LoopUnswitching(ControlFlowGraph *cfg, const DominatorTree *domtree, const LoopForest *loops)
+        : m_cfg(cfg)
+        , m_own_domtree(domtree != nullptr ? nullptr : new DominatorTree(cfg))
+        , m_domtree(domtree != nullptr ? *domtree : *m_own_domtree)
+        , m_own_loops(loops != nullptr ? nullptr : new LoopForest(cfg, m_domtree))
+        , m_loops(loops != nullptr ? *loops : *m_own_loops) {
+    // (the outermost loops first, so that a branch is unswitched out of
+    // all of the loops it is invariant in)
+    std::vector<unsigned> order;
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](unsigned a, unsigned b) {
+        return m_loops.get_loop(a).depth < m_loops.get_loop(b).depth;
+    });
+
+    std::set<BasicBlock *> unswitched_blocks;
+    unsigned growth = 0;
+    for (auto i = order.begin(); i != order.end(); i++) {
+        const LoopForest::Loop &loop = m_loops.get_loop(*i);
+        unsigned size = 0;
+        bool overlaps = false;
+        for (auto j = loop.blocks.begin(); j != loop.blocks.end(); j++) {
+            size += (*j)->get_length();
+            overlaps = overlaps || unswitched_blocks.count(*j) > 0;
+        }
+        if (overlaps || size > MAX_LOOP_SIZE || growth + size > MAX_GROWTH) {
+            continue;
+        }
+        BasicBlock *branch_bb = find_branch(loop);
+        if (branch_bb == nullptr) {
+            continue;
+        }
+
+        UnswitchedLoop uloop;
+        uloop.loop = &loop;
+        uloop.branch_bb = branch_bb;
+        const ControlFlowGraph::EdgeList &edges = m_cfg->get_outgoing_edges(branch_bb);
+        for (auto j = edges.cbegin(); j != edges.cend(); j++) {
+            if ((*j)->get_kind() == EDGE_FALLTHROUGH) {
+                find_reachable(uloop, (*j)->get_target(), uloop.taken_blocks);
+            } else {
+                find_reachable(uloop, (*j)->get_target(), uloop.not_taken_blocks);
+            }
+        }
+        m_unswitched.push_back(uloop);
+        unswitched_blocks.insert(loop.blocks.begin(), loop.blocks.end());
+        growth += size;
+        Statistics::get().add("unswitch.loops");
+    }
+}
+
+LoopUnswitching::~LoopUnswitching() {
+    delete m_own_loops;
+    delete m_own_domtree;
+}
+
+ControlFlowGraph *LoopUnswitching::transform_cfg() {
+    ControlFlowGraph *result = new ControlFlowGraph();
+
+    // the unswitched loop (if any) containing each block, or entered from
+    // it, and the blocks which need a label to be jumped to
+    std::map<BasicBlock *, const UnswitchedLoop *> loop_of, preheaders;
+    std::set<BasicBlock *> needs_label;
+    for (auto i = m_unswitched.begin(); i != m_unswitched.end(); i++) {
+        const LoopForest::Loop &loop = *i->loop;
+        for (auto j = loop.blocks.begin(); j != loop.blocks.end(); j++) {
+            loop_of[*j] = &*i;
+        }
+        preheaders[loop.preheader] = &*i;
+        needs_label.insert(loop.header);
+        for (auto j = loop.exits.begin(); j != loop.exits.end(); j++) {
+            needs_label.insert((*j)->get_target());
+        }
+    }
+
+    // the blocks of the original CFG (the loops with their branches taken)
+    std::map<BasicBlock *, BasicBlock *> block_map;
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        auto l = loop_of.find(orig);
+        if (l != loop_of.end() && l->second->taken_blocks.count(orig) == 0) {
+            continue;
+        }
+        std::string label = orig->get_label();
+        if (!orig->has_label() && needs_label.count(orig) > 0) {
+            label = StringTable::labels().new_label(".Lunswitch");
+        }
+        BasicBlock *result_bb = result->create_basic_block(orig->get_kind(), label);
+        block_map[orig] = result_bb;
+        result_bb->set_count(orig->get_count());
+        unsigned len = orig->get_length();
+        if (l != loop_of.end() && l->second->branch_bb == orig) {
+            len -= 2;
+        }
+        for (unsigned j = 0; j < len; j++) {
+            result_bb->add_instruction(orig->get_instruction(j)->duplicate());
+        }
+        if (len < orig->get_length()) {
+            Operand target = orig->get_last()->get_operand(0);
+            result_bb->add_instruction(new Instruction(HINS_JUMP, target));
+        }
+    }
+
+    // the copies of the loops with their branches not taken
+    std::map<BasicBlock *, BasicBlock *> copy_map;
+    for (auto i = m_unswitched.begin(); i != m_unswitched.end(); i++) {
+        std::map<std::string, std::string> labels;
+        for (auto j = m_cfg->bb_begin(); j != m_cfg->bb_end(); j++) {
+            if (i->not_taken_blocks.count(*j) > 0 && (*j)->has_label()) {
+                labels[(*j)->get_label()] = StringTable::labels().new_label(".Lunswitch");
+            }
+        }
+        for (auto j = m_cfg->bb_begin(); j != m_cfg->bb_end(); j++) {
+            BasicBlock *orig = *j;
+            if (i->not_taken_blocks.count(orig) == 0) {
+                continue;
+            }
+            // (the copy of the header is jumped to from the test)
+            std::string label;
+            if (orig->has_label()) {
+                label = labels[orig->get_label()];
+            } else if (orig == i->loop->header) {
+                label = StringTable::labels().new_label(".Lunswitch");
+            }
+            BasicBlock *copy = result->create_basic_block(BASICBLOCK_INTERIOR, label);
+            copy_map[orig] = copy;
+            copy->set_count(orig->get_count());
+            unsigned len = orig->get_length() - (orig == i->branch_bb ? 2 : 0);
+            for (unsigned k = 0; k < len; k++) {
+                Instruction *ins = orig->get_instruction(k)->duplicate();
+                for (unsigned m = 0; m < ins->get_num_operands(); m++) {
+                    if ((*ins)[m].get_kind() == OPERAND_LABEL && labels.count((*ins)[m].get_target_label()) > 0) {
+                        (*ins)[m] = Operand(labels[(*ins)[m].get_target_label()]);
+                    }
+                }
+                copy->add_instruction(ins);
+            }
+        }
+    }
+
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        if (block_map.count(orig) == 0) {
+            continue;
+        }
+        auto l = loop_of.find(orig);
+        auto p = preheaders.find(orig);
+        const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+            Edge *orig_edge = *j;
+            if (l != loop_of.end() && l->second->branch_bb == orig && orig_edge->get_kind() == EDGE_FALLTHROUGH) {
+                continue;
+            }
+            BasicBlock *source = block_map[orig];
+            assert(block_map.count(orig_edge->get_target()) > 0);
+            BasicBlock *target = block_map[orig_edge->get_target()];
+            if (p == preheaders.end() || orig_edge->get_target() != p->second->loop->header) {
+                result->create_edge(source, target, orig_edge->get_kind());
+                continue;
+            }
+
+            // test the branch's condition on the edge from the preheader,
+            // jumping to the loop with it taken
+            const UnswitchedLoop &uloop = *p->second;
+            BasicBlock *test_bb;
+            if (orig_edge->get_kind() == EDGE_BRANCH) {
+                std::string label = StringTable::labels().new_label(".Lunswitch");
+                test_bb = result->create_basic_block(BASICBLOCK_INTERIOR, label);
+                Instruction *jump = source->get_last();
+                assert(jump->get_opcode() == HINS_JUMP);
+                (*jump)[0] = Operand(label);
+            } else {
+                test_bb = result->create_basic_block(BASICBLOCK_INTERIOR);
+            }
+            test_bb->set_count(orig->get_count());
+            unsigned len = uloop.branch_bb->get_length();
+            test_bb->add_instruction(uloop.branch_bb->get_instruction(len - 2)->duplicate());
+            int opcode = uloop.branch_bb->get_last()->get_opcode();
+            test_bb->add_instruction(new Instruction(opcode, Operand(target->get_label())));
+
+            // (either header may already be fallen through to, by a latch)
+            BasicBlock *copy_header = copy_map[orig_edge->get_target()];
+            BasicBlock *jump_bb = result->create_basic_block(BASICBLOCK_INTERIOR);
+            jump_bb->set_count(orig->get_count());
+            jump_bb->add_instruction(new Instruction(HINS_JUMP, Operand(copy_header->get_label())));
+
+            result->create_edge(source, test_bb, orig_edge->get_kind());
+            result->create_edge(test_bb, target, EDGE_BRANCH);
+            result->create_edge(test_bb, jump_bb, EDGE_FALLTHROUGH);
+            result->create_edge(jump_bb, copy_header, EDGE_BRANCH);
+        }
+    }
+
+    for (auto i = m_unswitched.begin(); i != m_unswitched.end(); i++) {
+        for (auto j = m_cfg->bb_begin(); j != m_cfg->bb_end(); j++) {
+            BasicBlock *orig = *j;
+            if (i->not_taken_blocks.count(orig) == 0) {
+                continue;
+            }
+            const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(orig);
+            for (auto k = outgoing_edges.cbegin(); k != outgoing_edges.cend(); k++) {
+                Edge *orig_edge = *k;
+                BasicBlock *source = copy_map[orig];
+                if (orig == i->branch_bb && orig_edge->get_kind() == EDGE_BRANCH) {
+                    continue;
+                }
+                if (i->loop->contains(orig_edge->get_target())) {
+                    result->create_edge(source, copy_map[orig_edge->get_target()], orig_edge->get_kind());
+                    continue;
+                }
+
+                // (the original block falls through to the exit)
+                BasicBlock *target = block_map[orig_edge->get_target()];
+                if (orig_edge->get_kind() == EDGE_FALLTHROUGH) {
+                    BasicBlock *jump_bb = result->create_basic_block(BASICBLOCK_INTERIOR);
+                    jump_bb->set_count(orig->get_count());
+                    jump_bb->add_instruction(new Instruction(HINS_JUMP, Operand(target->get_label())));
+                    result->create_edge(source, jump_bb, EDGE_FALLTHROUGH);
+                    result->create_edge(jump_bb, target, EDGE_BRANCH);
+                } else {
+                    result->create_edge(source, target, orig_edge->get_kind());
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+BasicBlock *LoopUnswitching::find_branch(const LoopForest::Loop &loop) const {
+    if (loop.preheader == nullptr) {
+        return nullptr;
+    }
+    for (auto i = loop.exits.begin(); i != loop.exits.end(); i++) {
+        if ((*i)->get_target() == m_cfg->get_exit_block()) {
+            return nullptr;
+        }
+    }
+
+    // the vregs defined in the loop
+    std::set<int> defs;
+    for (auto i = loop.blocks.begin(); i != loop.blocks.end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            if (HighLevel::is_def(*j) && (*j)->get_operand(0).get_kind() == OPERAND_VREG) {
+                defs.insert((*j)->get_operand(0).get_base_reg());
+            }
+        }
+    }
+
+    // (the first such branch in the order of the blocks)
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *bb = *i;
+        unsigned len = bb->get_length();
+        if (!loop.contains(bb) || len < 2 || !is_conditional_branch(bb->get_last()->get_opcode())) {
+            continue;
+        }
+        Instruction *compare = bb->get_instruction(len - 2);
+        if (compare->get_opcode() != HINS_INT_COMPARE) {
+            continue;
+        }
+        bool is_invariant = true;
+        for (unsigned j = 0; j < compare->get_num_operands(); j++) {
+            const Operand &operand = compare->get_operand(j);
+            if (operand.get_kind() != OPERAND_INT_LITERAL
+                    && (operand.get_kind() != OPERAND_VREG || defs.count(operand.get_base_reg()) > 0)) {
+                is_invariant = false;
+            }
+        }
+        const ControlFlowGraph::EdgeList &edges = m_cfg->get_outgoing_edges(bb);
+        for (auto j = edges.cbegin(); j != edges.cend(); j++) {
+            is_invariant = is_invariant && loop.contains((*j)->get_target());
+        }
+        if (is_invariant && edges.size() == 2) {
+            return bb;
+        }
+    }
+    return nullptr;
+}
+
+void LoopUnswitching::find_reachable(const UnswitchedLoop &uloop, BasicBlock *removed,
+                                     std::set<BasicBlock *> &reachable) const {
+    std::vector<BasicBlock *> worklist;
+    worklist.push_back(uloop.loop->header);
+    reachable.insert(uloop.loop->header);
+    while (!worklist.empty()) {
+        BasicBlock *bb = worklist.back();
+        worklist.pop_back();
+        const ControlFlowGraph::EdgeList &edges = m_cfg->get_outgoing_edges(bb);
+        for (auto i = edges.cbegin(); i != edges.cend(); i++) {
+            BasicBlock *target = (*i)->get_target();
+            if ((bb == uloop.branch_bb && target == removed) || !uloop.loop->contains(target)
+                    || reachable.count(target) > 0) {
+                continue;
+            }
+            reachable.insert(target);
+            worklist.push_back(target);
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef UNSWITCH_H
+#define UNSWITCH_H
+
+#include <vector>
+#include <map>
+#include <set>
+#include "cfg.h"
+#include "loops.h"
+
+// Loop unswitching for a high-level CFG (not in SSA form): a loop
+// containing a conditional branch whose outcome can't change while the
+// loop runs, such as
+//
+//   WHILE i < N DO
+//     IF flag = 1 THEN s := s + a[i]; ELSE s := s - a[i]; END;
+//     i := i + 1;
+//   END;
+//
+// is replaced by two copies of itself, each with one of the branch's
+// outcomes, and the test moves in front of them:
+//
+//   test:  cmpi vrF, $1
+//          jne header             (the branch's own condition)
+//   copy:  (the loop, falling through at the branch)
+//   header:
+//          (the loop, jumping to the branch's target at the branch)
+//
+// The branch must be the conditional branch ending a block of the loop,
+// preceded by its comparison, whose operands are constants or vregs
+// defined outside the loop, and must not leave the loop (since then it is
+// the loop's test).  The loop must have a preheader, and it can't exit to
+// the CFG's exit block.  The blocks of each copy which the branch's other
+// outcome made unreachable are removed.  A block of the copy which fell
+// through to a block outside the loop jumps to it instead.
+//
+// Only loops of at most MAX_LOOP_SIZE instructions are unswitched, and
+// while the CFG has grown by less than MAX_GROWTH instructions (the loops
+// are considered from the outermost, each only if it doesn't overlap a loop
+// already unswitched).  Unswitching again, or running the pass several
+// times, unswitches the loop's other invariant branches.
+class LoopUnswitching {
+public:
+    static const unsigned MAX_LOOP_SIZE = 128;
+    static const unsigned MAX_GROWTH = 512;
+
+private:
+    // a loop to unswitch, and the block ending with the branch
+    struct UnswitchedLoop {
+        const LoopForest::Loop *loop;
+        BasicBlock *branch_bb;
+        // the blocks of each copy (of the loop with the branch taken, and
+        // the one with it not taken) which are still reachable
+        std::set<BasicBlock *> taken_blocks;
+        std::set<BasicBlock *> not_taken_blocks;
+    };
+
+    ControlFlowGraph *m_cfg;
+    DominatorTree *m_own_domtree;
+    const DominatorTree &m_domtree;
+    LoopForest *m_own_loops;
+    const LoopForest &m_loops;
+    std::vector<UnswitchedLoop> m_unswitched;
+
+    // disallow copy ctor and assignment operator
+    LoopUnswitching(const LoopUnswitching &);
+    LoopUnswitching &operator=(const LoopUnswitching &);
+
+public:
+    // (the dominator tree and loops are computed if they aren't given)
+    LoopUnswitching(ControlFlowGraph *cfg, const DominatorTree *domtree = nullptr, const LoopForest *loops = nullptr);
+    ~LoopUnswitching();
+
+    ControlFlowGraph *transform_cfg();
+
+private:
+    BasicBlock *find_branch(const LoopForest::Loop &loop) const;
+    // find the blocks of a copy of the loop reachable from its header, if
+    // the edge from the branch's block to removed isn't followed
+    void find_reachable(const UnswitchedLoop &uloop, BasicBlock *removed, std::set<BasicBlock *> &reachable) const;
+};
+
+#endif // UNSWITCH_H
@@ -20,15 +20,29 @@ char *xstrdup(const char *s) {
   return buf;
 }
 
+static _Thread_local void (*s_err_handler)(const char *msg);
+
 void err_fatal(const char *fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  vfprintf(stderr, fmt, args);
+  verr_fatal(fmt, args);
   va_end(args);
-  exit(1);
 }
 
 void verr_fatal(const char *fmt, va_list args) {
+  if (s_err_handler) {
+    char msg[4096];
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    s_err_handler(msg);
+  }
   vfprintf(stderr, fmt, args);
   exit(1);
 }
+
+void err_set_handler(void (*handler)(const char *msg)) {
+  s_err_handler = handler;
+}
+
+void (*err_get_handler(void))(const char *msg) {
+  return s_err_handler;
+}
@@ -26,6 +26,15 @@ char *xstrdup(const char *s);
 void err_fatal(const char *fmt, ...) GCC_ATTR(__attribute__((format(printf, 1, 2))));
 void verr_fatal(const char *fmt, va_list args);
 
+/* Set the function called with the message of a fatal error on the current
+   thread, instead of printing it and exiting (null for the default).  The
+   handler must not return: the compile server's throws an exception, so
+   the C code is compiled with -fexceptions. */
+void err_set_handler(void (*handler)(const char *msg));
+
+/* The handler set on the current thread (null if none). */
+void (*err_get_handler(void))(const char *msg);
+
 #define NOT_IMPLEMENTED(what) \
 err_fatal("%s:%d: Not implemented: %s\n", __FILE__, __LINE__, what)
 
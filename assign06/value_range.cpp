@@ -0,0 +1,530 @@
+#include <cassert>
+#include <climits>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "ssa.h"
+#include "const_prop.h"
+#include "stats.h"
+#include "value_range.h"
+
+namespace {
+    typedef ValueRangeAnalysis::Range Range;
+
+    bool is_vreg(const Operand &operand, int vreg) {
+        return operand.get_kind() == OPERAND_VREG && operand.get_base_reg() == vreg;
+    }
+
+    bool is_literal(const Operand &operand) {
+        return operand.get_kind() == OPERAND_INT_LITERAL;
+    }
+
+    Range join(const Range &a, const Range &b) {
+        return Range{ std::min(a.lo, b.lo), std::max(a.hi, b.hi) };
+    }
+
+    // the conditional branch opcode testing "r op l" when another tests "l op r"
+    int get_swapped_branch(int opcode) {
+        switch (opcode) {
+            case HINS_JLT:  return HINS_JGT;
+            case HINS_JLTE: return HINS_JGTE;
+            case HINS_JGT:  return HINS_JLT;
+            case HINS_JGTE: return HINS_JLTE;
+            default:        return opcode;
+        }
+    }
+
+    // the smallest range containing op(x, y) for x in a and y in b, for an
+    // operation which is monotonic in each operand (so that its extremes
+    // are at the corners), or the full range if it may overflow
+    template<typename Fn>
+    Range get_corners(const Range &a, const Range &b, Fn op) {
+        long corners[4];
+        if (op(a.lo, b.lo, corners[0]) || op(a.lo, b.hi, corners[1])
+                || op(a.hi, b.lo, corners[2]) || op(a.hi, b.hi, corners[3])) {
+            return ValueRangeAnalysis::get_full_range();
+        }
+        return Range{ *std::min_element(corners, corners + 4), *std::max_element(corners, corners + 4) };
+    }
+
+    // the outcomes of a branch (or conditional move) for a comparison whose
+    // first operand is less than, equal to, or greater than its second
+    const long s_relations[3][2] = { { 0, 1 }, { 0, 0 }, { 1, 0 } };
+}
+
+////////////////////////////////////////////////////////////////////////
+// ValueRangeAnalysis implementation
+////////////////////////////////////////////////////////////////////////
+
+ValueRangeAnalysis::ValueRangeAnalysis(ControlFlowGraph *cfg, const DominatorTree &domtree)
+        : m_cfg(cfg)
+        , m_domtree(domtree) {
+    unsigned num_vregs = unsigned(HighLevel::get_num_vregs(cfg));
+    m_ranges.assign(num_vregs, get_full_range());
+    m_known.assign(num_vregs, false);
+    m_changes.assign(num_vregs, 0);
+    m_conditions.resize(cfg->get_num_blocks());
+
+    count_defs();
+    find_conditions();
+    analyze();
+}
+
+ValueRangeAnalysis::~ValueRangeAnalysis() {
+}
+
+ValueRangeAnalysis::Range ValueRangeAnalysis::get_full_range() {
+    return Range{ LONG_MIN, LONG_MAX };
+}
+
+ValueRangeAnalysis::Range ValueRangeAnalysis::get_range(int vreg) const {
+    if (vreg < 0 || unsigned(vreg) >= m_ranges.size() || !m_known[vreg]) {
+        return get_full_range();
+    }
+    return m_ranges[vreg];
+}
+
+ValueRangeAnalysis::Range ValueRangeAnalysis::get_range(BasicBlock *bb, const Operand &operand) const {
+    return get_range(operand, get_conditions(bb), nullptr);
+}
+
+bool ValueRangeAnalysis::get_edge_condition(BasicBlock *pred, BasicBlock *succ, Condition &condition) const {
+    // the high-level code generator always emits the comparison
+    // immediately before the conditional branch
+    unsigned num_ins = pred->get_length();
+    if (num_ins < 2) {
+        return false;
+    }
+    Instruction *branch = pred->get_instruction(num_ins - 1);
+    Instruction *compare = pred->get_instruction(num_ins - 2);
+    if (!HighLevel::has_flags(branch->get_opcode(), HOP_BRANCH) || compare->get_opcode() != HINS_INT_COMPARE) {
+        return false;
+    }
+    const Operand &left = compare->get_operand(0), &right = compare->get_operand(1);
+    for (unsigned i = 0; i < 2; i++) {
+        const Operand &operand = compare->get_operand(i);
+        if (operand.get_kind() == OPERAND_VREG ? m_num_defs[operand.get_base_reg()] > 1 : !is_literal(operand)) {
+            return false;
+        }
+    }
+
+    BasicBlock *taken = nullptr, *not_taken = nullptr;
+    const ControlFlowGraph::EdgeList &edges = m_cfg->get_outgoing_edges(pred);
+    for (auto i = edges.begin(); i != edges.end(); i++) {
+        ((*i)->get_kind() == EDGE_BRANCH ? taken : not_taken) = (*i)->get_target();
+    }
+    if (taken == nullptr || not_taken == nullptr || taken == not_taken) {
+        return false;
+    }
+    if (succ == taken) {
+        condition = Condition{ branch->get_opcode(), left, right };
+    } else if (succ == not_taken) {
+        condition = Condition{ HighLevel::get_inverted_branch(branch->get_opcode()), left, right };
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void ValueRangeAnalysis::count_defs() {
+    m_num_defs.assign(m_ranges.size(), 0);
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+            if (HighLevel::is_def(*j) && (*j)->get_operand(0).get_kind() == OPERAND_VREG) {
+                m_num_defs[(*j)->get_operand(0).get_base_reg()]++;
+            }
+        }
+    }
+}
+
+void ValueRangeAnalysis::find_conditions() {
+    // a block has the conditions of its immediate dominator, and the
+    // condition of the branch to it, if that is its only predecessor
+    const std::vector<BasicBlock *> &rpo = m_domtree.get_reverse_postorder();
+    for (auto i = rpo.begin(); i != rpo.end(); i++) {
+        BasicBlock *bb = *i;
+        BasicBlock *idom = m_domtree.get_idom(bb);
+        if (idom == nullptr) {
+            continue;
+        }
+        std::vector<Condition> &conditions = m_conditions[bb->get_id()];
+        conditions = m_conditions[idom->get_id()];
+
+        std::vector<BasicBlock *> preds = SSA::get_predecessors(m_cfg, bb);
+        Condition condition;
+        if (preds.size() == 1 && get_edge_condition(preds[0], bb, condition)) {
+            conditions.push_back(condition);
+        }
+    }
+}
+
+void ValueRangeAnalysis::analyze() {
+    // a vreg without a def (such as a variable read before it's assigned)
+    // may hold anything
+    for (unsigned i = 0; i < m_ranges.size(); i++) {
+        m_known[i] = m_num_defs[i] == 0;
+    }
+
+    // the ranges only grow, and each one is widened once it has changed
+    // WIDEN_AFTER times, so this terminates
+    const std::vector<BasicBlock *> &rpo = m_domtree.get_reverse_postorder();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto i = rpo.begin(); i != rpo.end(); i++) {
+            for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+                Instruction *ins = *j;
+                if (!HighLevel::is_def(ins) || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+                    continue;
+                }
+                Range range;
+                if (!evaluate(*i, ins, range)) {
+                    continue;
+                }
+
+                int vreg = ins->get_operand(0).get_base_reg();
+                if (!m_known[vreg]) {
+                    m_ranges[vreg] = range;
+                    m_known[vreg] = true;
+                    changed = true;
+                    continue;
+                }
+                Range &old = m_ranges[vreg];
+                Range joined = join(old, range);
+                if (joined.lo == old.lo && joined.hi == old.hi) {
+                    continue;
+                }
+                if (++m_changes[vreg] > WIDEN_AFTER) {
+                    if (joined.lo < old.lo) {
+                        joined.lo = LONG_MIN;
+                    }
+                    if (joined.hi > old.hi) {
+                        joined.hi = LONG_MAX;
+                    }
+                }
+                old = joined;
+                changed = true;
+            }
+        }
+    }
+}
+
+bool ValueRangeAnalysis::evaluate(BasicBlock *bb, Instruction *ins, Range &result) const {
+    int opcode = ins->get_opcode();
+
+    if (opcode == HINS_PHI) {
+        // each operand is narrowed by the conditions holding at the end
+        // of its predecessor, and on the edge to the phi's block (the
+        // operands not known yet are skipped, so that a loop's induction
+        // variable starts out with its initial value)
+        std::vector<BasicBlock *> preds = SSA::get_predecessors(m_cfg, bb);
+        bool found = false;
+        for (unsigned i = 0; i < preds.size(); i++) {
+            const Operand &operand = ins->get_operand(i + 1);
+            if (!m_domtree.is_reachable(preds[i]) || !is_known(operand)) {
+                continue;
+            }
+            Condition edge;
+            bool has_edge = get_edge_condition(preds[i], bb, edge);
+            Range range = get_range(operand, get_conditions(preds[i]), has_edge ? &edge : nullptr);
+            result = found ? join(result, range) : range;
+            found = true;
+        }
+        return found;
+    }
+
+    for (unsigned i = 1; i < ins->get_num_operands(); i++) {
+        if (!is_known(ins->get_operand(i))) {
+            return false;
+        }
+    }
+    auto operand_range = [&](unsigned i) { return get_range(bb, ins->get_operand(i)); };
+
+    switch (opcode) {
+        case HINS_LOAD_ICONST:
+        case HINS_MOV:
+            result = operand_range(1);
+            return true;
+        case HINS_INT_ADD:
+            result = get_corners(operand_range(1), operand_range(2),
+                                 [](long a, long b, long &r) { return __builtin_add_overflow(a, b, &r); });
+            return true;
+        case HINS_INT_SUB:
+            result = get_corners(operand_range(1), operand_range(2),
+                                 [](long a, long b, long &r) { return __builtin_sub_overflow(a, b, &r); });
+            return true;
+        case HINS_INT_MUL:
+            result = get_corners(operand_range(1), operand_range(2),
+                                 [](long a, long b, long &r) { return __builtin_mul_overflow(a, b, &r); });
+            return true;
+        case HINS_INT_NEGATE: {
+            Range a = operand_range(1);
+            result = (a.lo == LONG_MIN) ? get_full_range() : Range{ -a.hi, -a.lo };
+            return true;
+        }
+        case HINS_INT_DIV:
+        case HINS_UINT_DIV: {
+            // the quotient is monotonic in each operand while the divisor
+            // doesn't change sign (LONG_MIN / -1 overflows)
+            Range a = operand_range(1), b = operand_range(2);
+            bool is_unsigned_ok = a.lo >= 0 && b.lo >= 1;
+            if (opcode == HINS_UINT_DIV ? is_unsigned_ok : (b.lo >= 1 || (b.hi <= -1 && a.lo != LONG_MIN))) {
+                result = get_corners(a, b, [](long x, long y, long &r) { r = x / y; return false; });
+            } else {
+                result = get_full_range();
+            }
+            return true;
+        }
+        case HINS_INT_MOD:
+        case HINS_UINT_MOD: {
+            // the remainder has the sign of the dividend, and is smaller
+            // in magnitude than the divisor (and no larger than the dividend)
+            Range a = operand_range(1), b = operand_range(2);
+            if (opcode == HINS_UINT_MOD && (a.lo < 0 || b.lo < 1)) {
+                result = get_full_range();
+                return true;
+            }
+            long max = (b.lo == LONG_MIN) ? LONG_MAX : std::max(std::max(b.hi < 0 ? -b.hi : b.hi, -b.lo), 1L) - 1;
+            if (a.lo >= 0) {
+                result = Range{ 0, std::min(a.hi, max) };
+            } else if (a.hi <= 0) {
+                result = Range{ std::max(a.lo, -max), 0 };
+            } else {
+                result = Range{ -max, max };
+            }
+            return true;
+        }
+        case HINS_CMOVE:
+        case HINS_CMOVNE:
+        case HINS_CMOVLT:
+        case HINS_CMOVLTE:
+        case HINS_CMOVGT:
+        case HINS_CMOVGTE:
+            result = join(operand_range(1), operand_range(2));
+            return true;
+        case HINS_LOAD_CHAR:
+            result = Range{ 0, 255 };
+            return true;
+        default:
+            result = get_full_range();
+            return true;
+    }
+}
+
+ValueRangeAnalysis::Range ValueRangeAnalysis::get_range(const Operand &operand, const std::vector<Condition> &conditions,
+                                                        const Condition *edge_condition) const {
+    if (is_literal(operand)) {
+        long value = operand.get_int_value();
+        return Range{ value, value };
+    }
+    if (operand.get_kind() != OPERAND_VREG) {
+        return get_full_range();
+    }
+
+    // narrow the vreg's range by each condition on it, comparing it with
+    // the other operand's range (not narrowed in turn)
+    int vreg = operand.get_base_reg();
+    Range range = get_range(vreg);
+    for (unsigned i = 0; i <= conditions.size(); i++) {
+        const Condition *condition = (i < conditions.size()) ? &conditions[i] : edge_condition;
+        if (condition == nullptr) {
+            continue;
+        }
+        if (is_vreg(condition->left, vreg) && !is_vreg(condition->right, vreg)) {
+            narrow(range, condition->opcode, get_range(condition->right, std::vector<Condition>(), nullptr));
+        } else if (is_vreg(condition->right, vreg) && !is_vreg(condition->left, vreg)) {
+            narrow(range, get_swapped_branch(condition->opcode), get_range(condition->left, std::vector<Condition>(), nullptr));
+        }
+    }
+    return range;
+}
+
+bool ValueRangeAnalysis::is_known(const Operand &operand) const {
+    if (operand.get_kind() != OPERAND_VREG) {
+        return true;
+    }
+    int vreg = operand.get_base_reg();
+    return unsigned(vreg) >= m_known.size() || m_known[vreg];
+}
+
+void ValueRangeAnalysis::narrow(Range &range, int opcode, const Range &other) {
+    Range narrowed = range;
+    switch (opcode) {
+        case HINS_JE:
+            narrowed.lo = std::max(range.lo, other.lo);
+            narrowed.hi = std::min(range.hi, other.hi);
+            break;
+        case HINS_JNE:
+            // only an endpoint equal to a constant can be removed
+            if (other.is_constant() && range.lo < range.hi) {
+                if (range.lo == other.lo) {
+                    narrowed.lo++;
+                } else if (range.hi == other.lo) {
+                    narrowed.hi--;
+                }
+            }
+            break;
+        case HINS_JLT:
+            if (other.hi != LONG_MIN) {
+                narrowed.hi = std::min(range.hi, other.hi - 1);
+            }
+            break;
+        case HINS_JLTE:
+            narrowed.hi = std::min(range.hi, other.hi);
+            break;
+        case HINS_JGT:
+            if (other.lo != LONG_MAX) {
+                narrowed.lo = std::max(range.lo, other.lo + 1);
+            }
+            break;
+        case HINS_JGTE:
+            narrowed.lo = std::max(range.lo, other.lo);
+            break;
+        default:
+            assert(false);
+    }
+    // (an empty range means the condition can't hold, in code which is
+    // never executed)
+    if (narrowed.lo <= narrowed.hi) {
+        range = narrowed;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// ValueRangeSimplification implementation
+////////////////////////////////////////////////////////////////////////
+
+ValueRangeSimplification::ValueRangeSimplification(ControlFlowGraph *cfg, const ValueRangeAnalysis &ranges)
+        : ControlFlowGraphTransform(cfg)
+        , m_ranges(ranges)
+        , m_num_folded(0) {
+}
+
+ValueRangeSimplification::~ValueRangeSimplification() {
+}
+
+InstructionSequence *ValueRangeSimplification::transform_basic_block(InstructionSequence *iseq) {
+    BasicBlock *bb = to_basic_block(iseq);
+    auto out = new InstructionSequence();
+
+    // the constants compared instead of the last comparison's operands
+    bool is_folded = false;
+    long left = 0, right = 0;
+    for (unsigned i = 0; i < bb->get_length(); i++) {
+        Instruction *ins = bb->get_instruction(i);
+        int opcode = ins->get_opcode();
+        Instruction *replacement = nullptr;
+
+        if (opcode == HINS_INT_COMPARE) {
+            is_folded = fold_comparison(bb, i, left, right);
+            if (is_folded) {
+                m_num_folded++;
+                Statistics::get().add("ranges.comparisons");
+                // (the comparison is only needed for a branch, since the
+                // conditional moves become moves)
+                bool has_branch = false;
+                for (unsigned j = i + 1; j < bb->get_length(); j++) {
+                    int user = bb->get_instruction(j)->get_opcode();
+                    if (user == HINS_INT_COMPARE) {
+                        break;
+                    }
+                    has_branch = has_branch || HighLevel::has_flags(user, HOP_BRANCH);
+                }
+                if (!has_branch) {
+                    continue;
+                }
+                replacement = new Instruction(HINS_INT_COMPARE, Operand(OPERAND_INT_LITERAL, left),
+                                              Operand(OPERAND_INT_LITERAL, right));
+            }
+        } else if (opcode >= HINS_CMOVE && opcode <= HINS_CMOVGTE && is_folded) {
+            bool taken = ConstantPropagation::eval_branch(opcode - HINS_CMOVE + HINS_JE, left, right);
+            replacement = new Instruction(HINS_MOV, ins->get_operand(0), ins->get_operand(taken ? 1 : 2));
+        } else {
+            replacement = simplify_division(bb, ins);
+        }
+
+        if (replacement != nullptr) {
+            replacement->copy_comment(ins);
+            out->add_instruction(replacement);
+        } else {
+            out->add_instruction(ins->duplicate());
+        }
+    }
+    return out;
+}
+
+Instruction *ValueRangeSimplification::simplify_division(BasicBlock *bb, Instruction *ins) const {
+    int opcode = ins->get_opcode();
+    if (opcode != HINS_INT_DIV && opcode != HINS_INT_MOD) {
+        return nullptr;
+    }
+    const Operand &dividend = ins->get_operand(1), &divisor = ins->get_operand(2);
+    Range a = m_ranges.get_range(bb, dividend), b = m_ranges.get_range(bb, divisor);
+    if (a.lo < 0 || b.lo < 1) {
+        return nullptr;
+    }
+
+    const Operand &dest = ins->get_operand(0);
+    if (a.hi < b.lo) {
+        // the quotient is 0, and the remainder is the dividend
+        Statistics::get().add("ranges.divisions_removed");
+        if (opcode == HINS_INT_DIV) {
+            return new Instruction(HINS_LOAD_ICONST, dest, Operand(OPERAND_INT_LITERAL, 0L));
+        }
+        return new Instruction(HINS_MOV, dest, dividend);
+    }
+    Statistics::get().add("ranges.unsigned_divisions");
+    return new Instruction(opcode == HINS_INT_DIV ? HINS_UINT_DIV : HINS_UINT_MOD, dest, dividend, divisor);
+}
+
+bool ValueRangeSimplification::fold_comparison(BasicBlock *bb, unsigned index, long &left, long &right) const {
+    Instruction *compare = bb->get_instruction(index);
+    if (is_literal(compare->get_operand(0)) && is_literal(compare->get_operand(1))) {
+        return false;
+    }
+    Range a = m_ranges.get_range(bb, compare->get_operand(0)), b = m_ranges.get_range(bb, compare->get_operand(1));
+
+    // which of less than, equal to and greater than are possible
+    bool is_possible[3] = { a.lo < b.hi, a.lo <= b.hi && b.lo <= a.hi, a.hi > b.lo };
+    int first = -1;
+    for (int r = 0; r < 3 && first < 0; r++) {
+        if (is_possible[r]) {
+            first = r;
+        }
+    }
+    if (first < 0) {
+        return false;
+    }
+
+    // the branch and conditional moves using the comparison must have the
+    // same outcome for each possible relation
+    bool has_user = false;
+    for (unsigned i = index + 1; i < bb->get_length(); i++) {
+        int opcode = bb->get_instruction(i)->get_opcode();
+        if (opcode == HINS_INT_COMPARE) {
+            break;
+        }
+        int branch;
+        if (HighLevel::has_flags(opcode, HOP_BRANCH)) {
+            branch = opcode;
+        } else if (opcode >= HINS_CMOVE && opcode <= HINS_CMOVGTE) {
+            branch = opcode - HINS_CMOVE + HINS_JE;
+        } else {
+            continue;
+        }
+        has_user = true;
+        bool outcome = ConstantPropagation::eval_branch(branch, s_relations[first][0], s_relations[first][1]);
+        for (int r = first + 1; r < 3; r++) {
+            if (is_possible[r] && ConstantPropagation::eval_branch(branch, s_relations[r][0], s_relations[r][1]) != outcome) {
+                return false;
+            }
+        }
+    }
+    if (!has_user) {
+        return false;
+    }
+
+    left = s_relations[first][0];
+    right = s_relations[first][1];
+    return true;
+}
@@ -0,0 +1,133 @@
+#ifndef VALUE_RANGE_H
+#define VALUE_RANGE_H
+
+#include <map>
+#include <vector>
+#include "cfg.h"
+#include "cfg_transform.h"
+
+class DominatorTree;
+
+// Value range analysis for a high-level CFG in SSA form: the range
+// [lo, hi] of the (signed) integers each vreg may hold.
+//
+// The range of a def is computed from the ranges of its operands, which
+// are narrowed by the conditional branches dominating the def's block: in
+//
+//   header:  phi vr2, vr1, vr3
+//            cmpi vr2, vrN
+//            jlt body
+//            ...
+//   body:    addi vr3, vr2, $1
+//
+// where vr1 is 0 and body is only entered from header, vr2 is less than
+// vrN in body, so vr3 can't overflow and is at least 1.  A phi operand is
+// narrowed by the branches dominating its predecessor, and by the branch
+// to the phi's block.  The ranges are found by iterating to a fixed point,
+// and a bound which keeps moving is widened to the most negative (or
+// positive) integer after WIDEN_AFTER changes, so that vr2 is found to be
+// in [0, LONG_MAX].  An arithmetic operation which may overflow, and any
+// def other than arithmetic, moves, phis and conditional moves (e.g., a
+// load), has the full range.
+//
+// The ranges stay valid while the CFG's instructions don't change (as
+// for the other analyses cached by PassManager), so later passes can use
+// them to prove facts such as an index being non-negative.
+class ValueRangeAnalysis {
+public:
+    static const unsigned WIDEN_AFTER = 3;
+
+    struct Range {
+        long lo, hi;
+
+        bool is_constant() const { return lo == hi; }
+        bool is_non_negative() const { return lo >= 0; }
+    };
+
+    // a condition known to hold in a block: "l op r" for a comparison op
+    // (the opcode of the conditional branch taken when it holds)
+    struct Condition {
+        int opcode;
+        Operand left, right;
+    };
+
+private:
+    ControlFlowGraph *m_cfg;
+    const DominatorTree &m_domtree;
+    // the number of defs of each vreg (conditions are only used for vregs
+    // with at most one, whose value can't change after the comparison)
+    std::vector<unsigned> m_num_defs;
+    // the range of each vreg (and whether it has been found, while iterating)
+    std::vector<Range> m_ranges;
+    std::vector<bool> m_known;
+    std::vector<unsigned> m_changes;
+    // the conditions of the branches dominating each block (indexed by block id)
+    std::vector<std::vector<Condition>> m_conditions;
+
+    // disallow copy ctor and assignment operator
+    ValueRangeAnalysis(const ValueRangeAnalysis &);
+    ValueRangeAnalysis &operator=(const ValueRangeAnalysis &);
+
+public:
+    ValueRangeAnalysis(ControlFlowGraph *cfg, const DominatorTree &domtree);
+    ~ValueRangeAnalysis();
+
+    static Range get_full_range();
+
+    // the range of a vreg (anywhere it is defined)
+    Range get_range(int vreg) const;
+
+    // the range of an operand (a vreg or an integer literal) in a block,
+    // narrowed by the conditions holding there
+    Range get_range(BasicBlock *bb, const Operand &operand) const;
+
+    const std::vector<Condition> &get_conditions(BasicBlock *bb) const { return m_conditions.at(bb->get_id()); }
+
+    // the condition a conditional branch ending pred tests (or its
+    // negation, if the edge to succ is the fall through), or false if pred
+    // doesn't end with a comparison and a conditional branch to succ
+    bool get_edge_condition(BasicBlock *pred, BasicBlock *succ, Condition &condition) const;
+
+private:
+    void count_defs();
+    void find_conditions();
+    void analyze();
+    bool evaluate(BasicBlock *bb, Instruction *ins, Range &result) const;
+    Range get_range(const Operand &operand, const std::vector<Condition> &conditions,
+                    const Condition *edge_condition) const;
+    bool is_known(const Operand &operand) const;
+    static void narrow(Range &range, int opcode, const Range &other);
+};
+
+// Simplifications using the value ranges of a CFG in SSA form:
+//   - a divi or modi whose dividend is non-negative and whose divisor is
+//     positive becomes the unsigned HINS_UINT_DIV or HINS_UINT_MOD (which
+//     are lowered to shifts and masks for a power of two, and otherwise
+//     need no sign correction or sign extension), and one whose quotient
+//     is known to be 0 becomes "ldci vrD, $0" (or a move of the dividend),
+//   - a comparison whose outcome is the same for every value in the ranges
+//     of its operands, for the branch and conditional moves using it, is
+//     replaced by a comparison of constants (which ConstantPropagation
+//     then folds), and the conditional moves by moves.
+class ValueRangeSimplification : public ControlFlowGraphTransform {
+private:
+    const ValueRangeAnalysis &m_ranges;
+    unsigned m_num_folded;
+
+public:
+    ValueRangeSimplification(ControlFlowGraph *cfg, const ValueRangeAnalysis &ranges);
+    virtual ~ValueRangeSimplification();
+
+    virtual InstructionSequence *transform_basic_block(InstructionSequence *iseq);
+
+    // the number of comparisons folded (after transform_cfg)
+    unsigned get_num_folded() const { return m_num_folded; }
+
+private:
+    Instruction *simplify_division(BasicBlock *bb, Instruction *ins) const;
+    // find constants to compare instead of the operands of the comparison
+    // at index, if they give the same outcomes
+    bool fold_comparison(BasicBlock *bb, unsigned index, long &left, long &right) const;
+};
+
+#endif // VALUE_RANGE_H
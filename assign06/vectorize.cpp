@@ -0,0 +1,645 @@
+#include <cassert>
+#include <algorithm>
+#include <climits>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "ssa.h"
+#include "licm.h"
+#include "stats.h"
+#include "vectorize.h"
+
+namespace {
+    // the size of an array element
+    const long ELEMENT_SIZE = 8;
+
+    // (in find_variables) a vreg which may point into more than one variable
+    const long CONFLICT = -2;
+
+    // combine the variables (or -1 for none) two values may point into
+    long merge_variables(long a, long b) {
+        return (a == -1) ? b : (b == -1 || a == b) ? a : CONFLICT;
+    }
+
+    // wrapping arithmetic on offsets
+    long add_offset(long a, long b) {
+        return long((unsigned long) a + (unsigned long) b);
+    }
+
+    long mul_offset(long a, long b) {
+        return long((unsigned long) a * (unsigned long) b);
+    }
+}
+
+bool LoopVectorization::Value::is_same(const Value &other) const {
+    return kind == other.kind && iv == other.iv && scale == other.scale && offset == other.offset
+           && (kind != ADDRESS || operand == other.operand);
+}
+
+LoopVectorization::LoopVectorization(ControlFlowGraph *cfg, const DominatorTree *domtree,
+                                     const LoopForest *loops, const LiveVregs *live_vregs)
+        : m_cfg(cfg)
+        , m_own_domtree(domtree != nullptr ? nullptr : new DominatorTree(cfg))
+        , m_domtree(domtree != nullptr ? *domtree : *m_own_domtree)
+        , m_own_loops(loops != nullptr ? nullptr : new LoopForest(cfg, m_domtree))
+        , m_loops(loops != nullptr ? *loops : *m_own_loops)
+        , m_own_live_vregs(nullptr)
+        , m_live_vregs(live_vregs)
+        , m_next_vreg(HighLevel::get_num_vregs(cfg))
+        , m_num_vector_vregs(0) {
+    if (m_live_vregs == nullptr) {
+        m_own_live_vregs = new LiveVregs(cfg);
+        m_own_live_vregs->execute();
+        m_live_vregs = m_own_live_vregs;
+    }
+
+    find_variables();
+
+    for (unsigned i = 0; i < m_loops.get_num_loops(); i++) {
+        VectorLoop vloop;
+        int next_vreg = m_next_vreg;
+        if (vectorize_loop(m_loops.get_loop(i), vloop)) {
+            m_vector_loops.push_back(vloop);
+            Statistics::get().add("vectorize.loops");
+        } else {
+            for (auto j = m_setup.begin(); j != m_setup.end(); j++) {
+                delete *j;
+            }
+            for (auto j = m_vector_body.begin(); j != m_vector_body.end(); j++) {
+                delete *j;
+            }
+            m_next_vreg = next_vreg;
+        }
+        clear();
+    }
+}
+
+LoopVectorization::~LoopVectorization() {
+    delete m_own_loops;
+    delete m_own_domtree;
+    delete m_own_live_vregs;
+}
+
+ControlFlowGraph *LoopVectorization::transform_cfg() {
+    ControlFlowGraph *result = new ControlFlowGraph();
+
+    // map of basic blocks of original CFG to basic blocks in transformed CFG
+    std::map<BasicBlock *, BasicBlock *> block_map;
+    std::map<BasicBlock *, const VectorLoop *> preheaders;
+    for (auto i = m_vector_loops.begin(); i != m_vector_loops.end(); i++) {
+        preheaders[i->preheader] = &*i;
+    }
+
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        BasicBlock *result_bb = result->create_basic_block(orig->get_kind(), orig->get_label());
+        block_map[orig] = result_bb;
+        result_bb->set_count(orig->get_count());
+        for (auto j = orig->cbegin(); j != orig->cend(); j++) {
+            result_bb->add_instruction((*j)->duplicate());
+        }
+    }
+
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+        BasicBlock *orig = *i;
+        const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(orig);
+        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+            Edge *orig_edge = *j;
+            BasicBlock *source = block_map[orig];
+            BasicBlock *target = block_map[orig_edge->get_target()];
+
+            auto p = preheaders.find(orig);
+            if (p == preheaders.end()) {
+                result->create_edge(source, target, orig_edge->get_kind());
+                continue;
+            }
+
+            // insert the vectorized loop on the edge from the preheader to the header
+            const VectorLoop &vloop = *p->second;
+            std::string header_label = target->get_label();
+            int exit_opcode = HighLevel::get_inverted_branch(vloop.branch_opcode);
+
+            BasicBlock *setup_bb;
+            if (orig_edge->get_kind() == EDGE_BRANCH) {
+                std::string label = StringTable::labels().new_label(".Lvec");
+                setup_bb = result->create_basic_block(BASICBLOCK_INTERIOR, label);
+                Instruction *branch = source->get_last();
+                assert(branch->get_opcode() == HINS_JUMP && (*branch)[0].get_target_label() == header_label);
+                (*branch)[0] = Operand(label);
+            } else {
+                setup_bb = result->create_basic_block(BASICBLOCK_INTERIOR);
+            }
+            for (auto k = vloop.setup.begin(); k != vloop.setup.end(); k++) {
+                setup_bb->add_instruction(*k);
+            }
+            setup_bb->add_instruction(new Instruction(HINS_INT_COMPARE, vloop.counter, vloop.limit));
+            setup_bb->add_instruction(new Instruction(exit_opcode, Operand(header_label)));
+
+            std::string body_label = StringTable::labels().new_label(".Lvec");
+            BasicBlock *body_bb = result->create_basic_block(BASICBLOCK_INTERIOR, body_label);
+            for (auto k = vloop.vector_body.begin(); k != vloop.vector_body.end(); k++) {
+                body_bb->add_instruction(*k);
+            }
+            body_bb->add_instruction(new Instruction(HINS_INT_COMPARE, vloop.counter, vloop.limit));
+            body_bb->add_instruction(new Instruction(vloop.branch_opcode, Operand(body_label)));
+
+            BasicBlock *exit_bb = result->create_basic_block(BASICBLOCK_INTERIOR);
+            exit_bb->add_instruction(new Instruction(HINS_JUMP, Operand(header_label)));
+
+            result->create_edge(source, setup_bb, orig_edge->get_kind());
+            result->create_edge(setup_bb, body_bb, EDGE_FALLTHROUGH);
+            result->create_edge(setup_bb, target, EDGE_BRANCH);
+            result->create_edge(body_bb, body_bb, EDGE_BRANCH);
+            result->create_edge(body_bb, exit_bb, EDGE_FALLTHROUGH);
+            result->create_edge(exit_bb, target, EDGE_BRANCH);
+        }
+    }
+
+    return result;
+}
+
+void LoopVectorization::find_variables() {
+    // find the variable each vreg points into by following the address
+    // arithmetic of every definition until nothing changes (a pointer plus
+    // or minus an integer points into the same variable as the pointer)
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+            BasicBlock *bb = *i;
+            for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+                Instruction *ins = *j;
+                if (!HighLevel::is_def(ins) || ins->get_operand(0).get_kind() != OPERAND_VREG) {
+                    continue;
+                }
+
+                long var;
+                switch (ins->get_opcode()) {
+                    case HINS_LOCALADDR:
+                        var = ins->get_operand(1).get_int_value();
+                        break;
+                    case HINS_MOV:
+                    case HINS_INT_SUB:
+                        var = get_variable(ins->get_operand(1));
+                        break;
+                    case HINS_INT_ADD:
+                    case HINS_LEA: {
+                        long a = get_variable(ins->get_operand(1)), b = get_variable(ins->get_operand(2));
+                        var = (a >= 0 && b >= 0) ? CONFLICT : merge_variables(a, b);
+                        break;
+                    }
+                    default:
+                        var = -1;
+                        break;
+                }
+                if (var == -1) {
+                    continue;
+                }
+
+                int dest = ins->get_operand(0).get_base_reg();
+                long merged = merge_variables(get_variable(ins->get_operand(0)), var);
+                if (merged != get_variable(ins->get_operand(0))) {
+                    m_variables[dest] = merged;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (auto i = m_variables.begin(); i != m_variables.end(); ) {
+        if (i->second == CONFLICT) {
+            i = m_variables.erase(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+bool LoopVectorization::vectorize_loop(const LoopForest::Loop &loop, VectorLoop &vloop) {
+    // the loop must be a header, which only has the loop test,
+    // and a body, which is only entered from the header
+    BasicBlock *header = loop.header;
+    BasicBlock *preheader = loop.preheader;
+    if (loop.blocks.size() != 2 || preheader == nullptr || !header->has_label()) {
+        return false;
+    }
+    BasicBlock *body = *loop.blocks.begin() != header ? *loop.blocks.begin() : *loop.blocks.rbegin();
+    if (m_cfg->get_outgoing_edges(body).size() != 1 || m_cfg->get_incoming_edges(body).size() != 1) {
+        return false;
+    }
+    Edge *back_edge = m_cfg->lookup_edge(header, body);
+    if (header->get_length() != 2 || back_edge == nullptr || back_edge->get_kind() != EDGE_BRANCH) {
+        return false;
+    }
+    Instruction *compare = header->get_instruction(0);
+    Instruction *branch = header->get_instruction(1);
+    if (compare->get_opcode() != HINS_INT_COMPARE
+            || (branch->get_opcode() != HINS_JLT && branch->get_opcode() != HINS_JLTE)) {
+        return false;
+    }
+    Operand counter = compare->get_operand(0), bound = compare->get_operand(1);
+    if (counter.get_kind() != OPERAND_VREG
+            || (bound.get_kind() != OPERAND_VREG && bound.get_kind() != OPERAND_INT_LITERAL)) {
+        return false;
+    }
+
+    for (auto i = body->cbegin(); i != body->cend(); i++) {
+        if (HighLevel::is_def(*i)) {
+            m_body_defs.insert((*i)->get_operand(0).get_base_reg());
+        }
+    }
+    if (bound.get_kind() == OPERAND_VREG && m_body_defs.count(bound.get_base_reg()) > 0) {
+        return false;
+    }
+
+    for (auto i = body->cbegin(); i != body->cend(); i++) {
+        if (!vectorize_instruction(*i)) {
+            return false;
+        }
+    }
+    if (m_num_vector_vregs > MAX_VECTOR_VREGS || m_accesses.empty()) {
+        return false;
+    }
+
+    // the vregs defined in the body which are used in later iterations
+    // (or after the loop) must be induction variables
+    std::map<int, long> steps;
+    const LiveVregs::LiveSet &live_out = m_live_vregs->get_fact_at_end_of_block(body);
+    for (auto i = m_body_defs.begin(); i != m_body_defs.end(); i++) {
+        if (!live_out.test(unsigned(*i))) {
+            continue;
+        }
+        const Value &value = m_values[*i];
+        if (value.kind != Value::INDUCTION || value.iv != *i || value.scale != 1) {
+            return false;
+        }
+        steps[*i] = value.offset;
+    }
+
+    auto counter_step = steps.find(counter.get_base_reg());
+    if (counter_step == steps.end() || counter_step->second <= 0) {
+        return false;
+    }
+    long step = counter_step->second;
+
+    // consecutive iterations must access adjacent elements
+    bool has_store = false;
+    for (auto i = m_accesses.begin(); i != m_accesses.end(); i++) {
+        auto iv_step = steps.find(i->address.iv);
+        if (iv_step == steps.end() || iv_step->second == 0 || ELEMENT_SIZE % iv_step->second != 0
+                || i->address.scale != ELEMENT_SIZE / iv_step->second) {
+            return false;
+        }
+        has_store = has_store || i->is_store;
+    }
+    long num_iterations = get_num_iterations(preheader, counter, bound, branch->get_opcode(), step);
+    if (!has_store || !is_independent(preheader, steps, num_iterations)) {
+        return false;
+    }
+
+    // two iterations remain if vrI + step <= bound (or < bound)
+    Operand limit;
+    if (bound.get_kind() == OPERAND_INT_LITERAL) {
+        if (bound.get_int_value() < LONG_MIN + step) {
+            return false;
+        }
+        limit = Operand(OPERAND_INT_LITERAL, bound.get_int_value() - step);
+    } else {
+        limit = Operand(OPERAND_VREG, m_next_vreg++);
+        m_setup.push_back(new Instruction(HINS_INT_SUB, limit, bound, Operand(OPERAND_INT_LITERAL, step)));
+    }
+
+    for (auto i = steps.begin(); i != steps.end(); i++) {
+        Operand iv(OPERAND_VREG, i->first);
+        m_vector_body.push_back(new Instruction(HINS_INT_ADD, iv, iv, Operand(OPERAND_INT_LITERAL, 2 * i->second)));
+    }
+
+    vloop.preheader = preheader;
+    vloop.header = header;
+    vloop.body = body;
+    vloop.counter = counter;
+    vloop.limit = limit;
+    vloop.branch_opcode = branch->get_opcode();
+    vloop.setup = m_setup;
+    vloop.vector_body = m_vector_body;
+    return true;
+}
+
+bool LoopVectorization::vectorize_instruction(Instruction *ins) {
+    int opcode = ins->get_opcode();
+    if (opcode == HINS_NOP || opcode == HINS_JUMP) {
+        return true;
+    }
+
+    if (HighLevel::is_def(ins) && ins->get_operand(0).get_kind() != OPERAND_VREG) {
+        return false;
+    }
+    int dest = HighLevel::is_def(ins) ? ins->get_operand(0).get_base_reg() : -1;
+
+    switch (opcode) {
+        case HINS_LOAD_ICONST:
+        case HINS_MOV: {
+            Operand src = ins->get_operand(1);
+            if (src.get_kind() != OPERAND_VREG && src.get_kind() != OPERAND_INT_LITERAL) {
+                return false;
+            }
+            m_values[dest] = get_value(src);
+            return true;
+        }
+
+        case HINS_INT_ADD:
+        case HINS_INT_SUB: {
+            Value a = get_value(ins->get_operand(1)), b = get_value(ins->get_operand(2));
+            bool is_add = (opcode == HINS_INT_ADD);
+            if (is_add && b.kind != Value::INVARIANT && a.kind == Value::INVARIANT) {
+                std::swap(a, b);
+            }
+
+            if (a.kind == Value::VECTOR || b.kind == Value::VECTOR) {
+                int va, vb;
+                if (!get_vector(a, va) || !get_vector(b, vb)) {
+                    return false;
+                }
+                Value result = { Value::VECTOR, Operand(), -1, 0, 0, new_vector_vreg() };
+                m_vector_body.push_back(new Instruction(is_add ? HINS_VEC_ADD : HINS_VEC_SUB,
+                                                        Operand(OPERAND_VREG, result.vec),
+                                                        Operand(OPERAND_VREG, va), Operand(OPERAND_VREG, vb)));
+                m_values[dest] = result;
+                return true;
+            }
+
+            if ((a.kind != Value::INDUCTION && a.kind != Value::ADDRESS) || b.kind != Value::INVARIANT) {
+                return false;
+            }
+            Operand rhs = b.operand;
+            if (rhs.get_kind() == OPERAND_INT_LITERAL) {
+                // an induction variable (or address) plus or minus a constant
+                long value = rhs.get_int_value();
+                if (!is_add && value == LONG_MIN) {
+                    return false;
+                }
+                a.offset = add_offset(a.offset, is_add ? value : -value);
+                m_values[dest] = a;
+                return true;
+            }
+            if (!is_add || a.kind != Value::INDUCTION) {
+                return false;
+            }
+            // a loop-invariant base plus an induction variable
+            a.kind = Value::ADDRESS;
+            a.operand = rhs;
+            m_values[dest] = a;
+            return true;
+        }
+
+        case HINS_INT_MUL: {
+            // an induction variable multiplied by a constant
+            Value a = get_value(ins->get_operand(1)), b = get_value(ins->get_operand(2));
+            if (a.kind == Value::INVARIANT) {
+                std::swap(a, b);
+            }
+            if (a.kind != Value::INDUCTION || b.kind != Value::INVARIANT
+                    || b.operand.get_kind() != OPERAND_INT_LITERAL) {
+                return false;
+            }
+            a.scale = mul_offset(a.scale, b.operand.get_int_value());
+            a.offset = mul_offset(a.offset, b.operand.get_int_value());
+            m_values[dest] = a;
+            return true;
+        }
+
+        case HINS_LOAD_INT:
+        case HINS_STORE_INT: {
+            bool is_store = (opcode == HINS_STORE_INT);
+            Operand memref = ins->get_operand(is_store ? 0 : 1);
+            if (memref.get_kind() != OPERAND_VREG_MEMREF) {
+                return false;
+            }
+            Value address = get_value(Operand(OPERAND_VREG, memref.get_base_reg()));
+            if (address.kind != Value::ADDRESS && address.kind != Value::INDUCTION) {
+                return false;
+            }
+            m_accesses.push_back({ address, is_store });
+            Operand vec_addr = get_address(address).to_memref();
+
+            if (is_store) {
+                int vec;
+                if (!get_vector(get_value(ins->get_operand(1)), vec)) {
+                    return false;
+                }
+                m_vector_body.push_back(new Instruction(HINS_VEC_STORE, vec_addr, Operand(OPERAND_VREG, vec)));
+            } else {
+                Value result = { Value::VECTOR, Operand(), -1, 0, 0, new_vector_vreg() };
+                m_vector_body.push_back(new Instruction(HINS_VEC_LOAD, Operand(OPERAND_VREG, result.vec), vec_addr));
+                m_values[dest] = result;
+            }
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+bool LoopVectorization::is_independent(BasicBlock *preheader, const std::map<int, long> &steps,
+                                       long num_iterations) const {
+    for (unsigned i = 0; i < m_accesses.size(); i++) {
+        for (unsigned j = i + 1; j < m_accesses.size(); j++) {
+            if (!m_accesses[i].is_store && !m_accesses[j].is_store) {
+                continue;
+            }
+            const Value &a = m_accesses[i].address, &b = m_accesses[j].address;
+            if (a.is_same(b)) {
+                // the same element (accessed in the original order)
+                continue;
+            }
+
+            // elements of the same array at a constant distance (whose
+            // addresses in the first iteration differ by a constant)?
+            AffineForm form_a, form_b;
+            if (get_initial_address(preheader, a, form_a) && get_initial_address(preheader, b, form_b)
+                    && form_a.terms == form_b.terms) {
+                AffineAccess access_a = { mul_offset(a.scale, steps.at(a.iv)), form_a.constant, ELEMENT_SIZE };
+                AffineAccess access_b = { mul_offset(b.scale, steps.at(b.iv)), form_b.constant, ELEMENT_SIZE };
+                if (!DependenceTest::may_depend(access_a, access_b, num_iterations)) {
+                    continue;
+                }
+                // (b accesses the element a accessed distance iterations
+                // earlier, which is out of order if a did so one iteration
+                // after b, in the same vectorized iteration)
+                long distance;
+                if (DependenceTest::get_distance(access_a, access_b, distance) && distance != -1) {
+                    continue;
+                }
+                return false;
+            }
+
+            // otherwise, the accesses must be of different arrays
+            long var_a = get_variable(a), var_b = get_variable(b);
+            if (var_a < 0 || var_b < 0 || var_a == var_b) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool LoopVectorization::get_initial_address(BasicBlock *preheader, const Value &address, AffineForm &form) const {
+    // (the values at the end of the preheader are those at the start of the
+    // first iteration, since the header only has the loop test)
+    unsigned end = preheader->get_length();
+    if (!AffineForm::get(preheader, end, Operand(OPERAND_VREG, address.iv), form)) {
+        return false;
+    }
+    AffineForm iv = form;
+    form = AffineForm();
+    form.add(iv, address.scale);
+    form.constant = add_offset(form.constant, address.offset);
+    if (address.kind == Value::ADDRESS) {
+        AffineForm base;
+        if (!AffineForm::get(preheader, end, address.operand, base)) {
+            return false;
+        }
+        form.add(base);
+    }
+    return true;
+}
+
+long LoopVectorization::get_num_iterations(BasicBlock *preheader, const Operand &counter, const Operand &bound,
+                                           int branch_opcode, long step) const {
+    // the number of iterations is known if the counter is set to a
+    // constant in the preheader, and the bound is a constant
+    if (bound.get_kind() != OPERAND_INT_LITERAL) {
+        return -1;
+    }
+    for (unsigned i = preheader->get_length(); i > 0; i--) {
+        Instruction *ins = preheader->get_instruction(i - 1);
+        if (!HighLevel::is_def(ins) || ins->get_operand(0) != counter) {
+            continue;
+        }
+        int opcode = ins->get_opcode();
+        Operand init = ins->get_operand(1);
+        if ((opcode != HINS_LOAD_ICONST && opcode != HINS_MOV) || init.get_kind() != OPERAND_INT_LITERAL) {
+            return -1;
+        }
+        long start = init.get_int_value(), end = bound.get_int_value();
+        if (start < -DependenceTest::MAX_VALUE || start > DependenceTest::MAX_VALUE
+                || end < -DependenceTest::MAX_VALUE || end > DependenceTest::MAX_VALUE) {
+            return -1;
+        }
+        // the counter is start, start + step, ... while less than (or equal to) end
+        long range = (branch_opcode == HINS_JLTE) ? end - start + 1 : end - start;
+        return (range <= 0) ? 0 : (range + step - 1) / step;
+    }
+    return -1;
+}
+
+long LoopVectorization::get_variable(const Value &address) const {
+    // a scaled induction variable is an index rather than a pointer
+    long base = (address.kind == Value::ADDRESS) ? get_variable(address.operand) : -1;
+    long iv = (address.scale == 1) ? get_variable(Operand(OPERAND_VREG, address.iv)) : -1;
+    return (base >= 0 && iv >= 0) ? -1 : std::max(base, iv);
+}
+
+long LoopVectorization::get_variable(const Operand &operand) const {
+    if (operand.get_kind() != OPERAND_VREG) {
+        return -1;
+    }
+    auto i = m_variables.find(operand.get_base_reg());
+    return (i != m_variables.end()) ? i->second : -1;
+}
+
+LoopVectorization::Value LoopVectorization::get_value(const Operand &operand) {
+    Value value = { Value::INVARIANT, operand, -1, 1, 0, -1 };
+    if (operand.get_kind() != OPERAND_VREG) {
+        return value;
+    }
+    int vreg = operand.get_base_reg();
+    auto i = m_values.find(vreg);
+    if (i != m_values.end()) {
+        return i->second;
+    }
+    if (m_body_defs.count(vreg) > 0) {
+        // (the value at the start of the body, of what must be an induction variable)
+        value.kind = Value::INDUCTION;
+        value.iv = vreg;
+    }
+    return value;
+}
+
+bool LoopVectorization::get_vector(const Value &value, int &vec) {
+    if (value.kind == Value::VECTOR) {
+        vec = value.vec;
+        return true;
+    }
+    if (value.kind != Value::INVARIANT) {
+        return false;
+    }
+
+    // a loop-invariant value is duplicated into a vector once, before the loop
+    const Operand &operand = value.operand;
+    bool is_literal = (operand.get_kind() == OPERAND_INT_LITERAL);
+    if (is_literal && m_literal_dups.count(operand.get_int_value()) > 0) {
+        vec = m_literal_dups[operand.get_int_value()];
+        return true;
+    }
+    if (!is_literal && m_vreg_dups.count(operand.get_base_reg()) > 0) {
+        vec = m_vreg_dups[operand.get_base_reg()];
+        return true;
+    }
+
+    vec = new_vector_vreg();
+    m_setup.push_back(new Instruction(HINS_VEC_DUP, Operand(OPERAND_VREG, vec), operand));
+    if (is_literal) {
+        m_literal_dups[operand.get_int_value()] = vec;
+    } else {
+        m_vreg_dups[operand.get_base_reg()] = vec;
+    }
+    return true;
+}
+
+int LoopVectorization::new_vector_vreg() {
+    m_num_vector_vregs++;
+    return m_next_vreg++;
+}
+
+Operand LoopVectorization::get_address(const Value &address) {
+    // the induction variables aren't updated until the end of the vectorized
+    // body, so an address only needs to be computed once
+    for (auto i = m_addresses.begin(); i != m_addresses.end(); i++) {
+        if (i->first.is_same(address)) {
+            return Operand(OPERAND_VREG, i->second);
+        }
+    }
+
+    Operand result(OPERAND_VREG, address.iv);
+    if (address.scale != 1) {
+        Operand index = result;
+        result = Operand(OPERAND_VREG, m_next_vreg++);
+        m_vector_body.push_back(new Instruction(HINS_INT_MUL, result, index, Operand(OPERAND_INT_LITERAL, address.scale)));
+    }
+    if (address.kind == Value::ADDRESS) {
+        Operand index = result;
+        result = Operand(OPERAND_VREG, m_next_vreg++);
+        m_vector_body.push_back(new Instruction(HINS_INT_ADD, result, address.operand, index));
+    }
+    if (address.offset != 0) {
+        Operand sum = result;
+        result = Operand(OPERAND_VREG, m_next_vreg++);
+        m_vector_body.push_back(new Instruction(HINS_INT_ADD, result, sum, Operand(OPERAND_INT_LITERAL, address.offset)));
+    }
+    m_addresses.push_back(std::make_pair(address, result.get_base_reg()));
+    return result;
+}
+
+void LoopVectorization::clear() {
+    m_values.clear();
+    m_body_defs.clear();
+    m_accesses.clear();
+    m_setup.clear();
+    m_vector_body.clear();
+    m_literal_dups.clear();
+    m_vreg_dups.clear();
+    m_addresses.clear();
+    m_num_vector_vregs = 0;
+}
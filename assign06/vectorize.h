@@ -0,0 +1,147 @@
+#ifndef VECTORIZE_H
+#define VECTORIZE_H
+
+#include <vector>
+#include <map>
+#include <set>
+#include "cfg.h"
+#include "ssa.h"
+#include "loops.h"
+#include "dependence.h"
+
+class LiveVregs;
+
+// Loop vectorization for a high-level CFG (not in SSA form).
+//
+// A loop is vectorized if it consists of a header containing only
+//
+//   cmpi vrI, bound
+//   jlt body              (or jlte)
+//
+// and a single body block whose instructions are loads and stores of array
+// elements (at addresses which are a loop-invariant base plus a multiple of
+// an induction variable, stepping by the size of an integer), additions and
+// subtractions of the loaded values and loop-invariant values, and the updates
+// of the induction variables (every vreg defined in the body which is live at
+// its end must be an induction variable, such as those created by
+// InductionVariableStrengthReduction).  vrI must be an induction variable with
+// a positive step, and bound must be loop-invariant.  Two accesses of the same
+// array (at least one of them a store) must be of the same element, or
+// DependenceTest must show that they are independent or that the vectorized
+// loop keeps them in order (which it does unless one of them accesses the
+// element the other accessed one iteration earlier, and comes first in the
+// body).  (The
+// array an address points into is found by following the address
+// arithmetic back to a HINS_LOCALADDR.)
+//
+// A vectorized copy of the loop, which executes two iterations at a time
+// using the HINS_VEC_* instructions (which operate on pairs of adjacent
+// integers, and are lowered to SSE2 instructions), is inserted on the entry
+// edge of the loop:
+//
+//   preheader:  ldci vrL, $(bound - step)          (or subi vrL, bound, $step)
+//               vdupi vrV, vrK                     (for each invariant vrK)
+//               cmpi vrI, vrL
+//               jgte header                        (or jgt, for jlte)
+//   vector:     (the body, two iterations at a time)
+//               cmpi vrI, vrL
+//               jlt vector
+//               jmp header
+//
+// so that the original loop only executes the remaining iteration (if any).
+// (A bound in a vreg is assumed to be at least LONG_MIN + step, so that
+// bound - step doesn't wrap around.)
+class LoopVectorization {
+public:
+    // the vector values of a vectorized loop are kept in the SSE registers
+    static const unsigned MAX_VECTOR_VREGS = 16;
+
+private:
+    // the value of a vreg defined in the loop body
+    struct Value {
+        enum Kind {
+            INVARIANT,   // a loop-invariant operand
+            INDUCTION,   // scale * (induction variable iv at the start of the body) + offset
+            ADDRESS,     // base (a loop-invariant vreg) plus an INDUCTION value
+            VECTOR,      // a vector (held in vector vreg vec in the vectorized body)
+        };
+        Kind kind;
+        Operand operand;   // INVARIANT: the operand; ADDRESS: the base
+        int iv;
+        long scale;
+        long offset;
+        int vec;
+
+        // is this the same INDUCTION or ADDRESS value as other?
+        bool is_same(const Value &other) const;
+    };
+
+    // a load or store of an array element
+    struct Access {
+        Value address;
+        bool is_store;
+    };
+
+    // a loop which can be vectorized, and its vectorized code
+    struct VectorLoop {
+        BasicBlock *preheader;
+        BasicBlock *header;
+        BasicBlock *body;
+        Operand counter;   // vrI
+        Operand limit;     // vrI must be less than (or equal to) limit for two iterations to remain
+        int branch_opcode;
+        std::vector<Instruction *> setup;         // (without the compare and branch)
+        std::vector<Instruction *> vector_body;   // (without the compare and branch)
+    };
+
+    ControlFlowGraph *m_cfg;
+    DominatorTree *m_own_domtree;
+    const DominatorTree &m_domtree;
+    LoopForest *m_own_loops;
+    const LoopForest &m_loops;
+    LiveVregs *m_own_live_vregs;
+    const LiveVregs *m_live_vregs;
+    int m_next_vreg;
+    // the variables (offsets in the symbol table) that vregs point into
+    std::map<int, long> m_variables;
+    std::vector<VectorLoop> m_vector_loops;
+
+    // the state of the loop being analyzed
+    std::map<int, Value> m_values;
+    std::set<int> m_body_defs;
+    std::vector<Access> m_accesses;
+    std::vector<Instruction *> m_setup, m_vector_body;
+    // vector vregs holding loop-invariant values, and computed addresses
+    std::map<long, int> m_literal_dups;
+    std::map<int, int> m_vreg_dups;
+    std::vector<std::pair<Value, int>> m_addresses;
+    unsigned m_num_vector_vregs;
+
+public:
+    LoopVectorization(ControlFlowGraph *cfg, const DominatorTree *domtree = nullptr,
+                      const LoopForest *loops = nullptr, const LiveVregs *live_vregs = nullptr);
+    ~LoopVectorization();
+
+    ControlFlowGraph *get_orig_cfg() { return m_cfg; }
+    ControlFlowGraph *transform_cfg();
+
+private:
+    void find_variables();
+    bool vectorize_loop(const LoopForest::Loop &loop, VectorLoop &vloop);
+    bool vectorize_instruction(Instruction *ins);
+    bool is_independent(BasicBlock *preheader, const std::map<int, long> &steps, long num_iterations) const;
+    bool get_initial_address(BasicBlock *preheader, const Value &address, AffineForm &form) const;
+    long get_num_iterations(BasicBlock *preheader, const Operand &counter, const Operand &bound,
+                            int branch_opcode, long step) const;
+    long get_variable(const Value &address) const;
+    long get_variable(const Operand &operand) const;
+
+    Value get_value(const Operand &operand);
+    bool get_vector(const Value &value, int &vec);
+    int new_vector_vreg();
+    Operand get_address(const Value &address);
+
+    void clear();
+};
+
+#endif // VECTORIZE_H
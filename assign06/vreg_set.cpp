@@ -0,0 +1,271 @@
+#include <cassert>
+#include <algorithm>
+#include <iterator>
+#include "vreg_set.h"
+
+namespace {
+    const unsigned BITS_PER_WORD = 64;
+
+    unsigned num_words(unsigned size) {
+        return (size + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// VregSet::const_iterator implementation
+////////////////////////////////////////////////////////////////////////
+
+VregSet::const_iterator::const_iterator(const VregSet *set, unsigned pos)
+        : m_set(set)
+        , m_pos(pos) {
+    skip_to_member();
+}
+
+unsigned VregSet::const_iterator::operator*() const {
+    return m_set->m_is_dense ? m_pos : m_set->m_members[m_pos];
+}
+
+VregSet::const_iterator &VregSet::const_iterator::operator++() {
+    m_pos++;
+    skip_to_member();
+    return *this;
+}
+
+VregSet::const_iterator VregSet::const_iterator::operator++(int) {
+    const_iterator copy(*this);
+    ++(*this);
+    return copy;
+}
+
+void VregSet::const_iterator::skip_to_member() {
+    if (!m_set->m_is_dense) {
+        return;
+    }
+
+    // find the next set bit at or after m_pos
+    while (m_pos < m_set->m_size) {
+        unsigned w = m_pos / BITS_PER_WORD;
+        uint64_t word = m_set->m_words[w] >> (m_pos % BITS_PER_WORD);
+        if (word != 0) {
+            m_pos += unsigned(__builtin_ctzll(word));
+            return;
+        }
+        m_pos = (w + 1) * BITS_PER_WORD;
+    }
+    m_pos = m_set->m_size;
+}
+
+////////////////////////////////////////////////////////////////////////
+// VregSet implementation
+////////////////////////////////////////////////////////////////////////
+
+VregSet::VregSet()
+        : m_size(0)
+        , m_count(0)
+        , m_is_dense(false) {
+}
+
+VregSet::VregSet(unsigned size)
+        : m_size(size)
+        , m_count(0)
+        , m_is_dense(false) {
+}
+
+bool VregSet::test(unsigned vreg) const {
+    if (vreg >= m_size) {
+        return false;
+    }
+    if (m_is_dense) {
+        return (m_words[vreg / BITS_PER_WORD] >> (vreg % BITS_PER_WORD)) & 1;
+    }
+    return std::binary_search(m_members.begin(), m_members.end(), vreg);
+}
+
+void VregSet::set(unsigned vreg) {
+    assert(vreg < m_size);
+
+    if (m_is_dense) {
+        uint64_t &word = m_words[vreg / BITS_PER_WORD];
+        uint64_t bit = uint64_t(1) << (vreg % BITS_PER_WORD);
+        if ((word & bit) == 0) {
+            word |= bit;
+            m_count++;
+        }
+        return;
+    }
+
+    auto i = std::lower_bound(m_members.begin(), m_members.end(), vreg);
+    if (i == m_members.end() || *i != vreg) {
+        m_members.insert(i, vreg);
+        m_count++;
+        update_representation();
+    }
+}
+
+void VregSet::reset(unsigned vreg) {
+    if (vreg >= m_size) {
+        return;
+    }
+
+    if (m_is_dense) {
+        uint64_t &word = m_words[vreg / BITS_PER_WORD];
+        uint64_t bit = uint64_t(1) << (vreg % BITS_PER_WORD);
+        if ((word & bit) != 0) {
+            word &= ~bit;
+            m_count--;
+            update_representation();
+        }
+        return;
+    }
+
+    auto i = std::lower_bound(m_members.begin(), m_members.end(), vreg);
+    if (i != m_members.end() && *i == vreg) {
+        m_members.erase(i);
+        m_count--;
+    }
+}
+
+void VregSet::clear() {
+    m_count = 0;
+    m_is_dense = false;
+    m_members.clear();
+    m_words.clear();
+}
+
+VregSet &VregSet::operator|=(const VregSet &other) {
+    assert(m_size == other.m_size);
+
+    if (other.m_count == 0) {
+        return *this;
+    }
+
+    if (m_is_dense || other.m_is_dense) {
+        if (!m_is_dense) {
+            to_dense();
+        }
+        if (other.m_is_dense) {
+            m_count = 0;
+            for (unsigned i = 0; i < m_words.size(); i++) {
+                m_words[i] |= other.m_words[i];
+                m_count += unsigned(__builtin_popcountll(m_words[i]));
+            }
+        } else {
+            for (auto i = other.m_members.begin(); i != other.m_members.end(); i++) {
+                set(*i);
+            }
+        }
+    } else {
+        std::vector<unsigned> merged;
+        merged.reserve(m_members.size() + other.m_members.size());
+        std::set_union(m_members.begin(), m_members.end(),
+                       other.m_members.begin(), other.m_members.end(),
+                       std::back_inserter(merged));
+        m_members.swap(merged);
+        m_count = unsigned(m_members.size());
+    }
+
+    update_representation();
+    return *this;
+}
+
+VregSet &VregSet::operator-=(const VregSet &other) {
+    assert(m_size == other.m_size);
+
+    if (m_count == 0 || other.m_count == 0) {
+        return *this;
+    }
+
+    if (m_is_dense && other.m_is_dense) {
+        m_count = 0;
+        for (unsigned i = 0; i < m_words.size(); i++) {
+            m_words[i] &= ~other.m_words[i];
+            m_count += unsigned(__builtin_popcountll(m_words[i]));
+        }
+    } else if (m_is_dense) {
+        for (auto i = other.m_members.begin(); i != other.m_members.end(); i++) {
+            uint64_t bit = uint64_t(1) << (*i % BITS_PER_WORD);
+            uint64_t &word = m_words[*i / BITS_PER_WORD];
+            if ((word & bit) != 0) {
+                word &= ~bit;
+                m_count--;
+            }
+        }
+    } else {
+        auto end = std::remove_if(m_members.begin(), m_members.end(),
+                                  [&other](unsigned vreg) { return other.test(vreg); });
+        m_members.erase(end, m_members.end());
+        m_count = unsigned(m_members.size());
+    }
+
+    update_representation();
+    return *this;
+}
+
+bool VregSet::operator==(const VregSet &other) const {
+    if (m_size != other.m_size || m_count != other.m_count) {
+        return false;
+    }
+    if (m_is_dense && other.m_is_dense) {
+        return m_words == other.m_words;
+    }
+    if (!m_is_dense && !other.m_is_dense) {
+        return m_members == other.m_members;
+    }
+
+    // different representations: same number of members, so it's
+    // enough to check that every member of one is a member of the other
+    const VregSet &sparse = m_is_dense ? other : *this;
+    const VregSet &dense = m_is_dense ? *this : other;
+    for (auto i = sparse.m_members.begin(); i != sparse.m_members.end(); i++) {
+        if (!dense.test(*i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+VregSet::const_iterator VregSet::begin() const {
+    return const_iterator(this, 0);
+}
+
+VregSet::const_iterator VregSet::end() const {
+    return const_iterator(this, m_is_dense ? m_size : m_count);
+}
+
+unsigned VregSet::get_sparse_limit() const {
+    // a sparse member takes 4 bytes, a dense word takes 8 bytes
+    return 2 * num_words(m_size);
+}
+
+void VregSet::to_dense() {
+    assert(!m_is_dense);
+    m_words.assign(num_words(m_size), 0);
+    for (auto i = m_members.begin(); i != m_members.end(); i++) {
+        m_words[*i / BITS_PER_WORD] |= uint64_t(1) << (*i % BITS_PER_WORD);
+    }
+    m_members.clear();
+    m_members.shrink_to_fit();
+    m_is_dense = true;
+}
+
+void VregSet::to_sparse() {
+    assert(m_is_dense);
+    std::vector<unsigned> members;
+    members.reserve(m_count);
+    for (auto i = begin(); i != end(); i++) {
+        members.push_back(*i);
+    }
+    m_members.swap(members);
+    m_words.clear();
+    m_words.shrink_to_fit();
+    m_is_dense = false;
+}
+
+void VregSet::update_representation() {
+    unsigned limit = get_sparse_limit();
+    if (!m_is_dense && m_count > limit) {
+        to_dense();
+    } else if (m_is_dense && m_count < limit / 2) {
+        to_sparse();
+    }
+}
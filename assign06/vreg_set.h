@@ -0,0 +1,80 @@
+#ifndef VREG_SET_H
+#define VREG_SET_H
+
+#include <cstdint>
+#include <vector>
+
+// Set of vreg numbers in the range [0, size), used to represent dataflow facts.
+//
+// A VregSet uses one of two representations, depending on how many
+// members it has relative to its size:
+//   - sparse: a sorted vector of member vreg numbers
+//   - dense: a vector of 64-bit words, one bit per vreg
+// A set starts out sparse, and switches to the dense representation
+// once the sorted vector would take more space than the bit vector.
+// It switches back when the number of members drops well below that
+// point, so that the representation doesn't flip back and forth.
+class VregSet {
+private:
+    unsigned m_size;
+    unsigned m_count;
+    bool m_is_dense;
+    std::vector<unsigned> m_members; // sparse representation
+    std::vector<uint64_t> m_words;   // dense representation
+
+public:
+    // iterates over the members of the set in increasing order
+    class const_iterator {
+    private:
+        const VregSet *m_set;
+        unsigned m_pos;  // index into m_members (sparse) or vreg number (dense)
+
+    public:
+        const_iterator(const VregSet *set, unsigned pos);
+
+        unsigned operator*() const;
+        const_iterator &operator++();
+        const_iterator operator++(int);
+        bool operator==(const const_iterator &other) const { return m_pos == other.m_pos; }
+        bool operator!=(const const_iterator &other) const { return m_pos != other.m_pos; }
+
+    private:
+        void skip_to_member();
+    };
+
+    VregSet();
+    explicit VregSet(unsigned size);
+
+    // number of vregs that can be members of the set (like std::bitset::size())
+    unsigned size() const { return m_size; }
+
+    // number of members
+    unsigned count() const { return m_count; }
+
+    bool any() const { return m_count > 0; }
+    bool none() const { return m_count == 0; }
+    bool is_dense() const { return m_is_dense; }
+
+    bool test(unsigned vreg) const;
+    void set(unsigned vreg);
+    void reset(unsigned vreg);
+    void clear();
+
+    // union
+    VregSet &operator|=(const VregSet &other);
+    // difference
+    VregSet &operator-=(const VregSet &other);
+    bool operator==(const VregSet &other) const;
+    bool operator!=(const VregSet &other) const { return !(*this == other); }
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+private:
+    unsigned get_sparse_limit() const;
+    void to_dense();
+    void to_sparse();
+    void update_representation();
+};
+
+#endif // VREG_SET_H
@@ -1,38 +1,264 @@
 #include <cassert>
 #include "x86_64.h"
+#include "output.h"
 
 PrintX86_64InstructionSequence::PrintX86_64InstructionSequence(InstructionSequence *iseq)
         : PrintInstructionSequence(iseq) {
 }
 
-std::string PrintX86_64InstructionSequence::get_opcode_name(int opcode) {
-    const char *s;
-    switch (opcode) {
-        case MINS_NOP:  return "nop";
-        case MINS_MOVQ: return "movq";
-        case MINS_ADDQ: return "addq";
-        case MINS_SUBQ: return "subq";
-        case MINS_LEAQ: return "leaq";
-        case MINS_JMP:  return "jmp";
-        case MINS_JE:   return "je";
-        case MINS_JNE:  return "jne";
-        case MINS_JL:   return "jl";
-        case MINS_JLE : return "jle";
-        case MINS_JG:   return "jg";
-        case MINS_JGE : return "jge";
-        case MINS_CMPQ: return "cmpq";
-        case MINS_CALL: return "call";
-        case MINS_IMULQ: return "imulq";
-        case MINS_IDIVQ: return "idivq";
-        case MINS_CQTO: return "cqto";
+const X86_64OpcodeInfo X86_64::s_opcode_info[] = {
+    { "nop",        0 },
+    { "movq",       0 },
+    { "movzbq",     0 },
+    { "movb",       0 },
+    { "movslq",     0 },
+    { "movl",       0 },
+    { "addq",       0 },
+    { "subq",       0 },
+    { "leaq",       0 },
+    { "jmp",        MOP_JUMP },
+    { "jmp",        MOP_JUMP },
+    { "je",         MOP_BRANCH },
+    { "jne",        MOP_BRANCH },
+    { "jl",         MOP_BRANCH },
+    { "jle",        MOP_BRANCH },
+    { "jg",         MOP_BRANCH },
+    { "jge",        MOP_BRANCH },
+    { "ja",         MOP_BRANCH },
+    { "cmpq",       0 },
+    { "cmove",      0 },
+    { "cmovne",     0 },
+    { "cmovl",      0 },
+    { "cmovle",     0 },
+    { "cmovg",      0 },
+    { "cmovge",     0 },
+    { "call",       MOP_CALL },
+    { "imulq",      0 },
+    { "mulq",       0 },
+    { "idivq",      0 },
+    { "divq",       0 },
+    { "cqto",       0 },
+    { "xorq",       0 },
+    { "xorl",       0 },
+    { "andq",       0 },
+    { "sarq",       0 },
+    { "shrq",       0 },
+    { "shlq",       0 },
+    { "incq",       0 },
+    { "decq",       0 },
+    { "pushq",      0 },
+    { "popq",       0 },
+    { "ret",        0 },
+    { "ud2",        0 },
+    { ".cold",      0 },
+    { "rep stosq",  0 },
+    { "rep movsq",  0 },
+    { ".long",      0 },
+    { ".p2align",   0 },
+    { "prefetcht0", 0 },
+    { "movdqu",     MOP_SSE },
+    { "movdqa",     MOP_SSE },
+    { "movq",       MOP_SSE },
+    { "punpcklqdq", MOP_SSE },
+    { "paddq",      MOP_SSE },
+    { "psubq",      MOP_SSE },
+    { "vmovdqu",    MOP_SSE },
+    { "vmovq",      MOP_SSE },
+    { "vpbroadcastq", MOP_SSE },
+    { "vpaddq",     MOP_SSE },
+    { "vpsubq",     MOP_SSE },
+};
+
+static_assert(sizeof(X86_64::s_opcode_info) / sizeof(X86_64OpcodeInfo) == MINS_VPSUBQ + 1,
+              "every x86-64 opcode needs an entry in the table");
+
+namespace {
+    const unsigned CALLER_SAVED_MASK =
+        (1U << MREG_RAX) | (1U << MREG_RCX) | (1U << MREG_RDX) | (1U << MREG_RSI) | (1U << MREG_RDI)
+        | (1U << MREG_R8) | (1U << MREG_R9) | (1U << MREG_R10) | (1U << MREG_R11) | (1U << X86_64::FLAGS);
+}
+
+unsigned X86_64::get_address_regs(const Operand &operand) {
+    unsigned mask = 0;
+    if (operand.is_memref()) {
+        if (operand.has_base_reg()) {
+            mask |= 1U << operand.get_base_reg();
+        }
+        if (operand.has_index_reg()) {
+            mask |= 1U << operand.get_index_reg();
+        }
+    }
+    return mask;
+}
+
+unsigned X86_64::get_source_regs(const Operand &operand) {
+    if (operand.get_kind() == OPERAND_MREG) {
+        return 1U << operand.get_base_reg();
+    }
+    return get_address_regs(operand);
+}
+
+X86_64Effects X86_64::get_effects(const Instruction *ins) {
+    X86_64Effects effects = { 0, 0 };
+    switch (ins->get_opcode()) {
+        case MINS_MOVQ:
+        case MINS_LEAQ:
+            effects.reads = (ins->get_opcode() == MINS_MOVQ)
+                            ? get_source_regs(ins->get_operand(0))
+                            : get_address_regs(ins->get_operand(0));
+            if (ins->get_operand(1).get_kind() == OPERAND_MREG) {
+                effects.writes = 1U << ins->get_operand(1).get_base_reg();
+            } else {
+                effects.reads |= get_address_regs(ins->get_operand(1));
+            }
+            break;
+
+        case MINS_MOVZBQ:
+        case MINS_MOVSLQ:
+            effects.reads = get_address_regs(ins->get_operand(0));
+            effects.writes = 1U << ins->get_operand(1).get_base_reg();
+            break;
+
+        case MINS_MOVB:
+            effects.reads = get_source_regs(ins->get_operand(0)) | get_address_regs(ins->get_operand(1));
+            break;
+
+        case MINS_MOVL:
+            effects.writes = 1U << ins->get_operand(1).get_base_reg();
+            break;
+
+        case MINS_MULQ:
+        case MINS_IMULQ:
+            if (ins->get_num_operands() == 1) {
+                // %rdx:%rax = %rax * op
+                effects.reads = get_source_regs(ins->get_operand(0)) | (1U << MREG_RAX);
+                effects.writes = (1U << MREG_RAX) | (1U << MREG_RDX) | (1U << FLAGS);
+                break;
+            }
+            if (ins->get_num_operands() == 3) {
+                // dest = src * $imm
+                effects.reads = get_source_regs(ins->get_operand(1));
+                effects.writes = (1U << ins->get_operand(2).get_base_reg()) | (1U << FLAGS);
+                break;
+            }
+            // fall through
+        case MINS_ADDQ:
+        case MINS_SUBQ:
+        case MINS_XORQ:
+        case MINS_XORL:
+        case MINS_ANDQ:
+        case MINS_SARQ:
+        case MINS_SHRQ:
+        case MINS_SHLQ:
+        case MINS_CMPQ:
+            effects.reads = get_source_regs(ins->get_operand(0)) | get_source_regs(ins->get_operand(1));
+            effects.writes = 1U << FLAGS;
+            if (ins->get_opcode() != MINS_CMPQ && ins->get_operand(1).get_kind() == OPERAND_MREG) {
+                effects.writes |= 1U << ins->get_operand(1).get_base_reg();
+            }
+            break;
+
+        case MINS_INCQ:
+        case MINS_DECQ:
+            effects.reads = get_source_regs(ins->get_operand(0));
+            effects.writes = 1U << FLAGS;
+            if (ins->get_operand(0).get_kind() == OPERAND_MREG) {
+                effects.writes |= 1U << ins->get_operand(0).get_base_reg();
+            }
+            break;
+
+        case MINS_JMP_INDIRECT:
+            effects.reads = get_source_regs(ins->get_operand(0));
+            break;
+
+        case MINS_JE:
+        case MINS_JNE:
+        case MINS_JL:
+        case MINS_JLE:
+        case MINS_JG:
+        case MINS_JGE:
+        case MINS_JA:
+            effects.reads = 1U << FLAGS;
+            break;
+
+        case MINS_CMOVE:
+        case MINS_CMOVNE:
+        case MINS_CMOVL:
+        case MINS_CMOVLE:
+        case MINS_CMOVG:
+        case MINS_CMOVGE:
+            // (the destination keeps its value if the condition is false)
+            effects.reads = get_source_regs(ins->get_operand(0)) | get_source_regs(ins->get_operand(1))
+                            | (1U << FLAGS);
+            effects.writes = 1U << ins->get_operand(1).get_base_reg();
+            break;
+
+        case MINS_COLD:
+            // (the function returns its result in %rax)
+            effects.reads = 1U << MREG_RAX;
+            break;
+
+        case MINS_CALL:
+            // arguments (and %al, the number of vector arguments to a varargs function)
+            effects.reads = (1U << MREG_RDI) | (1U << MREG_RSI) | (1U << MREG_RDX) | (1U << MREG_RCX)
+                            | (1U << MREG_R8) | (1U << MREG_R9) | (1U << MREG_RAX);
+            effects.writes = CALLER_SAVED_MASK;
+            break;
+
+        case MINS_IDIVQ:
+        case MINS_DIVQ:
+            effects.reads = get_source_regs(ins->get_operand(0)) | (1U << MREG_RAX) | (1U << MREG_RDX);
+            effects.writes = (1U << MREG_RAX) | (1U << MREG_RDX) | (1U << FLAGS);
+            break;
+
+        case MINS_CQTO:
+            effects.reads = 1U << MREG_RAX;
+            effects.writes = 1U << MREG_RDX;
+            break;
+
+        case MINS_REP_STOSQ:
+            effects.reads = (1U << MREG_RDI) | (1U << MREG_RCX) | (1U << MREG_RAX);
+            effects.writes = (1U << MREG_RDI) | (1U << MREG_RCX);
+            break;
+
+        case MINS_REP_MOVSQ:
+            effects.reads = (1U << MREG_RDI) | (1U << MREG_RSI) | (1U << MREG_RCX);
+            effects.writes = effects.reads;
+            break;
+
+        case MINS_MOVQX:
+        case MINS_VMOVQX:
+            effects.reads = get_source_regs(ins->get_operand(0));
+            break;
+
+        case MINS_PREFETCHT0:
+            effects.reads = get_address_regs(ins->get_operand(0));
+            break;
+
+        case MINS_MOVDQU:
+        case MINS_MOVDQA:
+        case MINS_PUNPCKLQDQ:
+        case MINS_PADDQ:
+        case MINS_PSUBQ:
+        case MINS_VMOVDQU:
+        case MINS_VPBROADCASTQ:
+        case MINS_VPADDQ:
+        case MINS_VPSUBQ:
+            // (the SSE registers aren't tracked)
+            effects.reads = get_address_regs(ins->get_operand(0)) | get_address_regs(ins->get_operand(1));
+            break;
+
         default:
-            assert(false);
-            s = "<invalid>";
+            break;
     }
-    return std::string(s);
+    return effects;
 }
 
-std::string PrintX86_64InstructionSequence::get_mreg_name(int regnum) {
+const char *PrintX86_64InstructionSequence::get_opcode_name(int opcode) {
+    return X86_64::get_opcode_info(opcode).name;
+}
+
+const char *PrintX86_64InstructionSequence::get_mreg_name(int regnum) {
     const char *s;
     switch (regnum) {
         case MREG_RAX: s = "%rax"; break;
@@ -51,11 +277,103 @@ std::string PrintX86_64InstructionSequence::get_mreg_name(int regnum) {
         case MREG_R13: s = "%r13"; break;
         case MREG_R14: s = "%r14"; break;
         case MREG_R15: s = "%r15"; break;
+        case MREG_XMM0:  s = "%xmm0"; break;
+        case MREG_XMM1:  s = "%xmm1"; break;
+        case MREG_XMM2:  s = "%xmm2"; break;
+        case MREG_XMM3:  s = "%xmm3"; break;
+        case MREG_XMM4:  s = "%xmm4"; break;
+        case MREG_XMM5:  s = "%xmm5"; break;
+        case MREG_XMM6:  s = "%xmm6"; break;
+        case MREG_XMM7:  s = "%xmm7"; break;
+        case MREG_XMM8:  s = "%xmm8"; break;
+        case MREG_XMM9:  s = "%xmm9"; break;
+        case MREG_XMM10: s = "%xmm10"; break;
+        case MREG_XMM11: s = "%xmm11"; break;
+        case MREG_XMM12: s = "%xmm12"; break;
+        case MREG_XMM13: s = "%xmm13"; break;
+        case MREG_XMM14: s = "%xmm14"; break;
+        case MREG_XMM15: s = "%xmm15"; break;
         default:
             assert(false);
             s = "<invalid>";
     }
-    return std::string(s);
+    return s;
+}
+
+const char *PrintX86_64InstructionSequence::get_operand_mreg_name(const Instruction *ins, unsigned i, int regnum) {
+    if (ins->get_opcode() == MINS_MOVL || ins->get_opcode() == MINS_XORL) {
+        // (the names of the low 32 bits of the registers)
+        switch (regnum) {
+            case MREG_RAX: return "%eax";
+            case MREG_RBX: return "%ebx";
+            case MREG_RCX: return "%ecx";
+            case MREG_RDX: return "%edx";
+            case MREG_RDI: return "%edi";
+            case MREG_RSI: return "%esi";
+            case MREG_RSP: return "%esp";
+            case MREG_RBP: return "%ebp";
+            case MREG_R8:  return "%r8d";
+            case MREG_R9:  return "%r9d";
+            case MREG_R10: return "%r10d";
+            case MREG_R11: return "%r11d";
+            case MREG_R12: return "%r12d";
+            case MREG_R13: return "%r13d";
+            case MREG_R14: return "%r14d";
+            case MREG_R15: return "%r15d";
+            default:
+                assert(false);
+                return "<invalid>";
+        }
+    }
+    if (ins->get_opcode() != MINS_MOVB) {
+        return get_mreg_name(regnum);
+    }
+    // (the names of the low bytes of the registers)
+    switch (regnum) {
+        case MREG_RAX: return "%al";
+        case MREG_RBX: return "%bl";
+        case MREG_RCX: return "%cl";
+        case MREG_RDX: return "%dl";
+        case MREG_RDI: return "%dil";
+        case MREG_RSI: return "%sil";
+        case MREG_RSP: return "%spl";
+        case MREG_RBP: return "%bpl";
+        case MREG_R8:  return "%r8b";
+        case MREG_R9:  return "%r9b";
+        case MREG_R10: return "%r10b";
+        case MREG_R11: return "%r11b";
+        case MREG_R12: return "%r12b";
+        case MREG_R13: return "%r13b";
+        case MREG_R14: return "%r14b";
+        case MREG_R15: return "%r15b";
+        default:
+            assert(false);
+            return "<invalid>";
+    }
+}
+
+void PrintX86_64InstructionSequence::format_instruction(OutputSink &out, const Instruction *ins) {
+    switch (ins->get_opcode()) {
+        case MINS_JMP_INDIRECT:
+            out.put("jmp *");
+            out.put(get_mreg_name(ins->get_operand(0).get_base_reg()));
+            return;
+        case MINS_JUMP_TABLE_ENTRY:
+            // (the offset of the target from the start of the table)
+            out.put(".long ");
+            out.put(ins->get_operand(0).get_target_label());
+            out.put('-');
+            out.put(ins->get_operand(1).get_target_label());
+            return;
+        case MINS_P2ALIGN:
+            out.put(".p2align ");
+            out.put_int(ins->get_operand(0).get_int_value());
+            out.put(",,");
+            out.put_int(ins->get_operand(1).get_int_value());
+            return;
+        default:
+            PrintInstructionSequence::format_instruction(out, ins);
+    }
 }
 
 X86_64ControlFlowGraphBuilder::X86_64ControlFlowGraphBuilder(InstructionSequence *iseq)
@@ -69,7 +387,7 @@ X86_64ControlFlowGraphBuilder::~X86_64ControlFlowGraphBuilder() {
 // have a single label as an Operand, but for our purposes, should not be considered
 // as a branch.
 bool X86_64ControlFlowGraphBuilder::is_branch(Instruction *ins) {
-    if (ins->get_opcode() == MINS_CALL) {
+    if (X86_64::has_flags(ins->get_opcode(), MOP_CALL)) {
         return false;
     }
     return ControlFlowGraphBuilder::is_branch(ins);
@@ -77,7 +395,7 @@ bool X86_64ControlFlowGraphBuilder::is_branch(Instruction *ins) {
 
 bool X86_64ControlFlowGraphBuilder::falls_through(Instruction *ins) {
     // only the jmp instruction does not fall through
-    return ins->get_opcode() != MINS_JMP;
+    return !X86_64::has_flags(ins->get_opcode(), MOP_JUMP);
 }
 
 X86_64ControlFlowGraphPrinter::X86_64ControlFlowGraphPrinter(ControlFlowGraph *cfg)
@@ -87,7 +405,7 @@ X86_64ControlFlowGraphPrinter::X86_64ControlFlowGraphPrinter(ControlFlowGraph *c
 X86_64ControlFlowGraphPrinter::~X86_64ControlFlowGraphPrinter() {
 }
 
-void X86_64ControlFlowGraphPrinter::print_basic_block(BasicBlock *bb) {
+void X86_64ControlFlowGraphPrinter::print_basic_block(OutputSink &out, BasicBlock *bb) {
     PrintX86_64InstructionSequence print_iseq(bb);
-    print_iseq.print();
+    print_iseq.print(out);
 }
\ No newline at end of file
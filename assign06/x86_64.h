@@ -1,6 +1,7 @@
 #ifndef X86_64_H
 #define X86_64_H
 
+#include <cassert>
 #include "cfg.h"
 
 enum X86_64Reg {
@@ -20,34 +21,146 @@ enum X86_64Reg {
     MREG_R13,
     MREG_R14,
     MREG_R15,
+    // SSE registers (only used by vectorized loops)
+    MREG_XMM0,
+    MREG_XMM1,
+    MREG_XMM2,
+    MREG_XMM3,
+    MREG_XMM4,
+    MREG_XMM5,
+    MREG_XMM6,
+    MREG_XMM7,
+    MREG_XMM8,
+    MREG_XMM9,
+    MREG_XMM10,
+    MREG_XMM11,
+    MREG_XMM12,
+    MREG_XMM13,
+    MREG_XMM14,
+    MREG_XMM15,
 };
 
 enum X86_64Instruction {
     MINS_NOP,
     MINS_MOVQ,
+    MINS_MOVZBQ,     // load a byte, zero-extended
+    MINS_MOVB,       // store the low byte of a register (or an immediate)
+    MINS_MOVSLQ,     // load a 32-bit integer, sign-extended
+    MINS_MOVL,       // move an unsigned 32-bit immediate to a register (zero-extended)
     MINS_ADDQ,
     MINS_SUBQ,
     MINS_LEAQ,
     MINS_JMP,
+    MINS_JMP_INDIRECT,  // jmp *%reg
     MINS_JE,
     MINS_JNE,
     MINS_JL,
     MINS_JLE,
     MINS_JG,
     MINS_JGE,
+    MINS_JA,         // (unsigned, only used to bounds check a jump table's index)
     MINS_CMPQ,
+    MINS_CMOVE,      // (conditional moves, from a register or memory to a register)
+    MINS_CMOVNE,
+    MINS_CMOVL,
+    MINS_CMOVLE,
+    MINS_CMOVG,
+    MINS_CMOVGE,
     MINS_CALL,
     MINS_IMULQ,
+    MINS_MULQ,       // (unsigned, %rdx:%rax = %rax * op)
     MINS_IDIVQ,
+    MINS_DIVQ,       // (unsigned, dividing %rdx:%rax)
     MINS_CQTO,
+    MINS_XORQ,
+    MINS_XORL,       // (only used to zero a register, as xorl %eX, %eX)
+    MINS_ANDQ,
+    MINS_SARQ,
+    MINS_SHRQ,
+    MINS_SHLQ,
+    MINS_INCQ,
+    MINS_DECQ,
+    MINS_PUSHQ,
+    MINS_POPQ,
+    MINS_RET,
+    MINS_UD2,        // (the trap for a failed array bounds check)
+    MINS_COLD,       // (the epilogue goes here, and the cold code follows, see HINS_COLD)
+    MINS_REP_STOSQ,  // store %rax to the %rcx quadwords at %rdi
+    MINS_REP_MOVSQ,  // copy the %rcx quadwords at %rsi to %rdi
+    MINS_JUMP_TABLE_ENTRY,  // .long target - table (see JumpTableFormation)
+    MINS_P2ALIGN,    // .p2align log2,,max: pad to a 1 << log2 boundary with nops, if that takes at most max bytes
+    MINS_PREFETCHT0, // prefetch the cache line at the address into all levels of the cache
+    // SSE2 instructions (operating on pairs of 64-bit integers)
+    MINS_MOVDQU,     // unaligned load or store
+    MINS_MOVDQA,     // (only used between registers)
+    MINS_MOVQX,      // movq from a general purpose register to an SSE register
+    MINS_PUNPCKLQDQ,
+    MINS_PADDQ,
+    MINS_PSUBQ,
+    // AVX instructions (used instead of the SSE2 ones with -march=x86-64-v3,
+    // see X86_64Cpu), whose destination is the last of three operands
+    MINS_VMOVDQU,
+    MINS_VMOVQX,
+    MINS_VPBROADCASTQ,  // (AVX2) both elements of the destination are the low element of the source
+    MINS_VPADDQ,     // vpaddq B, A, D: D = A + B
+    MINS_VPSUBQ,     // vpsubq B, A, D: D = A - B
+};
+
+// properties of the x86-64 opcodes (see X86_64OpcodeInfo)
+enum X86_64OpcodeFlags {
+    MOP_JUMP   = 1 << 0,    // an unconditional branch
+    MOP_BRANCH = 1 << 1,    // a conditional branch
+    MOP_CALL   = 1 << 2,    // a call (which has a label operand, but isn't a branch)
+    MOP_SSE    = 1 << 3,    // an SSE2 (or AVX) instruction
+};
+
+struct X86_64OpcodeInfo {
+    const char *name;
+    unsigned flags;     // X86_64OpcodeFlags
+};
+
+// the registers an instruction reads and writes, as masks with the bit
+// 1 << reg for each X86_64Reg (other than the SSE registers, which aren't
+// tracked), and 1 << X86_64::FLAGS for the condition codes
+struct X86_64Effects {
+    unsigned reads;
+    unsigned writes;
+};
+
+class X86_64 {
+public:
+    // the bit of the condition codes in an X86_64Effects mask
+    static const int FLAGS = 16;
+
+    // the properties of each opcode (indexed by opcode)
+    static const X86_64OpcodeInfo s_opcode_info[];
+
+    static const X86_64OpcodeInfo &get_opcode_info(int opcode) {
+        assert(opcode >= MINS_NOP && opcode <= MINS_VPSUBQ);
+        return s_opcode_info[opcode];
+    }
+    static bool has_flags(int opcode, unsigned flags) {
+        return (get_opcode_info(opcode).flags & flags) != 0;
+    }
+
+    // the mask of the registers used to compute the address of a memory
+    // reference, and of the registers read by an operand whose value is used
+    static unsigned get_address_regs(const Operand &operand);
+    static unsigned get_source_regs(const Operand &operand);
+
+    static X86_64Effects get_effects(const Instruction *ins);
 };
 
 class PrintX86_64InstructionSequence : public PrintInstructionSequence {
 public:
     PrintX86_64InstructionSequence(InstructionSequence *iseq);
 
-    virtual std::string get_opcode_name(int opcode);
-    virtual std::string get_mreg_name(int regnum);
+    virtual const char *get_opcode_name(int opcode);
+    virtual const char *get_mreg_name(int regnum);
+    virtual const char *get_operand_mreg_name(const Instruction *ins, unsigned i, int regnum);
+
+    using PrintInstructionSequence::format_instruction;
+    virtual void format_instruction(OutputSink &out, const Instruction *ins);
 };
 
 class X86_64ControlFlowGraphBuilder : public ControlFlowGraphBuilder {
@@ -64,7 +177,7 @@ public:
     X86_64ControlFlowGraphPrinter(ControlFlowGraph *cfg);
     ~X86_64ControlFlowGraphPrinter();
 
-    virtual void print_basic_block(BasicBlock *bb);
+    virtual void print_basic_block(OutputSink &out, BasicBlock *bb);
 };
 
 #endif // X86_64_H
\ No newline at end of file
@@ -0,0 +1,672 @@
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <elf.h>
+#include "util.h"
+#include "cfg.h"
+#include "x86_64.h"
+#include "x86_64_encoder.h"
+
+namespace {
+    // hardware register numbers, indexed by X86_64Reg
+    const unsigned HW_REG[] = {
+        0,  // %rax
+        3,  // %rbx
+        1,  // %rcx
+        2,  // %rdx
+        7,  // %rdi
+        6,  // %rsi
+        4,  // %rsp
+        5,  // %rbp
+        8, 9, 10, 11, 12, 13, 14, 15,
+        // %xmm0-%xmm15
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    };
+
+    unsigned hw_reg(int mreg) {
+        assert(mreg >= MREG_RAX && mreg <= MREG_XMM15);
+        return HW_REG[mreg];
+    }
+
+    bool is_mreg(const Operand &operand) {
+        return operand.get_kind() == OPERAND_MREG;
+    }
+
+    bool is_imm(const Operand &operand) {
+        return operand.get_kind() == OPERAND_INT_LITERAL;
+    }
+
+    bool is_imm8(const Operand &operand) {
+        return is_imm(operand) && operand.get_int_value() >= -128 && operand.get_int_value() <= 127;
+    }
+
+    bool is_imm32(const Operand &operand) {
+        return is_imm(operand) && operand.get_int_value() >= INT_MIN && operand.get_int_value() <= INT_MAX;
+    }
+
+    // the condition code of a conditional jump or move (the low nibble of its opcode)
+    unsigned char get_condition_code(int opcode) {
+        switch (opcode) {
+            case MINS_JE:  case MINS_CMOVE:  return 0x4;
+            case MINS_JNE: case MINS_CMOVNE: return 0x5;
+            case MINS_JL:  case MINS_CMOVL:  return 0xC;
+            case MINS_JGE: case MINS_CMOVGE: return 0xD;
+            case MINS_JLE: case MINS_CMOVLE: return 0xE;
+            case MINS_JG:  case MINS_CMOVG:  return 0xF;
+            case MINS_JA:                    return 0x7;
+            default:
+                assert(false);
+                return 0;
+        }
+    }
+}
+
+X86_64Encoder::X86_64Encoder() {
+}
+
+X86_64Encoder::~X86_64Encoder() {
+}
+
+void X86_64Encoder::define_label(const std::string &label) {
+    assert(m_labels.count(label) == 0);
+    m_labels[label] = m_code.size();
+}
+
+void X86_64Encoder::encode(const InstructionSequence *iseq) {
+    encode(iseq, 0, iseq->get_length());
+}
+
+void X86_64Encoder::encode(const InstructionSequence *iseq, unsigned begin, unsigned end) {
+    for (unsigned i = begin; i < end; i++) {
+        if (iseq->has_label(i)) {
+            define_label(iseq->get_label(i));
+        }
+        encode(iseq->get_instruction(i));
+    }
+    if (end == iseq->get_length() && iseq->has_label_at_end()) {
+        define_label(iseq->get_label_at_end());
+    }
+}
+
+void X86_64Encoder::encode(const Instruction *ins) {
+    unsigned num_operands = ins->get_num_operands();
+    unsigned num_relocations = m_relocations.size();
+    switch (ins->get_opcode()) {
+        case MINS_NOP:
+            emit_byte(0x90);
+            break;
+
+        case MINS_MOVQ: {
+            Operand src = ins->get_operand(0), dst = ins->get_operand(1);
+            if (is_mreg(src)) {
+                emit_modrm({ 0x89 }, hw_reg(src.get_base_reg()), dst);
+            } else if (src.is_memref() && is_mreg(dst)) {
+                emit_modrm({ 0x8B }, hw_reg(dst.get_base_reg()), src);
+            } else if (is_imm(src) && is_mreg(dst) && !is_imm32(src)) {
+                // movabsq $imm64, %reg
+                unsigned reg = hw_reg(dst.get_base_reg());
+                emit_byte(0x48 | (reg >> 3));
+                emit_byte(0xB8 + (reg & 7));
+                emit_imm64(src.get_int_value());
+            } else if (is_imm32(src)) {
+                emit_modrm({ 0xC7 }, 0, dst);
+                emit_imm32(src.get_int_value());
+            } else if (src.get_kind() == OPERAND_LABEL_IMMEDIATE) {
+                // the (sign-extended) 32-bit address of a symbol
+                emit_modrm({ 0xC7 }, 0, dst);
+                emit_symbol_ref(src.get_target_label(), R_X86_64_32S, 0);
+            } else {
+                cant_encode(ins);
+            }
+            break;
+        }
+
+        case MINS_MOVZBQ:
+            if (!is_mreg(ins->get_operand(1))) {
+                cant_encode(ins);
+            }
+            emit_modrm({ 0x0F, 0xB6 }, hw_reg(ins->get_operand(1).get_base_reg()), ins->get_operand(0));
+            break;
+
+        case MINS_MOVSLQ:
+            if (!is_mreg(ins->get_operand(1))) {
+                cant_encode(ins);
+            }
+            emit_modrm({ 0x63 }, hw_reg(ins->get_operand(1).get_base_reg()), ins->get_operand(0));
+            break;
+
+        case MINS_MOVL: {
+            // movl $imm32, %reg (B8+r, with a REX prefix only for %r8-%r15)
+            Operand src = ins->get_operand(0), dst = ins->get_operand(1);
+            if (!is_imm(src) || !is_mreg(dst) || src.get_int_value() < 0 || src.get_int_value() > long(UINT_MAX)) {
+                cant_encode(ins);
+            }
+            unsigned reg = hw_reg(dst.get_base_reg());
+            if (reg >= 8) {
+                emit_byte(0x41);
+            }
+            emit_byte(0xB8 + (reg & 7));
+            emit_imm32(src.get_int_value());
+            break;
+        }
+
+        case MINS_MOVB: {
+            Operand src = ins->get_operand(0), dst = ins->get_operand(1);
+            if (is_mreg(src)) {
+                // (without a REX prefix, %spl, %bpl, %sil and %dil would be %ah, %ch, %dh and %bh)
+                unsigned reg = hw_reg(src.get_base_reg());
+                if (reg >= 4 && reg < 8) {
+                    cant_encode(ins);
+                }
+                emit_modrm({ 0x88 }, reg, dst, false);
+            } else if (is_imm(src)) {
+                emit_modrm({ 0xC6 }, 0, dst, false);
+                emit_byte((unsigned char) src.get_int_value());
+            } else {
+                cant_encode(ins);
+            }
+            break;
+        }
+
+        case MINS_ADDQ:
+            encode_alu(ins, 0x01, 0x03, 0);
+            break;
+        case MINS_SUBQ:
+            encode_alu(ins, 0x29, 0x2B, 5);
+            break;
+        case MINS_XORQ:
+            encode_alu(ins, 0x31, 0x33, 6);
+            break;
+        case MINS_XORL:
+            if (!is_mreg(ins->get_operand(0)) || !is_mreg(ins->get_operand(1))) {
+                cant_encode(ins);
+            }
+            emit_modrm({ 0x31 }, hw_reg(ins->get_operand(0).get_base_reg()), ins->get_operand(1), false);
+            break;
+        case MINS_ANDQ:
+            encode_alu(ins, 0x21, 0x23, 4);
+            break;
+        case MINS_CMPQ:
+            encode_alu(ins, 0x39, 0x3B, 7);
+            break;
+
+        case MINS_CMOVE:
+        case MINS_CMOVNE:
+        case MINS_CMOVL:
+        case MINS_CMOVLE:
+        case MINS_CMOVG:
+        case MINS_CMOVGE:
+            if (!is_mreg(ins->get_operand(1)) || is_imm(ins->get_operand(0))) {
+                cant_encode(ins);
+            }
+            emit_modrm({ 0x0F, (unsigned char) (0x40 | get_condition_code(ins->get_opcode())) },
+                       hw_reg(ins->get_operand(1).get_base_reg()), ins->get_operand(0));
+            break;
+
+        case MINS_LEAQ:
+            if (!ins->get_operand(0).is_memref() || !is_mreg(ins->get_operand(1))) {
+                cant_encode(ins);
+            }
+            emit_modrm({ 0x8D }, hw_reg(ins->get_operand(1).get_base_reg()), ins->get_operand(0));
+            break;
+
+        case MINS_IMULQ: {
+            if (num_operands == 1) {
+                // %rdx:%rax = %rax * op
+                emit_modrm({ 0xF7 }, 5, ins->get_operand(0));
+                break;
+            }
+            // imulq $imm, src, dst (with src = dst, if there are two operands)
+            Operand src = ins->get_operand(num_operands - 2), dst = ins->get_operand(num_operands - 1);
+            Operand imm = ins->get_operand(0);
+            if (!is_mreg(dst)) {
+                cant_encode(ins);
+            }
+            unsigned reg = hw_reg(dst.get_base_reg());
+            if (num_operands == 3 || is_imm(src)) {
+                Operand rm = (num_operands == 3) ? src : dst;
+                if (is_imm8(imm)) {
+                    emit_modrm({ 0x6B }, reg, rm);
+                    emit_byte((unsigned char) imm.get_int_value());
+                } else if (is_imm32(imm)) {
+                    emit_modrm({ 0x69 }, reg, rm);
+                    emit_imm32(imm.get_int_value());
+                } else {
+                    cant_encode(ins);
+                }
+            } else {
+                emit_modrm({ 0x0F, 0xAF }, reg, src);
+            }
+            break;
+        }
+
+        case MINS_MULQ:
+            emit_modrm({ 0xF7 }, 4, ins->get_operand(0));
+            break;
+        case MINS_IDIVQ:
+            emit_modrm({ 0xF7 }, 7, ins->get_operand(0));
+            break;
+        case MINS_DIVQ:
+            emit_modrm({ 0xF7 }, 6, ins->get_operand(0));
+            break;
+
+        case MINS_CQTO:
+            emit_byte(0x48);
+            emit_byte(0x99);
+            break;
+
+        case MINS_SARQ:
+            encode_shift(ins, 7);
+            break;
+        case MINS_SHRQ:
+            encode_shift(ins, 5);
+            break;
+        case MINS_SHLQ:
+            encode_shift(ins, 4);
+            break;
+
+        case MINS_INCQ:
+            emit_modrm({ 0xFF }, 0, ins->get_operand(0));
+            break;
+        case MINS_DECQ:
+            emit_modrm({ 0xFF }, 1, ins->get_operand(0));
+            break;
+
+        case MINS_PUSHQ:
+        case MINS_POPQ: {
+            unsigned reg = hw_reg(ins->get_operand(0).get_base_reg());
+            if (reg >= 8) {
+                emit_byte(0x41);
+            }
+            emit_byte(((ins->get_opcode() == MINS_PUSHQ) ? 0x50 : 0x58) + (reg & 7));
+            break;
+        }
+
+        case MINS_RET:
+            emit_byte(0xC3);
+            break;
+        case MINS_UD2:
+            emit_byte(0x0F);
+            emit_byte(0x0B);
+            break;
+
+        case MINS_REP_STOSQ:
+        case MINS_REP_MOVSQ:
+            emit_byte(0xF3);
+            emit_byte(0x48);
+            emit_byte((ins->get_opcode() == MINS_REP_STOSQ) ? 0xAB : 0xA5);
+            break;
+
+        case MINS_JMP:
+            encode_branch(ins, { 0xE9 });
+            break;
+        case MINS_JMP_INDIRECT:
+            if (!is_mreg(ins->get_operand(0))) {
+                cant_encode(ins);
+            }
+            emit_modrm({ 0xFF }, 4, ins->get_operand(0), false);
+            break;
+        case MINS_JE:
+        case MINS_JNE:
+        case MINS_JL:
+        case MINS_JLE:
+        case MINS_JG:
+        case MINS_JGE:
+        case MINS_JA:
+            encode_branch(ins, { 0x0F, (unsigned char) (0x80 | get_condition_code(ins->get_opcode())) });
+            break;
+
+        case MINS_CALL:
+            // (resolved by finish if the callee is defined in the code)
+            emit_byte(0xE8);
+            m_fixups.push_back({ m_code.size(), ins->get_operand(0).get_target_label(), true, "" });
+            emit_imm32(0);
+            break;
+
+        case MINS_JUMP_TABLE_ENTRY:
+            m_fixups.push_back({ m_code.size(), ins->get_operand(0).get_target_label(), false,
+                                 ins->get_operand(1).get_target_label() });
+            emit_imm32(0);
+            break;
+
+        case MINS_P2ALIGN: {
+            // (the code starts at a 16-byte boundary, see ElfObjectWriter)
+            unsigned long alignment = 1UL << ins->get_operand(0).get_int_value();
+            if (alignment > 16) {
+                cant_encode(ins);
+            }
+            unsigned long padding = (alignment - m_code.size() % alignment) % alignment;
+            if (padding <= (unsigned long) ins->get_operand(1).get_int_value()) {
+                emit_nops(padding);
+            }
+            break;
+        }
+
+        case MINS_PREFETCHT0:
+            if (!ins->get_operand(0).is_memref()) {
+                cant_encode(ins);
+            }
+            emit_modrm({ 0x0F, 0x18 }, 1, ins->get_operand(0), false);
+            break;
+
+        case MINS_MOVDQU: {
+            Operand src = ins->get_operand(0), dst = ins->get_operand(1);
+            if (is_mreg(dst) && src.is_memref()) {
+                emit_modrm({ 0x0F, 0x6F }, hw_reg(dst.get_base_reg()), src, false, 0xF3);
+            } else if (is_mreg(src) && dst.is_memref()) {
+                emit_modrm({ 0x0F, 0x7F }, hw_reg(src.get_base_reg()), dst, false, 0xF3);
+            } else {
+                cant_encode(ins);
+            }
+            break;
+        }
+
+        case MINS_MOVQX:
+            if (!is_mreg(ins->get_operand(1))) {
+                cant_encode(ins);
+            }
+            emit_modrm({ 0x0F, 0x6E }, hw_reg(ins->get_operand(1).get_base_reg()), ins->get_operand(0), true, 0x66);
+            break;
+
+        case MINS_MOVDQA:
+            encode_sse(ins, 0x6F);
+            break;
+        case MINS_PUNPCKLQDQ:
+            encode_sse(ins, 0x6C);
+            break;
+        case MINS_PADDQ:
+            encode_sse(ins, 0xD4);
+            break;
+        case MINS_PSUBQ:
+            encode_sse(ins, 0xFB);
+            break;
+
+        case MINS_VMOVDQU: {
+            Operand src = ins->get_operand(0), dst = ins->get_operand(1);
+            if (is_mreg(dst) && src.is_memref()) {
+                emit_vex(0x6F, false, 0xF3, false, hw_reg(dst.get_base_reg()), 0, src);
+            } else if (is_mreg(src) && dst.is_memref()) {
+                emit_vex(0x7F, false, 0xF3, false, hw_reg(src.get_base_reg()), 0, dst);
+            } else {
+                cant_encode(ins);
+            }
+            break;
+        }
+
+        case MINS_VMOVQX:
+            if (!is_mreg(ins->get_operand(1))) {
+                cant_encode(ins);
+            }
+            emit_vex(0x6E, false, 0x66, true, hw_reg(ins->get_operand(1).get_base_reg()), 0, ins->get_operand(0));
+            break;
+
+        case MINS_VPBROADCASTQ:
+            if (!is_mreg(ins->get_operand(1))) {
+                cant_encode(ins);
+            }
+            emit_vex(0x59, true, 0x66, false, hw_reg(ins->get_operand(1).get_base_reg()), 0, ins->get_operand(0));
+            break;
+
+        case MINS_VPADDQ:
+            encode_avx(ins, 0xD4);
+            break;
+        case MINS_VPSUBQ:
+            encode_avx(ins, 0xFB);
+            break;
+
+        default:
+            cant_encode(ins);
+    }
+
+    // a %rip-relative displacement is relative to the end of the instruction
+    for (unsigned i = num_relocations; i < m_relocations.size(); i++) {
+        Relocation &reloc = m_relocations[i];
+        if (reloc.type == R_X86_64_PC32) {
+            reloc.addend = long(reloc.offset) - long(m_code.size());
+        }
+    }
+}
+
+void X86_64Encoder::finish() {
+    for (auto i = m_fixups.begin(); i != m_fixups.end(); i++) {
+        auto j = m_labels.find(i->label);
+        if (j == m_labels.end() && i->is_call) {
+            m_relocations.push_back({ i->offset, i->label, R_X86_64_PLT32, -4 });
+            continue;
+        }
+        if (j == m_labels.end()) {
+            err_fatal("Branch to undefined label '%s'\n", i->label.c_str());
+        }
+        // the displacement is relative to the end of the branch (or a
+        // jump table entry to the start of the table)
+        long disp = long(j->second) - long(i->offset + 4);
+        if (!i->base.empty()) {
+            assert(m_labels.count(i->base) != 0);
+            disp = long(j->second) - long(m_labels[i->base]);
+        }
+        patch_imm32(i->offset, disp);
+    }
+    m_fixups.clear();
+
+    // a %rip-relative reference to a label in the code (such as the
+    // address of a jump table) needs no relocation
+    std::vector<Relocation> relocations;
+    for (auto i = m_relocations.begin(); i != m_relocations.end(); i++) {
+        auto j = m_labels.find(i->symbol);
+        if (i->type == R_X86_64_PC32 && j != m_labels.end()) {
+            patch_imm32(i->offset, long(j->second) + i->addend - long(i->offset));
+        } else {
+            relocations.push_back(*i);
+        }
+    }
+    m_relocations = relocations;
+}
+
+void X86_64Encoder::encode_alu(const Instruction *ins, unsigned char op_mr, unsigned char op_rm, unsigned ext) {
+    Operand src = ins->get_operand(0), dst = ins->get_operand(1);
+    if (is_mreg(src)) {
+        emit_modrm({ op_mr }, hw_reg(src.get_base_reg()), dst);
+    } else if (src.is_memref() && is_mreg(dst)) {
+        emit_modrm({ op_rm }, hw_reg(dst.get_base_reg()), src);
+    } else if (is_imm8(src)) {
+        emit_modrm({ 0x83 }, ext, dst);
+        emit_byte((unsigned char) src.get_int_value());
+    } else if (is_imm32(src)) {
+        emit_modrm({ 0x81 }, ext, dst);
+        emit_imm32(src.get_int_value());
+    } else {
+        cant_encode(ins);
+    }
+}
+
+void X86_64Encoder::encode_shift(const Instruction *ins, unsigned ext) {
+    Operand count = ins->get_operand(0);
+    if (!is_imm(count) || count.get_int_value() < 0 || count.get_int_value() > 63) {
+        cant_encode(ins);
+    }
+    if (count.get_int_value() == 1) {
+        emit_modrm({ 0xD1 }, ext, ins->get_operand(1));
+    } else {
+        emit_modrm({ 0xC1 }, ext, ins->get_operand(1));
+        emit_byte((unsigned char) count.get_int_value());
+    }
+}
+
+void X86_64Encoder::encode_sse(const Instruction *ins, unsigned char op) {
+    // (the destination, always a register, is in the reg field)
+    Operand src = ins->get_operand(0), dst = ins->get_operand(1);
+    if (!is_mreg(dst)) {
+        cant_encode(ins);
+    }
+    emit_modrm({ 0x0F, op }, hw_reg(dst.get_base_reg()), src, false, 0x66);
+}
+
+void X86_64Encoder::encode_avx(const Instruction *ins, unsigned char op) {
+    // vpaddq B, A, D has D in the reg field, A in vvvv and B in rm
+    Operand b = ins->get_operand(0), a = ins->get_operand(1), d = ins->get_operand(2);
+    if (!is_mreg(a) || !is_mreg(d)) {
+        cant_encode(ins);
+    }
+    emit_vex(op, false, 0x66, false, hw_reg(d.get_base_reg()), hw_reg(a.get_base_reg()), b);
+}
+
+void X86_64Encoder::encode_branch(const Instruction *ins, const std::vector<unsigned char> &opcode) {
+    for (auto i = opcode.begin(); i != opcode.end(); i++) {
+        emit_byte(*i);
+    }
+    m_fixups.push_back({ m_code.size(), ins->get_operand(0).get_target_label(), false, "" });
+    emit_imm32(0);
+}
+
+void X86_64Encoder::emit_modrm(const std::vector<unsigned char> &opcode, unsigned reg, const Operand &rm,
+                               bool rex_w, unsigned char prefix) {
+    unsigned rex = rex_w ? 0x08 : 0;
+    std::vector<unsigned char> suffix;
+    std::string rip_label;
+    get_modrm(reg, rm, rex, suffix, rip_label);
+
+    if (prefix != 0) {
+        emit_byte(prefix);
+    }
+    if (rex != 0) {
+        emit_byte((unsigned char) (0x40 | rex));
+    }
+    for (auto i = opcode.begin(); i != opcode.end(); i++) {
+        emit_byte(*i);
+    }
+    emit_modrm_suffix(suffix, rip_label);
+}
+
+void X86_64Encoder::emit_vex(unsigned char op, bool map_0f38, unsigned char prefix, bool w, unsigned reg,
+                             unsigned vvvv, const Operand &rm) {
+    unsigned rex = 0;
+    std::vector<unsigned char> suffix;
+    std::string rip_label;
+    get_modrm(reg, rm, rex, suffix, rip_label);
+
+    // (the R, X, B and vvvv fields are inverted, and L is 0 for 128 bits)
+    unsigned pp = (prefix == 0x66) ? 1 : (prefix == 0xF3) ? 2 : 0;
+    unsigned char last = (unsigned char) (((~vvvv & 15) << 3) | pp);
+    if ((rex & 0x03) == 0 && !w && !map_0f38) {
+        // the two-byte form only has the R bit, for the 0F map
+        emit_byte(0xC5);
+        emit_byte((unsigned char) (((rex & 0x04) != 0 ? 0 : 0x80) | last));
+    } else {
+        emit_byte(0xC4);
+        emit_byte((unsigned char) ((~(rex << 5) & 0xE0) | (map_0f38 ? 2 : 1)));
+        emit_byte((unsigned char) ((w ? 0x80 : 0) | last));
+    }
+    emit_byte(op);
+    emit_modrm_suffix(suffix, rip_label);
+}
+
+void X86_64Encoder::get_modrm(unsigned reg, const Operand &rm, unsigned &rex, std::vector<unsigned char> &suffix,
+                              std::string &rip_label) {
+    rex |= (reg >> 3) << 2;
+    if (is_mreg(rm)) {
+        unsigned r = hw_reg(rm.get_base_reg());
+        rex |= r >> 3;
+        suffix.push_back((unsigned char) (0xC0 | ((reg & 7) << 3) | (r & 7)));
+    } else if (rm.get_kind() == OPERAND_LABEL_MEMREF) {
+        // disp32(%rip): the displacement is filled in by the linker
+        suffix.push_back((unsigned char) (((reg & 7) << 3) | 5));
+        rip_label = rm.get_target_label();
+    } else {
+        if (!rm.is_memref() || !rm.has_base_reg()) {
+            err_fatal("Invalid memory operand in encoded instruction\n");
+        }
+        unsigned base = hw_reg(rm.get_base_reg());
+        long disp = ((rm.get_kind() & OPROP_HAS_INTVAL) != 0) ? rm.get_offset() : 0;
+        bool has_index = rm.has_index_reg();
+        // a SIB byte is needed for an index register, or a base of %rsp/%r12
+        bool has_sib = has_index || (base & 7) == 4;
+        unsigned mod;
+        if (disp == 0 && (base & 7) != 5) {
+            // (a base of %rbp/%r13 always needs a displacement)
+            mod = 0;
+        } else if (disp >= -128 && disp <= 127) {
+            mod = 1;
+        } else {
+            mod = 2;
+        }
+
+        rex |= base >> 3;
+        suffix.push_back((unsigned char) ((mod << 6) | ((reg & 7) << 3) | (has_sib ? 4 : (base & 7))));
+        if (has_sib) {
+            unsigned index = 4;   // no index
+            unsigned scale_bits = 0;
+            if (has_index) {
+                index = hw_reg(rm.get_index_reg());
+                assert(index != 4);
+                rex |= (index >> 3) << 1;
+                int scale = rm.get_scale();
+                scale_bits = (scale == 8) ? 3 : (scale == 4) ? 2 : (scale == 2) ? 1 : 0;
+            }
+            suffix.push_back((unsigned char) ((scale_bits << 6) | ((index & 7) << 3) | (base & 7)));
+        }
+        if (mod == 1) {
+            suffix.push_back((unsigned char) disp);
+        } else if (mod == 2) {
+            for (unsigned k = 0; k < 4; k++) {
+                suffix.push_back((unsigned char) (disp >> (8 * k)));
+            }
+        }
+    }
+}
+
+void X86_64Encoder::emit_modrm_suffix(const std::vector<unsigned char> &suffix, const std::string &rip_label) {
+    m_code.insert(m_code.end(), suffix.begin(), suffix.end());
+    if (!rip_label.empty()) {
+        // (the addend is set by encode(), when the end of the instruction is known)
+        emit_symbol_ref(rip_label, R_X86_64_PC32, 0);
+    }
+}
+
+void X86_64Encoder::emit_nops(unsigned long n) {
+    // the recommended multi-byte nops (nopw, and nopl with a ModRM, SIB
+    // and displacement), of up to 9 bytes each
+    static const unsigned char nops[9][9] = {
+        { 0x90 },
+        { 0x66, 0x90 },
+        { 0x0F, 0x1F, 0x00 },
+        { 0x0F, 0x1F, 0x40, 0x00 },
+        { 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+        { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+        { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
+        { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        { 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    };
+    while (n > 0) {
+        unsigned long len = std::min(n, 9UL);
+        m_code.insert(m_code.end(), nops[len - 1], nops[len - 1] + len);
+        n -= len;
+    }
+}
+
+void X86_64Encoder::emit_imm32(long value) {
+    for (unsigned k = 0; k < 4; k++) {
+        emit_byte((unsigned char) (value >> (8 * k)));
+    }
+}
+
+void X86_64Encoder::patch_imm32(unsigned long offset, long value) {
+    for (unsigned k = 0; k < 4; k++) {
+        m_code[offset + k] = (unsigned char) (value >> (8 * k));
+    }
+}
+
+void X86_64Encoder::emit_imm64(long value) {
+    for (unsigned k = 0; k < 8; k++) {
+        emit_byte((unsigned char) (value >> (8 * k)));
+    }
+}
+
+void X86_64Encoder::emit_symbol_ref(const std::string &symbol, unsigned type, long addend) {
+    m_relocations.push_back({ m_code.size(), symbol, type, addend });
+    emit_imm32(0);
+}
+
+void X86_64Encoder::cant_encode(const Instruction *ins) {
+    PrintX86_64InstructionSequence printer(nullptr);
+    err_fatal("Can't encode instruction '%s'\n", printer.format_instruction(ins).c_str());
+}
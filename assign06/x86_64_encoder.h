@@ -0,0 +1,124 @@
+#ifndef X86_64_ENCODER_H
+#define X86_64_ENCODER_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include "cfg.h"
+
+// Encodes x86-64 instructions (as generated by AssemblyCodeGen) into
+// machine code.
+//
+// Branches and calls to labels defined in the encoded code (such as the
+// subprograms of the program), %rip-relative references to them, and the
+// entries of jump tables are resolved by finish(); any other label (a
+// called library function, the address of a string, or a variable in
+// .bss) is left as a relocation for the linker.  Branches always use
+// 32-bit displacements.
+class X86_64Encoder {
+public:
+    // a reference to a symbol which isn't defined in the code
+    struct Relocation {
+        unsigned long offset;    // of the 32-bit field to be relocated
+        std::string symbol;
+        unsigned type;           // R_X86_64_PLT32, R_X86_64_32S, ...
+        long addend;
+    };
+
+private:
+    // a 32-bit branch (or call) displacement to a label, or a jump table
+    // entry (the label's offset from the table's label, base)
+    struct Fixup {
+        unsigned long offset;
+        std::string label;
+        // a call to a label which isn't defined is to an external function
+        bool is_call;
+        std::string base;
+    };
+
+    std::vector<unsigned char> m_code;
+    std::map<std::string, unsigned long> m_labels;
+    std::vector<Fixup> m_fixups;
+    std::vector<Relocation> m_relocations;
+
+    // disallow copy ctor and assignment operator
+    X86_64Encoder(const X86_64Encoder &);
+    X86_64Encoder &operator=(const X86_64Encoder &);
+
+public:
+    X86_64Encoder();
+    ~X86_64Encoder();
+
+    // define a label at the current end of the code
+    void define_label(const std::string &label);
+
+    void encode(const Instruction *ins);
+
+    // encode the instructions of a sequence, with their labels
+    void encode(const InstructionSequence *iseq);
+    // (the instructions at indices [begin, end), and the label at the end
+    // of the sequence if end is its length)
+    void encode(const InstructionSequence *iseq, unsigned begin, unsigned end);
+
+    // resolve the branches, calls and other references to labels
+    void finish();
+
+    const std::vector<unsigned char> &get_code() const { return m_code; }
+    const std::vector<Relocation> &get_relocations() const { return m_relocations; }
+
+private:
+    void encode_alu(const Instruction *ins, unsigned char op_mr, unsigned char op_rm, unsigned ext);
+    void encode_shift(const Instruction *ins, unsigned ext);
+    void encode_branch(const Instruction *ins, const std::vector<unsigned char> &opcode);
+    void encode_sse(const Instruction *ins, unsigned char op);
+
+    // emit an instruction with a ModRM byte: the opcode, with its REX
+    // prefix (preceded by the mandatory prefix of an SSE instruction, if
+    // any), followed by the ModRM (and SIB) byte and displacement
+    // addressing rm, with reg (a hardware register number, or an opcode
+    // extension) in the reg field
+    void emit_modrm(const std::vector<unsigned char> &opcode, unsigned reg, const Operand &rm, bool rex_w = true,
+                    unsigned char prefix = 0);
+
+    // emit an AVX instruction with a VEX prefix: the opcode (in the opcode
+    // map 0F, or 0F38 if map_0f38), with its mandatory prefix (0x66 or
+    // 0xF3, or 0) and the second source register vvvv (a hardware
+    // register number) encoded in the prefix, followed by the ModRM (and
+    // SIB) byte and displacement, as for emit_modrm
+    void emit_vex(unsigned char op, bool map_0f38, unsigned char prefix, bool w, unsigned reg, unsigned vvvv,
+                  const Operand &rm);
+    void encode_avx(const Instruction *ins, unsigned char op);
+
+    // the ModRM (and SIB) byte and displacement addressing rm, with reg
+    // in the reg field, setting the REX bits they need (R, X and B) and
+    // the label of a %rip-relative reference (or leaving it empty)
+    void get_modrm(unsigned reg, const Operand &rm, unsigned &rex, std::vector<unsigned char> &suffix,
+                   std::string &rip_label);
+    void emit_modrm_suffix(const std::vector<unsigned char> &suffix, const std::string &rip_label);
+
+    void emit_byte(unsigned char b) { m_code.push_back(b); }
+    void emit_nops(unsigned long n);
+    void emit_imm32(long value);
+    void emit_imm64(long value);
+    void patch_imm32(unsigned long offset, long value);
+    void emit_symbol_ref(const std::string &symbol, unsigned type, long addend);
+
+    static void cant_encode(const Instruction *ins);
+};
+
+// The data of a program whose code was encoded by an X86_64Encoder: its
+// read-only strings and its zero-initialized (.bss) variables, referred to
+// by the code's relocations.  (ElfObjectWriter writes them to an object
+// file, and JitProgram loads them into memory.)
+class DataSections {
+public:
+    virtual ~DataSections() { }
+
+    // add a NUL-terminated string to the read-only data
+    virtual void add_rodata_string(const std::string &label, const std::string &s) = 0;
+
+    // add a zero-initialized variable to .bss
+    virtual void add_bss_variable(const std::string &label, unsigned long size, unsigned long alignment) = 0;
+};
+
+#endif // X86_64_ENCODER_H